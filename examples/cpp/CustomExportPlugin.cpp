@@ -0,0 +1,13 @@
+#include <zcm/tools/LogExport.hpp>
+
+#include "types/example_t.hpp"
+#include "types/example2_t.hpp"
+#include "types/multidim_t.hpp"
+#include "types/recursive_t.hpp"
+
+// The types zcm-log-export exports, and all it needs of them. Build this into
+// a shared library and pass it with --plugin-path:
+//
+//   zcm-log-export -p libexample-export-plugin.so -f csv -o out/ my.log
+//
+ZCM_LOG_EXPORT_TYPES(example_t, example2_t, multidim_t, recursive_t)
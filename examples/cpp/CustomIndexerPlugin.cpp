@@ -25,10 +25,11 @@ class CustomIndexerPlugin : public zcm::IndexerPlugin
                zcm::Json::Value& pluginIndex,
                zcm::LogFile& log) override;
 
-    void indexEvent(const zcm::Json::Value& index, zcm::Json::Value& pluginIndex,
-                    std::string channel, std::string typeName,
-                    off_t offset, uint64_t timestamp, int64_t hash,
-                    const uint8_t* data, int32_t datalen) override;
+    void indexAnnotatedEvent(const zcm::Json::Value& index, zcm::Json::Value& pluginIndex,
+                             zcm::Json::Value& annotations,
+                             const std::string& channel, const std::string& typeName,
+                             off_t offset, uint64_t timestamp, int64_t hash,
+                             const uint8_t* data, int32_t datalen) override;
 
     void tearDown(const zcm::Json::Value& index,
                   zcm::Json::Value& pluginIndex,
@@ -53,11 +54,13 @@ bool CustomIndexerPlugin::setUp(const zcm::Json::Value& index,
                                 zcm::LogFile& log)
 { return true; }
 
-void CustomIndexerPlugin::indexEvent(const zcm::Json::Value& index,
-                                     zcm::Json::Value& pluginIndex,
-                                     std::string channel, std::string typeName,
-                                     off_t offset, uint64_t timestamp, int64_t hash,
-                                     const uint8_t* data, int32_t datalen)
+void CustomIndexerPlugin::indexAnnotatedEvent(const zcm::Json::Value& index,
+                                              zcm::Json::Value& pluginIndex,
+                                              zcm::Json::Value& annotations,
+                                              const std::string& channel,
+                                              const std::string& typeName,
+                                              off_t offset, uint64_t timestamp, int64_t hash,
+                                              const uint8_t* data, int32_t datalen)
 {
     if (typeName != "example_t") return;
     pluginIndex[channel][typeName].append(std::to_string(offset));
@@ -3,6 +3,13 @@ var app = express();
 var http = require('http').Server(app);
 var assert = require('assert');
 app.use(express.static("public"));
+// For the page to decode its messages itself (see zcm.create() in public/js/index.js)
+app.get('/js/zcmtypes.js', function (req, res) {
+    res.sendFile(require.resolve('zcmtypes'));
+});
+app.get('/js/BigInteger.min.js', function (req, res) {
+    res.sendFile(require.resolve('big-integer/BigInteger.min.js'));
+});
 
 var zcm = require('zerocm');
 var zcmtypes = require('zcmtypes');
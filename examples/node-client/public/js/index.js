@@ -72,7 +72,8 @@ function resume() {
 }
 
 onload = function(){
-    z = zcm.create();
+    // Messages come as their bytes, decoded here by zcmtypes.js
+    z = zcm.create({ binary: true });
 
     z.setQueueSize(5);
 }
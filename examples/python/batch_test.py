@@ -0,0 +1,39 @@
+#!/usr/bin/python
+
+from zcm import ZCM
+import sys
+sys.path.insert(0, '../build/types/')
+from example_t import example_t
+
+zcm = ZCM("")
+if not zcm.good():
+    print("Unable to initialize zcm")
+    exit()
+
+# messages of "TEST" are queued without taking the gil, rather than going
+# through a handler each
+subs = zcm.subscribe_batch("TEST")
+zcm.start()
+
+msg = example_t()
+for i in range(100):
+    msg.timestamp = i
+    zcm.publish("TEST", msg)
+
+received = 0
+while received < 100:
+    batch = zcm.recv_batch(timeout = 1.0)
+    if len(batch) == 0:
+        break
+    for channel, data in batch:
+        assert channel == "TEST"
+        assert example_t.decode(data).timestamp == received
+        received = received + 1
+
+zcm.stop()
+zcm.unsubscribe(subs)
+
+if received == 100 and zcm.batch_dropped() == 0:
+    print("Success")
+else:
+    print("Failure")
@@ -0,0 +1,27 @@
+#!/usr/bin/python
+
+from zcm import LogFile
+import sys
+
+if len(sys.argv) < 2:
+    print("Usage: ./log_batch_counter.py <logfile.log> [channel...]")
+    exit(1)
+
+log = LogFile(sys.argv[1], 'r')
+
+if not log.good():
+    print("Unable to open log")
+    exit(1)
+
+# events are read in batches and picked by channel without the gil, and their
+# data is viewed in the mapping of the log rather than copied
+channels = sys.argv[2:] if len(sys.argv) > 2 else None
+events = 0
+nbytes = 0
+for timestamp, channel, data in log.iterEvents(channels = channels):
+    events = events + 1
+    nbytes = nbytes + len(data)
+data = None # the log can only be closed once no event data is viewed
+log.close()
+
+print("Total events: " + str(events) + ", " + str(nbytes) + " bytes of data")
@@ -0,0 +1,44 @@
+#!/usr/bin/python
+
+from zcm import ZCM
+import sys
+import time
+sys.path.insert(0, '../build/types/')
+from example_t import example_t
+
+zcm = ZCM("")
+if not zcm.good():
+    print("Unable to initialize zcm")
+    exit()
+
+# the handler gets read-only memoryviews of the messages instead of copies of
+# them, which stay valid after it returns for as long as they are kept
+kept = []
+def handler(channel, data):
+    assert isinstance(data, memoryview) and data.readonly
+    kept.append(data)
+
+subs = zcm.subscribe_raw("TEST", handler, zerocopy = True)
+zcm.start()
+
+msg = example_t()
+for i in range(100):
+    msg.timestamp = i
+    zcm.publish("TEST", msg)
+
+for i in range(100):
+    if len(kept) == 100:
+        break
+    time.sleep(0.01)
+zcm.stop()
+zcm.unsubscribe(subs)
+
+ok = len(kept) == 100
+for i in range(len(kept)):
+    ok = ok and example_t.decode(kept[i]).timestamp == i
+del kept
+
+if ok:
+    print("Success")
+else:
+    print("Failure")
@@ -45,6 +45,8 @@ def configure(ctx):
 #                 Can also be a space separated string.
 #   littleEndian: True or false based on desired endianess of output. Should almost always
 #                 be false. Don't use this option unless you really know what you're doing
+#   cView:        True to also generate the _view functions of the C types (--c-view)
+#                 default = False
 #   javapkg:      name of the java package
 #                 default = 'zcmtypes' (though it is encouraged to name it something more unique
 #                                       to avoid library naming conflicts)
@@ -165,6 +167,10 @@ def zcmgen(ctx, **kw):
     if 'littleEndian' in kw:
         littleEndian = kw['littleEndian']
 
+    cView = False
+    if 'cView' in kw:
+        cView = kw['cView']
+
     if 'lang' not in kw:
         # TODO: this should probably be a more specific error type
         raise WafError('zcmgen requires keword argument: "lang"')
@@ -202,6 +208,7 @@ def zcmgen(ctx, **kw):
              source       = kw['source'],
              lang         = lang,
              littleEndian = littleEndian,
+             cView        = cView,
              javapkg      = javapkg_name)
     for s in tg.source:
         ctx.add_manual_dependency(s, zcmgen)
@@ -320,6 +327,8 @@ class zcmgen(Task.Task):
         if ('c_stlib' in gen.lang) or ('c_shlib' in gen.lang):
             langs['c'] = '--c --c-typeinfo --c-cpath %s --c-hpath %s --c-include %s' % \
                          (bld, bld, inc)
+            if gen.cView:
+                langs['c'] += ' --c-view'
         if 'cpp' in gen.lang:
             langs['cpp'] = '--cpp --cpp-hpath %s --cpp-include %s' % (bld, inc)
         if 'java' in gen.lang:
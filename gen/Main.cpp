@@ -41,6 +41,11 @@ int main(int argc, char* argv[])
     gopt.addBool('n', "node",      0,     "Emit Node.js code");
     setupOptionsNode(gopt);
 
+    gopt.addSpacer("**** Migration options ****");
+    gopt.addBool(0,   "migrate",   0,     "Emit a zcm-log-transcoder plugin migrating logs of "
+                                          "older versions of the types");
+    setupOptionsMigrate(gopt);
+
     bool parseSuccess = gopt.parse(argc, argv, 1);
     if (!parseSuccess || gopt.getBool("help")) {
         printf("Usage: %s [options] <input files>\n\n", argv[0]);
@@ -129,6 +134,14 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (gopt.getBool("migrate")) {
+        did_something = 1;
+        if (emitMigrate(zcm)) {
+            printf("An error occurred while emitting the migration plugin.\n");
+            ret = 1;
+        }
+    }
+
     if (did_something == 0) {
         printf("No actions specified. Try --help.\n");
         ret = 1;
@@ -1,4 +1,5 @@
 #include "ZCMGen.hpp"
+#include <algorithm>
 #include <cmath>
 #include <unordered_map>
 
@@ -415,6 +416,26 @@ static int parseConst(ZCMGen& zcmgen, ZCMStruct& zs, tokenize_t* t)
 
 // parse a member declaration. This looks long and scary, but most of
 // the code is for semantic analysis (error checking)
+// Parses the bound after a "<=": a positive integer or the name of an integer constant
+static u64 parseBound(ZCMStruct& zs, tokenize_t* t)
+{
+    tokenizeNextOrFail(t, "size bound");
+    if (ZCMConstant* c = zs.findConst(t->token)) {
+        if (!ZCMGen::isArrayDimType(c->type))
+            semantic_error(t, "Size bound '%s' must be an integer type.", t->token);
+        long long v = strtoll(c->valstr.c_str(), NULL, 0);
+        if (v <= 0)
+            semantic_error(t, "Size bound must be > 0");
+        return v;
+    }
+    if (!isdigit(t->token[0]))
+        semantic_error(t, "Size bound must be a constant.");
+    long long v = strtoll(t->token, NULL, 0);
+    if (v <= 0)
+        semantic_error(t, "Size bound must be > 0");
+    return v;
+}
+
 static int parseMember(ZCMGen& zcmgen, ZCMStruct& zs, tokenize_t* t)
 {
     // Read a type specification. Then read members (multiple
@@ -522,6 +543,10 @@ static int parseMember(ZCMGen& zcmgen, ZCMStruct& zs, tokenize_t* t)
 
                     dim.mode = ZCM_VAR;
                     dim.size = t->token;
+
+                    // optional bound: "[size <= max]"
+                    if (parseTryConsume(t, "<="))
+                        dim.maxSize = parseBound(zs, t);
                 }
             }
             parseRequire(t, "]");
@@ -530,6 +555,13 @@ static int parseMember(ZCMGen& zcmgen, ZCMStruct& zs, tokenize_t* t)
             zm.dimensions.push_back(std::move(dim));
         }
 
+        // optional bound on strings: "string s <= max"
+        if (parseTryConsume(t, "<=")) {
+            if (zm.type.fullname != "string")
+                semantic_error(t, "Only strings and variable array dimensions can be bounded.");
+            zm.maxStringLength = parseBound(zs, t);
+        }
+
         zs.members.push_back(std::move(zm));
 
     } while(parseTryConsume(t, ","));
@@ -668,7 +700,10 @@ void ZCMMember::dump()
                 printf(" [ (const) %s ]", dim.size.c_str());
                 break;
             case ZCM_VAR:
-                printf(" [ (var) %s ]", dim.size.c_str());
+                if (dim.maxSize)
+                    printf(" [ (var) %s <= %" PRIu64 " ]", dim.size.c_str(), dim.maxSize);
+                else
+                    printf(" [ (var) %s ]", dim.size.c_str());
                 break;
             default:
                 // oops! unhandled case
@@ -676,6 +711,9 @@ void ZCMMember::dump()
         }
     }
 
+    if (maxStringLength)
+        printf(" <= %" PRIu64, maxStringLength);
+
     printf("\n");
 }
 
@@ -711,6 +749,98 @@ ZCMConstant* ZCMStruct::findConst(const string& name)
     return nullptr;
 }
 
+// Same as the generated _computeHash(): 0 for types already being hashed ('parents')
+static bool fingerprintRecursive(const ZCMGen& zcm, const ZCMStruct& zs, bool anyFile,
+                                 vector<const ZCMStruct*>& parents, u64& hash)
+{
+    if (std::find(parents.begin(), parents.end(), &zs) != parents.end()) {
+        hash = 0;
+        return true;
+    }
+    parents.push_back(&zs);
+
+    u64 v = zs.hash;
+    for (auto& zm : zs.members) {
+        if (ZCMGen::isPrimitiveType(zm.type.fullname))
+            continue;
+        const ZCMStruct* member = nullptr;
+        for (auto& other : zcm.structs)
+            if (other.structname.fullname == zm.type.fullname &&
+                (anyFile || other.zcmfile == zs.zcmfile))
+                member = &other;
+        u64 memberHash;
+        if (!member || !fingerprintRecursive(zcm, *member, anyFile, parents, memberHash))
+            return false;
+        v += memberHash;
+    }
+
+    parents.pop_back();
+    hash = (v << 1) + ((v >> 63) & 1);
+    return true;
+}
+
+bool ZCMGen::computeFingerprint(const ZCMStruct& zs, u64& hash, bool anyFile) const
+{
+    vector<const ZCMStruct*> parents;
+    return fingerprintRecursive(*this, zs, anyFile, parents, hash);
+}
+
+// Without the hash. 'parents' are the types being sized: a type nested in itself
+// can only be through a variable array, and that has no bound
+static bool maxEncodedSizeRecursive(const ZCMGen& zcm, const ZCMStruct& zs,
+                                    vector<const ZCMStruct*>& parents, u64& size)
+{
+    if (std::find(parents.begin(), parents.end(), &zs) != parents.end())
+        return false;
+    parents.push_back(&zs);
+
+    u64 total = 0;
+    for (auto& zm : zs.members) {
+        u64 elt;
+        if (zm.type.fullname == "string") {
+            if (!zm.maxStringLength)
+                return false;
+            elt = 4 + zm.maxStringLength + 1;
+        } else if (ZCMGen::isPrimitiveType(zm.type.fullname)) {
+            elt = ZCMGen::getPrimitiveTypeSize(zm.type.fullname);
+        } else {
+            const ZCMStruct* member = nullptr;
+            for (auto& other : zcm.structs)
+                if (other.structname.fullname == zm.type.fullname && other.zcmfile == zs.zcmfile)
+                    member = &other;
+            if (!member || !maxEncodedSizeRecursive(zcm, *member, parents, elt))
+                return false;
+        }
+
+        for (auto& dim : zm.dimensions) {
+            u64 n = dim.mode == ZCM_CONST ? strtoull(dim.size.c_str(), NULL, 0) : dim.maxSize;
+            if (n == 0)
+                return false;
+            if (elt > UINT32_MAX / n)
+                return false;
+            elt *= n;
+        }
+
+        total += elt;
+        if (total > UINT32_MAX)
+            return false;
+    }
+
+    parents.pop_back();
+    size = total;
+    return true;
+}
+
+bool ZCMGen::computeMaxEncodedSize(const ZCMStruct& zs, u64& size) const
+{
+    vector<const ZCMStruct*> parents;
+    u64 s;
+    if (!maxEncodedSizeRecursive(*this, zs, parents, s) || s + 8 > UINT32_MAX)
+        return false;
+    size = s + 8;
+    return true;
+}
+
 bool ZCMGen::needsGeneration(const string& declaringfile, const string& outfile)
 {
     struct stat instat, outstat;
@@ -51,6 +51,7 @@ struct ZCMDimension
 {
 	ZCMDimensionMode mode;
 	string size;      // a string containing either a member variable name or a constant
+	u64    maxSize = 0; // for ZCM_VAR, the bound declared as "[size <= maxSize]", or 0 if none
 };
 
 struct ZCMMember
@@ -65,6 +66,10 @@ struct ZCMMember
     // declaration are attached to that member
     string comment;
 
+    // For strings, the longest string (without the \0) declared as "string s <= N",
+    // or 0 if none
+    u64 maxStringLength = 0;
+
     // Are all of the dimensions of this array constant? (scalars return true)
     bool isConstantSizeArray();
 
@@ -141,6 +146,18 @@ struct ZCMGen
     // older than the file "declaringfile"
     bool needsGeneration(const string& declaringfile, const string& outfile);
 
+    // Computes into 'hash' the fingerprint of 'zs' that the generated code would compute
+    // when it's first needed: over the types of its members too. Returns false if one of
+    // those types isn't declared in the same file as 'zs', as it could then change without
+    // 'zs' being generated again. With 'anyFile', the types of every file parsed count
+    bool computeFingerprint(const ZCMStruct& zs, u64& hash, bool anyFile = false) const;
+
+    // Computes into 'size' the most bytes an encoded 'zs' can take, hash included, from
+    // the bounds declared on its variable dimensions and strings. Returns false if one of
+    // them has no bound, if the size doesn't fit in 32 bits, or, as for computeFingerprint(),
+    // if one of its member types isn't declared in the same file as 'zs'
+    bool computeMaxEncodedSize(const ZCMStruct& zs, u64& size) const;
+
     // for debugging, emit the contents to stdout
     void dump();
 
@@ -14,3 +14,6 @@ int emitPython(ZCMGen& zcm);
 
 void setupOptionsNode(GetOpt& gopt);
 int emitNode(ZCMGen& zcm);
+
+void setupOptionsMigrate(GetOpt& gopt);
+int emitMigrate(ZCMGen& zcm);
@@ -11,6 +11,7 @@
 
 // flags for emit_c_array_loops_start
 #define FLAG_EMIT_MALLOCS 1
+#define FLAG_EMIT_ARENA_ALLOCS 4
 
 // flags for emit_c_array_loops_end
 #define FLAG_EMIT_FREES   2
@@ -49,6 +50,33 @@ static string makeArraySize(ZCMMember& zm, const string& n, size_t dim)
     assert(0 && "Should be unreachable");
 }
 
+// The size of the dim'th dimension of zm, for code that keeps the members
+// decoded so far in a struct named "dims" instead of in the array "p"
+static string makeDimsArraySize(ZCMMember& zm, size_t dim)
+{
+    auto& zd = zm.dimensions[dim];
+    return zd.mode == ZCM_CONST ? zd.size : "dims." + zd.size;
+}
+
+// Whether the encoding of a top-level 1-D array member can be the array itself
+// in memory, for the _encode_iov functions. If so, 'hostCond' is the C
+// expression for the hosts where it is
+static bool isInPlaceArray(ZCMGen& zcm, ZCMMember& zm, string& hostCond)
+{
+    if (zm.dimensions.size() != 1) return false;
+    const string& t = zm.type.fullname;
+    if (t == "byte" || t == "int8_t" || t == "boolean") {
+        hostCond = "1";
+        return true;
+    }
+    if (!zcm.gopt->getBool("little-endian-encoding")) return false;
+    if (t == "int16_t" || t == "int32_t" || t == "int64_t" || t == "float" || t == "double") {
+        hostCond = "ZCM_HOST_LITTLE_ENDIAN";
+        return true;
+    }
+    return false;
+}
+
 // Some types do not have a 1:1 mapping from zcm types to native C storage types.
 static string mapTypeName(const string& t)
 {
@@ -59,6 +87,10 @@ static string mapTypeName(const string& t)
     return StringUtil::dotsToUnderscores(t);
 }
 
+// The emitter of every language has a struct Emit: theirs must not be mixed up
+// with these at link time
+namespace {
+
 struct Emit : public Emitter
 {
     ZCMGen& zcm;
@@ -95,6 +127,83 @@ struct Emit : public Emitter
             emit(indent, " */");
         }
     }
+
+    // --c-view support: views read the members of a message straight out of
+    // its encoding (see emitHeaderView())
+
+    const char* lePrefix()
+    {
+        return zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "";
+    }
+
+    static bool isPrimitiveNonString(ZCMMember& zm)
+    {
+        return ZCMGen::isPrimitiveType(zm.type.fullname) && zm.type.fullname != "string";
+    }
+
+    // Arrays of these are the encoding itself, which views can point at
+    static bool isByteLike(ZCMMember& zm)
+    {
+        const string& t = zm.type.fullname;
+        return t == "byte" || t == "int8_t" || t == "boolean";
+    }
+
+    static bool isFixedSize(ZCMMember& zm)
+    {
+        return isPrimitiveNonString(zm) && zm.isConstantSizeArray();
+    }
+
+    static size_t fixedEncodedSize(ZCMMember& zm)
+    {
+        size_t n = ZCMGen::getPrimitiveTypeSize(zm.type.fullname);
+        for (auto& dim : zm.dimensions)
+            n *= strtoul(dim.size.c_str(), NULL, 0);
+        return n;
+    }
+
+    // Where the members start in the encoding of a view 'v': constants up to
+    // the first member with a variable size ('first'), the 'offs' the view
+    // records when decoding after that. Returns the size of the fixed size
+    // prefix, and the number of 'offs'
+    size_t viewOffsets(vector<string>& offsets, size_t& first, size_t& noffs)
+    {
+        size_t pos = 0;
+        first = zs.members.size();
+        noffs = 0;
+        for (size_t m = 0; m < zs.members.size(); ++m) {
+            auto& zm = zs.members[m];
+            if (m <= first) {
+                offsets.push_back(std::to_string(pos));
+                if (isFixedSize(zm))
+                    pos += fixedEncodedSize(zm);
+                else
+                    first = m;
+            } else {
+                offsets.push_back("v->offs[" + std::to_string(noffs++) + "]");
+            }
+        }
+        return pos;
+    }
+
+    // Number of elements of the array 'zm', for a view whose encoding holds
+    // 'maxExpr' bytes
+    string viewCount(ZCMMember& zm, const string& maxExpr)
+    {
+        if (zm.isConstantSizeArray()) {
+            size_t n = 1;
+            for (auto& dim : zm.dimensions)
+                n *= strtoul(dim.size.c_str(), NULL, 0);
+            return std::to_string(n);
+        }
+        const char* tn_ = zs.structname.nameUnderscoreCStr();
+        string count = "1";
+        for (auto& dim : zm.dimensions) {
+            string size = dim.mode == ZCM_CONST ? dim.size
+                : "(int64_t) " + string(tn_) + "_view_" + dim.size + "(v)";
+            count = "__zcm_view_dim(" + count + ", " + size + ", " + maxExpr + ")";
+        }
+        return count;
+    }
 };
 
 struct EmitHeader : public Emit
@@ -198,6 +307,14 @@ struct EmitHeader : public Emit
         }
         emit(0, "};");
         emit(0, "");
+
+        u64 maxSize;
+        if (zcm.computeMaxEncodedSize(zs, maxSize)) {
+            emit(0, "/// The most bytes %s_encode() can take, from the bounds in the .zcm file:", tn.c_str());
+            emit(0, "/// a buffer this big never needs %s_encoded_size()", tn.c_str());
+            emit(0, "#define %s_MAX_ENCODED_SIZE %" PRIu64 "u", tnUpper.c_str(), maxSize);
+            emit(0, "");
+        }
     }
 
     void emitHeaderPrototypes()
@@ -241,6 +358,52 @@ struct EmitHeader : public Emit
             emit(0, " */");
             emit(0,"int %s_publish(zcm_t* zcm, const char* channel, const %s* msg);", tn_, tn_);
             emit(0, "");
+            u64 maxSize;
+            if (zcm.computeMaxEncodedSize(zs, maxSize)) {
+                emit(0, "/**");
+                emit(0, " * Publish a message of type %s like %s_publish(), but encoding it", tn_, tn_);
+                emit(0, " * into @p buf instead of a buffer of %s_encoded_size() from the heap.", tn_);
+                emit(0, " *");
+                emit(0, " * @param buf The buffer to encode into, generally of");
+                emit(0, " *            %s_MAX_ENCODED_SIZE bytes.", StringUtil::toUpper(tn_).c_str());
+                emit(0, " * @param maxlen The size of @p buf.");
+                emit(0, " * @return 0 on success, <0 on error, including @p buf being too small.");
+                emit(0, " */");
+                emit(0,"int %s_publish_buf(zcm_t* zcm, const char* channel, const %s* msg, uint8_t* buf, uint32_t maxlen);", tn_, tn_);
+                emit(0, "");
+            }
+            if (zcm.gopt->getBool("c-iov")) {
+                size_t nInPlace = 0;
+                string hostCond;
+                for (auto& zm : zs.members)
+                    if (isInPlaceArray(zcm, zm, hostCond)) ++nInPlace;
+                emit(0, "/**");
+                emit(0, " * The most pieces %s_encode_iov() splits a message into", tn_);
+                emit(0, " */");
+                emit(0, "#define %s_IOV_MAX %zu", StringUtil::toUpper(tn_).c_str(), 2 * nInPlace + 1);
+                emit(0, "");
+                emit(0, "/**");
+                emit(0, " * Encode a message of type %s like %s_encode(), but as a list of", tn_, tn_);
+                emit(0, " * pieces: the large primitive arrays of the message are left where they");
+                emit(0, " * are, and everything else is encoded into @p buf. For zcm_publish_iov()");
+                emit(0, " *");
+                emit(0, " * @param buf The buffer for everything but the arrays, of at least");
+                emit(0, " *            %s_encoded_size() bytes.", tn_);
+                emit(0, " * @param maxlen The size of @p buf.");
+                emit(0, " * @param iov Output parameter for the pieces, pointing into @p buf and @p msg");
+                emit(0, " *            which must both outlive them.");
+                emit(0, " * @param maxiov The room in @p iov, generally %s_IOV_MAX.", StringUtil::toUpper(tn_).c_str());
+                emit(0, " * @return The number of pieces, or <0 if an error occured.");
+                emit(0, " */");
+                emit(0,"int %s_encode_iov(const %s* msg, void* buf, uint32_t maxlen, zcm_iov_t* iov, uint32_t maxiov);", tn_, tn_);
+                emit(0, "");
+                emit(0, "/**");
+                emit(0, " * Publish a message of type %s like %s_publish(), from the pieces", tn_, tn_);
+                emit(0, " * of %s_encode_iov(): see zcm_publish_iov()", tn_);
+                emit(0, " */");
+                emit(0,"int %s_publish_iov(zcm_t* zcm, const char* channel, const %s* msg);", tn_, tn_);
+                emit(0, "");
+            }
             emit(0, "/**");
             emit(0, " * Subscribe to messages of type %s using ZCM.", tn_);
             emit(0, " *");
@@ -310,6 +473,28 @@ struct EmitHeader : public Emit
         emit(0, " */");
         emit(0,"int %s_decode_cleanup(%s* p);", tn_, tn_);
         emit(0, "");
+        if (zcm.gopt->getBool("c-arena")) {
+            emit(0, "/**");
+            emit(0, " * Decode a message of type %s from binary form like %s_decode(),", tn_, tn_);
+            emit(0, " * but taking its strings and variable-length arrays from @p arena instead");
+            emit(0, " * of the heap. There is nothing to clean up: the message is valid until");
+            emit(0, " * the arena is reset.");
+            emit(0, " *");
+            emit(0, " * @param arena The arena to allocate from, with room for at least");
+            emit(0, " *              %s_decode_arena_size() bytes.", tn_);
+            emit(0, " * @return The number of bytes decoded, or <0 if an error occured,");
+            emit(0, " *         including running out of room in @p arena.");
+            emit(0, " */");
+            emit(0,"int %s_decode_arena(const void* buf, uint32_t offset, uint32_t maxlen, %s* msg, zcm_arena_t* arena);", tn_, tn_);
+            emit(0, "");
+            emit(0, "/**");
+            emit(0, " * Check how many bytes of arena %s_decode_arena() needs to decode", tn_);
+            emit(0, " * the encoded message in @p buf, without decoding it.");
+            emit(0, " * @return The number of bytes, or <0 if an error occured.");
+            emit(0, " */");
+            emit(0,"int %s_decode_arena_size(const void* buf, uint32_t offset, uint32_t maxlen);", tn_);
+            emit(0, "");
+        }
         emit(0, "/**");
         emit(0, " * Check how many bytes are required to encode a message of type %s", tn_);
         emit(0, " */");
@@ -328,10 +513,96 @@ struct EmitHeader : public Emit
         emit(0,"int      __%s_encode_array(void* buf, uint32_t offset, uint32_t maxlen, const %s* p, uint32_t elements);", tn_, tn_);
         emit(0,"int      __%s_decode_array(const void* buf, uint32_t offset, uint32_t maxlen, %s* p, uint32_t elements);", tn_, tn_);
         emit(0,"int      __%s_decode_array_cleanup(%s* p, uint32_t elements);", tn_, tn_);
+        if (zcm.gopt->getBool("c-arena")) {
+            emit(0,"int      __%s_decode_arena_array(const void* buf, uint32_t offset, uint32_t maxlen, %s* p, uint32_t elements, zcm_arena_t* arena);", tn_, tn_);
+            emit(0,"int      __%s_decode_arena_array_size(const void* buf, uint32_t offset, uint32_t maxlen, uint32_t elements, uint32_t* need);", tn_);
+        }
         emit(0,"uint32_t __%s_encoded_array_size(const %s* p, uint32_t elements);", tn_, tn_);
         emit(0,"uint32_t __%s_clone_array(const %s* p, %s* q, uint32_t elements);", tn_, tn_, tn_);
         emit(0,"");
     }
+
+    void emitHeaderView()
+    {
+        const char* tn_ = zs.structname.nameUnderscoreCStr();
+        vector<string> offsets;
+        size_t first, noffs;
+        viewOffsets(offsets, first, noffs);
+
+        emit(0, "/**");
+        emit(0, " * Read only view of an encoded %s, to work on a message in place: its", tn_);
+        emit(0, " * members are read straight out of the encoded bytes when they are");
+        emit(0, " * accessed, at offsets that %s_view_decode() finds once, and none of", tn_);
+        emit(0, " * them is copied into RAM until then. A view is only valid as long as the");
+        emit(0, " * buffer it was decoded from.");
+        emit(0, " *");
+        emit(0, " * %s_view_<member>(v) returns each member, nested types as views of", tn_);
+        emit(0, " * their own. Arrays are flattened in row major order: they have");
+        emit(0, " * %s_view_<member>_count(v) elements, %s_view_<member>(v, i) returning", tn_, tn_);
+        emit(0, " * the i-th. Arrays of primitives also have %s_view_<member>_get(), which", tn_);
+        emit(0, " * decodes a range of elements, and byte, int8_t and boolean arrays");
+        emit(0, " * %s_view_<member>_data(), which points at them. The elements of arrays", tn_);
+        emit(0, " * of strings and of nested types aren't all the same size, so the i-th is");
+        emit(0, " * found by reading through the ones before it.");
+        emit(0, " */");
+        emit(0, "typedef struct _%s_view_t %s_view_t;", tn_, tn_);
+        emit(0, "struct _%s_view_t", tn_);
+        emit(0, "{");
+        emit(1, "const uint8_t* buf; // the encoded members, after the hash");
+        emit(1, "uint32_t       len;");
+        if (noffs > 0)
+            emit(1, "uint32_t       offs[%zu];", noffs);
+        emit(0, "};");
+        emit(0, "");
+        emit(0, "/**");
+        emit(0, " * Check an encoded %s and point @p v at it, without copying it.", tn_);
+        emit(0, " *");
+        emit(0, " * @param buf The buffer containing the encoded message.");
+        emit(0, " * @param offset The byte offset into @p buf where the encoded message starts.");
+        emit(0, " * @param maxlen The maximum number of bytes to read.");
+        emit(0, " * @param v Output parameter for the view.");
+        emit(0, " * @return The number of bytes of the message, or <0 if it is invalid.");
+        emit(0, " */");
+        emit(0, "int %s_view_decode(const void* buf, uint32_t offset, uint32_t maxlen, %s_view_t* v);", tn_, tn_);
+        emit(0, "");
+
+        for (auto& zm : zs.members) {
+            auto& mtn = zm.type.fullname;
+            const char* mn = zm.membername.c_str();
+            string ctype = mapTypeName(mtn);
+            string viewType = mtn == "string" ? "" : ctype + "_view_t";
+            emitComment(0, zm.comment);
+            if (zm.dimensions.empty()) {
+                if (mtn == "string")
+                    emit(0, "const char* %s_view_%s(const %s_view_t* v);", tn_, mn, tn_);
+                else if (ZCMGen::isPrimitiveType(mtn))
+                    emit(0, "%s %s_view_%s(const %s_view_t* v);", ctype.c_str(), tn_, mn, tn_);
+                else
+                    emit(0, "int %s_view_%s(const %s_view_t* v, %s* out);",
+                         tn_, mn, tn_, viewType.c_str());
+                continue;
+            }
+            emit(0, "uint32_t %s_view_%s_count(const %s_view_t* v);", tn_, mn, tn_);
+            if (mtn == "string") {
+                emit(0, "const char* %s_view_%s(const %s_view_t* v, uint32_t i);", tn_, mn, tn_);
+            } else if (ZCMGen::isPrimitiveType(mtn)) {
+                emit(0, "%s %s_view_%s(const %s_view_t* v, uint32_t i);", ctype.c_str(), tn_, mn, tn_);
+                emit(0, "int %s_view_%s_get(const %s_view_t* v, uint32_t first, uint32_t n, %s* out);",
+                     tn_, mn, tn_, ctype.c_str());
+                if (isByteLike(zm))
+                    emit(0, "const %s* %s_view_%s_data(const %s_view_t* v);", ctype.c_str(), tn_, mn, tn_);
+            } else {
+                emit(0, "int %s_view_%s(const %s_view_t* v, uint32_t i, %s* out);",
+                     tn_, mn, tn_, viewType.c_str());
+            }
+        }
+        if (!zs.members.empty())
+            emit(0, "");
+
+        emit(0,"// ZCM support functions. Users should not call these");
+        emit(0,"int __%s_view_decode_nohash(const void* buf, uint32_t offset, uint32_t maxlen, %s_view_t* v);", tn_, tn_);
+        emit(0,"");
+    }
 };
 
 struct EmitSource : public Emit
@@ -359,10 +630,14 @@ struct EmitSource : public Emit
     void emitCStructGetHash()
     {
         const char* tn_ = zs.structname.nameUnderscoreCStr();
+        uint64_t fingerprint;
+        bool known = zcm.computeFingerprint(zs, fingerprint);
 
-        emit(0, "static int __%s_hash_computed;", tn_);
-        emit(0, "static uint64_t __%s_hash;", tn_);
-        emit(0, "");
+        if (!known) {
+            emit(0, "static int __%s_hash_computed;", tn_);
+            emit(0, "static uint64_t __%s_hash;", tn_);
+            emit(0, "");
+        }
 
         emit(0, "uint64_t __%s_hash_recursive(const __zcm_hash_ptr* p)", tn_);
         emit(0, "{");
@@ -389,6 +664,13 @@ struct EmitSource : public Emit
 
         emit(0, "int64_t __%s_get_hash(void)", tn_);
         emit(0, "{");
+        if (known) {
+            // what __<type>_hash_recursive(NULL) returns, without a flag to check each call
+            emit(1, "return (int64_t)0x%016" PRIx64 "LL;", fingerprint);
+            emit(0, "}");
+            emit(0, "");
+            return;
+        }
         emit(1, "if (!__%s_hash_computed) {", tn_);
         emit(2,      "__%s_hash = (int64_t)__%s_hash_recursive(NULL);", tn_, tn_);
         emit(2,      "__%s_hash_computed = 1;", tn_);
@@ -399,7 +681,8 @@ struct EmitSource : public Emit
         emit(0, "");
     }
 
-    void emitCArrayLoopsStart(ZCMMember& zm, const string& n, int flags)
+    // 'base' is the indent of the code around the loops
+    void emitCArrayLoopsStart(ZCMMember& zm, const string& n, int flags, int base = 2)
     {
         if (zm.dimensions.size() == 0)
             return;
@@ -407,41 +690,55 @@ struct EmitSource : public Emit
         for (size_t i = 0; i < zm.dimensions.size() - 1; ++i) {
             char var = 'a' + i;
 
-            if (flags & FLAG_EMIT_MALLOCS) {
-                string stars = string(zm.dimensions.size()-1-i, '*');
-                emit(2+i, "%s = (%s%s*) zcm_malloc(sizeof(%s%s) * %s);",
-                     makeAccessor(zm, n, i).c_str(),
-                     mapTypeName(zm.type.fullname).c_str(),
-                     stars.c_str(),
-                     mapTypeName(zm.type.fullname).c_str(),
-                     stars.c_str(),
-                     makeArraySize(zm, n, i).c_str());
-            }
+            emitCArrayAlloc(base+i, zm, n, i, flags);
 
-            emit(2+i, "{ int %c;", var);
-            emit(2+i, "for (%c = 0; %c < %s; ++%c) {", var, var, makeArraySize(zm, "p", i).c_str(), var);
+            emit(base+i, "{ int %c;", var);
+            emit(base+i, "for (%c = 0; %c < %s; ++%c) {", var, var, makeArraySize(zm, "p", i).c_str(), var);
         }
 
+        emitCArrayAlloc(base + (int)zm.dimensions.size() - 1, zm, n, zm.dimensions.size() - 1, flags);
+    }
+
+    // Allocates the dim'th dimension of zm, from the heap or, for the
+    // _decode_arena functions, from "arena"
+    void emitCArrayAlloc(int indent, ZCMMember& zm, const string& n, size_t dim, int flags)
+    {
+        if (!(flags & (FLAG_EMIT_MALLOCS | FLAG_EMIT_ARENA_ALLOCS)))
+            return;
+
+        string stars = string(zm.dimensions.size()-1-dim, '*');
+        string accessor = makeAccessor(zm, n, dim);
+        string size = makeArraySize(zm, n, dim);
         if (flags & FLAG_EMIT_MALLOCS) {
-            emit(2 + (int)zm.dimensions.size() - 1, "%s = (%s*) zcm_malloc(sizeof(%s) * %s);",
-                 makeAccessor(zm, n, zm.dimensions.size() - 1).c_str(),
-                 mapTypeName(zm.type.fullname).c_str(),
-                 mapTypeName(zm.type.fullname).c_str(),
-                 makeArraySize(zm, n, zm.dimensions.size() - 1).c_str());
+            emit(indent, "%s = (%s%s*) zcm_malloc(sizeof(%s%s) * %s);",
+                 accessor.c_str(),
+                 mapTypeName(zm.type.fullname).c_str(), stars.c_str(),
+                 mapTypeName(zm.type.fullname).c_str(), stars.c_str(),
+                 size.c_str());
+        } else {
+            emit(indent, "%s = (%s%s*) zcm_arena_alloc(arena, sizeof(%s%s) * %s);",
+                 accessor.c_str(),
+                 mapTypeName(zm.type.fullname).c_str(), stars.c_str(),
+                 mapTypeName(zm.type.fullname).c_str(), stars.c_str(),
+                 size.c_str());
+            if (zm.dimensions[dim].mode == ZCM_VAR)
+                emit(indent, "if (!%s && %s) return -1;", accessor.c_str(), size.c_str());
+            else
+                emit(indent, "if (!%s) return -1;", accessor.c_str());
         }
     }
 
-    void emitCArrayLoopsEnd(ZCMMember& zm, const string& n, int flags)
+    void emitCArrayLoopsEnd(ZCMMember& zm, const string& n, int flags, int base = 2)
     {
         if (zm.dimensions.size() == 0)
             return;
 
         auto sz = zm.dimensions.size();
         for (size_t i = 0; i < sz - 1; ++i) {
-            size_t indent = sz - i;
+            size_t indent = base - 2 + sz - i;
             if (flags & FLAG_EMIT_FREES) {
                 string accessor = makeAccessor(zm, "p", sz-1-i);
-                emit(indent+1, "if (%s) free(%s);", accessor.c_str(), accessor.c_str());
+                emit(indent+1, "if (%s) zcm_free(%s);", accessor.c_str(), accessor.c_str());
             }
             emit(indent, "}");
             emit(indent, "}");
@@ -449,7 +746,7 @@ struct EmitSource : public Emit
 
         if (flags & FLAG_EMIT_FREES) {
             string accessor = makeAccessor(zm, "p", 0);
-            emit(2, "if (%s) free(%s);", accessor.c_str(), accessor.c_str());
+            emit(base, "if (%s) zcm_free(%s);", accessor.c_str(), accessor.c_str());
         }
     }
 
@@ -601,6 +898,373 @@ struct EmitSource : public Emit
         emit(0,"");
     }
 
+    void emitCDecodeArenaArray()
+    {
+        const char* tn_ = zs.structname.nameUnderscoreCStr();
+        const char* le = zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "";
+
+        emit(0,"int __%s_decode_arena_array(const void* buf, uint32_t offset, uint32_t maxlen, %s* p, uint32_t elements, zcm_arena_t* arena)", tn_, tn_);
+        emit(0,"{");
+        emit(1,    "uint32_t pos = 0, element;");
+        emit(1,    "int thislen;");
+        emit(1,    "(void) arena;");
+        emit(0,"");
+        emit(1,    "for (element = 0; element < elements; ++element) {");
+        emit(0,"");
+        for (auto& zm : zs.members) {
+            emitCArrayLoopsStart(zm, "p", zm.isConstantSizeArray() ? FLAG_NONE : FLAG_EMIT_ARENA_ALLOCS);
+
+            int indent = 2+std::max(0, (int)zm.dimensions.size() - 1);
+            string accessor = makeAccessor(zm, "p", (int)zm.dimensions.size() - 1);
+            string size = makeArraySize(zm, "p", (int)zm.dimensions.size() - 1);
+            const string& tn = zm.type.fullname;
+            if (tn == "string") {
+                emit(indent, "thislen = __string_decode_%sarena_array(buf, offset + pos, maxlen - pos, %s, %s, arena);",
+                     le, accessor.c_str(), size.c_str());
+            } else if (ZCMGen::isPrimitiveType(tn)) {
+                emit(indent, "thislen = __%s_decode_%sarray(buf, offset + pos, maxlen - pos, %s, %s);",
+                     zm.type.nameUnderscoreCStr(), le, accessor.c_str(), size.c_str());
+            } else {
+                emit(indent, "thislen = __%s_decode_arena_array(buf, offset + pos, maxlen - pos, %s, %s, arena);",
+                     zm.type.nameUnderscoreCStr(), accessor.c_str(), size.c_str());
+            }
+            emit(indent, "if (thislen < 0) return thislen; else pos += thislen;");
+
+            emitCArrayLoopsEnd(zm, "p", FLAG_NONE);
+            emit(0,"");
+        }
+        emit(1,   "}");
+        emit(1, "return pos;");
+        emit(0,"}");
+        emit(0,"");
+    }
+
+    // Walks an encoded array, adding up what __<type>_decode_arena_array()
+    // would allocate, in the same order and with the same rounding. Only the
+    // scalar primitive members are decoded, into "dims", since the variable
+    // array dimensions are among them
+    void emitCDecodeArenaArraySize()
+    {
+        const char* tn_ = zs.structname.nameUnderscoreCStr();
+        const char* le = zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "";
+
+        bool hasDims = false;
+        for (auto& zm : zs.members)
+            if (zm.dimensions.size() == 0 && zm.type.fullname != "string" &&
+                ZCMGen::isPrimitiveType(zm.type.fullname))
+                hasDims = true;
+
+        emit(0,"int __%s_decode_arena_array_size(const void* buf, uint32_t offset, uint32_t maxlen, uint32_t elements, uint32_t* need)", tn_);
+        emit(0,"{");
+        emit(1,    "uint32_t pos = 0, element;");
+        emit(1,    "int thislen;");
+        if (hasDims)
+            emit(1, "%s dims;", tn_);
+        emit(1,    "(void) need;");
+        emit(0,"");
+        emit(1,    "for (element = 0; element < elements; ++element) {");
+        emit(0,"");
+        for (auto& zm : zs.members) {
+            const string& tn = zm.type.fullname;
+            size_t ndim = zm.dimensions.size();
+            bool alloc = !zm.isConstantSizeArray();
+
+            // mirrors emitCArrayLoopsStart()
+            for (size_t i = 0; i + 1 < ndim; ++i) {
+                emitCArenaNeed(2+i, zm, i, alloc);
+                emit(2+i, "{ int %c;", (char)('a' + i));
+                emit(2+i, "for (%c = 0; %c < %s; ++%c) {", (char)('a' + i), (char)('a' + i),
+                     makeDimsArraySize(zm, i).c_str(), (char)('a' + i));
+            }
+            if (ndim > 0)
+                emitCArenaNeed(2 + ndim - 1, zm, ndim - 1, alloc);
+
+            int indent = 2+std::max(0, (int)ndim - 1);
+            string size = ndim == 0 ? "1" : makeDimsArraySize(zm, ndim - 1);
+            if (tn == "string") {
+                emit(indent, "thislen = __string_decode_%sarena_array_size(buf, offset + pos, maxlen - pos, %s, need);",
+                     le, size.c_str());
+            } else if (!ZCMGen::isPrimitiveType(tn)) {
+                emit(indent, "thislen = __%s_decode_arena_array_size(buf, offset + pos, maxlen - pos, %s, need);",
+                     zm.type.nameUnderscoreCStr(), size.c_str());
+            } else if (ndim == 0) {
+                emit(indent, "thislen = __%s_decode_%sarray(buf, offset + pos, maxlen - pos, &dims.%s, 1);",
+                     zm.type.nameUnderscoreCStr(), le, zm.membername.c_str());
+            } else {
+                // nothing to allocate: skip the elements
+                emit(indent, "if ((uint64_t)(uint32_t)(%s) * %zu > maxlen - pos) return -1;",
+                     size.c_str(), ZCMGen::getPrimitiveTypeSize(tn));
+                emit(indent, "pos += (uint32_t)(%s) * %zu;", size.c_str(), ZCMGen::getPrimitiveTypeSize(tn));
+            }
+            if (tn == "string" || !ZCMGen::isPrimitiveType(tn) || ndim == 0)
+                emit(indent, "if (thislen < 0) return thislen; else pos += thislen;");
+
+            emitCArrayLoopsEnd(zm, "p", FLAG_NONE);
+            emit(0,"");
+        }
+        emit(1,   "}");
+        emit(1, "return pos;");
+        emit(0,"}");
+        emit(0,"");
+    }
+
+    void emitCArenaNeed(int indent, ZCMMember& zm, size_t dim, bool alloc)
+    {
+        if (!alloc)
+            return;
+        string stars = string(zm.dimensions.size()-1-dim, '*');
+        string size = makeDimsArraySize(zm, dim);
+        if (zm.dimensions[dim].mode == ZCM_VAR)
+            emit(indent, "if (%s < 0) return -1;", size.c_str());
+        emit(indent, "*need += ZCM_ARENA_ROUND(sizeof(%s%s) * (uint32_t)(%s));",
+             mapTypeName(zm.type.fullname).c_str(), stars.c_str(), size.c_str());
+    }
+
+    void emitCDecodeArena()
+    {
+        const char* tn_ = zs.structname.nameUnderscoreCStr();
+
+        emit(0,"int %s_decode_arena(const void* buf, uint32_t offset, uint32_t maxlen, %s* p, zcm_arena_t* arena)", tn_, tn_);
+        emit(0,"{");
+        emit(1,    "uint32_t pos = 0;");
+        emit(1,    "int thislen;");
+        emit(1,    "int64_t hash = __%s_get_hash();", tn_);
+        emit(0,"");
+        emit(1,    "int64_t this_hash;");
+        emit(1,    "thislen = __int64_t_decode_%sarray(buf, offset + pos, maxlen - pos, &this_hash, 1);",
+                   zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "");
+        emit(1,    "if (thislen < 0) return thislen; else pos += thislen;");
+        emit(1,    "if (this_hash != hash) return -1;");
+        emit(0,"");
+        emit(1,    "thislen = __%s_decode_arena_array(buf, offset + pos, maxlen - pos, p, 1, arena);", tn_);
+        emit(1,    "if (thislen < 0) return thislen; else pos += thislen;");
+        emit(0,"");
+        emit(1, "return pos;");
+        emit(0,"}");
+        emit(0,"");
+
+        emit(0,"int %s_decode_arena_size(const void* buf, uint32_t offset, uint32_t maxlen)", tn_);
+        emit(0,"{");
+        emit(1,    "uint32_t pos = 0, need = 0;");
+        emit(1,    "int thislen;");
+        emit(1,    "int64_t hash = __%s_get_hash();", tn_);
+        emit(0,"");
+        emit(1,    "int64_t this_hash;");
+        emit(1,    "thislen = __int64_t_decode_%sarray(buf, offset + pos, maxlen - pos, &this_hash, 1);",
+                   zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "");
+        emit(1,    "if (thislen < 0) return thislen; else pos += thislen;");
+        emit(1,    "if (this_hash != hash) return -1;");
+        emit(0,"");
+        emit(1,    "thislen = __%s_decode_arena_array_size(buf, offset + pos, maxlen - pos, 1, &need);", tn_);
+        emit(1,    "if (thislen < 0) return thislen;");
+        emit(0,"");
+        emit(1, "return need;");
+        emit(0,"}");
+        emit(0,"");
+    }
+
+    // Skips the 'zm' encoded at 'pos' in __*_view_decode_nohash()
+    void emitCViewSkip(ZCMMember& zm)
+    {
+        auto& mtn = zm.type.fullname;
+        if (isPrimitiveNonString(zm)) {
+            if (zm.isConstantSizeArray()) {
+                size_t size = fixedEncodedSize(zm);
+                emit(1, "if (maxlen - pos < %zu) return -1;", size);
+                emit(1, "pos += %zu;", size);
+            } else {
+                size_t elemSize = ZCMGen::getPrimitiveTypeSize(mtn);
+                emit(1, "n = %s;", viewCount(zm, "maxlen").c_str());
+                emit(1, "if (n > (maxlen - pos) / %zu) return -1;", elemSize);
+                emit(1, "pos += (uint32_t) n * %zu;", elemSize);
+            }
+            return;
+        }
+
+        if (mtn == "string") {
+            if (zm.dimensions.empty()) {
+                emit(1, "thislen = __string_view_skip_%sarray(buf, offset + pos, maxlen - pos, 1);",
+                     lePrefix());
+            } else {
+                // every string takes at least 5 bytes
+                emit(1, "n = %s;", viewCount(zm, "maxlen").c_str());
+                emit(1, "if (n > maxlen - pos) return -1;");
+                emit(1, "thislen = __string_view_skip_%sarray(buf, offset + pos, maxlen - pos, (uint32_t) n);",
+                     lePrefix());
+            }
+            emit(1, "if (thislen < 0) return thislen; else pos += thislen;");
+            return;
+        }
+
+        string sub = mapTypeName(mtn);
+        int indent = 1;
+        if (!zm.dimensions.empty()) {
+            emit(1, "n = %s;", viewCount(zm, "maxlen").c_str());
+            emit(1, "for (i = 0; i < n; ++i) {");
+            indent = 2;
+        }
+        emit(indent, "%s_view_t sub;", sub.c_str());
+        emit(indent, "thislen = __%s_view_decode_nohash(buf, offset + pos, maxlen - pos, &sub);",
+             sub.c_str());
+        emit(indent, "if (thislen < 0) return thislen; else pos += thislen;");
+        if (!zm.dimensions.empty())
+            emit(1, "}");
+    }
+
+    void emitCView()
+    {
+        const char* tn_ = zs.structname.nameUnderscoreCStr();
+        vector<string> offsets;
+        size_t first, noffs;
+        size_t prefix = viewOffsets(offsets, first, noffs);
+
+        emit(0,"int %s_view_decode(const void* buf, uint32_t offset, uint32_t maxlen, %s_view_t* v)", tn_, tn_);
+        emit(0,"{");
+        emit(1,    "int thislen;");
+        emit(1,    "int64_t this_hash;");
+        emit(1,    "thislen = __int64_t_decode_%sarray(buf, offset, maxlen, &this_hash, 1);", lePrefix());
+        emit(1,    "if (thislen < 0) return thislen;");
+        emit(1,    "if (this_hash != __%s_get_hash()) return -1;", tn_);
+        emit(0,"");
+        emit(1,    "thislen = __%s_view_decode_nohash(buf, offset + 8, maxlen - 8, v);", tn_);
+        emit(1,    "if (thislen < 0) return thislen;");
+        emit(1,    "return 8 + thislen;");
+        emit(0,"}");
+        emit(0,"");
+
+        bool hasCount = false, hasLen = false, hasLoop = false;
+        for (size_t m = first; m < zs.members.size(); ++m) {
+            auto& zm = zs.members[m];
+            if (!zm.isConstantSizeArray() || (!isPrimitiveNonString(zm) && !zm.dimensions.empty()))
+                hasCount = true;
+            if (!isPrimitiveNonString(zm)) {
+                hasLen = true;
+                if (zm.type.fullname != "string" && !zm.dimensions.empty())
+                    hasLoop = true;
+            }
+        }
+        emit(0,"int __%s_view_decode_nohash(const void* buf, uint32_t offset, uint32_t maxlen, %s_view_t* v)", tn_, tn_);
+        emit(0,"{");
+        emit(1,    "uint32_t pos = %zu;", prefix);
+        if (hasCount) emit(1, "uint64_t n;");
+        if (hasLoop) emit(1, "uint64_t i;");
+        if (hasLen) emit(1, "int thislen;");
+        emit(0,"");
+        if (prefix > 0)
+            emit(1, "if (maxlen < %zu) return -1;", prefix);
+        // the sizes of arrays are read through the view as it is decoded
+        emit(1,    "v->buf = (const uint8_t*) buf + offset;");
+        emit(1,    "v->len = maxlen;");
+        emit(0,"");
+        for (size_t m = first; m < zs.members.size(); ++m) {
+            auto& zm = zs.members[m];
+            if (m > first)
+                emit(1, "%s = pos;", offsets[m].c_str());
+            emitCViewSkip(zm);
+            emit(0,"");
+        }
+        emit(1,    "v->len = pos;");
+        emit(1,    "return pos;");
+        emit(0,"}");
+        emit(0,"");
+
+        for (size_t m = 0; m < zs.members.size(); ++m) {
+            auto& zm = zs.members[m];
+            auto& mtn = zm.type.fullname;
+            const char* mn = zm.membername.c_str();
+            const char* at = offsets[m].c_str();
+            string ctype = mapTypeName(mtn);
+            const char* ct = ctype.c_str();
+            const char* mtn_ = zm.type.nameUnderscoreCStr();
+
+            if (zm.dimensions.empty()) {
+                if (mtn == "string") {
+                    emit(0,"const char* %s_view_%s(const %s_view_t* v)", tn_, mn, tn_);
+                    emit(0,"{");
+                    emit(1,    "return (const char*) v->buf + %s + 4;", at);
+                } else if (ZCMGen::isPrimitiveType(mtn)) {
+                    emit(0,"%s %s_view_%s(const %s_view_t* v)", ct, tn_, mn, tn_);
+                    emit(0,"{");
+                    emit(1,    "%s x = 0;", ct);
+                    emit(1,    "__%s_decode_%sarray(v->buf, %s, v->len - %s, &x, 1);",
+                               mtn_, lePrefix(), at, at);
+                    emit(1,    "return x;");
+                } else {
+                    emit(0,"int %s_view_%s(const %s_view_t* v, %s_view_t* out)", tn_, mn, tn_, ct);
+                    emit(0,"{");
+                    emit(1,    "int thislen = __%s_view_decode_nohash(v->buf, %s, v->len - %s, out);",
+                               ct, at, at);
+                    emit(1,    "return thislen < 0 ? thislen : 0;");
+                }
+                emit(0,"}");
+                emit(0,"");
+                continue;
+            }
+
+            emit(0,"uint32_t %s_view_%s_count(const %s_view_t* v)", tn_, mn, tn_);
+            emit(0,"{");
+            if (zm.isConstantSizeArray())
+                emit(1,    "(void) v;");
+            emit(1,    "return (uint32_t) %s;", viewCount(zm, "v->len").c_str());
+            emit(0,"}");
+            emit(0,"");
+
+            if (isPrimitiveNonString(zm)) {
+                size_t elemSize = ZCMGen::getPrimitiveTypeSize(mtn);
+                emit(0,"%s %s_view_%s(const %s_view_t* v, uint32_t i)", ct, tn_, mn, tn_);
+                emit(0,"{");
+                emit(1,    "%s x = 0;", ct);
+                emit(1,    "__%s_decode_%sarray(v->buf, %s + i * %zu, %zu, &x, 1);",
+                           mtn_, lePrefix(), at, elemSize, elemSize);
+                emit(1,    "return x;");
+                emit(0,"}");
+                emit(0,"");
+
+                emit(0,"int %s_view_%s_get(const %s_view_t* v, uint32_t first, uint32_t n, %s* out)",
+                     tn_, mn, tn_, ct);
+                emit(0,"{");
+                emit(1,    "uint32_t count = %s_view_%s_count(v);", tn_, mn);
+                emit(1,    "if (first > count || n > count - first) return -1;");
+                emit(1,    "return __%s_decode_%sarray(v->buf, %s + first * %zu, n * %zu, out, n);",
+                           mtn_, lePrefix(), at, elemSize, elemSize);
+                emit(0,"}");
+                emit(0,"");
+
+                if (isByteLike(zm)) {
+                    emit(0,"const %s* %s_view_%s_data(const %s_view_t* v)", ct, tn_, mn, tn_);
+                    emit(0,"{");
+                    emit(1,    "return (const %s*) (v->buf + %s);", ct, at);
+                    emit(0,"}");
+                    emit(0,"");
+                }
+            } else if (mtn == "string") {
+                emit(0,"const char* %s_view_%s(const %s_view_t* v, uint32_t i)", tn_, mn, tn_);
+                emit(0,"{");
+                emit(1,    "int skip;");
+                emit(1,    "if (i >= %s_view_%s_count(v)) return NULL;", tn_, mn);
+                emit(1,    "skip = __string_view_skip_%sarray(v->buf, %s, v->len - %s, i);",
+                           lePrefix(), at, at);
+                emit(1,    "return (const char*) v->buf + %s + skip + 4;", at);
+                emit(0,"}");
+                emit(0,"");
+            } else {
+                emit(0,"int %s_view_%s(const %s_view_t* v, uint32_t i, %s_view_t* out)", tn_, mn, tn_, ct);
+                emit(0,"{");
+                emit(1,    "uint32_t pos = %s, element;", at);
+                emit(1,    "int thislen;");
+                emit(1,    "if (i >= %s_view_%s_count(v)) return -1;", tn_, mn);
+                emit(1,    "for (element = 0; ; ++element) {");
+                emit(2,        "thislen = __%s_view_decode_nohash(v->buf, pos, v->len - pos, out);", ct);
+                emit(2,        "if (thislen < 0) return thislen;");
+                emit(2,        "if (element == i) return 0;");
+                emit(2,        "pos += thislen;");
+                emit(1,    "}");
+                emit(0,"}");
+                emit(0,"");
+            }
+        }
+    }
+
     void emitCEncodedArraySize()
     {
         const char* tn_ = zs.structname.nameUnderscoreCStr();
@@ -783,7 +1447,7 @@ struct EmitSource : public Emit
 
         emit(0,"%s* %s_copy(const %s* p)", tn_, tn_, tn_);
         emit(0,"{");
-        emit(1,    "%s* q = (%s*) malloc(sizeof(%s));", tn_, tn_, tn_);
+        emit(1,    "%s* q = (%s*) zcm_malloc(sizeof(%s));", tn_, tn_, tn_);
         emit(1,    "__%s_clone_array(p, q, 1);", tn_);
         emit(1,    "return q;");
         emit(0,"}");
@@ -797,7 +1461,7 @@ struct EmitSource : public Emit
         emit(0,"void %s_destroy(%s* p)", tn_, tn_);
         emit(0,"{");
         emit(1,    "__%s_decode_array_cleanup(p, 1);", tn_);
-        emit(1,    "free(p);");
+        emit(1,    "zcm_free(p);");
         emit(0,"}");
         emit(0,"");
     }
@@ -821,6 +1485,102 @@ struct EmitSource : public Emit
         emit(0, "      return status;");
         emit(0, "}");
         emit(0, "");
+
+        u64 maxSize;
+        if (!zcm.computeMaxEncodedSize(zs, maxSize))
+            return;
+        emit(0, "int %s_publish_buf(zcm_t* zcm, const char* channel, const %s* p, uint8_t* buf, uint32_t maxlen)", tn_, tn_);
+        emit(0, "{");
+        emit(0, "      int data_size = %s_encode (buf, 0, maxlen, p);", tn_);
+        emit(0, "      if (data_size < 0) return data_size;");
+        emit(0, "      return zcm_publish (zcm, channel, buf, (uint32_t)data_size);");
+        emit(0, "}");
+        emit(0, "");
+    }
+
+    void emitCStructEncodeIov()
+    {
+        const char* tn_ = zs.structname.nameUnderscoreCStr();
+        const char* le = zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "";
+
+        // Like __T_encode_array() for the one element, posting a piece for
+        // whatever it encoded so far before each array it leaves in place
+        emit(0,"int %s_encode_iov(const %s* p, void* buf, uint32_t maxlen, zcm_iov_t* iov, uint32_t maxiov)", tn_, tn_);
+        emit(0,"{");
+        emit(1,    "uint32_t pos = 0, start = 0, n = 0, element = 0;");
+        emit(1,    "int thislen;");
+        emit(1,    "int64_t hash = __%s_get_hash();", tn_);
+        emit(0,"");
+        emit(1,    "thislen = __int64_t_encode_%sarray(buf, pos, maxlen - pos, &hash, 1);", le);
+        emit(1,    "if (thislen < 0) return thislen; else pos += thislen;");
+        emit(0,"");
+        for (auto& zm : zs.members) {
+            string hostCond;
+            if (isInPlaceArray(zcm, zm, hostCond)) {
+                string size = makeArraySize(zm, "p", 0);
+                string elt = mapTypeName(zm.type.fullname);
+                // A negative size is left for the encode to reject
+                string cond = hostCond == "1" ? "" : hostCond + " && ";
+                if (zm.dimensions[0].mode == ZCM_VAR) cond += size + " > 0 && ";
+                emit(1, "if (%s(uint32_t) %s * sizeof(%s) >= ZCM_IOV_INPLACE_MIN) {",
+                     cond.c_str(), size.c_str(), elt.c_str());
+                emit(2,     "if (n + 2 > maxiov) return -1;");
+                emit(2,     "if (pos > start) {");
+                emit(3,         "iov[n].base = (const uint8_t*) buf + start;");
+                emit(3,         "iov[n++].len = pos - start;");
+                emit(3,         "start = pos;");
+                emit(2,     "}");
+                emit(2,     "iov[n].base = %s;", makeAccessor(zm, "p", 0).c_str());
+                emit(2,     "iov[n++].len = %s * sizeof(%s);", size.c_str(), elt.c_str());
+                emit(1, "} else {");
+                emit(2,     "thislen = __%s_encode_%sarray(buf, pos, maxlen - pos, %s, %s);",
+                     zm.type.nameUnderscoreCStr(), le,
+                     makeAccessor(zm, "p", 0).c_str(), size.c_str());
+                emit(2,     "if (thislen < 0) return thislen; else pos += thislen;");
+                emit(1, "}");
+                emit(0,"");
+                continue;
+            }
+
+            emitCArrayLoopsStart(zm, "p", FLAG_NONE, 1);
+
+            int indent = 1+std::max(0, (int)zm.dimensions.size() - 1);
+            emit(indent, "thislen = __%s_encode_%sarray(buf, pos, maxlen - pos, %s, %s);",
+                 zm.type.nameUnderscoreCStr(), le,
+                 makeAccessor(zm, "p", (int)zm.dimensions.size() - 1).c_str(),
+                 makeArraySize(zm, "p", (int)zm.dimensions.size() - 1).c_str());
+            emit(indent, "if (thislen < 0) return thislen; else pos += thislen;");
+
+            emitCArrayLoopsEnd(zm, "p", FLAG_NONE, 1);
+            emit(0,"");
+        }
+        emit(1,    "if (pos > start) {");
+        emit(2,        "if (n + 1 > maxiov) return -1;");
+        emit(2,        "iov[n].base = (const uint8_t*) buf + start;");
+        emit(2,        "iov[n++].len = pos - start;");
+        emit(1,    "}");
+        emit(1,    "(void)element;");
+        emit(1,    "return (int) n;");
+        emit(0,"}");
+        emit(0,"");
+
+        string tnUpper = StringUtil::toUpper(tn_);
+        emit(0, "int %s_publish_iov(zcm_t* zcm, const char* channel, const %s* p)", tn_, tn_);
+        emit(0, "{");
+        emit(0, "      zcm_iov_t iov[%s_IOV_MAX];", tnUpper.c_str());
+        emit(0, "      uint32_t max_data_size = %s_encoded_size (p);", tn_);
+        emit(0, "      uint8_t* buf = (uint8_t*) malloc (max_data_size);");
+        emit(0, "      if (!buf) return -1;");
+        emit(0, "      int niov = %s_encode_iov (p, buf, max_data_size, iov, %s_IOV_MAX);", tn_, tnUpper.c_str());
+        emit(0, "      if (niov < 0) {");
+        emit(0, "          free (buf);");
+        emit(0, "          return niov;");
+        emit(0, "      }");
+        emit(0, "      int status = zcm_publish_iov (zcm, channel, iov, (uint32_t)niov);");
+        emit(0, "      free (buf);");
+        emit(0, "      return status;");
+        emit(0, "}");
+        emit(0, "");
     }
 
     void emitCStructSubscribe()
@@ -867,7 +1627,7 @@ struct EmitSource : public Emit
         //       there is probably a hack that involves returning an int in the pointer and using an internal subscription
         //       table...
         emit(0, "    %s_subscription_t* n = (%s_subscription_t*)", tn_, tn_);
-        emit(0, "                       malloc(sizeof(%s_subscription_t));", tn_);
+        emit(0, "                       zcm_malloc(sizeof(%s_subscription_t));", tn_);
         emit(0, "    n->user_handler = f;");
         emit(0, "    n->userdata = userdata;");
         emit(0, "    n->z_sub = zcm_subscribe (zcm, channel,");
@@ -876,7 +1636,7 @@ struct EmitSource : public Emit
         emit(0, "        #ifndef ZCM_EMBEDDED");
         emit(0, "        fprintf (stderr,\"couldn't reg %s ZCM handler!\\n\");", tn_);
         emit(0, "        #endif");
-        emit(0, "        free (n);");
+        emit(0, "        zcm_free (n);");
         emit(0, "        return NULL;");
         emit(0, "    }");
         emit(0, "    return n;");
@@ -898,12 +1658,14 @@ struct EmitSource : public Emit
         emit(0, "        #endif");
         emit(0, "        return -1;");
         emit(0, "    }");
-        emit(0, "    free (hid);");
+        emit(0, "    zcm_free (hid);");
         emit(0, "    return 0;");
         emit(0, "}\n");
     }
 };
 
+}
+
 static int emitStructHeader(ZCMGen& zcm, ZCMStruct& zs, const string& fname)
 {
     EmitHeader E{zcm, zs, fname};
@@ -914,6 +1676,8 @@ static int emitStructHeader(ZCMGen& zcm, ZCMStruct& zs, const string& fname)
     E.emitHeaderTop();
     E.emitHeaderStruct();
     E.emitHeaderPrototypes();
+    if (zcm.gopt->getBool("c-view"))
+        E.emitHeaderView();
 
     E.emitHeaderBottom();
     return 0;
@@ -946,18 +1710,65 @@ static int emitStructSource(ZCMGen& zcm, ZCMStruct& zs, const string& fname)
     E.emitCDecode();
     E.emitCDecodeCleanup();
 
+    if(zcm.gopt->getBool("c-arena")) {
+        E.emitCDecodeArenaArray();
+        E.emitCDecodeArenaArraySize();
+        E.emitCDecodeArena();
+    }
+
+    if(zcm.gopt->getBool("c-view"))
+        E.emitCView();
+
     E.emitCCloneArray();
     E.emitCCopy();
     E.emitCDestroy();
 
     if(!zcm.gopt->getBool("c-no-pubsub")) {
         E.emitCStructPublish();
+        if(zcm.gopt->getBool("c-iov"))
+            E.emitCStructEncodeIov();
         E.emitCStructSubscribe();
     }
 
     return 0;
 }
 
+// Lists all the types, for TypeDb to load instead of reading symbol tables
+static int emitRegistry(ZCMGen& zcm, const string& fname)
+{
+    Emitter E{fname};
+    if (!E.good())
+        return -1;
+
+    E.emit(0, "// THIS IS AN AUTOMATICALLY GENERATED FILE.  DO NOT MODIFY");
+    E.emit(0, "// BY HAND!!");
+    E.emit(0, "//");
+    E.emit(0, "// Generated by zcm-gen\n");
+
+    E.emit(0, "#include <stddef.h>");
+    E.emit(0, "#include <zcm/zcm_coretypes.h>");
+    for (auto& zs : zcm.structs) {
+        string package = dotsToSlashes(zs.structname.package);
+        E.emit(0, "#include \"%s%s%s%s%s.h\"",
+                zcm.gopt->getString("c-include").c_str(),
+                zcm.gopt->getString("c-include").size()>0 ? "/" : "",
+                package.c_str(),
+                package.size()>0 ? "/" : "",
+                zs.structname.nameUnderscoreCStr());
+    }
+    E.emit(0, "");
+
+    E.emit(0, "const zcm_type_registry_entry_t zcm_type_registry[] = {");
+    for (auto& zs : zcm.structs) {
+        const char* tn_ = zs.structname.nameUnderscoreCStr();
+        E.emit(1, "{ \"%s\", %s_get_type_info },", tn_, tn_);
+    }
+    E.emit(1, "{ NULL, NULL }");
+    E.emit(0, "};");
+
+    return 0;
+}
+
 void setupOptionsC(GetOpt& gopt)
 {
     gopt.addString(0, "c-cpath",    ".",      "Location for .c files");
@@ -965,6 +1776,10 @@ void setupOptionsC(GetOpt& gopt)
     gopt.addString(0, "c-include",   "",       "Generated #include lines reference this folder");
     gopt.addBool(0, "c-no-pubsub",   0,     "Do not generate _publish and _subscribe functions");
     gopt.addBool(0, "c-typeinfo",   0,      "Generate typeinfo functions for each type");
+    gopt.addBool(0, "c-arena",      0,      "Generate _decode_arena functions for each type, decoding into a caller's zcm_arena_t (needed by all nested types too)");
+    gopt.addBool(0, "c-view",       0,      "Generate _view functions for each type, reading members straight out of an encoded message (needed by all nested types too)");
+    gopt.addBool(0, "c-iov",        0,      "Generate _encode_iov and _publish_iov functions for each type, leaving large primitive arrays in place");
+    gopt.addString(0, "c-registry",  "",     "Also generate this .c file, listing all the types for tools to load (needs --c-typeinfo)");
 }
 
 int emitC(ZCMGen& zcm)
@@ -994,5 +1809,21 @@ int emitC(ZCMGen& zcm)
         }
     }
 
+    string registry = zcm.gopt->getString("c-registry");
+    if (registry != "") {
+        if (!zcm.gopt->getBool("c-typeinfo")) {
+            fprintf(stderr, "--c-registry needs --c-typeinfo\n");
+            return -1;
+        }
+        bool needed = false;
+        for (auto& zs : zcm.structs)
+            if (zcm.needsGeneration(zs.zcmfile, registry)) needed = true;
+        if (needed) {
+            FileUtil::makeDirsForFile(registry);
+            if (int ret = emitRegistry(zcm, registry))
+                return ret;
+        }
+    }
+
     return 0;
 }
@@ -5,6 +5,8 @@
 #include "util/StringUtil.hpp"
 #include "util/FileUtil.hpp"
 
+using std::to_string;
+
 static string dotsToUnderscores(const string& s)
 {
     return StringUtil::replace(s, '.', '_');
@@ -65,8 +67,21 @@ void setupOptionsCpp(GetOpt& gopt)
 {
     gopt.addString(0, "cpp-hpath",    ".",      "Location for .hpp files");
     gopt.addString(0, "cpp-include",   "",       "Generated #include lines reference this folder");
+    gopt.addInt   (0, "cpp-inline-max", "0",     "Store the variable arrays bounded by at most this "
+                                                 "many elements inside the message");
+    gopt.addString(0, "cpp-soa",       "",       "Comma separated arrays to hold as one array per "
+                                                 "field of their type: TYPE.MEMBER, or an element "
+                                                 "TYPE for all its arrays");
+    gopt.addBool  (0, "cpp-string-lists", false, "Store variable arrays of strings in one buffer, "
+                                                 "as a zcm::StringList");
+    gopt.addBool  (0, "cpp-package-types", false, "Also emit <package>/package.hpp, listing the "
+                                                  "types of each package for subscribeMulti()");
 }
 
+// The emitter of every language has a struct Emit: theirs must not be mixed up
+// with this one at link time
+namespace {
+
 struct Emit : public Emitter
 {
     ZCMGen& zcm;
@@ -75,6 +90,68 @@ struct Emit : public Emitter
     Emit(ZCMGen& zcm, ZCMStruct& zs, const string& fname):
         Emitter(fname), zcm(zcm), zs(zs) {}
 
+    // The capacity of the zcm::InlineVector holding 'zm', from the bound of its
+    // size in the .zcm file, or 0 if it isn't held in one: only 1 dimensional
+    // arrays bounded by at most --cpp-inline-max, and never of the type itself
+    u64 inlineCapacity(const ZCMMember& zm)
+    {
+        int max = zcm.gopt->getInt("cpp-inline-max");
+        if (max <= 0 || zm.dimensions.size() != 1) return 0;
+        auto& dim = zm.dimensions[0];
+        if (dim.mode != ZCM_VAR || dim.maxSize == 0 || dim.maxSize > (u64)max) return 0;
+        if (zm.type.fullname == zs.structname.fullname || soaType(zm) || isStringList(zm))
+            return 0;
+        return dim.maxSize;
+    }
+
+    // Whether 'zm' is held in a zcm::StringList: with --cpp-string-lists, the
+    // 1 dimensional variable arrays of strings
+    bool isStringList(const ZCMMember& zm)
+    {
+        return zcm.gopt->getBool("cpp-string-lists") && zm.type.fullname == "string" &&
+               zm.dimensions.size() == 1 && zm.dimensions[0].mode == ZCM_VAR;
+    }
+
+    // The type of 'zm' if --cpp-soa asks for it to be held as one std::vector per
+    // field of that type, or NULL. Only 1 dimensional variable arrays qualify, of
+    // a type from the same run made of scalar primitives other than strings: each
+    // element then encodes to the same bytes, out of the same index of every field
+    const ZCMStruct* soaType(const ZCMMember& zm, bool warn = false)
+    {
+        const string& opt = zcm.gopt->getString("cpp-soa");
+        if (opt.empty()) return NULL;
+
+        bool asked = false;
+        for (auto& entry : StringUtil::split(opt, ',')) {
+            if (entry == zs.structname.fullname + "." + zm.membername ||
+                entry == zs.structname.shortname + "." + zm.membername ||
+                entry == zm.type.fullname || entry == zm.type.shortname)
+                asked = true;
+        }
+        if (!asked) return NULL;
+
+        const ZCMStruct* elem = NULL;
+        for (auto& s : zcm.structs)
+            if (s.structname.fullname == zm.type.fullname) elem = &s;
+
+        bool ok = elem && !elem->members.empty() && zm.dimensions.size() == 1 &&
+                  zm.dimensions[0].mode == ZCM_VAR;
+        for (size_t i = 0; ok && i < elem->members.size(); ++i) {
+            auto& em = elem->members[i];
+            ok = ZCMGen::isPrimitiveType(em.type.fullname) && em.type.fullname != "string" &&
+                 em.dimensions.empty();
+        }
+        if (!ok) {
+            if (warn)
+                    fprintf(stderr, "%s.%s can't be held as one array per field: only variable "
+                                "arrays of the scalar primitives of a type from the same "
+                                ".zcm files can\n",
+                                zs.structname.shortname.c_str(), zm.membername.c_str());
+            return NULL;
+        }
+        return elem;
+    }
+
     void emitAutoGeneratedWarning()
     {
         emit(0, "/** THIS IS AN AUTOMATICALLY GENERATED FILE.  DO NOT MODIFY");
@@ -131,6 +208,8 @@ struct Emit : public Emitter
         emitAutoGeneratedWarning();
 
         emit(0, "#include <zcm/zcm_coretypes.h>");
+        emit(0, "#include <zcm/zcm_view.hpp>");
+        emit(0, "#include <zcm/zcm_stream.hpp>");
         emit(0, "");
         emit(0, "#ifndef __%s_hpp__", tn_);
         emit(0, "#define __%s_hpp__", tn_);
@@ -138,10 +217,20 @@ struct Emit : public Emitter
 
         // do we need to #include <vector> and/or <string>?
         bool emitIncludeVector = false;
+        bool emitIncludeInline = false;
+        bool emitIncludeList = false;
         bool emitIncludeString = false;
         for (auto& zm : zs.members) {
-            if (!emitIncludeVector &&
-                zm.dimensions.size() != 0 && !zm.isConstantSizeArray()) {
+            bool isVar = zm.dimensions.size() != 0 && !zm.isConstantSizeArray();
+            if (!emitIncludeInline && isVar && inlineCapacity(zm) > 0) {
+                emit(0, "#include <zcm/zcm_inline_vector.hpp>");
+                emitIncludeInline = true;
+            }
+            if (!emitIncludeList && isStringList(zm)) {
+                emit(0, "#include <zcm/zcm_string_list.hpp>");
+                emitIncludeList = true;
+            }
+            if (!emitIncludeVector && isVar && inlineCapacity(zm) == 0 && !isStringList(zm)) {
                 emit(0, "#include <vector>");
                 emitIncludeVector = true;
             }
@@ -151,6 +240,9 @@ struct Emit : public Emitter
                 emitIncludeString = true;
             }
         }
+        // for offsetof in the raw layout fast path
+        if (rawLayoutSize() > 0)
+            emit(0, "#include <stddef.h>");
 
         // include header files for other ZCM types
         for (auto& zm : zs.members) {
@@ -179,6 +271,7 @@ struct Emit : public Emitter
                 emitComment(2, zm.comment);
                 string mappedTypename = mapTypeName(mtn);
                 int ndim = (int)zm.dimensions.size();
+                const ZCMStruct* soa = soaType(zm, true);
                 if (ndim == 0) {
                     emit(2, "%-10s %s;", mappedTypename.c_str(), zm.membername.c_str());
                 } else {
@@ -187,6 +280,21 @@ struct Emit : public Emitter
                         for (auto& zd : zm.dimensions)
                             emitContinue("[%s]", zd.size.c_str());
                         emitEnd(";");
+                    } else if (isStringList(zm)) {
+                        emit(2, "zcm::StringList %s;", zm.membername.c_str());
+                    } else if (const ZCMStruct* elem = soa) {
+                        auto* mn = zm.membername.c_str();
+                        emit(2, "/// One array per field of %s, each %s long",
+                                mappedTypename.c_str(), zm.dimensions[0].size.c_str());
+                        emit(2, "struct %s_soa", mn);
+                        emit(2, "{");
+                        for (auto& em : elem->members)
+                            emit(3, "std::vector< %s > %s;",
+                                    mapTypeName(em.type.fullname).c_str(), em.membername.c_str());
+                        emit(2, "} %s;", mn);
+                    } else if (u64 cap = inlineCapacity(zm)) {
+                        emit(2, "zcm::InlineVector< %s, %" PRIu64 " > %s;",
+                                mappedTypename.c_str(), cap, zm.membername.c_str());
                     } else {
                         emitStart(2, "");
                         for (int d = 0; d < ndim; ++d)
@@ -231,6 +339,16 @@ struct Emit : public Emitter
         emit(2, "*/");
         emit(2, "virtual ~%s() {}", zs.structname.shortname.c_str());
         emit(0, "");
+        emit(2, "#if __cplusplus > 199711L /* if c++11 */");
+        emit(2, "// The destructor above would otherwise leave the type without moves,");
+        emit(2, "// copying the arrays and strings of every message put in a container");
+        emit(2, "%s() = default;", sn);
+        emit(2, "%s(const %s&) = default;", sn, sn);
+        emit(2, "%s(%s&&) noexcept = default;", sn, sn);
+        emit(2, "%s& operator=(const %s&) = default;", sn, sn);
+        emit(2, "%s& operator=(%s&&) noexcept = default;", sn, sn);
+        emit(2, "#endif");
+        emit(0, "");
         emit(2, "/**");
         emit(2, " * Encode a message into binary form.");
         emit(2, " *");
@@ -246,6 +364,16 @@ struct Emit : public Emitter
         emit(2, " * Check how many bytes are required to encode this message.");
         emit(2, " */");
         emit(2, "inline uint32_t getEncodedSize() const;");
+        u64 maxSize;
+        if (zcm.computeMaxEncodedSize(zs, maxSize)) {
+            emit(0, "");
+            emit(2, "#if __cplusplus > 199711L /* if c++11 */");
+            emit(2, "/// The most bytes encode() can take, from the bounds in the .zcm file: a");
+            emit(2, "/// buffer this big, as for ZCM::publish(channel, msg, buf, maxlen), never");
+            emit(2, "/// needs getEncodedSize()");
+            emit(2, "static constexpr uint32_t MAX_ENCODED_SIZE = %" PRIu64 ";", maxSize);
+            emit(2, "#endif");
+        }
         emit(0, "");
         emit(2, "/**");
         emit(2, " * Decode a message from binary form into this instance.");
@@ -264,16 +392,47 @@ struct Emit : public Emitter
         emit(2, " * the message contents.");
         emit(2, " */");
         emit(2, "inline static int64_t getHash();");
+        uint64_t fingerprint;
+        if (zcm.computeFingerprint(zs, fingerprint)) {
+            emit(0, "");
+            emit(2, "#if __cplusplus > 199711L /* if c++11 */");
+            emit(2, "/// What getHash() returns, for constant expressions");
+            emit(2, "static constexpr int64_t ZCM_FINGERPRINT = (int64_t)0x%016" PRIx64 "LL;",
+                    fingerprint);
+            emit(2, "#endif");
+        }
         emit(0, "");
         emit(2, "/**");
         emit(2, " * Returns \"%s\"", zs.structname.shortname.c_str());
         emit(2, " */");
         emit(2, "inline static const char* getTypeName();");
+        emit(0, "");
+        emit(2, "/**");
+        emit(2, " * Calls v.field(name, member) for every member, in order, so generic code");
+        emit(2, " * (e.g. zcm/tools/LogExport.hpp) is compiled for the type instead of going");
+        emit(2, " * through type info at run time. Members of a nested type are passed as is:");
+        emit(2, " * call visit() on them to walk into them.");
+        emit(2, " */");
+        emit(2, "template <class Visitor>");
+        emit(2, "inline void visit(Visitor& v) const;");
+        emit(0, "");
+        emit(2, "/**");
+        emit(2, " * Read only view of an encoded message, decoded without copying it.");
+        emit(2, " */");
+        emit(2, "class View;");
+        emit(0, "");
+        emit(2, "#if __cplusplus > 199711L /* if c++11 */");
+        emit(2, "/**");
+        emit(2, " * Decoder fed an encoded message a piece at a time, as it arrives.");
+        emit(2, " */");
+        emit(2, "class Decoder;");
+        emit(2, "#endif");
 
         emit(0, "");
         emit(2, "// ZCM support functions. Users should not call these");
         emit(2, "inline int      _encodeNoHash(void* buf, uint32_t offset, uint32_t maxlen) const;");
         emit(2, "inline uint32_t _getEncodedSizeNoHash() const;");
+        emit(2, "inline static uint32_t _fixedEncodedSizeNoHash();");
         emit(2, "inline int      _decodeNoHash(const void* buf, uint32_t offset, uint32_t maxlen);");
         emit(2, "inline static uint64_t _computeHash(const __zcm_hash_ptr* p);");
         emit(0, "};");
@@ -342,10 +501,16 @@ struct Emit : public Emitter
     void emitGetHash()
     {
         const char* sn = zs.structname.shortname.c_str();
+        uint64_t fingerprint;
         emit(0, "int64_t %s::getHash()", sn);
         emit(0, "{");
-        emit(1,     "static int64_t hash = _computeHash(NULL);");
-        emit(1,     "return hash;");
+        if (zcm.computeFingerprint(zs, fingerprint)) {
+            // same as _computeHash(NULL), without a static to check on every call
+            emit(1, "return (int64_t)0x%016" PRIx64 "LL;", fingerprint);
+        } else {
+            emit(1, "static int64_t hash = _computeHash(NULL);");
+            emit(1, "return hash;");
+        }
         emit(0, "}");
         emit(0, "");
     }
@@ -360,6 +525,29 @@ struct Emit : public Emitter
         emit(0, "");
     }
 
+    void emitVisit()
+    {
+        auto* sn = zs.structname.shortname.c_str();
+        emit(0, "template <class Visitor>");
+        emit(0, "void %s::visit(Visitor& v) const", sn);
+        emit(0, "{");
+        if (zs.members.empty())
+            emit(1, "(void)v;");
+        for (auto& zm : zs.members) {
+            auto* mn = zm.membername.c_str();
+            // Each field of the element type is an array of its own
+            if (const ZCMStruct* elem = soaType(zm)) {
+                for (auto& em : elem->members)
+                    emit(1, "v.field(\"%s.%s\", this->%s.%s);",
+                            mn, em.membername.c_str(), mn, em.membername.c_str());
+            } else {
+                emit(1, "v.field(\"%s\", this->%s);", mn, mn);
+            }
+        }
+        emit(0, "}");
+        emit(0, "");
+    }
+
     void emitComputeHash()
     {
         const char* sn = zs.structname.shortname.c_str();
@@ -405,6 +593,51 @@ struct Emit : public Emitter
         emit(0, "");
     }
 
+    // Encoded size of the members if they are laid out in memory as they are
+    // encoded, 0 otherwise: when encoding in little endian, fixed size
+    // primitives each at a multiple of its size from the first. No strings,
+    // and no booleans, whose member type a bulk copy must not assume holds
+    // any byte that comes off the wire
+    size_t rawLayoutSize()
+    {
+        if (!zcm.gopt->getBool("little-endian-encoding") || zs.members.empty())
+            return 0;
+
+        size_t size = 0;
+        for (auto& zm : zs.members) {
+            auto& mtn = zm.type.fullname;
+            if (!ZCMGen::isPrimitiveType(mtn) || mtn == "string" || mtn == "boolean" ||
+                !zm.isConstantSizeArray())
+                return 0;
+            size_t elemSize = ZCMGen::getPrimitiveTypeSize(mtn);
+            if (size % elemSize != 0)
+                return 0;
+            size_t n = 1;
+            for (auto& dim : zm.dimensions)
+                n *= strtoul(dim.size.c_str(), NULL, 0);
+            size += n * elemSize;
+        }
+        return size;
+    }
+
+    // Opens the fast path of _encodeNoHash() and _decodeNoHash() for types
+    // with a raw layout, on little endian hosts and in c++11: a single copy,
+    // the static_assert making sure the members are indeed laid out as expected
+    void emitRawLayoutStart(size_t size)
+    {
+        const char* sn = zs.structname.shortname.c_str();
+        const char* first = zs.members.front().membername.c_str();
+        const char* last = zs.members.back().membername.c_str();
+        emit(0, "#if __cplusplus > 199711L && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__");
+        emit(0, "#pragma GCC diagnostic push");
+        emit(0, "#pragma GCC diagnostic ignored \"-Winvalid-offsetof\"");
+        emit(1, "static_assert(offsetof(%s, %s) + sizeof(%s) - offsetof(%s, %s) == %zu,",
+                sn, last, last, sn, first, size);
+        emit(1, "              \"%s members are not laid out as they are encoded\");", sn);
+        emit(0, "#pragma GCC diagnostic pop");
+        emit(1, "if (maxlen < %zu) return -1;", size);
+    }
+
     void _encodeRecursive(ZCMMember& zm, int depth, int extraIndent)
     {
         auto& mtn = zm.type.fullname;
@@ -428,12 +661,12 @@ struct Emit : public Emitter
         }
         if(depth == ndims) {
             if(mtn == "string") {
-                emitStart(indent, "char* __cstr = (char*) this->%s", zm.membername.c_str());
+                string elem = "this->" + zm.membername;
                 for(int i = 0; i < depth; ++i)
-                    emitContinue("[a%d]", i);
-                emitEnd(".c_str();");
-                emit(indent, "thislen = __string_encode_%sarray(buf, offset + pos, maxlen - pos, &__cstr, 1);",
-                             zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "");
+                    elem += "[a" + to_string(i) + "]";
+                emit(indent, "thislen = __string_encode_%ssized(buf, offset + pos, maxlen - pos, %s.c_str(), %s.size());",
+                             zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "",
+                             elem.c_str(), elem.c_str());
             } else {
                 emitStart(indent, "thislen = this->%s", zm.membername.c_str());
                 for(int i = 0; i < depth; ++i)
@@ -466,6 +699,14 @@ struct Emit : public Emitter
         }
         emit(0, "int %s::_encodeNoHash(void* buf, uint32_t offset, uint32_t maxlen) const", sn);
         emit(0, "{");
+        size_t rawSize = rawLayoutSize();
+        if (rawSize > 0) {
+            emitRawLayoutStart(rawSize);
+            emit(1, "memcpy((uint8_t*)buf + offset, &this->%s, %zu);",
+                    zs.members.front().membername.c_str(), rawSize);
+            emit(1, "return %zu;", rawSize);
+            emit(0, "#else");
+        }
         emit(1,     "uint32_t pos = 0;");
         emit(1,     "int thislen;");
         emit(0, "");
@@ -474,14 +715,40 @@ struct Emit : public Emitter
             auto& mtn = zm.type.fullname;
             auto* mn = zm.membername.c_str();
 
+            if (isStringList(zm)) {
+                emit(1, "for (int a0 = 0; a0 < %s; ++a0) {",
+                        dimSizeAccessor(zm.dimensions[0].size).c_str());
+                emit(2, "thislen = __string_encode_%ssized(buf, offset + pos, maxlen - pos, this->%s[a0], this->%s.length(a0));",
+                        zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "", mn, mn);
+                emit(2, "if(thislen < 0) return thislen; else pos += thislen;");
+                emit(1, "}");
+                emit(0, "");
+                continue;
+            }
+
+            if (const ZCMStruct* elem = soaType(zm)) {
+                // each element as its type would encode it, a field at a time
+                string n = dimSizeAccessor(zm.dimensions[0].size);
+                emit(1, "for (int a0 = 0; a0 < %s; ++a0) {", n.c_str());
+                for (auto& em : elem->members) {
+                    emit(2, "thislen = __%s_encode_%sarray(buf, offset + pos, maxlen - pos, &this->%s.%s[a0], 1);",
+                            em.type.fullname.c_str(),
+                            zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "",
+                            mn, em.membername.c_str());
+                    emit(2, "if(thislen < 0) return thislen; else pos += thislen;");
+                }
+                emit(1, "}");
+                emit(0, "");
+                continue;
+            }
+
             int ndims = (int)zm.dimensions.size();
             if (ndims == 0) {
                 if (ZCMGen::isPrimitiveType(mtn)) {
                     if(mtn == "string") {
-                        emit(1, "char* %s_cstr = (char*) this->%s.c_str();", mn, mn);
-                        emit(1, "thislen = __string_encode_%sarray(buf, offset + pos, maxlen - pos, &%s_cstr, 1);",
+                        emit(1, "thislen = __string_encode_%ssized(buf, offset + pos, maxlen - pos, this->%s.c_str(), this->%s.size());",
                                 zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "",
-                                mn);
+                                mn, mn);
                     } else {
                         emit(1, "thislen = __%s_encode_%sarray(buf, offset + pos, maxlen - pos, &this->%s, 1);",
                              mtn.c_str(),
@@ -510,6 +777,8 @@ struct Emit : public Emitter
             emit(0,"");
         }
         emit(1, "return pos;");
+        if (rawSize > 0)
+            emit(0, "#endif");
         emit(0,"}");
         emit(0,"");
     }
@@ -531,7 +800,15 @@ struct Emit : public Emitter
             auto* mn = zm.membername.c_str();
             int ndim = (int)zm.dimensions.size();
 
-            if (ZCMGen::isPrimitiveType(mtn) && mtn != "string") {
+            if (isStringList(zm)) {
+                emit(1, "enc_size += this->%s.encodedSize();", mn);
+            } else if (const ZCMStruct* elem = soaType(zm)) {
+                size_t elemSize = 0;
+                for (auto& em : elem->members)
+                    elemSize += ZCMGen::getPrimitiveTypeSize(em.type.fullname);
+                emit(1, "enc_size += %s * %zu;", dimSizeAccessor(zm.dimensions[0].size).c_str(),
+                        elemSize);
+            } else if (ZCMGen::isPrimitiveType(mtn) && mtn != "string") {
                 emitStart(1, "enc_size += ");
                 for(int n = 0; n < ndim-1; ++n) {
                     auto& dim = zm.dimensions[n];
@@ -545,12 +822,25 @@ struct Emit : public Emitter
                     emitEnd("__%s_encoded_array_size(NULL, 1);", mtn.c_str());
                 }
             } else {
+                // arrays of a type of fixed size don't need to be walked
+                bool maybeFixed = mtn != "string" && ndim > 0 && mtn != zs.structname.fullname;
+                int indent = 1;
+                if (maybeFixed) {
+                    string mapped = mapTypeName(mtn);
+                    emit(1, "if (%s::_fixedEncodedSizeNoHash() > 0) {", mapped.c_str());
+                    emitStart(2, "enc_size += ");
+                    for (auto& dim : zm.dimensions)
+                        emitContinue("%s%s * ", dimSizePrefix(dim.size).c_str(), dim.size.c_str());
+                    emitEnd("%s::_fixedEncodedSizeNoHash();", mapped.c_str());
+                    emit(1, "} else {");
+                    indent = 2;
+                }
                 for(int n = 0; n < ndim; ++n) {
                     auto& dim = zm.dimensions[n];
-                    emit(1+n, "for (int a%d = 0; a%d < %s%s; ++a%d) {",
+                    emit(indent+n, "for (int a%d = 0; a%d < %s%s; ++a%d) {",
                          n, n, dimSizePrefix(dim.size).c_str(), dim.size.c_str(), n);
                 }
-                emitStart(ndim + 1, "enc_size += this->%s", mn);
+                emitStart(ndim + indent, "enc_size += this->%s", mn);
                 for(int i = 0; i < ndim; ++i)
                     emitContinue("[a%d]", i);
                 if (mtn == "string") {
@@ -559,8 +849,10 @@ struct Emit : public Emitter
                     emitEnd("._getEncodedSizeNoHash();");
                 }
                 for(int n = ndim-1; n >= 0; --n) {
-                    emit(1 + n, "}");
+                    emit(indent + n, "}");
                 }
+                if (maybeFixed)
+                    emit(1, "}");
             }
         }
         emit(1, "return enc_size;");
@@ -568,6 +860,49 @@ struct Emit : public Emitter
         emit(0,"");
     }
 
+    // The encoded size of every instance, or 0 if that depends on the instance: constant
+    // for primitives, and for types the generated code of other types can be asked about
+    void emitFixedEncodedSizeNohash()
+    {
+        const char* sn = zs.structname.shortname.c_str();
+        size_t primitives = 0;
+        vector<string> types, terms;
+        bool fixed = !zs.members.empty();
+        for (auto& zm : zs.members) {
+            auto& mtn = zm.type.fullname;
+            if (mtn == "string" || !zm.isConstantSizeArray() || mtn == zs.structname.fullname) {
+                fixed = false;
+            } else if (ZCMGen::isPrimitiveType(mtn)) {
+                primitives += fixedEncodedSize(zm);
+            } else {
+                size_t n = 1;
+                for (auto& dim : zm.dimensions)
+                    n *= strtoul(dim.size.c_str(), NULL, 0);
+                string size = mapTypeName(mtn) + "::_fixedEncodedSizeNoHash()";
+                if (std::find(types.begin(), types.end(), size) == types.end())
+                    types.push_back(size);
+                terms.push_back(n == 1 ? size : to_string(n) + " * " + size);
+            }
+        }
+
+        emit(0, "uint32_t %s::_fixedEncodedSizeNoHash()", sn);
+        emit(0, "{");
+        if (!fixed) {
+            emit(1, "return 0;");
+        } else if (terms.empty()) {
+            emit(1, "return %zu;", primitives);
+        } else {
+            for (auto& size : types)
+                emit(1, "if (%s == 0) return 0;", size.c_str());
+            emitStart(1, "return %zu", primitives);
+            for (auto& term : terms)
+                emitContinue(" + %s", term.c_str());
+            emitEnd(";");
+        }
+        emit(0, "}");
+        emit(0, "");
+    }
+
     void _decodeRecursive(ZCMMember& zm, int depth)
     {
         auto& mtn = zm.type.fullname;
@@ -580,6 +915,9 @@ struct Emit : public Emitter
 
             auto& dim = zm.dimensions[depth];
             int decodeIndent = 1 + depth;
+            if (inlineCapacity(zm))
+                emit(1 + depth, "if(!this->%s.fits(%s)) return -1;",
+                                mn, dimSizeAccessor(dim.size).c_str());
             if(!zm.isConstantSizeArray()) {
                 emit(1 + depth, "if(%s > 0) {", dimSizeAccessor(dim.size).c_str());
                 emitStart(2 + depth, "this->%s", mn);
@@ -598,6 +936,12 @@ struct Emit : public Emitter
             emitEnd("[0], %s);", dimSizeAccessor(dim.size).c_str());
             emit(decodeIndent, "if(thislen < 0) return thislen; else pos += thislen;");
             if (!zm.isConstantSizeArray()) {
+                // a message decoded into again must not keep its old elements
+                emit(1 + depth, "} else {");
+                emitStart(2 + depth, "this->%s", mn);
+                for(int i = 0; i < depth; ++i)
+                    emitContinue("[a%d]", i);
+                emitEnd(".clear();");
                 emit(1 + depth, "}");
             }
         } else if(depth == ndims) {
@@ -621,6 +965,9 @@ struct Emit : public Emitter
             }
         } else {
             auto& dim = zm.dimensions[depth];
+            if (inlineCapacity(zm))
+                emit(1 + depth, "if(!this->%s.fits(%s)) return -1;",
+                                mn, dimSizeAccessor(dim.size).c_str());
             if(!zm.isConstantSizeArray()) {
                 emitStart(1+depth, "this->%s", mn);
                 for(int i = 0; i < depth; ++i) {
@@ -650,6 +997,14 @@ struct Emit : public Emitter
         }
         emit(0, "int %s::_decodeNoHash(const void* buf, uint32_t offset, uint32_t maxlen)", sn);
         emit(0, "{");
+        size_t rawSize = rawLayoutSize();
+        if (rawSize > 0) {
+            emitRawLayoutStart(rawSize);
+            emit(1, "memcpy(&this->%s, (const uint8_t*)buf + offset, %zu);",
+                    zs.members.front().membername.c_str(), rawSize);
+            emit(1, "return %zu;", rawSize);
+            emit(0, "#else");
+        }
         emit(1,     "uint32_t pos = 0;");
         emit(1,     "int thislen;");
         emit(0, "");
@@ -657,6 +1012,44 @@ struct Emit : public Emitter
             auto& mtn = zm.type.fullname;
             auto* mn = zm.membername.c_str();
 
+            if (isStringList(zm)) {
+                emit(1, "this->%s.clear();", mn);
+                emit(1, "for (int a0 = 0; a0 < %s; ++a0) {",
+                        dimSizeAccessor(zm.dimensions[0].size).c_str());
+                emit(2, "int32_t __elem_len;");
+                emit(2, "thislen = __int32_t_decode_%sarray(buf, offset + pos, maxlen - pos, &__elem_len, 1);",
+                        zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "");
+                emit(2, "if(thislen < 0) return thislen; else pos += thislen;");
+                emit(2, "if(__elem_len < 1 || (uint32_t)__elem_len > maxlen - pos) return -1;");
+                emit(2, "this->%s.push_back(((const char*)buf) + offset + pos, __elem_len - 1);", mn);
+                emit(2, "pos += __elem_len;");
+                emit(1, "}");
+                emit(0, "");
+                continue;
+            }
+
+            if (const ZCMStruct* elem = soaType(zm)) {
+                string n = dimSizeAccessor(zm.dimensions[0].size);
+                emit(1, "if(%s > 0) {", n.c_str());
+                for (auto& em : elem->members)
+                    emit(2, "this->%s.%s.resize(%s);", mn, em.membername.c_str(), n.c_str());
+                emit(2, "for (int a0 = 0; a0 < %s; ++a0) {", n.c_str());
+                for (auto& em : elem->members) {
+                    emit(3, "thislen = __%s_decode_%sarray(buf, offset + pos, maxlen - pos, &this->%s.%s[a0], 1);",
+                            em.type.fullname.c_str(),
+                            zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "",
+                            mn, em.membername.c_str());
+                    emit(3, "if(thislen < 0) return thislen; else pos += thislen;");
+                }
+                emit(2, "}");
+                emit(1, "} else {");
+                for (auto& em : elem->members)
+                    emit(2, "this->%s.%s.clear();", mn, em.membername.c_str());
+                emit(1, "}");
+                emit(0, "");
+                continue;
+            }
+
             int ndims = (int)zm.dimensions.size();
             if (ndims == 0 && ZCMGen::isPrimitiveType(mtn)) {
                 if(mtn == "string") {
@@ -682,26 +1075,697 @@ struct Emit : public Emitter
             emit(0,"");
         }
         emit(1, "return pos;");
+        if (rawSize > 0)
+            emit(0, "#endif");
+        emit(0, "}");
+        emit(0, "");
+    }
+
+    // T::View support (see zcm/zcm_view.hpp)
+
+    const char* viewLE()
+    {
+        return zcm.gopt->getBool("little-endian-encoding") ? "true" : "false";
+    }
+
+    bool isPrimitiveNonString(ZCMMember& zm)
+    {
+        return ZCMGen::isPrimitiveType(zm.type.fullname) && zm.type.fullname != "string";
+    }
+
+    bool isFixedSize(ZCMMember& zm)
+    {
+        return isPrimitiveNonString(zm) && zm.isConstantSizeArray();
+    }
+
+    size_t fixedEncodedSize(ZCMMember& zm)
+    {
+        size_t n = ZCMGen::getPrimitiveTypeSize(zm.type.fullname);
+        for (auto& dim : zm.dimensions)
+            n *= strtoul(dim.size.c_str(), NULL, 0);
+        return n;
+    }
+
+    // Where the members start in an encoded message, as expressions of a
+    // View: constants up to the first member with a variable size ('first'),
+    // the '_offs' the View records when decoding after that. Returns the size
+    // of the fixed size prefix, and the number of '_offs'
+    size_t viewOffsets(vector<string>& offsets, size_t& first, size_t& noffs)
+    {
+        size_t pos = 0;
+        first = zs.members.size();
+        noffs = 0;
+        for (size_t m = 0; m < zs.members.size(); ++m) {
+            auto& zm = zs.members[m];
+            if (m <= first) {
+                offsets.push_back(to_string(pos));
+                if (isFixedSize(zm))
+                    pos += fixedEncodedSize(zm);
+                else
+                    first = m;
+            } else {
+                offsets.push_back("this->_offs[" + to_string(noffs++) + "]");
+            }
+        }
+        return pos;
+    }
+
+    // Number of elements of the array 'zm', for a View whose buffer holds
+    // 'maxExpr' bytes
+    string viewCount(ZCMMember& zm, const char* maxExpr)
+    {
+        if (zm.isConstantSizeArray()) {
+            size_t n = 1;
+            for (auto& dim : zm.dimensions)
+                n *= strtoul(dim.size.c_str(), NULL, 0);
+            return to_string(n);
+        }
+        string count = "1";
+        for (auto& dim : zm.dimensions) {
+            string size = isDimSizeFixed(dim.size) ? dim.size : "this->" + dim.size + "()";
+            count = "zcm::viewDim(" + count + ", " + size + ", " + maxExpr + ")";
+        }
+        return count;
+    }
+
+    // What the accessor of 'zm' returns, and for arrays of strings or of other
+    // types, what their SeqView reads
+    string viewAccessorType(ZCMMember& zm)
+    {
+        auto& mtn = zm.type.fullname;
+        string mapped = mapTypeName(mtn);
+        if (zm.dimensions.empty()) {
+            if (mtn == "string") return "const char*";
+            if (ZCMGen::isPrimitiveType(mtn)) return mapped;
+            return mapped + "::View";
+        }
+        if (isPrimitiveNonString(zm))
+            return "zcm::ArrayView< " + mapped + ", " + viewLE() + " >";
+        return "zcm::SeqView< " + viewElem(zm) + " >";
+    }
+
+    string viewElem(ZCMMember& zm)
+    {
+        if (zm.type.fullname == "string")
+            return string("zcm::StringViewElem< ") + viewLE() + " >";
+        return mapTypeName(zm.type.fullname) + "::View";
+    }
+
+    void emitViewClass()
+    {
+        const char* sn = zs.structname.shortname.c_str();
+        vector<string> offsets;
+        size_t first, noffs;
+        viewOffsets(offsets, first, noffs);
+
+        emit(0, "/**");
+        emit(0, " * Read only view of an encoded %s, reading its members straight out", sn);
+        emit(0, " * of the encoded bytes when they are accessed. Views can be subscribed to");
+        emit(0, " * like %s itself, and are then only valid during the callback.", sn);
+        emit(0, " * Arrays are flattened: see zcm/zcm_view.hpp");
+        emit(0, " */");
+        emit(0, "class %s::View", sn);
+        emit(0, "{");
+        emit(1, "public:");
+        emit(2, "typedef %s::View value_type;", sn);
+        emit(0, "");
+        emit(2, "View() : _buf(NULL), _len(0) {}");
+        emit(0, "");
+        emit(2, "/**");
+        emit(2, " * Check an encoded message and point this view at it, without copying it.");
+        emit(2, " *");
+        emit(2, " * @param buf The buffer containing the encoded message.");
+        emit(2, " * @param offset The byte offset into @p buf where the encoded message starts.");
+        emit(2, " * @param maxlen The maximum number of bytes to read.");
+        emit(2, " * @return The number of bytes of the message, or <0 if it is invalid.");
+        emit(2, " */");
+        emit(2, "inline int decode(const void* buf, uint32_t offset, uint32_t maxlen);");
+        emit(0, "");
+        emit(2, "/**");
+        emit(2, " * Decode the whole message into @p msg.");
+        emit(2, " *");
+        emit(2, " * @return The number of bytes decoded, or <0 if an error occured.");
+        emit(2, " */");
+        emit(2, "inline int copyTo(%s& msg) const;", sn);
+        emit(0, "");
+        emit(2, "// Copy the message viewed, as %s would encode it", sn);
+        emit(2, "inline int encode(void* buf, uint32_t offset, uint32_t maxlen) const;");
+        emit(2, "inline uint32_t getEncodedSize() const;");
+        emit(0, "");
+        emit(2, "inline static int64_t getHash();");
+        emit(2, "inline static const char* getTypeName();");
+        if (!zs.members.empty()) {
+            emit(0, "");
+            for (auto& zm : zs.members) {
+                emitComment(2, zm.comment);
+                emit(2, "inline %s %s() const;",
+                        viewAccessorType(zm).c_str(), zm.membername.c_str());
+            }
+        }
+        emit(0, "");
+        emit(2, "// ZCM support functions. Users should not call these");
+        emit(2, "inline int _decodeNoHash(const void* buf, uint32_t offset, uint32_t maxlen);");
+        emit(2, "inline static int _skip(const uint8_t* p, uint32_t maxlen);");
+        emit(2, "inline static View _at(const uint8_t* p, uint32_t maxlen);");
+        emit(0, "");
+        emit(1, "private:");
+        emit(2, "const uint8_t* _buf;");
+        emit(2, "uint32_t _len;");
+        if (noffs > 0)
+            emit(2, "uint32_t _offs[%zu];", noffs);
+        emit(0, "};");
+        emit(0, "");
+    }
+
+    // Skips the 'zm' encoded at 'pos' in _decodeNoHash()
+    void emitViewSkip(ZCMMember& zm)
+    {
+        auto& mtn = zm.type.fullname;
+        const char* le = viewLE();
+        if (isPrimitiveNonString(zm)) {
+            if (zm.isConstantSizeArray()) {
+                size_t size = fixedEncodedSize(zm);
+                emit(1, "if (maxlen - pos < %zu) return -1;", size);
+                emit(1, "pos += %zu;", size);
+            } else {
+                size_t elemSize = ZCMGen::getPrimitiveTypeSize(mtn);
+                emit(1, "n = %s;", viewCount(zm, "maxlen").c_str());
+                emit(1, "if (n > (maxlen - pos) / %zu) return -1;", elemSize);
+                emit(1, "pos += (uint32_t) n * %zu;", elemSize);
+            }
+            return;
+        }
+
+        string skip = mtn == "string"
+            ? string("zcm::viewStringSize< ") + le + " >(this->_buf + pos, maxlen - pos)"
+            : mapTypeName(mtn) + "::View::_skip(this->_buf + pos, maxlen - pos)";
+        int indent = 1;
+        if (!zm.dimensions.empty()) {
+            emit(1, "n = %s;", viewCount(zm, "maxlen").c_str());
+            emit(1, "for (uint64_t i = 0; i < n; ++i) {");
+            indent = 2;
+        }
+        emit(indent, "thislen = %s;", skip.c_str());
+        emit(indent, "if (thislen < 0) return thislen; else pos += thislen;");
+        if (!zm.dimensions.empty())
+            emit(1, "}");
+    }
+
+    void emitViewMethods()
+    {
+        const char* sn = zs.structname.shortname.c_str();
+        const char* le = viewLE();
+        const char* lePrefix = zcm.gopt->getBool("little-endian-encoding") ? "little_endian_" : "";
+        vector<string> offsets;
+        size_t first, noffs;
+        size_t prefix = viewOffsets(offsets, first, noffs);
+
+        emit(0, "int %s::View::decode(const void* buf, uint32_t offset, uint32_t maxlen)", sn);
+        emit(0, "{");
+        emit(1,     "if (maxlen < 8) return -1;");
+        emit(1,     "if (zcm::viewRead< int64_t, %s >((const uint8_t*)buf + offset) != %s::getHash())",
+                    le, sn);
+        emit(2,         "return -1;");
+        emit(1,     "int thislen = this->_decodeNoHash(buf, offset + 8, maxlen - 8);");
+        emit(1,     "if (thislen < 0) return thislen;");
+        emit(1,     "return 8 + thislen;");
+        emit(0, "}");
+        emit(0, "");
+
+        emit(0, "int %s::View::copyTo(%s& msg) const", sn, sn);
+        emit(0, "{");
+        emit(1,     "return msg._decodeNoHash(this->_buf, 0, this->_len);");
+        emit(0, "}");
+        emit(0, "");
+
+        emit(0, "int %s::View::encode(void* buf, uint32_t offset, uint32_t maxlen) const", sn);
+        emit(0, "{");
+        emit(1,     "if (maxlen < 8 + this->_len) return -1;");
+        emit(1,     "int64_t hash = getHash();");
+        emit(1,     "__int64_t_encode_%sarray(buf, offset, 8, &hash, 1);", lePrefix);
+        emit(1,     "memcpy((uint8_t*)buf + offset + 8, this->_buf, this->_len);");
+        emit(1,     "return 8 + this->_len;");
+        emit(0, "}");
+        emit(0, "");
+
+        emit(0, "uint32_t %s::View::getEncodedSize() const", sn);
+        emit(0, "{");
+        emit(1,     "return 8 + this->_len;");
+        emit(0, "}");
+        emit(0, "");
+
+        emit(0, "int64_t %s::View::getHash()", sn);
+        emit(0, "{");
+        emit(1,     "return %s::getHash();", sn);
+        emit(0, "}");
+        emit(0, "");
+
+        emit(0, "const char* %s::View::getTypeName()", sn);
+        emit(0, "{");
+        emit(1,     "return %s::getTypeName();", sn);
+        emit(0, "}");
+        emit(0, "");
+
+        for (size_t m = 0; m < zs.members.size(); ++m) {
+            auto& zm = zs.members[m];
+            auto& mtn = zm.type.fullname;
+            string type = viewAccessorType(zm);
+            const char* at = offsets[m].c_str();
+            emit(0, "%s %s::View::%s() const", type.c_str(), sn, zm.membername.c_str());
+            emit(0, "{");
+            if (zm.dimensions.empty()) {
+                if (mtn == "string")
+                    emit(1, "return (const char*)this->_buf + %s + 4;", at);
+                else if (ZCMGen::isPrimitiveType(mtn))
+                    emit(1, "return zcm::viewRead< %s, %s >(this->_buf + %s);",
+                            type.c_str(), le, at);
+                else
+                    emit(1, "return %s::View::_at(this->_buf + %s, this->_len - %s);",
+                            mapTypeName(mtn).c_str(), at, at);
+            } else if (isPrimitiveNonString(zm)) {
+                emit(1, "return %s(this->_buf + %s, (uint32_t) %s);",
+                        type.c_str(), at, viewCount(zm, "this->_len").c_str());
+            } else {
+                emit(1, "return %s(this->_buf + %s, this->_len - %s, %s);",
+                        type.c_str(), at, at, viewCount(zm, "this->_len").c_str());
+            }
+            emit(0, "}");
+            emit(0, "");
+        }
+
+        emit(0, "int %s::View::_decodeNoHash(const void* buf, uint32_t offset, uint32_t maxlen)", sn);
+        emit(0, "{");
+        if (prefix > 0)
+            emit(1, "if (maxlen < %zu) return -1;", prefix);
+        emit(1,     "this->_buf = (const uint8_t*)buf + offset;");
+        emit(1,     "this->_len = maxlen;");
+        emit(1,     "uint32_t pos = %zu;", prefix);
+        bool hasCount = false, hasLen = false;
+        for (size_t m = first; m < zs.members.size(); ++m) {
+            auto& zm = zs.members[m];
+            if (!zm.isConstantSizeArray()) hasCount = true;
+            if (!isPrimitiveNonString(zm)) {
+                hasLen = true;
+                if (!zm.dimensions.empty()) hasCount = true;
+            }
+        }
+        if (hasCount) emit(1, "uint64_t n;");
+        if (hasLen) emit(1, "int thislen;");
+        emit(0, "");
+        for (size_t m = first; m < zs.members.size(); ++m) {
+            auto& zm = zs.members[m];
+            if (m > first)
+                emit(1, "%s = pos;", offsets[m].c_str());
+            emitViewSkip(zm);
+            emit(0, "");
+        }
+        emit(1,     "this->_len = pos;");
+        emit(1,     "return pos;");
+        emit(0, "}");
+        emit(0, "");
+
+        emit(0, "int %s::View::_skip(const uint8_t* p, uint32_t maxlen)", sn);
+        emit(0, "{");
+        emit(1,     "View v;");
+        emit(1,     "return v._decodeNoHash(p, 0, maxlen);");
         emit(0, "}");
         emit(0, "");
+
+        emit(0, "%s::View %s::View::_at(const uint8_t* p, uint32_t maxlen)", sn, sn);
+        emit(0, "{");
+        emit(1,     "View v;");
+        emit(1,     "v._decodeNoHash(p, 0, maxlen);");
+        emit(1,     "return v;");
+        emit(0, "}");
+        emit(0, "");
+    }
+
+    // T::Decoder support (see zcm/zcm_stream.hpp)
+    int decoderSteps = 0;
+
+    // A size of 'zm', as decoded into 'msg' so far
+    static string decoderDimSize(const string& dimSize)
+    {
+        return dimSizePrefix(dimSize).empty() ? dimSize : "msg." + dimSize;
+    }
+
+    // The element of 'zm' at 'depth', indexed by the loops around it
+    static string decoderElem(const ZCMMember& zm, int depth)
+    {
+        string s = "msg." + zm.membername;
+        for (int i = 0; i < depth; ++i)
+            s += "[this->_a[" + to_string(i) + "]]";
+        return s;
+    }
+
+    // Whether the innermost dimension of 'zm' is decoded in one streamArray()
+    bool decoderBulk(ZCMMember& zm)
+    {
+        return !zm.dimensions.empty() && isPrimitiveNonString(zm) && !soaType(zm);
+    }
+
+    // How many loops decoding 'zm' nests, each needing an index in '_a'
+    int decoderLoops(ZCMMember& zm)
+    {
+        return (int)zm.dimensions.size() - (decoderBulk(zm) ? 1 : 0);
+    }
+
+    // Starts a point _feedNoHash() can stop at for more bytes, and resume at
+    void emitDecoderStep(int indent, int& step)
+    {
+        step = ++decoderSteps;
+        emit(indent, "// fall through");
+        emit(indent - 1, "case %d:", step);
+    }
+
+    void emitDecoderString(int indent, const string& dst)
+    {
+        int step;
+        emitDecoderStep(indent, step);
+        emit(indent, "if (!zcm::streamArray< int32_t, %s >(c, &this->_len, 1, this->_n)) "
+                     "{ this->_step = %d; return 0; }", viewLE(), step);
+        emit(indent, "if (!zcm::streamStringLen(c, this->_len)) return -1;");
+        emit(indent, "%s.resize(this->_len - 1);", dst.c_str());
+        emitDecoderStep(indent, step);
+        emit(indent, "if (!zcm::streamChars(c, %s, this->_len, this->_n)) "
+                     "{ this->_step = %d; return 0; }", dst.c_str(), step);
+    }
+
+    void emitDecoderMember(ZCMMember& zm, int depth, int indent)
+    {
+        auto& mtn = zm.type.fullname;
+        auto* mn = zm.membername.c_str();
+        string elem = decoderElem(zm, depth);
+        int ndims = (int)zm.dimensions.size();
+        int step;
+
+        if (depth == ndims) {
+            if (mtn == "string") {
+                emitDecoderString(indent, elem);
+            } else if (ZCMGen::isPrimitiveType(mtn)) {
+                emitDecoderStep(indent, step);
+                emit(indent, "if (!zcm::streamArray< %s, %s >(c, &%s, 1, this->_n)) "
+                             "{ this->_step = %d; return 0; }",
+                             mapTypeName(mtn).c_str(), viewLE(), elem.c_str(), step);
+            } else {
+                emit(indent, "if (!this->_d_%s) this->_d_%s.reset(new %s::Decoder(%s));",
+                             mn, mn, mapTypeName(mtn).c_str(), elem.c_str());
+                emit(indent, "else this->_d_%s->_begin(%s);", mn, elem.c_str());
+                emitDecoderStep(indent, step);
+                emit(indent, "thislen = this->_d_%s->_feedNoHash(c);", mn);
+                emit(indent, "if (thislen <= 0) { this->_step = %d; return thislen; }", step);
+            }
+            return;
+        }
+
+        auto& dim = zm.dimensions[depth];
+        string n = decoderDimSize(dim.size);
+        const char* ns = n.c_str();
+        bool bulk = depth + 1 == ndims && decoderBulk(zm);
+        if (inlineCapacity(zm)) {
+            emit(indent, "if (!%s.fits(%s)) return -1;", elem.c_str(), ns);
+        } else if (!zm.isConstantSizeArray()) {
+            if (bulk)
+                // all of the elements have to be in the message: no allocating
+                // for more, whatever the size decoded says
+                emit(indent, "if (%s < 0 || (uint64_t) %s * %zu > c.left) return -1;",
+                             ns, ns, ZCMGen::getPrimitiveTypeSize(mtn));
+            else
+                emit(indent, "if (%s < 0) return -1;", ns);
+        }
+        const ZCMStruct* soa = soaType(zm);
+        if (isStringList(zm)) {
+            emit(indent, "%s.clear();", elem.c_str());
+        } else if (soa) {
+            for (auto& em : soa->members)
+                emit(indent, "%s.%s.resize(%s);", elem.c_str(), em.membername.c_str(), ns);
+        } else if (!zm.isConstantSizeArray()) {
+            emit(indent, "%s.resize(%s);", elem.c_str(), ns);
+        }
+
+        if (bulk) {
+            emitDecoderStep(indent, step);
+            emit(indent, "if (!zcm::streamArray< %s, %s >(c, %s%s, (uint32_t) %s, this->_n)) "
+                         "{ this->_step = %d; return 0; }",
+                         mapTypeName(mtn).c_str(), viewLE(), elem.c_str(),
+                         zm.isConstantSizeArray() ? "" : ".data()", ns, step);
+            return;
+        }
+
+        emit(indent, "for (this->_a[%d] = 0; this->_a[%d] < %s; ++this->_a[%d]) {",
+                     depth, depth, ns, depth);
+        if (isStringList(zm)) {
+            emitDecoderString(indent + 1, "this->_str");
+            emit(indent + 1, "%s.push_back(this->_str);", elem.c_str());
+        } else if (soa) {
+            for (auto& em : soa->members) {
+                emitDecoderStep(indent + 1, step);
+                emit(indent + 1, "if (!zcm::streamArray< %s, %s >(c, &%s.%s[this->_a[0]], 1, this->_n)) "
+                                 "{ this->_step = %d; return 0; }",
+                                 mapTypeName(em.type.fullname).c_str(), viewLE(),
+                                 elem.c_str(), em.membername.c_str(), step);
+            }
+        } else {
+            emitDecoderMember(zm, depth + 1, indent + 1);
+        }
+        emit(indent, "}");
+    }
+
+    void emitDecoder()
+    {
+        const char* sn = zs.structname.shortname.c_str();
+        int loops = 0;
+        bool hasNested = false, hasList = false;
+        for (auto& zm : zs.members) {
+            loops = std::max(loops, decoderLoops(zm));
+            if (!ZCMGen::isPrimitiveType(zm.type.fullname) && !soaType(zm)) hasNested = true;
+            if (isStringList(zm)) hasList = true;
+        }
+
+        emit(0, "#if __cplusplus > 199711L /* if c++11 */");
+        emit(0, "/**");
+        emit(0, " * Decodes a %s from its encoding fed a piece at a time, for instance as", sn);
+        emit(0, " * it is read from a socket or a file, resuming each time where the last piece");
+        emit(0, " * left off. The pieces are decoded as they come, straight into the message:");
+        emit(0, " * the whole encoding needn't ever be in memory. See zcm/zcm_stream.hpp");
+        emit(0, " */");
+        emit(0, "class %s::Decoder", sn);
+        emit(0, "{");
+        emit(1, "public:");
+        emit(2, "/**");
+        emit(2, " * Decode into @p msg, which must outlive the decoder, from an encoding");
+        emit(2, " * taking at most @p maxlen bytes.");
+        emit(2, " */");
+        emit(2, "Decoder(%s& msg, uint32_t maxlen = UINT32_MAX) { this->reset(msg, maxlen); }", sn);
+        emit(0, "");
+        emit(2, "// Start decoding another message, as a new decoder would");
+        emit(2, "inline void reset(%s& msg, uint32_t maxlen = UINT32_MAX);", sn);
+        emit(0, "");
+        emit(2, "/**");
+        emit(2, " * Decode the next piece of the encoding.");
+        emit(2, " *");
+        emit(2, " * @return The number of bytes of @p buf used, all of them until the");
+        emit(2, " *         message is done, or <0 if the encoding is invalid: nothing");
+        emit(2, " *         more can be decoded until reset().");
+        emit(2, " */");
+        emit(2, "inline int feed(const void* buf, uint32_t len);");
+        emit(0, "");
+        emit(2, "// Whether the message is fully decoded");
+        emit(2, "bool done() const { return this->_step < 0; }");
+        emit(0, "");
+        emit(2, "// ZCM support functions. Users should not call these");
+        emit(2, "inline void _begin(%s& msg);", sn);
+        emit(2, "inline int  _feedNoHash(zcm::StreamCursor& c);");
+        emit(0, "");
+        emit(1, "private:");
+        emit(2, "%s* _msg;", sn);
+        emit(2, "int _step;");
+        emit(2, "uint32_t _n;");
+        emit(2, "int32_t _len;");
+        emit(2, "int64_t _hash;");
+        emit(2, "uint32_t _left;");
+        emit(2, "bool _hashed;");
+        emit(2, "bool _failed;");
+        if (loops > 0)
+            emit(2, "int _a[%d];", loops);
+        if (hasList)
+            emit(2, "std::string _str;");
+        // Made when first needed, as a type may hold itself
+        for (auto& zm : zs.members)
+            if (!ZCMGen::isPrimitiveType(zm.type.fullname) && !soaType(zm))
+                emit(2, "std::unique_ptr< %s::Decoder > _d_%s;",
+                        mapTypeName(zm.type.fullname).c_str(), zm.membername.c_str());
+        emit(0, "};");
+        emit(0, "");
+
+        emit(0, "void %s::Decoder::reset(%s& msg, uint32_t maxlen)", sn, sn);
+        emit(0, "{");
+        emit(1,     "this->_begin(msg);");
+        emit(1,     "this->_left = maxlen;");
+        emit(1,     "this->_hashed = false;");
+        emit(1,     "this->_failed = false;");
+        emit(0, "}");
+        emit(0, "");
+
+        emit(0, "int %s::Decoder::feed(const void* buf, uint32_t len)", sn);
+        emit(0, "{");
+        emit(1,     "if (this->_failed) return -1;");
+        emit(1,     "zcm::StreamCursor c;");
+        emit(1,     "c.p = (const uint8_t*)buf;");
+        emit(1,     "c.len = len < this->_left ? len : this->_left;");
+        emit(1,     "c.left = this->_left;");
+        emit(1,     "int thislen = 1;");
+        emit(1,     "if (!this->_hashed) {");
+        emit(2,         "if (!zcm::streamArray< int64_t, %s >(c, &this->_hash, 1, this->_n))", viewLE());
+        emit(3,             "thislen = 0;");
+        emit(2,         "else if (this->_hash != %s::getHash())", sn);
+        emit(3,             "thislen = -1;");
+        emit(2,         "else");
+        emit(3,             "this->_hashed = true;");
+        emit(1,     "}");
+        emit(1,     "if (this->_hashed)");
+        emit(2,         "thislen = this->_feedNoHash(c);");
+        emit(1,     "// out of bytes before the end of the message");
+        emit(1,     "if (thislen == 0 && c.left == 0) thislen = -1;");
+        emit(1,     "if (thislen < 0) {");
+        emit(2,         "this->_failed = true;");
+        emit(2,         "return thislen;");
+        emit(1,     "}");
+        emit(1,     "this->_left = c.left;");
+        emit(1,     "return (int)(c.p - (const uint8_t*)buf);");
+        emit(0, "}");
+        emit(0, "");
+
+        emit(0, "void %s::Decoder::_begin(%s& msg)", sn, sn);
+        emit(0, "{");
+        emit(1,     "this->_msg = &msg;");
+        emit(1,     "this->_step = 0;");
+        emit(1,     "this->_n = 0;");
+        emit(0, "}");
+        emit(0, "");
+
+        emit(0, "int %s::Decoder::_feedNoHash(zcm::StreamCursor& c)", sn);
+        emit(0, "{");
+        if (zs.members.empty()) {
+            emit(1, "(void)c;");
+        } else {
+            emit(1, "%s& msg = *this->_msg;", sn);
+            if (hasNested)
+                emit(1, "int thislen;");
+            emit(0, "");
+            decoderSteps = 0;
+            emit(1, "switch (this->_step) {");
+            emit(1, "case 0:");
+            for (auto& zm : zs.members)
+                emitDecoderMember(zm, 0, 2);
+            emit(1, "}");
+        }
+        emit(1,     "this->_step = -1;");
+        emit(1,     "return 1;");
+        emit(0, "}");
+        emit(0, "#endif");
+        emit(0, "");
     }
 
     void emitHeader()
     {
         emitHeaderStart();
+        emitViewClass();
         emitEncode();
         emitDecode();
         emitEncodedSize();
         emitGetHash();
         emitGetTypeName();
+        emitVisit();
         emitEncodeNohash();
         emitDecodeNohash();
         emitEncodedSizeNohash();
+        emitFixedEncodedSizeNohash();
         emitComputeHash();
+        emitViewMethods();
+        emitDecoder();
         emitHeaderEnd();
     }
 };
 
+}
+
+// <package>/package.hpp: every type of the package, as a zcm::MsgTypes list (see
+// zcm/zcm_dispatch.hpp). zcm-gen usually runs once per .zcm file, so the types
+// an existing one lists are kept, as for the __init__.py of python packages
+static int emitPackageTypes(ZCMGen& zcm, const string& package,
+                            const vector<const ZCMStruct*>& structs)
+{
+    string hpath = zcm.gopt->getString("cpp-hpath");
+    string fname = hpath + (hpath.size() > 0 ? "/" : "") + dotsToSlashes(package) + "/package.hpp";
+
+    vector<string> types;
+    bool regenerate = !FileUtil::exists(fname);
+    if (FILE* f = fopen(fname.c_str(), "r")) {
+        bool inList = false;
+        char buf[4096];
+        while (fgets(buf, sizeof(buf), f)) {
+            buf[strcspn(buf, "\r\n")] = '\0';
+            string line = StringUtil::strip(buf);
+            if (line == "typedef zcm::MsgTypes<") { inList = true; continue; }
+            if (!inList) continue;
+            if (line == "> Types;") break;
+            if (!line.empty() && line.back() == ',') line.pop_back();
+            types.push_back(line);
+        }
+        fclose(f);
+    }
+    for (auto* zs : structs) {
+        const string& sn = zs->structname.shortname;
+        if (std::find(types.begin(), types.end(), sn) == types.end()) {
+            types.push_back(sn);
+            regenerate = true;
+        }
+        if (zcm.needsGeneration(zs->zcmfile, fname)) regenerate = true;
+    }
+    if (!regenerate) return 0;
+
+    FileUtil::makeDirsForFile(fname);
+    Emitter E{fname};
+    if (!E.good())
+        return -1;
+
+    string guard = "__" + dotsToUnderscores(package) + "_package_hpp__";
+    E.emit(0, "/** THIS IS AN AUTOMATICALLY GENERATED FILE.  DO NOT MODIFY");
+    E.emit(0, " * BY HAND!!");
+    E.emit(0, " *");
+    E.emit(0, " * Generated by zcm-gen");
+    E.emit(0, " **/");
+    E.emit(0, "");
+    E.emit(0, "#ifndef %s", guard.c_str());
+    E.emit(0, "#define %s", guard.c_str());
+    E.emit(0, "");
+    E.emit(0, "#include <zcm/zcm_dispatch.hpp>");
+    E.emit(0, "");
+    const string& inc = zcm.gopt->getString("cpp-include");
+    for (auto& t : types)
+        E.emit(0, "#include \"%s%s%s/%s.hpp\"", inc.c_str(), inc.size() > 0 ? "/" : "",
+               dotsToSlashes(package).c_str(), t.c_str());
+    E.emit(0, "");
+
+    auto namespaces = StringUtil::split(package, '.');
+    for (auto& ns : namespaces)
+        E.emit(0, "namespace %s {", ns.c_str());
+    E.emit(0, "");
+    E.emit(0, "/// Every type of the package, for zcm::MsgSwitch<> and ZCM::subscribeMulti<>()");
+    E.emit(0, "typedef zcm::MsgTypes<");
+    for (size_t i = 0; i < types.size(); ++i)
+        E.emit(1, "%s%s", types[i].c_str(), i + 1 < types.size() ? "," : "");
+    E.emit(0, "> Types;");
+    E.emit(0, "");
+    for (size_t i = 0; i < namespaces.size(); ++i)
+        E.emit(0, "}");
+    E.emit(0, "");
+    E.emit(0, "#endif");
+
+    return 0;
+}
+
 int emitCpp(ZCMGen& zcm)
 {
     // iterate through all defined message types
@@ -723,5 +1787,21 @@ int emitCpp(ZCMGen& zcm)
         }
     }
 
+    // Types outside of any package have no namespace to put a list in
+    if (zcm.gopt->getBool("cpp-package-types")) {
+        vector<string> packages;
+        unordered_map<string, vector<const ZCMStruct*>> byPackage;
+        for (auto& zs : zcm.structs) {
+            const string& pkg = zs.structname.package;
+            if (pkg.empty()) continue;
+            auto& structs = byPackage[pkg];
+            if (structs.empty()) packages.push_back(pkg);
+            structs.push_back(&zs);
+        }
+        for (auto& pkg : packages)
+            if (emitPackageTypes(zcm, pkg, byPackage[pkg]))
+                return -1;
+    }
+
     return 0;
 }
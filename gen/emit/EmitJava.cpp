@@ -14,7 +14,7 @@ void setupOptionsJava(GetOpt& gopt)
 {
     gopt.addString(0,   "jpath",     "",         "Java file destination directory");
     gopt.addBool(0,    "jmkdir",     1,         "Make java source directories automatically");
-    gopt.addString(0,   "jdecl",      "implements zcm.zcm.ZCMEncodable", "String added to class declarations");
+    gopt.addString(0,   "jdecl",      "implements zcm.zcm.ZCMBufferEncodable", "String added to class declarations");
     gopt.addString(0,   "jdefaultpkg", "zcmtypes", "Default Java package if ZCM type has no package");
 }
 
@@ -23,9 +23,19 @@ struct PrimInfo
     string storage;
     string decode;
     string encode;
-
-    PrimInfo(const string& storage, const string& decode, const string& encode) :
-        storage(storage), decode(decode), encode(encode) {}
+    // The same, from and into a ByteBuffer 'buf'
+    string bufDecode;
+    string bufEncode;
+    // The view buffer, and element size, that arrays are bulk copied through
+    // (e.g. asShortBuffer()), or "" if arrays are copied element by element
+    string view;
+    int size;
+
+    PrimInfo(const string& storage, const string& decode, const string& encode,
+             const string& bufDecode, const string& bufEncode,
+             const string& view = "", int size = 0) :
+        storage(storage), decode(decode), encode(encode),
+        bufDecode(bufDecode), bufEncode(bufEncode), view(view), size(size) {}
 };
 
 string makeFqn(ZCMGen& zcm, const string& typeName)
@@ -104,47 +114,70 @@ struct TypeTable
         tbl.emplace("byte", PrimInfo{
             "byte",
             "# = ins.readByte();",
-            "outs.writeByte(#);"});
+            "outs.writeByte(#);",
+            "# = buf.get();",
+            "buf.put(#);"});
 
         tbl.emplace("int8_t", PrimInfo{
             "byte",
             "# = ins.readByte();",
-            "outs.writeByte(#);"});
+            "outs.writeByte(#);",
+            "# = buf.get();",
+            "buf.put(#);"});
 
         tbl.emplace("int16_t", PrimInfo{
             "short",
             "# = ins.readShort();",
-            "outs.writeShort(#);"});
+            "outs.writeShort(#);",
+            "# = buf.getShort();",
+            "buf.putShort(#);",
+            "Short", 2});
 
         tbl.emplace("int32_t", PrimInfo{
             "int",
             "# = ins.readInt();",
-            "outs.writeInt(#);"});
+            "outs.writeInt(#);",
+            "# = buf.getInt();",
+            "buf.putInt(#);",
+            "Int", 4});
 
         tbl.emplace("int64_t", PrimInfo{
             "long",
             "# = ins.readLong();",
-            "outs.writeLong(#);"});
+            "outs.writeLong(#);",
+            "# = buf.getLong();",
+            "buf.putLong(#);",
+            "Long", 8});
 
         tbl.emplace("string", PrimInfo{
             "String",
             "__strbuf = new char[ins.readInt()-1]; for (int _i = 0; _i < __strbuf.length; ++_i) __strbuf[_i] = (char) (ins.readByte()&0xff); ins.readByte(); # = new String(__strbuf);",
-            "__strbuf = new char[#.length()]; #.getChars(0, #.length(), __strbuf, 0); outs.writeInt(__strbuf.length+1); for (int _i = 0; _i < __strbuf.length; ++_i) outs.write(__strbuf[_i]); outs.writeByte(0);"});
+            "__strbuf = new char[#.length()]; #.getChars(0, #.length(), __strbuf, 0); outs.writeInt(__strbuf.length+1); for (int _i = 0; _i < __strbuf.length; ++_i) outs.write(__strbuf[_i]); outs.writeByte(0);",
+            "__strbuf = new char[buf.getInt()-1]; for (int _i = 0; _i < __strbuf.length; ++_i) __strbuf[_i] = (char) (buf.get()&0xff); buf.get(); # = new String(__strbuf);",
+            "buf.putInt(#.length()+1); for (int _i = 0; _i < #.length(); ++_i) buf.put((byte) #.charAt(_i)); buf.put((byte) 0);"});
 
         tbl.emplace("boolean", PrimInfo{
             "boolean",
             "# = ins.readByte()!=0;",
-            "outs.writeByte( # ? 1 : 0);"});
+            "outs.writeByte( # ? 1 : 0);",
+            "# = buf.get()!=0;",
+            "buf.put((byte) (# ? 1 : 0));"});
 
         tbl.emplace("float", PrimInfo{
             "float",
             "# = ins.readFloat();",
-            "outs.writeFloat(#);"});
+            "outs.writeFloat(#);",
+            "# = buf.getFloat();",
+            "buf.putFloat(#);",
+            "Float", 4});
 
         tbl.emplace("double", PrimInfo{
             "double",
             "# = ins.readDouble();",
-            "outs.writeDouble(#);"});
+            "outs.writeDouble(#);",
+            "# = buf.getDouble();",
+            "buf.putDouble(#);",
+            "Double", 8});
     }
 
     PrimInfo* find(const string& type)
@@ -167,14 +200,34 @@ struct EmitStruct : public Emitter
     EmitStruct(ZCMGen& zcm, ZCMStruct& zs, const string& fname):
         Emitter(fname), zcm(zcm), zs(zs) {}
 
-    void encodeRecursive(ZCMMember& zm, PrimInfo* pinfo, const string& accessor, int depth)
+    // 'buf' encodes into a ByteBuffer rather than a DataOutput
+    void encodeRecursive(ZCMMember& zm, PrimInfo* pinfo, const string& accessor, int depth,
+                         bool buf)
     {
         int ndims = (int)zm.dimensions.size();
 
         // base case: primitive array
         if (depth+1 == ndims && pinfo != nullptr) {
             string accessorArray = makeAccessorArray(zm, "");
-            if (pinfo->storage == "byte") {
+            if (buf && (pinfo->storage == "byte" || pinfo->view != "")) {
+                auto& dim = zm.dimensions[depth];
+                string n = dimSizePrefix(dim.size) + dim.size;
+                int indent = 2+depth;
+                if (dim.mode == ZCM_VAR) {
+                    emit(indent++, "if (%s > 0) {", n.c_str());
+                }
+                if (pinfo->storage == "byte") {
+                    emit(indent, "buf.put(this.%s, 0, %s);", accessorArray.c_str(), n.c_str());
+                } else {
+                    emit(indent, "buf.as%sBuffer().put(this.%s, 0, %s);",
+                         pinfo->view.c_str(), accessorArray.c_str(), n.c_str());
+                    emit(indent, "buf.position(buf.position() + %s * %d);", n.c_str(), pinfo->size);
+                }
+                if (dim.mode == ZCM_VAR)
+                    emit(2+depth, "}");
+                return;
+            }
+            if (!buf && pinfo->storage == "byte") {
                 auto& dim = zm.dimensions[depth];
                 if (dim.mode == ZCM_VAR) {
                     emit(2+depth, "if (this.%s > 0)", dim.size.c_str());
@@ -190,9 +243,12 @@ struct EmitStruct : public Emitter
         if (depth == ndims) {
             emitStart(2 + ndims, "");
             if (pinfo != NULL)
-                emitContinue("%s", specialReplace(pinfo->encode, accessor).c_str());
+                emitContinue("%s", specialReplace(buf ? pinfo->bufEncode : pinfo->encode,
+                                                  accessor).c_str());
             else
-                emitContinue("%s", specialReplace("#._encodeRecursive(outs);", accessor).c_str());
+                emitContinue("%s", specialReplace(buf ? "#._encodeRecursive(buf);"
+                                                      : "#._encodeRecursive(outs);",
+                                                  accessor).c_str());
             emitEnd(" ");
 
             return;
@@ -202,12 +258,14 @@ struct EmitStruct : public Emitter
         emit(2+depth, "for (int %c = 0; %c < %s%s; ++%c) {",
              'a'+depth, 'a'+depth, dimSizePrefix(dim.size).c_str(), dim.size.c_str(), 'a'+depth);
 
-        encodeRecursive(zm, pinfo, accessor, depth+1);
+        encodeRecursive(zm, pinfo, accessor, depth+1, buf);
 
         emit(2+depth, "}");
     }
 
-    void decodeRecursive(ZCMMember& zm, PrimInfo* pinfo, const string& accessor, int depth)
+    // 'buf' decodes from a ByteBuffer rather than a DataInput
+    void decodeRecursive(ZCMMember& zm, PrimInfo* pinfo, const string& accessor, int depth,
+                         bool buf)
     {
         int ndims = (int)zm.dimensions.size();
 
@@ -215,8 +273,22 @@ struct EmitStruct : public Emitter
         if (depth+1 == ndims && pinfo != nullptr) {
             string accessorArray = makeAccessorArray(zm, "");
 
+            // bulk copies out of the buffer
+            if (buf && (pinfo->storage == "byte" || pinfo->view != "")) {
+                auto& dim = zm.dimensions[depth];
+                string n = dimSizePrefix(dim.size) + dim.size;
+                if (pinfo->storage == "byte") {
+                    emit(2+depth, "buf.get(this.%s, 0, %s);", accessorArray.c_str(), n.c_str());
+                } else {
+                    emit(2+depth, "buf.as%sBuffer().get(this.%s, 0, %s);",
+                         pinfo->view.c_str(), accessorArray.c_str(), n.c_str());
+                    emit(2+depth, "buf.position(buf.position() + %s * %d);", n.c_str(), pinfo->size);
+                }
+                return;
+            }
+
             // byte array
-            if (pinfo->storage == "byte") {
+            if (!buf && pinfo->storage == "byte") {
                 auto& dim = zm.dimensions[depth];
                 emitStart(2+depth, "ins.readFully(this.%s, 0, %s);", accessorArray.c_str(), dim.size.c_str());
                 return;
@@ -227,9 +299,18 @@ struct EmitStruct : public Emitter
         if (depth == ndims) {
             emitStart(2 + ndims,"");
             if (pinfo)
-                emitContinue("%s", specialReplace(pinfo->decode, accessor).c_str());
-            else {
-                emitContinue("%s = %s._decodeRecursiveFactory(ins);", accessor.c_str(), makeFqn(zcm, zm.type.fullname).c_str());
+                emitContinue("%s", specialReplace(buf ? pinfo->bufDecode : pinfo->decode,
+                                                  accessor).c_str());
+            else if (buf) {
+                // decoding into the objects already there, if any
+                emitContinue("if (%s == null)", accessor.c_str());
+                emitEnd("");
+                emit(3 + ndims, "%s = new %s();", accessor.c_str(),
+                     makeFqn(zcm, zm.type.fullname).c_str());
+                emitStart(2 + ndims, "%s._decodeRecursive(buf);", accessor.c_str());
+            } else {
+                emitContinue("%s = %s._decodeRecursiveFactory(ins);", accessor.c_str(),
+                             makeFqn(zcm, zm.type.fullname).c_str());
             }
             emitEnd("");
             return;
@@ -239,7 +320,7 @@ struct EmitStruct : public Emitter
         emit(2+depth, "for (int %c = 0; %c < %s%s; ++%c) {",
              'a'+depth, 'a'+depth, dimSizePrefix(dim.size).c_str(), dim.size.c_str(), 'a'+depth);
 
-        decodeRecursive(zm, pinfo, accessor, depth+1);
+        decodeRecursive(zm, pinfo, accessor, depth+1, buf);
 
         emit(2+depth, "}");
     }
@@ -303,6 +384,60 @@ struct EmitStruct : public Emitter
         emit(2+depth, "}");
     }
 
+    // Decoding from a buffer reuses the arrays already there when they're the
+    // sizes decoded, so that decodeFrom() allocates nothing in steady state
+    void emitDecodeRecursive(bool buf)
+    {
+        emit(1, "public void _decodeRecursive(%s) throws IOException",
+             buf ? "ByteBuffer buf" : "DataInput ins");
+        emit(1,"{");
+        if (structHasStringMember(zs))
+            emit(2, "char[] __strbuf = null;");
+
+        for (auto& zm : zs.members) {
+            PrimInfo* pinfo = typeTable.find(zm.type.fullname);
+            string accessor = makeAccessor(zm, "this");
+
+            // allocate an array if necessary
+            if (zm.dimensions.size() > 0) {
+
+                if (buf) {
+                    string arr = "this." + zm.membername;
+                    emitStart(2, "if (%s == null || %s.length != (int) %s",
+                              arr.c_str(), arr.c_str(), zm.dimensions[0].size.c_str());
+                    string nonEmpty;
+                    for (size_t d = 1; d < zm.dimensions.size(); ++d) {
+                        nonEmpty += "(int) " + zm.dimensions[d-1].size + " > 0 && ";
+                        arr += "[0]";
+                        emitContinue(" ||");
+                        emitEnd("");
+                        emitStart(4, "(%s%s.length != (int) %s)", nonEmpty.c_str(),
+                                  arr.c_str(), zm.dimensions[d].size.c_str());
+                    }
+                    emitEnd(")");
+                    emitStart(3, "this.%s = new ", zm.membername.c_str());
+                } else {
+                    emitStart(2, "this.%s = new ", zm.membername.c_str());
+                }
+
+                if (pinfo)
+                    emitContinue("%s", pinfo->storage.c_str());
+                else
+                    emitContinue("%s", makeFqn(zcm, zm.type.fullname).c_str());
+
+                for (auto& dim : zm.dimensions)
+                    emitContinue("[(int) %s]", dim.size.c_str());
+                emitEnd(";");
+            }
+
+            decodeRecursive(zm, pinfo, accessor, 0, buf);
+            emit(0," ");
+        }
+
+        emit(1,"}");
+        emit(0," ");
+    }
+
     void emitStruct()
     {
         emit(0, "/* ZCM type definition class file");
@@ -323,6 +458,7 @@ struct EmitStruct : public Emitter
         emit(0, "package %s;", package.c_str());
         emit(0, " ");
         emit(0, "import java.io.*;");
+        emit(0, "import java.nio.*;");
         emit(0, "import java.util.*;");
         emit(0, "import zcm.zcm.*;");
         emit(0, " ");
@@ -370,7 +506,12 @@ struct EmitStruct : public Emitter
         emit(1,"}");
         emit(0," ");
 
-        emit(1, "public static final long ZCM_FINGERPRINT;");
+        uint64_t fingerprint;
+        bool known = zcm.computeFingerprint(zs, fingerprint);
+        if (known)
+            emit(1, "public static final long ZCM_FINGERPRINT = 0x%016" PRIx64 "L;", fingerprint);
+        else
+            emit(1, "public static final long ZCM_FINGERPRINT;");
         emit(1, "public static final long ZCM_FINGERPRINT_BASE = 0x%016" PRIx64 "L;", zs.hash);
         emit(0," ");
 
@@ -403,10 +544,12 @@ struct EmitStruct : public Emitter
             emit(0, "");
 
         ///////////////// compute fingerprint //////////////////
-        emit(1, "static {");
-        emit(2, "ZCM_FINGERPRINT = _hashRecursive(new ArrayList<Class<?>>());");
-        emit(1, "}");
-        emit(0, " ");
+        if (!known) {
+            emit(1, "static {");
+            emit(2, "ZCM_FINGERPRINT = _hashRecursive(new ArrayList<Class<?>>());");
+            emit(1, "}");
+            emit(0, " ");
+        }
 
         emit(1, "public static long _hashRecursive(ArrayList<Class<?>> classes)");
         emit(1, "{");
@@ -447,7 +590,28 @@ struct EmitStruct : public Emitter
         for (auto& zm : zs.members) {
             PrimInfo* pinfo = typeTable.find(zm.type.fullname);
             string accessor = makeAccessor(zm, "this");
-            encodeRecursive(zm, pinfo, accessor, 0);
+            encodeRecursive(zm, pinfo, accessor, 0, false);
+            emit(0," ");
+        }
+        emit(1,"}");
+        emit(0," ");
+
+        // encoding straight into a (typically direct) ByteBuffer, at its
+        // position, which is left after the message
+        emit(1,"public void encode(ByteBuffer buf)");
+        emit(1,"{");
+        emit(2,"buf.order(ByteOrder.BIG_ENDIAN);");
+        emit(2,"buf.putLong(ZCM_FINGERPRINT);");
+        emit(2,"_encodeRecursive(buf);");
+        emit(1,"}");
+        emit(0," ");
+
+        emit(1,"public void _encodeRecursive(ByteBuffer buf)");
+        emit(1,"{");
+        for (auto& zm : zs.members) {
+            PrimInfo* pinfo = typeTable.find(zm.type.fullname);
+            string accessor = makeAccessor(zm, "this");
+            encodeRecursive(zm, pinfo, accessor, 0, true);
             emit(0," ");
         }
         emit(1,"}");
@@ -472,6 +636,36 @@ struct EmitStruct : public Emitter
         emit(2,"_decodeRecursive(ins);");
         emit(1,"}");
         emit(0," ");
+        emit(1,"public %s(ByteBuffer buf) throws IOException", sn);
+        emit(1,"{");
+        emit(2,"decodeFrom(buf);");
+        emit(1,"}");
+        emit(0," ");
+
+        // decoding into an existing object, reusing its arrays (and the
+        // objects in them) when they're the sizes decoded
+        emit(1,"public static %s decodeInto(%s existing, ByteBuffer buf) throws IOException", fqn, fqn);
+        emit(1,"{");
+        emit(2,"if (existing == null)");
+        emit(3,    "existing = new %s();", fqn);
+        emit(2,"existing.decodeFrom(buf);");
+        emit(2,"return existing;");
+        emit(1,"}");
+        emit(0," ");
+
+        emit(1,"public void decodeFrom(ByteBuffer buf) throws IOException");
+        emit(1,"{");
+        emit(2,"buf.order(ByteOrder.BIG_ENDIAN);");
+        emit(2,"try {");
+        emit(3,    "if (buf.getLong() != ZCM_FINGERPRINT)");
+        emit(4,        "throw new IOException(\"ZCM Decode error: bad fingerprint\");");
+        emit(0," ");
+        emit(3,    "_decodeRecursive(buf);");
+        emit(2,"} catch (BufferUnderflowException ex) {");
+        emit(3,    "throw new IOException(\"ZCM Decode error: message too short\");");
+        emit(2,"}");
+        emit(1,"}");
+        emit(0," ");
 
         emit(1,"public static %s _decodeRecursiveFactory(DataInput ins) throws IOException", fqn);
         emit(1,"{");
@@ -481,37 +675,16 @@ struct EmitStruct : public Emitter
         emit(1,"}");
         emit(0," ");
 
-        emit(1,"public void _decodeRecursive(DataInput ins) throws IOException");
+        emit(1,"public static %s _decodeRecursiveFactory(ByteBuffer buf) throws IOException", fqn);
         emit(1,"{");
-        if (structHasStringMember(zs))
-            emit(2, "char[] __strbuf = null;");
-
-        for (auto& zm : zs.members) {
-            PrimInfo* pinfo = typeTable.find(zm.type.fullname);
-            string accessor = makeAccessor(zm, "this");
-
-            // allocate an array if necessary
-            if (zm.dimensions.size() > 0) {
-
-                emitStart(2, "this.%s = new ", zm.membername.c_str());
-
-                if (pinfo)
-                    emitContinue("%s", pinfo->storage.c_str());
-                else
-                    emitContinue("%s", makeFqn(zcm, zm.type.fullname).c_str());
-
-                for (auto& dim : zm.dimensions)
-                    emitContinue("[(int) %s]", dim.size.c_str());
-                emitEnd(";");
-            }
-
-            decodeRecursive(zm, pinfo, accessor, 0);
-            emit(0," ");
-        }
-
+        emit(2,"%s o = new %s();", fqn, fqn);
+        emit(2,"o._decodeRecursive(buf);");
+        emit(2,"return o;");
         emit(1,"}");
         emit(0," ");
 
+        emitDecodeRecursive(false);
+        emitDecodeRecursive(true);
 
         ///////////////// copy //////////////////
         string classname = makeFqn(zcm, zs.structname.fullname);
@@ -0,0 +1,763 @@
+#include "Common.hpp"
+#include "GetOpt.hpp"
+#include "ZCMGen.hpp"
+#include "Emitter.hpp"
+#include "util/StringUtil.hpp"
+#include "util/FileUtil.hpp"
+
+#include <map>
+
+// Emits a zcm-log-transcoder plugin migrating the encodings of older versions of the
+// types (--migrate-from) to the ones given, without decoding them: the members a type
+// kept are copied as they are, in runs as long as they go, the hash is patched and the
+// members appended to the type are written with their default (zero) encoding.
+// Members are matched by position, so renaming one changes nothing of the encoding.
+// Types are matched by name; removing, reordering or retyping members of one is left
+// to a hand written TranscoderPlugin
+
+void setupOptionsMigrate(GetOpt& gopt)
+{
+    gopt.addString(0, "migrate-from",  "",      "Comma separated .zcm files of the older versions "
+                                                "of the types, to migrate logs from");
+    gopt.addString(0, "migrate-out",   "MigratePlugin.cpp", "The plugin's source file");
+    gopt.addString(0, "migrate-class", "MigratePlugin",     "The plugin's class name");
+}
+
+static const ZCMStruct* findStruct(const ZCMGen& zcm, const string& fullname)
+{
+    for (auto& zs : zcm.structs)
+        if (zs.structname.fullname == fullname)
+            return &zs;
+    return nullptr;
+}
+
+static int memberIndex(const ZCMStruct& zs, const string& name)
+{
+    for (size_t i = 0; i < zs.members.size(); ++i)
+        if (zs.members[i].membername == name)
+            return (int) i;
+    return -1;
+}
+
+static u64 constDim(const ZCMDimension& dim)
+{
+    return strtoull(dim.size.c_str(), NULL, 0);
+}
+
+static string cType(const string& t)
+{
+    if (t == "boolean") return "int8_t";
+    if (t == "byte")    return "uint8_t";
+    return t;
+}
+
+static u64 byteSwap(u64 v)
+{
+    u64 r = 0;
+    for (int i = 0; i < 8; ++i)
+        r = (r << 8) | ((v >> (8 * i)) & 0xff);
+    return r;
+}
+
+enum Change
+{
+    SAME,         // encodes the same way: copied as is
+    MIGRATABLE,   // members were appended to it, or to a type it nests
+    INCOMPATIBLE,
+};
+
+struct EmitMigrate : public Emitter
+{
+    ZCMGen& nu;
+    ZCMGen& old;
+    bool littleEndian;
+
+    // Of the types in both, by name
+    std::map<string, Change> changes;
+    std::map<string, string> whyIncompatible;
+
+    vector<const ZCMStruct*> skipped;  // old types walked over
+    vector<const ZCMStruct*> migrated; // old types walked and migrated
+
+    EmitMigrate(ZCMGen& nu, ZCMGen& old, const string& fname) :
+        Emitter(fname), nu(nu), old(old),
+        littleEndian(nu.gopt->getBool("little-endian-encoding")) {}
+
+    const char* endianSuffix() { return littleEndian ? "_little_endian" : ""; }
+
+    string sn(const ZCMStruct& zs) { return zs.structname.nameUnderscore(); }
+
+    bool sameDims(const ZCMStruct& os, const ZCMMember& om,
+                  const ZCMStruct& ns, const ZCMMember& nm)
+    {
+        if (om.dimensions.size() != nm.dimensions.size())
+            return false;
+        for (size_t d = 0; d < om.dimensions.size(); ++d) {
+            auto& od = om.dimensions[d];
+            auto& nd = nm.dimensions[d];
+            if (od.mode != nd.mode)
+                return false;
+            if (od.mode == ZCM_CONST ? constDim(od) != constDim(nd)
+                                     : memberIndex(os, od.size) != memberIndex(ns, nd.size))
+                return false;
+        }
+        return true;
+    }
+
+    // What became of 'os' in 'ns', from what is known so far of the types they nest
+    Change classify(const ZCMStruct& os, const ZCMStruct& ns, string& why)
+    {
+        if (ns.members.size() < os.members.size()) {
+            why = "members were removed";
+            return INCOMPATIBLE;
+        }
+        Change c = ns.members.size() > os.members.size() ? MIGRATABLE : SAME;
+        for (size_t i = 0; i < os.members.size(); ++i) {
+            auto& om = os.members[i];
+            auto& nm = ns.members[i];
+            if (om.type.fullname != nm.type.fullname || !sameDims(os, om, ns, nm)) {
+                why = "member " + nm.membername + " isn't " + om.membername + " retyped or renamed";
+                return INCOMPATIBLE;
+            }
+            if (ZCMGen::isPrimitiveType(om.type.fullname))
+                continue;
+            auto it = changes.find(om.type.fullname);
+            if (it == changes.end() || it->second == INCOMPATIBLE) {
+                why = "member " + nm.membername + " is of a type that can't be migrated";
+                return INCOMPATIBLE;
+            }
+            if (it->second == MIGRATABLE)
+                c = MIGRATABLE;
+        }
+        for (size_t i = os.members.size(); i < ns.members.size(); ++i) {
+            auto& nm = ns.members[i];
+            if (!ZCMGen::isPrimitiveType(nm.type.fullname) && !findStruct(nu, nm.type.fullname)) {
+                why = "member " + nm.membername + " is of a type not declared";
+                return INCOMPATIBLE;
+            }
+        }
+        return c;
+    }
+
+    // Until nothing changes: types nested in themselves are known once their members are
+    void classifyAll()
+    {
+        for (auto& os : old.structs)
+            if (findStruct(nu, os.structname.fullname))
+                changes[os.structname.fullname] = SAME;
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto& c : changes) {
+                string why;
+                Change now = classify(*findStruct(old, c.first), *findStruct(nu, c.first), why);
+                if (now > c.second) {
+                    c.second = now;
+                    if (now == INCOMPATIBLE)
+                        whyIncompatible[c.first] = why;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // The bytes an old 'zs' always encodes to, if it does
+    bool fixedSize(const ZCMStruct& zs, u64& size, vector<const ZCMStruct*>& parents)
+    {
+        if (std::find(parents.begin(), parents.end(), &zs) != parents.end())
+            return false;
+        parents.push_back(&zs);
+        u64 total = 0;
+        for (auto& zm : zs.members) {
+            u64 elt;
+            if (!memberFixedSize(zm, elt, parents))
+                return false;
+            total += elt;
+        }
+        parents.pop_back();
+        size = total;
+        return true;
+    }
+
+    bool memberFixedSize(const ZCMMember& zm, u64& size, vector<const ZCMStruct*>& parents)
+    {
+        if (!elementFixedSize(zm, size, parents))
+            return false;
+        for (auto& dim : zm.dimensions) {
+            if (dim.mode != ZCM_CONST)
+                return false;
+            size *= constDim(dim);
+        }
+        return true;
+    }
+
+    bool elementFixedSize(const ZCMMember& zm, u64& size, vector<const ZCMStruct*>& parents)
+    {
+        if (zm.type.fullname == "string")
+            return false;
+        if (ZCMGen::isPrimitiveType(zm.type.fullname)) {
+            size = ZCMGen::getPrimitiveTypeSize(zm.type.fullname);
+            return true;
+        }
+        const ZCMStruct* sub = findStruct(old, zm.type.fullname);
+        return sub && fixedSize(*sub, size, parents);
+    }
+
+    bool elementFixedSize(const ZCMMember& zm, u64& size)
+    {
+        vector<const ZCMStruct*> parents;
+        return elementFixedSize(zm, size, parents);
+    }
+
+    // What a new 'zs' encodes to when every member is zero, empty or has no
+    // elements: variable dimensions are members of the type, so they are 0
+    void defaultEncoding(const ZCMStruct& zs, vector<u8>& out)
+    {
+        for (auto& zm : zs.members) {
+            u64 n = 1;
+            for (auto& dim : zm.dimensions)
+                n *= dim.mode == ZCM_CONST ? constDim(dim) : 0;
+            vector<u8> elt;
+            defaultElement(zm, elt);
+            for (u64 k = 0; k < n; ++k)
+                out.insert(out.end(), elt.begin(), elt.end());
+        }
+    }
+
+    void defaultElement(const ZCMMember& zm, vector<u8>& out)
+    {
+        if (zm.type.fullname == "string") {
+            // The length, with the \0, then the \0
+            vector<u8> len = { 0, 0, 0, 1 };
+            if (littleEndian)
+                std::reverse(len.begin(), len.end());
+            out.insert(out.end(), len.begin(), len.end());
+            out.push_back(0);
+        } else if (ZCMGen::isPrimitiveType(zm.type.fullname)) {
+            out.resize(out.size() + ZCMGen::getPrimitiveTypeSize(zm.type.fullname), 0);
+        } else {
+            defaultEncoding(*findStruct(nu, zm.type.fullname), out);
+        }
+    }
+
+    // Adds the old types walked through to migrate 'os' to 'skipped' and 'migrated'
+    void collect(const ZCMStruct& os)
+    {
+        auto& list = changes[os.structname.fullname] == MIGRATABLE ? migrated : skipped;
+        if (std::find(list.begin(), list.end(), &os) != list.end())
+            return;
+        list.push_back(&os);
+        for (auto& om : os.members) {
+            if (ZCMGen::isPrimitiveType(om.type.fullname))
+                continue;
+            u64 size = 0;
+            if (changes[om.type.fullname] == SAME && elementFixedSize(om, size))
+                continue;
+            collect(*findStruct(old, om.type.fullname));
+        }
+    }
+
+    void emitBytes(const string& name, const vector<u8>& bytes)
+    {
+        if (bytes.empty()) {
+            emit(0, "static const uint8_t* const %s = nullptr;", name.c_str());
+            return;
+        }
+        emit(0, "static const uint8_t %s[%zu] = {", name.c_str(), bytes.size());
+        for (size_t i = 0; i < bytes.size(); i += 16) {
+            emitStart(1, "");
+            for (size_t j = i; j < bytes.size() && j < i + 16; ++j)
+                emitContinue("0x%02x,", bytes[j]);
+            emitEnd("");
+        }
+        emit(0, "};");
+    }
+
+    void emitHelpers()
+    {
+        const char* le = endianSuffix();
+        emit(0, "// n *= d, false if d is negative or n goes over max");
+        emit(0, "static inline bool mul(uint64_t& n, int64_t d, uint64_t max)");
+        emit(0, "{");
+        emit(1, "if (d < 0 || (d != 0 && n > max / (uint64_t) d)) return false;");
+        emit(1, "n *= (uint64_t) d;");
+        emit(1, "return true;");
+        emit(0, "}");
+        emit(0, "");
+        emit(0, "static inline bool skipString(const uint8_t* buf, uint32_t len, uint32_t& pos)");
+        emit(0, "{");
+        emit(1, "int32_t n;");
+        emit(1, "int r = __int32_t_decode%s_array(buf, pos, len - pos, &n, 1);", le);
+        emit(1, "if (r < 0 || n < 0 || (uint32_t) n > len - pos - r) return false;");
+        emit(1, "pos += r + n;");
+        emit(1, "return true;");
+        emit(0, "}");
+        emit(0, "");
+        emit(0, "// Where a message is migrated to: the buffer only grows, by doubling, so the");
+        emit(0, "// appends to it are plain copies");
+        emit(0, "struct Out");
+        emit(0, "{");
+        emit(1, "std::vector<uint8_t>& buf;");
+        emit(1, "size_t n;");
+        emit(0, "");
+        emit(1, "uint8_t* take(size_t k)");
+        emit(1, "{");
+        emit(2, "if (n + k > buf.size()) buf.resize(std::max(buf.size() * 2, n + k));");
+        emit(2, "uint8_t* p = buf.data() + n;");
+        emit(2, "n += k;");
+        emit(2, "return p;");
+        emit(1, "}");
+        emit(0, "");
+        emit(1, "void append(const uint8_t* p, size_t k) { if (k) memcpy(take(k), p, k); }");
+        emit(1, "void appendZeros(uint64_t k) { if (k) memset(take(k), 0, k); }");
+        emit(1, "void appendCopies(const uint8_t* elt, uint32_t size, uint64_t k)");
+        emit(1, "{");
+        emit(2, "uint8_t* p = take(size * k);");
+        emit(2, "for (uint64_t i = 0; i < k; ++i, p += size) memcpy(p, elt, size);");
+        emit(1, "}");
+        emit(0, "};");
+        emit(0, "");
+    }
+
+    // What the members appended to 'ns' default to, in the order they encode:
+    // runs of constant bytes, and the members whose counts are members 'os' had
+    struct Segment
+    {
+        vector<u8> bytes;   // all of them, or of one element if 'dims' isn't empty
+        u64 constN = 1;     // elements, of the constant dimensions
+        vector<int> dims;   // the members giving the others
+        string name;        // of the array holding 'bytes', if they aren't all 0
+    };
+
+    vector<Segment> appendedSegments(const ZCMStruct& os, const ZCMStruct& ns)
+    {
+        vector<Segment> segs;
+        size_t oldN = os.members.size();
+        for (size_t j = oldN; j < ns.members.size(); ++j) {
+            auto& nm = ns.members[j];
+            Segment s;
+            for (auto& dim : nm.dimensions) {
+                int idx = dim.mode == ZCM_VAR ? memberIndex(ns, dim.size) : -1;
+                if (dim.mode == ZCM_CONST) s.constN *= constDim(dim);
+                else if (idx >= 0 && (size_t) idx < oldN) s.dims.push_back(idx);
+                else s.constN = 0; // an appended member: 0 by default
+            }
+            if (s.constN == 0)
+                continue;
+
+            vector<u8> elt;
+            defaultElement(nm, elt);
+            if (elt.empty())
+                continue;
+            if (!s.dims.empty()) {
+                s.bytes = elt;
+                s.name = "DEFAULT_" + sn(ns) + "_" + nm.membername;
+                segs.push_back(std::move(s));
+                continue;
+            }
+            if (segs.empty() || !segs.back().dims.empty()) {
+                segs.push_back(Segment());
+                segs.back().name = "APPEND_" + sn(ns) + "_" + nm.membername;
+            }
+            for (u64 k = 0; k < s.constN; ++k)
+                segs.back().bytes.insert(segs.back().bytes.end(), elt.begin(), elt.end());
+        }
+        for (auto& s : segs)
+            if (std::all_of(s.bytes.begin(), s.bytes.end(), [](u8 b) { return b == 0; }))
+                s.name = "";
+        return segs;
+    }
+
+    // The walk over an encoded 'os' from 'pos', to skip it or, given 'ns', to
+    // migrate it into 'out'
+    void emitWalker(const ZCMStruct& os, const ZCMStruct* ns)
+    {
+        const char* le = endianSuffix();
+        string name = sn(os);
+        size_t oldN = os.members.size();
+
+        // The members read for the dimensions they are of others
+        vector<bool> needed(oldN, false);
+        for (auto& om : os.members)
+            for (auto& dim : om.dimensions)
+                if (dim.mode == ZCM_VAR)
+                    needed[memberIndex(os, dim.size)] = true;
+        vector<Segment> segs;
+        if (ns) {
+            segs = appendedSegments(os, *ns);
+            for (auto& s : segs)
+                for (int idx : s.dims)
+                    needed[idx] = true;
+        }
+
+        if (ns) {
+            emit(0, "static bool migrate_%s(const uint8_t* buf, uint32_t len, uint32_t& pos,",
+                    name.c_str());
+            emit(0, "%*s Out& out)", (int) (20 + name.size()), "");
+        } else {
+            emit(0, "static bool skip_%s(const uint8_t* buf, uint32_t len, uint32_t& pos)",
+                    name.c_str());
+        }
+        emit(0, "{");
+        if (oldN == 0)
+            emit(1, "(void) buf; (void) len; (void) pos;");
+        if (ns)
+            emit(1, "uint32_t run = pos;");
+
+        // Fixed size members in a row are stepped over at once
+        u64 fixed = 0;
+        auto flushFixed = [&]() {
+            if (fixed == 0)
+                return;
+            emit(1, "if (len - pos < %" PRIu64 ") return false;", fixed);
+            emit(1, "pos += %" PRIu64 ";", fixed);
+            fixed = 0;
+        };
+
+        for (size_t i = 0; i < oldN; ++i) {
+            auto& om = os.members[i];
+            auto* mn = om.membername.c_str();
+            const string& tn = om.type.fullname;
+            string tu = StringUtil::dotsToUnderscores(tn);
+            u64 size = 0;
+
+            if (needed[i]) {
+                flushFixed();
+                string ct = cType(tn);
+                emit(1, "int64_t d%zu; // %s", i, mn);
+                emit(1, "{");
+                emit(2, "%s v;", ct.c_str());
+                emit(2, "int r = __%s_decode%s_array(buf, pos, len - pos, &v, 1);", tn.c_str(), le);
+                emit(2, "if (r < 0) return false;");
+                emit(2, "pos += r;");
+                emit(2, "d%zu = v;", i);
+                emit(1, "}");
+                continue;
+            }
+
+            bool eltFixed = elementFixedSize(om, size);
+            bool constCount = true;
+            u64 constN = 1;
+            for (auto& dim : om.dimensions) {
+                if (dim.mode == ZCM_CONST) constN *= constDim(dim);
+                else constCount = false;
+            }
+            bool changed = !ZCMGen::isPrimitiveType(tn) && changes[tn] == MIGRATABLE;
+
+            if (eltFixed && constCount && !changed) {
+                fixed += size * constN;
+                continue;
+            }
+            flushFixed();
+
+            string call;
+            if (tn == "string") call = "skipString(buf, len, pos)";
+            else if (!changed)  call = "skip_" + tu + "(buf, len, pos)";
+            else                call = "migrate_" + tu + "(buf, len, pos, out)";
+
+            if (om.dimensions.empty()) {
+                if (changed)
+                    emit(1, "out.append(buf + run, pos - run);");
+                emit(1, "if (!%s) return false; // %s", call.c_str(), mn);
+                if (changed)
+                    emit(1, "run = pos;");
+                continue;
+            }
+
+            emit(1, "// %s", mn);
+            emit(1, "{");
+            emit(2, "uint64_t n = %" PRIu64 ";", constN);
+            for (auto& dim : om.dimensions)
+                if (dim.mode == ZCM_VAR)
+                    emit(2, "if (!mul(n, d%d, len)) return false;", memberIndex(os, dim.size));
+            if (eltFixed && !changed) {
+                emit(2, "if (n > (len - pos) / %" PRIu64 ") return false;", size);
+                emit(2, "pos += (uint32_t) (n * %" PRIu64 ");", size);
+            } else {
+                if (changed)
+                    emit(2, "out.append(buf + run, pos - run);");
+                emit(2, "for (uint64_t k = 0; k < n; ++k)");
+                emit(3, "if (!%s) return false;", call.c_str());
+                if (changed)
+                    emit(2, "run = pos;");
+            }
+            emit(1, "}");
+        }
+        flushFixed();
+
+        if (ns) {
+            emit(1, "out.append(buf + run, pos - run);");
+            for (auto& s : segs) {
+                auto* arr = s.name.c_str();
+                if (s.dims.empty()) {
+                    if (s.name.empty())
+                        emit(1, "out.appendZeros(%zu);", s.bytes.size());
+                    else
+                        emit(1, "out.append(%s, sizeof(%s));", arr, arr);
+                    continue;
+                }
+                emit(1, "{");
+                emit(2, "uint64_t n = %" PRIu64 ";", s.constN);
+                for (int idx : s.dims)
+                    emit(2, "if (!mul(n, d%d, UINT32_MAX / %zu)) return false;",
+                            idx, s.bytes.size());
+                if (s.name.empty())
+                    emit(2, "out.appendZeros(n * %zu);", s.bytes.size());
+                else
+                    emit(2, "out.appendCopies(%s, sizeof(%s), n);", arr, arr);
+                emit(1, "}");
+            }
+        }
+        emit(1, "return true;");
+        emit(0, "}");
+        emit(0, "");
+    }
+
+    void emitAppendedDefaults(const ZCMStruct& os, const ZCMStruct& ns)
+    {
+        bool any = false;
+        for (auto& s : appendedSegments(os, ns)) {
+            if (s.name.empty())
+                continue;
+            emitBytes(s.name, s.bytes);
+            any = true;
+        }
+        if (any)
+            emit(0, "");
+    }
+
+    // Whether migrating 'os' to 'ns' only takes appending bytes that don't
+    // depend on the message: the old encoding is then copied whole
+    bool appendsOnly(const ZCMStruct& os, const ZCMStruct& ns, vector<u8>& tail)
+    {
+        for (auto& om : os.members)
+            if (!ZCMGen::isPrimitiveType(om.type.fullname) && changes[om.type.fullname] != SAME)
+                return false;
+        tail.clear();
+        for (auto& s : appendedSegments(os, ns)) {
+            if (!s.dims.empty())
+                return false;
+            tail.insert(tail.end(), s.bytes.begin(), s.bytes.end());
+        }
+        return true;
+    }
+
+    void hashBytes(u64 hash, u8 out[8])
+    {
+        for (int i = 0; i < 8; ++i)
+            out[littleEndian ? i : 7 - i] = (u8) (hash >> (8 * i));
+    }
+
+    int emitPlugin()
+    {
+        classifyAll();
+
+        struct Top
+        {
+            const ZCMStruct* os;
+            const ZCMStruct* ns;
+            u64 oldHash;  // as zcm-log-transcoder reads it, big endian
+            u64 newHash;
+            bool appends;
+            vector<u8> tail;
+        };
+        vector<Top> tops;
+        for (auto& c : changes) {
+            const ZCMStruct* os = findStruct(old, c.first);
+            const ZCMStruct* ns = findStruct(nu, c.first);
+            if (c.second == INCOMPATIBLE) {
+                fprintf(stderr, "Not migrating %s: %s\n", c.first.c_str(),
+                        whyIncompatible[c.first].c_str());
+                continue;
+            }
+            Top t { os, ns, 0, 0, false, {} };
+            if (!old.computeFingerprint(*os, t.oldHash, true) ||
+                !nu.computeFingerprint(*ns, t.newHash, true)) {
+                fprintf(stderr, "Not migrating %s: it nests a type not declared\n", c.first.c_str());
+                continue;
+            }
+            if (t.oldHash == t.newHash)
+                continue;
+            if (littleEndian)
+                t.oldHash = byteSwap(t.oldHash);
+            t.appends = appendsOnly(*os, *ns, t.tail);
+            if (!t.appends)
+                collect(*os);
+            tops.push_back(std::move(t));
+        }
+        if (tops.empty()) {
+            fprintf(stderr, "No type to migrate\n");
+            return -1;
+        }
+
+        string cls = nu.gopt->getString("migrate-class");
+        auto* cn = cls.c_str();
+
+        emit(0, "// THIS IS AN AUTOMATICALLY GENERATED FILE.");
+        emit(0, "// DO NOT MODIFY BY HAND!!");
+        emit(0, "//");
+        emit(0, "// Generated by zcm-gen --migrate");
+        emit(0, "//");
+        emit(0, "// Migrates logs of older versions of types to their current one, on the encoded");
+        emit(0, "// bytes: what was kept is copied, the hash patched and appended members encoded");
+        emit(0, "// as zero, empty or without elements. Build it into a shared library for");
+        emit(0, "// zcm-log-transcoder:");
+        emit(0, "//");
+        emit(0, "//   g++ -std=c++11 -O2 -fPIC -shared %s -o migrate.so",
+                nu.gopt->getString("migrate-out").c_str());
+        emit(0, "//");
+        emit(0, "// Event data is expected to be one encoded message: the appended members go");
+        emit(0, "// right after it");
+        emit(0, "");
+        emit(0, "#include <algorithm>");
+        emit(0, "#include <cstring>");
+        emit(0, "#include <vector>");
+        emit(0, "");
+        emit(0, "#include <zcm/zcm_coretypes.h>");
+        emit(0, "#include <zcm/tools/TranscoderPlugin.hpp>");
+        emit(0, "");
+        emit(0, "namespace {");
+        emit(0, "");
+        emitHelpers();
+
+        for (auto* os : skipped)
+            emit(0, "static bool skip_%s(const uint8_t* buf, uint32_t len, uint32_t& pos);",
+                    sn(*os).c_str());
+        for (auto* os : migrated)
+            emit(0, "static bool migrate_%s(const uint8_t* buf, uint32_t len, uint32_t& pos, "
+                    "Out& out);", sn(*os).c_str());
+        if (!skipped.empty() || !migrated.empty())
+            emit(0, "");
+
+        for (auto* os : migrated)
+            emitAppendedDefaults(*os, *findStruct(nu, os->structname.fullname));
+        for (auto* os : skipped)
+            emitWalker(*os, nullptr);
+        for (auto* os : migrated)
+            emitWalker(*os, findStruct(nu, os->structname.fullname));
+
+        for (auto& t : tops) {
+            string name = sn(*t.ns);
+            u8 hb[8];
+            hashBytes(t.newHash, hb);
+            emit(0, "static const int64_t OLD_HASH_%s = (int64_t) 0x%016" PRIx64 "ULL;",
+                    name.c_str(), t.oldHash);
+            emitBytes("NEW_HASH_" + name, vector<u8>(hb, hb + 8));
+            if (t.appends)
+                emitBytes("TAIL_" + name, t.tail);
+            emit(0, "");
+        }
+
+        emit(0, "typedef bool (*MigrateFn)(const uint8_t* buf, uint32_t len, uint32_t& pos, Out& out);");
+        emit(0, "");
+        emit(0, "// The old encoding whole, but for its hash, then 'tail'");
+        emit(0, "static inline bool appendTail(const zcm::LogEvent* evt, const uint8_t* hash,");
+        emit(0, "                              const uint8_t* tail, uint32_t tailLen,");
+        emit(0, "                              zcm::TranscoderOutput& out)");
+        emit(0, "{");
+        emit(1, "if (evt->datalen < 8) return false;");
+        emit(1, "uint8_t* p = out.add(evt->timestamp, evt->channel, evt->datalen + tailLen);");
+        emit(1, "memcpy(p, hash, 8);");
+        emit(1, "memcpy(p + 8, evt->data + 8, evt->datalen - 8);");
+        emit(1, "if (tailLen) memcpy(p + evt->datalen, tail, tailLen);");
+        emit(1, "return true;");
+        emit(0, "}");
+        emit(0, "");
+        emit(0, "}");
+        emit(0, "");
+
+        emit(0, "class %s : public zcm::TranscoderPlugin", cn);
+        emit(0, "{");
+        emit(0, "  public:");
+        emit(1, "static zcm::TranscoderPlugin* makeTranscoderPlugin();");
+        emit(0, "");
+        emit(1, "bool transcodeEventInto(int64_t hash, const zcm::LogEvent* evt,");
+        emit(1, "                        zcm::TranscoderOutput& out) override;");
+        emit(1, "std::vector<const zcm::LogEvent*> transcodeEvent(int64_t hash,");
+        emit(1, "                                                 const zcm::LogEvent* evt) override;");
+        emit(1, "std::vector<int64_t> handledHashes() const override;");
+        emit(0, "");
+        emit(0, "  private:");
+        emit(1, "bool migrate(const zcm::LogEvent* evt, const uint8_t* hash, MigrateFn fn,");
+        emit(1, "             zcm::TranscoderOutput& out);");
+        emit(0, "");
+        emit(1, "std::vector<uint8_t> buf;");
+        emit(1, "zcm::TranscoderOutput single;");
+        emit(0, "};");
+        emit(0, "");
+        emit(0, "zcm::TranscoderPlugin* %s::makeTranscoderPlugin()", cn);
+        emit(0, "{ return new %s(); }", cn);
+        emit(0, "");
+        emit(0, "bool %s::migrate(const zcm::LogEvent* evt, const uint8_t* hash, MigrateFn fn,", cn);
+        emit(0, "%*s zcm::TranscoderOutput& out)", (int) (14 + cls.size()), "");
+        emit(0, "{");
+        emit(1, "if (evt->datalen < 8) return false;");
+        emit(1, "Out o { buf, 0 };");
+        emit(1, "o.append(hash, 8);");
+        emit(1, "uint32_t pos = 8;");
+        emit(1, "if (!fn(evt->data, (uint32_t) evt->datalen, pos, o)) return false;");
+        emit(1, "memcpy(out.add(evt->timestamp, evt->channel, o.n), buf.data(), o.n);");
+        emit(1, "return true;");
+        emit(0, "}");
+        emit(0, "");
+        emit(0, "bool %s::transcodeEventInto(int64_t hash, const zcm::LogEvent* evt,", cn);
+        emit(0, "%*s zcm::TranscoderOutput& out)", (int) (25 + cls.size()), "");
+        emit(0, "{");
+        for (auto& t : tops) {
+            string name = sn(*t.ns);
+            auto* n = name.c_str();
+            if (t.appends)
+                emit(1, "if (hash == OLD_HASH_%s) return appendTail(evt, NEW_HASH_%s, TAIL_%s, %s, out);",
+                        n, n, n, t.tail.empty() ? "0" : ("sizeof(TAIL_" + name + ")").c_str());
+            else
+                emit(1, "if (hash == OLD_HASH_%s) return migrate(evt, NEW_HASH_%s, migrate_%s, out);",
+                        n, n, sn(*t.os).c_str());
+        }
+        emit(1, "return false;");
+        emit(0, "}");
+        emit(0, "");
+        emit(0, "std::vector<const zcm::LogEvent*> %s::transcodeEvent(int64_t hash,", cn);
+        emit(0, "%*s const zcm::LogEvent* evt)", (int) (50 + cls.size()), "");
+        emit(0, "{");
+        emit(1, "single.clear();");
+        emit(1, "if (!transcodeEventInto(hash, evt, single)) return TYPE_NOT_HANDLED();");
+        emit(1, "return { single[0] };");
+        emit(0, "}");
+        emit(0, "");
+        emit(0, "std::vector<int64_t> %s::handledHashes() const", cn);
+        emit(0, "{");
+        emitStart(1, "return {");
+        for (size_t i = 0; i < tops.size(); ++i)
+            emitContinue("%s OLD_HASH_%s", i ? "," : "", sn(*tops[i].ns).c_str());
+        emitEnd(" };");
+        emit(0, "}");
+
+        for (auto& t : tops)
+            printf("Migrating %s%s\n", t.ns->structname.fullname.c_str(),
+                   t.appends ? " (appended members only)" : "");
+        return 0;
+    }
+};
+
+int emitMigrate(ZCMGen& zcm)
+{
+    string from = zcm.gopt->getString("migrate-from");
+    if (from.empty()) {
+        fprintf(stderr, "--migrate needs the older versions of the types: --migrate-from\n");
+        return -1;
+    }
+
+    ZCMGen old;
+    old.gopt = zcm.gopt;
+    for (auto& fname : StringUtil::split(from, ','))
+        if (int res = old.handleFile(fname))
+            return res;
+
+    string out = zcm.gopt->getString("migrate-out");
+    FileUtil::makeDirsForFile(out);
+    EmitMigrate E{zcm, old, out};
+    if (!E.good())
+        return -1;
+    return E.emitPlugin();
+}
@@ -11,6 +11,33 @@ using namespace std;
 void setupOptionsNode(GetOpt& gopt)
 {
     gopt.addString(0, "npath", ".", "Location for zcmtypes.js file");
+    gopt.addBool(0,   "ntypedarrays", 0,
+                 "Decode arrays of numbers (but int64_t) into TypedArrays, viewing the "
+                 "received data where possible");
+}
+
+// The TypedArray arrays of 'type' can be encoded from (and with --ntypedarrays
+// decoded into), and the DataView method reading them, or "" if there is none
+static string getTypedArray(const string& type, string& getter)
+{
+    if (type == "double") {
+        getter = "getFloat64";
+        return "Float64Array";
+    } else if (type == "float") {
+        getter = "getFloat32";
+        return "Float32Array";
+    } else if (type == "int32_t") {
+        getter = "getInt32";
+        return "Int32Array";
+    } else if (type == "int16_t") {
+        getter = "getInt16";
+        return "Int16Array";
+    } else if (type == "int8_t" || type == "byte") {
+        getter = "getInt8";
+        return "Int8Array";
+    } else {
+        return "";
+    }
 }
 
 static string getReaderFunc(const string& type)
@@ -62,9 +89,10 @@ static string getWriterFunc(const string& type)
 struct EmitModule : public Emitter
 {
     ZCMGen& zcm;
+    bool typedArrays;
 
     EmitModule(ZCMGen& zcm, const string& fname):
-        Emitter(fname), zcm(zcm) {}
+        Emitter(fname), zcm(zcm), typedArrays(zcm.gopt->getBool("ntypedarrays")) {}
 
     void emitAutoGeneratedWarning()
     {
@@ -80,8 +108,16 @@ struct EmitModule : public Emitter
     {
         emitAutoGeneratedWarning();
 
-        emit(0, "var ref = require('ref');");
-        emit(0, "var bigint = require('big-integer');");
+        emit(0, "// Also runs in browsers, for zcm-client.js to decode what it receives raw:");
+        emit(0, "// there, big-integer's BigInteger.min.js must be loaded first, and the");
+        emit(0, "// types are in window.zcmtypes. Scoped so as to define no other globals");
+        emit(0, "(function() {");
+        emit(0, "");
+        emit(0, "var inNode = typeof module !== 'undefined' && typeof require === 'function';");
+        emit(0, "var exports = inNode ? module.exports : (window.zcmtypes = {});");
+        emit(0, "var bigint = inNode ? require('big-integer') : bigInt;");
+        emit(0, "var TWO_32 = 4294967296;");
+        emit(0, "var utf8Decoder = typeof TextDecoder !== 'undefined' ? new TextDecoder() : null;");
         emit(0, "");
         emit(0, "var UINT64_MAX = bigint('ffffffffffffffff', 16);");
         emit(0, "function rotateLeftOne(val)");
@@ -90,120 +126,175 @@ struct EmitModule : public Emitter
                            "val.shiftRight(63).and(1))");
         emit(0, "}");
         emit(0, "");
+        emit(0, "var HOST_LE = new Uint8Array(new Uint16Array([1]).buffer)[0] == 1;");
+        emit(0, "");
+        emit(0, "// Both the reader and the writer are reset for every message rather than");
+        emit(0, "// created: decoding and encoding allocate nothing but what they return");
+        emit(0, "var reader = {");
+        emit(0, "    buf: null,");
+        emit(0, "    view: null,");
+        emit(0, "    offset: 0,");
+        emit(0, "    readDouble: function() {");
+        emit(0, "        var ret = reader.view.getFloat64(reader.offset);");
+        emit(0, "        reader.offset += 8;");
+        emit(0, "        return ret;");
+        emit(0, "    },");
+        emit(0, "    readFloat: function() {");
+        emit(0, "        var ret = reader.view.getFloat32(reader.offset);");
+        emit(0, "        reader.offset += 4;");
+        emit(0, "        return ret;");
+        emit(0, "    },");
+        emit(0, "    read64: function() {");
+        emit(0, "        var hi = reader.view.getInt32(reader.offset);");
+        emit(0, "        var lo = reader.view.getUint32(reader.offset + 4);");
+        emit(0, "        reader.offset += 8;");
+        emit(0, "        return bigint(hi).multiply(TWO_32).add(lo);");
+        emit(0, "    },");
+        emit(0, "    readU64: function() {");
+        emit(0, "        var hi = reader.view.getUint32(reader.offset);");
+        emit(0, "        var lo = reader.view.getUint32(reader.offset + 4);");
+        emit(0, "        reader.offset += 8;");
+        emit(0, "        return bigint(hi).multiply(TWO_32).add(lo);");
+        emit(0, "    },");
+        emit(0, "    read32: function() {");
+        emit(0, "        var ret = reader.view.getInt32(reader.offset);");
+        emit(0, "        reader.offset += 4;");
+        emit(0, "        return ret;");
+        emit(0, "    },");
+        emit(0, "    read16: function() {");
+        emit(0, "        var ret = reader.view.getInt16(reader.offset);");
+        emit(0, "        reader.offset += 2;");
+        emit(0, "        return ret;");
+        emit(0, "    },");
+        emit(0, "    read8: function() {");
+        emit(0, "        var ret = reader.view.getInt8(reader.offset);");
+        emit(0, "        reader.offset += 1;");
+        emit(0, "        return ret;");
+        emit(0, "    },");
+        emit(0, "    readBoolean: function() {");
+        emit(0, "        var ret = reader.view.getInt8(reader.offset);");
+        emit(0, "        reader.offset += 1;");
+        emit(0, "        return ret != 0;");
+        emit(0, "    },");
+        emit(0, "    // Up to the first NULL, as written");
+        emit(0, "    readString: function() {");
+        emit(0, "        var len = reader.read32();");
+        emit(0, "        var bytes = new Uint8Array(reader.view.buffer, reader.view.byteOffset + reader.offset,");
+        emit(0, "                                   Math.max(len - 1, 0));");
+        emit(0, "        var end = bytes.indexOf(0);");
+        emit(0, "        if (end >= 0) bytes = bytes.subarray(0, end);");
+        emit(0, "        reader.offset += len;");
+        emit(0, "        if (utf8Decoder) return utf8Decoder.decode(bytes);");
+        emit(0, "        return Buffer.from(bytes.buffer, bytes.byteOffset, bytes.length).toString();");
+        emit(0, "    },");
+        emit(0, "    readArray: function(size, readValFunc) {");
+        emit(0, "        var arr = [size];");
+        emit(0, "        for (var i = 0; i < size; ++i)");
+        emit(0, "            arr[i] = readValFunc();");
+        emit(0, "        return arr;");
+        emit(0, "    },");
+        emit(0, "    // A view of the data when the elements need no byte swapping and are");
+        emit(0, "    // aligned, or else a copy");
+        emit(0, "    readTypedArray: function(size, Type, getter) {");
+        emit(0, "        var elemSize = Type.BYTES_PER_ELEMENT;");
+        emit(0, "        if (size < 0) size = 0;");
+        emit(0, "        if (reader.offset + size * elemSize > reader.view.byteLength)");
+        emit(0, "            throw new RangeError('zcm: message too short');");
+        emit(0, "        var start = reader.view.byteOffset + reader.offset;");
+        emit(0, "        var arr;");
+        emit(0, "        if ((elemSize == 1 || !HOST_LE) && start %% elemSize == 0) {");
+        emit(0, "            arr = new Type(reader.view.buffer, start, size);");
+        emit(0, "        } else {");
+        emit(0, "            arr = new Type(size);");
+        emit(0, "            for (var i = 0; i < size; ++i)");
+        emit(0, "                arr[i] = reader.view[getter](reader.offset + i * elemSize);");
+        emit(0, "        }");
+        emit(0, "        reader.offset += size * elemSize;");
+        emit(0, "        return arr;");
+        emit(0, "    },");
+        emit(0, "};");
+        emit(0, "");
         emit(0, "function createReader(data)");
         emit(0, "{");
-        emit(0, "    var buf = data;");
-        emit(0, "    var offset = 0;");
-        emit(0, "    var methods = {");
-        emit(0, "        readDouble: function() {");
-        emit(0, "            var ret = buf.readDoubleBE(offset);");
-        emit(0, "            offset += 8;");
-        emit(0, "            return ret;");
-        emit(0, "        },");
-        emit(0, "        readFloat: function() {");
-        emit(0, "            var ret = buf.readFloatBE(offset);");
-        emit(0, "            offset += 4;");
-        emit(0, "            return ret;");
-        emit(0, "        },");
-        emit(0, "        read64: function() {");
-        emit(0, "            var ret = bigint(ref.readInt64BE(buf, offset));");
-        emit(0, "            offset += 8;");
-        emit(0, "            return ret;");
-        emit(0, "        },");
-        emit(0, "        readU64: function() {");
-        emit(0, "            var ret = bigint(ref.readUInt64BE(buf, offset));");
-        emit(0, "            offset += 8;");
-        emit(0, "            return ret;");
-        emit(0, "        },");
-        emit(0, "        read32: function() {");
-        emit(0, "            var ret = buf.readInt32BE(offset);");
-        emit(0, "            offset += 4;");
-        emit(0, "            return ret;");
-        emit(0, "        },");
-        emit(0, "        read16: function() {");
-        emit(0, "            var ret = buf.readInt16BE(offset);");
-        emit(0, "            offset += 2;");
-        emit(0, "            return ret;");
-        emit(0, "        },");
-        emit(0, "        read8: function() {");
-        emit(0, "            var ret = buf.readInt8(offset);");
-        emit(0, "            offset += 1;");
-        emit(0, "            return ret;");
-        emit(0, "        },");
-        emit(0, "        readBoolean: function() {");
-        emit(0, "            var ret = buf.readInt8(offset);");
-        emit(0, "            offset += 1;");
-        emit(0, "            return ret != 0;");
-        emit(0, "        },");
-        emit(0, "        readString: function() {");
-        emit(0, "            var len = methods.read32();");
-        emit(0, "            var ret = ref.readCString(buf, offset);");
-        emit(0, "            offset += len;");
-        emit(0, "            return ret;");
-        emit(0, "        },");
-        emit(0, "        readArray: function(size, readValFunc) {");
-        emit(0, "            var arr = [size];");
+        emit(0, "    reader.buf = data;");
+        emit(0, "    reader.view = new DataView(data.buffer, data.byteOffset, data.byteLength);");
+        emit(0, "    reader.offset = 0;");
+        emit(0, "    return reader;");
+        emit(0, "}");
+        emit(0, "");
+        emit(0, "var writer = {");
+        emit(0, "    buf: null,");
+        emit(0, "    view: null,");
+        emit(0, "    offset: 0,");
+        emit(0, "    writeDouble: function(value) {");
+        emit(0, "        writer.view.setFloat64(writer.offset, value);");
+        emit(0, "        writer.offset += 8;");
+        emit(0, "    },");
+        emit(0, "    writeFloat: function(value) {");
+        emit(0, "        writer.view.setFloat32(writer.offset, value);");
+        emit(0, "        writer.offset += 4;");
+        emit(0, "    },");
+        emit(0, "    // 'value' can be a number, a bigint or a string of one, negative ones");
+        emit(0, "    // written in two's complement");
+        emit(0, "    write64: function(value) {");
+        emit(0, "        var v = bigint(value).and(UINT64_MAX);");
+        emit(0, "        var parts = v.divmod(TWO_32);");
+        emit(0, "        writer.view.setUint32(writer.offset, parts.quotient.toJSNumber());");
+        emit(0, "        writer.view.setUint32(writer.offset + 4, parts.remainder.toJSNumber());");
+        emit(0, "        writer.offset += 8;");
+        emit(0, "    },");
+        emit(0, "    writeU64: function(value) {");
+        emit(0, "        writer.write64(value);");
+        emit(0, "    },");
+        emit(0, "    write32: function(value) {");
+        emit(0, "        writer.view.setInt32(writer.offset, value);");
+        emit(0, "        writer.offset += 4;");
+        emit(0, "    },");
+        emit(0, "    write16: function(value) {");
+        emit(0, "        writer.view.setInt16(writer.offset, value);");
+        emit(0, "        writer.offset += 2;");
+        emit(0, "    },");
+        emit(0, "    write8: function(value) {");
+        emit(0, "        writer.view.setInt8(writer.offset, value);");
+        emit(0, "        writer.offset += 1;");
+        emit(0, "    },");
+        emit(0, "    writeBoolean: function(value) {");
+        emit(0, "        writer.view.setInt8(writer.offset, value ? 1 : 0);");
+        emit(0, "        writer.offset += 1;");
+        emit(0, "    },");
+        emit(0, "    writeString: function(value) {");
+        emit(0, "        writer.write32(value.length+1);");
+        emit(0, "        for (var i = 0; i < value.length; ++i)");
+        emit(0, "            writer.view.setUint8(writer.offset + i, value.charCodeAt(i));");
+        emit(0, "        writer.view.setUint8(writer.offset + value.length, 0);");
+        emit(0, "        writer.offset += value.length+1;");
+        emit(0, "    },");
+        emit(0, "    writeArray: function(arr, size, writeValFunc) {");
+        emit(0, "        for (var i = 0; i < size; ++i)");
+        emit(0, "            writeValFunc(arr[i]);");
+        emit(0, "    },");
+        emit(0, "    // 'arr' can be an Array or any TypedArray, those of 'Type' that need no");
+        emit(0, "    // byte swapping being copied in one go");
+        emit(0, "    writeTypedArray: function(arr, size, Type, setter) {");
+        emit(0, "        var elemSize = Type.BYTES_PER_ELEMENT;");
+        emit(0, "        if (arr instanceof Type && (elemSize == 1 || !HOST_LE) && size <= arr.length) {");
+        emit(0, "            new Uint8Array(writer.view.buffer, writer.view.byteOffset + writer.offset,");
+        emit(0, "                           size * elemSize)");
+        emit(0, "                .set(new Uint8Array(arr.buffer, arr.byteOffset, size * elemSize));");
+        emit(0, "        } else {");
         emit(0, "            for (var i = 0; i < size; ++i)");
-        emit(0, "                arr[i] = readValFunc();");
-        emit(0, "            return arr;");
+        emit(0, "                writer.view[setter](writer.offset + i * elemSize, arr[i]);");
         emit(0, "        }");
-        emit(0, "    };");
-        emit(0, "    return methods;");
-        emit(0, "}");
+        emit(0, "        writer.offset += size * elemSize;");
+        emit(0, "    },");
+        emit(0, "};");
         emit(0, "");
-        emit(0, "function createWriter(size)");
+        emit(0, "function createWriter(buf, offset)");
         emit(0, "{");
-        emit(0, "    var buf = new Buffer(size);");
-        emit(0, "    var offset = 0;");
-        emit(0, "    var methods = {");
-        emit(0, "        writeDouble: function(value) {");
-        emit(0, "            buf.writeDoubleBE(value, offset);");
-        emit(0, "            offset += 8;");
-        emit(0, "        },");
-        emit(0, "        writeFloat: function(value) {");
-        emit(0, "            buf.writeFloatBE(value, offset);");
-        emit(0, "            offset += 4;");
-        emit(0, "        },");
-        emit(0, "        write64: function(value) {");
-        emit(0, "            ref.writeInt64BE(buf, offset, bigint.isInstance(value) ?");
-        emit(0, "                                          value.toString() : value);");
-        emit(0, "            offset += 8;");
-        emit(0, "        },");
-        emit(0, "        writeU64: function(value) {");
-        emit(0, "            ref.writeUInt64BE(buf, offset, bigint.isInstance(value) ?");
-        emit(0, "                                           value.toString() : value);");
-        emit(0, "            offset += 8;");
-        emit(0, "        },");
-        emit(0, "        write32: function(value) {");
-        emit(0, "            buf.writeInt32BE(value, offset);");
-        emit(0, "            offset += 4;");
-        emit(0, "        },");
-        emit(0, "        write16: function(value) {");
-        emit(0, "            buf.writeInt16BE(value, offset);");
-        emit(0, "            offset += 2;");
-        emit(0, "        },");
-        emit(0, "        write8: function(value) {");
-        emit(0, "            buf.writeInt8(value, offset);");
-        emit(0, "            offset += 1;");
-        emit(0, "        },");
-        emit(0, "        writeBoolean: function(value) {");
-        emit(0, "            buf.writeInt8(value, offset);");
-        emit(0, "            offset += 1;");
-        emit(0, "        },");
-        emit(0, "        writeString: function(value) {");
-        emit(0, "            methods.write32(value.length+1);");
-        emit(0, "            ref.writeCString(buf, offset, value);");
-        emit(0, "            offset += value.length+1;");
-        emit(0, "        },");
-        emit(0, "        writeArray: function(arr, size, writeValFunc) {");
-        emit(0, "            for (var i = 0; i < size; ++i)");
-        emit(0, "                writeValFunc(arr[i]);");
-        emit(0, "        },");
-        emit(0, "        getBuffer: function() {");
-        emit(0, "            return buf;");
-        emit(0, "        },");
-        emit(0, "    };");
-        emit(0, "    return methods;");
+        emit(0, "    writer.buf = buf;");
+        emit(0, "    writer.view = new DataView(buf.buffer, buf.byteOffset, buf.byteLength);");
+        emit(0, "    writer.offset = offset;");
+        emit(0, "    return writer;");
         emit(0, "}");
         emit(0, "");
         unordered_set<string> packages;
@@ -237,8 +328,14 @@ struct EmitModule : public Emitter
         auto* len = len_.c_str();
 
         auto writerFunc = getWriterFunc(tn);
-
-        if (writerFunc != "") {
+        string setter;
+        string typedArray = getTypedArray(tn, setter);
+        setter.replace(0, 3, "set");
+
+        if (typedArray != "") {
+            emit(indent, "W.writeTypedArray(%s, %s%s, %s, '%s');", accessor,
+                         fixedLen ? "" : "msg.", len, typedArray.c_str(), setter.c_str());
+        } else if (writerFunc != "") {
             if (fixedLen) {
                 emit(indent, "W.writeArray(%s, %s, W.%s);", accessor, len, writerFunc.c_str());
             } else {
@@ -255,7 +352,7 @@ struct EmitModule : public Emitter
     {
         auto* sn = zs.structname.nameUnderscoreCStr();
 
-        emit(0, "%s_encode_one = function(msg, W)", sn);
+        emit(0, "var %s_encode_one = function(msg, W)", sn);
         emit(0, "{");
         if (zs.members.size() == 0) {
             emit(0, "}");
@@ -313,10 +410,22 @@ struct EmitModule : public Emitter
         emit(0, "%s.encode = function(msg)", sn);
         emit(0, "{");
         emit(0, "    var size = %s.getEncodedSize(msg);", sn);
-        emit(0, "    var W = createWriter(size);");
+        emit(0, "    var buf = inNode ? Buffer.allocUnsafe(size) : new Uint8Array(size);");
+        emit(0, "    var W = createWriter(buf, 0);");
+        emit(0, "    W.writeU64(%s.__get_hash_recursive());", sn);
+        emit(0, "    %s_encode_one(msg, W);", sn);
+        emit(0, "    return buf;");
+        emit(0, "};");
+        emit(0, "// Encodes into 'buf', which can be reused from one message to the next,");
+        emit(0, "// from 'offset'. Returns the encoded size, or -1 if it doesn't fit");
+        emit(0, "%s.encodeInto = function(msg, buf, offset)", sn);
+        emit(0, "{");
+        emit(0, "    var size = %s.getEncodedSize(msg);", sn);
+        emit(0, "    if (offset + size > buf.length) return -1;");
+        emit(0, "    var W = createWriter(buf, offset);");
         emit(0, "    W.writeU64(%s.__get_hash_recursive());", sn);
         emit(0, "    %s_encode_one(msg, W);", sn);
-        emit(0, "    return W.getBuffer();");
+        emit(0, "    return size;");
         emit(0, "};");
         emit(0, "%s.prototype.encode = function()", sn);
         emit(0, "{");
@@ -424,6 +533,15 @@ struct EmitModule : public Emitter
             assert(0);
         }
 
+        string getter;
+        string typedArray = getTypedArray(tn, getter);
+        if (typedArrays && typedArray != "") {
+            emit(indent, "%sR.readTypedArray(%s%s, %s, '%s')%s",
+                         accessor, (fixedLen ? "" : "msg."),
+                         len, typedArray.c_str(), getter.c_str(), suffix);
+            return;
+        }
+
         emit(indent, "%sR.readArray(%s%s, R.%s)%s",
                      accessor, (fixedLen ? "" : "msg."),
                      len, readerFunc.c_str(), suffix);
@@ -433,7 +551,7 @@ struct EmitModule : public Emitter
     {
         auto* sn = zs.structname.nameUnderscoreCStr();
 
-        emit(0, "%s_decode_one = function(R)", sn);
+        emit(0, "var %s_decode_one = function(R)", sn);
         emit(0, "{");
         emit(1,     "var msg = new %s();", sn);
         for (auto& zm : zs.members) {
@@ -534,7 +652,7 @@ struct EmitModule : public Emitter
         // If any nonPrimitive members, push yourself into the list so you aren't double counted
         for (auto& zm : zs.members) {
             if (!ZCMGen::isPrimitiveType(zm.type.fullname)) {
-                emit(1, "newparents = parents.slice(0, parents.length);");
+                emit(1, "var newparents = parents.slice(0, parents.length);");
                 emit(1, "newparents.push('%s')", zs.structname.fullname.c_str());
                 break;
             }
@@ -669,6 +787,8 @@ struct EmitModule : public Emitter
             emitStruct(zs);
         }
         emitGetClientZcmTypes();
+        emit(0, "");
+        emit(0, "})();");
     }
 };
 
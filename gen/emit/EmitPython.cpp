@@ -15,6 +15,8 @@ using std::cerr;
 void setupOptionsPython(GetOpt& gopt)
 {
     gopt.addString(0, "ppath", "", "Python destination directory");
+    gopt.addBool(0,   "pnumpy", 0,  "Decode arrays of numbers into numpy arrays, without copies");
+    gopt.addBool(0,   "pcython", 0, "Emit Cython types (.pyx and .pxd) with typed encode and decode");
 }
 
 static char getStructFormat(ZCMMember& zm)
@@ -31,13 +33,85 @@ static char getStructFormat(ZCMMember& zm)
     return 0;
 }
 
+// Big endian numpy dtype of arrays of 'zm', or nullptr if they aren't decoded into
+// numpy arrays: bytes stay strings, and booleans are read as integers
+static const char* getNumpyDtype(ZCMMember& zm)
+{
+    auto& tn = zm.type.fullname;
+    if (tn == "boolean") return "i1";
+    if (tn == "int8_t")  return "i1";
+    if (tn == "int16_t") return ">i2";
+    if (tn == "int32_t") return ">i4";
+    if (tn == "int64_t") return ">i8";
+    if (tn == "float")   return ">f4";
+    if (tn == "double")  return ">f8";
+    return nullptr;
+}
+
 struct PyEmitStruct : public Emitter
 {
     ZCMGen& zcm;
     ZCMStruct& zs;
+    bool numpy;
+    // How arrays of bytes are initialized
+    const char* emptyBytes = "\"\"";
 
     PyEmitStruct(ZCMGen& zcm, ZCMStruct& zs, const string& fname):
-        Emitter(fname), zcm(zcm), zs(zs) {}
+        Emitter(fname), zcm(zcm), zs(zs), numpy(zcm.gopt->getBool("pnumpy")) {}
+
+    bool isNumpyArray(ZCMMember& zm)
+    { return numpy && zm.dimensions.size() > 0 && getNumpyDtype(zm); }
+
+    // The dimensions of 'zm', as a python tuple
+    string numpyShape(ZCMMember& zm)
+    {
+        string shape = "(";
+        for (auto& dim : zm.dimensions)
+            shape += (dim.mode == ZCM_CONST ? "" : "self.") + dim.size + ", ";
+        if (zm.dimensions.size() > 1)
+            shape.resize(shape.size() - 2);
+        else
+            shape.resize(shape.size() - 1);
+        return shape + ")";
+    }
+
+    void emitNumpySupport()
+    {
+        emit(0, "import numpy");
+        emit(0, "");
+        emit(0, "class _ZcmReader(object):");
+        emit(1, "\"\"\"Reads an encoded message like BytesIO, without copying the arrays");
+        emit(1, "numpy decodes through view()\"\"\"");
+        emit(1, "__slots__ = [\"data\", \"pos\"]");
+        emit(0, "");
+        emit(1, "def __init__(self, data):");
+        emit(2, "self.data = memoryview(data)");
+        emit(2, "self.pos = 0");
+        emit(0, "");
+        emit(1, "def view(self, n):");
+        emit(2, "v = self.data[self.pos:self.pos + n]");
+        emit(2, "self.pos += len(v)");
+        emit(2, "return v");
+        emit(0, "");
+        emit(1, "def read(self, n):");
+        emit(2, "return self.view(n).tobytes()");
+        emit(0, "");
+        emit(0, "def _zcm_decode_array(buf, dtype, shape):");
+        emit(1, "\"\"\"Read only array of 'shape' decoded from 'buf', sharing its memory if");
+        emit(1, "it is a _ZcmReader\"\"\"");
+        emit(1, "shape = tuple(max(d, 0) for d in shape)");
+        emit(1, "dtype = numpy.dtype(dtype)");
+        emit(1, "n = 1");
+        emit(1, "for d in shape:");
+        emit(2, "n *= d");
+        emit(1, "view = getattr(buf, 'view', buf.read)");
+        emit(1, "return numpy.frombuffer(view(n * dtype.itemsize), dtype, n).reshape(shape)");
+        emit(0, "");
+        emit(0, "def _zcm_encode_array(buf, a, dtype, shape):");
+        emit(1, "shape = tuple(max(d, 0) for d in shape)");
+        emit(1, "buf.write(numpy.asarray(a, dtype).reshape(shape).tobytes())");
+        emit(0, "");
+    }
 
     void emitStruct()
     {
@@ -56,6 +130,8 @@ struct PyEmitStruct : public Emitter
              "import struct\n");
 
         emitPythonDependencies();
+        if (numpy)
+            emitNumpySupport();
 
         emit(0, "class %s(object):", sn);
         emitStart(0, "    __slots__ = [");
@@ -210,6 +286,11 @@ struct PyEmitStruct : public Emitter
                     string accessor = "self." + zm.membername + " = ";
                     emitDecodeOne(zm, accessor.c_str(), 2, "");
                 }
+            } else if (isNumpyArray(zm)) {
+                flushReadStructFmt(structFmt, structMembers);
+                emit(2, "self.%s = _zcm_decode_array(buf, '%s', %s)%s", zm.membername.c_str(),
+                     getNumpyDtype(zm), numpyShape(zm).c_str(),
+                     zm.type.fullname == "boolean" ? " != 0" : "");
             } else {
                 flushReadStructFmt(structFmt, structMembers);
                 string accessor = "self." + zm.membername;
@@ -285,7 +366,7 @@ struct PyEmitStruct : public Emitter
         emit(1, "    if hasattr(data, 'read'):");
         emit(1, "        buf = data");
         emit(1, "    else:");
-        emit(1, "        buf = BytesIO(data)");
+        emit(1, "        buf = %s(data)", numpy ? "_ZcmReader" : "BytesIO");
         emit(1, "    if buf.read(8) != %s._get_packed_fingerprint():", zs.structname.shortname.c_str());
         emit(1, "        raise ValueError(\"Decode error\")");
         emit(1, "    return %s._decode_one(buf)", zs.structname.shortname.c_str());
@@ -399,6 +480,14 @@ struct PyEmitStruct : public Emitter
                     flushWriteStructFmt(structFmt, structMembers);
                     emitEncodeOne (zm, "self."+zm.membername, 2);
                 }
+            } else if (isNumpyArray(zm)) {
+                flushWriteStructFmt(structFmt, structMembers);
+                // one dimensional arrays may be longer than encoded, as lists are
+                auto& dim = zm.dimensions[0];
+                string slice = zm.dimensions.size() > 1 ? "" :
+                               string("[:") + (dim.mode == ZCM_CONST ? "" : "self.") + dim.size + "]";
+                emit(2, "_zcm_encode_array(buf, self.%s%s, '%s', %s)", zm.membername.c_str(),
+                     slice.c_str(), getNumpyDtype(zm), numpyShape(zm).c_str());
             } else {
                 flushWriteStructFmt(structFmt, structMembers);
                 string accessor = "self." + zm.membername;
@@ -472,7 +561,7 @@ struct PyEmitStruct : public Emitter
         // efficiently packed and unpacked.
         if ((size_t)dimNum == zm.dimensions.size() - 1 &&
             zm.type.fullname == "byte") {
-            fprintfPass("\"\"");
+            fprintfPass("%s", emptyBytes);
             return;
         }
         auto& dim = zm.dimensions[dimNum];
@@ -572,6 +661,472 @@ struct PyEmitStruct : public Emitter
     }
 };
 
+// Cython types: extension types encoding and decoding themselves with typed
+// code straight from and to the encoded bytes. Their .pxd declares their
+// attributes and the cdef methods types containing them call, so all the types
+// a --pcython type contains must be generated with --pcython too
+struct PyxEmitStruct : public PyEmitStruct
+{
+    PyxEmitStruct(ZCMGen& zcm, ZCMStruct& zs, const string& fname):
+        PyEmitStruct(zcm, zs, fname) { emptyBytes = "b\"\""; }
+
+    // Type of the attribute of a scalar member of type 'tn'
+    static const char* attributeType(const string& tn)
+    {
+        if (tn == "byte")    return "uint8_t";
+        if (tn == "boolean") return "bint";
+        if (tn == "string")  return "object";
+        if (ZCMGen::isPrimitiveType(tn)) return tn.c_str();
+        return "object";
+    }
+
+    // Expression decoding the primitive 'tn' at 'buf + at'
+    static string loadPrimitive(const string& tn, const string& at)
+    {
+        if (tn == "byte")    return "buf[" + at + "]";
+        if (tn == "boolean") return "buf[" + at + "] != 0";
+        if (tn == "int8_t")  return "<int8_t> buf[" + at + "]";
+        if (tn == "float")   return "_zcm_load_float(buf + " + at + ")";
+        if (tn == "double")  return "_zcm_load_double(buf + " + at + ")";
+        string size = to_string(ZCMGen::getPrimitiveTypeSize(tn));
+        return "<" + tn + "> _zcm_load(buf + " + at + ", " + size + ")";
+    }
+
+    // Statement encoding 'val' as the primitive 'tn' at 'buf + at'
+    static string storePrimitive(const string& tn, const string& at, const string& val)
+    {
+        if (tn == "byte")    return "buf[" + at + "] = <uint8_t> " + val;
+        if (tn == "boolean") return "buf[" + at + "] = 1 if " + val + " else 0";
+        if (tn == "int8_t")  return "buf[" + at + "] = <uint8_t> <int8_t> " + val;
+        if (tn == "float")   return "_zcm_store_float(buf + " + at + ", " + val + ")";
+        if (tn == "double")  return "_zcm_store_double(buf + " + at + ", " + val + ")";
+        string size = to_string(ZCMGen::getPrimitiveTypeSize(tn));
+        return "_zcm_store(buf + " + at + ", <uint64_t> <" + tn + "> " + val + ", " + size + ")";
+    }
+
+    static bool isNumber(const string& tn)
+    { return ZCMGen::isPrimitiveType(tn) && tn != "string"; }
+
+    // Name the type of 'zm' goes by in this module
+    string typeName(ZCMMember& zm)
+    {
+        if (zm.type.fullname == zs.structname.fullname)
+            return zs.structname.shortname;
+        return zm.type.nameUnderscore();
+    }
+
+    static string dimCount(ZCMDimension& dim)
+    { return dim.mode == ZCM_CONST ? dim.size : "_zcm_dim(self." + dim.size + ")"; }
+
+    size_t maxDims()
+    {
+        size_t n = 0;
+        for (auto& zm : zs.members)
+            n = std::max(n, zm.dimensions.size());
+        return n;
+    }
+
+    // "i0, i1" for the loop indexes of the members with the most dimensions
+    string loopIndexes()
+    {
+        string ret;
+        for (size_t i = 0; i < maxDims(); ++i)
+            ret += (i ? ", i" : "i") + to_string(i);
+        return ret;
+    }
+
+    void emitHeader()
+    {
+        emit(0, "\"\"\"ZCM type definitions\n"
+             "This file automatically generated by zcm.\n"
+             "DO NOT MODIFY BY HAND!!!!\n"
+             "\"\"\"\n");
+        emit(0, "from libc.stdint cimport int8_t, int16_t, int32_t, int64_t");
+        emit(0, "from libc.stdint cimport uint8_t, uint32_t, uint64_t");
+    }
+
+    void emitPxd()
+    {
+        auto* sn = zs.structname.shortname.c_str();
+        emitHeader();
+        emit(0, "");
+        emit(0, "cdef class %s:", sn);
+        for (auto& zm : zs.members)
+            emit(1, "cdef public %s %s",
+                 zm.dimensions.empty() ? attributeType(zm.type.fullname) : "object",
+                 zm.membername.c_str());
+        emit(0, "");
+        emit(1, "cdef Py_ssize_t _encoded_size(self) except -1");
+        emit(1, "cdef Py_ssize_t _encode_into(self, uint8_t* buf, Py_ssize_t pos) except -1");
+        emit(1, "cdef Py_ssize_t _decode_from(self, const uint8_t* buf, Py_ssize_t pos,");
+        emit(1, "                             Py_ssize_t end) except -1");
+    }
+
+    void emitCimports()
+    {
+        unordered_map<string, ZCMTypename> dependencies;
+        for (auto& zm : zs.members) {
+            auto& tn = zm.type.fullname;
+            if (!ZCMGen::isPrimitiveType(tn) && tn != zs.structname.fullname)
+                dependencies.insert({tn, zm.type});
+        }
+        for (auto& p : dependencies) {
+            auto* tn = p.first.c_str();
+            auto& type = p.second;
+            if (type.package.empty()) {
+                emit(0, "from %s cimport %s", tn, tn);
+            } else {
+                emit(0, "from %s cimport %s as %s",
+                        tn, type.shortname.c_str(), type.nameUnderscoreCStr());
+            }
+        }
+        if (!dependencies.empty())
+            emit(0, "");
+    }
+
+    void emitSupport()
+    {
+        emit(0, "cdef inline int _zcm_check(Py_ssize_t pos, Py_ssize_t n, Py_ssize_t end) except -1:");
+        emit(1, "if n < 0 or n > end - pos:");
+        emit(2, "raise ValueError(\"Decode error\")");
+        emit(1, "return 0");
+        emit(0, "");
+        emit(0, "cdef inline Py_ssize_t _zcm_dim(Py_ssize_t n):");
+        emit(1, "return n if n > 0 else 0");
+        emit(0, "");
+        emit(0, "cdef inline uint64_t _zcm_load(const uint8_t* p, int n):");
+        emit(1, "cdef uint64_t v = 0");
+        emit(1, "cdef int i");
+        emit(1, "for i in range(n):");
+        emit(2, "v = (v << 8) | p[i]");
+        emit(1, "return v");
+        emit(0, "");
+        emit(0, "cdef inline void _zcm_store(uint8_t* p, uint64_t v, int n):");
+        emit(1, "cdef int i");
+        emit(1, "for i in range(n):");
+        emit(2, "p[n - 1 - i] = <uint8_t> (v >> (8 * i))");
+        emit(0, "");
+        emit(0, "cdef inline float _zcm_load_float(const uint8_t* p):");
+        emit(1, "cdef uint32_t u = <uint32_t> _zcm_load(p, 4)");
+        emit(1, "cdef float f");
+        emit(1, "memcpy(&f, &u, 4)");
+        emit(1, "return f");
+        emit(0, "");
+        emit(0, "cdef inline double _zcm_load_double(const uint8_t* p):");
+        emit(1, "cdef uint64_t u = _zcm_load(p, 8)");
+        emit(1, "cdef double d");
+        emit(1, "memcpy(&d, &u, 8)");
+        emit(1, "return d");
+        emit(0, "");
+        emit(0, "cdef inline void _zcm_store_float(uint8_t* p, float f):");
+        emit(1, "cdef uint32_t u");
+        emit(1, "memcpy(&u, &f, 4)");
+        emit(1, "_zcm_store(p, u, 4)");
+        emit(0, "");
+        emit(0, "cdef inline void _zcm_store_double(uint8_t* p, double d):");
+        emit(1, "cdef uint64_t u");
+        emit(1, "memcpy(&u, &d, 8)");
+        emit(1, "_zcm_store(p, u, 8)");
+        emit(0, "");
+        emit(0, "cdef inline bytes _zcm_utf8(s):");
+        emit(1, "return s if isinstance(s, bytes) else s.encode('utf-8')");
+        emit(0, "");
+        emit(0, "cdef inline Py_ssize_t _zcm_encode_string(uint8_t* buf, Py_ssize_t pos,");
+        emit(0, "                                         bytes s) except -1:");
+        emit(1, "cdef Py_ssize_t n = len(s)");
+        emit(1, "_zcm_store(buf + pos, n + 1, 4)");
+        emit(1, "memcpy(buf + pos + 4, <const char*> s, n)");
+        emit(1, "buf[pos + 4 + n] = 0");
+        emit(1, "return pos + 5 + n");
+        emit(0, "");
+        emit(0, "cdef inline object _zcm_decode_string(const uint8_t* buf, Py_ssize_t* pos,");
+        emit(0, "                                      Py_ssize_t end):");
+        emit(1, "cdef Py_ssize_t n");
+        emit(1, "_zcm_check(pos[0], 4, end)");
+        emit(1, "n = <int32_t> _zcm_load(buf + pos[0], 4)");
+        emit(1, "_zcm_check(pos[0] + 4, n, end)");
+        emit(1, "if n < 1:");
+        emit(2, "raise ValueError(\"Decode error\")");
+        emit(1, "s = (<const char*> buf)[pos[0] + 4:pos[0] + 3 + n].decode('utf-8', 'replace')");
+        emit(1, "pos[0] += 4 + n");
+        emit(1, "return s");
+        emit(0, "");
+        emit(0, "cdef inline object _zcm_not_none(o):");
+        emit(1, "if o is None:");
+        emit(2, "raise TypeError(\"Encode error: member is None\")");
+        emit(1, "return o");
+        emit(0, "");
+    }
+
+    void emitPyx()
+    {
+        auto* sn = zs.structname.shortname.c_str();
+
+        emit(0, "# cython: language_level=3");
+        emitHeader();
+        emit(0, "from libc.string cimport memcpy, memcmp");
+        emit(0, "from cpython.bytes cimport PyBytes_FromStringAndSize, PyBytes_AS_STRING");
+        emit(0, "");
+        emit(0, "import struct");
+        emit(0, "");
+        emitCimports();
+        emitSupport();
+
+        emit(0, "_packed_fingerprint = None");
+        emit(0, "");
+        emit(0, "cdef class %s:", sn);
+        for (auto& zc : zs.constants) {
+            assert(ZCMGen::isLegalConstType(zc.type));
+            emit(1, "%s = %s", zc.membername.c_str(), zc.valstr.c_str());
+        }
+        if (zs.constants.size() > 0)
+            emit(0, "");
+
+        emitPythonInit();
+        emitEncode();
+        emitDecode();
+        emitEncodedSize();
+        emitEncodeInto();
+        emitDecodeFrom();
+        emitFingerprint();
+    }
+
+    void emitEncode()
+    {
+        auto* sn = zs.structname.shortname.c_str();
+        emit(1, "def encode(self):");
+        emit(2, "cdef Py_ssize_t size = 8 + self._encoded_size()");
+        emit(2, "cdef object out = PyBytes_FromStringAndSize(NULL, size)");
+        emit(2, "cdef uint8_t* buf = <uint8_t*> PyBytes_AS_STRING(out)");
+        emit(2, "cdef bytes fp = %s._get_packed_fingerprint()", sn);
+        emit(2, "memcpy(buf, <const char*> fp, 8)");
+        emit(2, "self._encode_into(buf, 8)");
+        emit(2, "return out");
+        emit(0, "");
+    }
+
+    void emitDecode()
+    {
+        auto* sn = zs.structname.shortname.c_str();
+        emit(1, "@staticmethod");
+        emit(1, "def decode(data):");
+        emit(2, "cdef bytes b");
+        emit(2, "cdef bytes fp = %s._get_packed_fingerprint()", sn);
+        emit(2, "cdef %s self", sn);
+        emit(2, "if hasattr(data, 'read'):");
+        emit(3, "data = data.read()");
+        emit(2, "b = data if type(data) is bytes else bytes(data)");
+        emit(2, "if len(b) < 8 or memcmp(<const char*> b, <const char*> fp, 8) != 0:");
+        emit(3, "raise ValueError(\"Decode error\")");
+        emit(2, "self = %s.__new__(%s)", sn, sn);
+        emit(2, "self._decode_from(<const uint8_t*> <const char*> b, 8, len(b))");
+        emit(2, "return self");
+        emit(0, "");
+    }
+
+    void emitEncodedSize()
+    {
+        size_t fixed = 0;
+        for (auto& zm : zs.members)
+            if (zm.dimensions.empty() && isNumber(zm.type.fullname))
+                fixed += ZCMGen::getPrimitiveTypeSize(zm.type.fullname);
+
+        emit(1, "cdef Py_ssize_t _encoded_size(self) except -1:");
+        emit(2, "cdef Py_ssize_t size = %zu", fixed);
+        if (maxDims() > 0)
+            emit(2, "cdef Py_ssize_t %s", loopIndexes().c_str());
+        for (auto& zm : zs.members) {
+            auto& tn = zm.type.fullname;
+            if (isNumber(tn)) {
+                if (zm.dimensions.empty())
+                    continue;
+                // arrays of numbers are sized without looking at them
+                emitStart(2, "size += %zu", ZCMGen::getPrimitiveTypeSize(tn));
+                for (auto& dim : zm.dimensions)
+                    emitContinue(" * %s", dimCount(dim).c_str());
+                emitEnd("");
+                continue;
+            }
+            string acc = "self." + zm.membername;
+            size_t n = 0;
+            for (; n < zm.dimensions.size(); ++n) {
+                emit(2 + n, "for i%zu in range(%s):", n, dimCount(zm.dimensions[n]).c_str());
+                acc += "[i" + to_string(n) + "]";
+            }
+            if (tn == "string") {
+                emit(2 + n, "size += 5 + len(_zcm_utf8(%s))", acc.c_str());
+            } else {
+                emit(2 + n, "size += (<%s?> _zcm_not_none(%s))._encoded_size()",
+                     typeName(zm).c_str(), acc.c_str());
+            }
+        }
+        emit(2, "return size");
+        emit(0, "");
+    }
+
+    void emitEncodeElement(ZCMMember& zm, const string& acc, int indent)
+    {
+        auto& tn = zm.type.fullname;
+        if (tn == "string") {
+            emit(indent, "pos = _zcm_encode_string(buf, pos, _zcm_utf8(%s))", acc.c_str());
+        } else if (isNumber(tn)) {
+            emit(indent, "%s", storePrimitive(tn, "pos", acc).c_str());
+            emit(indent, "pos += %zu", ZCMGen::getPrimitiveTypeSize(tn));
+        } else {
+            emit(indent, "pos = (<%s?> _zcm_not_none(%s))._encode_into(buf, pos)",
+                 typeName(zm).c_str(), acc.c_str());
+        }
+    }
+
+    void emitEncodeInto()
+    {
+        emit(1, "cdef Py_ssize_t _encode_into(self, uint8_t* buf, Py_ssize_t pos) except -1:");
+        emit(2, "cdef Py_ssize_t n");
+        if (maxDims() > 0)
+            emit(2, "cdef Py_ssize_t %s", loopIndexes().c_str());
+        emit(2, "cdef bytes _b");
+        for (auto& zm : zs.members) {
+            auto& tn = zm.type.fullname;
+            string acc = "self." + zm.membername;
+            if (zm.dimensions.empty()) {
+                emitEncodeElement(zm, acc, 2);
+                continue;
+            }
+            size_t last = zm.dimensions.size() - 1;
+            for (size_t d = 0; d < last; ++d) {
+                emit(2 + d, "for i%zu in range(%s):", d, dimCount(zm.dimensions[d]).c_str());
+                acc += "[i" + to_string(d) + "]";
+            }
+            int indent = 2 + last;
+            string n = dimCount(zm.dimensions[last]);
+            string i = "i" + to_string(last);
+            if (tn == "byte") {
+                // encoded sizes count exactly n bytes
+                emit(indent, "n = %s", n.c_str());
+                emit(indent, "_b = bytes(bytearray(%s[:n]))", acc.c_str());
+                emit(indent, "if len(_b) != n:");
+                emit(indent + 1, "raise ValueError(\"Encode error: %s is too short\")",
+                     zm.membername.c_str());
+                emit(indent, "memcpy(buf + pos, <const char*> _b, n)");
+                emit(indent, "pos += n");
+            } else if (isNumber(tn)) {
+                size_t size = ZCMGen::getPrimitiveTypeSize(tn);
+                emit(indent, "for %s in range(%s):", i.c_str(), n.c_str());
+                emit(indent + 1, "%s", storePrimitive(tn, "pos + " + to_string(size) + " * " + i,
+                                                      acc + "[" + i + "]").c_str());
+                emit(indent, "pos += %zu * %s", size, n.c_str());
+            } else {
+                emit(indent, "for %s in range(%s):", i.c_str(), n.c_str());
+                emitEncodeElement(zm, acc + "[" + i + "]", indent + 1);
+            }
+        }
+        emit(2, "return pos");
+        emit(0, "");
+    }
+
+    void emitDecodeElement(ZCMMember& zm, const string& target, int indent)
+    {
+        auto& tn = zm.type.fullname;
+        if (tn == "string") {
+            emit(indent, "%s = _zcm_decode_string(buf, &pos, end)", target.c_str());
+        } else if (isNumber(tn)) {
+            size_t size = ZCMGen::getPrimitiveTypeSize(tn);
+            emit(indent, "_zcm_check(pos, %zu, end)", size);
+            emit(indent, "%s = %s", target.c_str(), loadPrimitive(tn, "pos").c_str());
+            emit(indent, "pos += %zu", size);
+        } else {
+            auto t = typeName(zm);
+            emit(indent, "_e = %s.__new__(%s)", t.c_str(), t.c_str());
+            emit(indent, "pos = (<%s> _e)._decode_from(buf, pos, end)", t.c_str());
+            if (target != "_e")
+                emit(indent, "%s = _e", target.c_str());
+        }
+    }
+
+    // Decodes dimension 'd' and the ones after it of 'zm' into the list _a<d>
+    void emitDecodeDim(ZCMMember& zm, size_t d, int indent)
+    {
+        auto& tn = zm.type.fullname;
+        string a = "_a" + to_string(d);
+        string i = "i" + to_string(d);
+        string n = dimCount(zm.dimensions[d]);
+        if (d + 1 < zm.dimensions.size()) {
+            emit(indent, "%s = []", a.c_str());
+            emit(indent, "for %s in range(%s):", i.c_str(), n.c_str());
+            emitDecodeDim(zm, d + 1, indent + 1);
+            emit(indent + 1, "%s.append(_a%zu)", a.c_str(), d + 1);
+        } else if (tn == "byte") {
+            emit(indent, "n = %s", n.c_str());
+            emit(indent, "_zcm_check(pos, n, end)");
+            emit(indent, "%s = (<const char*> buf)[pos:pos + n]", a.c_str());
+            emit(indent, "pos += n");
+        } else if (isNumber(tn)) {
+            string size = to_string(ZCMGen::getPrimitiveTypeSize(tn));
+            emit(indent, "n = %s", n.c_str());
+            emit(indent, "_zcm_check(pos, n * %s, end)", size.c_str());
+            emit(indent, "%s = []", a.c_str());
+            emit(indent, "for %s in range(n):", i.c_str());
+            emit(indent + 1, "%s.append(%s)", a.c_str(),
+                 loadPrimitive(tn, "pos + " + size + " * " + i).c_str());
+            emit(indent, "pos += n * %s", size.c_str());
+        } else {
+            emit(indent, "%s = []", a.c_str());
+            emit(indent, "for %s in range(%s):", i.c_str(), n.c_str());
+            emitDecodeElement(zm, "_e", indent + 1);
+            emit(indent + 1, "%s.append(_e)", a.c_str());
+        }
+    }
+
+    void emitDecodeFrom()
+    {
+        emit(1, "cdef Py_ssize_t _decode_from(self, const uint8_t* buf, Py_ssize_t pos,");
+        emit(1, "                             Py_ssize_t end) except -1:");
+        emit(2, "cdef Py_ssize_t n");
+        if (maxDims() > 0)
+            emit(2, "cdef Py_ssize_t %s", loopIndexes().c_str());
+        for (auto& zm : zs.members) {
+            if (zm.dimensions.empty()) {
+                emitDecodeElement(zm, "self." + zm.membername, 2);
+            } else {
+                emitDecodeDim(zm, 0, 2);
+                emit(2, "self.%s = _a0", zm.membername.c_str());
+            }
+        }
+        emit(2, "return pos");
+        emit(0, "");
+    }
+
+    void emitFingerprint()
+    {
+        auto* sn = zs.structname.shortname.c_str();
+
+        emit(1, "@staticmethod");
+        emit(1, "def _get_hash_recursive(parents):");
+        emit(2,     "if %s in parents: return 0", sn);
+        for (auto& zm : zs.members) {
+            if (!ZCMGen::isPrimitiveType(zm.type.fullname)) {
+                emit(2,     "newparents = parents + [%s]", sn);
+                break;
+            }
+        }
+        emitStart(2, "tmphash = (0x%" PRIx64, zs.hash);
+        for (auto &zm : zs.members)
+            if (!ZCMGen::isPrimitiveType(zm.type.fullname))
+                emitContinue("+ %s._get_hash_recursive(newparents)", typeName(zm).c_str());
+        emitEnd (") & 0xffffffffffffffff");
+        emit(2, "tmphash  = (((tmphash<<1)&0xffffffffffffffff)  + "
+             "((tmphash>>63)&0x1)) & 0xffffffffffffffff");
+        emit(2, "return tmphash");
+        emit(0, "");
+        emit(1, "@staticmethod");
+        emit(1, "def _get_packed_fingerprint():");
+        emit(2,     "global _packed_fingerprint");
+        emit(2,     "if _packed_fingerprint is None:");
+        emit(3,         "_packed_fingerprint = struct.pack(\">Q\", %s._get_hash_recursive([]))", sn);
+        emit(2,     "return _packed_fingerprint");
+    }
+};
+
 struct PyEmitPack : public Emitter
 {
     ZCMGen& zcm;
@@ -673,7 +1228,8 @@ struct PyEmitPack : public Emitter
             auto& zs = *ls_;
             auto& sn_ = zs.structname.shortname;
             auto* sn = sn_.c_str();
-            string path = packageDir + sn_ + ".py";
+            bool cython = zcm.gopt->getBool("pcython");
+            string path = packageDir + sn_ + (cython ? ".pyx" : ".py");
 
             if(initPyFp && initPyImports.find(sn_) == initPyImports.end()) {
                 fprintf(initPyFp, "from .%s import %s\n", sn, sn);
@@ -682,7 +1238,12 @@ struct PyEmitPack : public Emitter
             if (!zcm.needsGeneration(zs.zcmfile, path))
                 continue;
 
-            PyEmitStruct{zcm, zs, path}.emitStruct();
+            if (cython) {
+                PyxEmitStruct{zcm, zs, packageDir + sn_ + ".pxd"}.emitPxd();
+                PyxEmitStruct{zcm, zs, path}.emitPyx();
+            } else {
+                PyEmitStruct{zcm, zs, path}.emitStruct();
+            }
         }
 
         if(initPyFp)
@@ -698,6 +1259,10 @@ int emitPython(ZCMGen& zcm)
         printf("Python does not currently support little endian encoding\n");
         return -1;
     }
+    if (zcm.gopt->getBool("pnumpy") && zcm.gopt->getBool("pcython")) {
+        printf("--pnumpy and --pcython can't be used together\n");
+        return -1;
+    }
 
     unordered_map<string, vector<ZCMStruct*> > packages;
 
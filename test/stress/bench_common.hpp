@@ -0,0 +1,153 @@
+#pragma once
+
+// What the stress programs share: the transports they run over, each as two
+// zcm instances
+
+#include "zcm/zcm.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Two pseudo terminals joined back to back, standing in for a serial cable
+class PtyPair
+{
+  public:
+    ~PtyPair()
+    {
+        stop = true;
+        if (relay.joinable()) relay.join();
+        for (int fd : { master[0], master[1], slave[0], slave[1] })
+            if (fd >= 0) ::close(fd);
+    }
+
+    bool open()
+    {
+        for (int i = 0; i < 2; ++i) {
+            master[i] = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+            if (master[i] < 0 || grantpt(master[i]) || unlockpt(master[i])) return false;
+            path[i] = ptsname(master[i]);
+            // Held open so that the masters don't see a hangup between transports
+            slave[i] = ::open(path[i].c_str(), O_RDWR | O_NOCTTY);
+            if (slave[i] < 0) return false;
+            struct termios t;
+            if (tcgetattr(slave[i], &t)) return false;
+            cfmakeraw(&t);
+            if (tcsetattr(slave[i], TCSANOW, &t)) return false;
+        }
+        relay = std::thread([this]() { run(); });
+        return true;
+    }
+
+    std::string path[2];
+
+  private:
+    void run()
+    {
+        std::vector<uint8_t> buf(1 << 16);
+        while (!stop) {
+            struct pollfd fds[2] = { { master[0], POLLIN, 0 }, { master[1], POLLIN, 0 } };
+            if (poll(fds, 2, 10) <= 0) continue;
+            for (int i = 0; i < 2; ++i) {
+                if (!(fds[i].revents & POLLIN)) continue;
+                ssize_t n = ::read(master[i], buf.data(), buf.size());
+                for (ssize_t off = 0; n > 0 && off < n && !stop;) {
+                    ssize_t w = ::write(master[1 - i], buf.data() + off, n - off);
+                    if (w > 0) off += w;
+                    else usleep(100);
+                }
+            }
+        }
+    }
+
+    int master[2] = { -1, -1 };
+    int slave[2] = { -1, -1 };
+    std::thread relay;
+    std::atomic<bool> stop {false};
+};
+
+// The two ends of a transport: 'b' echoes what 'a' sends, and is 'a' itself
+// for transports that only loop back within one instance
+struct Link
+{
+    zcm_t* a = nullptr;
+    zcm_t* b = nullptr;
+    bool blocking = true;
+    PtyPair* pty = nullptr;
+
+    ~Link()
+    {
+        if (blocking) {
+            if (a) zcm_stop(a);
+            if (b && b != a) zcm_stop(b);
+        }
+        if (b && b != a) zcm_destroy(b);
+        if (a) zcm_destroy(a);
+        delete pty;
+    }
+
+    void start()
+    {
+        if (!blocking) return;
+        zcm_start(a);
+        if (b != a) zcm_start(b);
+    }
+
+    // Lets nonblocking instances dispatch what they received
+    void poll()
+    {
+        if (blocking) return;
+        while (zcm_handle_nonblock(b) == ZCM_EOK) {}
+        if (a != b) while (zcm_handle_nonblock(a) == ZCM_EOK) {}
+    }
+};
+
+static bool makeLink(const std::string& transport, bool blocking, Link& link)
+{
+    link.blocking = blocking;
+    std::string ua, ub;
+    bool loopback = false;
+
+    if (transport == "inproc") {
+        ua = blocking ? "block-inproc" : "nonblock-inproc";
+        loopback = true;
+    }
+#ifdef USING_TRANS_IPC
+    else if (transport == "ipc" && blocking) {
+        ua = ub = "ipc";
+    }
+#endif
+#ifdef USING_TRANS_UDPM
+    else if (transport == "udpm" && blocking) {
+        ua = ub = "udpm://239.255.76.67:7667?ttl=0";
+    }
+#endif
+#ifdef USING_TRANS_SHM
+    else if (transport == "shm" && blocking) {
+        ua = ub = "shm://zcm-bench-" + std::to_string(getpid());
+    }
+#endif
+#ifdef USING_TRANS_SERIAL
+    else if (transport == "serial") {
+        link.pty = new PtyPair();
+        if (!link.pty->open()) return false;
+        std::string scheme = blocking ? "serial://" : "nonblock-serial://";
+        ua = scheme + link.pty->path[0] + "?baud=115200";
+        ub = scheme + link.pty->path[1] + "?baud=115200";
+    }
+#endif
+    else {
+        return false;
+    }
+
+    link.a = zcm_create(ua.c_str());
+    link.b = loopback ? link.a : zcm_create(ub.c_str());
+    return link.a && link.b;
+}
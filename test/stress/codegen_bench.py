@@ -0,0 +1,577 @@
+#!/usr/bin/env python3
+#
+# Encode and decode throughput of the code zcm-gen emits, for each of the C,
+# C++, Python, Java and Node emitters and each of the given types. Every
+# language decodes the same sample message, and encodes it back: results are
+# printed one JSON object per line and per measurement, e.g.
+#
+#   {"lang":"cpp","type":"multidim_t","size":65554,"test":"decode",...}
+#
+# as transport_bench does. Run through "./waf bench", or directly (see --help)
+
+import argparse
+import glob
+import importlib
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), '..', '..'))
+
+# Types without a package, covering fixed, const, variable length and
+# multidimensional arrays, strings, nested and self recursive types
+DEFAULT_TYPES = ['example_t', 'example2_t', 'example3_t', 'encoded_t', 'multidim_t',
+                 'recursive_t']
+
+LANGS = ['c', 'cpp', 'python', 'java', 'node']
+
+PRIMITIVES = {
+    'int8_t': 100, 'byte': 256, 'int16_t': 30000, 'int32_t': 1 << 30, 'int64_t': 1 << 40,
+    'float': None, 'double': None, 'string': None, 'boolean': None,
+}
+
+################################################################################
+# Types
+
+class Field(object):
+    def __init__(self, type, name, dims):
+        self.type = type
+        self.name = name
+        self.dims = dims
+
+class Struct(object):
+    def __init__(self, name, fields, consts):
+        self.name = name
+        self.fields = fields
+        self.consts = consts
+
+def parse(path):
+    src = open(path).read()
+    src = re.sub(r'//[^\n]*|/\*.*?\*/', '', src, flags=re.S)
+    if re.search(r'\bpackage\b', src):
+        return None
+    m = re.search(r'struct\s+(\w+)\s*\{(.*)\}', src, flags=re.S)
+    if not m:
+        return None
+    fields, consts = [], {}
+    for decl in m.group(2).split(';'):
+        decl = decl.strip()
+        if not decl:
+            continue
+        c = re.match(r'const\s+\w+\s+(.*)', decl, flags=re.S)
+        if c:
+            for assign in c.group(1).split(','):
+                k, v = [s.strip() for s in assign.split('=')]
+                consts[k] = v
+            continue
+        f = re.match(r'([\w.]+)\s+(\w+)\s*((?:\[\s*\w+\s*\])*)$', decl)
+        if not f:
+            return None
+        dims = re.findall(r'\[\s*(\w+)\s*\]', f.group(3))
+        fields.append(Field(f.group(1), f.group(2), dims))
+    return Struct(m.group(1), fields, consts)
+
+def loadTypes(names, dirs):
+    paths = {}
+    for d in dirs:
+        for p in glob.glob(os.path.join(d, '*.zcm')):
+            paths.setdefault(os.path.basename(p)[:-4], p)
+    types = {}
+    def load(name):
+        if name in types:
+            return True
+        if name not in paths:
+            return False
+        s = parse(paths[name])
+        if not s or s.name != name:
+            return False
+        types[name] = s
+        return all(load(f.type) for f in s.fields if f.type not in PRIMITIVES)
+    ok = []
+    for n in names:
+        if load(n):
+            ok.append(n)
+        else:
+            sys.stderr.write('Skipping %s: not found, or packaged\n' % n)
+    return ok, types, paths
+
+################################################################################
+# The sample messages, encoded by the generated Python code
+
+class Sampler(object):
+    def __init__(self, types, modules, length):
+        self.types = types
+        self.modules = modules
+        self.length = length
+        self.counter = 0
+
+    def value(self, type):
+        self.counter += 1
+        i = self.counter
+        if type == 'string':
+            return 'bench-%d' % i
+        if type == 'boolean':
+            return bool(i & 1)
+        if type in ('float', 'double'):
+            return i * 0.5
+        return i % PRIMITIVES[type]
+
+    def array(self, type, sizes, stack):
+        if not sizes:
+            if type in PRIMITIVES:
+                return self.value(type)
+            return self.make(type, stack)
+        ret = [self.array(type, sizes[1:], stack) for _ in range(sizes[0])]
+        if type == 'byte' and len(sizes) == 1:
+            return bytes(ret)
+        return ret
+
+    def make(self, name, stack=()):
+        s = self.types[name]
+        msg = getattr(self.modules[name], name)()
+        stack = stack + (name,)
+
+        # Sizes of the variable length arrays: small ones for arrays of types
+        # already being made, so that recursion ends
+        lengths = {}
+        for f in s.fields:
+            for d in f.dims:
+                if d in s.consts or d.isdigit():
+                    continue
+                n = self.length
+                if f.type in stack:
+                    n = 2 if len(stack) == 1 else 0
+                sizeType = next(g.type for g in s.fields if g.name == d)
+                n = min(n, PRIMITIVES[sizeType] - 1)
+                lengths[d] = min(lengths.get(d, n), n)
+
+        for f in s.fields:
+            if f.name in lengths:
+                setattr(msg, f.name, lengths[f.name])
+                continue
+            sizes = []
+            for d in f.dims:
+                if d.isdigit():
+                    sizes.append(int(d))
+                elif d in s.consts:
+                    sizes.append(int(s.consts[d], 0))
+                else:
+                    sizes.append(lengths[d])
+            setattr(msg, f.name, self.array(f.type, sizes, stack))
+        return msg
+
+################################################################################
+# Harnesses: each reads the samples it's given, then decodes and encodes each
+# one for as long as it's given, printing what transport_bench prints
+
+C_HARNESS = r'''
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+%(includes)s
+
+static double secs;
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint8_t* readSample(const char* path, uint32_t* len)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* buf = malloc(*len);
+    if (fread(buf, 1, *len, f) != *len) { free(buf); buf = NULL; }
+    fclose(f);
+    return buf;
+}
+
+static void report(const char* type, uint32_t size, const char* test, uint64_t n,
+                   uint64_t ns, int ok)
+{
+    printf("{\"lang\":\"c\",\"type\":\"%%s\",\"size\":%%u,\"test\":\"%%s\",\"count\":%%llu,"
+           "\"ns_per_msg\":%%.3f,\"mb_per_s\":%%.3f%%s}\n",
+           type, size, test, (unsigned long long) n, (double) ns / n,
+           (double) size * n / (ns / 1e9) / 1e6, ok ? "" : ",\"error\":\"mismatch\"");
+}
+
+#define BENCH(T)                                                                \
+static void bench_##T(const char* path)                                         \
+{                                                                               \
+    uint32_t len;                                                               \
+    uint8_t* in = readSample(path, &len);                                       \
+    uint8_t* out = malloc(len);                                                 \
+    T msg;                                                                      \
+    uint64_t n = 0, start = nowNs(), end = start + secs * 1e9;                  \
+    do {                                                                        \
+        if (T##_decode(in, 0, len, &msg) != (int) len) break;                   \
+        T##_decode_cleanup(&msg);                                               \
+        ++n;                                                                    \
+    } while ((n & 63) || nowNs() < end);                                        \
+    report(#T, len, "decode", n, nowNs() - start, n > 0);                     \
+                                                                                \
+    T##_decode(in, 0, len, &msg);                                               \
+    n = 0, start = nowNs(), end = start + secs * 1e9;                           \
+    do {                                                                        \
+        if (T##_encode(out, 0, len, &msg) != (int) len) break;                  \
+        ++n;                                                                    \
+    } while ((n & 63) || nowNs() < end);                                        \
+    report(#T, len, "encode", n, nowNs() - start, n > 0 && !memcmp(in, out, len)); \
+    T##_decode_cleanup(&msg);                                                   \
+    free(in);                                                                   \
+    free(out);                                                                  \
+}
+
+%(benches)s
+
+int main(int argc, char* argv[])
+{
+    secs = atof(argv[1]);
+%(calls)s
+    return 0;
+}
+'''
+
+CPP_HARNESS = r'''
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+%(includes)s
+
+static double secs;
+
+static uint64_t nowNs()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char* type, uint32_t size, const char* test, uint64_t n,
+                   uint64_t ns, bool ok)
+{
+    printf("{\"lang\":\"cpp\",\"type\":\"%%s\",\"size\":%%u,\"test\":\"%%s\",\"count\":%%llu,"
+           "\"ns_per_msg\":%%.3f,\"mb_per_s\":%%.3f%%s}\n",
+           type, size, test, (unsigned long long) n, (double) ns / n,
+           (double) size * n / (ns / 1e9) / 1e6, ok ? "" : ",\"error\":\"mismatch\"");
+}
+
+template <typename T>
+static void bench(const char* name, const char* path)
+{
+    std::ifstream f(path, std::ios::binary);
+    std::vector<uint8_t> in((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    std::vector<uint8_t> out(in.size());
+    int len = in.size();
+
+    T msg;
+    uint64_t n = 0, start = nowNs(), end = start + secs * 1e9;
+    do {
+        if (msg.decode(in.data(), 0, len) != len) break;
+        ++n;
+    } while ((n & 63) || nowNs() < end);
+    report(name, len, "decode", n, nowNs() - start, n > 0);
+
+    n = 0, start = nowNs(), end = start + secs * 1e9;
+    do {
+        if (msg.encode(out.data(), 0, len) != len) break;
+        ++n;
+    } while ((n & 63) || nowNs() < end);
+    report(name, len, "encode", n, nowNs() - start, n > 0 && in == out);
+}
+
+int main(int argc, char* argv[])
+{
+    secs = atof(argv[1]);
+%(calls)s
+    return 0;
+}
+'''
+
+PYTHON_HARNESS = r'''
+import json, sys, time
+secs = float(sys.argv[1])
+
+def report(type, size, test, n, ns, ok):
+    r = {'lang': 'python', 'type': type, 'size': size, 'test': test, 'count': n,
+         'ns_per_msg': round(ns / n, 3), 'mb_per_s': round(size * n / (ns / 1e9) / 1e6, 3)}
+    if not ok: r['error'] = 'mismatch'
+    print(json.dumps(r, separators=(',', ':')), flush=True)
+
+for name, path in zip(sys.argv[2::2], sys.argv[3::2]):
+    cls = getattr(__import__(name), name)
+    data = open(path, 'rb').read()
+    n, start = 0, time.monotonic_ns()
+    end = start + secs * 1e9
+    while True:
+        msg = cls.decode(data)
+        n += 1
+        if time.monotonic_ns() >= end: break
+    report(name, len(data), 'decode', n, time.monotonic_ns() - start, True)
+    n, start = 0, time.monotonic_ns()
+    end = start + secs * 1e9
+    while True:
+        out = msg.encode()
+        n += 1
+        if time.monotonic_ns() >= end: break
+    report(name, len(data), 'encode', n, time.monotonic_ns() - start, out == data)
+'''
+
+JAVA_HARNESS = r'''
+import java.lang.reflect.Constructor;
+import java.nio.ByteBuffer;
+import java.nio.file.Files;
+import java.nio.file.Paths;
+import java.util.Arrays;
+import zcm.zcm.ZCMBufferEncodable;
+
+public class CodegenBench
+{
+    static void report(String type, int size, String test, long n, long ns, boolean ok)
+    {
+        System.out.printf("{\"lang\":\"java\",\"type\":\"%%s\",\"size\":%%d,\"test\":\"%%s\","
+                          + "\"count\":%%d,\"ns_per_msg\":%%.3f,\"mb_per_s\":%%.3f%%s}%%n",
+                          type, size, test, n, (double) ns / n,
+                          (double) size * n / (ns / 1e9) / 1e6,
+                          ok ? "" : ",\"error\":\"mismatch\"");
+    }
+
+    public static void main(String[] args) throws Exception
+    {
+        double secs = Double.parseDouble(args[0]);
+        for (int i = 1; i + 1 < args.length; i += 2) {
+            Constructor<?> ctor = Class.forName("bench." + args[i]).getConstructor(ByteBuffer.class);
+            byte[] data = Files.readAllBytes(Paths.get(args[i + 1]));
+            ByteBuffer in = ByteBuffer.wrap(data);
+            ByteBuffer out = ByteBuffer.allocate(data.length);
+
+            // Twice each, the first one warming up the JIT
+            for (int pass = 0; pass < 2; ++pass) {
+                ZCMBufferEncodable msg = null;
+                long n = 0, start = System.nanoTime(), end = start + (long) (secs * 1e9);
+                do {
+                    in.rewind();
+                    msg = (ZCMBufferEncodable) ctor.newInstance(in);
+                    ++n;
+                } while ((n & 63) != 0 || System.nanoTime() < end);
+                if (pass == 1) report(args[i], data.length, "decode", n, System.nanoTime() - start, true);
+
+                n = 0;
+                start = System.nanoTime();
+                end = start + (long) (secs * 1e9);
+                do {
+                    out.clear();
+                    msg.encode(out);
+                    ++n;
+                } while ((n & 63) != 0 || System.nanoTime() < end);
+                if (pass == 1) report(args[i], data.length, "encode", n, System.nanoTime() - start,
+                                      Arrays.equals(data, out.array()));
+            }
+        }
+    }
+}
+'''
+
+NODE_HARNESS = r'''
+var fs = require('fs');
+var zcmtypes = require('./zcmtypes');
+var secs = parseFloat(process.argv[2]);
+
+function nowNs() { return Number(process.hrtime.bigint()); }
+
+function report(type, size, test, n, ns, ok)
+{
+    var r = { lang: 'node', type: type, size: size, test: test, count: n,
+              ns_per_msg: +(ns / n).toFixed(3), mb_per_s: +(size * n / (ns / 1e9) / 1e6).toFixed(3) };
+    if (!ok) r.error = 'mismatch';
+    console.log(JSON.stringify(r));
+}
+
+for (var i = 3; i + 1 < process.argv.length; i += 2) {
+    var name = process.argv[i];
+    var T = zcmtypes[name];
+    var data = fs.readFileSync(process.argv[i + 1]);
+    var msg, out, n, start, end;
+
+    n = 0; start = nowNs(); end = start + secs * 1e9;
+    do { msg = T.decode(data); ++n; } while ((n & 63) || nowNs() < end);
+    report(name, data.length, 'decode', n, nowNs() - start, true);
+
+    n = 0; start = nowNs(); end = start + secs * 1e9;
+    do { out = T.encode(msg); ++n; } while ((n & 63) || nowNs() < end);
+    report(name, data.length, 'encode', n, nowNs() - start, Buffer.compare(out, data) == 0);
+}
+'''
+
+################################################################################
+
+def error(lang, name, msg):
+    print(json.dumps({'lang': lang, 'type': name, 'error': msg}, separators=(',', ':')),
+          flush=True)
+
+def run(lang, names, cmd, **kw):
+    sys.stderr.write('%s\n' % lang)
+    try:
+        subprocess.check_call(cmd, **kw)
+    except (OSError, subprocess.CalledProcessError) as e:
+        for n in names:
+            error(lang, n, 'harness failed: %s' % e)
+
+def compile(lang, names, cmd):
+    try:
+        subprocess.check_output(cmd, stderr=subprocess.STDOUT)
+        return True
+    except (OSError, subprocess.CalledProcessError) as e:
+        sys.stderr.write(getattr(e, 'output', b'').decode(errors='replace'))
+        for n in names:
+            error(lang, n, 'unable to build the harness')
+        return False
+
+def main():
+    p = argparse.ArgumentParser(description='Measures the encode and decode throughput '
+                                'of the code zcm-gen emits, printing one JSON object per '
+                                'line and per measurement.')
+    p.add_argument('-b', '--build-dir', default=os.path.join(ROOT, 'build'),
+                   help='Where zcm was built (default %(default)s)')
+    p.add_argument('-l', '--langs', default=','.join(LANGS),
+                   help='Comma separated, among %s (default all)' % ', '.join(LANGS))
+    p.add_argument('-t', '--types', default=','.join(DEFAULT_TYPES),
+                   help='Comma separated type names, found in the --type-dirs; packaged '
+                   'types are skipped (default %(default)s)')
+    p.add_argument('--type-dirs', default=os.path.join(ROOT, 'examples', 'types'),
+                   help='Comma separated directories of .zcm files (default %(default)s)')
+    p.add_argument('-n', '--length', type=int, default=64,
+                   help='Length of the variable length arrays of the samples (default '
+                   '%(default)s)')
+    p.add_argument('-d', '--seconds', type=float, default=0.5,
+                   help='Time spent on each measurement (default %(default)s)')
+    p.add_argument('-k', '--keep', action='store_true',
+                   help='Keep the generated code and samples, printing where they are')
+    args = p.parse_args()
+
+    langs = [l for l in args.langs.split(',') if l]
+    for l in langs:
+        if l not in LANGS:
+            p.error('unknown language: %s' % l)
+    args.build_dir = os.path.abspath(args.build_dir)
+    zcmgen = os.path.join(args.build_dir, 'gen', 'zcm-gen')
+    if not os.path.exists(zcmgen):
+        p.error('%s not found: build zcm, or give its --build-dir' % zcmgen)
+
+    names, types, paths = loadTypes([t for t in args.types.split(',') if t],
+                                    args.type_dirs.split(','))
+    if not names:
+        return 1
+    zcms = sorted(set(paths[n] for n in types))
+    secs = str(args.seconds)
+
+    tmp = tempfile.mkdtemp(prefix='zcm-codegen-bench-')
+    try:
+        def gen(*flags):
+            subprocess.check_call([zcmgen] + list(flags) + zcms, cwd=tmp)
+
+        # Python encodes the samples every language decodes
+        gen('--python', '--ppath', os.path.join(tmp, 'python'))
+        sys.path.insert(0, os.path.join(tmp, 'python'))
+        modules = dict((n, importlib.import_module(n)) for n in types)
+        sampler = Sampler(types, modules, args.length)
+        samples = []
+        for n in names:
+            path = os.path.join(tmp, n + '.bin')
+            with open(path, 'wb') as f:
+                f.write(sampler.make(n).encode())
+            samples += [n, path]
+
+        cc = os.environ.get('CC', 'cc')
+        cxx = os.environ.get('CXX', 'c++')
+        zcmlib = ['-L' + os.path.join(args.build_dir, 'zcm'), '-lzcm',
+                  '-Wl,-rpath,' + os.path.join(args.build_dir, 'zcm')]
+
+        if 'c' in langs:
+            d = os.path.join(tmp, 'c')
+            gen('--c', '--c-cpath', d, '--c-hpath', d)
+            with open(os.path.join(d, 'bench.c'), 'w') as f:
+                f.write(C_HARNESS % {
+                    'includes': '\n'.join('#include "%s.h"' % n for n in names),
+                    'benches': '\n'.join('BENCH(%s)' % n for n in names),
+                    'calls': '\n'.join('    bench_%s(argv[%d]);' % (n, 2 + i)
+                                       for i, n in enumerate(names)),
+                })
+            exe = os.path.join(d, 'bench')
+            if compile('c', names, [cc, '-O2', '-std=gnu99', '-I' + ROOT, '-I' + d, '-o', exe]
+                       + glob.glob(os.path.join(d, '*.c')) + zcmlib):
+                run('c', names, [exe, secs] + samples[1::2])
+
+        if 'cpp' in langs:
+            d = os.path.join(tmp, 'cpp')
+            gen('--cpp', '--cpp-hpath', d)
+            with open(os.path.join(d, 'bench.cpp'), 'w') as f:
+                f.write(CPP_HARNESS % {
+                    'includes': '\n'.join('#include "%s.hpp"' % n for n in names),
+                    'calls': '\n'.join('    bench<%s>("%s", argv[%d]);' % (n, n, 2 + i)
+                                       for i, n in enumerate(names)),
+                })
+            exe = os.path.join(d, 'bench')
+            if compile('cpp', names, [cxx, '-O2', '-std=c++11', '-I' + ROOT, '-I' + d, '-o', exe,
+                                      os.path.join(d, 'bench.cpp')] + zcmlib):
+                run('cpp', names, [exe, secs] + samples[1::2])
+
+        if 'python' in langs:
+            d = os.path.join(tmp, 'python')
+            with open(os.path.join(d, 'bench.py'), 'w') as f:
+                f.write(PYTHON_HARNESS)
+            run('python', names, [sys.executable, os.path.join(d, 'bench.py'), secs] + samples,
+                cwd=d)
+
+        if 'java' in langs:
+            d = os.path.join(tmp, 'java')
+            jar = os.path.join(args.build_dir, 'zcm', 'java', 'zcm.jar')
+            javac = shutil.which('javac')
+            if not javac or not os.path.exists(jar):
+                for n in names:
+                    error('java', n, 'javac or %s not found' % jar)
+            else:
+                gen('--java', '--jpath', d, '--jdefaultpkg', 'bench')
+                with open(os.path.join(d, 'CodegenBench.java'), 'w') as f:
+                    f.write(JAVA_HARNESS)
+                if compile('java', names, [javac, '-cp', jar, '-d', d] +
+                           glob.glob(os.path.join(d, '**', '*.java'), recursive=True)):
+                    run('java', names, ['java', '-cp', jar + ':' + d, 'CodegenBench', secs]
+                        + samples)
+
+        if 'node' in langs:
+            d = os.path.join(tmp, 'node')
+            node = shutil.which('node') or shutil.which('nodejs')
+            if not node:
+                for n in names:
+                    error('node', n, 'node not found')
+            else:
+                os.makedirs(d)
+                gen('--node', '--npath', d)
+                with open(os.path.join(d, 'bench.js'), 'w') as f:
+                    f.write(NODE_HARNESS)
+                run('node', names, [node, os.path.join(d, 'bench.js'), secs] + samples, cwd=d)
+    finally:
+        if args.keep:
+            sys.stderr.write('Kept %s\n' % tmp)
+        else:
+            shutil.rmtree(tmp)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,57 @@
+#include "zcm/zcm_coretypes.h"
+
+#include "util/TimeUtil.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#define BYTES (4 << 20)
+#define ROUNDS 50
+
+// Encodes and decodes arrays of BYTES bytes of T, ROUNDS times each,
+// prints the throughput of each in GB/s
+template <class T>
+static void bench(const char *name,
+                  int (*enc)(void*, uint32_t, uint32_t, const T*, uint32_t),
+                  int (*dec)(const void*, uint32_t, uint32_t, T*, uint32_t))
+{
+    uint32_t n = BYTES / sizeof(T);
+    std::vector<T> in(n), out(n);
+    std::vector<uint8_t> buf(BYTES);
+    for (uint32_t i = 0; i < n; ++i) in[i] = (T) (i * 7);
+
+    uint64_t start = TimeUtil::utime();
+    for (int r = 0; r < ROUNDS; ++r) enc(buf.data(), 0, BYTES, in.data(), n);
+    uint64_t encUs = TimeUtil::utime() - start;
+
+    start = TimeUtil::utime();
+    for (int r = 0; r < ROUNDS; ++r) dec(buf.data(), 0, BYTES, out.data(), n);
+    uint64_t decUs = TimeUtil::utime() - start;
+
+    if (in != out) fprintf(stderr, "%s: decoded array differs\n", name);
+
+    double gb = (double) BYTES * ROUNDS / 1e9;
+    printf("%-24s encode %6.2f GB/s  decode %6.2f GB/s\n",
+           name, gb / (encUs / 1e6), gb / (decUs / 1e6));
+}
+
+int main(int argc, char *argv[])
+{
+    bench<int16_t>("int16_t",                  __int16_t_encode_array, __int16_t_decode_array);
+    bench<int32_t>("int32_t",                  __int32_t_encode_array, __int32_t_decode_array);
+    bench<int64_t>("int64_t",                  __int64_t_encode_array, __int64_t_decode_array);
+    bench<float>  ("float",                    __float_encode_array,   __float_decode_array);
+    bench<double> ("double",                   __double_encode_array,  __double_decode_array);
+    bench<int16_t>("int16_t (little endian)",  __int16_t_encode_little_endian_array,
+                                               __int16_t_decode_little_endian_array);
+    bench<int32_t>("int32_t (little endian)",  __int32_t_encode_little_endian_array,
+                                               __int32_t_decode_little_endian_array);
+    bench<int64_t>("int64_t (little endian)",  __int64_t_encode_little_endian_array,
+                                               __int64_t_decode_little_endian_array);
+    bench<float>  ("float (little endian)",    __float_encode_little_endian_array,
+                                               __float_decode_little_endian_array);
+    bench<double> ("double (little endian)",   __double_encode_little_endian_array,
+                                               __double_decode_little_endian_array);
+    return 0;
+}
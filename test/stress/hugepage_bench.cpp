@@ -0,0 +1,96 @@
+#include "zcm/util/huge_pages.hpp"
+
+#include "util/TimeUtil.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <sys/mman.h>
+
+// The size of the buffer copied through, the order of a shm ring or a pool
+// of partly received messages
+#define REGION_MB 512
+// Copies of one fragment (udpm's payload) at random spots of the region
+#define FRAG_BYTES 1400
+#define NUM_FRAGS 4000000
+
+// What /proc reports of the huge pages backing this process right now, in KB.
+// Explicit huge pages don't count into AnonHugePages
+static long anonHugeKb()
+{
+    FILE* f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) break;
+    fclose(f);
+    return kb;
+}
+
+// Copies fragments in and out of random spots of 'region', the way messages
+// are assembled and read back, which takes a TLB miss each unless the pages
+// are big. Returns the ns per fragment
+static double bench(const char* name, uint8_t* region, size_t size)
+{
+    // Touched up front, so page faults don't count
+    memset(region, 1, size);
+
+    std::vector<size_t> offsets(1 << 16);
+    uint64_t x = 88172645463325252ull;
+    for (auto& off : offsets) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        off = x % (size - FRAG_BYTES);
+    }
+
+    uint8_t frag[FRAG_BYTES];
+    memset(frag, 2, sizeof(frag));
+    uint64_t sum = 0;
+    uint64_t start = TimeUtil::utime();
+    for (size_t i = 0; i < NUM_FRAGS; ++i) {
+        // Written to one spot, read back from another
+        memcpy(region + offsets[i % offsets.size()], frag, FRAG_BYTES);
+        memcpy(frag, region + offsets[(i + offsets.size() / 2) % offsets.size()], FRAG_BYTES);
+        sum += frag[i % FRAG_BYTES];
+    }
+    uint64_t elapsed = TimeUtil::utime() - start;
+
+    double ns = (double) elapsed * 1000.0 / NUM_FRAGS;
+    double gbs = 2.0 * FRAG_BYTES * NUM_FRAGS / ((double) elapsed * 1000.0);
+    printf("%-16s %8.1f ns/frag  %6.2f GB/s  (AnonHugePages %ld kB, sum %llu)\n",
+           name, ns, gbs, anonHugeKb(), (unsigned long long) (sum & 0xff));
+    return ns;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t size = (size_t) (argc > 1 ? atoi(argv[1]) : REGION_MB) << 20;
+
+    uint8_t* small = (uint8_t*) mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (small == MAP_FAILED) {
+        fprintf(stderr, "failed to map %zu bytes\n", size);
+        return 1;
+    }
+#ifdef MADV_NOHUGEPAGE
+    madvise(small, size, MADV_NOHUGEPAGE);
+#endif
+    double base = bench("4k pages", small, size);
+    munmap(small, size);
+
+    HugePages::Backing how;
+    uint8_t* huge = (uint8_t*) HugePages::map(size, &how);
+    if (!huge) {
+        fprintf(stderr, "failed to map %zu bytes of huge pages\n", size);
+        return 1;
+    }
+    std::string name = std::string("huge (") + HugePages::backingName(how) + ")";
+    double ns = bench(name.c_str(), huge, size);
+    HugePages::unmap(huge, size);
+
+    printf("huge pages: %.2fx\n", base / ns);
+    return 0;
+}
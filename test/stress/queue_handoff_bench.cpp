@@ -0,0 +1,110 @@
+#include "zcm/zcm.h"
+#include "zcm/util/queue.hpp"
+#include "zcm/util/threadsafe_queue.hpp"
+#include "zcm/util/spsc_queue.hpp"
+
+#include "util/TimeUtil.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+
+#define N 2000000
+#define QUEUE_SIZE 16
+
+// Stand-in for the blocking layer's Msg: something non-trivial to construct
+struct Elt
+{
+    uint64_t utime;
+    uint64_t seq;
+    Elt(uint64_t utime, uint64_t seq) : utime(utime), seq(seq) {}
+};
+
+// A Queue behind a spinlock, polled rather than waited on: without the
+// condition variable of ThreadsafeQueue, what's left of the handoff is mostly
+// the cache lines of the Queue moving between the cores
+template <class Element>
+class SpinlockQueue
+{
+    Queue<Element> queue;
+    std::atomic_flag locked = ATOMIC_FLAG_INIT;
+
+    void lock()   { while (locked.test_and_set(std::memory_order_acquire)) std::this_thread::yield(); }
+    void unlock() { locked.clear(std::memory_order_release); }
+
+  public:
+    SpinlockQueue(size_t size) : queue(size) {}
+
+    template <class... Args>
+    void push(Args&&... args)
+    {
+        while (true) {
+            lock();
+            if (queue.hasFreeSpace()) break;
+            unlock();
+            std::this_thread::yield();
+        }
+        queue.push(std::forward<Args>(args)...);
+        unlock();
+    }
+
+    // Only the consumer pops, so the top stays put once there is one
+    Element* top()
+    {
+        while (true) {
+            lock();
+            bool has = queue.hasMessage();
+            Element* e = has ? &queue.top() : nullptr;
+            unlock();
+            if (has) return e;
+            std::this_thread::yield();
+        }
+    }
+
+    void pop()
+    {
+        lock();
+        queue.pop();
+        unlock();
+    }
+};
+
+// Pushes N elements from one thread and pops them in another,
+// returns the average producer->consumer handoff cost in ns
+template <class QueueType>
+static double bench(const char *name)
+{
+    QueueType q {QUEUE_SIZE};
+
+    uint64_t start = TimeUtil::utime();
+
+    std::thread producer {[&]() {
+        for (uint64_t i = 0; i < N; ++i)
+            q.push(0, i);
+    }};
+
+    uint64_t expected = 0;
+    for (uint64_t i = 0; i < N; ++i) {
+        Elt *e = q.top();
+        if (!e || e->seq != expected++) {
+            fprintf(stderr, "%s: out of order element\n", name);
+            break;
+        }
+        q.pop();
+    }
+    producer.join();
+
+    uint64_t elapsed = TimeUtil::utime() - start;
+    double ns = (double)elapsed * 1000.0 / N;
+    printf("%-16s %8.1f ns/msg  %8.2f Mmsg/s\n", name, ns, N / (double)elapsed);
+    return ns;
+}
+
+int main(int argc, char *argv[])
+{
+    bench<SpinlockQueue<Elt>>("Queue");
+    bench<ThreadsafeQueue<Elt>>("ThreadsafeQueue");
+    bench<SpscQueue<Elt>>("SpscQueue");
+    return 0;
+}
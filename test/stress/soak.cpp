@@ -0,0 +1,458 @@
+// Long running mixed workload over every transport built: many channels,
+// subscriptions coming and going, pauses, queue resizes, and messages small and
+// big. Samples the resident memory as it goes, counts the allocations each
+// message costs and the dispatch latency of every message, printing one JSON
+// object per line:
+//
+//   {"transport":"udpm","mode":"blocking","test":"rss","t_s":10.000,"rss_kb":5120}
+//   {"transport":"udpm","mode":"blocking","test":"soak","received":...,"p999_us":...}
+//
+// and fails when the memory grows, or the allocations or the latency go over
+// the limits given (see --help). Run directly: a useful soak takes hours
+
+#include "zcm/zcm.h"
+#include "zcm/util/latency_hist.h"
+
+#include "util/TimeUtil.hpp"
+
+#include "bench_common.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Every allocation of the process, zcm's included: the program's own malloc()
+// family, in front of glibc's
+static atomic<uint64_t> allocs {0};
+
+#ifdef __GLIBC__
+static const bool countingAllocs = true;
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void  __libc_free(void* p);
+
+void* malloc(size_t size)
+{
+    allocs.fetch_add(1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    allocs.fetch_add(1, memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    allocs.fetch_add(1, memory_order_relaxed);
+    return __libc_realloc(p, size);
+}
+
+void free(void* p)
+{
+    __libc_free(p);
+}
+}
+#else
+static const bool countingAllocs = false;
+#endif
+
+struct Options
+{
+    vector<string> transports;
+    vector<string> modes { "blocking", "nonblocking" };
+    vector<uint32_t> sizes { 64, 4096, 256 << 10 };
+    uint32_t channels = 32;
+    // Per transport and mode. Nothing counts during the first 'warmup' seconds,
+    // while caches and queues settle
+    double seconds = 60;
+    double warmup = 10;
+    double sampleSeconds = 10;
+    uint32_t rate = 2000;
+    // The limits a run fails over. 0 for none
+    uint64_t maxRssGrowthKb = 8192;
+    double maxAllocsPerMsg = 0;
+    double maxP999Us = 0;
+    FILE* out = stdout;
+};
+
+static Options opts;
+
+static vector<string> split(const string& s)
+{
+    vector<string> ret;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == string::npos) end = s.size();
+        if (end > start) ret.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    return ret;
+}
+
+// One JSON object per line
+class Record
+{
+  public:
+    Record(const string& transport, const string& mode, const char* test)
+    {
+        s = "{\"transport\":\"" + transport + "\",\"mode\":\"" + mode + "\"" +
+            ",\"test\":\"" + test + "\"";
+    }
+
+    Record& add(const char* key, uint64_t v)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), ",\"%s\":%llu", key, (unsigned long long) v);
+        s += buf;
+        return *this;
+    }
+
+    Record& add(const char* key, double v)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), ",\"%s\":%.3f", key, v);
+        s += buf;
+        return *this;
+    }
+
+    Record& add(const char* key, const string& v)
+    {
+        s += ",\"" + string(key) + "\":\"" + v + "\"";
+        return *this;
+    }
+
+    void print()
+    {
+        fprintf(opts.out, "%s}\n", s.c_str());
+        fflush(opts.out);
+    }
+
+  private:
+    string s;
+};
+
+// The resident memory that is the process' own: without the pages mapped from
+// files and shared memory, that the shm transport touches as its rings wrap
+static uint64_t rssKb()
+{
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long long size = 0, resident = 0, shared = 0;
+    int n = fscanf(f, "%llu %llu %llu", &size, &resident, &shared);
+    fclose(f);
+    if (n != 3 || shared > resident) return 0;
+    return (resident - shared) * (uint64_t) sysconf(_SC_PAGESIZE) / 1024;
+}
+
+// Each message starts with when it was published and the pause epoch it was
+// published in: messages a pause held back don't count toward the latency
+struct Stamp
+{
+    uint64_t ns;
+    uint64_t epoch;
+};
+
+struct SoakState
+{
+    atomic<uint64_t> epoch {0};
+    atomic<bool> measuring {false};
+    atomic<uint64_t> received {0};
+    atomic<uint64_t> hist[ZCM_LATENCY_HIST_BUCKETS];
+
+    SoakState()
+    {
+        for (auto& c : hist) c.store(0, memory_order_relaxed);
+    }
+};
+
+static void soakHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    SoakState* st = (SoakState*) usr;
+    if (rbuf->data_size < sizeof(Stamp) || !st->measuring.load(memory_order_relaxed)) return;
+    Stamp stamp;
+    memcpy(&stamp, rbuf->data, sizeof(stamp));
+    st->received.fetch_add(1, memory_order_relaxed);
+    if (stamp.epoch != st->epoch.load(memory_order_relaxed)) return;
+    uint64_t now = TimeUtil::monoNs();
+    uint64_t ns = now > stamp.ns ? now - stamp.ns : 0;
+    st->hist[zcm_latency_hist_bucket(ns)].fetch_add(1, memory_order_relaxed);
+}
+
+// Returns whether the run stayed within the limits
+static bool soak(const string& transport, const string& mode, Link& link)
+{
+    SoakState st;
+    vector<string> channels;
+    vector<zcm_sub_t*> subs;
+    for (uint32_t i = 0; i < opts.channels; ++i) {
+        channels.push_back("SOAK_" + to_string(i));
+        subs.push_back(zcm_subscribe(link.b, channels.back().c_str(), soakHandler, &st));
+    }
+    link.start();
+
+    vector<vector<uint8_t>> msgs;
+    for (uint32_t size : opts.sizes) msgs.emplace_back(max<size_t>(size, sizeof(Stamp)));
+
+    uint64_t start = TimeUtil::monoNs();
+    uint64_t warm = start + opts.warmup * 1e9;
+    uint64_t end = warm + opts.seconds * 1e9;
+    uint64_t periodNs = 1e9 / max<uint32_t>(opts.rate, 1);
+    uint64_t nextSample = warm;
+    uint64_t rssStart = 0, rssPeak = 0, allocStart = 0, sent = 0;
+    uint32_t queueSize = 0;
+    bool measuring = false;
+
+    for (uint64_t i = 0, now = start; now < end; ++i, now = TimeUtil::monoNs()) {
+        if (!measuring && now >= warm) {
+            measuring = true;
+            rssStart = rssPeak = rssKb();
+            allocStart = allocs.load();
+            st.measuring = true;
+        }
+        if (measuring && now >= nextSample) {
+            uint64_t rss = rssKb();
+            rssPeak = max(rssPeak, rss);
+            Record(transport, mode, "rss").add("t_s", (now - warm) / 1e9)
+                                          .add("rss_kb", rss).print();
+            nextSample += opts.sampleSeconds * 1e9;
+        }
+
+        const string& channel = channels[i % channels.size()];
+        vector<uint8_t>& msg = msgs[i % msgs.size()];
+        Stamp stamp { TimeUtil::monoNs(), st.epoch.load() };
+        memcpy(msg.data(), &stamp, sizeof(stamp));
+        if (zcm_publish(link.a, channel.c_str(), msg.data(), msg.size()) == ZCM_EOK && measuring)
+            ++sent;
+
+        // Subscription churn: one channel comes and goes every 100 messages
+        if (i % 100 == 99) {
+            size_t c = (i / 100) % channels.size();
+            zcm_unsubscribe(link.b, subs[c]);
+            subs[c] = zcm_subscribe(link.b, channels[c].c_str(), soakHandler, &st);
+        }
+        if (link.blocking && i % 5000 == 4999) {
+            st.epoch.fetch_add(1);
+            zcm_pause(link.b);
+            usleep(1000);
+            zcm_resume(link.b);
+            st.epoch.fetch_add(1);
+        }
+        if (link.blocking && i % 7000 == 6999) {
+            queueSize = queueSize == 64 ? 1024 : 64;
+            zcm_set_queue_size(link.b, queueSize);
+        }
+
+        link.poll();
+        uint64_t next = start + (i + 1) * periodNs;
+        uint64_t t = TimeUtil::monoNs();
+        if (next > t) usleep((next - t) / 1000);
+    }
+
+    // What is still queued is no leak: lets it drain before the last sample
+    uint64_t last = st.received.load();
+    uint64_t lastChange = TimeUtil::monoNs();
+    while (TimeUtil::monoNs() - lastChange < 200000000ULL) {
+        link.poll();
+        usleep(1000);
+        if (st.received.load() != last) {
+            last = st.received.load();
+            lastChange = TimeUtil::monoNs();
+        }
+    }
+    st.measuring = false;
+    uint64_t rssEnd = rssKb();
+    rssPeak = max(rssPeak, rssEnd);
+    uint64_t allocated = allocs.load() - allocStart;
+
+    if (link.blocking) {
+        zcm_stop(link.a);
+        if (link.b != link.a) zcm_stop(link.b);
+    }
+    for (auto* sub : subs) zcm_unsubscribe(link.b, sub);
+
+    uint64_t counts[ZCM_LATENCY_HIST_BUCKETS];
+    uint64_t total = 0;
+    for (size_t b = 0; b < ZCM_LATENCY_HIST_BUCKETS; ++b) total += counts[b] = st.hist[b].load();
+    uint64_t recvd = st.received.load();
+    double perMsg = allocated / (double) max<uint64_t>(sent + recvd, 1);
+    double p999 = zcm_latency_hist_percentile(counts, total, 999000) / 1000.0;
+    uint64_t growth = rssEnd > rssStart ? rssEnd - rssStart : 0;
+
+    string failed;
+    if (opts.maxRssGrowthKb && growth > opts.maxRssGrowthKb) failed += "rss,";
+    if (countingAllocs && opts.maxAllocsPerMsg && perMsg > opts.maxAllocsPerMsg)
+        failed += "allocs,";
+    if (opts.maxP999Us && p999 > opts.maxP999Us) failed += "latency,";
+    if (!failed.empty()) failed.pop_back();
+
+    Record rec(transport, mode, "soak");
+    rec.add("sent", sent)
+       .add("received", recvd)
+       .add("rss_start_kb", rssStart)
+       .add("rss_end_kb", rssEnd)
+       .add("rss_peak_kb", rssPeak)
+       .add("rss_growth_kb", growth);
+    if (countingAllocs) rec.add("allocs_per_msg", perMsg);
+    rec.add("p50_us", zcm_latency_hist_percentile(counts, total, 500000) / 1000.0)
+       .add("p99_us", zcm_latency_hist_percentile(counts, total, 990000) / 1000.0)
+       .add("p999_us", p999)
+       .add("max_us", zcm_latency_hist_percentile(counts, total, 1000000) / 1000.0);
+    if (!failed.empty()) rec.add("failed", failed);
+    rec.print();
+    return failed.empty();
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: soak [options]\n"
+            "\n"
+            "    Runs a mixed workload over zcm transports for a long time, printing\n"
+            "    the resident memory, allocations and dispatch latency as JSON objects,\n"
+            "    one per line. Exits with 1 if any run went over a limit.\n"
+            "\n"
+            "Options:\n"
+            "    -t, --transports=LIST      Comma separated, among inproc, ipc, udpm,\n"
+            "                               serial (over a pair of ptys) and shm.\n"
+            "                               Defaults to all the transports built\n"
+            "    -m, --modes=LIST           Among blocking and nonblocking (default both).\n"
+            "                               Only inproc and serial are nonblocking\n"
+            "    -s, --sizes=LIST           Message sizes, in bytes, published in turn\n"
+            "                               (default 64,4096,262144)\n"
+            "    -c, --channels=N           Channels published in turn (default 32)\n"
+            "    -r, --rate=N               Messages per second (default 2000)\n"
+            "    -d, --seconds=S            Length of each run, after the warmup (default 60)\n"
+            "    -w, --warmup=S             Seconds that don't count (default 10)\n"
+            "    -i, --sample=S             Seconds between memory samples (default 10)\n"
+            "    -M, --max-rss-growth-kb=N  Fail if the memory grew more (default 8192)\n"
+            "    -A, --max-allocs-per-msg=N Fail over this many allocations per message\n"
+            "                               published or received (default no limit)\n"
+            "    -L, --max-p999-us=US       Fail over this 99.9th percentile dispatch\n"
+            "                               latency (default no limit)\n"
+            "    -o, --output=FILE          Write the results to FILE rather than stdout\n"
+            "    -h, --help                 Shows this help text and exits\n");
+}
+
+static bool parseArgs(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        string val;
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") == 0 && eq != string::npos) {
+            val = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        } else if (arg == "-h" || arg == "--help") {
+            return false;
+        } else if (i + 1 < argc) {
+            val = argv[++i];
+        } else {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+
+        if (arg == "-t" || arg == "--transports") {
+            opts.transports = split(val);
+        } else if (arg == "-m" || arg == "--modes") {
+            opts.modes = split(val);
+        } else if (arg == "-s" || arg == "--sizes") {
+            opts.sizes.clear();
+            for (auto& s : split(val)) opts.sizes.push_back(strtoul(s.c_str(), nullptr, 0));
+            if (opts.sizes.empty()) return false;
+        } else if (arg == "-c" || arg == "--channels") {
+            opts.channels = max(1UL, strtoul(val.c_str(), nullptr, 0));
+        } else if (arg == "-r" || arg == "--rate") {
+            opts.rate = strtoul(val.c_str(), nullptr, 0);
+        } else if (arg == "-d" || arg == "--seconds") {
+            opts.seconds = atof(val.c_str());
+        } else if (arg == "-w" || arg == "--warmup") {
+            opts.warmup = atof(val.c_str());
+        } else if (arg == "-i" || arg == "--sample") {
+            opts.sampleSeconds = atof(val.c_str());
+        } else if (arg == "-M" || arg == "--max-rss-growth-kb") {
+            opts.maxRssGrowthKb = strtoull(val.c_str(), nullptr, 0);
+        } else if (arg == "-A" || arg == "--max-allocs-per-msg") {
+            opts.maxAllocsPerMsg = atof(val.c_str());
+        } else if (arg == "-L" || arg == "--max-p999-us") {
+            opts.maxP999Us = atof(val.c_str());
+        } else if (arg == "-o" || arg == "--output") {
+            opts.out = fopen(val.c_str(), "w");
+            if (!opts.out) {
+                fprintf(stderr, "Unable to open %s\n", val.c_str());
+                return false;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return opts.sampleSeconds > 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (!parseArgs(argc, argv)) {
+        usage();
+        return 1;
+    }
+
+    if (opts.transports.empty()) {
+        opts.transports.push_back("inproc");
+#ifdef USING_TRANS_IPC
+        opts.transports.push_back("ipc");
+#endif
+#ifdef USING_TRANS_UDPM
+        opts.transports.push_back("udpm");
+#endif
+#ifdef USING_TRANS_SERIAL
+        opts.transports.push_back("serial");
+#endif
+#ifdef USING_TRANS_SHM
+        opts.transports.push_back("shm");
+#endif
+    }
+
+    // The serial transport locks the devices it opens
+    string lockDir = "/tmp/zcm-soak-lock-" + to_string(getpid());
+    mkdir(lockDir.c_str(), 0700);
+    setenv("ZCM_LOCK_DIR", lockDir.c_str(), 0);
+
+    bool ok = true;
+    for (auto& transport : opts.transports) {
+        for (auto& mode : opts.modes) {
+            if (mode != "blocking" && mode != "nonblocking") {
+                fprintf(stderr, "Unknown mode: %s\n", mode.c_str());
+                return 1;
+            }
+            bool blocking = mode == "blocking";
+            if (!blocking && transport != "inproc" && transport != "serial") continue;
+
+            fprintf(stderr, "%s %s\n", transport.c_str(), mode.c_str());
+            Link link;
+            if (!makeLink(transport, blocking, link)) {
+                Record(transport, mode, "soak").add("error", string("unavailable")).print();
+                continue;
+            }
+            if (!soak(transport, mode, link)) ok = false;
+        }
+    }
+
+    rmdir(lockDir.c_str());
+    if (opts.out != stdout) fclose(opts.out);
+    return ok ? 0 : 1;
+}
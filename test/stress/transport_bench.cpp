@@ -0,0 +1,519 @@
+// Round trip latency, and throughput and loss, of every transport built, for a
+// range of message sizes, in blocking and nonblocking modes. Results are
+// printed one JSON object per line and per measurement, e.g.
+//
+//   {"transport":"udpm","mode":"blocking","size":16,"test":"latency",...}
+//
+// so that runs can be compared with a script. Run through "./waf bench", or
+// directly (see --help)
+
+#include "zcm/zcm.h"
+
+#include "util/TimeUtil.hpp"
+
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+struct Options
+{
+    vector<string> transports;
+    vector<string> modes { "blocking", "nonblocking" };
+    vector<uint32_t> sizes { 16, 256, 4096, 65536, 1 << 20, 16 << 20 };
+    // Latency runs stop after 'count' round trips or 'seconds', whichever
+    // comes first. Throughput runs last 'seconds'
+    uint32_t count = 1000;
+    double seconds = 1.0;
+    // Round trips not back within this are counted as lost
+    double timeoutMs = 1000.0;
+    FILE* out = stdout;
+};
+
+static Options opts;
+
+static const char* PING = "BENCH_PING";
+static const char* PONG = "BENCH_PONG";
+static const char* DATA = "BENCH_DATA";
+
+static vector<string> split(const string& s)
+{
+    vector<string> ret;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == string::npos) end = s.size();
+        if (end > start) ret.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    return ret;
+}
+
+// One measurement, printed as a JSON object
+class Record
+{
+  public:
+    Record(const string& transport, const string& mode, uint32_t size, const char* test)
+    {
+        s = "{\"transport\":\"" + transport + "\",\"mode\":\"" + mode + "\"";
+        add("size", (uint64_t) size);
+        s += ",\"test\":\"" + string(test) + "\"";
+    }
+
+    Record& add(const char* key, uint64_t v)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), ",\"%s\":%llu", key, (unsigned long long) v);
+        s += buf;
+        return *this;
+    }
+
+    Record& add(const char* key, double v)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), ",\"%s\":%.3f", key, v);
+        s += buf;
+        return *this;
+    }
+
+    Record& add(const char* key, const char* v)
+    {
+        s += ",\"" + string(key) + "\":\"" + v + "\"";
+        return *this;
+    }
+
+    void print()
+    {
+        fprintf(opts.out, "%s}\n", s.c_str());
+        fflush(opts.out);
+    }
+
+  private:
+    string s;
+};
+
+static void echoHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    zcm_publish(rbuf->zcm, PONG, rbuf->data, rbuf->data_size);
+}
+
+struct PongState
+{
+    mutex lk;
+    condition_variable cond;
+    uint64_t seq = 0;
+};
+
+static void pongHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    PongState* st = (PongState*) usr;
+    uint64_t seq;
+    if (rbuf->data_size < sizeof(seq)) return;
+    memcpy(&seq, rbuf->data, sizeof(seq));
+    unique_lock<mutex> lk(st->lk);
+    st->seq = seq;
+    st->cond.notify_all();
+}
+
+// Waits for the echo of 'seq', returning false on timeout
+static bool waitPong(Link& link, PongState& st, uint64_t seq, uint64_t deadlineNs)
+{
+    if (link.blocking) {
+        unique_lock<mutex> lk(st.lk);
+        while (st.seq != seq) {
+            uint64_t now = TimeUtil::monoNs();
+            if (now >= deadlineNs) return false;
+            st.cond.wait_for(lk, chrono::nanoseconds(deadlineNs - now));
+        }
+        return true;
+    }
+    while (true) {
+        link.poll();
+        {
+            unique_lock<mutex> lk(st.lk);
+            if (st.seq == seq) return true;
+        }
+        if (TimeUtil::monoNs() >= deadlineNs) return false;
+    }
+}
+
+// Publishes until the transport takes the message, returning its last error
+static int publish(Link& link, zcm_t* z, const char* channel, const vector<uint8_t>& msg,
+                   uint64_t deadlineNs)
+{
+    while (true) {
+        int rc = zcm_publish(z, channel, msg.data(), msg.size());
+        if (rc != ZCM_EAGAIN || TimeUtil::monoNs() >= deadlineNs) return rc;
+        link.poll();
+        if (link.blocking) this_thread::yield();
+    }
+}
+
+static double percentile(const vector<uint64_t>& sorted, double q)
+{
+    if (sorted.empty()) return 0;
+    size_t i = (size_t) (q * (sorted.size() - 1) + 0.5);
+    return sorted[i] / 1000.0;
+}
+
+static void benchLatency(const string& transport, const string& mode, uint32_t size,
+                         Link& link)
+{
+    Record rec(transport, mode, size, "latency");
+    PongState st;
+    zcm_sub_t* echo = zcm_subscribe(link.b, PING, echoHandler, nullptr);
+    zcm_sub_t* pong = zcm_subscribe(link.a, PONG, pongHandler, &st);
+    link.start();
+
+    vector<uint8_t> msg(size);
+    uint64_t timeoutNs = opts.timeoutMs * 1e6;
+    uint64_t seq = 0;
+
+    // Subscriptions of some transports take a while to be effective: waits for a
+    // first echo before measuring anything
+    bool connected = false;
+    uint64_t connectDeadline = TimeUtil::monoNs() + 5 * timeoutNs;
+    while (!connected && TimeUtil::monoNs() < connectDeadline) {
+        ++seq;
+        memcpy(msg.data(), &seq, sizeof(seq));
+        uint64_t deadline = TimeUtil::monoNs() + timeoutNs;
+        int rc = publish(link, link.a, PING, msg, deadline);
+        if (rc != ZCM_EOK) {
+            rec.add("error", zcm_strerrno(rc)).print();
+            goto done;
+        }
+        connected = waitPong(link, st, seq, min(deadline, TimeUtil::monoNs() + timeoutNs / 10));
+    }
+    if (!connected) {
+        rec.add("error", "no echo").print();
+        goto done;
+    }
+
+    {
+        vector<uint64_t> rtts;
+        uint64_t lost = 0;
+        uint64_t end = TimeUtil::monoNs() + opts.seconds * 1e9;
+        for (uint32_t i = 0; i < opts.count && TimeUtil::monoNs() < end; ++i) {
+            ++seq;
+            memcpy(msg.data(), &seq, sizeof(seq));
+            uint64_t start = TimeUtil::monoNs();
+            if (publish(link, link.a, PING, msg, start + timeoutNs) != ZCM_EOK ||
+                !waitPong(link, st, seq, start + timeoutNs)) {
+                ++lost;
+                continue;
+            }
+            rtts.push_back(TimeUtil::monoNs() - start);
+        }
+        sort(rtts.begin(), rtts.end());
+        rec.add("count", (uint64_t) rtts.size())
+           .add("lost", lost)
+           .add("p50_us", percentile(rtts, 0.50))
+           .add("p99_us", percentile(rtts, 0.99))
+           .add("p999_us", percentile(rtts, 0.999))
+           .add("max_us", rtts.empty() ? 0.0 : rtts.back() / 1000.0)
+           .print();
+    }
+
+  done:
+    if (link.blocking) {
+        zcm_stop(link.a);
+        if (link.b != link.a) zcm_stop(link.b);
+    }
+    zcm_unsubscribe(link.b, echo);
+    zcm_unsubscribe(link.a, pong);
+}
+
+struct DataState
+{
+    atomic<uint64_t> msgs {0};
+    atomic<uint64_t> lastNs {0};
+};
+
+static void dataHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    DataState* st = (DataState*) usr;
+    st->msgs.store(st->msgs.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    st->lastNs.store(TimeUtil::monoNs(), memory_order_relaxed);
+}
+
+// Publishes as fast as the transport takes messages for 'seconds', then waits
+// for the stragglers
+static void benchThroughput(const string& transport, const string& mode, uint32_t size,
+                            Link& link)
+{
+    Record rec(transport, mode, size, "throughput");
+    DataState st;
+    zcm_sub_t* sub = zcm_subscribe(link.b, DATA, dataHandler, &st);
+    link.start();
+
+    vector<uint8_t> msg(size);
+    uint64_t sent = 0;
+    uint64_t start = TimeUtil::monoNs();
+    uint64_t end = start + opts.seconds * 1e9;
+    int rc = ZCM_EOK;
+    while (TimeUtil::monoNs() < end) {
+        rc = publish(link, link.a, DATA, msg, end);
+        if (rc == ZCM_EOK) ++sent;
+        else if (rc != ZCM_EAGAIN) break;
+        link.poll();
+    }
+
+    if (rc != ZCM_EOK && rc != ZCM_EAGAIN) {
+        rec.add("error", zcm_strerrno(rc)).print();
+    } else {
+        // Done when nothing arrived for a while
+        uint64_t quietNs = opts.timeoutMs * 1e6;
+        uint64_t last = st.msgs.load();
+        uint64_t lastChange = TimeUtil::monoNs();
+        while (st.msgs.load() < sent && TimeUtil::monoNs() - lastChange < quietNs) {
+            link.poll();
+            if (link.blocking) usleep(1000);
+            if (st.msgs.load() != last) {
+                last = st.msgs.load();
+                lastChange = TimeUtil::monoNs();
+            }
+        }
+
+        uint64_t recvd = st.msgs.load();
+        uint64_t lastNs = st.lastNs.load();
+        double secs = (max(end, lastNs) - start) / 1e9;
+        rec.add("sent", sent)
+           .add("received", recvd)
+           .add("loss", sent ? (double) (sent - min(sent, recvd)) / sent : 0.0)
+           .add("msgs_per_s", recvd / secs)
+           .add("mb_per_s", recvd * (double) size / secs / 1e6)
+           .print();
+    }
+
+    if (link.blocking) {
+        zcm_stop(link.a);
+        if (link.b != link.a) zcm_stop(link.b);
+    }
+    zcm_unsubscribe(link.b, sub);
+}
+
+// The file transport has no other end: measures how fast a log is written,
+// then read back
+static void benchFile(uint32_t size)
+{
+    string path = "/tmp/zcm-bench-" + to_string(getpid()) + ".log";
+    vector<uint8_t> msg(size);
+    uint64_t written = 0;
+
+    {
+        Record rec("file", "blocking", size, "write");
+        zcm_t* z = zcm_create(("file://" + path + "?mode=w").c_str());
+        if (!z) {
+            rec.add("error", "unable to create").print();
+            return;
+        }
+        // Publishing starts the send thread: the receive one would fail in this mode
+        uint64_t start = TimeUtil::monoNs();
+        uint64_t end = start + opts.seconds * 1e9;
+        while (TimeUtil::monoNs() < end) {
+            int rc = zcm_publish(z, DATA, msg.data(), msg.size());
+            if (rc == ZCM_EOK) ++written;
+            else if (rc == ZCM_EAGAIN) this_thread::yield();
+            else break;
+        }
+        zcm_flush(z);
+        double secs = (TimeUtil::monoNs() - start) / 1e9;
+        zcm_destroy(z);
+        rec.add("count", written)
+           .add("msgs_per_s", written / secs)
+           .add("mb_per_s", written * (double) size / secs / 1e6)
+           .print();
+    }
+
+    {
+        Record rec("file", "blocking", size, "read");
+        zcm_t* z = zcm_create(("file://" + path + "?mode=r&speed=1e12").c_str());
+        if (!z) {
+            rec.add("error", "unable to open").print();
+            unlink(path.c_str());
+            return;
+        }
+        DataState st;
+        zcm_subscribe(z, DATA, dataHandler, &st);
+        uint64_t start = TimeUtil::monoNs();
+        zcm_start(z);
+        uint64_t last = 0;
+        uint64_t lastChange = TimeUtil::monoNs();
+        while (st.msgs.load() < written &&
+               TimeUtil::monoNs() - lastChange < opts.timeoutMs * 1e6) {
+            usleep(1000);
+            if (st.msgs.load() != last) {
+                last = st.msgs.load();
+                lastChange = TimeUtil::monoNs();
+            }
+        }
+        zcm_stop(z);
+        zcm_destroy(z);
+        uint64_t recvd = st.msgs.load();
+        double secs = (max(st.lastNs.load(), start + 1) - start) / 1e9;
+        rec.add("count", recvd)
+           .add("msgs_per_s", recvd / secs)
+           .add("mb_per_s", recvd * (double) size / secs / 1e6)
+           .print();
+    }
+
+    unlink(path.c_str());
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: transport_bench [options]\n"
+            "\n"
+            "    Measures the round trip latency and the throughput of zcm transports,\n"
+            "    printing one JSON object per line and per measurement.\n"
+            "\n"
+            "Options:\n"
+            "    -t, --transports=LIST  Comma separated, among inproc, ipc, udpm, serial\n"
+            "                           (over a pair of ptys), shm and file.\n"
+            "                           Defaults to all the transports built\n"
+            "    -m, --modes=LIST       Among blocking and nonblocking (default both).\n"
+            "                           Only inproc and serial are nonblocking\n"
+            "    -s, --sizes=LIST       Message sizes, in bytes, at least 16\n"
+            "                           (default 16,256,4096,65536,1048576,16777216)\n"
+            "    -n, --count=N          Round trips per latency run (default 1000)\n"
+            "    -d, --seconds=S        Maximum time of each run (default 1)\n"
+            "    -T, --timeout-ms=MS    Time after which a round trip is lost (default 1000)\n"
+            "    -o, --output=FILE      Write the results to FILE rather than stdout\n"
+            "    -h, --help             Shows this help text and exits\n");
+}
+
+static bool parseArgs(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        string val;
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") == 0 && eq != string::npos) {
+            val = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        } else if (arg == "-h" || arg == "--help") {
+            return false;
+        } else if (i + 1 < argc) {
+            val = argv[++i];
+        } else {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+
+        if (arg == "-t" || arg == "--transports") {
+            opts.transports = split(val);
+        } else if (arg == "-m" || arg == "--modes") {
+            opts.modes = split(val);
+        } else if (arg == "-s" || arg == "--sizes") {
+            opts.sizes.clear();
+            for (auto& s : split(val)) {
+                long n = strtol(s.c_str(), nullptr, 0);
+                if (n < 16) {
+                    fprintf(stderr, "Invalid size: %s\n", s.c_str());
+                    return false;
+                }
+                opts.sizes.push_back(n);
+            }
+        } else if (arg == "-n" || arg == "--count") {
+            opts.count = strtoul(val.c_str(), nullptr, 0);
+        } else if (arg == "-d" || arg == "--seconds") {
+            opts.seconds = atof(val.c_str());
+        } else if (arg == "-T" || arg == "--timeout-ms") {
+            opts.timeoutMs = atof(val.c_str());
+        } else if (arg == "-o" || arg == "--output") {
+            opts.out = fopen(val.c_str(), "w");
+            if (!opts.out) {
+                fprintf(stderr, "Unable to open %s\n", val.c_str());
+                return false;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (!parseArgs(argc, argv)) {
+        usage();
+        return 1;
+    }
+
+    if (opts.transports.empty()) {
+        opts.transports.push_back("inproc");
+#ifdef USING_TRANS_IPC
+        opts.transports.push_back("ipc");
+#endif
+#ifdef USING_TRANS_UDPM
+        opts.transports.push_back("udpm");
+#endif
+#ifdef USING_TRANS_SERIAL
+        opts.transports.push_back("serial");
+#endif
+#ifdef USING_TRANS_SHM
+        opts.transports.push_back("shm");
+#endif
+        opts.transports.push_back("file");
+    }
+
+    // The serial transport locks the devices it opens
+    string lockDir = "/tmp/zcm-bench-lock-" + to_string(getpid());
+    mkdir(lockDir.c_str(), 0700);
+    setenv("ZCM_LOCK_DIR", lockDir.c_str(), 0);
+
+    for (auto& transport : opts.transports) {
+        for (auto& mode : opts.modes) {
+            if (mode != "blocking" && mode != "nonblocking") {
+                fprintf(stderr, "Unknown mode: %s\n", mode.c_str());
+                return 1;
+            }
+            bool blocking = mode == "blocking";
+
+            if (transport == "file") {
+                if (!blocking) continue;
+                for (uint32_t size : opts.sizes) benchFile(size);
+                continue;
+            }
+
+            for (uint32_t size : opts.sizes) {
+                fprintf(stderr, "%s %s %u\n", transport.c_str(), mode.c_str(), size);
+                for (int test = 0; test < 2; ++test) {
+                    // A fresh link for each run, so that no run sees the
+                    // leftovers of the previous one
+                    const char* name = test ? "throughput" : "latency";
+                    if (!blocking && transport != "inproc" && transport != "serial") {
+                        Record(transport, mode, size, name).add("error", "unsupported").print();
+                        continue;
+                    }
+                    Link link;
+                    if (!makeLink(transport, blocking, link)) {
+                        Record(transport, mode, size, name).add("error", "unavailable").print();
+                        continue;
+                    }
+                    if (test == 0) benchLatency(transport, mode, size, link);
+                    else           benchThroughput(transport, mode, size, link);
+                }
+            }
+        }
+    }
+
+    rmdir(lockDir.c_str());
+    if (opts.out != stdout) fclose(opts.out);
+    return 0;
+}
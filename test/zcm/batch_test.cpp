@@ -0,0 +1,216 @@
+// Batched subscriptions of zcm_subscribe_batch(): what queued up while the
+// callback ran comes in batches of at most maxBatch, in order, of one channel
+// each, dropping the oldest past the depth; and ZCM::subscribeBatch() leaves
+// out what doesn't decode
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "zcm/zcm-cpp.hpp"
+#include "types/example_t.hpp"
+
+#include "test_util.h"
+
+using namespace std;
+
+#define MAX_BATCH 8
+
+struct Batches
+{
+    mutex                    mut;
+    vector<vector<uint32_t>> seqs;
+    vector<string>           channels;
+    atomic<int>              n {0};
+    atomic<bool>             bad {false};
+    atomic<bool>             inside {false};
+    atomic<bool>             release {true};
+};
+
+// Holds on to the first batch until released, so that the rest queue up
+static void batchHandler(const zcm_recv_buf_t* rbufs, uint32_t n, const char* channel, void* usr)
+{
+    Batches* b = (Batches*) usr;
+    vector<uint32_t> seqs;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t seq;
+        memcpy(&seq, rbufs[i].data, sizeof(seq));
+        seqs.push_back(seq);
+        if (rbufs[i].zcm == nullptr || rbufs[i].data_size != 16) b->bad = true;
+    }
+    {
+        unique_lock<mutex> lk(b->mut);
+        b->seqs.push_back(seqs);
+        b->channels.push_back(channel);
+    }
+    b->n += n;
+    b->inside = true;
+    while (!b->release) usleep(100);
+}
+
+static void publish(zcm_t* zcm, const char* channel, uint32_t seq)
+{
+    uint8_t data[16] = {};
+    memcpy(data, &seq, sizeof(seq));
+    zcm_publish(zcm, channel, data, sizeof(data));
+    // Not faster than the recv thread keeps up, so that none are dropped
+    usleep(200);
+}
+
+// Publishes 'n' messages while the callback is held up on message 0
+static bool backlog(zcm_t* zcm, Batches& b, const char* channel, uint32_t n)
+{
+    b.release = false;
+    publish(zcm, channel, 0);
+    if (!waitFor([&]() { return b.inside.load(); })) return false;
+    for (uint32_t seq = 1; seq < n; ++seq) publish(zcm, channel, seq);
+    b.release = true;
+    return true;
+}
+
+/********************** TESTS **********************/
+// The backlog comes in full batches, the last one short, all in order
+static int batches()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Batches b;
+    if (!zcm_subscribe_batch(zcm, "SEQ", batchHandler, MAX_BATCH, 64, &b)) fail("subscribe");
+    zcm_start(zcm);
+    if (!backlog(zcm, b, "SEQ", 21)) fail("never called");
+    if (!waitFor([&]() { return b.n == 21; })) fail("got %d", b.n.load());
+    zcm_stop(zcm);
+    // The one held up, then 8 + 8 + 4
+    vector<size_t> sizes;
+    uint32_t next = 0;
+    for (auto& s : b.seqs) {
+        sizes.push_back(s.size());
+        for (uint32_t seq : s)
+            if (seq != next++) fail("message %u out of order", seq);
+    }
+    if (sizes != vector<size_t>({1, 8, 8, 4})) fail("%zu batches", sizes.size());
+    if (b.bad) fail("bad receive buffer");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// Past the depth, the oldest go
+static int depth()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Batches b;
+    if (!zcm_subscribe_batch(zcm, "SEQ", batchHandler, MAX_BATCH, 5, &b)) fail("subscribe");
+    zcm_start(zcm);
+    if (!backlog(zcm, b, "SEQ", 20)) fail("never called");
+    if (!waitFor([&]() { return b.n == 6; })) fail("got %d", b.n.load());
+    usleep(50000);
+    zcm_stop(zcm);
+    if (b.n != 6 || b.seqs.size() != 2) fail("got %d in %zu batches", b.n.load(), b.seqs.size());
+    if (b.seqs[1] != vector<uint32_t>({15, 16, 17, 18, 19})) fail("not the last five");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// A regex sub gets a batch for each run of messages on one channel
+static int channels()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Batches b;
+    if (!zcm_subscribe_batch(zcm, "RUN_.*", batchHandler, MAX_BATCH, 64, &b)) fail("subscribe");
+    zcm_start(zcm);
+    b.release = false;
+    publish(zcm, "RUN_A", 0);
+    if (!waitFor([&]() { return b.inside.load(); })) fail("never called");
+    uint32_t seq = 1;
+    for (int i = 0; i < 3; ++i) publish(zcm, "RUN_A", seq++);
+    for (int i = 0; i < 2; ++i) publish(zcm, "RUN_B", seq++);
+    for (int i = 0; i < 3; ++i) publish(zcm, "RUN_A", seq++);
+    b.release = true;
+    if (!waitFor([&]() { return b.n == (int) seq; })) fail("got %d", b.n.load());
+    zcm_stop(zcm);
+    if (b.channels != vector<string>({"RUN_A", "RUN_A", "RUN_B", "RUN_A"}))
+        fail("%zu batches", b.channels.size());
+    if (b.seqs[2] != vector<uint32_t>({4, 5})) fail("not the run on RUN_B");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+static int badArgs()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Batches b;
+    if (zcm_subscribe_batch(zcm, "SEQ", batchHandler, 0, 64, &b)) fail("batches of none");
+    if (zcm_subscribe_batch(zcm, "SEQ", batchHandler, MAX_BATCH, 0, &b)) fail("queue of none");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// The message that fails to decode is left out, with its receive buffer
+static int decoded()
+{
+    zcm::ZCM zcm("block-inproc");
+    if (!zcm.good()) fail("no zcm");
+    mutex mut;
+    vector<int64_t> utimes;
+    atomic<int> calls {0};
+    atomic<bool> bad {false};
+    zcm.subscribeBatch<example_t>("EX", MAX_BATCH, 64,
+        [&](const zcm::ReceiveBuffer* rbufs, const example_t* msgs, uint32_t n,
+            const string& channel) {
+            unique_lock<mutex> lk(mut);
+            for (uint32_t i = 0; i < n; ++i) {
+                utimes.push_back(msgs[i].utime);
+                example_t m;
+                if (m.decode(rbufs[i].data, 0, rbufs[i].data_size) < 0) bad = true;
+                else if (m.utime != msgs[i].utime) bad = true;
+            }
+            calls++;
+        });
+    zcm.start();
+    example_t m {};
+    m.name = "batch";
+    for (int i = 0; i < 10; ++i) {
+        m.utime = i;
+        if (i == 4) {
+            uint8_t junk[8] = {};
+            zcm.publish("EX", junk, sizeof(junk));
+        }
+        zcm.publish("EX", &m);
+        usleep(200);
+    }
+    bool all = waitFor([&]() { unique_lock<mutex> lk(mut); return utimes.size() == 10; });
+    zcm.stop();
+    if (!all) fail("got %zu", utimes.size());
+    for (int i = 0; i < 10; ++i)
+        if (utimes[i] != i) fail("message %d was %ld", i, (long) utimes[i]);
+    if (bad) fail("receive buffers don't match the messages");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "batches", batches },
+        { "depth", depth },
+        { "channels", channels },
+        { "bad args", badArgs },
+        { "decoded", decoded },
+    };
+
+    // A callback never released fails the test rather than hang it
+    alarm(60);
+    int ret = 0;
+    for (auto& t : tests) {
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
@@ -0,0 +1,266 @@
+// Subscribing and unsubscribing from within callbacks, with more than one
+// dispatch thread: once zcm_unsubscribe() returns, the callback isn't running
+// and is never called again, even though messages keep coming
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "test_util.h"
+
+using namespace std;
+
+#define ALIVE 0x600d
+#define FREED 0xdead
+#define ROUNDS 20
+
+static zcm_t* zcm;
+
+// Keeps publishing on the channels given until stopped
+struct Publisher
+{
+    atomic<bool> stop {false};
+    thread t;
+    Publisher(const string& a, const string& b)
+    {
+        t = thread([this, a, b]() {
+            uint8_t data[16] = {};
+            while (!stop) {
+                zcm_publish(zcm, a.c_str(), data, sizeof(data));
+                zcm_publish(zcm, b.c_str(), data, sizeof(data));
+                usleep(50);
+            }
+        });
+    }
+    ~Publisher() { stop = true; t.join(); }
+};
+
+// What the callback of a subscription being killed uses. The killer marks it
+// freed right after zcm_unsubscribe(), as it could then free it
+struct Victim
+{
+    atomic<int>  state {ALIVE};
+    atomic<int>  calls {0};
+    atomic<bool> bad {false};
+};
+
+static void victimHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Victim* v = (Victim*) usr;
+    if (v->state != ALIVE) v->bad = true;
+    v->calls++;
+    // Long enough that the killer's unsubscribe often finds us running
+    usleep(200);
+    if (v->state != ALIVE) v->bad = true;
+}
+
+struct Killer
+{
+    Victim*    victim;
+    zcm_sub_t* victimSub;
+    atomic<int> calls {0};
+    atomic<int> rc {-1};
+};
+
+static void killerHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Killer* k = (Killer*) usr;
+    if (++k->calls != 10) return;
+    k->rc = zcm_unsubscribe(zcm, k->victimSub);
+    k->victim->state = FREED;
+}
+
+/********************** TESTS **********************/
+static int unsubOther()
+{
+    string kch = channelOn("KILLER", 0, 2), vch = channelOn("VICTIM", 1, 2);
+    for (int round = 0; round < ROUNDS; ++round) {
+        Victim v;
+        Killer k;
+        k.victim = &v;
+        k.victimSub = zcm_subscribe(zcm, vch.c_str(), victimHandler, &v);
+        zcm_sub_t* ks = zcm_subscribe(zcm, kch.c_str(), killerHandler, &k);
+        if (!k.victimSub || !ks) fail("subscribe");
+        {
+            Publisher p(kch, vch);
+            if (!waitFor([&]() { return v.state == FREED; })) fail("victim never unsubscribed");
+            int calls = v.calls;
+            usleep(20000);
+            if (v.calls != calls) fail("victim called after unsubscribing");
+        }
+        if (k.rc != ZCM_EOK) fail("unsubscribe returned %d", k.rc.load());
+        if (v.bad) fail("victim ran after unsubscribing (round %d)", round);
+        zcm_unsubscribe(zcm, ks);
+    }
+    return 0;
+}
+
+struct Self
+{
+    zcm_sub_t*  sub = nullptr;
+    atomic<int> calls {0};
+};
+
+static void selfHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Self* s = (Self*) usr;
+    if (++s->calls == 5) zcm_unsubscribe(zcm, s->sub);
+}
+
+static int unsubSelf()
+{
+    string a = channelOn("SELF", 0, 2), b = channelOn("SELF", 1, 2);
+    Self sa, sb;
+    sa.sub = zcm_subscribe(zcm, a.c_str(), selfHandler, &sa);
+    sb.sub = zcm_subscribe(zcm, b.c_str(), selfHandler, &sb);
+    if (!sa.sub || !sb.sub) fail("subscribe");
+    Publisher p(a, b);
+    if (!waitFor([&]() { return sa.calls >= 5 && sb.calls >= 5; })) fail("too few calls");
+    usleep(20000);
+    if (sa.calls != 5 || sb.calls != 5)
+        fail("called %d and %d times, not 5", sa.calls.load(), sb.calls.load());
+    return 0;
+}
+
+struct Spawner
+{
+    string      channel;
+    zcm_sub_t*  spawned = nullptr;
+    atomic<int> spawnedCalls {0};
+};
+
+static void spawnedHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{ ((Spawner*) usr)->spawnedCalls++; }
+
+static void spawnHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Spawner* s = (Spawner*) usr;
+    if (!s->spawned) s->spawned = zcm_subscribe(zcm, s->channel.c_str(), spawnedHandler, s);
+}
+
+static int subscribeFromCallback()
+{
+    string a = channelOn("SPAWN", 0, 2), b = channelOn("SPAWNED", 1, 2);
+    Spawner s;
+    s.channel = b;
+    zcm_sub_t* sub = zcm_subscribe(zcm, a.c_str(), spawnHandler, &s);
+    if (!sub) fail("subscribe");
+    {
+        Publisher p(a, b);
+        if (!waitFor([&]() { return s.spawnedCalls > 10; })) fail("spawned sub not called");
+    }
+    zcm_unsubscribe(zcm, sub);
+    zcm_unsubscribe(zcm, s.spawned);
+    return 0;
+}
+
+// Two callbacks on either dispatcher unsubscribe from each other at once
+struct Mutual
+{
+    zcm_sub_t*    other = nullptr;
+    atomic<int>*  arrived;
+    atomic<bool>  done {false};
+};
+
+static void mutualHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Mutual* m = (Mutual*) usr;
+    if (m->done) return;
+    // Both in their callbacks before either unsubscribes
+    ++*m->arrived;
+    uint64_t deadline = TimeUtil::utime() + TIMEOUT_US;
+    while (*m->arrived < 2 && TimeUtil::utime() < deadline) usleep(10);
+    zcm_unsubscribe(zcm, m->other);
+    m->done = true;
+}
+
+static int unsubEachOther()
+{
+    string a = channelOn("MUTUAL", 0, 2), b = channelOn("MUTUAL", 1, 2);
+    atomic<int> arrived {0};
+    Mutual ma, mb;
+    ma.arrived = mb.arrived = &arrived;
+    zcm_sub_t* sa = zcm_subscribe(zcm, a.c_str(), mutualHandler, &ma);
+    zcm_sub_t* sb = zcm_subscribe(zcm, b.c_str(), mutualHandler, &mb);
+    if (!sa || !sb) fail("subscribe");
+    ma.other = sb;
+    mb.other = sa;
+    Publisher p(a, b);
+    // Hangs (for the watchdog to catch) if they wait on each other
+    if (!waitFor([&]() { return ma.done && mb.done; })) fail("not both unsubscribed");
+    if (arrived != 2) fail("both in their callbacks %d times", arrived.load());
+    return 0;
+}
+
+struct Blocker
+{
+    atomic<bool> inside {false};
+    atomic<bool> release {false};
+    atomic<int>  calls {0};
+};
+
+static void blockerHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Blocker* b = (Blocker*) usr;
+    b->calls++;
+    b->inside = true;
+    while (!b->release) usleep(100);
+    b->inside = false;
+}
+
+// zcm_try_unsubscribe() doesn't wait for the callback, nor unsubscribe
+static int tryUnsub()
+{
+    string ch = channelOn("BLOCK", 1, 2);
+    Blocker b;
+    zcm_sub_t* sub = zcm_subscribe(zcm, ch.c_str(), blockerHandler, &b);
+    if (!sub) fail("subscribe");
+    uint8_t data[4] = {};
+    zcm_publish(zcm, ch.c_str(), data, sizeof(data));
+    if (!waitFor([&]() { return b.inside.load(); })) fail("callback never called");
+
+    if (zcm_try_unsubscribe(zcm, sub) != ZCM_EAGAIN) fail("didn't fail in the callback");
+    zcm_publish(zcm, ch.c_str(), data, sizeof(data));
+    b.release = true;
+    if (!waitFor([&]() { return b.calls == 2; })) fail("unsubscribed by the failed call");
+
+    int rc;
+    if (!waitFor([&]() { return (rc = zcm_try_unsubscribe(zcm, sub)) != ZCM_EAGAIN; }))
+        fail("never unsubscribed");
+    if (rc != ZCM_EOK) fail("unsubscribe returned %d", rc);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "unsubscribe other", unsubOther },
+        { "unsubscribe self", unsubSelf },
+        { "subscribe from callback", subscribeFromCallback },
+        { "unsubscribe each other", unsubEachOther },
+        { "try unsubscribe", tryUnsub },
+    };
+
+    // A deadlock fails the test rather than hang it
+    alarm(60);
+    int ret = 0;
+    for (auto& t : tests) {
+        zcm = zcm_create("block-inproc://?dispatch_threads=2");
+        if (!zcm) {
+            fprintf(stderr, "Err: no zcm\n");
+            return 1;
+        }
+        zcm_start(zcm);
+        int r = t.fn();
+        zcm_stop(zcm);
+        zcm_destroy(zcm);
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
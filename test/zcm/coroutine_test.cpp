@@ -0,0 +1,238 @@
+// The C++20 coroutines of zcm::ZCM: Receivers resumed by the dispatcher (the
+// one a coroutine destroys included), and publishAsync() completing inline,
+// from the send thread, or with ZCM_EINTR when the zcm goes away first
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "zcm/zcm-cpp.hpp"
+#include "types/example_t.hpp"
+
+#include "test_util.h"
+
+#ifdef ZCM_CPP_COROUTINES
+
+using namespace std;
+
+#define NUM_MSGS 200
+
+// Runs straight away, up to its first suspension, and frees itself once done
+struct Task
+{
+    struct promise_type
+    {
+        Task get_return_object() { return {}; }
+        suspend_never initial_suspend() { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+static int publish(zcm::ZCM& zcm, const char* channel, int64_t utime)
+{
+    example_t m {};
+    m.utime = utime;
+    m.name = "coroutine";
+    // Not faster than the dispatcher keeps up, so that none are dropped
+    usleep(200);
+    return zcm.publish(channel, &m);
+}
+
+struct Count
+{
+    atomic<int> n {0};
+};
+
+static void countHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{ ((Count*) usr)->n++; }
+
+/********************** TESTS **********************/
+struct Consumer
+{
+    vector<int64_t> got;
+    atomic<int>     n {0};
+};
+
+static Task consume(zcm::ZCM::Receiver<example_t>& rx, Consumer& c, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        example_t m = co_await rx;
+        c.got.push_back(m.utime);
+        c.n++;
+    }
+}
+
+// In order, resumed from the dispatcher for each message
+static int receive()
+{
+    zcm::ZCM zcm("block-inproc");
+    if (!zcm.good()) fail("no zcm");
+    auto rx = zcm.recv<example_t>("RX", NUM_MSGS);
+    Consumer c;
+    consume(rx, c, NUM_MSGS);
+    zcm.start();
+    for (int i = 0; i < NUM_MSGS; ++i) publish(zcm, "RX", i);
+    if (!waitFor([&]() { return c.n == NUM_MSGS; })) fail("got %d messages", c.n.load());
+    zcm.stop();
+    for (int i = 0; i < NUM_MSGS; ++i)
+        if (c.got[i] != i) fail("message %d was %ld", i, (long) c.got[i]);
+    return 0;
+}
+
+// Messages that came while nobody waited are kept, up to maxBuffered
+static int buffered()
+{
+    zcm::ZCM zcm("block-inproc");
+    if (!zcm.good()) fail("no zcm");
+    Count all;
+    zcm_subscribe(zcm.getUnderlyingZCM(), "BUF", countHandler, &all);
+    auto rx = zcm.recv<example_t>("BUF", 3);
+    zcm.start();
+    for (int i = 0; i < 10; ++i) publish(zcm, "BUF", i);
+    if (!waitFor([&]() { return all.n == 10; })) fail("not all dispatched");
+
+    // Doesn't suspend for these three
+    Consumer c;
+    consume(rx, c, 3);
+    if (c.n != 3) fail("suspended with messages buffered");
+    zcm.stop();
+    if (c.got != vector<int64_t>({7, 8, 9})) fail("not the last three");
+    return 0;
+}
+
+struct Single
+{
+    atomic<int> n {0};
+    int64_t     utime = -1;
+};
+
+// The Receiver of co_await zcm.recv<>() is destroyed by the coroutine, from
+// within its own callback
+static Task receiveOne(zcm::ZCM& zcm, Single& s)
+{
+    example_t m = co_await zcm.recv<example_t>("ONE");
+    s.utime = m.utime;
+    s.n++;
+}
+
+static int single()
+{
+    zcm::ZCM zcm("block-inproc");
+    if (!zcm.good()) fail("no zcm");
+    Count all;
+    zcm_subscribe(zcm.getUnderlyingZCM(), "ONE", countHandler, &all);
+    Single s;
+    receiveOne(zcm, s);
+    zcm.start();
+    for (int i = 0; i < 20; ++i) publish(zcm, "ONE", 100 + i);
+    if (!waitFor([&]() { return all.n == 20; })) fail("not all dispatched");
+    zcm.stop();
+    if (s.n != 1 || s.utime != 100) fail("got %d messages, first %ld", s.n.load(), (long) s.utime);
+    return 0;
+}
+
+struct Sender
+{
+    vector<int>       status;
+    thread::id        resumedOn;
+    atomic<bool>      done {false};
+};
+
+static Task send(zcm::ZCM& zcm, Sender& s, int n)
+{
+    example_t m {};
+    for (int i = 0; i < n; ++i) {
+        m.utime = i;
+        s.status.push_back(co_await zcm.publishAsync("SENT", &m));
+    }
+    s.resumedOn = this_thread::get_id();
+    s.done = true;
+}
+
+// Resumed on the send thread once each is sent
+static int queued()
+{
+    zcm::ZCM zcm("block-inproc");
+    if (!zcm.good()) fail("no zcm");
+    Count recv;
+    zcm_subscribe(zcm.getUnderlyingZCM(), "SENT", countHandler, &recv);
+    zcm.start();
+    Sender s;
+    send(zcm, s, NUM_MSGS);
+    if (!waitFor([&]() { return s.done.load(); })) fail("sent %zu", s.status.size());
+    if (!waitFor([&]() { return recv.n == NUM_MSGS; })) fail("received %d", recv.n.load());
+    zcm.stop();
+    if (s.resumedOn == this_thread::get_id()) fail("resumed on the publishing thread");
+    for (int st : s.status) if (st != ZCM_EOK) fail("sent with %d", st);
+    return 0;
+}
+
+// Sent before zcm_publish_notify() returns: the coroutine doesn't suspend
+static int inlined()
+{
+    zcm::ZCM zcm("block-inproc");
+    if (!zcm.good()) fail("no zcm");
+    if (zcm.setInlinePublish(true) != ZCM_EOK) fail("no inline publish");
+    Count recv;
+    zcm_subscribe(zcm.getUnderlyingZCM(), "SENT", countHandler, &recv);
+    zcm.start();
+    Sender s;
+    send(zcm, s, NUM_MSGS);
+    if (!s.done) fail("suspended");
+    if (s.resumedOn != this_thread::get_id()) fail("resumed elsewhere");
+    if (!waitFor([&]() { return recv.n == NUM_MSGS; })) fail("received %d", recv.n.load());
+    zcm.stop();
+    for (int st : s.status) if (st != ZCM_EOK) fail("sent with %d", st);
+    return 0;
+}
+
+// Still queued when the zcm is destroyed
+static int interrupted()
+{
+    unique_ptr<zcm::ZCM> zcm(new zcm::ZCM("block-inproc"));
+    if (!zcm->good()) fail("no zcm");
+    zcm->pause();
+    Sender s;
+    send(*zcm, s, 1);
+    if (s.done) fail("sent while paused");
+    zcm.reset();
+    if (!s.done) fail("never resumed");
+    if (s.status.size() != 1 || s.status[0] != ZCM_EINTR) fail("not interrupted");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "receive", receive },
+        { "buffered", buffered },
+        { "single", single },
+        { "queued", queued },
+        { "inline", inlined },
+        { "interrupted", interrupted },
+    };
+
+    int ret = 0;
+    for (auto& t : tests) {
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
+
+#else
+
+int main(int argc, char *argv[])
+{
+    printf("no coroutines: skipped\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,178 @@
+// Several dispatch threads of zcm_set_dispatch_threads(): a slow callback only
+// holds up the channels of its own thread, each channel stays in order, and
+// zcm_pause(), zcm_resume() and zcm_flush() cover every thread
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+
+using namespace std;
+
+#define NUM_THREADS 4
+#define NUM_CHANNELS 8
+#define NUM_MSGS 200
+
+struct Seq
+{
+    atomic<int>  count {0};
+    uint32_t     next = 0;
+    atomic<bool> bad {false};
+};
+
+// The threads that ran callbacks
+static mutex threadsMutex;
+static set<thread::id> threads;
+
+static void seqHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Seq* s = (Seq*) usr;
+    uint32_t seq;
+    memcpy(&seq, rbuf->data, sizeof(seq));
+    if (seq != s->next) s->bad = true;
+    s->next = seq + 1;
+    {
+        unique_lock<mutex> lk(threadsMutex);
+        threads.insert(this_thread::get_id());
+    }
+    s->count++;
+}
+
+static void publish(zcm_t* zcm, const string& channel, uint32_t seq)
+{
+    uint8_t data[16] = {};
+    memcpy(data, &seq, sizeof(seq));
+    zcm_publish(zcm, channel.c_str(), data, sizeof(data));
+}
+
+struct Blocker
+{
+    atomic<bool> inside {false};
+    atomic<bool> release {false};
+};
+
+static void blockerHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Blocker* b = (Blocker*) usr;
+    b->inside = true;
+    while (!b->release) usleep(100);
+}
+
+/********************** TESTS **********************/
+// A callback that never returns doesn't keep another thread's channel waiting
+static int independent()
+{
+    zcm_t* zcm = zcm_create("block-inproc://?dispatch_threads=2");
+    if (!zcm) fail("no zcm");
+    string slow = channelOn("SLOW", 0, 2), fast = channelOn("FAST", 1, 2);
+    Blocker b;
+    Seq s;
+    zcm_subscribe(zcm, slow.c_str(), blockerHandler, &b);
+    zcm_subscribe(zcm, fast.c_str(), seqHandler, &s);
+    zcm_start(zcm);
+    publish(zcm, slow, 0);
+    if (!waitFor([&]() { return b.inside.load(); })) fail("slow callback never called");
+    for (uint32_t i = 0; i < 10; ++i) publish(zcm, fast, i);
+    bool ran = waitFor([&]() { return s.count == 10; });
+    b.release = true;
+    zcm_stop(zcm);
+    if (!ran) fail("held up by the other thread (%d of 10)", s.count.load());
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// Every channel in order, its messages all on one thread, the channels
+// spread over several
+static int ordered()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    if (zcm_set_dispatch_threads(zcm, NUM_THREADS) != ZCM_EOK) fail("set threads");
+    zcm_set_queue_size(zcm, NUM_CHANNELS * NUM_MSGS);
+    Seq seqs[NUM_CHANNELS];
+    vector<string> channels;
+    for (int i = 0; i < NUM_CHANNELS; ++i) {
+        channels.push_back(channelOn("SEQ" + to_string(i) + "_", i % NUM_THREADS, NUM_THREADS));
+        zcm_subscribe(zcm, channels[i].c_str(), seqHandler, &seqs[i]);
+    }
+    threads.clear();
+    zcm_start(zcm);
+    if (zcm_set_dispatch_threads(zcm, 2) != ZCM_EINVALID) fail("changed threads while running");
+    for (uint32_t seq = 0; seq < NUM_MSGS; ++seq) {
+        for (auto& ch : channels) publish(zcm, ch, seq);
+        usleep(100);
+    }
+    for (int i = 0; i < NUM_CHANNELS; ++i)
+        if (!waitFor([&]() { return seqs[i].count == NUM_MSGS; }))
+            fail("%s got %d", channels[i].c_str(), seqs[i].count.load());
+    zcm_stop(zcm);
+    for (int i = 0; i < NUM_CHANNELS; ++i)
+        if (seqs[i].bad) fail("%s out of order", channels[i].c_str());
+    if (threads.size() != NUM_THREADS) fail("dispatched on %zu threads", threads.size());
+    if (zcm_set_dispatch_threads(zcm, 0) != ZCM_EINVALID) fail("set no threads");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// Paused, no thread dispatches, until resumed or flushed
+static int pauseFlush()
+{
+    zcm_t* zcm = zcm_create("block-inproc://?dispatch_threads=2");
+    if (!zcm) fail("no zcm");
+    string a = channelOn("A", 0, 2), b = channelOn("B", 1, 2);
+    Seq sa, sb;
+    zcm_subscribe(zcm, a.c_str(), seqHandler, &sa);
+    zcm_subscribe(zcm, b.c_str(), seqHandler, &sb);
+    zcm_start(zcm);
+
+    zcm_pause(zcm);
+    for (uint32_t i = 0; i < 5; ++i) {
+        publish(zcm, a, i);
+        publish(zcm, b, i);
+    }
+    usleep(50000);
+    if (sa.count || sb.count) fail("dispatched while paused");
+    zcm_resume(zcm);
+    if (!waitFor([&]() { return sa.count == 5 && sb.count == 5; }))
+        fail("got %d and %d once resumed", sa.count.load(), sb.count.load());
+
+    zcm_pause(zcm);
+    for (uint32_t i = 5; i < 10; ++i) {
+        publish(zcm, a, i);
+        publish(zcm, b, i);
+    }
+    // The first flush may send them before the recv thread queued them
+    if (!waitFor([&]() { zcm_flush(zcm); return sa.count == 10 && sb.count == 10; }))
+        fail("got %d and %d once flushed", sa.count.load(), sb.count.load());
+    zcm_resume(zcm);
+    zcm_stop(zcm);
+    if (sa.bad || sb.bad) fail("out of order");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "independent", independent },
+        { "ordered", ordered },
+        { "pause and flush", pauseFlush },
+    };
+
+    // A dispatcher that never wakes up fails the test rather than hang it
+    alarm(60);
+    int ret = 0;
+    for (auto& t : tests) {
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
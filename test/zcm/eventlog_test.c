@@ -0,0 +1,218 @@
+// Event logs of every kind (plain, compressed, with channel ids, with a time
+// index) written, appended to, then read forwards, backwards, at offsets and
+// from timestamps, through the log and (where they exist) through cursors
+
+#include "zcm/eventlog.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test_util.h"
+
+// Written, then appended
+#define NUM_FIRST  300
+#define NUM_EVENTS 500
+#define MAX_DATA   3000
+
+typedef struct logmode_t logmode_t;
+struct logmode_t
+{
+    const char* name;
+    bool compressed;
+    bool channelIds;
+    bool indexed;
+};
+
+static const char* channels[] = {
+    "A", "POSE", "IMAGE_LEFT",
+    "A_CHANNEL_NAME_LONG_ENOUGH_THAT_WRITING_IT_ONCE_SAVES_A_GOOD_DEAL",
+};
+#define NUM_CHANNELS (sizeof(channels) / sizeof(channels[0]))
+
+// Timestamps go up by 10, but for every 50th event, logged at the same time
+// as the one before it
+static int64_t eventTime(int i)
+{ return 1000 + 10 * (i - (i % 50 == 1)); }
+
+static const char* eventChannel(int i)
+{ return channels[(i * 7 + i / 100) % NUM_CHANNELS]; }
+
+static int32_t eventLen(int i)
+{ return i % 13 == 0 ? 0 : (i * 37) % MAX_DATA; }
+
+static void eventData(int i, uint8_t* data)
+{
+    int32_t j;
+    for (j = 0; j < eventLen(i); ++j) data[j] = (uint8_t) (i + j / 4);
+}
+
+// Whether 'le' is event 'i', which 'first' were written before in the
+// session that wrote it
+static bool isEvent(const zcm_eventlog_event_t* le, int i)
+{
+    uint8_t data[MAX_DATA];
+    const char* channel = eventChannel(i);
+    int first = i < NUM_FIRST ? 0 : NUM_FIRST;
+    if (!le) return false;
+    // Each writer numbers its events from 0
+    if (le->eventnum != i - first || le->timestamp != eventTime(i)) return false;
+    if (le->channellen != (int32_t) strlen(channel) ||
+        memcmp(le->channel, channel, le->channellen) != 0) return false;
+    eventData(i, data);
+    return le->datalen == eventLen(i) && memcmp(le->data, data, le->datalen) == 0;
+}
+
+static int writeEvents(zcm_eventlog_t* l, int from, int to)
+{
+    uint8_t data[MAX_DATA];
+    int i;
+    for (i = from; i < to; ++i) {
+        zcm_eventlog_event_t le;
+        memset(&le, 0, sizeof(le));
+        le.timestamp = eventTime(i);
+        le.channel = (char*) eventChannel(i);
+        le.channellen = strlen(le.channel);
+        eventData(i, data);
+        le.data = data;
+        le.datalen = eventLen(i);
+        if (zcm_eventlog_write_event(l, &le) != 0) fail("writing event %d", i);
+    }
+    return 0;
+}
+
+static int writeLog(const logmode_t* m, const char* path)
+{
+    zcm_eventlog_t* l = zcm_eventlog_create(path, "w");
+    if (!l) fail("can't create %s", path);
+    if (m->compressed && zcm_eventlog_enable_compression(l, 6, 4096) != 0) fail("compression");
+    if (m->channelIds && zcm_eventlog_enable_channel_ids(l) != 0) fail("channel ids");
+    if (m->indexed && zcm_eventlog_enable_index(l, 16, 0) != 0) fail("index");
+    if (writeEvents(l, 0, NUM_FIRST)) return 1;
+    zcm_eventlog_destroy(l);
+
+    // Appending continues compression and channel ids by itself
+    l = zcm_eventlog_create(path, "a");
+    if (!l) fail("can't append to %s", path);
+    if (m->indexed && zcm_eventlog_enable_index(l, 16, 0) != 0) fail("index");
+    if (writeEvents(l, NUM_FIRST, NUM_EVENTS)) return 1;
+    zcm_eventlog_destroy(l);
+    return 0;
+}
+
+// The first event logged at or after 'ts', or the last event
+static int expectedAt(int64_t ts)
+{
+    int i;
+    for (i = 0; i < NUM_EVENTS; ++i)
+        if (eventTime(i) >= ts) return i;
+    return NUM_EVENTS - 1;
+}
+
+static int readLog(const logmode_t* m, const char* path)
+{
+    off_t offsets[NUM_EVENTS];
+    zcm_eventlog_event_t* le;
+    int i;
+
+    zcm_eventlog_t* l = zcm_eventlog_create(path, "r");
+    if (!l) fail("can't open %s", path);
+
+    // Forwards, noting where each event is
+    for (i = 0; i < NUM_EVENTS; ++i) {
+        offsets[i] = ftello(zcm_eventlog_get_fileptr(l));
+        le = zcm_eventlog_read_next_event(l);
+        if (!isEvent(le, i)) fail("event %d read forwards", i);
+        if (m->channelIds != (le->channelid != 0)) fail("channel id of event %d", i);
+        zcm_eventlog_free_event(le);
+    }
+    if ((le = zcm_eventlog_read_next_event(l))) fail("read past the last event");
+
+    // Backwards from the end, then forwards again from the start
+    for (i = NUM_EVENTS - 1; i >= 0; --i) {
+        le = zcm_eventlog_read_prev_event(l);
+        if (!isEvent(le, i)) fail("event %d read backwards", i);
+        zcm_eventlog_free_event(le);
+    }
+    if ((le = zcm_eventlog_read_prev_event(l))) fail("read before the first event");
+    le = zcm_eventlog_read_next_event(l);
+    if (!isEvent(le, 0)) fail("first event after reading backwards");
+    zcm_eventlog_free_event(le);
+
+    for (i = 0; i < NUM_EVENTS; i += 37) {
+        le = zcm_eventlog_read_event_at_offset(l, offsets[i]);
+        if (!isEvent(le, i)) fail("event %d read at its offset", i);
+        zcm_eventlog_free_event(le);
+    }
+
+    // Before the first event, on each of a few (the last one included),
+    // in between two and after the last
+    int64_t targets[] = {
+        0, eventTime(0), eventTime(1), eventTime(51), eventTime(77) + 5,
+        eventTime(NUM_FIRST - 1), eventTime(NUM_FIRST), eventTime(NUM_FIRST) - 1,
+        eventTime(423), eventTime(NUM_EVENTS - 2) + 1, eventTime(NUM_EVENTS - 1),
+        eventTime(NUM_EVENTS - 1) + 1000,
+    };
+    size_t t;
+    for (t = 0; t < sizeof(targets) / sizeof(targets[0]); ++t) {
+        int64_t ts = targets[t];
+        int at = expectedAt(ts);
+        if (zcm_eventlog_seek_to_timestamp(l, ts) != 0) fail("seek to %ld", (long) ts);
+        le = zcm_eventlog_read_next_event(l);
+        if (!isEvent(le, at)) fail("seek to %ld: not event %d", (long) ts, at);
+        zcm_eventlog_free_event(le);
+
+        // Reading goes on from there either way
+        le = zcm_eventlog_read_prev_event(l);
+        if (!isEvent(le, at)) fail("seek to %ld: back to event %d", (long) ts, at);
+        zcm_eventlog_free_event(le);
+        if (at > 0) {
+            le = zcm_eventlog_read_prev_event(l);
+            if (!isEvent(le, at - 1)) fail("seek to %ld: event before %d", (long) ts, at);
+            zcm_eventlog_free_event(le);
+        }
+    }
+
+    // Cursors seek the same
+    zcm_eventlog_cursor_t* c = zcm_eventlog_cursor_create(l);
+    if (!m->compressed && !c) fail("no cursor");
+    for (t = 0; c && t < sizeof(targets) / sizeof(targets[0]); ++t) {
+        int at = expectedAt(targets[t]);
+        if (zcm_eventlog_cursor_seek_to_timestamp(c, targets[t]) != 0) fail("cursor seek");
+        le = zcm_eventlog_cursor_read_next_event(c);
+        if (!isEvent(le, at)) fail("cursor seek to %ld: not event %d", (long) targets[t], at);
+        zcm_eventlog_free_event(le);
+    }
+    if (c) zcm_eventlog_cursor_destroy(c);
+
+    zcm_eventlog_destroy(l);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    logmode_t modes[] = {
+        { "plain",            false, false, false },
+        { "compressed",       true,  false, false },
+        { "channel ids",      false, true,  false },
+        { "indexed",          false, false, true  },
+        { "compressed, indexed",  true,  false, true  },
+        { "channel ids, indexed", false, true,  true  },
+    };
+    size_t i;
+    int ret = 0;
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+        char path[256], idx[256 + 8];
+        snprintf(path, sizeof(path), "/tmp/eventlog_test-%d-%zu.log", (int) getpid(), i);
+        snprintf(idx, sizeof(idx), "%s.tidx", path);
+        int r = writeLog(&modes[i], path) || readLog(&modes[i], path);
+        unlink(path);
+        unlink(idx);
+        printf("%s: %s\n", modes[i].name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
@@ -0,0 +1,214 @@
+// Many zcms served by one executor of two threads: each one's callbacks in
+// order and never two at once, its queued publishes sent by the executor, and
+// detaching or destroying the executor while messages flow
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+
+using namespace std;
+
+#define NUM_ZCMS 8
+#define NUM_THREADS 2
+#define NUM_MSGS 300
+
+struct Instance
+{
+    zcm_t*       zcm = nullptr;
+    atomic<int>  inside {0};
+    atomic<int>  count {0};
+    uint32_t     next = 0;
+    atomic<bool> bad {false};
+};
+
+// The threads that ran callbacks
+static mutex threadsMutex;
+static set<thread::id> threads;
+
+static void handler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Instance* in = (Instance*) usr;
+    if (in->inside++ != 0) in->bad = true;
+    uint32_t seq;
+    memcpy(&seq, rbuf->data, sizeof(seq));
+    // Never out of order (though some may be dropped)
+    if (seq < in->next) in->bad = true;
+    in->next = seq + 1;
+    {
+        unique_lock<mutex> lk(threadsMutex);
+        threads.insert(this_thread::get_id());
+    }
+    // Long enough that another thread would get in, were it allowed to
+    usleep(20);
+    in->inside--;
+    in->count++;
+}
+
+// Waits for room in the send queue, which the executor empties
+static int publish(Instance& in, uint32_t seq)
+{
+    uint8_t data[64] = {};
+    memcpy(data, &seq, sizeof(seq));
+    int rc;
+    uint64_t deadline = TimeUtil::utime() + TIMEOUT_US;
+    while ((rc = zcm_publish(in.zcm, "SEQ", data, sizeof(data))) == ZCM_EAGAIN &&
+           TimeUtil::utime() < deadline)
+        usleep(100);
+    return rc;
+}
+
+static bool make(Instance ins[], size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        ins[i].zcm = zcm_create("block-inproc");
+        if (!ins[i].zcm || !zcm_subscribe(ins[i].zcm, "SEQ", handler, &ins[i])) return false;
+    }
+    return true;
+}
+
+static void destroy(Instance ins[], size_t n)
+{
+    for (size_t i = 0; i < n; ++i) zcm_destroy(ins[i].zcm);
+}
+
+/********************** TESTS **********************/
+static int ordered()
+{
+    Instance ins[NUM_ZCMS];
+    if (!make(ins, NUM_ZCMS)) fail("no zcm");
+    zcm_executor_t* ex = zcm_executor_create(NUM_THREADS);
+    if (!ex) fail("no executor");
+    for (auto& in : ins)
+        if (zcm_executor_attach(ex, in.zcm) != ZCM_EOK) fail("attach");
+    threads.clear();
+
+    for (uint32_t seq = 0; seq < NUM_MSGS; ++seq) {
+        for (auto& in : ins)
+            if (int rc = publish(in, seq)) fail("publish %u: %d", seq, rc);
+    }
+    for (size_t i = 0; i < NUM_ZCMS; ++i) {
+        Instance& in = ins[i];
+        if (!waitFor([&]() { return in.count == NUM_MSGS; }))
+            fail("zcm %zu got %d messages", i, in.count.load());
+        if (in.bad) fail("zcm %zu: callbacks out of order or at once", i);
+    }
+    if (threads.size() > NUM_THREADS) fail("callbacks on %zu threads", threads.size());
+    if (threads.count(this_thread::get_id())) fail("callbacks on the publishing thread");
+
+    zcm_executor_destroy(ex);
+    destroy(ins, NUM_ZCMS);
+    return 0;
+}
+
+static int badArgs()
+{
+    Instance ins[2];
+    if (!make(ins, 2)) fail("no zcm");
+    zcm_executor_t* ex = zcm_executor_create(NUM_THREADS);
+    if (!ex) fail("no executor");
+    if (zcm_executor_create(0)) fail("made an executor of no threads");
+
+    if (zcm_executor_detach(ex, ins[0].zcm) != ZCM_EINVALID) fail("detached, not attached");
+    if (zcm_executor_attach(ex, ins[0].zcm) != ZCM_EOK) fail("attach");
+    if (zcm_executor_attach(ex, ins[0].zcm) != ZCM_EINVALID) fail("attached twice");
+    zcm_start(ins[1].zcm);
+    if (zcm_executor_attach(ex, ins[1].zcm) != ZCM_EINVALID) fail("attached while running");
+    zcm_stop(ins[1].zcm);
+
+    // Can be attached again once detached
+    if (zcm_executor_detach(ex, ins[0].zcm) != ZCM_EOK) fail("detach");
+    if (zcm_executor_attach(ex, ins[0].zcm) != ZCM_EOK) fail("attach again");
+    if (publish(ins[0], 0) != ZCM_EOK) fail("publish");
+    if (!waitFor([&]() { return ins[0].count == 1; })) fail("not dispatched once reattached");
+
+    zcm_executor_destroy(ex);
+    destroy(ins, 2);
+    return 0;
+}
+
+// Keeps publishing on every instance until stopped
+struct Traffic
+{
+    atomic<bool> stop {false};
+    vector<thread> ts;
+    Traffic(Instance ins[], size_t n)
+    {
+        for (size_t i = 0; i < n; ++i) {
+            Instance* in = &ins[i];
+            ts.emplace_back([this, in]() {
+                for (uint32_t seq = 0; !stop; ++seq) {
+                    publish(*in, seq);
+                    usleep(200);
+                }
+            });
+        }
+    }
+    ~Traffic()
+    {
+        stop = true;
+        for (auto& t : ts) t.join();
+    }
+};
+
+static int detachFlowing()
+{
+    Instance ins[NUM_ZCMS];
+    if (!make(ins, NUM_ZCMS)) fail("no zcm");
+    zcm_executor_t* ex = zcm_executor_create(NUM_THREADS);
+    if (!ex) fail("no executor");
+    for (auto& in : ins)
+        if (zcm_executor_attach(ex, in.zcm) != ZCM_EOK) fail("attach");
+
+    {
+        Traffic traffic(ins, NUM_ZCMS);
+        if (!waitFor([&]() { return ins[0].count > 50; })) fail("nothing dispatched");
+        for (size_t i = 0; i < NUM_ZCMS / 2; ++i)
+            if (zcm_executor_detach(ex, ins[i].zcm) != ZCM_EOK) fail("detach %zu", i);
+
+        // Only the ones still attached get anything
+        int before[NUM_ZCMS];
+        for (size_t i = 0; i < NUM_ZCMS; ++i) before[i] = ins[i].count;
+        usleep(100000);
+        for (size_t i = 0; i < NUM_ZCMS; ++i) {
+            bool attached = i >= NUM_ZCMS / 2;
+            if (attached != (ins[i].count != before[i]))
+                fail("zcm %zu %s", i, attached ? "stalled" : "dispatched once detached");
+        }
+
+        zcm_executor_destroy(ex);
+        for (size_t i = 0; i < NUM_ZCMS; ++i) before[i] = ins[i].count;
+        usleep(50000);
+        for (size_t i = 0; i < NUM_ZCMS; ++i)
+            if (ins[i].count != before[i]) fail("zcm %zu dispatched after the destroy", i);
+    }
+    for (size_t i = 0; i < NUM_ZCMS; ++i)
+        if (ins[i].bad) fail("zcm %zu: callbacks out of order or at once", i);
+    destroy(ins, NUM_ZCMS);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "ordered", ordered },
+        { "bad args", badArgs },
+        { "detach while flowing", detachFlowing },
+    };
+
+    // A deadlock fails the test rather than hang it
+    alarm(60);
+    int ret = 0;
+    for (auto& t : tests) {
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
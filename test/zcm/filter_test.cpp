@@ -0,0 +1,202 @@
+// Subscription filters of zcm_set_sub_filter(): on plain subscriptions (by the
+// recv thread, counted as zcm.recv_filtered when nobody wants a message), on
+// compressed messages (by the dispatcher, once decompressed) and on batches
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "test_util.h"
+
+using namespace std;
+
+#define NUM_MSGS 100
+#define MSG_SIZE 256
+
+// Lets the messages through whose first byte is even
+static int even(const uint8_t* data, uint32_t len, const char* channel, void* usr)
+{
+    ++*(atomic<int>*) usr;
+    return len == MSG_SIZE && data[0] % 2 == 0;
+}
+
+struct Got
+{
+    mutex           mut;
+    vector<uint8_t> keys;
+    atomic<int>     n {0};
+    atomic<bool>    bad {false};
+
+    void add(const zcm_recv_buf_t& rbuf)
+    {
+        // The rest of the message is zeros (and compresses well)
+        if (rbuf.data_size != MSG_SIZE) bad = true;
+        for (uint32_t i = 1; i < rbuf.data_size; ++i)
+            if (rbuf.data[i] != 0) bad = true;
+        unique_lock<mutex> lk(mut);
+        keys.push_back(rbuf.data[0]);
+        n++;
+    }
+    bool evens(int count)
+    {
+        unique_lock<mutex> lk(mut);
+        if (keys.size() != (size_t) count) return false;
+        for (int i = 0; i < count; ++i)
+            if (keys[i] != 2 * i) return false;
+        return true;
+    }
+};
+
+static void handler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{ ((Got*) usr)->add(*rbuf); }
+
+static void batchHandler(const zcm_recv_buf_t* rbufs, uint32_t n, const char* channel, void* usr)
+{
+    for (uint32_t i = 0; i < n; ++i) ((Got*) usr)->add(rbufs[i]);
+}
+
+// Messages of keys 0 to NUM_MSGS - 1
+static void publish(zcm_t* zcm, const char* channel)
+{
+    uint8_t data[MSG_SIZE] = {};
+    for (int i = 0; i < NUM_MSGS; ++i) {
+        data[0] = i;
+        // Not faster than the dispatcher keeps up, so that none are dropped
+        usleep(200);
+        zcm_publish(zcm, channel, data, sizeof(data));
+    }
+}
+
+/********************** TESTS **********************/
+// Only the filtered sub misses out, and nothing counts as filtered as long as
+// another sub wants every message
+static int plain()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Got a, b;
+    atomic<int> calls {0};
+    zcm_sub_t* sa = zcm_subscribe(zcm, "PLAIN", handler, &a);
+    zcm_subscribe(zcm, "PLAIN", handler, &b);
+    if (zcm_set_sub_filter(zcm, sa, even, &calls) != ZCM_EOK) fail("set filter");
+    zcm_start(zcm);
+    publish(zcm, "PLAIN");
+    if (!waitFor([&]() { return b.n == NUM_MSGS; })) fail("unfiltered got %d", b.n.load());
+    if (!waitFor([&]() { return a.n == NUM_MSGS / 2; })) fail("filtered got %d", a.n.load());
+    if (!a.evens(NUM_MSGS / 2)) fail("filtered sub got odd messages");
+    if (calls != NUM_MSGS) fail("filter called %d times", calls.load());
+    if (stat(zcm, "zcm.recv_filtered") != 0) fail("counted as filtered");
+
+    // Not filtered any more, as of the next message
+    if (zcm_set_sub_filter(zcm, sa, NULL, NULL) != ZCM_EOK) fail("remove filter");
+    publish(zcm, "PLAIN");
+    if (!waitFor([&]() { return a.n == NUM_MSGS / 2 + NUM_MSGS; })) fail("got %d", a.n.load());
+    zcm_stop(zcm);
+    if (a.bad || b.bad) fail("corrupted");
+    if (calls != NUM_MSGS) fail("removed filter called");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// Every message rejected by all the subs of its channel is counted
+static int counted()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Got a;
+    atomic<int> calls {0};
+    zcm_sub_t* sa = zcm_subscribe(zcm, "ONLY", handler, &a);
+    if (zcm_set_sub_filter(zcm, sa, even, &calls) != ZCM_EOK) fail("set filter");
+    zcm_sub_t* unknown = (zcm_sub_t*) &a;
+    if (zcm_set_sub_filter(zcm, unknown, even, &calls) != ZCM_EINVALID) fail("filtered no sub");
+    zcm_start(zcm);
+    publish(zcm, "ONLY");
+    if (!waitFor([&]() { return calls == NUM_MSGS; })) fail("filter called %d", calls.load());
+    if (!waitFor([&]() { return a.n == NUM_MSGS / 2; })) fail("got %d", a.n.load());
+    zcm_stop(zcm);
+    if (!a.evens(NUM_MSGS / 2) || a.bad) fail("got odd messages");
+    uint64_t filtered = stat(zcm, "zcm.recv_filtered");
+    if (filtered != NUM_MSGS / 2) fail("%lu counted as filtered", (unsigned long) filtered);
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// The filter sees the message decompressed, and the sub gets it intact
+static int compressed()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    if (zcm_set_compression(zcm, "ZIP", ZCM_CODEC_FAST, 0) != ZCM_EOK) {
+        zcm_destroy(zcm);
+        printf("no compression: skipped\n");
+        return 0;
+    }
+    Got a, b;
+    atomic<int> calls {0};
+    zcm_sub_t* sa = zcm_subscribe(zcm, "ZIP", handler, &a);
+    zcm_subscribe(zcm, "ZIP", handler, &b);
+    if (zcm_set_sub_filter(zcm, sa, even, &calls) != ZCM_EOK) fail("set filter");
+    zcm_start(zcm);
+    publish(zcm, "ZIP");
+    if (!waitFor([&]() { return b.n == NUM_MSGS; })) fail("unfiltered got %d", b.n.load());
+    if (!waitFor([&]() { return a.n == NUM_MSGS / 2; })) fail("filtered got %d", a.n.load());
+    zcm_stop(zcm);
+    if (stat(zcm, "zcm.compressed_msgs") != NUM_MSGS) fail("not compressed");
+    if (!a.evens(NUM_MSGS / 2)) fail("filtered sub got odd messages");
+    if (a.bad || b.bad) fail("corrupted");
+    if (calls < NUM_MSGS) fail("filter called %d times", calls.load());
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// The batches of a filtered sub only hold what it lets through, compressed or not
+static int batch()
+{
+    for (bool compress : { false, true }) {
+        zcm_t* zcm = zcm_create("block-inproc");
+        if (!zcm) fail("no zcm");
+        if (compress && zcm_set_compression(zcm, "BATCH", ZCM_CODEC_FAST, 0) != ZCM_EOK) {
+            zcm_destroy(zcm);
+            printf("no compression: skipped\n");
+            return 0;
+        }
+        Got a, b;
+        atomic<int> calls {0};
+        zcm_sub_t* sa = zcm_subscribe_batch(zcm, "BATCH", batchHandler, 8, NUM_MSGS, &a);
+        zcm_subscribe_batch(zcm, "BATCH", batchHandler, 8, NUM_MSGS, &b);
+        if (!sa) fail("subscribe");
+        if (zcm_set_sub_filter(zcm, sa, even, &calls) != ZCM_EOK) fail("set filter");
+        zcm_start(zcm);
+        publish(zcm, "BATCH");
+        if (!waitFor([&]() { return b.n == NUM_MSGS; })) fail("unfiltered got %d", b.n.load());
+        if (!waitFor([&]() { return a.n == NUM_MSGS / 2; })) fail("filtered got %d", a.n.load());
+        zcm_stop(zcm);
+        if (!a.evens(NUM_MSGS / 2)) fail("filtered sub got odd messages (compressed %d)", compress);
+        if (a.bad || b.bad) fail("corrupted");
+        zcm_destroy(zcm);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "plain", plain },
+        { "counted", counted },
+        { "compressed", compressed },
+        { "batch", batch },
+    };
+
+    // A dispatcher that never gets a message fails the test rather than hang it
+    alarm(60);
+    int ret = 0;
+    for (auto& t : tests) {
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
@@ -0,0 +1,191 @@
+// The bounded dispatch calls: zcm_handle_timeout() dispatching at most one
+// message or timer within its timeout, and zcm_flush_n() dispatching no more
+// than its count or budget, in blocking and nonblocking mode
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "zcm/zcm-cpp.hpp"
+
+#include "test_util.h"
+
+using namespace std;
+
+struct Count
+{
+    atomic<int> n {0};
+    useconds_t  delay = 0;
+};
+
+static void handler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Count* c = (Count*) usr;
+    c->n++;
+    if (c->delay) usleep(c->delay);
+}
+
+static void tick(zcm_t* zcm, uint32_t ticks, void* usr)
+{ ((Count*) usr)->n++; }
+
+static void publish(zcm_t* zcm, int n)
+{
+    uint8_t data[8] = {};
+    for (int i = 0; i < n; ++i) zcm_publish(zcm, "CH", data, sizeof(data));
+}
+
+/********************** TESTS **********************/
+// Waits out the timeout with nothing to do, and returns as soon as there's
+// one message, dispatching only that one
+static int handleTimeout()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Count c;
+    zcm_subscribe(zcm, "CH", handler, &c);
+
+    uint64_t start = TimeUtil::utime();
+    if (zcm_handle_timeout(zcm, 50000) != ZCM_EAGAIN) fail("dispatched nothing");
+    uint64_t took = TimeUtil::utime() - start;
+    if (took < 50000 || took > 1000000) fail("timed out after %luus", (unsigned long) took);
+
+    publish(zcm, 3);
+    for (int i = 1; i <= 3; ++i) {
+        start = TimeUtil::utime();
+        if (zcm_handle_timeout(zcm, 2000000) != ZCM_EOK) fail("message %d not dispatched", i);
+        if (c.n != i) fail("dispatched %d, not %d", c.n.load(), i);
+        if (TimeUtil::utime() - start > 1000000) fail("waited out the timeout");
+    }
+    if (zcm_handle_timeout(zcm, 0) != ZCM_EAGAIN) fail("dispatched more");
+
+    // Not while dispatched by zcm_start()'s thread
+    zcm_destroy(zcm);
+    zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    zcm_start(zcm);
+    if (zcm_handle_timeout(zcm, 1000) != ZCM_EINVALID) fail("handled while started");
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// A timer due before the timeout ends the wait
+static int handleTimer()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Count t;
+    zcm_timer_t* timer = zcm_add_timer(zcm, 20000, tick, &t);
+    if (!timer) fail("no timer");
+    uint64_t start = TimeUtil::utime();
+    int rc;
+    // Timers added before the first call may wake it up once for nothing
+    while ((rc = zcm_handle_timeout(zcm, 2000000)) == ZCM_EOK && t.n == 0) {}
+    uint64_t took = TimeUtil::utime() - start;
+    if (rc != ZCM_EOK || t.n != 1) fail("timer not run (%d)", rc);
+    if (took > 1000000) fail("waited out the timeout");
+    zcm_remove_timer(zcm, timer);
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// Paused, dispatch is only by zcm_flush_n(), in bites of maxMsgs
+static int flushCount()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Count c;
+    zcm_subscribe(zcm, "CH", handler, &c);
+    zcm_start(zcm);
+    zcm_pause(zcm);
+    publish(zcm, 10);
+    int total = 0;
+    uint64_t deadline = TimeUtil::utime() + TIMEOUT_US;
+    while (total < 10 && TimeUtil::utime() < deadline) {
+        int n = zcm_flush_n(zcm, 3, 0);
+        if (n < 0 || n > 3) fail("flushed %d with a max of 3", n);
+        total += n;
+        if (c.n != total) fail("dispatched %d, returned %d", c.n.load(), total);
+    }
+    if (total != 10) fail("flushed %d", total);
+    if (zcm_flush_n(zcm, 0, 0) != 0) fail("flushed more");
+    zcm_resume(zcm);
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// The budget is checked before each message, so a callback longer than the
+// budget is the last one
+static int flushBudget()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Count c;
+    c.delay = 50000;
+    zcm_subscribe(zcm, "CH", handler, &c);
+    // Starts the recv thread, leaving dispatch to us
+    zcm_handle_timeout(zcm, 0);
+    publish(zcm, 5);
+    if (!waitFor([&]() { return stat(zcm, "zcm.recv_msgs") == 5; })) fail("not received");
+    // Leaves time for taking over the send side from the send thread
+    int n = zcm_flush_n(zcm, 0, 20000);
+    if (n != 1 || c.n != 1) fail("flushed %d on a budget of one message", n);
+    n = zcm_flush_n(zcm, 0, 0);
+    if (n != 4 || c.n != 5) fail("flushed %d of the rest", n);
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// Nonblocking: the transport update that flushes is done, and the count holds
+static int flushNonblock()
+{
+    zcm_t* zcm = zcm_create("nonblock-inproc");
+    if (!zcm) fail("no zcm");
+    Count c;
+    zcm_subscribe(zcm, "CH", handler, &c);
+    publish(zcm, 1);
+    if (zcm_flush_n(zcm, 0, 0) != 1 || c.n != 1) fail("dispatched %d", c.n.load());
+    if (zcm_flush_n(zcm, 0, 0) != 0) fail("flushed more");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// The overloads of zcm::ZCM
+static int cpp()
+{
+    zcm::ZCM zcm("block-inproc");
+    if (!zcm.good()) fail("no zcm");
+    Count c;
+    zcm_subscribe(zcm.getUnderlyingZCM(), "CH", handler, &c);
+    if (zcm.handle(1000) != ZCM_EAGAIN) fail("handled nothing");
+    publish(zcm.getUnderlyingZCM(), 2);
+    if (zcm.handle(2000000) != ZCM_EOK || c.n != 1) fail("handled %d", c.n.load());
+    // The second one may still be on its way
+    if (!waitFor([&]() { zcm.flush(1, 0); return c.n == 2; })) fail("flushed %d", c.n.load());
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "handle timeout", handleTimeout },
+        { "handle timer", handleTimer },
+        { "flush count", flushCount },
+        { "flush budget", flushBudget },
+        { "flush nonblock", flushNonblock },
+        { "c++", cpp },
+    };
+
+    // A handle that never times out fails the test rather than hang it
+    alarm(60);
+    int ret = 0;
+    for (auto& t : tests) {
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
@@ -0,0 +1,200 @@
+// The hybrid transport hands a subscriber exactly one copy of each message:
+// through shm alone from the hybrid publishers of this host, through udpm from
+// the others (played here by a plain udpm publisher, whose messages loop back)
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+#include "test_util.h"
+
+using namespace std;
+
+#define NUM_MSGS 200
+
+static string udpmAddr, subnet;
+
+static zcm_trans_t* makeHybrid(const string& opts = "")
+{ return makeTransport("hybrid://" + udpmAddr + "?ttl=0&shm=" + subnet + opts); }
+
+static zcm_trans_t* makeUdpm()
+{ return makeTransport("udpm://" + udpmAddr + "?ttl=0"); }
+
+static int send(zcm_trans_t* zt, const char* channel, uint32_t seq)
+{
+    // Some over a udpm packet, so that they go in fragments
+    vector<uint8_t> data(4 + (seq * 131) % 3000);
+    memcpy(data.data(), &seq, 4);
+    for (size_t i = 4; i < data.size(); ++i) data[i] = (uint8_t) (seq ^ i);
+
+    zcm_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.channel = channel;
+    msg.len = data.size();
+    msg.buf = data.data();
+    return zcm_trans_sendmsg(zt, msg);
+}
+
+// Receives until nothing comes for a while, checking that every channel of
+// 'expected' gets its messages 0 to expected[channel] - 1, once each, in order
+static int recvAll(zcm_trans_t* zt, const unordered_map<string, uint32_t>& expected)
+{
+    unordered_map<string, uint32_t> next;
+    uint64_t deadline = TimeUtil::utime() + TIMEOUT_US;
+    zcm_msg_t msg;
+    while (TimeUtil::utime() < deadline) {
+        if (zcm_trans_recvmsg(zt, &msg, 300) != ZCM_EOK) {
+            if (next == expected) break;
+            continue;
+        }
+        uint32_t seq;
+        if (expected.count(msg.channel) == 0) fail("message on %s", msg.channel);
+        if (msg.len < 4) fail("short message on %s", msg.channel);
+        memcpy(&seq, msg.buf, 4);
+        uint32_t& n = next[msg.channel];
+        if (seq != n) fail("got message %u on %s, expected %u", seq, msg.channel, n);
+        if (msg.len != 4 + (seq * 131) % 3000) fail("message %u has %zu bytes", seq, msg.len);
+        for (size_t i = 4; i < msg.len; ++i)
+            if (msg.buf[i] != (uint8_t) (seq ^ i)) fail("message %u corrupt", seq);
+        ++n;
+    }
+    for (auto& elt : expected)
+        if (next[elt.first] != elt.second)
+            fail("got %u messages on %s, expected %u", next[elt.first], elt.first.c_str(),
+                 elt.second);
+    return 0;
+}
+
+/********************** TESTS **********************/
+// The udpm side doesn't loop back, or every message would come twice
+static int localOnce()
+{
+    zcm_trans_t* sub = makeHybrid();
+    zcm_trans_t* pub = makeHybrid();
+    if (!sub || !pub) fail("no transport");
+    zcm_trans_recvmsg_enable(sub, "LOCAL", true);
+    usleep(50000);
+
+    for (uint32_t i = 0; i < NUM_MSGS; ++i) {
+        if (send(pub, "LOCAL", i) != ZCM_EOK) fail("send %u", i);
+        usleep(200);
+    }
+    if (recvAll(sub, {{"LOCAL", NUM_MSGS}})) return 1;
+    if (stat(sub, "hybrid.local_msgs") != NUM_MSGS) fail("not all through shm");
+    if (stat(sub, "hybrid.net_msgs") != 0) fail("some through udpm");
+
+    zcm_trans_destroy(pub);
+    zcm_trans_destroy(sub);
+    return 0;
+}
+
+static int remoteOnce()
+{
+    zcm_trans_t* sub = makeHybrid();
+    zcm_trans_t* pub = makeUdpm();
+    if (!sub || !pub) fail("no transport");
+    zcm_trans_recvmsg_enable(sub, "REMOTE", true);
+    usleep(50000);
+
+    for (uint32_t i = 0; i < NUM_MSGS; ++i) {
+        if (send(pub, "REMOTE", i) != ZCM_EOK) fail("send %u", i);
+        usleep(200);
+    }
+    if (recvAll(sub, {{"REMOTE", NUM_MSGS}})) return 1;
+    if (stat(sub, "hybrid.local_msgs") != 0) fail("some through shm");
+    if (stat(sub, "hybrid.net_msgs") != NUM_MSGS) fail("not all through udpm");
+
+    zcm_trans_destroy(pub);
+    zcm_trans_destroy(sub);
+    return 0;
+}
+
+// Both sides at once, into one subscription to everything
+static int merged()
+{
+    zcm_trans_t* sub = makeHybrid();
+    zcm_trans_t* local = makeHybrid();
+    zcm_trans_t* remote = makeUdpm();
+    if (!sub || !local || !remote) fail("no transport");
+    zcm_trans_recvmsg_enable(sub, NULL, true);
+    usleep(50000);
+
+    for (uint32_t i = 0; i < NUM_MSGS; ++i) {
+        if (send(local, "LOCAL", i) != ZCM_EOK) fail("send %u", i);
+        if (send(remote, "REMOTE", i) != ZCM_EOK) fail("send %u", i);
+        usleep(200);
+    }
+    if (recvAll(sub, {{"LOCAL", NUM_MSGS}, {"REMOTE", NUM_MSGS}})) return 1;
+
+    zcm_trans_destroy(remote);
+    zcm_trans_destroy(local);
+    zcm_trans_destroy(sub);
+    return 0;
+}
+
+// Messages never handed out are released with the transport
+static int teardown()
+{
+    zcm_trans_t* sub = makeHybrid();
+    zcm_trans_t* local = makeHybrid();
+    zcm_trans_t* remote = makeUdpm();
+    if (!sub || !local || !remote) fail("no transport");
+    zcm_trans_recvmsg_enable(sub, NULL, true);
+    usleep(50000);
+
+    for (uint32_t i = 0; i < 20; ++i) {
+        send(local, "LOCAL", i);
+        send(remote, "REMOTE", i);
+    }
+    usleep(100000);
+    zcm_msg_t msg;
+    if (zcm_trans_recvmsg(sub, &msg, 1000) != ZCM_EOK) fail("nothing received");
+    zcm_trans_destroy(sub);
+
+    zcm_trans_destroy(remote);
+    zcm_trans_destroy(local);
+    return 0;
+}
+
+static int badOptions()
+{
+    const char* opts[] = { "&loopback=all", "&loopback=none", "&selftest=true" };
+    for (const char* o : opts) {
+        zcm_trans_t* zt = makeHybrid(o);
+        if (zt) {
+            zcm_trans_destroy(zt);
+            fail("created with '%s'", o);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "local once", localOnce },
+        { "remote once", remoteOnce },
+        { "merged", merged },
+        { "teardown", teardown },
+        { "bad options", badOptions },
+    };
+
+    int ret = 0;
+    int port = testPort();
+    for (auto& t : tests) {
+        // Of their own, so that no two tests see each other's messages
+        udpmAddr = "239.255.76.67:" + to_string(port++);
+        subnet = "hybridtest" + to_string(getpid()) + "-" + to_string(&t - tests);
+        int r = t.fn();
+        // The doorbell of a shm subnet outlives its users
+        unlink(("/dev/shm/zcm-shm-" + subnet).c_str());
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
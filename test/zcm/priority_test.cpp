@@ -0,0 +1,144 @@
+// Channel priorities of zcm_set_channel_priority(): the messages of a higher
+// class are sent first, each class has a send queue of its own, and the
+// priorities can be changed while other threads publish
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+
+using namespace std;
+
+#define QUEUE_SIZE 16
+
+struct Order
+{
+    mutex          mut;
+    vector<string> channels;
+    atomic<int>    n {0};
+};
+
+static void handler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Order* o = (Order*) usr;
+    unique_lock<mutex> lk(o->mut);
+    o->channels.push_back(channel);
+    o->n++;
+}
+
+static zcm_t* make()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) return nullptr;
+    zcm_set_queue_size(zcm, QUEUE_SIZE);
+    zcm_set_channel_priority(zcm, "CTRL", ZCM_PRIORITY_HIGH);
+    zcm_set_channel_priority(zcm, "LOG", ZCM_PRIORITY_LOW);
+    return zcm;
+}
+
+/********************** TESTS **********************/
+// Queued while paused, sent by class once resumed
+static int order()
+{
+    zcm_t* zcm = make();
+    if (!zcm) fail("no zcm");
+    Order o;
+    zcm_subscribe(zcm, ".*", handler, &o);
+    zcm_start(zcm);
+    zcm_pause(zcm);
+    uint8_t data[8] = {};
+    for (int i = 0; i < 4; ++i) {
+        zcm_publish(zcm, "LOG", data, sizeof(data));
+        zcm_publish(zcm, "DATA", data, sizeof(data));
+        zcm_publish(zcm, "CTRL", data, sizeof(data));
+    }
+    zcm_resume(zcm);
+    if (!waitFor([&]() { return o.n == 12; })) fail("got %d", o.n.load());
+    zcm_stop(zcm);
+    for (int i = 0; i < 12; ++i) {
+        const char* want = i < 4 ? "CTRL" : i < 8 ? "DATA" : "LOG";
+        if (o.channels[i] != want)
+            fail("message %d on %s, not %s", i, o.channels[i].c_str(), want);
+    }
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// A full class doesn't keep the others from queueing, so there is room for
+// ZCM_NUM_PRIORITIES times the queue size in all
+static int capacity()
+{
+    zcm_t* zcm = make();
+    if (!zcm) fail("no zcm");
+    zcm_pause(zcm);
+    uint8_t data[8] = {};
+    for (const char* ch : { "CTRL", "DATA", "LOG" }) {
+        int queued = 0;
+        zcm_pub_status_t st;
+        while (zcm_try_publish(zcm, ch, data, sizeof(data), &st) == ZCM_EOK) ++queued;
+        // Note: a queue of capacity N holds at most N-1 messages
+        if (queued != QUEUE_SIZE - 1) fail("queued %d on %s", queued, ch);
+        if (st.capacity != QUEUE_SIZE - 1 || st.queued != QUEUE_SIZE - 1)
+            fail("%s: %u of %u queued", ch, st.queued, st.capacity);
+    }
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// Setting priorities races with the publishes that look them up
+static int whilePublishing()
+{
+    zcm_t* zcm = make();
+    if (!zcm) fail("no zcm");
+    Order o;
+    zcm_subscribe(zcm, "FLIP", handler, &o);
+    zcm_start(zcm);
+    atomic<bool> stop {false};
+    atomic<int> sent {0};
+    thread publisher([&]() {
+        uint8_t data[8] = {};
+        while (!stop) {
+            if (zcm_publish(zcm, "FLIP", data, sizeof(data)) == ZCM_EOK) sent++;
+            usleep(10);
+        }
+    });
+    for (int i = 0; i < 2000; ++i) {
+        // Growing the map on the way, so that it gets rehashed under the publisher
+        string ch = "CH" + to_string(i);
+        if (zcm_set_channel_priority(zcm, ch.c_str(), ZCM_PRIORITY_LOW) != ZCM_EOK)
+            fail("set %s", ch.c_str());
+        zcm_set_channel_priority(zcm, "FLIP", i % 2 ? ZCM_PRIORITY_HIGH : ZCM_PRIORITY_NORMAL);
+    }
+    stop = true;
+    publisher.join();
+    if (!waitFor([&]() { return o.n == sent; })) fail("got %d of %d", o.n.load(), sent.load());
+    zcm_stop(zcm);
+    if (zcm_set_channel_priority(zcm, "FLIP", ZCM_NUM_PRIORITIES) != ZCM_EINVALID)
+        fail("set an unknown class");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "order", order },
+        { "capacity", capacity },
+        { "while publishing", whilePublishing },
+    };
+
+    // A send thread that never resumes fails the test rather than hang it
+    alarm(60);
+    int ret = 0;
+    for (auto& t : tests) {
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
@@ -0,0 +1,518 @@
+// Two generic serial transports on either end of a loopback wire: messages of
+// every awkward shape, with escape or COBS framing, packed or not, through
+// buffers that wrap, with garbage on the line and with a checksum of our own
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+#include "zcm/transport/generic_serial_transport.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_util.h"
+
+#define MTU 1000
+// Not much more than a frame: frames straddle the end of the buffers all the time
+#define BUF_SIZE 1100
+#define MAX_SENT 4096
+#define ESCAPE_CHAR 0xcc
+// Pumping more than this is the transports stuck, not slow
+#define MAX_PUMPS 100000
+
+// What the sending end put and the receiving end hasn't got yet. 'chunk'
+// bytes at most move at a time, so that frames arrive in pieces
+typedef struct wire_t wire_t;
+struct wire_t
+{
+    uint8_t bytes[1 << 16];
+    size_t  len;
+    size_t  chunk;
+    size_t  total;
+};
+
+static size_t wirePut(const uint8_t* data, size_t n, void* usr)
+{
+    wire_t* w = (wire_t*) usr;
+    if (n > w->chunk) n = w->chunk;
+    if (n > sizeof(w->bytes) - w->len) n = sizeof(w->bytes) - w->len;
+    memcpy(w->bytes + w->len, data, n);
+    w->len += n;
+    w->total += n;
+    return n;
+}
+
+static size_t wireGet(uint8_t* data, size_t n, void* usr)
+{
+    wire_t* w = (wire_t*) usr;
+    if (n > w->chunk) n = w->chunk;
+    if (n > w->len) n = w->len;
+    memcpy(data, w->bytes, n);
+    memmove(w->bytes, w->bytes + n, w->len - n);
+    w->len -= n;
+    return n;
+}
+
+// The wire only goes one way: the sending end hears nothing, the receiving one
+// says nothing
+static size_t nothingPut(const uint8_t* data, size_t n, void* usr)
+{ return n; }
+
+static size_t nothingGet(uint8_t* data, size_t n, void* usr)
+{ return 0; }
+
+static uint64_t timestampNow(void* usr)
+{ return 0; }
+
+typedef struct sent_t sent_t;
+struct sent_t
+{
+    char    channel[ZCM_CHANNEL_MAXLEN + 1];
+    uint8_t data[MTU];
+    size_t  len;
+};
+
+// A transport to send with and one to receive with. With 'dma', there is no
+// wire: bytes go from serial_tx_span() to serial_rx_span()
+typedef struct link_t link_t;
+struct link_t
+{
+    zcm_trans_t* tx;
+    zcm_trans_t* rx;
+    wire_t       wire;
+    bool         dma;
+
+    sent_t       sent[MAX_SENT];
+    size_t       nsent;
+    size_t       nrecv;  // of 'sent', in order
+    size_t       lost;   // skipped over in 'sent'
+    size_t       bad;    // received but never sent
+    bool         stuck;  // bytes stopped moving
+};
+
+typedef uint16_t (*checksum_t)(const uint8_t* data, size_t nData, uint16_t prevSum, void* usr);
+
+static bool linkInit(link_t* l, bool cobs, size_t packSize, bool dma, size_t chunk,
+                     checksum_t txSum, checksum_t rxSum)
+{
+    memset(l, 0, sizeof(*l));
+    l->dma = dma;
+    l->wire.chunk = chunk;
+    l->tx = zcm_trans_generic_serial_create_checksum(dma ? NULL : nothingGet, dma ? NULL : wirePut,
+                                                     &l->wire, timestampNow, NULL,
+                                                     MTU, BUF_SIZE, txSum, NULL);
+    l->rx = zcm_trans_generic_serial_create_checksum(dma ? NULL : wireGet, dma ? NULL : nothingPut,
+                                                     &l->wire, timestampNow, NULL,
+                                                     MTU, BUF_SIZE, rxSum, NULL);
+    if (!l->tx || !l->rx) return false;
+    if (zcm_trans_generic_serial_enable_cobs(l->tx, cobs) != ZCM_EOK) return false;
+    if (zcm_trans_generic_serial_enable_cobs(l->rx, cobs) != ZCM_EOK) return false;
+    return zcm_trans_generic_serial_enable_packing(l->tx, packSize) == ZCM_EOK;
+}
+
+static void linkDeinit(link_t* l)
+{
+    zcm_trans_generic_serial_destroy(l->tx);
+    zcm_trans_generic_serial_destroy(l->rx);
+}
+
+static void linkCheck(link_t* l, const zcm_msg_t* msg)
+{
+    // Messages may be lost (to garbage on the line), never reordered
+    size_t i;
+    for (i = l->nrecv; i < l->nsent; ++i) {
+        sent_t* s = &l->sent[i];
+        if (strcmp(s->channel, msg->channel) == 0 && s->len == msg->len &&
+            memcmp(s->data, msg->buf, msg->len) == 0)
+            break;
+    }
+    if (i == l->nsent) {
+        l->bad++;
+        return;
+    }
+    l->lost += i - l->nrecv;
+    l->nrecv = i + 1;
+}
+
+static void linkRecv(link_t* l)
+{
+    zcm_msg_t msg;
+    while (zcm_trans_recvmsg(l->rx, &msg, 0) == ZCM_EOK) linkCheck(l, &msg);
+}
+
+// Moves bytes along until there are none in flight, receiving as it goes.
+// A link that got stuck once is left alone
+static void linkPump(link_t* l)
+{
+    int pumps;
+    for (pumps = 0; pumps < MAX_PUMPS && !l->stuck; ++pumps) {
+        size_t n, room;
+        if (l->dma) {
+            const uint8_t* out = serial_tx_span(l->tx, &n);
+            uint8_t* in = serial_rx_span(l->rx, &room);
+            if (n > l->wire.chunk) n = l->wire.chunk;
+            if (n > room) n = room;
+            memcpy(in, out, n);
+            serial_rx_commit(l->rx, n);
+            serial_tx_consume(l->tx, n);
+        } else {
+            zcm_trans_update(l->tx);
+            zcm_trans_update(l->rx);
+        }
+        linkRecv(l);
+        serial_tx_span(l->tx, &n);
+        if (n == 0 && l->wire.len == 0) {
+            // Whatever is left in the receive buffer is as far as it goes
+            linkRecv(l);
+            return;
+        }
+    }
+    l->stuck = true;
+}
+
+static void linkSend(link_t* l, const char* channel, const uint8_t* data, size_t len)
+{
+    sent_t* s = &l->sent[l->nsent++];
+    strcpy(s->channel, channel);
+    memcpy(s->data, data, len);
+    s->len = len;
+
+    zcm_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.channel = s->channel;
+    msg.buf = s->data;
+    msg.len = len;
+    while (!l->stuck && zcm_trans_sendmsg(l->tx, msg) == ZCM_EAGAIN) linkPump(l);
+}
+
+// Puts 'len' bytes straight on the wire, in between frames
+static void linkGarbage(link_t* l, const uint8_t* data, size_t len)
+{
+    linkPump(l);
+    if (l->dma) {
+        uint8_t* in;
+        size_t room;
+        while (len > 0) {
+            in = serial_rx_span(l->rx, &room);
+            if (room == 0 || l->stuck) {
+                l->stuck = true;
+                return;
+            }
+            if (room > len) room = len;
+            memcpy(in, data, room);
+            serial_rx_commit(l->rx, room);
+            data += room;
+            len -= room;
+            linkRecv(l);
+        }
+    } else {
+        while (len > 0 && !l->stuck) {
+            size_t n = wirePut(data, len, &l->wire);
+            data += n;
+            len -= n;
+            linkPump(l);
+        }
+    }
+}
+
+/********************** PAYLOADS **********************/
+#define NUM_PAYLOADS 16
+
+// Runs of zeros and of non-zero bytes either side of what a COBS block holds,
+// escape chars, and the empty and MTU sized messages
+static size_t makePayload(int which, uint8_t* p)
+{
+    size_t i, len = 0;
+    switch (which) {
+        case 0: return 0;
+        case 1: p[0] = 0; return 1;
+        case 2: len = 300; memset(p, 0, len); return len;
+        case 3: case 4: case 5: case 6:
+            // Exactly 253, 254, 255 and 256 non-zero bytes
+            len = 253 + which - 3;
+            for (i = 0; i < len; ++i) p[i] = (uint8_t) (1 + i % 255);
+            return len;
+        case 7:
+            // 254 non-zero bytes between zeros
+            len = 256;
+            p[0] = 0;
+            for (i = 1; i < 255; ++i) p[i] = (uint8_t) i;
+            p[255] = 0;
+            return len;
+        case 8:
+            // 255 non-zero bytes, then a zero
+            len = 256;
+            for (i = 0; i < 255; ++i) p[i] = 0xff;
+            p[255] = 0;
+            return len;
+        case 9:
+            // Several 254 byte runs back to back
+            len = 254 * 3;
+            for (i = 0; i < len; ++i) p[i] = 0x5a;
+            return len;
+        case 10: len = 100; memset(p, ESCAPE_CHAR, len); return len;
+        case 11:
+            len = 200;
+            for (i = 0; i < len; ++i) p[i] = i % 2 ? ESCAPE_CHAR : 0;
+            return len;
+        case 12: len = MTU; memset(p, 0x11, len); return len;
+        case 13: len = MTU; memset(p, 0, len); return len;
+        default:
+            len = (which * 97) % MTU;
+            for (i = 0; i < len; ++i) p[i] = (uint8_t) rand();
+            return len;
+    }
+}
+
+static const char* channels[] = {
+    "A", "CHANNEL", "ZEROS_AND_\xcc\xcc", "0123456789abcdef0123456789abcdef",
+};
+#define NUM_CHANNELS (sizeof(channels) / sizeof(channels[0]))
+
+static void sendPayloads(link_t* l, int rounds)
+{
+    uint8_t p[MTU];
+    int r, i;
+    for (r = 0; r < rounds; ++r) {
+        for (i = 0; i < NUM_PAYLOADS; ++i) {
+            size_t len = makePayload(i, p);
+            linkSend(l, channels[(r + i) % NUM_CHANNELS], p, len);
+        }
+    }
+}
+
+/********************** TESTS **********************/
+static int roundTrips(bool cobs, size_t packSize, bool dma, size_t chunk)
+{
+    link_t* l = malloc(sizeof(link_t));
+    if (!linkInit(l, cobs, packSize, dma, chunk, NULL, NULL)) fail("no transport");
+
+    // Enough rounds that the buffers wrap many times
+    sendPayloads(l, 20);
+    linkPump(l);
+    if (l->nrecv != l->nsent || l->lost || l->bad || l->stuck)
+        fail("got %zu of %zu messages, %zu lost, %zu bad", l->nrecv, l->nsent, l->lost, l->bad);
+
+    linkDeinit(l);
+    free(l);
+    return 0;
+}
+
+// What every payload costs on the wire with COBS: one delimiter, no zero
+// before it, and no more than the overhead the framing promises
+static int cobsFrames()
+{
+    link_t* l = malloc(sizeof(link_t));
+    uint8_t p[MTU];
+    int i;
+    if (!linkInit(l, true, 0, false, BUF_SIZE, NULL, NULL)) fail("no transport");
+
+    for (i = 0; i < NUM_PAYLOADS; ++i) {
+        size_t len = makePayload(i, p), body = 2 + strlen("CH") + len + 2, j;
+        linkSend(l, "CH", p, len);
+        zcm_trans_update(l->tx);
+        if (l->wire.len > body + body / 254 + 3)
+            fail("payload %d: %zu bytes on the wire for %zu", i, l->wire.len, body);
+        for (j = 0; j + 1 < l->wire.len; ++j)
+            if (l->wire.bytes[j] == 0) fail("payload %d: a zero inside the frame", i);
+        if (l->wire.bytes[l->wire.len - 1] != 0) fail("payload %d: no delimiter", i);
+        linkPump(l);
+    }
+    if (l->nrecv != l->nsent || l->lost || l->bad || l->stuck) fail("not all received");
+
+    linkDeinit(l);
+    free(l);
+    return 0;
+}
+
+// Garbage between frames, frames cut short and frames with a byte flipped:
+// nothing wrong gets through and receiving picks up again right after.
+// The frame right after garbage may go with it (without COBS, garbage
+// without escape chars doesn't take any)
+static int resync(bool cobs, bool dma)
+{
+    link_t* l = malloc(sizeof(link_t));
+    uint8_t p[MTU], garbage[300];
+    size_t i, before;
+    int round;
+    if (!linkInit(l, cobs, 0, dma, 64, NULL, NULL)) fail("no transport");
+
+    for (round = 0; round < 20; ++round) {
+        for (i = 0; i < sizeof(garbage); ++i) {
+            garbage[i] = (uint8_t) rand();
+            if (!cobs && garbage[i] == ESCAPE_CHAR) garbage[i] = 0;
+        }
+        linkGarbage(l, garbage, (round * 37) % sizeof(garbage) + 1);
+        before = l->lost;
+        sendPayloads(l, 1);
+        linkPump(l);
+        if (l->lost - before > (cobs ? 1 : 0))
+            fail("round %d: %zu messages lost after garbage", round, l->lost - before);
+    }
+
+    // A frame cut short, then one with a byte flipped: each costs itself
+    // alone, or with COBS the one frame it runs into
+    for (round = 0; round < 10; ++round) {
+        size_t len = makePayload(NUM_PAYLOADS + round, p);
+        uint8_t frame[2 * MTU];
+        size_t flen;
+
+        linkSend(l, "CUT", p, len);
+        if (dma) {
+            const uint8_t* out = serial_tx_span(l->tx, &flen);
+            memcpy(frame, out, flen);
+            serial_tx_consume(l->tx, flen);
+        } else {
+            zcm_trans_update(l->tx);
+            flen = l->wire.len;
+            memcpy(frame, l->wire.bytes, flen);
+            l->wire.len = 0;
+        }
+        l->nsent--;
+        linkGarbage(l, frame, flen / 2);
+        before = l->lost;
+        sendPayloads(l, 1);
+        linkPump(l);
+        if (l->lost - before > 1) fail("%zu messages lost after a cut frame", l->lost - before);
+
+        linkSend(l, "FLIP", p, len);
+        if (dma) {
+            const uint8_t* out = serial_tx_span(l->tx, &flen);
+            memcpy(frame, out, flen);
+            serial_tx_consume(l->tx, flen);
+        } else {
+            zcm_trans_update(l->tx);
+            flen = l->wire.len;
+            memcpy(frame, l->wire.bytes, flen);
+            l->wire.len = 0;
+        }
+        l->nsent--;
+        frame[flen / 2] ^= 0x10;
+        if (cobs && frame[flen / 2] == 0) frame[flen / 2] = 0x10;
+        linkGarbage(l, frame, flen);
+        before = l->lost;
+        sendPayloads(l, 1);
+        linkPump(l);
+        if (l->lost - before > 1) fail("%zu messages lost after a bad frame", l->lost - before);
+    }
+
+    if (l->bad || l->stuck) fail("%zu bad messages received%s", l->bad, l->stuck ? ", stuck" : "");
+
+    linkDeinit(l);
+    free(l);
+    return 0;
+}
+
+// Small messages, some over more channels than a packed frame has room for,
+// and big ones in between: all arrive in order, in fewer bytes than unpacked
+static int packing(bool cobs)
+{
+    size_t bytes[2];
+    int packed;
+    for (packed = 0; packed < 2; ++packed) {
+        link_t* l = malloc(sizeof(link_t));
+        uint8_t p[MTU];
+        char channel[16];
+        int i;
+        if (!linkInit(l, cobs, packed ? 256 : 0, false, 32, NULL, NULL)) fail("no transport");
+
+        for (i = 0; i < 2000; ++i) {
+            // Runs of empty messages each on a channel of its own fill the
+            // channel table of a packed frame
+            bool run = i % 100 < 40;
+            size_t len = run ? 0 : i % 50 == 49 ? 600 : (size_t) (i % 7) * 4;
+            memset(p, i, len);
+            if (len > 2) p[1] = 0;
+            snprintf(channel, sizeof(channel), "CHAN%d", run ? i % 100 : i % 4);
+            linkSend(l, channel, p, len);
+            if (i % 100 == 99) linkPump(l);
+        }
+        linkPump(l);
+        if (l->nrecv != l->nsent || l->lost || l->bad || l->stuck)
+            fail("got %zu of %zu messages, %zu lost, %zu bad",
+                 l->nrecv, l->nsent, l->lost, l->bad);
+        bytes[packed] = l->wire.total;
+
+        if (zcm_trans_generic_serial_enable_packing(l->tx, MTU + 1) != ZCM_EINVALID)
+            fail("packed frames bigger than the MTU");
+        linkDeinit(l);
+        free(l);
+    }
+    if (bytes[1] >= bytes[0]) fail("packed: %zu bytes, unpacked: %zu", bytes[1], bytes[0]);
+    return 0;
+}
+
+// CRC-16/CCITT
+static size_t crcCalls;
+static uint16_t crc16(const uint8_t* data, size_t n, uint16_t crc, void* usr)
+{
+    size_t i;
+    int b;
+    crcCalls++;
+    for (i = 0; i < n; ++i) {
+        crc ^= (uint16_t) data[i] << 8;
+        for (b = 0; b < 8; ++b) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+static int checksumHook(bool cobs)
+{
+    link_t* l = malloc(sizeof(link_t));
+
+    // Both ends on the hook: everything gets through
+    if (!linkInit(l, cobs, 128, false, 50, crc16, crc16)) fail("no transport");
+    crcCalls = 0;
+    sendPayloads(l, 5);
+    linkPump(l);
+    if (l->nrecv != l->nsent || l->lost || l->bad || l->stuck)
+        fail("not all received with the hook");
+    if (crcCalls == 0) fail("hook never called");
+    linkDeinit(l);
+
+    // Only one of them: the frames are the same, their checksums aren't
+    if (!linkInit(l, cobs, 0, false, 50, crc16, NULL)) fail("no transport");
+    sendPayloads(l, 2);
+    linkPump(l);
+    if (l->nrecv != 0 || l->bad || l->stuck) fail("%zu received with the wrong checksum", l->nrecv);
+    linkDeinit(l);
+
+    free(l);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = 0, cobs, pack, dma, r;
+    srand(1);
+
+    for (cobs = 0; cobs < 2; ++cobs) {
+        const char* framing = cobs ? "cobs" : "escaped";
+        for (pack = 0; pack < 2; ++pack) {
+            for (dma = 0; dma < 2; ++dma) {
+                r = roundTrips(cobs, pack ? 256 : 0, dma, dma ? 13 : 7);
+                printf("%s round trips%s%s: %s\n", framing, pack ? ", packed" : "",
+                       dma ? ", dma" : "", r == 0 ? "passed" : "FAILED");
+                ret |= r;
+            }
+        }
+        for (dma = 0; dma < 2; ++dma) {
+            r = resync(cobs, dma);
+            printf("%s resync%s: %s\n", framing, dma ? ", dma" : "", r == 0 ? "passed" : "FAILED");
+            ret |= r;
+        }
+        r = packing(cobs);
+        printf("%s packing: %s\n", framing, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+        r = checksumHook(cobs);
+        printf("%s checksum hook: %s\n", framing, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    r = cobsFrames();
+    printf("cobs frames: %s\n", r == 0 ? "passed" : "FAILED");
+    ret |= r;
+
+    return ret;
+}
@@ -0,0 +1,183 @@
+// Round trips through the shm transport between processes, and what happens
+// when the processes on either end of a ring die without cleaning up
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "zcm/zcm.h"
+#include "util/TimeUtil.hpp"
+
+using namespace std;
+
+// Messages run up to 3KB, so the 64KB ring wraps many times over
+#define NUM_MSGS 300
+#define RING_SIZE 65536
+#define TIMEOUT_US 10000000
+
+static string url;
+static int readyPipe[2]; // readers write a byte to it once they have subscribed
+
+static vector<uint8_t> makeMsg(uint32_t seq)
+{
+    vector<uint8_t> msg(4 + (seq * 37) % 3000);
+    memcpy(msg.data(), &seq, 4);
+    for (size_t i = 4; i < msg.size(); ++i) msg[i] = (uint8_t) (seq + i);
+    return msg;
+}
+
+struct Reader
+{
+    uint32_t next = 0;
+    uint32_t bad = 0;
+};
+
+static void handler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Reader* r = (Reader*) usr;
+    uint32_t seq;
+    if (rbuf->data_size < 4) { r->bad++; return; }
+    memcpy(&seq, rbuf->data, 4);
+    vector<uint8_t> expected = makeMsg(r->next);
+    if (seq != r->next || rbuf->data_size != expected.size() ||
+        memcmp(rbuf->data, expected.data(), expected.size()) != 0) {
+        fprintf(stderr, "reader %d: got message %u (%u bytes), expected %u\n",
+                getpid(), seq, rbuf->data_size, r->next);
+        r->bad++;
+    }
+    r->next = seq + 1;
+}
+
+// Forks a reader that subscribes, says so on readyPipe and then checks that it
+// gets all NUM_MSGS messages, in order. If 'forever' it never exits by itself
+static pid_t forkReader(bool forever)
+{
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    zcm_t* zcm = zcm_create(url.c_str());
+    if (!zcm) _exit(2);
+    Reader r;
+    zcm_subscribe(zcm, "DATA", handler, &r);
+    zcm_start(zcm);
+    if (write(readyPipe[1], "r", 1) != 1) _exit(2);
+
+    uint64_t deadline = TimeUtil::utime() + TIMEOUT_US;
+    while ((forever || r.next < NUM_MSGS) && TimeUtil::utime() < deadline)
+        usleep(1000);
+    zcm_stop(zcm);
+    zcm_destroy(zcm);
+    if (r.next != NUM_MSGS || r.bad != 0) {
+        fprintf(stderr, "reader %d: got %u messages, %u bad\n", getpid(), r.next, r.bad);
+        _exit(1);
+    }
+    _exit(0);
+}
+
+static void waitReady(int n)
+{
+    char c;
+    for (int i = 0; i < n; ++i)
+        if (read(readyPipe[0], &c, 1) != 1) exit(1);
+}
+
+static bool reaped(pid_t pid, bool killed)
+{
+    int status;
+    if (waitpid(pid, &status, 0) != pid) return false;
+    if (killed) return WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool publish(zcm_t* zcm, uint32_t first, uint32_t last)
+{
+    for (uint32_t seq = first; seq < last; ++seq) {
+        vector<uint8_t> msg = makeMsg(seq);
+        if (zcm_publish(zcm, "DATA", msg.data(), msg.size()) != ZCM_EOK) return false;
+        usleep(500);
+    }
+    zcm_flush(zcm);
+    return true;
+}
+
+static int roundTrip()
+{
+    pid_t reader = forkReader(false);
+    waitReady(1);
+
+    zcm_t* zcm = zcm_create(url.c_str());
+    if (!zcm) return 1;
+    bool ok = publish(zcm, 0, NUM_MSGS);
+    zcm_destroy(zcm);
+    return ok && reaped(reader, false) ? 0 : 1;
+}
+
+// Readers share nothing but the doorbell with the publisher, so one that is
+// killed in the middle of the stream must hold up neither it nor the others
+static int deadReader()
+{
+    pid_t doomed = forkReader(true);
+    pid_t reader = forkReader(false);
+    waitReady(2);
+
+    zcm_t* zcm = zcm_create(url.c_str());
+    if (!zcm) return 1;
+    bool ok = publish(zcm, 0, NUM_MSGS / 2);
+    kill(doomed, SIGKILL);
+    ok = reaped(doomed, true) && ok;
+    ok = publish(zcm, NUM_MSGS / 2, NUM_MSGS) && ok;
+    zcm_destroy(zcm);
+    return ok && reaped(reader, false) ? 0 : 1;
+}
+
+// A publisher that is killed leaves its ring and lockfile behind: the next
+// publisher of the channel takes both over and its readers follow it there
+static int deadPublisher()
+{
+    pid_t reader = forkReader(false);
+    waitReady(1);
+
+    pid_t doomed = fork();
+    if (doomed == 0) {
+        zcm_t* zcm = zcm_create(url.c_str());
+        if (!zcm || !publish(zcm, 0, NUM_MSGS / 2)) _exit(1);
+        kill(getpid(), SIGKILL);
+    }
+    if (!reaped(doomed, true)) return 1;
+
+    zcm_t* zcm = zcm_create(url.c_str());
+    if (!zcm) return 1;
+    bool ok = publish(zcm, NUM_MSGS / 2, NUM_MSGS);
+    zcm_destroy(zcm);
+    return ok && reaped(reader, false) ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (pipe(readyPipe) < 0) return 1;
+
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "round trip", roundTrip },
+        { "dead reader", deadReader },
+        { "dead publisher", deadPublisher },
+    };
+
+    int ret = 0;
+    for (auto& t : tests) {
+        // A subnet of our own, so that rings other tests left can't interfere
+        string subnet = "shmtest" + to_string(getpid()) + "-" + to_string(&t - tests);
+        url = "shm://" + subnet + "?size=" + to_string(RING_SIZE);
+        int r = t.fn();
+        // The doorbell of a subnet outlives its users
+        unlink(("/dev/shm/zcm-shm-" + subnet).c_str());
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
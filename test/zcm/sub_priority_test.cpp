@@ -0,0 +1,123 @@
+// Subscription priorities of zcm_set_sub_priority(): what queued up behind a
+// long callback is dispatched by class, a message going by the highest class
+// of the subs it matches, and each channel stays in order
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "test_util.h"
+
+using namespace std;
+
+static mutex orderMutex;
+static vector<string> order;
+
+static void handler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    uint32_t seq;
+    memcpy(&seq, rbuf->data, sizeof(seq));
+    unique_lock<mutex> lk(orderMutex);
+    order.push_back(string(channel) + ":" + to_string(seq) + (usr ? "+" : ""));
+}
+
+struct Blocker
+{
+    atomic<bool> inside {false};
+    atomic<bool> release {false};
+};
+
+static void blockerHandler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Blocker* b = (Blocker*) usr;
+    b->inside = true;
+    while (!b->release) usleep(100);
+}
+
+static void publish(zcm_t* zcm, const char* channel, uint32_t seq)
+{
+    uint8_t data[8] = {};
+    memcpy(data, &seq, sizeof(seq));
+    zcm_publish(zcm, channel, data, sizeof(data));
+}
+
+/********************** TESTS **********************/
+// Queued in the order LOG, BULK, ESTOP, dispatched high class first and low
+// class last, each channel in order. BOTH has a normal and a high sub, and
+// goes as high along with ESTOP
+static int byClass()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Blocker b;
+    zcm_subscribe(zcm, "BLOCK", blockerHandler, &b);
+    zcm_sub_t* log = zcm_subscribe(zcm, "LOG", handler, nullptr);
+    zcm_subscribe(zcm, "BULK", handler, nullptr);
+    zcm_sub_t* estop = zcm_subscribe(zcm, "ESTOP", handler, nullptr);
+    zcm_subscribe(zcm, "BOTH", handler, nullptr);
+    zcm_sub_t* both = zcm_subscribe(zcm, "BOTH", handler, &b);
+    if (zcm_set_sub_priority(zcm, log, ZCM_PRIORITY_LOW) != ZCM_EOK) fail("set low");
+    if (zcm_set_sub_priority(zcm, estop, ZCM_PRIORITY_HIGH) != ZCM_EOK) fail("set high");
+    if (zcm_set_sub_priority(zcm, both, ZCM_PRIORITY_HIGH) != ZCM_EOK) fail("set high");
+    zcm_start(zcm);
+
+    publish(zcm, "BLOCK", 0);
+    if (!waitFor([&]() { return b.inside.load(); })) fail("never blocked");
+    for (uint32_t i = 0; i < 2; ++i) publish(zcm, "LOG", i);
+    for (uint32_t i = 0; i < 2; ++i) publish(zcm, "BULK", i);
+    for (uint32_t i = 0; i < 2; ++i) publish(zcm, "ESTOP", i);
+    publish(zcm, "BOTH", 0);
+    // All of them queued before any is dispatched
+    if (!waitFor([&]() { return stat(zcm, "zcm.recv_msgs") == 8; })) fail("not received");
+    b.release = true;
+    if (!waitFor([&]() { unique_lock<mutex> lk(orderMutex); return order.size() == 8; }))
+        fail("dispatched %zu", order.size());
+    zcm_stop(zcm);
+
+    vector<string> want = { "ESTOP:0", "ESTOP:1", "BOTH:0", "BOTH:0+",
+                            "BULK:0", "BULK:1", "LOG:0", "LOG:1" };
+    if (order != want) {
+        string got;
+        for (auto& o : order) got += " " + o;
+        fail("dispatched%s", got.c_str());
+    }
+    zcm_destroy(zcm);
+    return 0;
+}
+
+static int badArgs()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    zcm_sub_t* sub = zcm_subscribe(zcm, "CH", handler, nullptr);
+    if (zcm_set_sub_priority(zcm, sub, ZCM_NUM_PRIORITIES) != ZCM_EINVALID) fail("unknown class");
+    zcm_start(zcm);
+    if (zcm_set_sub_priority(zcm, sub, ZCM_PRIORITY_HIGH) != ZCM_EINVALID) fail("set while running");
+    zcm_stop(zcm);
+    zcm_unsubscribe(zcm, sub);
+    if (zcm_set_sub_priority(zcm, sub, ZCM_PRIORITY_HIGH) != ZCM_EINVALID) fail("set unsubscribed");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "by class", byClass },
+        { "bad args", badArgs },
+    };
+
+    // A callback never released fails the test rather than hang it
+    alarm(60);
+    int ret = 0;
+    for (auto& t : tests) {
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
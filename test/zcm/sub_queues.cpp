@@ -0,0 +1,97 @@
+// Test cases for per-subscription queues (zcm_set_sub_queue())
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include "zcm/zcm.h"
+
+static constexpr int NUM_MSGS = 200;
+
+struct Counter
+{
+    std::atomic<int> count {0};
+    std::atomic<int> last {0};
+    useconds_t delay = 0;
+};
+
+static void handler(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{
+    Counter* c = (Counter*) usr;
+    int v;
+    memcpy(&v, rbuf->data, sizeof(v));
+    c->last = v;
+    c->count++;
+    if (c->delay) usleep(c->delay);
+}
+
+static void test_args()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    assert(zcm);
+
+    Counter c;
+    zcm_sub_t* sub = zcm_subscribe(zcm, "CHAN", handler, &c);
+    assert(sub);
+
+    assert(zcm_set_sub_queue(zcm, sub, 0, ZCM_QUEUE_DROP_OLDEST) == ZCM_EINVALID);
+    assert(zcm_set_sub_queue(zcm, sub, 0, ZCM_QUEUE_KEEP_LATEST) == ZCM_EOK);
+    assert(zcm_set_sub_queue(zcm, sub, 0, ZCM_QUEUE_SHARED) == ZCM_EOK);
+
+    zcm_unsubscribe(zcm, sub);
+    assert(zcm_set_sub_queue(zcm, sub, 4, ZCM_QUEUE_DROP_NEWEST) == ZCM_EINVALID);
+
+    zcm_destroy(zcm);
+}
+
+// A slow subscriber must neither stall a fast one on another dispatch thread
+// nor see anything but (close to) the most recent message
+static void test_policies()
+{
+    zcm_t* zcm = zcm_create("block-inproc://?dispatch_threads=4");
+    assert(zcm);
+
+    Counter fast, latest, newest;
+    latest.delay = newest.delay = 20000;
+
+    // Note: these channels hash to distinct dispatchers
+    zcm_subscribe(zcm, "FAST", handler, &fast);
+    zcm_sub_t* sl = zcm_subscribe(zcm, "SLOW", handler, &latest);
+    zcm_sub_t* sn = zcm_subscribe(zcm, "NEW", handler, &newest);
+    assert(zcm_set_sub_queue(zcm, sl, 0, ZCM_QUEUE_KEEP_LATEST) == ZCM_EOK);
+    assert(zcm_set_sub_queue(zcm, sn, 3, ZCM_QUEUE_DROP_NEWEST) == ZCM_EOK);
+
+    zcm_start(zcm);
+    for (int i = 1; i <= NUM_MSGS; ++i) {
+        zcm_publish(zcm, "SLOW", (uint8_t*) &i, sizeof(i));
+        zcm_publish(zcm, "NEW", (uint8_t*) &i, sizeof(i));
+        zcm_publish(zcm, "FAST", (uint8_t*) &i, sizeof(i));
+        usleep(500);
+    }
+    usleep(300000);
+    zcm_stop(zcm);
+
+    if (fast.count != NUM_MSGS) {
+        printf("Fast subscriber got %d of %d msgs. Test Failed.\n", fast.count.load(), NUM_MSGS);
+        exit(1);
+    }
+    if (latest.last != NUM_MSGS || latest.count >= NUM_MSGS) {
+        printf("Keep-latest subscriber ended on msg %d. Test Failed.\n", latest.last.load());
+        exit(1);
+    }
+    if (newest.last == NUM_MSGS || newest.count >= NUM_MSGS) {
+        printf("Drop-newest subscriber got the newest msg. Test Failed.\n");
+        exit(1);
+    }
+
+    zcm_destroy(zcm);
+}
+
+int main()
+{
+    test_args();
+    test_policies();
+
+    return 0;
+}
@@ -0,0 +1,317 @@
+// The tcp transport's framing, its queueing of partial writes, the forwarding
+// of subscriptions between peers and reconnection, tested against a raw
+// socket and between two transports
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "test_util.h"
+
+using namespace std;
+
+#define FRAME_MSG 0
+#define FRAME_SUB 1
+#define FRAME_UNSUB 2
+
+static int port;
+
+static string listenUrl(const string& opts = "")
+{ return "tcp://*:" + to_string(port) + opts; }
+
+static string connectUrl(const string& opts = "")
+{ return "tcp://127.0.0.1:" + to_string(port) + opts; }
+
+static string payload(size_t len, int seed)
+{
+    string s(len, '\0');
+    for (size_t i = 0; i < len; ++i) s[i] = (char) (i * 7 + seed);
+    return s;
+}
+
+static int send(zcm_trans_t* zt, const char* channel, const string& data)
+{
+    zcm_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.channel = channel;
+    msg.len = data.size();
+    msg.buf = (uint8_t*) data.data();
+    return zcm_trans_sendmsg(zt, msg);
+}
+
+// Receives the next message, skipping none. Fails unless it is 'data' on 'channel'
+static bool recvExpect(zcm_trans_t* zt, const char* channel, const string& data)
+{
+    zcm_msg_t msg;
+    uint64_t deadline = TimeUtil::utime() + TIMEOUT_US;
+    while (zcm_trans_recvmsg(zt, &msg, 100) != ZCM_EOK)
+        if (TimeUtil::utime() > deadline) return false;
+    return strcmp(msg.channel, channel) == 0 && msg.len == data.size() &&
+           memcmp(msg.buf, data.data(), data.size()) == 0;
+}
+
+static bool nothingToRecv(zcm_trans_t* zt)
+{
+    zcm_msg_t msg;
+    return zcm_trans_recvmsg(zt, &msg, 200) == ZCM_EAGAIN;
+}
+
+static string frame(uint8_t type, const string& body)
+{
+    uint32_t len = body.size() + 1;
+    string f;
+    f += (char) (len >> 24);
+    f += (char) (len >> 16);
+    f += (char) (len >> 8);
+    f += (char) len;
+    f += (char) type;
+    return f + body;
+}
+
+static string msgFrame(const string& channel, const string& data)
+{ return frame(FRAME_MSG, string(1, (char) channel.size()) + channel + data); }
+
+/********************** RAW PEER **********************/
+struct RawPeer
+{
+    int fd = -1;
+    string in;
+
+    ~RawPeer() { if (fd >= 0) close(fd); }
+
+    bool connectTo()
+    {
+        uint64_t deadline = TimeUtil::utime() + TIMEOUT_US;
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        while (true) {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(fd, (struct sockaddr*) &sa, sizeof(sa)) == 0) return true;
+            close(fd);
+            fd = -1;
+            if (TimeUtil::utime() > deadline) return false;
+            usleep(10000);
+        }
+    }
+
+    // Writes 'data' 'chunk' bytes at a time, so that frames arrive in pieces
+    bool write(const string& data, size_t chunk)
+    {
+        for (size_t off = 0; off < data.size(); off += chunk) {
+            size_t n = min(chunk, data.size() - off);
+            if (::send(fd, data.data() + off, n, MSG_NOSIGNAL) != (ssize_t) n) return false;
+            if (chunk < data.size()) usleep(2000);
+        }
+        return true;
+    }
+
+    // Reads the next frame, as its type and body. False on EOF or timeout
+    bool readFrame(uint8_t& type, string& body)
+    {
+        struct timeval tv = { TIMEOUT_US / 1000000, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        while (true) {
+            if (in.size() >= 5) {
+                uint32_t len = ((uint32_t) (uint8_t) in[0] << 24) |
+                               ((uint32_t) (uint8_t) in[1] << 16) |
+                               ((uint32_t) (uint8_t) in[2] << 8) | (uint8_t) in[3];
+                if (in.size() >= 4 + len) {
+                    type = in[4];
+                    body = in.substr(5, len - 1);
+                    in.erase(0, 4 + len);
+                    return true;
+                }
+            }
+            char buf[65536];
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) return false;
+            in.append(buf, n);
+        }
+    }
+
+    bool eof()
+    {
+        char c;
+        struct timeval tv = { TIMEOUT_US / 1000000, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        while (true) {
+            ssize_t n = recv(fd, &c, 1, 0);
+            if (n == 0) return true;
+            if (n < 0) return false;
+        }
+    }
+};
+
+/********************** TESTS **********************/
+// Frames split across writes, several in one write, both ways
+static int framing()
+{
+    zcm_trans_t* zt = makeTransport(listenUrl());
+    if (!zt) fail("no transport");
+    zcm_trans_recvmsg_enable(zt, "IN", true);
+
+    RawPeer raw;
+    if (!raw.connectTo()) fail("can't connect");
+
+    // What we subscribe to is the first thing a peer hears
+    uint8_t type;
+    string body;
+    if (!raw.readFrame(type, body) || type != FRAME_SUB || body != "IN")
+        fail("no subscription to IN on connect");
+
+    // One byte at a time, then three frames in a single write
+    string big = payload(200000, 1);
+    if (!raw.write(msgFrame("IN", "hello"), 1)) fail("write");
+    if (!raw.write(msgFrame("IN", "") + msgFrame("IN", big) + msgFrame("OTHER", "x"),
+                   1 << 20))
+        fail("write");
+    if (!recvExpect(zt, "IN", "hello")) fail("split frame");
+    if (!recvExpect(zt, "IN", "")) fail("empty message");
+    if (!recvExpect(zt, "IN", big)) fail("big message");
+    // Delivered whatever the channel: the other end only sends what we asked for
+    if (!recvExpect(zt, "OTHER", "x")) fail("message on another channel");
+
+    // Out: only what the peer subscribed to
+    if (!raw.write(frame(FRAME_SUB, "OUT"), 2)) fail("write");
+    if (!waitFor([&]() { return zcm_trans_has_subscribers(zt, "OUT") == 1; }))
+        fail("subscription to OUT not seen");
+    if (zcm_trans_has_subscribers(zt, "NOPE") != 0) fail("subscribers to NOPE");
+    send(zt, "NOPE", "no");
+    send(zt, "OUT", "first");
+    send(zt, "OUT", big);
+    if (!raw.readFrame(type, body) || body != msgFrame("OUT", "first").substr(5))
+        fail("first message out");
+    if (!raw.readFrame(type, body) || type != FRAME_MSG || body != msgFrame("OUT", big).substr(5))
+        fail("big message out");
+
+    // A frame that can't be one gets the connection closed
+    if (!raw.write(string("\0\0\0\0\0", 5), 5)) fail("write");
+    if (!raw.eof()) fail("connection not closed on a bad frame");
+
+    zcm_trans_destroy(zt);
+    return 0;
+}
+
+// The receiver doesn't read for a while: the sender's writes come up short,
+// and what the kernel didn't take goes out later, intact and in order
+static int partialWrites()
+{
+    const int nmsgs = 32;
+    zcm_trans_t* sender = makeTransport(listenUrl("?sndqueue=" + to_string(64 << 20)));
+    if (!sender) fail("no transport");
+
+    RawPeer raw;
+    if (!raw.connectTo()) fail("can't connect");
+    if (!raw.write(frame(FRAME_SUB, ""), 6)) fail("write");
+    if (!waitFor([&]() { return zcm_trans_has_subscribers(sender, "ANY") == 1; }))
+        fail("subscription to everything not seen");
+
+    // Far more than the socket buffers hold
+    for (int i = 0; i < nmsgs; ++i)
+        if (send(sender, "BIG", payload(1 << 20, i)) != ZCM_EOK) fail("send %d", i);
+
+    usleep(200000);
+    uint8_t type;
+    string body;
+    for (int i = 0; i < nmsgs; ++i) {
+        if (!raw.readFrame(type, body)) fail("message %d missing", i);
+        if (type != FRAME_MSG || body != msgFrame("BIG", payload(1 << 20, i)).substr(5))
+            fail("message %d corrupt", i);
+    }
+
+    zcm_trans_destroy(sender);
+    return 0;
+}
+
+// Two transports tell each other what they subscribe to, and only that crosses
+static int interest()
+{
+    zcm_trans_t* a = makeTransport(listenUrl());
+    zcm_trans_t* b = makeTransport(connectUrl());
+    if (!a || !b) fail("no transport");
+
+    zcm_trans_recvmsg_enable(b, "A", true);
+    if (!waitFor([&]() { return zcm_trans_has_subscribers(a, "A") == 1; }))
+        fail("subscription to A not forwarded");
+    if (zcm_trans_has_subscribers(a, "B") != 0) fail("subscribers to B");
+
+    send(a, "B", "b");
+    send(a, "A", "a");
+    if (!recvExpect(b, "A", "a")) fail("A not received");
+    if (!nothingToRecv(b)) fail("B received");
+
+    // Both ways
+    zcm_trans_recvmsg_enable(a, NULL, true);
+    if (!waitFor([&]() { return zcm_trans_has_subscribers(b, "C") == 1; }))
+        fail("subscription to everything not forwarded");
+    send(b, "C", "c");
+    if (!recvExpect(a, "C", "c")) fail("C not received");
+
+    zcm_trans_recvmsg_enable(b, "A", false);
+    if (!waitFor([&]() { return zcm_trans_has_subscribers(a, "A") == 0; }))
+        fail("unsubscription from A not forwarded");
+    send(a, "A", "a");
+    if (!nothingToRecv(b)) fail("A received after unsubscribing");
+
+    zcm_trans_destroy(b);
+    zcm_trans_destroy(a);
+    return 0;
+}
+
+// The connecting end comes back to a listener that restarted, and tells it
+// again what it subscribes to
+static int reconnect()
+{
+    zcm_trans_t* a = makeTransport(listenUrl());
+    zcm_trans_t* b = makeTransport(connectUrl());
+    if (!a || !b) fail("no transport");
+
+    zcm_trans_recvmsg_enable(b, "A", true);
+    if (!waitFor([&]() { return zcm_trans_has_subscribers(a, "A") == 1; }))
+        fail("subscription to A not forwarded");
+    send(a, "A", "before");
+    if (!recvExpect(b, "A", "before")) fail("message before the restart");
+
+    zcm_trans_destroy(a);
+    a = makeTransport(listenUrl());
+    if (!a) fail("no transport after the restart");
+    if (!waitFor([&]() { return zcm_trans_has_subscribers(a, "A") == 1; }))
+        fail("no reconnection with the subscription to A");
+    send(a, "A", "after");
+    if (!recvExpect(b, "A", "after")) fail("message after the restart");
+
+    zcm_trans_destroy(b);
+    zcm_trans_destroy(a);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "framing", framing },
+        { "partial writes", partialWrites },
+        { "interest", interest },
+        { "reconnect", reconnect },
+    };
+
+    int ret = 0;
+    port = testPort();
+    for (auto& t : tests) {
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+        ++port;
+    }
+    return ret;
+}
@@ -0,0 +1,93 @@
+// Helpers shared by the tests in test/zcm. The C++ ones are only there for C++
+
+#ifndef _ZCM_TEST_UTIL_H
+#define _ZCM_TEST_UTIL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// How long a test waits for anything before it gives up
+#ifndef TIMEOUT_US
+#define TIMEOUT_US 5000000
+#endif
+
+// Prints the error and fails the calling test (returns 1 from it)
+#define fail(...) \
+    do { \
+        fprintf(stderr, "Err: "); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        return 1; \
+    } while (0)
+
+// The first port of the ones a test uses, so that two runs don't share any
+static inline int testPort(void)
+{ return 20000 + getpid() % 20000; }
+
+#ifdef __cplusplus
+
+#include <functional>
+#include <string>
+
+#include "zcm/zcm.h"
+#include "zcm/transport.h"
+#include "zcm/transport_registrar.h"
+#include "zcm/url.h"
+#include "util/TimeUtil.hpp"
+
+// The transport of 'url', or nullptr
+static inline zcm_trans_t* makeTransport(const std::string& url)
+{
+    zcm_url_t* u = zcm_url_create(url.c_str());
+    zcm_trans_create_func* creator = zcm_transport_find(zcm_url_protocol(u));
+    zcm_trans_t* zt = creator ? creator(u) : nullptr;
+    zcm_url_destroy(u);
+    return zt;
+}
+
+struct StatFind { std::string name; uint64_t value; };
+static inline void statFind(const char* n, uint64_t v, void* usr)
+{
+    StatFind* f = (StatFind*) usr;
+    if (f->name == n) f->value = v;
+}
+
+// The counter 'name' of zcm_trans_get_stats() / zcm_get_stats(), 0 if there's none
+static inline uint64_t stat(zcm_trans_t* zt, const std::string& name)
+{
+    StatFind f { name, 0 };
+    zcm_trans_get_stats(zt, statFind, &f);
+    return f.value;
+}
+static inline uint64_t stat(zcm_t* zcm, const std::string& name)
+{
+    StatFind f { name, 0 };
+    zcm_get_stats(zcm, statFind, &f);
+    return f.value;
+}
+
+// A channel starting with 'prefix' that zcm_set_dispatch_threads(n) sends to
+// dispatcher 'd'
+static inline std::string channelOn(const std::string& prefix, uint32_t d, uint32_t n)
+{
+    for (int i = 0;; ++i) {
+        std::string ch = prefix + std::to_string(i);
+        if (zcm_channel_hash(ch.c_str()) % n == d) return ch;
+    }
+}
+
+// Polls 'cond' until it holds (true) or TIMEOUT_US is up (false)
+static inline bool waitFor(std::function<bool()> cond)
+{
+    uint64_t deadline = TimeUtil::utime() + TIMEOUT_US;
+    while (!cond()) {
+        if (TimeUtil::utime() > deadline) return false;
+        usleep(1000);
+    }
+    return true;
+}
+
+#endif
+
+#endif /* _ZCM_TEST_UTIL_H */
@@ -0,0 +1,157 @@
+// Timers of zcm_add_timer(): called every period, with the periods missed
+// while the dispatcher was busy as ticks, removable from within themselves,
+// and waking up zcm_handle() with nothing to dispatch
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "test_util.h"
+
+using namespace std;
+
+#define PERIOD_US 10000
+
+struct Ticks
+{
+    atomic<int>      calls {0};
+    atomic<uint32_t> ticks {0};
+    atomic<uint32_t> maxTicks {0};
+    zcm_timer_t*     timer = nullptr;
+    int              removeAt = 0;
+    atomic<int>      removeRc {-1};
+};
+
+static void tick(zcm_t* zcm, uint32_t ticks, void* usr)
+{
+    Ticks* t = (Ticks*) usr;
+    t->ticks += ticks;
+    if (ticks > t->maxTicks) t->maxTicks = ticks;
+    if (++t->calls == t->removeAt) t->removeRc = zcm_remove_timer(zcm, t->timer);
+}
+
+static void slow(const zcm_recv_buf_t* rbuf, const char* channel, void* usr)
+{ usleep(*(useconds_t*) usr); }
+
+/********************** TESTS **********************/
+// Once every period, their deadlines following on from each other
+static int period()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Ticks t;
+    t.timer = zcm_add_timer(zcm, PERIOD_US, tick, &t);
+    if (!t.timer) fail("no timer");
+    uint64_t start = TimeUtil::utime();
+    zcm_start(zcm);
+    usleep(30 * PERIOD_US);
+    zcm_stop(zcm);
+    uint64_t periods = (TimeUtil::utime() - start) / PERIOD_US;
+    if (t.ticks > periods || t.ticks + 3 < periods)
+        fail("%u ticks in %lu periods", t.ticks.load(), (unsigned long) periods);
+    if (zcm_remove_timer(zcm, t.timer) != ZCM_EOK) fail("remove");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// A callback keeping the dispatcher busy for several periods makes the next
+// call stand for all of them
+static int ticks()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    useconds_t delay = 6 * PERIOD_US;
+    zcm_subscribe(zcm, "SLOW", slow, &delay);
+    Ticks t;
+    t.timer = zcm_add_timer(zcm, PERIOD_US, tick, &t);
+    uint64_t start = TimeUtil::utime();
+    zcm_start(zcm);
+    uint8_t data[4] = {};
+    zcm_publish(zcm, "SLOW", data, sizeof(data));
+    usleep(20 * PERIOD_US);
+    zcm_stop(zcm);
+    uint64_t periods = (TimeUtil::utime() - start) / PERIOD_US;
+    if (t.maxTicks < 5) fail("at most %u ticks at once", t.maxTicks.load());
+    if (t.calls >= (int) t.ticks) fail("%d calls for %u ticks", t.calls.load(), t.ticks.load());
+    if (t.ticks > periods || t.ticks + 3 < periods)
+        fail("%u ticks in %lu periods", t.ticks.load(), (unsigned long) periods);
+    zcm_destroy(zcm);
+    return 0;
+}
+
+static int removeInside()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Ticks t;
+    t.removeAt = 3;
+    t.timer = zcm_add_timer(zcm, PERIOD_US, tick, &t);
+    zcm_start(zcm);
+    usleep(10 * PERIOD_US);
+    zcm_stop(zcm);
+    if (t.removeRc != ZCM_EOK) fail("remove returned %d", t.removeRc.load());
+    if (t.calls != 3) fail("called %d times", t.calls.load());
+    if (zcm_remove_timer(zcm, t.timer) != ZCM_EINVALID) fail("removed twice");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+// zcm_handle() waits for a timer to come due, including one added while it
+// waits with nothing to wait for. A wakeup that dispatches nothing returns
+// ZCM_EAGAIN, so it is called in a loop as usual
+static int handle()
+{
+    zcm_t* zcm = zcm_create("block-inproc");
+    if (!zcm) fail("no zcm");
+    Ticks t;
+    t.timer = zcm_add_timer(zcm, 2 * PERIOD_US, tick, &t);
+    uint64_t start = TimeUtil::utime();
+    int handles = 0;
+    while (t.calls == 0 && handles < 10) {
+        int rc = zcm_handle(zcm);
+        if (rc != ZCM_EOK && rc != ZCM_EAGAIN) fail("handle returned %d", rc);
+        ++handles;
+    }
+    uint64_t took = TimeUtil::utime() - start;
+    if (t.calls != 1) fail("not called after %d handles", handles);
+    // Waited for it rather than spin
+    if (handles > 2) fail("%d handles", handles);
+    if (took < PERIOD_US || took > 20 * PERIOD_US) fail("called after %luus", (unsigned long) took);
+    zcm_remove_timer(zcm, t.timer);
+
+    Ticks later;
+    atomic<bool> stop {false};
+    thread handler([&]() {
+        while (!stop && later.calls == 0) zcm_handle(zcm);
+    });
+    usleep(5 * PERIOD_US);
+    later.timer = zcm_add_timer(zcm, PERIOD_US, tick, &later);
+    bool woke = waitFor([&]() { return later.calls == 1; });
+    // Left to the alarm if the handler never wakes up
+    stop = true;
+    handler.join();
+    if (!woke) fail("not woken up for a new timer");
+    zcm_destroy(zcm);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "period", period },
+        { "ticks", ticks },
+        { "remove inside", removeInside },
+        { "handle", handle },
+    };
+
+    // A handler never woken up fails the test rather than hang it
+    alarm(60);
+    int ret = 0;
+    for (auto& t : tests) {
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
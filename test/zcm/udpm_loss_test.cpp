@@ -0,0 +1,475 @@
+// Loss recovery in udpm: a relay in between the publisher's port and the
+// subscriber's drops chosen packets the first time they pass (and NACKs on
+// their way back), and the subscriber must still get every message intact,
+// from the parity packets of FEC or from the retransmits of reliable mode
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "test_util.h"
+
+using namespace std;
+
+// The packets the relay tells apart (see zcm/transport/udpm/buffers.hpp):
+// all start with magic and msg_seqno, fragments and parity packets have the
+// number of their (first) fragment 16 bytes in
+#define MAGIC_SHORT  0x4c433032
+#define MAGIC_LONG   0x4c433033
+#define MAGIC_PARITY 0x4c433034
+#define MAGIC_NACK   0x4c433035
+#define FRAGMENT_NO_OFFSET 16
+
+#define MC_ADDR "239.255.76.67"
+// With frag=1000, a message of BIG_LEN bytes on "BIG" is 20 fragments
+#define FRAG 1000
+#define BIG_LEN (20 * FRAG - 4)
+// Longer than the NACK retry interval, so that lost NACKs get sent again
+#define TICK_US 20000
+
+static int port;
+
+struct Packet
+{
+    uint32_t magic;
+    uint32_t seqno;
+    int      frag;  // fragment_no or first_fragment, -1 for short messages
+};
+
+// Forwards what the publisher sends on 'port' to the subscriber on 'port' + 1,
+// and the NACKs the subscriber unicasts back to the relay to the publisher.
+// 'copies' says how many times a packet passes the first time it comes by
+// (retransmits always pass), 'dropNack' whether the n-th NACK is lost
+struct Relay
+{
+    int in = -1, out = -1;
+    struct sockaddr_in dest, pub;
+    bool havePub = false;
+
+    function<int(const Packet&)> copies = [](const Packet&) { return 1; };
+    function<bool(size_t)> dropNack = [](size_t) { return false; };
+
+    set<tuple<uint32_t, uint32_t, int>> seen;
+    size_t dropped = 0, nacks = 0;
+
+    bool open()
+    {
+        in = socket(AF_INET, SOCK_DGRAM, 0);
+        out = socket(AF_INET, SOCK_DGRAM, 0);
+        if (in < 0 || out < 0) return false;
+
+        int one = 1;
+        setsockopt(in, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        setsockopt(in, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(port);
+        if (bind(in, (struct sockaddr*) &addr, sizeof(addr)) < 0) return false;
+
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr.s_addr = inet_addr(MC_ADDR);
+        mreq.imr_interface.s_addr = INADDR_ANY;
+        if (setsockopt(in, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) return false;
+
+        unsigned char ttl = 0, loop = 1;
+        setsockopt(out, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        setsockopt(out, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+        dest = addr;
+        dest.sin_addr.s_addr = inet_addr(MC_ADDR);
+        dest.sin_port = htons(port + 1);
+        return true;
+    }
+
+    ~Relay()
+    {
+        if (in >= 0) close(in);
+        if (out >= 0) close(out);
+    }
+
+    static Packet parse(const uint8_t* buf, size_t sz)
+    {
+        Packet p { 0, 0, -1 };
+        uint32_t v;
+        uint16_t frag;
+        if (sz >= 8) {
+            memcpy(&v, buf, 4);
+            p.magic = ntohl(v);
+            memcpy(&v, buf + 4, 4);
+            p.seqno = ntohl(v);
+        }
+        if ((p.magic == MAGIC_LONG || p.magic == MAGIC_PARITY) &&
+            sz >= FRAGMENT_NO_OFFSET + 2) {
+            memcpy(&frag, buf + FRAGMENT_NO_OFFSET, 2);
+            p.frag = ntohs(frag);
+        }
+        return p;
+    }
+
+    // Moves along whatever is waiting, both ways
+    void pump()
+    {
+        uint8_t buf[65536];
+        struct sockaddr_in from;
+        socklen_t fromlen = sizeof(from);
+        ssize_t sz;
+        while ((sz = recvfrom(in, buf, sizeof(buf), MSG_DONTWAIT,
+                              (struct sockaddr*) &from, &fromlen)) > 0) {
+            pub = from;
+            havePub = true;
+            Packet p = parse(buf, sz);
+            int n = seen.emplace(p.magic, p.seqno, p.frag).second ? copies(p) : 1;
+            if (n == 0) dropped++;
+            for (int i = 0; i < n; ++i)
+                sendto(out, buf, sz, 0, (struct sockaddr*) &dest, sizeof(dest));
+            fromlen = sizeof(from);
+        }
+        while ((sz = recv(out, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+            if (parse(buf, sz).magic != MAGIC_NACK || !havePub) continue;
+            if (dropNack(nacks++)) continue;
+            sendto(out, buf, sz, 0, (struct sockaddr*) &pub, sizeof(pub));
+        }
+    }
+};
+
+static vector<uint8_t> makeMsg(uint32_t seq, size_t len)
+{
+    vector<uint8_t> data(len);
+    memcpy(data.data(), &seq, 4);
+    for (size_t i = 4; i < len; ++i) data[i] = (uint8_t) (seq * 31 + i);
+    return data;
+}
+
+static int send(zcm_trans_t* zt, const char* channel, uint32_t seq, size_t len)
+{
+    vector<uint8_t> data = makeMsg(seq, len);
+    zcm_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.channel = channel;
+    msg.len = data.size();
+    msg.buf = data.data();
+    return zcm_trans_sendmsg(zt, msg);
+}
+
+// A publisher, the relay and a subscriber, all driven from here. The
+// publisher's own recvmsg() is what serves NACKs
+struct Link
+{
+    zcm_trans_t* pub = nullptr;
+    zcm_trans_t* sub = nullptr;
+    Relay relay;
+    size_t len;  // of the messages on 'channel'
+    string channel;
+
+    vector<int> got;  // times each message was received
+    size_t bad = 0;
+
+    Link(const string& opts, const string& channel, size_t len) : len(len), channel(channel)
+    {
+        if (!relay.open()) return;
+        pub = makeTransport("udpm://" MC_ADDR ":" + to_string(port) + "?ttl=0" + opts);
+        sub = makeTransport("udpm://" MC_ADDR ":" + to_string(port + 1) + "?ttl=0" + opts);
+        if (sub) zcm_trans_recvmsg_enable(sub, NULL, true);
+    }
+
+    ~Link()
+    {
+        if (pub) zcm_trans_destroy(pub);
+        if (sub) zcm_trans_destroy(sub);
+    }
+
+    void poll(int timeout)
+    {
+        zcm_msg_t msg;
+        relay.pump();
+        while (zcm_trans_recvmsg(pub, &msg, 0) == ZCM_EOK) {}
+        relay.pump();
+        while (zcm_trans_recvmsg(sub, &msg, timeout) == ZCM_EOK) {
+            timeout = 0;
+            if (channel != msg.channel) continue;
+            uint32_t seq;
+            if (msg.len != len) { bad++; continue; }
+            memcpy(&seq, msg.buf, 4);
+            if (seq >= got.size() || memcmp(msg.buf, makeMsg(seq, len).data(), len) != 0) {
+                bad++;
+                continue;
+            }
+            got[seq]++;
+        }
+    }
+
+    bool sendAll(uint32_t n)
+    {
+        got.assign(n, 0);
+        for (uint32_t seq = 0; seq < n; ++seq) {
+            if (send(pub, channel.c_str(), seq, len) != ZCM_EOK) return false;
+            poll(0);
+        }
+        return true;
+    }
+
+    // Until 'done', ticking along so that receivers notice what they miss
+    bool wait(function<bool()> done)
+    {
+        uint64_t deadline = TimeUtil::utime() + TIMEOUT_US;
+        uint64_t nextTick = 0;
+        uint32_t ticks = 0;
+        while (!done()) {
+            uint64_t now = TimeUtil::utime();
+            if (now > deadline) return false;
+            if (now >= nextTick) {
+                if (send(pub, "TICK", ticks++, 4) != ZCM_EOK) return false;
+                nextTick = now + TICK_US;
+            }
+            poll(1);
+        }
+        return true;
+    }
+
+    bool allOnce() const
+    {
+        for (int n : got) if (n != 1) return false;
+        return true;
+    }
+
+    int missing() const
+    {
+        int n = 0;
+        for (int g : got) n += g == 0;
+        return n;
+    }
+};
+
+/********************** FEC **********************/
+static const string fecOpts = "&frag=" + to_string(FRAG) + "&fec=4";
+
+// One fragment of every group of 4, fragment 0 and its channel included
+static int fecOnePerGroup()
+{
+    Link l(fecOpts, "BIG", BIG_LEN);
+    if (!l.pub || !l.sub) fail("no transport");
+    l.relay.copies = [](const Packet& p) {
+        return p.magic == MAGIC_LONG && p.frag % 4 == (int) (p.seqno % 4) ? 0 : 1;
+    };
+    if (!l.sendAll(10)) fail("send");
+    l.wait([&] { return l.missing() == 0; });
+
+    if (!l.allOnce() || l.bad) fail("%d messages missing, %zu bad", l.missing(), l.bad);
+    if (l.relay.dropped != 10 * 5) fail("dropped %zu fragments", l.relay.dropped);
+    // Fragments are rebuilt as soon as their group misses no other, so the
+    // count also takes in some that were still on their way
+    if (stat(l.sub, "udpm.fec_recovered") < l.relay.dropped) fail("lost fragments not rebuilt");
+    return 0;
+}
+
+// The last group is short and so is its last fragment
+static int fecShortGroup()
+{
+    // 19 fragments, the last one 500 bytes
+    Link l(fecOpts, "BIG", BIG_LEN - FRAG / 2 - FRAG);
+    if (!l.pub || !l.sub) fail("no transport");
+    l.relay.copies = [](const Packet& p) {
+        return p.magic == MAGIC_LONG && (p.frag == 18 || (p.seqno % 2 && p.frag == 0)) ? 0 : 1;
+    };
+    if (!l.sendAll(10)) fail("send");
+    l.wait([&] { return l.missing() == 0; });
+
+    if (!l.allOnce() || l.bad) fail("%d messages missing, %zu bad", l.missing(), l.bad);
+    if (stat(l.sub, "udpm.fec_recovered") < 15) fail("lost fragments not rebuilt");
+    return 0;
+}
+
+// Without parity, a message needs all of its fragments and nothing else
+static int fecLostParity()
+{
+    Link l(fecOpts, "BIG", BIG_LEN);
+    if (!l.pub || !l.sub) fail("no transport");
+    l.relay.copies = [](const Packet& p) {
+        // All parity of even messages, of odd ones the parity of group 1 and
+        // a fragment of group 2
+        if (p.magic == MAGIC_PARITY) return p.seqno % 2 == 0 || p.frag == 4 ? 0 : 1;
+        return p.magic == MAGIC_LONG && p.seqno % 2 && p.frag == 9 ? 0 : 1;
+    };
+    if (!l.sendAll(10)) fail("send");
+    l.wait([&] { return l.missing() == 0; });
+
+    if (!l.allOnce() || l.bad) fail("%d messages missing, %zu bad", l.missing(), l.bad);
+    if (stat(l.sub, "udpm.fec_recovered") < 5) fail("lost fragments not rebuilt");
+    return 0;
+}
+
+// Two fragments lost in a group are one too many: the message is lost, and
+// neither comes out corrupt nor holds up the others. Its buffer goes as soon
+// as a later message is complete
+static int fecTooMany()
+{
+    Link l(fecOpts, "BIG", BIG_LEN);
+    if (!l.pub || !l.sub) fail("no transport");
+    l.relay.copies = [](const Packet& p) {
+        return p.magic == MAGIC_LONG && p.seqno == 3 && (p.frag == 5 || p.frag == 6) ? 0 : 1;
+    };
+    if (!l.sendAll(10)) fail("send");
+    l.wait([&] { return l.missing() == 1; });
+
+    if (l.got[3] != 0 || l.missing() != 1 || l.bad)
+        fail("%d messages missing, %zu bad", l.missing(), l.bad);
+    if (stat(l.sub, "udpm.frag_bufs") != 0) fail("partial message still buffered");
+    if (stat(l.sub, "udpm.frag_timeouts") != 1) fail("lost message not counted");
+    return 0;
+}
+
+/********************** NACK **********************/
+static const string nackOpts = "&nack=64";
+
+// Single messages, and a run of them
+static int nackShort()
+{
+    Link l(nackOpts, "DATA", 200);
+    if (!l.pub || !l.sub) fail("no transport");
+    l.relay.copies = [](const Packet& p) {
+        return p.magic == MAGIC_SHORT && (p.seqno == 5 || (p.seqno >= 20 && p.seqno < 24) ||
+                                          p.seqno == 50) ? 0 : 1;
+    };
+    if (!l.sendAll(100)) fail("send");
+    l.wait([&] { return l.missing() == 0; });
+
+    if (!l.allOnce() || l.bad) fail("%d messages missing, %zu bad", l.missing(), l.bad);
+    uint64_t resent = stat(l.pub, "udpm.retransmitted");
+    if (resent < 6) fail("only %lu retransmitted", (unsigned long) resent);
+    return 0;
+}
+
+// A message missing a fragment is NACKed, and sent whole again
+static int nackFragment()
+{
+    Link l("&frag=" + to_string(FRAG) + nackOpts, "BIG", BIG_LEN);
+    if (!l.pub || !l.sub) fail("no transport");
+    l.relay.copies = [](const Packet& p) {
+        return p.magic == MAGIC_LONG && ((p.seqno == 2 && p.frag == 7) ||
+                                         (p.seqno == 5 && p.frag == 0) ||
+                                         (p.seqno == 6 && p.frag == 19)) ? 0 : 1;
+    };
+    if (!l.sendAll(10)) fail("send");
+    l.wait([&] { return l.missing() == 0; });
+
+    if (!l.allOnce() || l.bad) fail("%d messages missing, %zu bad", l.missing(), l.bad);
+    return 0;
+}
+
+// A lost NACK is sent again; a packet that comes twice is received once
+static int nackRetries()
+{
+    Link l(nackOpts, "DATA", 200);
+    if (!l.pub || !l.sub) fail("no transport");
+    l.relay.copies = [](const Packet& p) {
+        if (p.magic != MAGIC_SHORT) return 1;
+        return p.seqno == 10 ? 0 : p.seqno % 7 == 0 ? 2 : 1;
+    };
+    l.relay.dropNack = [](size_t n) { return n < 2; };
+    if (!l.sendAll(50)) fail("send");
+    l.wait([&] { return l.missing() == 0; });
+
+    if (!l.allOnce() || l.bad) fail("%d messages missing, %zu bad", l.missing(), l.bad);
+    if (l.relay.nacks < 3) fail("%zu NACKs", l.relay.nacks);
+    if (stat(l.sub, "udpm.duplicates") == 0) fail("no duplicates seen");
+    return 0;
+}
+
+// A message NACKed only once it fell out of the sender's window is lost, and
+// costs no retransmit
+static int nackWindow()
+{
+    Link l("&nack=4", "DATA", 200);
+    if (!l.pub || !l.sub) fail("no transport");
+    l.relay.copies = [](const Packet& p) { return p.magic == MAGIC_SHORT && p.seqno == 2 ? 0 : 1; };
+    bool pass = false;
+    size_t passFrom = 0;
+    l.relay.dropNack = [&](size_t n) {
+        if (pass && !passFrom) passFrom = n;
+        return !pass;
+    };
+    if (!l.sendAll(20)) fail("send");
+    pass = true;
+    l.wait([&] { return passFrom && l.relay.nacks > passFrom + 2; });
+
+    if (l.got[2] != 0 || l.missing() != 1 || l.bad)
+        fail("%d messages missing, %zu bad", l.missing(), l.bad);
+    if (!passFrom) fail("NACKs not retried");
+    uint64_t resent = stat(l.pub, "udpm.retransmitted");
+    if (resent != 0) fail("%lu retransmitted", (unsigned long) resent);
+    return 0;
+}
+
+// The window must fit MAX_NACK_WINDOW, and every msg_seqno must be seen
+static int nackOptions()
+{
+    string url = "udpm://" MC_ADDR ":" + to_string(port) + "?ttl=0";
+    for (const char* opts : { "&nack=-1", "&nack=4097", "&nack=8&groups=2" }) {
+        zcm_trans_t* zt = makeTransport(url + opts);
+        if (zt) {
+            zcm_trans_destroy(zt);
+            fail("made a transport with %s", opts);
+        }
+    }
+    zcm_trans_t* zt = makeTransport(url + "&nack=4096");
+    if (!zt) fail("no transport with the largest window");
+    zcm_trans_destroy(zt);
+    return 0;
+}
+
+// Both: what parity can't rebuild is NACKed
+static int fecAndNack()
+{
+    Link l(fecOpts + nackOpts, "BIG", BIG_LEN);
+    if (!l.pub || !l.sub) fail("no transport");
+    l.relay.copies = [](const Packet& p) {
+        if (p.magic != MAGIC_LONG) return 1;
+        if (p.seqno == 3) return p.frag == 5 || p.frag == 6 ? 0 : 1;
+        return p.frag == 10 ? 0 : 1;
+    };
+    if (!l.sendAll(10)) fail("send");
+    l.wait([&] { return l.missing() == 0; });
+
+    if (!l.allOnce() || l.bad) fail("%d messages missing, %zu bad", l.missing(), l.bad);
+    if (stat(l.pub, "udpm.retransmitted") == 0) fail("nothing retransmitted");
+    if (stat(l.sub, "udpm.fec_recovered") < 9) fail("lost fragments not rebuilt");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct { const char* name; int (*fn)(); } tests[] = {
+        { "fec one per group", fecOnePerGroup },
+        { "fec short group", fecShortGroup },
+        { "fec lost parity", fecLostParity },
+        { "fec too many", fecTooMany },
+        { "nack short", nackShort },
+        { "nack fragment", nackFragment },
+        { "nack retries", nackRetries },
+        { "nack window", nackWindow },
+        { "nack options", nackOptions },
+        { "fec and nack", fecAndNack },
+    };
+
+    int ret = 0;
+    port = testPort();
+    for (auto& t : tests) {
+        // Ports of their own, so that no two tests see each other's packets
+        port += 2;
+        int r = t.fn();
+        printf("%s: %s\n", t.name, r == 0 ? "passed" : "FAILED");
+        ret |= r;
+    }
+    return ret;
+}
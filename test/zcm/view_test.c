@@ -0,0 +1,137 @@
+#include "types/view_test_t.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM 5
+
+static int16_t      ranges[2][4] = { { -7, 993, 1993, 2993 }, { 1, 2, 3, 4 } };
+static const char*  names[NUM] = { "a", "", "ccc", "dddd", "" };
+
+static void makeExample(example_t* ex, int64_t utime, const char* name, int nranges, int16_t* r)
+{
+    int i;
+    ex->utime = utime;
+    for (i = 0; i < 3; ++i) ex->position[i] = utime + i * 0.5;
+    for (i = 0; i < 4; ++i) ex->orientation[i] = -i * 0.25;
+    ex->num_ranges = nranges;
+    ex->ranges = r;
+    ex->name = (char*) name;
+    ex->enabled = (int8_t) (nranges % 2);
+}
+
+static void checkExample(const example_t_view_t* v, const example_t* ex)
+{
+    int16_t r[4];
+    double pos[3];
+    uint32_t i;
+    assert(example_t_view_utime(v) == ex->utime);
+    assert(example_t_view_position_count(v) == 3);
+    assert(example_t_view_position_get(v, 0, 3, pos) >= 0);
+    for (i = 0; i < 3; ++i) {
+        assert(example_t_view_position(v, i) == ex->position[i]);
+        assert(pos[i] == ex->position[i]);
+    }
+    for (i = 0; i < 4; ++i) assert(example_t_view_orientation(v, i) == ex->orientation[i]);
+    assert(example_t_view_num_ranges(v) == ex->num_ranges);
+    assert(example_t_view_ranges_count(v) == (uint32_t) ex->num_ranges);
+    assert(example_t_view_ranges_get(v, 0, ex->num_ranges, r) >= 0);
+    for (i = 0; i < (uint32_t) ex->num_ranges; ++i) {
+        assert(example_t_view_ranges(v, i) == ex->ranges[i]);
+        assert(r[i] == ex->ranges[i]);
+    }
+    assert(strcmp(example_t_view_name(v), ex->name) == 0);
+    assert(example_t_view_enabled(v) == ex->enabled);
+}
+
+int main(int argc, char *argv[])
+{
+    uint8_t raw[NUM] = { 0xf0, 0xf1, 0x00, 0xf3, 0xf4 };
+    int16_t row0[NUM], row1[NUM];
+    int16_t* grid[2] = { row0, row1 };
+    int16_t got[2 * NUM];
+    view_test_t msg;
+    view_test_t_view_t v;
+    example_t_view_t ev;
+    uint8_t *buf, *bad;
+    uint32_t size, len, i;
+    int j;
+
+    for (j = 0; j < NUM; ++j) {
+        row0[j] = (int16_t) (j - 300);
+        row1[j] = (int16_t) (j * 7000);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.utime = 0x0102030405060708LL;
+    msg.num = NUM;
+    msg.raw = raw;
+    msg.name = (char*) "view test";
+    msg.grid = grid;
+    makeExample(&msg.inner, 42, "inner", 3, ranges[0]);
+    makeExample(&msg.more[0], 43, "", 0, NULL);
+    makeExample(&msg.more[1], 44, "more[1]", 4, ranges[1]);
+    msg.after = 3.25;
+    msg.names = (char**) names;
+    msg.flag = 1;
+
+    // At an odd offset: the view must not need aligned members
+    size = view_test_t_encoded_size(&msg);
+    buf = malloc(size + 1);
+    assert(view_test_t_encode(buf, 1, size, &msg) == (int) size);
+
+    assert(view_test_t_view_decode(buf, 1, size, &v) == (int) size);
+    assert(view_test_t_view_utime(&v) == msg.utime);
+    assert(view_test_t_view_num(&v) == NUM);
+
+    assert(view_test_t_view_raw_count(&v) == NUM);
+    for (i = 0; i < NUM; ++i) assert(view_test_t_view_raw(&v, i) == raw[i]);
+    assert(memcmp(view_test_t_view_raw_data(&v), raw, NUM) == 0);
+
+    assert(strcmp(view_test_t_view_name(&v), msg.name) == 0);
+
+    // Flattened in row major order
+    assert(view_test_t_view_grid_count(&v) == 2 * NUM);
+    assert(view_test_t_view_grid_get(&v, 0, 2 * NUM, got) >= 0);
+    for (i = 0; i < 2 * NUM; ++i) {
+        assert(view_test_t_view_grid(&v, i) == grid[i / NUM][i % NUM]);
+        assert(got[i] == grid[i / NUM][i % NUM]);
+    }
+    assert(view_test_t_view_grid_get(&v, NUM + 1, NUM - 1, got) >= 0);
+    assert(got[0] == row1[1] && got[NUM - 2] == row1[NUM - 1]);
+    assert(view_test_t_view_grid_get(&v, NUM + 1, NUM, got) < 0);
+
+    assert(view_test_t_view_inner(&v, &ev) == 0);
+    checkExample(&ev, &msg.inner);
+    assert(view_test_t_view_more_count(&v) == 2);
+    for (i = 0; i < 2; ++i) {
+        assert(view_test_t_view_more(&v, i, &ev) == 0);
+        checkExample(&ev, &msg.more[i]);
+    }
+    assert(view_test_t_view_more(&v, 2, &ev) < 0);
+
+    assert(view_test_t_view_after(&v) == msg.after);
+
+    assert(view_test_t_view_names_count(&v) == NUM);
+    for (i = 0; i < NUM; ++i) assert(strcmp(view_test_t_view_names(&v, i), names[i]) == 0);
+
+    assert(view_test_t_view_flag(&v) == msg.flag);
+
+    // Every truncation of the message is found out
+    for (len = 0; len < size; ++len) assert(view_test_t_view_decode(buf, 1, len, &v) < 0);
+
+    // As is a string that isn't NULL terminated
+    bad = malloc(size + 1);
+    memcpy(bad, buf, size + 1);
+    len = 1 + 8 + 8 + 4 + NUM + 4 + strlen(msg.name);
+    assert(bad[len] == '\0');
+    bad[len] = 'x';
+    assert(view_test_t_view_decode(bad, 1, size, &v) < 0);
+
+    free(bad);
+    free(buf);
+    printf("view_test_c passed\n");
+    return 0;
+}
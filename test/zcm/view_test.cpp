@@ -0,0 +1,144 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cassert>
+#include <cstring>
+
+#include "types/view_test_t.hpp"
+
+using namespace std;
+
+// Members after ones of variable size are at offsets only decode() can find
+static example_t makeExample(int64_t utime, const string& name, int nranges)
+{
+    example_t ex;
+    ex.utime = utime;
+    for (int i = 0; i < 3; ++i) ex.position[i] = utime + i * 0.5;
+    for (int i = 0; i < 4; ++i) ex.orientation[i] = -i * 0.25;
+    ex.num_ranges = nranges;
+    for (int i = 0; i < nranges; ++i) ex.ranges.push_back((int16_t) (i * 1000 - 7));
+    ex.name = name;
+    ex.enabled = (int8_t) (nranges % 2);
+    return ex;
+}
+
+static view_test_t makeMsg()
+{
+    view_test_t msg;
+    msg.utime = 0x0102030405060708LL;
+    msg.num = 5;
+    for (int i = 0; i < msg.num; ++i) msg.raw.push_back((uint8_t) (i == 2 ? 0 : 0xf0 + i));
+    msg.name = "view test";
+    msg.grid.resize(2);
+    for (int i = 0; i < msg.num; ++i) {
+        msg.grid[0].push_back((int16_t) (i - 300));
+        msg.grid[1].push_back((int16_t) (i * 7000));
+    }
+    msg.inner = makeExample(42, "inner", 3);
+    msg.more[0] = makeExample(43, "", 0);
+    msg.more[1] = makeExample(44, "more[1]", 4);
+    msg.after = 3.25;
+    const char* names[] = { "a", "", "ccc", "dddd", "" };
+    for (int i = 0; i < msg.num; ++i) msg.names.push_back(names[i]);
+    msg.flag = 1;
+    return msg;
+}
+
+static void checkExample(const example_t::View& v, const example_t& ex)
+{
+    assert(v.utime() == ex.utime);
+    for (int i = 0; i < 3; ++i) assert(v.position()[i] == ex.position[i]);
+    for (int i = 0; i < 4; ++i) assert(v.orientation()[i] == ex.orientation[i]);
+    assert(v.num_ranges() == ex.num_ranges);
+    assert(v.ranges().size() == ex.ranges.size());
+    for (size_t i = 0; i < ex.ranges.size(); ++i) assert(v.ranges()[i] == ex.ranges[i]);
+    assert(v.name() == ex.name);
+    assert(v.enabled() == ex.enabled);
+}
+
+static void checkView(const view_test_t::View& v, const view_test_t& msg)
+{
+    assert(v.utime() == msg.utime);
+    assert(v.num() == msg.num);
+
+    assert(v.raw().size() == (uint32_t) msg.num);
+    for (int i = 0; i < msg.num; ++i) assert(v.raw()[i] == msg.raw[i]);
+    assert(memcmp(v.raw().data(), msg.raw.data(), msg.num) == 0);
+
+    assert(v.name() == msg.name);
+
+    // Flattened in row major order
+    assert(v.grid().size() == 2 * (uint32_t) msg.num);
+    vector<int16_t> grid(v.grid().size());
+    v.grid().copyTo(grid.data());
+    for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < msg.num; ++j) {
+            assert(v.grid()[i * msg.num + j] == msg.grid[i][j]);
+            assert(grid[i * msg.num + j] == msg.grid[i][j]);
+        }
+    }
+
+    checkExample(v.inner(), msg.inner);
+    assert(v.more().size() == 2);
+    int i = 0;
+    for (auto it = v.more().begin(); it != v.more().end(); ++it) checkExample(*it, msg.more[i++]);
+    assert(i == 2);
+
+    assert(v.after() == msg.after);
+
+    assert(v.names().size() == (uint64_t) msg.num);
+    i = 0;
+    for (const char* s : v.names()) assert(s == msg.names[i++]);
+    assert(i == msg.num);
+
+    assert(v.flag() == msg.flag);
+}
+
+int main(int argc, char *argv[])
+{
+    view_test_t msg = makeMsg();
+    uint32_t size = msg.getEncodedSize();
+
+    // At an odd offset: the view must not need aligned members
+    vector<uint8_t> buf(size + 1);
+    assert(msg.encode(buf.data(), 1, size) == (int) size);
+
+    view_test_t::View v;
+    assert(v.decode(buf.data(), 1, size) == (int) size);
+    assert(v.getEncodedSize() == size);
+    checkView(v, msg);
+
+    // Copied out, the message is the one encoded ...
+    view_test_t copy;
+    assert(v.copyTo(copy) >= 0);
+    vector<uint8_t> buf2(size);
+    assert(copy.encode(buf2.data(), 0, size) == (int) size);
+    assert(memcmp(buf2.data(), buf.data() + 1, size) == 0);
+
+    // ... and so is the view re-encoded
+    vector<uint8_t> buf3(size);
+    assert(v.encode(buf3.data(), 0, size) == (int) size);
+    assert(memcmp(buf3.data(), buf.data() + 1, size) == 0);
+
+    // Every truncation of the message is found out
+    for (uint32_t len = 0; len < size; ++len) {
+        view_test_t::View t;
+        assert(t.decode(buf.data(), 1, len) < 0);
+    }
+
+    // As are messages of another type
+    example_t ex = makeExample(1, "ex", 2);
+    vector<uint8_t> exbuf(ex.getEncodedSize());
+    assert(ex.encode(exbuf.data(), 0, exbuf.size()) == (int) exbuf.size());
+    assert(v.decode(exbuf.data(), 0, exbuf.size()) < 0);
+
+    // A string that isn't NULL terminated is rejected
+    vector<uint8_t> bad(buf);
+    size_t at = 1 + 8 + 8 + 4 + msg.num + 4 + msg.name.size();
+    assert(bad[at] == '\0');
+    bad[at] = 'x';
+    assert(v.decode(bad.data(), 1, size) < 0);
+
+    cout << "view_test passed" << endl;
+    return 0;
+}
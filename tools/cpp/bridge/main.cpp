@@ -2,7 +2,17 @@
 #include <string>
 #include <unistd.h>
 #include <vector>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+#include <cstring>
+#include <cassert>
+#include <memory>
+#include <functional>
 #include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <signal.h>
 
 #include <getopt.h>
@@ -11,6 +21,7 @@
 #include "zcm/zcm_coretypes.h"
 
 #include "util/TranscoderPluginDb.hpp"
+#include "util/TimeUtil.hpp"
 
 using namespace std;
 
@@ -30,6 +41,18 @@ struct Args
     vector<int> Adec;
     vector<int> Bdec;
 
+    vector<double> Arate;
+    vector<double> Brate;
+
+    vector<char> Aconflate;
+    vector<char> Bconflate;
+
+    int Abundle_ms = 0;
+    int Bbundle_ms = 0;
+
+    size_t jobs = 1;
+    size_t queue_size = 1024;
+
     string Aurl = "";
     string Burl = "";
 
@@ -43,7 +66,7 @@ struct Args
     bool parse(int argc, char *argv[])
     {
         // set some defaults
-        const char *optstring = "hA:B:a:b:D:p:d";
+        const char *optstring = "hA:B:a:b:D:R:Cj:q:p:d";
         struct option long_opts[] = {
             { "help",              no_argument, 0,  'h' },
             { "A-prefix",    required_argument, 0,   0  },
@@ -53,6 +76,12 @@ struct Args
             { "A-channel",   required_argument, 0,  'a' },
             { "B-channel",   required_argument, 0,  'b' },
             { "decimation",  required_argument, 0,  'D' },
+            { "max-rate",    required_argument, 0,  'R' },
+            { "conflate",          no_argument, 0,  'C' },
+            { "jobs",        required_argument, 0,  'j' },
+            { "queue-size",  required_argument, 0,  'q' },
+            { "A-bundle",    required_argument, 0,   0  },
+            { "B-bundle",    required_argument, 0,   0  },
             { "plugin-path", required_argument, 0,  'p' },
             { "debug",             no_argument, 0,  'd' },
             { 0, 0, 0, 0 }
@@ -60,20 +89,34 @@ struct Args
 
         int c;
         vector<int> *currDec = nullptr;
+        vector<double> *currRate = nullptr;
+        vector<char> *currConflate = nullptr;
         int option_index;
         while ((c = getopt_long(argc, argv, optstring, long_opts, &option_index)) >= 0) {
+            if (c != 'D' && c != 'R' && c != 'C') {
+                currRate = nullptr;
+                currConflate = nullptr;
+            }
             switch (c) {
                 case 'A': currDec = nullptr; Aurl = optarg; break;
                 case 'B': currDec = nullptr; Burl = optarg; break;
                 case 'a':
                     Achannels.push_back(optarg);
                     Adec.push_back(0);
+                    Arate.push_back(0);
+                    Aconflate.push_back(false);
                     currDec = &Adec;
+                    currRate = &Arate;
+                    currConflate = &Aconflate;
                     break;
                 case 'b':
                     Bchannels.push_back(optarg);
                     Bdec.push_back(0);
+                    Brate.push_back(0);
+                    Bconflate.push_back(false);
                     currDec = &Bdec;
+                    currRate = &Brate;
+                    currConflate = &Bconflate;
                     break;
                 case 'D':
                     ZCM_ASSERT(currDec != nullptr &&
@@ -81,6 +124,36 @@ struct Args
                     currDec->back() = atoi(optarg);
                     currDec = nullptr;
                     break;
+                case 'R':
+                    ZCM_ASSERT(currRate != nullptr &&
+                               "Max rate must follow a channel");
+                    currRate->back() = atof(optarg);
+                    if (currRate->back() < 0) {
+                        cerr << "Max rate must be positive" << endl;
+                        return false;
+                    }
+                    break;
+                case 'C':
+                    ZCM_ASSERT(currConflate != nullptr &&
+                               "Conflate must follow a channel");
+                    currConflate->back() = true;
+                    break;
+                case 'j':
+                    currDec = nullptr;
+                    if (atoi(optarg) < 1) {
+                        cerr << "Need at least one job" << endl;
+                        return false;
+                    }
+                    jobs = atoi(optarg);
+                    break;
+                case 'q':
+                    currDec = nullptr;
+                    if (atoi(optarg) < 1) {
+                        cerr << "Queue size must be positive" << endl;
+                        return false;
+                    }
+                    queue_size = atoi(optarg);
+                    break;
                 case 'p':
                     plugin_path = string(optarg);
                     break;
@@ -94,6 +167,12 @@ struct Args
                     } else if (string(long_opts[option_index].name) == "B-prefix") {
                         currDec = nullptr;
                         Bprefix = optarg;
+                    } else if (string(long_opts[option_index].name) == "A-bundle") {
+                        currDec = nullptr;
+                        Abundle_ms = atoi(optarg);
+                    } else if (string(long_opts[option_index].name) == "B-bundle") {
+                        currDec = nullptr;
+                        Bbundle_ms = atoi(optarg);
                     }
                     break;
                 case 'h': default: usage(); return false;
@@ -146,11 +225,142 @@ struct Args
              << "                             Ex: zcm-bridge -A ipc -B udpm://239.255.76.67:7667?ttl=0 -b EXAMPLE -d 2" << endl
              << "                             This example would result in the message on EXAMPLE being rebroadcast on" << endl
              << "                             the A url every third message." << endl
+             << "  -R, --max-rate=HZ          Forward at most HZ messages per second of the preceeding" << endl
+             << "                             A-channel or B-channel, dropping the others." << endl
+             << "  -C, --conflate             For the preceeding A-channel or B-channel, only forward the" << endl
+             << "                             latest message: rather than dropping the messages over its" << endl
+             << "                             max rate, forward the latest one as soon as the rate allows," << endl
+             << "                             and only keep the latest one in a bundle." << endl
+             << "      --A-bundle=MS          Publish the messages bound for A in bundles on ZCM_BRIDGE_BUNDLE," << endl
+             << "                             each gathering up to MS milliseconds of messages. The zcm-bridge" << endl
+             << "                             on the other side of A unpacks them, if it subscribes to all" << endl
+             << "                             channels or to ZCM_BRIDGE_BUNDLE." << endl
+             << "      --B-bundle=MS          Same as --A-bundle, for the messages bound for B" << endl
+             << "  -j, --jobs=N               Number of threads forwarding messages in each direction" << endl
+             << "                             (default 1). Channels are spread over them, each channel" << endl
+             << "                             staying in order on one of them" << endl
+             << "  -q, --queue-size=N         Number of messages queued for each of these threads" << endl
+             << "                             (default 1024). Messages received while it's full are dropped" << endl
              << "  -p, --plugin-path=path     Path to shared library containing transcoder plugins" << endl
              << "" << endl << endl;
     }
 };
 
+// Messages gathered by --A-bundle and --B-bundle are published as one message
+// on BUNDLE_CHANNEL, encoded as
+//   int32_t magic, int32_t nmsgs, then nmsgs times
+//   int32_t channellen, char channel[channellen], int32_t datalen, uint8_t data[datalen]
+static const string   BUNDLE_CHANNEL = "ZCM_BRIDGE_BUNDLE";
+static const int32_t  BUNDLE_MAGIC = 0x5a424e44;
+static const uint32_t BUNDLE_HEADER_SIZE = 8;
+// Bundles are published once they reach this size, rather than waiting
+static const uint32_t MAX_BUNDLE_SIZE = 65000;
+
+// The messages bound for one network
+struct Outlet
+{
+    zcm::ZCM* zcm = nullptr;
+    string    prefix = "";
+    uint64_t  windowNs = 0; // 0 for no bundles
+
+    // Returns true if this started a new bundle, to be published by flushDue()
+    bool publish(const string& channel, const uint8_t* data, uint32_t len, bool conflate)
+    {
+        string newChannel = prefix + channel;
+        if (windowNs == 0) {
+            zcm->publish(newChannel, data, len);
+            return false;
+        }
+
+        uint32_t msgSize = 8 + newChannel.size() + len;
+        unique_lock<mutex> lock(lk);
+        if (conflate) {
+            auto it = conflated.find(newChannel);
+            if (it != conflated.end()) {
+                Msg& m = msgs[it->second];
+                if (size - m.data.size() + len <= MAX_BUNDLE_SIZE) {
+                    size = size - m.data.size() + len;
+                    m.data.assign(data, data + len);
+                    return false;
+                }
+                flushLocked();
+            }
+        }
+        if (size + msgSize > MAX_BUNDLE_SIZE) {
+            flushLocked();
+            if (size + msgSize > MAX_BUNDLE_SIZE) {
+                zcm->publish(newChannel, data, len);
+                return false;
+            }
+        }
+
+        if (nmsgs == msgs.size()) msgs.emplace_back();
+        Msg& m = msgs[nmsgs];
+        m.channel = newChannel;
+        m.data.assign(data, data + len);
+        if (conflate) conflated[newChannel] = nmsgs;
+        size += msgSize;
+        if (nmsgs++ > 0) return false;
+        deadline = TimeUtil::monoNs() + windowNs;
+        return true;
+    }
+
+    // Publishes the bundle if it's due at 'now' (or always if 'now' is 0).
+    // Returns when the next one is, 0 if there is none
+    uint64_t flushDue(uint64_t now)
+    {
+        unique_lock<mutex> lock(lk);
+        if (nmsgs == 0) return 0;
+        if (now != 0 && now < deadline) return deadline;
+        flushLocked();
+        return 0;
+    }
+
+  private:
+    struct Msg
+    {
+        string channel;
+        vector<uint8_t> data;
+    };
+
+    void flushLocked()
+    {
+        if (nmsgs == 0) return;
+        buf.resize(size);
+        uint32_t pos = 0;
+        auto encode = [&](int32_t v) {
+            pos += __int32_t_encode_array(buf.data(), pos, size - pos, &v, 1);
+        };
+        encode(BUNDLE_MAGIC);
+        encode(nmsgs);
+        for (size_t i = 0; i < nmsgs; ++i) {
+            encode(msgs[i].channel.size());
+            memcpy(&buf[pos], msgs[i].channel.data(), msgs[i].channel.size());
+            pos += msgs[i].channel.size();
+            encode(msgs[i].data.size());
+            memcpy(&buf[pos], msgs[i].data.data(), msgs[i].data.size());
+            pos += msgs[i].data.size();
+        }
+        assert(pos == size);
+        zcm->publish(BUNDLE_CHANNEL, buf.data(), size);
+
+        nmsgs = 0;
+        size = BUNDLE_HEADER_SIZE;
+        deadline = 0;
+        conflated.clear();
+    }
+
+    mutex lk;
+    // Only the first nmsgs are in the bundle: the others keep their buffers
+    vector<Msg> msgs;
+    size_t      nmsgs = 0;
+    uint32_t    size = BUNDLE_HEADER_SIZE;
+    uint64_t    deadline = 0;
+    // Channels whose latest message only is kept, to their message
+    unordered_map<string, size_t> conflated;
+    vector<uint8_t> buf;
+};
+
 struct Bridge
 {
     Args   args;
@@ -161,19 +371,121 @@ struct Bridge
     static TranscoderPluginDb* pluginDb;
     static vector<zcm::TranscoderPlugin*> plugins;
 
+    // Bound for A and for B
+    Outlet outA, outB;
+
+    static mutex flushLk;
+    static condition_variable flushCond;
+    static uint64_t flushGen;
+
+    struct Worker;
+
     struct BridgeInfo
     {
-        zcm::ZCM *zcmOut = nullptr;
-        string    prefix = "";
-        int       decimation = 0;
-        int       nSkipped = 0;
+        Outlet*  out = nullptr;
+        // Forwarding to 'out', channels spread over them
+        const vector<Worker*>* workers = nullptr;
+        int      decimation = 0;
+        int      nSkipped = 0;
+        uint64_t periodNs = 0; // 0 for no max rate
+        bool     conflate = false;
+
+        // Rate limiting state, shared with the flusher thread for conflated
+        // channels: their latest message over the max rate is kept pending
+        mutex    lk;
+        uint64_t lastNs = 0;
+        bool     pending = false;
+        string   pendingChannel;
+        int64_t  pendingUtime = 0;
+        vector<uint8_t> pendingData;
+
+        BridgeInfo(Outlet* out, const vector<Worker*>* workers,
+                   int dec, double rate = 0, bool conflate = false) :
+            out(out), workers(workers), decimation(dec), nSkipped(0),
+            periodNs(rate > 0 ? 1e9 / rate : 0), conflate(conflate) {}
+    };
+
+    // Forwards the messages queued by the dispatch threads and the flusher, so
+    // that a slow far side doesn't hold up receiving. With plugins instances
+    // of their own unless they are thread safe
+    struct Worker
+    {
+        struct Msg
+        {
+            BridgeInfo*     info;
+            string          channel;
+            vector<uint8_t> data;
+            int64_t         utime;
+        };
+
+        vector<zcm::TranscoderPlugin*> plugins;
+        uint64_t nDropped = 0;
+
+        Worker(size_t queueSize, const vector<zcm::TranscoderPlugin*>& plugins) :
+            plugins(plugins), queue(queueSize) {}
+
+        void start() { t = thread(&Worker::run, this); }
 
-        BridgeInfo(zcm::ZCM* zcmOut, const string &prefix, int dec) :
-            zcmOut(zcmOut), prefix(prefix), decimation(dec), nSkipped(0) {}
+        // Forwards what was queued, then stops
+        void stop()
+        {
+            {
+                unique_lock<mutex> lock(lk);
+                stopping = true;
+            }
+            cond.notify_one();
+            if (t.joinable()) t.join();
+        }
+
+        // Drops the message if the queue is full
+        void push(BridgeInfo* info, const string& channel,
+                  const uint8_t* data, uint32_t len, int64_t utime)
+        {
+            {
+                unique_lock<mutex> lock(lk);
+                if (count == queue.size()) {
+                    nDropped++;
+                    return;
+                }
+                // The worker doesn't touch the slots past the queued ones
+                Msg& m = queue[(head + count) % queue.size()];
+                m.info = info;
+                m.channel = channel;
+                m.data.assign(data, data + len);
+                m.utime = utime;
+                if (count++ > 0) return;
+            }
+            cond.notify_one();
+        }
+
+      private:
+        void run()
+        {
+            unique_lock<mutex> lock(lk);
+            while (true) {
+                cond.wait(lock, [&]{ return count > 0 || stopping; });
+                if (count == 0) break;
+                Msg& m = queue[head];
+                lock.unlock();
+                forward(m.info, plugins, m.channel, m.data.data(), m.data.size(), m.utime);
+                lock.lock();
+                head = (head + 1) % queue.size();
+                count--;
+            }
+        }
 
-        BridgeInfo() {}
+        mutex lk;
+        condition_variable cond;
+        vector<Msg> queue;
+        size_t head = 0;
+        size_t count = 0;
+        bool stopping = false;
+        thread t;
     };
 
+    // Bound for A and for B
+    vector<Worker*> workersA, workersB;
+
     Bridge() {}
 
     ~Bridge()
@@ -227,60 +539,211 @@ struct Bridge
         return true;
     }
 
-    static void handler(const zcm::ReceiveBuffer* rbuf, const string& channel, void* usr)
+    static void wakeFlusher()
     {
-        BridgeInfo* info = (BridgeInfo*)usr;
-        if (info->nSkipped++ == info->decimation) {
-            info->nSkipped = 0;
+        {
+            unique_lock<mutex> lock(flushLk);
+            flushGen++;
+        }
+        flushCond.notify_one();
+    }
 
-            vector<const zcm::LogEvent*> evts;
+    static void forward(BridgeInfo* info, const vector<zcm::TranscoderPlugin*>& plugins,
+                        const string& channel, const uint8_t* data, uint32_t len,
+                        int64_t utime)
+    {
+        vector<const zcm::LogEvent*> evts;
 
-            zcm::LogEvent le;
-            le.timestamp = rbuf->recv_utime;
-            le.channel   = channel;
-            le.datalen   = rbuf->data_size;
-            le.data      = rbuf->data;
+        zcm::LogEvent le;
+        le.timestamp = utime;
+        le.channel   = channel;
+        le.datalen   = len;
+        le.data      = (uint8_t*) data;
 
-            if (!plugins.empty()) {
+        if (!plugins.empty()) {
 
-                int64_t msg_hash;
-                __int64_t_decode_array(le.data, 0, 8, &msg_hash, 1);
+            int64_t msg_hash;
+            __int64_t_decode_array(le.data, 0, 8, &msg_hash, 1);
 
-                for (auto& p : plugins) {
-                    vector<const zcm::LogEvent*> pevts =
-                        p->transcodeEvent((uint64_t) msg_hash, &le);
-                    evts.insert(evts.end(), pevts.begin(), pevts.end());
-                }
+            for (auto& p : plugins) {
+                vector<const zcm::LogEvent*> pevts =
+                    p->transcodeEvent((uint64_t) msg_hash, &le);
+                evts.insert(evts.end(), pevts.begin(), pevts.end());
             }
+        }
 
-            if (evts.empty()) evts.push_back(&le);
+        if (evts.empty()) evts.push_back(&le);
 
-            for (auto* evt : evts) {
-                if (!evt) continue;
-                // Must create newChannel in here to handle regex based subscriptions.
-                // Ie you cant store the whole channel in BridgeInfo because you
-                // don't necessarily know what channel is until you receive a message
-                string newChannel = info->prefix + evt->channel;
-                info->zcmOut->publish(newChannel, evt->data, evt->datalen);
+        bool newBundle = false;
+        for (auto* evt : evts) {
+            if (!evt) continue;
+            // The outlet creates the new channel to handle regex based subscriptions.
+            // Ie you cant store the whole channel in BridgeInfo because you
+            // don't necessarily know what channel is until you receive a message
+            if (info->out->publish(evt->channel, evt->data, evt->datalen, info->conflate))
+                newBundle = true;
+        }
+        if (newBundle) wakeFlusher();
+    }
+
+    static void receive(BridgeInfo* info, const string& channel,
+                        const uint8_t* data, uint32_t len, int64_t utime)
+    {
+        if (info->nSkipped++ != info->decimation) return;
+        info->nSkipped = 0;
+
+        if (info->periodNs != 0) {
+            uint64_t now = TimeUtil::monoNs();
+            unique_lock<mutex> lock(info->lk);
+            if (info->lastNs != 0 && now < info->lastNs + info->periodNs) {
+                if (!info->conflate) return;
+                bool wasPending = info->pending;
+                info->pending = true;
+                info->pendingChannel = channel;
+                info->pendingUtime = utime;
+                info->pendingData.assign(data, data + len);
+                lock.unlock();
+                if (!wasPending) wakeFlusher();
+                return;
             }
+            info->lastNs = now;
+            info->pending = false;
         }
+
+        dispatch(info, channel, data, len, utime);
     }
 
-    void run()
+    static void dispatch(BridgeInfo* info, const string& channel,
+                         const uint8_t* data, uint32_t len, int64_t utime)
+    {
+        const vector<Worker*>& workers = *info->workers;
+        size_t w = workers.size() == 1 ? 0 : hash<string>()(channel) % workers.size();
+        workers[w]->push(info, channel, data, len, utime);
+    }
+
+    // Forwards the messages of a bundle as if they were received one by one
+    static void unbundle(BridgeInfo* info, const uint8_t* data, uint32_t len, int64_t utime)
+    {
+        uint32_t pos = 0;
+        auto decode = [&](int32_t& v) {
+            int ret = __int32_t_decode_array(data, pos, len - pos, &v, 1);
+            if (ret < 0) return false;
+            pos += ret;
+            return true;
+        };
+
+        int32_t magic, nmsgs;
+        if (!decode(magic) || magic != BUNDLE_MAGIC || !decode(nmsgs)) {
+            cerr << "Dropping bad bundle" << endl;
+            return;
+        }
+        string channel;
+        for (int32_t i = 0; i < nmsgs; ++i) {
+            int32_t channellen, datalen;
+            if (!decode(channellen) || channellen < 0 || (uint32_t) channellen > len - pos) break;
+            channel.assign((const char*) data + pos, channellen);
+            pos += channellen;
+            if (!decode(datalen) || datalen < 0 || (uint32_t) datalen > len - pos) break;
+            receive(info, channel, data + pos, datalen, utime);
+            pos += datalen;
+        }
+        if (pos != len) cerr << "Dropping the end of a bad bundle" << endl;
+    }
+
+    static void handler(const zcm::ReceiveBuffer* rbuf, const string& channel, void* usr)
+    {
+        BridgeInfo* info = (BridgeInfo*)usr;
+        if (channel == BUNDLE_CHANNEL)
+            unbundle(info, rbuf->data, rbuf->data_size, rbuf->recv_utime);
+        else
+            receive(info, channel, rbuf->data, rbuf->data_size, rbuf->recv_utime);
+    }
+
+    // Publishes the bundles and pending conflated messages once they are due
+    void flusher(const vector<BridgeInfo*>& conflating)
     {
-        vector<BridgeInfo> infoA, infoB;
+        string channel;
+        vector<uint8_t> data;
+        while (!done) {
+            uint64_t gen;
+            {
+                unique_lock<mutex> lock(flushLk);
+                gen = flushGen;
+            }
+
+            uint64_t now = TimeUtil::monoNs();
+            // Wake up regularly anyway to notice done
+            uint64_t next = now + 100e6;
+            for (Outlet* out : { &outA, &outB }) {
+                uint64_t due = out->flushDue(now);
+                if (due != 0) next = min(next, due);
+            }
+            for (BridgeInfo* info : conflating) {
+                unique_lock<mutex> lock(info->lk);
+                if (!info->pending) continue;
+                uint64_t due = info->lastNs + info->periodNs;
+                if (now < due) {
+                    next = min(next, due);
+                    continue;
+                }
+                info->lastNs = now;
+                info->pending = false;
+                channel.swap(info->pendingChannel);
+                data.swap(info->pendingData);
+                int64_t utime = info->pendingUtime;
+                lock.unlock();
+                dispatch(info, channel, data.data(), data.size(), utime);
+            }
+
+            unique_lock<mutex> lock(flushLk);
+            flushCond.wait_for(lock, chrono::nanoseconds(next - now),
+                               [&]{ return flushGen != gen || done; });
+        }
+    }
 
-        infoA.reserve(args.Achannels.size());
-        infoB.reserve(args.Bchannels.size());
+    void run()
+    {
+        // BridgeInfos hold mutexes, so can't be moved around
+        deque<BridgeInfo> infoA, infoB;
+        vector<BridgeInfo*> conflating;
+
+        outA.zcm = zcmA;
+        outA.prefix = args.Aprefix;
+        outA.windowNs = args.Abundle_ms * 1e6;
+        outB.zcm = zcmB;
+        outB.prefix = args.Bprefix;
+        outB.windowNs = args.Bbundle_ms * 1e6;
+
+        // Worker 0 of A uses the plugins of the db
+        vector<unique_ptr<zcm::TranscoderPlugin>> ownedPlugins;
+        vector<unique_ptr<Worker>> workers;
+        for (auto* ws : { &workersA, &workersB }) {
+            for (size_t w = 0; w < args.jobs; ++w) {
+                vector<zcm::TranscoderPlugin*> wplugins = plugins;
+                if (!workers.empty()) {
+                    for (size_t i = 0; i < plugins.size(); ++i) {
+                        if (plugins[i]->threadSafe()) continue;
+                        ownedPlugins.emplace_back(pluginDb->makePlugin(i));
+                        wplugins[i] = ownedPlugins.back().get();
+                    }
+                }
+                workers.emplace_back(new Worker(args.queue_size, wplugins));
+                ws->push_back(workers.back().get());
+            }
+        }
+        for (auto& w : workers) w->start();
 
-        BridgeInfo defaultA(zcmB, args.Bprefix, 0),
-                   defaultB(zcmA, args.Aprefix, 0);
+        BridgeInfo defaultA(&outB, &workersB, 0),
+                   defaultB(&outA, &workersA, 0);
 
         if (args.Achannels.size() == 0) {
             zcmA->subscribe(".*", &handler, &defaultA);
         } else {
             for (size_t i = 0; i < args.Achannels.size(); i++) {
-                infoA.emplace_back(zcmB, args.Bprefix, args.Adec.at(i));
+                infoA.emplace_back(&outB, &workersB, args.Adec.at(i),
+                                   args.Arate.at(i), args.Aconflate.at(i));
+                if (infoA.back().conflate && infoA.back().periodNs != 0)
+                    conflating.push_back(&infoA.back());
                 zcmA->subscribe(args.Achannels.at(i), &handler, &infoA.back());
             }
         }
@@ -289,7 +752,10 @@ struct Bridge
             zcmB->subscribe(".*", &handler, &defaultB);
         } else {
             for (size_t i = 0; i < args.Bchannels.size(); i++) {
-                infoB.emplace_back(zcmA, args.Aprefix, args.Bdec.at(i));
+                infoB.emplace_back(&outA, &workersA, args.Bdec.at(i),
+                                   args.Brate.at(i), args.Bconflate.at(i));
+                if (infoB.back().conflate && infoB.back().periodNs != 0)
+                    conflating.push_back(&infoB.back());
                 zcmB->subscribe(args.Bchannels.at(i), &handler, &infoB.back());
             }
         }
@@ -299,6 +765,10 @@ struct Bridge
                    infoB.size() == args.Bchannels.size() &&
                    infoB.size() == args.Bdec.size());
 
+        thread flush;
+        if (outA.windowNs != 0 || outB.windowNs != 0 || !conflating.empty())
+            flush = thread(&Bridge::flusher, this, cref(conflating));
+
         zcmA->start();
         zcmB->start();
 
@@ -307,13 +777,34 @@ struct Bridge
         zcmA->stop();
         zcmB->stop();
 
+        if (flush.joinable()) {
+            wakeFlusher();
+            flush.join();
+        }
+        for (auto& w : workers) w->stop();
+        outA.flushDue(0);
+        outB.flushDue(0);
+
         zcmA->flush();
         zcmB->flush();
+
+        uint64_t droppedA = 0, droppedB = 0;
+        for (auto* w : workersA) droppedA += w->nDropped;
+        for (auto* w : workersB) droppedB += w->nDropped;
+        if (droppedA != 0)
+            cerr << "Dropped " << droppedA << " messages bound for A, "
+                    "A couldn't keep up" << endl;
+        if (droppedB != 0)
+            cerr << "Dropped " << droppedB << " messages bound for B, "
+                    "B couldn't keep up" << endl;
     }
 };
 
 TranscoderPluginDb* Bridge::pluginDb = nullptr;
 vector<zcm::TranscoderPlugin*> Bridge::plugins = {};
+mutex Bridge::flushLk;
+condition_variable Bridge::flushCond;
+uint64_t Bridge::flushGen = 0;
 
 int main(int argc, char *argv[])
 {
@@ -1,14 +1,13 @@
 #include <cstring>
 #include <algorithm>
 #include <memory>
-#include <cxxabi.h>
 #include <typeinfo>
 #include <dlfcn.h>
 
 #include "zcm/util/Common.hpp"
 #include "util/StringUtil.hpp"
 
-#include "util/SymtabElf.hpp"
+#include "util/PluginSymbols.hpp"
 
 #include "IndexerPluginDb.hpp"
 
@@ -18,18 +17,6 @@
 
 using namespace std;
 
-static inline std::string demangle(std::string name)
-{
-    int status = 42; // some arbitrary value to eliminate the compiler warning
-
-    std::unique_ptr<char, void(*)(void*)> res {
-        abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status),
-        std::free
-    };
-
-    return (status==0) ? res.get() : name ;
-}
-
 static void* openlib(const string& libname)
 {
     // verify the .so library
@@ -61,19 +48,14 @@ bool IndexerPluginDb::findPlugins(const string& libname)
         return false;
     }
 
-    // read the library's symbol table
-    SymtabElf stbl{libname};
-    if (!stbl.good()) {
-        ERROR("ERR: failed to load symbol table for ELF file\n");
-        return false;
-    }
+    vector<pair<string, string>> symbols;
+    if (!findPluginSymbols(libname, method, symbols, debug)) return false;
 
     // process the symbols
-    string s;
-    while (stbl.getNext(s)) {
-        string demangled = demangle(s);
-        //DEBUG("%s\n", demangled.c_str());
-        if (!StringUtil::endswith(demangled, method)) continue;
+    size_t found = pluginMeta.size();
+    for (auto& sym : symbols) {
+        const string& s = sym.first;
+        const string& demangled = sym.second;
 
         IndexerPluginMetadata md;
         md.className = demangled;
@@ -92,7 +74,8 @@ bool IndexerPluginDb::findPlugins(const string& libname)
         DEBUG("Success loading plugin %s\n", demangled.c_str());
     }
 
-    for (auto& meta : pluginMeta) {
+    for (size_t i = found; i < pluginMeta.size(); ++i) {
+        auto& meta = pluginMeta[i];
         zcm::IndexerPlugin* p = (zcm::IndexerPlugin*) meta.makeIndexerPlugin();
         DEBUG("Added new plugin with address %p\n", p);
         plugins.push_back(p);
@@ -3,17 +3,199 @@
 #include <getopt.h>
 #include <algorithm>
 #include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <chrono>
+#include <csignal>
+#include <sys/stat.h>
 
 #include <zcm/zcm-cpp.hpp>
+#include <zcm/tools/BinaryIndex.hpp>
 
 #include "zcm/json/json.h"
 
 #include "util/TypeDb.hpp"
+#include "util/ChannelTypes.hpp"
 
 #include "IndexerPluginDb.hpp"
 
 using namespace std;
 
+// Events of the log that a plugin group indexes, read once into a ring of
+// batches that every plugin of the group goes through on a thread of its own
+struct EventBatches
+{
+    struct Event
+    {
+        off_t offset;
+        int64_t timestamp;
+        string channel;
+        const TypeMetadata* md;
+        uint64_t hash;
+        size_t data;     // offset in 'buf'
+        int32_t datalen;
+    };
+
+    struct Batch
+    {
+        vector<Event> events;
+        size_t nevents = 0;
+        vector<uint8_t> buf;
+        size_t pending = 0;   // readers that still have to go through it
+    };
+
+    static const size_t NUM_BATCHES = 8;
+    static const size_t BATCH_EVENTS = 4096;
+    static const size_t BATCH_BYTES = 8 << 20;
+
+    EventBatches(size_t readers) : batches(NUM_BATCHES), readers(readers) {}
+
+    // Returns the next batch to fill, once every reader is done with it
+    Batch& startBatch()
+    {
+        Batch& b = batches[produced % NUM_BATCHES];
+        unique_lock<mutex> lock{lk};
+        doneCond.wait(lock, [&]() { return b.pending == 0; });
+        b.nevents = 0;
+        b.buf.clear();
+        return b;
+    }
+
+    static void add(Batch& b, off_t offset, const zcm::LogEvent* evt,
+                    const TypeMetadata* md, uint64_t hash)
+    {
+        if (b.nevents == b.events.size()) b.events.resize(b.nevents + 1);
+        Event& e = b.events[b.nevents++];
+        e.offset = offset;
+        e.timestamp = evt->timestamp;
+        e.channel = evt->channel;
+        e.md = md;
+        e.hash = hash;
+        e.data = b.buf.size();
+        e.datalen = evt->datalen;
+        b.buf.insert(b.buf.end(), evt->data, evt->data + evt->datalen);
+    }
+
+    static bool full(const Batch& b)
+    { return b.nevents >= BATCH_EVENTS || b.buf.size() >= BATCH_BYTES; }
+
+    void publishBatch(Batch& b)
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            b.pending = readers;
+            produced++;
+        }
+        readyCond.notify_all();
+    }
+
+    void finish()
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            finished = true;
+        }
+        readyCond.notify_all();
+    }
+
+    // Returns batch number 'seq', or nullptr once there are no more
+    const Batch* waitBatch(size_t seq)
+    {
+        unique_lock<mutex> lock{lk};
+        readyCond.wait(lock, [&]() { return produced > seq || finished; });
+        if (produced <= seq) return nullptr;
+        return &batches[seq % NUM_BATCHES];
+    }
+
+    void releaseBatch(size_t seq)
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            batches[seq % NUM_BATCHES].pending--;
+        }
+        doneCond.notify_all();
+    }
+
+  private:
+    vector<Batch> batches;
+    size_t readers;
+    size_t produced = 0;
+    bool finished = false;
+    mutex lk;
+    condition_variable readyCond;
+    condition_variable doneCond;
+};
+
+// magic, eventnum, timestamp, channel length and data length
+static const size_t EVENT_HEADER_BYTES = 28;
+
+static int32_t get32(const uint8_t* p)
+{ return (int32_t) ((uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]); }
+
+// Plain logs (not compressed logs nor sets of logs) start with the magic of
+// their first event
+static bool isPlainLog(const string& path)
+{
+    uint8_t magic[4] = {};
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    bool ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic);
+    fclose(f);
+    return ok && magic[0] == 0xED && magic[1] == 0xA1 && magic[2] == 0xDA && magic[3] == 0x01;
+}
+
+// Returns where the events of the plain log at 'path' that were all written
+// by now end, going through their headers only from 'from', which one starts at
+static off_t completeEventsEnd(const string& path, off_t from)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return from;
+    struct stat st;
+    off_t size = fstat(fileno(f), &st) == 0 ? st.st_size : 0;
+
+    off_t end = from;
+    uint8_t h[EVENT_HEADER_BYTES];
+    while (fseeko(f, end, SEEK_SET) == 0 && fread(h, 1, sizeof(h), f) == sizeof(h)) {
+        int32_t channellen = get32(h + 20), datalen = get32(h + 24);
+        if (get32(h) != (int32_t) 0xEDA1DA01 || channellen <= 0 || datalen < 0) break;
+        off_t next = end + sizeof(h) + channellen + datalen;
+        if (next > size) break;
+        end = next;
+    }
+    fclose(f);
+    return end;
+}
+
+// Cuts the plain log at 'path' into up to 'n' ranges of events of about the
+// same size from 'from' to 'end', returning where each of them starts
+// followed by 'end'. Logs that aren't plain aren't cut at all
+static vector<off_t> splitLog(const string& path, off_t from, off_t end, size_t n)
+{
+    vector<off_t> starts = { from };
+    if (!isPlainLog(path)) n = 1;
+
+    zcm::LogFile log(path, "r");
+    for (size_t k = 1; k < n && log.good(); ++k) {
+        fseeko(log.getFilePtr(), from + (end - from) / n * k, SEEK_SET);
+        const zcm::LogEvent* evt = log.readNextEvent();
+        if (!evt) break;
+        off_t start = ftello(log.getFilePtr()) - EVENT_HEADER_BYTES -
+                      evt->channel.size() - evt->datalen;
+        if (start >= end) break;
+        if (start > starts.back()) starts.push_back(start);
+    }
+    log.close();
+
+    starts.push_back(end);
+    return starts;
+}
+
+static volatile sig_atomic_t stopFollowing = 0;
+static void stopHandler(int) { stopFollowing = 1; }
+
 struct Args
 {
     string logfile     = "";
@@ -21,20 +203,28 @@ struct Args
     string plugin_path = "";
     string type_path   = "";
     bool readable      = false;
+    bool binary        = false;
     bool debug         = false;
     bool useDefault    = false;
+    bool incremental   = false;
+    bool follow        = false;
+    size_t jobs        = thread::hardware_concurrency();
 
     bool parse(int argc, char *argv[])
     {
         // set some defaults
-        const char *optstring = "l:o:p:t:rdh";
+        const char *optstring = "l:o:p:t:rbdj:ifh";
         struct option long_opts[] = {
             { "log",         required_argument, 0, 'l' },
             { "output",      required_argument, 0, 'o' },
             { "plugin-path", required_argument, 0, 'p' },
             { "type-path",   required_argument, 0, 't' },
             { "readable",    no_argument,       0, 'r' },
+            { "binary",      no_argument,       0, 'b' },
             { "use-default", no_argument,       0, 'd' },
+            { "jobs",        required_argument, 0, 'j' },
+            { "incremental", no_argument,       0, 'i' },
+            { "follow",      no_argument,       0, 'f' },
             { "debug",       no_argument,       0,  0  },
             { "help",        no_argument,       0, 'h' },
             { 0, 0, 0, 0 }
@@ -49,7 +239,19 @@ struct Args
                 case 'p': plugin_path = string(optarg); break;
                 case 't': type_path   = string(optarg); break;
                 case 'r': readable    = true;           break;
+                case 'b': binary      = true;           break;
                 case 'd': useDefault  = true;           break;
+                case 'i': incremental = true;           break;
+                case 'f': follow      = true;           break;
+                case 'j': {
+                    int n = atoi(optarg);
+                    if (n < 1) {
+                        cerr << "Expected a positive number of jobs" << endl;
+                        return false;
+                    }
+                    jobs = n;
+                    break;
+                }
                 case  0:
                     if (string(long_opts[option_index].name) == "debug") debug = true;
                     break;
@@ -105,7 +307,21 @@ struct Args
              << "                          ZCM_LOG_INDEXER_ZCMTYPES_PATH" << endl
              << "  -r, --readable          Don't minify the output index file. " << endl
              << "                          Leave it human readable" << endl
+             << "  -b, --binary            Write a binary index (see zcm/tools/BinaryIndex.hpp)" << endl
+             << "                          rather than a json one. Only for plugins that" << endl
+             << "                          support it, such as the default one" << endl
              << "  -d, --use-default       Run with the default timestamp indexer" << endl
+             << "  -j, --jobs=N            Index plain logs for mergeable plugins (such as" << endl
+             << "                          the default one) in N ranges at once." << endl
+             << "                          Defaults to the number of cores" << endl
+             << "  -i, --incremental       Carry on from where the last incremental run" << endl
+             << "                          got to in the log, as saved next to the index" << endl
+             << "                          (in INDEXFILE.ckpt), indexing only what was" << endl
+             << "                          written to it since. Starts over if the log or" << endl
+             << "                          the index changed otherwise. Plain logs only" << endl
+             << "  -f, --follow            Same as --incremental, then keep indexing what" << endl
+             << "                          is written to the log every second, until" << endl
+             << "                          interrupted" << endl
              << "      --debug             Run a dry run to ensure proper indexer setup" << endl
              << endl << endl;
     }
@@ -124,12 +340,19 @@ int main(int argc, char* argv[])
     fseeko(log.getFilePtr(), 0, SEEK_END);
     // TODO: Look into handling large logfiles
     off_t logSize = ftello(log.getFilePtr());
+    log.close();
 
     ofstream output;
-    output.open(args.output);
+    output.open(args.output, ios::app);
     if (!output.is_open()) {
         cerr << "Unable to open output file: " << args.output << endl;
-        log.close();
+        return 1;
+    }
+    output.close();
+
+    bool incremental = args.incremental || args.follow;
+    if (incremental && !isPlainLog(args.logfile)) {
+        cerr << "Only plain logs can be indexed incrementally" << endl;
         return 1;
     }
 
@@ -176,6 +399,24 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (args.binary) {
+        for (auto* p : plugins) {
+            if (!p->binaryIndexable()) {
+                cerr << "Plugin " << p->name() << " can't write binary indexes" << endl;
+                return 1;
+            }
+        }
+    }
+
+    if (incremental) {
+        for (auto* p : plugins) {
+            if (!p->resumable()) {
+                cerr << "Plugin " << p->name() << " can't index logs incrementally" << endl;
+                return 1;
+            }
+        }
+    }
+
     TypeDb types(args.type_path, args.debug);
 
     if (args.debug) return 0;
@@ -190,27 +431,36 @@ int main(int argc, char* argv[])
         vector<zcm::IndexerPlugin*> lastLoop = plugins;
         while (!plugins.empty()) {
             groups.resize(groups.size() + 1);
-            for (auto p = plugins.begin(); p != plugins.end();) {
-                auto deps = (*p)->dependsOn();
-
-                bool skipUntilLater = false;
-                for (auto* dep : plugins) {
-                    if (find(deps.begin(), deps.end(), dep->name()) != deps.end()) {
-                        skipUntilLater = true;
-                        break;
+            // Plugins that stream their dependencies can join the group of
+            // these, which may only just have been placed in it
+            bool placed = true;
+            while (placed) {
+                placed = false;
+                for (auto p = plugins.begin(); p != plugins.end();) {
+                    auto deps = (*p)->dependsOn();
+
+                    bool skipUntilLater = false;
+                    for (auto* dep : plugins) {
+                        if (find(deps.begin(), deps.end(), dep->name()) != deps.end()) {
+                            skipUntilLater = true;
+                            break;
+                        }
                     }
-                }
-                for (auto dep : groups.back()) {
-                    if (find(deps.begin(), deps.end(), dep.plugin->name()) != deps.end()) {
-                        skipUntilLater = true;
-                        break;
+                    if (!(*p)->streamsDependencies()) {
+                        for (auto dep : groups.back()) {
+                            if (find(deps.begin(), deps.end(), dep.plugin->name()) != deps.end()) {
+                                skipUntilLater = true;
+                                break;
+                            }
+                        }
+                    }
+                    if (!skipUntilLater) {
+                        groups.back().push_back({*p, false});
+                        p = plugins.erase(p);
+                        placed = true;
+                    } else {
+                        ++p;
                     }
-                }
-                if (!skipUntilLater) {
-                    groups.back().push_back({*p, false});
-                    p = plugins.erase(p);
-                } else {
-                    ++p;
                 }
             }
 
@@ -242,68 +492,372 @@ int main(int argc, char* argv[])
     }
 
     zcm::Json::Value index;
+    zcm::BinaryIndexWriter binaryIndex;
+
+    // Binary indexes are written to binaryIndex rather than to json ones
+    auto indexEvent = [&](zcm::IndexerPlugin* plugin, zcm::Json::Value& pluginIndex,
+                          zcm::BinaryPluginIndex& binaryPluginIndex,
+                          zcm::Json::Value& annotations, const string& channel,
+                          const TypeMetadata* md, off_t offset, int64_t timestamp,
+                          uint64_t hash, const uint8_t* data, int32_t datalen) {
+        if (args.binary)
+            plugin->indexBinaryEvent(index, binaryPluginIndex, annotations,
+                                     channel, md->name, offset, timestamp,
+                                     hash, data, datalen);
+        else
+            plugin->indexAnnotatedEvent(index, pluginIndex, annotations,
+                                        channel, md->name, offset, timestamp,
+                                        hash, data, datalen);
+    };
 
-    size_t numEvents = 0;
-    const zcm::LogEvent* evt;
-    for (size_t i = 0; i < pluginGroups.size(); ++i) {
-        if (pluginGroups.size() != 1) cout << "Plugin group " << (i + 1) << endl;
-        off_t offset = 0;
-        fseeko(log.getFilePtr(), 0, SEEK_SET);
+    // Indexes the events of the log from 'from' to 'end', carrying on from
+    // the plugin states of a checkpoint if there are any. Returns how many
+    // events the plugins went through
+    auto indexLog = [&](zcm::LogFile& log, off_t from, off_t end,
+                        const zcm::Json::Value* states) -> size_t {
+        size_t numEvents = 0;
+        const zcm::LogEvent* evt;
+        vector<off_t> ranges;
+        for (size_t i = 0; i < pluginGroups.size(); ++i) {
+            if (pluginGroups.size() != 1) cout << "Plugin group " << (i + 1) << endl;
+            off_t offset = from;
+            fseeko(log.getFilePtr(), from, SEEK_SET);
+
+            for (auto& p : pluginGroups[i]) {
+                const string& name = p.plugin->name();
+                p.runThroughLog = states ?
+                    p.plugin->resume(index, index[name], (*states)[name], log) :
+                    p.plugin->setUp(index, index[name], log);
+            }
+
+            fseeko(log.getFilePtr(), from, SEEK_SET);
+
+            // Plugins that stream their dependencies run right after these for
+            // every event, sharing its annotations. Each such chain of plugins
+            // runs through the log on a thread of its own, only ever touching
+            // their own pluginIndex: they all exist by now, so 'index' itself
+            // doesn't change until they are done
+            vector<vector<zcm::IndexerPlugin*>> running;
+            vector<zcm::IndexerPlugin*> mergeable;
+            unordered_map<string, size_t> chainOf;
+            for (auto& p : pluginGroups[i]) {
+                if (!p.runThroughLog) continue;
+                size_t chain = running.size();
+                if (p.plugin->streamsDependencies()) {
+                    for (auto& dep : p.plugin->dependsOn()) {
+                        auto it = chainOf.find(dep);
+                        if (it == chainOf.end() || it->second == chain) continue;
+                        if (chain == running.size()) {
+                            chain = it->second;
+                            continue;
+                        }
+                        // Depends on two chains: the second one joins the first
+                        size_t other = it->second;
+                        for (auto* q : running[other]) chainOf[q->name()] = chain;
+                        running[chain].insert(running[chain].end(),
+                                              running[other].begin(), running[other].end());
+                        running[other].clear();
+                    }
+                }
+                if (chain == running.size()) running.emplace_back();
+                running[chain].push_back(p.plugin);
+                chainOf[p.plugin->name()] = chain;
+            }
+            running.erase(remove_if(running.begin(), running.end(),
+                                    [](const vector<zcm::IndexerPlugin*>& c) { return c.empty(); }),
+                          running.end());
+            for (auto c = running.begin(); c != running.end();) {
+                if (args.jobs > 1 && c->size() == 1 && c->front()->mergeable()) {
+                    mergeable.push_back(c->front());
+                    c = running.erase(c);
+                } else {
+                    ++c;
+                }
+            }
 
-        for (auto& p : pluginGroups[i])
-            p.runThroughLog = p.plugin->setUp(index, index[p.plugin->name()], log);
+            // Mergeable plugins rather go through ranges of the log at once, each
+            // on a thread of its own, with a log and range indexes of its own
+            if (!mergeable.empty() && ranges.empty())
+                ranges = splitLog(args.logfile, from, end, args.jobs);
+            size_t nranges = mergeable.empty() ? 0 : ranges.size() - 1;
+            if (nranges > 1) {
+                cout << "Indexing " << mergeable.size() << " mergeable plugin(s) in "
+                     << nranges << " ranges" << endl;
+            } else {
+                for (auto* p : mergeable) running.push_back({ p });
+                mergeable.clear();
+                nranges = 0;
+            }
 
-        fseeko(log.getFilePtr(), 0, SEEK_SET);
+            vector<vector<zcm::Json::Value>> rangeIndexes(nranges,
+                    vector<zcm::Json::Value>(mergeable.size()));
+            vector<vector<zcm::BinaryPluginIndex>> rangeBinaryIndexes(nranges,
+                    vector<zcm::BinaryPluginIndex>(mergeable.size()));
+            vector<size_t> rangeEvents(nranges, 0);
+            vector<unique_ptr<zcm::LogFile>> rangeLogs;
+            for (size_t r = 0; r < nranges; ++r) {
+                rangeLogs.emplace_back(new zcm::LogFile(args.logfile, "r"));
+                if (!rangeLogs.back()->good()) {
+                    cerr << "Unable to open logfile: " << args.logfile << endl;
+                    exit(1);
+                }
+            }
+            vector<thread> rangeWorkers;
+            for (size_t r = 0; r < nranges; ++r) {
+                rangeWorkers.emplace_back([&, r]() {
+                    zcm::LogFile& rangeLog = *rangeLogs[r];
+                    ChannelTypes chanTypes(types);
+                    zcm::Json::Value annotations;
+                    fseeko(rangeLog.getFilePtr(), ranges[r], SEEK_SET);
+                    while (1) {
+                        off_t offset = ftello(rangeLog.getFilePtr());
+                        if (offset >= ranges[r + 1]) break;
+
+                        const zcm::LogEvent* evt = rangeLog.readNextEvent();
+                        if (evt == nullptr) break;
+
+                        const TypeMetadata* md =
+                            chanTypes.resolve(evt->channel, evt->data, evt->datalen);
+                        if (!md) continue;
+
+                        for (size_t j = 0; j < mergeable.size(); ++j) {
+                            if (!annotations.isNull()) annotations = zcm::Json::Value();
+                            indexEvent(mergeable[j], rangeIndexes[r][j],
+                                       rangeBinaryIndexes[r][j], annotations,
+                                       evt->channel, md, offset, evt->timestamp,
+                                       (uint64_t) md->hash, evt->data, evt->datalen);
+                        }
+                        rangeEvents[r] += mergeable.size();
+                    }
+                    rangeLog.close();
+                });
+            }
 
-        while (1) {
-            offset = ftello(log.getFilePtr());
+            vector<vector<zcm::Json::Value*>> pluginIndexes(running.size());
+            vector<vector<zcm::BinaryPluginIndex*>> binaryPluginIndexes(running.size());
+            for (size_t j = 0; j < running.size(); ++j) {
+                for (auto* p : running[j]) {
+                    pluginIndexes[j].push_back(&index[p->name()]);
+                    binaryPluginIndexes[j].push_back(&binaryIndex.plugin(p->name()));
+                }
+            }
 
-            static int lastPrintPercent = 0;
-            int percent = (100.0 * offset / logSize) * 100;
-            if (percent != lastPrintPercent) {
-                cout << "\r" << "Percent Complete: " << (percent / 100) << flush;
-                lastPrintPercent = percent;
+            EventBatches batches(running.size());
+            ChannelTypes chanTypes(types);
+            vector<size_t> pluginEvents(running.size(), 0);
+            vector<thread> workers;
+            for (size_t j = 0; j < running.size(); ++j) {
+                workers.emplace_back([&, j]() {
+                    const vector<zcm::IndexerPlugin*>& chain = running[j];
+                    zcm::Json::Value annotations;
+                    for (size_t seq = 0;; ++seq) {
+                        const EventBatches::Batch* b = batches.waitBatch(seq);
+                        if (!b) break;
+                        for (size_t k = 0; k < b->nevents; ++k) {
+                            const EventBatches::Event& e = b->events[k];
+                            if (!annotations.isNull()) annotations = zcm::Json::Value();
+                            for (size_t m = 0; m < chain.size(); ++m) {
+                                indexEvent(chain[m], *pluginIndexes[j][m],
+                                           *binaryPluginIndexes[j][m], annotations,
+                                           e.channel, e.md, e.offset, e.timestamp, e.hash,
+                                           b->buf.data() + e.data, e.datalen);
+                            }
+                        }
+                        pluginEvents[j] += b->nevents * chain.size();
+                        batches.releaseBatch(seq);
+                    }
+                });
             }
 
-            evt = log.readNextEvent();
-            if (evt == nullptr) break;
+            EventBatches::Batch* batch = running.empty() ? nullptr : &batches.startBatch();
 
-            int64_t msg_hash;
-            __int64_t_decode_array(evt->data, 0, 8, &msg_hash, 1);
-            const TypeMetadata* md = types.getByHash(msg_hash);
-            if (!md) continue;
+            while (!running.empty()) {
+                offset = ftello(log.getFilePtr());
+                if (offset >= end) break;
 
-            for (auto& p : pluginGroups[i]) {
-                assert(p.plugin);
+                static int lastPrintPercent = 0;
+                int percent = (100.0 * (offset - from) / (end - from)) * 100;
+                if (percent != lastPrintPercent) {
+                    cout << "\r" << "Percent Complete: " << (percent / 100) << flush;
+                    lastPrintPercent = percent;
+                }
 
-                if (!p.runThroughLog) continue;
+                evt = log.readNextEvent();
+                if (evt == nullptr) break;
+
+                const TypeMetadata* md = chanTypes.resolve(evt->channel, evt->data, evt->datalen);
+                if (!md) continue;
+
+                EventBatches::add(*batch, offset, evt, md, (uint64_t) md->hash);
+                if (EventBatches::full(*batch)) {
+                    batches.publishBatch(*batch);
+                    batch = &batches.startBatch();
+                }
+            }
+
+            if (batch) {
+                if (batch->nevents > 0) batches.publishBatch(*batch);
+                batches.finish();
+            }
+            for (auto& w : workers) w.join();
+            for (size_t n : pluginEvents) numEvents += n;
+
+            for (auto& w : rangeWorkers) w.join();
+            for (size_t r = 0; r < nranges; ++r) {
+                for (size_t j = 0; j < mergeable.size(); ++j) {
+                    if (args.binary)
+                        binaryIndex.plugin(mergeable[j]->name()).merge(rangeBinaryIndexes[r][j]);
+                    else
+                        mergeable[j]->merge(index, index[mergeable[j]->name()], rangeIndexes[r][j]);
+                }
+                numEvents += rangeEvents[r];
+            }
+
+            cout << endl;
+
+            for (auto& p : pluginGroups[i])
+                p.plugin->tearDown(index, index[p.plugin->name()], log);
+        }
+        return numEvents;
+    };
+
+    // Incremental runs write the index to the side and move it in place once
+    // complete, as it may be in use
+    auto writeIndex = [&]() {
+        string path = incremental ? args.output + ".tmp" : args.output;
+        bool ok;
+        if (args.binary) {
+            ok = binaryIndex.write(path);
+        } else {
+            ofstream output(path);
+            zcm::Json::StreamWriterBuilder builder;
+            builder["indentation"] = args.readable ? "    " : "";
+            std::unique_ptr<zcm::Json::StreamWriter> writer(builder.newStreamWriter());
+            ok = output.is_open() && writer->write(index, &output) == 0;
+            output << endl;
+            output.close();
+            ok = ok && !output.fail();
+        }
+        if (ok && incremental) ok = rename(path.c_str(), args.output.c_str()) == 0;
+        if (!ok) cerr << "Unable to write output file: " << args.output << endl;
+        return ok;
+    };
+
+    // The checkpoint holds where the indexed events end, what the log starts
+    // with and how big the index is, so that both can be found unchanged, and
+    // what the plugins need to carry on
+    string checkpointPath = args.output + ".ckpt";
+    auto fileSize = [](const string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? (zcm::Json::Int64) st.st_size : -1;
+    };
+    auto logHead = [&]() {
+        string head(EVENT_HEADER_BYTES, '\0');
+        FILE* f = fopen(args.logfile.c_str(), "rb");
+        if (f) {
+            head.resize(fread(&head[0], 1, head.size(), f));
+            fclose(f);
+        }
+        string hex;
+        for (unsigned char c : head) hex += "0123456789abcdef"[c >> 4], hex += "0123456789abcdef"[c & 15];
+        return hex;
+    };
+
+    zcm::Json::Value states;
+    auto writeCheckpoint = [&](off_t end) {
+        for (auto* p : plugins) {
+            zcm::Json::Value state;
+            p->checkpoint(index, index[p->name()], state);
+            states[p->name()] = state;
+        }
+        zcm::Json::Value ckpt;
+        ckpt["offset"] = (zcm::Json::Int64) end;
+        ckpt["logHead"] = logHead();
+        ckpt["indexBytes"] = fileSize(args.output);
+        ckpt["plugins"] = states;
+
+        string tmp = checkpointPath + ".tmp";
+        ofstream out(tmp);
+        out << ckpt << endl;
+        out.close();
+        if (out.fail() || rename(tmp.c_str(), checkpointPath.c_str()) != 0)
+            cerr << "Unable to write checkpoint: " << checkpointPath << endl;
+    };
 
-                p.plugin->indexEvent(index, index[p.plugin->name()],
-                                     evt->channel, md->name,
-                                     offset, evt->timestamp,
-                                     (uint64_t) msg_hash,
-                                     evt->data, evt->datalen);
+    // Returns where the last run got to in the log, with the index it wrote
+    // loaded, or 0 if there's no going on from it
+    auto loadCheckpoint = [&]() -> off_t {
+        ifstream in(checkpointPath);
+        zcm::Json::Value ckpt;
+        zcm::Json::Reader reader;
+        if (!in.good() || !reader.parse(in, ckpt, false)) return 0;
+
+        off_t offset = ckpt["offset"].asInt64();
+        if (offset <= 0 || offset > logSize || ckpt["logHead"].asString() != logHead() ||
+            ckpt["indexBytes"].asInt64() != fileSize(args.output)) {
+            cout << "Log or index changed since the checkpoint: starting over" << endl;
+            return 0;
+        }
 
-                numEvents++;
+        if (args.binary) {
+            zcm::BinaryIndex prev(args.output);
+            if (!prev.good()) return 0;
+            for (size_t e = 0; e < prev.numEntries(); ++e) {
+                auto& p = binaryIndex.plugin(prev.plugin(e));
+                auto offsets = prev.offsets(e);
+                for (const uint64_t* o = offsets.begin; o != offsets.end; ++o)
+                    p.add(prev.channel(e), prev.typeName(e), *o);
+            }
+        } else {
+            ifstream prev(args.output);
+            if (!reader.parse(prev, index, false)) {
+                index = zcm::Json::Value();
+                return 0;
             }
         }
+        states = ckpt["plugins"];
+        return offset;
+    };
+
+    off_t from = incremental ? loadCheckpoint() : 0;
+    bool resuming = from > 0;
+    if (resuming) cout << "Carrying on from offset " << from << endl;
 
-        cout << endl;
+    if (args.follow) {
+        signal(SIGINT, stopHandler);
+        signal(SIGTERM, stopHandler);
+    }
+
+    size_t numEvents = 0;
+    for (bool first = true;; first = false) {
+        off_t end = incremental ? completeEventsEnd(args.logfile, from) : logSize;
+        if (first || end > from) {
+            // Opened anew every time, so that all of what was written is mapped
+            zcm::LogFile log(args.logfile, "r");
+            if (!log.good()) {
+                cerr << "Unable to open logfile: " << args.logfile << endl;
+                return 1;
+            }
+            size_t n = indexLog(log, from, end, resuming ? &states : nullptr);
+            log.close();
+            numEvents += n;
+
+            if (!writeIndex()) return 1;
+            if (incremental) writeCheckpoint(end);
+            if (args.follow) cout << "Indexed " << n << " events, up to offset " << end << endl;
+            from = end;
+            resuming = true;
+        }
 
-        for (auto& p : pluginGroups[i])
-            p.plugin->tearDown(index, index[p.plugin->name()], log);
+        if (!args.follow) break;
+        for (int k = 0; k < 10 && !stopFollowing; ++k)
+            this_thread::sleep_for(chrono::milliseconds(100));
+        if (stopFollowing) break;
     }
 
     delete defaultPlugin;
     defaultPlugin = nullptr;
 
-    zcm::Json::StreamWriterBuilder builder;
-    builder["indentation"] = args.readable ? "    " : "";
-    std::unique_ptr<zcm::Json::StreamWriter> writer(builder.newStreamWriter());
-    writer->write(index, &output);
-    output << endl;
-    output.close();
-
     cout << "Indexed " << numEvents << " events" << endl;
     return 0;
 }
@@ -0,0 +1,250 @@
+#include <iostream>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <getopt.h>
+#include <dlfcn.h>
+#include <regex>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+#include <zcm/zcm-cpp.hpp>
+#include <zcm/tools/LogExport.hpp>
+
+#include "util/TimeUtil.hpp"
+
+using namespace std;
+
+// Output is formatted into buffers of this size and written once they fill
+static const size_t WRITE_BUFFER_BYTES = 1 << 20;
+
+struct Args
+{
+    string plugin = "";
+    string format = "json";
+    string output = "";
+    string channelRegex = ".*";
+    string filename = "";
+    bool verbose = false;
+
+    bool init(int argc, char *argv[])
+    {
+        struct option long_opts[] = {
+            { "help",               no_argument, 0, 'h' },
+            { "plugin-path",  required_argument, 0, 'p' },
+            { "format",       required_argument, 0, 'f' },
+            { "output",       required_argument, 0, 'o' },
+            { "channel",      required_argument, 0, 'c' },
+            { "verbose",            no_argument, 0, 'v' },
+            { 0, 0, 0, 0 }
+        };
+
+        int c;
+        while ((c = getopt_long(argc, argv, "hp:f:o:c:v", long_opts, 0)) >= 0) {
+            switch (c) {
+                case 'p':       plugin = string(optarg); break;
+                case 'f':       format = string(optarg); break;
+                case 'o':       output = string(optarg); break;
+                case 'c': channelRegex = string(optarg); break;
+                case 'v':      verbose = true;           break;
+                case 'h': default: usage(); return false;
+            };
+        }
+
+        if (optind != argc - 1) {
+            cerr << "Please specify a logfile" << endl;
+            usage();
+            return false;
+        }
+        filename = string(argv[optind]);
+
+        if (plugin == "") {
+            cerr << "Please specify a plugin with the types to export" << endl;
+            usage();
+            return false;
+        }
+        if (format != "json" && format != "csv") {
+            cerr << "Unknown format: " << format << endl;
+            usage();
+            return false;
+        }
+        if (format == "csv" && output == "") {
+            cerr << "CSV exports need an output directory" << endl;
+            usage();
+            return false;
+        }
+
+        return true;
+    }
+
+    void usage()
+    {
+        cerr << "usage: zcm-log-export [options] FILE" << endl
+             << "" << endl
+             << "    Exports the messages of a ZCM log file to JSON or CSV for analysis" << endl
+             << "    tools. The types exported are the ones named by the plugin, see" << endl
+             << "    zcm/tools/LogExport.hpp. Messages of other types are skipped." << endl
+             << "" << endl
+             << "Options:" << endl
+             << "" << endl
+             << "  -p, --plugin-path=LIB  Shared library of the types to export (required)" << endl
+             << "  -f, --format=FMT       json: one object per line (the default)" << endl
+             << "                         csv: one file per channel, a column per field" << endl
+             << "  -o, --output=PATH      json: the file to write, stdout if none" << endl
+             << "                         csv: the directory to write <channel>.csv in" << endl
+             << "  -c, --channel=REGEX    Only export the channels matching REGEX" << endl
+             << "  -v, --verbose          Report the progress and the types of the plugin" << endl
+             << "  -h, --help             Shows this help text and exits" << endl
+             << endl;
+    }
+};
+
+// A file written in WRITE_BUFFER_BYTES pieces
+struct Output
+{
+    FILE* f = nullptr;
+    bool owned = false;
+    string buf;
+    string channel;           // for CSV: the channel and type of its rows
+    const char* type = nullptr;
+
+    Output() { buf.reserve(WRITE_BUFFER_BYTES + (WRITE_BUFFER_BYTES >> 2)); }
+    ~Output() { close(); }
+
+    bool open(const string& path)
+    {
+        f = fopen(path.c_str(), "w");
+        owned = true;
+        if (!f) cerr << "Unable to open " << path << ": " << strerror(errno) << endl;
+        return f;
+    }
+
+    bool flush()
+    {
+        if (!f) return false;
+        bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+        buf.clear();
+        return ok;
+    }
+
+    bool maybeFlush() { return buf.size() < WRITE_BUFFER_BYTES || flush(); }
+
+    void close()
+    {
+        if (!f) return;
+        flush();
+        if (owned) fclose(f);
+        else fflush(f);
+        f = nullptr;
+    }
+};
+
+// Channels make file names of their own, but for the path separators
+static string fileName(const string& channel)
+{
+    string name = channel;
+    for (auto& c : name) if (c == '/') c = '_';
+    return name + ".csv";
+}
+
+int main(int argc, char* argv[])
+{
+    Args args;
+    if (!args.init(argc, argv)) return 1;
+
+    void* lib = dlopen(args.plugin.c_str(), RTLD_LAZY);
+    if (!lib) {
+        cerr << "Unable to open plugin " << args.plugin << ": " << dlerror() << endl;
+        return 1;
+    }
+    typedef void (*RegisterFn)(zcm::LogExporter*);
+    RegisterFn registerTypes = (RegisterFn) dlsym(lib, ZCM_LOG_EXPORT_SYMBOL);
+    if (!registerTypes) {
+        cerr << "Plugin " << args.plugin << " has no " << ZCM_LOG_EXPORT_SYMBOL << "()."
+             << " Define it with ZCM_LOG_EXPORT_TYPES()" << endl;
+        return 1;
+    }
+    zcm::LogExporter exporter;
+    registerTypes(&exporter);
+    if (args.verbose) cerr << "Exporting " << exporter.numTypes() << " types" << endl;
+
+    zcm::LogFile log(args.filename, "r");
+    if (!log.good()) {
+        cerr << "Unable to open logfile: " << args.filename << endl;
+        return 1;
+    }
+
+    regex channelRegex(args.channelRegex);
+    bool csv = args.format == "csv";
+
+    Output json;
+    if (!csv) {
+        if (args.output == "") json.f = stdout;
+        else if (!json.open(args.output)) return 1;
+    } else if (mkdir(args.output.c_str(), 0755) != 0 && errno != EEXIST) {
+        cerr << "Unable to create " << args.output << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    unordered_map<string, unique_ptr<Output>> channels;
+    // What the regex made of each channel
+    unordered_map<string, bool> exported;
+
+    uint64_t numEvents = 0, numExported = 0, numSkipped = 0, numBytes = 0;
+    uint64_t start = TimeUtil::utime();
+    const zcm::LogEvent* le;
+    while ((le = log.readNextEvent())) {
+        ++numEvents;
+        numBytes += le->datalen;
+
+        auto ex = exported.find(le->channel);
+        if (ex == exported.end())
+            ex = exported.emplace(le->channel, regex_match(le->channel, channelRegex)).first;
+        if (!ex->second) continue;
+
+        bool ok;
+        if (!csv) {
+            ok = exporter.write(*le, zcm::LogExporter::JSON, json.buf) && json.maybeFlush();
+        } else {
+            auto& out = channels[le->channel];
+            if (!out) {
+                out.reset(new Output());
+                out->channel = le->channel;
+                out->type = exporter.typeName(*le);
+                // Channels are named by the first message of a type exported
+                if (!out->type) {
+                    channels.erase(le->channel);
+                    ++numSkipped;
+                    continue;
+                }
+                string path = args.output + "/" + fileName(le->channel);
+                if (!out->open(path)) return 1;
+                exporter.writeCsvHeader(*le, out->buf);
+                if (args.verbose)
+                    cerr << "Writing " << out->type << " of " << le->channel
+                         << " to " << path << endl;
+            }
+            // The columns are the first type's: other types on the channel are skipped
+            ok = exporter.typeName(*le) == out->type &&
+                 exporter.write(*le, zcm::LogExporter::CSV, out->buf) && out->maybeFlush();
+        }
+        if (ok) ++numExported;
+        else ++numSkipped;
+
+        if (args.verbose && numEvents % 1000000 == 0)
+            cerr << "Read " << numEvents << " events" << endl;
+    }
+
+    json.close();
+    for (auto& c : channels) c.second->close();
+
+    double secs = (TimeUtil::utime() - start) / 1e6;
+    cerr << "Exported " << numExported << " of " << numEvents << " events"
+         << " (" << numSkipped << " skipped) in " << secs << " s";
+    if (secs > 0) cerr << ", " << numBytes / 1e6 / secs << " MB/s";
+    cerr << endl;
+
+    dlclose(lib);
+    return 0;
+}
@@ -0,0 +1,375 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <limits>
+#include <getopt.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <cerrno>
+#include <cstring>
+
+#ifdef USING_ZLIB
+#include <zlib.h>
+#endif
+
+#include <zcm/eventlog.h>
+
+#include "util/TimeUtil.hpp"
+
+using namespace std;
+
+// The protocol of "zcmlog://" paths, see zcm/eventlog.c
+static const char* PROTOCOL_VERSION = "ZCMLOG1";
+static const int32_t EVENT_MAGIC = (int32_t) 0xEDA1DA01L;
+static const size_t EVENT_HEADER_BYTES = 28;
+enum { CODEC_STORED = 0, CODEC_ZLIB = 1 };
+static const size_t MAX_REQUEST_BYTES = 64 * 1024;
+
+struct Args
+{
+    string port = "7400";
+    string root = ".";
+    size_t batchBytes = 1 << 20;
+    int level = 1;
+    bool verbose = false;
+
+    bool init(int argc, char *argv[])
+    {
+        struct option long_opts[] = {
+            { "help",              no_argument, 0, 'h' },
+            { "port",        required_argument, 0, 'p' },
+            { "root",        required_argument, 0, 'd' },
+            { "batch-kb",    required_argument, 0, 'b' },
+            { "level",       required_argument, 0, 'l' },
+            { "verbose",           no_argument, 0, 'v' },
+            { 0, 0, 0, 0 }
+        };
+
+        int c;
+        while ((c = getopt_long(argc, argv, "hp:d:b:l:v", long_opts, 0)) >= 0) {
+            switch (c) {
+                case 'p':       port = string(optarg);                    break;
+                case 'd':       root = string(optarg);                    break;
+                case 'b': batchBytes = strtoul(optarg, NULL, 10) << 10;   break;
+                case 'l':      level = atoi(optarg);                      break;
+                case 'v':    verbose = true;                              break;
+                case 'h': default: usage(); return false;
+            };
+        }
+
+        if (optind != argc) {
+            usage();
+            return false;
+        }
+        if (batchBytes == 0 || batchBytes > (32 << 20)) {
+            cerr << "Batches have to be between 1kB and 32MB" << endl;
+            return false;
+        }
+        if (level < 0 || level > 9) {
+            cerr << "The compression level has to be between 0 and 9" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    void usage()
+    {
+        cerr << "usage: zcm-log-server [options]" << endl
+             << "" << endl
+             << "    Serves the ZCM logs under a directory to remote readers: any zcm" << endl
+             << "    log reader, zcm-logplayer and the file transport included, opens" << endl
+             << "    \"zcmlog://host:port/path/of.log\" to read 'path/of.log' of the" << endl
+             << "    directory. Readers can ask for a window of the log, with" << endl
+             << "    \"?start=SEC&end=SEC&channels=A,B\", which the server seeks to" << endl
+             << "    (through the time index of the log if it has one) and filters," << endl
+             << "    so that only those events are sent, in compressed batches." << endl
+             << "" << endl
+             << "Options:" << endl
+             << "" << endl
+             << "  -p, --port=PORT        The TCP port to listen on. Default is 7400." << endl
+             << "  -d, --root=DIR         The directory of the logs served. Default is" << endl
+             << "                         the current directory." << endl
+             << "  -b, --batch-kb=KB      Size the events are sent in. Default is 1024." << endl
+             << "  -l, --level=LEVEL      zlib level of the batches, 0 to send them" << endl
+             << "                         uncompressed. Default is 1." << endl
+             << "  -v, --verbose          Print the queries served." << endl
+             << "  -h, --help             Shows some help text and exits." << endl
+             << endl;
+    }
+};
+
+struct Query
+{
+    int64_t start;
+    int64_t end;
+    bool relative;
+    bool zlib;
+    string path;
+    unordered_set<string> channels;
+};
+
+static bool sendAll(int fd, const void* buf, size_t len)
+{
+    const char* p = (const char*) buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static uint8_t* put32(uint8_t* p, int32_t v)
+{
+    for (int i = 3; i >= 0; --i) *p++ = (uint8_t) (v >> (8 * i));
+    return p;
+}
+
+static uint8_t* put64(uint8_t* p, int64_t v)
+{
+    for (int i = 7; i >= 0; --i) *p++ = (uint8_t) (v >> (8 * i));
+    return p;
+}
+
+// Reads the three lines of a query
+static bool readQuery(int fd, Query& q)
+{
+    string req;
+    char buf[4096];
+    while (count(req.begin(), req.end(), '\n') < 3) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0 || req.size() + n > MAX_REQUEST_BYTES) return false;
+        req.append(buf, n);
+    }
+
+    istringstream in(req);
+    string head, channels;
+    if (!getline(in, head) || !getline(in, q.path) || !getline(in, channels)) return false;
+
+    char version[16];
+    long long start, end;
+    int relative, zlib;
+    if (sscanf(head.c_str(), "%15s %lld %lld %d %d", version, &start, &end, &relative, &zlib) != 5 ||
+        PROTOCOL_VERSION != string(version))
+        return false;
+    q.start = start;
+    q.end = end;
+    q.relative = relative;
+    q.zlib = zlib;
+
+    istringstream chans(channels);
+    string ch;
+    while (getline(chans, ch, ','))
+        if (!ch.empty()) q.channels.insert(ch);
+    return true;
+}
+
+// Logs are only served from under the root
+static bool validPath(const string& path)
+{
+    if (path.empty() || path[0] == '/') return false;
+    istringstream parts(path);
+    string part;
+    while (getline(parts, part, '/'))
+        if (part == "..") return false;
+    return true;
+}
+
+// Sends the events gathered in 'raw' as one batch, compressed if it helps
+struct Batcher
+{
+    int fd;
+    int level;
+    vector<uint8_t> raw;
+    vector<uint8_t> stored;
+    uint64_t rawBytes = 0;
+    uint64_t sentBytes = 0;
+
+    void add(const zcm_eventlog_event_t* le)
+    {
+        size_t len = EVENT_HEADER_BYTES + le->channellen + le->datalen;
+        size_t pos = raw.size();
+        raw.resize(pos + len);
+        uint8_t* p = raw.data() + pos;
+        p = put32(p, EVENT_MAGIC);
+        p = put64(p, le->eventnum);
+        p = put64(p, le->timestamp);
+        p = put32(p, le->channellen);
+        p = put32(p, le->datalen);
+        memcpy(p, le->channel, le->channellen);
+        memcpy(p + le->channellen, le->data, le->datalen);
+    }
+
+    // An empty batch ends the stream
+    bool flush()
+    {
+        uint8_t hdr[12];
+        int32_t codec = CODEC_STORED;
+        const uint8_t* payload = raw.data();
+        size_t len = raw.size();
+#ifdef USING_ZLIB
+        if (level > 0 && len > 0) {
+            stored.resize(compressBound(len));
+            uLongf storedlen = stored.size();
+            if (compress2(stored.data(), &storedlen, raw.data(), len, level) == Z_OK &&
+                storedlen < len) {
+                codec = CODEC_ZLIB;
+                payload = stored.data();
+                len = storedlen;
+            }
+        }
+#endif
+        put32(put32(put32(hdr, codec), raw.size()), len);
+        bool ok = sendAll(fd, hdr, sizeof(hdr)) && sendAll(fd, payload, len);
+        rawBytes += raw.size();
+        sentBytes += sizeof(hdr) + len;
+        raw.clear();
+        return ok;
+    }
+};
+
+static void serve(const Args& args, int fd, const string& peer)
+{
+    Query q;
+    if (!readQuery(fd, q)) {
+        if (args.verbose) cerr << peer << ": Invalid query" << endl;
+        close(fd);
+        return;
+    }
+    if (!validPath(q.path)) {
+        string err = "ERR Invalid path " + q.path + "\n";
+        sendAll(fd, err.data(), err.size());
+        close(fd);
+        return;
+    }
+
+    zcm_eventlog_t* log = zcm_eventlog_create((args.root + "/" + q.path).c_str(), "r");
+    if (!log) {
+        string err = "ERR Unable to open " + q.path + "\n";
+        sendAll(fd, err.data(), err.size());
+        close(fd);
+        return;
+    }
+
+    uint64_t t0 = TimeUtil::utime();
+    zcm_eventlog_event_t* first = zcm_eventlog_read_next_event(log);
+    int64_t firstTs = first ? first->timestamp : 0;
+    if (first) zcm_eventlog_free_event(first);
+
+    int64_t start = q.start, end = q.end;
+    if (q.relative) {
+        start += firstTs;
+        end = end > numeric_limits<int64_t>::max() - firstTs ? numeric_limits<int64_t>::max()
+                                                            : end + firstTs;
+    }
+
+    string ok = "OK " + to_string(firstTs) + "\n";
+    bool good = sendAll(fd, ok.data(), ok.size());
+
+    // Only compressed if asked for
+    Batcher batcher;
+    batcher.fd = fd;
+    batcher.level = q.zlib ? args.level : 0;
+    batcher.raw.reserve(args.batchBytes + (args.batchBytes >> 2));
+
+    uint64_t nevents = 0;
+    // Uses the sidecar time index of the log when there is one
+    if (good && first && zcm_eventlog_seek_to_timestamp(log, start) == 0) {
+        zcm_eventlog_event_t* le;
+        while (good && (le = zcm_eventlog_read_next_event(log))) {
+            if (le->timestamp > end) {
+                zcm_eventlog_free_event(le);
+                break;
+            }
+            if (le->timestamp >= start &&
+                (q.channels.empty() || q.channels.count(string(le->channel, le->channellen)))) {
+                batcher.add(le);
+                ++nevents;
+                if (batcher.raw.size() >= args.batchBytes) good = batcher.flush();
+            }
+            zcm_eventlog_free_event(le);
+        }
+    }
+    if (good && !batcher.raw.empty()) good = batcher.flush();
+    if (good) good = batcher.flush();
+
+    if (args.verbose)
+        cerr << peer << ": " << q.path << " [" << start << ", " << end << "]: "
+             << nevents << " events, " << batcher.rawBytes << " bytes sent as "
+             << batcher.sentBytes << " in " << (TimeUtil::utime() - t0) / 1e6 << " s"
+             << (good ? "" : " (interrupted)") << endl;
+
+    zcm_eventlog_destroy(log);
+    close(fd);
+}
+
+static int listenOn(const string& port)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(NULL, port.c_str(), &hints, &res) != 0) {
+        hints.ai_family = AF_INET;
+        if (getaddrinfo(NULL, port.c_str(), &hints, &res) != 0) return -1;
+    }
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    int one = 1, zero = 0;
+    if (fd >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        // Serves IPv4 readers as well
+        if (res->ai_family == AF_INET6)
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        if (bind(fd, res->ai_addr, res->ai_addrlen) != 0 || listen(fd, 16) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int main(int argc, char* argv[])
+{
+    Args args;
+    if (!args.init(argc, argv)) return 1;
+
+    int lfd = listenOn(args.port);
+    if (lfd < 0) {
+        cerr << "Unable to listen on port " << args.port << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    if (args.verbose) cerr << "Serving " << args.root << " on port " << args.port << endl;
+
+    while (true) {
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        int fd = accept(lfd, (struct sockaddr*) &addr, &addrlen);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            cerr << "Unable to accept readers: " << strerror(errno) << endl;
+            break;
+        }
+        char host[NI_MAXHOST] = "?", serv[NI_MAXSERV] = "?";
+        getnameinfo((struct sockaddr*) &addr, addrlen, host, sizeof(host), serv, sizeof(serv),
+                    NI_NUMERICHOST | NI_NUMERICSERV);
+        string peer = string(host) + ":" + serv;
+
+        // Every reader has a thread and a log of its own
+        thread([&args, fd, peer]() { serve(args, fd, peer); }).detach();
+    }
+
+    close(lfd);
+    return 1;
+}
@@ -9,7 +9,11 @@
 #include <mutex>
 #include <condition_variable>
 #include <thread>
-#include <queue>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <map>
+#include <chrono>
 #include <vector>
 #include <signal.h>
 #include <string>
@@ -20,6 +24,7 @@
 
 #include "zcm/zcm-cpp.hpp"
 #include "zcm/util/debug.h"
+#include "zcm/util/huge_pages.hpp"
 #include "zcm/zcm_coretypes.h"
 
 #include "util/TranscoderPluginDb.hpp"
@@ -41,7 +46,7 @@ struct Args
     string chan               = ".*";
     bool   auto_increment     = false;
     bool   use_strftime       = false;
-    string zcmurl             = "";
+    vector<string> zcmurls;
     bool   quiet              = false;
     bool   invert_channels    = false;
     int    rotate             = -1;
@@ -49,13 +54,23 @@ struct Args
     i64    max_target_memory  = 0;
     string plugin_path        = "";
     bool   debug              = false;
+    double index_mb           = 0.0;
+    bool   compress           = false;
+    bool   channel_ids        = false;
+    int    write_buffers      = 16;
+    bool   huge_pages         = false;
+    int    shards             = 1;
+    // --limit-rate and --keep-every: channel regexes with their max rate (Hz)
+    // or the N of keeping one message in N
+    vector<pair<string, double>> rate_limits;
+    vector<pair<string, int>>    keep_every;
 
     string input_fname;
 
     bool parse(int argc, char *argv[])
     {
         // set some defaults
-        const char *optstring = "hb:c:fiu:r:s:qvl:m:p:d";
+        const char *optstring = "hb:c:fiu:r:s:qvl:m:p:dx:zCw:S:HR:K:";
         struct option long_opts[] = {
             { "help",              no_argument,       0, 'h' },
             { "split-mb",          required_argument, 0, 'b' },
@@ -71,6 +86,14 @@ struct Args
             { "max-target-memory", required_argument, 0, 'm' },
             { "plugin-path",       required_argument, 0, 'p' },
             { "debug",             no_argument,       0, 'd' },
+            { "index-mb",          required_argument, 0, 'x' },
+            { "compress",          no_argument,       0, 'z' },
+            { "channel-ids",       no_argument,       0, 'C' },
+            { "write-buffers",     required_argument, 0, 'w' },
+            { "shards",            required_argument, 0, 'S' },
+            { "hugepages",         no_argument,       0, 'H' },
+            { "limit-rate",        required_argument, 0, 'R' },
+            { "keep-every",        required_argument, 0, 'K' },
 
             { 0, 0, 0, 0 }
         };
@@ -96,7 +119,7 @@ struct Args
                     use_strftime = true;
                     break;
                 case 'u':
-                    zcmurl = optarg;
+                    zcmurls.push_back(optarg);
                     break;
                 case 'q':
                     quiet = true;
@@ -124,6 +147,42 @@ struct Args
                 case 'd':
                     debug = true;
                     break;
+                case 'x':
+                    index_mb = strtod(optarg, NULL);
+                    if (index_mb <= 0)
+                        return false;
+                    break;
+                case 'z':
+                    compress = true;
+                    break;
+                case 'C':
+                    channel_ids = true;
+                    break;
+                case 'w':
+                    write_buffers = atoi(optarg);
+                    if (write_buffers < 0)
+                        return false;
+                    break;
+                case 'S':
+                    shards = atoi(optarg);
+                    if (shards < 1)
+                        return false;
+                    break;
+                case 'H':
+                    huge_pages = true;
+                    break;
+                case 'R': {
+                    string regex;
+                    double hz;
+                    if (!splitRule(optarg, regex, hz) || hz <= 0) return false;
+                    rate_limits.emplace_back(regex, hz);
+                } break;
+                case 'K': {
+                    string regex;
+                    double n;
+                    if (!splitRule(optarg, regex, n) || n < 1 || n != (int) n) return false;
+                    keep_every.emplace_back(regex, (int) n);
+                } break;
                 case 'h': default: usage(); return false;
             };
         }
@@ -148,9 +207,25 @@ struct Args
             return false;
         }
 
+        if (shards > 1 && (auto_split_mb > 0 || rotate > 0)) {
+            cerr << "ERROR.  --shards can't be used with --split-mb or --rotate" << endl;
+            return false;
+        }
+
         return true;
     }
 
+    // Splits "REGEX=VALUE" at its last '=', as regexes rarely have one
+    static bool splitRule(const string& rule, string& regex, double& value)
+    {
+        size_t eq = rule.rfind('=');
+        if (eq == string::npos || eq == 0) return false;
+        regex = rule.substr(0, eq);
+        char* end = nullptr;
+        value = strtod(rule.c_str() + eq + 1, &end);
+        return end != rule.c_str() + eq + 1 && *end == '\0';
+    }
+
     void usage()
     {
         cout << "usage: zcm-logger [options] [FILE]" << endl
@@ -172,7 +247,10 @@ struct Args
              << "                             such that the resulting filename does not" << endl
              << "                             already exist.  This option precludes -f and" << endl
              << "                             --rotate" << endl
-             << "  -u, --zcm-url=URL          Log messages on the specified ZCM URL" << endl
+             << "  -u, --zcm-url=URL          Log messages on the specified ZCM URL. Can be" << endl
+             << "                             given several times, to log all of them at once" << endl
+             << "                             into the same log, each received on a thread" << endl
+             << "                             of its own" << endl
              << "  -m, --max-unwritten-mb=SZ  Maximum size of received but unwritten" << endl
              << "                             messages to store in memory before dropping" << endl
              << "                             messages.  (default: 100 MB)" << endl
@@ -196,6 +274,32 @@ struct Args
              << "                             size you expect to receive. This argument is" << endl
              << "                             specified in bytes. Suffixes are not yet supported." << endl
              << "  -p, --plugin-path=path     Path to shared library containing transcoder plugins" << endl
+             << "  -x, --index-mb=N           Also write a time index to FILE.tidx, with an entry" << endl
+             << "                             every N MB of log (can be fractional). Seeks by" << endl
+             << "                             timestamp in the log then take a single read." << endl
+             << "  -z, --compress             Write the log as compressed blocks of events." << endl
+             << "                             --split-mb still counts uncompressed bytes." << endl
+             << "  -C, --channel-ids          Write each channel name once, and have events" << endl
+             << "                             refer to it by number. Not with --compress." << endl
+             << "  -w, --write-buffers=N      Write the log to disk from a separate thread," << endl
+             << "                             through up to N buffers of 1MB, so that disk" << endl
+             << "                             stalls don't hold up logging until they're all" << endl
+             << "                             full. 0 writes synchronously. (default: 16)" << endl
+             << "  -S, --shards=N             Spread the channels over N logs (FILE.s0, FILE.s1," << endl
+             << "                             ...), each written by its own thread, and make" << endl
+             << "                             FILE the set of them: reading FILE reads them all" << endl
+             << "                             as one log. --max-target-memory is split evenly" << endl
+             << "                             between them." << endl
+             << "  -H, --hugepages            Hold the messages waiting to be written on huge" << endl
+             << "                             pages, which makes copying them in and out cheaper" << endl
+             << "                             at high rates." << endl
+             << "  -R, --limit-rate=CHAN=HZ   Log at most HZ messages a second of the channels" << endl
+             << "                             matching the regex CHAN, dropping the others as" << endl
+             << "                             they're received. Can be given several times:" << endl
+             << "                             the first CHAN a channel matches applies" << endl
+             << "  -K, --keep-every=CHAN=N    Only log one in N messages of the channels" << endl
+             << "                             matching the regex CHAN. Can be given several" << endl
+             << "                             times, and along with --limit-rate" << endl
              << endl
              << "Rotating / splitting log files" << endl
              << "==============================" << endl
@@ -212,31 +316,218 @@ struct Args
     }
 };
 
-static zcm::LogEvent* cloneLogEvent(const zcm::LogEvent* evt)
+// Events waiting to be written, stored back to back (timestamp, lengths,
+// channel and data) in large chunks that are recycled once written. Not
+// thread safe, but records below the end of front() are never moved or
+// written to by push()
+struct CaptureRing
 {
-    zcm::LogEvent* ret = new zcm::LogEvent;
-    ret->eventnum  = evt->eventnum;
-    ret->timestamp = evt->timestamp;
-    ret->channel   = evt->channel;
-    ret->datalen   = evt->datalen;
-    ret->data      = new uint8_t[evt->datalen];
-    memcpy(ret->data, evt->data, evt->datalen * sizeof(uint8_t));
-    return ret;
-}
+    struct Span
+    {
+        const uint8_t* begin = nullptr;
+        const uint8_t* end   = nullptr;
+    };
 
-struct Logger
+    ~CaptureRing()
+    {
+        for (auto& c : chunks) release(c);
+        for (auto& c : spare)  release(c);
+    }
+
+    // At most this many bytes of events are held, 0 for no limit
+    void setMaxBytes(size_t bytes) { maxBytes = bytes; }
+    // Takes the chunks from huge pages. Must be set before the first push()
+    void setHugePages(bool enable) { hugePages = enable; }
+
+    // Returns false, dropping the event, if that would hold too many
+    bool push(int64_t timestamp, const string& channel, const uint8_t* data, int32_t datalen)
+    {
+        size_t sz = size(channel.size(), datalen);
+        if (maxBytes != 0 && usedBytes + sz > maxBytes) {
+            droppedEvents++;
+            return false;
+        }
+
+        if (chunks.empty() || chunks.back().cap - chunks.back().tail < sz) {
+            Chunk c;
+            if (!spare.empty() && sz <= CHUNK_BYTES) {
+                c = spare.back();
+                spare.pop_back();
+            } else {
+                c.cap = max(sz, CHUNK_BYTES);
+                c.data = hugePages ? (uint8_t*) HugePages::map(c.cap) : new uint8_t[c.cap];
+                if (!c.data) {
+                    droppedEvents++;
+                    return false;
+                }
+            }
+            chunks.push_back(c);
+        }
+
+        Chunk& c = chunks.back();
+        Header h { timestamp, (u32) channel.size(), (u32) datalen };
+        memcpy(c.data + c.tail, &h, sizeof(h));
+        memcpy(c.data + c.tail + sizeof(h), channel.data(), channel.size());
+        memcpy(c.data + c.tail + sizeof(h) + channel.size(), data, datalen);
+        c.tail += sz;
+        usedBytes += sz;
+        return true;
+    }
+
+    bool empty() const { return usedBytes == 0; }
+    size_t used() const { return usedBytes; }
+    size_t dropped() const { return droppedEvents; }
+
+    // The events of the oldest chunk. Must not be empty()
+    Span front() const
+    {
+        const Chunk& c = chunks.front();
+        Span span;
+        span.begin = c.data + c.head;
+        span.end   = c.data + c.tail;
+        return span;
+    }
+
+    // Frees what front() returned
+    void pop(const Span& span)
+    {
+        Chunk& c = chunks.front();
+        c.head += span.end - span.begin;
+        usedBytes -= span.end - span.begin;
+        if (c.head < c.tail) return;
+
+        c.head = c.tail = 0;
+        if (chunks.size() == 1) return;
+        if (c.cap == CHUNK_BYTES) spare.push_back(c);
+        else release(c);
+        chunks.pop_front();
+    }
+
+    // Makes 'le' refer to the event at 'p' (its channel is copied)
+    static void read(const uint8_t* p, zcm::LogEvent* le)
+    {
+        Header h;
+        memcpy(&h, p, sizeof(h));
+        le->timestamp = h.timestamp;
+        le->channel.assign((const char*) p + sizeof(h), h.channellen);
+        le->datalen   = h.datalen;
+        le->data      = (uint8_t*) p + sizeof(h) + h.channellen;
+    }
+
+    static int64_t timestamp(const uint8_t* p)
+    {
+        Header h;
+        memcpy(&h, p, sizeof(h));
+        return h.timestamp;
+    }
+
+    // Size of the event at 'p'
+    static size_t next(const uint8_t* p)
+    {
+        Header h;
+        memcpy(&h, p, sizeof(h));
+        return size(h.channellen, h.datalen);
+    }
+
+  private:
+    struct Header
+    {
+        int64_t timestamp;
+        u32     channellen;
+        u32     datalen;
+    };
+
+    struct Chunk
+    {
+        uint8_t* data = nullptr;
+        size_t   cap  = 0;
+        size_t   head = 0;
+        size_t   tail = 0;
+    };
+
+    static constexpr size_t CHUNK_BYTES = 4 << 20;
+
+    void release(Chunk& c)
+    {
+        if (hugePages) HugePages::unmap(c.data, c.cap);
+        else           delete[] c.data;
+    }
+
+    static size_t size(size_t channellen, size_t datalen)
+    {
+        return (sizeof(Header) + channellen + datalen + 7) & ~(size_t) 7;
+    }
+
+    bool   hugePages = false;
+    size_t maxBytes  = 0;
+    size_t usedBytes = 0;
+    size_t droppedEvents = 0;
+    deque<Chunk> chunks;
+    vector<Chunk> spare;
+};
+
+// Runs jobs one after the other, in order, on a thread of its own
+struct Background
 {
-    Args   args;
+    Background() : thr([this]() { loop(); }) {}
 
-    string filename;
-    string fname_prefix;
+    ~Background()
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            stop = true;
+        }
+        cond.notify_all();
+        thr.join();
+    }
 
-    zcm::LogFile* log = nullptr;
+    void run(function<void()> job)
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            jobs.push_back(std::move(job));
+        }
+        cond.notify_all();
+    }
 
-    int next_increment_num          = 0;
+    // Waits for every job run so far to be done
+    void wait()
+    {
+        unique_lock<mutex> lock{lk};
+        while (!jobs.empty() || busy) cond.wait(lock);
+    }
 
-    // variables for inverted matching (e.g., logging all but some channels)
-    regex invert_regex;
+  private:
+    void loop()
+    {
+        unique_lock<mutex> lock{lk};
+        while (true) {
+            while (jobs.empty() && !stop) cond.wait(lock);
+            if (jobs.empty()) return;
+            function<void()> job = std::move(jobs.front());
+            jobs.pop_front();
+            busy = true;
+            lock.unlock();
+            job();
+            lock.lock();
+            busy = false;
+            cond.notify_all();
+        }
+    }
+
+    mutex lk;
+    condition_variable cond;
+    deque<function<void()>> jobs;
+    bool busy = false;
+    bool stop = false;
+    thread thr;
+};
+
+// One output file, with the thread that writes it and the events queued for it
+struct Shard
+{
+    string filename;
+    zcm::LogFile* log = nullptr;
 
     // these members controlled by writing
     size_t nevents                  = 0;
@@ -244,36 +535,125 @@ struct Logger
     size_t events_since_last_report = 0;
     u64    last_report_time         = 0;
     size_t last_report_logsize      = 0;
-    u64    time0                    = TimeUtil::utime();
     u64    last_fflush_time         = 0;
+    u64    last_spew_utime          = 0;
 
     size_t dropped_packets_count    = 0;
     u64    last_drop_report_utime   = 0;
     size_t last_drop_report_count   = 0;
 
-    int    num_splits               = 0;
-
-    i64    totalMemoryUsage         = 0;
+    zcm::LogEvent cur;
+    // With several sources, the events held before being written, in
+    // timestamp order. Only touched by the writing thread
+    multimap<int64_t, string> pending;
+    size_t pendingBytes = 0;
 
     mutex lk;
     condition_variable newEventCond;
 
-    queue<zcm::LogEvent*> q;
+    // Filled by the handler, guarded by 'lk'
+    CaptureRing ring;
+
+    ~Shard()
+    {
+        if (log) { log->close(); delete log; }
+    }
+};
+
+struct Logger
+{
+    Args   args;
+
+    // With --shards, the set of all the shards' logs
+    string filename;
+    string fname_prefix;
+
+    vector<Shard*> shards;
+
+    int next_increment_num          = 0;
+
+    // variables for inverted matching (e.g., logging all but some channels)
+    regex invert_regex;
+
+    // --limit-rate and --keep-every, compiled
+    vector<pair<regex, u64>> rate_limits;   // min us between messages logged
+    vector<pair<regex, u32>> keep_every;
+
+    // What the handler decided of a channel the first time it saw it, and
+    // where it is in dropping its messages
+    struct Channel
+    {
+        string name;
+        bool   excluded = false;
+        u64    minIntervalUs = 0;
+        u64    lastLogged = 0;
+        bool   loggedAny = false;
+        u32    keepEvery = 1;
+        u32    seen = 0;
+    };
+
+    // What the handler keeps for each of the URLs logged, as they're all
+    // received at once, each on the thread of its own ZCM
+    struct Source
+    {
+        Logger* logger;
+        zcm::ZCM* zcm = nullptr;
+        // The channels seen so far, keyed by their chan_hash. Channels whose
+        // hash collides with another's are kept by name
+        unordered_map<u32, Channel> channels;
+        unordered_map<string, Channel> collided;
+
+        void handler(const zcm::ReceiveBuffer* rbuf, const string& channel)
+        { logger->handler(*this, rbuf, channel); }
+    };
+    vector<Source*> sources;
+
+    u64    time0                    = TimeUtil::utime();
+    int    num_splits               = 0;
 
     TranscoderPluginDb* pluginDb = nullptr;
     vector<zcm::TranscoderPlugin*> plugins;
+    TranscoderRouter* router = nullptr;
+    zcm::TranscoderOutput transcodedEvents;
+    // Plugins are only ever run on one event at a time
+    mutex pluginLk;
+
+    // With --split-mb, the log to move to on the next split, prepared in the
+    // background along with closing the previous logs. Naming logs happens
+    // there too once logging started
+    struct Spare
+    {
+        zcm::LogFile* log = nullptr;
+        string filename;
+        string openedAs;
+    };
+    mutex spareLk;
+    condition_variable spareCond;
+    Spare spare;
+    bool spareReady = false;
+    Background background;
 
     Logger() {}
 
     ~Logger()
     {
+        background.wait();
+        if (spare.log) {
+            // Never written to
+            delete spare.log;
+            for (const string suffix : { "", ".tidx" })
+                if (FileUtil::exists(spare.openedAs + suffix))
+                    FileUtil::remove(spare.openedAs + suffix);
+        }
+        for (auto* s : sources) {
+            delete s->zcm;
+            delete s;
+        }
+        if (router) { delete router; router = nullptr; }
         if (pluginDb) { delete pluginDb; pluginDb = nullptr; }
-        if (log)      { log->close(); delete log; }
-
-        while (!q.empty()) {
-            delete[] q.front()->data;
-            delete q.front();
-            q.pop();
+        for (auto* s : shards) {
+            if (s->log && args.auto_split_mb > 0) Platform::trimPreallocated(s->log->getFilePtr());
+            delete s;
         }
     }
 
@@ -282,8 +662,16 @@ struct Logger
         if (!args.parse(argc, argv))
             return false;
 
+        for (int i = 0; i < args.shards; ++i) {
+            shards.push_back(new Shard);
+            shards.back()->ring.setMaxBytes(args.max_target_memory / args.shards);
+            shards.back()->ring.setHugePages(args.huge_pages);
+        }
+
         if (!openLogfile())
             return false;
+        if (args.auto_split_mb > 0)
+            background.run([this]() { prepareSpare(); });
 
         // Load plugins from path if specified
         assert(pluginDb == nullptr);
@@ -299,12 +687,17 @@ struct Logger
                 plugins.push_back((zcm::TranscoderPlugin*) dbPlugins[i]);
                 if (args.debug) cout << "Loaded plugin: " << dbPluginNames[i] << endl;
             }
+            router = new TranscoderRouter(plugins);
         }
 
         if (args.debug) return true;
 
         // Compile the regex if we are in invert mode
         if (args.invert_channels) invert_regex = regex{args.chan};
+        for (auto& r : args.rate_limits)
+            rate_limits.emplace_back(regex{r.first}, (u64) (1e6 / r.second));
+        for (auto& k : args.keep_every)
+            keep_every.emplace_back(regex{k.first}, (u32) k.second);
 
         return true;
     }
@@ -321,22 +714,28 @@ struct Logger
         if (!args.quiet) cout << "Rotating log files" << endl;
 
         // delete log files that have fallen off the end of the rotation
-        string tomove = fname_prefix + "." + to_string(args.rotate-1);
-        if (FileUtil::exists(tomove))
-            if (0 != FileUtil::remove(tomove))
-                cerr << "ERROR! Unable to delete [" << tomove << "]" << endl;
+        // (along with their time index)
+        for (const string suffix : { "", ".tidx" }) {
+            string tomove = fname_prefix + "." + to_string(args.rotate-1) + suffix;
+            if (FileUtil::exists(tomove))
+                if (0 != FileUtil::remove(tomove))
+                    cerr << "ERROR! Unable to delete [" << tomove << "]" << endl;
+        }
 
         // Rotate away any existing log files
         for (int file_num = args.rotate-1; file_num >= 0; file_num--) {
-            string newname = fname_prefix + "." + to_string(file_num);
-            string tomove  = fname_prefix + "." + to_string(file_num-1);
-            if (FileUtil::exists(tomove))
-                if (0 != FileUtil::rename(tomove, newname))
-                    cerr << "ERROR!  Unable to rotate [" << tomove << "]" << endl;
+            for (const string suffix : { "", ".tidx" }) {
+                string newname = fname_prefix + "." + to_string(file_num) + suffix;
+                string tomove  = fname_prefix + "." + to_string(file_num-1) + suffix;
+                if (FileUtil::exists(tomove))
+                    if (0 != FileUtil::rename(tomove, newname))
+                        cerr << "ERROR!  Unable to rotate [" << tomove << "]" << endl;
+            }
         }
     }
 
-    bool openLogfile()
+    // Picks the next log file name, in 'filename'
+    bool nextFilename()
     {
         char tmp_path[PATH_MAX];
 
@@ -382,178 +781,371 @@ struct Logger
         string dirpart = FileUtil::dirname(filename);
         if (!FileUtil::dirExists(dirpart))
             FileUtil::mkdirWithParents(dirpart, 0755);
+        return true;
+    }
+
+    bool openLogfile()
+    {
+        if (!nextFilename()) return false;
 
-        if (!args.quiet) cout << "Opening log file \"" << filename << "\"" << endl;
+        if (shards.size() == 1) return openShard(*shards[0], filename);
 
+        // Shards are written next to their set, as FILE.s0, FILE.s1, ...
+        string base = filename.substr(filename.rfind('/') + 1);
+        vector<string> names;
+        for (size_t i = 0; i < shards.size(); ++i) {
+            names.push_back(base + ".s" + to_string(i));
+            if (!openShard(*shards[i], filename + ".s" + to_string(i))) return false;
+        }
+        vector<const char*> cnames;
+        for (auto& n : names) cnames.push_back(n.c_str());
+        if (zcm_eventlog_write_set(filename.c_str(), cnames.data(), cnames.size()) != 0) {
+            perror("Error: unable to write the set of shards");
+            return false;
+        }
+        return true;
+    }
+
+    bool openShard(Shard& s, const string& fname)
+    {
+        s.filename = fname;
         // open output file in append mode if we're rotating log files, or write
         // mode if not.
-        log = new zcm::LogFile(filename, (args.rotate > 0) ? "a" : "w");
+        s.log = openLog(fname, (args.rotate > 0) ? "a" : "w");
+        return s.log != nullptr;
+    }
+
+    zcm::LogFile* openLog(const string& fname, const char* mode)
+    {
+        if (!args.quiet) cout << "Opening log file \"" << fname << "\"" << endl;
+
+        zcm::LogFile* log = new zcm::LogFile(fname, mode);
         if (!log->good()) {
             perror("Error: fopen failed");
             delete log;
-            return false;
+            return nullptr;
         }
-        return true;
+        // Files that will be split are allocated up front, so that their
+        // writes don't have to find room on the disk
+        if (args.auto_split_mb > 0)
+            Platform::preallocate(log->getFilePtr(), args.auto_split_mb * (1 << 20));
+        if (args.index_mb > 0 && log->enableIndex(0, args.index_mb * (1 << 20)) != 0)
+            cerr << "Unable to write the time index of \"" << fname << "\"" << endl;
+        if (args.compress && log->enableCompression(1, 1 << 20) != 0)
+            cerr << "Unable to compress \"" << fname << "\"" << endl;
+        if (args.channel_ids && log->enableChannelIds() != 0)
+            cerr << "Unable to write channel ids to \"" << fname << "\"" << endl;
+        if (args.write_buffers > 0 &&
+            (log->setWriteBuffer(1 << 20) != 0 || log->enableAsyncWrites(args.write_buffers) != 0))
+            cerr << "Unable to write \"" << fname << "\" asynchronously" << endl;
+        return log;
     }
 
-    void handler(const zcm::ReceiveBuffer* rbuf, const string& channel)
+    // Opens the log that the next split moves to. Runs in the background
+    void prepareSpare()
     {
-        if (args.invert_channels) {
-            cmatch match;
-            regex_match(channel.c_str(), match, invert_regex);
-            if (match.size() > 0) return;
+        Spare next;
+        if (nextFilename()) {
+            // With --rotate, the name it gets is only free once rotated
+            next.filename = filename;
+            next.openedAs = args.rotate > 0 ? fname_prefix + ".next" : filename;
+            next.log = openLog(next.openedAs, "w");
         }
+        {
+            unique_lock<mutex> lock{spareLk};
+            spare = next;
+            spareReady = true;
+        }
+        spareCond.notify_all();
+    }
 
-        vector<zcm::LogEvent*> evts;
+    // Moves shard 's' to the spare log, leaving the old one to be closed
+    // (and the files rotated) in the background
+    bool split(Shard& s)
+    {
+        Spare next;
+        {
+            // Normally prepared long ago
+            unique_lock<mutex> lock{spareLk};
+            while (!spareReady) spareCond.wait(lock);
+            next = spare;
+            spare = Spare();
+            spareReady = false;
+        }
+        if (!next.log) return false;
+
+        zcm::LogFile* old = s.log;
+        s.log = next.log;
+        s.filename = next.filename;
+
+        background.run([this, old, next]() {
+            old->flush(true);
+            Platform::trimPreallocated(old->getFilePtr());
+            delete old;
+            if (args.rotate <= 0) return;
+            rotate_logfiles();
+            for (const string suffix : { "", ".tidx" })
+                if (FileUtil::exists(next.openedAs + suffix) &&
+                    0 != FileUtil::rename(next.openedAs + suffix, next.filename + suffix))
+                    cerr << "ERROR!  Unable to rename [" << next.openedAs + suffix << "]" << endl;
+        });
+        background.run([this]() { prepareSpare(); });
+        return true;
+    }
 
-        zcm::LogEvent* le = new zcm::LogEvent;
-        le->timestamp = rbuf->recv_utime;
-        le->channel   = channel;
-        le->datalen   = rbuf->data_size;
+    // Only evaluates the regexes once per channel
+    Channel& channelOf(Source& src, const zcm::ReceiveBuffer* rbuf, const string& channel)
+    {
+        u32 hash = rbuf->chan_hash ? rbuf->chan_hash : zcm_channel_hash(channel.c_str());
+        auto it = src.channels.find(hash);
+        if (it != src.channels.end() && it->second.name == channel) return it->second;
 
-        if (!plugins.empty()) {
-            le->data = rbuf->data;
+        Channel* c;
+        if (it == src.channels.end()) {
+            c = &src.channels[hash];
+        } else {
+            auto col = src.collided.find(channel);
+            if (col != src.collided.end()) return col->second;
+            c = &src.collided[channel];
+        }
+        c->name = channel;
+        c->excluded = args.invert_channels && regex_match(channel, invert_regex);
+        for (auto& r : rate_limits) {
+            if (!regex_match(channel, r.first)) continue;
+            c->minIntervalUs = r.second;
+            break;
+        }
+        for (auto& k : keep_every) {
+            if (!regex_match(channel, k.first)) continue;
+            c->keepEvery = k.second;
+            break;
+        }
+        return *c;
+    }
+
+    // Whether the message just received on 'c' is to be logged, before it
+    // costs anything more than this
+    static bool isLogged(Channel& c, u64 utime)
+    {
+        if (c.excluded) return false;
+        if (c.keepEvery > 1 && c.seen++ % c.keepEvery != 0) return false;
+        if (c.minIntervalUs > 0) {
+            if (c.loggedAny && utime - c.lastLogged < c.minIntervalUs) return false;
+            c.lastLogged = utime;
+            c.loggedAny = true;
+        }
+        return true;
+    }
+
+    // Channels always go to the same shard
+    Shard& shardOf(const zcm::ReceiveBuffer* rbuf, const string& channel)
+    {
+        if (shards.size() == 1) return *shards[0];
+        u32 hash = rbuf->chan_hash ? rbuf->chan_hash : zcm_channel_hash(channel.c_str());
+        return *shards[hash % shards.size()];
+    }
 
+    void handler(Source& src, const zcm::ReceiveBuffer* rbuf, const string& channel)
+    {
+        if ((args.invert_channels || !rate_limits.empty() || !keep_every.empty()) &&
+            !isLogged(channelOf(src, rbuf, channel), rbuf->recv_utime)) return;
+
+        // Plugins transcode events into transcodedEvents, reused from one
+        // message to the next
+        bool transcoded = false;
+        if (router) {
+            unique_lock<mutex> lock{pluginLk};
             int64_t msg_hash;
-            __int64_t_decode_array(le->data, 0, 8, &msg_hash, 1);
-
-            for (auto& p : plugins) {
-                vector<const zcm::LogEvent*> pevts =
-                    p->transcodeEvent((uint64_t) msg_hash, le);
-                for (auto* evt : pevts)
-                    if (evt) evts.emplace_back(cloneLogEvent(evt));
-                    else     evts.emplace_back(nullptr);
+            __int64_t_decode_array(rbuf->data, 0, 8, &msg_hash, 1);
+            const auto& route = router->route(msg_hash);
+
+            zcm::LogEvent le;
+            if (!route.empty()) {
+                le.timestamp = rbuf->recv_utime;
+                le.channel   = channel;
+                le.datalen   = rbuf->data_size;
+                le.data      = rbuf->data;
+            }
+
+            transcodedEvents.clear();
+            for (auto& p : route)
+                if (p->transcodeEventInto((uint64_t) msg_hash, &le, transcodedEvents))
+                    transcoded = true;
+
+            for (size_t i = 0; i < transcodedEvents.size(); ++i) {
+                const zcm::LogEvent* evt = transcodedEvents[i];
+                Shard& s = shards.size() == 1 ? *shards[0] :
+                    *shards[zcm_channel_hash(evt->channel.c_str()) % shards.size()];
+                push(s, evt->timestamp, evt->channel, evt->data, evt->datalen);
             }
         }
 
-        if (evts.empty()) {
-            le->data = new uint8_t[rbuf->data_size];
-            memcpy(le->data, rbuf->data, sizeof(uint8_t) * rbuf->data_size);
-            evts.push_back(le);
-        } else {
-            delete le;
+        if (!transcoded)
+            push(shardOf(rbuf, channel), rbuf->recv_utime, channel, rbuf->data, rbuf->data_size);
+    }
+
+    void push(Shard& s, int64_t timestamp, const string& channel,
+              const uint8_t* data, int32_t datalen)
+    {
+        {
+            unique_lock<mutex> lock{s.lk};
+            if (!s.ring.push(timestamp, channel, data, datalen)) {
+                ZCM_DEBUG("Dropping message due to enforced memory constraints");
+                ZCM_DEBUG("Current memory usage is at %zu bytes", s.ring.used());
+                return;
+            }
         }
+        s.newEventCond.notify_all();
+    }
+
+    // Sources are received on threads of their own, so their events can be
+    // queued slightly out of order: with several of them, events are held for
+    // this long in 'pending', in timestamp order, before being written
+    static constexpr i64 REORDER_US = 250000;
 
-        bool stillRoom = true;
+    void flushSortedWhenReady(Shard& s)
+    {
+        CaptureRing::Span span;
+        i64 memUsed = 0;
         {
-            unique_lock<mutex> lock{lk};
-            while (!evts.empty()) {
-                if (stillRoom) {
-                    zcm::LogEvent* le = evts.back();
-                    if (!le) {
-                        evts.pop_back();
-                        continue;
-                    }
-                    q.push(le);
-                    totalMemoryUsage += le->datalen + le->channel.size() + sizeof(*le);
-                    stillRoom = (args.max_target_memory == 0) ? true :
-                        (totalMemoryUsage + rbuf->data_size < args.max_target_memory);
-                    evts.pop_back();
-                } else {
-                    ZCM_DEBUG("Dropping message due to enforced memory constraints");
-                    ZCM_DEBUG("Current memory estimations are at %" PRId64 " bytes",
-                              totalMemoryUsage);
-                    while (!evts.empty()) {
-                        delete[] evts.back()->data;
-                        delete evts.back();
-                        evts.pop_back();
-                    }
-                    break;
-                }
+            unique_lock<mutex> lock{s.lk};
+            while (s.ring.empty() && !done) {
+                if (s.pending.empty()) s.newEventCond.wait(lock);
+                else if (s.newEventCond.wait_for(lock, chrono::microseconds(REORDER_US / 4)) ==
+                         cv_status::timeout) break;
             }
+            if (!s.ring.empty()) {
+                span = s.ring.front();
+                memUsed = s.ring.used();
+                s.dropped_packets_count = s.ring.dropped();
+            }
+        }
+
+        for (const uint8_t* p = span.begin; p < span.end; p += CaptureRing::next(p)) {
+            // Events with the same timestamp stay in the order they came in
+            size_t sz = CaptureRing::next(p);
+            s.pending.emplace_hint(s.pending.end(), CaptureRing::timestamp(p),
+                                   string((const char*) p, sz));
+            s.pendingBytes += sz;
+        }
+        if (span.begin) {
+            unique_lock<mutex> lock{s.lk};
+            s.ring.pop(span);
+        }
+
+        // Everything is written out once done
+        i64 until = TimeUtil::utime() - REORDER_US;
+        while (!s.pending.empty() && (done || s.pending.begin()->first <= until)) {
+            const string& rec = s.pending.begin()->second;
+            CaptureRing::read((const uint8_t*) rec.data(), &s.cur);
+            writeEvent(s, &s.cur, memUsed + s.pendingBytes);
+            s.pendingBytes -= rec.size();
+            s.pending.erase(s.pending.begin());
         }
-        newEventCond.notify_all();
     }
 
-    void flushWhenReady()
+    void flushWhenReady(Shard& s)
     {
-        zcm::LogEvent *le = nullptr;
-        size_t qSize = 0;
+        if (sources.size() > 1) return flushSortedWhenReady(s);
+
+        CaptureRing::Span span;
         i64 memUsed = 0;
         {
-            unique_lock<mutex> lock{lk};
+            unique_lock<mutex> lock{s.lk};
 
-            while (q.empty()) {
+            while (s.ring.empty()) {
                 if (done) return;
-                newEventCond.wait(lock);
+                s.newEventCond.wait(lock);
             }
             if (done) return;
 
-            le = q.front();
-            q.pop();
-            qSize = q.size();
-            memUsed = totalMemoryUsage; // want to capture the max mem used, not post flush
-            totalMemoryUsage -= (le->datalen + le->channel.size() + sizeof(*le));
+            span = s.ring.front();
+            memUsed = s.ring.used(); // want to capture the max mem used, not post flush
+            s.dropped_packets_count = s.ring.dropped();
+        }
+
+        // The handler only appends past the span, so it's read without the lock
+        size_t n = 0;
+        for (const uint8_t* p = span.begin; p < span.end; p += CaptureRing::next(p), ++n) {
+            CaptureRing::read(p, &s.cur);
+            writeEvent(s, &s.cur, memUsed);
         }
-        if (qSize != 0) ZCM_DEBUG("Queue size = %zu\n", qSize);
+        if (n > 1) ZCM_DEBUG("Wrote %zu queued events\n", n);
+
+        unique_lock<mutex> lock{s.lk};
+        s.ring.pop(span);
+    }
 
+    void writeEvent(Shard& s, const zcm::LogEvent* le, i64 memUsed)
+    {
         // Is it time to start a new logfile?
         if (args.auto_split_mb) {
-            double logsize_mb = (double)logsize / (1 << 20);
+            double logsize_mb = (double)s.logsize / (1 << 20);
             if (logsize_mb > args.auto_split_mb) {
-                // Yes.  open up a new log file
-                log->close();
-                if (args.rotate > 0)
-                    rotate_logfiles();
-                if (!openLogfile()) exit(1);
+                // Yes.  move to the next log file
+                if (!split(s)) exit(1);
                 num_splits++;
-                logsize = 0;
-                last_report_logsize = 0;
+                s.logsize = 0;
+                s.last_report_logsize = 0;
             }
         }
 
-        if (log->writeEvent(le) != 0) {
-            static u64 last_spew_utime = 0;
+        if (s.log->writeEvent(le) != 0) {
             string reason = strerror(errno);
             u64 now = TimeUtil::utime();
-            if (now - last_spew_utime > 500000) {
+            if (now - s.last_spew_utime > 500000) {
                 cerr << "zcm_eventlog_write_event: " << reason << endl;
-                last_spew_utime = now;
+                s.last_spew_utime = now;
             }
             if (errno == ENOSPC)
                 exit(1);
 
-            delete[] le->data;
-            delete le;
             return;
         }
 
         if (args.fflush_interval_ms >= 0 &&
-            (le->timestamp - last_fflush_time) > (u64)args.fflush_interval_ms * 1000) {
-            Platform::fflush(log->getFilePtr());
-            last_fflush_time = le->timestamp;
+            (le->timestamp - s.last_fflush_time) > (u64)args.fflush_interval_ms * 1000) {
+            if (s.log->flush(true) != 0)
+                cerr << "Unable to flush the log: " << strerror(errno) << endl;
+            s.last_fflush_time = le->timestamp;
         }
 
         // bookkeeping, cleanup
-        nevents++;
-        events_since_last_report++;
-        logsize += 4 + 8 + 8 + 4 + le->channel.size() + 4 + le->datalen;
+        s.nevents++;
+        s.events_since_last_report++;
+        s.logsize += 4 + 8 + 8 + 4 + le->channel.size() + 4 + le->datalen;
 
         i64 offset_utime = le->timestamp - time0;
-        if (!args.quiet && (offset_utime - last_report_time > 1000000)) {
-            double dt = (offset_utime - last_report_time)/1000000.0;
+        if (!args.quiet && (offset_utime - s.last_report_time > 1000000)) {
+            double dt = (offset_utime - s.last_report_time)/1000000.0;
 
-            double tps =  events_since_last_report / dt;
-            double kbps = (logsize - last_report_logsize) / dt / 1024.0;
+            double tps =  s.events_since_last_report / dt;
+            double kbps = (s.logsize - s.last_report_logsize) / dt / 1024.0;
             printf("Summary: %s ti:%4" PRId64 " sec  |  Events: %-9zu ( %4zu MB )  |  "
                    "TPS: %8.2f  |  KB/s: %8.2f  |  Buf Size: % 8" PRId64 " KB\n",
-                   filename.c_str(),
+                   s.filename.c_str(),
                    offset_utime / 1000000,
-                   nevents, logsize/1048576,
+                   s.nevents, s.logsize/1048576,
                    tps, kbps, memUsed / 1024);
-            last_report_time = offset_utime;
-            events_since_last_report = 0;
-            last_report_logsize = logsize;
+            s.last_report_time = offset_utime;
+            s.events_since_last_report = 0;
+            s.last_report_logsize = s.logsize;
+
+            if (s.dropped_packets_count != s.last_drop_report_count) {
+                printf("Dropped %zu messages over the memory limit\n",
+                       s.dropped_packets_count - s.last_drop_report_count);
+                s.last_drop_report_utime = offset_utime;
+                s.last_drop_report_count = s.dropped_packets_count;
+            }
         }
-
-        delete[] le->data;
-        delete le;
     }
 
     void wakeup()
     {
-        unique_lock<mutex> lock(lk);
-        newEventCond.notify_all();
+        for (auto* s : shards) {
+            unique_lock<mutex> lock(s->lk);
+            s->newEventCond.notify_all();
+        }
     }
 };
 
@@ -573,32 +1165,49 @@ int main(int argc, char *argv[])
     if (!logger.init(argc, argv)) return 1;
 
     // begin logging
-    zcm::ZCM zcmLocal(logger.args.zcmurl);
-    if (!zcmLocal.good()) {
-        cerr << "Couldn't initialize ZCM!" << endl;
-        if (logger.args.zcmurl != "") {
-            cerr << "Unable to parse url: " << logger.args.zcmurl << endl;
-            cerr << "Try running with ZCM_DEBUG=1 for more info" << endl;
-        } else {
-            cerr << "Please provide a valid zcm url either with the ZCM_DEFAULT_URL" << endl
-                 << "environment variable, or with the '-u' command line argument." << endl;
+    vector<string> urls = logger.args.zcmurls;
+    if (urls.empty()) urls.push_back("");
+    for (const string& url : urls) {
+        Logger::Source* src = new Logger::Source;
+        src->logger = &logger;
+        src->zcm = new zcm::ZCM(url);
+        logger.sources.push_back(src);
+        if (!src->zcm->good()) {
+            cerr << "Couldn't initialize ZCM!" << endl;
+            if (url != "") {
+                cerr << "Unable to parse url: " << url << endl;
+                cerr << "Try running with ZCM_DEBUG=1 for more info" << endl;
+            } else {
+                cerr << "Please provide a valid zcm url either with the ZCM_DEFAULT_URL" << endl
+                     << "environment variable, or with the '-u' command line argument." << endl;
+            }
+            return 1;
         }
-        return 1;
+        src->zcm->subscribe(logger.getSubChannel(), &Logger::Source::handler, src);
     }
 
-    zcmLocal.subscribe(logger.getSubChannel(), &Logger::handler, &logger);
-
     // Register signal handlers
     signal(SIGINT,  sighandler);
     signal(SIGQUIT, sighandler);
     signal(SIGTERM, sighandler);
 
-    zcmLocal.start();
+    for (auto* src : logger.sources) src->zcm->start();
 
-    while (!done) logger.flushWhenReady();
-
-    zcmLocal.stop();
-    zcmLocal.flush();
+    // The first shard is written from here, the others from threads of their own
+    vector<thread> writers;
+    for (size_t i = 1; i < logger.shards.size(); ++i) {
+        Shard* s = logger.shards[i];
+        writers.emplace_back([s]() { while (!done) logger.flushWhenReady(*s); });
+    }
+    while (!done) logger.flushWhenReady(*logger.shards[0]);
+    for (auto& w : writers) w.join();
+    // What may still be held back to be written in order
+    for (auto* s : logger.shards) if (!s->pending.empty()) logger.flushWhenReady(*s);
+
+    for (auto* src : logger.sources) {
+        src->zcm->stop();
+        src->zcm->flush();
+    }
 
     cerr << "Logger exiting" << endl;
 
@@ -8,17 +8,28 @@
 #else
 # include <sys/time.h>
 # include <unistd.h>
+# include <fcntl.h>
 # include <linux/limits.h>
+# include <linux/falloc.h>
 #endif
 
 struct Platform
 {
-    static inline void fflush(FILE *fp)
+    // Reserves room on the disk for 'bytes' of the file without changing its
+    // size, so that appends don't need to allocate. Only a hint
+    static inline void preallocate(FILE *fp, off_t bytes)
     {
-        ::fflush(fp);
 #ifndef WIN32
-        // Perform a full fsync operation after flush
-        fdatasync(fileno(fp));
+        (void) fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, 0, bytes);
+#endif
+    }
+
+    // Gives back what preallocate() reserved past the end of the file
+    static inline void trimPreallocated(FILE *fp)
+    {
+#ifndef WIN32
+        fseeko(fp, 0, SEEK_END);
+        (void) ftruncate(fileno(fp), ftello(fp));
 #endif
     }
 
@@ -8,6 +8,14 @@
 #include <unistd.h>
 #include <limits>
 #include <unordered_map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <set>
 
 #include <zcm/zcm-cpp.hpp>
 
@@ -34,6 +42,11 @@ struct Args
     string jslpFilename = "";
     zcm::Json::Value jslpRoot;
     string outfile = "";
+    size_t lockstep = 0;
+    uint64_t lockstepSliceUs = 0;
+    double lockstepTimeout = 10;
+    size_t loops = 1;
+    bool cache = false;
 
     bool init(int argc, char *argv[])
     {
@@ -44,17 +57,27 @@ struct Args
             { "zcm-url", required_argument, 0, 'u' },
             { "jslp",    required_argument, 0, 'j' },
             { "verbose",       no_argument, 0, 'v' },
+            { "lockstep",         required_argument, 0, 'l' },
+            { "lockstep-slice",   required_argument, 0, 'L' },
+            { "lockstep-timeout", required_argument, 0, 'T' },
+            { "loops",   required_argument, 0, 'n' },
+            { "cache",         no_argument, 0, 'c' },
             { 0, 0, 0, 0 }
         };
 
         int c;
-        while ((c = getopt_long(argc, argv, "ho:s:u:j:v", long_opts, 0)) >= 0) {
+        while ((c = getopt_long(argc, argv, "ho:s:u:j:vl:L:T:n:c", long_opts, 0)) >= 0) {
             switch (c) {
                 case 'o':      outfile = string(optarg);       break;
                 case 's':        speed = strtod(optarg, NULL); break;
                 case 'u':    zcmUrlOut = string(optarg);       break;
                 case 'j': jslpFilename = string(optarg);       break;
                 case 'v':      verbose = true;                 break;
+                case 'l':        lockstep = strtoul(optarg, NULL, 10);            break;
+                case 'L': lockstepSliceUs = strtod(optarg, NULL) * 1e6;           break;
+                case 'T': lockstepTimeout = strtod(optarg, NULL);                 break;
+                case 'n':           loops = strtoul(optarg, NULL, 10);            break;
+                case 'c':           cache = true;                                 break;
                 case 'h': default: usage(); return false;
             };
         }
@@ -67,6 +90,11 @@ struct Args
 
         filename = string(argv[optind]);
 
+        if (lockstep > 0 && outfile != "") {
+            cerr << "Lockstep replays need consumers: they can't go to an output file" << endl;
+            return false;
+        }
+
         ifstream jslpFile { jslpFilename != "" ? jslpFilename : filename + ".jslp" };
         if (jslpFile.good()) {
             zcm::Json::Reader reader;
@@ -114,11 +142,176 @@ struct Args
              << "                         with the same filename as the input log and " << endl
              << "                         a .jslp suffix" << endl
              << "  -v, --verbose          Print information about each packet." << endl
+             << "  -l, --lockstep=N       Wait for N consumers to acknowledge each message" << endl
+             << "                         before publishing the next one (see" << endl
+             << "                         docs/tools.md for the protocol). Also waits for" << endl
+             << "                         them before publishing anything." << endl
+             << "  -L, --lockstep-slice=SEC" << endl
+             << "                         With --lockstep, only wait between messages" << endl
+             << "                         logged at least this far apart." << endl
+             << "  -T, --lockstep-timeout=SEC" << endl
+             << "                         Give up if the consumers haven't acknowledged" << endl
+             << "                         within this long. 0 waits forever. Default is 10." << endl
+             << "  -n, --loops=N          Play the log N times over, back to back. 0 loops" << endl
+             << "                         until interrupted. Default is 1." << endl
+             << "  -c, --cache            Load the messages to play (those left by the jslp" << endl
+             << "                         file) into memory once, and play them from there," << endl
+             << "                         free of the disk: for logs looped over that fit" << endl
+             << "                         in memory." << endl
              << "  -h, --help             Shows some help text and exits." << endl
              << endl;
     }
 };
 
+// Reads the events of a log ahead of their playback, on a thread of its own,
+// into a ring of 'size' copies that are reused
+struct Prefetcher
+{
+    Prefetcher(zcm::LogFile* in, size_t size) : in(in), slots(size)
+    {
+        thr = thread([this]() { loop(); });
+    }
+
+    ~Prefetcher()
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            stop = true;
+        }
+        cond.notify_all();
+        thr.join();
+    }
+
+    // Same as LogFile::readNextEvent(): the event is valid until the next call
+    const zcm::LogEvent* next()
+    {
+        unique_lock<mutex> lock{lk};
+        if (holding) {
+            holding = false;
+            head = (head + 1) % slots.size();
+            count--;
+            cond.notify_all();
+        }
+        while (count == 0 && !ended) cond.wait(lock);
+        if (count == 0) return nullptr;
+        holding = true;
+        return &slots[head].le;
+    }
+
+  private:
+    struct Slot
+    {
+        zcm::LogEvent le;
+        vector<uint8_t> data;
+    };
+
+    void loop()
+    {
+        while (true) {
+            size_t tail;
+            {
+                unique_lock<mutex> lock{lk};
+                while (count == slots.size() && !stop) cond.wait(lock);
+                if (stop) return;
+                tail = (head + count) % slots.size();
+            }
+
+            // Only this thread touches the slot after the ones queued
+            const zcm::LogEvent* le = in->readNextEvent();
+            Slot& s = slots[tail];
+            if (le) {
+                s.le.eventnum  = le->eventnum;
+                s.le.timestamp = le->timestamp;
+                s.le.channel   = le->channel;
+                s.le.datalen   = le->datalen;
+                s.data.assign(le->data, le->data + le->datalen);
+                s.le.data      = s.data.data();
+            }
+
+            unique_lock<mutex> lock{lk};
+            if (le) count++;
+            else ended = true;
+            cond.notify_all();
+            if (ended) return;
+        }
+    }
+
+    zcm::LogFile* in;
+    vector<Slot> slots;
+    size_t head = 0;
+    size_t count = 0;
+    bool holding = false;
+    bool ended = false;
+    bool stop = false;
+    mutex lk;
+    condition_variable cond;
+    thread thr;
+};
+
+// Lockstep replays: after every message (or time slice) the player publishes
+// a sequence number on LOCKSTEP_CHANNEL, and waits for every consumer to have
+// answered on LOCKSTEP_ACK_CHANNEL with the same 8 bytes, followed by a name
+// of its own. Consumers answer once they've handled all they received before
+// it. The number is published again until then, in case it was lost
+#define LOCKSTEP_CHANNEL     "ZCM_LOCKSTEP"
+#define LOCKSTEP_ACK_CHANNEL "ZCM_LOCKSTEP_ACK"
+static const chrono::milliseconds LOCKSTEP_RESEND(100);
+
+struct Lockstep
+{
+    zcm::ZCM* zcm;
+    size_t consumers;
+    double timeout;
+
+    uint64_t seqno = 0;
+    mutex lk;
+    condition_variable cond;
+    set<string> acked;
+
+    Lockstep(zcm::ZCM* zcm, size_t consumers, double timeout) :
+        zcm(zcm), consumers(consumers), timeout(timeout)
+    {
+        zcm->subscribe(LOCKSTEP_ACK_CHANNEL, &Lockstep::handle, this);
+    }
+
+    static void handle(const zcm::ReceiveBuffer* rbuf, const string& channel, void* usr)
+    {
+        Lockstep* me = (Lockstep*) usr;
+        if (rbuf->data_size < 8) return;
+        uint64_t seqno = 0;
+        for (int i = 0; i < 8; ++i) seqno = (seqno << 8) | rbuf->data[i];
+
+        unique_lock<mutex> lk(me->lk);
+        if (seqno != me->seqno) return;
+        me->acked.insert(string((const char*) rbuf->data + 8, rbuf->data_size - 8));
+        if (me->acked.size() >= me->consumers) me->cond.notify_all();
+    }
+
+    // Returns false if the consumers didn't all acknowledge in time
+    bool sync()
+    {
+        uint8_t buf[8];
+        unique_lock<mutex> lk(this->lk);
+        seqno++;
+        acked.clear();
+        for (int i = 0; i < 8; ++i) buf[i] = (uint8_t) (seqno >> (56 - 8 * i));
+
+        auto deadline = chrono::steady_clock::now() + chrono::duration<double>(timeout);
+        while (acked.size() < consumers && !done) {
+            if (timeout > 0 && chrono::steady_clock::now() >= deadline) {
+                cerr << "Only " << acked.size() << " of " << consumers
+                     << " lockstep consumers acknowledged message " << seqno << endl;
+                return false;
+            }
+            lk.unlock();
+            zcm->publish(LOCKSTEP_CHANNEL, buf, sizeof(buf));
+            lk.lock();
+            cond.wait_for(lk, LOCKSTEP_RESEND, [&](){ return acked.size() >= consumers; });
+        }
+        return !done;
+    }
+};
+
 struct LogPlayer
 {
     Args args;
@@ -141,6 +334,37 @@ struct LogPlayer
 
     unordered_map<string, bool> channelMap;
 
+    // State of the pass through the log being played
+    bool startedPub = false;
+    uint64_t firstMsgUtime = UINT64_MAX;
+
+    // Messages are published once the consumers are all there, and again
+    // once they're done with all of the previous slice
+    unique_ptr<Lockstep> lockstep;
+    bool sliceStarted = false;
+    int64_t sliceStartUtime = 0;
+
+    int err = 0;
+
+    // With --cache, the messages to play: their channel (in 'channels') and
+    // data (in 'buf') along with when to publish them, from the first one
+    struct CachedEvent
+    {
+        int64_t  timestamp;
+        uint64_t deltaNs;
+        uint32_t channel;
+        int32_t  datalen;
+        size_t   data;
+    };
+    vector<CachedEvent> cachedEvents;
+    vector<string> channels;
+    vector<uint8_t> buf;
+
+    // Events are published at an absolute deadline: when the first one
+    // was, plus how much later than it they were logged (over the speed).
+    // Sleeps are cut short by this much, the rest being spun away
+    static const uint64_t SPIN_NS = 50000;
+
     LogPlayer() { }
 
     ~LogPlayer()
@@ -264,102 +488,194 @@ struct LogPlayer
         return true;
     }
 
-    int run()
+    // Returns whether the event is to be published, following the start and
+    // filter of the jslp file
+    bool selected(const zcm::LogEvent* le)
     {
-        int err = 0;
+        if (firstMsgUtime == UINT64_MAX)
+            firstMsgUtime = (uint64_t) le->timestamp;
+
+        if (!startedPub) {
+            if (startMode == StartMode::CHANNEL) {
+                if (le->channel == startChan)
+                    startedPub = true;
+            } else if (startMode == StartMode::US_DELAY) {
+                if ((uint64_t) le->timestamp > firstMsgUtime + startDelayUs)
+                    startedPub = true;
+            }
+        }
+        if (!startedPub) return false;
+        if (!filtering) return true;
+
+        if (filterType == FilterType::CHANNELS) {
+            if (filterMode == FilterMode::WHITELIST) {
+                return channelMap.count(le->channel) > 0;
+            } else if (filterMode == FilterMode::BLACKLIST) {
+                return channelMap.count(le->channel) == 0;
+            } else if (filterMode == FilterMode::SPECIFIED) {
+                if (channelMap.count(le->channel) == 0) {
+                    cerr << "jslp file does not specify filtering behavior "
+                         << "for channel: " << le->channel << endl;
+                    done = true;
+                    err = 1;
+                    return false;
+                }
+                return channelMap[le->channel];
+            } else {
+                assert(false && "Fatal error.");
+            }
+        } else {
+            assert(false && "Fatal error.");
+        }
+        return false;
+    }
 
-        uint64_t firstMsgUtime = UINT64_MAX;
-        uint64_t lastMsgUtime = 0;
-        uint64_t lastDispatchUtime = 0;
-        bool startedPub = false;
+    void publish(int64_t timestamp, const string& channel, const uint8_t* data, int32_t datalen)
+    {
+        if (lockstep) {
+            if (sliceStarted &&
+                (uint64_t) (timestamp - sliceStartUtime) >= args.lockstepSliceUs) {
+                if (!lockstep->sync()) {
+                    done = true;
+                    err = 1;
+                    return;
+                }
+                sliceStarted = false;
+            }
+            if (!sliceStarted) {
+                sliceStarted = true;
+                sliceStartUtime = timestamp;
+            }
+        }
 
-        if (startMode == StartMode::NUM_MODES) startedPub = true;
+        if (args.verbose)
+            printf("%.3f Channel %-20s size %d\n", timestamp / 1e6, channel.c_str(), datalen);
+
+        if (args.outfile == "") {
+            zcmOut->publish(channel, data, datalen);
+        } else {
+            zcm::LogEvent le;
+            le.eventnum = 0;
+            le.timestamp = timestamp;
+            le.channel = channel;
+            le.datalen = datalen;
+            le.data = (uint8_t*) data;
+            logOut->writeEvent(&le);
+        }
+    }
+
+    // Plays the log once, from the disk
+    void playLog()
+    {
+        int64_t firstPubUtime = -1;
+        uint64_t firstPubNs = 0;
+
+        Prefetcher prefetcher(zcmIn, 4096);
 
         while (!done) {
-            const zcm::LogEvent* le = zcmIn->readNextEvent();
-            if (!le) {
-                done = true;
-                continue;
+            const zcm::LogEvent* le = prefetcher.next();
+            if (!le) break;
+
+            if (startedPub && !std::isinf(args.speed)) {
+                if (firstPubUtime < 0) {
+                    firstPubUtime = le->timestamp;
+                    firstPubNs = TimeUtil::monoNs();
+                } else if (le->timestamp > firstPubUtime) {
+                    double logDiffNs = (le->timestamp - firstPubUtime) * 1e3 / args.speed;
+                    TimeUtil::sleepUntilNs(firstPubNs + (uint64_t) logDiffNs, SPIN_NS);
+                }
             }
 
-            uint64_t now = TimeUtil::utime();
-
-            if (lastMsgUtime == 0)
-                lastMsgUtime = le->timestamp;
-
-            if (lastDispatchUtime == 0)
-                lastDispatchUtime = now;
-
-            if (firstMsgUtime == UINT64_MAX)
-                firstMsgUtime = (uint64_t) le->timestamp;
-
-            uint64_t localDiff = now - lastDispatchUtime;
-            uint64_t logDiff = (uint64_t) le->timestamp - lastMsgUtime;
-            uint64_t logDiffSpeed = logDiff / args.speed;
-            uint64_t diff = logDiffSpeed > localDiff ? logDiffSpeed - localDiff
-                                                     : 0;
-            // TODO: this doesn't reproduce the input frequency perfectly but that is likely
-            //       due to the difficulty of accurately timing events with the OS scheduler
-            //       active. If it becomes an issue in the future, we could devote more time
-            //       to improving the loop timing accuracy.
-            //       Note that this inaccuracy does not apply if you are filting a log into
-            //       a different log via a jslp file because the log times are preserved.
-            //       Possible resource: http://www.tldp.org/HOWTO/IO-Port-Programming-4.html
-            timespec delay;
-            delay.tv_sec = (long int) diff / 1000000;
-            delay.tv_nsec = (long int) (diff - (delay.tv_sec * 1000000)) * 1000;
-            if (diff > 3 && startedPub) nanosleep(&delay, nullptr);
-
-            if (!startedPub) {
-                if (startMode == StartMode::CHANNEL) {
-                    if (le->channel == startChan)
-                        startedPub = true;
-                } else if (startMode == StartMode::US_DELAY) {
-                    if ((uint64_t) le->timestamp > firstMsgUtime + startDelayUs)
-                        startedPub = true;
-                }
+            if (selected(le)) publish(le->timestamp, le->channel, le->data, le->datalen);
+        }
+    }
+
+    // Reads the messages to play into memory, with their channel resolved
+    // and when to publish them worked out
+    void loadCache()
+    {
+        unordered_map<string, uint32_t> channelIds;
+        int64_t firstUtime = -1;
+
+        Prefetcher prefetcher(zcmIn, 4096);
+        while (!done) {
+            const zcm::LogEvent* le = prefetcher.next();
+            if (!le) break;
+            if (!selected(le)) continue;
+
+            auto it = channelIds.find(le->channel);
+            if (it == channelIds.end()) {
+                it = channelIds.emplace(le->channel, channels.size()).first;
+                channels.push_back(le->channel);
             }
 
-            auto publish = [&](){
-                if (args.verbose)
-                    printf("%.3f Channel %-20s size %d\n", le->timestamp / 1e6,
-                           le->channel.c_str(), le->datalen);
+            if (firstUtime < 0) firstUtime = le->timestamp;
+            uint64_t deltaNs = 0;
+            if (!std::isinf(args.speed) && le->timestamp > firstUtime)
+                deltaNs = (le->timestamp - firstUtime) * 1e3 / args.speed;
 
-                if (args.outfile == "")
-                    zcmOut->publish(le->channel, le->data, le->datalen);
-                else
-                    logOut->writeEvent(le);
-            };
+            cachedEvents.push_back({ le->timestamp, deltaNs, it->second, le->datalen, buf.size() });
+            buf.insert(buf.end(), le->data, le->data + le->datalen);
+        }
+        buf.shrink_to_fit();
+        cachedEvents.shrink_to_fit();
+        cout << "Cached " << cachedEvents.size() << " messages ("
+             << buf.size() / 1024 << " KB)" << endl;
+    }
 
-            if (startedPub) {
-                if (!filtering) {
-                    publish();
-                } else {
-                    if (filterType == FilterType::CHANNELS) {
-                        if (filterMode == FilterMode::WHITELIST) {
-                            if (channelMap.count(le->channel) > 0) publish();
-                        } else if (filterMode == FilterMode::BLACKLIST) {
-                            if (channelMap.count(le->channel) == 0) publish();
-                        } else if (filterMode == FilterMode::SPECIFIED) {
-                            if (channelMap.count(le->channel) == 0) {
-                                cerr << "jslp file does not specify filtering behavior "
-                                     << "for channel: " << le->channel << endl;
-                                done = true;
-                                err = 1;
-                                continue;
-                            }
-                            if (channelMap[le->channel]) publish();
-                        } else {
-                            assert(false && "Fatal error.");
-                        }
-                    } else {
-                        assert(false && "Fatal error.");
-                    }
+    // Plays the cached messages once
+    void playCache()
+    {
+        uint64_t firstPubNs = TimeUtil::monoNs();
+        for (const CachedEvent& e : cachedEvents) {
+            if (done) break;
+            if (e.deltaNs > 0) TimeUtil::sleepUntilNs(firstPubNs + e.deltaNs, SPIN_NS);
+            publish(e.timestamp, channels[e.channel], buf.data() + e.data, e.datalen);
+        }
+    }
+
+    int run()
+    {
+        if (args.lockstep > 0) {
+            lockstep.reset(new Lockstep(zcmOut, args.lockstep, args.lockstepTimeout));
+            zcmOut->start();
+            cout << "Waiting for " << args.lockstep << " lockstep consumers" << endl;
+            if (!lockstep->sync()) {
+                zcmOut->stop();
+                return 1;
+            }
+        }
+
+        if (args.cache) {
+            startedPub = startMode == StartMode::NUM_MODES;
+            loadCache();
+        }
+
+        for (size_t pass = 0; !done && (args.loops == 0 || pass < args.loops); ++pass) {
+            if (args.cache) {
+                playCache();
+                continue;
+            }
+
+            // Every pass starts over from the start of the log, and from the
+            // start condition of the jslp file
+            if (pass > 0) {
+                delete zcmIn;
+                zcmIn = new zcm::LogFile(args.filename, "r");
+                if (!zcmIn->good()) {
+                    cerr << "Error: Failed to reopen '" << args.filename << "'" << endl;
+                    err = 1;
+                    break;
                 }
             }
+            startedPub = startMode == StartMode::NUM_MODES;
+            firstMsgUtime = UINT64_MAX;
+            playLog();
+        }
 
-            lastDispatchUtime = TimeUtil::utime();
-            lastMsgUtime = le->timestamp;
+        if (lockstep) {
+            if (err == 0 && sliceStarted && !lockstep->sync()) err = 1;
+            zcmOut->stop();
         }
 
         return err;
@@ -0,0 +1,163 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <getopt.h>
+#include <fcntl.h>
+
+#include <zcm/zcm-cpp.hpp>
+
+#include "util/TimeUtil.hpp"
+
+using namespace std;
+
+struct Args
+{
+    vector<string> infiles;
+    string outfile = "";
+    double index_mb = 0;
+    size_t write_buffers = 16;
+    bool compress = false;
+    bool verbose = false;
+
+    bool init(int argc, char *argv[])
+    {
+        struct option long_opts[] = {
+            { "help",                no_argument, 0, 'h' },
+            { "output",        required_argument, 0, 'o' },
+            { "index-mb",      required_argument, 0, 'x' },
+            { "write-buffers", required_argument, 0, 'w' },
+            { "compress",            no_argument, 0, 'z' },
+            { "verbose",             no_argument, 0, 'v' },
+            { 0, 0, 0, 0 }
+        };
+
+        int c;
+        while ((c = getopt_long(argc, argv, "ho:x:w:zv", long_opts, 0)) >= 0) {
+            switch (c) {
+                case 'o':       outfile = string(optarg);               break;
+                case 'x':      index_mb = strtod(optarg, NULL);         break;
+                case 'w': write_buffers = strtoul(optarg, NULL, 10);    break;
+                case 'z':      compress = true;                         break;
+                case 'v':       verbose = true;                         break;
+                case 'h': default: usage(); return false;
+            };
+        }
+
+        for (int i = optind; i < argc; ++i) infiles.push_back(argv[i]);
+        if (infiles.empty()) {
+            cerr << "Please specify the logfiles to merge" << endl;
+            usage();
+            return false;
+        }
+        if (outfile == "") {
+            cerr << "Please specify an output file" << endl;
+            usage();
+            return false;
+        }
+
+        return true;
+    }
+
+    void usage()
+    {
+        cerr << "usage: zcm-log-merge [options] -o OUTPUT FILE..." << endl
+             << "" << endl
+             << "    Merges ZCM logs into a single one, with the events of all of" << endl
+             << "    them in timestamp order. Events with the same timestamp keep" << endl
+             << "    the order of the logs on the command line." << endl
+             << "" << endl
+             << "Options:" << endl
+             << "" << endl
+             << "  -o, --output=filename      The log to write." << endl
+             << "  -x, --index-mb=N           Also write a time index to OUTPUT.tidx, with an" << endl
+             << "                             entry every N MB of log (can be fractional)." << endl
+             << "  -w, --write-buffers=N      Write the log to disk from a separate thread," << endl
+             << "                             through up to N buffers of 1MB. 0 writes" << endl
+             << "                             synchronously. (default: 16)" << endl
+             << "  -z, --compress             Write the log as compressed blocks of events." << endl
+             << "  -v, --verbose              Print progress." << endl
+             << "  -h, --help                 Shows some help text and exits." << endl
+             << endl;
+    }
+};
+
+// The next event of every input that has one, earliest first
+struct Head
+{
+    int64_t timestamp;
+    size_t input;
+
+    bool operator>(const Head& o) const
+    {
+        return timestamp != o.timestamp ? timestamp > o.timestamp : input > o.input;
+    }
+};
+
+int main(int argc, char* argv[])
+{
+    Args args;
+    if (!args.init(argc, argv)) return 1;
+
+    // Each input holds on to its next event until it's written: that one
+    // event per log is all the merge keeps in memory
+    vector<unique_ptr<zcm::LogFile>> in;
+    vector<const zcm::LogEvent*> next;
+    priority_queue<Head, vector<Head>, greater<Head>> heads;
+    for (auto& f : args.infiles) {
+        in.emplace_back(new zcm::LogFile(f, "r"));
+        if (!in.back()->good()) {
+            cerr << "Unable to open input zcm log: " << f << endl;
+            return 1;
+        }
+        // Memory mapped logs read ahead on their own, this covers the others
+        posix_fadvise(fileno(in.back()->getFilePtr()), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        next.push_back(in.back()->readNextEvent());
+        if (next.back()) heads.push({ next.back()->timestamp, in.size() - 1 });
+    }
+
+    zcm::LogFile out(args.outfile, "w");
+    if (!out.good()) {
+        cerr << "Unable to open output zcm log: " << args.outfile << endl;
+        return 1;
+    }
+    if (args.index_mb > 0 && out.enableIndex(0, args.index_mb * (1 << 20)) != 0)
+        cerr << "Unable to write the time index of \"" << args.outfile << "\"" << endl;
+    if (args.compress && out.enableCompression(1, 1 << 20) != 0)
+        cerr << "Unable to compress \"" << args.outfile << "\"" << endl;
+    if (out.setWriteBuffer(1 << 20) != 0 ||
+        (args.write_buffers > 0 && out.enableAsyncWrites(args.write_buffers) != 0))
+        cerr << "Unable to buffer the writes of \"" << args.outfile << "\"" << endl;
+
+    uint64_t t0 = TimeUtil::utime();
+    uint64_t nevents = 0;
+    while (!heads.empty()) {
+        size_t i = heads.top().input;
+        heads.pop();
+
+        if (out.writeEvent(next[i]) != 0) {
+            perror("Unable to write event");
+            return 1;
+        }
+        nevents++;
+        if (args.verbose && nevents % 1000000 == 0)
+            cerr << "Merged " << nevents << " events" << endl;
+
+        // A log whose timestamps go back still comes out in its own order
+        next[i] = in[i]->readNextEvent();
+        if (next[i]) heads.push({ next[i]->timestamp, i });
+    }
+
+    if (out.flush(false) != 0) {
+        perror("Unable to write the merged log");
+        return 1;
+    }
+    out.close();
+
+    if (args.verbose)
+        cerr << "Merged " << nevents << " events from " << args.infiles.size()
+             << " logs in " << (TimeUtil::utime() - t0) / 1e6 << " seconds" << endl;
+    return 0;
+}
@@ -12,6 +12,7 @@
 #include "zcm/zcm.h"
 
 #include <string>
+#include <unordered_map>
 
 using namespace std;
 
@@ -97,6 +98,11 @@ struct Repeater
 
     // variables for inverted matching (e.g., logging all but some channels)
     regex invert_regex;
+    // Whether to repeat each channel seen, so that the regex only runs on the
+    // first message of a channel. Only used by the dispatch thread
+    unordered_map<string, bool> repeatChannel;
+    string channelKey;
+    static const size_t MAX_CACHED_CHANNELS = 10000;
 
     Repeater() {}
 
@@ -134,6 +140,10 @@ struct Repeater
             invert_regex = regex{args.chan};
         }
 
+        // Send from the dispatch thread, with the received buffer, rather than
+        // copying every message into the send queue for the send thread
+        zcm_set_inline_publish(zcmDest, 1);
+
         return true;
     }
 
@@ -149,9 +159,15 @@ struct Repeater
     void handler_(const zcm_recv_buf_t *rbuf, const char *channel)
     {
         if (args.invert_channels) {
-            cmatch match;
-            regex_match(channel, match, invert_regex);
-            if (match.size() > 0)
+            channelKey.assign(channel);
+            auto it = repeatChannel.find(channelKey);
+            if (it == repeatChannel.end()) {
+                // Don't grow forever on ever changing channel names
+                if (repeatChannel.size() >= MAX_CACHED_CHANNELS) repeatChannel.clear();
+                it = repeatChannel.emplace(channelKey,
+                                           !regex_match(channel, invert_regex)).first;
+            }
+            if (!it->second)
                 return;
         }
 
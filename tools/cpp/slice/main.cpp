@@ -0,0 +1,451 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <zcm/eventlog.h>
+#include <zcm/tools/BinaryIndex.hpp>
+
+#include "util/TimeUtil.hpp"
+
+using namespace std;
+
+// An event in a plain log: magic, eventnum, timestamp, channellen and datalen,
+// then the channel and the data
+static const off_t EVENT_HEADER_BYTES = 28;
+static const off_t EVENTNUM_OFFSET = 4;
+
+// Runs of events below this size are copied through memory, along with the
+// runs around them, rather than with a copy_file_range() of their own
+static const off_t SMALL_RUN_BYTES = 64 * 1024;
+static const size_t OUT_BUFFER_BYTES = 1 << 20;
+
+struct Args
+{
+    string infile = "";
+    string outfile = "";
+    string indexfile = "";
+    string plugin = "timestamp";
+    unordered_set<string> channels;
+    double start = 0;
+    double end = numeric_limits<double>::infinity();
+    bool verbose = false;
+
+    bool init(int argc, char *argv[])
+    {
+        struct option long_opts[] = {
+            { "help",          no_argument, 0, 'h' },
+            { "output",  required_argument, 0, 'o' },
+            { "channel", required_argument, 0, 'c' },
+            { "start",   required_argument, 0, 's' },
+            { "end",     required_argument, 0, 'e' },
+            { "index",   required_argument, 0, 'i' },
+            { "plugin",  required_argument, 0, 'p' },
+            { "verbose",       no_argument, 0, 'v' },
+            { 0, 0, 0, 0 }
+        };
+
+        int c;
+        while ((c = getopt_long(argc, argv, "ho:c:s:e:i:p:v", long_opts, 0)) >= 0) {
+            switch (c) {
+                case 'o':   outfile = string(optarg);       break;
+                case 'c': channels.insert(optarg);          break;
+                case 's':     start = strtod(optarg, NULL); break;
+                case 'e':       end = strtod(optarg, NULL); break;
+                case 'i': indexfile = string(optarg);       break;
+                case 'p':    plugin = string(optarg);       break;
+                case 'v':   verbose = true;                 break;
+                case 'h': default: usage(); return false;
+            };
+        }
+
+        if (optind != argc - 1) {
+            cerr << "Please specify a logfile" << endl;
+            usage();
+            return false;
+        }
+        infile = string(argv[optind]);
+
+        if (outfile == "") {
+            cerr << "Please specify an output file" << endl;
+            usage();
+            return false;
+        }
+        if (indexfile != "" && channels.empty()) {
+            cerr << "An index only helps with --channel, ignoring it" << endl;
+            indexfile = "";
+        }
+        if (end < start) {
+            cerr << "The end of the slice is before its start" << endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    void usage()
+    {
+        cerr << "usage: zcm-log-slice [options] -o OUTPUT [FILE]" << endl
+             << "" << endl
+             << "    Copies the events of a time window of an ZCM log, and optionally" << endl
+             << "    only those of some channels, into a new log without decoding" << endl
+             << "    them. Runs of events that are next to each other in the input" << endl
+             << "    are copied in one piece, with only their event numbers rewritten." << endl
+             << "" << endl
+             << "Options:" << endl
+             << "" << endl
+             << "  -o, --output=filename  The log to write." << endl
+             << "  -s, --start=SEC        Start of the window, in seconds from the first" << endl
+             << "                         event of the log. Default is 0." << endl
+             << "  -e, --end=SEC          End of the window, in seconds from the first" << endl
+             << "                         event of the log. Default is the end of the log." << endl
+             << "  -c, --channel=CHANNEL  Only keep the events of CHANNEL. May be given" << endl
+             << "                         more than once." << endl
+             << "  -i, --index=filename   Find the events of the channels in this binary" << endl
+             << "                         index (zcm-log-indexer -b) instead of reading" << endl
+             << "                         every event of the window." << endl
+             << "  -p, --plugin=NAME      The indexer plugin whose offsets to use." << endl
+             << "                         Default is \"timestamp\"." << endl
+             << "  -v, --verbose          Print information about the slice." << endl
+             << "  -h, --help             Shows some help text and exits." << endl
+             << endl;
+    }
+};
+
+// Writes the plain events of 'in', given by their offset and length, to a new
+// log 'out', renumbering them from 0 as they go
+struct Slicer
+{
+    int in = -1;
+    int out = -1;
+    off_t outpos = 0;
+    int64_t eventnum = 0;
+    bool copyRange = true;
+
+    // The run of events being gathered: [runStart, runEnd) of the input, with
+    // the offset of each of its events
+    off_t runStart = 0;
+    off_t runEnd = 0;
+    vector<off_t> runEvents;
+
+    // Pending output of the small runs, which starts at 'outpos'
+    vector<uint8_t> buf;
+
+    uint64_t nevents = 0;
+    uint64_t nruns = 0;
+
+    ~Slicer()
+    {
+        if (in >= 0) ::close(in);
+        if (out >= 0) ::close(out);
+    }
+
+    bool open(const string& infile, const string& outfile)
+    {
+        in = ::open(infile.c_str(), O_RDONLY);
+        if (in < 0) {
+            cerr << "Unable to open input zcm log: " << infile << endl;
+            return false;
+        }
+        out = ::open(outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) {
+            cerr << "Unable to open output zcm log: " << outfile << endl;
+            return false;
+        }
+        return true;
+    }
+
+    static void putEventnum(uint8_t* p, int64_t n)
+    {
+        for (int i = 7; i >= 0; --i, n >>= 8) p[i] = (uint8_t) n;
+    }
+
+    bool add(off_t offset, off_t len)
+    {
+        if (runEvents.empty() || offset != runEnd) {
+            if (!flushRun()) return false;
+            runStart = offset;
+            runEnd = offset;
+        }
+        runEvents.push_back(offset);
+        runEnd += len;
+        nevents++;
+        return true;
+    }
+
+    bool flushRun()
+    {
+        if (runEvents.empty()) return true;
+        off_t len = runEnd - runStart;
+        nruns++;
+
+        bool ok;
+        if (len < SMALL_RUN_BYTES) {
+            size_t at = buf.size();
+            buf.resize(at + len);
+            ok = readAll(buf.data() + at, len, runStart);
+            for (off_t e : runEvents)
+                putEventnum(buf.data() + at + (e - runStart) + EVENTNUM_OFFSET, eventnum++);
+            if (ok && buf.size() >= OUT_BUFFER_BYTES) ok = flushBuf();
+        } else {
+            // Only the event numbers are written twice
+            ok = flushBuf() && copy(runStart, len);
+            for (size_t i = 0; ok && i < runEvents.size(); ++i) {
+                uint8_t num[8];
+                putEventnum(num, eventnum++);
+                off_t at = outpos + (runEvents[i] - runStart) + EVENTNUM_OFFSET;
+                ok = pwrite(out, num, sizeof(num), at) == sizeof(num);
+            }
+            outpos += len;
+        }
+
+        runEvents.clear();
+        if (!ok) perror("zcm-log-slice");
+        return ok;
+    }
+
+    bool flushBuf()
+    {
+        size_t done = 0;
+        while (done < buf.size()) {
+            ssize_t n = pwrite(out, buf.data() + done, buf.size() - done, outpos + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            done += n;
+        }
+        outpos += buf.size();
+        buf.clear();
+        return true;
+    }
+
+    bool readAll(uint8_t* p, off_t len, off_t offset)
+    {
+        off_t done = 0;
+        while (done < len) {
+            ssize_t n = pread(in, p + done, len - done, offset + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                if (n == 0) errno = EIO;
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    // Copies the 'len' bytes at 'offset' of the input to 'outpos', within the
+    // kernel when it can
+    bool copy(off_t offset, off_t len)
+    {
+        off_t inoff = offset, outoff = outpos, end = offset + len;
+#ifdef __linux__
+        while (copyRange && inoff < end) {
+            ssize_t n = copy_file_range(in, &inoff, out, &outoff, end - inoff, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n > 0) continue;
+            if (n == 0) {
+                errno = EIO;
+                return false;
+            }
+            // Not between these files: fall back for this and every later run
+            if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+                return false;
+            copyRange = false;
+        }
+#endif
+        vector<uint8_t> chunk;
+        while (inoff < end) {
+            off_t n = min((off_t) OUT_BUFFER_BYTES, end - inoff);
+            chunk.resize(n);
+            if (!readAll(chunk.data(), n, inoff)) return false;
+            for (off_t done = 0; done < n;) {
+                ssize_t w = pwrite(out, chunk.data() + done, n - done, outoff + done);
+                if (w < 0 && errno == EINTR) continue;
+                if (w <= 0) return false;
+                done += w;
+            }
+            inoff += n;
+            outoff += n;
+        }
+        return true;
+    }
+
+    bool finish()
+    {
+        return flushRun() && flushBuf();
+    }
+};
+
+static bool wanted(const Args& args, const zcm_eventlog_event_t* evt)
+{
+    if (args.channels.empty()) return true;
+    return args.channels.count(string(evt->channel, evt->channellen)) > 0;
+}
+
+// Compressed logs and sets of logs have no plain events to copy: theirs are
+// read and written out one by one instead
+static int sliceByEvents(const Args& args, zcm_eventlog_t* log, int64_t startTs, int64_t endTs)
+{
+    zcm_eventlog_t* outlog = zcm_eventlog_create(args.outfile.c_str(), "w");
+    if (!outlog) {
+        cerr << "Unable to open output zcm log: " << args.outfile << endl;
+        return 1;
+    }
+
+    uint64_t nevents = 0;
+    int ret = 0;
+    zcm_eventlog_event_t* evt;
+    while ((evt = zcm_eventlog_read_next_event(log)) != NULL) {
+        bool past = evt->timestamp > endTs;
+        if (!past && evt->timestamp >= startTs && wanted(args, evt)) {
+            if (zcm_eventlog_write_event(outlog, evt) != 0) {
+                perror("zcm-log-slice");
+                ret = 1;
+                past = true;
+            }
+            nevents++;
+        }
+        zcm_eventlog_free_event(evt);
+        if (past) break;
+    }
+
+    if (zcm_eventlog_flush(outlog, 0) != 0) ret = 1;
+    zcm_eventlog_destroy(outlog);
+    if (args.verbose) cerr << "Wrote " << nevents << " events" << endl;
+    return ret;
+}
+
+// Reads every event of the window, from 'startOffset' on. Seeks without a time
+// index only land close to the start of the window, so events before it are
+// skipped
+static bool scan(const Args& args, zcm_eventlog_t* log, off_t startOffset,
+                 int64_t startTs, int64_t endTs, Slicer& slicer)
+{
+    // Plain logs are read in order, so the next event of one that isn't
+    // followed by garbage starts right after it, with the next eventnum
+    off_t offset = startOffset;
+    int64_t prevnum = -1;
+    zcm_eventlog_event_t* evt;
+    while ((evt = zcm_eventlog_read_next_event(log)) != NULL) {
+        off_t len = EVENT_HEADER_BYTES + evt->channellen + evt->datalen;
+        if (prevnum >= 0 && evt->eventnum != prevnum + 1)
+            offset = ftello(zcm_eventlog_get_fileptr(log)) - len;
+        prevnum = evt->eventnum;
+
+        bool past = evt->timestamp > endTs;
+        bool ok = past || evt->timestamp < startTs || !wanted(args, evt) ||
+                  slicer.add(offset, len);
+        zcm_eventlog_free_event(evt);
+        if (!ok) return false;
+        if (past) break;
+        offset += len;
+    }
+    return true;
+}
+
+// Only reads the events of the channels, found in the index
+static bool scanIndex(const Args& args, zcm_eventlog_t* log, const zcm::BinaryIndex& index,
+                      off_t startOffset, int64_t startTs, int64_t endTs, Slicer& slicer)
+{
+    vector<zcm::BinaryIndex::Offsets> ranges;
+    for (size_t i = 0; i < index.numEntries(); ++i) {
+        if (args.plugin != index.plugin(i) || !args.channels.count(index.channel(i)))
+            continue;
+        zcm::BinaryIndex::Offsets o = index.offsets(i);
+        o.begin = lower_bound(o.begin, o.end, (uint64_t) startOffset);
+        if (o.begin != o.end) ranges.push_back(o);
+    }
+
+    // The ranges are merged as they go, which only takes a few of them
+    while (!ranges.empty()) {
+        size_t next = 0;
+        for (size_t r = 1; r < ranges.size(); ++r)
+            if (*ranges[r].begin < *ranges[next].begin) next = r;
+
+        off_t offset = *ranges[next].begin++;
+        if (ranges[next].begin == ranges[next].end) ranges.erase(ranges.begin() + next);
+
+        zcm_eventlog_event_t* evt = zcm_eventlog_read_event_at_offset(log, offset);
+        if (!evt) {
+            cerr << "The index does not match the log at offset " << offset << endl;
+            return false;
+        }
+        off_t len = EVENT_HEADER_BYTES + evt->channellen + evt->datalen;
+        bool past = evt->timestamp > endTs;
+        bool before = evt->timestamp < startTs;
+        zcm_eventlog_free_event(evt);
+        if (past) break;
+        if (before) continue;
+        if (!slicer.add(offset, len)) return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    Args args;
+    if (!args.init(argc, argv)) return 1;
+
+    zcm_eventlog_t* log = zcm_eventlog_create(args.infile.c_str(), "r");
+    if (!log) {
+        cerr << "Unable to open input zcm log: " << args.infile << endl;
+        return 1;
+    }
+
+    zcm_eventlog_event_t* first = zcm_eventlog_read_next_event(log);
+    if (!first) {
+        cerr << "No events in " << args.infile << endl;
+        zcm_eventlog_destroy(log);
+        return 1;
+    }
+    int64_t startTs = first->timestamp + (int64_t) (args.start * 1e6);
+    int64_t endTs = isinf(args.end) ? numeric_limits<int64_t>::max()
+                                    : first->timestamp + (int64_t) (args.end * 1e6);
+    zcm_eventlog_free_event(first);
+
+    uint64_t t0 = TimeUtil::utime();
+    // Uses the sidecar time index of the log when there is one. Lands on the
+    // last event when the window starts after it, which the scans then skip
+    bool empty = zcm_eventlog_seek_to_timestamp(log, startTs) != 0;
+
+    if (!empty && (log->format != 0 || log->shards)) {
+        if (args.verbose) cerr << "Not a plain log, copying events one by one" << endl;
+        int ret = sliceByEvents(args, log, startTs, endTs);
+        zcm_eventlog_destroy(log);
+        return ret;
+    }
+
+    off_t startOffset = ftello(zcm_eventlog_get_fileptr(log));
+
+    Slicer slicer;
+    bool ok = slicer.open(args.infile, args.outfile);
+    if (ok && !empty) {
+        if (args.indexfile != "") {
+            zcm::BinaryIndex index(args.indexfile);
+            if (!index.good()) {
+                cerr << "Unable to read binary index: " << args.indexfile << endl;
+                ok = false;
+            } else {
+                ok = scanIndex(args, log, index, startOffset, startTs, endTs, slicer);
+            }
+        } else {
+            ok = scan(args, log, startOffset, startTs, endTs, slicer);
+        }
+    }
+    ok = ok && slicer.finish();
+    zcm_eventlog_destroy(log);
+
+    if (ok && args.verbose)
+        cerr << "Wrote " << slicer.nevents << " events in " << slicer.nruns << " runs ("
+             << slicer.outpos << " bytes) in "
+             << (TimeUtil::utime() - t0) / 1e6 << " seconds" << endl;
+    return ok ? 0 : 1;
+}
@@ -1,15 +1,13 @@
 #include "MsgInfo.hpp"
 #include "Debug.hpp"
 
-#include <limits>
-
 MsgInfo::MsgInfo(TypeDb& db, const char *channel) : db(db), channel(channel) {}
 
 MsgInfo::~MsgInfo()
 {
     if (last_msg) {
-        if (metadata)
-            metadata->info->decode_cleanup(last_msg);
+        if (type.get() && last_msg_valid)
+            type.get()->info->decode_cleanup(last_msg);
         free(last_msg);
         last_msg = NULL;
     }
@@ -33,6 +31,9 @@ void MsgInfo::decViewDepth()
 
 void MsgInfo::display()
 {
+    decodeLatest();
+
+    const TypeMetadata *metadata = type.get();
     const char *name = NULL;
     i64 hash = 0;
     if (metadata) {
@@ -42,94 +43,67 @@ void MsgInfo::display()
 
     printf("         Decoding %s (%s) %" PRIi64 ":\n", channel.c_str(), name, hash);
 
-    if (last_msg)
+    if (last_msg_valid)
         msg_display(db, *metadata, last_msg,  disp_state);
 }
 
-void MsgInfo::ensureHash(i64 h)
-{
-    if (hash == h)
-        return;
-
-    // if this not the first message, warn user
-    if (hash != 0) {
-        DEBUG(1, "WRN: hash changed, searching for new zcmtype on channel %s\n", channel.c_str());
-    }
-
-    // cleanup old memory if needed
-    if (metadata && last_msg) {
-        metadata->info->decode_cleanup(last_msg);
-        free(last_msg);
-        last_msg = NULL;
-    }
-
-    hash = h;
-    metadata = db.getByHash(h);
-    if (metadata == NULL) {
-        DEBUG(1, "WRN: failed to find zcmtype for hash: 0x%" PRIx64 "\n", hash);
-        return;
-    }
-}
-
-u64 MsgInfo::latestUtime()
-{
-    return queue.last();
-}
-
-u64 MsgInfo::oldestUtime()
+void MsgInfo::addMessage(const zcm_recv_buf_t *rbuf)
 {
-    return queue.first();
-}
+    stats.addMessage(rbuf->recv_utime, rbuf->data_size);
 
-void MsgInfo::removeOld()
-{
-    u64 oldest_allowed = TimeUtil::utime() - QUEUE_PERIOD;
-    while (!queue.isEmpty() && queue.first() < oldest_allowed)
-        queue.dequeue();
+    // only decoded when displayed
+    unique_lock<mutex> lk(latest_mut);
+    latest_data.assign(rbuf->data, rbuf->data + rbuf->data_size);
+    latest_new = true;
 }
 
-void MsgInfo::addMessage(u64 utime, const zcm_recv_buf_t *rbuf)
+void MsgInfo::decodeLatest()
 {
-    if (queue.isFull())
-        queue.dequeue();
-    queue.enqueue(utime);
-
-    num_msgs++;
+    {
+        unique_lock<mutex> lk(latest_mut);
+        if (!latest_new)
+            return;
+        latest_data.swap(last_data);
+        latest_new = false;
+    }
 
-    /* decode the data */
-    i64 hash = 0;
-    __int64_t_decode_array(rbuf->data, 0, rbuf->data_size, &hash, 1);
-    ensureHash(hash);
+    i64 prev_hash = type.getHash();
+    const TypeMetadata *prev = type.get();
+    const TypeMetadata *metadata = type.resolve(db, last_data.data(), last_data.size());
+    if (type.hashChanged()) {
+        // if this not the first message, warn user
+        if (prev_hash != 0) {
+            DEBUG(1, "WRN: hash changed, searching for new zcmtype on channel %s\n", channel.c_str());
+        }
 
-    if (metadata) {
-        // do we need to allocate memory for 'last_msg' ?
-        if (!last_msg) {
-            size_t sz = metadata->info->struct_size();
-            last_msg = malloc(sz);
-        } else {
-            metadata->info->decode_cleanup(last_msg);
+        // cleanup old memory if needed
+        if (prev && last_msg) {
+            if (last_msg_valid)
+                prev->info->decode_cleanup(last_msg);
+            free(last_msg);
+            last_msg = NULL;
+            last_msg_valid = false;
         }
 
-        // actually decode it
-        metadata->info->decode(rbuf->data, 0, rbuf->data_size, last_msg);
+        if (metadata == NULL)
+            DEBUG(1, "WRN: failed to find zcmtype for hash: 0x%" PRIx64 "\n", type.getHash());
+    }
+    if (!metadata)
+        return;
 
-        DEBUG(1, "INFO: successful decode on %s\n", channel.c_str());
+    // do we need to allocate memory for 'last_msg' ?
+    if (!last_msg) {
+        size_t sz = metadata->info->struct_size();
+        last_msg = malloc(sz);
+    } else if (last_msg_valid) {
+        metadata->info->decode_cleanup(last_msg);
     }
-}
 
-float MsgInfo::getHertz()
-{
-    removeOld();
-    if (queue.isEmpty())
-        return 0.0;
-
-    int sz = queue.getSize();
-    if (sz < 2) return 0.0;
-    u64 oldest = oldestUtime();
-    u64 latest = latestUtime();
-    u64 dt = latest - oldest;
-    if (dt == 0.0)
-        return std::numeric_limits<float>::infinity();
-
-    return (float) (sz - 1) / ((float) dt / 1000000.0);
+    // actually decode it
+    last_msg_valid = metadata->info->decode(last_data.data(), 0, last_data.size(), last_msg) >= 0;
+    if (last_msg_valid)
+        DEBUG(1, "INFO: successful decode on %s\n", channel.c_str());
+    else
+        DEBUG(1, "WRN: failed to decode message on %s\n", channel.c_str());
 }
+
@@ -1,21 +1,24 @@
 #pragma once
 #include "Common.hpp"
 #include "util/TypeDb.hpp"
-#include "ExpiringQueue.hpp"
+#include "util/ChannelTypes.hpp"
+#include "util/ChannelStats.hpp"
 #include "MsgDisplay.hpp"
 
+// addMessage() is called by the receive thread, and never waits on the rest,
+// which is only called by the display thread
 class MsgInfo
 {
-    static constexpr size_t QUEUE_SIZE = 400;
-    static constexpr size_t QUEUE_PERIOD = 4*1000*1000;
-
 public:
     MsgInfo(TypeDb& db, const char *channel);
     ~MsgInfo();
 
-    void addMessage(u64 utime, const zcm_recv_buf_t *rbuf);
-    float getHertz();
-    u64 getNumMsgs() { return num_msgs; }
+    void addMessage(const zcm_recv_buf_t *rbuf);
+
+    // Snapshots the stats at 'utime', for getStats()
+    void updateStats(u64 utime) { window.update(stats, utime); }
+    const ChannelStatsWindow& getStats() { return window; }
+    u64 getNumMsgs() { return stats.getNumMsgs(); }
 
     size_t getViewDepth();
     void incViewDepth(size_t viewid);
@@ -24,20 +27,26 @@ public:
     void display();
 
 private:
-    void ensureHash(i64 hash);
-    u64 latestUtime();
-    u64 oldestUtime();
-    void removeOld();
+    void decodeLatest();
 
 private:
     TypeDb& db;
     string channel;
 
-    ExpiringQueue<u64, QUEUE_SIZE> queue;
-    i64 hash = 0;
-    u64 num_msgs = 0;
+    ChannelStats stats;
+    ChannelStatsWindow window;
+
+    // Only the bytes of the latest message are kept as they come, in
+    // 'latest_data': the display thread swaps them into 'last_data' and
+    // decodes them into 'last_msg' when the channel is displayed. The lock
+    // is only held to copy or swap them
+    mutex latest_mut;
+    vector<u8> latest_data;
+    bool latest_new = false;
 
+    ChannelType type;
+    vector<u8> last_data;
     void *last_msg = NULL;
-    const TypeMetadata *metadata = NULL;
+    bool last_msg_valid = false;
     MsgDisplayState disp_state;
 };
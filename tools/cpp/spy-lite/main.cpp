@@ -26,7 +26,7 @@ struct SpyInfo
 
     ~SpyInfo()
     {
-        for (auto& it : minfomap)
+        for (auto& it : recvmap)
             delete it.second;
     }
 
@@ -50,24 +50,43 @@ struct SpyInfo
         return index < names.size();
     }
 
+    // Called by the receive thread only: never takes 'mut', so never waits
+    // on the display
     void addMessage(const char *channel, const zcm_recv_buf_t *rbuf)
     {
-        unique_lock<mutex> lk(mut);
-
-        MsgInfo *minfo = minfomap[channel];
+        recvkey.assign(channel);
+        MsgInfo *&minfo = recvmap[recvkey];
         if (minfo == NULL) {
             minfo = new MsgInfo(typedb, channel);
-            names.push_back(channel);
-            std::sort(begin(names), end(names));
-            minfomap[channel] = minfo;
+            unique_lock<mutex> lk(newmut);
+            newinfos.emplace_back(recvkey, minfo);
+        }
+        minfo->addMessage(rbuf);
+    }
+
+    // Picks up the channels received since the last call. Needs 'mut'
+    void addNewChannels()
+    {
+        vector<pair<string, MsgInfo*>> infos;
+        {
+            unique_lock<mutex> lk(newmut);
+            infos.swap(newinfos);
+        }
+        if (infos.empty())
+            return;
+        for (auto& it : infos) {
+            names.push_back(it.first);
+            minfomap[it.first] = it.second;
         }
-        minfo->addMessage(TimeUtil::utime(), rbuf);
+        std::sort(begin(names), end(names));
     }
 
     void display()
     {
         unique_lock<mutex> lk(mut);
 
+        addNewChannels();
+
         switch (mode) {
             case DisplayMode::Overview: {
                 displayOverview();
@@ -89,20 +108,39 @@ struct SpyInfo
 
     void displayOverview()
     {
-        printf("         %-28s\t%12s\t%8s\n", "Channel", "Num Messages", "Hz (ave)");
-        printf("   ----------------------------------------------------------------\n");
+        if (!show_dists) {
+            printf("         %-28s\t%12s\t%8s\t%10s\n", "Channel", "Num Messages", "Hz (ave)", "kB/s (ave)");
+            printf("   --------------------------------------------------------------------------------\n");
+        } else {
+            printf("         %-28s\t%20s\t%26s\t%6s\n", "Channel", "Size p50/p99/max (B)",
+                   "Interval p50/p99/max (ms)", "Gaps");
+            printf("   ------------------------------------------------------------------------------------------\n");
+        }
 
         DEBUG(5, "start-loop\n");
 
+        u64 now = TimeUtil::utime();
         for (size_t i = 0; i < names.size(); i++) {
             auto& channel = names[i];
             MsgInfo **minfo = lookup(minfomap, channel);
             assert(minfo != NULL);
-            float hz = (*minfo)->getHertz();
-            printf("   %3zu)  %-28s\t%9" PRIu64 "\t%7.2f\n", i, channel.c_str(), (*minfo)->getNumMsgs(), hz);
+            (*minfo)->updateStats(now);
+            const ChannelStatsWindow& stats = (*minfo)->getStats();
+            if (!show_dists) {
+                printf("   %3zu)  %-28s\t%9" PRIu64 "\t%7.2f\t%10.2f\n", i, channel.c_str(),
+                       (*minfo)->getNumMsgs(), stats.hertz, stats.bandwidth / 1000.0);
+            } else {
+                const auto& sz = stats.size;
+                const auto& dt = stats.interval;
+                printf("   %3zu)  %-28s\t%6" PRIu64 "/%6" PRIu64 "/%6" PRIu64
+                       "\t%8.2f/%8.2f/%8.2f\t%6" PRIu64 "\n", i, channel.c_str(),
+                       sz.p50, sz.p99, sz.max, dt.p50 / 1000.0, dt.p99 / 1000.0,
+                       dt.max / 1000.0, stats.gaps);
+            }
         }
 
         printf("\n");
+        printf("   Press 's' to toggle between rates and distributions\n");
 
         if (is_selecting) {
             printf("   Decode channel: ");
@@ -117,6 +155,8 @@ struct SpyInfo
         if (ch == '-') {
             is_selecting = true;
             decode_index = -1;
+        } else if (ch == 's') {
+            show_dists = !show_dists;
         } else if ('0' <= ch && ch <= '9') {
             // shortcut for single digit channels
             if (!is_selecting) {
@@ -223,14 +263,25 @@ struct SpyInfo
     }
 
 private:
+    // Only accessed by the receive thread
+    unordered_map<string, MsgInfo*> recvmap;
+    string recvkey;
+
+    // Channels seen by the receive thread, not yet added to 'names'
+    mutex newmut;
+    vector<pair<string, MsgInfo*>> newinfos;
+
     vector<string>                  names;
     unordered_map<string, MsgInfo*> minfomap;
     TypeDb typedb;
 
+    // Guards the rest, used by the display and keyboard threads
     mutex mut;
 
     DisplayMode mode = DisplayMode::Overview;
     bool is_selecting = false;
+    // Show the distributions of sizes and intervals rather than the rates
+    bool show_dists = false;
 
     int decode_index = 0;
     MsgInfo *decode_msg_info;
@@ -4,10 +4,31 @@
 #include <getopt.h>
 #include <inttypes.h>
 
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
 #include "zcm/zcm.h"
+#include "util/TimeUtil.hpp"
+#include "util/ChannelStats.hpp"
 
 volatile int done = 0;
 static bool verbose;
+static bool stats;
+static unsigned statsInterval = 1;
+// --every and --max-rate: messages of a channel not printed
+static u64 every = 1;
+static u64 minIntervalUs = 0;
+
+struct ChannelInfo
+{
+    ChannelStats stats;
+    ChannelStatsWindow window;
+};
+// Only ever inserted into by the handler
+static std::map<std::string, ChannelInfo*> channels;
+static std::mutex channelsLock;
 
 static void sighandler(int code)
 {
@@ -15,10 +36,82 @@ static void sighandler(int code)
     if (done >= 3) exit(1);
 }
 
+static void statsHandler(const zcm_recv_buf_t *rbuf, const char *channel,
+                         void *ser)
+{
+    static std::string key;
+    key.assign(channel);
+    auto it = channels.find(key);
+    if (it == channels.end()) {
+        std::unique_lock<std::mutex> lk(channelsLock);
+        it = channels.emplace(key, new ChannelInfo()).first;
+    }
+    it->second->stats.addMessage(rbuf->recv_utime, rbuf->data_size);
+}
+
+static void printStats()
+{
+    std::unique_lock<std::mutex> lk(channelsLock);
+    u64 now = TimeUtil::utime();
+    printf("%-28s %9s %10s %22s %29s %6s\n", "Channel", "Hz", "kB/s",
+           "Size p50/p99/max (B)", "Interval p50/p99/max (ms)", "Gaps");
+    for (auto& it : channels) {
+        ChannelStatsWindow& w = it.second->window;
+        w.update(it.second->stats, now);
+        printf("%-28s %9.2f %10.2f %6" PRIu64 "/%7" PRIu64 "/%7" PRIu64
+               " %9.2f/%9.2f/%9.2f %6" PRIu64 "\n",
+               it.first.c_str(), w.hertz, w.bandwidth / 1000.0,
+               w.size.p50, w.size.p99, w.size.max,
+               w.interval.p50 / 1000.0, w.interval.p99 / 1000.0, w.interval.max / 1000.0,
+               w.gaps);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+struct Sampling
+{
+    u64 seen = 0;
+    u64 lastPrinted = 0;
+    bool printedAny = false;
+    u64 skipped = 0;   // since the last message printed
+};
+// Only ever touched by the handler
+static std::unordered_map<std::string, Sampling> sampling;
+
+// Whether the message is to be printed, decided before anything is formatted
+static bool sampled(const zcm_recv_buf_t *rbuf, Sampling& s)
+{
+    bool keep = s.seen++ % every == 0;
+    if (keep && minIntervalUs > 0) {
+        keep = !s.printedAny || rbuf->recv_utime - s.lastPrinted >= minIntervalUs;
+        if (keep) {
+            s.lastPrinted = rbuf->recv_utime;
+            s.printedAny = true;
+        }
+    }
+    if (!keep) ++s.skipped;
+    return keep;
+}
+
 static void handler(const zcm_recv_buf_t *rbuf, const char *channel,
                     void *ser)
 {
-    printf("Message received on channel: \"%s\"\n", channel);
+    if (every > 1 || minIntervalUs > 0) {
+        static std::string key;
+        key.assign(channel);
+        Sampling& s = sampling[key];
+        if (!sampled(rbuf, s)) return;
+        if (s.skipped > 0) {
+            printf("Message received on channel: \"%s\" (%" PRIu64 " skipped)\n",
+                   channel, s.skipped);
+            s.skipped = 0;
+        } else {
+            printf("Message received on channel: \"%s\"\n", channel);
+        }
+    } else {
+        printf("Message received on channel: \"%s\"\n", channel);
+    }
     if (verbose) {
         printf("Raw data: ");
         for (size_t i = 0; i < rbuf->data_size; ++i) {
@@ -42,6 +135,13 @@ static void usage()
             "  -h, --help                 Shows this help text and exits\n"
             "  -u, --zcm-url=URL          Log messages on the specified ZCM URL\n"
             "  -v, --verbose              Print raw bytes of zcm data for each msg\n"
+            "  -s, --stats                Rather than each msg, print the rates, sizes and\n"
+            "                             intervals of each channel every second, over the\n"
+            "                             last few seconds\n"
+            "  -i, --interval=S           With --stats, print them every S seconds\n"
+            "  -n, --every=N              Only print one in N msgs of each channel\n"
+            "  -r, --max-rate=HZ          Print at most HZ msgs a second of each channel.\n"
+            "                             Msgs not printed are counted, but never formatted\n"
             "\n");
 }
 
@@ -49,19 +149,38 @@ static const char *zcmurl = nullptr;
 static bool parse_args(int argc, char *argv[])
 {
     // set some defaults
-    const char *optstring = "hu:v";
+    const char *optstring = "hu:vsi:n:r:";
     struct option long_opts[] = {
-        { "help",    no_argument,       0, 'h' },
-        { "zcm-url", required_argument, 0, 'u' },
-        { "verbose", no_argument,       0, 'v' },
+        { "help",     no_argument,       0, 'h' },
+        { "zcm-url",  required_argument, 0, 'u' },
+        { "verbose",  no_argument,       0, 'v' },
+        { "stats",    no_argument,       0, 's' },
+        { "interval", required_argument, 0, 'i' },
+        { "every",    required_argument, 0, 'n' },
+        { "max-rate", required_argument, 0, 'r' },
         { 0, 0, 0, 0 }
     };
 
     int c;
+    double hz;
     while ((c = getopt_long (argc, argv, optstring, long_opts, 0)) >= 0) {
         switch (c) {
             case 'u': zcmurl  = optarg; break;
             case 'v': verbose = true;   break;
+            case 's': stats   = true;   break;
+            case 'i':
+                statsInterval = atoi(optarg);
+                if (statsInterval < 1) { usage(); return false; }
+                break;
+            case 'n':
+                every = strtoull(optarg, NULL, 10);
+                if (every < 1) { usage(); return false; }
+                break;
+            case 'r':
+                hz = strtod(optarg, NULL);
+                if (hz <= 0) { usage(); return false; }
+                minIntervalUs = (u64) (1e6 / hz);
+                break;
             case 'h': default: usage(); return false;
         };
     }
@@ -80,7 +199,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    zcm_sub_t *subs = zcm_subscribe(zcm, ".*", &handler, NULL);
+    zcm_sub_t *subs = zcm_subscribe(zcm, ".*", stats ? &statsHandler : &handler, NULL);
 
     signal(SIGINT,  sighandler);
     signal(SIGQUIT, sighandler);
@@ -88,10 +207,18 @@ int main(int argc, char *argv[])
 
     zcm_start(zcm);
 
-    while (!done) usleep(500000);
+    while (!done) {
+        if (stats) {
+            sleep(statsInterval);
+            if (!done) printStats();
+        } else {
+            usleep(500000);
+        }
+    }
 
     zcm_stop(zcm);
     zcm_unsubscribe(zcm, subs);
     zcm_destroy(zcm);
+    for (auto& it : channels) delete it.second;
     return 0;
 }
@@ -3,9 +3,16 @@
 #include <getopt.h>
 #include <algorithm>
 #include <memory>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <zcm/zcm-cpp.hpp>
 #include <zcm/zcm_coretypes.h>
+#include <zcm/tools/TranscoderPlugin.hpp>
 
 #include "zcm/json/json.h"
 
@@ -13,21 +20,160 @@
 
 using namespace std;
 
+// Events go through the transcoder in numbered batches: read by the main
+// thread, transcoded by any one of the workers, then written out in order by
+// the writer. Batches are recycled, their events keeping their buffers
+struct Pipeline
+{
+    struct Event
+    {
+        int64_t timestamp;
+        string channel;
+        vector<uint8_t> data;
+
+        void assign(const zcm::LogEvent* evt)
+        {
+            timestamp = evt->timestamp;
+            channel = evt->channel;
+            data.assign(evt->data, evt->data + evt->datalen);
+        }
+    };
+
+    // The events that in[i] was transcoded into end at out[outEnd[i]], unless
+    // it wasn't (transcoded[i] is false) and is written as it is
+    struct Batch
+    {
+        size_t seq;
+        vector<Event> in;
+        size_t nin = 0;
+        zcm::TranscoderOutput out;
+        vector<size_t> outEnd;
+        vector<char> transcoded;
+
+        Event& pushIn()
+        {
+            if (nin == in.size()) in.resize(nin + 1);
+            return in[nin++];
+        }
+    };
+
+    static const size_t BATCH_EVENTS = 1024;
+
+    Pipeline(size_t workers) : batches(2 * workers + 2)
+    {
+        for (auto& b : batches) freeBatches.push_back(&b);
+    }
+
+    // For the reader
+    Batch* startBatch()
+    {
+        unique_lock<mutex> lock{lk};
+        freeCond.wait(lock, [&]() { return !freeBatches.empty(); });
+        Batch* b = freeBatches.back();
+        freeBatches.pop_back();
+        b->seq = nextSeq++;
+        b->nin = 0;
+        b->out.clear();
+        return b;
+    }
+
+    void readBatch(Batch* b)
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            toTranscode.push_back(b);
+        }
+        transcodeCond.notify_one();
+    }
+
+    void finish()
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            finished = true;
+            total = nextSeq;
+        }
+        transcodeCond.notify_all();
+        writeCond.notify_all();
+    }
+
+    // For the workers: returns nullptr once there are no more
+    Batch* nextToTranscode()
+    {
+        unique_lock<mutex> lock{lk};
+        transcodeCond.wait(lock, [&]() { return !toTranscode.empty() || finished; });
+        if (toTranscode.empty()) return nullptr;
+        Batch* b = toTranscode.front();
+        toTranscode.pop_front();
+        return b;
+    }
+
+    void transcodedBatch(Batch* b)
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            toWrite[b->seq] = b;
+        }
+        writeCond.notify_all();
+    }
+
+    // For the writer: returns the batches in order, nullptr once there are
+    // no more
+    Batch* nextToWrite()
+    {
+        unique_lock<mutex> lock{lk};
+        writeCond.wait(lock, [&]() {
+            return (!toWrite.empty() && toWrite.begin()->first == written) ||
+                   (finished && written == total);
+        });
+        if (toWrite.empty() || toWrite.begin()->first != written) return nullptr;
+        Batch* b = toWrite.begin()->second;
+        toWrite.erase(toWrite.begin());
+        return b;
+    }
+
+    void writtenBatch(Batch* b)
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            written++;
+            freeBatches.push_back(b);
+        }
+        freeCond.notify_one();
+    }
+
+  private:
+    vector<Batch> batches;
+    vector<Batch*> freeBatches;
+    deque<Batch*> toTranscode;
+    map<size_t, Batch*> toWrite;
+    size_t nextSeq = 0;
+    size_t written = 0;
+    size_t total = 0;
+    bool finished = false;
+    mutex lk;
+    condition_variable freeCond;
+    condition_variable transcodeCond;
+    condition_variable writeCond;
+};
+
 struct Args
 {
     string inlog       = "";
     string outlog      = "";
     string plugin_path = "";
+    size_t jobs        = max(thread::hardware_concurrency(), 1u);
     bool debug         = false;
 
     bool parse(int argc, char *argv[])
     {
         // set some defaults
-        const char *optstring = "l:o:p:dh";
+        const char *optstring = "l:o:p:j:dh";
         struct option long_opts[] = {
             { "log",         required_argument, 0, 'l' },
             { "output",      required_argument, 0, 'o' },
             { "plugin-path", required_argument, 0, 'p' },
+            { "jobs",        required_argument, 0, 'j' },
             { "debug",       no_argument,       0, 'd' },
             { "help",        no_argument,       0, 'h' },
             { 0, 0, 0, 0 }
@@ -39,6 +185,15 @@ struct Args
                 case 'l': inlog       = string(optarg); break;
                 case 'o': outlog      = string(optarg); break;
                 case 'p': plugin_path = string(optarg); break;
+                case 'j': {
+                    int n = atoi(optarg);
+                    if (n < 1) {
+                        cerr << "Expected a positive number of jobs" << endl;
+                        return false;
+                    }
+                    jobs = n;
+                    break;
+                }
                 case 'd': debug       = true;           break;
                 case 'h': default: usage(); return false;
             };
@@ -81,6 +236,8 @@ struct Args
              << "  -p, --plugin-path=path  Path to shared library containing transcoder plugins" << endl
              << "                          Can also be specified via the environment variable" << endl
              << "                          ZCM_LOG_TRANSCODER_PLUGINS_PATH" << endl
+             << "  -j, --jobs=N            Transcode events on N threads. Defaults to the" << endl
+             << "                          number of cores" << endl
              << "  -d, --debug             Run a dry run to ensure proper transcoder setup" << endl
              << endl << endl;
     }
@@ -122,10 +279,85 @@ int main(int argc, char* argv[])
 
     if (args.debug) return 0;
 
-    size_t numInEvents = 0, numOutEvents = 0;
+    // Plugins that aren't thread safe get an instance per worker
+    vector<vector<zcm::TranscoderPlugin*>> workerPlugins(args.jobs, plugins);
+    vector<unique_ptr<zcm::TranscoderPlugin>> ownedPlugins;
+    for (size_t w = 1; w < args.jobs; ++w) {
+        for (size_t i = 0; i < plugins.size(); ++i) {
+            if (plugins[i]->threadSafe()) continue;
+            ownedPlugins.emplace_back(pluginDb.makePlugin(i));
+            workerPlugins[w][i] = ownedPlugins.back().get();
+        }
+    }
+
+    Pipeline pipeline(args.jobs);
+
+    vector<thread> workers;
+    for (size_t w = 0; w < args.jobs; ++w) {
+        workers.emplace_back([&, w]() {
+            TranscoderRouter router(workerPlugins[w]);
+            zcm::LogEvent in;
+            while (Pipeline::Batch* b = pipeline.nextToTranscode()) {
+                b->outEnd.resize(b->nin);
+                b->transcoded.resize(b->nin);
+                for (size_t i = 0; i < b->nin; ++i) {
+                    Pipeline::Event& e = b->in[i];
+                    int64_t msg_hash;
+                    __int64_t_decode_array(e.data.data(), 0, 8, &msg_hash, 1);
+                    const auto& route = router.route(msg_hash);
+
+                    bool transcoded = false;
+                    if (!route.empty()) {
+                        in.eventnum = 0;
+                        in.timestamp = e.timestamp;
+                        in.channel = e.channel;
+                        in.datalen = e.data.size();
+                        in.data = e.data.data();
+
+                        for (auto* p : route)
+                            if (p->transcodeEventInto((uint64_t) msg_hash, &in, b->out))
+                                transcoded = true;
+                    }
+                    b->transcoded[i] = transcoded;
+                    b->outEnd[i] = b->out.size();
+                }
+                pipeline.transcodedBatch(b);
+            }
+        });
+    }
+
+    size_t numOutEvents = 0;
+    thread writer([&]() {
+        zcm::LogEvent out;
+        while (Pipeline::Batch* b = pipeline.nextToWrite()) {
+            size_t j = 0;
+            for (size_t i = 0; i < b->nin; ++i) {
+                if (b->transcoded[i]) {
+                    for (; j < b->outEnd[i]; ++j) {
+                        outlog.writeEvent(b->out[j]);
+                        numOutEvents++;
+                    }
+                    continue;
+                }
+                j = b->outEnd[i];
+                Pipeline::Event& e = b->in[i];
+                out.eventnum = 0;
+                out.timestamp = e.timestamp;
+                out.channel = e.channel;
+                out.datalen = e.data.size();
+                out.data = e.data.data();
+                outlog.writeEvent(&out);
+                numOutEvents++;
+            }
+            pipeline.writtenBatch(b);
+        }
+    });
+
+    size_t numInEvents = 0;
     const zcm::LogEvent* evt;
     off64_t offset;
 
+    Pipeline::Batch* batch = pipeline.startBatch();
     while (1) {
         offset = ftello(inlog.getFilePtr());
 
@@ -139,29 +371,18 @@ int main(int argc, char* argv[])
         evt = inlog.readNextEvent();
         if (evt == nullptr) break;
 
-        vector<const zcm::LogEvent*> evts;
-
-        if (!plugins.empty()) {
-            int64_t msg_hash;
-            __int64_t_decode_array(evt->data, 0, 8, &msg_hash, 1);
-
-            for (auto& p : plugins) {
-                vector<const zcm::LogEvent*> pevts =
-                    p->transcodeEvent((uint64_t) msg_hash, evt);
-                evts.insert(evts.end(), pevts.begin(), pevts.end());
-            }
-        }
-
-        if (evts.empty()) evts.push_back(evt);
-
-        for (auto* evt : evts) {
-            if (!evt) continue;
-            outlog.writeEvent(evt);
-            numOutEvents++;
+        batch->pushIn().assign(evt);
+        if (batch->nin == Pipeline::BATCH_EVENTS) {
+            pipeline.readBatch(batch);
+            batch = pipeline.startBatch();
         }
 
         numInEvents++;
     }
+    pipeline.readBatch(batch);
+    pipeline.finish();
+    for (auto& w : workers) w.join();
+    writer.join();
     cout << endl;
 
     inlog.close();
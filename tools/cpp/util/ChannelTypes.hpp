@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include <zcm/zcm_coretypes.h>
+
+#include "util/TypeDb.hpp"
+
+// The type of the messages of one channel. Its messages all start with the
+// same hash but when the channel changes type, so the TypeDb is only searched
+// when the hash differs from the one of the message before
+class ChannelType
+{
+  public:
+    // Returns the type of the message 'data' of 'len' bytes, null if it's too
+    // short to have a hash or the db doesn't have its type
+    const TypeMetadata* resolve(TypeDb& db, const uint8_t* data, size_t len)
+    {
+        int64_t h;
+        if (__int64_t_decode_array(data, 0, len, &h, 1) < 0) return nullptr;
+        changed = !seen || h != hash;
+        if (!changed) return md;
+        seen = true;
+        hash = h;
+        md = db.getByHash(h);
+        return md;
+    }
+
+    // Whether the last resolve() looked the type up: its message was the
+    // first of the channel, or had another hash than the one before it
+    bool hashChanged() const { return changed; }
+
+    int64_t getHash() const { return hash; }
+    const TypeMetadata* get() const { return md; }
+
+  private:
+    bool seen = false;
+    bool changed = false;
+    int64_t hash = 0;
+    const TypeMetadata* md = nullptr;
+};
+
+// The ChannelType of every channel, by name. Those returned by of() stay
+// where they are, so that tools with state of their own for each channel can
+// keep theirs and skip looking the channel up too
+// NOTE: Not thread safe: threads each need their own, but can share the db
+class ChannelTypes
+{
+  public:
+    explicit ChannelTypes(TypeDb& db) : db(db) {}
+
+    ChannelType& of(const std::string& channel) { return channels[channel]; }
+
+    const TypeMetadata* resolve(const std::string& channel, const uint8_t* data, size_t len)
+    { return of(channel).resolve(db, data, len); }
+
+    TypeDb& getDb() { return db; }
+
+  private:
+    TypeDb& db;
+    std::unordered_map<std::string, ChannelType> channels;
+};
@@ -0,0 +1,144 @@
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <cxxabi.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "zcm/util/Common.hpp"
+#include "util/StringUtil.hpp"
+#include "util/FileUtil.hpp"
+
+#include "SymtabElf.hpp"
+
+#include "PluginSymbols.hpp"
+
+#define DEBUG(...) do {\
+    if (debug) printf(__VA_ARGS__);\
+  } while(0)
+
+using namespace std;
+
+static inline std::string demangle(std::string name)
+{
+    int status = 42; // some arbitrary value to eliminate the compiler warning
+
+    std::unique_ptr<char, void(*)(void*)> res {
+        abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status),
+        std::free
+    };
+
+    return (status==0) ? res.get() : name ;
+}
+
+static string cachePath()
+{
+    const char* path = getenv("ZCM_PLUGIN_CACHE");
+    if (path) return path;
+    const char* dir = getenv("XDG_CACHE_HOME");
+    if (dir && *dir) return string(dir) + "/zcm/plugin-symbols";
+    dir = getenv("HOME");
+    if (dir && *dir) return string(dir) + "/.cache/zcm/plugin-symbols";
+    return "";
+}
+
+// A line of the cache is what a version of a library has for a suffix. Its
+// fields are tab separated: this key (path, mtime in ns, size and suffix),
+// then the mangled symbols separated by spaces
+static string cacheKey(const string& path, const struct stat& st, const string& suffix)
+{
+    stringstream ss;
+    ss << path << '\t'
+       << (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec << '\t'
+       << (int64_t) st.st_size << '\t' << suffix;
+    return ss.str();
+}
+
+static vector<string> readCache(const string& file)
+{
+    vector<string> lines;
+    ifstream in(file);
+    string line;
+    while (getline(in, line)) if (!line.empty()) lines.push_back(line);
+    return lines;
+}
+
+// Entries of the same library and suffix are replaced: older versions of it
+// go away. Written to a temporary file and renamed over the cache, so that
+// concurrent readers see one version or the other
+static void writeCache(const string& file, const string& path, const string& suffix,
+                       const string& line)
+{
+    vector<string> lines = readCache(file);
+    string prefix = path + "\t";
+    string tail = "\t" + suffix + "\t";
+    size_t kept = 0;
+    for (auto& l : lines) {
+        bool same = l.compare(0, prefix.size(), prefix) == 0 &&
+                    l.find(tail, prefix.size()) != string::npos;
+        if (!same) lines[kept++] = l;
+    }
+    lines.resize(kept);
+    lines.push_back(line);
+
+    FileUtil::mkdirWithParents(FileUtil::dirname(file), 0755);
+    string tmp = file + ".tmp." + to_string(getpid());
+    {
+        ofstream out(tmp);
+        for (auto& l : lines) out << l << '\n';
+        if (!out.good()) {
+            FileUtil::remove(tmp);
+            return;
+        }
+    }
+    if (FileUtil::rename(tmp, file) != 0) FileUtil::remove(tmp);
+}
+
+bool findPluginSymbols(const string& libname, const string& suffix,
+                       vector<pair<string, string>>& symbols, bool debug)
+{
+    char resolved[PATH_MAX];
+    string path = realpath(libname.c_str(), resolved) ? resolved : libname;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        ERROR("ERR: unable to stat '%s'\n", libname.c_str());
+        return false;
+    }
+
+    string file = cachePath();
+    string key = cacheKey(path, st, suffix);
+    if (!file.empty()) {
+        for (auto& line : readCache(file)) {
+            if (line.compare(0, key.size(), key) != 0 || line.size() == key.size() ||
+                line[key.size()] != '\t')
+                continue;
+            DEBUG("Found the plugins of '%s' in %s\n", libname.c_str(), file.c_str());
+            for (auto& s : StringUtil::split(line.substr(key.size() + 1), ' '))
+                if (!s.empty()) symbols.emplace_back(s, demangle(s));
+            return true;
+        }
+    }
+
+    // read the library's symbol table
+    SymtabElf stbl{libname};
+    if (!stbl.good()) {
+        ERROR("ERR: failed to load symbol table for ELF file\n");
+        return false;
+    }
+
+    string line = key + "\t";
+    string s;
+    size_t n = 0;
+    while (stbl.getNext(s)) {
+        string demangled = demangle(s);
+        if (!StringUtil::endswith(demangled, suffix)) continue;
+        symbols.emplace_back(s, demangled);
+        line += (n++ ? " " : "") + s;
+    }
+
+    if (!file.empty()) writeCache(file, path, suffix, line);
+    return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// The symbols of a plugin library whose demangled names end in 'suffix' (e.g.
+// "::makeIndexerPlugin()"), as (mangled, demangled) pairs. Finding them takes
+// a scan of the ELF symbol table of the library, so they are cached in the
+// file $ZCM_PLUGIN_CACHE (by default $XDG_CACHE_HOME/zcm/plugin-symbols or
+// ~/.cache/zcm/plugin-symbols) by the path, mtime and size of the library:
+// each version of a library is only scanned once. An empty ZCM_PLUGIN_CACHE
+// turns the cache off. Returns false if the library can't be read
+bool findPluginSymbols(const std::string& libname, const std::string& suffix,
+                       std::vector<std::pair<std::string, std::string>>& symbols,
+                       bool debug = false);
@@ -1,14 +1,13 @@
 #include <cstring>
 #include <algorithm>
 #include <memory>
-#include <cxxabi.h>
 #include <typeinfo>
 #include <dlfcn.h>
 
 #include "zcm/util/Common.hpp"
 #include "util/StringUtil.hpp"
 
-#include "SymtabElf.hpp"
+#include "PluginSymbols.hpp"
 
 #include "TranscoderPluginDb.hpp"
 
@@ -18,18 +17,6 @@
 
 using namespace std;
 
-static inline std::string demangle(std::string name)
-{
-    int status = 42; // some arbitrary value to eliminate the compiler warning
-
-    std::unique_ptr<char, void(*)(void*)> res {
-        abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status),
-        std::free
-    };
-
-    return (status==0) ? res.get() : name ;
-}
-
 static void* openlib(const string& libname)
 {
     // verify the .so library
@@ -60,19 +47,14 @@ bool TranscoderPluginDb::findPlugins(const string& libname)
         return false;
     }
 
-    // read the library's symbol table
-    SymtabElf stbl{libname};
-    if (!stbl.good()) {
-        ERROR("ERR: failed to load symbol table for ELF file\n");
-        return false;
-    }
+    vector<pair<string, string>> symbols;
+    if (!findPluginSymbols(libname, method, symbols, debug)) return false;
 
     // process the symbols
-    string s;
-    while (stbl.getNext(s)) {
-        string demangled = demangle(s);
-        //DEBUG("%s\n", demangled.c_str());
-        if (!StringUtil::endswith(demangled, method)) continue;
+    size_t found = pluginMeta.size();
+    for (auto& sym : symbols) {
+        const string& s = sym.first;
+        const string& demangled = sym.second;
 
         TranscoderPluginMetadata md;
         size_t methodPos = demangled.find(method);
@@ -93,12 +75,14 @@ bool TranscoderPluginDb::findPlugins(const string& libname)
         DEBUG("Success loading plugin %s\n", demangled.c_str());
     }
 
-    for (auto& meta : pluginMeta) {
+    for (size_t i = found; i < pluginMeta.size(); ++i) {
+        auto& meta = pluginMeta[i];
         zcm::TranscoderPlugin* p = (zcm::TranscoderPlugin*) meta.makeTranscoderPlugin();
         DEBUG("Added new plugin with address %p\n", p);
         plugins.push_back(p);
         constPlugins.push_back(plugins.back());
         names.push_back(meta.className);
+        factories.push_back(meta.makeTranscoderPlugin);
     }
 
     DEBUG("Loaded %d plugins from %s\n", (int)plugins.size(), libname.c_str());
@@ -112,6 +96,29 @@ std::vector<const zcm::TranscoderPlugin*> TranscoderPluginDb::getPlugins() const
 std::vector<string> TranscoderPluginDb::getPluginNames() const
 { return names; }
 
+zcm::TranscoderPlugin* TranscoderPluginDb::makePlugin(size_t i) const
+{ return factories[i](); }
+
+TranscoderRouter::TranscoderRouter(const vector<zcm::TranscoderPlugin*>& plugins)
+{
+    vector<vector<int64_t>> handled;
+    for (auto* p : plugins) {
+        handled.push_back(p->handledHashes());
+        for (int64_t h : handled.back()) byHash[h];
+    }
+    for (size_t i = 0; i < plugins.size(); ++i) {
+        if (handled[i].empty()) {
+            everyHash.push_back(plugins[i]);
+            for (auto& h : byHash) h.second.push_back(plugins[i]);
+            continue;
+        }
+        for (int64_t h : handled[i]) {
+            auto& route = byHash[h];
+            if (route.empty() || route.back() != plugins[i]) route.push_back(plugins[i]);
+        }
+    }
+}
+
 TranscoderPluginDb::TranscoderPluginDb(const string& paths, bool debug) : debug(debug)
 {
     for (auto& libname : StringUtil::split(paths, ':')) {
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 
 #include "zcm/tools/TranscoderPlugin.hpp"
 
@@ -14,6 +15,23 @@ struct TranscoderPluginMetadata
     { return className == o.className; }
 };
 
+// Which of a set of plugins to call on events of a given type hash, from
+// what they say they handle. Plugins stay in their original order
+class TranscoderRouter
+{
+  public:
+    TranscoderRouter(const std::vector<zcm::TranscoderPlugin*>& plugins);
+    const std::vector<zcm::TranscoderPlugin*>& route(int64_t hash) const
+    {
+        auto it = byHash.find(hash);
+        return it == byHash.end() ? everyHash : it->second;
+    }
+
+  private:
+    std::vector<zcm::TranscoderPlugin*> everyHash;
+    std::unordered_map<int64_t, std::vector<zcm::TranscoderPlugin*>> byHash;
+};
+
 class TranscoderPluginDb
 {
   public:
@@ -22,6 +40,8 @@ class TranscoderPluginDb
     ~TranscoderPluginDb();
     std::vector<const zcm::TranscoderPlugin*> getPlugins() const;
     std::vector<std::string> getPluginNames() const;
+    // Makes another instance of getPlugins()[i], owned by the caller
+    zcm::TranscoderPlugin* makePlugin(size_t i) const;
 
   private:
     bool findPlugins(const std::string& libname);
@@ -29,5 +49,6 @@ class TranscoderPluginDb
     std::vector<TranscoderPluginMetadata> pluginMeta;
     std::vector<zcm::TranscoderPlugin*> plugins;
     std::vector<std::string> names;
+    std::vector<zcm::TranscoderPlugin* (*)(void)> factories;
     std::vector<const zcm::TranscoderPlugin*> constPlugins;
 };
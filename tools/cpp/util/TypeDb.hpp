@@ -27,6 +27,8 @@ class TypeDb
   private:
     bool findTypenames(std::vector<std::string>& result, const std::string& libname);
     bool loadtypes(const std::string& libname, void* lib);
+    bool loadRegistry(const std::string& libname, void* lib);
+    void addType(const std::string& name, const zcm_type_info_t* typeinfo);
 
   private:
     bool debug;
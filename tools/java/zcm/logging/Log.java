@@ -4,6 +4,7 @@ import java.awt.*;
 import java.awt.event.*;
 import java.io.*;
 import java.util.*;
+import java.util.concurrent.*;
 
 import zcm.util.*;
 import zcm.zcm.*;
@@ -16,8 +17,22 @@ public class Log
     BufferedRandomAccessFile raf;
 
     static final int LOG_MAGIC = 0xEDA1DA01;
+    static final int INDEX_MAGIC = 0xEDA1DA1D;
     String path;
 
+    /** The time index of the log ("<path>.tidx", see zcm/eventlog.h): the
+     * time and offset of an event every few MB. Null if the log has none or
+     * it doesn't match the log. **/
+    long indexTimes[], indexOffsets[];
+
+    /** Time of the first and the last event, when the log is indexed **/
+    long startUtime, endUtime;
+
+    /** Time of the last event read (or seeked to), and its end **/
+    long lastUtime, lastEnd;
+
+    ReadAhead readAhead;
+
     /** Used to count the number of messages written so far. **/
     long numMessagesWritten = 0;
 
@@ -45,6 +60,75 @@ public class Log
          * Channel on which the message was received.
          */
         public String channel;
+
+        /** Offsets of the event and of its end in the log file **/
+        long offset, end;
+    }
+
+    /**
+     * Reads the events of the log ahead of readNext(), on a thread of its
+     * own, into a queue of up to a given number of events.
+     */
+    class ReadAhead extends Thread
+    {
+        int maxEvents;
+        BlockingQueue<Object> queue;
+        volatile boolean stop;
+        IOException error;
+
+        ReadAhead(int maxEvents)
+        {
+            this.maxEvents = maxEvents;
+            queue = new ArrayBlockingQueue<Object>(maxEvents);
+            setDaemon(true);
+        }
+
+        public void run()
+        {
+            try {
+                while (!stop) {
+                    Object o;
+                    try {
+                        o = readEvent();
+                    } catch (IOException ex) {
+                        o = ex;
+                    }
+                    while (!stop && !queue.offer(o, 50, TimeUnit.MILLISECONDS));
+                    // Errors, including the EOF, end the reading
+                    if (o instanceof IOException)
+                        break;
+                }
+            } catch (InterruptedException ex) {
+            }
+        }
+
+        Event take() throws IOException
+        {
+            if (error != null)
+                throw error;
+
+            Object o;
+            try {
+                o = queue.take();
+            } catch (InterruptedException ex) {
+                throw new InterruptedIOException();
+            }
+            if (o instanceof IOException) {
+                error = (IOException) o;
+                throw error;
+            }
+            return (Event) o;
+        }
+
+        /** Stops the thread, dropping the events it read ahead **/
+        void finish()
+        {
+            stop = true;
+            try {
+                join();
+            } catch (InterruptedException ex) {
+            }
+        }
     }
 
     /**
@@ -59,6 +143,115 @@ public class Log
         this.path = path;
         raf = new BufferedRandomAccessFile(path, mode);
         //raf = new RandomAccessFile(path, mode);
+
+        if (mode.equals("r"))
+            loadIndex();
+    }
+
+    /** Loads the time index of the log, if it has one that matches it **/
+    void loadIndex() throws IOException
+    {
+        File f = new File(path + ".tidx");
+        if (!f.isFile())
+            return;
+
+        int n = (int) ((f.length() - 4) / 24);
+        if (n <= 0)
+            return;
+        long times[] = new long[n], offsets[] = new long[n];
+        DataInputStream ins = new DataInputStream(new BufferedInputStream(new FileInputStream(f)));
+        try {
+            if (ins.readInt() != INDEX_MAGIC)
+                return;
+            for (int i = 0; i < n; i++) {
+                times[i] = ins.readLong();
+                ins.readLong(); // event number
+                offsets[i] = ins.readLong();
+            }
+        } catch (EOFException ex) {
+            return;
+        } finally {
+            ins.close();
+        }
+
+        try {
+            startUtime = readEvent().utime;
+
+            // The last entry has to be the event at its offset, and the last
+            // event of the log is no further than the next entry would be
+            raf.seek(offsets[n-1]);
+            Event e = readEvent();
+            if (e.offset != offsets[n-1] || e.utime != times[n-1])
+                return;
+            endUtime = e.utime;
+            try {
+                while (true)
+                    endUtime = readEvent().utime;
+            } catch (EOFException ex) {
+            }
+
+            if (endUtime > startUtime) {
+                indexTimes = times;
+                indexOffsets = offsets;
+            }
+        } catch (EOFException ex) {
+        } finally {
+            raf.seek(0);
+        }
+    }
+
+    /**
+     * Whether the log has a time index. The positions of an indexed log are
+     * fractions of its time span, rather than of its size, and seeking it
+     * takes a single read.
+     */
+    public boolean hasIndex()
+    {
+        return indexTimes != null;
+    }
+
+    /** Time of the first event of an indexed log **/
+    public long getStartUtime()
+    {
+        return startUtime;
+    }
+
+    /** Time of the last event of an indexed log **/
+    public long getEndUtime()
+    {
+        return endUtime;
+    }
+
+    /**
+     * Reads events ahead of readNext() on a background thread, keeping up to
+     * 'maxEvents' of them decoded. 0 stops reading ahead.
+     */
+    public synchronized void setReadAhead(int maxEvents) throws IOException
+    {
+        stopReadAhead();
+        if (maxEvents > 0) {
+            readAhead = new ReadAhead(maxEvents);
+            readAhead.start();
+        }
+    }
+
+    /** Stops reading ahead, the file where the last event read ended **/
+    void stopReadAhead() throws IOException
+    {
+        if (readAhead == null)
+            return;
+        readAhead.finish();
+        readAhead = null;
+        raf.seek(lastEnd);
+    }
+
+    /** Reads ahead again, if the log was, after a seek **/
+    void restartReadAhead(ReadAhead ra)
+    {
+        if (ra == null)
+            return;
+        readAhead = new ReadAhead(ra.maxEvents);
+        readAhead.start();
     }
 
     /**
@@ -84,6 +277,15 @@ public class Log
      * @throws java.io.EOFException if the end of the file has been reached.
      */
     public synchronized Event readNext() throws IOException
+    {
+        Event e = (readAhead != null) ? readAhead.take() : readEvent();
+        lastUtime = e.utime;
+        lastEnd = e.end;
+        return e;
+    }
+
+    /** Reads the event at the file pointer, or the first one after it **/
+    Event readEvent() throws IOException
     {
         int magic = 0;
         Event e = new Event();
@@ -98,6 +300,7 @@ public class Log
             if (magic != LOG_MAGIC)
                 continue;
 
+            e.offset      = raf.getFilePointer() - 4;
             e.eventNumber = raf.readLong();
             e.utime       = raf.readLong();
 
@@ -118,23 +321,100 @@ public class Log
         raf.readFully(bchannel);
         e.channel = new String(bchannel);
         raf.readFully(e.data);
+        e.end = raf.getFilePointer();
 
         return e;
     }
 
+    /**
+     * The position in the log of the last event read, as a fraction of its
+     * time span if it is indexed, of its size otherwise.
+     */
     public synchronized double getPositionFraction() throws IOException
     {
-        return raf.getFilePointer()/((double) raf.length());
+        if (!hasIndex())
+            return lastEnd/((double) raf.length());
+
+        double frac = (lastUtime - startUtime)/((double) (endUtime - startUtime));
+        return Math.max(0, Math.min(1, frac));
     }
 
     /**
-     * Seek to a position in the log file, specified by a fraction.
+     * Seek to a position in the log file, specified by a fraction. Indexed
+     * logs are positioned at the first event at or after that fraction of
+     * their time span.
      *
      * @param frac a number in the range [0, 1)
      */
     public synchronized void seekPositionFraction(double frac) throws IOException
     {
+        if (hasIndex()) {
+            seekToTimestamp(startUtime + (long) ((endUtime - startUtime)*frac));
+            return;
+        }
+
+        ReadAhead ra = readAhead;
+        stopReadAhead();
         raf.seek((long) (raf.length()*frac));
+        lastEnd = raf.getFilePointer();
+        restartReadAhead(ra);
+    }
+
+    /**
+     * Seek to the first event logged at or after 'utime', or to the end of
+     * the log if there is none. Indexed logs are read from the last entry of
+     * their index before it, others are bisected.
+     */
+    public synchronized void seekToTimestamp(long utime) throws IOException
+    {
+        ReadAhead ra = readAhead;
+        stopReadAhead();
+
+        long from = 0;
+        if (hasIndex()) {
+            // The last entry before 'utime'
+            int lo = -1, hi = indexTimes.length;
+            while (hi - lo > 1) {
+                int mid = (lo + hi) >>> 1;
+                if (indexTimes[mid] < utime)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            if (lo >= 0)
+                from = indexOffsets[lo];
+        } else {
+            long lo = 0, hi = raf.length();
+            while (hi - lo > 64*1024) {
+                long mid = lo + (hi - lo)/2;
+                raf.seek(mid);
+                Event e = null;
+                try {
+                    e = readEvent();
+                } catch (EOFException ex) {
+                }
+                if (e != null && e.utime < utime)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            from = lo;
+        }
+
+        raf.seek(from);
+        try {
+            while (true) {
+                Event e = readEvent();
+                if (e.utime >= utime) {
+                    raf.seek(e.offset);
+                    break;
+                }
+            }
+        } catch (EOFException ex) {
+        }
+        lastUtime = utime;
+        lastEnd = raf.getFilePointer();
+        restartReadAhead(ra);
     }
 
     /**
@@ -178,6 +458,7 @@ public class Log
      */
     public synchronized void close() throws IOException
     {
+        stopReadAhead();
         raf.close();
     }
 }
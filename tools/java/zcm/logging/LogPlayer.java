@@ -54,6 +54,9 @@ public class LogPlayer extends JComponent
 
     BlockingQueue<QueuedEvent> events = new LinkedBlockingQueue<QueuedEvent>();
 
+    /** How many events are read ahead of the player, in the background **/
+    static final int READ_AHEAD_EVENTS = 256;
+
     Object sync = new Object();
 
     interface QueuedEvent
@@ -127,6 +130,11 @@ public class LogPlayer extends JComponent
 
         public void execute(LogPlayer lp)
         {
+            // Dragging the scrubber queues seeks faster than they're done:
+            // only the last of them matters
+            if (events.peek() instanceof SeekEvent)
+                return;
+
             boolean player_was_running = (player != null);
 
             if (player_was_running)
@@ -611,6 +619,8 @@ public class LogPlayer extends JComponent
             savePreferences();
 
         currentLogPath = path;
+        if (log != null)
+            log.close();
         log = new Log(path, "r");
         logName.setText(new File(path).getName());
 
@@ -623,16 +633,21 @@ public class LogPlayer extends JComponent
             slowerButton.setEnabled(true);
             js.setEnabled(true);
 
-            log.seekPositionFraction(.10);
-            Log.Event e10 = log.readNext();
+            if (log.hasIndex()) {
+                total_seconds = (log.getEndUtime() - log.getStartUtime())/1000000.0;
+            } else {
+                log.seekPositionFraction(.10);
+                Log.Event e10 = log.readNext();
 
-            log.seekPositionFraction(.90);
-            Log.Event e90 = log.readNext();
+                log.seekPositionFraction(.90);
+                Log.Event e90 = log.readNext();
 
-            total_seconds = (e90.utime - e10.utime)/1000000.0 / 0.8;
+                total_seconds = (e90.utime - e10.utime)/1000000.0 / 0.8;
+            }
             System.out.printf("Total seconds: %f\n", total_seconds);
 
             log.seekPositionFraction(0);
+            log.setReadAhead(READ_AHEAD_EVENTS);
 
         } catch (IOException ex) {
             System.out.println("exception: "+ex);
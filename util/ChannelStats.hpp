@@ -0,0 +1,224 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include "util/Types.hpp"
+
+// Counts of values in buckets of logarithmic width, 8 per power of two, so
+// that the quantiles read from it are within 1/16 of the actual values (exact
+// below 8), without storing the values themselves. Counts are only written by
+// one thread, and can be read by another through snapshots
+class LogHistogram
+{
+  public:
+    static constexpr u64 SUB_BITS = 3;
+    static constexpr u64 SUB = 1 << SUB_BITS;
+    static constexpr size_t NBUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    struct Snapshot
+    {
+        u64 counts[NBUCKETS] = {};
+        u64 total = 0;
+
+        // Counts of 'this' not in 'older', a snapshot of the same histogram
+        void subtract(const Snapshot& older)
+        {
+            total = 0;
+            for (size_t i = 0; i < NBUCKETS; ++i) {
+                counts[i] -= older.counts[i];
+                total += counts[i];
+            }
+        }
+
+        // 'q' from 0 to 1. Returns 0 when empty
+        u64 quantile(double q) const
+        {
+            if (total == 0) return 0;
+            u64 rank = q * (total - 1);
+            u64 seen = 0;
+            for (size_t i = 0; i < NBUCKETS; ++i) {
+                seen += counts[i];
+                if (seen > rank) return value(i);
+            }
+            return value(NBUCKETS - 1);
+        }
+
+        u64 max() const
+        {
+            for (size_t i = NBUCKETS; i > 0; --i)
+                if (counts[i - 1]) return value(i - 1);
+            return 0;
+        }
+
+        // Number of values in buckets entirely above 'v'
+        u64 countAbove(u64 v) const
+        {
+            u64 n = 0;
+            for (size_t i = NBUCKETS; i > 0 && low(i - 1) > v; --i)
+                n += counts[i - 1];
+            return n;
+        }
+    };
+
+    // Only ever called by one thread
+    void add(u64 v)
+    {
+        std::atomic<u64>& c = counts[bucket(v)];
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void snapshot(Snapshot& s) const
+    {
+        s.total = 0;
+        for (size_t i = 0; i < NBUCKETS; ++i) {
+            s.counts[i] = counts[i].load(std::memory_order_relaxed);
+            s.total += s.counts[i];
+        }
+    }
+
+    static size_t bucket(u64 v)
+    {
+        if (v < SUB) return v;
+        u64 shift = 63 - __builtin_clzll(v) - SUB_BITS;
+        return (shift + 1) * SUB + ((v >> shift) - SUB);
+    }
+
+    // Lowest value of bucket 'i'
+    static u64 low(size_t i)
+    {
+        if (i < SUB) return i;
+        u64 shift = i / SUB - 1;
+        return (i % SUB + SUB) << shift;
+    }
+
+    // Middle of bucket 'i'
+    static u64 value(size_t i)
+    {
+        if (i < SUB) return i;
+        u64 shift = i / SUB - 1;
+        return low(i) + (((u64) 1 << shift) - 1) / 2;
+    }
+
+  private:
+    std::atomic<u64> counts[NBUCKETS] = {};
+};
+
+// Statistics of the messages received on a channel, updated by the receive
+// thread without ever waiting, and read by another one through
+// ChannelStatsWindow
+class ChannelStats
+{
+  public:
+    // Only ever called by one thread, with increasing 'recvUtime'
+    void addMessage(u64 recvUtime, u64 size)
+    {
+        numMsgs.store(numMsgs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        numBytes.store(numBytes.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+        sizes.add(size);
+        if (lastRecvUtime != 0 && recvUtime >= lastRecvUtime)
+            intervals.add(recvUtime - lastRecvUtime);
+        lastRecvUtime = recvUtime;
+    }
+
+    u64 getNumMsgs() const { return numMsgs.load(std::memory_order_relaxed); }
+    u64 getNumBytes() const { return numBytes.load(std::memory_order_relaxed); }
+
+  private:
+    friend class ChannelStatsWindow;
+
+    std::atomic<u64> numMsgs {0};
+    std::atomic<u64> numBytes {0};
+    // Message sizes, in bytes, and times between messages, in microseconds
+    LogHistogram sizes;
+    LogHistogram intervals;
+    u64 lastRecvUtime = 0;
+};
+
+// What a display reads of ChannelStats, updated at every refresh: rates
+// averaged over the last PERIOD, and distributions over the last one to two
+// PERIODs
+class ChannelStatsWindow
+{
+  public:
+    static constexpr u64 PERIOD = 4*1000*1000;
+
+    struct Dist
+    {
+        u64 p50 = 0;
+        u64 p99 = 0;
+        u64 max = 0;
+    };
+
+    void update(const ChannelStats& stats, u64 utime)
+    {
+        samples.push_back({ utime, stats.getNumMsgs(), stats.getNumBytes() });
+
+        // keep the latest sample at least PERIOD old as the reference
+        while (samples.size() > 2 && samples[1].utime + PERIOD <= utime)
+            samples.pop_front();
+
+        const Sample& oldest = samples.front();
+        const Sample& latest = samples.back();
+        u64 dt = latest.utime - oldest.utime;
+        if (dt == 0) {
+            hertz = bandwidth = 0.0;
+        } else {
+            hertz = (float) (latest.numMsgs - oldest.numMsgs) / ((float) dt / 1000000.0);
+            bandwidth = (float) (latest.numBytes - oldest.numBytes) / ((float) dt / 1000000.0);
+        }
+
+        stats.sizes.snapshot(sizesNow);
+        stats.intervals.snapshot(intervalsNow);
+        if (histsUtime == 0 || histsUtime + PERIOD <= utime) {
+            histsUtime = utime;
+            olderValid = oldValid;
+            sizesOlder = sizesOld;
+            intervalsOlder = intervalsOld;
+            oldValid = true;
+            sizesOld = sizesNow;
+            intervalsOld = intervalsNow;
+        }
+        if (olderValid) {
+            sizesNow.subtract(sizesOlder);
+            intervalsNow.subtract(intervalsOlder);
+        }
+
+        size = dist(sizesNow);
+        interval = dist(intervalsNow);
+        // Intervals over twice the usual one
+        gaps = interval.p50 ? intervalsNow.countAbove(2 * interval.p50) : 0;
+    }
+
+    float hertz = 0.0;
+    // In bytes per second
+    float bandwidth = 0.0;
+    // In bytes
+    Dist size;
+    // Between messages, in microseconds
+    Dist interval;
+    u64 gaps = 0;
+
+  private:
+    static Dist dist(const LogHistogram::Snapshot& s)
+    {
+        Dist d;
+        d.p50 = s.quantile(0.50);
+        d.p99 = s.quantile(0.99);
+        d.max = s.max();
+        return d;
+    }
+
+    struct Sample
+    {
+        u64 utime;
+        u64 numMsgs;
+        u64 numBytes;
+    };
+    std::deque<Sample> samples;
+
+    // Taken every PERIOD: distributions are what was added since 'older'
+    u64 histsUtime = 0;
+    bool oldValid = false, olderValid = false;
+    LogHistogram::Snapshot sizesOld, intervalsOld;
+    LogHistogram::Snapshot sizesOlder, intervalsOlder;
+    LogHistogram::Snapshot sizesNow, intervalsNow;
+};
@@ -1,5 +1,7 @@
 #pragma once
 #include <sys/time.h>
+#include <time.h>
+#include <errno.h>
 #include "util/Types.hpp"
 
 namespace TimeUtil
@@ -10,4 +12,33 @@ namespace TimeUtil
         gettimeofday(&tv, NULL);
         return (u64)tv.tv_sec * 1000000 + tv.tv_usec;
     }
+
+    // Wall clock, in nanoseconds
+    static u64 realNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    // Monotonic clock, in nanoseconds
+    static u64 monoNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    // Returns once monoNs() reaches 'deadline': sleeps until 'spinNs' before it,
+    // then spins, since waking up from a sleep is rarely that precise
+    static void sleepUntilNs(u64 deadline, u64 spinNs)
+    {
+        if (deadline > spinNs && monoNs() < deadline - spinNs) {
+            struct timespec ts;
+            ts.tv_sec  = (deadline - spinNs) / 1000000000;
+            ts.tv_nsec = (deadline - spinNs) % 1000000000;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        }
+        while (monoNs() < deadline);
+    }
 }
@@ -1,17 +1,41 @@
 #include "zcm/zcm.h"
 #include "zcm/zcm_private.h"
+#include "zcm/zcm_coretypes.h"
 #include "zcm/blocking.h"
 #include "zcm/transport.h"
 #include "zcm/util/threadsafe_queue.hpp"
+#include "zcm/util/multilevel_queue.hpp"
+#include "zcm/util/slab_arena.hpp"
+#include "zcm/util/mem_budget.hpp"
+#include "zcm/util/channel_matcher.hpp"
+#include "zcm/util/thread_util.hpp"
+#include "zcm/util/latency_hist.h"
+#include "zcm/util/probes.h"
+#ifdef USING_SPSC_QUEUE
+# include "zcm/util/spsc_queue.hpp"
+#endif
 #include "zcm/util/debug.h"
 
 #include "util/TimeUtil.hpp"
 
 #include <unistd.h>
+#include <fcntl.h>
+#ifdef USING_ZLIB
+# include <zlib.h>
+#endif
+#ifdef __linux__
+# include <sys/eventfd.h>
+#endif
 #include <cassert>
+#include <climits>
 #include <cstring>
 
 #include <unordered_map>
+#include <map>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <atomic>
 #include <vector>
 #include <string>
 #include <iostream>
@@ -23,29 +47,144 @@ using namespace std;
 
 #define RECV_TIMEOUT 100
 
+// Max number of messages handed to sendmsg_batch() at once
+#define SEND_BATCH_MAX 32
+
+// Max number of channels getStats() reports on one by one
+#define STATS_CHANNELS_MAX 1024
+
+// In busy-poll mode, how long (in us) a dispatcher polls its queue before
+// re-checking the running condition
+#define BUSY_POLL_CHECK_US 1000
+
+// Each recv queue only ever has one producer (the recv thread) and one consumer
+// (its dispatcher, serialized by dispOneMutex) so it may use the lock-free queue.
+// The sendQueue is fed by every publishing thread and can't.
+#ifdef USING_SPSC_QUEUE
+template <class Element> using RecvQueue = SpscQueue<Element>;
+#else
+template <class Element> using RecvQueue = ThreadsafeQueue<Element>;
+#endif
+
+struct SubSnapshot;
+
+// Counters written by one thread at a time don't need a read-modify-write
+static inline void statAdd(atomic<uint64_t>& c, uint64_t v)
+{
+    c.store(c.load(memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+// What zcm_hold_recv_buf() hands out: the memory of a message claimed from
+// the transport, given back to it once the message and every hold are done
+struct zcm_held_msg_t
+{
+    zcm_trans_t*     owner;
+    void*            token;
+    atomic<uint32_t> refs;
+};
+
+static void releaseHeld(zcm_held_msg_t* held)
+{
+    if (held->refs.fetch_sub(1) != 1) return;
+    zcm_trans_recvmsg_release(held->owner, held->token);
+    delete held;
+}
+
 // A C++ class that manages a zcm_msg_t*
 struct Msg
 {
     zcm_msg_t msg;
 
-    // NOTE: copy the provided data into this object
-    Msg(uint64_t utime, const char* channel, size_t len, const uint8_t* buf)
+    // When set, the channel and data share a single block from this arena
+    SlabArena* arena = nullptr;
+    size_t     memSize = 0;
+
+    // When set, the memory of 'msg' belongs to this transport and
+    // is handed back to it (via 'token') on destruction
+    zcm_trans_t* owner = nullptr;
+    void*        token = nullptr;
+    // Set once the message is held (see hold()), which then owns that memory
+    zcm_held_msg_t* held = nullptr;
+
+    // The footprint() of the message, charged to 'budget' until destruction
+    MemBudget* budget;
+    size_t     charged;
+
+    // Called by notifySent(), or on destruction if the message was never sent
+    zcm_sent_handler_t onSent = nullptr;
+    void*              onSentUsr = nullptr;
+
+    // Subscriptions resolved by the recv thread, valid as long as 'snap'
+    // is still the current subscription snapshot. Holding 'snap' also
+    // keeps every sub in 'route' alive
+    ChannelMatcher::Result             route;
+    shared_ptr<const SubSnapshot>      snap;
+
+    // The bytes a message counts for against a MemBudget: its channel, NULL and data
+    static size_t footprint(const char* channel, size_t len)
+    {
+        return strlen(channel) + 1 + len;
+    }
+
+    // NOTE: copy the provided data into this object. The channel and data
+    //       are packed into one arena block: [channel '\0'][data]
+    Msg(MemBudget* budget, SlabArena* arena, uint64_t utime,
+        const char* channel, size_t len, const uint8_t* buf,
+        zcm_sent_handler_t onSent = nullptr, void* onSentUsr = nullptr)
+        : arena(arena), budget(budget), onSent(onSent), onSentUsr(onSentUsr)
     {
+        size_t chanLen = strlen(channel);
+        memSize = chanLen + 1 + len;
+        charged = memSize;
+        uint8_t* mem = arena->alloc(memSize);
+        memcpy(mem, channel, chanLen + 1);
+        memcpy(mem + chanLen + 1, buf, len);
+
         msg.utime = utime;
-        msg.channel = strdup(channel);
+        msg.channel = (const char*) mem;
         msg.len = len;
-        msg.buf = (uint8_t*)malloc(len);
-        memcpy(msg.buf, buf, len);
+        msg.buf = mem + chanLen + 1;
+        msg.chan_hash = 0;
+        msg.recv_ns = 0;
+    }
+
+    // Calls 'onSent' (once) with the result of sending the message. Must not be
+    // called while holding the lock of the queue the message is in
+    void notifySent(int rc)
+    {
+        if (!onSent) return;
+        zcm_sent_handler_t cb = onSent;
+        onSent = nullptr;
+        cb(rc, onSentUsr);
+    }
+
+    Msg(MemBudget* budget, SlabArena* arena, uint64_t utime, const zcm_pub_msg_t& pub)
+        : Msg(budget, arena, utime, pub.channel, pub.len, pub.data) {}
+
+    Msg(MemBudget* budget, SlabArena* arena, zcm_msg_t* msg,
+        ChannelMatcher::Result route, shared_ptr<const SubSnapshot> snap)
+        : Msg(budget, arena, msg->utime, msg->channel, msg->len, msg->buf)
+    {
+        this->msg.chan_hash = msg->chan_hash;
+        this->msg.recv_ns = msg->recv_ns;
+        this->route = std::move(route);
+        this->snap = std::move(snap);
     }
 
-    Msg(zcm_msg_t* msg) : Msg(msg->utime, msg->channel, msg->len, msg->buf) {}
+    // NOTE: no copy, the memory was claimed from the transport via recvmsg_claim()
+    Msg(MemBudget* budget, zcm_msg_t* msg, zcm_trans_t* owner, void* token,
+        ChannelMatcher::Result route, shared_ptr<const SubSnapshot> snap)
+        : msg(*msg), owner(owner), token(token),
+          budget(budget), charged(footprint(msg->channel, msg->len)),
+          route(std::move(route)), snap(std::move(snap)) {}
 
     ~Msg()
     {
-        if (msg.channel)
-            free((void*)msg.channel);
-        if (msg.buf)
-            free((void*)msg.buf);
+        notifySent(ZCM_EINTR);
+        budget->release(charged);
+        if (held)       releaseHeld(held);
+        else if (owner) zcm_trans_recvmsg_release(owner, token);
+        else            arena->free((uint8_t*) msg.channel, memSize);
         memset(&msg, 0, sizeof(msg));
     }
 
@@ -54,6 +193,17 @@ struct Msg
         return &msg;
     }
 
+    // Keeps the memory of the message past its destruction, until the
+    // returned hold is released. Only messages claimed from the transport can
+    // be held: the others return NULL
+    zcm_held_msg_t* hold()
+    {
+        if (!owner) return nullptr;
+        if (!held) held = new zcm_held_msg_t { owner, token, {1} };
+        held->refs.fetch_add(1);
+        return held;
+    }
+
   private:
     // Disable all copying and moving
     Msg(const Msg& other) = delete;
@@ -62,6 +212,131 @@ struct Msg
     Msg& operator=(Msg&& other) = delete;
 };
 
+// The zcm_sub_t handed out to users, plus what dispatch needs to know
+// whether it is still wanted.
+// Note: 'sub' must stay the first member, zcm_sub_t* is cast back to SubEntry*
+struct SubEntry
+{
+    zcm_sub_t    sub;
+    atomic<bool> live {true};
+
+    // Set for zcm_subscribe_batch() subs, which always have a SubQueue,
+    // instead of sub.callback
+    zcm_batch_handler_t batchCb = nullptr;
+    uint32_t            maxBatch = 1;
+
+    // See zcm_set_sub_priority()
+    atomic<int> priority {ZCM_PRIORITY_NORMAL};
+
+    // See zcm_set_sub_decimation(). The settings may change at any time,
+    // the rest is only touched by the recv thread
+    atomic<uint32_t> minPeriodUs {0};
+    atomic<uint32_t> keepEvery {0};
+    uint64_t         seen = 0;
+    uint64_t         lastKeptUtime = 0;
+
+    // See zcm_set_sub_max_age(). May change at any time, and like the
+    // dispatch counters below, the drops take read-modify-writes
+    atomic<uint32_t> maxAgeUs {0};
+    atomic<uint64_t> staleDrops {0};
+
+    // Called by the recv thread: whether the sub wants a message received at 'utime'
+    bool keep(uint64_t utime)
+    {
+        uint32_t every = keepEvery.load(memory_order_relaxed);
+        if (every > 1 && seen++ % every != 0) return false;
+        uint32_t period = minPeriodUs.load(memory_order_relaxed);
+        if (period) {
+            // Note: a receive time going backwards restarts the period
+            if (lastKeptUtime && utime >= lastKeptUtime &&
+                utime - lastKeptUtime < period) return false;
+            lastKeptUtime = utime;
+        }
+        return true;
+    }
+
+    // See zcm_set_sub_filter(). Only ever swapped with atomic_load() and
+    // atomic_store(), so it may change while the recv thread reads it
+    struct Filter
+    {
+        zcm_filter_t fn;
+        void*        usr;
+    };
+    shared_ptr<const Filter> filter;
+
+    bool accepts(const uint8_t* data, uint32_t len, const char* channel) const
+    {
+        shared_ptr<const Filter> f = atomic_load(&filter);
+        return !f || f->fn(data, len, channel, f->usr);
+    }
+
+    // Reported by getStats(). Regex subs may be dispatched by several
+    // dispatchers at once, so these take read-modify-writes
+    uint64_t         id = 0;
+    atomic<uint64_t> dispatchMsgs {0};
+    atomic<uint64_t> dispatchNs {0};
+    atomic<uint64_t> dispatchMaxNs {0};
+    // Only counted into with dispatch profiling on (see zcm_latency_hist_bucket())
+    atomic<uint64_t> dispatchHist[ZCM_LATENCY_HIST_BUCKETS] {};
+
+    void addDispatch(uint64_t ns)
+    {
+        dispatchMsgs.fetch_add(1, memory_order_relaxed);
+        dispatchNs.fetch_add(ns, memory_order_relaxed);
+        uint64_t max = dispatchMaxNs.load(memory_order_relaxed);
+        while (ns > max && !dispatchMaxNs.compare_exchange_weak(max, ns, memory_order_relaxed));
+    }
+
+    ~SubEntry()
+    {
+        if (sub.regex) delete (std::regex*) sub.regexobj;
+    }
+
+    static SubEntry* of(zcm_sub_t* sub) { return reinterpret_cast<SubEntry*>(sub); }
+};
+static_assert(std::is_standard_layout<SubEntry>::value,
+              "SubEntry must be castable from its first member");
+
+// A bounded queue private to one subscription (see zcm_set_sub_queue()).
+// Never blocks the recv thread: when full, 'policy' decides what is dropped
+struct SubQueue
+{
+    size_t depth;
+    enum zcm_queue_policy policy;
+
+    mutex mut;
+    deque<unique_ptr<Msg>> msgs;
+
+    SubQueue(size_t depth, enum zcm_queue_policy policy) : depth(depth), policy(policy) {}
+};
+
+// An immutable view of the subscriptions. subscribe(), unsubscribe() and
+// setSubQueue() build a new one and swap it in atomically, so the recv thread
+// and the dispatchers read the subscriptions without taking any lock, and
+// outdated snapshots live on until the last message routed with them is done
+struct SubSnapshot
+{
+    shared_ptr<ChannelMatcher> matcher; // never add()ed to or remove()d from
+    vector<shared_ptr<SubEntry>> entries;
+
+    // Subscriptions with their own queue
+    unordered_map<zcm_sub_t*, shared_ptr<SubQueue>> subQueues;
+
+    // Whether any subscription has been decimated (see zcm_set_sub_decimation())
+    bool decimated = false;
+    // Whether any subscription has been filtered (see zcm_set_sub_filter())
+    bool filtered = false;
+    // Whether any subscription has been given a priority (see zcm_set_sub_priority())
+    bool prioritized = false;
+
+    bool contains(zcm_sub_t* sub) const
+    {
+        for (auto& e : entries)
+            if (&e->sub == sub) return true;
+        return false;
+    }
+};
+
 static bool isRegexChannel(const string& channel)
 {
     // These chars are considered regex
@@ -77,11 +352,81 @@ static bool isRegexChannel(const string& channel)
     return false;
 }
 
-struct zcm_blocking
+// See zcm_add_timer(). 'nextNs' is a TimeUtil::monoNs() deadline, guarded by
+// timerMutex like the list of timers
+struct zcm_timer_t
 {
-  private:
-    using SubList = vector<zcm_sub_t*>;
+    uint64_t            periodNs;
+    uint64_t            nextNs;
+    zcm_timer_handler_t cb;
+    void*               usr;
+    // Cleared by removeTimer(), like SubEntry::live
+    atomic<bool>        live {true};
+};
 
+// A descriptor that is readable from arm() until disarm(): an eventfd on
+// Linux, a pipe elsewhere
+struct NotifyFd
+{
+    atomic<int>  rd {-1};
+    int          wr = -1;
+    atomic<bool> armed {false};
+
+    ~NotifyFd()
+    {
+        if (wr != rd) close(wr);
+        if (rd >= 0) close(rd);
+    }
+
+    bool open()
+    {
+#ifdef __linux__
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            perror("eventfd");
+            return false;
+        }
+        wr = fd;
+        rd = fd;
+#else
+        int fds[2];
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            return false;
+        }
+        for (int fd : fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        wr = fds[1];
+        rd = fds[0];
+#endif
+        return true;
+    }
+
+    // Does nothing unless open(), or if already armed
+    void arm()
+    {
+        if (rd < 0 || armed.exchange(true)) return;
+#ifdef __linux__
+        uint64_t one = 1;
+#else
+        char one = 1;
+#endif
+        if (write(wr, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("zcm notify fd -- write");
+    }
+
+    void disarm()
+    {
+        if (rd < 0 || !armed.exchange(false)) return;
+        char buf[64];
+        while (read(rd, buf, sizeof(buf)) > 0) {}
+    }
+};
+
+struct zcm_blocking
+{
   public:
     zcm_blocking(zcm_t* z, zcm_trans_t* zt_);
     ~zcm_blocking();
@@ -90,48 +435,362 @@ struct zcm_blocking
     void start();
     int stop(bool block);
     int handle();
+    int handleTimeout(uint32_t timeoutUs);
+    int handleNonblock();
+    int handleNonblockN(uint32_t maxMsgs, uint32_t budgetUs);
+    int getFd();
+    int getSendFd();
+    void sendQueued();
+    void closeSendFd();
+    int hasSubscribers(const char* channel);
 
     void pause();
     void resume();
 
-    int publish(const string& channel, const uint8_t* data, uint32_t len);
-    zcm_sub_t* subscribe(const string& channel, zcm_msg_handler_t cb, void* usr, bool block);
+    // With 'tryOnly' (or setTryPublish()), returns ZCM_EAGAIN rather than wait
+    int publish(const string& channel, const uint8_t* data, uint32_t len, bool tryOnly,
+                zcm_sent_handler_t onSent = nullptr, void* onSentUsr = nullptr);
+    int publishBatch(const zcm_pub_msg_t* msgs, uint32_t nmsgs);
+    int publishIov(const char* channel, const zcm_iov_t* iov, uint32_t niov);
+    void getPubStatus(const char* channel, zcm_pub_status_t* status);
+    zcm_sub_t* subscribe(const string& channel, zcm_msg_handler_t cb, void* usr, bool block,
+                         zcm_batch_handler_t batchCb = nullptr, uint32_t maxBatch = 1,
+                         uint32_t depth = 0);
     int unsubscribe(zcm_sub_t* sub, bool block);
+    zcm_timer_t* addTimer(uint64_t periodUs, zcm_timer_handler_t cb, void* usr);
+    int removeTimer(zcm_timer_t* timer);
     int flush(bool block);
+    int flushN(uint32_t maxMsgs, uint32_t budgetUs);
+    int getStats(zcm_stat_handler_t cb, void* usr);
+    int setDispatchProfiling(bool enable, uint32_t slowUs, zcm_slow_handler_t cb, void* usr);
 
     int setQueueSize(uint32_t numMsgs, bool block);
+    int setQueueBytes(uint64_t maxBytes);
+    int setDispatchThreads(uint32_t numThreads);
+    int setSubQueue(zcm_sub_t* sub, uint32_t depth, enum zcm_queue_policy policy);
+    int setSubDecimation(zcm_sub_t* sub, uint32_t minPeriodUs, uint32_t keepEvery);
+    int setSubPriority(zcm_sub_t* sub, enum zcm_priority prio);
+    int setSubMaxAge(zcm_sub_t* sub, uint32_t maxAgeUs);
+    int setSubFilter(zcm_sub_t* sub, zcm_filter_t filter, void* usr);
+    int setInlinePublish(bool enable);
+    int setTryPublish(bool enable);
+    int setStatsPublish(uint32_t periodMs);
+    int setTracePublish(bool enable);
+    int setChannelPriority(const char* channel, enum zcm_priority prio);
+    int setCompression(const char* channel, enum zcm_codec codec, uint32_t minSize);
+    int setDecompress(bool enable);
+    int setRecvStrategy(enum zcm_recv_strategy strategy, uint32_t spinUs);
+    int setThreadAffinity(enum zcm_thread which, const vector<int>& cpus);
+    int setNumaNode(int node);
+    int setThreadPriority(enum zcm_thread which, int priority);
+    int setThreadName(enum zcm_thread which, const string& name);
+
+    void setUrlOpts(zcm_url_opts_t* opts);
 
   private:
+    // Latencies of the traced messages (see zcm_set_trace_publish()) on one
+    // channel, only written by the dispatcher owning them
+    struct TraceCounters
+    {
+        string           name;
+        atomic<uint64_t> msgs {0};
+        atomic<uint64_t> skewed {0};
+        atomic<uint64_t> minNs {UINT64_MAX};
+        atomic<uint64_t> recvHist[ZCM_LATENCY_HIST_BUCKETS] {};
+        atomic<uint64_t> dispatchHist[ZCM_LATENCY_HIST_BUCKETS] {};
+
+        TraceCounters(const char* name) : name(name) {}
+    };
+
+    // Each dispatcher owns a recv queue and dispatches it from one thread.
+    // Every channel is always routed to the same dispatcher, so messages on a
+    // channel are dispatched in order while independent channels can be
+    // dispatched concurrently by different dispatchers.
+    struct Dispatcher
+    {
+        RecvQueue<Msg> queue;
+
+        // The queues of the other priority classes (see zcm_set_sub_priority()),
+        // indexed by class, only made once a subscription is in that class.
+        // Never waited on: the recv thread wakes up 'queue' after a push
+        unique_ptr<RecvQueue<Msg>> levels[ZCM_NUM_PRIORITIES];
+        RecvQueue<Msg>& queueOf(size_t prio)
+        {
+            return prio == ZCM_PRIORITY_NORMAL ? queue : *levels[prio];
+        }
+        template <class F> void eachQueue(F f)
+        {
+            f(queue);
+            for (auto& q : levels) if (q) f(*q);
+        }
+        bool hasMessage()
+        {
+            bool any = false;
+            eachQueue([&](RecvQueue<Msg>& q){ any = any || q.hasMessage(); });
+            return any;
+        }
+
+        // Protects dispatchOneMessage() on this dispatcher
+        mutex dispOneMutex;
+
+        // The sub whose callback is running (if any). See invokeCallback()
+        atomic<zcm_sub_t*> inCallback {nullptr};
+        // Set while a callback on this dispatcher waits in waitForCallback().
+        // 'deferred' is what it stopped waiting for, to wait on once the
+        // callback returns (see finishDeferred())
+        atomic<bool> waiting {false};
+        vector<pair<shared_ptr<Dispatcher>, zcm_sub_t*>> deferred;
+
+        // This dispatcher's view of the subscriptions (see refreshSubs())
+        shared_ptr<const SubSnapshot> subs;
+        uint64_t                      subsVersion = 0;
+
+        // Set by the recv thread when a subscription queue owned by this
+        // dispatcher has messages. 'subQueueTurn' alternates between those
+        // and the shared queue so that neither can starve the other
+        atomic<bool> subQueuesReady {false};
+        bool         subQueueTurn = false;
+        // Reused by dispatchSubQueues() for the messages it takes off a queue
+        vector<unique_ptr<Msg>> batch;
+        vector<zcm_recv_buf_t>  batchBufs;
+
+        // Like 'channels' and 'channelIndex' below, but for the traced messages
+        // this dispatcher dispatched (guarded by dispOneMutex instead)
+        deque<TraceCounters> traces;
+        unordered_map<uint32_t, vector<TraceCounters*>> traceIndex;
+
+        // The messages fillRecvBuf() decompressed, one per slot of 'batchBufs'
+        vector<vector<uint8_t>> inflated;
+
+        Dispatcher(size_t queueSize) : queue(queueSize) {}
+    };
+
     void sendThreadFunc();
     void recvThreadFunc();
     void hndlThreadFunc();
-
-    void dispatchMsg(zcm_msg_t* msg);
-    bool dispatchOneMessage();
+    void workerThreadFunc(size_t index);
+    void dispatchLoop(Dispatcher& d);
+
+    // Receive one message according to 'recvStrategy'
+    int recvOneMessage(zcm_msg_t* msg, void** token, uint64_t& lastMsgUtime,
+                       ThreadUtil::Backoff& backoff);
+    // Poll for a message on 'd' instead of sleeping (unless 'recvStrategy' blocks)
+    void pollQueue(Dispatcher& d);
+
+    // Applies the settings of 'which' to the calling thread. 'index' tells
+    // apart the threads sharing a role (i.e. the dispatch workers)
+    void applyThreadConfig(enum zcm_thread which, size_t index = 0);
+
+    void dispatchMsg(Msg* m, Dispatcher& d);
+    // Fills 'rbuf' for 'msg', taking off its trace envelope (if any) and
+    // counting its latency, then decompressing it (if it is) into d.inflated[slot].
+    // Requires that d.dispOneMutex is locked
+    void fillRecvBuf(Dispatcher& d, zcm_msg_t* msg, zcm_recv_buf_t& rbuf, size_t slot = 0);
+    void countTrace(Dispatcher& d, zcm_msg_t* msg, const zcm_recv_buf_t& rbuf);
+    // Calls the callback of 'sub' unless it has been unsubscribed, once for
+    // all 'n' messages in 'rbufs' (more than one only for batched subs) that
+    // are not older than its max age
+    void invokeCallback(Dispatcher& d, zcm_sub_t* sub, const zcm_recv_buf_t* rbufs,
+                        uint32_t n, const char* channel);
+    // Waits for a message, up to 'untilNs' (a TimeUtil::monoNs() deadline) unless 0
+    bool dispatchOneMessage(Dispatcher& d, uint64_t untilNs = 0);
+    // Dispatches the front of the queue of priority class 'prio' of 'd', if any
+    bool dispatchLevel(Dispatcher& d, size_t prio);
+    // The highest priority class of the subscriptions in 'route' that use the
+    // shared queue
+    static size_t recvPriorityOf(const SubSnapshot& snap, const ChannelMatcher::SubList& route);
+    // Makes the queues of every priority class in 'recvLevels' for every dispatcher.
+    // Requires that zcm isn't running
+    void makeRecvLevels();
+    uint32_t recvLevels = 0; // bitmask of the priority classes in use
+    bool dispatchSubQueues(Dispatcher& d);
+    // Calls the timers that are due. Returns true if there were any.
+    // Requires that dispatchers[0]->dispOneMutex is locked
+    bool runTimers();
+    bool timerDue() const
+    {
+        uint64_t next = nextTimerNs.load(memory_order_relaxed);
+        return next && TimeUtil::monoNs() >= next;
+    }
     bool sendOneMessage();
+    bool sendMessageBatch();
+    void ensureSendThread();
+
+    // The sendQueue level of the messages on 'channel'
+    size_t priorityOf(const char* channel);
+    // The zcm_interleave_t of the transport, called from within sendOneMessage() or
+    // sendMessageBatch(): hands out the next message queued above 'sendingLevel'
+    static bool interleaveNext(void* usr, size_t maxlen, zcm_msg_t* msg);
+    // Pops the message interleaveNext() handed out last, now that it's sent.
+    // Requires that sendOneMutex is locked
+    void endInterleaved();
+
+    // Enters RECV_MODE_HANDLE (starting the recv thread) unless already in it.
+    // Returns false when zcm runs otherwise
+    bool startHandling();
+    // Makes 'readyFd' readable (if it exists), unless it already is
+    void armReadyFd() { readyFd.arm(); }
+    // Requires that dispatchers[0]->dispOneMutex is locked
+    void disarmReadyFd() { readyFd.disarm(); }
+    // Joins the sendThread, if it runs
+    void stopSendThread();
+
+    // Charges 'bytes' of a received message to queueBytes, waiting for room like on
+    // a full queue. Returns false if the recv thread is asked to stop meanwhile
+    bool waitForQueueBytes(size_t bytes);
+
+    // Returns true if publish() should send from the caller's thread right now
+    bool publishInline();
+    void countPublished(const zcm_pub_msg_t* msgs, uint32_t nmsgs);
+    // Requires that sendOneMutex is locked
+    void drainSendQueue();
+
+    // 'route' without the subs for which 'keep(sub)' is false. Only allocates if
+    // there are any
+    template<class Keep>
+    static ChannelMatcher::Result thin(const ChannelMatcher::Result& route, Keep keep);
+    // Called by the recv thread: 'route' without the decimated subs that skip
+    // a message received at 'utime'
+    ChannelMatcher::Result decimate(const ChannelMatcher::Result& route, uint64_t utime);
+    // Sets 'data' and 'len' to what the callbacks get of 'msg' (past its trace
+    // envelope), which the filters are given. Returns false if they get it
+    // decompressed, so that only its dispatcher can filter it (see fillRecvBuf())
+    bool filterPayload(const zcm_msg_t* msg, const uint8_t*& data, uint32_t& len) const;
+    // Called by the recv thread: 'route' without the subs whose filter rejects 'msg'
+    ChannelMatcher::Result filter(const ChannelMatcher::Result& route, const zcm_msg_t* msg);
+
+    bool pushSubQueues(const SubSnapshot& snap, const ChannelMatcher::SubList& route,
+                       zcm_msg_t* msg);
+
+    Dispatcher& dispatcherFor(uint32_t chanHash);
+    Dispatcher& dispatcherFor(const char* channel);
+
+    shared_ptr<const SubSnapshot> loadSubs() const { return atomic_load(&subSnap); }
+    // Requires that subWriteMutex is locked
+    void storeSubs(shared_ptr<const SubSnapshot> snap)
+    {
+        atomic_store(&subSnap, std::move(snap));
+        ++subVersion;
+    }
+    // Reloads 'snap' only if the subscriptions changed since it was last loaded.
+    // Keeps the per-message cost down to one atomic load
+    void refreshSubs(shared_ptr<const SubSnapshot>& snap, uint64_t& version) const
+    {
+        uint64_t v = subVersion.load();
+        if (snap && v == version) return;
+        snap = loadSubs();
+        version = v;
+    }
+
+    // A copy of 'dispatchers', safe to walk while setDispatchThreads() resizes it
+    vector<shared_ptr<Dispatcher>> dispatcherList();
+    // Whether a dispatcher other than the caller's is running the callback of 'sub'
+    bool callbackRunning(zcm_sub_t* sub);
+    // Waits until no dispatcher (other than the caller's) is running the callback
+    // of 'sub'. From within a callback, stops waiting on a dispatcher whose
+    // callback waits too (they may be waiting on each other) and leaves that
+    // until the caller's callback returns
+    void waitForCallback(zcm_sub_t* sub);
+    // Waits out what waitForCallback() left to 'd', now that its callback returned
+    static void finishDeferred(Dispatcher& d);
+
+    // The timers of addTimer(), all fired by dispatchers[0]. 'nextTimerNs' is
+    // the earliest of their deadlines (0 if none), readable without the lock.
+    // 'inTimer' is the one being called, if any, for removeTimer() to wait on
+    mutex                           timerMutex;
+    vector<shared_ptr<zcm_timer_t>> timers;
+    atomic<uint64_t>                nextTimerNs {0};
+    atomic<zcm_timer_t*>            inTimer {nullptr};
+    // Reused by runTimers() for the timers that are due, with their ticks
+    vector<pair<shared_ptr<zcm_timer_t>, uint32_t>> dueTimers;
+    // Requires that timerMutex is locked
+    void updateNextTimer()
+    {
+        uint64_t next = 0;
+        for (auto& t : timers)
+            if (!next || t->nextNs < next) next = t->nextNs;
+        nextTimerNs = next;
+    }
+
+    // Counts of what the recv thread received on one channel
+    struct ChannelCounters
+    {
+        string           name;
+        atomic<uint64_t> msgs {0};
+        atomic<uint64_t> bytes {0};
+
+        ChannelCounters(const char* name) : name(name) {}
+    };
+    // Only called by the recv thread. Returns nullptr past STATS_CHANNELS_MAX channels
+    ChannelCounters* channelCounters(const zcm_msg_t& msg);
 
-    // Mutexes protecting the ...OneMessage() functions
-    mutex dispOneMutex;
+    // Called by the recv thread: publishes the stats if 'statsPeriodUs' is up
+    void publishStats();
+
+    // Mutex protecting the sendOneMessage() function
     mutex sendOneMutex;
 
-    bool deleteSubEntry(zcm_sub_t* sub, size_t nentriesleft);
-    bool deleteFromSubList(SubList& slist, zcm_sub_t* sub);
+    bool disableSubChannel(zcm_sub_t* sub, size_t nregexleft);
 
     zcm_t* z;
     zcm_trans_t* zt;
-    unordered_map<string, SubList> subs;
-    SubList subRegex;
+    bool zeroCopyRecv;
+    bool batchSend;
+
+    // When set, publishes call into the transport from the publishing thread
+    // (under sendOneMutex) instead of going through the sendQueue and sendThread
+    atomic<bool> inlinePublish {false};
+    // See setTryPublish()
+    atomic<bool> tryPublish {false};
+
+    // See getFd(): armed by the recv thread once it queues a message for
+    // handleNonblock(), and disarmed by handleNonblock() once it finds nothing
+    // left. Opened once, under recvModeMutex
+    NotifyFd readyFd;
+    // See getSendFd(): armed by the publishes queued while 'externalSend', in
+    // place of the sendThread, and disarmed by sendQueued(). Opened once, under
+    // sendStateMutex
+    NotifyFd     sendFd;
+    atomic<bool> externalSend {false};
     size_t mtu;
 
-    // These 2 mutexes used to implement a read-write style infrastructure on the subscription
-    // lists. Both the recvThread and the message dispatch may read the subscriptions
-    // concurrently, but subscribe() and unsubscribe() need both locks in order to write to it.
-    mutex subDispMutex;
-    mutex subRecvMutex;
+    // The current subscriptions. Only ever accessed through loadSubs() and
+    // storeSubs(). Writers (subscribe(), unsubscribe(), ...) are serialized by
+    // subWriteMutex; readers never lock
+    shared_ptr<const SubSnapshot> subSnap;
+    atomic<uint64_t>              subVersion {0};
+    mutex subWriteMutex;
 
     static constexpr size_t QUEUE_SIZE = 16;
-    ThreadsafeQueue<Msg> sendQueue {QUEUE_SIZE};
-    ThreadsafeQueue<Msg> recvQueue {QUEUE_SIZE};
+    size_t queueSize = QUEUE_SIZE;
+    // Note: the arenas must outlive the queues holding Msgs allocated from them
+    SlabArena sendArena {QUEUE_SIZE};
+    SlabArena recvArena {QUEUE_SIZE};
+    // Every queued Msg is charged to it, from publish to send and from receipt
+    // to dispatch. Must outlive the queues as well
+    MemBudget queueBytes;
+    // One level per enum zcm_priority, each of 'queueSize'
+    typedef MultiLevelQueue<Msg, ZCM_NUM_PRIORITIES> SendQueue;
+    SendQueue sendQueue {QUEUE_SIZE};
+
+    // The channels set to a priority other than ZCM_PRIORITY_NORMAL. Like the
+    // subscriptions, setChannelPriority() swaps in a new map under
+    // chanPriorityMutex, and publishes read it without locking. The flag spares
+    // them the atomic load as long as no channel was ever set
+    typedef unordered_map<string, uint8_t> ChanPriorities;
+    shared_ptr<const ChanPriorities> chanPriority;
+    atomic<bool>                     anyChanPriority {false};
+    mutex                            chanPriorityMutex;
+    // Only used under sendOneMutex: the level of the message(s) being sent,
+    // and the level of the message last handed to the transport to interleave
+    size_t sendingLevel = SendQueue::NONE;
+    size_t interleavedLevel = SendQueue::NONE;
+    Msg*   interleaved = nullptr;
+
+    // Only resized while not running. 'numActive' is fixed while the recv
+    // thread runs: handle() only ever dispatches from the first dispatcher.
+    vector<shared_ptr<Dispatcher>> dispatchers;
+    size_t numActive = 1;
 
     typedef enum {
         RECV_MODE_NONE = 0,
@@ -144,9 +803,111 @@ struct zcm_blocking
     // This mutex protects read and write access to the recv mode flag
     mutex recvModeMutex;
 
+    // Only changed while not running (i.e. under recvModeMutex with RECV_MODE_NONE)
+    enum zcm_recv_strategy recvStrategy = ZCM_RECV_BLOCK;
+    uint64_t               recvSpinUs = 0;
+
+    // Settings applied by each internal thread when it starts
+    struct ThreadConfig
+    {
+        vector<int> cpus;
+        int         priority; // SCHED_FIFO priority, 0 for the default scheduler
+        string      name;
+    };
+    ThreadConfig threadConfig[ZCM_NUM_THREADS] = {
+        {{}, 0, "zcm-send"}, {{}, 0, "zcm-recv"}, {{}, 0, "zcm-dispatch"}
+    };
+    // See zcm_set_numa_node(): -1 for none, else the node and its cpus, which
+    // go to the threads that weren't given cpus of their own
+    int          numaNode = -1;
+    vector<int>  numaCpus;
+    mutex        threadConfigMutex;
+
+    // Counters reported by getStats(), never locked or waited on by the threads
+    // updating them. Publishes may come from any thread; the send counters are
+    // only written under sendOneMutex and the recv ones by the recv thread
+    atomic<uint64_t> pubMsgs {0};
+    atomic<uint64_t> pubBytes {0};
+    atomic<uint64_t> pubQueueFull {0};
+    atomic<uint64_t> sendErrors {0};
+    atomic<uint64_t> sendInterleaved {0};
+    atomic<uint64_t> recvMsgs {0};
+    atomic<uint64_t> recvBytes {0};
+    atomic<uint64_t> recvUnrouted {0};
+    atomic<uint64_t> recvDecimated {0};
+    atomic<uint64_t> recvFiltered {0};
+    atomic<uint64_t> subQueueDrops {0};
+    // Written by all the dispatching threads at once
+    atomic<uint64_t> dispatchStale {0};
+    atomic<uint64_t> recvBytesBlockedNs {0};
+    // Written by the publishing and the dispatching threads
+    atomic<uint64_t> compressedMsgs {0};
+    atomic<uint64_t> compressSkipped {0};
+    atomic<uint64_t> compressSavedBytes {0};
+    atomic<uint64_t> decompressErrors {0};
+
+    // 'channels' only ever grows, under statsMutex, so getStats() can walk it
+    // while the recv thread finds its entries through 'channelIndex' (which
+    // only the recv thread touches)
+    deque<ChannelCounters> channels;
+    unordered_map<uint32_t, vector<ChannelCounters*>> channelIndex;
+    // Also keeps setDispatchThreads() from resizing 'dispatchers' under getStats()
+    // and dispatcherList()
+    mutex statsMutex;
+
+    // Tells subscriptions apart in getStats(). Guarded by subWriteMutex
+    uint64_t nextSubId = 0;
+
+    // Only changed while not running, like recvStrategy
+    bool               profiling = false;
+    uint64_t           slowNs = 0;
+    zcm_slow_handler_t slowHandler = nullptr;
+    void*              slowUsr = nullptr;
+
+    // See setStatsPublish(). Only changed while not running, like recvStrategy;
+    // 'nextStatsUs' (on the monotonic clock) is only used by the recv thread
+    uint64_t statsPeriodUs = 0;
+    uint64_t nextStatsUs = 0;
+    string   statsName;
+
+    // See setTracePublish()
+    bool tracePublish = false;
+
+    // See setCompression(). 'compressRules' is only changed by setCompression(),
+    // which can't race with publishes. What they resolve to for each channel
+    // published since is kept in 'compressStates', under compressMutex
+    struct CompressRule
+    {
+        string         channel;
+        bool           regex;
+        std::regex     re;
+        enum zcm_codec codec;
+        uint32_t       minSize;
+    };
+    struct CompressState
+    {
+        enum zcm_codec codec = ZCM_CODEC_NONE;
+        uint32_t       minSize = 0;
+        // The poor ratios in a row, and the messages left to send raw after
+        // too many of them. Racing publishes only make these a little off
+        atomic<uint32_t> poorRun {0};
+        atomic<uint32_t> backoff {0};
+    };
+    vector<CompressRule> compressRules;
+    mutex compressMutex;
+    unordered_map<string, CompressState> compressStates;
+    // Only changed while not running, like recvStrategy
+    bool decompress = true;
+
+    // Compresses 'data' into 'out' if a rule (see setCompression()) asks for it
+    // and it pays off. Returns false to send 'data' as it is
+    bool compress(const char* channel, const uint8_t* data, uint32_t len, vector<uint8_t>& out);
+    CompressState* compressStateOf(const char* channel);
+
     thread sendThread;
     thread recvThread;
     thread hndlThread;
+    vector<thread> workerThreads;
 
     typedef enum {
         THREAD_STATE_STOPPED = 0,
@@ -165,16 +926,25 @@ struct zcm_blocking
     mutex hndlStateMutex;
 
     // Flag and condition variables used to pause the sendThread (use sendStateMutex)
-    // and hndlThread (use hndlStateMutex)
+    // and hndlThread + workerThreads (use hndlStateMutex)
     bool               paused {false};
     condition_variable sendPauseCond;
     condition_variable hndlPauseCond;
 };
 
-zcm_blocking_t::zcm_blocking(zcm_t* z, zcm_trans_t* zt_)
+zcm_blocking_t::zcm_blocking(zcm_t* z_, zcm_trans_t* zt_)
 {
+    z = z_;
     zt = zt_;
     mtu = zcm_trans_get_mtu(zt);
+    zeroCopyRecv = zcm_trans_can_claim(zt);
+    batchSend = zcm_trans_can_send_batch(zt);
+    zcm_trans_set_interleave(zt, &zcm_blocking_t::interleaveNext, this);
+    dispatchers.emplace_back(new Dispatcher(queueSize));
+
+    shared_ptr<SubSnapshot> snap(new SubSnapshot());
+    snap->matcher = make_shared<ChannelMatcher>();
+    storeSubs(std::move(snap));
 }
 
 zcm_blocking_t::~zcm_blocking()
@@ -182,19 +952,13 @@ zcm_blocking_t::~zcm_blocking()
     // Shutdown all threads
     stop(true);
 
+    // Claimed messages must be handed back before the transport goes away.
+    // Dropping the last snapshot also deletes all of the subs
+    dispatchers.clear();
+    storeSubs(nullptr);
+
     // Destroy the transport
     zcm_trans_destroy(zt);
-
-    // Need to delete all subs
-    for (auto& it : subs) {
-        for (auto& sub : it.second) {
-            delete sub;
-        }
-    }
-    for (auto& sub : subRegex) {
-        delete (regex*) sub->regexobj;
-        delete sub;
-    }
 }
 
 void zcm_blocking_t::run()
@@ -205,15 +969,21 @@ void zcm_blocking_t::run()
         return;
     }
     recvMode = RECV_MODE_RUN;
+    numActive = dispatchers.size();
 
     // Run it!
     {
         unique_lock<mutex> lk2(hndlStateMutex);
         lk1.unlock();
         hndlThreadState = THREAD_STATE_RUNNING;
-        recvQueue.enable();
+        for (auto& d : dispatchers) d->eachQueue([](RecvQueue<Msg>& q){ q.enable(); });
     }
+
+    // The caller's thread becomes the hndl thread: hand it back as we found it
+    ThreadUtil::Attributes callerAttrs;
+    callerAttrs.save();
     hndlThreadFunc();
+    callerAttrs.restore();
 
     // Restore the "non-running" state
     lk1.lock();
@@ -229,12 +999,13 @@ void zcm_blocking_t::start()
         return;
     }
     recvMode = RECV_MODE_SPAWN;
+    numActive = dispatchers.size();
 
     unique_lock<mutex> lk2(hndlStateMutex);
     lk1.unlock();
     // Start the hndl thread
     hndlThreadState = THREAD_STATE_RUNNING;
-    recvQueue.enable();
+    for (auto& d : dispatchers) d->eachQueue([](RecvQueue<Msg>& q){ q.enable(); });
     hndlThread = thread{&zcm_blocking::hndlThreadFunc, this};
 }
 
@@ -247,7 +1018,7 @@ int zcm_blocking_t::stop(bool block)
         unique_lock<mutex> lk2(hndlStateMutex);
         if (hndlThreadState == THREAD_STATE_RUNNING) {
             hndlThreadState = THREAD_STATE_HALTING;
-            recvQueue.disable();
+            for (auto& d : dispatchers) d->eachQueue([](RecvQueue<Msg>& q){ q.disable(); });
             lk2.unlock();
             hndlPauseCond.notify_all();
             if (block && recvMode == RECV_MODE_SPAWN) {
@@ -262,8 +1033,9 @@ int zcm_blocking_t::stop(bool block)
         unique_lock<mutex> lk2(recvStateMutex);
         if (recvThreadState == THREAD_STATE_RUNNING) {
             recvThreadState = THREAD_STATE_HALTING;
-            recvQueue.disable();
+            for (auto& d : dispatchers) d->eachQueue([](RecvQueue<Msg>& q){ q.disable(); });
             lk2.unlock();
+            zcm_trans_recvmsg_wakeup(zt);
             if (block) {
                 recvThread.join();
                 lk2.lock();
@@ -326,30 +1098,147 @@ int zcm_blocking_t::stop(bool block)
     return ZCM_EOK;
 }
 
+bool zcm_blocking_t::startHandling()
+{
+    unique_lock<mutex> lk1(recvModeMutex);
+    if (recvMode != RECV_MODE_NONE && recvMode != RECV_MODE_HANDLE) {
+        ZCM_DEBUG("Err: call to handle() when 'recvMode != RECV_MODE_NONE && recvMode != RECV_MODE_HANDLE'");
+        return false;
+    }
+
+    // If this is the first time handle() is called, we need to start the recv thread
+    if (recvMode == RECV_MODE_NONE) {
+        recvMode = RECV_MODE_HANDLE;
+        numActive = 1;
+
+        unique_lock<mutex> lk2(recvStateMutex);
+        lk1.unlock();
+        // Spawn the recv thread
+        recvThreadState = THREAD_STATE_RUNNING;
+        dispatchers[0]->eachQueue([](RecvQueue<Msg>& q){ q.enable(); });
+        recvThread = thread{&zcm_blocking::recvThreadFunc, this};
+    }
+    return true;
+}
+
 int zcm_blocking_t::handle()
+{
+    if (!startHandling()) return ZCM_EINVALID;
+
+    Dispatcher& d = *dispatchers[0];
+    unique_lock<mutex> lk(d.dispOneMutex);
+    if (runTimers()) return ZCM_EOK;
+    if (dispatchOneMessage(d, nextTimerNs)) return ZCM_EOK;
+    return runTimers() ? ZCM_EOK : ZCM_EAGAIN;
+}
+
+int zcm_blocking_t::handleTimeout(uint32_t timeoutUs)
+{
+    if (!startHandling()) return ZCM_EINVALID;
+
+    uint64_t deadline = TimeUtil::monoNs() + (uint64_t) timeoutUs * 1000;
+    Dispatcher& d = *dispatchers[0];
+    unique_lock<mutex> lk(d.dispOneMutex);
+    // Wakeups that dispatch nothing (e.g. for the subscription queues) don't
+    // end the wait, the deadline does
+    do {
+        if (runTimers()) return ZCM_EOK;
+        uint64_t next = nextTimerNs;
+        if (dispatchOneMessage(d, next && next < deadline ? next : deadline))
+            return ZCM_EOK;
+    } while (TimeUtil::monoNs() < deadline);
+    return runTimers() ? ZCM_EOK : ZCM_EAGAIN;
+}
+
+int zcm_blocking_t::handleNonblock()
+{
+    if (!startHandling()) return ZCM_EINVALID;
+
+    Dispatcher& d = *dispatchers[0];
+    unique_lock<mutex> lk(d.dispOneMutex);
+    if (runTimers()) return ZCM_EOK;
+    // Note: messages are only taken off the queue under dispOneMutex,
+    //       so dispatchOneMessage() won't wait
+    if ((d.hasMessage() || d.subQueuesReady) && dispatchOneMessage(d))
+        return ZCM_EOK;
+
+    // Nothing left, unless a message was queued since
+    disarmReadyFd();
+    if (d.hasMessage() || d.subQueuesReady) armReadyFd();
+    return ZCM_EAGAIN;
+}
+
+int zcm_blocking_t::handleNonblockN(uint32_t maxMsgs, uint32_t budgetUs)
+{
+    uint64_t deadline = budgetUs ? TimeUtil::utime() + budgetUs : 0;
+    int n = 0;
+    while (maxMsgs == 0 || (uint32_t) n < maxMsgs) {
+        int rc = handleNonblock();
+        if (rc != ZCM_EOK) break;
+        ++n;
+        if (deadline && TimeUtil::utime() >= deadline) break;
+    }
+    return n;
+}
+
+// Note: transports take care of has_subscribers() being called from any thread
+int zcm_blocking_t::hasSubscribers(const char* channel)
+{
+    return zcm_trans_has_subscribers(zt, channel) != 0;
+}
+
+int zcm_blocking_t::getFd()
 {
     {
-        unique_lock<mutex> lk1(recvModeMutex);
-        if (recvMode != RECV_MODE_NONE && recvMode != RECV_MODE_HANDLE) {
-            ZCM_DEBUG("Err: call to handle() when 'recvMode != RECV_MODE_NONE && recvMode != RECV_MODE_HANDLE'");
-            return ZCM_EINVALID;
-        }
+        unique_lock<mutex> lk(recvModeMutex);
+        if (readyFd.rd < 0 && !readyFd.open()) return -1;
+    }
+    if (!startHandling()) return -1;
+
+    // Messages may have been queued before 'readyFd' existed
+    Dispatcher& d = *dispatchers[0];
+    if (d.hasMessage() || d.subQueuesReady) armReadyFd();
+    return readyFd.rd;
+}
 
-        // If this is the first time handle() is called, we need to start the recv thread
-        if (recvMode == RECV_MODE_NONE) {
-            recvMode = RECV_MODE_HANDLE;
+int zcm_blocking_t::getSendFd()
+{
+    {
+        unique_lock<mutex> lk(sendStateMutex);
+        if (sendFd.rd < 0 && !sendFd.open()) return -1;
+        externalSend = true;
+    }
+    // No publish starts it again from here on
+    stopSendThread();
+    if (sendQueue.hasMessage()) sendFd.arm();
+    return sendFd.rd;
+}
 
-            unique_lock<mutex> lk2(recvStateMutex);
-            lk1.unlock();
-            // Spawn the recv thread
-            recvThreadState = THREAD_STATE_RUNNING;
-            recvQueue.enable();
-            recvThread = thread{&zcm_blocking::recvThreadFunc, this};
+void zcm_blocking_t::sendQueued()
+{
+    {
+        // resume() arms the descriptor again
+        unique_lock<mutex> lk(sendStateMutex);
+        if (paused) {
+            sendFd.disarm();
+            return;
         }
     }
+    unique_lock<mutex> lk(sendOneMutex);
+    // Whatever is queued from here on arms it again
+    sendFd.disarm();
+    while (sendQueue.hasMessage()) {
+        if (batchSend) sendMessageBatch();
+        else           sendOneMessage();
+    }
+}
 
-    unique_lock<mutex> lk(dispOneMutex);
-    return dispatchOneMessage() ? ZCM_EOK : ZCM_EAGAIN;
+void zcm_blocking_t::closeSendFd()
+{
+    externalSend = false;
+    sendFd.disarm();
+    // Leftovers go out through the sendThread, as if queued just now
+    if (!inlinePublish && sendQueue.hasMessage()) ensureSendThread();
 }
 
 void zcm_blocking_t::pause()
@@ -368,124 +1257,770 @@ void zcm_blocking_t::resume()
     lk1.unlock();
     sendPauseCond.notify_all();
     hndlPauseCond.notify_all();
+    if (externalSend && sendQueue.hasMessage()) sendFd.arm();
 }
 
 // Note: We use a lock on publish() to make sure it can be
 // called concurrently. Without the lock, there is a potential
 // race to block on sendQueue.push()
-int zcm_blocking_t::publish(const string& channel, const uint8_t* data, uint32_t len)
+// The trace id of the messages the thread publishes (see zcm_set_trace_id())
+static thread_local uint64_t traceId = 0;
+
+int zcm_blocking_t::publish(const string& channel, const uint8_t* data, uint32_t len,
+                            bool tryOnly, zcm_sent_handler_t onSent, void* onSentUsr)
 {
-    // Check the validity of the request
-    if (len > mtu) return ZCM_EINVALID;
+    ZCM_PROBE2(publish, channel.c_str(), len);
+
+    // Check the validity of the request (compressed, a message may fit the mtu)
     if (channel.size() > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
 
-    // If needed: spawn the send thread
-    {
-        unique_lock<mutex> lk(sendStateMutex);
-        if (sendThreadState == THREAD_STATE_STOPPED) {
-            sendThreadState = THREAD_STATE_RUNNING;
-            sendThread = thread{&zcm_blocking::sendThreadFunc, this};
-        }
+    // Kept for the thread's next publishes, like ZCM::encodeBuffer()
+    static thread_local vector<uint8_t> compressed;
+    if (compress(channel.c_str(), data, len, compressed)) {
+        data = compressed.data();
+        len = compressed.size();
     }
-
-    bool success = sendQueue.pushIfRoom(TimeUtil::utime(), channel.c_str(), len, data);
-    if (!success) ZCM_DEBUG("sendQueue has no free space");
-    return success ? ZCM_EOK : ZCM_EAGAIN;
-}
-
-// Note: We use a lock on subscribe() to make sure it can be
-// called concurrently. Without the lock, there is a race
-// on modifying and reading the 'subs' and 'subRegex' containers
-zcm_sub_t* zcm_blocking_t::subscribe(const string& channel,
-                                     zcm_msg_handler_t cb, void* usr,
-                                     bool block)
-{
-    unique_lock<mutex> lk1(subDispMutex, std::defer_lock);
-    unique_lock<mutex> lk2(subRecvMutex, std::defer_lock);
-    if (block) {
-        lk1.lock();
-        lk2.lock();
-    } else if (!lk1.try_lock() || !lk2.try_lock()) {
-        return nullptr;
+    if (len + (tracePublish ? ZCM_TRACE_HDR_SIZE : 0) > mtu) return ZCM_EINVALID;
+
+    if (tracePublish) {
+        static thread_local vector<uint8_t> traced;
+        traced.resize(ZCM_TRACE_HDR_SIZE + len);
+        zcm_trace_encode(traced.data(), TimeUtil::realNs(), traceId);
+        memcpy(traced.data() + ZCM_TRACE_HDR_SIZE, data, len);
+        data = traced.data();
+        len += ZCM_TRACE_HDR_SIZE;
     }
-    int rc;
 
-    bool regex = isRegexChannel(channel);
-    if (regex) {
-        if (subRegex.size() == 0) {
-            rc = zcm_trans_recvmsg_enable(zt, NULL, true);
-        } else {
-            rc = ZCM_EOK;
+    if (publishInline()) {
+        unique_lock<mutex> lk(sendOneMutex, defer_lock);
+        if (!tryOnly && !tryPublish) {
+            lk.lock();
+        } else if (!lk.try_lock()) {
+            pubQueueFull.fetch_add(1, memory_order_relaxed);
+            return ZCM_EAGAIN;
         }
-    } else {
-        rc = zcm_trans_recvmsg_enable(zt, channel.c_str(), true);
-    }
+        drainSendQueue();
 
-    if (rc != ZCM_EOK) {
-        ZCM_DEBUG("zcm_trans_recvmsg_enable() didn't return ZCM_EOK: %d", rc);
-        return nullptr;
+        zcm_msg_t msg;
+        msg.utime = TimeUtil::utime();
+        msg.channel = channel.c_str();
+        msg.len = len;
+        msg.buf = (uint8_t*) data;
+        msg.chan_hash = 0;
+        msg.recv_ns = 0;
+        ZCM_PROBE2(trans_sendmsg, msg.channel, msg.len);
+        int rc = zcm_trans_sendmsg(zt, msg);
+        if (rc != ZCM_EOK) {
+            statAdd(sendErrors, 1);
+            return rc;
+        }
+        pubMsgs.fetch_add(1, memory_order_relaxed);
+        pubBytes.fetch_add(len, memory_order_relaxed);
+        if (onSent) {
+            lk.unlock();
+            onSent(ZCM_EOK, onSentUsr);
+        }
+        return ZCM_EOK;
     }
 
-    zcm_sub_t* sub = new zcm_sub_t();
-    ZCM_ASSERT(sub);
-    strncpy(sub->channel, channel.c_str(), ZCM_CHANNEL_MAXLEN);
-    sub->channel[ZCM_CHANNEL_MAXLEN] = '\0';
-    sub->regex = regex;
-    sub->regexobj = nullptr;
-    sub->callback = cb;
-    sub->usr = usr;
-    if (regex) {
-        sub->regexobj = (void*) new std::regex(sub->channel);
-        ZCM_ASSERT(sub->regexobj);
-        subRegex.push_back(sub);
-    } else {
-        subs[channel].push_back(sub);
+    size_t bytes = Msg::footprint(channel.c_str(), len);
+    if (!queueBytes.tryAcquire(bytes)) {
+        ZCM_DEBUG("queue_bytes limit reached");
+        pubQueueFull.fetch_add(1, memory_order_relaxed);
+        return ZCM_EAGAIN;
     }
-
-    return sub;
-}
-
-// Note: We use a lock on unsubscribe() to make sure it can be
-// called concurrently. Without the lock, there is a race
-// on modifying and reading the 'subs' and 'subRegex' containers
-int zcm_blocking_t::unsubscribe(zcm_sub_t* sub, bool block)
-{
-    unique_lock<mutex> lk1(subDispMutex, std::defer_lock);
-    unique_lock<mutex> lk2(subRecvMutex, std::defer_lock);
-    if (block) {
-        lk1.lock();
-        lk2.lock();
-    } else if (!lk1.try_lock() || !lk2.try_lock()) {
+    bool success = sendQueue.pushIfRoom(priorityOf(channel.c_str()), &queueBytes, &sendArena,
+                                        TimeUtil::utime(), channel.c_str(), len, data,
+                                        onSent, onSentUsr);
+    if (!success) {
+        ZCM_DEBUG("sendQueue has no free space");
+        queueBytes.release(bytes);
+        pubQueueFull.fetch_add(1, memory_order_relaxed);
         return ZCM_EAGAIN;
     }
+    ZCM_PROBE2(send_queue_push, channel.c_str(), len);
+    if (externalSend) sendFd.arm();
+    pubMsgs.fetch_add(1, memory_order_relaxed);
+    pubBytes.fetch_add(len, memory_order_relaxed);
+    return ZCM_EOK;
+}
 
-    bool success = true;
-    if (sub->regex) {
-        success = deleteFromSubList(subRegex, sub);
-    } else {
-        auto it = subs.find(sub->channel);
-        if (it == subs.end()) {
-            ZCM_DEBUG("failed to find the subscription channel in unsubscribe()");
-            return ZCM_EINVALID;
+int zcm_blocking_t::getStats(zcm_stat_handler_t cb, void* usr)
+{
+    auto load = [](const atomic<uint64_t>& c) { return c.load(memory_order_relaxed); };
+
+    // Gather everything first, so 'cb' never runs while another thread waits
+    vector<pair<string, uint64_t>> stats = {
+        {"zcm.pub_msgs",         load(pubMsgs)},
+        {"zcm.pub_bytes",        load(pubBytes)},
+        {"zcm.pub_queue_full",   load(pubQueueFull)},
+        {"zcm.send_errors",      load(sendErrors)},
+        {"zcm.send_queue_depth", sendQueue.numMessages()},
+        {"zcm.send_queue_hwm",   sendQueue.getHighWaterMark()},
+        {"zcm.send_interleaved", load(sendInterleaved)},
+        {"zcm.recv_msgs",        load(recvMsgs)},
+        {"zcm.recv_bytes",       load(recvBytes)},
+        {"zcm.recv_unrouted",    load(recvUnrouted)},
+        {"zcm.recv_decimated",   load(recvDecimated)},
+        {"zcm.recv_filtered",    load(recvFiltered)},
+        {"zcm.sub_queue_drops",  load(subQueueDrops)},
+        {"zcm.dispatch_stale",   load(dispatchStale)},
+        {"zcm.queue_bytes",      queueBytes.getUsed()},
+        {"zcm.queue_bytes_hwm",  queueBytes.getHighWaterMark()},
+        {"zcm.compressed_msgs",      load(compressedMsgs)},
+        {"zcm.compress_skipped",     load(compressSkipped)},
+        {"zcm.compress_saved_bytes", load(compressSavedBytes)},
+        {"zcm.decompress_errors",    load(decompressErrors)},
+    };
+    {
+        unique_lock<mutex> lk(statsMutex);
+        // Summed up (or the max) over the dispatchers
+        uint64_t depth = 0, hwm = 0, blockedNs = 0;
+        for (auto& d : dispatchers) {
+            d->eachQueue([&](RecvQueue<Msg>& q) {
+                depth += q.numMessages();
+                hwm = std::max(hwm, (uint64_t) q.getHighWaterMark());
+                blockedNs += q.getBlockedNs();
+            });
+        }
+        stats.emplace_back("zcm.recv_queue_depth", depth);
+        stats.emplace_back("zcm.recv_queue_hwm", hwm);
+        blockedNs += load(recvBytesBlockedNs);
+        stats.emplace_back("zcm.recv_blocked_us", blockedNs / 1000);
+
+        for (auto& c : channels) {
+            string prefix = "zcm.channel." + c.name + ".";
+            stats.emplace_back(prefix + "msgs", load(c.msgs));
+            stats.emplace_back(prefix + "bytes", load(c.bytes));
         }
 
-        SubList& slist = it->second;
-        success = deleteFromSubList(slist, sub);
+        // A channel may have been dispatched by each of the dispatchers over time
+        struct Trace
+        {
+            uint64_t msgs = 0, skewed = 0, minNs = UINT64_MAX;
+            uint64_t recvHist[ZCM_LATENCY_HIST_BUCKETS] = {};
+            uint64_t dispatchHist[ZCM_LATENCY_HIST_BUCKETS] = {};
+        };
+        std::map<string, Trace> traces;
+        for (auto& d : dispatchers) {
+            for (auto& tc : d->traces) {
+                Trace& t = traces[tc.name];
+                t.msgs += load(tc.msgs);
+                t.skewed += load(tc.skewed);
+                t.minNs = std::min(t.minNs, load(tc.minNs));
+                for (size_t i = 0; i < ZCM_LATENCY_HIST_BUCKETS; ++i) {
+                    t.recvHist[i] += load(tc.recvHist[i]);
+                    t.dispatchHist[i] += load(tc.dispatchHist[i]);
+                }
+            }
+        }
+        static const pair<const char*, uint32_t> tracePercentiles[] = {
+            {"p50_ns", 500000}, {"p99_ns", 990000}, {"p999_ns", 999000},
+        };
+        for (auto& it : traces) {
+            string prefix = "zcm.trace." + it.first + ".";
+            Trace& t = it.second;
+            stats.emplace_back(prefix + "msgs", t.msgs);
+            for (auto& p : tracePercentiles)
+                stats.emplace_back(prefix + "recv_" + p.first,
+                                   zcm_latency_hist_percentile(t.recvHist, t.msgs, p.second));
+            for (auto& p : tracePercentiles)
+                stats.emplace_back(prefix + "dispatch_" + p.first,
+                                   zcm_latency_hist_percentile(t.dispatchHist, t.msgs, p.second));
+            stats.emplace_back(prefix + "min_ns", t.msgs ? t.minNs : 0);
+            stats.emplace_back(prefix + "clock_skewed", t.skewed);
+        }
+    }
+    for (auto& e : loadSubs()->entries) {
+        string prefix = "zcm.sub." + std::to_string(e->id) + "." + e->sub.channel + ".";
+        stats.emplace_back(prefix + "dispatch_msgs", load(e->dispatchMsgs));
+        stats.emplace_back(prefix + "dispatch_us", load(e->dispatchNs) / 1000);
+        stats.emplace_back(prefix + "dispatch_max_us", load(e->dispatchMaxNs) / 1000);
+        stats.emplace_back(prefix + "stale_drops", load(e->staleDrops));
+        if (!profiling) continue;
+
+        uint64_t hist[ZCM_LATENCY_HIST_BUCKETS], total = 0;
+        for (size_t i = 0; i < ZCM_LATENCY_HIST_BUCKETS; ++i)
+            total += hist[i] = load(e->dispatchHist[i]);
+        static const pair<const char*, uint32_t> percentiles[] = {
+            {"dispatch_p50_ns", 500000}, {"dispatch_p90_ns", 900000},
+            {"dispatch_p99_ns", 990000}, {"dispatch_p999_ns", 999000},
+        };
+        for (auto& p : percentiles)
+            stats.emplace_back(prefix + p.first,
+                               zcm_latency_hist_percentile(hist, total, p.second));
     }
 
-    if (!success) {
-        ZCM_DEBUG("failed to find the subscription entry in unsubscribe()");
+    for (auto& s : stats) cb(s.first.c_str(), s.second, usr);
+    // The transport guards its own counters. Not all transports keep any
+    zcm_trans_get_stats(zt, cb, usr);
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setDispatchProfiling(bool enable, uint32_t slowUs,
+                                         zcm_slow_handler_t cb, void* usr)
+{
+    unique_lock<mutex> lk(recvModeMutex);
+    if (recvMode != RECV_MODE_NONE) {
+        ZCM_DEBUG("Err: call to setDispatchProfiling() when 'recvMode != RECV_MODE_NONE'");
         return ZCM_EINVALID;
     }
+    profiling = enable;
+    slowNs = (uint64_t) slowUs * 1000;
+    slowHandler = enable ? cb : nullptr;
+    slowUsr = usr;
+    return ZCM_EOK;
+}
 
-    return 0;
+int zcm_blocking_t::setTracePublish(bool enable)
+{
+    if (enable && mtu < ZCM_TRACE_HDR_SIZE) return ZCM_EINVALID;
+    tracePublish = enable;
+    return ZCM_EOK;
 }
 
-int zcm_blocking_t::flush(bool block)
+int zcm_blocking_t::setQueueBytes(uint64_t maxBytes)
 {
-    size_t n;
+    queueBytes.setLimit(maxBytes);
+    return ZCM_EOK;
+}
 
-    {
+int zcm_blocking_t::setChannelPriority(const char* channel, enum zcm_priority prio)
+{
+    if (!channel || prio < ZCM_PRIORITY_LOW || prio >= ZCM_NUM_PRIORITIES)
+        return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(chanPriorityMutex);
+    shared_ptr<ChanPriorities> next = chanPriority ? make_shared<ChanPriorities>(*chanPriority)
+                                                   : make_shared<ChanPriorities>();
+    if (prio == ZCM_PRIORITY_NORMAL) next->erase(channel);
+    else (*next)[channel] = prio;
+    atomic_store(&chanPriority, shared_ptr<const ChanPriorities>(std::move(next)));
+    anyChanPriority = true;
+    return ZCM_EOK;
+}
+
+size_t zcm_blocking_t::priorityOf(const char* channel)
+{
+    if (!anyChanPriority.load(memory_order_acquire)) return ZCM_PRIORITY_NORMAL;
+    shared_ptr<const ChanPriorities> prios = atomic_load(&chanPriority);
+    auto it = prios->find(channel);
+    return it == prios->end() ? ZCM_PRIORITY_NORMAL : it->second;
+}
+
+int zcm_blocking_t::setCompression(const char* channel, enum zcm_codec codec, uint32_t minSize)
+{
+    if (!channel || codec < ZCM_CODEC_NONE || codec >= ZCM_NUM_CODECS) return ZCM_EINVALID;
+#ifndef USING_ZLIB
+    if (codec != ZCM_CODEC_NONE) {
+        ZCM_DEBUG("Err: zcm was built without zlib, can't compress '%s'", channel);
+        return ZCM_EINVALID;
+    }
+#endif
+
+    CompressRule rule;
+    rule.channel = channel;
+    rule.regex = isRegexChannel(rule.channel);
+    rule.codec = codec;
+    rule.minSize = minSize;
+    if (rule.regex) {
+        try {
+            rule.re = std::regex(rule.channel);
+        } catch (const std::regex_error&) {
+            ZCM_DEBUG("Err: invalid compression channel regex '%s'", channel);
+            return ZCM_EINVALID;
+        }
+    }
+
+    // A new rule for the same channel replaces the old one
+    compressRules.erase(std::remove_if(compressRules.begin(), compressRules.end(),
+                                       [&](const CompressRule& r) {
+                                           return r.channel == rule.channel;
+                                       }),
+                        compressRules.end());
+    compressRules.push_back(std::move(rule));
+
+    unique_lock<mutex> lk(compressMutex);
+    compressStates.clear();
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setDecompress(bool enable)
+{
+    unique_lock<mutex> lk(recvModeMutex);
+    if (recvMode != RECV_MODE_NONE) {
+        ZCM_DEBUG("Err: call to setDecompress() when 'recvMode != RECV_MODE_NONE'");
+        return ZCM_EINVALID;
+    }
+    decompress = enable;
+    return ZCM_EOK;
+}
+
+zcm_blocking_t::CompressState* zcm_blocking_t::compressStateOf(const char* channel)
+{
+    unique_lock<mutex> lk(compressMutex);
+    auto it = compressStates.find(channel);
+    if (it != compressStates.end()) return &it->second;
+
+    // Note: references to the elements of an unordered_map survive rehashes
+    CompressState& cs = compressStates[channel];
+    for (auto& r : compressRules) {
+        if (r.regex ? std::regex_match(channel, r.re) : r.channel == channel) {
+            cs.codec = r.codec;
+            cs.minSize = r.minSize;
+        }
+    }
+    return &cs;
+}
+
+// After this many poor ratios in a row, a channel is sent raw for the next
+// COMPRESS_BACKOFF messages
+static constexpr uint32_t COMPRESS_POOR_MAX = 4;
+static constexpr uint32_t COMPRESS_BACKOFF = 64;
+
+bool zcm_blocking_t::compress(const char* channel, const uint8_t* data, uint32_t len,
+                              vector<uint8_t>& out)
+{
+#ifdef USING_ZLIB
+    if (compressRules.empty()) return false;
+    CompressState* cs = compressStateOf(channel);
+    if (cs->codec == ZCM_CODEC_NONE || len < cs->minSize) return false;
+
+    // Bridges and players republish compressed messages as they received them
+    uint32_t rawLen;
+    if (zcm_codec_decode(data, len, &rawLen)) return false;
+
+    uint32_t backoff = cs->backoff.load(memory_order_relaxed);
+    if (backoff) {
+        cs->backoff.store(backoff - 1, memory_order_relaxed);
+        compressSkipped.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    uLongf outLen = compressBound(len);
+    out.resize(ZCM_CODEC_HDR_SIZE + outLen);
+    int level = cs->codec == ZCM_CODEC_FAST ? Z_BEST_SPEED : Z_BEST_COMPRESSION;
+    int rc = compress2(out.data() + ZCM_CODEC_HDR_SIZE, &outLen, data, len, level);
+    if (rc != Z_OK || ZCM_CODEC_HDR_SIZE + outLen > len - len / 8) {
+        if (cs->poorRun.fetch_add(1, memory_order_relaxed) + 1 >= COMPRESS_POOR_MAX) {
+            cs->poorRun.store(0, memory_order_relaxed);
+            cs->backoff.store(COMPRESS_BACKOFF, memory_order_relaxed);
+        }
+        compressSkipped.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    cs->poorRun.store(0, memory_order_relaxed);
+
+    zcm_codec_encode(out.data(), cs->codec, len);
+    out.resize(ZCM_CODEC_HDR_SIZE + outLen);
+    compressedMsgs.fetch_add(1, memory_order_relaxed);
+    compressSavedBytes.fetch_add(len - out.size(), memory_order_relaxed);
+    return true;
+#else
+    (void) channel; (void) data; (void) len; (void) out;
+    return false;
+#endif
+}
+
+int zcm_blocking_t::setStatsPublish(uint32_t periodMs)
+{
+    unique_lock<mutex> lk(recvModeMutex);
+    if (recvMode != RECV_MODE_NONE) {
+        ZCM_DEBUG("Err: call to setStatsPublish() when 'recvMode != RECV_MODE_NONE'");
+        return ZCM_EINVALID;
+    }
+    statsPeriodUs = (uint64_t) periodMs * 1000;
+    nextStatsUs = 0;
+    return ZCM_EOK;
+}
+
+// The fingerprint zcm-gen computes for zcm/types/zcm_stats_t.zcm
+#define ZCM_STATS_T_HASH ((int64_t) 0x0d7e7952bdaef99bLL)
+
+void zcm_blocking_t::publishStats()
+{
+    uint64_t now = TimeUtil::monoNs() / 1000;
+    if (now < nextStatsUs) return;
+    // Skips the periods missed while the recv thread was held up
+    nextStatsUs = std::max(nextStatsUs + statsPeriodUs, now);
+
+    vector<pair<string, uint64_t>> stats;
+    getStats([](const char* name, uint64_t value, void* usr) {
+        ((vector<pair<string, uint64_t>>*) usr)->emplace_back(name, value);
+    }, &stats);
+
+    char host[256] = {0};
+    gethostname(host, sizeof(host) - 1);
+    int64_t utime = TimeUtil::utime();
+    int32_t pid = getpid();
+    int32_t nstats = stats.size();
+    char* hostp = host;
+    char* namep = (char*) statsName.c_str();
+    vector<char*> names;
+    vector<int64_t> values;
+    for (auto& s : stats) {
+        names.push_back((char*) s.first.c_str());
+        values.push_back(s.second);
+    }
+
+    // Encoded as zcm-gen encodes a zcm_stats_t
+    uint32_t len = 8 + 8 + __string_encoded_array_size(&hostp, 1) + 4 +
+                   __string_encoded_array_size(&namep, 1) + 4 +
+                   __string_encoded_array_size(names.data(), nstats) + 8 * nstats;
+    vector<uint8_t> buf(len);
+    int64_t hash = ZCM_STATS_T_HASH;
+    uint32_t pos = 0;
+    pos += __int64_t_encode_array(buf.data(), pos, len - pos, &hash, 1);
+    pos += __int64_t_encode_array(buf.data(), pos, len - pos, &utime, 1);
+    pos += __string_encode_array(buf.data(), pos, len - pos, &hostp, 1);
+    pos += __int32_t_encode_array(buf.data(), pos, len - pos, &pid, 1);
+    pos += __string_encode_array(buf.data(), pos, len - pos, &namep, 1);
+    pos += __int32_t_encode_array(buf.data(), pos, len - pos, &nstats, 1);
+    pos += __string_encode_array(buf.data(), pos, len - pos, names.data(), nstats);
+    pos += __int64_t_encode_array(buf.data(), pos, len - pos, values.data(), nstats);
+    assert(pos == len);
+
+    // The recv thread had better not wait on inline publishes
+    if (publish(ZCM_STATS_CHANNEL, buf.data(), len, true) != ZCM_EOK)
+        ZCM_DEBUG("failed to publish the stats");
+}
+
+zcm_blocking_t::ChannelCounters* zcm_blocking_t::channelCounters(const zcm_msg_t& msg)
+{
+    auto it = channelIndex.find(msg.chan_hash);
+    if (it != channelIndex.end())
+        for (auto* c : it->second)
+            if (c->name == msg.channel) return c;
+
+    // Only the recv thread adds channels, so it may read the size unlocked
+    if (channels.size() >= STATS_CHANNELS_MAX) return nullptr;
+    unique_lock<mutex> lk(statsMutex);
+    channels.emplace_back(msg.channel);
+    channelIndex[msg.chan_hash].push_back(&channels.back());
+    return &channels.back();
+}
+
+int zcm_blocking_t::publishBatch(const zcm_pub_msg_t* msgs, uint32_t nmsgs)
+{
+    // Check the validity of the request (compressed, a message may fit the mtu)
+    for (uint32_t i = 0; i < nmsgs; ++i) {
+        ZCM_PROBE2(publish, msgs[i].channel, msgs[i].len);
+        if (strlen(msgs[i].channel) > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
+    }
+
+    if (!compressRules.empty()) {
+        static thread_local vector<vector<uint8_t>> compressed;
+        static thread_local vector<zcm_pub_msg_t> compressedMsgs;
+        if (compressed.size() < nmsgs) compressed.resize(nmsgs);
+        compressedMsgs.assign(msgs, msgs + nmsgs);
+        for (uint32_t i = 0; i < nmsgs; ++i) {
+            auto& m = compressedMsgs[i];
+            if (!compress(m.channel, m.data, m.len, compressed[i])) continue;
+            m.data = compressed[i].data();
+            m.len = compressed[i].size();
+        }
+        msgs = compressedMsgs.data();
+    }
+
+    size_t hdrSize = tracePublish ? ZCM_TRACE_HDR_SIZE : 0;
+    for (uint32_t i = 0; i < nmsgs; ++i)
+        if (msgs[i].len + hdrSize > mtu) return ZCM_EINVALID;
+
+    if (tracePublish) {
+        static thread_local vector<uint8_t> traced;
+        static thread_local vector<zcm_pub_msg_t> tracedMsgs;
+        size_t total = 0;
+        for (uint32_t i = 0; i < nmsgs; ++i) total += hdrSize + msgs[i].len;
+        traced.resize(total);
+        tracedMsgs.assign(msgs, msgs + nmsgs);
+
+        int64_t now = TimeUtil::realNs();
+        uint8_t* p = traced.data();
+        for (auto& m : tracedMsgs) {
+            zcm_trace_encode(p, now, traceId);
+            memcpy(p + hdrSize, m.data, m.len);
+            m.data = p;
+            m.len += hdrSize;
+            p += m.len;
+        }
+        msgs = tracedMsgs.data();
+    }
+
+    if (publishInline()) {
+        unique_lock<mutex> lk(sendOneMutex, defer_lock);
+        if (!tryPublish) {
+            lk.lock();
+        } else if (!lk.try_lock()) {
+            pubQueueFull.fetch_add(1, memory_order_relaxed);
+            return ZCM_EAGAIN;
+        }
+        drainSendQueue();
+
+        uint64_t utime = TimeUtil::utime();
+        int ret = ZCM_EOK;
+        zcm_msg_t batch[SEND_BATCH_MAX];
+        for (uint32_t i = 0; i < nmsgs; i += SEND_BATCH_MAX) {
+            size_t n = std::min((uint32_t) SEND_BATCH_MAX, nmsgs - i);
+            for (size_t j = 0; j < n; ++j) {
+                batch[j].utime = utime;
+                batch[j].channel = msgs[i + j].channel;
+                batch[j].len = msgs[i + j].len;
+                batch[j].buf = (uint8_t*) msgs[i + j].data;
+                batch[j].chan_hash = 0;
+                batch[j].recv_ns = 0;
+                ZCM_PROBE2(trans_sendmsg, batch[j].channel, batch[j].len);
+            }
+            int rc = zcm_trans_sendmsg_batch(zt, batch, n);
+            if (rc != ZCM_EOK) {
+                statAdd(sendErrors, 1);
+                if (ret == ZCM_EOK) ret = rc;
+            }
+        }
+        if (ret == ZCM_EOK) countPublished(msgs, nmsgs);
+        return ret;
+    }
+
+    // Note: all messages share one timestamp and one lock acquisition
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < nmsgs; ++i) bytes += Msg::footprint(msgs[i].channel, msgs[i].len);
+    if (!queueBytes.tryAcquire(bytes)) {
+        ZCM_DEBUG("queue_bytes limit reached for %u msgs", nmsgs);
+        pubQueueFull.fetch_add(1, memory_order_relaxed);
+        return ZCM_EAGAIN;
+    }
+    auto levelOf = [this](const zcm_pub_msg_t& m) { return priorityOf(m.channel); };
+    bool success = sendQueue.pushBatchIfRoom(msgs, nmsgs, levelOf,
+                                             &queueBytes, &sendArena, TimeUtil::utime());
+    if (!success) {
+        ZCM_DEBUG("sendQueue has no free space for %u msgs", nmsgs);
+        queueBytes.release(bytes);
+        pubQueueFull.fetch_add(1, memory_order_relaxed);
+        return ZCM_EAGAIN;
+    }
+    for (uint32_t i = 0; i < nmsgs; ++i)
+        ZCM_PROBE2(send_queue_push, msgs[i].channel, msgs[i].len);
+    if (externalSend) sendFd.arm();
+    countPublished(msgs, nmsgs);
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::publishIov(const char* channel, const zcm_iov_t* iov, uint32_t niov)
+{
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < niov; ++i) total += iov[i].len;
+    if (total > UINT32_MAX) return ZCM_EINVALID;
+    uint32_t len = (uint32_t) total;
+
+    // Anything but an inline publish as is needs the message in one piece
+    if (!compressRules.empty() || tracePublish || !publishInline()) {
+        static thread_local vector<uint8_t> gathered;
+        gathered.resize(len);
+        uint8_t* p = gathered.data();
+        for (uint32_t i = 0; i < niov; ++i) {
+            if (iov[i].len) memcpy(p, iov[i].base, iov[i].len);
+            p += iov[i].len;
+        }
+        return publish(channel, gathered.data(), len, false);
+    }
+
+    ZCM_PROBE2(publish, channel, len);
+    if (strlen(channel) > ZCM_CHANNEL_MAXLEN || len > mtu) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(sendOneMutex, defer_lock);
+    if (!tryPublish) {
+        lk.lock();
+    } else if (!lk.try_lock()) {
+        pubQueueFull.fetch_add(1, memory_order_relaxed);
+        return ZCM_EAGAIN;
+    }
+    drainSendQueue();
+
+    zcm_msg_t msg;
+    msg.utime = TimeUtil::utime();
+    msg.channel = channel;
+    msg.len = len;
+    msg.buf = nullptr;
+    msg.chan_hash = 0;
+    msg.recv_ns = 0;
+    ZCM_PROBE2(trans_sendmsg, msg.channel, msg.len);
+    int rc = zcm_trans_sendmsg_iov(zt, msg, iov, niov);
+    if (rc != ZCM_EOK) {
+        statAdd(sendErrors, 1);
+        return rc;
+    }
+    pubMsgs.fetch_add(1, memory_order_relaxed);
+    pubBytes.fetch_add(len, memory_order_relaxed);
+    return ZCM_EOK;
+}
+
+void zcm_blocking_t::getPubStatus(const char* channel, zcm_pub_status_t* status)
+{
+    size_t level = priorityOf(channel);
+    status->queued = sendQueue.numMessages(level);
+    // Note: a Queue of capacity N holds at most N-1 elements
+    status->capacity = sendQueue.getCapacity() - 1;
+    status->queued_bytes = queueBytes.getUsed();
+    status->max_bytes = queueBytes.getLimit();
+}
+
+void zcm_blocking_t::countPublished(const zcm_pub_msg_t* msgs, uint32_t nmsgs)
+{
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < nmsgs; ++i) bytes += msgs[i].len;
+    pubMsgs.fetch_add(nmsgs, memory_order_relaxed);
+    pubBytes.fetch_add(bytes, memory_order_relaxed);
+}
+
+bool zcm_blocking_t::publishInline()
+{
+    if (!inlinePublish) {
+        ensureSendThread();
+        return false;
+    }
+
+    // While paused, messages are queued (without a sendThread) and
+    // the first publish after resume() sends them out first
+    unique_lock<mutex> lk(sendStateMutex);
+    return !paused;
+}
+
+void zcm_blocking_t::drainSendQueue()
+{
+    while (sendQueue.hasMessage() && sendOneMessage());
+}
+
+void zcm_blocking_t::ensureSendThread()
+{
+    // See getSendFd()
+    if (externalSend) return;
+
+    // If needed: spawn the send thread
+    unique_lock<mutex> lk(sendStateMutex);
+    if (sendThreadState == THREAD_STATE_STOPPED) {
+        sendThreadState = THREAD_STATE_RUNNING;
+        sendThread = thread{&zcm_blocking::sendThreadFunc, this};
+    }
+}
+
+// Note: subscribe() and unsubscribe() only lock against each other. Dispatch
+// keeps running on the previous snapshot while the new one is built, which is
+// also why they may be called from within a callback
+zcm_sub_t* zcm_blocking_t::subscribe(const string& channel,
+                                     zcm_msg_handler_t cb, void* usr,
+                                     bool block, zcm_batch_handler_t batchCb,
+                                     uint32_t maxBatch, uint32_t depth)
+{
+    if (batchCb && (maxBatch == 0 || depth == 0)) return nullptr;
+
+    unique_lock<mutex> lk(subWriteMutex, defer_lock);
+    if (block) lk.lock();
+    else if (!lk.try_lock()) return nullptr;
+    int rc;
+
+    auto cur = loadSubs();
+
+    bool regex = isRegexChannel(channel);
+    if (regex) {
+        if (cur->matcher->numRegex() == 0) {
+            rc = zcm_trans_recvmsg_enable(zt, NULL, true);
+        } else {
+            rc = ZCM_EOK;
+        }
+    } else {
+        rc = zcm_trans_recvmsg_enable(zt, channel.c_str(), true);
+    }
+
+    if (rc != ZCM_EOK) {
+        ZCM_DEBUG("zcm_trans_recvmsg_enable() didn't return ZCM_EOK: %d", rc);
+        return nullptr;
+    }
+
+    shared_ptr<SubEntry> entry(new SubEntry());
+    entry->id = nextSubId++;
+    entry->batchCb = batchCb;
+    entry->maxBatch = maxBatch;
+    zcm_sub_t* sub = &entry->sub;
+    strncpy(sub->channel, channel.c_str(), ZCM_CHANNEL_MAXLEN);
+    sub->channel[ZCM_CHANNEL_MAXLEN] = '\0';
+    sub->regex = regex;
+    sub->regexobj = nullptr;
+    sub->callback = cb;
+    sub->usr = usr;
+    if (regex) {
+        sub->regexobj = (void*) new std::regex(sub->channel);
+        ZCM_ASSERT(sub->regexobj);
+    }
+
+    shared_ptr<SubSnapshot> next(new SubSnapshot(*cur));
+    next->entries.push_back(std::move(entry));
+    // Batched subs are only ever dispatched from their own queue
+    if (batchCb) next->subQueues[sub] = make_shared<SubQueue>(depth, ZCM_QUEUE_DROP_OLDEST);
+    ChannelMatcher::SubList all = cur->matcher->subs();
+    all.push_back(sub);
+    next->matcher = make_shared<ChannelMatcher>(all);
+    storeSubs(std::move(next));
+
+    return sub;
+}
+
+// Note: once unsubscribe() returns, the callback of 'sub' is not called again
+//       and is not running on any other thread. It may still be running
+//       on the calling thread (i.e. when unsubscribing from within a callback),
+//       or, from within a callback, on a thread whose callback unsubscribes
+//       from the caller's at the same time, until the caller's returns.
+//       Without blocking, fails with ZCM_EAGAIN rather than wait for the callback
+int zcm_blocking_t::unsubscribe(zcm_sub_t* sub, bool block)
+{
+    {
+        unique_lock<mutex> lk(subWriteMutex, defer_lock);
+        if (block) lk.lock();
+        else if (!lk.try_lock()) return ZCM_EAGAIN;
+
+        auto cur = loadSubs();
+        if (!cur->contains(sub)) {
+            ZCM_DEBUG("failed to find the subscription entry in unsubscribe()");
+            return ZCM_EINVALID;
+        }
+
+        // Snapshots taken before the swap below still hold the sub (which keeps
+        // its memory alive), this stops them from calling it. A message that
+        // comes meanwhile is skipped even if we then give up
+        SubEntry* e = SubEntry::of(sub);
+        e->live = false;
+        if (!block && callbackRunning(sub)) {
+            e->live = true;
+            return ZCM_EAGAIN;
+        }
+
+        shared_ptr<SubSnapshot> next(new SubSnapshot(*cur));
+        ChannelMatcher::SubList all;
+        next->entries.clear();
+        for (auto& e : cur->entries) {
+            if (&e->sub == sub) continue;
+            next->entries.push_back(e);
+            all.push_back(&e->sub);
+        }
+        next->matcher = make_shared<ChannelMatcher>(all);
+        next->subQueues.erase(sub);
+        size_t nregexleft = next->matcher->numRegex();
+        storeSubs(std::move(next));
+
+        if (!disableSubChannel(sub, nregexleft)) {
+            ZCM_DEBUG("failed to disable the subscription channel in unsubscribe()");
+            return ZCM_EINVALID;
+        }
+    }
+
+    // Not under subWriteMutex: the callback we wait for may itself (un)subscribe
+    if (block) waitForCallback(sub);
+    return 0;
+}
+
+int zcm_blocking_t::flush(bool block)
+{
+    size_t n;
+
+    {
         sendQueue.disable();
 
         unique_lock<mutex> lk(sendOneMutex, defer_lock);
@@ -498,247 +2033,1332 @@ int zcm_blocking_t::flush(bool block)
 
         sendQueue.enable();
         n = sendQueue.numMessages();
-        for (size_t i = 0; i < n; ++i) sendOneMessage();
+        // Messages interleaved by the transport leave the queue early
+        for (size_t i = 0; i < n && sendQueue.hasMessage(); ++i) sendOneMessage();
     }
 
-    {
-        recvQueue.disable();
+    for (auto& d : dispatchers) {
+        d->queue.disable();
 
-        unique_lock<mutex> lk(dispOneMutex, defer_lock);
+        unique_lock<mutex> lk(d->dispOneMutex, defer_lock);
 
         if (block) lk.lock();
         else if (!lk.try_lock()) {
-            recvQueue.enable();
+            d->queue.enable();
             return ZCM_EAGAIN;
         }
 
-        recvQueue.enable();
-        n = recvQueue.numMessages();
-        for (size_t i = 0; i < n; ++i) dispatchOneMessage();
+        d->queue.enable();
+        n = 0;
+        d->eachQueue([&](RecvQueue<Msg>& q){ n += q.numMessages(); });
+        for (size_t i = 0; i < n; ++i) dispatchOneMessage(*d);
+        while (dispatchSubQueues(*d));
     }
 
     return ZCM_EOK;
 }
 
+int zcm_blocking_t::flushN(uint32_t maxMsgs, uint32_t budgetUs)
+{
+    uint64_t deadline = budgetUs ? TimeUtil::utime() + budgetUs : 0;
+    auto expired = [&]() { return deadline && TimeUtil::utime() >= deadline; };
+
+    {
+        sendQueue.disable();
+        unique_lock<mutex> lk(sendOneMutex);
+        sendQueue.enable();
+        size_t n = sendQueue.numMessages();
+        for (size_t i = 0; i < n && sendQueue.hasMessage() && !expired(); ++i)
+            sendOneMessage();
+    }
+
+    // Only what was received by now: messages that arrive meanwhile are left
+    // for the next call
+    uint32_t dispatched = 0;
+    auto done = [&]() { return (maxMsgs && dispatched >= maxMsgs) || expired(); };
+    for (auto& d : dispatchers) {
+        d->queue.disable();
+        unique_lock<mutex> lk(d->dispOneMutex);
+        d->queue.enable();
+        size_t n = 0;
+        d->eachQueue([&](RecvQueue<Msg>& q){ n += q.numMessages(); });
+        for (size_t i = 0; i < n && !done(); ++i)
+            if (dispatchOneMessage(*d)) ++dispatched;
+        while (!done() && dispatchSubQueues(*d)) ++dispatched;
+    }
+
+    return dispatched;
+}
+
+// Queues resize in place, without moving or dropping messages, so publishers
+// and the dispatchers carry on through it. Only the SPSC receive queue has to
+// be resized from its consumer's side
 int zcm_blocking_t::setQueueSize(uint32_t numMsgs, bool block)
 {
     if (sendQueue.getCapacity() != numMsgs) {
+        sendQueue.setCapacity(numMsgs);
+        sendArena.setCapacity(numMsgs);
+    }
 
-        sendQueue.disable();
+    for (auto& d : dispatchers) {
+        if (d->queue.getCapacity() == numMsgs) continue;
+#ifndef USING_SPSC_QUEUE
+        d->eachQueue([&](RecvQueue<Msg>& q){ q.setCapacity(numMsgs); });
+#else
+        d->queue.disable();
 
-        unique_lock<mutex> lk(sendOneMutex, defer_lock);
+        unique_lock<mutex> lk(d->dispOneMutex, defer_lock);
 
         if (block) lk.lock();
         else if (!lk.try_lock()) {
-            sendQueue.enable();
+            d->queue.enable();
             return ZCM_EAGAIN;
         }
 
-        sendQueue.setCapacity(numMsgs);
-        sendQueue.enable();
+        d->eachQueue([&](RecvQueue<Msg>& q){ q.setCapacity(numMsgs); });
+        d->queue.enable();
+#endif
+    }
+    recvArena.setCapacity(numMsgs * dispatchers.size());
+    queueSize = numMsgs;
+
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setDispatchThreads(uint32_t numThreads)
+{
+    if (numThreads == 0) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(recvModeMutex);
+    if (recvMode != RECV_MODE_NONE) {
+        ZCM_DEBUG("Err: call to setDispatchThreads() when 'recvMode != RECV_MODE_NONE'");
+        return ZCM_EINVALID;
+    }
+
+    // Note: messages still queued on dispatchers that go away are dropped
+    unique_lock<mutex> lk2(statsMutex);
+    if (numThreads < dispatchers.size()) dispatchers.resize(numThreads);
+    while (dispatchers.size() < numThreads)
+        dispatchers.emplace_back(new Dispatcher(queueSize));
+    makeRecvLevels();
+    recvArena.setCapacity(queueSize * dispatchers.size());
+
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setSubQueue(zcm_sub_t* sub, uint32_t depth, enum zcm_queue_policy policy)
+{
+    if (policy == ZCM_QUEUE_KEEP_LATEST) depth = 1;
+    if (policy != ZCM_QUEUE_SHARED && depth == 0) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(subWriteMutex);
+
+    auto cur = loadSubs();
+    if (!cur->contains(sub)) {
+        ZCM_DEBUG("failed to find the subscription entry in setSubQueue()");
+        return ZCM_EINVALID;
+    }
+    if (policy == ZCM_QUEUE_SHARED && SubEntry::of(sub)->batchCb) return ZCM_EINVALID;
+
+    // Note: messages still in the sub's old queue are dropped
+    shared_ptr<SubSnapshot> next(new SubSnapshot(*cur));
+    if (policy == ZCM_QUEUE_SHARED) next->subQueues.erase(sub);
+    else next->subQueues[sub] = make_shared<SubQueue>(depth, policy);
+    storeSubs(std::move(next));
+
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setSubDecimation(zcm_sub_t* sub, uint32_t minPeriodUs, uint32_t keepEvery)
+{
+    unique_lock<mutex> lk(subWriteMutex);
+
+    auto cur = loadSubs();
+    if (!cur->contains(sub)) {
+        ZCM_DEBUG("failed to find the subscription entry in setSubDecimation()");
+        return ZCM_EINVALID;
+    }
+
+    SubEntry* e = SubEntry::of(sub);
+    e->minPeriodUs = minPeriodUs;
+    e->keepEvery = keepEvery;
+
+    // Only swap in a new snapshot the first time, for the recv thread to start checking
+    if (!cur->decimated && (minPeriodUs || keepEvery > 1)) {
+        shared_ptr<SubSnapshot> next(new SubSnapshot(*cur));
+        next->decimated = true;
+        storeSubs(std::move(next));
+    }
+
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setSubPriority(zcm_sub_t* sub, enum zcm_priority prio)
+{
+    if (prio < ZCM_PRIORITY_LOW || prio >= ZCM_NUM_PRIORITIES) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk1(recvModeMutex);
+    if (recvMode != RECV_MODE_NONE) {
+        ZCM_DEBUG("Err: call to setSubPriority() when 'recvMode != RECV_MODE_NONE'");
+        return ZCM_EINVALID;
+    }
+
+    unique_lock<mutex> lk2(subWriteMutex);
+    auto cur = loadSubs();
+    if (!cur->contains(sub)) {
+        ZCM_DEBUG("failed to find the subscription entry in setSubPriority()");
+        return ZCM_EINVALID;
+    }
+
+    SubEntry::of(sub)->priority = prio;
+    if (prio != ZCM_PRIORITY_NORMAL) {
+        recvLevels |= 1u << prio;
+        makeRecvLevels();
+    }
+
+    // Only swap in a new snapshot the first time, for the recv thread to start checking
+    if (!cur->prioritized && prio != ZCM_PRIORITY_NORMAL) {
+        shared_ptr<SubSnapshot> next(new SubSnapshot(*cur));
+        next->prioritized = true;
+        storeSubs(std::move(next));
+    }
+
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setSubMaxAge(zcm_sub_t* sub, uint32_t maxAgeUs)
+{
+    unique_lock<mutex> lk(subWriteMutex);
+
+    auto cur = loadSubs();
+    if (!cur->contains(sub)) {
+        ZCM_DEBUG("failed to find the subscription entry in setSubMaxAge()");
+        return ZCM_EINVALID;
+    }
+
+    SubEntry::of(sub)->maxAgeUs = maxAgeUs;
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setSubFilter(zcm_sub_t* sub, zcm_filter_t filter, void* usr)
+{
+    unique_lock<mutex> lk(subWriteMutex);
+
+    auto cur = loadSubs();
+    if (!cur->contains(sub)) {
+        ZCM_DEBUG("failed to find the subscription entry in setSubFilter()");
+        return ZCM_EINVALID;
+    }
+
+    SubEntry* e = SubEntry::of(sub);
+    shared_ptr<const SubEntry::Filter> f;
+    if (filter) f.reset(new SubEntry::Filter{filter, usr});
+    atomic_store(&e->filter, f);
+
+    // Only swap in a new snapshot the first time, for the recv thread to start checking
+    if (!cur->filtered && filter) {
+        shared_ptr<SubSnapshot> next(new SubSnapshot(*cur));
+        next->filtered = true;
+        storeSubs(std::move(next));
+    }
+
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setTryPublish(bool enable)
+{
+    tryPublish = enable;
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setInlinePublish(bool enable)
+{
+    // The sendThread holds sendOneMutex while it waits for messages,
+    // so it can't coexist with inline publishing
+    if (enable) stopSendThread();
+    inlinePublish = enable;
+    return ZCM_EOK;
+}
+
+void zcm_blocking_t::stopSendThread()
+{
+    unique_lock<mutex> lk(sendStateMutex);
+    if (sendThreadState == THREAD_STATE_RUNNING) {
+        sendThreadState = THREAD_STATE_HALTING;
+        sendQueue.disable();
+        lk.unlock();
+        sendPauseCond.notify_all();
+        sendThread.join();
+        lk.lock();
+        sendThreadState = THREAD_STATE_STOPPED;
+        sendQueue.enable();
+    }
+}
+
+int zcm_blocking_t::setRecvStrategy(enum zcm_recv_strategy strategy, uint32_t spinUs)
+{
+    if (strategy != ZCM_RECV_BLOCK && strategy != ZCM_RECV_SPIN &&
+        strategy != ZCM_RECV_BUSY_POLL)
+        return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(recvModeMutex);
+    if (recvMode != RECV_MODE_NONE) {
+        ZCM_DEBUG("Err: call to setRecvStrategy() when 'recvMode != RECV_MODE_NONE'");
+        return ZCM_EINVALID;
+    }
+    recvStrategy = strategy;
+    recvSpinUs = spinUs;
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setThreadAffinity(enum zcm_thread which, const vector<int>& cpus)
+{
+    if (which < 0 || which >= ZCM_NUM_THREADS) return ZCM_EINVALID;
+    for (int cpu : cpus)
+        if (cpu < 0) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(threadConfigMutex);
+    threadConfig[which].cpus = cpus;
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setNumaNode(int node)
+{
+    vector<int> cpus;
+    if (node < -1 || (node >= 0 && !ThreadUtil::getNodeCpus(node, cpus))) {
+        ZCM_DEBUG("no cpus found for numa node %d", node);
+        return ZCM_EINVALID;
+    }
+
+    unique_lock<mutex> lk(threadConfigMutex);
+    numaNode = node;
+    numaCpus = std::move(cpus);
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setThreadPriority(enum zcm_thread which, int priority)
+{
+    if (which < 0 || which >= ZCM_NUM_THREADS) return ZCM_EINVALID;
+    if (priority < 0 || priority > 99) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(threadConfigMutex);
+    threadConfig[which].priority = priority;
+    return ZCM_EOK;
+}
+
+int zcm_blocking_t::setThreadName(enum zcm_thread which, const string& name)
+{
+    if (which < 0 || which >= ZCM_NUM_THREADS) return ZCM_EINVALID;
+
+    unique_lock<mutex> lk(threadConfigMutex);
+    threadConfig[which].name = name;
+    return ZCM_EOK;
+}
+
+static const char* optFind(zcm_url_opts_t* opts, const string& key)
+{
+    for (size_t i = 0; i < opts->numopts; ++i)
+        if (key == opts->name[i])
+            return opts->value[i];
+    return nullptr;
+}
+
+void zcm_blocking_t::setUrlOpts(zcm_url_opts_t* opts)
+{
+    const char* val = optFind(opts, "dispatch_threads");
+    if (val) {
+        int n = atoi(val);
+        if (n <= 0 || setDispatchThreads(n) != ZCM_EOK)
+            ZCM_DEBUG("Invalid dispatch_threads option: %s", val);
+    }
+
+    val = optFind(opts, "recv_strategy");
+    if (val) {
+        const char* spin = optFind(opts, "recv_spin_us");
+        uint32_t spinUs = spin ? atoi(spin) : 50;
+        enum zcm_recv_strategy strategy;
+        string s = val;
+        if      (s == "block")     strategy = ZCM_RECV_BLOCK;
+        else if (s == "spin")      strategy = ZCM_RECV_SPIN;
+        else if (s == "busy_poll") strategy = ZCM_RECV_BUSY_POLL;
+        else {
+            ZCM_DEBUG("Invalid recv_strategy option: %s", val);
+            strategy = recvStrategy;
+        }
+        setRecvStrategy(strategy, spinUs);
+    }
+
+    // A node number, or the name of the network interface to take the node of
+    val = optFind(opts, "numa_node");
+    if (val) {
+        char* end;
+        long node = strtol(val, &end, 10);
+        if (*end || end == val) node = ThreadUtil::getInterfaceNode(val);
+        if (node < 0 || node > INT_MAX || setNumaNode((int) node) != ZCM_EOK)
+            ZCM_DEBUG("Invalid numa_node option: %s", val);
+    }
+
+    static const char* threadPrefixes[ZCM_NUM_THREADS] = { "send", "recv", "dispatch" };
+    for (int i = 0; i < ZCM_NUM_THREADS; ++i) {
+        enum zcm_thread which = (enum zcm_thread) i;
+        string prefix = threadPrefixes[i];
+
+        string opt = prefix + "_cpus";
+        val = optFind(opts, opt.c_str());
+        vector<int> cpus;
+        if (val && (!ThreadUtil::parseCpuList(val, cpus) || setThreadAffinity(which, cpus) != ZCM_EOK))
+            ZCM_DEBUG("Invalid %s option: %s", opt.c_str(), val);
+
+        opt = prefix + "_prio";
+        val = optFind(opts, opt.c_str());
+        if (val && setThreadPriority(which, atoi(val)) != ZCM_EOK)
+            ZCM_DEBUG("Invalid %s option: %s", opt.c_str(), val);
+
+        opt = prefix + "_name";
+        val = optFind(opts, opt.c_str());
+        if (val) setThreadName(which, val);
+    }
+
+    val = optFind(opts, "queue_bytes");
+    if (val) {
+        char* end;
+        unsigned long long n = strtoull(val, &end, 10);
+        if (*end || setQueueBytes(n) != ZCM_EOK)
+            ZCM_DEBUG("Invalid queue_bytes option: %s", val);
+    }
+
+    val = optFind(opts, "inline_publish");
+    if (val) {
+        if (string(val) == "true") setInlinePublish(true);
+        else if (string(val) != "false")
+            ZCM_DEBUG("Invalid inline_publish option: %s", val);
+    }
+
+    val = optFind(opts, "try_publish");
+    if (val) {
+        if (string(val) == "true") setTryPublish(true);
+        else if (string(val) != "false")
+            ZCM_DEBUG("Invalid try_publish option: %s", val);
+    }
+
+    val = optFind(opts, "trace_publish");
+    if (val) {
+        if (string(val) == "true") setTracePublish(true);
+        else if (string(val) != "false")
+            ZCM_DEBUG("Invalid trace_publish option: %s", val);
+    }
+
+    val = optFind(opts, "compress");
+    if (val) {
+        const char* minVal = optFind(opts, "compress_min");
+        uint32_t minSize = minVal ? (uint32_t) strtoul(minVal, nullptr, 10) : 0;
+        if (string(val) == "fast") setCompression(".*", ZCM_CODEC_FAST, minSize);
+        else if (string(val) == "small") setCompression(".*", ZCM_CODEC_SMALL, minSize);
+        else if (string(val) != "none")
+            ZCM_DEBUG("Invalid compress option: %s", val);
+    }
+
+    val = optFind(opts, "decompress");
+    if (val) {
+        if (string(val) == "false") setDecompress(false);
+        else if (string(val) != "true")
+            ZCM_DEBUG("Invalid decompress option: %s", val);
+    }
+
+    const pair<const char*, enum zcm_priority> prioOpts[] = {
+        {"priority_high", ZCM_PRIORITY_HIGH}, {"priority_low", ZCM_PRIORITY_LOW}
+    };
+    for (auto& p : prioOpts) {
+        val = optFind(opts, p.first);
+        if (!val) continue;
+        string list = val;
+        size_t pos = 0;
+        while (pos < list.size()) {
+            size_t end = list.find(',', pos);
+            if (end == string::npos) end = list.size();
+            string channel = list.substr(pos, end - pos);
+            pos = end + 1;
+            if (channel.empty() || setChannelPriority(channel.c_str(), p.second) != ZCM_EOK)
+                ZCM_DEBUG("Invalid %s option: %s", p.first, val);
+        }
+    }
+
+    val = optFind(opts, "stats_publish_ms");
+    if (val) {
+        int ms = atoi(val);
+        if (ms < 0 || setStatsPublish(ms) != ZCM_EOK)
+            ZCM_DEBUG("Invalid stats_publish_ms option: %s", val);
+    }
+
+    val = optFind(opts, "stats_name");
+    if (val) statsName = val;
+
+    val = optFind(opts, "dispatch_profiling");
+    if (val) {
+        if (string(val) == "true") setDispatchProfiling(true, 0, nullptr, nullptr);
+        else if (string(val) != "false")
+            ZCM_DEBUG("Invalid dispatch_profiling option: %s", val);
+    }
+}
+
+void zcm_blocking_t::sendThreadFunc()
+{
+    applyThreadConfig(ZCM_THREAD_SEND);
+
+    while (true) {
+        {
+            unique_lock<mutex> lk(sendStateMutex);
+            sendPauseCond.wait(lk, [&]{
+                    return !paused || sendThreadState == THREAD_STATE_HALTING;
+            });
+            if (sendThreadState == THREAD_STATE_HALTING) break;
+        }
+        unique_lock<mutex> lk(sendOneMutex);
+        if (batchSend) sendMessageBatch();
+        else           sendOneMessage();
+    }
+
+    unique_lock<mutex> lk(sendStateMutex);
+    sendThreadState = THREAD_STATE_HALTED;
+}
+
+int zcm_blocking_t::recvOneMessage(zcm_msg_t* msg, void** token, uint64_t& lastMsgUtime,
+                                   ThreadUtil::Backoff& backoff)
+{
+    int timeout = RECV_TIMEOUT;
+    if (recvStrategy == ZCM_RECV_BUSY_POLL) {
+        timeout = 0;
+    } else if (recvStrategy == ZCM_RECV_SPIN) {
+        // Poll as long as the last message is recent, then go back to blocking
+        if (TimeUtil::utime() - lastMsgUtime < recvSpinUs) timeout = 0;
+    }
+
+    int rc = zeroCopyRecv ? zcm_trans_recvmsg_claim(zt, msg, timeout, token)
+                          : zcm_trans_recvmsg(zt, msg, timeout);
+    if (timeout == 0) {
+        if (rc == ZCM_EOK) backoff.reset();
+        else               backoff.pause();
+    }
+    if (rc == ZCM_EOK && recvStrategy == ZCM_RECV_SPIN) lastMsgUtime = TimeUtil::utime();
+    return rc;
+}
+
+void zcm_blocking_t::recvThreadFunc()
+{
+    applyThreadConfig(ZCM_THREAD_RECV);
+
+    uint64_t lastMsgUtime = 0;
+    ThreadUtil::Backoff backoff;
+
+    shared_ptr<const SubSnapshot> snap;
+    uint64_t snapVersion = 0;
+
+    while (true) {
+        {
+            unique_lock<mutex> lk(recvStateMutex);
+            if (recvThreadState == THREAD_STATE_HALTING) break;
+        }
+        if (statsPeriodUs) publishStats();
+
+        zcm_msg_t msg;
+        msg.chan_hash = 0;
+        msg.recv_ns = 0;
+        void* token = nullptr;
+        int rc = recvOneMessage(&msg, &token, lastMsgUtime, backoff);
+        if (rc == ZCM_EOK) {
+            ZCM_PROBE2(trans_recvmsg, msg.channel, msg.len);
+
+            // Hash the channel once; everything downstream reuses it
+            if (!msg.chan_hash) msg.chan_hash = zcm_channel_hash(msg.channel);
+
+            statAdd(recvMsgs, 1);
+            statAdd(recvBytes, msg.len);
+            ChannelCounters* cc = channelCounters(msg);
+            if (cc) {
+                statAdd(cc->msgs, 1);
+                statAdd(cc->bytes, msg.len);
+            }
+
+            refreshSubs(snap, snapVersion);
+            ChannelMatcher::Result route = snap->matcher->match(msg.channel, msg.chan_hash);
+            // Taken before filtering: the same for every message of a channel,
+            // which keeps them in order
+            size_t prio = snap->prioritized ? recvPriorityOf(*snap, *route)
+                                            : ZCM_PRIORITY_NORMAL;
+            // Filtered and decimated messages go no further than this
+            if (snap->filtered && !route->empty()) {
+                route = filter(route, &msg);
+                if (route->empty()) {
+                    statAdd(recvFiltered, 1);
+                    if (zeroCopyRecv) zcm_trans_recvmsg_release(zt, token);
+                    continue;
+                }
+            }
+            if (snap->decimated && !route->empty()) {
+                route = decimate(route, msg.utime);
+                if (route->empty()) {
+                    statAdd(recvDecimated, 1);
+                    if (zeroCopyRecv) zcm_trans_recvmsg_release(zt, token);
+                    continue;
+                }
+            }
+            bool shared = true;
+            if (!snap->subQueues.empty()) {
+                shared = pushSubQueues(*snap, *route, &msg);
+                armReadyFd();
+            }
+
+            // No subscription actually wants the message (from the shared queue)
+            if (route->empty() || !shared) {
+                if (route->empty()) statAdd(recvUnrouted, 1);
+                if (zeroCopyRecv) zcm_trans_recvmsg_release(zt, token);
+                continue;
+            }
+
+            // Note: After this returns, you have either successfully pushed a message
+            //       into the queue, or the queue was disabled and you will quit out of
+            //       this loop when you re-check the running condition
+            size_t bytes = Msg::footprint(msg.channel, msg.len);
+            if (!waitForQueueBytes(bytes)) {
+                if (zeroCopyRecv) zcm_trans_recvmsg_release(zt, token);
+                continue;
+            }
+            Dispatcher& d = dispatcherFor(msg.chan_hash);
+            auto& queue = d.queueOf(prio);
+            ZCM_PROBE2(recv_queue_push, msg.channel, msg.len);
+            if (zeroCopyRecv) {
+                if (!queue.push(&queueBytes, &msg, zt, token, std::move(route), snap)) {
+                    zcm_trans_recvmsg_release(zt, token);
+                    queueBytes.release(bytes);
+                }
+            } else {
+                if (!queue.push(&queueBytes, &recvArena, &msg, std::move(route), snap))
+                    queueBytes.release(bytes);
+            }
+            // The dispatcher only ever waits on the shared queue
+            if (prio != ZCM_PRIORITY_NORMAL) d.queue.wakeup();
+            armReadyFd();
+        }
+    }
+    unique_lock<mutex> lk(recvStateMutex);
+    recvThreadState = THREAD_STATE_HALTED;
+}
+
+bool zcm_blocking_t::waitForQueueBytes(size_t bytes)
+{
+    if (queueBytes.tryAcquire(bytes)) return true;
+
+    uint64_t start = TimeUtil::monoNs();
+    bool ok;
+    // Like on a full queue, but waking up to recheck the running condition
+    while (!(ok = queueBytes.acquire(bytes, std::chrono::milliseconds(10)))) {
+        unique_lock<mutex> lk(recvStateMutex);
+        if (recvThreadState == THREAD_STATE_HALTING) break;
+    }
+    statAdd(recvBytesBlockedNs, TimeUtil::monoNs() - start);
+    return ok;
+}
+
+void zcm_blocking_t::hndlThreadFunc()
+{
+    applyThreadConfig(ZCM_THREAD_DISPATCH);
+
+    {
+        // Spawn the recv thread
+        unique_lock<mutex> lk(recvStateMutex);
+        recvThreadState = THREAD_STATE_RUNNING;
+        recvThread = thread{&zcm_blocking::recvThreadFunc, this};
+    }
+
+    // Every additional dispatcher gets its own thread
+    for (size_t i = 1; i < numActive; ++i)
+        workerThreads.emplace_back(&zcm_blocking::workerThreadFunc, this, i);
+
+    // Become the handle thread
+    dispatchLoop(*dispatchers[0]);
+
+    for (auto& t : workerThreads) t.join();
+    workerThreads.clear();
+
+    {
+        // Shutdown recv thread
+        unique_lock<mutex> lk(recvStateMutex);
+        recvThreadState = THREAD_STATE_HALTING;
+        for (auto& d : dispatchers) d->eachQueue([](RecvQueue<Msg>& q){ q.disable(); });
+        lk.unlock();
+        zcm_trans_recvmsg_wakeup(zt);
+        recvThread.join();
+    }
+
+    unique_lock<mutex> lk(hndlStateMutex);
+    hndlThreadState = THREAD_STATE_HALTED;
+}
+
+void zcm_blocking_t::workerThreadFunc(size_t index)
+{
+    applyThreadConfig(ZCM_THREAD_DISPATCH, index);
+    dispatchLoop(*dispatchers[index]);
+}
+
+void zcm_blocking_t::dispatchLoop(Dispatcher& d)
+{
+    while (true) {
+        {
+            unique_lock<mutex> lk(hndlStateMutex);
+            hndlPauseCond.wait(lk, [&]{
+                return !paused || hndlThreadState == THREAD_STATE_HALTING;
+            });
+            if (hndlThreadState == THREAD_STATE_HALTING) break;
+        }
+        pollQueue(d);
+        unique_lock<mutex> lk(d.dispOneMutex);
+        if (&d != dispatchers[0].get()) {
+            dispatchOneMessage(d);
+            continue;
+        }
+        runTimers();
+        dispatchOneMessage(d, nextTimerNs);
+    }
+}
+
+void zcm_blocking_t::pollQueue(Dispatcher& d)
+{
+    if (recvStrategy == ZCM_RECV_BLOCK) return;
+
+    // Busy-polling still has to come up for air to notice stop() and pause()
+    uint64_t limit = recvStrategy == ZCM_RECV_BUSY_POLL ? BUSY_POLL_CHECK_US : recvSpinUs;
+    uint64_t start = TimeUtil::utime();
+    ThreadUtil::Backoff backoff;
+    while (!d.hasMessage() && !d.subQueuesReady) {
+        if (TimeUtil::utime() - start >= limit) break;
+        if (&d == dispatchers[0].get() && timerDue()) break;
+        backoff.pause();
+    }
+}
+
+void zcm_blocking_t::applyThreadConfig(enum zcm_thread which, size_t index)
+{
+    ThreadConfig cfg;
+    int node;
+    {
+        unique_lock<mutex> lk(threadConfigMutex);
+        cfg = threadConfig[which];
+        node = numaNode;
+        if (cfg.cpus.empty()) cfg.cpus = numaCpus;
+    }
+    if (!cfg.cpus.empty() && !ThreadUtil::setAffinity(cfg.cpus))
+        ZCM_DEBUG("failed to set the cpu affinity of zcm thread %d", (int) which);
+    // What the thread allocates from now on (e.g. the copies of received
+    // messages, and the transport's buffers on the recv thread) is then local
+    if (node >= 0 && !ThreadUtil::setPreferredNode(node))
+        ZCM_DEBUG("failed to set the numa node of zcm thread %d", (int) which);
+    if (cfg.priority > 0 && !ThreadUtil::setRealtimePriority(cfg.priority))
+        ZCM_DEBUG("failed to set the priority of zcm thread %d", (int) which);
+    if (!cfg.name.empty()) {
+        // Keep the suffix: it is the part that tells the workers apart
+        string name = cfg.name;
+        if (index > 0) {
+            string suffix = "-" + std::to_string(index);
+            name = name.substr(0, ThreadUtil::MAX_NAME_LEN - suffix.size()) + suffix;
+        }
+        ThreadUtil::setName(name);
+    }
+}
+
+// The message dispatchMsg() is dispatching on this thread, for zcm_hold_recv_buf()
+static thread_local Msg* dispatchingMsg = nullptr;
+
+void zcm_blocking_t::dispatchMsg(Msg* m, Dispatcher& d)
+{
+    zcm_msg_t* msg = m->get();
+
+    zcm_recv_buf_t rbuf;
+    fillRecvBuf(d, msg, rbuf);
+
+    // The recv thread already resolved the subscriptions for this message.
+    // Only if they changed in the meantime do we need to look them up again
+    // Note: requires that d.dispOneMutex is locked (which guards 'd.subs')
+    refreshSubs(d.subs, d.subsVersion);
+    const SubSnapshot* snap = d.subs.get();
+    const ChannelMatcher::Result* route = &m->route;
+    ChannelMatcher::Result fresh;
+    if (m->snap.get() != snap) {
+        fresh = snap->matcher->match(msg->channel, msg->chan_hash);
+        route = &fresh;
+    }
+
+    // The recv thread left the filtering to us if the message was compressed,
+    // and never saw the subs looked up again
+    const uint8_t* data;
+    uint32_t len;
+    bool refilter = snap->filtered && (route == &fresh || !filterPayload(msg, data, len));
+
+    // These got their own copy in pushSubQueues(), from the recv thread's snapshot
+    const auto& queued = m->snap ? m->snap->subQueues : snap->subQueues;
+    Msg* outer = dispatchingMsg;
+    dispatchingMsg = m;
+    for (zcm_sub_t* sub : **route) {
+        if (!queued.empty() && queued.count(sub)) continue;
+        if (refilter && !SubEntry::of(sub)->accepts(rbuf.data, rbuf.data_size, msg->channel))
+            continue;
+        invokeCallback(d, sub, &rbuf, 1, msg->channel);
+    }
+    dispatchingMsg = outer;
+}
+
+void zcm_blocking_t::fillRecvBuf(Dispatcher& d, zcm_msg_t* msg, zcm_recv_buf_t& rbuf,
+                                 size_t slot)
+{
+    rbuf.recv_utime = msg->utime;
+    rbuf.zcm = z;
+    rbuf.data = msg->buf;
+    rbuf.data_size = msg->len;
+    rbuf.chan_hash = msg->chan_hash;
+    rbuf.recv_ns = msg->recv_ns ? (int64_t)msg->recv_ns : (int64_t)msg->utime * 1000;
+    if (zcm_trace_decode(msg->buf, msg->len, &rbuf.send_ns, &rbuf.trace_id)) {
+        rbuf.data += ZCM_TRACE_HDR_SIZE;
+        rbuf.data_size -= ZCM_TRACE_HDR_SIZE;
+        countTrace(d, msg, rbuf);
+    }
+
+    uint32_t rawLen;
+    if (!decompress || !zcm_codec_decode(rbuf.data, rbuf.data_size, &rawLen)) return;
+#ifdef USING_ZLIB
+    if (d.inflated.size() <= slot) d.inflated.resize(slot + 1);
+    vector<uint8_t>& buf = d.inflated[slot];
+    buf.resize(rawLen);
+    uLongf outLen = rawLen;
+    int rc = uncompress(buf.data(), &outLen, rbuf.data + ZCM_CODEC_HDR_SIZE,
+                        rbuf.data_size - ZCM_CODEC_HDR_SIZE);
+    if (rc == Z_OK && outLen == rawLen) {
+        rbuf.data = buf.data();
+        rbuf.data_size = rawLen;
+        return;
+    }
+#endif
+    // Dispatched with its envelope, as if decompression was disabled
+    decompressErrors.fetch_add(1, memory_order_relaxed);
+}
+
+void zcm_blocking_t::countTrace(Dispatcher& d, zcm_msg_t* msg, const zcm_recv_buf_t& rbuf)
+{
+    TraceCounters* tc = nullptr;
+    auto it = d.traceIndex.find(msg->chan_hash);
+    if (it != d.traceIndex.end())
+        for (auto* t : it->second)
+            if (t->name == msg->channel) tc = t;
+    if (!tc) {
+        if (d.traces.size() >= STATS_CHANNELS_MAX) return;
+        unique_lock<mutex> lk(statsMutex);
+        d.traces.emplace_back(msg->channel);
+        tc = &d.traces.back();
+        d.traceIndex[msg->chan_hash].push_back(tc);
+    }
+
+    // Clocks of different hosts are never quite in sync
+    int64_t recvNs = rbuf.recv_ns - rbuf.send_ns;
+    int64_t dispatchNs = (int64_t) TimeUtil::realNs() - rbuf.send_ns;
+    if (recvNs < 0 || dispatchNs < 0) statAdd(tc->skewed, 1);
+    recvNs = std::max(recvNs, (int64_t) 0);
+    dispatchNs = std::max(dispatchNs, (int64_t) 0);
+
+    statAdd(tc->msgs, 1);
+    statAdd(tc->recvHist[zcm_latency_hist_bucket(recvNs)], 1);
+    statAdd(tc->dispatchHist[zcm_latency_hist_bucket(dispatchNs)], 1);
+    if ((uint64_t) dispatchNs < tc->minNs.load(memory_order_relaxed))
+        tc->minNs.store(dispatchNs, memory_order_relaxed);
+}
+
+// Tells waitForCallback() which dispatcher (if any) the calling thread runs
+static thread_local const void* currentDispatcher = nullptr;
+
+void zcm_blocking_t::invokeCallback(Dispatcher& d, zcm_sub_t* sub, const zcm_recv_buf_t* rbufs,
+                                    uint32_t n, const char* channel)
+{
+    // The messages are in the order they arrived, so the stale ones come first
+    uint32_t maxAgeUs = SubEntry::of(sub)->maxAgeUs.load(memory_order_relaxed);
+    if (maxAgeUs) {
+        uint64_t now = TimeUtil::utime();
+        uint32_t stale = 0;
+        while (stale < n && rbufs[stale].recv_utime + maxAgeUs < (int64_t) now) ++stale;
+        if (stale) {
+            SubEntry::of(sub)->staleDrops.fetch_add(stale, memory_order_relaxed);
+            dispatchStale.fetch_add(stale, memory_order_relaxed);
+            rbufs += stale;
+            n -= stale;
+            if (n == 0) return;
+        }
+    }
+
+    // Pairs with unsubscribe() clearing 'live' and then reading 'inCallback'
+    // in waitForCallback(): either it sees us in the callback and waits, or
+    // we see that the sub is gone (both are seq_cst)
+    d.inCallback.store(sub);
+    if (SubEntry::of(sub)->live.load()) {
+        const void* outer = currentDispatcher;
+        currentDispatcher = &d;
+        SubEntry* e = SubEntry::of(sub);
+        ZCM_PROBE3(dispatch_begin, channel, rbufs->data_size, sub);
+        uint64_t start = TimeUtil::monoNs();
+        if (e->batchCb) e->batchCb(rbufs, n, channel, sub->usr);
+        else            sub->callback(rbufs, channel, sub->usr);
+        uint64_t ns = TimeUtil::monoNs() - start;
+        ZCM_PROBE3(dispatch_end, channel, rbufs->data_size, sub);
+        e->addDispatch(ns);
+        if (profiling) {
+            e->dispatchHist[zcm_latency_hist_bucket(ns)].fetch_add(1, memory_order_relaxed);
+            if (slowHandler && ns >= slowNs) slowHandler(sub, channel, ns / 1000, slowUsr);
+        }
+        currentDispatcher = outer;
+    }
+    d.inCallback.store(nullptr);
+    if (!d.deferred.empty()) finishDeferred(d);
+}
+
+vector<shared_ptr<zcm_blocking_t::Dispatcher>> zcm_blocking_t::dispatcherList()
+{
+    unique_lock<mutex> lk(statsMutex);
+    return dispatchers;
+}
+
+bool zcm_blocking_t::callbackRunning(zcm_sub_t* sub)
+{
+    for (auto& d : dispatcherList())
+        if (d.get() != currentDispatcher && d->inCallback.load() == sub) return true;
+    return false;
+}
+
+void zcm_blocking_t::waitForCallback(zcm_sub_t* sub)
+{
+    // Possibly the dispatcher of another zcm, whose callback unsubscribes from this one
+    Dispatcher* self = (Dispatcher*) currentDispatcher;
+    if (self) self->waiting.store(true);
+    for (auto& d : dispatcherList()) {
+        if (d.get() == self) continue;
+        ThreadUtil::Backoff backoff;
+        while (d->inCallback.load() == sub) {
+            // Both seq_cst: of two callbacks waiting on each other, at least
+            // one sees the other waiting and stops
+            if (self && d->waiting.load()) {
+                self->deferred.emplace_back(d, sub);
+                break;
+            }
+            backoff.pause();
+        }
+    }
+    if (self) self->waiting.store(false);
+}
+
+void zcm_blocking_t::finishDeferred(Dispatcher& d)
+{
+    // Nothing waits on 'd' now that it isn't in a callback
+    for (auto& w : d.deferred) {
+        ThreadUtil::Backoff backoff;
+        while (w.first->inCallback.load() == w.second) backoff.pause();
+    }
+    d.deferred.clear();
+}
+
+bool zcm_blocking_t::runTimers()
+{
+    if (!timerDue()) return false;
+
+    dueTimers.clear();
+    {
+        unique_lock<mutex> lk(timerMutex);
+        uint64_t now = TimeUtil::monoNs();
+        for (auto& t : timers) {
+            if (t->nextNs > now) continue;
+            // The next deadline follows on from the last one (not from now) so
+            // that lateness doesn't add up; whole periods missed are skipped
+            uint64_t ticks = 1 + (now - t->nextNs) / t->periodNs;
+            t->nextNs += ticks * t->periodNs;
+            dueTimers.emplace_back(t, ticks > UINT32_MAX ? UINT32_MAX : (uint32_t) ticks);
+        }
+        updateNextTimer();
+    }
+    if (dueTimers.empty()) return false;
+
+    // Like invokeCallback(): either removeTimer() sees us in the callback and
+    // waits, or we see that the timer is gone
+    const void* outer = currentDispatcher;
+    currentDispatcher = dispatchers[0].get();
+    for (auto& due : dueTimers) {
+        zcm_timer_t* t = due.first.get();
+        inTimer.store(t);
+        if (t->live.load()) t->cb(z, due.second, t->usr);
+        inTimer.store(nullptr);
+    }
+    currentDispatcher = outer;
+    if (!dispatchers[0]->deferred.empty()) finishDeferred(*dispatchers[0]);
+    dueTimers.clear();
+    return true;
+}
+
+zcm_timer_t* zcm_blocking_t::addTimer(uint64_t periodUs, zcm_timer_handler_t cb, void* usr)
+{
+    if (periodUs == 0 || !cb) return nullptr;
+
+    shared_ptr<zcm_timer_t> t = make_shared<zcm_timer_t>();
+    t->periodNs = periodUs * 1000;
+    t->nextNs = TimeUtil::monoNs() + t->periodNs;
+    t->cb = cb;
+    t->usr = usr;
+    {
+        unique_lock<mutex> lk(timerMutex);
+        timers.push_back(t);
+        updateNextTimer();
     }
+    // The dispatcher may be waiting for a message with no (or a later) deadline
+    dispatchers[0]->queue.wakeup();
+    return t.get();
+}
 
-    if (recvQueue.getCapacity() != numMsgs) {
+int zcm_blocking_t::removeTimer(zcm_timer_t* timer)
+{
+    {
+        unique_lock<mutex> lk(timerMutex);
+        auto it = timers.begin();
+        while (it != timers.end() && it->get() != timer) ++it;
+        if (it == timers.end()) return ZCM_EINVALID;
+        // runTimers() may still hold it: it only frees it once done with it
+        timer->live = false;
+        timers.erase(it);
+        updateNextTimer();
+    }
+    if (currentDispatcher != dispatchers[0].get()) {
+        ThreadUtil::Backoff backoff;
+        while (inTimer.load() == timer) backoff.pause();
+    }
+    return ZCM_EOK;
+}
 
-        recvQueue.disable();
+bool zcm_blocking_t::dispatchOneMessage(Dispatcher& d, uint64_t untilNs)
+{
+    // The higher priority class goes before anything else (see zcm_set_sub_priority())
+    if (d.levels[ZCM_PRIORITY_HIGH] && dispatchLevel(d, ZCM_PRIORITY_HIGH)) return true;
 
-        unique_lock<mutex> lk(dispOneMutex, defer_lock);
+    if (d.subQueueTurn) {
+        d.subQueueTurn = false;
+        if (dispatchSubQueues(d)) return true;
+    }
+    d.subQueueTurn = true;
+
+    // And the lower one once the shared queue is empty, rather than waiting on it
+    if (d.levels[ZCM_PRIORITY_LOW] && !d.queue.hasMessage() &&
+        dispatchLevel(d, ZCM_PRIORITY_LOW)) return true;
+
+    Msg* m;
+    if (untilNs) {
+        // TimeUtil::monoNs() and steady_clock need not count from the same epoch
+        uint64_t now = TimeUtil::monoNs();
+        uint64_t left = untilNs > now ? untilNs - now : 0;
+        m = d.queue.topUntil(chrono::steady_clock::now() + chrono::nanoseconds(left));
+    } else {
+        m = d.queue.top();
+    }
+    // If the Queue was forcibly woken-up (or timed out), recheck the
+    // running condition, and then retry. The wakeup
+    // may have been for the subscription queues, or the priority classes.
+    if (m == nullptr) {
+        for (size_t prio = ZCM_NUM_PRIORITIES; prio-- > 0;)
+            if (d.levels[prio] && dispatchLevel(d, prio)) return true;
+        return dispatchSubQueues(d);
+    }
 
-        if (block) lk.lock();
-        else if (!lk.try_lock()) {
-            recvQueue.enable();
-            return ZCM_EAGAIN;
-        }
+    ZCM_PROBE2(recv_queue_pop, m->get()->channel, m->get()->len);
+    dispatchMsg(m, d);
+    d.queue.pop();
+    return true;
+}
 
-        recvQueue.setCapacity(numMsgs);
-        recvQueue.enable();
-    }
+bool zcm_blocking_t::dispatchLevel(Dispatcher& d, size_t prio)
+{
+    RecvQueue<Msg>& q = *d.levels[prio];
+    if (!q.hasMessage()) return false;
+    Msg* m = q.top();
+    if (m == nullptr) return false;
 
-    return ZCM_EOK;
+    ZCM_PROBE2(recv_queue_pop, m->get()->channel, m->get()->len);
+    dispatchMsg(m, d);
+    q.pop();
+    return true;
 }
 
-void zcm_blocking_t::sendThreadFunc()
+size_t zcm_blocking_t::recvPriorityOf(const SubSnapshot& snap,
+                                      const ChannelMatcher::SubList& route)
 {
-    while (true) {
-        {
-            unique_lock<mutex> lk(sendStateMutex);
-            sendPauseCond.wait(lk, [&]{
-                    return !paused || sendThreadState == THREAD_STATE_HALTING;
-            });
-            if (sendThreadState == THREAD_STATE_HALTING) break;
-        }
-        unique_lock<mutex> lk(sendOneMutex);
-        sendOneMessage();
+    int prio = ZCM_PRIORITY_LOW;
+    for (zcm_sub_t* sub : route) {
+        if (snap.subQueues.count(sub)) continue;
+        prio = std::max(prio, SubEntry::of(sub)->priority.load(memory_order_relaxed));
     }
+    return route.empty() ? ZCM_PRIORITY_NORMAL : prio;
+}
 
-    unique_lock<mutex> lk(sendStateMutex);
-    sendThreadState = THREAD_STATE_HALTED;
+void zcm_blocking_t::makeRecvLevels()
+{
+    for (auto& d : dispatchers)
+        for (size_t prio = 0; prio < ZCM_NUM_PRIORITIES; ++prio)
+            if ((recvLevels & (1u << prio)) && !d->levels[prio])
+                d->levels[prio].reset(new RecvQueue<Msg>(queueSize));
 }
 
-void zcm_blocking_t::recvThreadFunc()
+// Dispatches (at most) one message, or one batch for batched subs, from every
+// subscription queue owned by 'd'
+bool zcm_blocking_t::dispatchSubQueues(Dispatcher& d)
 {
-    while (true) {
+    if (!d.subQueuesReady.exchange(false)) return false;
+
+    bool dispatched = false;
+    bool more = false;
+
+    refreshSubs(d.subs, d.subsVersion);
+    auto snap = d.subs;
+    for (auto& it : snap->subQueues) {
+        zcm_sub_t* sub = it.first;
+        SubQueue& sq = *it.second;
+        if (&dispatcherFor(sub->channel) != &d) continue;
+
+        // Up to maxBatch messages in a row on the same channel, 1 unless batched
+        uint32_t maxBatch = SubEntry::of(sub)->maxBatch;
+        d.batch.clear();
         {
-            unique_lock<mutex> lk(recvStateMutex);
-            if (recvThreadState == THREAD_STATE_HALTING) break;
+            unique_lock<mutex> lk2(sq.mut);
+            while (!sq.msgs.empty() && d.batch.size() < maxBatch) {
+                if (!d.batch.empty() &&
+                    strcmp(sq.msgs.front()->get()->channel, d.batch[0]->get()->channel) != 0)
+                    break;
+                d.batch.push_back(std::move(sq.msgs.front()));
+                sq.msgs.pop_front();
+            }
+            more |= !sq.msgs.empty();
         }
-        zcm_msg_t msg;
-        int rc = zcm_trans_recvmsg(zt, &msg, RECV_TIMEOUT);
-        if (rc == ZCM_EOK) {
-            {
-                unique_lock<mutex> lk(subRecvMutex);
-
-                // Check if message matches a non regex channel
-                auto it = subs.find(msg.channel);
-                if (it == subs.end()) {
-                    // Check if message matches a regex channel
-                    bool foundRegex = false;
-                    for (zcm_sub_t* sub : subRegex) {
-                        regex* r = (regex*)sub->regexobj;
-                        if (regex_match(msg.channel, *r)) {
-                            foundRegex = true;
-                            break;
-                        }
-                    }
-                    // No subscription actually wants the message
-                    if (!foundRegex) continue;
-                }
+        if (d.batch.empty()) continue;
+
+        d.batchBufs.resize(d.batch.size());
+        for (size_t i = 0; i < d.batch.size(); ++i)
+            fillRecvBuf(d, d.batch[i]->get(), d.batchBufs[i], i);
+        // Only the compressed messages are left to filter, as in dispatchMsg()
+        if (snap->filtered) {
+            size_t n = 0;
+            for (size_t i = 0; i < d.batch.size(); ++i) {
+                const uint8_t* data;
+                uint32_t len;
+                const zcm_recv_buf_t& rb = d.batchBufs[i];
+                if (filterPayload(d.batch[i]->get(), data, len) ||
+                    SubEntry::of(sub)->accepts(rb.data, rb.data_size, d.batch[i]->get()->channel))
+                    d.batchBufs[n++] = rb;
+            }
+            d.batchBufs.resize(n);
+            if (n == 0) {
+                d.batch.clear();
+                continue;
             }
-
-            // Note: After this returns, you have either successfully pushed a message
-            //       into the queue, or the queue was disabled and you will quit out of
-            //       this loop when you re-check the running condition
-            recvQueue.push(&msg);
         }
+        invokeCallback(d, sub, d.batchBufs.data(), d.batchBufs.size(), d.batch[0]->get()->channel);
+        d.batch.clear();
+        dispatched = true;
     }
-    unique_lock<mutex> lk(recvStateMutex);
-    recvThreadState = THREAD_STATE_HALTED;
-}
 
-void zcm_blocking_t::hndlThreadFunc()
-{
-    {
-        // Spawn the recv thread
-        unique_lock<mutex> lk(recvStateMutex);
-        recvThreadState = THREAD_STATE_RUNNING;
-        recvThread = thread{&zcm_blocking::recvThreadFunc, this};
+    // Note: top() won't notice the flag on its own, so don't leave the rest
+    //       of the queues waiting for the next message on the shared one
+    if (more) {
+        d.subQueuesReady = true;
+        d.queue.wakeup();
     }
+    return dispatched;
+}
 
-    // Become the handle thread
-    while (true) {
-        {
-            unique_lock<mutex> lk(hndlStateMutex);
-            hndlPauseCond.wait(lk, [&]{
-                return !paused || hndlThreadState == THREAD_STATE_HALTING;
-            });
-            if (hndlThreadState == THREAD_STATE_HALTING) break;
+template<class Keep>
+ChannelMatcher::Result zcm_blocking_t::thin(const ChannelMatcher::Result& route, Keep keep)
+{
+    shared_ptr<ChannelMatcher::SubList> kept;
+    for (size_t i = 0; i < route->size(); ++i) {
+        zcm_sub_t* sub = (*route)[i];
+        if (keep(sub)) {
+            if (kept) kept->push_back(sub);
+        } else if (!kept) {
+            kept = make_shared<ChannelMatcher::SubList>(route->begin(), route->begin() + i);
         }
-        unique_lock<mutex> lk(dispOneMutex);
-        dispatchOneMessage();
-    }
-
-    {
-        // Shutdown recv thread
-        unique_lock<mutex> lk(recvStateMutex);
-        recvThreadState = THREAD_STATE_HALTING;
-        recvQueue.disable();
-        lk.unlock();
-        recvThread.join();
     }
+    if (!kept) return route;
+    return kept;
+}
 
-    unique_lock<mutex> lk(hndlStateMutex);
-    hndlThreadState = THREAD_STATE_HALTED;
+ChannelMatcher::Result zcm_blocking_t::decimate(const ChannelMatcher::Result& route,
+                                                uint64_t utime)
+{
+    return thin(route, [&](zcm_sub_t* sub) { return SubEntry::of(sub)->keep(utime); });
 }
 
-void zcm_blocking_t::dispatchMsg(zcm_msg_t* msg)
+bool zcm_blocking_t::filterPayload(const zcm_msg_t* msg, const uint8_t*& data,
+                                   uint32_t& len) const
 {
-    zcm_recv_buf_t rbuf;
-    rbuf.recv_utime = msg->utime;
-    rbuf.zcm = z;
-    rbuf.data = msg->buf;
-    rbuf.data_size = msg->len;
+    data = msg->buf;
+    len = msg->len;
+    int64_t sendNs;
+    uint64_t traceId;
+    if (zcm_trace_decode(data, len, &sendNs, &traceId)) {
+        data += ZCM_TRACE_HDR_SIZE;
+        len -= ZCM_TRACE_HDR_SIZE;
+    }
+    uint32_t rawLen;
+    return !(decompress && zcm_codec_decode(data, len, &rawLen));
+}
 
-    // Note: We use a lock on dispatch to ensure there is not
-    // a race on modifying and reading the 'subs' container.
-    // This means users cannot call zcm_subscribe or
-    // zcm_unsubscribe from a callback without deadlocking.
-    {
-        unique_lock<mutex> lk(subDispMutex);
+ChannelMatcher::Result zcm_blocking_t::filter(const ChannelMatcher::Result& route,
+                                              const zcm_msg_t* msg)
+{
+    const uint8_t* data;
+    uint32_t len;
+    if (!filterPayload(msg, data, len)) return route;
+    return thin(route, [&](zcm_sub_t* sub) {
+        return SubEntry::of(sub)->accepts(data, len, msg->channel);
+    });
+}
 
-        // dispatch to a non regex channel
-        auto it = subs.find(msg->channel);
-        if (it != subs.end()) {
-            for (zcm_sub_t* sub : it->second) {
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
+bool zcm_blocking_t::pushSubQueues(const SubSnapshot& snap, const ChannelMatcher::SubList& route,
+                                   zcm_msg_t* msg)
+{
+    bool shared = false;
+    for (zcm_sub_t* sub : route) {
+        auto it = snap.subQueues.find(sub);
+        if (it == snap.subQueues.end()) {
+            shared = true;
+            continue;
         }
 
-        // dispatch to any regex channels
-        for (zcm_sub_t* sub : subRegex) {
-            regex* r = (regex*)sub->regexobj;
-            if (regex_match(msg->channel, *r)) {
-                sub->callback(&rbuf, msg->channel, sub->usr);
+        SubQueue& sq = *it->second;
+        {
+            unique_lock<mutex> lk(sq.mut);
+            if (sq.msgs.size() >= sq.depth) {
+                statAdd(subQueueDrops, 1);
+                if (sq.policy == ZCM_QUEUE_DROP_NEWEST) continue;
+                sq.msgs.pop_front();
+            }
+            // Over the memory bound, the new message is dropped whatever the policy
+            if (!queueBytes.tryAcquire(Msg::footprint(msg->channel, msg->len))) {
+                statAdd(subQueueDrops, 1);
+                continue;
             }
+            sq.msgs.emplace_back(new Msg(&queueBytes, &recvArena, msg, nullptr, 0));
         }
+
+        Dispatcher& d = dispatcherFor(sub->channel);
+        d.subQueuesReady = true;
+        d.queue.wakeup();
     }
+    return shared;
 }
 
-bool zcm_blocking_t::dispatchOneMessage()
+bool zcm_blocking_t::sendOneMessage()
 {
-    Msg* m = recvQueue.top();
+    size_t level;
+    Msg* m = sendQueue.top(level);
     // If the Queue was forcibly woken-up, recheck the
     // running condition, and then retry.
     if (m == nullptr) return false;
 
-    dispatchMsg(m->get());
-    recvQueue.pop();
+    zcm_msg_t* msg = m->get();
+    ZCM_PROBE2(send_queue_pop, msg->channel, msg->len);
+    ZCM_PROBE2(trans_sendmsg, msg->channel, msg->len);
+    sendingLevel = level;
+    int ret = zcm_trans_sendmsg(zt, *msg);
+    endInterleaved();
+    sendingLevel = SendQueue::NONE;
+    if (ret != ZCM_EOK) {
+        ZCM_DEBUG("zcm_trans_sendmsg() returned error, dropping the msg!");
+        statAdd(sendErrors, 1);
+    }
+    m->notifySent(ret);
+    sendQueue.pop(level);
     return true;
 }
 
-bool zcm_blocking_t::sendOneMessage()
+// Hands everything queued (up to SEND_BATCH_MAX msgs) to the transport at once
+bool zcm_blocking_t::sendMessageBatch()
 {
-    Msg* m = sendQueue.top();
+    Msg* ms[SEND_BATCH_MAX];
+    size_t level;
+    size_t n = sendQueue.topN(ms, SEND_BATCH_MAX, level);
     // If the Queue was forcibly woken-up, recheck the
     // running condition, and then retry.
-    if (m == nullptr) return false;
+    if (n == 0) return false;
 
-    zcm_msg_t* msg = m->get();
-    int ret = zcm_trans_sendmsg(zt, *msg);
-    if (ret != ZCM_EOK) ZCM_DEBUG("zcm_trans_sendmsg() returned error, dropping the msg!");
-    sendQueue.pop();
+    zcm_msg_t msgs[SEND_BATCH_MAX];
+    for (size_t i = 0; i < n; ++i) {
+        msgs[i] = *ms[i]->get();
+        ZCM_PROBE2(send_queue_pop, msgs[i].channel, msgs[i].len);
+        ZCM_PROBE2(trans_sendmsg, msgs[i].channel, msgs[i].len);
+    }
+    sendingLevel = level;
+    int ret = zcm_trans_sendmsg_batch(zt, msgs, n);
+    endInterleaved();
+    sendingLevel = SendQueue::NONE;
+    if (ret != ZCM_EOK) {
+        ZCM_DEBUG("zcm_trans_sendmsg_batch() returned error, dropping msgs!");
+        statAdd(sendErrors, 1);
+    }
+    for (size_t i = 0; i < n; ++i) ms[i]->notifySent(ret);
+    sendQueue.popN(level, n);
+    return true;
+}
+
+bool zcm_blocking_t::interleaveNext(void* usr, size_t maxlen, zcm_msg_t* msg)
+{
+    zcm_blocking_t* zcm = (zcm_blocking_t*) usr;
+    zcm->endInterleaved();
+    // Nothing can overtake messages sent inline
+    if (zcm->sendingLevel == SendQueue::NONE) return false;
+
+    size_t level;
+    Msg* m = zcm->sendQueue.peekAbove(zcm->sendingLevel, level);
+    if (m == nullptr || m->get()->len > maxlen) return false;
+
+    *msg = *m->get();
+    zcm->interleaved = m;
+    ZCM_PROBE2(send_queue_pop, msg->channel, msg->len);
+    ZCM_PROBE2(trans_sendmsg, msg->channel, msg->len);
+    zcm->interleavedLevel = level;
     return true;
 }
 
-bool zcm_blocking_t::deleteSubEntry(zcm_sub_t* sub, size_t nentriesleft)
+void zcm_blocking_t::endInterleaved()
+{
+    if (interleavedLevel == SendQueue::NONE) return;
+    // Note: transports don't report errors per interleaved message
+    interleaved->notifySent(ZCM_EOK);
+    sendQueue.pop(interleavedLevel);
+    interleavedLevel = SendQueue::NONE;
+    statAdd(sendInterleaved, 1);
+}
+
+zcm_blocking_t::Dispatcher& zcm_blocking_t::dispatcherFor(uint32_t chanHash)
+{
+    return *dispatchers[chanHash % numActive];
+}
+
+zcm_blocking_t::Dispatcher& zcm_blocking_t::dispatcherFor(const char* channel)
+{
+    if (numActive == 1) return *dispatchers[0];
+    return dispatcherFor(zcm_channel_hash(channel));
+}
+
+// Note: the sub itself is deleted along with the last snapshot holding it
+bool zcm_blocking_t::disableSubChannel(zcm_sub_t* sub, size_t nregexleft)
 {
     int rc = ZCM_EOK;
     if (sub->regex) {
-        delete (std::regex*) sub->regexobj;
-        if (nentriesleft == 0) {
+        if (nregexleft == 0) {
             rc = zcm_trans_recvmsg_enable(zt, NULL, false);
         }
     } else {
         rc = zcm_trans_recvmsg_enable(zt, sub->channel, false);
     }
-    delete sub;
     return rc == ZCM_EOK;
 }
 
-bool zcm_blocking_t::deleteFromSubList(SubList& slist, zcm_sub_t* sub)
-{
-    for (size_t i = 0; i < slist.size(); i++) {
-        if (slist[i] == sub) {
-            // shrink the array by moving the last element
-            size_t last = slist.size()-1;
-            slist[i] = slist[last];
-            slist.resize(last);
-            // delete the element
-            return deleteSubEntry(sub, slist.size());
-        }
-    }
-    return false;
-}
-
 /////////////// C Interface Functions ////////////////
 extern "C" {
 
@@ -754,7 +3374,22 @@ void zcm_blocking_destroy(zcm_blocking_t* zcm)
 
 int zcm_blocking_publish(zcm_blocking_t* zcm, const char* channel, const uint8_t* data, uint32_t len)
 {
-    return zcm->publish(channel, data, len);
+    return zcm->publish(channel, data, len, false);
+}
+
+int zcm_blocking_publish_notify(zcm_blocking_t* zcm, const char* channel,
+                                const uint8_t* data, uint32_t len,
+                                zcm_sent_handler_t cb, void* usr)
+{
+    return zcm->publish(channel, data, len, false, cb, usr);
+}
+
+int zcm_blocking_try_publish(zcm_blocking_t* zcm, const char* channel,
+                             const uint8_t* data, uint32_t len, zcm_pub_status_t* status)
+{
+    int ret = zcm->publish(channel, data, len, true);
+    if (status) zcm->getPubStatus(channel, status);
+    return ret;
 }
 
 zcm_sub_t* zcm_blocking_subscribe(zcm_blocking_t* zcm, const char* channel,
@@ -769,11 +3404,45 @@ zcm_sub_t* zcm_blocking_try_subscribe(zcm_blocking_t* zcm, const char* channel,
     return zcm->subscribe(channel, cb, usr, false);
 }
 
+zcm_sub_t* zcm_blocking_subscribe_batch(zcm_blocking_t* zcm, const char* channel,
+                                        zcm_batch_handler_t cb, uint32_t maxBatch,
+                                        uint32_t depth, void* usr)
+{
+    return zcm->subscribe(channel, nullptr, usr, true, cb, maxBatch, depth);
+}
+
 int zcm_blocking_unsubscribe(zcm_blocking_t* zcm, zcm_sub_t* sub)
 {
     return zcm->unsubscribe(sub, true);
 }
 
+zcm_timer_t* zcm_blocking_add_timer(zcm_blocking_t* zcm, uint64_t periodUs,
+                                    zcm_timer_handler_t cb, void* usr)
+{
+    return zcm->addTimer(periodUs, cb, usr);
+}
+
+int zcm_blocking_remove_timer(zcm_blocking_t* zcm, zcm_timer_t* timer)
+{
+    return zcm->removeTimer(timer);
+}
+
+zcm_held_msg_t* zcm_blocking_hold_recv_buf(const zcm_recv_buf_t* rbuf)
+{
+    // Decompressed messages are dispatched from a buffer of the dispatcher
+    Msg* m = dispatchingMsg;
+    if (!m) return nullptr;
+    const zcm_msg_t* msg = m->get();
+    if (rbuf->data < msg->buf || rbuf->data + rbuf->data_size > msg->buf + msg->len)
+        return nullptr;
+    return m->hold();
+}
+
+void zcm_blocking_release_recv_buf(zcm_held_msg_t* held)
+{
+    releaseHeld(held);
+}
+
 int zcm_blocking_try_unsubscribe(zcm_blocking_t* zcm, zcm_sub_t* sub)
 {
     return zcm->unsubscribe(sub, false);
@@ -789,6 +3458,11 @@ int  zcm_blocking_try_flush(zcm_blocking_t* zcm)
     return zcm->flush(false);
 }
 
+int  zcm_blocking_flush_n(zcm_blocking_t* zcm, uint32_t maxMsgs, uint32_t budgetUs)
+{
+    return zcm->flushN(maxMsgs, budgetUs);
+}
+
 void zcm_blocking_run(zcm_blocking_t* zcm)
 {
     return zcm->run();
@@ -824,6 +3498,46 @@ int zcm_blocking_handle(zcm_blocking_t* zcm)
     return zcm->handle();
 }
 
+int zcm_blocking_handle_timeout(zcm_blocking_t* zcm, uint32_t timeoutUs)
+{
+    return zcm->handleTimeout(timeoutUs);
+}
+
+int zcm_blocking_handle_nonblock(zcm_blocking_t* zcm)
+{
+    return zcm->handleNonblock();
+}
+
+int zcm_blocking_handle_nonblock_n(zcm_blocking_t* zcm, uint32_t maxMsgs, uint32_t budgetUs)
+{
+    return zcm->handleNonblockN(maxMsgs, budgetUs);
+}
+
+int zcm_blocking_get_fd(zcm_blocking_t* zcm)
+{
+    return zcm->getFd();
+}
+
+int zcm_blocking_get_send_fd(zcm_blocking_t* zcm)
+{
+    return zcm->getSendFd();
+}
+
+void zcm_blocking_send_queued(zcm_blocking_t* zcm)
+{
+    zcm->sendQueued();
+}
+
+void zcm_blocking_close_send_fd(zcm_blocking_t* zcm)
+{
+    zcm->closeSendFd();
+}
+
+int zcm_blocking_has_subscribers(zcm_blocking_t* zcm, const char* channel)
+{
+    return zcm->hasSubscribers(channel);
+}
+
 void zcm_blocking_set_queue_size(zcm_blocking_t* zcm, uint32_t sz)
 {
     zcm->setQueueSize(sz, true);
@@ -834,4 +3548,140 @@ int  zcm_blocking_try_set_queue_size(zcm_blocking_t* zcm, uint32_t sz)
     return zcm->setQueueSize(sz, false);
 }
 
+int  zcm_blocking_set_queue_bytes(zcm_blocking_t* zcm, uint64_t maxBytes)
+{
+    return zcm->setQueueBytes(maxBytes);
+}
+
+int  zcm_blocking_set_dispatch_threads(zcm_blocking_t* zcm, uint32_t numThreads)
+{
+    return zcm->setDispatchThreads(numThreads);
+}
+
+int  zcm_blocking_publish_batch(zcm_blocking_t* zcm, const zcm_pub_msg_t* msgs, uint32_t nmsgs)
+{
+    return zcm->publishBatch(msgs, nmsgs);
+}
+
+int  zcm_blocking_publish_iov(zcm_blocking_t* zcm, const char* channel,
+                              const zcm_iov_t* iov, uint32_t niov)
+{
+    return zcm->publishIov(channel, iov, niov);
+}
+
+int  zcm_blocking_get_stats(zcm_blocking_t* zcm, zcm_stat_handler_t cb, void* usr)
+{
+    return zcm->getStats(cb, usr);
+}
+
+int  zcm_blocking_set_dispatch_profiling(zcm_blocking_t* zcm, int enable, uint32_t slowUs,
+                                         zcm_slow_handler_t cb, void* usr)
+{
+    return zcm->setDispatchProfiling(enable != 0, slowUs, cb, usr);
+}
+
+int  zcm_blocking_set_inline_publish(zcm_blocking_t* zcm, int enable)
+{
+    return zcm->setInlinePublish(enable != 0);
+}
+
+int  zcm_blocking_set_try_publish(zcm_blocking_t* zcm, int enable)
+{
+    return zcm->setTryPublish(enable != 0);
+}
+
+int  zcm_blocking_set_trace_publish(zcm_blocking_t* zcm, int enable)
+{
+    return zcm->setTracePublish(enable != 0);
+}
+
+void zcm_blocking_set_trace_id(uint64_t trace_id)
+{
+    traceId = trace_id;
+}
+
+int  zcm_blocking_set_channel_priority(zcm_blocking_t* zcm, const char* channel,
+                                       enum zcm_priority prio)
+{
+    return zcm->setChannelPriority(channel, prio);
+}
+
+int  zcm_blocking_set_compression(zcm_blocking_t* zcm, const char* channel,
+                                  enum zcm_codec codec, uint32_t minSize)
+{
+    return zcm->setCompression(channel, codec, minSize);
+}
+
+int  zcm_blocking_set_decompress(zcm_blocking_t* zcm, int enable)
+{
+    return zcm->setDecompress(enable != 0);
+}
+
+int  zcm_blocking_set_stats_publish(zcm_blocking_t* zcm, uint32_t periodMs)
+{
+    return zcm->setStatsPublish(periodMs);
+}
+
+int  zcm_blocking_set_recv_strategy(zcm_blocking_t* zcm, enum zcm_recv_strategy strategy,
+                                    uint32_t spinUs)
+{
+    return zcm->setRecvStrategy(strategy, spinUs);
+}
+
+int  zcm_blocking_set_thread_affinity(zcm_blocking_t* zcm, enum zcm_thread which,
+                                      const int* cpus, uint32_t ncpus)
+{
+    if (ncpus > 0 && !cpus) return ZCM_EINVALID;
+    return zcm->setThreadAffinity(which, vector<int>(cpus, cpus + ncpus));
+}
+
+int  zcm_blocking_set_numa_node(zcm_blocking_t* zcm, int node)
+{
+    return zcm->setNumaNode(node);
+}
+
+int  zcm_blocking_set_thread_priority(zcm_blocking_t* zcm, enum zcm_thread which, int priority)
+{
+    return zcm->setThreadPriority(which, priority);
+}
+
+int  zcm_blocking_set_thread_name(zcm_blocking_t* zcm, enum zcm_thread which, const char* name)
+{
+    return zcm->setThreadName(which, name ? name : "");
+}
+
+int  zcm_blocking_set_sub_queue(zcm_blocking_t* zcm, zcm_sub_t* sub,
+                                uint32_t depth, enum zcm_queue_policy policy)
+{
+    return zcm->setSubQueue(sub, depth, policy);
+}
+
+int  zcm_blocking_set_sub_decimation(zcm_blocking_t* zcm, zcm_sub_t* sub,
+                                     uint32_t minPeriodUs, uint32_t keepEvery)
+{
+    return zcm->setSubDecimation(sub, minPeriodUs, keepEvery);
+}
+
+int  zcm_blocking_set_sub_priority(zcm_blocking_t* zcm, zcm_sub_t* sub,
+                                   enum zcm_priority prio)
+{
+    return zcm->setSubPriority(sub, prio);
+}
+
+int  zcm_blocking_set_sub_max_age(zcm_blocking_t* zcm, zcm_sub_t* sub, uint32_t maxAgeUs)
+{
+    return zcm->setSubMaxAge(sub, maxAgeUs);
+}
+
+int  zcm_blocking_set_sub_filter(zcm_blocking_t* zcm, zcm_sub_t* sub,
+                                 zcm_filter_t filter, void* usr)
+{
+    return zcm->setSubFilter(sub, filter, usr);
+}
+
+void zcm_blocking_set_url_opts(zcm_blocking_t* zcm, zcm_url_opts_t* opts)
+{
+    zcm->setUrlOpts(opts);
+}
+
 }
@@ -3,6 +3,7 @@
 
 #include "zcm/zcm.h"
 #include "zcm/transport.h"
+#include "zcm/url.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,6 +15,11 @@ void            zcm_blocking_destroy(zcm_blocking_t* zcm);
 
 int zcm_blocking_publish(zcm_blocking_t* zcm, const char* channel,
                          const uint8_t* data, uint32_t len);
+int zcm_blocking_try_publish(zcm_blocking_t* zcm, const char* channel,
+                             const uint8_t* data, uint32_t len, zcm_pub_status_t* status);
+int zcm_blocking_publish_notify(zcm_blocking_t* zcm, const char* channel,
+                                const uint8_t* data, uint32_t len,
+                                zcm_sent_handler_t cb, void* usr);
 
 zcm_sub_t* zcm_blocking_subscribe(zcm_blocking_t* zcm, const char* channel,
                                   zcm_msg_handler_t cb, void* usr);
@@ -25,6 +31,7 @@ int zcm_blocking_try_unsubscribe(zcm_blocking_t* zcm, zcm_sub_t* sub);
 
 void zcm_blocking_flush(zcm_blocking_t* zcm);
 int  zcm_blocking_try_flush(zcm_blocking_t* zcm);
+int  zcm_blocking_flush_n(zcm_blocking_t* zcm, uint32_t maxMsgs, uint32_t budgetUs);
 
 void zcm_blocking_run(zcm_blocking_t* zcm);
 void zcm_blocking_start(zcm_blocking_t* zcm);
@@ -33,8 +40,64 @@ void zcm_blocking_stop(zcm_blocking_t* zcm);
 void zcm_blocking_pause(zcm_blocking_t* zcm);
 void zcm_blocking_resume(zcm_blocking_t* zcm);
 int  zcm_blocking_handle(zcm_blocking_t* zcm);
+int  zcm_blocking_handle_timeout(zcm_blocking_t* zcm, uint32_t timeoutUs);
+int  zcm_blocking_handle_nonblock(zcm_blocking_t* zcm);
+int  zcm_blocking_handle_nonblock_n(zcm_blocking_t* zcm, uint32_t maxMsgs, uint32_t budgetUs);
+int  zcm_blocking_get_fd(zcm_blocking_t* zcm);
+/* For zcm_executor_attach(): from get_send_fd() until close_send_fd() no send thread
+   runs, messages are queued and the descriptor becomes readable when there are some
+   for send_queued() to send */
+int  zcm_blocking_get_send_fd(zcm_blocking_t* zcm);
+void zcm_blocking_send_queued(zcm_blocking_t* zcm);
+void zcm_blocking_close_send_fd(zcm_blocking_t* zcm);
+int  zcm_blocking_has_subscribers(zcm_blocking_t* zcm, const char* channel);
 void zcm_blocking_set_queue_size(zcm_blocking_t* zcm, uint32_t numMsgs);
 int  zcm_blocking_try_set_queue_size(zcm_blocking_t* zcm, uint32_t numMsgs);
+int  zcm_blocking_set_queue_bytes(zcm_blocking_t* zcm, uint64_t maxBytes);
+int  zcm_blocking_publish_batch(zcm_blocking_t* zcm, const zcm_pub_msg_t* msgs, uint32_t nmsgs);
+int  zcm_blocking_publish_iov(zcm_blocking_t* zcm, const char* channel,
+                              const zcm_iov_t* iov, uint32_t niov);
+int  zcm_blocking_get_stats(zcm_blocking_t* zcm, zcm_stat_handler_t cb, void* usr);
+int  zcm_blocking_set_dispatch_profiling(zcm_blocking_t* zcm, int enable, uint32_t slowUs,
+                                         zcm_slow_handler_t cb, void* usr);
+int  zcm_blocking_set_inline_publish(zcm_blocking_t* zcm, int enable);
+int  zcm_blocking_set_try_publish(zcm_blocking_t* zcm, int enable);
+int  zcm_blocking_set_stats_publish(zcm_blocking_t* zcm, uint32_t periodMs);
+int  zcm_blocking_set_trace_publish(zcm_blocking_t* zcm, int enable);
+void zcm_blocking_set_trace_id(uint64_t trace_id);
+int  zcm_blocking_set_channel_priority(zcm_blocking_t* zcm, const char* channel,
+                                       enum zcm_priority prio);
+int  zcm_blocking_set_compression(zcm_blocking_t* zcm, const char* channel,
+                                  enum zcm_codec codec, uint32_t minSize);
+int  zcm_blocking_set_decompress(zcm_blocking_t* zcm, int enable);
+int  zcm_blocking_set_recv_strategy(zcm_blocking_t* zcm, enum zcm_recv_strategy strategy,
+                                    uint32_t spinUs);
+int  zcm_blocking_set_thread_affinity(zcm_blocking_t* zcm, enum zcm_thread which,
+                                      const int* cpus, uint32_t ncpus);
+int  zcm_blocking_set_numa_node(zcm_blocking_t* zcm, int node);
+int  zcm_blocking_set_thread_priority(zcm_blocking_t* zcm, enum zcm_thread which, int priority);
+int  zcm_blocking_set_thread_name(zcm_blocking_t* zcm, enum zcm_thread which, const char* name);
+int  zcm_blocking_set_dispatch_threads(zcm_blocking_t* zcm, uint32_t numThreads);
+int  zcm_blocking_set_sub_queue(zcm_blocking_t* zcm, zcm_sub_t* sub,
+                                uint32_t depth, enum zcm_queue_policy policy);
+int  zcm_blocking_set_sub_decimation(zcm_blocking_t* zcm, zcm_sub_t* sub,
+                                     uint32_t minPeriodUs, uint32_t keepEvery);
+int  zcm_blocking_set_sub_priority(zcm_blocking_t* zcm, zcm_sub_t* sub,
+                                   enum zcm_priority prio);
+int  zcm_blocking_set_sub_max_age(zcm_blocking_t* zcm, zcm_sub_t* sub, uint32_t maxAgeUs);
+int  zcm_blocking_set_sub_filter(zcm_blocking_t* zcm, zcm_sub_t* sub,
+                                 zcm_filter_t filter, void* usr);
+zcm_sub_t* zcm_blocking_subscribe_batch(zcm_blocking_t* zcm, const char* channel,
+                                        zcm_batch_handler_t cb, uint32_t maxBatch,
+                                        uint32_t depth, void* usr);
+zcm_timer_t* zcm_blocking_add_timer(zcm_blocking_t* zcm, uint64_t periodUs,
+                                    zcm_timer_handler_t cb, void* usr);
+int  zcm_blocking_remove_timer(zcm_blocking_t* zcm, zcm_timer_t* timer);
+zcm_held_msg_t* zcm_blocking_hold_recv_buf(const zcm_recv_buf_t* rbuf);
+void zcm_blocking_release_recv_buf(zcm_held_msg_t* held);
+
+/* Applies the zcm-level (as opposed to transport-level) options of a url */
+void zcm_blocking_set_url_opts(zcm_blocking_t* zcm, zcm_url_opts_t* opts);
 
 #ifdef __cplusplus
 }
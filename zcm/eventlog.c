@@ -3,8 +3,471 @@
 #include <assert.h>
 #include <string.h>
 
+#ifdef USING_ZLIB
+#include <zlib.h>
+#endif
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#define USE_MMAP
+#define USE_WRITEV
+#define USE_ASYNC_WRITES
+#define USE_PREAD
+#include <sys/socket.h>
+#include <netdb.h>
+#define USE_REMOTE
+#endif
+
 #define MAGIC ((int32_t) 0xEDA1DA01L)
 
+// The sidecar time index is this magic followed by (timestamp, eventnum,
+// offset) entries, all big-endian like the log itself
+#define INDEX_MAGIC ((int32_t) 0xEDA1DA1DL)
+#define INDEX_ENTRY_BYTES (sizeof(int64_t) * 3)
+
+// Compressed logs are a sequence of blocks:
+//   magic, codec, nevents, rawlen, storedlen, blocklen (int32)
+//   first eventnum, first timestamp, last timestamp (int64)
+//   storedlen bytes, then padding up to blocklen bytes in total
+// where the stored bytes are 'nevents' events as written in plain logs
+// (rawlen bytes), compressed with 'codec'. Blocks are padded to at least one
+// byte per event, which gives every event an offset
+#define BLOCK_MAGIC ((int32_t) 0xEDA1DA0CL)
+#define BLOCK_HEADER_BYTES (sizeof(int32_t) * 6 + sizeof(int64_t) * 3)
+#define BLOCK_MAX_RAW (64 << 20)
+#define BLOCK_DEFAULT_BYTES (1 << 20)
+#define BLOCK_DEFAULT_LEVEL 1
+
+enum { CODEC_STORED = 0, CODEC_ZLIB = 1 };
+enum { FORMAT_EMPTY = -1, FORMAT_EVENTS = 0, FORMAT_BLOCKS = 1, FORMAT_SET = 2 };
+
+// Sets of logs are text files: this line, then the path of every log (relative
+// to the directory of the set unless absolute) on its own line
+#define SET_HEADER "ZCM-LOG-SET\n"
+#define SET_MAGIC ((int32_t) 0x5A434D2DL)   // "ZCM-"
+#define SET_MAX_PATH 4096
+
+// Logs served by zcm-log-server are read through a query of three lines:
+//   "ZCMLOG1 <start> <end> <relative> <zlib>"
+//   the path of the log, relative to the root of the server
+//   the channels to read, comma separated, none for all of them
+// for the events logged in [start, end] (in us, counted from the first event
+// of the log if 'relative'), compressed if 'zlib'. The server answers "OK
+// <timestamp of the first event>" or "ERR <reason>", then streams the events
+// as written in plain logs, in batches of a header of three int32 (codec,
+// rawlen, storedlen) and storedlen bytes. A batch of no bytes ends the stream
+#define REMOTE_PREFIX "zcmlog://"
+#define REMOTE_VERSION "ZCMLOG1"
+#define REMOTE_DEFAULT_PORT "7400"
+#define REMOTE_BATCH_HEADER_BYTES (sizeof(int32_t) * 3)
+
+typedef struct block_header_t block_header_t;
+struct block_header_t
+{
+    int32_t codec;
+    int32_t nevents;
+    int32_t rawlen;
+    int32_t storedlen;
+    int32_t blocklen;
+    int64_t eventnum;
+    int64_t first;
+    int64_t last;
+};
+
+struct _zcm_eventlog_blocks_t
+{
+    // Reading: the block loaded from [offset, end), -1 if none, and where
+    // its 'nevents' events start in 'raw'
+    off_t    offset;
+    off_t    end;
+    int32_t  nevents;
+    size_t*  starts;
+    size_t   startscap;
+
+    // Writing: 'pending' events of the block being filled are in 'raw'
+    int      level;
+    size_t   blockbytes;
+    int32_t  pending;
+    int64_t  eventnum;
+    int64_t  first;
+    int64_t  last;
+
+    uint8_t* raw;
+    size_t   rawlen;
+    size_t   rawcap;
+    uint8_t* stored;
+    size_t   storedcap;
+};
+
+struct _zcm_eventlog_remote_t
+{
+    char*    host;
+    char*    port;
+    char*    path;
+    char*    channels;
+
+    // The window of the query. Relative until the first answer tells when
+    // the log starts
+    int64_t  start;
+    int64_t  end;
+    int      relative;
+
+    // The batch being read, 'rawpos' into its 'rawlen' bytes
+    uint8_t* raw;
+    size_t   rawlen;
+    size_t   rawcap;
+    size_t   rawpos;
+    uint8_t* stored;
+    size_t   storedcap;
+    int      ended;
+};
+
+// Event header size, after the magic
+#define HEADER_BYTES (sizeof(int64_t) * 2 + sizeof(int32_t) * 2)
+
+// How far ahead of the read position mapped logs are asked to be read
+#define READAHEAD_BYTES (32 << 20)
+
+// Events written are gathered up to this many bytes before reaching the file
+#define WRITE_BUFFER_DEFAULT_BYTES (256 << 10)
+
+#ifdef USE_MMAP
+static void map_open(zcm_eventlog_t *l)
+{
+    struct stat st;
+    int fd = fileno(l->f);
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) return;
+    if ((uint64_t) st.st_size > SIZE_MAX) return;
+
+    // Private and writable so that users may still modify the data of events
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    l->map = (uint8_t*) map;
+    l->maplen = st.st_size;
+
+    // Has stdio cache the file offset, so that pos_tell() is a cheap ftello()
+    fseeko(l->f, 0, SEEK_SET);
+}
+#endif
+
+static int peek_format(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return FORMAT_EMPTY;
+    int32_t magic;
+    int format = fread32(f, &magic) != 0    ? FORMAT_EMPTY :
+                 magic == BLOCK_MAGIC        ? FORMAT_BLOCKS :
+                 magic == SET_MAGIC          ? FORMAT_SET    : FORMAT_EVENTS;
+    fclose(f);
+    return format;
+}
+
+static zcm_eventlog_blocks_t *blocks_create(int level, size_t block_bytes)
+{
+    zcm_eventlog_blocks_t *b = (zcm_eventlog_blocks_t*) calloc(1, sizeof(zcm_eventlog_blocks_t));
+    b->offset = -1;
+    b->level = level;
+    b->blockbytes = block_bytes;
+    return b;
+}
+
+static uint8_t *put32(uint8_t *p, int32_t v)
+{
+    p[0] = (uint32_t) v >> 24;
+    p[1] = (uint32_t) v >> 16;
+    p[2] = (uint32_t) v >> 8;
+    p[3] = (uint32_t) v;
+    return p + 4;
+}
+
+static uint8_t *put64(uint8_t *p, int64_t v)
+{
+    return put32(put32(p, (uint64_t) v >> 32), (uint64_t) v & 0xffffffff);
+}
+
+// Writes the 'n' chunks out, straight to the file descriptor when possible.
+// Returns 0 on success -1 on failure
+static int write_chunks(zcm_eventlog_t *l, const uint8_t **p, size_t *len, int n)
+{
+#ifdef USE_WRITEV
+    struct iovec iov[3];
+    int i, first = 0;
+    assert(n <= 3);
+    for (i = 0; i < n; ++i) {
+        iov[i].iov_base = (void*) p[i];
+        iov[i].iov_len = len[i];
+    }
+    while (first < n) {
+        ssize_t r = writev(fileno(l->f), iov + first, n - first);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (first < n && (size_t) r >= iov[first].iov_len)
+            r -= iov[first++].iov_len;
+        if (first < n) {
+            iov[first].iov_base = (uint8_t*) iov[first].iov_base + r;
+            iov[first].iov_len -= r;
+        }
+    }
+    return 0;
+#else
+    int i;
+    for (i = 0; i < n; ++i)
+        if (fwrite(p[i], 1, len[i], l->f) != len[i]) return -1;
+    return 0;
+#endif
+}
+
+#ifdef USE_ASYNC_WRITES
+// The writer thread writes out the 'count' buffers of 'bufs' from 'head' on,
+// syncing the file after those marked so. Writers trade their full buffer for
+// a free one, and only wait when all of them are queued
+typedef struct writer_buf_t writer_buf_t;
+struct writer_buf_t
+{
+    uint8_t* data;
+    size_t   len;
+    size_t   cap;
+    int      sync;
+};
+
+struct _zcm_eventlog_writer_t
+{
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+
+    writer_buf_t*   bufs;
+    size_t          nbufs;
+    size_t          head;
+    size_t          count;
+
+    int             stop;
+    int             error;      // errno of the first failed write, 0 if none
+};
+
+static void *writer_thread(void *arg)
+{
+    zcm_eventlog_t *l = (zcm_eventlog_t*) arg;
+    zcm_eventlog_writer_t *w = l->writer;
+
+    pthread_mutex_lock(&w->mutex);
+    while (1) {
+        while (w->count == 0 && !w->stop) pthread_cond_wait(&w->cond, &w->mutex);
+        if (w->count == 0) break;
+        writer_buf_t *b = &w->bufs[w->head];
+        pthread_mutex_unlock(&w->mutex);
+
+        // Once a write failed, the rest of the log is dropped
+        const uint8_t *data = b->data;
+        int err = 0;
+        if (w->error == 0 && b->len > 0 && write_chunks(l, &data, &b->len, 1) != 0)
+            err = errno ? errno : EIO;
+        if (w->error == 0 && err == 0 && b->sync && fdatasync(fileno(l->f)) != 0)
+            err = errno;
+
+        pthread_mutex_lock(&w->mutex);
+        if (err && w->error == 0) w->error = err;
+        b->len = 0;
+        b->sync = 0;
+        w->head = (w->head + 1) % w->nbufs;
+        w->count--;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return NULL;
+}
+
+// Queues the write buffer (and a sync after it if 'sync'), and makes a free
+// buffer the write buffer. Returns -1, with errno set, if a write failed
+static int writer_push(zcm_eventlog_t *l, int sync)
+{
+    zcm_eventlog_writer_t *w = l->writer;
+    if (l->wbuflen == 0 && !sync) return 0;
+
+    pthread_mutex_lock(&w->mutex);
+    while (w->count == w->nbufs && w->error == 0) pthread_cond_wait(&w->cond, &w->mutex);
+    int err = w->error;
+    if (err == 0) {
+        writer_buf_t *b = &w->bufs[(w->head + w->count) % w->nbufs];
+        uint8_t *data = b->data;
+        size_t cap = b->cap;
+        b->data = l->wbuf;
+        b->cap = l->wbufcap;
+        b->len = l->wbuflen;
+        b->sync = sync;
+        l->wbuf = data;
+        l->wbufcap = cap;
+        w->count++;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->mutex);
+
+    l->wbuflen = 0;
+    if (err) errno = err;
+    return err ? -1 : 0;
+}
+
+// Waits for everything queued to be written
+static int writer_drain(zcm_eventlog_t *l)
+{
+    zcm_eventlog_writer_t *w = l->writer;
+    int ret = writer_push(l, 0);
+    pthread_mutex_lock(&w->mutex);
+    while (w->count > 0) pthread_cond_wait(&w->cond, &w->mutex);
+    if (w->error) {
+        errno = w->error;
+        ret = -1;
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return ret;
+}
+
+static void writer_destroy(zcm_eventlog_t *l)
+{
+    zcm_eventlog_writer_t *w = l->writer;
+    writer_drain(l);
+    pthread_mutex_lock(&w->mutex);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+    pthread_join(w->thread, NULL);
+
+    size_t i;
+    for (i = 0; i < w->nbufs; ++i) free(w->bufs[i].data);
+    free(w->bufs);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->mutex);
+    free(w);
+    l->writer = NULL;
+}
+#endif
+
+// Hands the write buffer out to be written (by the writer thread if any)
+static int write_flush(zcm_eventlog_t *l)
+{
+#ifdef USE_ASYNC_WRITES
+    if (l->writer) return writer_push(l, 0);
+#endif
+    if (l->wbuflen == 0) return 0;
+    const uint8_t *p = l->wbuf;
+    size_t len = l->wbuflen;
+    l->wbuflen = 0;
+    return write_chunks(l, &p, &len, 1);
+}
+
+// Same as write_flush(), but also waits for the writer thread to be done
+static int write_drain(zcm_eventlog_t *l)
+{
+#ifdef USE_ASYNC_WRITES
+    if (l->writer) return writer_drain(l);
+#endif
+    return write_flush(l);
+}
+
+// Writes the chunks through the write buffer: they're copied into it if they
+// fit, and written in one go (after what it holds) otherwise
+static int write_buffered(zcm_eventlog_t *l, const uint8_t **p, size_t *len, int n)
+{
+    size_t total = 0;
+    int i;
+    for (i = 0; i < n; ++i) total += len[i];
+
+    if (total > l->wbufcap - l->wbuflen) {
+        if (write_flush(l) != 0) return -1;
+#ifdef USE_ASYNC_WRITES
+        // The writer thread must see everything in order: grow the buffer
+        if (l->writer && total > l->wbufcap) {
+            uint8_t *wbuf = (uint8_t*) realloc(l->wbuf, total);
+            if (!wbuf) return -1;
+            l->wbuf = wbuf;
+            l->wbufcap = total;
+        }
+#endif
+        if (total > l->wbufcap) return write_chunks(l, p, len, n);
+    }
+    for (i = 0; i < n; ++i) {
+        memcpy(l->wbuf + l->wbuflen, p[i], len[i]);
+        l->wbuflen += len[i];
+    }
+    return 0;
+}
+
+int zcm_eventlog_set_write_buffer(zcm_eventlog_t *l, size_t bytes)
+{
+    if (l->mode == 'r' || l->writer || write_flush(l) != 0) return -1;
+    uint8_t *wbuf = NULL;
+    if (bytes > 0 && !(wbuf = (uint8_t*) malloc(bytes))) return -1;
+    free(l->wbuf);
+    l->wbuf = wbuf;
+    l->wbufcap = bytes;
+    return 0;
+}
+
+int zcm_eventlog_enable_async_writes(zcm_eventlog_t *l, size_t buffers)
+{
+#ifdef USE_ASYNC_WRITES
+    if (l->mode == 'r' || l->writer || l->wbufcap == 0 || buffers == 0) return -1;
+    if (write_flush(l) != 0) return -1;
+
+    zcm_eventlog_writer_t *w = (zcm_eventlog_writer_t*) calloc(1, sizeof(zcm_eventlog_writer_t));
+    w->bufs = (writer_buf_t*) calloc(buffers, sizeof(writer_buf_t));
+    w->nbufs = buffers;
+    size_t i;
+    for (i = 0; i < buffers; ++i) {
+        w->bufs[i].data = (uint8_t*) malloc(l->wbufcap);
+        w->bufs[i].cap = l->wbufcap;
+    }
+    pthread_mutex_init(&w->mutex, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    l->writer = w;
+    if (pthread_create(&w->thread, NULL, writer_thread, l) != 0) {
+        for (i = 0; i < buffers; ++i) free(w->bufs[i].data);
+        free(w->bufs);
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->mutex);
+        free(w);
+        l->writer = NULL;
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int zcm_eventlog_flush(zcm_eventlog_t *l, int sync)
+{
+    if (l->mode == 'r') return -1;
+#ifdef USE_ASYNC_WRITES
+    if (l->writer) return writer_push(l, sync);
+#endif
+    if (write_flush(l) != 0 || fflush(l->f) != 0) return -1;
+#ifdef USE_WRITEV
+    if (sync && fdatasync(fileno(l->f)) != 0) return -1;
+#endif
+    return 0;
+}
+
+static int block_flush(zcm_eventlog_t *l);
+static int set_open(zcm_eventlog_t *l, const char *path);
+static zcm_eventlog_channels_t *chans_create(void);
+static void chans_destroy(zcm_eventlog_channels_t *c);
+static int chans_open_append(zcm_eventlog_t *l, const char *path);
+#ifdef USE_REMOTE
+static int remote_open(zcm_eventlog_t *l, const char *path);
+static void remote_destroy(zcm_eventlog_t *l);
+#endif
+
 zcm_eventlog_t *zcm_eventlog_create(const char *path, const char *mode)
 {
     assert(!strcmp(mode, "r") || !strcmp(mode, "w") || !strcmp(mode, "a"));
@@ -19,6 +482,18 @@ zcm_eventlog_t *zcm_eventlog_create(const char *path, const char *mode)
 
     zcm_eventlog_t *l = (zcm_eventlog_t*) calloc(1, sizeof(zcm_eventlog_t));
 
+    if (!strncmp(path, REMOTE_PREFIX, strlen(REMOTE_PREFIX))) {
+#ifdef USE_REMOTE
+        l->mode = 'r';
+        l->format = FORMAT_EVENTS;
+        if (*mode == 'r' && remote_open(l, path) == 0) return l;
+        zcm_eventlog_destroy(l);
+#else
+        free(l);
+#endif
+        return NULL;
+    }
+
     l->f = fopen(path, mode);
     if (!l->f) {
         free (l);
@@ -26,209 +501,2212 @@ zcm_eventlog_t *zcm_eventlog_create(const char *path, const char *mode)
     }
 
     l->eventcount = 0;
+    l->mode = *mode;
+    l->format = *mode == 'w' ? FORMAT_EMPTY : peek_format(path);
+
+    l->idxpath = (char*) malloc(strlen(path) + sizeof(".tidx"));
+    strcpy(l->idxpath, path);
+    strcat(l->idxpath, ".tidx");
+
+    if (l->format == FORMAT_SET) {
+        if (*mode != 'r' || set_open(l, path) != 0) {
+            zcm_eventlog_destroy(l);
+            return NULL;
+        }
+        return l;
+    }
+
+    if (l->format == FORMAT_BLOCKS) {
+        l->blocks = blocks_create(BLOCK_DEFAULT_LEVEL, BLOCK_DEFAULT_BYTES);
+        // Has stdio cache the file offset, so that pos_tell() is a cheap ftello()
+        if (*mode == 'r') {
+            fseeko(l->f, 0, SEEK_SET);
+        } else {
+            fseeko(l->f, 0, SEEK_END);
+            l->writepos = ftello(l->f);
+        }
+    }
+
+#ifdef USE_MMAP
+    if (*mode == 'r' && !l->blocks) map_open(l);
+#endif
+    if (*mode == 'r' && !l->blocks) l->chans = chans_create();
+    if (*mode == 'a' && l->format == FORMAT_EVENTS && chans_open_append(l, path) != 0) {
+        zcm_eventlog_destroy(l);
+        return NULL;
+    }
+    if (*mode != 'r') zcm_eventlog_set_write_buffer(l, WRITE_BUFFER_DEFAULT_BYTES);
 
     return l;
 }
 
 void zcm_eventlog_destroy(zcm_eventlog_t *l)
 {
-    fflush(l->f);
-    fclose(l->f);
+    size_t i;
+    for (i = 0; i < l->nshards; ++i) {
+        if (l->shardnext[i]) zcm_eventlog_free_event(l->shardnext[i]);
+        zcm_eventlog_destroy(l->shards[i]);
+    }
+    free(l->shards);
+    free(l->shardnext);
+#ifdef USE_REMOTE
+    if (l->remote) remote_destroy(l);
+#endif
+#ifdef USE_MMAP
+    if (l->map) munmap(l->map, l->maplen);
+#endif
+    if (l->blocks) {
+        if (l->mode != 'r') block_flush(l);
+        free(l->blocks->starts);
+        free(l->blocks->raw);
+        free(l->blocks->stored);
+        free(l->blocks);
+    }
+    if (l->idx) fclose(l->idx);
+    free(l->index);
+    free(l->idxpath);
+    free(l->prevstarts);
+    free(l->prevbuf);
+    if (l->chans) chans_destroy(l->chans);
+#ifdef USE_ASYNC_WRITES
+    if (l->writer) writer_destroy(l);
+#endif
+    write_flush(l);
+    free(l->wbuf);
+    if (l->f) {
+        fflush(l->f);
+        fclose(l->f);
+    }
     free(l);
 }
 
-FILE *zcm_eventlog_get_fileptr(zcm_eventlog_t *l)
+// Moves the FILE of a mapped or compressed log to the read position
+static void pos_to_file(zcm_eventlog_t *l)
 {
-    return l->f;
+    if (l->pos != l->filepos) {
+        fseeko(l->f, l->pos, SEEK_SET);
+        l->filepos = l->pos;
+    }
 }
 
-// Returns 0 on success -1 on failure
-static int sync_stream(zcm_eventlog_t *l)
+// Moves the read position of a mapped or compressed log to its FILE's
+static void pos_from_file(zcm_eventlog_t *l)
 {
-    uint32_t magic = 0;
-    int r;
-    do {
-        r = fgetc(l->f);
-        if (r < 0) return -1;
-        magic = (magic << 8) | r;
-    } while( (int32_t)magic != MAGIC );
-    return 0;
+    l->pos = l->filepos = ftello(l->f);
 }
 
-static int sync_stream_backwards(zcm_eventlog_t *l)
+// Returns the read position of a mapped or compressed log, following any seek
+// done on its FILE
+static off_t pos_tell(zcm_eventlog_t *l)
 {
-    uint32_t magic = 0;
-    int r;
-    do {
-        if (ftello (l->f) < 2) return -1;
-        fseeko (l->f, -2, SEEK_CUR);
-        r = fgetc(l->f);
-        if (r < 0) return 1;
-        magic = ((magic >> 8) & 0x00ffffff) | (((uint32_t)r << 24) & 0xff000000);
-    } while( (int32_t)magic != MAGIC );
-    fseeko (l->f, sizeof(uint32_t) - 1, SEEK_CUR);
-    return 0;
+    off_t cur = ftello(l->f);
+    if (cur != l->filepos) l->pos = l->filepos = cur;
+    return l->pos;
 }
 
-static int64_t get_next_event_time(zcm_eventlog_t *l)
+static int32_t get32(const uint8_t *p)
 {
-    if (sync_stream(l)) return -1;
+    return (int32_t) ((uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+                      (uint32_t) p[2] << 8  | (uint32_t) p[3]);
+}
 
-    int64_t event_num;
-    int64_t timestamp;
-    if (0 != fread64(l->f, &event_num)) return -1;
-    if (0 != fread64(l->f, &timestamp)) return -1;
-    fseeko (l->f, -(sizeof(int64_t) * 2 + sizeof(int32_t)), SEEK_CUR);
+static int64_t get64(const uint8_t *p)
+{
+    return (int64_t) ((uint64_t) (uint32_t) get32(p) << 32 | (uint32_t) get32(p + 4));
+}
 
-    l->eventcount = event_num;
+/**** Channel ids ****/
 
-    return timestamp;
+// Logs with channel ids (see zcm_eventlog_enable_channel_ids()) have the name
+// of each channel written once, in a definition framed like an event (with
+// the eventnum and timestamp of the event it comes before) that has minus the
+// id of the channel as datalen, and no data. Events then have minus the id of
+// their channel as channellen, and no channel. Ids count up from 1 in the
+// order channels are first written
+struct _zcm_eventlog_channels_t
+{
+    // The channel of id i + 1 is names[i], of lens[i] bytes. NULL until its
+    // definition is read
+    char**   names;
+    int32_t* lens;
+    size_t   n;
+    size_t   cap;
+
+    // Ids by name, in an open addressed table of 'nslots' (a power of 2)
+    int32_t* slots;
+    size_t   nslots;
+
+    // Reading: definitions not read yet are looked for from 'scanned' on
+    off_t    scanned;
+#ifdef USE_PREAD
+    // Cursors look channels up from several threads
+    pthread_mutex_t lock;
+#endif
+};
+
+// Bytes of channel and data after an event header: those of an event, of an
+// event referring to its channel by id, or of a definition. -1 if the
+// lengths aren't any of these
+static int64_t body_len(int32_t channellen, int32_t datalen)
+{
+    if (channellen > 0 && channellen < 1000)
+        return datalen < 0 ? channellen : (int64_t) channellen + datalen;
+    if (channellen < 0 && datalen >= 0) return datalen;
+    return -1;
 }
 
-int zcm_eventlog_seek_to_timestamp(zcm_eventlog_t *l, int64_t timestamp)
+// Reports why body_len() fails, as reads always did
+static void report_lengths(int32_t channellen, int32_t datalen)
+{
+    if (channellen >= 0 && body_len(channellen, 0) < 0)
+        fprintf(stderr, "Log event has invalid channel length: %d\n", channellen);
+    else
+        fprintf(stderr, "Log event has invalid data length: %d\n", datalen);
+}
+
+static zcm_eventlog_channels_t *chans_create(void)
 {
-    fseeko (l->f, 0, SEEK_END);
-    off_t file_len = ftello(l->f);
+    zcm_eventlog_channels_t *c =
+        (zcm_eventlog_channels_t*) calloc(1, sizeof(zcm_eventlog_channels_t));
+#ifdef USE_PREAD
+    pthread_mutex_init(&c->lock, NULL);
+#endif
+    return c;
+}
 
-    int64_t cur_time;
-    double frac1 = 0;               // left bracket
-    double frac2 = 1;               // right bracket
-    double prev_frac = -1;
-    double frac;                    // current position
+static void chans_destroy(zcm_eventlog_channels_t *c)
+{
+    size_t i;
+    for (i = 0; i < c->n; ++i) free(c->names[i]);
+    free(c->names);
+    free(c->lens);
+    free(c->slots);
+#ifdef USE_PREAD
+    pthread_mutex_destroy(&c->lock);
+#endif
+    free(c);
+}
 
-    while (1) {
-        frac = 0.5*(frac1+frac2);
-        off_t offset = (off_t)(frac*file_len);
-        fseeko (l->f, offset, SEEK_SET);
-        cur_time = get_next_event_time (l);
-        if (cur_time < 0)
-            return -1;
+static void chans_lock(zcm_eventlog_channels_t *c)
+{
+#ifdef USE_PREAD
+    pthread_mutex_lock(&c->lock);
+#endif
+}
 
-        if ((frac > frac2) || (frac < frac1) || (frac1>=frac2))
-            break;
+static void chans_unlock(zcm_eventlog_channels_t *c)
+{
+#ifdef USE_PREAD
+    pthread_mutex_unlock(&c->lock);
+#endif
+}
 
-        double df = frac-prev_frac;
-        if (df < 0)
-            df = -df;
-        if (df < 1e-12)
-            break;
+static size_t chan_hash(const char *name, int32_t len)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    int32_t i;
+    for (i = 0; i < len; ++i) h = (h ^ (uint8_t) name[i]) * 16777619u;
+    return h;
+}
 
-        if (cur_time == timestamp)
-            break;
+static void chan_slot(zcm_eventlog_channels_t *c, int32_t id)
+{
+    size_t mask = c->nslots - 1;
+    size_t i = chan_hash(c->names[id - 1], c->lens[id - 1]) & mask;
+    while (c->slots[i]) i = (i + 1) & mask;
+    c->slots[i] = id;
+}
 
-        if (cur_time < timestamp)
-            frac1 = frac;
-        else
-            frac2 = frac;
+// Records that channel 'id' is 'name'. Ids defined already keep their name.
+// Returns 0 on success, -1 on failure
+static int chan_define(zcm_eventlog_channels_t *c, int32_t id, const char *name, int32_t len)
+{
+    if (id <= 0 || len <= 0 || len >= 1000) return -1;
+    if ((size_t) id > c->cap) {
+        size_t cap = c->cap ? c->cap : 64;
+        while (cap < (size_t) id) cap *= 2;
+        char **names = (char**) realloc(c->names, cap * sizeof(char*));
+        if (!names) return -1;
+        c->names = names;
+        int32_t *lens = (int32_t*) realloc(c->lens, cap * sizeof(int32_t));
+        if (!lens) return -1;
+        c->lens = lens;
+        memset(c->names + c->cap, 0, (cap - c->cap) * sizeof(char*));
+        c->cap = cap;
+    }
+    if (c->names[id - 1]) return 0;
 
-        prev_frac = frac;
+    // Kept at most half full
+    if (2 * (c->n + 1) > c->nslots) {
+        size_t nslots = c->nslots ? c->nslots * 2 : 128, i;
+        int32_t *slots = (int32_t*) calloc(nslots, sizeof(int32_t));
+        if (!slots) return -1;
+        free(c->slots);
+        c->slots = slots;
+        c->nslots = nslots;
+        for (i = 0; i < c->cap; ++i)
+            if (c->names[i]) chan_slot(c, i + 1);
     }
 
+    char *s = (char*) malloc(len + 1);
+    if (!s) return -1;
+    memcpy(s, name, len);
+    s[len] = '\0';
+    c->names[id - 1] = s;
+    c->lens[id - 1] = len;
+    if ((size_t) id > c->n) c->n = id;
+    chan_slot(c, id);
     return 0;
 }
 
-static zcm_eventlog_event_t *zcm_event_read_helper(zcm_eventlog_t *l, int rewindWhenDone)
+// Returns the id of channel 'name', 0 if it has none
+static int32_t chan_find(const zcm_eventlog_channels_t *c, const char *name, int32_t len)
 {
-    zcm_eventlog_event_t *le =
-        (zcm_eventlog_event_t*) calloc(1, sizeof(zcm_eventlog_event_t));
-
-    if (0 != fread64(l->f, &le->eventnum) ||
-        0 != fread64(l->f, &le->timestamp) ||
-        0 != fread32(l->f, &le->channellen) ||
-        0 != fread32(l->f, &le->datalen)) {
-        free(le);
-        return NULL;
+    if (c->nslots == 0) return 0;
+    size_t mask = c->nslots - 1;
+    size_t i = chan_hash(name, len) & mask;
+    for (; c->slots[i]; i = (i + 1) & mask) {
+        int32_t id = c->slots[i];
+        if (c->lens[id - 1] == len && memcmp(c->names[id - 1], name, len) == 0) return id;
     }
+    return 0;
+}
 
-    // Sanity check the channel length and data length
-    if (le->channellen <= 0 || le->channellen >= 1000) {
-        fprintf(stderr, "Log event has invalid channel length: %d\n", le->channellen);
-        free(le);
-        return NULL;
+// Returns how many of the 'len' bytes at 'pos' could be read into 'buf',
+// leaving the read position of the log (and of its cursors) as it is
+static size_t chan_read(zcm_eventlog_t *l, void *buf, size_t len, off_t pos)
+{
+#ifdef USE_MMAP
+    if (l->map && (size_t) pos + len <= l->maplen) {
+        memcpy(buf, l->map + pos, len);
+        return len;
     }
-    if (le->datalen < 0) {
-        fprintf(stderr, "Log event has invalid data length: %d\n", le->datalen);
-        free(le);
-        return NULL;
+#endif
+#ifdef USE_PREAD
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fileno(l->f), (uint8_t*) buf + done, len - done, pos + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
     }
+    return done;
+#else
+    off_t cur = ftello(l->f);
+    fseeko(l->f, pos, SEEK_SET);
+    size_t n = fread(buf, 1, len, l->f);
+    fseeko(l->f, cur, SEEK_SET);
+    return n;
+#endif
+}
 
-    le->channel = (char *) calloc(1, le->channellen+1);
-    if (fread(le->channel, 1, le->channellen, l->f) != (size_t) le->channellen) {
-        free(le->channel);
-        free(le);
-        return NULL;
+// Reads the definitions of the log from 'scanned' on, until that of 'id'.
+// Channels are defined before their first event, so this only goes as far as
+// that event, but it stops at the first corrupted event too: past it, ids are
+// only learnt by reading their definitions. Called with the lock held
+static void chan_scan(zcm_eventlog_t *l, int32_t id)
+{
+    zcm_eventlog_channels_t *c = l->chans;
+    uint8_t h[sizeof(int32_t) + HEADER_BYTES];
+    char name[1000];
+    while (chan_read(l, h, sizeof(h), c->scanned) == sizeof(h) && get32(h) == MAGIC) {
+        int32_t channellen = get32(h + 20), datalen = get32(h + 24);
+        int64_t body = body_len(channellen, datalen);
+        if (body < 0) return;
+        if (datalen < 0) {
+            if (chan_read(l, name, channellen, c->scanned + sizeof(h)) != (size_t) channellen)
+                return;
+            chan_define(c, -datalen, name, channellen);
+        }
+        c->scanned += sizeof(h) + body;
+        if (datalen == -id) return;
     }
+}
 
-    le->data = calloc(1, le->datalen+1);
-    if (fread(le->data, 1, le->datalen, l->f) != (size_t) le->datalen) {
-        free(le->channel);
-        free(le->data);
-        free(le);
-        return NULL;
+// Returns the name of channel 'id' (its length in '*len'), looking for its
+// definition in the log if it wasn't read yet. NULL if there is none
+// NOTE: Only changes the channels of 'l', under their lock
+static const char *chan_name(const zcm_eventlog_t *l, int32_t id, int32_t *len)
+{
+    zcm_eventlog_channels_t *c = l->chans;
+    const char *name = NULL;
+    if (!c || id <= 0) return NULL;
+    chans_lock(c);
+    if ((size_t) id > c->n || !c->names[id - 1]) chan_scan((zcm_eventlog_t*) l, id);
+    if ((size_t) id <= c->n && c->names[id - 1]) {
+        name = c->names[id - 1];
+        *len = c->lens[id - 1];
     }
+    chans_unlock(c);
+    return name;
+}
 
-    // Check that there's a valid event or the EOF after this event.
-    int32_t next_magic;
-    if (0 == fread32(l->f, &next_magic)) {
-        if (next_magic != MAGIC) {
-            fprintf(stderr, "Invalid header after log data\n");
-            free(le->channel);
-            free(le->data);
-            free(le);
-            return NULL;
-        }
-        fseeko (l->f, -4, SEEK_CUR);
+// Definitions are read like events, only to learn their id. Returns 1 (and
+// frees 'le') if it is one
+static int chan_skip(const zcm_eventlog_t *l, zcm_eventlog_event_t *le)
+{
+    if (le->datalen >= 0) return 0;
+    if (l->chans) {
+        chans_lock(l->chans);
+        chan_define(l->chans, -le->datalen, le->channel, le->channellen);
+        chans_unlock(l->chans);
     }
-    if (rewindWhenDone) {
-        fseeko (l->f, -(sizeof(int64_t) * 2 + sizeof(int32_t) * 3 +
-                        le->datalen + le->channellen), SEEK_CUR);
+    zcm_eventlog_free_event(le);
+    return 1;
+}
+
+// For logs opened in "a" mode: reads the log through for its channel ids, if
+// it has them. Returns 0 on success, -1 on failure
+static int chans_open_append(zcm_eventlog_t *l, const char *path)
+{
+    zcm_eventlog_t *r = zcm_eventlog_create(path, "r");
+    if (!r) return -1;
+
+    // The first event of a log with channel ids is a definition
+    uint8_t h[sizeof(int32_t) + HEADER_BYTES];
+    if (chan_read(r, h, sizeof(h), 0) != sizeof(h) || get32(h + 24) >= 0) {
+        zcm_eventlog_destroy(r);
+        return 0;
     }
-    return le;
+
+    // Past events that fail to read too
+    off_t last = -1, at;
+    zcm_eventlog_event_t *le;
+    while ((le = zcm_eventlog_read_next_event(r)) || (at = pos_tell(r)) > last) {
+        if (le) zcm_eventlog_free_event(le);
+        else last = at;
+    }
+    l->chans = r->chans;
+    r->chans = NULL;
+    zcm_eventlog_destroy(r);
+    return 0;
 }
 
-zcm_eventlog_event_t *zcm_eventlog_read_next_event(zcm_eventlog_t *l)
+FILE *zcm_eventlog_get_fileptr(zcm_eventlog_t *l)
 {
-    if (sync_stream(l)) return NULL;
-    return zcm_event_read_helper(l, 0);
+    if (l->blocks && l->mode == 'r') pos_to_file(l);
+    if (l->mode != 'r') {
+        // stdio may hold an offset from before the writes it didn't see
+        write_drain(l);
+        fseeko(l->f, 0, SEEK_END);
+    }
+#ifdef USE_MMAP
+    if (l->map) pos_to_file(l);
+#endif
+    return l->f;
 }
 
-zcm_eventlog_event_t *zcm_eventlog_read_prev_event(zcm_eventlog_t *l)
+// Returns 0 on success -1 on failure
+// Scanning the log for magics, forwards or backwards, reads it in chunks of
+// this many bytes
+#define PREV_SCAN_BYTES (64 << 10)
+
+// Returns the offset of the first 'magic' at or after 'offset', -1 if there is
+// none before the EOF, where the FILE is then left (but for the bytes that may
+// start a magic written after them). The chunks read are searched with memchr()
+static off_t scan_magic(zcm_eventlog_t *l, off_t offset, int32_t magic)
 {
-    if (sync_stream_backwards(l) < 0) return NULL;
-    return zcm_event_read_helper(l, 1);
+    if (!l->prevbuf) l->prevbuf = (uint8_t*) malloc(PREV_SCAN_BYTES + sizeof(int32_t) - 1);
+    if (fseeko(l->f, offset, SEEK_SET) != 0) return -1;
+
+    uint8_t *buf = l->prevbuf;
+    size_t have = 0;
+    while (1) {
+        size_t n = have + fread(buf + have, 1, PREV_SCAN_BYTES, l->f);
+        const uint8_t *p = buf, *end = buf + n;
+        while (end - p >= 4) {
+            p = (const uint8_t*) memchr(p, ((uint32_t) magic >> 24) & 0xff, end - p - 3);
+            if (!p) break;
+            if (get32(p) == magic) return offset + (p - buf);
+            ++p;
+        }
+        // The last 3 bytes may be the start of a magic
+        size_t keep = n < sizeof(int32_t) - 1 ? n : sizeof(int32_t) - 1;
+        if (n == have) {
+            fseeko(l->f, offset + n - keep, SEEK_SET);
+            return -1;
+        }
+        memmove(buf, end - keep, keep);
+        offset += n - keep;
+        have = keep;
+    }
 }
 
-zcm_eventlog_event_t *zcm_eventlog_read_event_at_offset(zcm_eventlog_t *l, off_t offset)
+// Whether the magic at 'pos' starts what looks like an event: a sane header,
+// with the magic of the next event (or exactly the EOF) after it
+static int sync_check(zcm_eventlog_t *l, off_t pos)
 {
-    fseeko(l->f, offset, SEEK_SET);
-    if (sync_stream(l)) return NULL;
-    return zcm_event_read_helper(l, 0);
+    uint8_t h[HEADER_BYTES];
+    fseeko(l->f, pos + sizeof(int32_t), SEEK_SET);
+    // An event cut short is left for the read to fail on
+    if (fread(h, 1, sizeof(h), l->f) != sizeof(h)) return 1;
+
+    int64_t body = body_len(get32(h + 16), get32(h + 20));
+    if (body < 0) return 0;
+
+    int32_t next;
+    fseeko(l->f, (off_t) body, SEEK_CUR);
+    off_t end = ftello(l->f);
+    if (fread32(l->f, &next) == 0) return next == MAGIC;
+    fseeko(l->f, 0, SEEK_END);
+    return ftello(l->f) == end;
 }
 
-void zcm_eventlog_free_event(zcm_eventlog_event_t *le)
+// Positions the FILE past the magic of the next event. Between events it's
+// right there; otherwise (in a corrupted log, or after a seek into the middle
+// of an event) the log is scanned for it, skipping the magics whose event
+// doesn't check out. With 'seeking', the FILE is at an arbitrary offset and a
+// magic right there is checked too
+static int sync_stream(zcm_eventlog_t *l, int seeking)
 {
-    if (le->data) free(le->data);
-    if (le->channel) free(le->channel);
-    memset(le,0,sizeof(zcm_eventlog_event_t));
-    free(le);
+    off_t pos = ftello(l->f);
+    int32_t magic;
+    if (0 != fread32(l->f, &magic)) return -1;
+    if (magic == MAGIC) {
+        if (!seeking || sync_check(l, pos)) {
+            if (seeking) fseeko(l->f, pos + sizeof(int32_t), SEEK_SET);
+            return 0;
+        }
+    }
+
+    while ((pos = scan_magic(l, pos + 1, MAGIC)) >= 0) {
+        if (sync_check(l, pos)) {
+            fseeko(l->f, pos + sizeof(int32_t), SEEK_SET);
+            return 0;
+        }
+    }
+    return -1;
 }
 
-int zcm_eventlog_write_event(zcm_eventlog_t *l, const zcm_eventlog_event_t *le)
+// Bisections of the log stop once they are down to this many bytes, which
+// are scanned
+#define SEEK_SCAN_BYTES (64 << 10)
+
+// Positions the log at the first event logged at or after 'timestamp' (or at
+// its last event), scanning from 'offset'. With 'e', the first event must be
+// the one of that index entry, right at 'offset'. Returns -1 if there is no
+// event to scan (or the index doesn't match the log)
+static int scan_to_timestamp(zcm_eventlog_t *l, off_t offset, int64_t timestamp,
+                             const zcm_eventlog_index_entry_t *e)
 {
-    if (0 != fwrite32(l->f, MAGIC)) return -1;
+    off_t last = -1;
+    int64_t lastnum = 0;
+    fseeko(l->f, offset, SEEK_SET);
+    while (1) {
+        // Only an index entry says an event starts right there
+        if (sync_stream(l, last < 0 && !e)) break;
+        off_t start = ftello(l->f) - sizeof(int32_t);
 
-    if (0 != fwrite64(l->f, l->eventcount)) return -1;
+        int64_t event_num, event_time;
+        int32_t channellen, datalen;
+        if (0 != fread64(l->f, &event_num) ||
+            0 != fread64(l->f, &event_time) ||
+            0 != fread32(l->f, &channellen) ||
+            0 != fread32(l->f, &datalen)) break;
 
-    if (0 != fwrite64(l->f, le->timestamp)) return -1;
-    if (0 != fwrite32(l->f, le->channellen)) return -1;
-    if (0 != fwrite32(l->f, le->datalen)) return -1;
+        if (last < 0 && e && (start != e->offset || event_num != e->eventnum ||
+                              event_time != e->timestamp)) return -1;
 
-    if (le->channellen != fwrite(le->channel, 1, le->channellen, l->f))
-        return -1;
-    if (le->datalen != fwrite(le->data, 1, le->datalen, l->f))
-        return -1;
+        if (event_time >= timestamp) {
+            fseeko(l->f, start, SEEK_SET);
+            l->eventcount = event_num;
+            return 0;
+        }
+        last = start;
+        lastnum = event_num;
+
+        int64_t body = body_len(channellen, datalen);
+        if (body < 0) break;
+        fseeko(l->f, (off_t) body, SEEK_CUR);
+    }
+
+    if (last < 0) return -1;
+    fseeko(l->f, last, SEEK_SET);
+    l->eventcount = lastnum;
+    return 0;
+}
+
+// Returns the timestamp of the first event at or after the FILE's position,
+// -1 if there is none
+static int64_t get_next_event_time(zcm_eventlog_t *l)
+{
+    if (sync_stream(l, 1)) return -1;
+
+    int64_t event_num;
+    int64_t timestamp;
+    if (0 != fread64(l->f, &event_num)) return -1;
+    if (0 != fread64(l->f, &timestamp)) return -1;
+    return timestamp;
+}
+
+// Bisects the log down to where the first event logged at or after
+// 'timestamp' (or its last event) is, then scans for it
+static int seek_to_timestamp(zcm_eventlog_t *l, int64_t timestamp)
+{
+    fseeko(l->f, 0, SEEK_END);
+    off_t lo = 0, hi = ftello(l->f);
+
+    // An event before 'timestamp' starts at or after 'lo'
+    while (hi - lo > SEEK_SCAN_BYTES) {
+        off_t mid = lo + (hi - lo) / 2;
+        fseeko(l->f, mid, SEEK_SET);
+        int64_t cur_time = get_next_event_time(l);
+        if (cur_time >= 0 && cur_time < timestamp) lo = mid;
+        else hi = mid;
+    }
+    return scan_to_timestamp(l, lo, timestamp, NULL);
+}
+
+static void load_index(zcm_eventlog_t *l)
+{
+    l->indexloaded = 1;
+
+    FILE *f = fopen(l->idxpath, "rb");
+    if (!f) return;
+
+    int32_t magic;
+    if (0 != fread32(f, &magic) || magic != INDEX_MAGIC) {
+        fclose(f);
+        return;
+    }
+
+    fseeko(f, 0, SEEK_END);
+    size_t n = (ftello(f) - sizeof(int32_t)) / INDEX_ENTRY_BYTES;
+    fseeko(f, sizeof(int32_t), SEEK_SET);
+
+    l->index = (zcm_eventlog_index_entry_t*) malloc(n * sizeof(zcm_eventlog_index_entry_t) + 1);
+    for (l->indexlen = 0; l->indexlen < n; ++l->indexlen) {
+        zcm_eventlog_index_entry_t *e = &l->index[l->indexlen];
+        if (0 != fread64(f, &e->timestamp) ||
+            0 != fread64(f, &e->eventnum) ||
+            0 != fread64(f, &e->offset)) break;
+    }
+    fclose(f);
+}
+
+// Returns the last index entry before 'timestamp', NULL if the index is
+// missing or doesn't cover it
+static const zcm_eventlog_index_entry_t *index_find(zcm_eventlog_t *l, int64_t timestamp)
+{
+    if (!l->indexloaded) load_index(l);
+    if (l->indexlen == 0) return NULL;
+
+    size_t lo = 0, hi = l->indexlen;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (l->index[mid].timestamp < timestamp) lo = mid;
+        else hi = mid;
+    }
+    const zcm_eventlog_index_entry_t *e = &l->index[lo];
+
+    // The index of a log appended to may only cover its end
+    if (e->timestamp >= timestamp && e->offset > 0) return NULL;
+    return e;
+}
+
+// Positions the log at the first event logged at or after 'timestamp' (or at
+// its last event), scanning from the last index entry before it. Returns -1
+// if the index is missing or doesn't match the log
+static int index_seek(zcm_eventlog_t *l, int64_t timestamp)
+{
+    const zcm_eventlog_index_entry_t *e = index_find(l, timestamp);
+    if (!e) return -1;
+    return scan_to_timestamp(l, e->offset, timestamp, e);
+}
+
+/**** Reading backwards ****/
+
+// Returns the 'len' bytes at 'pos', from the mapping when they're in it,
+// read into 'buf' otherwise. Returns NULL past the EOF
+static const uint8_t *prev_read(zcm_eventlog_t *l, uint8_t *buf, size_t len, off_t pos)
+{
+#ifdef USE_MMAP
+    if (l->map && (size_t) pos + len <= l->maplen) return l->map + pos;
+#endif
+    fseeko(l->f, pos, SEEK_SET);
+    size_t n = fread(buf, 1, len, l->f);
+#ifdef USE_MMAP
+    // Leaves the FILE where the read position of the mapping has it
+    if (l->map) fseeko(l->f, l->filepos, SEEK_SET);
+#endif
+    return n == len ? buf : NULL;
+}
+
+static int prev_push(zcm_eventlog_t *l, off_t start)
+{
+    if (l->nprev == l->prevcap) {
+        size_t cap = l->prevcap ? l->prevcap * 2 : 256;
+        off_t *p = (off_t*) realloc(l->prevstarts, cap * sizeof(off_t));
+        if (!p) return -1;
+        l->prevstarts = p;
+        l->prevcap = cap;
+    }
+    l->prevstarts[l->nprev++] = start;
+    return 0;
+}
+
+// Fills 'prevstarts' with every event from the last index entry at or before
+// 'q' to the first event after it, so that they're exactly where the events
+// start. Returns -1 if the index doesn't cover 'q' or doesn't match the log
+static int prev_fill_from_index(zcm_eventlog_t *l, off_t q)
+{
+    if (!l->indexloaded) load_index(l);
+    if (l->indexlen == 0 || l->index[0].offset > q) return -1;
+
+    size_t lo = 0, hi = l->indexlen;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (l->index[mid].offset <= q) lo = mid;
+        else hi = mid;
+    }
+    const zcm_eventlog_index_entry_t *e = &l->index[lo];
+
+    uint8_t buf[sizeof(int32_t) + HEADER_BYTES];
+    const uint8_t *h = prev_read(l, buf, sizeof(buf), e->offset);
+    if (!h || get32(h) != MAGIC || get64(h + 4) != e->eventnum || get64(h + 12) != e->timestamp)
+        return -1;
+
+    l->nprev = 0;
+    off_t start = e->offset;
+    while (1) {
+        if (prev_push(l, start) != 0) return -1;
+        int64_t body = body_len(get32(h + 20), get32(h + 24));
+        if (body < 0) return -1;
+
+        off_t next = start + sizeof(buf) + body;
+        if (next > q) {
+            l->prevlo = e->offset;
+            l->prevhi = next - 1;
+            return 0;
+        }
+        // Any event the walk can't get to has to be looked for in the bytes
+        h = prev_read(l, buf, sizeof(buf), next);
+        if (!h || get32(h) != MAGIC) {
+            l->nprev = 0;
+            return -1;
+        }
+        start = next;
+    }
+}
+
+// Fills 'prevstarts' with every magic found in the chunk of the log ending at
+// 'q', going further back until there is one. Returns -1 if there is none
+static int prev_fill_from_scan(zcm_eventlog_t *l, off_t q)
+{
+    if (!l->prevbuf) l->prevbuf = (uint8_t*) malloc(PREV_SCAN_BYTES + sizeof(int32_t) - 1);
+
+    l->nprev = 0;
+    while (q >= 0) {
+        off_t lo = q >= PREV_SCAN_BYTES ? q - PREV_SCAN_BYTES + 1 : 0;
+        size_t len = q - lo + sizeof(int32_t);
+        const uint8_t *p = prev_read(l, l->prevbuf, len, lo);
+        if (!p) return -1;
+
+        size_t i;
+        for (i = 0; i + sizeof(int32_t) <= len; ++i) {
+            const uint8_t *m = (const uint8_t*) memchr(p + i, (MAGIC >> 24) & 0xff,
+                                                       len - sizeof(int32_t) + 1 - i);
+            if (!m) break;
+            i = m - p;
+            if (get32(m) == MAGIC && prev_push(l, lo + i) != 0) return -1;
+        }
+        if (l->nprev > 0) {
+            l->prevlo = lo;
+            l->prevhi = q;
+            return 0;
+        }
+        q = lo - 1;
+    }
+    return -1;
+}
+
+// Returns the offset past the last magic ending before 'pos' - 1 (where the
+// event before the one at 'pos' starts), -1 if there is none. When the time
+// index covers it, only event boundaries are considered; otherwise any magic
+// is, as the log is scanned backwards. Either way the chunk found is kept in
+// 'prevstarts', so that stepping back through it costs as much as forwards
+static off_t prev_event(zcm_eventlog_t *l, off_t pos)
+{
+    off_t q = pos - (off_t) sizeof(int32_t) - 1;
+    if (q < 0) return -1;
+
+    if (l->nprev == 0 || q < l->prevlo || q > l->prevhi || l->prevstarts[0] > q) {
+        if (prev_fill_from_index(l, q) != 0 && prev_fill_from_scan(l, q) != 0) {
+            l->nprev = 0;
+            return -1;
+        }
+    }
+
+    // The last start at or before 'q'
+    size_t lo = 0, hi = l->nprev;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (l->prevstarts[mid] <= q) lo = mid;
+        else hi = mid;
+    }
+    return l->prevstarts[lo] + sizeof(int32_t);
+}
+
+static int sync_stream_backwards(zcm_eventlog_t *l)
+{
+    off_t pos = prev_event(l, ftello(l->f));
+    if (pos < 0) return -1;
+    fseeko(l->f, pos, SEEK_SET);
+    return 0;
+}
+
+/**** Compressed logs: reading ****/
+
+static int reserve(uint8_t **buf, size_t *cap, size_t n)
+{
+    if (n <= *cap) return 0;
+    size_t c = *cap ? *cap : 4096;
+    while (c < n) c *= 2;
+    uint8_t *p = (uint8_t*) realloc(*buf, c);
+    if (!p) return -1;
+    *buf = p;
+    *cap = c;
+    return 0;
+}
+
+static int parse_block_header(const uint8_t *p, block_header_t *h)
+{
+    if (get32(p) != BLOCK_MAGIC) return -1;
+    h->codec     = get32(p + 4);
+    h->nevents   = get32(p + 8);
+    h->rawlen    = get32(p + 12);
+    h->storedlen = get32(p + 16);
+    h->blocklen  = get32(p + 20);
+    h->eventnum  = get64(p + 24);
+    h->first     = get64(p + 32);
+    h->last      = get64(p + 40);
+
+    if (h->codec != CODEC_STORED && h->codec != CODEC_ZLIB) return -1;
+    if (h->nevents <= 0 || h->rawlen <= 0 || h->rawlen > BLOCK_MAX_RAW) return -1;
+    if (h->storedlen <= 0 || h->storedlen > h->rawlen) return -1;
+    if (h->codec == CODEC_STORED && h->storedlen != h->rawlen) return -1;
+    if ((size_t) h->blocklen < BLOCK_HEADER_BYTES + h->storedlen ||
+        h->blocklen <= h->nevents) return -1;
+    return 0;
+}
+
+// Reads the header of the block at 'offset'. Returns -1 if there is none
+static int block_read_header(zcm_eventlog_t *l, off_t offset, block_header_t *h)
+{
+    uint8_t p[BLOCK_HEADER_BYTES];
+    if (offset < 0 || fseeko(l->f, offset, SEEK_SET) != 0) return -1;
+    if (fread(p, 1, sizeof(p), l->f) != sizeof(p)) return -1;
+    return parse_block_header(p, h);
+}
+
+// Returns the offset of the first block at or after 'offset', -1 if none
+static off_t block_sync(zcm_eventlog_t *l, off_t offset)
+{
+    off_t pos = offset - 1;
+    while ((pos = scan_magic(l, pos + 1, BLOCK_MAGIC)) >= 0) {
+        block_header_t h;
+        if (block_read_header(l, pos, &h) == 0) return pos;
+    }
+    return -1;
+}
+
+// Returns the offset of the last block starting before 'offset', -1 if none
+static off_t block_sync_backwards(zcm_eventlog_t *l, off_t offset)
+{
+    uint8_t buf[4096 + 3];
+    off_t hi = offset;
+    while (hi > 0) {
+        off_t lo = hi > 4096 ? hi - 4096 : 0;
+        if (fseeko(l->f, lo, SEEK_SET) != 0) return -1;
+        size_t n = fread(buf, 1, hi - lo + 3, l->f);
+        size_t i;
+        for (i = hi - lo; i-- > 0;) {
+            if (i + 4 > n || get32(buf + i) != BLOCK_MAGIC) continue;
+            block_header_t h;
+            if (block_read_header(l, lo + i, &h) == 0) return lo + i;
+        }
+        hi = lo;
+    }
+    return -1;
+}
+
+// Loads the block at 'offset' and finds its events. Returns -1 if it's corrupt
+static int block_load(zcm_eventlog_t *l, off_t offset)
+{
+    zcm_eventlog_blocks_t *b = l->blocks;
+    block_header_t h;
+    b->offset = -1;
+    if (block_read_header(l, offset, &h) != 0) return -1;
+
+    if (reserve(&b->raw, &b->rawcap, h.rawlen) != 0) return -1;
+    if (h.codec == CODEC_STORED) {
+        if (fread(b->raw, 1, h.rawlen, l->f) != (size_t) h.rawlen) return -1;
+    } else {
+#ifdef USING_ZLIB
+        if (reserve(&b->stored, &b->storedcap, h.storedlen) != 0) return -1;
+        if (fread(b->stored, 1, h.storedlen, l->f) != (size_t) h.storedlen) return -1;
+        uLongf rawlen = h.rawlen;
+        if (uncompress(b->raw, &rawlen, b->stored, h.storedlen) != Z_OK ||
+            rawlen != (uLongf) h.rawlen) return -1;
+#else
+        static int warned = 0;
+        if (!warned++) fprintf(stderr, "Log is compressed, but zcm was built without zlib\n");
+        return -1;
+#endif
+    }
+
+    if ((size_t) h.nevents > b->startscap) {
+        size_t *starts = (size_t*) realloc(b->starts, h.nevents * sizeof(size_t));
+        if (!starts) return -1;
+        b->starts = starts;
+        b->startscap = h.nevents;
+    }
+
+    size_t pos = 0;
+    int32_t i;
+    for (i = 0; i < h.nevents; ++i) {
+        if (h.rawlen - pos < sizeof(int32_t) + HEADER_BYTES) return -1;
+        if (get32(b->raw + pos) != MAGIC) return -1;
+        size_t left = h.rawlen - pos - sizeof(int32_t) - HEADER_BYTES;
+        int32_t channellen = get32(b->raw + pos + sizeof(int32_t) + 16);
+        int32_t datalen    = get32(b->raw + pos + sizeof(int32_t) + 20);
+        if (channellen <= 0 || channellen >= 1000 || (size_t) channellen > left) return -1;
+        if (datalen < 0 || (size_t) datalen > left - channellen) return -1;
+        b->starts[i] = pos;
+        pos += sizeof(int32_t) + HEADER_BYTES + channellen + datalen;
+    }
+    if (pos != (size_t) h.rawlen) return -1;
+
+    b->offset = offset;
+    b->end = offset + h.blocklen;
+    b->nevents = h.nevents;
+    return 0;
+}
+
+// Returns the block holding 'offset', or else the first one after it
+static off_t block_find(zcm_eventlog_t *l, off_t offset)
+{
+    block_header_t h;
+    if (block_read_header(l, offset, &h) == 0) return offset;
+    off_t prev = block_sync_backwards(l, offset);
+    if (prev >= 0 && block_read_header(l, prev, &h) == 0 && prev + h.blocklen > offset)
+        return prev;
+    return block_sync(l, offset);
+}
+
+// Loads the block of the event at 'offset' (or of the first event after it)
+// and returns its index in the block, -1 if there's none
+static int32_t block_locate(zcm_eventlog_t *l, off_t offset)
+{
+    zcm_eventlog_blocks_t *b = l->blocks;
+    while (1) {
+        if (b->offset < 0 || offset < b->offset || offset >= b->end) {
+            off_t found = block_find(l, offset);
+            while (found >= 0 && block_load(l, found) != 0)
+                found = block_sync(l, found + 1);
+            if (found < 0) return -1;
+            if (offset < found) offset = found;
+        }
+        if (offset - b->offset < b->nevents) return offset - b->offset;
+        offset = b->end;
+    }
+}
+
+// Returns the event 'i' of the loaded block, with its channel and data in
+// the same allocation, and makes the read position follow it
+static zcm_eventlog_event_t *block_event(zcm_eventlog_t *l, int32_t i)
+{
+    zcm_eventlog_blocks_t *b = l->blocks;
+    const uint8_t *p = b->raw + b->starts[i] + sizeof(int32_t);
+    int32_t channellen = get32(p + 16);
+    int32_t datalen    = get32(p + 20);
+
+    zcm_eventlog_event_t *le = (zcm_eventlog_event_t*)
+        malloc(sizeof(zcm_eventlog_event_t) + channellen + 1 + datalen);
+    le->eventnum   = get64(p);
+    le->timestamp  = get64(p + 8);
+    le->channellen = channellen;
+    le->datalen    = datalen;
+    le->channel    = (char*) (le + 1);
+    memcpy(le->channel, p + HEADER_BYTES, channellen);
+    le->channel[channellen] = '\0';
+    le->data       = (uint8_t*) le->channel + channellen + 1;
+    memcpy(le->data, p + HEADER_BYTES + channellen, datalen);
+    le->channelid  = 0;
+
+    l->pos = i + 1 < b->nevents ? b->offset + i + 1 : b->end;
+    return le;
+}
+
+static zcm_eventlog_event_t *block_read_next_event(zcm_eventlog_t *l)
+{
+    zcm_eventlog_event_t *le = NULL;
+    int32_t i = block_locate(l, pos_tell(l));
+    if (i >= 0) le = block_event(l, i);
+    else pos_from_file(l);
+    l->filepos = ftello(l->f);
+    return le;
+}
+
+static zcm_eventlog_event_t *block_read_prev_event(zcm_eventlog_t *l)
+{
+    zcm_eventlog_blocks_t *b = l->blocks;
+    zcm_eventlog_event_t *le = NULL;
+    off_t pos = pos_tell(l);
+
+    if (b->offset < 0 || pos <= b->offset || pos > b->end) {
+        off_t found = block_sync_backwards(l, pos);
+        while (found >= 0 && block_load(l, found) != 0)
+            found = block_sync_backwards(l, found);
+        if (found < 0) b->offset = -1;
+    }
+
+    if (b->offset >= 0) {
+        int32_t i = (pos - b->offset < b->nevents ? pos - b->offset : b->nevents) - 1;
+        le = block_event(l, i);
+        l->pos = b->offset + i;
+    } else {
+        l->pos = 0;
+    }
+    l->filepos = ftello(l->f);
+    return le;
+}
+
+static zcm_eventlog_event_t *block_read_event_at_offset(zcm_eventlog_t *l, off_t offset)
+{
+    pos_tell(l);
+    l->pos = offset;
+    return block_read_next_event(l);
+}
+
+// Returns the offset of the last block starting before 'timestamp',
+// bisecting the log if it has no usable index
+static off_t block_seek_start(zcm_eventlog_t *l, int64_t timestamp)
+{
+    block_header_t h;
+    const zcm_eventlog_index_entry_t *e = index_find(l, timestamp);
+    if (e && block_read_header(l, e->offset, &h) == 0 &&
+        h.eventnum == e->eventnum && h.first == e->timestamp)
+        return e->offset;
+
+    fseeko(l->f, 0, SEEK_END);
+    off_t hi = ftello(l->f);
+    off_t best = block_sync(l, 0);
+    if (best < 0) return -1;
+
+    off_t lo = best + 1;
+    while (lo < hi) {
+        off_t mid = lo + (hi - lo) / 2;
+        off_t found = block_sync(l, mid);
+        if (found < 0 || found >= hi || block_read_header(l, found, &h) != 0) {
+            hi = mid;
+            continue;
+        }
+        if (h.first < timestamp) {
+            best = found;
+            lo = found + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return best;
+}
+
+// Positions the log at the first event logged at or after 'timestamp' (or at
+// its last event). Fails, leaving the log at its end, if it has no events
+static int block_seek(zcm_eventlog_t *l, int64_t timestamp)
+{
+    zcm_eventlog_blocks_t *b = l->blocks;
+    block_header_t h;
+    off_t offset = block_seek_start(l, timestamp), last = -1;
+
+    while (offset >= 0 && block_read_header(l, offset, &h) == 0) {
+        if (h.last >= timestamp && block_load(l, offset) == 0) {
+            int32_t i = 0;
+            while (i < b->nevents - 1 &&
+                   get64(b->raw + b->starts[i] + sizeof(int32_t) + 8) < timestamp) ++i;
+            l->pos = offset + i;
+            l->filepos = ftello(l->f);
+            return 0;
+        }
+        last = offset;
+        offset = block_sync(l, offset + h.blocklen);
+    }
+
+    if (last >= 0 && block_load(l, last) == 0) {
+        l->pos = last + b->nevents - 1;
+        l->filepos = ftello(l->f);
+        return 0;
+    }
+    fseeko(l->f, 0, SEEK_END);
+    l->pos = l->filepos = ftello(l->f);
+    return -1;
+}
+
+/**** Sets of logs ****/
+
+static int set_open(zcm_eventlog_t *l, const char *path)
+{
+    char line[SET_MAX_PATH];
+    char sub[2 * SET_MAX_PATH];
+    const char *slash = strrchr(path, '/');
+    int dirlen = slash ? slash - path + 1 : 0;
+
+    fseeko(l->f, 0, SEEK_SET);
+    if (!fgets(line, sizeof(line), l->f) || strcmp(line, SET_HEADER) != 0) return -1;
+
+    while (fgets(line, sizeof(line), l->f)) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        if (len == 0) continue;
+
+        if (line[0] == '/') snprintf(sub, sizeof(sub), "%s", line);
+        else                snprintf(sub, sizeof(sub), "%.*s%s", dirlen, path, line);
+
+        zcm_eventlog_t *s = zcm_eventlog_create(sub, "r");
+        if (!s) return -1;
+
+        zcm_eventlog_t **shards = (zcm_eventlog_t**)
+            realloc(l->shards, (l->nshards + 1) * sizeof(zcm_eventlog_t*));
+        if (!shards || s->shards) {
+            if (shards) l->shards = shards;
+            zcm_eventlog_destroy(s);
+            return -1;
+        }
+        l->shards = shards;
+        l->shards[l->nshards++] = s;
+    }
+    if (l->nshards == 0) return -1;
+
+    l->shardnext = (zcm_eventlog_event_t**) calloc(l->nshards, sizeof(zcm_eventlog_event_t*));
+    return 0;
+}
+
+// Returns the earliest next event of the logs, keeping the next event of each
+// of the others in 'shardnext'. Ties go to the first log of the set
+static zcm_eventlog_event_t *set_read_next_event(zcm_eventlog_t *l)
+{
+    size_t i;
+    int best = -1;
+    for (i = 0; i < l->nshards; ++i) {
+        if (!l->shardnext[i]) l->shardnext[i] = zcm_eventlog_read_next_event(l->shards[i]);
+        if (l->shardnext[i] &&
+            (best < 0 || l->shardnext[i]->timestamp < l->shardnext[best]->timestamp))
+            best = i;
+    }
+    if (best < 0) return NULL;
+
+    zcm_eventlog_event_t *le = l->shardnext[best];
+    l->shardnext[best] = NULL;
+    return le;
+}
+
+// Puts the events kept in 'shardnext' back, so that the position of every
+// log is that of the set
+static void set_unread(zcm_eventlog_t *l)
+{
+    size_t i;
+    for (i = 0; i < l->nshards; ++i) {
+        if (!l->shardnext[i]) continue;
+        zcm_eventlog_free_event(l->shardnext[i]);
+        l->shardnext[i] = NULL;
+        zcm_eventlog_event_t *le = zcm_eventlog_read_prev_event(l->shards[i]);
+        if (le) zcm_eventlog_free_event(le);
+    }
+}
+
+// Returns the latest previous event of the logs, moving the others back to
+// where they were. Ties go to the last log of the set
+static zcm_eventlog_event_t *set_read_prev_event(zcm_eventlog_t *l)
+{
+    size_t i;
+    int best = -1;
+    zcm_eventlog_event_t *bestle = NULL;
+    set_unread(l);
+
+    for (i = 0; i < l->nshards; ++i) {
+        zcm_eventlog_event_t *le = zcm_eventlog_read_prev_event(l->shards[i]);
+        if (!le) continue;
+
+        int undo = i;
+        if (!bestle || le->timestamp >= bestle->timestamp) {
+            if (bestle) zcm_eventlog_free_event(bestle);
+            undo = best;
+            best = i;
+            bestle = le;
+        } else {
+            zcm_eventlog_free_event(le);
+        }
+        if (undo >= 0) {
+            le = zcm_eventlog_read_next_event(l->shards[undo]);
+            if (le) zcm_eventlog_free_event(le);
+        }
+    }
+    return bestle;
+}
+
+static int set_seek(zcm_eventlog_t *l, int64_t timestamp)
+{
+    size_t i;
+    int ret = -1;
+    for (i = 0; i < l->nshards; ++i) {
+        if (l->shardnext[i]) zcm_eventlog_free_event(l->shardnext[i]);
+        l->shardnext[i] = NULL;
+
+        // Logs with every event before 'timestamp' are left on their last one
+        zcm_eventlog_event_t *le = NULL;
+        if (zcm_eventlog_seek_to_timestamp(l->shards[i], timestamp) == 0 &&
+            (le = zcm_eventlog_read_next_event(l->shards[i])) && le->timestamp >= timestamp) {
+            l->shardnext[i] = le;
+            ret = 0;
+            continue;
+        }
+        if (le) zcm_eventlog_free_event(le);
+        // Nothing at or after 'timestamp' in this log: it has to end up at its end
+        while ((le = zcm_eventlog_read_next_event(l->shards[i])))
+            zcm_eventlog_free_event(le);
+    }
+    return ret;
+}
+
+int zcm_eventlog_write_set(const char *path, const char *const *logs, size_t nlogs)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    int ret = fputs(SET_HEADER, f) < 0 ? -1 : 0;
+    size_t i;
+    for (i = 0; i < nlogs && ret == 0; ++i)
+        if (fprintf(f, "%s\n", logs[i]) < 0) ret = -1;
+    if (fclose(f) != 0) ret = -1;
+    return ret;
+}
+
+/**** Logs served by zcm-log-server ****/
+#ifdef USE_REMOTE
+
+static void remote_destroy(zcm_eventlog_t *l)
+{
+    zcm_eventlog_remote_t *r = l->remote;
+    free(r->host);
+    free(r->port);
+    free(r->path);
+    free(r->channels);
+    free(r->raw);
+    free(r->stored);
+    free(r);
+    l->remote = NULL;
+}
+
+static char *remote_strndup(const char *s, size_t len)
+{
+    char *d = (char*) malloc(len + 1);
+    if (!d) return NULL;
+    memcpy(d, s, len);
+    d[len] = '\0';
+    return d;
+}
+
+// Parses "zcmlog://host[:port]/path[?start=S&end=S&channels=A,B]", the
+// window in seconds from the first event of the log
+static int remote_parse(zcm_eventlog_remote_t *r, const char *path)
+{
+    const char *host = path + strlen(REMOTE_PREFIX);
+    const char *slash = strchr(host, '/');
+    if (!slash || slash == host) return -1;
+    const char *colon = memchr(host, ':', slash - host);
+
+    r->host = remote_strndup(host, (colon ? colon : slash) - host);
+    r->port = colon ? remote_strndup(colon + 1, slash - colon - 1)
+                    : remote_strndup(REMOTE_DEFAULT_PORT, strlen(REMOTE_DEFAULT_PORT));
+
+    const char *query = strchr(slash + 1, '?');
+    size_t pathlen = query ? (size_t) (query - slash - 1) : strlen(slash + 1);
+    if (pathlen == 0 || pathlen >= SET_MAX_PATH) return -1;
+    r->path = remote_strndup(slash + 1, pathlen);
+
+    r->start = 0;
+    r->end = INT64_MAX;
+    r->relative = 1;
+    while (query && *query) {
+        const char *opt = query + 1;
+        query = strchr(opt, '&');
+        size_t len = query ? (size_t) (query - opt) : strlen(opt);
+        if (!strncmp(opt, "start=", 6))
+            r->start = (int64_t) (strtod(opt + 6, NULL) * 1e6);
+        else if (!strncmp(opt, "end=", 4))
+            r->end = (int64_t) (strtod(opt + 4, NULL) * 1e6);
+        else if (!strncmp(opt, "channels=", 9) && !r->channels)
+            r->channels = remote_strndup(opt + 9, len - 9);
+        else
+            return -1;
+    }
+    if (!r->channels) r->channels = remote_strndup("", 0);
+    if (!r->host || !r->port || !r->path || !r->channels || r->end < r->start) return -1;
+    return 0;
+}
+
+static int remote_connect(const zcm_eventlog_remote_t *r)
+{
+    struct addrinfo hints, *res, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(r->host, r->port, &hints, &res) != 0) return -1;
+
+    int fd = -1;
+    for (ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int send_all(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Reads the next batch of the stream into 'raw'. Returns -1 at its end
+static int remote_batch(zcm_eventlog_t *l)
+{
+    zcm_eventlog_remote_t *r = l->remote;
+    uint8_t hdr[REMOTE_BATCH_HEADER_BYTES];
+    r->rawlen = r->rawpos = 0;
+    if (r->ended) return -1;
+    if (fread(hdr, 1, sizeof(hdr), l->f) != sizeof(hdr)) goto fail;
+
+    int32_t codec     = get32(hdr);
+    int32_t rawlen    = get32(hdr + 4);
+    int32_t storedlen = get32(hdr + 8);
+    if (rawlen == 0) {
+        r->ended = 1;
+        return -1;
+    }
+    if (rawlen < 0 || storedlen < 0) goto fail;
+    if (reserve(&r->raw, &r->rawcap, rawlen) != 0) goto fail;
+
+    if (codec == CODEC_STORED) {
+        if (storedlen != rawlen || fread(r->raw, 1, rawlen, l->f) != (size_t) rawlen) goto fail;
+    } else {
+#ifdef USING_ZLIB
+        if (codec != CODEC_ZLIB || reserve(&r->stored, &r->storedcap, storedlen) != 0) goto fail;
+        if (fread(r->stored, 1, storedlen, l->f) != (size_t) storedlen) goto fail;
+        uLongf len = rawlen;
+        if (uncompress(r->raw, &len, r->stored, storedlen) != Z_OK ||
+            len != (uLongf) rawlen) goto fail;
+#else
+        // Never asked for
+        goto fail;
+#endif
+    }
+    r->rawlen = rawlen;
+    return 0;
+
+  fail:
+    fprintf(stderr, "Lost the stream of %s%s:%s/%s\n", REMOTE_PREFIX, r->host, r->port, r->path);
+    r->ended = 1;
+    return -1;
+}
+
+// Queries the events of the window from 'start' on, which replaces any
+// query under way
+static int remote_query(zcm_eventlog_t *l, int64_t start)
+{
+    zcm_eventlog_remote_t *r = l->remote;
+    if (l->f) fclose(l->f);
+    l->f = NULL;
+    r->rawlen = r->rawpos = 0;
+    r->ended = 1;
+
+    int fd = remote_connect(r);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to connect to %s:%s\n", r->host, r->port);
+        return -1;
+    }
+#ifdef USING_ZLIB
+    int zlib = 1;
+#else
+    int zlib = 0;
+#endif
+    size_t len = 64 + strlen(r->path) + strlen(r->channels);
+    char *req = (char*) malloc(len);
+    int n = snprintf(req, len, "%s %lld %lld %d %d\n%s\n%s\n", REMOTE_VERSION,
+                     (long long) start, (long long) r->end, r->relative, zlib,
+                     r->path, r->channels);
+    int ok = n > 0 && (size_t) n < len && send_all(fd, req, n) == 0;
+    free(req);
+    if (ok) l->f = fdopen(fd, "rb");
+    if (!l->f) {
+        close(fd);
+        return -1;
+    }
+
+    char line[SET_MAX_PATH];
+    long long first;
+    if (!fgets(line, sizeof(line), l->f)) {
+        fprintf(stderr, "No answer from %s:%s\n", r->host, r->port);
+        return -1;
+    }
+    if (sscanf(line, "OK %lld", &first) != 1) {
+        fprintf(stderr, "%s%s:%s/%s: %s", REMOTE_PREFIX, r->host, r->port, r->path,
+                !strncmp(line, "ERR ", 4) ? line + 4 : "Invalid answer\n");
+        return -1;
+    }
+    // From now on, queries are of absolute times
+    if (r->relative) {
+        r->start = start + first;
+        r->end = r->end > INT64_MAX - first ? INT64_MAX : r->end + first;
+        r->relative = 0;
+    }
+    r->ended = 0;
+    return 0;
+}
+
+static int remote_open(zcm_eventlog_t *l, const char *path)
+{
+    l->remote = (zcm_eventlog_remote_t*) calloc(1, sizeof(zcm_eventlog_remote_t));
+    if (!l->remote) return -1;
+    if (remote_parse(l->remote, path) != 0) {
+        fprintf(stderr, "Invalid remote log: %s\n", path);
+        return -1;
+    }
+    return remote_query(l, l->remote->start);
+}
+
+static zcm_eventlog_event_t *remote_read_next_event(zcm_eventlog_t *l)
+{
+    zcm_eventlog_remote_t *r = l->remote;
+    while (r->rawpos >= r->rawlen)
+        if (remote_batch(l) != 0) return NULL;
+
+    // Events are checked here as blocks are when they are loaded
+    const uint8_t *p = r->raw + r->rawpos;
+    size_t left = r->rawlen - r->rawpos;
+    if (left < sizeof(int32_t) + HEADER_BYTES || get32(p) != MAGIC) goto invalid;
+    p += sizeof(int32_t);
+    left -= sizeof(int32_t) + HEADER_BYTES;
+    int32_t channellen = get32(p + 16);
+    int32_t datalen    = get32(p + 20);
+    if (channellen <= 0 || channellen >= 1000 || (size_t) channellen > left) goto invalid;
+    if (datalen < 0 || (size_t) datalen > left - channellen) goto invalid;
+
+    zcm_eventlog_event_t *le = (zcm_eventlog_event_t*)
+        malloc(sizeof(zcm_eventlog_event_t) + channellen + 1 + datalen);
+    le->eventnum   = get64(p);
+    le->timestamp  = get64(p + 8);
+    le->channellen = channellen;
+    le->datalen    = datalen;
+    le->channel    = (char*) (le + 1);
+    memcpy(le->channel, p + HEADER_BYTES, channellen);
+    le->channel[channellen] = '\0';
+    le->data       = (uint8_t*) le->channel + channellen + 1;
+    memcpy(le->data, p + HEADER_BYTES + channellen, datalen);
+    le->channelid  = 0;
+
+    r->rawpos += sizeof(int32_t) + HEADER_BYTES + channellen + datalen;
+    return le;
+
+  invalid:
+    fprintf(stderr, "Invalid event from %s:%s\n", r->host, r->port);
+    r->rawlen = r->rawpos = 0;
+    r->ended = 1;
+    return NULL;
+}
+
+// Starts the query over from 'timestamp', or from the start of its window if
+// later. Fails if nothing is left of it
+static int remote_seek(zcm_eventlog_t *l, int64_t timestamp)
+{
+    zcm_eventlog_remote_t *r = l->remote;
+    if (remote_query(l, timestamp > r->start ? timestamp : r->start) != 0) return -1;
+    return remote_batch(l);
+}
+
+#endif
+
+int zcm_eventlog_seek_to_timestamp(zcm_eventlog_t *l, int64_t timestamp)
+{
+    if (l->shards) return set_seek(l, timestamp);
+#ifdef USE_REMOTE
+    if (l->remote) return remote_seek(l, timestamp);
+#endif
+    if (l->blocks) return block_seek(l, timestamp);
+
+    int ret = index_seek(l, timestamp) == 0 ? 0 : seek_to_timestamp(l, timestamp);
+#ifdef USE_MMAP
+    if (l->map) pos_from_file(l);
+#endif
+    return ret;
+}
+
+static zcm_eventlog_event_t *zcm_event_read_helper(zcm_eventlog_t *l, int rewindWhenDone)
+{
+    zcm_eventlog_event_t *le =
+        (zcm_eventlog_event_t*) calloc(1, sizeof(zcm_eventlog_event_t));
+
+    if (0 != fread64(l->f, &le->eventnum) ||
+        0 != fread64(l->f, &le->timestamp) ||
+        0 != fread32(l->f, &le->channellen) ||
+        0 != fread32(l->f, &le->datalen)) {
+        free(le);
+        return NULL;
+    }
+
+    // Sanity check the channel length and data length
+    int64_t body = body_len(le->channellen, le->datalen);
+    if (body < 0) {
+        report_lengths(le->channellen, le->datalen);
+        free(le);
+        return NULL;
+    }
+
+    if (le->channellen < 0) {
+        le->channelid = -le->channellen;
+        const char *name = chan_name(l, le->channelid, &le->channellen);
+        if (!name) {
+            fprintf(stderr, "Log event has unknown channel id: %d\n", le->channelid);
+            free(le);
+            return NULL;
+        }
+        le->channel = (char *) malloc(le->channellen+1);
+        memcpy(le->channel, name, le->channellen+1);
+    } else {
+        le->channel = (char *) calloc(1, le->channellen+1);
+        if (fread(le->channel, 1, le->channellen, l->f) != (size_t) le->channellen) {
+            free(le->channel);
+            free(le);
+            return NULL;
+        }
+    }
+
+    // Definitions have no data
+    if (le->datalen >= 0) {
+        le->data = calloc(1, le->datalen+1);
+        if (fread(le->data, 1, le->datalen, l->f) != (size_t) le->datalen) {
+            free(le->channel);
+            free(le->data);
+            free(le);
+            return NULL;
+        }
+    }
+
+    // Check that there's a valid event or the EOF after this event.
+    int32_t next_magic;
+    if (0 == fread32(l->f, &next_magic)) {
+        if (next_magic != MAGIC) {
+            fprintf(stderr, "Invalid header after log data\n");
+            free(le->channel);
+            free(le->data);
+            free(le);
+            return NULL;
+        }
+        fseeko (l->f, -4, SEEK_CUR);
+    }
+    if (rewindWhenDone) {
+        fseeko (l->f, -(sizeof(int64_t) * 2 + sizeof(int32_t) * 3 + body), SEEK_CUR);
+    }
+    return le;
+}
+
+static zcm_eventlog_event_t *read_next_event(zcm_eventlog_t *l)
+{
+    if (sync_stream(l, 0)) return NULL;
+    return zcm_event_read_helper(l, 0);
+}
+
+static zcm_eventlog_event_t *read_prev_event(zcm_eventlog_t *l)
+{
+    if (sync_stream_backwards(l) < 0) return NULL;
+    return zcm_event_read_helper(l, 1);
+}
+
+#ifdef USE_MMAP
+// Returns the offset past the first magic starting at or after 'pos', -1 if
+// there is none in the mapping
+static off_t map_sync_stream(const zcm_eventlog_t *l, off_t pos)
+{
+    if (pos < 0 || (size_t) pos + 4 > l->maplen) return -1;
+
+    const uint8_t *p = l->map + pos;
+    const uint8_t *end = l->map + l->maplen;
+    while (end - p >= 4) {
+        p = (const uint8_t*) memchr(p, (MAGIC >> 24) & 0xff, end - p - 3);
+        if (!p) break;
+        if (get32(p) == MAGIC) return p + 4 - l->map;
+        ++p;
+    }
+    return -1;
+}
+
+// Asks the kernel to start reading the part of the log that follows 'pos',
+// with '*advised' the end of what was asked for so far by this reader
+static void map_advise(zcm_eventlog_t *l, size_t *advised, off_t pos)
+{
+    if ((size_t) pos + READAHEAD_BYTES / 2 < *advised || *advised >= l->maplen) return;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = (*advised > (size_t) pos ? *advised : (size_t) pos) / page * page;
+    size_t len = l->maplen - start < READAHEAD_BYTES ? l->maplen - start : READAHEAD_BYTES;
+    madvise(l->map + start, len, MADV_WILLNEED);
+    *advised = start + len;
+}
+
+// Reads the event whose header is at 'pos' in the mapping. '*end' is set to
+// the offset past what was read (as zcm_event_read_helper() would leave the
+// FILE, even on failure), or to -1 if the event doesn't fit in the mapping.
+// Only the event and its channel are allocated: its data points into the mapping
+// NOTE: Only reads 'l', so that cursors can use it from several threads
+static zcm_eventlog_event_t *map_read_helper(const zcm_eventlog_t *l, off_t pos, off_t *end)
+{
+    *end = -1;
+    if (l->maplen - pos < HEADER_BYTES) return NULL;
+
+    const uint8_t *p = l->map + pos;
+    int64_t eventnum   = get64(p);
+    int64_t timestamp  = get64(p + 8);
+    int32_t channellen = get32(p + 16);
+    int32_t datalen    = get32(p + 20);
+
+    // Sanity check the channel length and data length
+    int64_t body = body_len(channellen, datalen);
+    if (body < 0) {
+        report_lengths(channellen, datalen);
+        *end = pos + HEADER_BYTES;
+        return NULL;
+    }
+
+    size_t len = HEADER_BYTES + body;
+    if (l->maplen - pos < len) return NULL;
+
+    int32_t channelid = 0;
+    const char *channel = (const char*) p + HEADER_BYTES;
+    if (channellen < 0) {
+        channelid = -channellen;
+        channel = chan_name(l, channelid, &channellen);
+        if (!channel) {
+            fprintf(stderr, "Log event has unknown channel id: %d\n", channelid);
+            *end = pos + len;
+            return NULL;
+        }
+    }
+
+    // Check that there's a valid event or the EOF after this event.
+    if (l->maplen - pos - len >= sizeof(int32_t) && get32(p + len) != MAGIC) {
+        fprintf(stderr, "Invalid header after log data\n");
+        *end = pos + len + sizeof(int32_t);
+        return NULL;
+    }
+
+    zcm_eventlog_event_t *le =
+        (zcm_eventlog_event_t*) malloc(sizeof(zcm_eventlog_event_t) + channellen + 1);
+    le->eventnum   = eventnum;
+    le->timestamp  = timestamp;
+    le->channellen = channellen;
+    le->datalen    = datalen;
+    le->channel    = (char*) (le + 1);
+    memcpy(le->channel, channel, channellen);
+    le->channel[channellen] = '\0';
+    // Definitions have no data
+    le->data       = datalen < 0 ? NULL : (uint8_t*) p + len - datalen;
+    le->channelid  = channelid;
+
+    *end = pos + len;
+    return le;
+}
+
+static zcm_eventlog_event_t *map_read_next_event(zcm_eventlog_t *l)
+{
+    zcm_eventlog_event_t *le;
+    off_t pos = map_sync_stream(l, pos_tell(l));
+    if (pos >= 0) {
+        off_t end;
+        le = map_read_helper(l, pos, &end);
+        if (end >= 0) {
+            l->pos = end;
+            map_advise(l, &l->advised, end);
+            return le;
+        }
+    }
+
+    // Past the end of the mapping: the log may have grown since it was opened
+    pos_to_file(l);
+    le = read_next_event(l);
+    pos_from_file(l);
+    return le;
+}
+
+static zcm_eventlog_event_t *map_read_prev_event(zcm_eventlog_t *l)
+{
+    zcm_eventlog_event_t *le;
+    off_t pos = pos_tell(l);
+    if ((size_t) pos > l->maplen) {
+        pos_to_file(l);
+        le = read_prev_event(l);
+        pos_from_file(l);
+        return le;
+    }
+
+    off_t end;
+    pos = prev_event(l, pos);
+    if (pos < 0) {
+        l->pos = 0;
+        return NULL;
+    }
+    l->pos = pos;
+    le = map_read_helper(l, pos, &end);
+    if (end >= 0) {
+        map_advise(l, &l->advised, end);
+        // Like zcm_event_read_helper(), rewind to the magic unless at the EOF
+        if (le && (size_t) end + sizeof(int32_t) <= l->maplen) l->pos -= sizeof(int32_t);
+        return le;
+    }
+
+    // The last event of the mapping continues past it
+    pos_to_file(l);
+    le = zcm_event_read_helper(l, 1);
+    pos_from_file(l);
+    return le;
+}
+#endif
+
+zcm_eventlog_event_t *zcm_eventlog_read_next_event(zcm_eventlog_t *l)
+{
+    if (l->shards) return set_read_next_event(l);
+#ifdef USE_REMOTE
+    if (l->remote) return remote_read_next_event(l);
+#endif
+    if (l->blocks) return block_read_next_event(l);
+
+    zcm_eventlog_event_t *le;
+    do {
+#ifdef USE_MMAP
+        if (l->map) le = map_read_next_event(l);
+        else
+#endif
+        le = read_next_event(l);
+    } while (le && chan_skip(l, le));
+    return le;
+}
+
+zcm_eventlog_event_t *zcm_eventlog_read_prev_event(zcm_eventlog_t *l)
+{
+    if (l->shards) return set_read_prev_event(l);
+    if (l->remote) return NULL;
+    if (l->blocks) return block_read_prev_event(l);
+
+    zcm_eventlog_event_t *le;
+    do {
+#ifdef USE_MMAP
+        if (l->map) le = map_read_prev_event(l);
+        else
+#endif
+        le = read_prev_event(l);
+    } while (le && chan_skip(l, le));
+    return le;
+}
+
+zcm_eventlog_event_t *zcm_eventlog_read_event_at_offset(zcm_eventlog_t *l, off_t offset)
+{
+    if (l->shards || l->remote) return NULL;
+    if (l->blocks) return block_read_event_at_offset(l, offset);
+#ifdef USE_MMAP
+    if (l->map) {
+        pos_tell(l);
+        l->pos = offset;
+    } else
+#endif
+    fseeko(l->f, offset, SEEK_SET);
+    return zcm_eventlog_read_next_event(l);
+}
+
+void zcm_eventlog_free_event(zcm_eventlog_event_t *le)
+{
+    // Events read from a mapping or from blocks hold their channel and don't
+    // own their data
+    if (le->channel != (char*) (le + 1)) {
+        if (le->data) free(le->data);
+        if (le->channel) free(le->channel);
+    }
+    memset(le,0,sizeof(zcm_eventlog_event_t));
+    free(le);
+}
+
+/**** Cursors ****/
+#ifdef USE_PREAD
+// Cursors only ever read the log (its mapping, index and file descriptor,
+// through pread()), all of which stay as they are until it is destroyed
+struct _zcm_eventlog_cursor_t
+{
+    const zcm_eventlog_t *log;
+    int    fd;
+    off_t  pos;
+    size_t advised;
+};
+
+// Bisections stop once they are down to this many bytes, which are scanned
+#define CURSOR_SCAN_BYTES (64 << 10)
+
+// Returns how many of the 'len' bytes at 'pos' were read, fewer at the EOF,
+// -1 on failure
+static ssize_t cursor_pread(const zcm_eventlog_cursor_t *c, void *buf, size_t len, off_t pos)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(c->fd, (uint8_t*) buf + done, len - done, pos + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+// Returns the offset past the first magic starting at or after 'pos', -1 if
+// there is none
+static off_t cursor_sync(const zcm_eventlog_cursor_t *c, off_t pos)
+{
+#ifdef USE_MMAP
+    if (c->log->map && (size_t) pos + sizeof(int32_t) <= c->log->maplen) {
+        off_t p = map_sync_stream(c->log, pos);
+        if (p >= 0) return p;
+        // One may still start in the last bytes of the mapping
+        pos = c->log->maplen - (sizeof(int32_t) - 1);
+    }
+#endif
+    uint8_t buf[4096];
+    while (1) {
+        ssize_t n = cursor_pread(c, buf, sizeof(buf), pos), i;
+        if (n < (ssize_t) sizeof(int32_t)) return -1;
+        for (i = 0; i + (ssize_t) sizeof(int32_t) <= n; ++i)
+            if (buf[i] == ((MAGIC >> 24) & 0xff) && get32(buf + i) == MAGIC)
+                return pos + i + sizeof(int32_t);
+        pos += n - (sizeof(int32_t) - 1);
+    }
+}
+
+// Reads the header of the first event at or after 'pos', whose magic is at
+// '*start'. Returns 0 on success, -1 if there is none
+static int cursor_header(const zcm_eventlog_cursor_t *c, off_t pos, off_t *start,
+                         int64_t *eventnum, int64_t *timestamp,
+                         int32_t *channellen, int32_t *datalen)
+{
+    uint8_t h[HEADER_BYTES];
+    const uint8_t *p = h;
+    off_t at = cursor_sync(c, pos);
+    if (at < 0) return -1;
+#ifdef USE_MMAP
+    if (c->log->map && (size_t) at + HEADER_BYTES <= c->log->maplen) p = c->log->map + at;
+    else
+#endif
+    if (cursor_pread(c, h, HEADER_BYTES, at) != HEADER_BYTES) return -1;
+
+    *start      = at - sizeof(int32_t);
+    *eventnum   = get64(p);
+    *timestamp  = get64(p + 8);
+    *channellen = get32(p + 16);
+    *datalen    = get32(p + 20);
+    return 0;
+}
+
+zcm_eventlog_cursor_t *zcm_eventlog_cursor_create(zcm_eventlog_t *l)
+{
+    if (l->mode != 'r' || l->blocks || l->shards || l->remote) return NULL;
+
+    // Loaded now, so that seeks don't have to
+    if (!l->indexloaded) load_index(l);
+
+    zcm_eventlog_cursor_t *c = (zcm_eventlog_cursor_t*) calloc(1, sizeof(zcm_eventlog_cursor_t));
+    c->log = l;
+    c->fd = fileno(l->f);
+    return c;
+}
+
+void zcm_eventlog_cursor_destroy(zcm_eventlog_cursor_t *c)
+{
+    free(c);
+}
+
+off_t zcm_eventlog_cursor_tell(const zcm_eventlog_cursor_t *c)
+{
+    return c->pos;
+}
+
+void zcm_eventlog_cursor_seek(zcm_eventlog_cursor_t *c, off_t offset)
+{
+    c->pos = offset;
+}
+
+int zcm_eventlog_cursor_seek_to_timestamp(zcm_eventlog_cursor_t *c, int64_t timestamp)
+{
+    off_t start, lo = 0, last = -1;
+    int64_t eventnum, ts;
+    int32_t channellen, datalen;
+
+    // Scans from the index entry before 'timestamp' if it matches the log,
+    // from where a bisection of the log gets down to otherwise
+    const zcm_eventlog_index_entry_t *e = index_find((zcm_eventlog_t*) c->log, timestamp);
+    if (e && cursor_header(c, e->offset, &start, &eventnum, &ts, &channellen, &datalen) == 0 &&
+        start == e->offset && eventnum == e->eventnum && ts == e->timestamp) {
+        lo = e->offset;
+    } else {
+        struct stat st;
+        off_t hi = fstat(c->fd, &st) == 0 ? st.st_size : 0;
+        while (hi - lo > CURSOR_SCAN_BYTES) {
+            off_t mid = lo + (hi - lo) / 2;
+            if (cursor_header(c, mid, &start, &eventnum, &ts, &channellen, &datalen) == 0 &&
+                ts < timestamp) lo = mid;
+            else hi = mid;
+        }
+    }
+
+    off_t pos = lo;
+    while (cursor_header(c, pos, &start, &eventnum, &ts, &channellen, &datalen) == 0) {
+        if (ts >= timestamp) {
+            c->pos = start;
+            return 0;
+        }
+        last = start;
+        pos = start + sizeof(int32_t) + HEADER_BYTES;
+        int64_t body = body_len(channellen, datalen);
+        if (body >= 0) pos += (off_t) body;
+    }
+
+    // Like zcm_eventlog_seek_to_timestamp(), on the last event if all are before
+    if (last < 0) return -1;
+    c->pos = last;
+    return 0;
+}
+
+static zcm_eventlog_event_t *cursor_read_next_event(zcm_eventlog_cursor_t *c)
+{
+    off_t start;
+    int64_t eventnum, timestamp;
+    int32_t channellen, datalen;
+    if (cursor_header(c, c->pos, &start, &eventnum, &timestamp, &channellen, &datalen) != 0)
+        return NULL;
+    off_t pos = start + sizeof(int32_t);
+
+#ifdef USE_MMAP
+    if (c->log->map && (size_t) pos <= c->log->maplen) {
+        off_t end;
+        zcm_eventlog_event_t *le = map_read_helper(c->log, pos, &end);
+        if (end >= 0) {
+            c->pos = end;
+            map_advise((zcm_eventlog_t*) c->log, &c->advised, end);
+            return le;
+        }
+        // The event continues past the mapping, the log having grown
+    }
+#endif
+
+    // Sanity check the channel length and data length
+    int64_t body = body_len(channellen, datalen);
+    if (body < 0) {
+        report_lengths(channellen, datalen);
+        c->pos = pos + HEADER_BYTES;
+        return NULL;
+    }
+
+    // Events refer to their channel by id, definitions have no data
+    int32_t channelid = 0, stored = channellen, len = datalen < 0 ? 0 : datalen;
+    const char *name = NULL;
+    if (channellen < 0) {
+        channelid = -channellen;
+        stored = 0;
+        name = chan_name(c->log, channelid, &channellen);
+        if (!name) {
+            fprintf(stderr, "Log event has unknown channel id: %d\n", channelid);
+            c->pos = pos + HEADER_BYTES + body;
+            return NULL;
+        }
+    }
+
+    // All in one allocation, followed by the magic of the next event
+    zcm_eventlog_event_t *le = (zcm_eventlog_event_t*)
+        malloc(sizeof(zcm_eventlog_event_t) + channellen + 1 + len + sizeof(int32_t));
+    le->eventnum   = eventnum;
+    le->timestamp  = timestamp;
+    le->channellen = channellen;
+    le->datalen    = datalen;
+    le->channel    = (char*) (le + 1);
+    le->data       = (uint8_t*) le->channel + channellen + 1;
+    le->channelid  = channelid;
+
+    pos += HEADER_BYTES;
+    ssize_t n = -1;
+    if (name) memcpy(le->channel, name, channellen);
+    if (name || cursor_pread(c, le->channel, channellen, pos) == channellen)
+        n = cursor_pread(c, le->data, len + sizeof(int32_t), pos + stored);
+    if (n < len) {
+        free(le);
+        return NULL;
+    }
+    le->channel[channellen] = '\0';
+
+    pos += body;
+    if (n == len + (ssize_t) sizeof(int32_t) && get32(le->data + len) != MAGIC) {
+        fprintf(stderr, "Invalid header after log data\n");
+        c->pos = pos + sizeof(int32_t);
+        free(le);
+        return NULL;
+    }
+    c->pos = pos;
+    return le;
+}
+
+zcm_eventlog_event_t *zcm_eventlog_cursor_read_next_event(zcm_eventlog_cursor_t *c)
+{
+    zcm_eventlog_event_t *le;
+    while ((le = cursor_read_next_event(c)) && chan_skip(c->log, le));
+    return le;
+}
+
+zcm_eventlog_event_t *zcm_eventlog_cursor_read_event_at_offset(zcm_eventlog_cursor_t *c, off_t offset)
+{
+    c->pos = offset;
+    return zcm_eventlog_cursor_read_next_event(c);
+}
+#else
+zcm_eventlog_cursor_t *zcm_eventlog_cursor_create(zcm_eventlog_t *l) { return NULL; }
+void zcm_eventlog_cursor_destroy(zcm_eventlog_cursor_t *c) {}
+off_t zcm_eventlog_cursor_tell(const zcm_eventlog_cursor_t *c) { return -1; }
+void zcm_eventlog_cursor_seek(zcm_eventlog_cursor_t *c, off_t offset) {}
+int zcm_eventlog_cursor_seek_to_timestamp(zcm_eventlog_cursor_t *c, int64_t timestamp) { return -1; }
+zcm_eventlog_event_t *zcm_eventlog_cursor_read_next_event(zcm_eventlog_cursor_t *c) { return NULL; }
+zcm_eventlog_event_t *zcm_eventlog_cursor_read_event_at_offset(zcm_eventlog_cursor_t *c, off_t offset) { return NULL; }
+#endif
+
+int zcm_eventlog_enable_index(zcm_eventlog_t *l, int64_t every_events, int64_t every_bytes)
+{
+    if (l->mode == 'r' || l->idx || every_events < 0 || every_bytes < 0) return -1;
+
+    // Append mode writes at the end whatever the position is
+    fseeko(l->f, 0, SEEK_END);
+    l->writepos = ftello(l->f);
+
+    int append = l->writepos > 0;
+    l->idx = fopen(l->idxpath, append ? "ab" : "wb");
+    if (!l->idx) return -1;
+    fseeko(l->idx, 0, SEEK_END);
+    if (ftello(l->idx) == 0 && 0 != fwrite32(l->idx, INDEX_MAGIC)) {
+        fclose(l->idx);
+        l->idx = NULL;
+        return -1;
+    }
+
+    l->idx_every_events = every_events;
+    l->idx_every_bytes = every_bytes;
+    l->idx_events = 0;
+    l->idx_last = -1;
+    return 0;
+}
+
+static void write_index_entry(zcm_eventlog_t *l, int64_t timestamp, int64_t eventnum)
+{
+    int due = l->idx_last < 0 ||
+              (l->idx_every_events > 0 && l->idx_events >= l->idx_every_events) ||
+              (l->idx_every_bytes > 0 && l->writepos - l->idx_last >= l->idx_every_bytes);
+    if (!due) return;
+
+    // A failed entry only makes the index sparser
+    if (0 == fwrite64(l->idx, timestamp) &&
+        0 == fwrite64(l->idx, eventnum) &&
+        0 == fwrite64(l->idx, l->writepos)) {
+        l->idx_events = 0;
+        l->idx_last = l->writepos;
+    }
+}
+
+/**** Compressed logs: writing ****/
+
+int zcm_eventlog_enable_compression(zcm_eventlog_t *l, int level, size_t block_bytes)
+{
+#ifdef USING_ZLIB
+    if (l->mode == 'r' || l->eventcount > 0 || l->chans) return -1;
+    if (level < 1 || level > 9 || block_bytes == 0 || block_bytes > BLOCK_MAX_RAW / 2) return -1;
+
+    // Appending to a compressed log already writes blocks, but they can't
+    // follow plain events
+    if (l->blocks) {
+        l->blocks->level = level;
+        l->blocks->blockbytes = block_bytes;
+        return 0;
+    }
+    if (l->format == FORMAT_EVENTS) return -1;
+
+    fseeko(l->f, 0, SEEK_END);
+    l->writepos = ftello(l->f);
+    l->blocks = blocks_create(level, block_bytes);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static int block_flush(zcm_eventlog_t *l)
+{
+    zcm_eventlog_blocks_t *b = l->blocks;
+    if (b->pending == 0) return 0;
+
+    int32_t codec = CODEC_STORED;
+    const uint8_t *stored = b->raw;
+    size_t storedlen = b->rawlen;
+#ifdef USING_ZLIB
+    uLongf zlen = compressBound(b->rawlen);
+    if (reserve(&b->stored, &b->storedcap, zlen) == 0 &&
+        compress2(b->stored, &zlen, b->raw, b->rawlen, b->level) == Z_OK &&
+        zlen < b->rawlen) {
+        codec = CODEC_ZLIB;
+        stored = b->stored;
+        storedlen = zlen;
+    }
+#endif
+
+    size_t blocklen = BLOCK_HEADER_BYTES + storedlen;
+    if (blocklen <= (size_t) b->pending) blocklen = b->pending + 1;
+
+    if (l->idx) write_index_entry(l, b->first, b->eventnum);
+
+    uint8_t h[BLOCK_HEADER_BYTES];
+    uint8_t *p = h;
+    p = put32(p, BLOCK_MAGIC);
+    p = put32(p, codec);
+    p = put32(p, b->pending);
+    p = put32(p, b->rawlen);
+    p = put32(p, storedlen);
+    p = put32(p, blocklen);
+    p = put64(p, b->eventnum);
+    p = put64(p, b->first);
+    p = put64(p, b->last);
+
+    b->pending = 0;
+    b->rawlen = 0;
+
+    static const uint8_t zeros[256];
+    size_t pad = blocklen - sizeof(h) - storedlen;
+    const uint8_t *chunks[] = { h, stored };
+    size_t lens[] = { sizeof(h), storedlen };
+    if (write_buffered(l, chunks, lens, 2) != 0) return -1;
+    while (pad > 0) {
+        const uint8_t *z = zeros;
+        size_t n = pad < sizeof(zeros) ? pad : sizeof(zeros);
+        if (write_buffered(l, &z, &n, 1) != 0) return -1;
+        pad -= n;
+    }
+    l->writepos += blocklen;
+    return 0;
+}
+
+static int block_write_event(zcm_eventlog_t *l, const zcm_eventlog_event_t *le)
+{
+    zcm_eventlog_blocks_t *b = l->blocks;
+    size_t len = sizeof(int32_t) + HEADER_BYTES + le->channellen + le->datalen;
+    if (le->channellen <= 0 || le->datalen < 0 || len > BLOCK_MAX_RAW) return -1;
+    if (b->rawlen + len > BLOCK_MAX_RAW && block_flush(l) != 0) return -1;
+    if (reserve(&b->raw, &b->rawcap, b->rawlen + len) != 0) return -1;
+
+    uint8_t *p = b->raw + b->rawlen;
+    p = put32(p, MAGIC);
+    p = put64(p, l->eventcount);
+    p = put64(p, le->timestamp);
+    p = put32(p, le->channellen);
+    p = put32(p, le->datalen);
+    memcpy(p, le->channel, le->channellen);
+    memcpy(p + le->channellen, le->data, le->datalen);
+    b->rawlen += len;
+
+    if (b->pending++ == 0) {
+        b->eventnum = l->eventcount;
+        b->first = le->timestamp;
+    }
+    b->last = le->timestamp;
+    l->eventcount++;
+    l->idx_events++;
+
+    if (b->rawlen >= b->blockbytes) return block_flush(l);
+    return 0;
+}
+
+int zcm_eventlog_enable_channel_ids(zcm_eventlog_t *l)
+{
+    if (l->mode == 'r' || l->blocks || l->eventcount > 0) return -1;
+
+    // Appending to a log with channel ids already continues them, but they
+    // can't follow plain events
+    if (l->chans) return 0;
+    if (l->format == FORMAT_EVENTS) return -1;
+
+    l->chans = chans_create();
+    return 0;
+}
+
+// Writes the definition of channel 'id' as the channel of 'le'. Returns 0 on
+// success, -1 on failure
+static int chan_write_definition(zcm_eventlog_t *l, const zcm_eventlog_event_t *le, int32_t id)
+{
+    uint8_t h[sizeof(int32_t) + HEADER_BYTES];
+    uint8_t *p = h;
+    p = put32(p, MAGIC);
+    p = put64(p, l->eventcount);
+    p = put64(p, le->timestamp);
+    p = put32(p, le->channellen);
+    p = put32(p, -id);
+
+    const uint8_t *chunks[] = { h, (const uint8_t*) le->channel };
+    size_t lens[] = { sizeof(h), le->channellen };
+    if (write_buffered(l, chunks, lens, 2) != 0) return -1;
+
+    l->writepos += sizeof(h) + le->channellen;
+    return 0;
+}
+
+int zcm_eventlog_write_event(zcm_eventlog_t *l, const zcm_eventlog_event_t *le)
+{
+    if (l->blocks) return block_write_event(l, le);
+
+    // Channels with an id are only written in their definition
+    int32_t id = 0;
+    if (l->chans) {
+        if (le->channellen <= 0 || le->channellen >= 1000) return -1;
+        id = chan_find(l->chans, le->channel, le->channellen);
+        if (id == 0) {
+            id = l->chans->n + 1;
+            if (chan_define(l->chans, id, le->channel, le->channellen) != 0 ||
+                chan_write_definition(l, le, id) != 0) return -1;
+        }
+    }
+    int32_t channellen = id ? 0 : le->channellen;
+
+    if (l->idx) write_index_entry(l, le->timestamp, l->eventcount);
+
+    uint8_t h[sizeof(int32_t) + HEADER_BYTES];
+    uint8_t *p = h;
+    p = put32(p, MAGIC);
+    p = put64(p, l->eventcount);
+    p = put64(p, le->timestamp);
+    p = put32(p, id ? -id : le->channellen);
+    p = put32(p, le->datalen);
+
+    // The header, channel and data go out together
+    const uint8_t *chunks[] = { h, (const uint8_t*) le->channel, le->data };
+    size_t lens[] = { sizeof(h), channellen, le->datalen };
+    if (write_buffered(l, chunks, lens, 3) != 0) return -1;
 
     l->eventcount++;
+    l->idx_events++;
+    l->writepos += sizeof(int32_t) + HEADER_BYTES + channellen + le->datalen;
 
     return 0;
 }
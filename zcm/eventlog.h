@@ -18,27 +18,178 @@ struct _zcm_eventlog_event_t
     int32_t  datalen;
     char*    channel;
     uint8_t* data;
+    int32_t  channelid;  /* populated by read in logs with channel ids (see
+                            zcm_eventlog_enable_channel_ids()), 0 otherwise */
 };
 
+/* Entry of the sparse time index of a log: the event 'eventnum', logged at
+   'timestamp', starts (with its magic) at byte 'offset' of the log */
+typedef struct _zcm_eventlog_index_entry_t zcm_eventlog_index_entry_t;
+struct _zcm_eventlog_index_entry_t
+{
+    int64_t timestamp;
+    int64_t eventnum;
+    int64_t offset;
+};
+
+/* State of compressed logs and of the writer thread, internal to eventlog.c */
+typedef struct _zcm_eventlog_blocks_t zcm_eventlog_blocks_t;
+typedef struct _zcm_eventlog_writer_t zcm_eventlog_writer_t;
+typedef struct _zcm_eventlog_remote_t zcm_eventlog_remote_t;
+typedef struct _zcm_eventlog_channels_t zcm_eventlog_channels_t;
+
 typedef struct _zcm_eventlog_t zcm_eventlog_t;
 struct _zcm_eventlog_t
 {
     FILE* f;
     int64_t eventcount;
+    char mode;           /* 'r', 'w' or 'a' */
+
+    /* Logs opened for reading are memory mapped when possible. 'pos' is then
+       the read position: the FILE is only moved there (to 'filepos') by
+       zcm_eventlog_get_fileptr(), and seeks done on it are picked up by the
+       next read */
+    uint8_t* map;
+    size_t   maplen;
+    size_t   advised;
+    off_t    pos;
+    off_t    filepos;
+
+    /* Sidecar time index, in idxpath ("<path>.tidx"). Writers append to idx
+       (see zcm_eventlog_enable_index()); readers load it into 'index' on
+       their first seek */
+    char*    idxpath;
+    FILE*    idx;
+    int64_t  idx_every_events;
+    int64_t  idx_every_bytes;
+    int64_t  idx_events;
+    off_t    idx_last;
+    off_t    writepos;
+    zcm_eventlog_index_entry_t* index;
+    size_t   indexlen;
+    int      indexloaded;
+
+    /* Compressed logs (see zcm_eventlog_enable_compression()) are read and
+       written in blocks through 'blocks'. 'format' is what the file held when
+       it was opened: -1 nothing, 0 events, 1 blocks */
+    int      format;
+    zcm_eventlog_blocks_t* blocks;
+
+    /* Writers gather what they write in 'wbuf' (see
+       zcm_eventlog_set_write_buffer()), handed to 'writer' once full if there
+       is one (see zcm_eventlog_enable_async_writes()) */
+    uint8_t* wbuf;
+    size_t   wbuflen;
+    size_t   wbufcap;
+    zcm_eventlog_writer_t* writer;
+
+    /* Sets of logs (see zcm_eventlog_write_set()) read each of their
+       'nshards' logs through 'shards', with the next event of each kept in
+       'shardnext' */
+    struct _zcm_eventlog_t** shards;
+    size_t   nshards;
+    zcm_eventlog_event_t** shardnext;
+
+    /* Logs served by zcm-log-server are streamed from 'remote', with 'f' the
+       connection */
+    zcm_eventlog_remote_t* remote;
+
+    /* The channel ids of the log: always there for reading, only once
+       enabled for writing (see zcm_eventlog_enable_channel_ids()) */
+    zcm_eventlog_channels_t* chans;
+
+    /* Reading backwards (see zcm_eventlog_read_prev_event()) goes through the
+       'nprev' offsets in 'prevstarts': where events start in [prevlo, prevhi],
+       found through the index or by scanning the log in 'prevbuf' (which
+       scanning forwards reads into too) */
+    off_t*   prevstarts;
+    size_t   nprev;
+    size_t   prevcap;
+    off_t    prevlo;
+    off_t    prevhi;
+    uint8_t* prevbuf;
 };
 
 /**** Methods for creation/deletion ****/
+// Paths of the form "zcmlog://host[:port]/path" read the log at 'path' under
+// the root of a zcm-log-server (on port 7400 by default), which can be asked
+// for a window of it with "?start=S&end=S&channels=A,B" (S in seconds from
+// the first event of the log). Such logs are read only and streamed: seeks
+// start a new query, and they have no offsets, previous events or cursors.
+// zcm_eventlog_get_fileptr() returns the connection
 zcm_eventlog_t* zcm_eventlog_create(const char* path, const char* mode);
 void zcm_eventlog_destroy(zcm_eventlog_t* eventlog);
 
 
 /**** Methods for general operations ****/
+// NOTE: For logs opened for writing, this first writes out the buffered
+//       events, so that flushing or syncing the FILE covers all of them
 FILE* zcm_eventlog_get_fileptr(zcm_eventlog_t* eventlog);
+// Moves to the first event logged at or after 'ts' (or to the last event).
+// Uses the sidecar time index when there is one, bisects the log otherwise.
+// Returns 0 on success, -1 if the log has no events
 int zcm_eventlog_seek_to_timestamp(zcm_eventlog_t* eventlog, int64_t ts);
 
+// For logs opened for writing: from now on, also write a sidecar time index
+// ("<path>.tidx", appended to in "a" mode) with an entry every 'every_events'
+// events or 'every_bytes' bytes of log, whichever comes first (0 disables a
+// criterion). Returns 0 on success, -1 on failure
+int zcm_eventlog_enable_index(zcm_eventlog_t* eventlog, int64_t every_events, int64_t every_bytes);
+
+// For logs opened for writing, before their first event: write the events in
+// blocks of about 'block_bytes', each compressed on its own (zlib, 'level' 1
+// to 9), so that readers can still seek and read single events. Opening a
+// compressed log in "a" mode continues it with default settings. Returns -1
+// on failure, or if zcm was built without zlib (--use-zlib)
+// NOTE: In compressed logs, the offset of the nth event of a block (as in
+//       ftello() on the FILE and zcm_eventlog_read_event_at_offset()) is that
+//       of the block plus n. Up to a block of events is lost on a crash
+int zcm_eventlog_enable_compression(zcm_eventlog_t* eventlog, int level, size_t block_bytes);
+
+// For plain logs opened for writing, before their first event: write the name
+// of each channel only once, before its first event, and have its events
+// refer to it by a number (the event's channelid when read). Logs of small
+// messages on long channel names shrink by a lot, and readers can decide what
+// to do with a channel by its number. Opening such a log in "a" mode reads it
+// through to continue its numbers. Returns -1 on failure, or for compressed
+// logs (where compression takes care of the names)
+// NOTE: These logs are read by zcm/eventlog.h (and what is built on it: C++,
+//       Python, zcm-log-server), not by the Java and Javascript readers
+int zcm_eventlog_enable_channel_ids(zcm_eventlog_t* eventlog);
+
+// For logs opened for writing: gather events in a buffer of 'bytes' (256kB by
+// default, 0 writes every event on its own) and write it out in one call once
+// it's full. Events that don't fit are written directly. Returns 0 on
+// success, -1 on failure
+int zcm_eventlog_set_write_buffer(zcm_eventlog_t* eventlog, size_t bytes);
+
+// For logs opened for writing: from now on, have a thread write the full
+// write buffers out, with up to 'buffers' of them queued, so that a slow disk
+// only holds up writing events once they are all full. Events bigger than
+// the write buffer are copied too. Write errors (errno) are reported by the
+// following write_event() or flush(). The write buffer size can't be changed
+// afterwards. Returns 0 on success, -1 on failure
+int zcm_eventlog_enable_async_writes(zcm_eventlog_t* eventlog, size_t buffers);
+
+// For logs opened for writing: write out the buffered events, and if 'sync'
+// have them reach the disk (fdatasync). With async writes, this is queued and
+// returns at once. Returns 0 on success, -1 on failure
+int zcm_eventlog_flush(zcm_eventlog_t* eventlog, int sync);
+
+// Writes a set of logs to 'path': a small text file naming 'nlogs' logs
+// (relative to its own directory unless absolute). Opening it for reading
+// reads all of them as one log, with their events merged by timestamp and
+// seeks done on every log. Returns 0 on success, -1 on failure
+// NOTE: Events keep the eventnum they have in their own log, and sets have no
+//       offsets: zcm_eventlog_read_event_at_offset() returns NULL, and
+//       zcm_eventlog_get_fileptr() the FILE of the set file itself
+int zcm_eventlog_write_set(const char* path, const char* const* logs, size_t nlogs);
+
 
 /**** Methods for read/write ****/
 // NOTE: The returned zcm_eventlog_event_t must be freed by zcm_eventlog_free_event()
+//       Events of memory mapped logs point into the mapping for their data,
+//       which is only valid until the log is destroyed
 zcm_eventlog_event_t* zcm_eventlog_read_next_event(zcm_eventlog_t* eventlog);
 zcm_eventlog_event_t* zcm_eventlog_read_prev_event(zcm_eventlog_t* eventlog);
 zcm_eventlog_event_t* zcm_eventlog_read_event_at_offset(zcm_eventlog_t* eventlog, off_t offset);
@@ -46,6 +197,32 @@ void zcm_eventlog_free_event(zcm_eventlog_event_t* event);
 int zcm_eventlog_write_event(zcm_eventlog_t* eventlog, const zcm_eventlog_event_t* event);
 
 
+/**** Methods for concurrent reads ****/
+// A read position of its own in a plain log opened for reading, read through
+// pread() (or the mapping) rather than the FILE: a thread can read the log
+// through each of its cursors at once, or through the log itself, as long as
+// every cursor (and the log) is only used by one thread at a time.
+// Returns NULL for compressed logs and sets of logs, and when unsupported
+// (WIN32). Must not be called while the log is in use by other threads, and
+// cursors must be destroyed before their log
+// NOTE: Events are read as with zcm_eventlog_read_next_event(), and must still
+//       be freed by zcm_eventlog_free_event()
+typedef struct _zcm_eventlog_cursor_t zcm_eventlog_cursor_t;
+zcm_eventlog_cursor_t* zcm_eventlog_cursor_create(zcm_eventlog_t* eventlog);
+void zcm_eventlog_cursor_destroy(zcm_eventlog_cursor_t* cursor);
+
+// The offset of the cursor: the next read is of the first event at or after it
+off_t zcm_eventlog_cursor_tell(const zcm_eventlog_cursor_t* cursor);
+void zcm_eventlog_cursor_seek(zcm_eventlog_cursor_t* cursor, off_t offset);
+// Moves to the first event logged at or after 'ts' (or to the last event),
+// through the sidecar time index when there is one. Returns 0 on success, -1
+// if the log has no events
+int zcm_eventlog_cursor_seek_to_timestamp(zcm_eventlog_cursor_t* cursor, int64_t ts);
+
+zcm_eventlog_event_t* zcm_eventlog_cursor_read_next_event(zcm_eventlog_cursor_t* cursor);
+zcm_eventlog_event_t* zcm_eventlog_cursor_read_event_at_offset(zcm_eventlog_cursor_t* cursor, off_t offset);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,249 @@
+#include "zcm/zcm.h"
+#include "zcm/blocking.h"
+#include "zcm/util/debug.h"
+#include "zcm/util/thread_util.hpp"
+
+#ifdef __linux__
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Most messages dispatched for one zcm before another gets its turn
+#define EXECUTOR_DISPATCH_BATCH 64
+
+#ifdef __linux__
+
+// Every attached zcm registers two descriptors with 'epfd' (see zcm_get_fd()
+// and zcm_blocking_get_send_fd()), one shot each: the thread that gets one
+// serves that side of that zcm alone until it re-arms it, which keeps the
+// callbacks of a zcm in order and off of two threads at once. The events carry
+// the id of the zcm, shifted left, and 1 for the send side; 0 is 'stopFd'
+struct zcm_executor_t
+{
+    struct Attached
+    {
+        zcm_t* zcm;
+        int    recvFd;
+        int    sendFd;
+        int    busy = 0;          // threads serving it right now
+        bool   detaching = false; // not re-armed anymore
+    };
+
+    int epfd = -1;
+    int stopFd = -1;
+    vector<thread> threads;
+
+    // Guards everything below
+    mutex              mut;
+    condition_variable idle;
+    uint64_t           nextId = 1;
+    unordered_map<uint64_t, Attached> attached;
+
+    ~zcm_executor_t()
+    {
+        vector<zcm_t*> zcms;
+        {
+            unique_lock<mutex> lk(mut);
+            for (auto& elt : attached) zcms.push_back(elt.second.zcm);
+        }
+        for (zcm_t* z : zcms) detach(z);
+
+        // Level triggered: every thread sees it
+        if (stopFd >= 0) {
+            uint64_t one = 1;
+            if (write(stopFd, &one, sizeof(one)) < 0) perror("zcm executor -- write");
+        }
+        for (auto& t : threads) t.join();
+        if (stopFd >= 0) close(stopFd);
+        if (epfd >= 0) close(epfd);
+    }
+
+    bool init(uint32_t numThreads)
+    {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epfd < 0 || stopFd < 0) {
+            perror("zcm executor");
+            return false;
+        }
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, stopFd, &ev) < 0) {
+            perror("zcm executor -- epoll_ctl");
+            return false;
+        }
+        for (uint32_t i = 0; i < numThreads; ++i)
+            threads.emplace_back(&zcm_executor_t::run, this, i);
+        return true;
+    }
+
+    bool watch(int op, int fd, uint64_t key)
+    {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.u64 = key;
+        return epoll_ctl(epfd, op, fd, &ev) == 0;
+    }
+
+    void run(uint32_t index)
+    {
+        ThreadUtil::setName("zcm-exec-" + to_string(index));
+        while (true) {
+            // One at a time, so the others are left for the other threads
+            struct epoll_event ev;
+            int n = epoll_wait(epfd, &ev, 1, -1);
+            if (n < 0 && errno != EINTR) {
+                perror("zcm executor -- epoll_wait");
+                return;
+            }
+            if (n <= 0) continue;
+            if (ev.data.u64 == 0) return;
+            serve(ev.data.u64);
+        }
+    }
+
+    void serve(uint64_t key)
+    {
+        uint64_t id = key >> 1;
+        bool send = key & 1;
+        zcm_t* zcm;
+        {
+            unique_lock<mutex> lk(mut);
+            auto it = attached.find(id);
+            if (it == attached.end()) return;
+            it->second.busy++;
+            zcm = it->second.zcm;
+        }
+
+        if (send) zcm_blocking_send_queued((zcm_blocking_t*) zcm->impl);
+        else zcm_blocking_handle_nonblock_n((zcm_blocking_t*) zcm->impl,
+                                            EXECUTOR_DISPATCH_BATCH, 0);
+
+        // The entry outlives us: detach() waits for 'busy' to drop to 0
+        unique_lock<mutex> lk(mut);
+        Attached& a = attached.at(id);
+        if (--a.busy == 0) idle.notify_all();
+        if (!a.detaching && !watch(EPOLL_CTL_MOD, send ? a.sendFd : a.recvFd, key))
+            perror("zcm executor -- epoll_ctl");
+    }
+
+    int attach(zcm_t* zcm)
+    {
+        if (zcm->type != ZCM_BLOCKING) return ZCM_EINVALID;
+        zcm_blocking_t* impl = (zcm_blocking_t*) zcm->impl;
+        {
+            unique_lock<mutex> lk(mut);
+            for (auto& elt : attached)
+                if (elt.second.zcm == zcm) return ZCM_EINVALID;
+        }
+
+        // Starts the recv thread, unless zcm runs already
+        int recvFd = zcm_blocking_get_fd(impl);
+        if (recvFd < 0) return ZCM_EINVALID;
+        int sendFd = zcm_blocking_get_send_fd(impl);
+        if (sendFd < 0) {
+            zcm_blocking_stop(impl);
+            return ZCM_EINVALID;
+        }
+
+        unique_lock<mutex> lk(mut);
+        uint64_t id = nextId++;
+        Attached& a = attached[id];
+        a.zcm = zcm;
+        a.recvFd = recvFd;
+        a.sendFd = sendFd;
+        if (!watch(EPOLL_CTL_ADD, recvFd, id << 1) ||
+            !watch(EPOLL_CTL_ADD, sendFd, (id << 1) | 1)) {
+            perror("zcm executor -- epoll_ctl");
+            epoll_ctl(epfd, EPOLL_CTL_DEL, recvFd, nullptr);
+            attached.erase(id);
+            lk.unlock();
+            zcm_blocking_close_send_fd(impl);
+            zcm_blocking_stop(impl);
+            return ZCM_EINVALID;
+        }
+        return ZCM_EOK;
+    }
+
+    int detach(zcm_t* zcm)
+    {
+        {
+            unique_lock<mutex> lk(mut);
+            auto it = attached.begin();
+            while (it != attached.end() && it->second.zcm != zcm) ++it;
+            if (it == attached.end()) return ZCM_EINVALID;
+
+            Attached& a = it->second;
+            a.detaching = true;
+            epoll_ctl(epfd, EPOLL_CTL_DEL, a.recvFd, nullptr);
+            epoll_ctl(epfd, EPOLL_CTL_DEL, a.sendFd, nullptr);
+            idle.wait(lk, [&](){ return a.busy == 0; });
+            attached.erase(it);
+        }
+
+        zcm_blocking_t* impl = (zcm_blocking_t*) zcm->impl;
+        zcm_blocking_close_send_fd(impl);
+        zcm_blocking_stop(impl);
+        return ZCM_EOK;
+    }
+};
+
+zcm_executor_t* zcm_executor_create(uint32_t numThreads)
+{
+    if (numThreads == 0) return nullptr;
+    zcm_executor_t* ex = new zcm_executor_t();
+    if (!ex->init(numThreads)) {
+        delete ex;
+        return nullptr;
+    }
+    return ex;
+}
+
+void zcm_executor_destroy(zcm_executor_t* ex)
+{
+    delete ex;
+}
+
+int zcm_executor_attach(zcm_executor_t* ex, zcm_t* zcm)
+{
+    return ex->attach(zcm);
+}
+
+int zcm_executor_detach(zcm_executor_t* ex, zcm_t* zcm)
+{
+    return ex->detach(zcm);
+}
+
+#else
+
+zcm_executor_t* zcm_executor_create(uint32_t numThreads)
+{
+    ZCM_DEBUG("zcm executors are only supported on linux");
+    return nullptr;
+}
+
+void zcm_executor_destroy(zcm_executor_t* ex) {}
+
+int zcm_executor_attach(zcm_executor_t* ex, zcm_t* zcm)
+{
+    return ZCM_EINVALID;
+}
+
+int zcm_executor_detach(zcm_executor_t* ex, zcm_t* zcm)
+{
+    return ZCM_EINVALID;
+}
+
+#endif
@@ -15,6 +15,9 @@ typedef struct SubscriptionUsr SubscriptionUsr;
 struct SubscriptionUsr {
     Internal* I;
     jobject self;
+    // looked up once, at subscribe time, rather than on every message
+    jmethodID method;
+    zcm_sub_t* sub;
 };
 
 // J is the type signature for long
@@ -88,27 +91,75 @@ JNIEXPORT jint JNICALL Java_zcm_zcm_ZCMJNI_publish
     return ret;
 }
 
-static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *_usr)
+/*
+ * Class:     zcm_zcm_ZCMJNI
+ * Method:    publishDirect
+ * Signature: (Ljava/lang/String;Ljava/nio/ByteBuffer;II)I
+ */
+JNIEXPORT jint JNICALL Java_zcm_zcm_ZCMJNI_publishDirect
+(JNIEnv *env, jobject self, jstring channelJ, jobject dataJ, jint offsetJ, jint lenJ)
 {
-    SubscriptionUsr *usr = (SubscriptionUsr *)_usr;
-    Internal *I = (Internal *)usr->I;
-    jobject self = usr->self;
+    Internal *I = getNativePtr(env, self);
+    assert(I);
 
-    bool isAttached = false;
-    JavaVM *vm = I->jvm;
-    JNIEnv *env;
+    // The buffer's memory is handed to zcm_publish as is: no copy, and no pinning
+    uint8_t *data = (*env)->GetDirectBufferAddress(env, dataJ);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, dataJ);
+    if (!data || offsetJ < 0 || lenJ < 0 || (jlong)offsetJ + lenJ > capacity)
+        return ZCM_EINVALID;
+
+    const char *channel = (*env)->GetStringUTFChars(env, channelJ, 0);
+
+    int ret = zcm_publish(I->zcm, channel, data + offsetJ, lenJ);
+
+    (*env)->ReleaseStringUTFChars(env, channelJ, channel);
+
+    return ret;
+}
+
+// The JNIEnv of the calling thread, which is attached to the vm if it wasn't,
+// and then must be detached with detachEnv()
+static JNIEnv *attachEnv(JavaVM *vm, bool *isAttached)
+{
+    JNIEnv *env = NULL;
+    *isAttached = false;
 
     int rc = (*vm)->GetEnv(vm, (void **)&env, JNI_VERSION_1_6);
     if (rc == JNI_EDETACHED) {
         if ((*vm)->AttachCurrentThread(vm, (void **)&env, NULL) != 0) {
             fprintf(stderr, "ZCMJNI: getEnv: Failed to attach Thread in JNI!\n");
+            env = NULL;
         } else {
-            isAttached = true;
+            *isAttached = true;
         }
     } else if (rc == JNI_EVERSION) {
         fprintf(stderr, "ZCMJNI: getEnv: JNI version not supported!\n");
+        env = NULL;
     }
+    return env;
+}
 
+static void detachEnv(JavaVM *vm, bool isAttached)
+{
+    // NOTE: if we attached this thread to dispatch up to java, we need to make sure
+    //       that we detach before returning so the references get freed.
+    //       Forgetting to do this step can cause references to be lost and memory to be leaked,
+    //       ultimately crashing the entire process due to Out-of-Memory.
+    if (isAttached)
+        (*vm)->DetachCurrentThread(vm);
+}
+
+static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *_usr)
+{
+    SubscriptionUsr *usr = (SubscriptionUsr *)_usr;
+    Internal *I = (Internal *)usr->I;
+    jobject self = usr->self;
+
+    bool isAttached;
+    JavaVM *vm = I->jvm;
+    JNIEnv *env = attachEnv(vm, &isAttached);
+    if (!env)
+        return;
 
     jstring channelJ = (*env)->NewStringUTF(env, channel);
 
@@ -118,20 +169,63 @@ static void handler(const zcm_recv_buf_t *rbuf, const char *channel, void *_usr)
     jint offsetJ = 0;
     jint lenJ = rbuf->data_size;
 
-    jclass cls = (*env)->GetObjectClass(env, self);
+    (*env)->CallVoidMethod(env, self, usr->method,
+                           channelJ, dataJ, offsetJ, lenJ);
+
+    (*env)->DeleteLocalRef(env, dataJ);
+    (*env)->DeleteLocalRef(env, channelJ);
+
+    detachEnv(vm, isAttached);
+}
+
+// Hands java a direct ByteBuffer over the received bytes themselves, which is
+// only valid until the call returns
+static void handlerDirect(const zcm_recv_buf_t *rbuf, const char *channel, void *_usr)
+{
+    SubscriptionUsr *usr = (SubscriptionUsr *)_usr;
+    Internal *I = (Internal *)usr->I;
+
+    bool isAttached;
+    JavaVM *vm = I->jvm;
+    JNIEnv *env = attachEnv(vm, &isAttached);
+    if (!env)
+        return;
+
+    jstring channelJ = (*env)->NewStringUTF(env, channel);
+    jobject dataJ = (*env)->NewDirectByteBuffer(env, rbuf->data, rbuf->data_size);
+
+    if (dataJ)
+        (*env)->CallVoidMethod(env, usr->self, usr->method, channelJ, dataJ);
+    else
+        fprintf(stderr, "ZCMJNI: direct ByteBuffers are not supported by this vm!\n");
+
+    if (dataJ)
+        (*env)->DeleteLocalRef(env, dataJ);
+    (*env)->DeleteLocalRef(env, channelJ);
+
+    detachEnv(vm, isAttached);
+}
+
+static SubscriptionUsr *makeSubscriptionUsr(JNIEnv *env, Internal *I, jobject obj,
+                                            const char *method, const char *signature)
+{
+    jclass cls = (*env)->GetObjectClass(env, obj);
     assert(cls);
-    jmethodID receiveMessage = (*env)->GetMethodID(env, cls, "receiveMessage", "(Ljava/lang/String;[BII)V");
-    assert(receiveMessage);
+    jmethodID methodID = (*env)->GetMethodID(env, cls, method, signature);
+    assert(methodID);
 
-    (*env)->CallVoidMethod(env, self, receiveMessage,
-                           channelJ, dataJ, offsetJ, lenJ);
+    SubscriptionUsr* usr = malloc(sizeof(SubscriptionUsr));
+    usr->self = (*env)->NewGlobalRef(env, obj);
+    usr->I = I;
+    usr->method = methodID;
+    usr->sub = NULL;
+    return usr;
+}
 
-    // NOTE: if we attached this thread to dispatch up to java, we need to make sure
-    //       that we detach before returning so the references get freed.
-    //       Forgetting to do this step can cause references to be lost and memory to be leaked,
-    //       ultimately crashing the entire process due to Out-of-Memory.
-    if (isAttached)
-        (*vm)->DetachCurrentThread(vm);
+static void freeSubscriptionUsr(JNIEnv *env, SubscriptionUsr *usr)
+{
+    (*env)->DeleteGlobalRef(env, usr->self);
+    free(usr);
 }
 
 /*
@@ -144,10 +238,8 @@ JNIEXPORT jint JNICALL Java_zcm_zcm_ZCMJNI_subscribe
 {
     Internal *I = getNativePtr(env, self);
     assert(I);
-    // TODO: Should delete usr and call DeleteGlobalRef on an unsubscribe call
-    SubscriptionUsr* usr = malloc(sizeof(SubscriptionUsr));
-    usr->self = (*env)->NewGlobalRef(env, zcmObjJ);
-    usr->I = I;
+    SubscriptionUsr* usr = makeSubscriptionUsr(env, I, zcmObjJ, "receiveMessage",
+                                               "(Ljava/lang/String;[BII)V");
 
     const char *channel = (*env)->GetStringUTFChars(env, channelJ, 0);
 
@@ -157,3 +249,51 @@ JNIEXPORT jint JNICALL Java_zcm_zcm_ZCMJNI_subscribe
     (*env)->ReleaseStringUTFChars(env, channelJ, channel);
     return 0;
 }
+
+/*
+ * Class:     zcm_zcm_ZCMJNI
+ * Method:    subscribeDirect
+ * Signature: (Ljava/lang/String;Lzcm/zcm/ZCM$DirectSubscription;)J
+ */
+JNIEXPORT jlong JNICALL Java_zcm_zcm_ZCMJNI_subscribeDirect
+(JNIEnv *env, jobject self, jstring channelJ, jobject subJ)
+{
+    Internal *I = getNativePtr(env, self);
+    assert(I);
+    SubscriptionUsr* usr = makeSubscriptionUsr(env, I, subJ, "receive",
+                                               "(Ljava/lang/String;Ljava/nio/ByteBuffer;)V");
+
+    const char *channel = (*env)->GetStringUTFChars(env, channelJ, 0);
+
+    usr->sub = zcm_subscribe(I->zcm, channel, handlerDirect, (void*)usr);
+
+    (*env)->ReleaseStringUTFChars(env, channelJ, channel);
+
+    if (!usr->sub) {
+        freeSubscriptionUsr(env, usr);
+        return 0;
+    }
+    // The handle unsubscribeDirect() takes
+    return (jlong)(intptr_t)usr;
+}
+
+/*
+ * Class:     zcm_zcm_ZCMJNI
+ * Method:    unsubscribeDirect
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_zcm_zcm_ZCMJNI_unsubscribeDirect
+(JNIEnv *env, jobject self, jlong handleJ)
+{
+    Internal *I = getNativePtr(env, self);
+    assert(I);
+    SubscriptionUsr *usr = (SubscriptionUsr*)(intptr_t)handleJ;
+    if (!usr)
+        return ZCM_EINVALID;
+
+    // No callback uses 'usr' once zcm_unsubscribe() returns
+    int ret = zcm_unsubscribe(I->zcm, usr->sub);
+    if (ret == ZCM_EOK)
+        freeSubscriptionUsr(env, usr);
+    return ret;
+}
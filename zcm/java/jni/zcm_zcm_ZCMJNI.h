@@ -31,6 +31,30 @@ JNIEXPORT jint JNICALL Java_zcm_zcm_ZCMJNI_publish
 JNIEXPORT jint JNICALL Java_zcm_zcm_ZCMJNI_subscribe
   (JNIEnv *, jobject, jstring, jobject);
 
+/*
+ * Class:     zcm_zcm_ZCMJNI
+ * Method:    publishDirect
+ * Signature: (Ljava/lang/String;Ljava/nio/ByteBuffer;II)I
+ */
+JNIEXPORT jint JNICALL Java_zcm_zcm_ZCMJNI_publishDirect
+  (JNIEnv *, jobject, jstring, jobject, jint, jint);
+
+/*
+ * Class:     zcm_zcm_ZCMJNI
+ * Method:    subscribeDirect
+ * Signature: (Ljava/lang/String;Lzcm/zcm/ZCM$DirectSubscription;)J
+ */
+JNIEXPORT jlong JNICALL Java_zcm_zcm_ZCMJNI_subscribeDirect
+  (JNIEnv *, jobject, jstring, jobject);
+
+/*
+ * Class:     zcm_zcm_ZCMJNI
+ * Method:    unsubscribeDirect
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_zcm_zcm_ZCMJNI_unsubscribeDirect
+  (JNIEnv *, jobject, jlong);
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,7 +16,32 @@ public class ZCM
         ZCMSubscriber lcsub;
     }
 
+    /** The upcall target of a subscribeDirect(): there is one per
+     * subscription, so messages need no dispatching in java. Handed to
+     * unsubscribeDirect() to remove the subscription.
+     **/
+    public static class DirectSubscription
+    {
+        ZCM zcm;
+        ZCMBufferSubscriber sub;
+        long handle; // of the native subscription, 0 once removed
+
+        DirectSubscription(ZCM zcm, ZCMBufferSubscriber sub)
+        {
+            this.zcm = zcm;
+            this.sub = sub;
+        }
+
+        // Called by ZCMJNI, with a buffer over the received data
+        void receive(String channel, ByteBuffer buf)
+        {
+            if (zcm.closed) throw new IllegalStateException();
+            sub.messageReceived(zcm, channel, buf);
+        }
+    }
+
     ArrayList<SubscriptionRecord> subscriptions = new ArrayList<SubscriptionRecord>();
+    ArrayList<DirectSubscription> directSubscriptions = new ArrayList<DirectSubscription>();
     ArrayList<Provider> providers = new ArrayList<Provider>();
 
     HashMap<String,ArrayList<SubscriptionRecord>> subscriptionsMap = new HashMap<String,ArrayList<SubscriptionRecord>>();
@@ -26,6 +51,9 @@ public class ZCM
     static ZCM singleton;
 
     ZCMDataOutputStream encodeBuffer = new ZCMDataOutputStream(new byte[1024]);
+    // Native memory ZCMBufferEncodables are encoded into, kept across
+    // publishes and only ever grown
+    ByteBuffer directBuffer = ByteBuffer.allocateDirect(1024);
     ZCMJNI zcmjni;
 
     /** Create a new ZCM object, connecting to one or more URLs. If
@@ -86,6 +114,21 @@ public class ZCM
         if (this.closed) throw new IllegalStateException();
 
         try {
+            if (e instanceof ZCMBufferEncodable) {
+                ZCMBufferEncodable be = (ZCMBufferEncodable) e;
+                while (true) {
+                    directBuffer.clear();
+                    try {
+                        be.encode(directBuffer);
+                        break;
+                    } catch (BufferOverflowException ex) {
+                        directBuffer = ByteBuffer.allocateDirect(directBuffer.capacity() * 2);
+                    }
+                }
+                zcmjni.publishDirect(channel, directBuffer, 0, directBuffer.position());
+                return;
+            }
+
             encodeBuffer.reset();
 
             e.encode(encodeBuffer);
@@ -96,6 +139,24 @@ public class ZCM
         }
     }
 
+    /** Publish the remaining bytes of a buffer on a channel, bypassing the
+     * ZCM type specification. Direct buffers are published without being
+     * copied. The position of the buffer is left unchanged.
+     **/
+    public synchronized void publish(String channel, ByteBuffer data)
+        throws IOException
+    {
+        if (this.closed) throw new IllegalStateException();
+        if (data.isDirect()) {
+            zcmjni.publishDirect(channel, data, data.position(), data.remaining());
+        } else {
+            // ZCMJNI.publish() does not support offsets into the array
+            byte[] b = new byte[data.remaining()];
+            data.duplicate().get(b);
+            zcmjni.publish(channel, b, 0, b.length);
+        }
+    }
+
     /** Publish raw data on a channel, bypassing the ZCM type
      * specification. If more than one URL was specified when the ZCM
      * object was created, the message will be sent on each.
@@ -215,6 +276,62 @@ public class ZCM
         }
     }
 
+    /** Subscribe 'sub' to all channels whose name matches the regular
+     * expression, handing it each message in a direct buffer over the bytes
+     * received rather than in a copy of them. ZCMBufferEncodables decode
+     * straight out of it, and it must not be used once messageReceived()
+     * returns. Returns the subscription to remove with unsubscribeDirect(),
+     * or null on failure.
+     **/
+    public DirectSubscription subscribeDirect(String regex, ZCMBufferSubscriber sub)
+    {
+        if (this.closed) throw new IllegalStateException();
+        DirectSubscription ds = new DirectSubscription(this, sub);
+        synchronized(this) {
+            ds.handle = zcmjni.subscribeDirect(regex, ds);
+            if (ds.handle == 0) return null;
+            directSubscriptions.add(ds);
+        }
+        return ds;
+    }
+
+    /** Remove a subscription made by subscribeDirect() (or with a message
+     * pool), releasing what the native side holds for it. Once this has
+     * returned, its subscriber is not called again.
+     **/
+    public synchronized void unsubscribeDirect(DirectSubscription ds)
+    {
+        if (this.closed) throw new IllegalStateException();
+        if (ds.handle == 0) return;
+        zcmjni.unsubscribeDirect(ds.handle);
+        ds.handle = 0;
+        directSubscriptions.remove(ds);
+    }
+
+    /** Subscribe 'sub' to all channels whose name matches the regular
+     * expression, handing it each message decoded straight out of the
+     * buffer it was received in, into a message of 'pool'. Messages that
+     * fail to decode (e.g. of another type) are dropped. Returns the
+     * subscription to remove with unsubscribeDirect(), or null on failure.
+     **/
+    public <T extends ZCMBufferEncodable> DirectSubscription
+        subscribe(String regex, final ZCMMessagePool<T> pool, final ZCMMessageSubscriber<T> sub)
+    {
+        return subscribeDirect(regex, new ZCMBufferSubscriber() {
+            public void messageReceived(ZCM zcm, String channel, ByteBuffer buf)
+            {
+                T msg;
+                try {
+                    msg = pool.decode(buf);
+                } catch (IOException ex) {
+                    System.err.println("ZCM: dropping a message on " + channel + ": " + ex);
+                    return;
+                }
+                sub.messageReceived(zcm, channel, msg);
+            }
+        });
+    }
+
     /** A convenience function that subscribes to all ZCM channels. **/
     public synchronized void subscribeAll(ZCMSubscriber sub)
     {
@@ -232,6 +349,11 @@ public class ZCM
             p.close();
         }
         providers = null;
+        for (DirectSubscription ds : directSubscriptions) {
+            zcmjni.unsubscribeDirect(ds.handle);
+            ds.handle = 0;
+        }
+        directSubscriptions.clear();
         this.closed = true;
     }
 
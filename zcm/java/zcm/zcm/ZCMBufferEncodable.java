@@ -0,0 +1,41 @@
+package zcm.zcm;
+
+import java.io.*;
+import java.nio.*;
+
+/** A ZCMEncodable that can also be encoded straight into, and decoded
+ * straight out of, a ByteBuffer, without going through a byte[].
+ * zcm-gen generated types implement it.
+ **/
+public interface ZCMBufferEncodable extends ZCMEncodable
+{
+    /** ZCMBufferEncodables also have a constructor that takes a
+     * ByteBuffer. **/
+
+    /**
+     * Invoked by ZCM. Encodes starting at the position of the buffer, which
+     * is left after the message.
+     * @param buf the buffer to encode into, whose order is set to big endian.
+     * @throws BufferOverflowException if the message doesn't fit.
+     */
+    public void encode(ByteBuffer buf);
+
+    /** Encode the data without the magic header. Most users will
+     * never use this function.
+     **/
+    public void _encodeRecursive(ByteBuffer buf);
+
+    /**
+     * Decodes a message into this object, reusing its arrays when they're
+     * the sizes of the ones decoded, so that decoding messages of the same
+     * shape over and over allocates nothing (but their strings).
+     * @param buf the buffer to decode from, whose order is set to big endian.
+     * @throws IOException if the message is of another type or too short.
+     */
+    public void decodeFrom(ByteBuffer buf) throws IOException;
+
+    /** Decode the data without the magic header. Most users will
+     * never use this function.
+     **/
+    public void _decodeRecursive(ByteBuffer buf) throws IOException;
+}
@@ -0,0 +1,20 @@
+package zcm.zcm;
+
+import java.nio.*;
+
+/** A class which listens for messages on a particular channel, and reads them
+ * straight out of the buffer they were received in. **/
+public interface ZCMBufferSubscriber
+{
+    /**
+     * Invoked by ZCM when a message is received.
+     *
+     * This method is invoked from the ZCM thread.
+     *
+     * @param zcm the ZCM instance that received the message.
+     * @param channel the channel on which the message was received.
+     * @param buf a direct buffer over the message contents, which are not
+     *        copied: it must not be used after this method returns.
+     */
+    public void messageReceived(ZCM zcm, String channel, ByteBuffer buf);
+}
@@ -1,5 +1,6 @@
 package zcm.zcm;
 import java.io.IOException;
+import java.nio.ByteBuffer;
 
 class ZCMJNI
 {
@@ -24,4 +25,17 @@ class ZCMJNI
 
     // This method registers the ZCM object for an upcall to receiveMessage()
     public native int subscribe(String channel, ZCM zcm);
+
+    // This method publishes 'length' bytes of the direct buffer 'data', from
+    // 'offset', on the requested channel, without copying them
+    public native int publishDirect(String channel, ByteBuffer data, int offset, int length);
+
+    // This method registers 'sub' for an upcall to receive(), with a direct
+    // buffer over the received data. Returns the handle to unsubscribe it
+    // with, or 0 on failure
+    public native long subscribeDirect(String channel, ZCM.DirectSubscription sub);
+
+    // This method removes the subscription 'handle', from subscribeDirect(),
+    // and releases what it holds
+    public native int unsubscribeDirect(long handle);
 }
@@ -0,0 +1,66 @@
+package zcm.zcm;
+
+import java.io.*;
+import java.nio.*;
+import java.util.*;
+
+/**
+ * Objects of one ZCMBufferEncodable type, decoded into over and over.
+ * <p>
+ * Messages are taken out of the pool to be decoded into, and handed back with
+ * release() once they're done with. As decodeFrom() reuses the arrays of a
+ * message, a subscriber that releases each message it's given makes the
+ * decoding of a channel allocate nothing in steady state. Messages that
+ * aren't released are simply left to the garbage collector.
+ */
+public class ZCMMessagePool<T extends ZCMBufferEncodable>
+{
+    Class<T> cls;
+    int maxFree;
+    ArrayList<T> free = new ArrayList<T>();
+
+    /**
+     * @param cls the type of the messages.
+     * @param maxFree how many released messages are kept at most.
+     */
+    public ZCMMessagePool(Class<T> cls, int maxFree)
+    {
+        this.cls = cls;
+        this.maxFree = maxFree;
+    }
+
+    /** A message released to the pool, or a new one if there is none. **/
+    public synchronized T get()
+    {
+        if (free.size() > 0)
+            return free.remove(free.size() - 1);
+
+        try {
+            return cls.newInstance();
+        } catch (InstantiationException ex) {
+            throw new IllegalArgumentException(cls + " can't be instantiated", ex);
+        } catch (IllegalAccessException ex) {
+            throw new IllegalArgumentException(cls + " can't be instantiated", ex);
+        }
+    }
+
+    /** Hands 'msg' back to the pool, to be decoded into again. **/
+    public synchronized void release(T msg)
+    {
+        if (free.size() < maxFree)
+            free.add(msg);
+    }
+
+    /** Decodes the message in 'buf' into a message of the pool. **/
+    public T decode(ByteBuffer buf) throws IOException
+    {
+        T msg = get();
+        try {
+            msg.decodeFrom(buf);
+        } catch (IOException ex) {
+            release(msg);
+            throw ex;
+        }
+        return msg;
+    }
+}
@@ -0,0 +1,18 @@
+package zcm.zcm;
+
+/** A class which listens for messages of one type on a particular channel,
+ * decoded for it out of a ZCMMessagePool. **/
+public interface ZCMMessageSubscriber<T extends ZCMBufferEncodable>
+{
+    /**
+     * Invoked by ZCM when a message is received.
+     *
+     * This method is invoked from the ZCM thread.
+     *
+     * @param zcm the ZCM instance that received the message.
+     * @param channel the channel on which the message was received.
+     * @param msg the message, which is the subscriber's: it may be kept, or
+     *        handed back to the pool it came from to be decoded into again.
+     */
+    public void messageReceived(ZCM zcm, String channel, T msg);
+}
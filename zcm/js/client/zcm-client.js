@@ -4,8 +4,24 @@ document.head.appendChild(imported);
 
 var zcm = (function(){
 
-    function create()
+    // Frames of the binary WebSocket, see zcm/js/node/index.js
+    var FRAME_BATCH   = 1;
+    var FRAME_CHANNEL = 2;
+    var FRAME_PUBLISH = 3;
+
+    /**
+     * Connects to the zcm server of the page
+     * @param {object} opts - optional. With "binary" set, subscriptions have their messages
+     *                        sent as the bytes received and decoded here, and messages are
+     *                        published the same way, over a WebSocket of their own: much
+     *                        cheaper for both ends on busy channels. This takes the codecs
+     *                        of the types, from the zcmtypes.js generated by zcm-gen:
+     *                        "zcmtypes" if given, or else window.zcmtypes, and the
+     *                        server's "binaryPath" if it isn't the default
+     */
+    function create(opts)
     {
+        opts = opts || {};
         var socket = io();
 
         var subscriptions = {};
@@ -13,14 +29,93 @@ var zcm = (function(){
         // key is zcmtype name
         var zcmtypes = null;
 
-        socket.on('server-to-client', function (data) {
-            var subId = data.subId;
-            if (subId in subscriptions)
-                subscriptions[subId].callback(data.channel, data.msg);
+        // messages dropped by the server since we connected
+        var dropped = 0;
+
+        // With opts.binary: the codecs by type hash, and the WebSocket once open,
+        // with the names of the channels the server numbered
+        var codecs = null;
+        var binary = null;
+        var channels = {};
+        var utf8Decoder = new TextDecoder();
+        var utf8Encoder = new TextEncoder();
+
+        if (opts.binary) {
+            codecs = {};
+            // Note: recursive to handle packages
+            (function addCodecs(types) {
+                for (var name in types) {
+                    var t = types[name];
+                    if (typeof t == 'function' && t.__get_hash_recursive)
+                        codecs[t.__get_hash_recursive().toString()] = t;
+                    else if (t && typeof t == 'object')
+                        addCodecs(t);
+                }
+            })(opts.zcmtypes || window.zcmtypes || {});
+        }
+
+        function dispatch(subId, channel, data)
+        {
+            var sub = subscriptions[subId];
+            if (!sub) return;
+            if (!sub.codec) {
+                sub.callback(channel, data);
+                return;
+            }
+            var msg = sub.codec.decode(data);
+            if (msg != null) sub.callback(channel, msg);
+        }
+
+        socket.on('server-to-client-batch', function (batch) {
+            dropped += batch.dropped;
+            for (var i = 0; i < batch.msgs.length; ++i) {
+                var data = batch.msgs[i];
+                var sub = subscriptions[data.subId];
+                // Binary subscriptions are sent raw here until the WebSocket is open
+                var msg = sub && sub.binary ? new Uint8Array(data.msg) : data.msg;
+                dispatch(data.subId, data.channel, msg);
+            }
         });
 
         socket.on('zcmtypes', function (data) { zcmtypes = data; });
 
+        function onBinaryFrame(ev)
+        {
+            var view = new DataView(ev.data);
+            var kind = view.getUint8(0);
+            if (kind == FRAME_CHANNEL) {
+                channels[view.getUint16(1)] = utf8Decoder.decode(new Uint8Array(ev.data, 3));
+                return;
+            }
+            if (kind != FRAME_BATCH) return;
+
+            dropped += view.getUint32(1);
+            var off = 5;
+            while (off + 10 <= view.byteLength) {
+                var subId = view.getUint32(off);
+                var channel = channels[view.getUint16(off + 4)];
+                var len = view.getUint32(off + 6);
+                off += 10;
+                // Note: typed arrays decoded with --ntypedarrays view the batch
+                dispatch(subId, channel, new Uint8Array(ev.data, off, len));
+                off += len;
+            }
+        }
+
+        socket.on('binary-token', function (token) {
+            if (!opts.binary || binary) return;
+            var proto = location.protocol == 'https:' ? 'wss://' : 'ws://';
+            var ws = new WebSocket(proto + location.host + (opts.binaryPath || '/zcm-binary') +
+                                   '?token=' + token);
+            ws.binaryType = 'arraybuffer';
+            ws.onopen = function () { binary = ws; };
+            ws.onmessage = onBinaryFrame;
+            ws.onclose = function () {
+                if (binary == ws) binary = null;
+                channels = {};
+            };
+        });
+
         function getZcmtypes(key)
         { return key ? JSON.parse(JSON.stringify(zcmtypes[key])) : zcmtypes; }
 
@@ -32,8 +127,20 @@ var zcm = (function(){
          * @param {zcmtype} msg - a decoded zcmtype (from the generated types in zcmtypes.js)
          */
         function publish(channel, msg) {
-            socket.emit('client-to-server', { channel : channel,
-                                              msg     : msg });
+            var codec = codecs && binary && codecs[msg.__hash];
+            if (!codec) {
+                socket.emit('client-to-server', { channel : channel,
+                                                  msg     : msg });
+                return;
+            }
+            var name = utf8Encoder.encode(channel);
+            var data = codec.encode(msg);
+            var frame = new Uint8Array(3 + name.length + data.length);
+            frame[0] = FRAME_PUBLISH;
+            new DataView(frame.buffer).setUint16(1, name.length);
+            frame.set(name, 3);
+            frame.set(data, 3 + name.length);
+            binary.send(frame);
         }
 
         /**
@@ -43,13 +150,28 @@ var zcm = (function(){
          *                        type from zcmtypes.js). Passing null yields an untyped
          *                        subscription.
          * @param {dispatchDecodedCallback} handler - handler for received messages
+         * @param {object} opts - optional. With "conflate" set, only the latest message
+         *                        received between two of the server's batches is handled,
+         *                        and with "maxRateHz" set, the latest at most that often.
+         *                        With "binary" set to false, the messages come decoded by the
+         *                        server even if the client was created with "binary", where
+         *                        untyped subscriptions get the messages as Uint8Arrays
          */
-        function subscribe(channel, type, handler, successCb) {
-            socket.emit("subscribe", { channel : channel, type : type },
+        function subscribe(channel, type, handler, successCb, opts) {
+            var codec = codecs && type ? codecs[type.__hash] : null;
+            if (codecs && type && !codec)
+                console.log("No codec for the type of " + channel + ", decoded by the server");
+            var isBinary = !!codecs && (!type || !!codec) && !(opts && opts.binary === false);
+            var subOpts = {};
+            for (var k in opts) subOpts[k] = opts[k];
+            subOpts.binary = isBinary;
+            socket.emit("subscribe", { channel : channel, type : type, opts : subOpts },
                         function (subId) {
                             subscriptions[subId] = { callback : handler,
                                                      channel  : channel,
-                                                     type     : type };
+                                                     type     : type,
+                                                     binary   : isBinary,
+                                                     codec    : isBinary ? codec : null };
                             if (successCb) successCb(subId);
                         });
         }
@@ -104,6 +226,15 @@ var zcm = (function(){
             socket.emit('setQueueSize', sz, cb);
         }
 
+        /**
+         * Returns the number of messages the server dropped, rather than send them to a
+         * client that wasn't keeping up, or that were conflated
+         */
+        function getDropped()
+        {
+            return dropped;
+        }
+
         return {
             publish:        publish,
             subscribe:      subscribe,
@@ -112,6 +243,7 @@ var zcm = (function(){
             pause:          pause,
             resume:         resume,
             setQueueSize:   setQueueSize,
+            getDropped:     getDropped,
             getZcmtypes:    getZcmtypes,
         };
     }
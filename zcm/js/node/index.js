@@ -21,6 +21,7 @@ var recvBuf = StructType({
     zcm:   voidRef,
     data:  charRef,
     len:   ref.types.uint32,
+    hash:  ref.types.uint32,
 });
 var recvBufRef = ref.refType(recvBuf);
 
@@ -81,8 +82,10 @@ exports.ZCM_NUM_RETURN_CODES = ZCM_NUM_RETURN_CODES;
 /**
  * Creates a dispatch function that can interface with the ffi library
  * @param {dispatchRawCallback} cb - the js callback function to be linked into the ffi library
+ * @param {boolean} copy - whether cb is given a copy of the data, rather than a Buffer over
+ *                         zcm's own memory, which is only valid until cb returns
  */
-function makeDispatcher(cb)
+function makeDispatcher(cb, copy)
 {
     return function (rbuf, channel, usr) {
         var pointerSize = ref.coerceType('size_t').alignment;
@@ -108,7 +111,7 @@ function makeDispatcher(cb)
         offset += int32Size;
 
         var dataBuf = ref.reinterpret(data, len);
-        cb(channel, new Buffer(dataBuf));
+        cb(channel, copy ? Buffer.from(dataBuf) : dataBuf);
     }
 }
 
@@ -172,12 +175,14 @@ function zcm(zcmtypes, zcmurl)
             //       the necessary functions, so we need to look up our complete class here
             var hash = bigint.isInstance(_type.__hash) ?  _type.__hash.toString() : _type.__hash;
             var type = zcmtypeHashMap[hash];
-            var sub = subscribe_raw(channel, function (channel, data) {
+            // Note: the data is copied, as types generated with --ntypedarrays decode
+            //       arrays into views of it
+            subscribe_dispatch(channel, makeDispatcher(function (channel, data) {
                 var msg = type.decode(data)
                 if (msg != null) cb(channel, msg);
-            }, successCb);
+            }, true), successCb);
         } else {
-            var sub = subscribe_raw(channel, cb, successCb);
+            subscribe_raw(channel, cb, successCb);
         }
     }
 
@@ -188,9 +193,13 @@ function zcm(zcmtypes, zcmurl)
      * @param {successCb} successCb - callback for successful subscription
      */
     function subscribe_raw(channel, cb, successCb)
+    {
+        subscribe_dispatch(channel, makeDispatcher(cb, true), successCb);
+    }
+
+    function subscribe_dispatch(channel, dispatcher, successCb)
     {
         if (!successCb) assert(false, "subcribe requires a success callback to be specified");
-        var dispatcher = makeDispatcher(cb);
         var funcPtr = ffi.Callback('void', [recvBufRef, 'string', 'pointer'], dispatcher);
         setTimeout(function sub() {
             var subs = libzcm.zcm_try_subscribe(z, channel, funcPtr, null);
@@ -294,6 +303,7 @@ function zcm(zcmtypes, zcmurl)
 
     return {
         publish:        publish,
+        publish_raw:    publish_raw,
         subscribe:      subscribe,
         unsubscribe:    unsubscribe,
         flush:          flush,
@@ -305,27 +315,238 @@ function zcm(zcmtypes, zcmurl)
     };
 }
 
-function zcm_create(zcmtypes, zcmurl, http)
+/**
+ * Default options of the socket.io bridge, see zcm_create()
+ */
+var bridgeDefaults = {
+    // Messages are sent to each browser in batches, at most this often
+    flushIntervalMs:   20,
+    // Messages a subscription queues between batches, beyond which the oldest are dropped
+    maxQueuedMsgs:     100,
+    // Batches are held back while a browser has more than this many packets left to send
+    maxPendingPackets: 8,
+    // Path of the binary WebSocket browsers can also take messages over (see below), or
+    // null for socket.io only
+    binaryPath:        '/zcm-binary',
+    // Binary batches are held back while a browser has more than this many bytes left
+    // to receive
+    maxPendingBytes:   1 << 20,
+};
+
+/**
+ * Subscriptions made with the "binary" option (see zcm-client.js) get their messages as
+ * the bytes received, for the browser to decode, rather than as objects the server
+ * decoded. They come over a plain WebSocket at binaryPath once the browser opened it,
+ * with the token it was given ('binary-token'): "<binaryPath>?token=<token>". All of its
+ * frames are binary, their integers big endian:
+ *
+ *   server to browser, the message batches:
+ *     [u8 BATCH][u32 dropped] then per message [u32 subId][u16 channelId][u32 len][len bytes]
+ *   server to browser, before the first message of each channel:
+ *     [u8 CHANNEL][u16 channelId][utf8 name]
+ *   browser to server, messages to publish:
+ *     [u8 PUBLISH][u16 name length][utf8 name][encoded message]
+ *
+ * Until the WebSocket is open, their messages come in socket.io batches, still as bytes
+ */
+var FRAME_BATCH   = 1;
+var FRAME_CHANNEL = 2;
+var FRAME_PUBLISH = 3;
+var MAX_CHANNEL_IDS = 65536;
+
+/**
+ * Creates a zcm instance, and optionally serves it to browsers (see zcm-client.js)
+ * @param {object} zcmtypes - the generated zcmtypes.js
+ * @param {string} zcmurl - the zcm url, or null for the default
+ * @param {http.Server} http - server to attach socket.io to, if browsers are to be served
+ * @param {object} opts - overrides of bridgeDefaults
+ */
+function zcm_create(zcmtypes, zcmurl, http, opts)
 {
     var ret = zcm(zcmtypes, zcmurl);
 
     if (http) {
         var io = require('socket.io')(http);
 
+        var o = {};
+        for (var k in bridgeDefaults)
+            o[k] = (opts && k in opts) ? opts[k] : bridgeDefaults[k];
+
+        // The connections binary WebSockets attach to, by token
+        var binaryClients = {};
+        if (o.binaryPath) {
+            var WebSocket = require('ws');
+            var wss = new WebSocket.Server({ server: http, path: o.binaryPath });
+            wss.on('connection', function (ws, req) {
+                // Older ws versions only give the request as ws.upgradeReq
+                var url = (req || ws.upgradeReq).url;
+                var token = /[?&]token=([0-9a-f]+)/.exec(url);
+                var client = token && binaryClients[token[1]];
+                if (!client) {
+                    ws.close();
+                    return;
+                }
+                client(ws);
+            });
+        }
+
         io.on('connection', function (socket) {
             var subscriptions = {};
             var nextSub = 0;
+
+            // Messages received for each subscription since the last batch, and how to
+            // queue them: subscriptions that conflate only keep the latest message, and
+            // those that have a max rate are also sent no more often than that
+            var queues = {};
+            var flushTimer = null;
+            var dropped = 0;
+
+            // The binary WebSocket, and the ids of the channels it was told of
+            var binary = null;
+            var channelIds = {};
+            var nextChannelId = 0;
+            var token = require('crypto').randomBytes(16).toString('hex');
+            if (o.binaryPath) {
+                binaryClients[token] = function (ws) {
+                    if (binary) binary.close();
+                    binary = ws;
+                    channelIds = {};
+                    nextChannelId = 0;
+                    ws.on('message', function (data) {
+                        if (!Buffer.isBuffer(data)) data = Buffer.from(data);
+                        if (data.length < 3 || data[0] != FRAME_PUBLISH) return;
+                        var len = data.readUInt16BE(1);
+                        if (data.length < 3 + len) return;
+                        ret.publish_raw(data.toString('utf8', 3, 3 + len), data.slice(3 + len));
+                    });
+                    ws.on('close', function () {
+                        if (binary == ws) binary = null;
+                    });
+                    ws.on('error', function () {});
+                };
+            }
+
+            // Sends the messages of binary subscriptions, and the channels they are on
+            function sendBinary(msgs)
+            {
+                var size = 5;
+                for (var i = 0; i < msgs.length; ++i) {
+                    var m = msgs[i];
+                    if (!(m.channel in channelIds)) {
+                        if (nextChannelId == MAX_CHANNEL_IDS) {
+                            // Only browsers following that many channels start over
+                            channelIds = {};
+                            nextChannelId = 0;
+                        }
+                        var name = Buffer.from(m.channel, 'utf8');
+                        var frame = Buffer.allocUnsafe(3 + name.length);
+                        frame.writeUInt8(FRAME_CHANNEL, 0);
+                        frame.writeUInt16BE(nextChannelId, 1);
+                        name.copy(frame, 3);
+                        binary.send(frame, { binary: true });
+                        channelIds[m.channel] = nextChannelId++;
+                    }
+                    size += 10 + m.msg.length;
+                }
+
+                var buf = Buffer.allocUnsafe(size);
+                buf.writeUInt8(FRAME_BATCH, 0);
+                buf.writeUInt32BE(dropped, 1);
+                var off = 5;
+                for (var i = 0; i < msgs.length; ++i) {
+                    var m = msgs[i];
+                    buf.writeUInt32BE(m.subId, off);
+                    buf.writeUInt16BE(channelIds[m.channel], off + 4);
+                    buf.writeUInt32BE(m.msg.length, off + 6);
+                    m.msg.copy(buf, off + 10);
+                    off += 10 + m.msg.length;
+                }
+                binary.send(buf, { binary: true });
+            }
+
+            function scheduleFlush(ms)
+            {
+                if (flushTimer == null) flushTimer = setTimeout(flush, ms);
+            }
+
+            function enqueue(subId, channel, msg)
+            {
+                var q = queues[subId];
+                if (!q) return;
+                var m = { channel: channel, msg: msg, subId: subId };
+                if (q.conflate) {
+                    if (q.msgs.length > 0) ++dropped;
+                    q.msgs = [m];
+                } else {
+                    q.msgs.push(m);
+                    if (q.msgs.length > o.maxQueuedMsgs) {
+                        q.msgs.shift();
+                        ++dropped;
+                    }
+                }
+                scheduleFlush(o.flushIntervalMs);
+            }
+
+            function flush()
+            {
+                flushTimer = null;
+
+                // Shed load rather than queue up in socket.io while the browser can't keep
+                // up: what's held here is conflated or bounded
+                var conn = socket.conn;
+                if ((conn && conn.writeBuffer && conn.writeBuffer.length > o.maxPendingPackets) ||
+                    (binary && binary.bufferedAmount > o.maxPendingBytes)) {
+                    scheduleFlush(o.flushIntervalMs);
+                    return;
+                }
+
+                var now = Date.now();
+                var batch = [];
+                var binaryBatch = [];
+                var waitMs = -1;
+                for (var subId in queues) {
+                    var q = queues[subId];
+                    if (q.msgs.length == 0) continue;
+                    var left = q.lastSent + q.minIntervalMs - now;
+                    if (left > 0) {
+                        if (waitMs < 0 || left < waitMs) waitMs = left;
+                        continue;
+                    }
+                    var to = q.binary && binary ? binaryBatch : batch;
+                    for (var i = 0; i < q.msgs.length; ++i) to.push(q.msgs[i]);
+                    q.msgs = [];
+                    q.lastSent = now;
+                }
+
+                if (binaryBatch.length > 0) {
+                    sendBinary(binaryBatch);
+                    dropped = 0;
+                }
+                if (batch.length > 0) {
+                    socket.emit('server-to-client-batch', { msgs: batch, dropped: dropped });
+                    dropped = 0;
+                }
+                if (waitMs >= 0) scheduleFlush(Math.max(waitMs, o.flushIntervalMs));
+            }
+
             socket.on('client-to-server', function (data) {
                 ret.publish(data.channel, data.msg);
             });
             socket.on('subscribe', function (data, returnSubscription) {
                 var subId = nextSub++;
-                ret.subscribe(data.channel, data.type, function (channel, msg) {
-                    socket.emit('server-to-client', {
-                        channel: channel,
-                        msg: msg,
-                        subId: subId
-                    });
+                var subOpts = data.opts || {};
+                var maxRateHz = subOpts.maxRateHz || 0;
+                var binarySub = !!subOpts.binary && !!o.binaryPath;
+                queues[subId] = {
+                    msgs:          [],
+                    conflate:      !!subOpts.conflate || maxRateHz > 0,
+                    minIntervalMs: maxRateHz > 0 ? 1000 / maxRateHz : 0,
+                    lastSent:      0,
+                    binary:        binarySub,
+                };
+                // Binary subscriptions are left for the browser to decode
+                ret.subscribe(data.channel, binarySub ? null : data.type, function (channel, msg) {
+                    enqueue(subId, channel, msg);
                 }, function successCb (subscription) {
                     subscriptions[subId] = subscription;
                     returnSubscription(subId);
@@ -339,6 +560,7 @@ function zcm_create(zcmtypes, zcmurl, http)
                 ret.unsubscribe(subscriptions[subId],
                                 function _successCb() {
                                     delete subscriptions[subId];
+                                    delete queues[subId];
                                     if (successCb) successCb();
                                 });
             });
@@ -361,9 +583,18 @@ function zcm_create(zcmtypes, zcmurl, http)
                     ret.unsubscribe(subscriptions[subId]);
                     delete subscriptions[subId];
                 }
+                queues = {};
+                if (flushTimer != null) {
+                    clearTimeout(flushTimer);
+                    flushTimer = null;
+                }
                 nextSub = 0;
+                delete binaryClients[token];
+                if (binary) binary.close();
+                binary = null;
             });
             socket.emit('zcmtypes', zcmtypes.getZcmtypes());
+            if (o.binaryPath) socket.emit('binary-token', token);
         });
     }
 
@@ -16,6 +16,12 @@
 #include <functional>
 #include <tuple>
 #include <type_traits>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <cassert>
+#include <array>
 
 #include <zcm/zcm-cpp.hpp>
 #include <zcm/util/Filter.hpp>
@@ -47,12 +53,37 @@ class Tracker
   protected:
     virtual uint64_t getMsgUtime(const T* msg) const { return UINT64_MAX; }
 
-    // The returned value must be "new" in all cases
+    // The returned value must be "new" in all cases. Used by the get()
+    // functions returning pointers: trackers that interpolate should override
+    // the version below as well, for get(utime, out)
     virtual T* interpolate(uint64_t utimeTarget,
                            const T* A, uint64_t utimeA,
                            const T* B, uint64_t utimeB) const
     {
-        return utimeTarget - utimeA < utimeB - utimeTarget ? new T(*A) : new T(*B);
+        T* ret = new T();
+        interpolate(utimeTarget, A, utimeA, B, utimeB, *ret);
+        return ret;
+    }
+
+    // Same, writing into 'out'. Used by get(utime, out), with the buffer locked
+    virtual void interpolate(uint64_t utimeTarget,
+                             const T* A, uint64_t utimeA,
+                             const T* B, uint64_t utimeB, T& out) const
+    {
+        out = utimeTarget - utimeA < utimeB - utimeTarget ? *A : *B;
+    }
+
+    // Same, for the 'n' queries of a batch get() that fall between two
+    // messages, writing into *out[i]. Calls the version above for each one by
+    // default: trackers of plain types can override it with a single loop
+    // over the queries, that the compiler can vectorize
+    virtual void interpolateBatch(size_t n, const uint64_t* utimeTarget,
+                                  const T* const* A, const uint64_t* utimeA,
+                                  const T* const* B, const uint64_t* utimeB,
+                                  T* const* out) const
+    {
+        for (size_t i = 0; i < n; ++i)
+            interpolate(utimeTarget[i], A[i], utimeA[i], B[i], utimeB[i], *out[i]);
     }
 
   private:
@@ -81,17 +112,31 @@ class Tracker
 
     template<typename F>
     struct MsgWithUtime<F, true> : public F {
+        MsgWithUtime() {}
         MsgWithUtime(const F& msg, uint64_t utime) : F(msg) {}
         MsgWithUtime(const MsgWithUtime& msg) : F(msg) {}
+        // So that rotating and compacting the buffer moves messages instead of copying them
+        MsgWithUtime(MsgWithUtime&& msg)
+            noexcept(std::is_nothrow_move_constructible<F>::value) : F(std::move(msg)) {}
+        MsgWithUtime& operator=(const MsgWithUtime&) = default;
+        MsgWithUtime& operator=(MsgWithUtime&&) = default;
         virtual ~MsgWithUtime() {}
+        void set(const F& msg, uint64_t utime) { F::operator=(msg); }
     };
 
     template<typename F>
     struct MsgWithUtime<F, false> : public F {
-        uint64_t utime;
+        uint64_t utime = 0;
+        MsgWithUtime() {}
         MsgWithUtime(const F& msg, uint64_t utime) : F(msg), utime(utime) {}
         MsgWithUtime(const MsgWithUtime& msg) : F(msg), utime(msg.utime) {}
+        MsgWithUtime(MsgWithUtime&& msg)
+            noexcept(std::is_nothrow_move_constructible<F>::value)
+            : F(std::move(msg)), utime(msg.utime) {}
+        MsgWithUtime& operator=(const MsgWithUtime&) = default;
+        MsgWithUtime& operator=(MsgWithUtime&&) = default;
         virtual ~MsgWithUtime() {}
+        void set(const F& msg, uint64_t utime) { F::operator=(msg); this->utime = utime; }
     };
 
     typedef MsgWithUtime<T, hasUtime<T>::present> MsgType;
@@ -103,11 +148,16 @@ class Tracker
     // This is only to be used for the callback thread func
     bool done = false;
 
-  public:
-    typedef std::deque<MsgType*> ContainerType;
-
-  private:
-    ContainerType buf;
+    // The buffer is a ring of up to bufMax messages, oldest first, along with
+    // their utimes. Slots are allocated as the buffer first fills up, then
+    // reused: copying a message into a slot reuses the memory of the message
+    // that was there. 'descents' counts the messages with an earlier utime
+    // than the one before them: searches bisect the buffer when there are none
+    std::vector<MsgType> slots;
+    std::vector<uint64_t> utimes;
+    size_t head = 0;
+    size_t count = 0;
+    size_t descents = 0;
     uint64_t lastHostUtime = UINT64_MAX;
     size_t bufMax;
     typedef std::recursive_mutex BufLockType;
@@ -123,6 +173,121 @@ class Tracker
     Filter hzFilter;
     Filter jitterFilter;
 
+    inline size_t at(size_t i) const { return (head + i) % slots.size(); }
+
+    void pushBack(const T& msg, uint64_t hostUtime)
+    {
+        if (count == bufMax) popFront();
+        if (count == slots.size()) {
+            std::rotate(slots.begin(), slots.begin() + head, slots.end());
+            std::rotate(utimes.begin(), utimes.begin() + head, utimes.end());
+            head = 0;
+            slots.emplace_back();
+            utimes.push_back(0);
+        }
+        size_t i = at(count);
+        slots[i].set(msg, hostUtime);
+        utimes[i] = getMsgUtime(&slots[i]);
+        if (count > 0 && utimes[i] < utimes[at(count - 1)]) ++descents;
+        ++count;
+    }
+
+    void popFront()
+    {
+        if (count > 1 && utimes[at(1)] < utimes[head]) --descents;
+        head = (head + 1) % slots.size();
+        --count;
+    }
+
+    // Removes the messages for which remove(i) is true, keeping the others in
+    // order
+    template <typename Pred>
+    size_t removeIf(Pred remove)
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (remove(i)) continue;
+            if (kept != i) {
+                slots[at(kept)] = std::move(slots[at(i)]);
+                utimes[at(kept)] = utimes[at(i)];
+            }
+            ++kept;
+        }
+        size_t ret = count - kept;
+        count = kept;
+        descents = 0;
+        for (size_t i = 1; i < count; ++i)
+            if (utimes[at(i)] < utimes[at(i - 1)]) ++descents;
+        return ret;
+    }
+
+    // First message with a utime of at least 'utime', when sorted
+    size_t lowerBound(uint64_t utime) const
+    {
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (utimes[at(mid)] < utime) lo = mid + 1;
+            else                         hi = mid;
+        }
+        return lo;
+    }
+
+    // Calls f(slot) for the messages with a utime in [A,B], in order
+    template <typename F>
+    void forRange(uint64_t utimeA, uint64_t utimeB, F f) const
+    {
+        if (descents == 0) {
+            for (size_t i = lowerBound(utimeA); i < count && utimes[at(i)] <= utimeB; ++i)
+                f(at(i));
+        } else {
+            for (size_t i = 0; i < count; ++i)
+                if (utimeA <= utimes[at(i)] && utimes[at(i)] <= utimeB) f(at(i));
+        }
+    }
+
+    // The messages bracketing 'utime' within maxTimeErr_us, 'count' if none.
+    // Of messages with the same utime, the oldest is used
+    void bracket(uint64_t utime, size_t& i0, size_t& i1) const
+    {
+        i0 = i1 = count;
+        if (descents == 0) {
+            i1 = lowerBound(utime);
+            if (i1 < count && utimes[at(i1)] == utime) i0 = i1;
+            else if (i1 > 0) i0 = lowerBound(utimes[at(i1 - 1)]);
+        } else {
+            // The reason why we do a linear search here is to support the
+            // ability to skip around in logs, with non-monotonically
+            // increasing utimes
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t mUtime = utimes[at(i)];
+                if (mUtime <= utime && (i0 == count || mUtime > utimes[at(i0)])) i0 = i;
+                if (mUtime >= utime && (i1 == count || mUtime < utimes[at(i1)])) i1 = i;
+            }
+        }
+        dropFar(utime, i0, i1);
+    }
+
+    // Same as bracket() when sorted, for a utime no earlier than the one
+    // 'cursor' was last used for: moves 'cursor' to the first message with a
+    // utime of at least 'utime'
+    void bracketFrom(uint64_t utime, size_t& cursor, size_t& i0, size_t& i1) const
+    {
+        while (cursor < count && utimes[at(cursor)] < utime) ++cursor;
+        i0 = i1 = cursor;
+        if (i1 == count || utimes[at(i1)] != utime) {
+            if (i1 == 0) i0 = count;
+            else for (i0 = i1 - 1; i0 > 0 && utimes[at(i0 - 1)] == utimes[at(i0)]; --i0);
+        }
+        dropFar(utime, i0, i1);
+    }
+
+    void dropFar(uint64_t utime, size_t& i0, size_t& i1) const
+    {
+        if (i0 != count && utime - utimes[at(i0)] > maxTimeErr_us) i0 = count;
+        if (i1 != count && utimes[at(i1)] - utime > maxTimeErr_us) i1 = count;
+    }
+
     void callbackThreadFunc()
     {
         std::unique_lock<BufLockType> lk(callbackLock);
@@ -143,25 +308,83 @@ class Tracker
 
     // Note: Be careful of asynchronous iterator invalidation if using a tracker
     //       subscribed to a running zcm thread.
+    //       Iterators dereference to pointers into the buffer: the messages
+    //       are owned by the tracker, copy them to keep them.
 
-    typedef typename ContainerType::              iterator               iterator;
-    typedef typename ContainerType::        const_iterator         const_iterator;
-    typedef typename ContainerType::      reverse_iterator       reverse_iterator;
-    typedef typename ContainerType::const_reverse_iterator const_reverse_iterator;
+    template <typename TrackerPtr, typename MsgPtr>
+    class Iter
+    {
+      public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef MsgPtr                          value_type;
+        typedef std::ptrdiff_t                  difference_type;
+        typedef MsgPtr*                         pointer;
+        typedef MsgPtr                          reference;
+
+        Iter() {}
+        Iter(TrackerPtr t, size_t i) : t(t), i(i) {}
+        template <typename P, typename M>
+        Iter(const Iter<P, M>& o) : t(o.t), i(o.i) {}
+
+        MsgPtr operator*() const { return &t->slots[t->at(i)]; }
+        MsgPtr operator[](difference_type n) const { return *(*this + n); }
+
+        Iter& operator++() { ++i; return *this; }
+        Iter& operator--() { --i; return *this; }
+        Iter operator++(int) { Iter ret = *this; ++i; return ret; }
+        Iter operator--(int) { Iter ret = *this; --i; return ret; }
+        Iter& operator+=(difference_type n) { i += n; return *this; }
+        Iter& operator-=(difference_type n) { i -= n; return *this; }
+        Iter operator+(difference_type n) const { return Iter(t, i + n); }
+        Iter operator-(difference_type n) const { return Iter(t, i - n); }
+        difference_type operator-(const Iter& o) const
+        { return (difference_type) i - (difference_type) o.i; }
+
+        bool operator==(const Iter& o) const { return i == o.i; }
+        bool operator!=(const Iter& o) const { return i != o.i; }
+        bool operator< (const Iter& o) const { return i <  o.i; }
+        bool operator> (const Iter& o) const { return i >  o.i; }
+        bool operator<=(const Iter& o) const { return i <= o.i; }
+        bool operator>=(const Iter& o) const { return i >= o.i; }
 
-    inline                iterator  begin()       { return buf.  begin(); }
-    inline          const_iterator cbegin() const { return buf. cbegin(); }
-    inline                iterator    end()       { return buf.    end(); }
-    inline          const_iterator   cend() const { return buf.   cend(); }
+      private:
+        friend class Tracker;
+        template <typename P, typename M> friend class Iter;
+        TrackerPtr t = nullptr;
+        size_t i = 0;
+    };
+
+    typedef Iter<      Tracker*,       MsgType*>               iterator;
+    typedef Iter<const Tracker*, const MsgType*>         const_iterator;
+    typedef std::reverse_iterator<      iterator>       reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    inline                iterator  begin()       { return       iterator(this,     0); }
+    inline          const_iterator cbegin() const { return const_iterator(this,     0); }
+    inline                iterator    end()       { return       iterator(this, count); }
+    inline          const_iterator   cend() const { return const_iterator(this, count); }
 
-    inline       reverse_iterator  rbegin()       { return buf. rbegin(); }
-    inline const_reverse_iterator crbegin() const { return buf.crbegin(); }
-    inline       reverse_iterator    rend()       { return buf.   rend(); }
-    inline const_reverse_iterator   crend() const { return buf.  crend(); }
+    inline       reverse_iterator  rbegin()       { return       reverse_iterator( end()); }
+    inline const_reverse_iterator crbegin() const { return const_reverse_iterator(cend()); }
+    inline       reverse_iterator    rend()       { return       reverse_iterator( begin()); }
+    inline const_reverse_iterator   crend() const { return const_reverse_iterator(cbegin()); }
 
-    // Note: you probably want to `delete *iter` before calling erase on it
-    template <typename IterType>
-    inline IterType erase(IterType iter) { return buf.erase(iter); }
+    // Returns an iterator to the message that followed the erased one
+    inline iterator erase(const_iterator iter)
+    {
+        size_t i = iter.i;
+        if (i == 0) {
+            popFront();
+        } else if (i == count - 1) {
+            if (utimes[at(i)] < utimes[at(i - 1)]) --descents;
+            --count;
+        } else {
+            removeIf([&](size_t j) { return j == i; });
+        }
+        return iterator(this, i);
+    }
+
+    inline size_t size() const { return count; }
 
     ///////////////////////////////
 
@@ -207,13 +430,6 @@ class Tracker
             delete thr;
             if (callbackMsg) delete callbackMsg;
         }
-
-        std::unique_lock<BufLockType> lk(bufLock);
-        while (!buf.empty()) {
-            MsgType* tmp = buf.front();
-            delete tmp;
-            buf.pop_front();
-        }
     }
 
     // You must free the memory returned here. This may return nullptr
@@ -223,17 +439,111 @@ class Tracker
 
         {
             std::unique_lock<BufLockType> lk(bufLock);
-            if (!buf.empty()) ret = new T(*buf.back());
+            if (count > 0) ret = new T(slots[at(count - 1)]);
         }
 
         return ret;
     }
 
+    // Copies the latest message into 'out'. Returns false if there is none
+    bool get(T& out) const
+    {
+        std::unique_lock<BufLockType> lk(bufLock);
+        if (count == 0) return false;
+        out = slots[at(count - 1)];
+        return true;
+    }
+
     // Same semantics as get()
     virtual T* get(uint64_t utime) const
     {
         std::unique_lock<BufLockType> lk(bufLock);
-        return get(utime, buf.begin(), buf.end(), &lk);
+
+        size_t i0, i1;
+        bracket(utime, i0, i1);
+        if (i0 == count && i1 == count) return nullptr;
+        if (i1 == count || i0 == i1) return new T(slots[at(i0)]);
+        if (i0 == count) return new T(slots[at(i1)]);
+
+        uint64_t m0Utime = utimes[at(i0)], m1Utime = utimes[at(i1)];
+        if (m0Utime == m1Utime) return new T(slots[at(i0)]);
+
+        T m0(slots[at(i0)]), m1(slots[at(i1)]);
+        lk.unlock();
+        return interpolate(utime, &m0, m0Utime, &m1, m1Utime);
+    }
+
+    // Same as get(utime), without allocating: the result is written into
+    // 'out'. Returns false if there are no messages close enough to 'utime'
+    bool get(uint64_t utime, T& out) const
+    {
+        std::unique_lock<BufLockType> lk(bufLock);
+
+        size_t i0, i1;
+        bracket(utime, i0, i1);
+        if (i0 == count && i1 == count) return false;
+        if (i1 == count || i0 == i1) {
+            out = slots[at(i0)];
+        } else if (i0 == count) {
+            out = slots[at(i1)];
+        } else {
+            uint64_t m0Utime = utimes[at(i0)], m1Utime = utimes[at(i1)];
+            if (m0Utime == m1Utime) out = slots[at(i0)];
+            else interpolate(utime, &slots[at(i0)], m0Utime, &slots[at(i1)], m1Utime, out);
+        }
+        return true;
+    }
+
+    // Same as get(utime, out) for each of the 'n' 'queries', into out[i], in
+    // one pass over the buffer with it locked once. 'queries' should be in
+    // increasing order, which is what makes this faster than that many get()
+    // calls. Sets found[i], if given, to whether out[i] was written. Returns
+    // the number of queries found
+    size_t get(const uint64_t* queries, size_t n, T* out, bool* found = nullptr) const
+    {
+        std::vector<uint64_t> targets, utimeA, utimeB;
+        std::vector<const T*> A, B;
+        std::vector<T*> outs;
+
+        std::unique_lock<BufLockType> lk(bufLock);
+
+        size_t ret = 0, cursor = 0;
+        for (size_t k = 0; k < n; ++k) {
+            uint64_t utime = queries[k];
+            size_t i0, i1;
+            if (descents > 0) {
+                bracket(utime, i0, i1);
+            } else {
+                if (k > 0 && utime < queries[k - 1]) cursor = 0;
+                bracketFrom(utime, cursor, i0, i1);
+            }
+
+            bool ok = i0 != count || i1 != count;
+            if (found) found[k] = ok;
+            if (!ok) continue;
+            ++ret;
+
+            if (i1 == count || i0 == i1) {
+                out[k] = slots[at(i0)];
+            } else if (i0 == count) {
+                out[k] = slots[at(i1)];
+            } else if (utimes[at(i0)] == utimes[at(i1)]) {
+                out[k] = slots[at(i0)];
+            } else {
+                targets.push_back(utime);
+                A.push_back(&slots[at(i0)]);
+                utimeA.push_back(utimes[at(i0)]);
+                B.push_back(&slots[at(i1)]);
+                utimeB.push_back(utimes[at(i1)]);
+                outs.push_back(&out[k]);
+            }
+        }
+
+        if (!targets.empty())
+            interpolateBatch(targets.size(), targets.data(),
+                             A.data(), utimeA.data(), B.data(), utimeB.data(), outs.data());
+
+        return ret;
     }
 
     // TODO: Should consider how to allow the user to ask for an extrapolated
@@ -311,39 +621,39 @@ class Tracker
     virtual std::vector<T*> getRange(uint64_t utimeA, uint64_t utimeB) const
     {
         std::unique_lock<BufLockType> lk(bufLock);
-
-        // See reason for linear search given in the get() function
         std::vector<T*> ret;
-        for (const MsgType* m : buf) {
-            uint64_t mUtime = getMsgUtime(m);
-            if (utimeA <= mUtime && mUtime <= utimeB)
-                ret.push_back(new T(*m));
-        }
+        forRange(utimeA, utimeB, [&](size_t i) { ret.push_back(new T(slots[i])); });
         return ret;
     }
 
+    // Same, copying the messages into 'out', resized to their number. The
+    // messages already in 'out' are reused
+    size_t getRange(uint64_t utimeA, uint64_t utimeB, std::vector<T>& out) const
+    {
+        std::unique_lock<BufLockType> lk(bufLock);
+        size_t n = 0;
+        forRange(utimeA, utimeB, [&](size_t i) {
+            if (n < out.size()) out[n] = slots[i];
+            else out.push_back(slots[i]);
+            ++n;
+        });
+        out.resize(n);
+        return n;
+    }
+
     size_t expireBefore(uint64_t utime)
     {
         size_t ret = 0;
         std::unique_lock<BufLockType> lk(bufLock);
 
         // Expire things that are too old
-        while (!buf.empty()) {
-            if (getMsgUtime(buf.front()) >= utime) break;
-            delete buf.front();
-            buf.pop_front();
+        while (count > 0 && utimes[head] < utime) {
+            popFront();
             ++ret;
         }
 
-        for (auto iter = buf.begin(); iter != buf.end();) {
-            if (getMsgUtime(*iter) < utime) {
-                delete *iter;
-                iter = buf.erase(iter);
-                ++ret;
-            } else {
-                ++iter;
-            }
-        }
+        if (descents > 0)
+            ret += removeIf([&](size_t i) { return utimes[at(i)] < utime; });
 
         return ret;
     }
@@ -353,18 +663,14 @@ class Tracker
     // Returns utime of message
     virtual uint64_t newMsg(const T& _msg, uint64_t hostUtime = UINT64_MAX)
     {
-        MsgType* tmp = new MsgType(_msg, hostUtime);
-        uint64_t tmpUtime = getMsgUtime(tmp);
+        uint64_t tmpUtime;
 
         {
             std::unique_lock<BufLockType> lk(bufLock);
 
-            // Expire due to buffer being full
-            if (buf.size() == bufMax) {
-                MsgType* tmp = buf.front();
-                delete tmp;
-                buf.pop_front();
-            }
+            // Expires the oldest message if the buffer is full
+            pushBack(_msg, hostUtime);
+            tmpUtime = utimes[at(count - 1)];
 
             // Run the filter for jitter and frequency
             if (lastHostUtime != UINT64_MAX) {
@@ -388,7 +694,6 @@ class Tracker
             }
 
             lastHostUtime = hostUtime;
-            buf.push_back(tmp);
         }
 
         // Dispatch to callback
@@ -415,7 +720,7 @@ class Tracker
     {
         {
             std::unique_lock<BufLockType> lk(bufLock);
-            if (!buf.empty()) return lastHostUtime;
+            if (count > 0) return lastHostUtime;
         }
         return UINT64_MAX;
     }
@@ -487,6 +792,314 @@ class MessageTracker : public virtual Tracker<T>
     { if (s) zcmLocal->unsubscribe(s); }
 };
 
+// A tracker for a single producer, typically the zcm dispatch thread, and
+// readers that never block on it, nor it on them: there are no locks. Meant
+// for real time threads that must not wait behind the producer.
+//
+// Messages are copied into a pool of slots, which readers pin while copying
+// out of them. The producer never writes into a pinned slot, and readers
+// retry when the message they looked up is replaced before they could pin
+// it. Up to 'maxReaders' readers can read at once, each pinning up to two
+// slots. Beyond that, new messages can be dropped rather than waited on (see
+// getNumDropped()).
+//
+// Unlike Tracker, there is no callback and no iteration over the buffer.
+template <typename T>
+class LockFreeTracker
+{
+  public:
+    typedef T ZcmType;
+
+  protected:
+    // Defaults to the 'utime' field of T when it has one, 'hostUtime' otherwise
+    virtual uint64_t getMsgUtime(const T* msg, uint64_t hostUtime) const
+    { return MsgUtime<T>::get(*msg, hostUtime); }
+
+    // Called by readers, with A and B pinned
+    virtual void interpolate(uint64_t utimeTarget,
+                             const T* A, uint64_t utimeA,
+                             const T* B, uint64_t utimeB, T& out) const
+    {
+        out = utimeTarget - utimeA < utimeB - utimeTarget ? *A : *B;
+    }
+
+  private:
+    template <typename F, typename = void>
+    struct MsgUtime {
+        static uint64_t get(const F& msg, uint64_t hostUtime) { return hostUtime; }
+    };
+
+    template <typename F>
+    struct MsgUtime<F, decltype((void) std::declval<F>().utime)> {
+        static uint64_t get(const F& msg, uint64_t hostUtime) { return msg.utime; }
+    };
+
+    static constexpr uint64_t NONE = UINT64_MAX;
+
+    struct Slot {
+        T msg;
+        // Number of the message held, NONE while being written
+        std::atomic<uint64_t> seq {NONE};
+        std::atomic<uint64_t> utime {0};
+        mutable std::atomic<uint32_t> pins {0};
+    };
+
+    uint64_t maxTimeErr_us;
+    size_t bufMax;
+    size_t nslots;
+    std::unique_ptr<Slot[]> slots;
+
+    // The buffer holds the messages numbered from nextSeq - bufMax (or 0) to
+    // nextSeq, message s being in slot order[s % bufMax]. descentSeq is the
+    // last message with an earlier utime than the one before it: readers
+    // bisect the buffer when it's older than all of it
+    std::unique_ptr<std::atomic<size_t>[]> order;
+    std::atomic<uint64_t> nextSeq {0};
+    std::atomic<uint64_t> descentSeq {0};
+
+    std::atomic<uint64_t> lastHostUtime {UINT64_MAX};
+    std::atomic<double> hzLowPass {0};
+    std::atomic<double> jitterLowPass {0};
+    std::atomic<uint64_t> dropped {0};
+
+    // Only used by the producer
+    uint64_t lastUtime = 0;
+    size_t scan = 0;
+    Filter hzFilter;
+    Filter jitterFilter;
+
+    // Claims unpinned slot 'x' for writing
+    bool claim(size_t x)
+    {
+        Slot& sl = slots[x];
+        if (sl.pins.load() != 0) return false;
+        uint64_t seq = sl.seq.exchange(NONE);
+        if (sl.pins.load() == 0) return true;
+        // A reader pinned it in the meantime: leave it the message
+        sl.seq.store(seq);
+        return false;
+    }
+
+    // The slot to write message 's' into: that of the message it evicts if it
+    // isn't pinned, any other one out of the buffer otherwise. Returns
+    // nslots if there are none
+    size_t takeSlot(uint64_t s)
+    {
+        if (s >= bufMax) {
+            size_t x = order[s % bufMax].load();
+            if (claim(x)) return x;
+        }
+        for (size_t n = 0; n < nslots; ++n) {
+            size_t x = (scan + n) % nslots;
+            uint64_t seq = slots[x].seq.load();
+            if ((seq == NONE || seq + bufMax <= s) && claim(x)) {
+                scan = x + 1;
+                return x;
+            }
+        }
+        return nslots;
+    }
+
+    // Utime of message 's', false if it was replaced
+    bool utimeOf(uint64_t s, uint64_t& utime) const
+    {
+        const Slot& sl = slots[order[s % bufMax].load()];
+        if (sl.seq.load() != s) return false;
+        utime = sl.utime.load();
+        return sl.seq.load() == s;
+    }
+
+    // Pins the slot of message 's', nullptr if it was replaced
+    const Slot* pin(uint64_t s) const
+    {
+        const Slot& sl = slots[order[s % bufMax].load()];
+        sl.pins.fetch_add(1);
+        if (sl.seq.load() == s) return &sl;
+        sl.pins.fetch_sub(1);
+        return nullptr;
+    }
+
+    static void unpin(const Slot* sl) { if (sl) sl->pins.fetch_sub(1); }
+
+    // The messages bracketing 'utime' within maxTimeErr_us, NONE if none, with
+    // the same semantics as Tracker. Returns false if messages were replaced
+    // while searching
+    bool bracket(uint64_t utime, uint64_t& s0, uint64_t& u0,
+                 uint64_t& s1, uint64_t& u1) const
+    {
+        s0 = s1 = NONE;
+        uint64_t end = nextSeq.load();
+        uint64_t begin = end > bufMax ? end - bufMax : 0;
+        uint64_t u;
+
+        if (descentSeq.load() <= begin) {
+            uint64_t lo = begin, hi = end;
+            while (lo < hi) {
+                uint64_t mid = lo + (hi - lo) / 2;
+                if (!utimeOf(mid, u)) return false;
+                if (u < utime) lo = mid + 1;
+                else           hi = mid;
+            }
+            if (lo < end) {
+                if (!utimeOf(lo, u1)) return false;
+                s1 = lo;
+                if (u1 == utime) { s0 = s1; u0 = u1; }
+            }
+            if (s0 == NONE && lo > begin) {
+                s0 = lo - 1;
+                if (!utimeOf(s0, u0)) return false;
+                while (s0 > begin) {
+                    if (!utimeOf(s0 - 1, u)) return false;
+                    if (u != u0) break;
+                    --s0;
+                }
+            }
+        } else {
+            for (uint64_t s = begin; s < end; ++s) {
+                if (!utimeOf(s, u)) return false;
+                if (u <= utime && (s0 == NONE || u > u0)) { s0 = s; u0 = u; }
+                if (u >= utime && (s1 == NONE || u < u1)) { s1 = s; u1 = u; }
+            }
+        }
+
+        if (s0 != NONE && utime - u0 > maxTimeErr_us) s0 = NONE;
+        if (s1 != NONE && u1 - utime > maxTimeErr_us) s1 = NONE;
+        return true;
+    }
+
+  public:
+    LockFreeTracker(double maxTimeErr = 0.25, size_t maxMsgs = 1, size_t maxReaders = 4,
+                    double freqEstConvergenceNumMsgs = 10)
+        : maxTimeErr_us(maxTimeErr * 1e6), bufMax(maxMsgs),
+          nslots(maxMsgs + 2 * maxReaders),
+          slots(new Slot[nslots]), order(new std::atomic<size_t>[maxMsgs]),
+          hzFilter(Filter::convergenceTimeToNatFreq(freqEstConvergenceNumMsgs, 0.8), 0.8),
+          jitterFilter(Filter::convergenceTimeToNatFreq(freqEstConvergenceNumMsgs, 1), 1)
+    {
+        assert(maxMsgs > 0 && "Cannot allocate a tracker to track 0 messages");
+        for (size_t i = 0; i < bufMax; ++i) order[i].store(0);
+    }
+
+    virtual ~LockFreeTracker() {}
+
+    // Only ever called by the producer. hostUtime is only used and required
+    // when _msg does not have an internal utime field
+    // Returns utime of message
+    virtual uint64_t newMsg(const T& _msg, uint64_t hostUtime = UINT64_MAX)
+    {
+        uint64_t s = nextSeq.load(std::memory_order_relaxed);
+        uint64_t utime = getMsgUtime(&_msg, hostUtime);
+
+        size_t x = takeSlot(s);
+        if (x == nslots) {
+            dropped.fetch_add(1);
+            return utime;
+        }
+        Slot& sl = slots[x];
+        sl.msg = _msg;
+        sl.utime.store(utime);
+        sl.seq.store(s);
+        order[s % bufMax].store(x);
+        if (s > 0 && utime < lastUtime) descentSeq.store(s);
+        lastUtime = utime;
+        nextSeq.store(s + 1);
+
+        uint64_t last = lastHostUtime.load(std::memory_order_relaxed);
+        if (last != UINT64_MAX) {
+            if (last > hostUtime) {
+                hzFilter.reset();
+            } else {
+                double obs = hostUtime - last;
+                hzFilter(obs, 1);
+                double jitterObs = obs - hzFilter[Filter::LOW_PASS];
+                jitterFilter(jitterObs * jitterObs, 1);
+            }
+            hzLowPass.store(hzFilter[Filter::LOW_PASS]);
+            jitterLowPass.store(jitterFilter[Filter::LOW_PASS]);
+        }
+        lastHostUtime.store(hostUtime);
+
+        return utime;
+    }
+
+    // Copies the latest message into 'out'. Returns false if there is none
+    bool get(T& out) const
+    {
+        for (;;) {
+            uint64_t end = nextSeq.load();
+            if (end == 0) return false;
+            const Slot* sl = pin(end - 1);
+            if (!sl) continue;
+            out = sl->msg;
+            unpin(sl);
+            return true;
+        }
+    }
+
+    // Same as Tracker::get(utime, out)
+    bool get(uint64_t utime, T& out) const
+    {
+        for (;;) {
+            uint64_t s0, u0, s1, u1;
+            if (!bracket(utime, s0, u0, s1, u1)) continue;
+            if (s0 == NONE && s1 == NONE) return false;
+
+            bool both = s0 != NONE && s1 != NONE && u0 != u1;
+            if (s0 == NONE) s0 = s1;
+
+            const Slot* A = pin(s0);
+            const Slot* B = both ? pin(s1) : nullptr;
+            bool ok = A && (!both || B);
+            if (ok) {
+                if (both) interpolate(utime, &A->msg, u0, &B->msg, u1, out);
+                else      out = A->msg;
+            }
+            unpin(A);
+            unpin(B);
+            if (ok) return true;
+        }
+    }
+
+    // Messages dropped for lack of a free slot
+    uint64_t getNumDropped() const { return dropped.load(); }
+
+    double getHz() const
+    {
+        double lp = hzLowPass.load();
+        return lp <= 1e-9 ? -1 : 1e6 / lp;
+    }
+
+    uint64_t lastMsgHostUtime() const { return lastHostUtime.load(); }
+
+    double getJitterUs() const { return sqrt(jitterLowPass.load()); }
+};
+
+// LockFreeTracker fed from a zcm subscription
+template <typename T>
+class LockFreeMessageTracker : public LockFreeTracker<T>
+{
+  private:
+    zcm::ZCM* zcmLocal = nullptr;
+    zcm::Subscription *s = nullptr;
+
+    void handle(const zcm::ReceiveBuffer* rbuf, const std::string& chan, const T* _msg)
+    { this->newMsg(*_msg, rbuf->recv_utime); }
+
+  public:
+    LockFreeMessageTracker(zcm::ZCM* zcmLocal, const std::string& channel,
+                           double maxTimeErr = 0.25, size_t maxMsgs = 1,
+                           size_t maxReaders = 4, double freqEstConvergenceNumMsgs = 20)
+        : LockFreeTracker<T>(maxTimeErr, maxMsgs, maxReaders, freqEstConvergenceNumMsgs),
+          zcmLocal(zcmLocal)
+    {
+        if (zcmLocal && channel != "")
+            s = zcmLocal->subscribe(channel, &LockFreeMessageTracker<T>::handle, this);
+    }
+
+    virtual ~LockFreeMessageTracker()
+    { if (s) zcmLocal->unsubscribe(s); }
+};
+
 // This class will attempt to synchronize messages of type Type1Tracker::ZcmType to
 // messages of type Type2Tracker::ZcmType.
 //
@@ -597,10 +1210,8 @@ class SynchronizedMessageDispatcher
             if (t1Utime <= t2Utime) {
                 auto msg2 = t2.get(t1Utime);
                 if (msg2) {
-                    onSynchronizedMsg(*it, msg2, usr);
-                    // Note that we intentionally DO NOT delete *it since we
-                    // forfeit this memory to the callback
-                    // delete *it;
+                    // The callback owns both messages, and t1 its buffer
+                    onSynchronizedMsg(new typename Type1Tracker::ZcmType(**it), msg2, usr);
                     it = t1.erase(it);
                     continue;
                 }
@@ -654,6 +1265,139 @@ class SynchronizedMessageDispatcher
     friend class ::MessageTrackerTest;
 };
 
+
+// Aligns messages of several types by utime, the first type being the
+// reference. For each reference message, once every other stream has a
+// message at least as late, the callback gets it along with, for each other
+// stream, what Tracker::get() returns at its utime (NEAREST) or the message
+// with that very utime (EXACT). Reference messages some stream has nothing
+// for, within maxTimeErr, are dropped (see getNumDropped()).
+//
+// Streams are aligned on the thread feeding them, under a single lock: there
+// are no threads of their own. The tuple handed to the callback is reused
+// from one call to the next, and the callback must not feed this tracker.
+template <typename... Ts>
+class MultiTracker
+{
+  public:
+    static constexpr size_t N = sizeof...(Ts);
+    typedef std::tuple<Ts...> Tuple;
+    template <size_t I> using Elt = typename std::tuple_element<I, Tuple>::type;
+
+    typedef std::function<void (uint64_t utime, const Tuple& msgs, void* usr)> callback;
+
+    enum Policy { NEAREST, EXACT };
+
+  private:
+    std::tuple<std::unique_ptr<Tracker<Ts>>...> trackers;
+    Tuple aligned;
+    callback onAligned;
+    void* usr;
+    uint64_t dropped = 0;
+    mutable std::mutex lock;
+
+    zcm::ZCM* zcmLocal = nullptr;
+    std::array<zcm::Subscription*, N> subs {};
+
+    // Whether all streams from I on have a message at least as late as 'utime'
+    template <size_t I>
+    typename std::enable_if<I == N, bool>::type settled(uint64_t utime) const { return true; }
+
+    template <size_t I>
+    typename std::enable_if<I < N, bool>::type settled(uint64_t utime) const
+    {
+        const Tracker<Elt<I>>& t = *std::get<I>(trackers);
+        auto last = t.crbegin();
+        return last != t.crend() && t.getMsgUtime(*last) >= utime && settled<I + 1>(utime);
+    }
+
+    template <size_t I>
+    typename std::enable_if<I == N, bool>::type fill(uint64_t utime) { return true; }
+
+    template <size_t I>
+    typename std::enable_if<I < N, bool>::type fill(uint64_t utime)
+    { return std::get<I>(trackers)->get(utime, std::get<I>(aligned)) && fill<I + 1>(utime); }
+
+    template <size_t I>
+    typename std::enable_if<I == N>::type subscribe(const std::array<std::string, N>& channels) {}
+
+    template <size_t I>
+    typename std::enable_if<I < N>::type subscribe(const std::array<std::string, N>& channels)
+    {
+        if (channels[I] != "")
+            subs[I] = zcmLocal->subscribe(channels[I], &MultiTracker::handle<I>, this);
+        subscribe<I + 1>(channels);
+    }
+
+    template <size_t I>
+    void handle(const zcm::ReceiveBuffer* rbuf, const std::string& chan, const Elt<I>* msg)
+    { newMsg<I>(*msg, rbuf->recv_utime); }
+
+    void align()
+    {
+        Tracker<Elt<0>>& ref = *std::get<0>(trackers);
+        for (auto it = ref.begin(); it != ref.end();) {
+            uint64_t utime = ref.getMsgUtime(*it);
+            if (!settled<1>(utime)) {
+                ++it;
+                continue;
+            }
+            if (fill<1>(utime)) {
+                std::get<0>(aligned) = **it;
+                onAligned(utime, aligned, usr);
+            } else {
+                ++dropped;
+            }
+            it = ref.erase(it);
+        }
+    }
+
+  public:
+    // Each stream buffers up to 'maxMsgs' messages
+    MultiTracker(double maxTimeErr, size_t maxMsgs, Policy policy,
+                 callback onAligned, void* usr = nullptr)
+        : trackers(std::unique_ptr<Tracker<Ts>>(
+                       new Tracker<Ts>(policy == EXACT ? 0 : maxTimeErr, maxMsgs))...),
+          onAligned(onAligned), usr(usr) {}
+
+    // Subscribes stream I to channels[I], unless it's empty
+    MultiTracker(zcm::ZCM* zcmLocal, const std::array<std::string, N>& channels,
+                 double maxTimeErr, size_t maxMsgs, Policy policy,
+                 callback onAligned, void* usr = nullptr)
+        : MultiTracker(maxTimeErr, maxMsgs, policy, onAligned, usr)
+    {
+        this->zcmLocal = zcmLocal;
+        if (zcmLocal) subscribe<0>(channels);
+    }
+
+    virtual ~MultiTracker()
+    {
+        for (auto* s : subs)
+            if (s) zcmLocal->unsubscribe(s);
+    }
+
+    // Feeds a message of stream I, then calls the callback for every
+    // reference message that can now be aligned. Returns utime of message
+    template <size_t I>
+    uint64_t newMsg(const Elt<I>& msg, uint64_t hostUtime = UINT64_MAX)
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        uint64_t utime = std::get<I>(trackers)->newMsg(msg, hostUtime);
+        align();
+        return utime;
+    }
+
+    // For the statistics of stream I
+    template <size_t I>
+    const Tracker<Elt<I>>& getTracker() const { return *std::get<I>(trackers); }
+
+    uint64_t getNumDropped() const
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        return dropped;
+    }
+};
+
 }
 
 #undef ZCM_DEBUG
@@ -1,26 +1,60 @@
 #include "zcm/zcm_private.h"
 #include "zcm/transport.h"
 #include "zcm/nonblocking.h"
+#include "zcm/util/probes.h"
 
 #include <string.h>
 
-/* TODO remove malloc for preallocated mem and linked-lists */
+/* Time source (in microseconds) for the budget of zcm_nonblocking_handle_nonblock_n().
+   Embedded targets can define it to their own clock; without one the budget is ignored */
+#if !defined(ZCM_NONBLOCK_UTIME) && !defined(ZCM_EMBEDDED)
+#include <sys/time.h>
+static uint64_t nonblock_utime(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+#define ZCM_NONBLOCK_UTIME() nonblock_utime()
+#endif
+
+/* Monotonic time source (in nanoseconds) for timing callbacks with
+   zcm_nonblocking_set_dispatch_profiling(). Embedded targets can define it to
+   their own clock; without one profiling is unavailable */
+#if !defined(ZCM_NONBLOCK_NSTIME) && !defined(ZCM_EMBEDDED)
+#include <time.h>
+static uint64_t nonblock_nstime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#define ZCM_NONBLOCK_NSTIME() nonblock_nstime()
+#endif
+
+#ifdef ZCM_NONBLOCK_NSTIME
+#include "zcm/util/latency_hist.h"
+#include <stdio.h>
+#endif
+
+/* The number of subscriptions zcm_nonblocking_create() makes room for. Nodes that
+   need an exact footprint can give their own memory to zcm_nonblocking_create_static() */
 #ifndef ZCM_NONBLOCK_SUBS_MAX
 #define ZCM_NONBLOCK_SUBS_MAX 512
 #endif
 
-struct zcm_nonblocking
-{
-    zcm_t* z;
-    zcm_trans_t* zt;
+/* Number of hash buckets zcm_nonblocking_create() uses for the non-regex
+   subscriptions. Must be a power of 2 */
+#ifndef ZCM_NONBLOCK_HASH_BUCKETS
+#define ZCM_NONBLOCK_HASH_BUCKETS 256
+#endif
 
-    bool allChannelsEnabled;
+#if (ZCM_NONBLOCK_HASH_BUCKETS & (ZCM_NONBLOCK_HASH_BUCKETS - 1)) != 0
+#error "ZCM_NONBLOCK_HASH_BUCKETS must be a power of 2"
+#endif
 
-    /* TODO speed this up */
-    zcm_sub_t subs[ZCM_NONBLOCK_SUBS_MAX];
-    bool      subInUse[ZCM_NONBLOCK_SUBS_MAX];
-    size_t    subInUseEnd;
-};
+/* Terminates the subscription lists below */
+#define SUB_NONE (-1)
 
 static bool isRegexChannel(const char* c, size_t clen)
 {
@@ -53,29 +87,89 @@ static bool isSupportedRegex(const char* c, size_t clen)
     return true;
 }
 
-zcm_nonblocking_t* zcm_nonblocking_create(zcm_t* z, zcm_trans_t* zt)
+static int* listHeadFor(zcm_nonblocking_t* zcm, int idx)
 {
-    zcm_nonblocking_t* zcm;
+    if (zcm->subs[idx].sub.regex) return &zcm->prefixHead;
+    return &zcm->buckets[zcm->subs[idx].hash & zcm->bucketMask];
+}
+
+static void listInsert(zcm_nonblocking_t* zcm, int idx)
+{
+    int* link = listHeadFor(zcm, idx);
+    while (*link != SUB_NONE && *link < idx) link = &zcm->subs[*link].next;
+    zcm->subs[idx].next = *link;
+    *link = idx;
+}
+
+static void listRemove(zcm_nonblocking_t* zcm, int idx)
+{
+    int* link = listHeadFor(zcm, idx);
+    while (*link != SUB_NONE && *link != idx) link = &zcm->subs[*link].next;
+    if (*link == idx) *link = zcm->subs[idx].next;
+}
+
+zcm_nonblocking_t* zcm_nonblocking_create_static(zcm_t* z, zcm_trans_t* zt,
+                                                 zcm_nonblocking_t* zcm,
+                                                 zcm_nonblocking_slot_t* subs, size_t nsubs,
+                                                 int* buckets, size_t nbuckets)
+{
+    size_t i;
+
+    if (nbuckets == 0 || (nbuckets & (nbuckets - 1)) != 0) return NULL;
 
-    zcm = malloc(sizeof(zcm_nonblocking_t));
-    if (!zcm) return NULL;
     zcm->z = z;
     zcm->zt = zt;
+    zcm->ownsMem = false;
     zcm->allChannelsEnabled = false;
 
-    size_t i;
-    for (i = 0; i < ZCM_NONBLOCK_SUBS_MAX; ++i)
-        zcm->subInUse[i] = false;
+    zcm->subs = subs;
+    zcm->subsMax = nsubs;
+    for (i = 0; i < nsubs; ++i)
+        zcm->subs[i].inUse = false;
+    zcm->buckets = buckets;
+    zcm->bucketMask = nbuckets - 1;
+    for (i = 0; i < nbuckets; ++i)
+        zcm->buckets[i] = SUB_NONE;
 
     zcm->subInUseEnd = 0;
+    zcm->prefixHead = SUB_NONE;
+
+    zcm->profiling = false;
+    zcm->slowNs = 0;
+    zcm->slowHandler = NULL;
+    zcm->slowUsr = NULL;
+    zcm->subHist = NULL;
+    return zcm;
+}
+
+zcm_nonblocking_t* zcm_nonblocking_create(zcm_t* z, zcm_trans_t* zt)
+{
+    zcm_nonblocking_t* zcm;
+
+    /* One allocation for the state and both arrays */
+    zcm = zcm_alloc(sizeof(zcm_nonblocking_t) +
+                    ZCM_NONBLOCK_SUBS_MAX * sizeof(zcm_nonblocking_slot_t) +
+                    ZCM_NONBLOCK_HASH_BUCKETS * sizeof(int), ZCM_ALLOC_CORE);
+    if (!zcm) return NULL;
+    zcm_nonblocking_create_static(z, zt, zcm,
+                                  (zcm_nonblocking_slot_t*) (zcm + 1), ZCM_NONBLOCK_SUBS_MAX,
+                                  (int*) ((zcm_nonblocking_slot_t*) (zcm + 1) + ZCM_NONBLOCK_SUBS_MAX),
+                                  ZCM_NONBLOCK_HASH_BUCKETS);
+    zcm->ownsMem = true;
     return zcm;
 }
 
 void zcm_nonblocking_destroy(zcm_nonblocking_t* zcm)
 {
     if (zcm) {
+        size_t i;
+        if (zcm->subHist) {
+            for (i = 0; i < zcm->subsMax; ++i)
+                zcm_dealloc(zcm->subHist[i], ZCM_ALLOC_CORE);
+            zcm_dealloc(zcm->subHist, ZCM_ALLOC_CORE);
+        }
         if (zcm->zt) zcm_trans_destroy(zcm->zt);
-        free(zcm);
+        if (zcm->ownsMem) zcm_dealloc(zcm, ZCM_ALLOC_CORE);
         zcm = NULL;
     }
 }
@@ -89,9 +183,31 @@ int zcm_nonblocking_publish(zcm_nonblocking_t* z, const char* channel,
     msg.len = len;
     /* Casting away constness okay because msg isn't used past end of function */
     msg.buf = (uint8_t*) data;
+    msg.chan_hash = 0;
+    msg.recv_ns = 0;
+    ZCM_PROBE2(publish, channel, len);
+    ZCM_PROBE2(trans_sendmsg, channel, len);
     return zcm_trans_sendmsg(z->zt, msg);
 }
 
+int zcm_nonblocking_publish_iov(zcm_nonblocking_t* z, const char* channel,
+                                const zcm_iov_t* iov, uint32_t niov)
+{
+    zcm_msg_t msg;
+    uint32_t i;
+
+    msg.utime = 0;
+    msg.channel = channel;
+    msg.len = 0;
+    for (i = 0; i < niov; ++i) msg.len += iov[i].len;
+    msg.buf = NULL;
+    msg.chan_hash = 0;
+    msg.recv_ns = 0;
+    ZCM_PROBE2(publish, channel, msg.len);
+    ZCM_PROBE2(trans_sendmsg, channel, msg.len);
+    return zcm_trans_sendmsg_iov(z->zt, msg, iov, niov);
+}
+
 zcm_sub_t* zcm_nonblocking_subscribe(zcm_nonblocking_t* zcm, const char* channel,
                                      zcm_msg_handler_t cb, void* usr)
 {
@@ -116,18 +232,25 @@ zcm_sub_t* zcm_nonblocking_subscribe(zcm_nonblocking_t* zcm, const char* channel
         return NULL;
     }
 
-    for (i = 0; i <= zcm->subInUseEnd && i < ZCM_NONBLOCK_SUBS_MAX; ++i) {
-        if (!zcm->subInUse[i]) {
+    for (i = 0; i <= zcm->subInUseEnd && i < zcm->subsMax; ++i) {
+        if (!zcm->subs[i].inUse) {
+            zcm_sub_t* sub = &zcm->subs[i].sub;
+
+            strncpy(sub->channel, channel, ZCM_CHANNEL_MAXLEN);
+            sub->channel[ZCM_CHANNEL_MAXLEN] = '\0';
+            sub->regex = regex;
+            sub->regexobj = NULL;
+            sub->callback = cb;
+            sub->usr = usr;
+            zcm->subs[i].inUse = true;
 
-            strncpy(zcm->subs[i].channel, channel, ZCM_CHANNEL_MAXLEN);
-            zcm->subs[i].channel[ZCM_CHANNEL_MAXLEN] = '\0';
-            zcm->subs[i].callback = cb;
-            zcm->subs[i].usr = usr;
-            zcm->subInUse[i] = true;
+            zcm->subs[i].hash = zcm_channel_hash(sub->channel);
+            zcm->subs[i].prefixLen = regex ? clen - 2 : 0;
+            listInsert(zcm, i);
 
             if (i == zcm->subInUseEnd) ++zcm->subInUseEnd;
 
-            return &zcm->subs[i];
+            return sub;
         }
     }
     return NULL;
@@ -135,27 +258,36 @@ zcm_sub_t* zcm_nonblocking_subscribe(zcm_nonblocking_t* zcm, const char* channel
 
 int zcm_nonblocking_unsubscribe(zcm_nonblocking_t* zcm, zcm_sub_t* sub)
 {
-    size_t i;
-    int    match_idx = sub - zcm->subs;
+    int    i;
+    /* The sub is the first member of its slot */
+    int    match_idx = (zcm_nonblocking_slot_t*) sub - zcm->subs;
     size_t num_chan_matches = 0;
     int rc = ZCM_EOK;
-    for (i = 0; i < zcm->subInUseEnd; ++i) {
-        /* Note: it would be nice if we didn't have to do a string comp to unsubscribe, but
-                 we need to count the number of channel matches so we know when we can disable
-                 the transport's recvmsg_enable */
-        if (strncmp(sub->channel, zcm->subs[i].channel,
-                    sizeof(zcm->subs[i].channel)/sizeof(zcm->subs[i].channel[0])) == 0) {
-            ++num_chan_matches;
+
+    if (0 <= match_idx && match_idx < zcm->subInUseEnd && zcm->subs[match_idx].inUse) {
+        /* Count the subs on the same channel so we know when we can disable the
+           transport's recvmsg_enable. They all live on the same list as 'sub' */
+        for (i = *listHeadFor(zcm, match_idx); i != SUB_NONE; i = zcm->subs[i].next) {
+            if (zcm->subs[i].hash == zcm->subs[match_idx].hash &&
+                strcmp(sub->channel, zcm->subs[i].sub.channel) == 0) {
+                ++num_chan_matches;
+            }
         }
-    }
 
-    if (0 <= match_idx && match_idx < zcm->subInUseEnd) {
         if (num_chan_matches <= 1) {
             rc = zcm_trans_recvmsg_enable(zcm->zt, sub->channel, false);
         }
 
-        zcm->subInUse[match_idx] = false;
-        while (zcm->subInUseEnd > 0 && !zcm->subInUse[zcm->subInUseEnd - 1]) {
+        listRemove(zcm, match_idx);
+        zcm->subs[match_idx].inUse = false;
+#ifdef ZCM_NONBLOCK_NSTIME
+        /* So that a later sub in this slot starts from an empty histogram */
+        if (zcm->subHist) {
+            zcm_dealloc(zcm->subHist[match_idx], ZCM_ALLOC_CORE);
+            zcm->subHist[match_idx] = NULL;
+        }
+#endif
+        while (zcm->subInUseEnd > 0 && !zcm->subs[zcm->subInUseEnd - 1].inUse) {
             --zcm->subInUseEnd;
         }
     } else {
@@ -165,41 +297,87 @@ int zcm_nonblocking_unsubscribe(zcm_nonblocking_t* zcm, zcm_sub_t* sub)
     return rc;
 }
 
+#ifdef ZCM_NONBLOCK_NSTIME
+/* Counts a call of the callback of sub 'i' that took 'ns' */
+static void profile_callback(zcm_nonblocking_t* zcm, int i, const char* channel, uint64_t ns)
+{
+    /* The callback may have unsubscribed itself */
+    if (!zcm->subs[i].inUse) return;
+    if (!zcm->subHist) {
+        zcm->subHist = zcm_alloc(zcm->subsMax * sizeof(uint64_t*), ZCM_ALLOC_CORE);
+        if (!zcm->subHist) return;
+        memset(zcm->subHist, 0, zcm->subsMax * sizeof(uint64_t*));
+    }
+    if (!zcm->subHist[i]) {
+        zcm->subHist[i] = zcm_alloc(ZCM_LATENCY_HIST_BUCKETS * sizeof(uint64_t), ZCM_ALLOC_CORE);
+        if (!zcm->subHist[i]) return;
+        memset(zcm->subHist[i], 0, ZCM_LATENCY_HIST_BUCKETS * sizeof(uint64_t));
+    }
+    ++zcm->subHist[i][zcm_latency_hist_bucket(ns)];
+    if (zcm->slowHandler && ns >= zcm->slowNs)
+        zcm->slowHandler(&zcm->subs[i].sub, channel, ns / 1000, zcm->slowUsr);
+}
+#endif
+
 static void dispatch_message(zcm_nonblocking_t* zcm, zcm_msg_t* msg)
 {
     zcm_recv_buf_t rbuf;
     zcm_sub_t* sub;
+    size_t msgLen = 0;
+    uint32_t hash;
+    int exact;
+    int prefix = zcm->prefixHead;
+    int i;
+
+    ZCM_PROBE2(trans_recvmsg, msg->channel, msg->len);
+    if (!msg->chan_hash) msg->chan_hash = zcm_channel_hash(msg->channel);
+    hash = msg->chan_hash;
+    exact = zcm->buckets[hash & zcm->bucketMask];
+    if (prefix != SUB_NONE) msgLen = strlen(msg->channel);
+
+    rbuf.zcm = zcm->z;
+    rbuf.data = msg->buf;
+    rbuf.data_size = msg->len;
+    rbuf.recv_utime = msg->utime;
+    rbuf.chan_hash = hash;
+    rbuf.recv_ns = msg->recv_ns ? (int64_t)msg->recv_ns : (int64_t)msg->utime * 1000;
+    if (zcm_trace_decode(msg->buf, msg->len, &rbuf.send_ns, &rbuf.trace_id)) {
+        rbuf.data += ZCM_TRACE_HDR_SIZE;
+        rbuf.data_size -= ZCM_TRACE_HDR_SIZE;
+    }
 
-    size_t i;
-    for (i = 0; i < zcm->subInUseEnd; ++i) {
-        if (!zcm->subInUse[i]) continue;
-
-        size_t subsChanLen = strlen(zcm->subs[i].channel);
-        if (isRegexChannel(zcm->subs[i].channel, subsChanLen)) {
-            size_t msgLen = strlen(msg->channel);
+    /* Merge the two sorted lists so callbacks run in subscribe order */
+    while (exact != SUB_NONE || prefix != SUB_NONE) {
+        if (prefix == SUB_NONE || (exact != SUB_NONE && exact < prefix)) {
+            i = exact;
+            exact = zcm->subs[i].next;
+            if (zcm->subs[i].hash != hash || strcmp(zcm->subs[i].sub.channel, msg->channel) != 0)
+                continue;
+        } else {
+            i = prefix;
+            prefix = zcm->subs[i].next;
             /* This only works because isSupportedRegex() is called on subscribe */
-            if (msgLen > 2 &&
-                strncmp(zcm->subs[i].channel, msg->channel, subsChanLen - 2) == 0) {
-
-                rbuf.zcm = zcm->z;
-                rbuf.data = msg->buf;
-                rbuf.data_size = msg->len;
-                rbuf.recv_utime = msg->utime;
+            if (msgLen <= 2 ||
+                strncmp(zcm->subs[i].sub.channel, msg->channel, zcm->subs[i].prefixLen) != 0)
+                continue;
+        }
 
-                sub = &zcm->subs[i];
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
-        } else {
-            if (strcmp(zcm->subs[i].channel, msg->channel) == 0) {
-                rbuf.zcm = zcm->z;
-                rbuf.data = msg->buf;
-                rbuf.data_size = msg->len;
-                rbuf.recv_utime = msg->utime;
-
-                sub = &zcm->subs[i];
-                sub->callback(&rbuf, msg->channel, sub->usr);
-            }
+        /* A callback may have unsubscribed this sub since 'exact' and 'prefix'
+           were read, so check it is still live before calling out */
+        if (!zcm->subs[i].inUse) continue;
+        sub = &zcm->subs[i].sub;
+        ZCM_PROBE3(dispatch_begin, msg->channel, rbuf.data_size, sub);
+#ifdef ZCM_NONBLOCK_NSTIME
+        if (zcm->profiling) {
+            uint64_t start = ZCM_NONBLOCK_NSTIME();
+            sub->callback(&rbuf, msg->channel, sub->usr);
+            profile_callback(zcm, i, msg->channel, ZCM_NONBLOCK_NSTIME() - start);
+            ZCM_PROBE3(dispatch_end, msg->channel, rbuf.data_size, sub);
+            continue;
         }
+#endif
+        sub->callback(&rbuf, msg->channel, sub->usr);
+        ZCM_PROBE3(dispatch_end, msg->channel, rbuf.data_size, sub);
     }
 }
 
@@ -212,6 +390,8 @@ int zcm_nonblocking_handle_nonblock(zcm_nonblocking_t* zcm)
     zcm_trans_update(zcm->zt);
 
     /* Try to receive a messages from the transport and dispatch them */
+    msg.chan_hash = 0;
+    msg.recv_ns = 0;
     if ((ret = zcm_trans_recvmsg(zcm->zt, &msg, 0)) != ZCM_EOK) return ret;
 
     dispatch_message(zcm, &msg);
@@ -219,6 +399,89 @@ int zcm_nonblocking_handle_nonblock(zcm_nonblocking_t* zcm)
     return ZCM_EOK;
 }
 
+int zcm_nonblocking_handle_nonblock_n(zcm_nonblocking_t* zcm, uint32_t maxMsgs,
+                                      uint32_t budgetUs)
+{
+    int n = 0;
+    zcm_msg_t msg;
+#ifdef ZCM_NONBLOCK_UTIME
+    uint64_t start = budgetUs ? ZCM_NONBLOCK_UTIME() : 0;
+#endif
+
+    /* Transport-level updates only need to run once for the whole burst */
+    zcm_trans_update(zcm->zt);
+
+    while (maxMsgs == 0 || n < maxMsgs) {
+        msg.chan_hash = 0;
+        msg.recv_ns = 0;
+        if (zcm_trans_recvmsg(zcm->zt, &msg, 0) != ZCM_EOK) break;
+        dispatch_message(zcm, &msg);
+        ++n;
+#ifdef ZCM_NONBLOCK_UTIME
+        if (budgetUs && ZCM_NONBLOCK_UTIME() - start >= budgetUs) break;
+#endif
+    }
+
+    return n;
+}
+
+int zcm_nonblocking_get_stats(zcm_nonblocking_t* zcm, zcm_stat_handler_t cb, void* usr)
+{
+#ifdef ZCM_NONBLOCK_NSTIME
+    static const char* names[] = { "p50", "p90", "p99", "p999" };
+    static const uint32_t ppms[] = { 500000, 900000, 990000, 999000 };
+    char name[64 + ZCM_CHANNEL_MAXLEN];
+    uint64_t total;
+    size_t i, j;
+
+    if (zcm->profiling) {
+        for (i = 0; zcm->subHist && i < zcm->subInUseEnd; ++i) {
+            if (!zcm->subs[i].inUse || !zcm->subHist[i]) continue;
+            total = 0;
+            for (j = 0; j < ZCM_LATENCY_HIST_BUCKETS; ++j) total += zcm->subHist[i][j];
+
+            snprintf(name, sizeof(name), "zcm.sub.%u.%s.dispatch_msgs",
+                     (unsigned) i, zcm->subs[i].sub.channel);
+            cb(name, total, usr);
+            for (j = 0; j < 4; ++j) {
+                snprintf(name, sizeof(name), "zcm.sub.%u.%s.dispatch_%s_ns",
+                         (unsigned) i, zcm->subs[i].sub.channel, names[j]);
+                cb(name, zcm_latency_hist_percentile(zcm->subHist[i], total, ppms[j]), usr);
+            }
+        }
+        /* The transport guards its own counters. Not all transports keep any */
+        zcm_trans_get_stats(zcm->zt, cb, usr);
+        return ZCM_EOK;
+    }
+#endif
+    return zcm_trans_get_stats(zcm->zt, cb, usr);
+}
+
+int zcm_nonblocking_set_dispatch_profiling(zcm_nonblocking_t* zcm, int enable, uint32_t slowUs,
+                                           zcm_slow_handler_t cb, void* usr)
+{
+#ifdef ZCM_NONBLOCK_NSTIME
+    zcm->profiling = enable != 0;
+    zcm->slowNs = (uint64_t) slowUs * 1000;
+    zcm->slowHandler = enable ? cb : NULL;
+    zcm->slowUsr = usr;
+    return ZCM_EOK;
+#else
+    (void) zcm; (void) enable; (void) slowUs; (void) cb; (void) usr;
+    return ZCM_EINVALID;
+#endif
+}
+
+int zcm_nonblocking_get_fd(zcm_nonblocking_t* zcm)
+{
+    return zcm_trans_get_fd(zcm->zt);
+}
+
+int zcm_nonblocking_has_subscribers(zcm_nonblocking_t* zcm, const char* channel)
+{
+    return zcm_trans_has_subscribers(zcm->zt, channel) != 0;
+}
+
 void zcm_nonblocking_flush(zcm_nonblocking_t* zcm)
 {
     /* Call twice because we need to make sure publish and subscribe are both handled */
@@ -226,6 +489,18 @@ void zcm_nonblocking_flush(zcm_nonblocking_t* zcm)
     zcm_trans_update(zcm->zt);
 
     zcm_msg_t msg;
-    while (zcm_trans_recvmsg(zcm->zt, &msg, 0) == ZCM_EOK)
+    msg.chan_hash = 0;
+    msg.recv_ns = 0;
+    while (zcm_trans_recvmsg(zcm->zt, &msg, 0) == ZCM_EOK) {
         dispatch_message(zcm, &msg);
+        msg.chan_hash = 0;
+        msg.recv_ns = 0;
+    }
+}
+
+int zcm_nonblocking_flush_n(zcm_nonblocking_t* zcm, uint32_t maxMsgs, uint32_t budgetUs)
+{
+    /* The first update is zcm_nonblocking_handle_nonblock_n()'s */
+    zcm_trans_update(zcm->zt);
+    return zcm_nonblocking_handle_nonblock_n(zcm, maxMsgs, budgetUs);
 }
@@ -2,6 +2,7 @@
 #define _ZCM_NONBLOCKING_H
 
 #include "zcm/zcm.h"
+#include "zcm/zcm_private.h"
 #include "zcm/transport.h"
 
 #ifdef __cplusplus
@@ -9,11 +10,80 @@ extern "C" {
 #endif
 
 typedef struct     zcm_nonblocking zcm_nonblocking_t;
+
+/* One subscription of a nonblocking zcm and the links of its hash list */
+typedef struct zcm_nonblocking_slot_t
+{
+    zcm_sub_t sub;
+    bool      inUse;
+    uint32_t  hash;
+    size_t    prefixLen;
+    int       next;
+} zcm_nonblocking_slot_t;
+
+/* The state of a nonblocking zcm. It is only declared here so that callers can
+   allocate it themselves (see ZCM_NONBLOCKING_STORAGE()): treat it as opaque */
+struct zcm_nonblocking
+{
+    zcm_t* z;
+    zcm_trans_t* zt;
+    bool ownsMem;
+
+    bool allChannelsEnabled;
+
+    zcm_nonblocking_slot_t* subs;
+    size_t                  subsMax;
+    size_t                  subInUseEnd;
+
+    /* Non-regex subs are chained (through next) off the bucket of their
+       channel's hash; regex subs are all chained off prefixHead. Both kinds of
+       list are kept sorted by sub index so dispatch order matches subscribe order */
+    int*     buckets;
+    uint32_t bucketMask;
+    int      prefixHead;
+
+    /* Set by zcm_nonblocking_set_dispatch_profiling(). The histograms of the
+       subs' callbacks are only allocated once they have been called */
+    bool               profiling;
+    uint64_t           slowNs;
+    zcm_slow_handler_t slowHandler;
+    void*              slowUsr;
+    uint64_t**         subHist;
+};
+
+/* Declares the memory of a nonblocking zcm with room for 'nsubs' subscriptions
+   hashed into 'nbuckets' buckets (a power of 2), for zcm_nonblocking_create_static():
+   nothing else is allocated, so the RAM a node spends on zcm is known at compile
+   time. The channel names live in the subscriptions, ZCM_CHANNEL_MAXLEN + 1 bytes each.
+       static ZCM_NONBLOCKING_STORAGE(zcmMem, 4, 4);
+       zcm_init_nonblocking(&zcm, ZCM_NONBLOCKING_CREATE_STATIC(&zcm, zt, zcmMem)); */
+#define ZCM_NONBLOCKING_STORAGE(name, nsubs, nbuckets) \
+    struct { \
+        zcm_nonblocking_t      zcm; \
+        zcm_nonblocking_slot_t subs[nsubs]; \
+        int                    buckets[nbuckets]; \
+    } name
+#define ZCM_NONBLOCKING_CREATE_STATIC(z, trans, name) \
+    zcm_nonblocking_create_static((z), (trans), &(name).zcm, \
+        (name).subs, sizeof((name).subs) / sizeof((name).subs[0]), \
+        (name).buckets, sizeof((name).buckets) / sizeof((name).buckets[0]))
+
+/* Mallocs room for ZCM_NONBLOCK_SUBS_MAX subscriptions */
 zcm_nonblocking_t* zcm_nonblocking_create(zcm_t* z, zcm_trans_t* trans);
+/* Uses the memory given instead: 'subs' and 'buckets' must outlive it. Returns
+   NULL if 'nbuckets' isn't a power of 2 */
+zcm_nonblocking_t* zcm_nonblocking_create_static(zcm_t* z, zcm_trans_t* trans,
+                                                 zcm_nonblocking_t* mem,
+                                                 zcm_nonblocking_slot_t* subs, size_t nsubs,
+                                                 int* buckets, size_t nbuckets);
+/* Destroys the transport, and frees the memory unless it was given to
+   zcm_nonblocking_create_static() */
 void               zcm_nonblocking_destroy(zcm_nonblocking_t* zcm);
 
 int        zcm_nonblocking_publish(zcm_nonblocking_t* zcm, const char* channel,
                                    const uint8_t* data, uint32_t len);
+int        zcm_nonblocking_publish_iov(zcm_nonblocking_t* zcm, const char* channel,
+                                       const zcm_iov_t* iov, uint32_t niov);
 zcm_sub_t* zcm_nonblocking_subscribe(zcm_nonblocking_t* zcm, const char* channel,
                                      zcm_msg_handler_t cb, void* usr);
 int        zcm_nonblocking_unsubscribe(zcm_nonblocking_t* zcm, zcm_sub_t* sub);
@@ -21,8 +91,22 @@ int        zcm_nonblocking_unsubscribe(zcm_nonblocking_t* zcm, zcm_sub_t* sub);
 /* Returns 1 if a message was dispatched, and 0 otherwise */
 int zcm_nonblocking_handle_nonblock(zcm_nonblocking_t* zcm);
 
+/* Returns the number of messages dispatched */
+int zcm_nonblocking_handle_nonblock_n(zcm_nonblocking_t* zcm, uint32_t maxMsgs,
+                                      uint32_t budgetUs);
+
 void zcm_nonblocking_flush(zcm_nonblocking_t* zcm);
 
+/* Returns the number of messages dispatched */
+int  zcm_nonblocking_flush_n(zcm_nonblocking_t* zcm, uint32_t maxMsgs, uint32_t budgetUs);
+
+int  zcm_nonblocking_get_stats(zcm_nonblocking_t* zcm, zcm_stat_handler_t cb, void* usr);
+int  zcm_nonblocking_set_dispatch_profiling(zcm_nonblocking_t* zcm, int enable, uint32_t slowUs,
+                                            zcm_slow_handler_t cb, void* usr);
+
+int  zcm_nonblocking_get_fd(zcm_nonblocking_t* zcm);
+int  zcm_nonblocking_has_subscribers(zcm_nonblocking_t* zcm, const char* channel);
+
 #ifdef __cplusplus
 }
 #endif
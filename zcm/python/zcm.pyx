@@ -1,11 +1,31 @@
-from libc.stdint cimport int64_t, int32_t, uint32_t, uint8_t
+from libc.stdint cimport int64_t, int32_t, uint64_t, uint32_t, uint8_t
+from libc.stdlib cimport malloc, realloc, free
+from libc.string cimport memcpy, memcmp, memset, strlen
+from cpython.buffer cimport PyBuffer_FillInfo
 from posix.unistd cimport off_t
+from posix.time cimport clock_gettime, timespec, CLOCK_REALTIME
 import time
 
 cdef extern from "Python.h":
     void PyEval_InitThreads()
 
-cdef extern from "zcm/zcm.h":
+cdef extern from "pthread.h" nogil:
+    ctypedef struct pthread_mutex_t:
+        pass
+    ctypedef struct pthread_cond_t:
+        pass
+    int pthread_mutex_init   (pthread_mutex_t* mutex, void* attr)
+    int pthread_mutex_destroy(pthread_mutex_t* mutex)
+    int pthread_mutex_lock   (pthread_mutex_t* mutex)
+    int pthread_mutex_unlock (pthread_mutex_t* mutex)
+    int pthread_cond_init     (pthread_cond_t* cond, void* attr)
+    int pthread_cond_destroy  (pthread_cond_t* cond)
+    int pthread_cond_signal   (pthread_cond_t* cond)
+    int pthread_cond_wait     (pthread_cond_t* cond, pthread_mutex_t* mutex)
+    int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex,
+                               const timespec* abstime)
+
+cdef extern from "zcm/zcm.h" nogil:
     cdef enum zcm_return_codes:
         ZCM_EOK,
         ZCM_EINVALID,
@@ -36,6 +56,11 @@ cdef extern from "zcm/zcm.h":
 
     int  zcm_publish(zcm_t* zcm, const char* channel, const uint8_t* data, uint32_t dlen)
 
+    ctypedef struct zcm_held_msg_t:
+        pass
+    zcm_held_msg_t* zcm_hold_recv_buf(const zcm_recv_buf_t* rbuf)
+    void            zcm_release_recv_buf(zcm_held_msg_t* held)
+
     int  zcm_try_flush         (zcm_t* zcm)
 
     void zcm_run               (zcm_t* zcm)
@@ -49,7 +74,8 @@ cdef extern from "zcm/zcm.h":
     int  zcm_handle_nonblock(zcm_t* zcm)
 
     ctypedef struct zcm_eventlog_t:
-        pass
+        uint8_t* map
+        size_t   maplen
     ctypedef struct zcm_eventlog_event_t:
         int64_t  eventnum
         int64_t  timestamp
@@ -57,6 +83,7 @@ cdef extern from "zcm/zcm.h":
         int32_t  datalen
         char*    channel
         uint8_t* data
+        int32_t  channelid
 
     zcm_eventlog_t* zcm_eventlog_create(const char* path, const char* mode)
     void            zcm_eventlog_destroy(zcm_eventlog_t* eventlog)
@@ -74,6 +101,25 @@ cdef class ZCMSubscription:
     cdef zcm_sub_t* sub
     cdef object handler
     cdef object msgtype
+    cdef void*  zcm # the ZCM, not counted as a reference so as not to make a cycle
+
+# The data of a message of subscribe_raw(zerocopy=True), viewed where zcm received
+# it for as long as it is in use. zcm_hold_recv_buf() can't keep every message:
+# the others are copied
+cdef class RecvBuffer:
+    cdef object          zcm # holds must be released before zcm_destroy()
+    cdef zcm_held_msg_t* held
+    cdef uint8_t*        data
+    cdef size_t          size
+    def __getbuffer__(self, Py_buffer* buffer, int flags):
+        PyBuffer_FillInfo(buffer, self, self.data, self.size, 1, flags)
+    def __releasebuffer__(self, Py_buffer* buffer):
+        pass
+    def __dealloc__(self):
+        if self.held != NULL:
+            zcm_release_recv_buf(self.held)
+        else:
+            free(self.data)
 
 cdef void handler_cb(const zcm_recv_buf_t* rbuf, const char* channel, void* usr) with gil:
     subs = (<ZCMSubscription>usr)
@@ -84,9 +130,103 @@ cdef void handler_cb_raw(const zcm_recv_buf_t* rbuf, const char* channel, void*
     subs = (<ZCMSubscription>usr)
     subs.handler(channel.decode('utf-8'), rbuf.data[:rbuf.data_size])
 
+cdef void handler_cb_view(const zcm_recv_buf_t* rbuf, const char* channel, void* usr) with gil:
+    subs = (<ZCMSubscription>usr)
+    cdef RecvBuffer buf = RecvBuffer.__new__(RecvBuffer)
+    buf.zcm = <object>subs.zcm
+    buf.size = rbuf.data_size
+    buf.held = zcm_hold_recv_buf(rbuf)
+    if buf.held != NULL:
+        buf.data = rbuf.data
+    else:
+        buf.data = <uint8_t*>malloc(rbuf.data_size + 1)
+        if buf.data == NULL:
+            return
+        memcpy(buf.data, rbuf.data, rbuf.data_size)
+    subs.handler(channel.decode('utf-8'), memoryview(buf))
+
+# Messages of the subscribe_batch() channels, copied into 'data' by the receive
+# thread without taking the GIL, until recv_batch() takes them. Each message is
+# 8 byte aligned: the uint32_t lengths of its channel and data, then both
+cdef struct BatchState:
+    pthread_mutex_t lock
+    pthread_cond_t  cond
+    uint8_t*        data
+    uint8_t*        spare # a buffer given back by recv_batch(), or NULL
+    size_t          size  # of every buffer
+    size_t          used
+    uint32_t        nmsgs
+    uint64_t        dropped
+
+cdef void handler_cb_batch(const zcm_recv_buf_t* rbuf, const char* channel, void* usr) nogil:
+    cdef BatchState* b = <BatchState*>usr
+    cdef uint32_t chanlen = strlen(channel)
+    cdef uint32_t datalen = rbuf.data_size
+    cdef size_t need = (8 + <size_t>chanlen + datalen + 7) & ~(<size_t>7)
+    pthread_mutex_lock(&b.lock)
+    if b.data == NULL or need > b.size - b.used:
+        b.dropped += 1
+    else:
+        memcpy(b.data + b.used, &chanlen, 4)
+        memcpy(b.data + b.used + 4, &datalen, 4)
+        memcpy(b.data + b.used + 8, channel, chanlen)
+        memcpy(b.data + b.used + 8 + chanlen, rbuf.data, datalen)
+        b.used += need
+        b.nmsgs += 1
+        pthread_cond_signal(&b.cond)
+    pthread_mutex_unlock(&b.lock)
+
+cdef class BatchQueue:
+    cdef BatchState* state
+    def __cinit__(self, size_t size):
+        self.state = <BatchState*>malloc(sizeof(BatchState))
+        if self.state == NULL:
+            raise MemoryError()
+        pthread_mutex_init(&self.state.lock, NULL)
+        pthread_cond_init(&self.state.cond, NULL)
+        self.state.spare = NULL
+        self.state.size = size
+        self.state.used = 0
+        self.state.nmsgs = 0
+        self.state.dropped = 0
+        self.state.data = <uint8_t*>malloc(size)
+        if self.state.data == NULL:
+            raise MemoryError()
+    def __dealloc__(self):
+        if self.state == NULL:
+            return
+        free(self.state.data)
+        free(self.state.spare)
+        pthread_cond_destroy(&self.state.cond)
+        pthread_mutex_destroy(&self.state.lock)
+        free(self.state)
+
+# Messages recv_batch() took, viewed by memoryviews. The buffer is given back
+# to be received into again once they are all gone
+cdef class BatchBuffer:
+    cdef BatchQueue queue
+    cdef uint8_t*   data
+    cdef size_t     used
+    def __getbuffer__(self, Py_buffer* buffer, int flags):
+        PyBuffer_FillInfo(buffer, self, self.data, self.used, 1, flags)
+    def __releasebuffer__(self, Py_buffer* buffer):
+        pass
+    def __dealloc__(self):
+        cdef BatchState* b
+        if self.data == NULL:
+            return
+        b = self.queue.state
+        pthread_mutex_lock(&b.lock)
+        if b.spare == NULL:
+            b.spare = self.data
+            self.data = NULL
+        pthread_mutex_unlock(&b.lock)
+        free(self.data)
+
 cdef class ZCM:
     cdef zcm_t* zcm
     cdef object subscriptions
+    cdef BatchQueue batch
     def __cinit__(self, str url=""):
         PyEval_InitThreads()
         self.subscriptions = []
@@ -106,12 +246,20 @@ cdef class ZCM:
         return zcm_strerror(self.zcm).decode('utf-8')
     def strerrno(self, err):
         return zcm_strerrno(err).decode('utf-8')
-    def subscribe_raw(self, str channel, handler):
+    def subscribe_raw(self, str channel, handler, bint zerocopy=False):
+        # With 'zerocopy', 'handler' gets a read-only memoryview of the message
+        # rather than a copy of it in bytes, e.g. for numpy.frombuffer(). It
+        # views the memory zcm received the message into whenever zcm can keep
+        # it (see zcm_hold_recv_buf()) and stays valid for as long as it is in
+        # use, but holding on to many of them takes up the receive buffers
         cdef ZCMSubscription subs = ZCMSubscription()
         subs.handler = handler
         subs.msgtype = None
+        subs.zcm = <void*> self
         while True:
-            subs.sub = zcm_try_subscribe(self.zcm, channel.encode('utf-8'), handler_cb_raw, <void*> subs)
+            subs.sub = zcm_try_subscribe(self.zcm, channel.encode('utf-8'),
+                                         handler_cb_view if zerocopy else handler_cb_raw,
+                                         <void*> subs)
             if subs.sub != NULL:
                 self.subscriptions.append(subs)
                 return subs
@@ -126,6 +274,91 @@ cdef class ZCM:
                 self.subscriptions.append(subs)
                 return subs
             time.sleep(0) # yield the gil
+    def subscribe_batch(self, str channel, size_t bufsize=4*1024*1024):
+        # Queues the messages of 'channel' for recv_batch() rather than calling
+        # a handler for each: the receive thread doesn't take the GIL for them.
+        # 'bufsize' bytes of messages are kept until recv_batch() takes them,
+        # the ones that don't fit are dropped. Only the first call sets it
+        cdef ZCMSubscription subs = ZCMSubscription()
+        if self.batch is None:
+            self.batch = BatchQueue(bufsize)
+        subs.handler = None
+        subs.msgtype = None
+        while True:
+            subs.sub = zcm_try_subscribe(self.zcm, channel.encode('utf-8'), handler_cb_batch,
+                                         <void*> self.batch.state)
+            if subs.sub != NULL:
+                self.subscriptions.append(subs)
+                return subs
+            time.sleep(0) # yield the gil
+    def recv_batch(self, timeout=None):
+        # All the messages of subscribe_batch() channels received since the last
+        # call, as a list of (channel, memoryview of the message data). Waits up
+        # to 'timeout' seconds, or forever if None, for one to arrive if there
+        # were none, without holding the GIL. Messages aren't copied again:
+        # their memoryviews share one buffer, which is received into again
+        # once they are all gone
+        cdef BatchState* b
+        cdef timespec deadline
+        cdef bint forever = timeout is None
+        cdef double secs
+        cdef int err = 0
+        cdef uint8_t* data = NULL
+        cdef size_t used = 0, pos = 0, start
+        cdef uint32_t n = 0, i, chanlen, datalen
+        cdef BatchBuffer taken
+        if self.batch is None:
+            return []
+        b = self.batch.state
+        if not forever:
+            secs = timeout
+            clock_gettime(CLOCK_REALTIME, &deadline)
+            deadline.tv_sec += <long>secs
+            deadline.tv_nsec += <long>((secs - <long>secs) * 1e9)
+            if deadline.tv_nsec >= 1000000000:
+                deadline.tv_sec += 1
+                deadline.tv_nsec -= 1000000000
+        with nogil:
+            pthread_mutex_lock(&b.lock)
+            while b.nmsgs == 0 and err == 0:
+                if forever:
+                    pthread_cond_wait(&b.cond, &b.lock)
+                else:
+                    err = pthread_cond_timedwait(&b.cond, &b.lock, &deadline)
+            if b.nmsgs > 0:
+                data = b.data
+                used = b.used
+                n = b.nmsgs
+                b.data = b.spare if b.spare != NULL else <uint8_t*>malloc(b.size)
+                b.spare = NULL
+                b.used = 0
+                b.nmsgs = 0
+            pthread_mutex_unlock(&b.lock)
+        if n == 0:
+            return []
+        taken = BatchBuffer.__new__(BatchBuffer)
+        taken.queue = self.batch
+        taken.data = data
+        taken.used = used
+        view = memoryview(taken)
+        msgs = []
+        for i in range(n):
+            memcpy(&chanlen, data + pos, 4)
+            memcpy(&datalen, data + pos + 4, 4)
+            start = pos + 8 + chanlen
+            msgs.append(((<char*>data)[pos + 8:start].decode('utf-8'),
+                         view[start:start + datalen]))
+            pos += (8 + <size_t>chanlen + datalen + 7) & ~(<size_t>7)
+        return msgs
+    def batch_dropped(self):
+        # Number of messages of subscribe_batch() channels that didn't fit
+        cdef uint64_t dropped
+        if self.batch is None:
+            return 0
+        pthread_mutex_lock(&self.batch.state.lock)
+        dropped = self.batch.state.dropped
+        pthread_mutex_unlock(&self.batch.state.lock)
+        return dropped
     def unsubscribe(self, ZCMSubscription subs):
         while zcm_try_unsubscribe(self.zcm, subs.sub) != ZCM_EOK:
             time.sleep(0) # yield the gil
@@ -138,7 +371,8 @@ cdef class ZCM:
         while zcm_try_flush(self.zcm) != ZCM_EOK:
             time.sleep(0) # yield the gil
     def run(self):
-        zcm_run(self.zcm)
+        with nogil:
+            zcm_run(self.zcm)
     def start(self):
         zcm_start(self.zcm)
     def stop(self):
@@ -149,7 +383,10 @@ cdef class ZCM:
     def resume(self):
         zcm_resume(self.zcm)
     def handle(self):
-        return zcm_handle(self.zcm)
+        cdef int ret
+        with nogil:
+            ret = zcm_handle(self.zcm)
+        return ret
     def setQueueSize(self, numMsgs):
         while zcm_try_set_queue_size(self.zcm, numMsgs) != ZCM_EOK:
             time.sleep(0) # yield the gil
@@ -180,15 +417,69 @@ cdef class LogEvent:
     def getData(self):
         return self.data
 
+# An event of LogFile.readBatch(): where its channel and data are, in the
+# mapping of the log or in the copy of the batch
+cdef struct LogBatchEvent:
+    int64_t timestamp
+    size_t  chanoff
+    size_t  dataoff
+    int32_t channellen
+    int32_t datalen
+    int32_t channelid
+    bint    mapped
+    bint    chanmapped
+
+# What a batch knows of a channel id: whether its events are wanted (0 until
+# decided, then 1 or -1), and where its name was copied to
+cdef struct LogBatchChannel:
+    int     wanted
+    bint    copied
+    size_t  chanoff
+
+cdef class LogFile
+
+# Memory viewed by the memoryviews of LogFile.readBatch(): the mapping of the
+# log, which can't be closed while they're in use, or a copy of the events
+# that weren't read from it
+cdef class LogBuffer:
+    cdef LogFile  log
+    cdef uint8_t* data
+    cdef size_t   size
+    cdef bint     owned
+    def __getbuffer__(self, Py_buffer* buffer, int flags):
+        PyBuffer_FillInfo(buffer, self, self.data, self.size, 1, flags)
+        if not self.owned:
+            self.log.views += 1
+    def __releasebuffer__(self, Py_buffer* buffer):
+        if not self.owned:
+            self.log.views -= 1
+    def __dealloc__(self):
+        if self.owned:
+            free(self.data)
+
+cdef bint channel_wanted(const zcm_eventlog_event_t* evt, const char** chans,
+                         const int32_t* chanlens, size_t nchans) nogil:
+    cdef size_t i
+    for i in range(nchans):
+        if chanlens[i] == evt.channellen and memcmp(chans[i], evt.channel, evt.channellen) == 0:
+            return True
+    return False
+
 cdef class LogFile:
     cdef zcm_eventlog_t* eventlog
     cdef zcm_eventlog_event_t* lastevent
+    cdef size_t views # memoryviews of the mapping in use
     def __cinit__(self, str path, str mode):
         self.eventlog = zcm_eventlog_create(path.encode('utf-8'), mode.encode('utf-8'))
         self.lastevent = NULL
+        self.views = 0
     def __dealloc__(self):
         self.close()
+    def __iter__(self):
+        return self.iterEvents()
     def close(self):
+        if self.views > 0:
+            raise BufferError("memoryviews of the log's events are still in use")
         if self.eventlog != NULL:
             zcm_eventlog_destroy(self.eventlog)
             self.eventlog = NULL
@@ -220,6 +511,179 @@ cdef class LogFile:
     def readEventOffset(self, off_t offset):
         cdef zcm_eventlog_event_t* evt = zcm_eventlog_read_event_at_offset(self.eventlog, offset)
         return self.__setCurrentEvent(evt)
+    def readBatch(self, size_t maxEvents=4096, channels=None, start=None, end=None):
+        # Up to 'maxEvents' of the next events, as a list of (timestamp, channel,
+        # memoryview of the event data), without making a LogEvent of each.
+        # When given, only the events of 'channels' timestamped from 'start'
+        # through 'end' are returned: those are picked without the GIL, and the
+        # batch stops at the first event after 'end'. Returns [] at the end.
+        # Events read from the mapping of the log are viewed there rather than
+        # copied, and the log can't be closed while their memoryviews are in use
+        cdef bint hasStart = start is not None, hasEnd = end is not None
+        cdef bint hasChans = channels is not None
+        cdef int64_t startTs = start if hasStart else 0
+        cdef int64_t endTs = end if hasEnd else 0
+        cdef list names = [c.encode('utf-8') for c in channels] if hasChans else []
+        cdef size_t nchans = len(names), n = 0, i, len_
+        cdef const char** chans = NULL
+        cdef int32_t* chanlens = NULL
+        cdef LogBatchEvent* evts = NULL
+        cdef LogBatchEvent* rec
+        cdef LogBatchChannel* ids = NULL
+        cdef LogBatchChannel* grownids
+        cdef LogBatchChannel* chan
+        cdef size_t nids = 0, chanlen
+        cdef bint wanted
+        cdef zcm_eventlog_event_t* evt
+        cdef uint8_t* m
+        cdef uint8_t* copy = NULL
+        cdef uint8_t* grown
+        cdef size_t copyused = 0, copysize = 0
+        cdef bint nomem = False, anyMapped = False
+        cdef LogBuffer buf
+        if self.eventlog == NULL or maxEvents == 0:
+            return []
+        m = self.eventlog.map
+        try:
+            chans = <const char**>malloc(nchans * sizeof(char*) + 1)
+            chanlens = <int32_t*>malloc(nchans * sizeof(int32_t) + 1)
+            evts = <LogBatchEvent*>malloc(maxEvents * sizeof(LogBatchEvent))
+            if chans == NULL or chanlens == NULL or evts == NULL:
+                raise MemoryError()
+            for i in range(nchans):
+                chans[i] = names[i]
+                chanlens[i] = len(names[i])
+            with nogil:
+                while n < maxEvents:
+                    evt = zcm_eventlog_read_next_event(self.eventlog)
+                    if evt == NULL:
+                        break
+                    if hasEnd and evt.timestamp > endTs:
+                        zcm_eventlog_free_event(evt)
+                        break
+                    # Events of logs with channel ids are only matched
+                    # against 'channels' once per channel
+                    chan = NULL
+                    if evt.channelid > 0:
+                        if <size_t>evt.channelid > nids:
+                            grownids = <LogBatchChannel*>realloc(ids, (evt.channelid + 64) *
+                                                                 sizeof(LogBatchChannel))
+                            if grownids == NULL:
+                                zcm_eventlog_free_event(evt)
+                                nomem = True
+                                break
+                            memset(grownids + nids, 0,
+                                   (evt.channelid + 64 - nids) * sizeof(LogBatchChannel))
+                            ids = grownids
+                            nids = evt.channelid + 64
+                        chan = &ids[evt.channelid - 1]
+                    wanted = not hasStart or evt.timestamp >= startTs
+                    if wanted and hasChans:
+                        if chan == NULL:
+                            wanted = channel_wanted(evt, chans, chanlens, nchans)
+                        else:
+                            if chan.wanted == 0:
+                                chan.wanted = 1 if channel_wanted(evt, chans, chanlens, nchans) else -1
+                            wanted = chan.wanted > 0
+                    if not wanted:
+                        zcm_eventlog_free_event(evt)
+                        continue
+                    rec = &evts[n]
+                    rec.timestamp  = evt.timestamp
+                    rec.channellen = evt.channellen
+                    rec.datalen    = evt.datalen
+                    rec.channelid  = evt.channelid
+                    rec.mapped = m != NULL and evt.data >= m and \
+                                 evt.data + evt.datalen <= m + self.eventlog.maplen
+                    # The channel is just before the data in the log, unless
+                    # it is referred to by id
+                    rec.chanmapped = rec.mapped and chan == NULL
+                    if rec.mapped:
+                        rec.dataoff = evt.data - m
+                        anyMapped = True
+                    if rec.chanmapped:
+                        rec.chanoff = rec.dataoff - evt.channellen
+                    else:
+                        chanlen = 0 if chan != NULL and chan.copied else evt.channellen
+                        len_ = chanlen + (0 if rec.mapped else evt.datalen)
+                        if copysize - copyused < len_:
+                            copysize = max(2 * copysize, copyused + len_, 1 << 16)
+                            grown = <uint8_t*>realloc(copy, copysize)
+                            if grown == NULL:
+                                zcm_eventlog_free_event(evt)
+                                nomem = True
+                                break
+                            copy = grown
+                        if chanlen == 0:
+                            rec.chanoff = chan.chanoff
+                        else:
+                            rec.chanoff = copyused
+                            memcpy(copy + rec.chanoff, evt.channel, evt.channellen)
+                            copyused += chanlen
+                            if chan != NULL:
+                                chan.copied = True
+                                chan.chanoff = rec.chanoff
+                        if not rec.mapped:
+                            rec.dataoff = copyused
+                            memcpy(copy + rec.dataoff, evt.data, evt.datalen)
+                            copyused += evt.datalen
+                    zcm_eventlog_free_event(evt)
+                    n += 1
+            if nomem:
+                raise MemoryError()
+
+            mapview = copyview = None
+            if anyMapped:
+                buf = LogBuffer.__new__(LogBuffer)
+                buf.log = self
+                buf.data = m
+                buf.size = self.eventlog.maplen
+                buf.owned = False
+                mapview = memoryview(buf)
+            if copy != NULL:
+                buf = LogBuffer.__new__(LogBuffer)
+                buf.data = copy
+                buf.size = copyused
+                buf.owned = True
+                copy = NULL
+                copyview = memoryview(buf)
+
+            # Channels are only decoded once a batch
+            decoded = {}
+            byid = {}
+            batch = []
+            for i in range(n):
+                rec = &evts[i]
+                view = mapview if rec.mapped else copyview
+                name = byid.get(rec.channelid) if rec.channelid > 0 else None
+                if name is None:
+                    chanview = mapview if rec.chanmapped else copyview
+                    chanbytes = bytes(chanview[rec.chanoff:rec.chanoff + rec.channellen])
+                    name = decoded.get(chanbytes)
+                    if name is None:
+                        name = decoded[chanbytes] = chanbytes.decode('utf-8')
+                    if rec.channelid > 0:
+                        byid[rec.channelid] = name
+                batch.append((rec.timestamp, name, view[rec.dataoff:rec.dataoff + rec.datalen]))
+            return batch
+        finally:
+            free(chans)
+            free(chanlens)
+            free(evts)
+            free(ids)
+            free(copy)
+    def iterEvents(self, channels=None, start=None, end=None, size_t batchSize=4096):
+        # Iterates over the (timestamp, channel, data) of the events from the
+        # read position on, or from 'start' if given, reading them through
+        # readBatch(). Iterating over the log itself goes through all of them
+        if start is not None and self.seekToTimestamp(start) != 0:
+            return
+        while True:
+            batch = self.readBatch(batchSize, channels, start, end)
+            if not batch:
+                return
+            for evt in batch:
+                yield evt
     def writeEvent(self, LogEvent event):
         cdef zcm_eventlog_event_t evt
         evt.eventnum   = event.eventnum
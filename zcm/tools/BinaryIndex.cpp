@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "BinaryIndex.hpp"
+
+using namespace zcm;
+
+static const char MAGIC[8] = { 'Z', 'C', 'M', '-', 'I', 'D', 'X', '1' };
+static const size_t HEADER_SIZE = sizeof(MAGIC) + sizeof(uint64_t);
+static const size_t ENTRY_WORDS = 5;
+enum { ENTRY_PLUGIN, ENTRY_CHANNEL, ENTRY_TYPE, ENTRY_OFFSETS, ENTRY_COUNT };
+
+void BinaryPluginIndex::add(const std::string& channel, const std::string& typeName,
+                            uint64_t offset)
+{ offsets[std::make_pair(channel, typeName)].push_back(offset); }
+
+void BinaryPluginIndex::merge(BinaryPluginIndex& other)
+{
+    for (auto& o : other.offsets) {
+        auto& to = offsets[o.first];
+        if (to.empty()) to.swap(o.second);
+        else to.insert(to.end(), o.second.begin(), o.second.end());
+    }
+    other.offsets.clear();
+}
+
+size_t BinaryPluginIndex::size() const
+{
+    size_t n = 0;
+    for (auto& o : offsets) n += o.second.size();
+    return n;
+}
+
+BinaryPluginIndex& BinaryIndexWriter::plugin(const std::string& name)
+{ return plugins[name]; }
+
+bool BinaryIndexWriter::write(const std::string& path)
+{
+    struct Entry
+    {
+        const std::string* plugin;
+        const std::string* channel;
+        const std::string* type;
+        std::vector<uint64_t>* offsets;
+    };
+    // Both maps are ordered, so entries come out sorted
+    std::vector<Entry> entries;
+    for (auto& p : plugins) {
+        for (auto& o : p.second.offsets) {
+            std::sort(o.second.begin(), o.second.end());
+            o.second.erase(std::unique(o.second.begin(), o.second.end()), o.second.end());
+            entries.push_back({ &p.first, &o.first.first, &o.first.second, &o.second });
+        }
+    }
+
+    std::vector<uint64_t> table;
+    std::string strings;
+    uint64_t stringsStart = HEADER_SIZE + entries.size() * ENTRY_WORDS * sizeof(uint64_t);
+    std::map<std::string, uint64_t> stringOffsets;
+    auto addString = [&](const std::string& s) {
+        auto it = stringOffsets.find(s);
+        if (it != stringOffsets.end()) return it->second;
+        uint64_t off = stringsStart + strings.size();
+        strings.append(s.c_str(), s.size() + 1);
+        stringOffsets[s] = off;
+        return off;
+    };
+    for (auto& e : entries) {
+        table.push_back(addString(*e.plugin));
+        table.push_back(addString(*e.channel));
+        table.push_back(addString(*e.type));
+        table.push_back(0);
+        table.push_back(e.offsets->size());
+    }
+    strings.resize((strings.size() + 7) & ~(size_t) 7, '\0');
+
+    uint64_t offsetsAt = stringsStart + strings.size();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        table[i * ENTRY_WORDS + ENTRY_OFFSETS] = offsetsAt;
+        offsetsAt += entries[i].offsets->size() * sizeof(uint64_t);
+    }
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    uint64_t nentries = entries.size();
+    bool ok = fwrite(MAGIC, sizeof(MAGIC), 1, f) == 1 &&
+              fwrite(&nentries, sizeof(nentries), 1, f) == 1 &&
+              fwrite(table.data(), sizeof(uint64_t), table.size(), f) == table.size() &&
+              fwrite(strings.data(), 1, strings.size(), f) == strings.size();
+    for (size_t i = 0; ok && i < entries.size(); ++i) {
+        auto& o = *entries[i].offsets;
+        ok = fwrite(o.data(), sizeof(uint64_t), o.size(), f) == o.size();
+    }
+    if (fclose(f) != 0) ok = false;
+    return ok;
+}
+
+BinaryIndex::BinaryIndex(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= HEADER_SIZE) {
+        void* m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (m != MAP_FAILED) {
+            map = (uint8_t*) m;
+            maplen = st.st_size;
+        }
+    }
+    close(fd);
+    if (!map) return;
+
+    // Check everything up front, so that accessors don't have to
+    uint64_t n;
+    memcpy(&n, map + sizeof(MAGIC), sizeof(n));
+    bool ok = memcmp(map, MAGIC, sizeof(MAGIC)) == 0 &&
+              n <= (maplen - HEADER_SIZE) / (ENTRY_WORDS * sizeof(uint64_t));
+    for (size_t i = 0; ok && i < n; ++i) {
+        const uint64_t* e = (const uint64_t*) (map + HEADER_SIZE) + i * ENTRY_WORDS;
+        for (int s = ENTRY_PLUGIN; ok && s <= ENTRY_TYPE; ++s)
+            ok = e[s] < maplen && memchr(map + e[s], '\0', maplen - e[s]);
+        ok = ok && e[ENTRY_OFFSETS] % sizeof(uint64_t) == 0 &&
+             e[ENTRY_OFFSETS] <= maplen &&
+             e[ENTRY_COUNT] <= (maplen - e[ENTRY_OFFSETS]) / sizeof(uint64_t);
+    }
+    if (!ok) {
+        munmap(map, maplen);
+        map = nullptr;
+        return;
+    }
+    nentries = n;
+    madvise(map, maplen, MADV_RANDOM);
+}
+
+BinaryIndex::~BinaryIndex()
+{
+    if (map) munmap(map, maplen);
+}
+
+bool BinaryIndex::good() const
+{ return map != nullptr; }
+
+size_t BinaryIndex::numEntries() const
+{ return nentries; }
+
+const uint64_t* BinaryIndex::entry(size_t i) const
+{ return (const uint64_t*) (map + HEADER_SIZE) + i * ENTRY_WORDS; }
+
+const char* BinaryIndex::plugin(size_t i) const
+{ return (const char*) map + entry(i)[ENTRY_PLUGIN]; }
+
+const char* BinaryIndex::channel(size_t i) const
+{ return (const char*) map + entry(i)[ENTRY_CHANNEL]; }
+
+const char* BinaryIndex::typeName(size_t i) const
+{ return (const char*) map + entry(i)[ENTRY_TYPE]; }
+
+BinaryIndex::Offsets BinaryIndex::offsets(size_t i) const
+{
+    const uint64_t* begin = (const uint64_t*) (map + entry(i)[ENTRY_OFFSETS]);
+    return { begin, begin + entry(i)[ENTRY_COUNT] };
+}
+
+BinaryIndex::Offsets BinaryIndex::find(const std::string& p, const std::string& c,
+                                       const std::string& t) const
+{
+    size_t lo = 0, hi = nentries;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(plugin(mid), p.c_str());
+        if (cmp == 0) cmp = strcmp(channel(mid), c.c_str());
+        if (cmp == 0) cmp = strcmp(typeName(mid), t.c_str());
+        if (cmp == 0) return offsets(mid);
+        if (cmp < 0) lo = mid + 1;
+        else         hi = mid;
+    }
+    return { nullptr, nullptr };
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+//
+// Binary log indexes, as written by zcm-log-indexer --binary: for every plugin
+// and every channel and type it indexed, the sorted offsets of the events.
+// Files are meant to be memory mapped as is:
+//
+//   "ZCM-IDX1"                  magic
+//   uint64_t nentries
+//   Entry    entries[nentries]  sorted by plugin, channel then type
+//   char     strings[]          NULL terminated names the entries point at
+//   uint64_t offsets[]          each array sorted, 8 byte aligned
+//
+// where an Entry is 5 uint64_t: the file offsets of its plugin, channel and
+// type names and of its offsets, then the number of these. Everything is in
+// host byte order: the magic reads differently on hosts of the other order.
+//
+
+namespace zcm {
+
+// What a plugin writes into a binary index: 8 bytes per event indexed, rather
+// than a Json node
+class BinaryPluginIndex
+{
+  public:
+    // Offsets can be added in any order and more than once: they are sorted,
+    // and duplicates removed, when the index is written
+    void add(const std::string& channel, const std::string& typeName, uint64_t offset);
+
+    // Appends all the offsets of 'other', which is left empty
+    void merge(BinaryPluginIndex& other);
+
+    size_t size() const;
+
+  private:
+    friend class BinaryIndexWriter;
+    std::map<std::pair<std::string, std::string>, std::vector<uint64_t>> offsets;
+};
+
+class BinaryIndexWriter
+{
+  public:
+    // The index of plugin 'name', created empty on its first use
+    BinaryPluginIndex& plugin(const std::string& name);
+
+    // Returns true on success
+    bool write(const std::string& path);
+
+  private:
+    std::map<std::string, BinaryPluginIndex> plugins;
+};
+
+class BinaryIndex
+{
+  public:
+    struct Offsets
+    {
+        const uint64_t* begin;
+        const uint64_t* end;
+        size_t size() const { return end - begin; }
+    };
+
+    BinaryIndex(const std::string& path);
+    ~BinaryIndex();
+
+    bool good() const;
+
+    // Entries, in the order of their plugin, channel and type names
+    size_t numEntries() const;
+    const char* plugin(size_t entry) const;
+    const char* channel(size_t entry) const;
+    const char* typeName(size_t entry) const;
+    Offsets offsets(size_t entry) const;
+
+    // Returns an empty range if the plugin didn't index that channel and type
+    Offsets find(const std::string& plugin, const std::string& channel,
+                 const std::string& typeName) const;
+
+  private:
+    BinaryIndex(const BinaryIndex&) = delete;
+    BinaryIndex& operator=(const BinaryIndex&) = delete;
+
+    const uint64_t* entry(size_t i) const;
+
+    uint8_t* map = nullptr;
+    size_t maplen = 0;
+    size_t nentries = 0;
+};
+
+}
@@ -77,3 +77,74 @@ void IndexerPlugin::tearDown(const zcm::Json::Value& index,
 
 
 }
+
+// Plugins deriving from this one only are if they say so
+bool IndexerPlugin::binaryIndexable() const
+{ return typeid(*this) == typeid(IndexerPlugin); }
+
+void IndexerPlugin::indexBinaryEvent(const zcm::Json::Value& index,
+                                     zcm::BinaryPluginIndex& pluginIndex,
+                                     zcm::Json::Value& annotations,
+                                     const std::string& channel,
+                                     const std::string& typeName,
+                                     off_t offset,
+                                     uint64_t timestamp,
+                                     int64_t hash,
+                                     const uint8_t* data,
+                                     int32_t datalen)
+{ pluginIndex.add(channel, typeName, offset); }
+
+bool IndexerPlugin::streamsDependencies() const
+{ return false; }
+
+void IndexerPlugin::indexAnnotatedEvent(const zcm::Json::Value& index,
+                                        zcm::Json::Value& pluginIndex,
+                                        zcm::Json::Value& annotations,
+                                        const std::string& channel,
+                                        const std::string& typeName,
+                                        off_t offset,
+                                        uint64_t timestamp,
+                                        int64_t hash,
+                                        const uint8_t* data,
+                                        int32_t datalen)
+{
+    // Only plugins that still override indexEvent alone pay for its copies
+    if (typeid(*this) == typeid(IndexerPlugin))
+        pluginIndex[channel][typeName].append(std::to_string(offset));
+    else
+        indexEvent(index, pluginIndex, channel, typeName,
+                   offset, timestamp, hash, data, datalen);
+}
+
+// Plugins deriving from this one only are if they say so
+bool IndexerPlugin::mergeable() const
+{ return typeid(*this) == typeid(IndexerPlugin); }
+
+void IndexerPlugin::merge(const zcm::Json::Value& index,
+                          zcm::Json::Value& pluginIndex,
+                          const zcm::Json::Value& rangeIndex)
+{
+    for (std::string channel : rangeIndex.getMemberNames()) {
+        for (std::string type : rangeIndex[channel].getMemberNames()) {
+            zcm::Json::Value& offsets = pluginIndex[channel][type];
+            for (const auto& offset : rangeIndex[channel][type])
+                offsets.append(offset);
+        }
+    }
+}
+
+// Plugins deriving from this one only are if they say so
+bool IndexerPlugin::resumable() const
+{ return typeid(*this) == typeid(IndexerPlugin); }
+
+// The default plugin's index is all there is to it
+void IndexerPlugin::checkpoint(const zcm::Json::Value& index,
+                               const zcm::Json::Value& pluginIndex,
+                               zcm::Json::Value& state)
+{}
+
+bool IndexerPlugin::resume(const zcm::Json::Value& index,
+                           zcm::Json::Value& pluginIndex,
+                           const zcm::Json::Value& state,
+                           zcm::LogFile& log)
+{ return true; }
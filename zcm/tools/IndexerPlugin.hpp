@@ -6,6 +6,7 @@
 
 #include "zcm/zcm-cpp.hpp"
 #include "zcm/json/json.h"
+#include "zcm/tools/BinaryIndex.hpp"
 
 //
 // Remember you must inherit from this class and implement your functions
@@ -118,11 +119,18 @@ class IndexerPlugin
 
     // pluginIndex is the index you should modify. It is your json object that
     // will be passed back to this function every time the function is called.
-    // This function will be called on every event in the log
+    // This function will be called on every event in the log, through the
+    // default indexAnnotatedEvent below. Overriding that one instead saves
+    // copying channel and typeName for every event
     //
     // index is the entire json object containing the output of every plugin run
     // so far
     //
+    // NOTE: The plugins that have no dependencies on each other are run
+    //       through the log at the same time, each on a thread of its own.
+    //       Only ever modify pluginIndex, and only read the parts of index
+    //       written by the plugins you depend on
+    //
     // channel is the channel name of the event
     //
     // typeName is the name of the zcmtype encoded inside the event
@@ -167,6 +175,89 @@ class IndexerPlugin
     virtual void tearDown(const zcm::Json::Value& index,
                           zcm::Json::Value& pluginIndex,
                           zcm::LogFile& log);
+
+    // Return true from this if your plugin can index parts of the log on their
+    // own and merge the results. The indexer may then cut the log into ranges
+    // of events and index them all at once, each range on a thread of its own:
+    // indexEvent is called on the events of a range in order, starting from an
+    // empty pluginIndex for that range. It must therefore only ever touch the
+    // pluginIndex it is handed, as other calls run concurrently. The result of
+    // every range is then handed to merge, in the order of the log. Only the
+    // default plugin itself is mergeable by default.
+    virtual bool mergeable() const;
+
+    // Merge rangeIndex, the pluginIndex of the next range of the log, into
+    // pluginIndex. Called after setUp and before tearDown, on mergeable
+    // plugins only. The default plugin appends the offsets of rangeIndex
+    virtual void merge(const zcm::Json::Value& index,
+                       zcm::Json::Value& pluginIndex,
+                       const zcm::Json::Value& rangeIndex);
+
+    // Return true from this if your plugin only needs what the plugins it
+    // depends on annotate each event with (see below), rather than their
+    // final index. It then runs in the same pass through the log as them,
+    // right after them on every event, instead of in a later pass of its own.
+    // Their part of the index passed to setUp is then still empty.
+    virtual bool streamsDependencies() const;
+
+    // Same as indexEvent, with the annotations of the event at hand: what the
+    // plugins run on it before this one wrote under their own name. Plugins
+    // that annotate events write theirs to annotations[name()], and plugins
+    // that stream their dependencies read those of them. channel and
+    // typeName are only valid for the duration of the call.
+    // This is the one the indexer calls: unlike indexEvent, which it calls by
+    // default and which plugins can keep overriding, it copies no strings.
+    virtual void indexAnnotatedEvent(const zcm::Json::Value& index,
+                                     zcm::Json::Value& pluginIndex,
+                                     zcm::Json::Value& annotations,
+                                     const std::string& channel,
+                                     const std::string& typeName,
+                                     off_t offset,
+                                     uint64_t timestamp,
+                                     int64_t hash,
+                                     const uint8_t* data,
+                                     int32_t datalen);
+
+    // Return true from this if your plugin can write binary indexes
+    // (zcm-log-indexer --binary, see BinaryIndex.hpp) through indexBinaryEvent.
+    // Only the default plugin itself can by default.
+    virtual bool binaryIndexable() const;
+
+    // Same as indexAnnotatedEvent, when writing a binary index: add the offsets
+    // your plugin indexes to pluginIndex, which sorts them on its own. Your
+    // part of index stays empty, and setUp and tearDown are still called on it
+    virtual void indexBinaryEvent(const zcm::Json::Value& index,
+                                  zcm::BinaryPluginIndex& pluginIndex,
+                                  zcm::Json::Value& annotations,
+                                  const std::string& channel,
+                                  const std::string& typeName,
+                                  off_t offset,
+                                  uint64_t timestamp,
+                                  int64_t hash,
+                                  const uint8_t* data,
+                                  int32_t datalen);
+
+    // Return true from this if your plugin can carry on indexing a log that
+    // grew since it was last indexed, rather than start over
+    // (zcm-log-indexer --incremental and --follow). Only the default plugin
+    // itself can by default.
+    virtual bool resumable() const;
+
+    // Called after tearDown when the indexer saves where it got to in the log:
+    // write anything besides pluginIndex that your plugin needs to carry on
+    // into state, which must hold json only
+    virtual void checkpoint(const zcm::Json::Value& index,
+                            const zcm::Json::Value& pluginIndex,
+                            zcm::Json::Value& state);
+
+    // Called instead of setUp when carrying on from a checkpoint: pluginIndex
+    // is as it was after tearDown then, and state as checkpoint left it.
+    // Events are then only passed in from where the last run stopped, and
+    // tearDown is called again once they are. Return as from setUp
+    virtual bool resume(const zcm::Json::Value& index,
+                        zcm::Json::Value& pluginIndex,
+                        const zcm::Json::Value& state,
+                        zcm::LogFile& log);
 };
 
 }
@@ -0,0 +1,427 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <type_traits>
+#include <unordered_map>
+
+#include "zcm/zcm-cpp.hpp"
+#include "zcm/zcm_inline_vector.hpp"
+#include "zcm/zcm_string_list.hpp"
+
+//
+// Exports the messages of a log to text through the visit() method zcm-gen
+// gives every C++ zcmtype: the code that formats each type is compiled for it,
+// so nothing is looked up by name or walked through type info per message.
+//
+// zcm-log-export loads the types to export from a shared library that names
+// them. All it takes is a cpp file like:
+//
+// #include <zcm/tools/LogExport.hpp>
+// #include "types/pose_t.hpp"
+// #include "types/image_t.hpp"
+//
+// ZCM_LOG_EXPORT_TYPES(pose_t, image_t)
+//
+// compiled with:
+//
+// g++ -std=c++11 -O2 -fPIC -shared ExportTypes.cpp -o export-types.so
+//
+// Formats:
+//   JSON: one object per line: {"log_utime":..,"channel":"..","type":"..","msg":{..}}
+//   CSV:  one row per message, a column per scalar. Nested types and fixed size
+//         arrays are flattened into columns named "pose.pos[0]"; variable size
+//         arrays don't have a fixed number of columns, so each is one cell
+//         holding the array as JSON
+//
+
+namespace zcm {
+
+namespace exportfmt {
+
+// Whether T is a zcmtype (has getHash() and visit())
+template <class T>
+class IsMessage
+{
+    template <class U> static std::true_type test(decltype(U::getHash())*);
+    template <class U> static std::false_type test(...);
+  public:
+    static constexpr bool value = decltype(test<T>(nullptr))::value;
+};
+
+template <class T>
+static inline void putInt(std::string& out, T v)
+{
+    char tmp[24];
+    char* end = tmp + sizeof(tmp);
+    char* p = end;
+    bool neg = v < 0;
+    // Negated unsigned, so the most negative value doesn't overflow
+    uint64_t u = neg ? 0 - (uint64_t) v : (uint64_t) v;
+    do { *--p = (char) ('0' + u % 10); u /= 10; } while (u);
+    if (neg) *--p = '-';
+    out.append(p, end - p);
+}
+
+// Shortest precision that keeps every float or double exact. NaN and
+// infinity aren't JSON numbers: 'NaN' and 'Infinity' are what most readers take
+// of CSV, null what they take of JSON
+static inline void putFloat(std::string& out, double v, int digits, bool json)
+{
+    if (!std::isfinite(v)) {
+        if (json) out += "null";
+        else out += std::isnan(v) ? "NaN" : (v > 0 ? "Infinity" : "-Infinity");
+        return;
+    }
+    char tmp[32];
+    int n = snprintf(tmp, sizeof(tmp), "%.*g", digits, v);
+    out.append(tmp, n);
+}
+
+static inline void putJsonString(std::string& out, const char* s, size_t len)
+{
+    static const char* hex = "0123456789abcdef";
+    out += '"';
+    size_t run = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char) s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        out.append(s + run, i - run);
+        run = i + 1;
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            case '\t': out += "\\t";  break;
+            default:
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xf];
+        }
+    }
+    out.append(s + run, len - run);
+    out += '"';
+}
+
+// Cells with a separator, a quote or a line break in them are quoted, their
+// quotes doubled (RFC 4180)
+static inline void putCsvCell(std::string& out, const char* s, size_t len)
+{
+    bool quote = false;
+    for (size_t i = 0; i < len && !quote; ++i)
+        quote = s[i] == ',' || s[i] == '"' || s[i] == '\n' || s[i] == '\r';
+    if (!quote) {
+        out.append(s, len);
+        return;
+    }
+    out += '"';
+    for (size_t i = 0; i < len; ++i) {
+        if (s[i] == '"') out += '"';
+        out += s[i];
+    }
+    out += '"';
+}
+
+}
+
+// Visitor writing a message as a JSON object's members, into 'out'
+class JsonWriter
+{
+  public:
+    explicit JsonWriter(std::string& out) : out(out) {}
+
+    template <class T>
+    void field(const char* name, const T& v)
+    {
+        if (!first) out += ',';
+        first = false;
+        out += '"';
+        out += name;
+        out += "\":";
+        value(v);
+    }
+
+    template <class T>
+    typename std::enable_if<std::is_integral<T>::value>::type value(T v)
+    { exportfmt::putInt(out, v); }
+
+    void value(float v)  { exportfmt::putFloat(out, v, 9, true); }
+    void value(double v) { exportfmt::putFloat(out, v, 17, true); }
+
+    void value(const std::string& s) { exportfmt::putJsonString(out, s.data(), s.size()); }
+
+    void value(const StringList& l)
+    {
+        out += '[';
+        for (size_t i = 0; i < l.size(); ++i) {
+            if (i) out += ',';
+            exportfmt::putJsonString(out, l[i], l.length(i));
+        }
+        out += ']';
+    }
+
+    template <class T>
+    void value(const std::vector<T>& a) { seq(a.data(), a.size()); }
+
+    template <class T, size_t N>
+    void value(const InlineVector<T, N>& a) { seq(a.data(), a.size()); }
+
+    template <class T, size_t N>
+    void value(const T (&a)[N]) { seq(a, N); }
+
+    template <class T>
+    typename std::enable_if<exportfmt::IsMessage<T>::value>::type value(const T& m)
+    {
+        out += '{';
+        JsonWriter w(out);
+        m.visit(w);
+        out += '}';
+    }
+
+  private:
+    template <class T>
+    void seq(const T* a, size_t n)
+    {
+        out += '[';
+        for (size_t i = 0; i < n; ++i) {
+            if (i) out += ',';
+            value(a[i]);
+        }
+        out += ']';
+    }
+
+    std::string& out;
+    bool first = true;
+};
+
+// Visitor writing a message as one CSV row (without the line break) into
+// 'out', or with 'header' its column names
+class CsvWriter
+{
+  public:
+    CsvWriter(std::string& out, bool header) : out(out), header(header) {}
+
+    // Starts the row after what is already in it, e.g. the time of the event
+    void continueRow() { first = false; }
+
+    template <class T>
+    void field(const char* name, const T& v)
+    {
+        size_t len = prefix.size();
+        prefix += name;
+        column(v);
+        prefix.resize(len);
+    }
+
+    template <class T>
+    typename std::enable_if<std::is_integral<T>::value>::type column(T v)
+    {
+        if (cell()) return;
+        exportfmt::putInt(out, v);
+    }
+
+    void column(float v)
+    {
+        if (cell()) return;
+        exportfmt::putFloat(out, v, 9, false);
+    }
+
+    void column(double v)
+    {
+        if (cell()) return;
+        exportfmt::putFloat(out, v, 17, false);
+    }
+
+    void column(const std::string& s)
+    {
+        if (cell()) return;
+        exportfmt::putCsvCell(out, s.data(), s.size());
+    }
+
+    template <class T, size_t N>
+    void column(const T (&a)[N])
+    {
+        size_t len = prefix.size();
+        for (size_t i = 0; i < N; ++i) {
+            prefix += '[';
+            exportfmt::putInt(prefix, i);
+            prefix += ']';
+            column(a[i]);
+            prefix.resize(len);
+        }
+    }
+
+    template <class T>
+    typename std::enable_if<exportfmt::IsMessage<T>::value>::type column(const T& m)
+    {
+        prefix += '.';
+        m.visit(*this);
+        prefix.pop_back();
+    }
+
+    // Variable size arrays
+    template <class T>
+    void column(const std::vector<T>& a) { jsonCell(a); }
+    template <class T, size_t N>
+    void column(const InlineVector<T, N>& a) { jsonCell(a); }
+    void column(const StringList& l) { jsonCell(l); }
+
+  private:
+    // Starts a cell. Returns true if the header's name filled it
+    bool cell()
+    {
+        if (!first) out += ',';
+        first = false;
+        if (!header) return false;
+        out += prefix;
+        return true;
+    }
+
+    template <class T>
+    void jsonCell(const T& a)
+    {
+        if (cell()) return;
+        json.clear();
+        JsonWriter(json).value(a);
+        exportfmt::putCsvCell(out, json.data(), json.size());
+    }
+
+    std::string& out;
+    bool header;
+    bool first = true;
+    std::string prefix;
+    std::string json;
+};
+
+// The types a log is exported with, and the formatting of its events
+class LogExporter
+{
+  public:
+    enum Format { JSON, CSV };
+
+    // Makes the types given exportable
+    template <class... Msgs>
+    void add()
+    {
+        int dummy[] = { 0, (addOne<Msgs>(), 0)... };
+        (void) dummy;
+    }
+
+    size_t numTypes() const { return handlers.size(); }
+
+    // The name of the type of 'le', null if it isn't one added
+    const char* typeName(const LogEvent& le) const
+    {
+        const Handler* h = find(le);
+        return h ? h->name : nullptr;
+    }
+
+    // Appends 'le' to 'out' in 'fmt': a JSON line, or a CSV row of its time and
+    // its message, line break included. Returns false, leaving 'out' as it
+    // was, if its type isn't one added or it fails to decode
+    bool write(const LogEvent& le, Format fmt, std::string& out)
+    {
+        const Handler* h = find(le);
+        if (!h) return false;
+        size_t len = out.size();
+        if (fmt == JSON) {
+            out += "{\"log_utime\":";
+            exportfmt::putInt(out, le.timestamp);
+            out += ",\"channel\":";
+            exportfmt::putJsonString(out, le.channel.data(), le.channel.size());
+            out += ",\"type\":\"";
+            out += h->name;
+            out += "\",\"msg\":";
+        } else {
+            exportfmt::putInt(out, le.timestamp);
+        }
+        if (!h->write(le, fmt, out)) {
+            out.resize(len);
+            return false;
+        }
+        if (fmt == JSON) out += '}';
+        out += '\n';
+        return true;
+    }
+
+    // Appends the CSV column names of the type of 'le' to 'out', line break
+    // included. Returns false if its type isn't one added
+    bool writeCsvHeader(const LogEvent& le, std::string& out) const
+    {
+        const Handler* h = find(le);
+        if (!h) return false;
+        out += "log_utime";
+        h->header(out);
+        out += '\n';
+        return true;
+    }
+
+  private:
+    struct Handler
+    {
+        const char* name;
+        std::function<bool(const LogEvent&, Format, std::string&)> write;
+        std::function<void(std::string&)> header;
+    };
+
+    template <class Msg>
+    void addOne()
+    {
+        // The one message each event of the type is decoded into, so its
+        // arrays keep their memory from one event to the next
+        std::shared_ptr<Msg> msg(new Msg());
+        Handler h;
+        h.name = Msg::getTypeName();
+        h.write = [msg](const LogEvent& le, Format fmt, std::string& out) {
+            if (msg->decode(le.data, 0, le.datalen) < 0) return false;
+            if (fmt == JSON) {
+                JsonWriter(out).value(*msg);
+            } else {
+                CsvWriter w(out, false);
+                w.continueRow();
+                msg->visit(w);
+            }
+            return true;
+        };
+        h.header = [](std::string& out) {
+            Msg m;
+            CsvWriter w(out, true);
+            w.continueRow();
+            m.visit(w);
+        };
+        handlers[(uint64_t) Msg::getHash()] = std::move(h);
+    }
+
+    // Messages start with their type's hash: big endian, or little endian for
+    // types generated with --little-endian-encoding
+    const Handler* find(const LogEvent& le) const
+    {
+        if (le.datalen < 8) return nullptr;
+        uint64_t be = 0, le64 = 0;
+        for (int i = 0; i < 8; ++i) {
+            be = (be << 8) | le.data[i];
+            le64 |= (uint64_t) le.data[i] << (8 * i);
+        }
+        auto it = handlers.find(be);
+        if (it == handlers.end()) it = handlers.find(le64);
+        return it == handlers.end() ? nullptr : &it->second;
+    }
+
+    std::unordered_map<uint64_t, Handler> handlers;
+};
+
+}
+
+// What zcm-log-export looks up in the library it loads
+#define ZCM_LOG_EXPORT_SYMBOL "zcm_log_export_types"
+
+// Defines the entry point giving zcm-log-export the types listed
+#define ZCM_LOG_EXPORT_TYPES(...) \
+    extern "C" void zcm_log_export_types(zcm::LogExporter* ex) { ex->add<__VA_ARGS__>(); }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <cstring>
 #include <cstdint>
 
 #include "zcm/zcm-cpp.hpp"
@@ -37,6 +39,42 @@
 
 namespace zcm {
 
+// Where transcodeEventInto() puts the events to write. Owned by the host and
+// reused: the events are copied into buffers kept from one use to the next
+class TranscoderOutput
+{
+  public:
+    // Returns where to encode the 'datalen' bytes of its data
+    uint8_t* add(int64_t timestamp, const std::string& channel, int32_t datalen)
+    {
+        if (n == slots.size()) slots.resize(n + 1);
+        Slot& s = slots[n++];
+        s.evt.eventnum = 0;
+        s.evt.timestamp = timestamp;
+        s.evt.channel = channel;
+        s.data.resize(datalen);
+        s.evt.datalen = datalen;
+        s.evt.data = s.data.data();
+        return s.evt.data;
+    }
+
+    void add(const LogEvent* evt)
+    { memcpy(add(evt->timestamp, evt->channel, evt->datalen), evt->data, evt->datalen); }
+
+    size_t size() const { return n; }
+    const LogEvent* operator[](size_t i) const { return &slots[i].evt; }
+    void clear() { n = 0; }
+
+  private:
+    struct Slot
+    {
+        LogEvent evt;
+        std::vector<uint8_t> data;
+    };
+    std::vector<Slot> slots;
+    size_t n = 0;
+};
+
 class TranscoderPlugin
 {
   public:
@@ -51,7 +89,9 @@ class TranscoderPlugin
     virtual ~TranscoderPlugin() {}
 
     //
-    // hash is the hash of the type encoded inside the event
+    // hash is the hash of the type encoded inside the event. With many types to
+    // tell apart, zcm::MsgSwitch (zcm/zcm_dispatch.hpp) finds which it is with
+    // one lookup rather than a chain of comparisons
     //
     //  if (hash == msg_t::getHash()) {
     //      old_t oldMsg;
@@ -82,6 +122,41 @@ class TranscoderPlugin
     {
         return TYPE_NO_RECORD();
     }
+
+    //
+    // Same as transcodeEvent, without building a vector per call: add the
+    // events you want to transcode this event into to 'out', and return
+    // whether you handled it (false being TYPE_NOT_HANDLED). Adding nothing
+    // and returning true is TYPE_NO_RECORD. This is the one hosts call: the
+    // default calls transcodeEvent
+    //
+    //  uint8_t* buf = out.add(evt->timestamp, evt->channel, newMsg.getEncodedSize());
+    //  newMsg.encode(buf, 0, newMsg.getEncodedSize());
+    //  return true;
+    //
+    virtual bool transcodeEventInto(int64_t hash, const LogEvent* evt, TranscoderOutput& out)
+    {
+        std::vector<const LogEvent*> evts = transcodeEvent(hash, evt);
+        for (auto* e : evts)
+            if (e) out.add(e);
+        return !evts.empty();
+    }
+
+    //
+    // zcm-log-transcoder transcodes events on several threads at once. Return
+    // true from this if transcodeEvent can be called on this instance from all
+    // of them concurrently: the events it returns must then stay valid until
+    // the next call made from the same thread. Otherwise every thread gets an
+    // instance of its own, made with makeTranscoderPlugin()
+    //
+    virtual bool threadSafe() const { return false; }
+
+    //
+    // The hashes of the types transcodeEvent handles: events of other types
+    // are then written as they are without calling it. Return nothing, the
+    // default, to be called on every event
+    //
+    virtual std::vector<int64_t> handledHashes() const { return {}; }
 };
 
 }
@@ -96,6 +96,12 @@
  *         NOTE: We do *NOT* require a very accurate clock for this timeout feature
  *         and users should only expect accuracy within a few milliseconds. Users
  *         should *not* attempt to use this timing mechanism for real-time events.
+ *         NOTE: The caller zeroes 'msg->chan_hash' beforehand. A transport that
+ *         already knows the hash of the channel (e.g. from the sender) may fill
+ *         it in to save the caller from hashing the channel again.
+ *         NOTE: 'msg->recv_ns' is zeroed by the caller too. A transport that
+ *         has a more precise receive time than 'utime' (e.g. a kernel or NIC
+ *         timestamp) may set it, in nanoseconds on the same clock as 'utime'.
  *
  *      int update(zcm_trans_t* zt);
  *      --------------------------------------------------------------------
@@ -106,6 +112,81 @@
  *      --------------------------------------------------------------------
  *         Close the transport and cleanup any resources used.
  *
+ *      int recvmsg_claim(zcm_trans_t* zt, zcm_msg_t* msg, int timeout, void** token)
+ *      --------------------------------------------------------------------
+ *         This method is optional and may be set to NULL. It behaves exactly
+ *         like recvmsg() except that ownership of the memory referenced by
+ *         'msg->channel' and 'msg->buf' is handed over to the caller. That
+ *         memory must remain valid (even across further calls to recvmsg_claim())
+ *         until the caller passes the returned 'token' to recvmsg_release().
+ *         This allows ZCM to queue received messages without copying them.
+ *
+ *      void recvmsg_release(zcm_trans_t* zt, void* token)
+ *      --------------------------------------------------------------------
+ *         Returns the memory of a message received by recvmsg_claim() back to
+ *         the transport. Must be set if and only if recvmsg_claim() is set.
+ *         NOTE: This method may be called from a different thread than
+ *         recvmsg_claim() and must be safe to call concurrently with it.
+ *
+ *      int sendmsg_batch(zcm_trans_t* zt, const zcm_msg_t* msgs, size_t nmsgs)
+ *      --------------------------------------------------------------------
+ *         This method is optional and may be set to NULL. It sends 'nmsgs'
+ *         messages, in order, exactly as if sendmsg() was called on each of them.
+ *         Transports that can coalesce sends (e.g. into fewer syscalls) should
+ *         implement this. A failure on one message must not prevent the others
+ *         from being attempted. Returns ZCM_EOK if every message was sent,
+ *         otherwise the error of the first message that failed.
+ *
+ *      void recvmsg_wakeup(zcm_trans_t* zt)
+ *      --------------------------------------------------------------------
+ *         This method is optional and may be set to NULL. It makes a recvmsg()
+ *         or recvmsg_claim() that is currently blocked (or the next one to
+ *         block) return ZCM_EAGAIN without waiting out its timeout. ZCM calls
+ *         this to shut down its recv thread promptly.
+ *         NOTE: This method is called from a different thread than recvmsg()
+ *         and must be safe to call concurrently with it.
+ *
+ *      int get_stats(zcm_trans_t* zt, zcm_stat_handler_t cb, void* usr)
+ *      --------------------------------------------------------------------
+ *         This method is optional and may be set to NULL. It calls 'cb' once
+ *         for every counter the transport keeps (e.g. packets dropped, gaps
+ *         in the sequence numbers of a sender), with a name unique within the
+ *         transport. Returns ZCM_EOK.
+ *         NOTE: This method may be called from any thread and must be safe
+ *         to call concurrently with every other method.
+ *
+ *      int get_fd(zcm_trans_t* zt)
+ *      --------------------------------------------------------------------
+ *         This method is unused (in this mode) and is never called.
+ *
+ *      void set_interleave(zcm_trans_t* zt, zcm_interleave_t next, void* usr)
+ *      --------------------------------------------------------------------
+ *         This method is optional and may be set to NULL. ZCM calls it once,
+ *         before any message is sent. Transports that send a large message in
+ *         several pieces (e.g. fragments) may then call 'next(usr, maxlen, &msg)'
+ *         between two pieces, from within sendmsg() or sendmsg_batch(): while it
+ *         returns true, the transport sends 'msg' (of at most 'maxlen' bytes of
+ *         data) before going on with the large message. Its memory stays valid
+ *         until the following call to 'next' or the end of the send. This lets
+ *         urgent short messages overtake a large one that is already going out.
+ *
+ *      int has_subscribers(zcm_trans_t* zt, const char* channel)
+ *      --------------------------------------------------------------------
+ *         This method is optional and may be set to NULL. Returns 0 if the
+ *         transport knows that nobody receives 'channel' right now (so that
+ *         publishers can skip encoding the message at all), 1 if somebody may,
+ *         and -1 if it can't tell. Erring towards 1 is fine, a 0 must be
+ *         right. This method must be thread-safe: it is called from any
+ *         user thread, concurrently with every other method.
+ *      int sendmsg_iov(zcm_trans_t* zt, zcm_msg_t msg, const zcm_iov_t* iov, size_t niov)
+ *      --------------------------------------------------------------------
+ *         This method is optional and may be set to NULL. It sends 'msg'
+ *         exactly as sendmsg() would, except that its data is not at
+ *         'msg.buf' (which is NULL) but in the 'niov' pieces of 'iov', one
+ *         after the other, 'msg.len' bytes in all. Transports that can send
+ *         the pieces from where they are, without putting them together first
+ *         (e.g. with scatter-gather system calls), should implement this.
+ *
  *******************************************************************************
  * Non-Blocking Transport API:
  *
@@ -176,6 +257,32 @@
  *      --------------------------------------------------------------------
  *         Close the transport and cleanup any resources used.
  *
+ *      int get_stats(zcm_trans_t* zt, zcm_stat_handler_t cb, void* usr)
+ *      --------------------------------------------------------------------
+ *         Same as in blocking mode, except that it is only ever called from
+ *         the thread that calls zcm_handle_nonblock().
+ *
+ *      int get_fd(zcm_trans_t* zt)
+ *      --------------------------------------------------------------------
+ *         This method is optional and may be set to NULL. It returns a file
+ *         descriptor that becomes readable when recvmsg() may have a message,
+ *         so that users can wait for it in their own event loop (with select(),
+ *         poll(), epoll...) before calling zcm_handle_nonblock(). Returns -1 if
+ *         there is no such descriptor.
+ *
+ *      int has_subscribers(zcm_trans_t* zt, const char* channel)
+ *      --------------------------------------------------------------------
+ *         As in blocking mode, except it is only called from the thread that
+ *         calls zcm_publish().
+ *      int sendmsg_iov(zcm_trans_t* zt, zcm_msg_t msg, const zcm_iov_t* iov, size_t niov)
+ *      --------------------------------------------------------------------
+ *         As in blocking mode, except that it should *never block*, like sendmsg().
+ *
+ *      int recvmsg_claim(...) / void recvmsg_release(...) / int sendmsg_batch(...)
+ *      void recvmsg_wakeup(...) / void set_interleave(...)
+ *      --------------------------------------------------------------------
+ *         These methods are unused (in this mode) and are never called.
+ *
  ******************************************************************************/
 
 #ifdef __cplusplus
@@ -186,6 +293,7 @@ extern "C" {
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "zcm/zcm.h"
 
 /* Only define inline for C99 builds or better */
@@ -198,6 +306,9 @@ extern "C" {
 typedef struct zcm_msg_t zcm_msg_t;
 typedef struct zcm_trans_methods_t zcm_trans_methods_t;
 
+/* See set_interleave() */
+typedef bool (*zcm_interleave_t)(void* usr, size_t maxlen, zcm_msg_t* msg);
+
 
 /* TODO: Discuss the semantics of this datastruct depending on the context (send vs. recv) */
 /* TODO: do we really need another structure for this (zcm_recv_buf_t is almost identiical) */
@@ -207,6 +318,8 @@ struct zcm_msg_t
     const char* channel;
     size_t len;
     uint8_t* buf;
+    uint32_t chan_hash; /* zcm_channel_hash() of 'channel', 0 means not computed */
+    uint64_t recv_ns;   /* receive time in nanoseconds, 0 if only 'utime' is known */
 };
 
 struct zcm_trans_t
@@ -223,6 +336,17 @@ struct zcm_trans_methods_t
     int     (*recvmsg)(zcm_trans_t* zt, zcm_msg_t* msg, int timeout);
     int     (*update)(zcm_trans_t* zt);
     void    (*destroy)(zcm_trans_t* zt);
+
+    /* Optional methods (may be NULL) */
+    int     (*recvmsg_claim)(zcm_trans_t* zt, zcm_msg_t* msg, int timeout, void** token);
+    void    (*recvmsg_release)(zcm_trans_t* zt, void* token);
+    int     (*sendmsg_batch)(zcm_trans_t* zt, const zcm_msg_t* msgs, size_t nmsgs);
+    void    (*recvmsg_wakeup)(zcm_trans_t* zt);
+    int     (*get_stats)(zcm_trans_t* zt, zcm_stat_handler_t cb, void* usr);
+    int     (*get_fd)(zcm_trans_t* zt);
+    void    (*set_interleave)(zcm_trans_t* zt, zcm_interleave_t next, void* usr);
+    int     (*has_subscribers)(zcm_trans_t* zt, const char* channel);
+    int     (*sendmsg_iov)(zcm_trans_t* zt, zcm_msg_t msg, const zcm_iov_t* iov, size_t niov);
 };
 
 /* Helper functions to make the VTbl dispatch cleaner */
@@ -244,6 +368,72 @@ static INLINE int zcm_trans_update(zcm_trans_t* zt)
 static INLINE void zcm_trans_destroy(zcm_trans_t* zt)
 { return zt->vtbl->destroy(zt); }
 
+static INLINE bool zcm_trans_can_claim(zcm_trans_t* zt)
+{ return zt->vtbl->recvmsg_claim != NULL && zt->vtbl->recvmsg_release != NULL; }
+
+static INLINE int zcm_trans_recvmsg_claim(zcm_trans_t* zt, zcm_msg_t* msg,
+                                          int timeout, void** token)
+{ return zt->vtbl->recvmsg_claim(zt, msg, timeout, token); }
+
+static INLINE void zcm_trans_recvmsg_release(zcm_trans_t* zt, void* token)
+{ zt->vtbl->recvmsg_release(zt, token); }
+
+static INLINE bool zcm_trans_can_send_batch(zcm_trans_t* zt)
+{ return zt->vtbl->sendmsg_batch != NULL; }
+
+/* Falls back to one sendmsg() per message if the transport can't batch */
+static INLINE int zcm_trans_sendmsg_batch(zcm_trans_t* zt, const zcm_msg_t* msgs, size_t nmsgs)
+{
+    size_t i;
+    int ret = ZCM_EOK, rc;
+    if (zt->vtbl->sendmsg_batch) return zt->vtbl->sendmsg_batch(zt, msgs, nmsgs);
+    for (i = 0; i < nmsgs; ++i) {
+        rc = zt->vtbl->sendmsg(zt, msgs[i]);
+        if (rc != ZCM_EOK && ret == ZCM_EOK) ret = rc;
+    }
+    return ret;
+}
+
+/* Does nothing if the transport can't be woken up */
+static INLINE void zcm_trans_recvmsg_wakeup(zcm_trans_t* zt)
+{ if (zt->vtbl->recvmsg_wakeup) zt->vtbl->recvmsg_wakeup(zt); }
+
+static INLINE int zcm_trans_get_stats(zcm_trans_t* zt, zcm_stat_handler_t cb, void* usr)
+{ return zt->vtbl->get_stats ? zt->vtbl->get_stats(zt, cb, usr) : ZCM_EINVALID; }
+
+static INLINE int zcm_trans_get_fd(zcm_trans_t* zt)
+{ return zt->vtbl->get_fd ? zt->vtbl->get_fd(zt) : -1; }
+
+/* Does nothing if the transport can't interleave */
+static INLINE void zcm_trans_set_interleave(zcm_trans_t* zt, zcm_interleave_t next, void* usr)
+{ if (zt->vtbl->set_interleave) zt->vtbl->set_interleave(zt, next, usr); }
+
+static INLINE int zcm_trans_has_subscribers(zcm_trans_t* zt, const char* channel)
+{ return zt->vtbl->has_subscribers ? zt->vtbl->has_subscribers(zt, channel) : -1; }
+
+/* Falls back to sendmsg() of a copy of the pieces put together (of the only piece
+   as is) if the transport can't send them in place. 'msg.len' is their total */
+static INLINE int zcm_trans_sendmsg_iov(zcm_trans_t* zt, zcm_msg_t msg,
+                                        const zcm_iov_t* iov, size_t niov)
+{
+    size_t i, pos = 0;
+    int rc;
+    if (zt->vtbl->sendmsg_iov) return zt->vtbl->sendmsg_iov(zt, msg, iov, niov);
+    if (niov == 1) {
+        msg.buf = (uint8_t*) iov[0].base;
+        return zt->vtbl->sendmsg(zt, msg);
+    }
+    msg.buf = (uint8_t*) malloc(msg.len ? msg.len : 1);
+    if (!msg.buf) return ZCM_EAGAIN;
+    for (i = 0; i < niov; ++i) {
+        if (iov[i].len) memcpy(msg.buf + pos, iov[i].base, iov[i].len);
+        pos += iov[i].len;
+    }
+    rc = zt->vtbl->sendmsg(zt, msg);
+    free(msg.buf);
+    return rc;
+}
+
 #ifdef __cplusplus
 }
 #endif
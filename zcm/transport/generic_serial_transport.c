@@ -22,7 +22,38 @@
 //   *data
 //   sum1(*chan, *data)
 //   sum2(*chan, *data)
+//
+// Packed frames (size = 9 + payload_len) bundle several small messages
+//   0xCC
+//   0x01
+//   count     (of messages)
+//   payload_len  (4 bytes)
+//   *payload
+//   sum1(*payload)
+//   sum2(*payload)
+// The payload holds 'count' messages, each one
+//   chan_ref  (0xff: a channel new to this frame, followed by chan_len and *chan,
+//              that gets the next index of the frame's channel table.
+//              Otherwise the index of a channel already in the table)
+//   data_len  (1 byte if less than 0x80, otherwise 2 bytes with the 0x80 bit set)
+//   *data
 #define FRAME_BYTES 9
+#define FRAME_SINGLE 0x00
+#define FRAME_PACKED 0x01
+
+//
+// With COBS framing (see zcm_trans_generic_serial_enable_cobs()), both frame
+// types are sent as (size <= 3 + body_len + body_len / 254)
+//   COBS(type, n, *payload, sum1(*payload), sum2(*payload))
+//   0x00
+// where type is 0x00 or 0x01, n is chan_len or count, and *payload is either
+// *chan, *data or the packed payload
+#define COBS_MAX_RUN 0xfe
+
+#define PACK_NEW_CHANNEL  0xff
+#define PACK_MAX_CHANNELS 16
+#define PACK_MAX_COUNT    0xff
+#define PACK_MAX_DATA     0x7fff
 
 // Note: there is little to no error checking in this, misuse will cause problems
 typedef struct circBuffer_t circBuffer_t;
@@ -40,7 +71,7 @@ bool cb_init(circBuffer_t* cb, size_t sz)
     cb->front = 0;
     cb->back  = 0;
     if (cb->capacity == 0) return false;
-    cb->data = malloc(cb->capacity * sizeof(uint8_t));
+    cb->data = zcm_alloc(cb->capacity * sizeof(uint8_t), ZCM_ALLOC_TRANSPORT);
     if (cb->data == NULL) {
         cb->capacity = 0;
         return false;
@@ -50,7 +81,7 @@ bool cb_init(circBuffer_t* cb, size_t sz)
 
 void cb_deinit(circBuffer_t* cb)
 {
-    free(cb->data);
+    zcm_dealloc(cb->data, ZCM_ALLOC_TRANSPORT);
     cb->data = NULL;
     cb->capacity = 0;
 }
@@ -66,6 +97,37 @@ size_t cb_room(circBuffer_t* cb)
     return cb->capacity - 1 - cb_size(cb);
 }
 
+// Contiguous free space at the back of the buffer: up to '*len' bytes can be
+// written at the returned pointer and then added to the buffer with cb_commit()
+uint8_t* cb_get_write_span(circBuffer_t* cb, size_t* len)
+{
+    size_t room = cb_room(cb);
+    size_t contiguous = cb->capacity - cb->back;
+    *len = room < contiguous ? room : contiguous;
+    return cb->data + cb->back;
+}
+
+void cb_commit(circBuffer_t* cb, size_t num)
+{
+    ASSERT((cb_room(cb) >= num) && "cb_commit 1");
+    cb->back += num;
+    if (cb->back >= cb->capacity) cb->back -= cb->capacity;
+}
+
+// Contiguous data 'offset' bytes past the front: '*len' bytes can be read at the
+// returned pointer. They stay in the buffer until cb_pop()'d
+const uint8_t* cb_get_read_span(circBuffer_t* cb, size_t offset, size_t* len)
+{
+    size_t sz = cb_size(cb);
+    size_t idx, contiguous;
+    ASSERT((sz >= offset) && "cb_get_read_span 1");
+    idx = cb->front + offset;
+    if (idx >= cb->capacity) idx -= cb->capacity;
+    contiguous = cb->capacity - idx;
+    *len = sz - offset < contiguous ? sz - offset : contiguous;
+    return cb->data + idx;
+}
+
 void cb_push(circBuffer_t* cb, uint8_t d)
 {
     ASSERT((cb->capacity > cb_size(cb) + 1) && "cb_push 1");
@@ -75,6 +137,21 @@ void cb_push(circBuffer_t* cb, uint8_t d)
     if (cb->back == cb->capacity) cb->back = 0;
 }
 
+// NOTE: This function should never be called w/ num > cb_room(cb)
+void cb_push_bytes(circBuffer_t* cb, const uint8_t* d, size_t num)
+{
+    while (num > 0) {
+        size_t n;
+        uint8_t* span = cb_get_write_span(cb, &n);
+        ASSERT((n > 0) && "cb_push_bytes 1");
+        if (n > num) n = num;
+        memcpy(span, d, n);
+        cb_commit(cb, n);
+        d += n;
+        num -= n;
+    }
+}
+
 uint8_t cb_top(circBuffer_t* cb, size_t offset)
 {
     ASSERT((cb_size(cb) > offset) && "cb_top 1");
@@ -90,31 +167,24 @@ void cb_pop(circBuffer_t* cb, size_t num)
     if (cb->front >= cb->capacity) cb->front -= cb->capacity;
 }
 
-#define MIN(a, b) (((a) < (b)) ? (a) : (b))
 size_t cb_flush_out(circBuffer_t* cb,
                     size_t (*write)(const uint8_t* data, size_t num, void* usr),
                     void* usr)
 {
-	size_t written = 0;
-	size_t n;
-    size_t sz = cb_size(cb);
-
-    if (sz == 0) return 0;
+    size_t written = 0;
 
-    size_t contiguous = MIN(cb->capacity - cb->front, sz);
-    size_t wrapped    = sz - contiguous;
+    // At most two spans: up to the end of the buffer, then from its start
+    while (cb_size(cb) > 0) {
+        size_t contiguous, n;
+        const uint8_t* span = cb_get_read_span(cb, 0, &contiguous);
 
-    n = write(cb->data + cb->front, contiguous, usr);
-    written += n;
-    cb_pop(cb, n);
+        n = write(span, contiguous, usr);
+        written += n;
+        cb_pop(cb, n);
 
-    // If we failed to write everything we tried to write, or if there's nothing
-    // left to write, return.
-    if (written != contiguous || wrapped == 0) return written;
-
-    n = write(cb->data, wrapped, usr);
-    written += n;
-    cb_pop(cb, n);
+        // If we failed to write everything we tried to write, return.
+        if (n != contiguous) break;
+    }
     return written;
 }
 
@@ -124,56 +194,54 @@ size_t cb_flush_in(circBuffer_t* cb, size_t bytes,
                    void* usr)
 {
     ASSERT((bytes <= cb_room(cb)) && "cb_flush_in 1");
-	size_t bytesRead = 0;
-	size_t n;
-
-    // Find out how much room is left between back and end of buffer or back and front
-    // of buffer. Because we already know there's room for whatever we're about to place,
-    // if back < front, we can just read in every byte starting at "back".
-    if (cb->back < cb->front) {
-    	bytesRead += read(cb->data + cb->back, bytes, usr);
-        ASSERT((bytesRead <= bytes) && "cb_flush_in 2");
-        cb->back += bytesRead;
-        return bytesRead;
-    }
+    size_t bytesRead = 0;
 
-    // Otherwise, we need to be a bit more careful about overflowing the back of the buffer.
-    size_t contiguous = MIN(cb->capacity - cb->back, bytes);
-    size_t wrapped    = bytes - contiguous;
+    // At most two spans: up to the end of the buffer (or the front), then from its start
+    while (bytesRead < bytes) {
+        size_t contiguous, n;
+        uint8_t* span = cb_get_write_span(cb, &contiguous);
+        if (contiguous == 0) break;
+        if (contiguous > bytes - bytesRead) contiguous = bytes - bytesRead;
 
-    n = read(cb->data + cb->back, contiguous, usr);
-    ASSERT((n <= contiguous) && "cb_flush_in 3");
-    bytesRead += n;
-    ASSERT((bytesRead <= bytes) && "cb_flush_in 4");
-    cb->back += n;
-    if (n != contiguous) return bytesRead; // back could NOT have hit BUFFER_SIZE in this case
+        n = read(span, contiguous, usr);
+        ASSERT((n <= contiguous) && "cb_flush_in 2");
+        bytesRead += n;
+        cb_commit(cb, n);
 
-    // may need to wrap back here (if bytes >= BUFFER_SIZE - cb->back) but not otherwise
-    ASSERT((cb->back <= cb->capacity) && "cb_flush_in 5");
-    if (cb->back == cb->capacity) cb->back = 0;
-    if (wrapped == 0) return bytesRead;
-
-    n = read(cb->data, wrapped, usr);
-    ASSERT((n <= wrapped) && "cb_flush_in 6");
-    bytesRead += n;
-    ASSERT((bytesRead <= bytes) && "cb_flush_in 7");
-    cb->back += n;
+        if (n != contiguous) break;
+    }
     return bytesRead;
 }
-#undef MIN
 
-static uint16_t fletcherUpdate(uint8_t b, uint16_t prevSum)
-{
-    uint16_t sumHigh = (prevSum >> 8) & 0xff;
-    uint16_t sumLow  =  prevSum       & 0xff;
-    sumHigh += sumLow += b;
-
-    sumLow  = (sumLow  & 0xff) + (sumLow  >> 8);
-    sumHigh = (sumHigh & 0xff) + (sumHigh >> 8);
+// Fletcher-16 of 'data', continuing from 'prevSum'. Both sums are kept in 1..255
+// (0 only while nothing but zeros was summed), which lets the reduction be done
+// once per block of bytes rather than for each byte
+#define FLETCHER_BLOCK 4096
+static uint32_t fletcherReduce(uint32_t sum)
+{ return sum == 0 ? 0 : (sum - 1) % 255 + 1; }
 
-    // Note: double reduction to ensure no overflow after first
-    sumLow  = (sumLow  & 0xff) + (sumLow  >> 8);
-    sumHigh = (sumHigh & 0xff) + (sumHigh >> 8);
+static uint16_t fletcherUpdateBytes(const uint8_t* data, size_t len, uint16_t prevSum,
+                                    void* usr)
+{
+    uint32_t sumHigh = (prevSum >> 8) & 0xff;
+    uint32_t sumLow  =  prevSum       & 0xff;
+
+    while (len > 0) {
+        size_t n = len < FLETCHER_BLOCK ? len : FLETCHER_BLOCK;
+        len -= n;
+        // Four bytes per step: each byte is added to sumHigh once for every byte
+        // from it to the end of the step
+        for (; n >= 4; n -= 4, data += 4) {
+            sumHigh += 4 * sumLow + 4 * data[0] + 3 * data[1] + 2 * data[2] + data[3];
+            sumLow  += data[0] + data[1] + data[2] + data[3];
+        }
+        while (n--) {
+            sumLow  += *data++;
+            sumHigh += sumLow;
+        }
+        sumLow  = fletcherReduce(sumLow);
+        sumHigh = fletcherReduce(sumHigh);
+    }
 
     return (sumHigh << 8) | sumLow;
 }
@@ -195,6 +263,35 @@ struct zcm_trans_generic_serial_t
 
     uint64_t (*time)(void* usr);
     void* time_usr;
+
+    uint16_t (*checksum)(const uint8_t* data, size_t nData, uint16_t prevSum, void* usr);
+    void* checksum_usr;
+
+    // Packed frame being built, packSize is 0 unless packing is enabled
+    uint8_t* packData;
+    size_t   packSize;
+    size_t   packLen;
+    uint8_t  packCount;
+    uint8_t  packNumChans;
+    size_t   packChanOff[PACK_MAX_CHANNELS];
+    uint8_t  packChanLen[PACK_MAX_CHANNELS];
+
+    // COBS framing, cobsBuf holds the last frame decoded. The receive buffer
+    // holds no delimiter in its first cobsScanned bytes
+    bool     cobs;
+    uint8_t* cobsBuf;
+    size_t   cobsSize;
+    size_t   cobsScanned;
+
+    // Packed frame received in unpackData, with unpackCount messages left
+    uint8_t* unpackData;
+    uint64_t unpackUtime;
+    size_t   unpackPos;
+    size_t   unpackLen;
+    uint8_t  unpackCount;
+    uint8_t  unpackNumChans;
+    size_t   unpackChanOff[PACK_MAX_CHANNELS];
+    uint8_t  unpackChanLen[PACK_MAX_CHANNELS];
 };
 
 static zcm_trans_generic_serial_t *cast(zcm_trans_t *zt);
@@ -202,71 +299,210 @@ static zcm_trans_generic_serial_t *cast(zcm_trans_t *zt);
 size_t serial_get_mtu(zcm_trans_generic_serial_t *zt)
 { return zt->mtu; }
 
-int serial_sendmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t msg)
+// Number of escape chars in 'data', each of which is sent twice
+static size_t countEscapes(const uint8_t* data, size_t len)
 {
-    size_t chan_len = strlen(msg.channel);
-    size_t nPushed = 0;
+    size_t n = 0;
+    const uint8_t* end = data + len;
+    while (data < end && (data = memchr(data, ZCM_GENERIC_SERIAL_ESCAPE_CHAR, end - data))) {
+        ++n;
+        ++data;
+    }
+    return n;
+}
+
+// Pushes 'data' with every escape char doubled
+static void pushEscaped(circBuffer_t* cb, const uint8_t* data, size_t len)
+{
+    while (len > 0) {
+        const uint8_t* esc = memchr(data, ZCM_GENERIC_SERIAL_ESCAPE_CHAR, len);
+        size_t n = esc ? (size_t)(esc - data) + 1 : len;
+        cb_push_bytes(cb, data, n);
+        if (esc) cb_push(cb, ZCM_GENERIC_SERIAL_ESCAPE_CHAR);
+        data += n;
+        len  -= n;
+    }
+}
 
-    if (chan_len > ZCM_CHANNEL_MAXLEN)                               return ZCM_EINVALID;
-    if (msg.len > zt->mtu)                                           return ZCM_EINVALID;
-    if (FRAME_BYTES + chan_len + msg.len > cb_room(&zt->sendBuffer)) return ZCM_EAGAIN;
+// Encodes COBS straight into a circular buffer: the code of each block is
+// written once the block is complete, over the placeholder left for it
+typedef struct cobsEncoder_t cobsEncoder_t;
+struct cobsEncoder_t
+{
+    circBuffer_t* cb;
+    size_t        codeIdx;
+    uint8_t       code;
+};
 
-    cb_push(&zt->sendBuffer, ZCM_GENERIC_SERIAL_ESCAPE_CHAR); ++nPushed;
-    cb_push(&zt->sendBuffer, 0x00);                           ++nPushed;
-    cb_push(&zt->sendBuffer, chan_len);                       ++nPushed;
+static void cobsStartBlock(cobsEncoder_t* e)
+{
+    e->codeIdx = e->cb->back;
+    cb_push(e->cb, 0);
+    e->code = 1;
+}
 
-    uint32_t len = (uint32_t)msg.len;
-    cb_push(&zt->sendBuffer, (len>>24)&0xff); ++nPushed;
-    cb_push(&zt->sendBuffer, (len>>16)&0xff); ++nPushed;
-    cb_push(&zt->sendBuffer, (len>> 8)&0xff); ++nPushed;
-    cb_push(&zt->sendBuffer, (len>> 0)&0xff); ++nPushed;
+static void cobsEndBlock(cobsEncoder_t* e)
+{ e->cb->data[e->codeIdx] = e->code; }
 
-    uint16_t checksum = 0xffff;
-    size_t i;
-    for (i = 0; i < chan_len; ++i) {
-        uint8_t c = (uint8_t) msg.channel[i];
-
-        cb_push(&zt->sendBuffer, c); ++nPushed;
-
-        if (c == ZCM_GENERIC_SERIAL_ESCAPE_CHAR) {
-        	// the escape character doesn't count, so we have chan_len - i characters
-        	// remaining in channel + the msg + the checksum.
-            if (cb_room(&zt->sendBuffer) > chan_len - i + msg.len + 1) {
-                cb_push(&zt->sendBuffer, c); ++nPushed;
-            } else {
-                cb_pop(&zt->sendBuffer, nPushed);
-                return ZCM_EAGAIN;
-            }
+static void cobsPush(cobsEncoder_t* e, const uint8_t* data, size_t len)
+{
+    while (len > 0) {
+        size_t n = 0xff - e->code;
+        if (n > len) n = len;
+        const uint8_t* zero = memchr(data, 0x00, n);
+        if (zero) n = zero - data;
+
+        cb_push_bytes(e->cb, data, n);
+        e->code += n;
+        data    += n;
+        len     -= n;
+
+        if (zero) {
+            ++data;
+            --len;
+        } else if (e->code != 0xff) {
+            continue;
         }
+        cobsEndBlock(e);
+        cobsStartBlock(e);
+    }
+}
 
-        checksum = fletcherUpdate(c, checksum);
+// Writes a frame: its header, then 'a' and 'b' escaped and their checksum.
+// 'n' is chan_len for single message frames and count for packed ones
+static int pushFrame(zcm_trans_generic_serial_t *zt, uint8_t type, uint8_t n, uint32_t len,
+                     const uint8_t* a, size_t alen, const uint8_t* b, size_t blen)
+{
+    uint16_t checksum = 0xffff;
+
+    if (zt->cobs) {
+        size_t body = 2 + alen + blen + 2;
+        if (body + body / COBS_MAX_RUN + 3 > cb_room(&zt->sendBuffer))
+            return ZCM_EAGAIN;
+
+        checksum = zt->checksum(a, alen, checksum, zt->checksum_usr);
+        checksum = zt->checksum(b, blen, checksum, zt->checksum_usr);
+        uint8_t header[2] = { type, n };
+        uint8_t sum[2] = { (checksum >> 8) & 0xff, checksum & 0xff };
+
+        cobsEncoder_t e;
+        e.cb = &zt->sendBuffer;
+        cobsStartBlock(&e);
+        cobsPush(&e, header, sizeof(header));
+        cobsPush(&e, a, alen);
+        cobsPush(&e, b, blen);
+        cobsPush(&e, sum, sizeof(sum));
+        cobsEndBlock(&e);
+        cb_push(&zt->sendBuffer, 0x00);
+        return ZCM_EOK;
     }
 
-    for (i = 0; i < msg.len; ++i) {
-        uint8_t c = (uint8_t) msg.buf[i];
+    size_t escapes = countEscapes(a, alen) + countEscapes(b, blen);
+    if (FRAME_BYTES + alen + blen + escapes > cb_room(&zt->sendBuffer))
+        return ZCM_EAGAIN;
 
-        cb_push(&zt->sendBuffer, c); ++nPushed;
+    uint8_t header[FRAME_BYTES - 2] = {
+        ZCM_GENERIC_SERIAL_ESCAPE_CHAR, type, n,
+        (len>>24)&0xff, (len>>16)&0xff, (len>>8)&0xff, (len>>0)&0xff
+    };
+    cb_push_bytes(&zt->sendBuffer, header, sizeof(header));
 
-        if (c == ZCM_GENERIC_SERIAL_ESCAPE_CHAR) {
-        	// the escape character doesn't count, so we have msg.len - i characters
-        	// remaining in the msg + the checksum.
-            if (cb_room(&zt->sendBuffer) > msg.len - i + 1) {
-                cb_push(&zt->sendBuffer, c); ++nPushed;
-            } else {
-                cb_pop(&zt->sendBuffer, nPushed);
-                return ZCM_EAGAIN;
-            }
-        }
+    pushEscaped(&zt->sendBuffer, a, alen);
+    pushEscaped(&zt->sendBuffer, b, blen);
 
-        checksum = fletcherUpdate(c, checksum);
-    }
+    checksum = zt->checksum(a, alen, checksum, zt->checksum_usr);
+    checksum = zt->checksum(b, blen, checksum, zt->checksum_usr);
 
-    cb_push(&zt->sendBuffer, (checksum >> 8) & 0xff); ++nPushed;
-    cb_push(&zt->sendBuffer,  checksum       & 0xff); ++nPushed;
+    cb_push(&zt->sendBuffer, (checksum >> 8) & 0xff);
+    cb_push(&zt->sendBuffer,  checksum       & 0xff);
 
     return ZCM_EOK;
 }
 
+static size_t packEntrySize(bool newChan, size_t chan_len, size_t len)
+{ return 1 + (newChan ? 1 + chan_len : 0) + (len < 0x80 ? 1 : 2) + len; }
+
+// Index of 'channel' in the table of the packed frame being built, or -1
+static int packFindChannel(zcm_trans_generic_serial_t *zt, const char* channel, size_t chan_len)
+{
+    int i;
+    for (i = 0; i < zt->packNumChans; ++i)
+        if (zt->packChanLen[i] == chan_len &&
+            memcmp(zt->packData + zt->packChanOff[i], channel, chan_len) == 0)
+            return i;
+    return -1;
+}
+
+static int packFlush(zcm_trans_generic_serial_t *zt)
+{
+    if (zt->packCount == 0) return ZCM_EOK;
+
+    int ret = pushFrame(zt, FRAME_PACKED, zt->packCount, zt->packLen,
+                        NULL, 0, zt->packData, zt->packLen);
+    if (ret != ZCM_EOK) return ret;
+
+    zt->packLen = 0;
+    zt->packCount = 0;
+    zt->packNumChans = 0;
+    return ZCM_EOK;
+}
+
+static void packAppend(zcm_trans_generic_serial_t *zt, int chan, zcm_msg_t msg, size_t chan_len)
+{
+    uint8_t* p = zt->packData + zt->packLen;
+
+    if (chan < 0) {
+        *p++ = PACK_NEW_CHANNEL;
+        *p++ = (uint8_t) chan_len;
+        zt->packChanOff[zt->packNumChans] = p - zt->packData;
+        zt->packChanLen[zt->packNumChans] = chan_len;
+        zt->packNumChans++;
+        memcpy(p, msg.channel, chan_len);
+        p += chan_len;
+    } else {
+        *p++ = (uint8_t) chan;
+    }
+
+    if (msg.len < 0x80) {
+        *p++ = (uint8_t) msg.len;
+    } else {
+        *p++ = 0x80 | (msg.len >> 8);
+        *p++ = msg.len & 0xff;
+    }
+    memcpy(p, msg.buf, msg.len);
+    p += msg.len;
+
+    zt->packLen = p - zt->packData;
+    zt->packCount++;
+}
+
+int serial_sendmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t msg)
+{
+    size_t chan_len = strlen(msg.channel);
+
+    if (chan_len > ZCM_CHANNEL_MAXLEN) return ZCM_EINVALID;
+    if (msg.len > zt->mtu)             return ZCM_EINVALID;
+
+    if (zt->packSize > 0 && msg.len <= PACK_MAX_DATA &&
+        packEntrySize(true, chan_len, msg.len) <= zt->packSize) {
+        int chan = packFindChannel(zt, msg.channel, chan_len);
+        if (zt->packLen + packEntrySize(chan < 0, chan_len, msg.len) > zt->packSize ||
+            zt->packCount == PACK_MAX_COUNT ||
+            (chan < 0 && zt->packNumChans == PACK_MAX_CHANNELS)) {
+            if (packFlush(zt) != ZCM_EOK) return ZCM_EAGAIN;
+            chan = -1;
+        }
+        packAppend(zt, chan, msg, chan_len);
+        return ZCM_EOK;
+    }
+
+    // Too big to be packed, the messages packed so far must go out first
+    if (packFlush(zt) != ZCM_EOK) return ZCM_EAGAIN;
+
+    return pushFrame(zt, FRAME_SINGLE, (uint8_t) chan_len, (uint32_t) msg.len,
+                     (const uint8_t*) msg.channel, chan_len, msg.buf, msg.len);
+}
+
 int serial_recvmsg_enable(zcm_trans_generic_serial_t *zt, const char *channel, bool enable)
 {
     // NOTE: not implemented because it is unlikely that a microprocessor is
@@ -275,8 +511,197 @@ int serial_recvmsg_enable(zcm_trans_generic_serial_t *zt, const char *channel, b
     return ZCM_EOK;
 }
 
+// Copies 'len' bytes that start 'consumed' bytes into the buffer to 'dst',
+// undoubling escape chars. Returns ZCM_EAGAIN if they didn't all arrive yet and
+// ZCM_EINVALID on an escape char that isn't doubled, leaving 'consumed' on it
+static int readEscaped(circBuffer_t* cb, size_t* consumed, uint8_t* dst, size_t len)
+{
+    while (len > 0) {
+        // Every escape char takes a byte more, so there must be at least 'len'
+        if (cb_size(cb) - *consumed < len) return ZCM_EAGAIN;
+
+        size_t n;
+        const uint8_t* span = cb_get_read_span(cb, *consumed, &n);
+        if (n > len) n = len;
+
+        const uint8_t* esc = memchr(span, ZCM_GENERIC_SERIAL_ESCAPE_CHAR, n);
+        if (esc) n = (size_t)(esc - span) + 1;
+
+        memcpy(dst, span, n);
+        dst       += n;
+        len       -= n;
+        *consumed += n;
+
+        if (esc) {
+            if (*consumed >= cb_size(cb)) return ZCM_EAGAIN;
+            if (cb_top(cb, *consumed) != ZCM_GENERIC_SERIAL_ESCAPE_CHAR) {
+                *consumed -= 1;
+                return ZCM_EINVALID;
+            }
+            *consumed += 1;
+        }
+    }
+    return ZCM_EOK;
+}
+
+// Returns the next message of the packed frame in unpackData. If it's
+// malformed, the rest of the frame is dropped and ZCM_EINVALID returned
+static int unpackNext(zcm_trans_generic_serial_t *zt, zcm_msg_t *msg)
+{
+    const uint8_t* p   = zt->unpackData + zt->unpackPos;
+    const uint8_t* end = zt->unpackData + zt->unpackLen;
+    size_t len;
+
+    if (p == end) goto fail;
+    uint8_t chan = *p++;
+    if (chan == PACK_NEW_CHANNEL) {
+        if (p == end || zt->unpackNumChans == PACK_MAX_CHANNELS) goto fail;
+        size_t chan_len = *p++;
+        if (chan_len > ZCM_CHANNEL_MAXLEN || (size_t)(end - p) < chan_len) goto fail;
+        chan = zt->unpackNumChans++;
+        zt->unpackChanOff[chan] = p - zt->unpackData;
+        zt->unpackChanLen[chan] = chan_len;
+        p += chan_len;
+    } else if (chan >= zt->unpackNumChans) {
+        goto fail;
+    }
+
+    if (p == end) goto fail;
+    len = *p++;
+    if (len & 0x80) {
+        if (p == end) goto fail;
+        len = (len & 0x7f) << 8 | *p++;
+    }
+    if ((size_t)(end - p) < len) goto fail;
+
+    memcpy(zt->recvChanName, zt->unpackData + zt->unpackChanOff[chan], zt->unpackChanLen[chan]);
+    zt->recvChanName[zt->unpackChanLen[chan]] = '\0';
+    msg->channel = (char*) zt->recvChanName;
+    msg->buf     = (uint8_t*) p;
+    msg->len     = len;
+    msg->utime   = zt->unpackUtime;
+
+    zt->unpackPos = p + len - zt->unpackData;
+    zt->unpackCount--;
+    return ZCM_EOK;
+
+  fail:
+    zt->unpackCount = 0;
+    return ZCM_EINVALID;
+}
+
+// Decodes the COBS frame in the first 'len' bytes of the receive buffer into
+// cobsBuf. Returns its size, or -1 if it's malformed or too big
+static long cobsDecode(zcm_trans_generic_serial_t *zt, size_t len)
+{
+    circBuffer_t* cb = &zt->recvBuffer;
+    size_t in = 0, out = 0;
+
+    while (in < len) {
+        uint8_t code = cb_top(cb, in++);
+        size_t n = code - 1;
+        if (n > len - in || n > zt->cobsSize - out) return -1;
+
+        while (n > 0) {
+            size_t contiguous;
+            const uint8_t* span = cb_get_read_span(cb, in, &contiguous);
+            if (contiguous > n) contiguous = n;
+            memcpy(zt->cobsBuf + out, span, contiguous);
+            in  += contiguous;
+            out += contiguous;
+            n   -= contiguous;
+        }
+
+        if (code != 0xff && in < len) {
+            if (out == zt->cobsSize) return -1;
+            zt->cobsBuf[out++] = 0x00;
+        }
+    }
+    return (long) out;
+}
+
+static int cobsRecvmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t *msg)
+{
+    circBuffer_t* cb = &zt->recvBuffer;
+
+    while (true) {
+        // Find the end of the next frame
+        size_t size = cb_size(cb);
+        const uint8_t* delim = NULL;
+        while (zt->cobsScanned < size) {
+            size_t n;
+            const uint8_t* span = cb_get_read_span(cb, zt->cobsScanned, &n);
+            delim = memchr(span, 0x00, n);
+            if (delim) {
+                zt->cobsScanned += delim - span;
+                break;
+            }
+            zt->cobsScanned += n;
+        }
+        if (!delim) {
+            // A frame that doesn't fit in the buffer can never be completed
+            if (cb_room(cb) == 0) {
+                cb_pop(cb, size);
+                zt->cobsScanned = 0;
+            }
+            return ZCM_EAGAIN;
+        }
+
+        size_t frameLen = zt->cobsScanned;
+        long len = frameLen > 0 ? cobsDecode(zt, frameLen) : -1;
+        cb_pop(cb, frameLen + 1);
+        zt->cobsScanned = 0;
+        if (len < 4) continue;
+
+        uint8_t type = zt->cobsBuf[0];
+        uint8_t n    = zt->cobsBuf[1];
+        uint8_t* payload = zt->cobsBuf + 2;
+        size_t payloadLen = len - 4;
+
+        if (type == FRAME_SINGLE) {
+            if (n > ZCM_CHANNEL_MAXLEN || n > payloadLen || payloadLen - n > zt->mtu) continue;
+        } else if (type == FRAME_PACKED) {
+            if (n == 0 || payloadLen > zt->mtu) continue;
+        } else {
+            continue;
+        }
+
+        size_t alen = type == FRAME_SINGLE ? n : 0;
+        uint16_t checksum = 0xffff;
+        checksum = zt->checksum(payload, alen, checksum, zt->checksum_usr);
+        checksum = zt->checksum(payload + alen, payloadLen - alen, checksum, zt->checksum_usr);
+        if (checksum != ((payload[payloadLen] << 8) | payload[payloadLen + 1])) continue;
+
+        uint64_t utime = zt->time(zt->time_usr);
+        if (type == FRAME_PACKED) {
+            zt->unpackData     = payload;
+            zt->unpackUtime    = utime;
+            zt->unpackPos      = 0;
+            zt->unpackLen      = payloadLen;
+            zt->unpackCount    = n;
+            zt->unpackNumChans = 0;
+            if (unpackNext(zt, msg) == ZCM_EOK) return ZCM_EOK;
+            continue;
+        }
+
+        memcpy(zt->recvChanName, payload, n);
+        zt->recvChanName[n] = '\0';
+        msg->channel = (char*) zt->recvChanName;
+        msg->buf     = payload + n;
+        msg->len     = payloadLen - n;
+        msg->utime   = utime;
+        return ZCM_EOK;
+    }
+}
+
 int serial_recvmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t *msg, int timeout)
 {
+    if (zt->unpackCount > 0 && unpackNext(zt, msg) == ZCM_EOK)
+        return ZCM_EOK;
+
+    if (zt->cobs)
+        return cobsRecvmsg(zt, msg);
+
     uint64_t utime = zt->time(zt->time_usr);
     size_t incomingSize = cb_size(&zt->recvBuffer);
     if (incomingSize < FRAME_BYTES)
@@ -288,75 +713,60 @@ int serial_recvmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t *msg, int timeout)
     uint8_t expectedHighCS = 0;
     uint8_t expectedLowCS  = 0;
     uint16_t receivedCS = 0;
+    uint8_t type;
+    uint8_t msgs = 0;
+    int ret;
 
     // Sync
     if (cb_top(&zt->recvBuffer, consumed++) != ZCM_GENERIC_SERIAL_ESCAPE_CHAR) goto fail;
-    if (cb_top(&zt->recvBuffer, consumed++) != 0x00)                           goto fail;
+    type = cb_top(&zt->recvBuffer, consumed++);
+    if (type != FRAME_SINGLE && type != FRAME_PACKED)                          goto fail;
 
-    // Msg sizes
+    // Msg sizes (for packed frames, chan_len is the count and there is no channel)
     chan_len  = cb_top(&zt->recvBuffer, consumed++);
     msg->len  = cb_top(&zt->recvBuffer, consumed++) << 24;
     msg->len |= cb_top(&zt->recvBuffer, consumed++) << 16;
     msg->len |= cb_top(&zt->recvBuffer, consumed++) << 8;
     msg->len |= cb_top(&zt->recvBuffer, consumed++);
 
+    if (type == FRAME_PACKED) {
+        if (chan_len == 0)                 goto fail;
+        msgs = chan_len;
+        chan_len = 0;
+    }
     if (chan_len > ZCM_CHANNEL_MAXLEN)     goto fail;
     if (msg->len > zt->mtu)                goto fail;
 
     if (incomingSize < FRAME_BYTES + chan_len + msg->len) return ZCM_EAGAIN;
 
-    memset(&zt->recvChanName, '\0', ZCM_CHANNEL_MAXLEN);
-
-    checksum = 0xffff;
-    int i;
-    for (i = 0; i < chan_len; ++i) {
-
-        uint8_t c = cb_top(&zt->recvBuffer, consumed++);
-
-        if (c == ZCM_GENERIC_SERIAL_ESCAPE_CHAR) {
-        	// the escape character doesn't count, so we have chan_len - i characters
-        	// remaining in channel + the msg + the checksum.
-            if (consumed + chan_len - i + msg->len + 2 > incomingSize) return ZCM_EAGAIN;
-
-            c = cb_top(&zt->recvBuffer, consumed++);
-
-            if (c != ZCM_GENERIC_SERIAL_ESCAPE_CHAR) {
-                consumed-=2;
-                goto fail;
-            }
-        }
-
-        zt->recvChanName[i] = c;
-        checksum = fletcherUpdate(c, checksum);
-    }
-
+    ret = readEscaped(&zt->recvBuffer, &consumed, zt->recvChanName, chan_len);
+    if (ret == ZCM_EAGAIN) return ZCM_EAGAIN;
+    if (ret != ZCM_EOK)    goto fail;
     zt->recvChanName[chan_len] = '\0';
 
-    for (i = 0; i < msg->len; ++i) {
-        if (consumed > incomingSize) return ZCM_EAGAIN;
-
-        uint8_t c = cb_top(&zt->recvBuffer, consumed++);
+    ret = readEscaped(&zt->recvBuffer, &consumed, zt->recvMsgData, msg->len);
+    if (ret == ZCM_EAGAIN) return ZCM_EAGAIN;
+    if (ret != ZCM_EOK)    goto fail;
 
-        if (c == ZCM_GENERIC_SERIAL_ESCAPE_CHAR) {
-        	// the escape character doesn't count, so we have msg.len - i characters
-        	// remaining in the msg + the checksum.
-            if (consumed + msg->len - i + 2 > incomingSize) return ZCM_EAGAIN;
+    if (consumed + 2 > incomingSize) return ZCM_EAGAIN;
 
-            c = cb_top(&zt->recvBuffer, consumed++);
-
-            if (c != ZCM_GENERIC_SERIAL_ESCAPE_CHAR) {
-                consumed-=2;
-                goto fail;
-            }
-        }
-
-        zt->recvMsgData[i] = c;
-        checksum = fletcherUpdate(c, checksum);
-    }
+    checksum = 0xffff;
+    checksum = zt->checksum(zt->recvChanName, chan_len, checksum, zt->checksum_usr);
+    checksum = zt->checksum(zt->recvMsgData, msg->len, checksum, zt->checksum_usr);
 
     expectedHighCS = cb_top(&zt->recvBuffer, consumed++);
     expectedLowCS  = cb_top(&zt->recvBuffer, consumed++);
     receivedCS = (expectedHighCS << 8) | expectedLowCS;
+    if (receivedCS == checksum && type == FRAME_PACKED) {
+        cb_pop(&zt->recvBuffer, consumed);
+        zt->unpackData     = zt->recvMsgData;
+        zt->unpackUtime    = utime;
+        zt->unpackPos      = 0;
+        zt->unpackLen      = msg->len;
+        zt->unpackCount    = msgs;
+        zt->unpackNumChans = 0;
+        return serial_recvmsg(zt, msg, timeout);
+    }
     if (receivedCS == checksum) {
         msg->channel = (char*) zt->recvChanName;
         msg->buf     = zt->recvMsgData;
@@ -375,17 +785,45 @@ int serial_recvmsg(zcm_trans_generic_serial_t *zt, zcm_msg_t *msg, int timeout)
 int serial_update_rx(zcm_trans_t *_zt)
 {
     zcm_trans_generic_serial_t* zt = cast(_zt);
-    cb_flush_in(&zt->recvBuffer, cb_room(&zt->recvBuffer), zt->get, zt->put_get_usr);
+    if (zt->get)
+        cb_flush_in(&zt->recvBuffer, cb_room(&zt->recvBuffer), zt->get, zt->put_get_usr);
     return ZCM_EOK;
 }
 
 int serial_update_tx(zcm_trans_t *_zt)
 {
     zcm_trans_generic_serial_t* zt = cast(_zt);
-    cb_flush_out(&zt->sendBuffer, zt->put, zt->put_get_usr);
+    packFlush(zt);
+    if (zt->put)
+        cb_flush_out(&zt->sendBuffer, zt->put, zt->put_get_usr);
     return ZCM_EOK;
 }
 
+uint8_t* serial_rx_span(zcm_trans_t *_zt, size_t *nData)
+{
+    zcm_trans_generic_serial_t* zt = cast(_zt);
+    return cb_get_write_span(&zt->recvBuffer, nData);
+}
+
+void serial_rx_commit(zcm_trans_t *_zt, size_t nData)
+{
+    zcm_trans_generic_serial_t* zt = cast(_zt);
+    cb_commit(&zt->recvBuffer, nData);
+}
+
+const uint8_t* serial_tx_span(zcm_trans_t *_zt, size_t *nData)
+{
+    zcm_trans_generic_serial_t* zt = cast(_zt);
+    packFlush(zt);
+    return cb_get_read_span(&zt->sendBuffer, 0, nData);
+}
+
+void serial_tx_consume(zcm_trans_t *_zt, size_t nData)
+{
+    zcm_trans_generic_serial_t* zt = cast(_zt);
+    cb_pop(&zt->sendBuffer, nData);
+}
+
 /********************** STATICS **********************/
 static size_t _serial_get_mtu(zcm_trans_t *zt)
 { return serial_get_mtu(cast(zt)); }
@@ -407,7 +845,7 @@ static int _serial_update(zcm_trans_t *zt)
 }
 
 static void _serial_destroy(zcm_trans_t *zt)
-{ free(cast(zt)); }
+{ zcm_dealloc(cast(zt), ZCM_ALLOC_TRANSPORT); }
 
 static zcm_trans_methods_t methods = {
     &_serial_get_mtu,
@@ -416,6 +854,15 @@ static zcm_trans_methods_t methods = {
     &_serial_recvmsg,
     &_serial_update,
     &_serial_destroy,
+    NULL, /* recvmsg_claim */
+    NULL, /* recvmsg_release */
+    NULL, /* sendmsg_batch */
+    NULL, /* recvmsg_wakeup */
+    NULL, /* get_stats */
+    NULL, /* get_fd */
+    NULL, /* set_interleave */
+    NULL, /* has_subscribers */
+    NULL, /* sendmsg_iov */
 };
 
 static zcm_trans_generic_serial_t *cast(zcm_trans_t *zt)
@@ -432,28 +879,44 @@ zcm_trans_t *zcm_trans_generic_serial_create(
         void* time_usr,
         size_t MTU,
         size_t bufSize)
+{
+    return zcm_trans_generic_serial_create_checksum(get, put, put_get_usr,
+                                                    timestamp_now, time_usr,
+                                                    MTU, bufSize, NULL, NULL);
+}
+
+zcm_trans_t *zcm_trans_generic_serial_create_checksum(
+        size_t (*get)(uint8_t* data, size_t nData, void* usr),
+        size_t (*put)(const uint8_t* data, size_t nData, void* usr),
+        void* put_get_usr,
+        uint64_t (*timestamp_now)(void* usr),
+        void* time_usr,
+        size_t MTU,
+        size_t bufSize,
+        uint16_t (*checksum)(const uint8_t* data, size_t nData, uint16_t prevSum, void* usr),
+        void* checksum_usr)
 {
     if (MTU == 0 || bufSize < FRAME_BYTES + MTU) return NULL;
-    zcm_trans_generic_serial_t *zt = malloc(sizeof(zcm_trans_generic_serial_t));
+    zcm_trans_generic_serial_t *zt = zcm_alloc(sizeof(zcm_trans_generic_serial_t), ZCM_ALLOC_TRANSPORT);
     if (zt == NULL) return NULL;
     zt->mtu = MTU;
-    zt->recvMsgData = malloc(zt->mtu * sizeof(uint8_t));
+    zt->recvMsgData = zcm_alloc(zt->mtu * sizeof(uint8_t), ZCM_ALLOC_TRANSPORT);
     if (zt->recvMsgData == NULL) {
-        free(zt);
+        zcm_dealloc(zt, ZCM_ALLOC_TRANSPORT);
         return NULL;
     }
 
     zt->trans.trans_type = ZCM_NONBLOCKING;
     zt->trans.vtbl = &methods;
     if (!cb_init(&zt->sendBuffer, bufSize)) {
-        free(zt->recvMsgData);
-        free(zt);
+        zcm_dealloc(zt->recvMsgData, ZCM_ALLOC_TRANSPORT);
+        zcm_dealloc(zt, ZCM_ALLOC_TRANSPORT);
         return NULL;
     }
     if (!cb_init(&zt->recvBuffer, bufSize)) {
         cb_deinit(&zt->sendBuffer);
-        free(zt->recvMsgData);
-        free(zt);
+        zcm_dealloc(zt->recvMsgData, ZCM_ALLOC_TRANSPORT);
+        zcm_dealloc(zt, ZCM_ALLOC_TRANSPORT);
         return NULL;
     }
 
@@ -464,6 +927,21 @@ zcm_trans_t *zcm_trans_generic_serial_create(
     zt->time = timestamp_now;
     zt->time_usr = time_usr;
 
+    zt->checksum = checksum ? checksum : fletcherUpdateBytes;
+    zt->checksum_usr = checksum_usr;
+
+    zt->packData = NULL;
+    zt->packSize = 0;
+    zt->packLen = 0;
+    zt->packCount = 0;
+    zt->packNumChans = 0;
+    zt->unpackCount = 0;
+    zt->unpackData = zt->recvMsgData;
+    zt->cobs = false;
+    zt->cobsBuf = NULL;
+    zt->cobsSize = 0;
+    zt->cobsScanned = 0;
+
     return (zcm_trans_t*) zt;
 }
 
@@ -472,6 +950,43 @@ void zcm_trans_generic_serial_destroy(zcm_trans_t* _zt)
     zcm_trans_generic_serial_t *zt = cast(_zt);
     cb_deinit(&zt->recvBuffer);
     cb_deinit(&zt->sendBuffer);
-    free(zt->recvMsgData);
-    free(zt);
+    zcm_dealloc(zt->recvMsgData, ZCM_ALLOC_TRANSPORT);
+    zcm_dealloc(zt->packData, ZCM_ALLOC_TRANSPORT);
+    zcm_dealloc(zt->cobsBuf, ZCM_ALLOC_TRANSPORT);
+    zcm_dealloc(zt, ZCM_ALLOC_TRANSPORT);
+}
+
+int zcm_trans_generic_serial_enable_packing(zcm_trans_t* _zt, size_t packSize)
+{
+    zcm_trans_generic_serial_t *zt = cast(_zt);
+    if (packSize > zt->mtu || packSize > UINT32_MAX) return ZCM_EINVALID;
+    if (packFlush(zt) != ZCM_EOK) return ZCM_EAGAIN;
+
+    zcm_dealloc(zt->packData, ZCM_ALLOC_TRANSPORT);
+    zt->packData = NULL;
+    zt->packSize = 0;
+    if (packSize == 0) return ZCM_EOK;
+
+    zt->packData = zcm_alloc(packSize, ZCM_ALLOC_TRANSPORT);
+    if (zt->packData == NULL) return ZCM_EUNKNOWN;
+    zt->packSize = packSize;
+    return ZCM_EOK;
+}
+
+int zcm_trans_generic_serial_enable_cobs(zcm_trans_t* _zt, bool enable)
+{
+    zcm_trans_generic_serial_t *zt = cast(_zt);
+    if (packFlush(zt) != ZCM_EOK) return ZCM_EAGAIN;
+
+    if (enable && zt->cobsBuf == NULL) {
+        zt->cobsSize = 2 + ZCM_CHANNEL_MAXLEN + zt->mtu + 2;
+        zt->cobsBuf = zcm_alloc(zt->cobsSize, ZCM_ALLOC_TRANSPORT);
+        if (zt->cobsBuf == NULL) {
+            zt->cobsSize = 0;
+            return ZCM_EUNKNOWN;
+        }
+    }
+    zt->cobs = enable;
+    zt->cobsScanned = 0;
+    return ZCM_EOK;
 }
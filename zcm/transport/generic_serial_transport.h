@@ -18,12 +18,55 @@ zcm_trans_t *zcm_trans_generic_serial_create(
         void* time_usr,
         size_t MTU, size_t bufSize);
 
+// Same as above, but frames are checked with 'checksum' instead of the built-in
+// Fletcher-16, e.g. to use a hardware CRC unit. It's called on the channel, then
+// on the data of every message, with 'prevSum' starting at 0xffff and then set
+// to what the previous call returned. Both ends of the link must use the same
+// one: the frames themselves don't change, but their checksums do.
+// NULL selects the built-in Fletcher-16
+zcm_trans_t *zcm_trans_generic_serial_create_checksum(
+        size_t (*get)(uint8_t* data, size_t nData, void* usr),
+        size_t (*put)(const uint8_t* data, size_t nData, void* usr),
+        void* put_get_usr,
+        uint64_t (*timestamp_now)(void* usr),
+        void* time_usr,
+        size_t MTU, size_t bufSize,
+        uint16_t (*checksum)(const uint8_t* data, size_t nData, uint16_t prevSum, void* usr),
+        void* checksum_usr);
+
+// Bundles messages small enough into packed frames of up to 'packSize' bytes,
+// which carry each channel name once and no per-message framing. Messages are
+// held until the next serial_update_tx() (or serial_tx_span()), or until the
+// frame is full. Receivers always understand packed frames, but need an MTU of
+// at least 'packSize'. 0 turns packing back off. Returns ZCM_EINVALID if
+// 'packSize' is bigger than the MTU
+int zcm_trans_generic_serial_enable_packing(zcm_trans_t* zt, size_t packSize);
+
+// Switches both directions to COBS framing: frames are COBS encoded and end
+// with a 0x00, so their overhead is bounded (at most 3 + 1 per 254 bytes) and
+// receivers find them with a scan for the delimiter. Both ends of the link
+// must use the same framing. Call before any traffic, or pending bytes of the
+// previous framing are lost
+int zcm_trans_generic_serial_enable_cobs(zcm_trans_t* zt, bool enable);
+
 // frees all resources inside of zt and frees zt itself
 void zcm_trans_generic_serial_destroy(zcm_trans_t* zt);
 
 int serial_update_rx(zcm_trans_t *zt);
 int serial_update_tx(zcm_trans_t *zt);
 
+// Direct access to the receive and send buffers, e.g. for DMA. 'get' and 'put'
+// may be NULL when the buffers are only accessed this way.
+// Up to '*nData' received bytes can be written at serial_rx_span(), then
+// handed to the transport with serial_rx_commit(). '*nData' bytes waiting to be
+// sent can be read at serial_tx_span(), then dropped with serial_tx_consume().
+// Spans are contiguous, so a buffer that wraps around takes two of them.
+// These aren't interrupt safe: call them from the context that updates zcm
+uint8_t*       serial_rx_span(zcm_trans_t *zt, size_t *nData);
+void           serial_rx_commit(zcm_trans_t *zt, size_t nData);
+const uint8_t* serial_tx_span(zcm_trans_t *zt, size_t *nData);
+void           serial_tx_consume(zcm_trans_t *zt, size_t nData);
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,7 +12,11 @@
 #include <cstdio>
 #include <cassert>
 #include <unordered_map>
+#include <vector>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 #include <unistd.h>
 #include <limits.h>
 
@@ -32,6 +36,27 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     u64 lastMsgUtime = 0;
     u64 lastDispatchUtime = 0;
 
+    // In "r" mode, events are read up to 'prefetch' of them ahead by 'reader',
+    // into a ring of copies that are reused. The one handed out by the last
+    // recvmsg() is 'holding', and stays valid until the next one
+    struct Slot
+    {
+        u64 utime;
+        string channel;
+        vector<u8> data;
+    };
+    size_t prefetch = 1024;
+    vector<Slot> slots;
+    size_t head = 0;
+    size_t count = 0;
+    bool holding = false;
+    bool ended = false;
+    bool stopReader = false;
+    bool woken = false; // by recvmsg_wakeup()
+    mutex lk;
+    condition_variable cond;
+    thread reader;
+
     string *findOption(const string& s)
     {
         auto it = options.find(s);
@@ -67,20 +92,122 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             }
         }
 
-        auto filename = zcm_url_address(url);
-        ZCM_DEBUG("Opening zcm logfile: \"%s\"", filename);
+        string* prefetchStr = findOption("prefetch");
+        if (prefetchStr) {
+            char *end;
+            prefetch = strtoul(prefetchStr->c_str(), &end, 10);
+            if (*end != '\0') {
+                ZCM_DEBUG("Expected number of events as 'prefetch' argument");
+                return;
+            }
+        }
+
+        // Logs served by zcm-log-server ("file://zcmlog://host:port/path") take
+        // the window to read along
+        string filename = zcm_url_address(url);
+        if (filename.compare(0, 9, "zcmlog://") == 0) {
+            char sep = '?';
+            for (const char* name : { "start", "end", "channels" }) {
+                string* opt = findOption(name);
+                if (!opt) continue;
+                filename += sep + string(name) + "=" + *opt;
+                sep = '&';
+            }
+        }
+        ZCM_DEBUG("Opening zcm logfile: \"%s\"", filename.c_str());
         log = new zcm::LogFile(filename, string(mode));
         if (!log->good()) {
-            fprintf(stderr, "Unable to open logfile %s\n", filename);
+            fprintf(stderr, "Unable to open logfile %s\n", filename.c_str());
             return;
         }
+
+        if (mode == "r" && prefetch > 0) {
+            slots.resize(prefetch);
+            reader = thread([this]() { readerThread(); });
+        }
     }
 
     ~ZCM_TRANS_CLASSNAME()
     {
+        if (reader.joinable()) {
+            {
+                unique_lock<mutex> lock{lk};
+                stopReader = true;
+            }
+            cond.notify_all();
+            reader.join();
+        }
         if (log) delete log;
     }
 
+    void readerThread()
+    {
+        while (true) {
+            size_t tail;
+            {
+                unique_lock<mutex> lock{lk};
+                cond.wait(lock, [&](){ return count < slots.size() || stopReader; });
+                if (stopReader) return;
+                tail = (head + count) % slots.size();
+            }
+
+            // Only this thread touches the slots after the queued ones
+            const zcm::LogEvent* le = log->readNextEvent();
+            if (le) {
+                Slot& s = slots[tail];
+                s.utime = le->timestamp;
+                s.channel = le->channel;
+                s.data.assign(le->data, le->data + le->datalen);
+            }
+
+            {
+                unique_lock<mutex> lock{lk};
+                if (le) count++;
+                else ended = true;
+            }
+            cond.notify_all();
+            if (!le) return;
+        }
+    }
+
+    // Releases the event handed out last, and waits up to 'timeout' ms (forever
+    // if negative) for the next one. Returns ZCM_EAGAIN if none came in time
+    // (or on recvmsg_wakeup()), ZCM_ECONNECT at the end of the log
+    int nextPrefetched(zcm_msg_t *msg, int timeout)
+    {
+        unique_lock<mutex> lock{lk};
+        if (holding) {
+            holding = false;
+            head = (head + 1) % slots.size();
+            count--;
+            cond.notify_all();
+        }
+
+        auto ready = [&](){ return count > 0 || ended || woken; };
+        if (timeout < 0) cond.wait(lock, ready);
+        else if (!cond.wait_for(lock, chrono::milliseconds(timeout), ready))
+            return ZCM_EAGAIN;
+        woken = false;
+        if (count == 0) return ended ? ZCM_ECONNECT : ZCM_EAGAIN;
+
+        Slot& s = slots[head];
+        holding = true;
+        msg->utime = s.utime;
+        msg->channel = s.channel.c_str();
+        msg->len = s.data.size();
+        msg->buf = s.data.data();
+        return ZCM_EOK;
+    }
+
+    void recvmsg_wakeup()
+    {
+        {
+            unique_lock<mutex> lock{lk};
+            woken = true;
+        }
+        cond.notify_all();
+    }
+
     bool good()
     {
         return log ? log->good() : false;
@@ -128,17 +255,28 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             return ZCM_ECONNECT;
         }
 
-        const zcm::LogEvent* le = log->readNextEvent();
-        if (!le) {
-            delete log;
-            log = nullptr;
-            return ZCM_ECONNECT;
-        }
+        if (reader.joinable()) {
+            int ret = nextPrefetched(msg, timeout);
+            if (ret == ZCM_EAGAIN) return ret;
+            if (ret == ZCM_ECONNECT) {
+                reader.join();
+                delete log;
+                log = nullptr;
+                return ret;
+            }
+        } else {
+            const zcm::LogEvent* le = log->readNextEvent();
+            if (!le) {
+                delete log;
+                log = nullptr;
+                return ZCM_ECONNECT;
+            }
 
-        msg->utime = le->timestamp;
-        msg->channel = le->channel.c_str();
-        msg->len = le->datalen;
-        msg->buf = le->data;
+            msg->utime = le->timestamp;
+            msg->channel = le->channel.c_str();
+            msg->len = le->datalen;
+            msg->buf = le->data;
+        }
 
         u64 now = TimeUtil::utime();
 
@@ -153,8 +291,12 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         u64 logDiffSpeed = logDiff / this->speed;
         u64 diff = logDiffSpeed > localDiff ? logDiffSpeed - localDiff : 0;
 
-        if (diff > 0)
-            usleep(diff);
+        // Keeping pace with the log may take long: recvmsg_wakeup() cuts it short
+        if (diff > 0) {
+            unique_lock<mutex> lock{lk};
+            cond.wait_for(lock, chrono::microseconds(diff), [&](){ return woken; });
+            woken = false;
+        }
 
         lastDispatchUtime = TimeUtil::utime();
         lastMsgUtime = msg->utime;
@@ -182,6 +324,9 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static int _recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
     { return cast(zt)->recvmsg(msg, timeout); }
 
+    static void _recvmsg_wakeup(zcm_trans_t *zt)
+    { return cast(zt)->recvmsg_wakeup(); }
+
     static void _destroy(zcm_trans_t *zt)
     { delete cast(zt); }
 
@@ -195,6 +340,15 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_recvmsg,
     NULL,
     &ZCM_TRANS_CLASSNAME::_destroy,
+    NULL, // recvmsg_claim
+    NULL, // recvmsg_release
+    NULL, // sendmsg_batch
+    &ZCM_TRANS_CLASSNAME::_recvmsg_wakeup,
+    NULL, // get_stats
+    NULL, // get_fd
+    NULL, // set_interleave
+    NULL, // has_subscribers
+    NULL, // sendmsg_iov
 };
 
 static zcm_trans_t *create(zcm_url_t *url)
@@ -208,4 +362,6 @@ static zcm_trans_t *create(zcm_url_t *url)
 }
 
 const TransportRegister ZCM_TRANS_CLASSNAME::reg(
-    "file", "Interact with zcm log file (e.g. 'file://vehicle.log?speed=2.0)", create);
+    "file", "Interact with zcm log file (e.g. 'file://vehicle.log?speed=2.0&prefetch=1024,"
+    " or 'file://zcmlog://host:7400/vehicle.log?start=10&end=20&channels=POSE' for one"
+    " served by zcm-log-server)", create);
@@ -0,0 +1,374 @@
+#ifdef __linux__
+
+#include "zcm/transport.h"
+#include "zcm/transport_registrar.h"
+#include "zcm/transport_register.hpp"
+#include "zcm/util/debug.h"
+
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Define this the class name you want
+#define ZCM_TRANS_CLASSNAME TransportHybrid
+#define MAX_RECV_QUEUE 1024
+#define RECV_POLL_MS 100
+
+// Publishes every message to a shm ring for the subscribers on this host and
+// over udpm for the others, and receives from both. The udpm side is created
+// with loopback=none, so nothing sent over the network comes back to this
+// host: a subscriber gets exactly one copy of each message, the local ones
+// through shared memory alone. For that, every process of the bus on a host
+// must use hybrid (a plain udpm subscriber there misses the hybrid publishers
+// of its host). Messages aren't sent over the network while the udpm side
+// knows that nobody else receives them (see has_subscribers()).
+struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
+{
+    zcm_trans_t *local = nullptr;
+    zcm_trans_t *net = nullptr;
+
+    // Both sides are read by a thread of their own into 'queue'
+    struct Received
+    {
+        zcm_trans_t *from;
+        zcm_msg_t    msg;
+        void        *token;
+    };
+    mutex              queueLock;
+    condition_variable queueCond;
+    deque<Received*>   queue;
+    bool               woken = false;
+    atomic<bool>       running {true};
+    vector<thread>     threads;
+    Received          *current = nullptr; // the last message handed out by recvmsg()
+
+    atomic<uint64_t> localMsgs {0};
+    atomic<uint64_t> netMsgs {0};
+    atomic<uint64_t> netSkipped {0};
+
+    ZCM_TRANS_CLASSNAME(zcm_url_t *url)
+    {
+        trans_type = ZCM_BLOCKING;
+        vtbl = &methods;
+
+        // By default the shm subnet is named after the udpm address
+        string address = zcm_url_address(url);
+        string subnet = address;
+        for (char& c : subnet)
+            if (!isalnum((unsigned char)c)) c = '_';
+        string shmOpts, udpmOpts = "loopback=none";
+
+        auto *opts = zcm_url_opts(url);
+        for (size_t i = 0; i < opts->numopts; ++i) {
+            string name = opts->name[i], value = opts->value[i];
+            if (name == "shm") {
+                subnet = value;
+            } else if (name == "shm_size") {
+                shmOpts += (shmOpts.empty() ? "?" : "&") + string("size=") + value;
+            } else if (name == "hugepages") {
+                // Both sides have buffers worth putting on huge pages
+                shmOpts += (shmOpts.empty() ? "?" : "&") + name + "=" + value;
+                udpmOpts += "&" + name + "=" + value;
+            } else if (name == "loopback" || name == "selftest") {
+                ZCM_DEBUG("hybrid can't take the udpm option '%s'", name.c_str());
+                return;
+            } else {
+                udpmOpts += "&" + name + "=" + value;
+            }
+        }
+
+        local = openInner("shm", "shm://" + subnet + shmOpts);
+        if (!local) return;
+        net = openInner("udpm", "udpm://" + address + "?" + udpmOpts);
+        if (!net) return;
+
+        threads.emplace_back(&ZCM_TRANS_CLASSNAME::run, this, local);
+        threads.emplace_back(&ZCM_TRANS_CLASSNAME::run, this, net);
+    }
+
+    ~ZCM_TRANS_CLASSNAME()
+    {
+        running = false;
+        {
+            unique_lock<mutex> lk(queueLock);
+            queueCond.notify_all();
+        }
+        if (local) zcm_trans_recvmsg_wakeup(local);
+        if (net) zcm_trans_recvmsg_wakeup(net);
+        for (auto& t : threads) t.join();
+
+        if (current) recvmsgRelease(current);
+        for (Received *r : queue) recvmsgRelease(r);
+
+        if (net) zcm_trans_destroy(net);
+        if (local) zcm_trans_destroy(local);
+    }
+
+    bool good() { return local && net; }
+
+    static zcm_trans_t *openInner(const char *protocol, const string& url)
+    {
+        zcm_trans_create_func *creator = zcm_transport_find(protocol);
+        if (!creator) {
+            ZCM_DEBUG("hybrid needs the %s transport, which isn't built in", protocol);
+            return nullptr;
+        }
+        zcm_url_t *u = zcm_url_create(url.c_str());
+        zcm_trans_t *zt = creator(u);
+        zcm_url_destroy(u);
+        if (!zt) {
+            ZCM_DEBUG("hybrid failed to create '%s'", url.c_str());
+        } else if (zt->trans_type != ZCM_BLOCKING || !zcm_trans_can_claim(zt)) {
+            ZCM_DEBUG("hybrid can't receive from '%s'", url.c_str());
+            zcm_trans_destroy(zt);
+            zt = nullptr;
+        }
+        return zt;
+    }
+
+    void run(zcm_trans_t *from)
+    {
+        while (running) {
+            Received *r = new Received { from, {}, nullptr };
+            if (zcm_trans_recvmsg_claim(from, &r->msg, RECV_POLL_MS, &r->token) != ZCM_EOK) {
+                delete r;
+                continue;
+            }
+            (from == local ? localMsgs : netMsgs)++;
+
+            unique_lock<mutex> lk(queueLock);
+            queueCond.wait(lk, [&](){ return !running || queue.size() < MAX_RECV_QUEUE; });
+            if (!running) {
+                lk.unlock();
+                recvmsgRelease(r);
+                break;
+            }
+            queue.push_back(r);
+            queueCond.notify_all();
+        }
+    }
+
+    bool sendsOverNet(const char *channel)
+    {
+        if (zcm_trans_has_subscribers(net, channel) != 0) return true;
+        netSkipped++;
+        return false;
+    }
+
+    /********************** METHODS **********************/
+    size_t getMtu()
+    {
+        return std::min(zcm_trans_get_mtu(local), zcm_trans_get_mtu(net));
+    }
+
+    int sendmsg(zcm_msg_t msg)
+    {
+        int rc = zcm_trans_sendmsg(local, msg);
+        if (!sendsOverNet(msg.channel)) return rc;
+        int netRc = zcm_trans_sendmsg(net, msg);
+        return rc != ZCM_EOK ? rc : netRc;
+    }
+
+    int sendmsgIov(zcm_msg_t msg, const zcm_iov_t *iov, size_t niov)
+    {
+        int rc = zcm_trans_sendmsg_iov(local, msg, iov, niov);
+        if (!sendsOverNet(msg.channel)) return rc;
+        int netRc = zcm_trans_sendmsg_iov(net, msg, iov, niov);
+        return rc != ZCM_EOK ? rc : netRc;
+    }
+
+    int sendmsgBatch(const zcm_msg_t *msgs, size_t nmsgs)
+    {
+        int ret = ZCM_EOK;
+        for (size_t i = 0; i < nmsgs; i++) {
+            int rc = zcm_trans_sendmsg(local, msgs[i]);
+            if (rc != ZCM_EOK && ret == ZCM_EOK) ret = rc;
+        }
+
+        // Kept for the next batches
+        static thread_local vector<zcm_msg_t> toNet;
+        toNet.clear();
+        for (size_t i = 0; i < nmsgs; i++)
+            if (sendsOverNet(msgs[i].channel)) toNet.push_back(msgs[i]);
+        if (toNet.empty()) return ret;
+
+        int rc = zcm_trans_sendmsg_batch(net, toNet.data(), toNet.size());
+        return ret != ZCM_EOK ? ret : rc;
+    }
+
+    int recvmsgEnable(const char *channel, bool enable)
+    {
+        int rc = zcm_trans_recvmsg_enable(local, channel, enable);
+        int netRc = zcm_trans_recvmsg_enable(net, channel, enable);
+        return rc != ZCM_EOK ? rc : netRc;
+    }
+
+    int recvmsg(zcm_msg_t *msg, int timeout)
+    {
+        if (current) {
+            recvmsgRelease(current);
+            current = nullptr;
+        }
+        void *token;
+        int rc = recvmsgClaim(msg, timeout, &token);
+        if (rc == ZCM_EOK) current = (Received*) token;
+        return rc;
+    }
+
+    int recvmsgClaim(zcm_msg_t *msg, int timeout, void **token)
+    {
+        unique_lock<mutex> lk(queueLock);
+        auto ready = [&](){ return woken || !queue.empty(); };
+        if (timeout < 0) queueCond.wait(lk, ready);
+        else queueCond.wait_for(lk, chrono::milliseconds(timeout), ready);
+        woken = false;
+        if (queue.empty()) return ZCM_EAGAIN;
+
+        Received *r = queue.front();
+        queue.pop_front();
+        queueCond.notify_all();
+        *msg = r->msg;
+        *token = r;
+        return ZCM_EOK;
+    }
+
+    void recvmsgRelease(void *token)
+    {
+        Received *r = (Received*) token;
+        zcm_trans_recvmsg_release(r->from, r->token);
+        delete r;
+    }
+
+    void recvmsgWakeup()
+    {
+        unique_lock<mutex> lk(queueLock);
+        woken = true;
+        queueCond.notify_all();
+    }
+
+    int getStats(zcm_stat_handler_t cb, void *usr)
+    {
+        cb("hybrid.local_msgs", localMsgs.load(), usr);
+        cb("hybrid.net_msgs", netMsgs.load(), usr);
+        cb("hybrid.net_skipped", netSkipped.load(), usr);
+        // Their names already tell them apart
+        zcm_trans_get_stats(local, cb, usr);
+        zcm_trans_get_stats(net, cb, usr);
+        return ZCM_EOK;
+    }
+
+    void setInterleave(zcm_interleave_t next, void *usr)
+    {
+        // Only udpm sends in pieces
+        zcm_trans_set_interleave(net, next, usr);
+    }
+
+    int hasSubscribers(const char *channel)
+    {
+        int l = zcm_trans_has_subscribers(local, channel);
+        int n = zcm_trans_has_subscribers(net, channel);
+        if (l == 1 || n == 1) return 1;
+        return l == 0 && n == 0 ? 0 : -1;
+    }
+
+    /********************** STATICS **********************/
+    static zcm_trans_methods_t methods;
+    static ZCM_TRANS_CLASSNAME *cast(zcm_trans_t *zt)
+    {
+        assert(zt->vtbl == &methods);
+        return (ZCM_TRANS_CLASSNAME*)zt;
+    }
+
+    static size_t _getMtu(zcm_trans_t *zt)
+    { return cast(zt)->getMtu(); }
+
+    static int _sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
+    { return cast(zt)->sendmsg(msg); }
+
+    static int _recvmsgEnable(zcm_trans_t *zt, const char *channel, bool enable)
+    { return cast(zt)->recvmsgEnable(channel, enable); }
+
+    static int _recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
+    { return cast(zt)->recvmsg(msg, timeout); }
+
+    static void _destroy(zcm_trans_t *zt)
+    { delete cast(zt); }
+
+    static int _recvmsgClaim(zcm_trans_t *zt, zcm_msg_t *msg, int timeout, void **token)
+    { return cast(zt)->recvmsgClaim(msg, timeout, token); }
+
+    static void _recvmsgRelease(zcm_trans_t *zt, void *token)
+    { return cast(zt)->recvmsgRelease(token); }
+
+    static int _sendmsgBatch(zcm_trans_t *zt, const zcm_msg_t *msgs, size_t nmsgs)
+    { return cast(zt)->sendmsgBatch(msgs, nmsgs); }
+
+    static void _recvmsgWakeup(zcm_trans_t *zt)
+    { return cast(zt)->recvmsgWakeup(); }
+
+    static int _getStats(zcm_trans_t *zt, zcm_stat_handler_t cb, void *usr)
+    { return cast(zt)->getStats(cb, usr); }
+
+    static void _setInterleave(zcm_trans_t *zt, zcm_interleave_t next, void *usr)
+    { return cast(zt)->setInterleave(next, usr); }
+
+    static int _hasSubscribers(zcm_trans_t *zt, const char *channel)
+    { return cast(zt)->hasSubscribers(channel); }
+
+    static int _sendmsgIov(zcm_trans_t *zt, zcm_msg_t msg, const zcm_iov_t *iov, size_t niov)
+    { return cast(zt)->sendmsgIov(msg, iov, niov); }
+
+    static const TransportRegister reg;
+};
+
+zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
+    &ZCM_TRANS_CLASSNAME::_getMtu,
+    &ZCM_TRANS_CLASSNAME::_sendmsg,
+    &ZCM_TRANS_CLASSNAME::_recvmsgEnable,
+    &ZCM_TRANS_CLASSNAME::_recvmsg,
+    NULL, // update
+    &ZCM_TRANS_CLASSNAME::_destroy,
+    &ZCM_TRANS_CLASSNAME::_recvmsgClaim,
+    &ZCM_TRANS_CLASSNAME::_recvmsgRelease,
+    &ZCM_TRANS_CLASSNAME::_sendmsgBatch,
+    &ZCM_TRANS_CLASSNAME::_recvmsgWakeup,
+    &ZCM_TRANS_CLASSNAME::_getStats,
+    NULL, // get_fd
+    &ZCM_TRANS_CLASSNAME::_setInterleave,
+    &ZCM_TRANS_CLASSNAME::_hasSubscribers,
+    &ZCM_TRANS_CLASSNAME::_sendmsgIov,
+};
+
+static zcm_trans_t *create(zcm_url_t *url)
+{
+    auto *trans = new ZCM_TRANS_CLASSNAME(url);
+    if (trans->good())
+        return trans;
+
+    delete trans;
+    return nullptr;
+}
+
+#ifdef USING_TRANS_HYBRID
+// Register this transport with ZCM
+const TransportRegister ZCM_TRANS_CLASSNAME::reg(
+    "hybrid", "Publish to shm rings for this host and over udpm for the others "
+              "(e.g. 'hybrid://239.255.76.67:7667?ttl=1', 'hybrid://...?shm=mysubnet')",
+    create);
+#endif
+
+#endif
@@ -3,51 +3,146 @@
 #include "zcm/transport_register.hpp"
 
 #include "zcm/util/debug.h"
+#include "zcm/util/huge_pages.hpp"
 #include "util/TimeUtil.hpp"
 
 #include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <deque>
+#include <unordered_map>
 #include <mutex>
 #include <condition_variable>
+#include <string>
 
 #define ZCM_TRANS_CLASSNAME TransportNonblockInproc
 #define MTU (1<<28)
+#define DEFAULT_RING_SIZE (1<<24)
+#define MIN_RING_SIZE (1<<12)
 
 using namespace std;
 
+// Messages are stored in a byte ring as one record each: this header, then the
+// channel and its NULL, then the data, padded to a multiple of 8 bytes.
+// Records are freed in any order (claimed messages may be released out of
+// order), the ring only reclaims the space up to the oldest unreleased one
+struct InprocRecord
+{
+    uint32_t size;     // of the whole record
+    uint32_t released;
+};
+
 struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
 {
-    // Messages are queued into a deque and then dispatched one at a time through recvmsg
-    // using the "inFlight" pointers to store their memory until the next message is dispatched
-    // Note: Have to use free() to clean up chan memory in these because we create them via strdup
-    deque<zcm_msg_t*> msgs;
-    const char*    inFlightChanMem = nullptr;
-          uint8_t* inFlightDataMem = nullptr;
+    // A queued message. 'rec' points to its record in the ring, or is null when
+    // the message didn't fit in the ring and 'mem' was allocated for it instead
+    struct Queued
+    {
+        int64_t       utime;
+        const char   *channel;
+        uint8_t      *buf;
+        size_t        len;
+        InprocRecord *rec;
+        uint8_t      *mem;
+    };
+
+    // Messages are queued into a deque and then dispatched one at a time through
+    // recvmsg, which holds on to the last one in "inFlight" until the next message
+    // is dispatched
+    deque<Queued> msgs;
+    Queued inFlight {};
+    bool   hasInFlight = false;
+
+    uint8_t *ring = nullptr;
+    size_t   ringSize = DEFAULT_RING_SIZE;
+    bool     hugePages = false; // whether 'ring' came from HugePages::map()
+    uint64_t head = 0; // ring offsets, taken modulo ringSize
+    uint64_t tail = 0;
 
     condition_variable msgCond;
     mutex msgLock;
+    bool  woken = false; // by recvmsg_wakeup(), under 'msgLock'
+
+    // What recvmsg_enable() turned on, for has_subscribers(): messages only
+    // ever loop back to this zcm, so nobody else could be listening
+    unordered_map<string, size_t> enabled;
+    bool enabledAll = false;
+    mutex enabledLock;
 
     ZCM_TRANS_CLASSNAME(zcm_url_t *url, bool blocking)
     {
         trans_type = blocking ? ZCM_BLOCKING : ZCM_NONBLOCKING;
         vtbl = &methods;
+
+        auto *opts = zcm_url_opts(url);
+        for (size_t i = 0; i < opts->numopts; ++i) {
+            if (string(opts->name[i]) == "size") {
+                ringSize = strtoull(opts->value[i], nullptr, 10) & ~(size_t)7;
+                if (ringSize < MIN_RING_SIZE || ringSize > MTU) {
+                    ZCM_DEBUG("inproc size must be between %d and %d bytes",
+                              MIN_RING_SIZE, MTU);
+                    ringSize = 0;
+                    return;
+                }
+            } else if (string(opts->name[i]) == "hugepages") {
+                hugePages = string(opts->value[i]) == "true";
+            }
+        }
+
+        if (hugePages) ring = (uint8_t*) HugePages::map(ringSize);
+        else           ring = (uint8_t*) zcm_alloc(ringSize, ZCM_ALLOC_TRANSPORT);
     }
 
     ~ZCM_TRANS_CLASSNAME()
     {
-        for (auto msg: msgs) {
-            free((void*) msg->channel);
-            delete [] msg->buf;
-            delete msg;
-        }
+        for (auto& q : msgs) zcm_dealloc(q.mem, ZCM_ALLOC_TRANSPORT);
         msgs.clear();
+        if (hasInFlight) zcm_dealloc(inFlight.mem, ZCM_ALLOC_TRANSPORT);
+        if (hugePages) HugePages::unmap(ring, ringSize);
+        else           zcm_dealloc(ring, ZCM_ALLOC_TRANSPORT);
+    }
+
+    bool good() { return ring != nullptr; }
+
+    static size_t recordSize(size_t chanLen, size_t len)
+    { return (sizeof(InprocRecord) + chanLen + 1 + len + 7) & ~(size_t)7; }
+
+    // Returns the memory for a record of 'need' bytes, or null if the ring is full
+    InprocRecord *ringAlloc(size_t need)
+    {
+        if (need > ringSize / 2) return nullptr;
 
-        free((void*) inFlightChanMem);
-        delete [] inFlightDataMem;
+        uint64_t off = head % ringSize;
+        uint64_t pad = off + need > ringSize ? ringSize - off : 0;
+        if (head + pad + need - tail > ringSize) return nullptr;
+
+        // Records never wrap: the end of the ring is skipped with a released record
+        if (pad) {
+            InprocRecord *padRec = (InprocRecord*)(ring + off);
+            padRec->size = pad;
+            padRec->released = 1;
+        }
+
+        InprocRecord *rec = (InprocRecord*)(ring + (head + pad) % ringSize);
+        rec->size = need;
+        rec->released = 0;
+        head += pad + need;
+        return rec;
     }
 
-    bool good() { return true; }
+    void releaseQueued(const Queued& q)
+    {
+        if (!q.rec) {
+            zcm_dealloc(q.mem, ZCM_ALLOC_TRANSPORT);
+            return;
+        }
+        q.rec->released = 1;
+        while (tail != head) {
+            InprocRecord *rec = (InprocRecord*)(ring + tail % ringSize);
+            if (!rec->released) break;
+            tail += rec->size;
+        }
+    }
 
     /********************** METHODS **********************/
     size_t get_mtu() { return MTU; }
@@ -67,16 +162,29 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             return ZCM_EINVALID;
         }
 
-        zcm_msg_t *newMsg = new zcm_msg_t();
-        newMsg->utime = msg.utime;
-        newMsg->len = msg.len;
-        newMsg->channel = strdup(msg.channel);
-        newMsg->buf = new uint8_t[msg.len];
-        std::copy_n(msg.buf, msg.len, newMsg->buf);
-
         std::unique_lock<mutex> lk(msgLock, defer_lock);
         if (trans_type == ZCM_BLOCKING) lk.lock();
-        msgs.push_back(newMsg);
+
+        // Messages bigger than half the ring, or that come while it's full, are
+        // allocated on their own so that sending never fails nor waits
+        Queued q;
+        size_t need = recordSize(chanLen, msg.len);
+        q.rec = ringAlloc(need);
+        if (q.rec) {
+            q.mem = nullptr;
+            q.channel = (const char*)(q.rec + 1);
+        } else {
+            q.mem = (uint8_t*) zcm_alloc(chanLen + 1 + msg.len, ZCM_ALLOC_TRANSPORT);
+            ZCM_ASSERT(q.mem);
+            q.channel = (const char*)q.mem;
+        }
+        q.buf = (uint8_t*)q.channel + chanLen + 1;
+        q.len = msg.len;
+        q.utime = msg.utime;
+        memcpy((char*)q.channel, msg.channel, chanLen + 1);
+        std::copy_n(msg.buf, msg.len, q.buf);
+
+        msgs.push_back(q);
         if (trans_type == ZCM_BLOCKING) {
             lk.unlock();
             msgCond.notify_all();
@@ -85,38 +193,102 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         return ZCM_EOK;
     }
 
-    int recvmsg_enable(const char *channel, bool enable) { return ZCM_EOK; }
+    int recvmsg_enable(const char *channel, bool enable)
+    {
+        unique_lock<mutex> lk(enabledLock);
+        if (!channel) {
+            enabledAll = enable;
+            return ZCM_EOK;
+        }
+        auto it = enabled.find(channel);
+        if (enable) {
+            if (it == enabled.end()) enabled.emplace(channel, 1);
+            else                     ++it->second;
+        } else if (it != enabled.end() && --it->second == 0) {
+            enabled.erase(it);
+        }
+        return ZCM_EOK;
+    }
 
-    int recvmsg(zcm_msg_t *msg, int timeout)
+    int has_subscribers(const char *channel)
     {
-        std::unique_lock<mutex> lk(msgLock, defer_lock);
+        unique_lock<mutex> lk(enabledLock);
+        return enabledAll || enabled.count(channel) ? 1 : 0;
+    }
 
+    // In blocking mode, locks 'lk' and waits up to 'timeout' ms for a message
+    // (or for recvmsg_wakeup())
+    bool waitForMsg(std::unique_lock<mutex>& lk, int timeout)
+    {
         if (trans_type == ZCM_BLOCKING) {
             lk.lock();
-            bool available = msgCond.wait_for(lk, chrono::milliseconds(timeout),
-                                              [&](){ return !msgs.empty(); });
-            if (!available) return ZCM_EAGAIN;
-        } else {
-            if (msgs.empty()) return ZCM_EAGAIN;
+            msgCond.wait_for(lk, chrono::milliseconds(timeout),
+                             [&](){ return woken || !msgs.empty(); });
+            woken = false;
         }
+        return !msgs.empty();
+    }
 
-        // Clean up memory from last message
-        free((void*) inFlightChanMem);
-        delete [] inFlightDataMem;
+    void recvmsg_wakeup()
+    {
+        unique_lock<mutex> lk(msgLock);
+        woken = true;
+        msgCond.notify_all();
+    }
+
+    Queued popMsg(zcm_msg_t *msg)
+    {
+        Queued q = msgs.front();
+        msgs.pop_front();
 
-        // Steal the dynamic memory from the front of the queue, but hang onto the
-        // ptrs via the "inFlight" ptrs so we can clean it up later
-        *msg = *(msgs.front());
         msg->utime = TimeUtil::utime();
-        inFlightChanMem = msg->channel;
-        inFlightDataMem = msg->buf;
+        msg->channel = q.channel;
+        msg->len = q.len;
+        msg->buf = q.buf;
+        return q;
+    }
 
-        delete msgs.front();
-        msgs.pop_front();
+    int recvmsg(zcm_msg_t *msg, int timeout)
+    {
+        std::unique_lock<mutex> lk(msgLock, defer_lock);
+        if (!waitForMsg(lk, timeout)) return ZCM_EAGAIN;
+
+        // Clean up memory from last message
+        if (hasInFlight) releaseQueued(inFlight);
+
+        inFlight = popMsg(msg);
+        hasInFlight = true;
 
         return ZCM_EOK;
     }
 
+    // Same as recvmsg(), but the message is handed to the caller instead of being
+    // held in "inFlight". Its record (or its own allocation) doubles as the token
+    // given back to recvmsg_release()
+    int recvmsg_claim(zcm_msg_t *msg, int timeout, void **token)
+    {
+        std::unique_lock<mutex> lk(msgLock, defer_lock);
+        if (!waitForMsg(lk, timeout)) return ZCM_EAGAIN;
+
+        Queued q = popMsg(msg);
+        *token = q.rec ? (void*)q.rec : (void*)q.mem;
+
+        return ZCM_EOK;
+    }
+
+    void recvmsg_release(void *token)
+    {
+        std::unique_lock<mutex> lk(msgLock, defer_lock);
+        if (trans_type == ZCM_BLOCKING) lk.lock();
+
+        Queued q {};
+        if ((uint8_t*)token >= ring && (uint8_t*)token < ring + ringSize)
+            q.rec = (InprocRecord*)token;
+        else
+            q.mem = (uint8_t*)token;
+        releaseQueued(q);
+    }
+
     int update() { return ZCM_EOK; }
 
     /********************** STATICS **********************/
@@ -139,9 +311,21 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static int _recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
     { return cast(zt)->recvmsg(msg, timeout); }
 
+    static int _recvmsg_claim(zcm_trans_t *zt, zcm_msg_t *msg, int timeout, void **token)
+    { return cast(zt)->recvmsg_claim(msg, timeout, token); }
+
+    static void _recvmsg_release(zcm_trans_t *zt, void *token)
+    { return cast(zt)->recvmsg_release(token); }
+
+    static void _recvmsg_wakeup(zcm_trans_t *zt)
+    { return cast(zt)->recvmsg_wakeup(); }
+
     static int _update(zcm_trans_t *zt)
     { return cast(zt)->update(); }
 
+    static int _has_subscribers(zcm_trans_t *zt, const char *channel)
+    { return cast(zt)->has_subscribers(channel); }
+
     static void _destroy(zcm_trans_t *zt)
     { delete cast(zt); }
 
@@ -156,13 +340,32 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_recvmsg,
     &ZCM_TRANS_CLASSNAME::_update,
     &ZCM_TRANS_CLASSNAME::_destroy,
+    &ZCM_TRANS_CLASSNAME::_recvmsg_claim,
+    &ZCM_TRANS_CLASSNAME::_recvmsg_release,
+    NULL, // sendmsg_batch
+    &ZCM_TRANS_CLASSNAME::_recvmsg_wakeup,
+    NULL, // get_stats
+    NULL, // get_fd
+    NULL, // set_interleave
+    &ZCM_TRANS_CLASSNAME::_has_subscribers,
+    NULL, // sendmsg_iov
 };
 
+static zcm_trans_t *create(zcm_url_t *url, bool blocking)
+{
+    auto *trans = new ZCM_TRANS_CLASSNAME(url, blocking);
+    if (trans->good())
+        return trans;
+
+    delete trans;
+    return nullptr;
+}
+
 static zcm_trans_t *create_blocking(zcm_url_t *url)
-{ return new ZCM_TRANS_CLASSNAME(url, true); }
+{ return create(url, true); }
 
 static zcm_trans_t *create_nonblocking(zcm_url_t *url)
-{ return new ZCM_TRANS_CLASSNAME(url, false); }
+{ return create(url, false); }
 
 const TransportRegister ZCM_TRANS_CLASSNAME::regBlocking(
     "block-inproc",
@@ -12,10 +12,14 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <termios.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <linux/serial.h>
 #include <linux/usbdevice_fs.h>
 
 #include <cassert>
+#include <climits>
 #include <cstring>
 
 #include <string>
@@ -45,14 +49,33 @@ using u64 = uint64_t;
 struct Serial
 {
     Serial(){}
-    ~Serial() { close(); }
+    ~Serial()
+    {
+        close();
+        if (wakeFd >= 0) ::close(wakeFd);
+    }
 
     bool open(const string& port, int baud, bool hwFlowControl);
     bool isOpen() { return fd > 0; };
     void close();
 
-    int write(const u8 *buf, size_t sz);
-    int read(u8 *buf, size_t sz, u64 timeoutMs);
+    // The device is nonblocking: writes that don't fit in the driver's buffer
+    // return 0 unless 'wait'
+    int write(const u8 *buf, size_t sz, bool wait);
+    int read(u8 *buf, size_t sz, u64 timeoutUs);
+    int getFd() const { return fd; }
+
+    // Makes the read() that waits right now (or the next one to wait) return
+    // -2 at once. Safe to call from any thread
+    void wakeup();
+    // Whether a read() returned early because of wakeup() since the last call.
+    // Only for the thread that reads
+    bool takeWoken()
+    {
+        bool w = woken;
+        woken = false;
+        return w;
+    }
     // Returns 0 on invalid input baud otherwise returns termios constant baud value
     static int convertBaud(int baud);
 
@@ -64,6 +87,8 @@ struct Serial
   private:
     string port;
     int fd = -1;
+    int wakeFd = -1;
+    bool woken = false;
 };
 
 bool Serial::open(const string& port_, int baud, bool hwFlowControl)
@@ -83,7 +108,7 @@ bool Serial::open(const string& port_, int baud, bool hwFlowControl)
     }
     this->port = port_;
 
-    int flags = O_RDWR | O_NOCTTY | O_SYNC;
+    int flags = O_RDWR | O_NOCTTY | O_SYNC | O_NONBLOCK;
     fd = ::open(port.c_str(), flags, 0);
     if (fd < 0) {
         ZCM_DEBUG("failed to open serial device (%s): %s", port.c_str(), strerror(errno));
@@ -114,8 +139,10 @@ bool Serial::open(const string& port_, int baud, bool hwFlowControl)
     opts.c_cflag |= CS8;
     opts.c_cflag &= ~PARENB;
     if (hwFlowControl) opts.c_cflag |= CRTSCTS;
-    opts.c_cc[VTIME]    = 1;
-    opts.c_cc[VMIN]     = 30;
+    // Reads never wait in the driver: read() waits in poll() for the first byte,
+    // then takes everything that arrived in one go
+    opts.c_cc[VTIME]    = 0;
+    opts.c_cc[VMIN]     = 0;
 
     // set the new termios config
     if (tcsetattr(fd, TCSANOW, &opts)) {
@@ -125,6 +152,19 @@ bool Serial::open(const string& port_, int baud, bool hwFlowControl)
 
     tcflush(fd, TCIOFLUSH);
 
+    // Have the driver pass received bytes on right away rather than batching them
+    // (not every driver supports it)
+    struct serial_struct ss;
+    if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(fd, TIOCSSERIAL, &ss) != 0)
+            ZCM_DEBUG("failed to set low latency mode: %s", strerror(errno));
+    }
+
+    // Without it, read() just can't be woken up
+    if (wakeFd < 0 && (wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        ZCM_DEBUG("failed to create wakeup fd: %s", strerror(errno));
+
     return true;
 
  fail:
@@ -159,52 +199,78 @@ void Serial::close()
     }
 }
 
-int Serial::write(const u8 *buf, size_t sz)
+int Serial::write(const u8 *buf, size_t sz, bool wait)
 {
     assert(this->isOpen());
-    int ret = ::write(fd, buf, sz);
-    if (ret == -1) {
-        ZCM_DEBUG("ERR: write failed: %s", strerror(errno));
-        return -1;
+    while (true) {
+        int ret = ::write(fd, buf, sz);
+        if (ret >= 0) return ret;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) {
+            ZCM_DEBUG("ERR: write failed: %s", strerror(errno));
+            return -1;
+        }
+        if (!wait) return 0;
+
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        if (::poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            ZCM_DEBUG("ERR: serial poll failed: %s", strerror(errno));
+            return -1;
+        }
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) return -1;
     }
-    return ret;
 }
 
+// Takes what is already available, and only waits (up to 'timeoutUs') when
+// nothing is
 int Serial::read(u8 *buf, size_t sz, u64 timeoutUs)
 {
     assert(this->isOpen());
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(fd, &fds);
-
-    u64 tOut = max((u64)SERIAL_TIMEOUT_US, timeoutUs);
-
-    struct timeval timeout;
-    timeout.tv_sec = tOut / 1000000;
-    timeout.tv_usec = tOut % 1000000;
-    int status = ::select(fd + 1, &fds, NULL, NULL, &timeout);
-
-    if (status > 0) {
-        if (FD_ISSET(fd, &fds)) {
-            int ret = ::read(fd, buf, sz);
-            if (ret == -1) {
-                ZCM_DEBUG("ERR: serial read failed: %s", strerror(errno));
-            } else if (ret == 0) {
-                ZCM_DEBUG("ERR: serial device unplugged");
-                close();
-                assert(false && "ERR: serial device unplugged\n" &&
-                       "ZCM does not support reconnecting to serial devices");
-                return -3;
-            }
-            return ret;
-        } else {
-            ZCM_DEBUG("ERR: serial bytes not ready");
-            return -1;
-        }
-    } else {
+    int ret = ::read(fd, buf, sz);
+    if (ret > 0) return ret;
+    if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+        ZCM_DEBUG("ERR: serial read failed: %s", strerror(errno));
+        return -1;
+    }
+    if (timeoutUs == 0) return -2;
+
+    struct pollfd pfds[2] = { { fd, POLLIN, 0 }, { wakeFd, POLLIN, 0 } };
+    struct pollfd& pfd = pfds[0];
+    int timeoutMs = timeoutUs / 1000 >= (u64)INT_MAX ? -1 : (timeoutUs + 999) / 1000;
+    int status = ::poll(pfds, wakeFd >= 0 ? 2 : 1, timeoutMs);
+    if (status > 0 && (pfds[1].revents & POLLIN) && !(pfd.revents & POLLIN)) {
+        uint64_t n;
+        if (::read(wakeFd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+            ZCM_DEBUG("ERR: serial wakeup read failed: %s", strerror(errno));
+        woken = true;
+        return -2;
+    } else if (status == 0) {
         ZCM_DEBUG("ERR: serial read timed out");
         return -2;
+    } else if (status < 0) {
+        ZCM_DEBUG("ERR: serial poll failed: %s", strerror(errno));
+        return -1;
     }
+
+    ret = (pfd.revents & POLLIN) ? ::read(fd, buf, sz) : 0;
+    if (ret == -1) {
+        ZCM_DEBUG("ERR: serial read failed: %s", strerror(errno));
+    } else if (ret == 0) {
+        ZCM_DEBUG("ERR: serial device unplugged");
+        close();
+        assert(false && "ERR: serial device unplugged\n" &&
+               "ZCM does not support reconnecting to serial devices");
+        return -3;
+    }
+    return ret;
+}
+
+void Serial::wakeup()
+{
+    if (wakeFd < 0) return;
+    uint64_t one = 1;
+    if (::write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        ZCM_DEBUG("ERR: serial wakeup write failed: %s", strerror(errno));
 }
 
 int Serial::convertBaud(int baud)
@@ -241,6 +307,8 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     zcm_trans_t* gst;
 
     uint64_t timeoutLeft;
+    // Only the first read of each rx update waits for data
+    bool waitForData = false;
 
     string *findOption(const string& s)
     {
@@ -249,9 +317,9 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         return &it->second;
     }
 
-    ZCM_TRANS_CLASSNAME(zcm_url_t *url)
+    ZCM_TRANS_CLASSNAME(zcm_url_t *url, bool blocking)
     {
-        trans_type = ZCM_BLOCKING;
+        trans_type = blocking ? ZCM_BLOCKING : ZCM_NONBLOCKING;
         vtbl = &methods;
 
         // build 'options'
@@ -293,6 +361,31 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
                                               &ZCM_TRANS_CLASSNAME::timestamp_now,
                                               nullptr,
                                               MTU, MTU * 10);
+
+        auto *packStr = findOption("pack");
+        if (packStr) {
+            if (*packStr == "true") {
+                zcm_trans_generic_serial_enable_packing(gst, MTU);
+            } else if (*packStr != "false") {
+                ZCM_DEBUG("expected boolean argument for 'pack'");
+                ser.close();
+                return;
+            }
+        }
+
+        auto *framingStr = findOption("framing");
+        if (framingStr) {
+            if (*framingStr == "cobs") {
+                if (zcm_trans_generic_serial_enable_cobs(gst, true) != ZCM_EOK) {
+                    ser.close();
+                    return;
+                }
+            } else if (*framingStr != "escape") {
+                ZCM_DEBUG("expected 'escape' or 'cobs' for 'framing'");
+                ser.close();
+                return;
+            }
+        }
     }
 
     ~ZCM_TRANS_CLASSNAME()
@@ -309,8 +402,13 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static size_t get(uint8_t* data, size_t nData, void* usr)
     {
         ZCM_TRANS_CLASSNAME* me = cast((zcm_trans_t*) usr);
+        // The others take what's already there, e.g. the rest of the data after
+        // the circular buffer wraps around
+        u64 timeoutUs = me->waitForData ? max((u64)SERIAL_TIMEOUT_US, me->timeoutLeft) : 0;
+        me->waitForData = false;
+
         uint64_t startUtime = TimeUtil::utime();
-        int ret = me->ser.read(data, nData, me->timeoutLeft);
+        int ret = me->ser.read(data, nData, timeoutUs);
         uint64_t diff = TimeUtil::utime() - startUtime;
         me->timeoutLeft = me->timeoutLeft > diff ? me->timeoutLeft - diff : 0;
         return ret < 0 ? 0 : ret;
@@ -319,8 +417,18 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static size_t put(const uint8_t* data, size_t nData, void* usr)
     {
         ZCM_TRANS_CLASSNAME* me = cast((zcm_trans_t*) usr);
-        int ret = me->ser.write(data, nData);
-        return ret < 0 ? 0 : ret;
+        if (me->trans_type == ZCM_NONBLOCKING) {
+            int ret = me->ser.write(data, nData, false);
+            return ret < 0 ? 0 : ret;
+        }
+
+        size_t written = 0;
+        while (written < nData) {
+            int ret = me->ser.write(data + written, nData - written, true);
+            if (ret <= 0) break;
+            written += ret;
+        }
+        return written;
     }
 
     static uint64_t timestamp_now(void* usr)
@@ -340,6 +448,18 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         return serial_update_tx(this->gst);
     }
 
+    // With "pack=true", this is what lets the messages share packed frames
+    int sendmsgBatch(const zcm_msg_t* msgs, size_t nmsgs)
+    {
+        int ret = ZCM_EOK;
+        for (size_t i = 0; i < nmsgs; ++i) {
+            int r = zcm_trans_sendmsg(this->gst, msgs[i]);
+            if (r != ZCM_EOK && ret == ZCM_EOK) ret = r;
+        }
+        int r = serial_update_tx(this->gst);
+        return ret == ZCM_EOK ? r : ret;
+    }
+
     int recvmsgEnable(const char *channel, bool enable)
     { return zcm_trans_recvmsg_enable(this->gst, channel, enable); }
 
@@ -349,6 +469,14 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         //       generic serial transport recvmsg only use the recv related
         //       data members and touch no variables related to sending
 
+        if (trans_type == ZCM_NONBLOCKING) {
+            int ret = zcm_trans_recvmsg(this->gst, msg, 0);
+            if (ret == ZCM_EOK) return ret;
+            waitForData = false;
+            serial_update_rx(this->gst);
+            return zcm_trans_recvmsg(this->gst, msg, 0);
+        }
+
         timeoutLeft = timeoutMs > 0 ? timeoutMs * 1e3 : numeric_limits<uint64_t>::max();
         do {
             uint64_t startUtime = TimeUtil::utime();
@@ -363,7 +491,9 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             //       `get` knows how long it has to exit
             timeoutLeft = timeoutLeft > diff ? timeoutLeft - diff : 0;
 
+            waitForData = true;
             serial_update_rx(this->gst);
+            if (ser.takeWoken()) return zcm_trans_recvmsg(this->gst, msg, 0);
 
             diff = TimeUtil::utime() - startUtime;
             timeoutLeft = timeoutLeft > diff ? timeoutLeft - diff : 0;
@@ -373,6 +503,16 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         return ZCM_EAGAIN;
     }
 
+    // Nonblocking mode only: sends what the device couldn't take before
+    int update()
+    { return serial_update_tx(this->gst); }
+
+    int getFd()
+    { return ser.getFd(); }
+
+    void recvmsgWakeup()
+    { ser.wakeup(); }
+
     /********************** STATICS **********************/
     static zcm_trans_methods_t methods;
     static ZCM_TRANS_CLASSNAME *cast(zcm_trans_t *zt)
@@ -387,16 +527,29 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static int _sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
     { return cast(zt)->sendmsg(msg); }
 
+    static int _sendmsgBatch(zcm_trans_t *zt, const zcm_msg_t* msgs, size_t nmsgs)
+    { return cast(zt)->sendmsgBatch(msgs, nmsgs); }
+
     static int _recvmsgEnable(zcm_trans_t *zt, const char *channel, bool enable)
     { return cast(zt)->recvmsgEnable(channel, enable); }
 
     static int _recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
     { return cast(zt)->recvmsg(msg, timeout); }
 
+    static int _update(zcm_trans_t *zt)
+    { return cast(zt)->update(); }
+
     static void _destroy(zcm_trans_t *zt)
     { delete cast(zt); }
 
+    static int _getFd(zcm_trans_t *zt)
+    { return cast(zt)->getFd(); }
+
+    static void _recvmsgWakeup(zcm_trans_t *zt)
+    { return cast(zt)->recvmsgWakeup(); }
+
     static const TransportRegister reg;
+    static const TransportRegister regNonblocking;
 };
 
 zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
@@ -404,13 +557,22 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_sendmsg,
     &ZCM_TRANS_CLASSNAME::_recvmsgEnable,
     &ZCM_TRANS_CLASSNAME::_recvmsg,
-    NULL, // update
+    &ZCM_TRANS_CLASSNAME::_update,
     &ZCM_TRANS_CLASSNAME::_destroy,
+    NULL, // recvmsg_claim
+    NULL, // recvmsg_release
+    &ZCM_TRANS_CLASSNAME::_sendmsgBatch,
+    &ZCM_TRANS_CLASSNAME::_recvmsgWakeup,
+    NULL, // get_stats
+    &ZCM_TRANS_CLASSNAME::_getFd,
+    NULL, // set_interleave
+    NULL, // has_subscribers
+    NULL, // sendmsg_iov
 };
 
-static zcm_trans_t *create(zcm_url_t *url)
+static zcm_trans_t *create(zcm_url_t *url, bool blocking)
 {
-    auto *trans = new ZCM_TRANS_CLASSNAME(url);
+    auto *trans = new ZCM_TRANS_CLASSNAME(url, blocking);
     if (trans->good())
         return trans;
 
@@ -418,10 +580,22 @@ static zcm_trans_t *create(zcm_url_t *url)
     return nullptr;
 }
 
+static zcm_trans_t *create_blocking(zcm_url_t *url)
+{ return create(url, true); }
+
+static zcm_trans_t *create_nonblocking(zcm_url_t *url)
+{ return create(url, false); }
+
 #ifdef USING_TRANS_SERIAL
 // Register this transport with ZCM
 const TransportRegister ZCM_TRANS_CLASSNAME::reg(
     "serial", "Transfer data via a serial connection "
-              "(e.g. 'serial:///dev/ttyUSB0?baud=115200&hw_flow_control=true')",
-    create);
+              "(e.g. 'serial:///dev/ttyUSB0?baud=115200&hw_flow_control=true&pack=true')",
+    create_blocking);
+
+const TransportRegister ZCM_TRANS_CLASSNAME::regNonblocking(
+    "nonblock-serial", "Nonblocking version of the serial transport "
+                       "(e.g. 'nonblock-serial:///dev/ttyUSB0?baud=115200'). "
+                       "zcm_get_fd() gives its device for external event loops",
+    create_nonblocking);
 #endif
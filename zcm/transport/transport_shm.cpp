@@ -0,0 +1,738 @@
+#ifdef __linux__
+
+#include "zcm/transport.h"
+#include "zcm/transport_registrar.h"
+#include "zcm/transport_register.hpp"
+#include "zcm/util/debug.h"
+#include "zcm/util/lockfile.h"
+#include "zcm/util/huge_pages.hpp"
+
+#include "util/TimeUtil.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Define this the class name you want
+#define ZCM_TRANS_CLASSNAME TransportShm
+#define SHM_DIR "/dev/shm/"
+#define SHM_NAME_PREFIX "zcm-shm-"
+#define SHM_MAGIC 0x7a636d73 // "zcms"
+#define DEFAULT_RING_SIZE (64 << 20)
+#define MIN_RING_SIZE (1 << 16)
+#define MAX_RING_SIZE (1ull << 32)
+#define PAD_RECORD 0xffffffff
+
+// Every channel gets its own ring in a segment under SHM_DIR, created by the
+// one publisher of that channel (the one holding its lockfile) and mapped by
+// any number of subscribers, each reading at its own position. The publisher
+// never waits for subscribers: one that falls more than a ring behind loses
+// the messages that were overwritten.
+//
+// With the "hugepages" url option, the publisher puts the ring in a hugetlbfs
+// instead when one is mounted, filling whole huge pages, and otherwise asks for
+// transparent huge pages for it. Subscribers look for rings in both places.
+//
+// Records are appended at 'head' and never straddle the end of the ring. Before
+// writing, the publisher moves 'tail' past every record it's about to overwrite,
+// so a subscriber knows the copy it just made is intact if 'tail' still hasn't
+// passed it afterwards.
+struct ShmRing
+{
+    atomic<u32> magic;   // set once the rest of the header is valid
+    atomic<u32> closed;  // set when the publisher goes away
+    u64         size;    // bytes of records following this header
+    char        channel[ZCM_CHANNEL_MAXLEN + 1];
+
+    alignas(64) atomic<u64> head; // total bytes ever appended
+    alignas(64) atomic<u64> tail; // oldest record that is still intact
+};
+
+struct ShmRecord
+{
+    u32 len;      // of the data that follows, or PAD_RECORD: skip to the ring start
+    u32 reserved;
+};
+
+// One per subnet and rung on every publish, so that a subscriber can sleep on
+// a single futex whatever channels it's reading
+struct ShmDoorbell
+{
+    atomic<u32> seq;
+    atomic<u32> waiters;
+    atomic<u32> rings;   // bumped whenever a ring is created or closed
+};
+
+static inline u64 recordSize(u64 len)
+{ return (sizeof(ShmRecord) + len + 7) & ~(u64)7; }
+
+static void futexWait(atomic<u32> *word, u32 val, int timeoutMs)
+{
+    struct timespec ts, *tsp = nullptr;
+    if (timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+        tsp = &ts;
+    }
+    syscall(SYS_futex, (u32*)word, FUTEX_WAIT, val, tsp, nullptr, 0);
+}
+
+static void futexWakeAll(atomic<u32> *word)
+{ syscall(SYS_futex, (u32*)word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0); }
+
+// Maps the segment at 'path'. With O_CREAT in 'oflag' it's grown to '*size'
+// bytes if smaller, otherwise '*size' is set to the size of the segment
+static void *mapSegment(const string& path, int oflag, int prot, size_t *size)
+{
+    int fd = open(path.c_str(), oflag | O_CLOEXEC, 0666);
+    if (fd < 0) return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) { close(fd); return nullptr; }
+    if (oflag & O_CREAT) {
+        if ((size_t)st.st_size < *size && ftruncate(fd, *size) < 0) {
+            ZCM_DEBUG("failed to size '%s': %s", path.c_str(), strerror(errno));
+            close(fd);
+            return nullptr;
+        }
+    } else {
+        *size = st.st_size;
+        if (*size < sizeof(ShmRing)) { close(fd); return nullptr; }
+    }
+
+    void *p = mmap(nullptr, *size, prot, MAP_SHARED, fd, 0);
+    close(fd);
+    return p == MAP_FAILED ? nullptr : p;
+}
+
+struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
+{
+    struct Segment
+    {
+        ShmRing *ring = nullptr;
+        size_t   mapSize = 0;
+        string   path;
+
+        char *records() { return (char*)(ring + 1); }
+        void unmap()
+        {
+            if (ring) munmap(ring, mapSize);
+            ring = nullptr;
+        }
+    };
+
+    struct Subscriber
+    {
+        Segment seg;         // no ring until its publisher shows up
+        u64     pos = 0;     // of the next record to read
+        u32     refs = 0;    // explicit recvmsg_enable()s, 0 if only found by a scan
+        u64     msgs = 0;
+        u64     overruns = 0;
+    };
+
+    // Memory of a message handed out by recvmsg_claim()
+    struct Claimed
+    {
+        string   channel;
+        uint8_t *buf;
+    };
+
+    string subnet;
+    u64    ringSize = DEFAULT_RING_SIZE;
+    bool   hugePages = false;
+    // Where rings may be: SHM_DIR, then the hugetlbfs if there is one
+    vector<string> dirs {SHM_DIR};
+
+    ShmDoorbell *doorbell = nullptr;
+    u32          seenRings = 0;
+    bool         needRescan = true;
+    atomic<bool> wakeupPending {false};
+
+    unordered_map<string, Segment> pubs;
+
+    // Mutex used to protect 'subs' while allowing recvmsgEnable() and
+    // recvmsg() to be called concurrently
+    mutex mut;
+    unordered_map<string, Subscriber> subs;
+    bool   recvAllChannels = false;
+    size_t nextSub = 0;
+
+    string          recvmsgChannel;
+    vector<uint8_t> recvmsgBuffer;
+
+    ZCM_TRANS_CLASSNAME(zcm_url_t *url)
+    {
+        trans_type = ZCM_BLOCKING;
+        vtbl = &methods;
+
+        // The subnet is part of file names and '.' separates it from the channel
+        subnet = zcm_url_address(url);
+        if (subnet == "") subnet = "default";
+        for (char c : subnet) {
+            if (!isalnum((unsigned char)c) && c != '_' && c != '-') {
+                ZCM_DEBUG("shm subnet may only contain letters, digits, '_' and '-'");
+                return;
+            }
+        }
+
+        auto *opts = zcm_url_opts(url);
+        for (size_t i = 0; i < opts->numopts; ++i) {
+            if (string(opts->name[i]) == "size") {
+                ringSize = strtoull(opts->value[i], nullptr, 10) & ~(u64)7;
+                if (ringSize < MIN_RING_SIZE || ringSize > MAX_RING_SIZE) {
+                    ZCM_DEBUG("shm size must be between %d and %llu bytes",
+                              MIN_RING_SIZE, (unsigned long long)MAX_RING_SIZE);
+                    return;
+                }
+            } else if (string(opts->name[i]) == "hugepages") {
+                string val = opts->value[i];
+                if (val == "true") {
+                    hugePages = true;
+                } else if (val != "false") {
+                    ZCM_DEBUG("Invalid hugepages option: %s", opts->value[i]);
+                    return;
+                }
+            }
+        }
+
+        string hugeDir = HugePages::hugetlbfsDir();
+        if (hugeDir != "") dirs.push_back(hugeDir);
+
+        size_t size = sizeof(ShmDoorbell);
+        doorbell = (ShmDoorbell*) mapSegment(SHM_DIR SHM_NAME_PREFIX + subnet,
+                                             O_RDWR | O_CREAT, PROT_READ | PROT_WRITE, &size);
+        if (!doorbell) {
+            ZCM_DEBUG("failed to open the shm doorbell: %s", strerror(errno));
+            return;
+        }
+        ZCM_DEBUG("SHM Subnet: %s\n", subnet.c_str());
+    }
+
+    ~ZCM_TRANS_CLASSNAME()
+    {
+        for (auto& elt : pubs) {
+            elt.second.ring->closed.store(1, memory_order_release);
+            unlink(elt.second.path.c_str());
+            elt.second.unmap();
+            lockfile_unlock(getLockName(elt.first).c_str());
+        }
+        if (!pubs.empty()) {
+            doorbell->rings++;
+            ringDoorbell();
+        }
+
+        for (auto& elt : subs)
+            elt.second.seg.unmap();
+
+        if (doorbell) munmap(doorbell, sizeof(ShmDoorbell));
+    }
+
+    bool good() { return doorbell != nullptr; }
+
+    string getPath(const string& dir, const string& channel)
+    {
+        // shm names can't hold a '/'
+        string name = channel;
+        for (auto& c : name)
+            if (c == '/') c = '_';
+        return dir + SHM_NAME_PREFIX + subnet + "." + name;
+    }
+
+    string getLockName(const string& channel)
+    { return "shm://" + subnet + "/" + channel; }
+
+    void ringDoorbell()
+    {
+        doorbell->seq++;
+        if (doorbell->waiters > 0)
+            futexWakeAll(&doorbell->seq);
+    }
+
+    // May return null if it cannot create the ring
+    Segment *pubFindOrCreate(const string& channel)
+    {
+        auto it = pubs.find(channel);
+        if (it != pubs.end())
+            return &it->second;
+        // Before we create a ring, we need to acquire the lock file for this
+        if (!lockfile_trylock(getLockName(channel).c_str())) {
+            fprintf(stderr, "Failed to acquire publish lock on %s! "
+                            "Are you attempting multiple publishers?\n",
+                            channel.c_str());
+            return nullptr;
+        }
+
+        // A publisher that died left its ring behind. Close it so that its
+        // subscribers move over to ours
+        for (auto& dir : dirs) {
+            string path = getPath(dir, channel);
+            Segment old;
+            old.ring = (ShmRing*) mapSegment(path, O_RDWR, PROT_READ | PROT_WRITE, &old.mapSize);
+            if (old.ring) {
+                old.ring->closed.store(1, memory_order_release);
+                old.unmap();
+            }
+            unlink(path.c_str());
+        }
+
+        // hugetlbfs files only come in whole huge pages, which the ring fills.
+        // Mapping fails there if too few of them are left
+        Segment seg;
+        if (hugePages && dirs.size() > 1) {
+            seg.path = getPath(dirs[1], channel);
+            seg.mapSize = HugePages::roundUp(sizeof(ShmRing) + ringSize);
+            seg.ring = (ShmRing*) mapSegment(seg.path, O_RDWR | O_CREAT | O_EXCL,
+                                             PROT_READ | PROT_WRITE, &seg.mapSize);
+            if (!seg.ring) {
+                ZCM_DEBUG("no huge pages for shm ring '%s': %s",
+                          seg.path.c_str(), strerror(errno));
+                unlink(seg.path.c_str());
+            }
+        }
+        if (!seg.ring) {
+            seg.path = getPath(dirs[0], channel);
+            seg.mapSize = sizeof(ShmRing) + ringSize;
+            seg.ring = (ShmRing*) mapSegment(seg.path, O_RDWR | O_CREAT | O_EXCL,
+                                             PROT_READ | PROT_WRITE, &seg.mapSize);
+            if (seg.ring && hugePages) HugePages::advise(seg.ring, seg.mapSize);
+        }
+        if (!seg.ring) {
+            ZCM_DEBUG("failed to create shm ring '%s': %s", seg.path.c_str(), strerror(errno));
+            lockfile_unlock(getLockName(channel).c_str());
+            return nullptr;
+        }
+        // The segment starts out zeroed
+        seg.ring->size = seg.mapSize - sizeof(ShmRing);
+        strncpy(seg.ring->channel, channel.c_str(), ZCM_CHANNEL_MAXLEN);
+        seg.ring->magic.store(SHM_MAGIC, memory_order_release);
+
+        doorbell->rings++;
+        ringDoorbell();
+        return &pubs.emplace(channel, seg).first->second;
+    }
+
+    // Maps the ring at 'path' if it's a valid ring of 'channel' and still open.
+    // An empty 'channel' accepts any channel
+    Segment openRing(const string& path, const string& channel)
+    {
+        Segment seg;
+        seg.path = path;
+        seg.ring = (ShmRing*) mapSegment(path, O_RDONLY, PROT_READ, &seg.mapSize);
+        if (!seg.ring) return seg;
+        if (hugePages) HugePages::advise(seg.ring, seg.mapSize);
+
+        ShmRing *r = seg.ring;
+        if (r->magic.load(memory_order_acquire) != SHM_MAGIC ||
+            r->closed.load(memory_order_acquire) ||
+            seg.mapSize != sizeof(ShmRing) + r->size ||
+            strnlen(r->channel, sizeof(r->channel)) > ZCM_CHANNEL_MAXLEN ||
+            (channel != "" && channel != r->channel)) {
+            seg.unmap();
+        }
+        return seg;
+    }
+
+    // Like any subscriber, start with whatever is published next. Rings that
+    // only showed up after we subscribed are read from the start though: all
+    // of their messages were published after that
+    void subscriberOpen(const string& channel, Subscriber& s, bool fromHead)
+    {
+        for (auto& dir : dirs) {
+            s.seg = openRing(getPath(dir, channel), channel);
+            if (s.seg.ring) break;
+        }
+        if (s.seg.ring) s.pos = (fromHead ? s.seg.ring->head : s.seg.ring->tail).load();
+    }
+
+    void scanForNewChannels(bool fromHead)
+    {
+        string prefix = SHM_NAME_PREFIX + subnet + ".";
+
+        for (auto& dir : dirs) {
+            DIR *d;
+            dirent *ent;
+
+            if (!(d=opendir(dir.c_str())))
+                continue;
+
+            while ((ent=readdir(d)) != nullptr) {
+                if (strncmp(ent->d_name, prefix.c_str(), prefix.size()) != 0)
+                    continue;
+                Segment seg = openRing(dir + ent->d_name, "");
+                if (!seg.ring) continue;
+                auto& s = subs[seg.ring->channel];
+                if (s.seg.ring) {
+                    seg.unmap();
+                    continue;
+                }
+                s.seg = seg;
+                s.pos = (fromHead ? seg.ring->head : seg.ring->tail).load();
+            }
+
+            closedir(d);
+        }
+    }
+
+    // Retries opening the rings of channels whose publisher wasn't around
+    void rescan()
+    {
+        u32 rings = doorbell->rings.load();
+        if (!needRescan && rings == seenRings) return;
+        needRescan = false;
+        seenRings = rings;
+
+        for (auto& elt : subs)
+            if (!elt.second.seg.ring)
+                subscriberOpen(elt.first, elt.second, false);
+        if (recvAllChannels)
+            scanForNewChannels(false);
+    }
+
+    // Copies the next message of 's' out of its ring. Returns false if there is none
+    bool readRecord(Subscriber& s, uint8_t **buf, size_t *len, bool claim)
+    {
+        ShmRing *r = s.seg.ring;
+        char *records = s.seg.records();
+        while (true) {
+            if (s.pos == r->head.load(memory_order_acquire)) return false;
+
+            u64 off = s.pos % r->size;
+            if (r->size - off < sizeof(ShmRecord)) {
+                s.pos += r->size - off;
+                continue;
+            }
+
+            ShmRecord rec;
+            memcpy(&rec, records + off, sizeof(rec));
+            atomic_thread_fence(memory_order_acquire);
+            if (s.pos < r->tail.load(memory_order_relaxed)) {
+                s.pos = r->tail.load(memory_order_acquire);
+                s.overruns++;
+                continue;
+            }
+            if (rec.len == PAD_RECORD) {
+                s.pos += r->size - off;
+                continue;
+            }
+            if (rec.len > r->size - off - sizeof(rec)) {
+                ZCM_DEBUG("corrupt shm record of %u bytes, skipping ahead", rec.len);
+                s.pos = r->head.load(memory_order_acquire);
+                return false;
+            }
+
+            uint8_t *dst;
+            if (claim) {
+                dst = (uint8_t*) zcm_alloc(rec.len, ZCM_ALLOC_TRANSPORT);
+            } else {
+                if (recvmsgBuffer.size() < rec.len) recvmsgBuffer.resize(rec.len);
+                dst = recvmsgBuffer.data();
+            }
+            memcpy(dst, records + off + sizeof(rec), rec.len);
+
+            // The publisher may have lapped us while we were copying
+            atomic_thread_fence(memory_order_acquire);
+            if (s.pos < r->tail.load(memory_order_relaxed)) {
+                if (claim) zcm_dealloc(dst, ZCM_ALLOC_TRANSPORT);
+                s.pos = r->tail.load(memory_order_acquire);
+                s.overruns++;
+                continue;
+            }
+
+            s.pos += recordSize(rec.len);
+            s.msgs++;
+            *buf = dst;
+            *len = rec.len;
+            return true;
+        }
+    }
+
+    // Reads the next message of any subscribed ring, taking turns between them
+    bool readAny(zcm_msg_t *msg, bool claim, void **token)
+    {
+        rescan();
+
+        size_t n = subs.size();
+        if (n == 0) return false;
+        auto it = subs.begin();
+        size_t start = nextSub++ % n;
+        for (size_t i = 0; i < start; i++) ++it;
+
+        for (size_t i = 0; i < n; i++, ++it) {
+            if (it == subs.end()) it = subs.begin();
+            Subscriber& s = it->second;
+            if (!s.seg.ring) continue;
+
+            // Only leave a closed ring once everything published to it was read
+            bool closed = s.seg.ring->closed.load(memory_order_acquire);
+
+            uint8_t *buf;
+            size_t len;
+            if (readRecord(s, &buf, &len, claim)) {
+                msg->utime = TimeUtil::utime();
+                msg->len = len;
+                msg->buf = buf;
+                if (claim) {
+                    auto *owned = new Claimed { it->first, buf };
+                    msg->channel = owned->channel.c_str();
+                    *token = owned;
+                } else {
+                    recvmsgChannel = it->first;
+                    msg->channel = recvmsgChannel.c_str();
+                }
+                return true;
+            }
+
+            if (closed) {
+                s.seg.unmap();
+                needRescan = true;
+            }
+        }
+        return false;
+    }
+
+    /********************** METHODS **********************/
+    size_t getMtu()
+    {
+        return ringSize / 2 - sizeof(ShmRecord);
+    }
+
+    int sendmsg(zcm_msg_t msg)
+    {
+        if (strlen(msg.channel) > ZCM_CHANNEL_MAXLEN)
+            return ZCM_EINVALID;
+        if (msg.len > getMtu())
+            return ZCM_EINVALID;
+
+        Segment *seg = pubFindOrCreate(msg.channel);
+        if (seg == nullptr)
+            return ZCM_ECONNECT;
+        ShmRing *r = seg->ring;
+        char *records = seg->records();
+
+        // Records never straddle the end of the ring
+        u64 head = r->head.load(memory_order_relaxed);
+        u64 off = head % r->size;
+        u64 need = recordSize(msg.len);
+        u64 pad = off + need > r->size ? r->size - off : 0;
+        u64 end = head + pad + need;
+
+        // Move 'tail' past the records we're about to overwrite before touching them
+        u64 tail = r->tail.load(memory_order_relaxed);
+        while (end - tail > r->size) {
+            u64 toff = tail % r->size;
+            ShmRecord *rec = (ShmRecord*)(records + toff);
+            if (r->size - toff < sizeof(ShmRecord) || rec->len == PAD_RECORD)
+                tail += r->size - toff;
+            else
+                tail += recordSize(rec->len);
+        }
+        r->tail.store(tail, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        if (pad >= sizeof(ShmRecord))
+            ((ShmRecord*)(records + off))->len = PAD_RECORD;
+
+        ShmRecord *rec = (ShmRecord*)(records + (head + pad) % r->size);
+        rec->len = msg.len;
+        rec->reserved = 0;
+        memcpy(rec + 1, msg.buf, msg.len);
+
+        r->head.store(end, memory_order_release);
+        ringDoorbell();
+        return ZCM_EOK;
+    }
+
+    int recvmsgEnable(const char *channel, bool enable)
+    {
+        // Mutex used to protect 'subs' while allowing
+        // recvmsgEnable() and recvmsg() to be called
+        // concurrently
+        unique_lock<mutex> lk(mut);
+
+        if (channel == NULL) {
+            recvAllChannels = enable;
+            if (enable) {
+                scanForNewChannels(true);
+            } else {
+                for (auto it = subs.begin(); it != subs.end(); ) {
+                    if (it->second.refs == 0) { // This channel is only subscribed to implicitly
+                        it->second.seg.unmap();
+                        it = subs.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            return ZCM_EOK;
+        }
+
+        if (strlen(channel) > ZCM_CHANNEL_MAXLEN)
+            return ZCM_EINVALID;
+
+        if (enable) {
+            auto& s = subs[channel];
+            if (s.refs++ == 0 && !s.seg.ring)
+                subscriberOpen(channel, s, true);
+        } else {
+            auto it = subs.find(channel);
+            if (it == subs.end() || it->second.refs == 0)
+                return ZCM_EINVALID;
+            if (--it->second.refs == 0 && !recvAllChannels) {
+                it->second.seg.unmap();
+                subs.erase(it);
+            }
+        }
+        return ZCM_EOK;
+    }
+
+    int recvmsgInternal(zcm_msg_t *msg, int timeout, bool claim, void **token)
+    {
+        u64 deadline = TimeUtil::utime() + (u64)(timeout > 0 ? timeout : 0) * 1000;
+        while (true) {
+            // Anything published after this will change 'seq' and cut our wait short
+            u32 seq = doorbell->seq.load();
+            {
+                unique_lock<mutex> lk(mut);
+                if (readAny(msg, claim, token)) return ZCM_EOK;
+            }
+            if (wakeupPending.exchange(false)) return ZCM_EAGAIN;
+
+            int waitMs = -1;
+            if (timeout >= 0) {
+                u64 now = TimeUtil::utime();
+                if (now >= deadline) return ZCM_EAGAIN;
+                waitMs = (deadline - now + 999) / 1000;
+            }
+            doorbell->waiters++;
+            futexWait(&doorbell->seq, seq, waitMs);
+            doorbell->waiters--;
+        }
+    }
+
+    int recvmsg(zcm_msg_t *msg, int timeout)
+    { return recvmsgInternal(msg, timeout, false, nullptr); }
+
+    int recvmsgClaim(zcm_msg_t *msg, int timeout, void **token)
+    { return recvmsgInternal(msg, timeout, true, token); }
+
+    void recvmsgRelease(void *token)
+    {
+        Claimed *owned = (Claimed*) token;
+        zcm_dealloc(owned->buf, ZCM_ALLOC_TRANSPORT);
+        delete owned;
+    }
+
+    void recvmsgWakeup()
+    {
+        // Wakes every subscriber of the subnet, the others just go back to sleep
+        wakeupPending = true;
+        doorbell->seq++;
+        futexWakeAll(&doorbell->seq);
+    }
+
+    int getStats(zcm_stat_handler_t cb, void *usr)
+    {
+        unique_lock<mutex> lk(mut);
+        for (auto& elt : subs) {
+            string name = "shm.channel." + elt.first;
+            cb((name + ".msgs").c_str(), elt.second.msgs, usr);
+            cb((name + ".overruns").c_str(), elt.second.overruns, usr);
+        }
+        return ZCM_EOK;
+    }
+
+    /********************** STATICS **********************/
+    static zcm_trans_methods_t methods;
+    static ZCM_TRANS_CLASSNAME *cast(zcm_trans_t *zt)
+    {
+        assert(zt->vtbl == &methods);
+        return (ZCM_TRANS_CLASSNAME*)zt;
+    }
+
+    static size_t _getMtu(zcm_trans_t *zt)
+    { return cast(zt)->getMtu(); }
+
+    static int _sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
+    { return cast(zt)->sendmsg(msg); }
+
+    static int _recvmsgEnable(zcm_trans_t *zt, const char *channel, bool enable)
+    { return cast(zt)->recvmsgEnable(channel, enable); }
+
+    static int _recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
+    { return cast(zt)->recvmsg(msg, timeout); }
+
+    static void _destroy(zcm_trans_t *zt)
+    { delete cast(zt); }
+
+    static int _recvmsgClaim(zcm_trans_t *zt, zcm_msg_t *msg, int timeout, void **token)
+    { return cast(zt)->recvmsgClaim(msg, timeout, token); }
+
+    static void _recvmsgRelease(zcm_trans_t *zt, void *token)
+    { return cast(zt)->recvmsgRelease(token); }
+
+    static void _recvmsgWakeup(zcm_trans_t *zt)
+    { return cast(zt)->recvmsgWakeup(); }
+
+    static int _getStats(zcm_trans_t *zt, zcm_stat_handler_t cb, void *usr)
+    { return cast(zt)->getStats(cb, usr); }
+
+    static const TransportRegister reg;
+};
+
+zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
+    &ZCM_TRANS_CLASSNAME::_getMtu,
+    &ZCM_TRANS_CLASSNAME::_sendmsg,
+    &ZCM_TRANS_CLASSNAME::_recvmsgEnable,
+    &ZCM_TRANS_CLASSNAME::_recvmsg,
+    NULL, // update
+    &ZCM_TRANS_CLASSNAME::_destroy,
+    &ZCM_TRANS_CLASSNAME::_recvmsgClaim,
+    &ZCM_TRANS_CLASSNAME::_recvmsgRelease,
+    NULL, // sendmsg_batch
+    &ZCM_TRANS_CLASSNAME::_recvmsgWakeup,
+    &ZCM_TRANS_CLASSNAME::_getStats,
+    NULL, // get_fd
+    NULL, // set_interleave
+    NULL, // has_subscribers
+    NULL, // sendmsg_iov
+};
+
+static zcm_trans_t *create(zcm_url_t *url)
+{
+    auto *trans = new ZCM_TRANS_CLASSNAME(url);
+    if (trans->good())
+        return trans;
+
+    delete trans;
+    return nullptr;
+}
+
+#ifdef USING_TRANS_SHM
+// Register this transport with ZCM
+const TransportRegister ZCM_TRANS_CLASSNAME::reg(
+    "shm", "Transfer data via shared memory rings on this host "
+           "(e.g. 'shm', 'shm://mysubnet?size=67108864')",
+    create);
+#endif
+
+#endif
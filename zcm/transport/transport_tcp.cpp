@@ -0,0 +1,794 @@
+#ifndef WIN32
+
+#include "zcm/transport.h"
+#include "zcm/transport_registrar.h"
+#include "zcm/transport_register.hpp"
+#include "zcm/util/debug.h"
+
+#include "util/TimeUtil.hpp"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+// Define this the class name you want
+#define ZCM_TRANS_CLASSNAME TransportTcp
+#define MTU (1 << 28)
+#define DEFAULT_SNDQUEUE (4 << 20)
+#define MAX_RECV_QUEUE 1024
+#define RECONNECT_US 1000000
+#define READ_CHUNK (64 << 10)
+// Biggest write the 'cork' option waits to gather
+#define CORK_FLUSH_SIZE (64 << 10)
+
+// Every frame is a big endian u32 length of the rest of it, then a FrameType:
+//     FRAME_MSG    u8 channel length, the channel, then the data
+//     FRAME_SUB    the channel (empty for all of them) that the sender wants
+//     FRAME_UNSUB  ... no longer wants
+// Both ends tell each other what they subscribe to, so that messages only
+// cross the link on the channels someone on the other end receives.
+// Messages are only delivered to the peers that are connected: nothing is
+// relayed from one peer to another.
+enum FrameType : uint8_t { FRAME_MSG = 0, FRAME_SUB = 1, FRAME_UNSUB = 2 };
+#define FRAME_HDR 5
+#define MSG_HDR (FRAME_HDR + 1)
+#define MAX_FRAME (1 + 1 + ZCM_CHANNEL_MAXLEN + MTU)
+
+static void putFrameHdr(uint8_t *hdr, uint32_t bodylen, FrameType type)
+{
+    uint32_t len = bodylen + 1;
+    hdr[0] = (uint8_t)(len >> 24);
+    hdr[1] = (uint8_t)(len >> 16);
+    hdr[2] = (uint8_t)(len >> 8);
+    hdr[3] = (uint8_t)len;
+    hdr[4] = type;
+}
+
+static bool setNonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static string addrName(const struct sockaddr *sa)
+{
+    char host[NI_MAXHOST], serv[NI_MAXSERV];
+    socklen_t len = sa->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6)
+                                              : sizeof(struct sockaddr_in);
+    if (getnameinfo(sa, len, host, sizeof(host), serv, sizeof(serv),
+                    NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+        return "unknown";
+    return string(host) + ":" + serv;
+}
+
+struct TcpPeer
+{
+    int    fd = -1;
+    string name;                  // address of the other end, for the stats
+    atomic<bool> dead {false};    // a write failed, the I/O thread closes it
+
+    // Output the kernel didn't take yet, from 'outOff' on. 'outSince' is
+    // when the oldest of it was queued, for the 'cork' option
+    string out;
+    size_t outOff = 0;
+    uint64_t outSince = 0;
+
+    // Input read so far, from 'inOff' on. Only touched by the I/O thread
+    string in;
+    size_t inOff = 0;
+
+    // What the other end subscribes to
+    unordered_set<string> interest;
+    bool interestAll = false;
+
+    atomic<uint64_t> msgsSent {0};
+    atomic<uint64_t> msgsRecv {0};
+    atomic<uint64_t> drops {0};
+
+    size_t queued() const { return out.size() - outOff; }
+    bool wants(const char *channel) const
+    { return interestAll || interest.find(channel) != interest.end(); }
+};
+
+struct TcpRecvMsg
+{
+    uint64_t utime;
+    string   channel;
+    string   data;
+};
+
+struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
+{
+    string host, port;
+    bool   listening = false;
+    bool   nodelay = true;
+    uint64_t corkUs = 0;
+    size_t sndqueue = DEFAULT_SNDQUEUE;
+    bool   ok = false;
+
+    int listenFd = -1;
+    int connectFd = -1;           // a connect() in progress
+    uint64_t nextConnectUtime = 0;
+    int wakeRd = -1, wakeWr = -1;
+
+    // Guards the peers and their output, which every send writes to, and our
+    // subscriptions. Only the I/O thread adds or removes peers
+    mutex mut;
+    vector<unique_ptr<TcpPeer>> peers;
+    unordered_map<string, size_t> subs;
+    size_t subsAll = 0;
+    atomic<uint64_t> disconnects {0};
+
+    // Messages read by the I/O thread, for recvmsg()
+    mutex recvLock;
+    condition_variable recvCond;
+    deque<TcpRecvMsg> recvQueue;
+    bool recvWoken = false;
+    TcpRecvMsg current;
+
+    atomic<bool> running {true};
+    thread ioThread;
+
+    ZCM_TRANS_CLASSNAME(zcm_url_t *url)
+    {
+        trans_type = ZCM_BLOCKING;
+        vtbl = &methods;
+
+        string addr = zcm_url_address(url);
+        size_t colon = addr.rfind(':');
+        if (colon == string::npos || colon + 1 == addr.size()) {
+            ZCM_DEBUG("ERROR: Url format is tcp://<host>:<port> or tcp://*:<port>");
+            return;
+        }
+        host = addr.substr(0, colon);
+        port = addr.substr(colon + 1);
+        if (host.size() > 1 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+        listening = host.empty() || host == "*";
+
+        auto *opts = zcm_url_opts(url);
+        for (size_t i = 0; i < opts->numopts; ++i) {
+            string name = opts->name[i], value = opts->value[i];
+            if (name == "listen") {
+                listening = listening || value == "true";
+            } else if (name == "nodelay") {
+                nodelay = value != "false";
+            } else if (name == "cork") {
+                corkUs = strtoull(value.c_str(), nullptr, 10);
+            } else if (name == "sndqueue") {
+                sndqueue = strtoull(value.c_str(), nullptr, 10);
+            } else {
+                ZCM_DEBUG("IGNORING unknown tcp url option: %s", name.c_str());
+            }
+        }
+
+        int fds[2];
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            return;
+        }
+        wakeRd = fds[0];
+        wakeWr = fds[1];
+        setNonblocking(wakeRd);
+        setNonblocking(wakeWr);
+
+        if (listening && !startListening()) return;
+
+        ok = true;
+        ioThread = thread(&ZCM_TRANS_CLASSNAME::ioLoop, this);
+    }
+
+    ~ZCM_TRANS_CLASSNAME()
+    {
+        running = false;
+        wakeIo();
+        if (ioThread.joinable()) ioThread.join();
+
+        for (auto& p : peers) close(p->fd);
+        if (listenFd != -1) close(listenFd);
+        if (connectFd != -1) close(connectFd);
+        if (wakeRd != -1) close(wakeRd);
+        if (wakeWr != -1) close(wakeWr);
+    }
+
+    bool good() { return ok; }
+
+    void wakeIo()
+    {
+        char c = 0;
+        if (wakeWr != -1 && write(wakeWr, &c, 1) < 0) {} // a full pipe wakes it all the same
+    }
+
+    /********************** CONNECTIONS **********************/
+    struct addrinfo *resolve(bool passive)
+    {
+        struct addrinfo hints, *res = nullptr;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+        const char *h = (passive && (host.empty() || host == "*")) ? nullptr : host.c_str();
+        int rc = getaddrinfo(h, port.c_str(), &hints, &res);
+        if (rc != 0) {
+            ZCM_DEBUG("ERROR: unable to resolve %s:%s: %s", host.c_str(), port.c_str(),
+                      gai_strerror(rc));
+            return nullptr;
+        }
+        return res;
+    }
+
+    bool startListening()
+    {
+        struct addrinfo *res = resolve(true);
+        if (!res) return false;
+        for (struct addrinfo *ai = res; ai && listenFd == -1; ai = ai->ai_next) {
+            int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) continue;
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0 &&
+                setNonblocking(fd)) {
+                listenFd = fd;
+            } else {
+                close(fd);
+            }
+        }
+        freeaddrinfo(res);
+        if (listenFd == -1) {
+            perror("ERROR: unable to listen");
+            return false;
+        }
+        return true;
+    }
+
+    void startConnect()
+    {
+        nextConnectUtime = TimeUtil::utime() + RECONNECT_US;
+        struct addrinfo *res = resolve(false);
+        if (!res) return;
+        for (struct addrinfo *ai = res; ai && connectFd == -1; ai = ai->ai_next) {
+            int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) continue;
+            if (!setNonblocking(fd) ||
+                (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS)) {
+                close(fd);
+                continue;
+            }
+            connectFd = fd;
+        }
+        freeaddrinfo(res);
+    }
+
+    void connectDone()
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(connectFd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            ZCM_DEBUG("connecting to %s:%s failed: %s", host.c_str(), port.c_str(),
+                      strerror(err));
+            close(connectFd);
+        } else {
+            addPeer(connectFd);
+        }
+        connectFd = -1;
+    }
+
+    void addPeer(int fd)
+    {
+        int one = 1;
+        setNonblocking(fd);
+        if (nodelay) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+        unique_ptr<TcpPeer> p(new TcpPeer());
+        p->fd = fd;
+        struct sockaddr_storage ss;
+        socklen_t len = sizeof(ss);
+        p->name = getpeername(fd, (struct sockaddr*)&ss, &len) == 0
+                ? addrName((struct sockaddr*)&ss) : "unknown";
+        ZCM_DEBUG("tcp peer %s connected", p->name.c_str());
+
+        // Tell it everything we already subscribe to
+        unique_lock<mutex> lk(mut);
+        if (subsAll) queueSub(*p, nullptr, true);
+        for (auto& elt : subs) queueSub(*p, elt.first.c_str(), true);
+        flushPeer(*p);
+        peers.push_back(std::move(p));
+    }
+
+    void closePeer(size_t i)
+    {
+        unique_lock<mutex> lk(mut);
+        ZCM_DEBUG("tcp peer %s disconnected", peers[i]->name.c_str());
+        close(peers[i]->fd);
+        peers.erase(peers.begin() + i);
+        disconnects++;
+        if (!listening) nextConnectUtime = TimeUtil::utime() + RECONNECT_US;
+    }
+
+    /********************** OUTPUT **********************/
+    // These all require that 'mut' is locked
+    void queueSub(TcpPeer& p, const char *channel, bool enable)
+    {
+        size_t len = channel ? strlen(channel) : 0;
+        uint8_t hdr[FRAME_HDR];
+        putFrameHdr(hdr, len, enable ? FRAME_SUB : FRAME_UNSUB);
+        if (!p.queued()) p.outSince = TimeUtil::utime();
+        p.out.append((const char*)hdr, sizeof(hdr));
+        if (channel) p.out.append(channel, len);
+    }
+
+    void setCork(TcpPeer& p, bool cork)
+    {
+#if defined(TCP_CORK)
+        int opt = cork;
+        setsockopt(p.fd, IPPROTO_TCP, TCP_CORK, &opt, sizeof(opt));
+#elif defined(TCP_NOPUSH)
+        int opt = cork;
+        setsockopt(p.fd, IPPROTO_TCP, TCP_NOPUSH, &opt, sizeof(opt));
+#endif
+    }
+
+    // Writes as much of 'iov' as the kernel takes, returning how much that was,
+    // or -1 if the peer is gone
+    ssize_t writeIov(TcpPeer& p, struct iovec *iov, size_t n)
+    {
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = n;
+#ifdef MSG_NOSIGNAL
+        ssize_t ret = ::sendmsg(p.fd, &mh, MSG_NOSIGNAL);
+#else
+        ssize_t ret = ::sendmsg(p.fd, &mh, 0);
+#endif
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+            p.dead = true;
+            wakeIo();
+            return -1;
+        }
+        return ret;
+    }
+
+    void flushPeer(TcpPeer& p)
+    {
+        if (!p.queued() || p.dead) return;
+        if (corkUs) setCork(p, true);
+        while (p.queued()) {
+            struct iovec iov;
+            iov.iov_base = (char*)p.out.data() + p.outOff;
+            iov.iov_len = p.queued();
+            ssize_t n = writeIov(p, &iov, 1);
+            if (n <= 0) break;
+            p.outOff += n;
+        }
+        if (!p.queued()) {
+            p.out.clear();
+            p.outOff = 0;
+            if (corkUs) setCork(p, false);
+        }
+    }
+
+    // Sends 'n' messages to 'p', all of which it wants: in one writev() when
+    // nothing is queued yet, whatever the kernel doesn't take is queued
+    void sendToPeer(TcpPeer& p, const zcm_msg_t **msgs, size_t n)
+    {
+        // Up to 3 iovecs per message and IOV_MAX at a time
+        const size_t maxMsgs = 64;
+        uint8_t hdrs[maxMsgs][MSG_HDR];
+        struct iovec iov[maxMsgs * 3];
+
+        for (size_t first = 0; first < n; first += maxMsgs) {
+            size_t cnt = std::min(maxMsgs, n - first), niov = 0, total = 0;
+            for (size_t i = 0; i < cnt; ++i) {
+                const zcm_msg_t& msg = *msgs[first + i];
+                size_t chanlen = strlen(msg.channel);
+                putFrameHdr(hdrs[i], 1 + chanlen + msg.len, FRAME_MSG);
+                hdrs[i][FRAME_HDR] = (uint8_t)chanlen;
+                iov[niov].iov_base = hdrs[i];
+                iov[niov++].iov_len = MSG_HDR;
+                iov[niov].iov_base = (char*)msg.channel;
+                iov[niov++].iov_len = chanlen;
+                if (msg.len) {
+                    iov[niov].iov_base = msg.buf;
+                    iov[niov++].iov_len = msg.len;
+                }
+                total += MSG_HDR + chanlen + msg.len;
+            }
+
+            size_t sent = 0;
+            if (!corkUs && !p.queued()) {
+                ssize_t w = writeIov(p, iov, niov);
+                if (w < 0) return;
+                sent = w;
+            }
+            if (sent < total) {
+                if (!p.queued()) p.outSince = TimeUtil::utime();
+                // Queue what's left, skipping the 'sent' bytes
+                for (size_t i = 0; i < niov; ++i) {
+                    if (sent >= iov[i].iov_len) {
+                        sent -= iov[i].iov_len;
+                        continue;
+                    }
+                    p.out.append((const char*)iov[i].iov_base + sent, iov[i].iov_len - sent);
+                    sent = 0;
+                }
+            }
+            p.msgsSent += cnt;
+        }
+    }
+
+    /********************** INPUT **********************/
+    // Handles the complete frames in the input of 'p'. Returns false if it
+    // sent something that isn't a frame
+    bool drainInput(TcpPeer& p)
+    {
+        while (p.in.size() - p.inOff >= FRAME_HDR) {
+            const uint8_t *hdr = (const uint8_t*)p.in.data() + p.inOff;
+            uint32_t len = ((uint32_t)hdr[0] << 24) | ((uint32_t)hdr[1] << 16) |
+                           ((uint32_t)hdr[2] << 8) | hdr[3];
+            if (len < 1 || len > MAX_FRAME) return false;
+            if (p.in.size() - p.inOff < 4 + (size_t)len) break;
+
+            // Picked up again once recvmsg() makes room. Only this thread
+            // pushes, so there is still room below
+            if (hdr[4] == FRAME_MSG && recvQueueFull()) break;
+
+            const char *body = (const char*)hdr + FRAME_HDR;
+            size_t bodylen = len - 1;
+            switch (hdr[4]) {
+                case FRAME_MSG: {
+                    size_t chanlen = bodylen ? (uint8_t)body[0] : 0;
+                    if (chanlen == 0 || chanlen > ZCM_CHANNEL_MAXLEN || 1 + chanlen > bodylen)
+                        return false;
+                    unique_lock<mutex> lk(recvLock);
+                    recvQueue.push_back(TcpRecvMsg{TimeUtil::utime(), string(body + 1, chanlen),
+                                                   string(body + 1 + chanlen,
+                                                          bodylen - 1 - chanlen)});
+                    recvCond.notify_all();
+                    p.msgsRecv++;
+                } break;
+                case FRAME_SUB:
+                case FRAME_UNSUB: {
+                    if (bodylen > ZCM_CHANNEL_MAXLEN) return false;
+                    unique_lock<mutex> lk(mut);
+                    bool enable = hdr[4] == FRAME_SUB;
+                    if (bodylen == 0)  p.interestAll = enable;
+                    else if (enable)   p.interest.emplace(body, bodylen);
+                    else               p.interest.erase(string(body, bodylen));
+                } break;
+                default:
+                    return false;
+            }
+            p.inOff += 4 + len;
+        }
+        if (p.inOff == p.in.size()) {
+            p.in.clear();
+            p.inOff = 0;
+        } else if (p.inOff >= READ_CHUNK) {
+            p.in.erase(0, p.inOff);
+            p.inOff = 0;
+        }
+        return true;
+    }
+
+    // Returns false if the peer is gone
+    bool readPeer(TcpPeer& p)
+    {
+        size_t have = p.in.size();
+        p.in.resize(have + READ_CHUNK);
+        ssize_t n = recv(p.fd, &p.in[have], READ_CHUNK, 0);
+        p.in.resize(have + (n > 0 ? n : 0));
+        if (n == 0) return false;
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        if (!drainInput(p)) {
+            ZCM_DEBUG("tcp peer %s sent a bad frame", p.name.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool recvQueueFull()
+    {
+        unique_lock<mutex> lk(recvLock);
+        return recvQueue.size() >= MAX_RECV_QUEUE;
+    }
+
+    /********************** I/O THREAD **********************/
+    // Accepts and connects, reads from every peer and writes out what the
+    // sends couldn't
+    void ioLoop()
+    {
+        vector<struct pollfd> pfds;
+        while (running) {
+            uint64_t now = TimeUtil::utime();
+            if (!listening && connectFd == -1 && peers.empty() && now >= nextConnectUtime)
+                startConnect();
+
+            bool full = recvQueueFull();
+            int timeout = 100;
+            pfds.clear();
+            pfds.push_back({wakeRd, POLLIN, 0});
+            if (listenFd != -1)  pfds.push_back({listenFd, POLLIN, 0});
+            if (connectFd != -1) pfds.push_back({connectFd, POLLOUT, 0});
+            size_t firstPeer = pfds.size();
+            {
+                unique_lock<mutex> lk(mut);
+                for (auto& p : peers) {
+                    short events = full ? 0 : POLLIN;
+                    if (p->queued()) {
+                        uint64_t due = p->outSince + corkUs;
+                        if (!corkUs || now >= due || p->queued() >= CORK_FLUSH_SIZE)
+                            events |= POLLOUT;
+                        else
+                            timeout = std::min(timeout, (int)((due - now + 999) / 1000));
+                    }
+                    pfds.push_back({p->fd, events, 0});
+                }
+            }
+
+            if (poll(pfds.data(), pfds.size(), timeout) < 0 && errno != EINTR) {
+                perror("tcp poll");
+                continue;
+            }
+
+            if (pfds[0].revents) {
+                char buf[64];
+                while (read(wakeRd, buf, sizeof(buf)) > 0);
+            }
+            for (size_t i = 1; i < firstPeer; ++i) {
+                if (!pfds[i].revents) continue;
+                if (pfds[i].fd == listenFd) {
+                    int fd;
+                    while ((fd = accept(listenFd, nullptr, nullptr)) >= 0) addPeer(fd);
+                } else if (pfds[i].fd == connectFd) {
+                    connectDone();
+                }
+            }
+
+            // New peers, if any, were added at the end
+            for (size_t i = peers.size(); i-- > 0;) {
+                TcpPeer& p = *peers[i];
+                short revents = firstPeer + i < pfds.size() ? pfds[firstPeer + i].revents : 0;
+                bool alive = !p.dead;
+                if (alive && (revents & (POLLIN | POLLHUP | POLLERR)))
+                    alive = readPeer(p);
+                // Frames left waiting for room in the recv queue
+                if (alive && !full && p.in.size() > p.inOff)
+                    alive = drainInput(p);
+                if (alive && (revents & POLLOUT)) {
+                    unique_lock<mutex> lk(mut);
+                    flushPeer(p);
+                    alive = !p.dead;
+                }
+                if (!alive) closePeer(i);
+            }
+        }
+    }
+
+    /********************** METHODS **********************/
+    size_t getMtu()
+    {
+        return MTU;
+    }
+
+    int sendmsg(zcm_msg_t msg)
+    {
+        return sendmsgBatch(&msg, 1);
+    }
+
+    int sendmsgBatch(const zcm_msg_t *msgs, size_t nmsgs)
+    {
+        for (size_t i = 0; i < nmsgs; ++i)
+            if (strlen(msgs[i].channel) > ZCM_CHANNEL_MAXLEN || msgs[i].len > MTU)
+                return ZCM_EINVALID;
+
+        vector<const zcm_msg_t*> wanted;
+        unique_lock<mutex> lk(mut);
+        for (auto& p : peers) {
+            if (p->dead) continue;
+            // A peer that can't keep up misses messages rather than holding up
+            // the publisher (and every other peer)
+            size_t queued = p->queued();
+            wanted.clear();
+            for (size_t i = 0; i < nmsgs; ++i) {
+                if (!p->wants(msgs[i].channel)) continue;
+                size_t sz = MSG_HDR + strlen(msgs[i].channel) + msgs[i].len;
+                if (queued && queued + sz > sndqueue) {
+                    p->drops++;
+                    continue;
+                }
+                wanted.push_back(&msgs[i]);
+                if (queued || corkUs) queued += sz;
+            }
+            if (wanted.empty()) continue;
+
+            bool wasQueued = p->queued() > 0;
+            sendToPeer(*p, wanted.data(), wanted.size());
+            // The I/O thread writes out what's left
+            if (!wasQueued && p->queued()) wakeIo();
+        }
+        return ZCM_EOK;
+    }
+
+    int recvmsgEnable(const char *channel, bool enable)
+    {
+        unique_lock<mutex> lk(mut);
+        if (!enable && (channel ? subs.count(channel) == 0 : subsAll == 0))
+            return ZCM_EINVALID;
+        size_t& refs = channel ? subs[channel] : subsAll;
+        refs += enable ? 1 : -1;
+        bool changed = enable ? refs == 1 : refs == 0;
+        if (channel && refs == 0) subs.erase(channel);
+
+        if (changed) {
+            for (auto& p : peers) {
+                bool wasQueued = p->queued() > 0;
+                queueSub(*p, channel, enable);
+                if (!corkUs) flushPeer(*p);
+                if (!wasQueued && p->queued()) wakeIo();
+            }
+        }
+        return ZCM_EOK;
+    }
+
+    int recvmsg(zcm_msg_t *msg, int timeout)
+    {
+        unique_lock<mutex> lk(recvLock);
+        auto ready = [&](){ return recvWoken || !recvQueue.empty(); };
+        if (timeout < 0) recvCond.wait(lk, ready);
+        else recvCond.wait_for(lk, chrono::milliseconds(timeout), ready);
+        recvWoken = false;
+        if (recvQueue.empty()) return ZCM_EAGAIN;
+
+        bool wasFull = recvQueue.size() >= MAX_RECV_QUEUE;
+        current = std::move(recvQueue.front());
+        recvQueue.pop_front();
+        lk.unlock();
+        if (wasFull) wakeIo();
+
+        msg->utime = current.utime;
+        msg->channel = current.channel.c_str();
+        msg->len = current.data.size();
+        msg->buf = (uint8_t*)current.data.data();
+        return ZCM_EOK;
+    }
+
+    void recvmsgWakeup()
+    {
+        unique_lock<mutex> lk(recvLock);
+        recvWoken = true;
+        recvCond.notify_all();
+    }
+
+    int hasSubscribers(const char *channel)
+    {
+        unique_lock<mutex> lk(mut);
+        for (auto& p : peers)
+            if (!p->dead && p->wants(channel)) return 1;
+        return 0;
+    }
+
+    int getStats(zcm_stat_handler_t cb, void *usr)
+    {
+        // Gathered first, so that 'cb' never runs with 'mut' locked
+        vector<pair<string, uint64_t>> stats;
+        {
+            unique_lock<mutex> lk(mut);
+            stats.emplace_back("tcp.peers", peers.size());
+            stats.emplace_back("tcp.disconnects", disconnects.load());
+            for (auto& p : peers) {
+                string prefix = "tcp.peer." + p->name + ".";
+                stats.emplace_back(prefix + "msgs_sent", p->msgsSent.load());
+                stats.emplace_back(prefix + "msgs_recv", p->msgsRecv.load());
+                stats.emplace_back(prefix + "drops", p->drops.load());
+                stats.emplace_back(prefix + "queued_bytes", p->queued());
+            }
+        }
+        for (auto& elt : stats) cb(elt.first.c_str(), elt.second, usr);
+        return ZCM_EOK;
+    }
+
+    /********************** STATICS **********************/
+    static zcm_trans_methods_t methods;
+    static ZCM_TRANS_CLASSNAME *cast(zcm_trans_t *zt)
+    {
+        assert(zt->vtbl == &methods);
+        return (ZCM_TRANS_CLASSNAME*)zt;
+    }
+
+    static size_t _getMtu(zcm_trans_t *zt)
+    { return cast(zt)->getMtu(); }
+
+    static int _sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
+    { return cast(zt)->sendmsg(msg); }
+
+    static int _recvmsgEnable(zcm_trans_t *zt, const char *channel, bool enable)
+    { return cast(zt)->recvmsgEnable(channel, enable); }
+
+    static int _recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
+    { return cast(zt)->recvmsg(msg, timeout); }
+
+    static void _destroy(zcm_trans_t *zt)
+    { delete cast(zt); }
+
+    static int _sendmsgBatch(zcm_trans_t *zt, const zcm_msg_t *msgs, size_t nmsgs)
+    { return cast(zt)->sendmsgBatch(msgs, nmsgs); }
+
+    static void _recvmsgWakeup(zcm_trans_t *zt)
+    { return cast(zt)->recvmsgWakeup(); }
+
+    static int _getStats(zcm_trans_t *zt, zcm_stat_handler_t cb, void *usr)
+    { return cast(zt)->getStats(cb, usr); }
+
+    static int _hasSubscribers(zcm_trans_t *zt, const char *channel)
+    { return cast(zt)->hasSubscribers(channel); }
+
+    static const TransportRegister reg;
+};
+
+zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
+    &ZCM_TRANS_CLASSNAME::_getMtu,
+    &ZCM_TRANS_CLASSNAME::_sendmsg,
+    &ZCM_TRANS_CLASSNAME::_recvmsgEnable,
+    &ZCM_TRANS_CLASSNAME::_recvmsg,
+    NULL, // update
+    &ZCM_TRANS_CLASSNAME::_destroy,
+    NULL, // recvmsg_claim
+    NULL, // recvmsg_release
+    &ZCM_TRANS_CLASSNAME::_sendmsgBatch,
+    &ZCM_TRANS_CLASSNAME::_recvmsgWakeup,
+    &ZCM_TRANS_CLASSNAME::_getStats,
+    NULL, // get_fd
+    NULL, // set_interleave
+    &ZCM_TRANS_CLASSNAME::_hasSubscribers,
+    NULL, // sendmsg_iov
+};
+
+static zcm_trans_t *create(zcm_url_t *url)
+{
+    auto *trans = new ZCM_TRANS_CLASSNAME(url);
+    if (trans->good())
+        return trans;
+
+    delete trans;
+    return nullptr;
+}
+
+#ifdef USING_TRANS_TCP
+// Register this transport with ZCM
+const TransportRegister ZCM_TRANS_CLASSNAME::reg(
+    "tcp", "Transfer data over TCP to the peers of a routed link "
+           "(e.g. 'tcp://*:7700' to listen, 'tcp://host:7700' to connect)",
+    create);
+#endif
+
+#endif
@@ -16,6 +16,7 @@
 #include <cstring>
 #include <cassert>
 
+#include <atomic>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -23,15 +24,18 @@
 #include <thread>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 using namespace std;
 
 // Define this the class name you want
 #define ZCM_TRANS_CLASSNAME TransportZmqLocal
 #define MTU (1<<28)
-#define START_BUF_SIZE (1 << 20)
-#define ZMQ_IO_THREADS 1
+#define DEFAULT_IO_THREADS 1
 #define IPC_NAME_PREFIX "zcm-channel-zmq-ipc-"
+#define SCAN_PERIOD_US 100000
 
 enum Type { IPC, INPROC, };
 
@@ -42,14 +46,54 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
 
     string subnet;
 
+    // Socket options from the url, -1 leaves zmq's default. With 'nodrop' a
+    // publish that would go over some subscriber's high-water mark fails (and
+    // is counted) instead of zmq silently not sending it to that subscriber
+    int ioThreads = DEFAULT_IO_THREADS;
+    int sndhwm = -1, rcvhwm = -1;
+    int sndbuf = -1, rcvbuf = -1;
+    bool nodrop = false;
+    bool optsValid = true;
+
+    atomic<u64> numSent {0};
+    atomic<u64> numReceived {0};
+    atomic<u64> numHwmDrops {0};
+
+    // The pubsocks are XPUB sockets, so they tell whether each channel has any
+    // subscribers: 'pubInterest' as of the last hasSubscribers() call
     unordered_map<string, void*> pubsocks;
+    unordered_map<string, bool> pubInterest;
+    // Protects 'pubsocks' and 'pubInterest', since hasSubscribers() may be
+    // called concurrently with everything else
+    mutex pubMut;
     // socket pair contains the socket + whether it was subscribed to explicitly or not
     unordered_map<string, pair<void*, bool>> subsocks;
     bool recvAllChannels = false;
-
-    string recvmsgChannel;
-    size_t recvmsgBufferSize = START_BUF_SIZE; // Start at 1MB but allow it to grow to MTU
-    uint8_t* recvmsgBuffer;
+    u64 lastScanUtime = 0;
+
+    // Watches the ipc directory so new channels are found as soon as they're
+    // bound instead of by periodic scans. -1 if unavailable (or not ipc)
+    int inotifyFd = -1;
+
+    // The poll set over 'subsocks', only rebuilt when they change. It belongs to
+    // the recvmsg() thread: recvmsgEnable() just marks it dirty and leaves the
+    // subsocks it drops in 'closingSocks' for recvmsg() to close once they're
+    // out of the set
+    vector<zmq_pollitem_t> pitems;
+    vector<string> pchannels;
+    bool pollDirty = true;
+    size_t nextPoll = 0;
+    vector<pair<string, void*>> closingSocks;
+
+    // Received messages are handed out in the zmq_msg_t they arrived in. The one
+    // given out by recvmsg() is held until the next call, the ones claimed by
+    // recvmsg_claim() until they're released
+    struct Received
+    {
+        string channel;
+        zmq_msg_t zmsg;
+    };
+    Received recvmsgHeld;
 
     // Mutex used to protect 'subsocks' while allowing
     // recvmsgEnable() and recvmsg() to be called
@@ -67,11 +111,41 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
 
         ZCM_DEBUG("IPC Address: %s\n", subnet.c_str());
 
-        recvmsgBuffer = new uint8_t[recvmsgBufferSize];
+        auto *opts = zcm_url_opts(url);
+        for (size_t i = 0; i < opts->numopts; ++i) {
+            string name = opts->name[i];
+            int val = atoi(opts->value[i]);
+            if      (name == "io_threads") ioThreads = val;
+            else if (name == "sndhwm")     sndhwm = val;
+            else if (name == "rcvhwm")     rcvhwm = val;
+            else if (name == "sndbuf")     sndbuf = val;
+            else if (name == "rcvbuf")     rcvbuf = val;
+            else if (name == "nodrop")     nodrop = string(opts->value[i]) == "true";
+            else continue;
+            if (val < 0 || (name == "io_threads" && val < 1)) {
+                ZCM_DEBUG("invalid value for '%s': %s", opts->name[i], opts->value[i]);
+                optsValid = false;
+            }
+        }
+
+        zmq_msg_init(&recvmsgHeld.zmsg);
 
-        ctx = zmq_init(ZMQ_IO_THREADS);
+        ctx = zmq_init(ioThreads);
         assert(ctx != nullptr);
         type = type_;
+
+#ifdef __linux__
+        if (type == IPC) {
+            inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (inotifyFd >= 0 &&
+                inotify_add_watch(inotifyFd, string("/tmp/" + subnet).c_str(),
+                                  IN_CREATE | IN_MOVED_TO) < 0) {
+                ZCM_DEBUG("failed to watch the ipc directory: %s", strerror(errno));
+                close(inotifyFd);
+                inotifyFd = -1;
+            }
+        }
+#endif
     }
 
     ~ZCM_TRANS_CLASSNAME()
@@ -95,27 +169,27 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         }
 
         // Clean up all subscribe sockets
-        for (auto it = subsocks.begin(); it != subsocks.end(); ++it) {
-            address = getAddress(it->first);
-
-            rc = zmq_disconnect(it->second.first, address.c_str());
-            if (rc == -1) {
-                ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
-            }
+        for (auto it = subsocks.begin(); it != subsocks.end(); ++it)
+            closingSocks.emplace_back(it->first, it->second.first);
+        closeSubsocks();
+        zmq_msg_close(&recvmsgHeld.zmsg);
 
-            rc = zmq_close(it->second.first);
-            if (rc == -1) {
-                ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
-            }
-        }
+        if (inotifyFd >= 0) close(inotifyFd);
 
         // Clean up the zmq context
         rc = zmq_ctx_term(ctx);
         if (rc == -1) {
             ZCM_DEBUG("failed to terminate context: %s", zmq_strerror(errno));
         }
+    }
+
+    bool good() { return optsValid; }
 
-        delete[] recvmsgBuffer;
+    void setSockopt(void *sock, int opt, int val, const char *name)
+    {
+        if (val < 0) return;
+        if (zmq_setsockopt(sock, opt, &val, sizeof(val)) == -1)
+            ZCM_DEBUG("failed to set %s: %s", name, zmq_strerror(errno));
     }
 
     string getAddress(const string& channel)
@@ -158,11 +232,16 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
                             channel.c_str());
             return nullptr;
         }
-        void *sock = zmq_socket(ctx, ZMQ_PUB);
+        void *sock = zmq_socket(ctx, ZMQ_XPUB);
         if (sock == nullptr) {
             ZCM_DEBUG("failed to create pubsock: %s", zmq_strerror(errno));
             return nullptr;
         }
+        setSockopt(sock, ZMQ_SNDHWM, sndhwm, "ZMQ_SNDHWM");
+        setSockopt(sock, ZMQ_SNDBUF, sndbuf, "ZMQ_SNDBUF");
+#ifdef ZMQ_XPUB_NODROP
+        if (nodrop) setSockopt(sock, ZMQ_XPUB_NODROP, 1, "ZMQ_XPUB_NODROP");
+#endif
         string address = getAddress(channel);
         int rc = zmq_bind(sock, address.c_str());
         if (rc == -1) {
@@ -186,6 +265,8 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             ZCM_DEBUG("failed to create subsock: %s", zmq_strerror(errno));
             return nullptr;
         }
+        setSockopt(sock, ZMQ_RCVHWM, rcvhwm, "ZMQ_RCVHWM");
+        setSockopt(sock, ZMQ_RCVBUF, rcvbuf, "ZMQ_RCVBUF");
         string address = getAddress(channel);
         int rc;
         rc = zmq_connect(sock, address.c_str());
@@ -199,9 +280,61 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             return nullptr;
         }
         subsocks.emplace(channel, make_pair(sock, subExplicit));
+        pollDirty = true;
         return sock;
     }
 
+    void dropSubsock(unordered_map<string, pair<void*, bool>>::iterator it)
+    {
+        closingSocks.emplace_back(it->first, it->second.first);
+        subsocks.erase(it);
+        pollDirty = true;
+    }
+
+    void closeSubsocks()
+    {
+        for (auto& elt : closingSocks) {
+            string address = getAddress(elt.first);
+            int rc = zmq_disconnect(elt.second, address.c_str());
+            if (rc == -1) {
+                ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
+            }
+
+            rc = zmq_close(elt.second);
+            if (rc == -1) {
+                ZCM_DEBUG("failed to close subsock: %s", zmq_strerror(errno));
+            }
+        }
+        closingSocks.clear();
+    }
+
+    void rebuildPollItems()
+    {
+        closeSubsocks();
+
+        pitems.resize(subsocks.size());
+        pchannels.clear();
+        int i = 0;
+        for (auto& elt : subsocks) {
+            auto *p = &pitems[i];
+            memset(p, 0, sizeof(*p));
+            p->socket = elt.second.first;
+            p->events = ZMQ_POLLIN;
+            pchannels.emplace_back(elt.first);
+            ++i;
+        }
+        // Wakes us up when a new channel appears
+        if (recvAllChannels && inotifyFd >= 0) {
+            zmq_pollitem_t p;
+            memset(&p, 0, sizeof(p));
+            p.fd = inotifyFd;
+            p.events = ZMQ_POLLIN;
+            pitems.push_back(p);
+            pchannels.emplace_back("");
+        }
+        pollDirty = false;
+    }
+
     void ipcScanForNewChannels()
     {
         const char *prefix = IPC_NAME_PREFIX;
@@ -227,11 +360,44 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         closedir(d);
     }
 
+#ifdef __linux__
+    // Picks up the channels created since the last call
+    void ipcWatchNewChannels()
+    {
+        const char *prefix = IPC_NAME_PREFIX;
+        size_t prefixLen = strlen(IPC_NAME_PREFIX);
+
+        alignas(struct inotify_event) char buf[4096];
+        ssize_t len;
+        while ((len = read(inotifyFd, buf, sizeof(buf))) > 0) {
+            for (char *ptr = buf; ptr < buf + len; ) {
+                auto *ev = (struct inotify_event*) ptr;
+                ptr += sizeof(struct inotify_event) + ev->len;
+
+                // Events were lost, only a scan can tell what's there now
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    ipcScanForNewChannels();
+                    continue;
+                }
+                if (ev->len == 0 || strncmp(ev->name, prefix, prefixLen) != 0)
+                    continue;
+                string channel(ev->name + prefixLen);
+                void *sock = subsockFindOrCreate(channel, false);
+                if (sock == nullptr) {
+                    ZCM_DEBUG("failed to open subsock in ipcWatchNewChannels(%s)",
+                              channel.c_str());
+                }
+            }
+        }
+    }
+#endif
+
     // Note: This only works for channels within this instance! Creating another
     //       ZCM instance using 'inproc' will cause this scan to miss some channels!
     //       Need to implement a better technique. Should use a globally shared datastruct.
     void inprocScanForNewChannels()
     {
+        unique_lock<mutex> lk(pubMut);
         for (auto& elt : pubsocks) {
             auto& channel = elt.first;
             void *sock = subsockFindOrCreate(channel, false);
@@ -255,17 +421,44 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         if (msg.len > MTU)
             return ZCM_EINVALID;
 
+        unique_lock<mutex> lk(pubMut);
         void *sock = pubsockFindOrCreate(channel);
         if (sock == nullptr)
             return ZCM_ECONNECT;
-        int rc = zmq_send(sock, msg.buf, msg.len, 0);
-        if (rc == (int)msg.len)
+        int rc = zmq_send(sock, msg.buf, msg.len, nodrop ? ZMQ_DONTWAIT : 0);
+        if (rc == (int)msg.len) {
+            numSent++;
             return ZCM_EOK;
+        }
         assert(rc == -1);
+        if (errno == EAGAIN) {
+            numHwmDrops++;
+            return ZCM_EAGAIN;
+        }
         ZCM_DEBUG("zmq_send failed with: %s", zmq_strerror(errno));
         return ZCM_EUNKNOWN;
     }
 
+    int hasSubscribers(const char *channel)
+    {
+        if (strlen(channel) > ZCM_CHANNEL_MAXLEN)
+            return -1;
+
+        unique_lock<mutex> lk(pubMut);
+        // Subscribers only find channels that have a bound pubsock
+        void *sock = pubsockFindOrCreate(channel);
+        if (sock == nullptr)
+            return -1;
+
+        // XPUB sockets hand over the first subscription to a topic (1, topic) and the
+        // last unsubscription from it (0, topic), and subsocks all subscribe to ""
+        bool& interested = pubInterest[channel];
+        uint8_t sub[8];
+        while (zmq_recv(sock, sub, sizeof(sub), ZMQ_DONTWAIT) > 0)
+            interested = sub[0] == 1;
+        return interested ? 1 : 0;
+    }
+
     int recvmsgEnable(const char *channel, bool enable)
     {
         // Mutex used to protect 'subsocks' while allowing
@@ -277,25 +470,15 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         if (channel == NULL) {
             if (enable) {
                 recvAllChannels = enable;
+                lastScanUtime = 0;
+                pollDirty = true;
             } else {
+                recvAllChannels = false;
+                pollDirty = true;
                 for (auto it = subsocks.begin(); it != subsocks.end(); ) {
-                    if (!it->second.second) { // This channel is only subscribed to implicitly
-                        string address = getAddress(it->first);
-                        int rc = zmq_disconnect(it->second.first, address.c_str());
-                        if (rc == -1) {
-                            ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
-                            return ZCM_ECONNECT;
-                        }
-
-                        rc = zmq_close(it->second.first);
-                        if (rc == -1) {
-                            ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
-                            return ZCM_ECONNECT;
-                        }
-                        it = subsocks.erase(it);
-                    } else {
-                        ++it;
-                    }
+                    auto cur = it++;
+                    if (!cur->second.second) // This channel is only subscribed to implicitly
+                        dropSubsock(cur);
                 }
             }
             return ZCM_EOK;
@@ -311,19 +494,7 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
                         if (recvAllChannels) {
                             it->second.second = false;
                         } else {
-                            string address = getAddress(it->first);
-                            int rc = zmq_disconnect(it->second.first, address.c_str());
-                            if (rc == -1) {
-                                ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
-                                return ZCM_ECONNECT;
-                            }
-
-                            rc = zmq_close(it->second.first);
-                            if (rc == -1) {
-                                ZCM_DEBUG("failed to disconnect subsock: %s", zmq_strerror(errno));
-                                return ZCM_ECONNECT;
-                            }
-                            subsocks.erase(it);
+                            dropSubsock(it);
                         }
                     }
                 }
@@ -332,36 +503,32 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         }
     }
 
-    int recvmsg(zcm_msg_t *msg, int timeout)
+    // Receives the next message into 'into', whose 'zmsg' must be initialized
+    int recvInto(Received *into, zcm_msg_t *msg, int timeout)
     {
-        // Build up a list of poll items
-        vector<zmq_pollitem_t> pitems;
-        vector<string> pchannels;
         {
             // Mutex used to protect 'subsocks' while allowing
             // recvmsgEnable() and recvmsg() to be called
             // concurrently
             unique_lock<mutex> lk(mut);
 
-            if (recvAllChannels) {
+            // Scans cost as much as there are channels, so they're rate limited.
+            // With a directory watch only the first one is needed, for the
+            // channels that existed before
+            u64 now = TimeUtil::utime();
+            bool watching = inotifyFd >= 0 && lastScanUtime != 0;
+            if (recvAllChannels && !watching && now - lastScanUtime >= SCAN_PERIOD_US) {
+                lastScanUtime = now;
                 switch (type) {
                     case IPC: ipcScanForNewChannels();
                     case INPROC: inprocScanForNewChannels();
                 }
             }
+#ifdef __linux__
+            if (recvAllChannels && inotifyFd >= 0) ipcWatchNewChannels();
+#endif
 
-            pitems.resize(subsocks.size());
-            int i = 0;
-            for (auto& elt : subsocks) {
-                auto& channel = elt.first;
-                auto& sock = elt.second.first;
-                auto *p = &pitems[i];
-                memset(p, 0, sizeof(*p));
-                p->socket = sock;
-                p->events = ZMQ_POLLIN;
-                pchannels.emplace_back(channel);
-                ++i;
-            }
+            if (pollDirty) rebuildPollItems();
         }
 
         timeout = (timeout >= 0) ? timeout : -1;
@@ -374,44 +541,35 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
             return ZCM_EAGAIN;
         }
         if (rc >= 0) {
-            for (size_t i = 0; i < pitems.size(); ++i) {
+            // Take turns between the sockets that are ready, starting after the
+            // one we last read from, so busy channels can't starve the others
+            size_t n = pitems.size();
+            for (size_t k = 0; k < n; ++k) {
+                size_t i = (nextPoll + k) % n;
                 auto& p = pitems[i];
+                // New channels are picked up on the next call
+                if (p.socket == nullptr) continue;
                 if (p.revents != 0) {
-                    // NOTE: zmq_recv can return an integer > the len parameter passed in
-                    //       (in this case recvmsgBufferSize); however, all bytes past
-                    //       len are truncated and not placed in the buffer. This means
-                    //       that you will always lose the first message you get that is
-                    //       larger than recvmsgBufferSize
-                    int rc = zmq_recv(p.socket, recvmsgBuffer, recvmsgBufferSize, 0);
+                    nextPoll = i + 1;
+                    // Closes whatever 'zmsg' held before
+                    int rc = zmq_msg_recv(&into->zmsg, p.socket, 0);
                     msg->utime = TimeUtil::utime();
                     if (rc == -1) {
                         fprintf(stderr, "zmq_recv failed with: %s", zmq_strerror(errno));
                         // TODO: implement error handling, don't just assert
                         assert(0 && "unexpected codepath");
                     }
-                    assert(0 < rc);
                     assert(rc < MTU && "Received message that is bigger than a legally-published message could be");
-                    if (rc > (int)recvmsgBufferSize) {
-                        ZCM_DEBUG("Reallocating recv buffer to handle larger messages. Size is now %d", rc);
-                        recvmsgBufferSize = rc * 2;
-                        delete[] recvmsgBuffer;
-                        recvmsgBuffer = new uint8_t[recvmsgBufferSize];
-                        return ZCM_EAGAIN;
-                    }
-                    recvmsgChannel = pchannels[i];
-                    msg->channel = recvmsgChannel.c_str();
+                    numReceived++;
+                    into->channel = pchannels[i];
+                    msg->channel = into->channel.c_str();
                     msg->len = rc;
-                    msg->buf = recvmsgBuffer;
-
-                    // Note: This is probably fine and there probably isn't an elegant
-                    //       way to improve this, but we could technically have more than
-                    //       one socket with a message ready, but because our API is set
-                    //       up to only handle one message at a time, we don't read all
-                    //       the messages that are ready, only the first. You could
-                    //       imagine a case where one channel was at a very high freq
-                    //       and getting interpreted first could shadow a low freq message
-                    //       on a resource constrained system, though perhaps that's just
-                    //       and indicator that you need to optimize your code or do less.
+                    msg->buf = (uint8_t*) zmq_msg_data(&into->zmsg);
+
+                    // Note: Our API only handles one message at a time, so we don't
+                    //       read all the messages that are ready, only one. The others
+                    //       are still ready on the next poll, where the round robin
+                    //       above gets to them first.
 
                     return ZCM_EOK;
                 }
@@ -421,6 +579,40 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         return ZCM_EAGAIN;
     }
 
+    int recvmsg(zcm_msg_t *msg, int timeout)
+    {
+        return recvInto(&recvmsgHeld, msg, timeout);
+    }
+
+    int recvmsgClaim(zcm_msg_t *msg, int timeout, void **token)
+    {
+        Received *owned = new Received();
+        zmq_msg_init(&owned->zmsg);
+        int rc = recvInto(owned, msg, timeout);
+        if (rc != ZCM_EOK) {
+            recvmsgRelease(owned);
+            return rc;
+        }
+        *token = owned;
+        return ZCM_EOK;
+    }
+
+    void recvmsgRelease(void *token)
+    {
+        Received *owned = (Received*) token;
+        zmq_msg_close(&owned->zmsg);
+        delete owned;
+    }
+
+    int getStats(zcm_stat_handler_t cb, void *usr)
+    {
+        string prefix = type == IPC ? "ipc." : "inproc.";
+        cb((prefix + "sent").c_str(), numSent, usr);
+        cb((prefix + "received").c_str(), numReceived, usr);
+        cb((prefix + "hwm_drops").c_str(), numHwmDrops, usr);
+        return ZCM_EOK;
+    }
+
     /********************** STATICS **********************/
     static zcm_trans_methods_t methods;
     static ZCM_TRANS_CLASSNAME *cast(zcm_trans_t *zt)
@@ -444,6 +636,18 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static void _destroy(zcm_trans_t *zt)
     { delete cast(zt); }
 
+    static int _recvmsgClaim(zcm_trans_t *zt, zcm_msg_t *msg, int timeout, void **token)
+    { return cast(zt)->recvmsgClaim(msg, timeout, token); }
+
+    static void _recvmsgRelease(zcm_trans_t *zt, void *token)
+    { return cast(zt)->recvmsgRelease(token); }
+
+    static int _getStats(zcm_trans_t *zt, zcm_stat_handler_t cb, void *usr)
+    { return cast(zt)->getStats(cb, usr); }
+
+    static int _hasSubscribers(zcm_trans_t *zt, const char *channel)
+    { return cast(zt)->hasSubscribers(channel); }
+
     static const TransportRegister regIpc;
     static const TransportRegister regInproc;
 };
@@ -455,22 +659,42 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_recvmsg,
     NULL, // update
     &ZCM_TRANS_CLASSNAME::_destroy,
+    &ZCM_TRANS_CLASSNAME::_recvmsgClaim,
+    &ZCM_TRANS_CLASSNAME::_recvmsgRelease,
+    NULL, // sendmsg_batch
+    NULL, // recvmsg_wakeup
+    &ZCM_TRANS_CLASSNAME::_getStats,
+    NULL, // get_fd
+    NULL, // set_interleave
+    &ZCM_TRANS_CLASSNAME::_hasSubscribers,
+    NULL, // sendmsg_iov
 };
 
+static zcm_trans_t *create(Type type, zcm_url_t *url)
+{
+    auto *trans = new ZCM_TRANS_CLASSNAME(type, url);
+    if (trans->good())
+        return trans;
+
+    delete trans;
+    return nullptr;
+}
+
 static zcm_trans_t *createIpc(zcm_url_t *url)
 {
-    return new ZCM_TRANS_CLASSNAME(IPC, url);
+    return create(IPC, url);
 }
 
 static zcm_trans_t *createInproc(zcm_url_t *url)
 {
-    return new ZCM_TRANS_CLASSNAME(INPROC, url);
+    return create(INPROC, url);
 }
 
 // Register this transport with ZCM
 #ifdef USING_TRANS_IPC
 const TransportRegister ZCM_TRANS_CLASSNAME::regIpc(
-    "ipc",    "Transfer data via Inter-process Communication (e.g. 'ipc')", createIpc);
+    "ipc",    "Transfer data via Inter-process Communication "
+              "(e.g. 'ipc', 'ipc://mysubnet?io_threads=2&sndhwm=10000&rcvhwm=10000')", createIpc);
 #endif
 
 #ifdef USING_TRANS_INPROC
@@ -1,17 +1,5 @@
 #include "buffers.hpp"
 
-static bool sockaddrEqual(struct sockaddr_in *a, struct sockaddr_in *b)
-{
-    return a->sin_addr.s_addr == b->sin_addr.s_addr &&
-           a->sin_port        == b->sin_port &&
-           a->sin_family      == b->sin_family;
-}
-
-bool FragBuf::matchesSockaddr(struct sockaddr_in *addr)
-{
-    return sockaddrEqual(&from, addr);
-}
-
 MessagePool::MessagePool(size_t maxSize, size_t maxBuffers)
     : maxSize(maxSize), maxBuffers(maxBuffers)
 {
@@ -19,6 +7,9 @@ MessagePool::MessagePool(size_t maxSize, size_t maxBuffers)
 
 MessagePool::~MessagePool()
 {
+    // Messages that never got all of their fragments
+    while (!fragbufs.empty())
+        removeFragBuf(fragbufs.begin()->second);
 }
 
 Buffer MessagePool::allocBuffer(size_t sz)
@@ -82,69 +73,119 @@ void MessagePool::freeMessage(Message *b)
 }
 
 
-FragBuf *MessagePool::addFragBuf(u32 data_size)
+FragBuf *MessagePool::addFragBuf(const FragKey& key, u32 data_size, u16 fragments_in_msg)
 {
-    FragBuf *fbuf = new (mempool.alloc<FragBuf>()) FragBuf{};
-    fbuf->buf = this->allocBuffer(data_size);
-
-    while (totalSize > maxSize || fragbufs.size() > maxBuffers) {
-        // find and remove the least recently updated fragment buffer
-        int idx = -1;
-        FragBuf *eldest = nullptr;
-        for (size_t i = 0; i < fragbufs.size(); i++) {
-            FragBuf *f = fragbufs[i];
-            if (idx == -1 || f->last_packet_utime < eldest->last_packet_utime) {
-                idx = (int)i;
-                eldest = f;
-            }
-        }
-        if (eldest) {
-            _removeFragBuf((size_t)idx);
-            // XXX Need to free the removed FragBuf*
-        }
+    assert(fragbufs.find(key) == fragbufs.end());
+
+    // Make room by evicting fragment buffers, see FragEviction.
+    // This only happens for messages that are missing fragments
+    while (!fragbufs.empty() &&
+           (totalSize + data_size > maxSize || fragbufs.size() >= maxBuffers)) {
+        FragBuf *victim = pickEviction();
+        ZCM_DEBUG("Dropping message (missing %d fragments)", victim->fragments_remaining);
+        evictedBytes += victim->buf.size;
+        removeFragBuf(victim);
+        evicted++;
     }
 
-    fragbufs.push_back(fbuf);
+    // Not FragBuf{}, which would zero all of both bitmaps for every message
+    FragBuf *fbuf = new (mempool.alloc<FragBuf>()) FragBuf;
+    memset(fbuf->seen, 0, (fragments_in_msg + 7) / 8);
+    fbuf->fragments_in_msg = fragments_in_msg;
+    fbuf->key = key;
+    fbuf->buf = this->allocBuffer(data_size);
+
+    fragbufs.emplace(key, fbuf);
+    linkFragBuf(fbuf);
     totalSize += data_size;
+    numFrag++;
 
     return fbuf;
 }
 
-FragBuf *MessagePool::lookupFragBuf(struct sockaddr_in *key)
+FragBuf *MessagePool::pickEviction()
 {
-    for (auto& elt : fragbufs)
-        if (elt->matchesSockaddr(key))
-            return elt;
-    return nullptr;
+    if (eviction == FragEviction::LRU) return lruHead;
+
+    // Walking from the eldest, so that it goes first among equals
+    FragBuf *victim = lruHead;
+    for (FragBuf *f = lruHead->lru_next; f; f = f->lru_next) {
+        // f->fragments_remaining / f->fragments_in_msg > the victim's
+        if ((u64)f->fragments_remaining * victim->fragments_in_msg >
+            (u64)victim->fragments_remaining * f->fragments_in_msg)
+            victim = f;
+    }
+    return victim;
 }
 
-void MessagePool::_removeFragBuf(size_t index)
+void MessagePool::linkFragBuf(FragBuf *fbuf)
 {
-    assert(index < fragbufs.size());
+    fbuf->lru_prev = lruTail;
+    fbuf->lru_next = nullptr;
+    if (lruTail) lruTail->lru_next = fbuf;
+    else         lruHead = fbuf;
+    lruTail = fbuf;
+}
 
-    // Update the total_size of the fragment buffers
-    FragBuf *fbuf = fragbufs[index];
-    totalSize -= fbuf->buf.size;
+void MessagePool::unlinkFragBuf(FragBuf *fbuf)
+{
+    if (fbuf->lru_prev) fbuf->lru_prev->lru_next = fbuf->lru_next;
+    else                lruHead = fbuf->lru_next;
+    if (fbuf->lru_next) fbuf->lru_next->lru_prev = fbuf->lru_prev;
+    else                lruTail = fbuf->lru_prev;
+}
 
-    // delete old element, move last element to this slot, and shrink by 1
-    size_t lastIdx = fragbufs.size()-1;
-    fragbufs[index] = fragbufs[lastIdx];
-    fragbufs.pop_back();
+void MessagePool::touchFragBuf(FragBuf *fbuf)
+{
+    if (fbuf == lruTail) return;
+    unlinkFragBuf(fbuf);
+    linkFragBuf(fbuf);
+}
 
-    this->freeBuffer(fbuf->buf);
-    mempool.free(fbuf);
+void MessagePool::setFragLimits(size_t maxSize, size_t maxBuffers, FragEviction eviction)
+{
+    this->maxSize = maxSize;
+    this->maxBuffers = maxBuffers;
+    this->eviction = eviction;
+}
+
+FragBuf *MessagePool::lookupFragBuf(const FragKey& key)
+{
+    auto it = fragbufs.find(key);
+    return it == fragbufs.end() ? nullptr : it->second;
 }
 
 void MessagePool::removeFragBuf(FragBuf *fbuf)
 {
-    // NOTE: this is kinda slow...
-    // Search for the fragbuf index
-    for (size_t idx = 0; idx < fragbufs.size(); idx++)
-        if (fragbufs[idx] == fbuf)
-            return this->_removeFragBuf(idx);
+    auto it = fragbufs.find(fbuf->key);
+    assert(it != fragbufs.end() && it->second == fbuf && "Tried to remove invalid fragbuf");
+    fragbufs.erase(it);
+    unlinkFragBuf(fbuf);
+    numFrag--;
+
+    // Update the total_size of the fragment buffers. Note that 'size' is
+    // kept even when the data was already moved into a Message
+    totalSize -= fbuf->buf.size;
+
+    this->freeBuffer(fbuf->buf);
+    this->freeBuffer(fbuf->parity);
+    mempool.free(fbuf);
+}
 
-    // Did not find
-    assert(0 && "Tried to remove invalid fragbuf");
+void MessagePool::removeOlderFragBufs(const FragKey& key)
+{
+    for (FragBuf *f = lruHead; f;) {
+        FragBuf *next = f->lru_next;
+        // Older as in msg_seqno order, which wraps around
+        if (f->key.addr == key.addr && f->key.port == key.port &&
+            (i32)(key.msg_seqno - f->key.msg_seqno) > 0) {
+            ZCM_DEBUG("Dropping message (missing %d fragments)", f->fragments_remaining);
+            evictedBytes += f->buf.size;
+            removeFragBuf(f);
+            evicted++;
+        }
+        f = next;
+    }
 }
 
 void MessagePool::transferBufffer(Message *to, FragBuf *from)
@@ -64,6 +64,89 @@ struct MsgHeaderLong
 // ASCII-encoded channel name, followed by the payload data
 // if fragment_no > 0, then header is immediately followed by the payload data
 
+// Fragments carry 'fragment_payload' bytes after their header. Messages that fit
+// in a packet no bigger than a fragment's are sent as a single short message
+static inline size_t shortMessageMaxSize(size_t fragment_payload)
+{
+    return fragment_payload + sizeof(MsgHeaderLong) - sizeof(MsgHeaderShort);
+}
+
+// Optional forward error correction for fragmented messages. The channel, its
+// NULL and the data form one stream that is cut into fragments of
+// 'fragment_size' bytes (fragment i starts at i * fragment_size). Before every
+// group of 'group_size' fragments the sender may send a parity packet: the XOR
+// of the fragments of that group, each zero-padded to 'fragment_size'. This
+// lets a receiver rebuild one lost fragment per group. Receivers that don't
+// know ZCM_MAGIC_PARITY simply drop these packets.
+struct MsgHeaderParity
+{
+    // Layout
+    u32 magic;
+    u32 msg_seqno;
+    u32 msg_size;
+    u32 payload_size;   // channel + NULL + data
+    u16 first_fragment;
+    u16 group_size;
+
+    // Converted data
+  public:
+    u32 getMagic()         { return ntohl(magic); }
+    u32 getMsgSeqno()      { return ntohl(msg_seqno); }
+    u32 getMsgSize()       { return ntohl(msg_size); }
+    u32 getPayloadSize()   { return ntohl(payload_size); }
+    u16 getFirstFragment() { return ntohs(first_fragment); }
+    u16 getGroupSize()     { return ntohs(group_size); }
+
+    // Computed data
+  public:
+    // Note: the parity of a group is always 'fragment_size' long
+    u32 getFragmentSize(size_t pktsz) { return pktsz - sizeof(*this); }
+    char *getDataPtr() { return (char*)(this+1); }
+};
+
+// Sent (unicast, to the sender of the messages) by receivers in reliable mode
+// to ask for the retransmission of msg_seqnos [first_seqno, first_seqno+count)
+struct MsgHeaderNack
+{
+    // Layout
+    u32 magic;
+    u32 first_seqno;
+    u32 count;
+
+    // Converted data
+  public:
+    u32 getMagic()      { return ntohl(magic); }
+    u32 getFirstSeqno() { return ntohl(first_seqno); }
+    u32 getCount()      { return ntohl(count); }
+};
+
+/******************** message source **********************/
+// Identifies one message of one sender. For fragmented messages this is what
+// tells them apart: a sender can have several of them in flight at once
+// (e.g. two large channels published from one process)
+struct FragKey
+{
+    u32 addr;       // network order
+    u16 port;       // network order
+    u32 msg_seqno;
+
+    FragKey() : addr(0), port(0), msg_seqno(0) {}
+    FragKey(const struct sockaddr_in *from, u32 msg_seqno)
+        : addr(from->sin_addr.s_addr), port(from->sin_port), msg_seqno(msg_seqno) {}
+
+    bool operator==(const FragKey& o) const
+    { return addr == o.addr && port == o.port && msg_seqno == o.msg_seqno; }
+};
+
+struct FragKeyHash
+{
+    size_t operator()(const FragKey& k) const
+    {
+        u64 v = ((u64)k.addr << 32 | k.msg_seqno) ^ ((u64)k.port << 16);
+        return (size_t)((v * 0x9E3779B97F4A7C15ull) >> 16);
+    }
+};
+
 /******************** message buffer **********************/
 struct Buffer
 {
@@ -95,6 +178,7 @@ struct Buffer
 struct Message
 {
     i64               utime;       // timestamp of first datagram receipt
+    i64               recv_ns;     // same in nanoseconds, if it was that precise
 
     const char       *channel;     // points into 'buf'
     size_t            channellen;  // length of channel
@@ -105,12 +189,18 @@ struct Message
     // Backing store buffer that contains the actual data
     Buffer buf;
 
+    FragKey           src;         // sender and msg_seqno
+    u32               chan_hash;   // zcm_channel_hash() of 'channel', 0 if not computed
+    bool              local;       // from the direct loopback, see UDPM::localPool
+    u16               lane;        // the UDPM lane that claimed it, see UDPMLanes
+
     Message() { memset(this, 0, sizeof(*this)); }
 };
 
 struct Packet
 {
     i64             utime;      // timestamp of first datagram receipt
+    i64             recv_ns;    // same in nanoseconds, if it was that precise
     size_t          sz;         // size received
 
     struct sockaddr from;       // sender
@@ -127,19 +217,43 @@ struct Packet
 /******************** fragment buffer **********************/
 struct FragBuf
 {
-    i64     last_packet_utime;
-    u32     msg_seqno;
-    u16     fragments_remaining;
+    i64     last_packet_utime = 0;
+    i64     last_packet_ns = 0;
+    u32     msg_seqno = 0;
+    u16     fragments_remaining = 0;
 
     // The channel starts at the beginning of the buffer. The data
     // follows immediately after the channel and its NULL
-    size_t  channellen;
-    struct sockaddr_in from;
+    size_t  channellen = 0;
+    FragKey key;
+    u16     fragments_in_msg = 0;
+
+    // Bitmap of the fragments received so far. FragBufs come out of the
+    // MemPool, whose smallest block easily fits these. Only the bytes
+    // 'fragments_in_msg' needs are zeroed, see MessagePool::addFragBuf()
+    u8      seen[65536 / 8];
+
+    // Only set once a parity packet arrived for this message. 'parity'
+    // holds the parity of every group, 'parity_seen' which of them arrived
+    // (zeroed for the groups there are along with 'parity')
+    u16     fec_group = 0;
+    u32     fragment_size = 0;
+    Buffer  parity;
+    u8      parity_seen[65536 / 8];
 
     // Fields set by the allocator object
     Buffer buf;
+    // The pool's list of fragment buffers, from the least to the most
+    // recently updated
+    FragBuf *lru_prev = nullptr;
+    FragBuf *lru_next = nullptr;
+};
 
-    bool matchesSockaddr(struct sockaddr_in *addr);
+// Which partial message MessagePool::addFragBuf() gives up on when it needs room
+enum class FragEviction
+{
+    LRU,       // the one that went the longest without a new fragment
+    PROGRESS,  // the one that is missing the largest share of its fragments
 };
 
 /************** A pool to handle every alloc/dealloc operation on Message objects ******/
@@ -162,21 +276,48 @@ struct MessagePool
     void freeMessage(Message *b);
 
     // FragBuf
-    FragBuf *addFragBuf(u32 data_size);
-    FragBuf *lookupFragBuf(struct sockaddr_in *key);
+    FragBuf *addFragBuf(const FragKey& key, u32 data_size, u16 fragments_in_msg);
+    FragBuf *lookupFragBuf(const FragKey& key);
     void removeFragBuf(FragBuf *fbuf);
+    // Gives up on the messages of the sender of 'key' older than its
+    // msg_seqno, counting them as evicted
+    void removeOlderFragBufs(const FragKey& key);
+    // To call when a packet of 'fbuf' arrives
+    void touchFragBuf(FragBuf *fbuf);
+    bool hasFragBufs() const { return !fragbufs.empty(); }
+    // Bounds the fragment buffers, in bytes and in number, and picks which
+    // one is evicted once another one would go past them
+    void setFragLimits(size_t maxSize, size_t maxBuffers, FragEviction eviction);
+    // See MemPool::setHugePages()
+    void setHugePages(bool enable) { mempool.setHugePages(enable); }
+    // Messages given up on (evicted before all their fragments arrived), and
+    // the bytes they took
+    u32 numEvicted() const { return evicted; }
+    u64 numEvictedBytes() const { return evictedBytes; }
+    // The fragment buffers held right now
+    size_t numFragBufs() const { return numFrag; }
+    size_t fragBufsSize() const { return totalSize; }
 
     void transferBufffer(Message *to, FragBuf *from);
     void moveBuffer(Buffer& to, Buffer& from);
 
   private:
     void _freeMessageBuffer(Message *b);
-    void _removeFragBuf(size_t index);
+    FragBuf *pickEviction();
+    void unlinkFragBuf(FragBuf *fbuf);
+    void linkFragBuf(FragBuf *fbuf);
 
   private:
     MemPool mempool;
-    vector<FragBuf*> fragbufs;
+    unordered_map<FragKey, FragBuf*, FragKeyHash> fragbufs;
+    FragBuf *lruHead = nullptr;  // least recently updated
+    FragBuf *lruTail = nullptr;
     size_t maxSize;
     size_t maxBuffers;
-    size_t totalSize = 0;
+    FragEviction eviction = FragEviction::LRU;
+    // Read by getStats() from other threads
+    std::atomic<size_t> totalSize {0};
+    std::atomic<size_t> numFrag {0};
+    std::atomic<u32> evicted {0};
+    std::atomic<u64> evictedBytes {0};
 };
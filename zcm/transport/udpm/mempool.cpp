@@ -4,23 +4,35 @@
 #include <cstring>
 #include <climits>
 
+#include "zcm/zcm_alloc.h"
+#include "zcm/util/huge_pages.hpp"
+
 MemPool::MemPool()
 {
     memset(sizelists, 0, sizeof(sizelists));
 }
 
+static size_t slotToSize(int slot);
+
 MemPool::~MemPool()
 {
     for (size_t i = 0; i < NUMLISTS; i++) {
         Block *blk = sizelists[i];
+        bool huge = onHugePages(slotToSize(i));
         while (blk) {
             auto *next = blk->next;
-            std::free(blk);
+            if (huge) HugePages::unmap(blk, slotToSize(i));
+            else      zcm_dealloc(blk, ZCM_ALLOC_TRANSPORT);
             blk = next;
         }
     }
 }
 
+bool MemPool::onHugePages(size_t blockSize) const
+{
+    return hugePages && blockSize >= HugePages::SIZE;
+}
+
 static bool fitsInU32(size_t v)
 {
     return (v & 0xffffffff) == v;
@@ -57,7 +69,9 @@ char *MemPool::alloc(size_t sz)
         sizelists[slot] = mem->next;
         return (char*)mem;
     } else {
-        return (char*)malloc(slotToSize(slot));
+        size_t blockSize = slotToSize(slot);
+        if (onHugePages(blockSize)) return (char*)HugePages::map(blockSize);
+        return (char*)zcm_alloc(blockSize, ZCM_ALLOC_TRANSPORT);
     }
 }
 
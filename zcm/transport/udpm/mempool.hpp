@@ -11,6 +11,10 @@ class MemPool
     char *alloc(size_t sz);
     void free(char *mem, size_t sz);
 
+    // Takes the blocks of a huge page or more from huge pages (see
+    // HugePages::map()). Must be set before anything is allocated
+    void setHugePages(bool enable) { hugePages = enable; }
+
     template<class T>
     T *alloc();
 
@@ -23,6 +27,9 @@ class MemPool
     struct Block { Block *next; };
     static const size_t NUMLISTS = 13;
     Block* sizelists[NUMLISTS]; // Pow2 blocks from 2^16 to 2^28
+    bool hugePages = false;
+
+    bool onHugePages(size_t blockSize) const;
 
   private:
     // Disallow copies and moves
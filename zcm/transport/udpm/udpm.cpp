@@ -9,6 +9,26 @@
 
 #define MTU (1<<28)
 
+// Receivers in reliable mode track this many of the latest msg_seqnos of
+// every sender, and ask again for the ones still missing this often
+#define NACK_TRACKED_SEQNOS 64
+#define NACK_RETRY_US 10000
+// Upper bound on the "nack" url option: the number of sent messages kept
+#define MAX_NACK_WINDOW 4096
+// Lower bound on the "frag" url option. The first fragment must always have
+// room for the channel and its NULL
+#define MIN_FRAGMENT_PAYLOAD 256
+// Largest fragment payload that still fits in a single UDP datagram
+#define MAX_FRAGMENT_PAYLOAD (65507 - (int)sizeof(MsgHeaderLong))
+// Most messages waiting to be handed over by the direct loopback
+#define MAX_LOCAL_QUEUE 1024
+// Upper bound on the "lanes" url option, and the most messages the lanes
+// queue up for recvmsg() between them
+#define MAX_RECV_LANES 64
+#define MAX_LANE_QUEUE 1024
+// How long the self test waits for its message to loop back
+#define SELFTEST_TIMEOUT_US 1000000
+
 static i32 utimeInSeconds()
 {
     struct timeval tv;
@@ -16,6 +36,13 @@ static i32 utimeInSeconds()
     return (i32)tv.tv_sec;
 }
 
+static i64 utimeNow()
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (i64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 /**
  * udpm_params_t:
  * @mc_addr:        multicast address
@@ -26,6 +53,65 @@ static i32 utimeInSeconds()
  *                  don't use > 1.  that's just rude.
  * @recv_buf_size:  requested size of the kernel receive buffer, set with
  *                  SO_RCVBUF.  0 indicates to use the default settings.
+ * @fec_group:      if > 0, send one XOR parity packet per this many fragments
+ *                  of a large message, so receivers can rebuild one lost
+ *                  fragment per group. Set with the "fec" url option.
+ * @nack_window:    if > 0, run in reliable mode: receivers unicast NACKs for
+ *                  the msg_seqnos they missed, and the sender keeps its last
+ *                  this many messages around to multicast them again. Set
+ *                  with the "nack" url option.
+ * @frag_payload:   bytes of data carried by each fragment of a large message.
+ *                  Lower it so that packets fit the link MTU and the kernel
+ *                  never has to fragment them at the IP level. Set with the
+ *                  "frag" url option.
+ * @busy_poll_us:   if > 0, let the kernel busy poll the network device for
+ *                  this many microseconds before sleeping on an empty
+ *                  receive socket. Set with the "busypoll" url option.
+ * @groups:         if > 1, channels are spread over this many multicast groups
+ *                  (the one in the url and the ones numerically after it) by
+ *                  the hash of their name. Receivers only join the groups of
+ *                  the channels they subscribe to. Set with the "groups" url
+ *                  option; every process on the url must use the same value.
+ * @hw_timestamps:  if true, timestamp received packets with the NIC's clock when
+ *                  it provides one. Set with the "timestamps=hw" url option.
+ * @direct_loopback: if true, messages sent on channels this instance receives
+ *                  are handed to its receive side directly, instead of taking
+ *                  the round trip through the kernel's multicast loopback.
+ *                  The copies that still loop back (other processes on the
+ *                  host need them) are dropped by their sender address. Set
+ *                  with the "loopback=direct" url option.
+ * @no_loopback:    if true, nothing this instance sends loops back to the
+ *                  receivers on this host, for when they get it some other
+ *                  way (see the hybrid transport). Set with the
+ *                  "loopback=none" url option.
+ * @lanes:          if > 1, receive on this many sockets bound to the same
+ *                  port, each with its own thread and pool, which splits
+ *                  packet processing and reassembly over as many cores.
+ *                  Every sender is received by a single lane, so its
+ *                  messages stay in order. Set with the "lanes" url option
+ *                  (Linux only).
+ * @lane:           which one of the 'lanes' this UDPM receives for. Only
+ *                  lane 0 sends.
+ * @selftest:       if true, send a message on SELF_TEST_CHANNEL at startup
+ *                  and watch for it to loop back, without waiting for it.
+ *                  The outcome is reported as the "udpm.selftest" stat.
+ *                  Set with the "selftest=true" url option.
+ * @frag_mem:       the most bytes of partial messages kept around while their
+ *                  fragments come in. Set with the "fragmem" url option.
+ * @frag_bufs:      the most partial messages kept around. Set with the
+ *                  "fragbufs" url option.
+ * @frag_eviction:  which partial message is dropped when a new one needs
+ *                  room: "fragevict=lru" drops the one that went the longest
+ *                  without a fragment, "fragevict=progress" the one missing
+ *                  the largest share of its fragments.
+ * @autobuf:        if true, grow the kernel receive buffer (up to rmem_max)
+ *                  to hold the largest backlog and message seen, and sooner
+ *                  if the kernel drops packets, and size the send buffer
+ *                  for a batch of fragments (up to wmem_max). Turn it off
+ *                  with the "autobuf=false" url option.
+ * @huge_pages:     if true, the buffers of large messages come from huge
+ *                  pages, which cut the TLB misses of assembling them. Set
+ *                  with the "hugepages=true" url option.
  *
  */
 struct Params
@@ -35,6 +121,22 @@ struct Params
     u16            port;
     u8             ttl;
     size_t         recv_buf_size;
+    u16            fec_group = 0;
+    u32            nack_window = 0;
+    size_t         frag_payload = ZCM_FRAGMENT_MAX_PAYLOAD;
+    int            busy_poll_us = 0;
+    bool           hw_timestamps = false;
+    u16            groups = 1;
+    bool           direct_loopback = false;
+    bool           no_loopback = false;
+    u16            lanes = 1;
+    u16            lane = 0;
+    bool           selftest = false;
+    bool           autobuf = true;
+    size_t         frag_mem = MAX_FRAG_BUF_TOTAL_SIZE;
+    size_t         frag_bufs = MAX_NUM_FRAG_BUFS;
+    FragEviction   frag_eviction = FragEviction::LRU;
+    bool           huge_pages = false;
 
     Params(const string& ip, u16 port, size_t recv_buf_size, u8 ttl)
     {
@@ -52,24 +154,137 @@ struct UDPM
     Params params;
     UDPMAddress destAddr;
 
+    // Channel sharding: one address per group, and how many enabled channels
+    // (or regex subscriptions, for 'allRefs') need each group to be joined
+    vector<UDPMAddress> groupAddrs;
+    mutex       groupLock;
+    vector<u32> groupRefs;
+    u32         allRefs = 0;
+    const UDPMAddress& destFor(const char *channel)
+    {
+        if (params.groups == 1) return destAddr;
+        return groupAddrs[zcm_channel_hash(channel) % params.groups];
+    }
+    bool setGroupJoined(size_t group, bool wasJoined, bool joined);
+
     UDPMSocket recvfd;
     UDPMSocket sendfd;
 
-    /* size of the kernel UDP receive buffer */
-    size_t kernel_rbuf_sz = 0;
-    size_t kernel_sbuf_sz = 0;
+    /* size of the kernel UDP buffers, as the kernel reports them */
+    std::atomic<size_t> kernel_rbuf_sz {0};
+    std::atomic<size_t> kernel_sbuf_sz {0};
     bool warned_about_small_kernel_buf = false;
 
+    // Receive buffer tuning (see tuneRecvBuf()), from the recv thread only.
+    // A burst is what was read back to back, without waiting on the socket:
+    // what had piled up in the kernel buffer in the meantime
+    size_t rx_burst = 0;
+    std::atomic<size_t> rx_burst_peak {0};
+    std::atomic<size_t> rx_largest_msg {0};
+    u32    rx_tuned_drops = 0;  // udp_kernel_drops as of the last tuning
+    bool   rx_buf_capped = false;
+    void noteReceived(size_t bytes) { rx_burst += bytes; }
+    void endBurst();
+    void tuneRecvBuf();
+    void sizeSendBuf();
+
     MessagePool pool {MAX_FRAG_BUF_TOTAL_SIZE, MAX_NUM_FRAG_BUFS};
 
     /* other variables */
-    u32          udp_rx = 0;            // packets received and processed
-    u32          udp_discarded_bad = 0; // packets discarded because they were bad
-                                    // somehow
+    // Counters reported by getStats(), which may run on any thread
+    std::atomic<u32> udp_rx {0};            // packets received and processed
+    std::atomic<u32> udp_discarded_bad {0}; // packets discarded because they were bad
+                                            // somehow
+    std::atomic<u32> udp_fec_recovered {0}; // fragments rebuilt from parity packets
+    std::atomic<u32> udp_kernel_drops {0};  // packets dropped by the kernel (SO_RXQ_OVFL)
     double       udp_low_watermark = 1.0; // least buffer available
     i32          udp_last_report_secs = 0;
 
     u32          msg_seqno = 0; // rolling counter of how many messages transmitted
+    vector<char> parityBuf;     // scratch space for sending parity packets
+
+    // Reliable mode, sender side: the last 'nack_window' messages sent,
+    // indexed by msg_seqno % nack_window. NACKs are served from the recv
+    // thread, so this (and sending at all) is guarded by 'sendLock'
+    struct SentMsg
+    {
+        u32    msg_seqno = 0;
+        size_t channellen = 0;
+        size_t len = 0;
+        i64    last_resend_utime = 0;
+        Buffer buf;                  // channel, NULL, then data
+    };
+    mutex           sendLock;
+    vector<SentMsg> sentRing;
+
+    // Asked for short messages to send between the batches of fragments of a
+    // large one (see set_interleave() in transport.h). Not used in reliable
+    // mode, where a message overtaking one still being fragmented would look
+    // like a loss of the latter and get it NACKed
+    zcm_interleave_t interleave = nullptr;
+    void*            interleaveUsr = nullptr;
+    MessagePool     sentPool {0, 0}; // only used for its buffers
+    std::atomic<u32> udp_retransmitted {0};
+
+    // Per sender, a bitmap of which of the NACK_TRACKED_SEQNOS msg_seqnos
+    // before 'next' were received. This drives the loss counters and, in
+    // reliable mode, the NACKs. msg_seqno counts every message of a sender, so
+    // a message that never arrives can't be pinned on a channel; one that
+    // arrives late can
+    struct ChannelStats
+    {
+        string name;
+        u64    msgs = 0;
+        u64    reordered = 0;
+    };
+    struct PeerSeqnos
+    {
+        u32 next = 0;
+        u64 received = 0;
+        u32 known = 0;               // how many bits of 'received' are valid
+        i64 last_nack_utime = 0;
+
+        u64 msgs = 0;
+        u64 missing = 0;             // msg_seqnos skipped that did not show up (yet)
+        u64 reordered = 0;           // msg_seqnos that showed up after newer ones
+        u64 duplicates = 0;
+        unordered_map<u32, ChannelStats> channels; // by zcm_channel_hash()
+
+        // Starts tracking over from 'seqno', e.g. after the sender restarted
+        void restart(u32 seqno) { next = seqno + 1; received = 1; known = 1; }
+    };
+    // Guards 'peers', which getStats() reads from other threads
+    mutex           statsLock;
+    unordered_map<u64, PeerSeqnos> peers;
+    std::atomic<u32> udp_duplicates {0};
+
+    // Direct loopback: copies of the messages we send on the channels we
+    // receive (or all of them, while 'localAllRefs' regex subscriptions are
+    // enabled), queued by the send side for readMessage(). 'localPool' is used
+    // from both sides, so it is guarded by 'localLock' like the rest of these
+    mutex                   localLock;
+    MessagePool             localPool {0, 0}; // only used for its buffers
+    std::deque<Message*>    localQueue;
+    std::atomic<bool>       localPending {false};
+    unordered_map<string, u32> localChannels;
+    u32                     localAllRefs = 0;
+    // Our own packets, as seen looping back: from 'selfPort' of 'selfAddrs'
+    u16                     selfPort = 0;
+    vector<u32>             selfAddrs;
+    std::atomic<u32>        udp_self_dropped {0};
+    std::atomic<u32>        udp_local_overflow {0};
+
+    // The self test, shared by all the lanes since any of them may be the one
+    // to receive it. 'nonce' is the payload that tells our test message apart
+    // from those of other processes
+    struct SelfTest
+    {
+        enum State : u32 { WAITING = 0, PASSED = 1, FAILED = 2 };
+        std::atomic<u32> state {WAITING};
+        i64 deadline = 0;
+        u64 nonce = 0;
+    };
+    std::shared_ptr<SelfTest> selfTest;
 
     /***** Methods ******/
     UDPM(const string& ip, u16 port, size_t recv_buf_size, u8 ttl);
@@ -79,17 +294,86 @@ struct UDPM
     int handle();
 
     int sendmsg(zcm_msg_t msg);
+    int sendmsgBatch(const zcm_msg_t *msgs, size_t nmsgs);
+    int sendmsgIov(const zcm_msg_t& msg, const zcm_iov_t *iov, size_t niov);
+    // The fragments of 'msg', with the data taken from 'iov'
+    int sendFragmentsIov(const zcm_msg_t& msg, size_t channel_size, u32 seqno,
+                         const zcm_iov_t *iov, size_t niov);
+    // Sends 'msg' as message number 'seqno'. The channel must be valid
+    int sendMessage(const zcm_msg_t& msg, size_t channel_size, u32 seqno);
+    // sendmsg() without taking 'sendLock'
+    int sendOne(const zcm_msg_t& msg);
+    void setInterleave(zcm_interleave_t next, void* usr)
+    { interleave = next; interleaveUsr = usr; }
+    // Fills 'hdr' and 'iov' with the parity packet of fragments [first, end)
+    void sendParityOf(const zcm_msg_t& msg, size_t channel_size, u32 seqno,
+                      int first, int end, MsgHeaderParity& hdr, struct iovec (&iov)[3]);
+    void recvmsgWakeup() { recvfd.wakeup(); }
+    int recvmsgEnable(const char *channel, bool enable);
     int recvmsg(zcm_msg_t *msg, int timeout);
+    int recvmsgClaim(zcm_msg_t *msg, int timeout, void **token);
+    void recvmsgRelease(void *token);
+    int getStats(zcm_stat_handler_t cb, void *usr);
+    // Sends the message of the self test and returns right away. Called
+    // once every lane is listening, as any of them may be the one to get it
+    bool startSelfTest();
 
   private:
     // These returns non-null when a full message has been received
     Message *recvShort(Packet *pkt, u32 sz);
     Message *recvFragment(Packet *pkt, u32 sz);
+    Message *recvParity(Packet *pkt, u32 sz);
+    FragBuf *newFragBuf(const FragKey& key, size_t channellen, u32 data_size,
+                        u16 fragments_in_msg, i64 utime);
+    // Bookkeeping after the contents of 'fragment_no' were put in place
+    Message *fragmentArrived(FragBuf *fbuf, u16 fragment_no, i64 utime, i64 recv_ns);
+    void recoverFragment(FragBuf *fbuf, u16 group);
+    Message *completeFragBuf(FragBuf *fbuf);
     Message *readMessage(int timeout);
 
+    // Reads the next packet straight into its place in the fragment buffer
+    // of a message that is being reassembled, skipping the copy out of a
+    // Packet. Returns true if a packet was consumed. Sets 'msg' if that
+    // packet completed the message
+    bool recvFragmentInPlace(Message **msg);
+
     Message *m = nullptr;
 
-    bool selftest();
+    // Packets received (by one recvPackets() call) but not yet processed are
+    // rxPkts[rxNext..rxCount). Only touched by the recv thread
+    Packet *rxPkts[UDPMSocket::MAX_RECV_BATCH] = {};
+    size_t rxNext = 0;
+    size_t rxCount = 0;
+    // Returns false if no packets arrived within 'timeout'
+    bool fillRxPackets(int timeout);
+
+    // Claimed messages are handed back from the dispatch thread, but the pool
+    // is only touched from the recv thread. So they are parked here until
+    // the next recv call returns them to the pool.
+    mutex releasedLock;
+    vector<Message*> released;
+    void freeReleased();
+
+    // Direct loopback
+    void sendLocal(const zcm_msg_t& msg, size_t channel_size);
+    Message *popLocal();
+    bool isSelf(const struct sockaddr& from) const;
+    // Gives 'msg' back to the pool it came from
+    void freeMessage(Message *msg);
+
+    // Reliable mode
+    void rememberSent(const zcm_msg_t& msg, size_t channel_size, u32 seqno);
+    void serviceNacks();
+    void resend(u32 seqno);
+    // Updates the counters of the sender of 'msg' and sets its chan_hash.
+    // Returns false if 'msg' should be dropped as a duplicate (only done in
+    // reliable mode, where retransmits make them expected). Sends NACKs for gaps
+    bool trackSeqno(Message *msg);
+    void sendNacks(const FragKey& src, PeerSeqnos& peer);
+
+    // Returns true if 'msg' is the message of our self test, which passes it
+    bool isSelfTest(const Message *msg);
+    void checkSelfTest();
     void checkForMessageLoss();
 };
 
@@ -104,10 +388,10 @@ Message *UDPM::recvShort(Packet *pkt, u32 sz)
         return NULL;
     }
 
-    udp_rx++;
-
     Message *msg = pool.allocMessageEmpty();
     msg->utime = pkt->utime;
+    msg->recv_ns = pkt->recv_ns;
+    msg->src = FragKey((struct sockaddr_in*)&pkt->from, hdr->getMsgSeqno());
     msg->channel = hdr->getChannelPtr();
     msg->channellen = clen;
     msg->data = hdr->getDataPtr();
@@ -117,13 +401,41 @@ Message *UDPM::recvShort(Packet *pkt, u32 sz)
     return msg;
 }
 
+static bool testBit(const u8 *bits, size_t i)
+{ return (bits[i / 8] >> (i % 8)) & 1; }
+
+static void setBit(u8 *bits, size_t i)
+{ bits[i / 8] |= (u8)(1 << (i % 8)); }
+
+static void xorBytes(char *dst, const char *src, size_t len)
+{
+    size_t i = 0;
+    for (; i + sizeof(u64) <= len; i += sizeof(u64)) {
+        u64 a, b;
+        memcpy(&a, dst + i, sizeof(a));
+        memcpy(&b, src + i, sizeof(b));
+        a ^= b;
+        memcpy(dst + i, &a, sizeof(a));
+    }
+    for (; i < len; i++)
+        dst[i] ^= src[i];
+}
+
+FragBuf *UDPM::newFragBuf(const FragKey& key, size_t channellen, u32 data_size,
+                          u16 fragments_in_msg, i64 utime)
+{
+    FragBuf *fbuf = pool.addFragBuf(key, channellen + 1 + data_size, fragments_in_msg);
+    fbuf->last_packet_utime = utime;
+    fbuf->msg_seqno = key.msg_seqno;
+    fbuf->fragments_remaining = fragments_in_msg;
+    fbuf->channellen = channellen;
+    return fbuf;
+}
+
 Message *UDPM::recvFragment(Packet *pkt, u32 sz)
 {
     MsgHeaderLong *hdr = pkt->asHeaderLong();
 
-    // any existing fragment buffer for this message source?
-    FragBuf *fbuf = pool.lookupFragBuf((struct sockaddr_in*)&pkt->from);
-
     u32 msg_seqno = hdr->getMsgSeqno();
     u32 data_size = hdr->getMsgSize();
     u32 fragment_offset = hdr->getFragmentOffset();
@@ -132,11 +444,16 @@ Message *UDPM::recvFragment(Packet *pkt, u32 sz)
     u32 frag_size = hdr->getFragmentSize(sz);
     char *data_start = hdr->getDataPtr();
 
-    // discard any stale fragments from previous messages
-    if (fbuf && ((fbuf->msg_seqno != msg_seqno) ||
-                 (fbuf->buf.size != data_size + fbuf->channellen+1))) {
-        pool.removeFragBuf(fbuf);
+    // any existing fragment buffer for this message?
+    FragKey key((struct sockaddr_in*)&pkt->from, msg_seqno);
+    FragBuf *fbuf = pool.lookupFragBuf(key);
+
+    // discard fragments that don't belong to this message (the sender's
+    // seqno rolled over, or it restarted)
+    if (fbuf && (fbuf->buf.size != data_size + fbuf->channellen+1 ||
+                 fbuf->fragments_in_msg != fragments_in_msg)) {
         ZCM_DEBUG("Dropping message (missing %d fragments)", fbuf->fragments_remaining);
+        pool.removeFragBuf(fbuf);
         fbuf = NULL;
     }
 
@@ -148,29 +465,22 @@ Message *UDPM::recvFragment(Packet *pkt, u32 sz)
     // create a new fragment buffer if necessary
     if (!fbuf && fragment_no == 0) {
         char *channel = (char*) (hdr + 1);
-        int channel_sz = strlen(channel);
+        int channel_sz = strnlen(channel, frag_size);
         if (channel_sz > ZCM_CHANNEL_MAXLEN) {
             ZCM_DEBUG("bad channel name length");
             udp_discarded_bad++;
             return NULL;
         }
-
-        fbuf = pool.addFragBuf(channel_sz + 1 + data_size);
-        fbuf->last_packet_utime = pkt->utime;
-        fbuf->msg_seqno = msg_seqno;
-        fbuf->fragments_remaining = fragments_in_msg;
-        fbuf->channellen = channel_sz;
-        fbuf->from = *(struct sockaddr_in*)&pkt->from;
-        memcpy(fbuf->buf.data, data_start, frag_size);
-
-        --fbuf->fragments_remaining;
-        return NULL;
+        fbuf = newFragBuf(key, channel_sz, data_size, fragments_in_msg, pkt->utime);
     }
 
     if (!fbuf) return NULL;
-    recvfd.checkAndWarnAboutSmallBuffer(data_size, kernel_rbuf_sz);
+    if (data_size > rx_largest_msg) rx_largest_msg = data_size;
 
-    if (fbuf->channellen+1 + fragment_offset + frag_size > fbuf->buf.size) {
+    // The first fragment also carries the channel, so it starts the buffer
+    size_t start = fragment_no == 0 ? 0 : fbuf->channellen+1 + fragment_offset;
+    if (fragment_no >= fbuf->fragments_in_msg || start + frag_size > fbuf->buf.size ||
+        (fragment_no == 0 && strnlen(data_start, frag_size) != fbuf->channellen)) {
         ZCM_DEBUG("dropping invalid fragment (off: %d, %d / %zu)",
                 fragment_offset, frag_size, fbuf->buf.size);
         pool.removeFragBuf(fbuf);
@@ -178,15 +488,128 @@ Message *UDPM::recvFragment(Packet *pkt, u32 sz)
     }
 
     // copy data
-    memcpy(fbuf->buf.data + fbuf->channellen+1 + fragment_offset, data_start, frag_size);
+    memcpy(fbuf->buf.data + start, data_start, frag_size);
 
-    fbuf->last_packet_utime = pkt->utime;
-    if (--fbuf->fragments_remaining > 0)
+    return fragmentArrived(fbuf, fragment_no, pkt->utime, pkt->recv_ns);
+}
+
+Message *UDPM::recvParity(Packet *pkt, u32 sz)
+{
+    if (sz <= sizeof(MsgHeaderParity)) {
+        udp_discarded_bad++;
+        return NULL;
+    }
+    MsgHeaderParity *hdr = (MsgHeaderParity*)pkt->buf.data;
+
+    u32 data_size = hdr->getMsgSize();
+    u32 payload_size = hdr->getPayloadSize();
+    u32 frag_size = hdr->getFragmentSize(sz);
+    u16 first_fragment = hdr->getFirstFragment();
+    u16 group_size = hdr->getGroupSize();
+    u32 fragments_in_msg = payload_size / frag_size + !!(payload_size % frag_size);
+
+    if (data_size > MTU || payload_size <= data_size ||
+        payload_size - data_size - 1 > ZCM_CHANNEL_MAXLEN ||
+        fragments_in_msg > 65535 || group_size == 0 ||
+        first_fragment % group_size != 0 || first_fragment >= fragments_in_msg) {
+        ZCM_DEBUG("dropping invalid parity packet");
+        udp_discarded_bad++;
+        return NULL;
+    }
+
+    FragKey key((struct sockaddr_in*)&pkt->from, hdr->getMsgSeqno());
+    FragBuf *fbuf = pool.lookupFragBuf(key);
+    if (fbuf && (fbuf->buf.size != payload_size ||
+                 fbuf->fragments_in_msg != fragments_in_msg)) {
+        ZCM_DEBUG("Dropping message (missing %d fragments)", fbuf->fragments_remaining);
+        pool.removeFragBuf(fbuf);
+        fbuf = NULL;
+    }
+
+    // Parity usually comes first, so it may also start the message
+    if (!fbuf)
+        fbuf = newFragBuf(key, payload_size - data_size - 1, data_size,
+                          fragments_in_msg, pkt->utime);
+
+    if (fbuf->fec_group == 0) {
+        size_t ngroups = (fragments_in_msg + group_size - 1) / group_size;
+        fbuf->fec_group = group_size;
+        fbuf->fragment_size = frag_size;
+        fbuf->parity = pool.allocBuffer(ngroups * frag_size);
+        memset(fbuf->parity_seen, 0, (ngroups + 7) / 8);
+    } else if (fbuf->fec_group != group_size || fbuf->fragment_size != frag_size) {
+        ZCM_DEBUG("dropping inconsistent parity packet");
+        udp_discarded_bad++;
         return NULL;
+    }
+
+    size_t group = first_fragment / group_size;
+    if (testBit(fbuf->parity_seen, group)) return NULL;
+    memcpy(fbuf->parity.data + group * frag_size, hdr->getDataPtr(), frag_size);
+    setBit(fbuf->parity_seen, group);
+    fbuf->last_packet_utime = pkt->utime;
+    pool.touchFragBuf(fbuf);
+
+    recoverFragment(fbuf, group);
+    return fbuf->fragments_remaining == 0 ? completeFragBuf(fbuf) : NULL;
+}
+
+Message *UDPM::fragmentArrived(FragBuf *fbuf, u16 fragment_no, i64 utime, i64 recv_ns)
+{
+    fbuf->last_packet_utime = utime;
+    fbuf->last_packet_ns = recv_ns;
+    pool.touchFragBuf(fbuf);
+
+    // duplicates don't count
+    if (testBit(fbuf->seen, fragment_no)) return NULL;
+    setBit(fbuf->seen, fragment_no);
+    --fbuf->fragments_remaining;
+
+    if (fbuf->fragments_remaining > 0 && fbuf->fec_group > 0)
+        recoverFragment(fbuf, fragment_no / fbuf->fec_group);
+
+    return fbuf->fragments_remaining == 0 ? completeFragBuf(fbuf) : NULL;
+}
+
+void UDPM::recoverFragment(FragBuf *fbuf, u16 group)
+{
+    if (!testBit(fbuf->parity_seen, group)) return;
+
+    // Exactly one fragment of the group may be missing
+    size_t first = (size_t)group * fbuf->fec_group;
+    size_t last = std::min(first + fbuf->fec_group, (size_t)fbuf->fragments_in_msg);
+    size_t missing = last;
+    for (size_t i = first; i < last; i++) {
+        if (testBit(fbuf->seen, i)) continue;
+        if (missing != last) return;
+        missing = i;
+    }
+    if (missing == last) return;
+
+    size_t fragsz = fbuf->fragment_size;
+    size_t start = missing * fragsz;
+    size_t len = std::min(fragsz, fbuf->buf.size - start);
+    char *dst = fbuf->buf.data + start;
+    memcpy(dst, fbuf->parity.data + group * fragsz, len);
+    for (size_t i = first; i < last; i++) {
+        if (i == missing) continue;
+        size_t off = i * fragsz;
+        xorBytes(dst, fbuf->buf.data + off, std::min(len, fbuf->buf.size - off));
+    }
+
+    ZCM_DEBUG("recovered fragment %zu of %u from parity", missing, fbuf->fragments_in_msg);
+    udp_fec_recovered++;
+    setBit(fbuf->seen, missing);
+    --fbuf->fragments_remaining;
+}
 
+Message *UDPM::completeFragBuf(FragBuf *fbuf)
+{
     // we've received all the fragments, return a new Message
     Message *msg = pool.allocMessageEmpty();
     msg->utime = fbuf->last_packet_utime;
+    msg->recv_ns = fbuf->last_packet_ns;
+    msg->src = fbuf->key;
     msg->channel = fbuf->buf.data;
     msg->channellen = fbuf->channellen;
     msg->data = fbuf->buf.data + fbuf->channellen + 1;
@@ -196,9 +619,54 @@ Message *UDPM::recvFragment(Packet *pkt, u32 sz)
     // don't need the fragment buffer anymore
     pool.removeFragBuf(fbuf);
 
+    // A sender fragments one message at a time, so once a later one is
+    // complete the earlier ones it left partial are lost. In reliable mode
+    // their retransmits are still to come
+    if (!params.nack_window && pool.hasFragBufs())
+        pool.removeOlderFragBufs(msg->src);
+
     return msg;
 }
 
+bool UDPM::recvFragmentInPlace(Message **msg)
+{
+    MsgHeaderLong hdr;
+    struct sockaddr_in from;
+    if (recvfd.peekPacket((char*)&hdr, sizeof(hdr), &from) < (int)sizeof(hdr))
+        return false;
+
+    // Only later fragments of a message we already have a buffer for, the
+    // rest goes through recvShort() / recvFragment()
+    if (hdr.getMagic() != ZCM_MAGIC_LONG || hdr.getFragmentNo() == 0)
+        return false;
+
+    u32 data_size = hdr.getMsgSize();
+    FragBuf *fbuf = pool.lookupFragBuf(FragKey(&from, hdr.getMsgSeqno()));
+    if (!fbuf || fbuf->buf.size != data_size + fbuf->channellen+1)
+        return false;
+
+    u16 fragment_no = hdr.getFragmentNo();
+    size_t start = fbuf->channellen+1 + hdr.getFragmentOffset();
+    if (fragment_no >= fbuf->fragments_in_msg || start >= fbuf->buf.size)
+        return false;
+
+    i64 utime, recv_ns;
+    int sz = recvfd.recvPacketSplit((char*)&hdr, sizeof(hdr),
+                                    fbuf->buf.data + start, fbuf->buf.size - start,
+                                    &utime, &recv_ns);
+    if (sz < (int)sizeof(hdr)) {
+        ZCM_DEBUG("dropping invalid fragment (off: %zu / %zu)", start, fbuf->buf.size);
+        pool.removeFragBuf(fbuf);
+        return true;
+    }
+
+    noteReceived(sz);
+    udp_rx++;
+
+    *msg = fragmentArrived(fbuf, fragment_no, utime, recv_ns);
+    return true;
+}
+
 void UDPM::checkForMessageLoss()
 {
     // ISSUE-101 TODO: add this back
@@ -230,22 +698,134 @@ void UDPM::checkForMessageLoss()
     // }
 }
 
+bool UDPM::fillRxPackets(int timeout)
+{
+    // recvShort() moves the buffer of a packet into its Message
+    for (size_t i = 0; i < UDPMSocket::MAX_RECV_BATCH; i++) {
+        if (!rxPkts[i])
+            rxPkts[i] = pool.allocPacket(ZCM_MAX_UNFRAGMENTED_PACKET_SIZE);
+        else if (!rxPkts[i]->buf.data)
+            rxPkts[i]->buf = pool.allocBuffer(ZCM_MAX_UNFRAGMENTED_PACKET_SIZE);
+    }
+    rxNext = rxCount = 0;
+
+    if (params.nack_window && params.lane == 0) serviceNacks();
+
+    // Only wait on the socket when nothing is queued in the kernel already
+    int n = recvfd.recvPackets(rxPkts, UDPMSocket::MAX_RECV_BATCH);
+    if (n == 0) {
+        endBurst();
+        // wait for either incoming UDP data, or for an abort message
+        if (!recvfd.waitUntilData(timeout))
+            return false;
+        // give recvFragmentInPlace() a chance at the packet first
+        if (pool.hasFragBufs())
+            return true;
+        n = recvfd.recvPackets(rxPkts, UDPMSocket::MAX_RECV_BATCH);
+    }
+    if (n < 0) {
+        ZCM_DEBUG("udp_read_packet -- recvmmsg");
+        udp_discarded_bad++;
+        n = 0;
+    }
+    rxCount = n;
+    udp_rx += n;
+    for (int i = 0; i < n; i++)
+        noteReceived(rxPkts[i]->sz);
+    udp_kernel_drops = recvfd.getKernelDrops();
+    if (udp_kernel_drops != rx_tuned_drops) tuneRecvBuf();
+    return true;
+}
+
+void UDPM::endBurst()
+{
+    if (rx_burst > rx_burst_peak) {
+        rx_burst_peak = rx_burst;
+        tuneRecvBuf();
+    }
+    rx_burst = 0;
+}
+
+void UDPM::tuneRecvBuf()
+{
+    // Packets take about twice their size in the kernel buffer, and the next
+    // burst may well be bigger; drops mean that whatever we have is too small
+    size_t want = 4 * std::max(rx_burst_peak.load(), rx_largest_msg.load());
+    if (udp_kernel_drops != rx_tuned_drops) {
+        rx_tuned_drops = udp_kernel_drops;
+        want = std::max(want, 2 * kernel_rbuf_sz);
+    }
+    if (!params.autobuf || rx_buf_capped || want <= kernel_rbuf_sz) return;
+
+    // Grow by powers of 2, in case it keeps on growing
+    size_t size = kernel_rbuf_sz;
+    while (size < want) size *= 2;
+    size_t max = UDPMSocket::getMaxRecvBufSize();
+    if (max && size > max) size = max;
+    if (size > kernel_rbuf_sz) kernel_rbuf_sz = recvfd.setRecvBufSize(size);
+    ZCM_DEBUG("ZCM: grew the receive buffer to %zu bytes for %zu", kernel_rbuf_sz.load(), want);
+
+    if (kernel_rbuf_sz < want) {
+        rx_buf_capped = true;
+        if (!warned_about_small_kernel_buf) {
+            warned_about_small_kernel_buf = true;
+            fprintf(stderr,
+                    "==== ZCM Warning ===\n"
+                    "ZCM needs a kernel UDP receive buffer of %zu bytes, but the kernel\n"
+                    "only allows %zu. The possibility of dropping packets due to\n"
+                    "insufficient buffer space is very high. Raise net.core.rmem_max\n"
+                    "(sysctl) to at least %zu.\n",
+                    want, kernel_rbuf_sz.load(), want / 2);
+        }
+    }
+}
+
+void UDPM::sizeSendBuf()
+{
+    // Room for a whole batch of fragments, so sendPackets() hands them over in
+    // one go. Any bigger would only let us flood the receivers faster
+    size_t batch = UDPMSocket::MAX_BATCH *
+                   (params.frag_payload + sizeof(MsgHeaderLong) + ZCM_CHANNEL_MAXLEN + 1);
+    size_t want = 2 * batch;
+    if (kernel_sbuf_sz >= want) return;
+    size_t max = UDPMSocket::getMaxSendBufSize();
+    kernel_sbuf_sz = sendfd.setSendBufSize(max && want > max ? max : want);
+    ZCM_DEBUG("ZCM: send buffer is %zu bytes for %zu", kernel_sbuf_sz.load(), want);
+}
+
 // read continuously until a complete message arrives
 Message *UDPM::readMessage(int timeout)
 {
-    Packet *pkt = pool.allocPacket(ZCM_MAX_UNFRAGMENTED_PACKET_SIZE);
     UDPM::checkForMessageLoss();
+    if (selfTest) checkSelfTest();
 
     Message *msg = NULL;
     while (!msg) {
-        // // wait for either incoming UDP data, or for an abort message
-        if (!recvfd.waitUntilData(timeout))
+        if (localPending && (msg = popLocal()))
             break;
+        if (rxNext == rxCount && pool.hasFragBufs() && recvFragmentInPlace(&msg)) {
+            if (msg && !trackSeqno(msg)) {
+                pool.freeMessage(msg);
+                msg = NULL;
+            }
+            continue;
+        }
+        if (rxNext == rxCount && !fillRxPackets(timeout)) {
+            // sendLocal() wakes us up too
+            if (localPending) msg = popLocal();
+            break;
+        }
+        if (rxNext == rxCount)
+            continue;
 
-        int sz = recvfd.recvPacket(pkt);
-        if (sz < 0) {
-            ZCM_DEBUG("udp_read_packet -- recvmsg");
-            udp_discarded_bad++;
+        Packet *pkt = rxPkts[rxNext++];
+        int sz = (int)pkt->sz;
+
+        if (params.direct_loopback && isSelf(pkt->from)) {
+            // Already handed over by sendLocal(). This also shows that our
+            // packets loop back, which is all the self test checks
+            if (selfTest) selfTest->state = SelfTest::PASSED;
+            udp_self_dropped++;
             continue;
         }
 
@@ -262,18 +842,31 @@ Message *UDPM::readMessage(int timeout)
             msg = recvShort(pkt, sz);
         else if (magic == ZCM_MAGIC_LONG)
             msg = recvFragment(pkt, sz);
+        else if (magic == ZCM_MAGIC_PARITY)
+            msg = recvParity(pkt, sz);
         else {
             ZCM_DEBUG("ZCM: bad magic");
             udp_discarded_bad++;
             continue;
         }
+
+        if (msg && (!trackSeqno(msg) || (selfTest && isSelfTest(msg)))) {
+            pool.freeMessage(msg);
+            msg = NULL;
+        }
     }
 
-    pool.freePacket(pkt);
     return msg;
 }
 
 int UDPM::sendmsg(zcm_msg_t msg)
+{
+    unique_lock<mutex> lk(sendLock, std::defer_lock);
+    if (params.nack_window) lk.lock();
+    return sendOne(msg);
+}
+
+int UDPM::sendOne(const zcm_msg_t& msg)
 {
     int channel_size = strlen(msg.channel);
     if (channel_size > ZCM_CHANNEL_MAXLEN) {
@@ -281,15 +874,89 @@ int UDPM::sendmsg(zcm_msg_t msg)
         return ZCM_EINVALID;
     }
 
+    size_t payload_size = channel_size + 1 + msg.len;
+    if (payload_size > shortMessageMaxSize(params.frag_payload)) {
+        size_t nfragments = payload_size / params.frag_payload +
+            !!(payload_size % params.frag_payload);
+        if (nfragments > 65535) {
+            fprintf(stderr, "ZCM error: too much data for a single message\n");
+            return -1;
+        }
+    }
+
+    u32 seqno = msg_seqno++;
+    if (params.nack_window) rememberSent(msg, channel_size, seqno);
+    int ret = sendMessage(msg, channel_size, seqno);
+    if (ret == ZCM_EOK && params.direct_loopback) sendLocal(msg, channel_size);
+    return ret;
+}
+
+void UDPM::sendLocal(const zcm_msg_t& msg, size_t channel_size)
+{
+    {
+        unique_lock<mutex> lk(localLock);
+        if (!localAllRefs && localChannels.find(msg.channel) == localChannels.end())
+            return;
+        if (localQueue.size() >= MAX_LOCAL_QUEUE) {
+            udp_local_overflow++;
+            return;
+        }
+
+        Message *local = localPool.allocMessageEmpty();
+        local->buf = localPool.allocBuffer(channel_size + 1 + msg.len);
+        memcpy(local->buf.data, msg.channel, channel_size + 1);
+        if (msg.len) memcpy(local->buf.data + channel_size + 1, msg.buf, msg.len);
+        local->utime = utimeNow();
+        local->channel = local->buf.data;
+        local->channellen = channel_size;
+        local->data = local->buf.data + channel_size + 1;
+        local->datalen = msg.len;
+        local->local = true;
+        localQueue.push_back(local);
+        localPending = true;
+    }
+    recvfd.wakeup();
+}
+
+Message *UDPM::popLocal()
+{
+    unique_lock<mutex> lk(localLock);
+    if (localQueue.empty()) return nullptr;
+    Message *msg = localQueue.front();
+    localQueue.pop_front();
+    localPending = !localQueue.empty();
+    return msg;
+}
+
+bool UDPM::isSelf(const struct sockaddr& from) const
+{
+    if (from.sa_family != AF_INET) return false;
+    const struct sockaddr_in& in = (const struct sockaddr_in&)from;
+    if (ntohs(in.sin_port) != selfPort) return false;
+    return std::find(selfAddrs.begin(), selfAddrs.end(), in.sin_addr.s_addr) != selfAddrs.end();
+}
+
+void UDPM::freeMessage(Message *msg)
+{
+    if (!msg->local) {
+        pool.freeMessage(msg);
+        return;
+    }
+    unique_lock<mutex> lk(localLock);
+    localPool.freeMessage(msg);
+}
+
+int UDPM::sendMessage(const zcm_msg_t& msg, size_t channel_size, u32 seqno)
+{
     int payload_size = channel_size + 1 + msg.len;
-    if (payload_size <= ZCM_SHORT_MESSAGE_MAX_SIZE) {
+    if (payload_size <= (int)shortMessageMaxSize(params.frag_payload)) {
         // message is short.  send in a single packet
 
         MsgHeaderShort hdr;
         hdr.setMagic(ZCM_MAGIC_SHORT);
-        hdr.setMsgSeqno(msg_seqno);
+        hdr.setMsgSeqno(seqno);
 
-        ssize_t status = sendfd.sendBuffers(destAddr,
+        ssize_t status = sendfd.sendBuffers(destFor(msg.channel),
                               (char*)&hdr, sizeof(hdr),
                               (char*)msg.channel, channel_size+1,
                               (char*)msg.buf, msg.len);
@@ -297,7 +964,6 @@ int UDPM::sendmsg(zcm_msg_t msg)
         int packet_size = sizeof(hdr) + payload_size;
         ZCM_DEBUG("transmitting %zu byte [%s] payload (%d byte pkt)",
                   msg.len, msg.channel, packet_size);
-        msg_seqno++;
 
         return (status == packet_size) ? 0 : status;
     }
@@ -305,15 +971,10 @@ int UDPM::sendmsg(zcm_msg_t msg)
 
     else {
         // message is large.  fragment into multiple packets
-        int fragment_size = ZCM_FRAGMENT_MAX_PAYLOAD;
+        int fragment_size = params.frag_payload;
         int nfragments = payload_size / fragment_size +
             !!(payload_size % fragment_size);
 
-        if (nfragments > 65535) {
-            fprintf(stderr, "ZCM error: too much data for a single message\n");
-            return -1;
-        }
-
         // acquire transmit lock so that all fragments are transmitted
         // together, and so that no other message uses the same sequence number
         // (at least until the sequence # rolls over)
@@ -321,57 +982,584 @@ int UDPM::sendmsg(zcm_msg_t msg)
         ZCM_DEBUG("transmitting %d byte [%s] payload in %d fragments",
                   payload_size, msg.channel, nfragments);
 
-        u32 fragment_offset = 0;
-
-        MsgHeaderLong hdr;
-        hdr.magic = htonl(ZCM_MAGIC_LONG);
-        hdr.msg_seqno = htonl(msg_seqno);
-        hdr.msg_size = htonl(msg.len);
-        hdr.fragment_offset = 0;
-        hdr.fragment_no = 0;
-        hdr.fragments_in_msg = htons(nfragments);
-
         // first fragment is special.  insert channel before data
         size_t firstfrag_datasize = fragment_size - (channel_size + 1);
         assert(firstfrag_datasize <= msg.len);
 
-        int packet_size = sizeof(hdr) + (channel_size + 1) + firstfrag_datasize;
-        fragment_offset += firstfrag_datasize;
+        // Fragments go out in batches of up to MAX_BATCH packets per
+        // syscall. Each fragment carries its own header, so every packet in
+        // a batch gets its own copy. With FEC, every batch is one group of
+        // fragments led by its parity packet
+        MsgHeaderLong hdrs[UDPMSocket::MAX_BATCH];
+        struct iovec iovs[UDPMSocket::MAX_BATCH][3];
+        MsgHeaderParity phdr;
+        int perBatch = params.fec_group ? params.fec_group : (int)UDPMSocket::MAX_BATCH;
+
+        u32 fragment_offset = 0;
+        int frag_no = 0;
+        while (frag_no < nfragments) {
+            size_t npkts = 0;
+            int end = std::min(nfragments, frag_no + perBatch);
+            if (params.fec_group) {
+                sendParityOf(msg, channel_size, seqno, frag_no, end, phdr, iovs[0]);
+                npkts = 1;
+            }
+            for (; frag_no < end; frag_no++) {
+                MsgHeaderLong& hdr = hdrs[npkts];
+                hdr.magic = htonl(ZCM_MAGIC_LONG);
+                hdr.msg_seqno = htonl(seqno);
+                hdr.msg_size = htonl(msg.len);
+                hdr.fragment_offset = htonl(fragment_offset);
+                hdr.fragment_no = htons(frag_no);
+                hdr.fragments_in_msg = htons(nfragments);
+
+                iovs[npkts][0].iov_base = (char*)&hdr;
+                iovs[npkts][0].iov_len = sizeof(hdr);
+                size_t fraglen;
+                if (frag_no == 0) {
+                    fraglen = firstfrag_datasize;
+                    iovs[npkts][1].iov_base = (char*)msg.channel;
+                    iovs[npkts][1].iov_len = channel_size + 1;
+                } else {
+                    fraglen = std::min((size_t)fragment_size,
+                                       (size_t)msg.len - fragment_offset);
+                    iovs[npkts][1].iov_base = NULL;
+                    iovs[npkts][1].iov_len = 0;
+                }
+                iovs[npkts][2].iov_base = (char*)(msg.buf + fragment_offset);
+                iovs[npkts][2].iov_len = fraglen;
+
+                fragment_offset += fraglen;
+                npkts++;
+            }
+
+            size_t sent = sendfd.sendPackets(destFor(msg.channel), iovs, npkts);
+            if (sent != npkts) {
+                ZCM_DEBUG("only %zu of %zu packets of [%s] were sent",
+                          sent, npkts, msg.channel);
+                break;
+            }
+
+            // Let short urgent messages through before the next batch
+            zcm_msg_t urgent;
+            size_t maxlen = shortMessageMaxSize(params.frag_payload) - (ZCM_CHANNEL_MAXLEN + 1);
+            while (interleave && !params.nack_window && frag_no < nfragments &&
+                   interleave(interleaveUsr, maxlen, &urgent)) {
+                if (sendOne(urgent) != ZCM_EOK)
+                    ZCM_DEBUG("failed to send [%s] between fragments", urgent.channel);
+            }
+        }
+
+        // sanity check
+        if (frag_no == nfragments) {
+            assert(fragment_offset == msg.len);
+        }
+    }
+
+    return 0;
+}
+
+int UDPM::sendmsgIov(const zcm_msg_t& msg, const zcm_iov_t *iov, size_t niov)
+{
+    unique_lock<mutex> lk(sendLock, std::defer_lock);
+    if (params.nack_window) lk.lock();
+
+    size_t channel_size = strlen(msg.channel);
+    size_t payload_size = channel_size + 1 + msg.len;
+
+    // A short message is a single packet anyway, and resends, parity packets
+    // and local copies are made from the message in one piece
+    if (channel_size > ZCM_CHANNEL_MAXLEN ||
+        payload_size <= shortMessageMaxSize(params.frag_payload) ||
+        params.nack_window || params.fec_group || params.direct_loopback) {
+        static thread_local vector<u8> gathered;
+        gathered.resize(msg.len);
+        u8 *p = gathered.data();
+        for (size_t i = 0; i < niov; i++) {
+            if (iov[i].len) memcpy(p, iov[i].base, iov[i].len);
+            p += iov[i].len;
+        }
+        zcm_msg_t whole = msg;
+        whole.buf = gathered.data();
+        return sendOne(whole);
+    }
+
+    size_t nfragments = payload_size / params.frag_payload +
+        !!(payload_size % params.frag_payload);
+    if (nfragments > 65535) {
+        fprintf(stderr, "ZCM error: too much data for a single message\n");
+        return -1;
+    }
 
-        ssize_t status = sendfd.sendBuffers(destAddr,
-                                            (char*)&hdr, sizeof(hdr),
-                                            (char*)msg.channel, channel_size+1,
-                                            (char*)msg.buf, firstfrag_datasize);
+    return sendFragmentsIov(msg, channel_size, msg_seqno++, iov, niov);
+}
 
-        // transmit the rest of the fragments
-        for (u16 frag_no = 1; packet_size == status && frag_no < nfragments; frag_no++) {
+int UDPM::sendFragmentsIov(const zcm_msg_t& msg, size_t channel_size, u32 seqno,
+                           const zcm_iov_t *iov, size_t niov)
+{
+    size_t fragment_size = params.frag_payload;
+    size_t payload_size = channel_size + 1 + msg.len;
+    int nfragments = payload_size / fragment_size + !!(payload_size % fragment_size);
+    size_t firstfrag_datasize = fragment_size - (channel_size + 1);
+
+    ZCM_DEBUG("transmitting %zu byte [%s] payload in %d fragments from %zu pieces",
+              payload_size, msg.channel, nfragments, niov);
+
+    // As in sendMessage(), except that a fragment points at the pieces it
+    // spans. One that spans too many of them is copied together instead
+    MsgHeaderLong hdrs[UDPMSocket::MAX_BATCH];
+    struct iovec iovs[UDPMSocket::MAX_BATCH][UDPMSocket::MAX_PACKET_IOV];
+    size_t niovs[UDPMSocket::MAX_BATCH];
+    static thread_local vector<char> bounce;
+
+    size_t piece = 0, pieceOffset = 0;
+    u32 fragment_offset = 0;
+    int frag_no = 0;
+    while (frag_no < nfragments) {
+        size_t npkts = 0;
+        int end = std::min(nfragments, frag_no + (int)UDPMSocket::MAX_BATCH);
+        for (; frag_no < end; frag_no++) {
+            MsgHeaderLong& hdr = hdrs[npkts];
+            hdr.magic = htonl(ZCM_MAGIC_LONG);
+            hdr.msg_seqno = htonl(seqno);
+            hdr.msg_size = htonl(msg.len);
             hdr.fragment_offset = htonl(fragment_offset);
             hdr.fragment_no = htons(frag_no);
-
-            int fraglen = std::min(fragment_size, (int)msg.len - (int)fragment_offset);
-            status = sendfd.sendBuffers(destAddr,
-                                        (char*)&hdr, sizeof(hdr),
-                                        (char*)(msg.buf + fragment_offset), fraglen);
+            hdr.fragments_in_msg = htons(nfragments);
+
+            struct iovec *pkt = iovs[npkts];
+            size_t n = 0;
+            pkt[n].iov_base = (char*)&hdr;
+            pkt[n++].iov_len = sizeof(hdr);
+            size_t fraglen;
+            if (frag_no == 0) {
+                fraglen = firstfrag_datasize;
+                pkt[n].iov_base = (char*)msg.channel;
+                pkt[n++].iov_len = channel_size + 1;
+            } else {
+                fraglen = std::min(fragment_size, (size_t)msg.len - fragment_offset);
+            }
+
+            size_t first = n, startPiece = piece, startOffset = pieceOffset;
+            size_t left = fraglen;
+            while (left > 0 && n < UDPMSocket::MAX_PACKET_IOV) {
+                size_t take = std::min(left, (size_t)iov[piece].len - pieceOffset);
+                if (take > 0) {
+                    pkt[n].iov_base = (char*)iov[piece].base + pieceOffset;
+                    pkt[n++].iov_len = take;
+                }
+                left -= take;
+                pieceOffset += take;
+                if (pieceOffset == iov[piece].len) {
+                    piece++;
+                    pieceOffset = 0;
+                }
+            }
+            if (left > 0) {
+                bounce.resize(UDPMSocket::MAX_BATCH * fragment_size);
+                char *dst = bounce.data() + npkts * fragment_size;
+                piece = startPiece;
+                pieceOffset = startOffset;
+                for (left = fraglen; left > 0;) {
+                    size_t take = std::min(left, (size_t)iov[piece].len - pieceOffset);
+                    memcpy(dst + (fraglen - left), (const char*)iov[piece].base + pieceOffset, take);
+                    left -= take;
+                    pieceOffset += take;
+                    if (pieceOffset == iov[piece].len) {
+                        piece++;
+                        pieceOffset = 0;
+                    }
+                }
+                n = first;
+                pkt[n].iov_base = dst;
+                pkt[n++].iov_len = fraglen;
+            }
+            niovs[npkts] = n;
 
             fragment_offset += fraglen;
-            packet_size = sizeof(hdr) + fraglen;
+            npkts++;
         }
 
-        // sanity check
-        if (0 == status) {
-            assert(fragment_offset == msg.len);
+        size_t sent = sendfd.sendPackets(destFor(msg.channel), iovs, niovs, npkts);
+        if (sent != npkts) {
+            ZCM_DEBUG("only %zu of %zu packets of [%s] were sent",
+                      sent, npkts, msg.channel);
+            break;
         }
 
-        msg_seqno++;
+        // Let short urgent messages through before the next batch
+        zcm_msg_t urgent;
+        size_t maxlen = shortMessageMaxSize(params.frag_payload) - (ZCM_CHANNEL_MAXLEN + 1);
+        while (interleave && frag_no < nfragments &&
+               interleave(interleaveUsr, maxlen, &urgent)) {
+            if (sendOne(urgent) != ZCM_EOK)
+                ZCM_DEBUG("failed to send [%s] between fragments", urgent.channel);
+        }
     }
 
     return 0;
 }
 
+void UDPM::sendParityOf(const zcm_msg_t& msg, size_t channel_size, u32 seqno,
+                        int first, int end, MsgHeaderParity& hdr, struct iovec (&iov)[3])
+{
+    // Fragment i covers bytes [i * fragment_size, (i+1) * fragment_size) of
+    // the stream made by the channel, its NULL and then the data
+    size_t fragment_size = params.frag_payload;
+    size_t chan_len = channel_size + 1;
+    size_t payload_size = chan_len + msg.len;
+
+    parityBuf.assign(fragment_size, 0);
+    for (int i = first; i < end; i++) {
+        size_t pos = i * fragment_size;
+        size_t len = std::min(fragment_size, payload_size - pos);
+        char *dst = parityBuf.data();
+        if (pos < chan_len) {
+            size_t n = std::min(len, chan_len - pos);
+            xorBytes(dst, msg.channel + pos, n);
+            dst += n;
+            pos += n;
+            len -= n;
+        }
+        xorBytes(dst, (const char*)msg.buf + (pos - chan_len), len);
+    }
+
+    hdr.magic = htonl(ZCM_MAGIC_PARITY);
+    hdr.msg_seqno = htonl(seqno);
+    hdr.msg_size = htonl(msg.len);
+    hdr.payload_size = htonl(payload_size);
+    hdr.first_fragment = htons(first);
+    hdr.group_size = htons(params.fec_group);
+
+    iov[0].iov_base = (char*)&hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = parityBuf.data();
+    iov[1].iov_len = parityBuf.size();
+    iov[2].iov_base = NULL;
+    iov[2].iov_len = 0;
+}
+
+int UDPM::sendmsgBatch(const zcm_msg_t *msgs, size_t nmsgs)
+{
+    unique_lock<mutex> lk(sendLock, std::defer_lock);
+    if (params.nack_window) lk.lock();
+
+    int ret = ZCM_EOK;
+    size_t i = 0;
+    while (i < nmsgs) {
+        // Runs of short messages go out in as few syscalls as possible,
+        // fragmented messages are sent one at a time by sendOne()
+        // A batch goes to a single address, so with several groups a run
+        // also ends where the group changes
+        MsgHeaderShort hdrs[UDPMSocket::MAX_BATCH];
+        struct iovec iovs[UDPMSocket::MAX_BATCH][3];
+        size_t npkts = 0;
+        const UDPMAddress *dest = nullptr;
+        for (; i < nmsgs && npkts < UDPMSocket::MAX_BATCH; i++) {
+            const zcm_msg_t& msg = msgs[i];
+            size_t channel_size = strlen(msg.channel);
+            if (channel_size > ZCM_CHANNEL_MAXLEN ||
+                channel_size + 1 + msg.len > shortMessageMaxSize(params.frag_payload))
+                break;
+            const UDPMAddress *msgDest = &destFor(msg.channel);
+            if (dest && msgDest != dest) break;
+            dest = msgDest;
+
+            MsgHeaderShort& hdr = hdrs[npkts];
+            hdr.setMagic(ZCM_MAGIC_SHORT);
+            hdr.setMsgSeqno(msg_seqno);
+            if (params.nack_window) rememberSent(msg, channel_size, msg_seqno);
+            msg_seqno++;
+
+            iovs[npkts][0].iov_base = (char*)&hdr;
+            iovs[npkts][0].iov_len = sizeof(hdr);
+            iovs[npkts][1].iov_base = (char*)msg.channel;
+            iovs[npkts][1].iov_len = channel_size + 1;
+            iovs[npkts][2].iov_base = (char*)msg.buf;
+            iovs[npkts][2].iov_len = msg.len;
+            npkts++;
+        }
+
+        if (npkts > 0) {
+            ZCM_DEBUG("transmitting %zu short messages in one batch", npkts);
+            size_t sent = sendfd.sendPackets(*dest, iovs, npkts);
+            if (sent != npkts && ret == ZCM_EOK) ret = ZCM_EUNKNOWN;
+            if (params.direct_loopback)
+                for (size_t p = 0; p < sent; p++)
+                    sendLocal(msgs[i - npkts + p], iovs[p][1].iov_len - 1);
+        }
+
+        // The run ended on a message that isn't short
+        if (i < nmsgs && npkts < UDPMSocket::MAX_BATCH &&
+            (npkts == 0 || &destFor(msgs[i].channel) == dest)) {
+            int rc = sendOne(msgs[i++]);
+            if (rc != ZCM_EOK && ret == ZCM_EOK) ret = rc;
+        }
+    }
+    return ret;
+}
+
+void UDPM::rememberSent(const zcm_msg_t& msg, size_t channel_size, u32 seqno)
+{
+    SentMsg& sent = sentRing[seqno % sentRing.size()];
+    size_t sz = channel_size + 1 + msg.len;
+    if (sent.buf.data && sent.buf.size < sz) sentPool.freeBuffer(sent.buf);
+    if (!sent.buf.data) sent.buf = sentPool.allocBuffer(sz);
+
+    memcpy(sent.buf.data, msg.channel, channel_size + 1);
+    memcpy(sent.buf.data + channel_size + 1, msg.buf, msg.len);
+    sent.msg_seqno = seqno;
+    sent.channellen = channel_size;
+    sent.len = msg.len;
+    sent.last_resend_utime = 0;
+}
+
+void UDPM::resend(u32 seqno)
+{
+    unique_lock<mutex> lk(sendLock);
+
+    // Not sent yet, or already overwritten by a newer message
+    SentMsg& sent = sentRing[seqno % sentRing.size()];
+    if (!sent.buf.data || sent.msg_seqno != seqno || msg_seqno - seqno > sentRing.size())
+        return;
+
+    // Every receiver that missed it NACKs, but one retransmit reaches all
+    i64 now = utimeNow();
+    if (now - sent.last_resend_utime < NACK_RETRY_US / 2)
+        return;
+    sent.last_resend_utime = now;
+
+    zcm_msg_t msg;
+    msg.utime = 0;
+    msg.channel = sent.buf.data;
+    msg.len = sent.len;
+    msg.buf = (uint8_t*)sent.buf.data + sent.channellen + 1;
+    msg.chan_hash = 0;
+    ZCM_DEBUG("retransmitting msg_seqno %u [%s]", seqno, msg.channel);
+    sendMessage(msg, sent.channellen, seqno);
+    udp_retransmitted++;
+}
+
+void UDPM::serviceNacks()
+{
+    // NACKs are unicast to the socket our messages come from
+    MsgHeaderNack nack;
+    struct sockaddr_in from;
+    int sz;
+    while ((sz = sendfd.recvDatagram((char*)&nack, sizeof(nack), &from)) != 0) {
+        if (sz != (int)sizeof(nack) || nack.getMagic() != ZCM_MAGIC_NACK) {
+            udp_discarded_bad++;
+            if (sz < 0) break;
+            continue;
+        }
+        u32 first = nack.getFirstSeqno();
+        u32 count = std::min(nack.getCount(), (u32)sentRing.size());
+        for (u32 i = 0; i < count; i++)
+            resend(first + i);
+    }
+}
+
+bool UDPM::trackSeqno(Message *msg)
+{
+    msg->chan_hash = zcm_channel_hash(msg->channel);
+
+    u64 peerKey = (u64)msg->src.addr << 16 | msg->src.port;
+    u32 seqno = msg->src.msg_seqno;
+    bool late = false;
+
+    unique_lock<mutex> lk(statsLock);
+    auto it = peers.find(peerKey);
+    if (it == peers.end()) {
+        it = peers.emplace(peerKey, PeerSeqnos{}).first;
+        it->second.restart(seqno);
+    } else if (params.groups == 1) {
+        // Receivers only see the groups they joined, so with several groups
+        // msg_seqnos skip for reasons other than loss
+        PeerSeqnos& peer = it->second;
+        i32 ahead = (i32)(seqno - peer.next);
+        if (ahead >= 0) {
+            // Newest message so far, anything in between is missing
+            u32 shift = (u32)ahead + 1;
+            peer.received = shift >= 64 ? 0 : peer.received << shift;
+            peer.received |= 1;
+            peer.known = std::min((u32)NACK_TRACKED_SEQNOS, peer.known + shift);
+            peer.next = seqno + 1;
+            peer.missing += ahead;
+            if (ahead > 0) peer.last_nack_utime = 0;
+        } else {
+            u32 age = (u32)(-ahead) - 1;
+            if (age >= peer.known) {
+                // Too old to tell, most likely the sender restarted
+                peer.restart(seqno);
+            } else if ((peer.received >> age) & 1) {
+                peer.duplicates++;
+                udp_duplicates++;
+                return !params.nack_window;
+            } else {
+                peer.received |= (u64)1 << age;
+                peer.missing--;
+                peer.reordered++;
+                late = true;
+            }
+        }
+    }
+    PeerSeqnos& peer = it->second;
+    peer.msgs++;
+
+    // Hash collisions between channels move on to the next slot
+    u32 slot = msg->chan_hash;
+    auto chan = peer.channels.find(slot);
+    while (chan != peer.channels.end() && chan->second.name != msg->channel)
+        chan = peer.channels.find(++slot);
+    if (chan == peer.channels.end()) {
+        chan = peer.channels.emplace(slot, ChannelStats{}).first;
+        chan->second.name = msg->channel;
+    }
+    chan->second.msgs++;
+    if (late) chan->second.reordered++;
+
+    if (!params.nack_window)
+        return true;
+
+    u64 knownMask = peer.known >= 64 ? ~(u64)0 : ((u64)1 << peer.known) - 1;
+    if (~peer.received & knownMask) {
+        i64 now = utimeNow();
+        if (now - peer.last_nack_utime >= NACK_RETRY_US) {
+            peer.last_nack_utime = now;
+            sendNacks(msg->src, peer);
+        }
+    }
+    return true;
+}
+
+int UDPM::getStats(zcm_stat_handler_t cb, void *usr)
+{
+    // Gather everything first, so 'cb' never runs while the recv thread waits
+    vector<std::pair<string, u64>> stats = {
+        {"udpm.rx_packets",       udp_rx},
+        {"udpm.discarded_bad",    udp_discarded_bad},
+        {"udpm.kernel_drops",     udp_kernel_drops},
+        {"udpm.frag_timeouts",    pool.numEvicted()},
+        {"udpm.frag_evicted_bytes", pool.numEvictedBytes()},
+        {"udpm.frag_bufs",        pool.numFragBufs()},
+        {"udpm.frag_bytes",       pool.fragBufsSize()},
+        {"udpm.fec_recovered",    udp_fec_recovered},
+        {"udpm.duplicates",       udp_duplicates},
+        {"udpm.retransmitted",    udp_retransmitted},
+        // The kernel buffers in effect, and what autobuf sized them by
+        {"udpm.kernel_rbuf",      kernel_rbuf_sz},
+        {"udpm.kernel_rbuf_max",  UDPMSocket::getMaxRecvBufSize()},
+        {"udpm.rx_burst_peak",    rx_burst_peak},
+        {"udpm.rx_largest_msg",   rx_largest_msg},
+    };
+    if (params.lane == 0) {
+        stats.emplace_back("udpm.kernel_sbuf", kernel_sbuf_sz);
+        stats.emplace_back("udpm.kernel_sbuf_max", UDPMSocket::getMaxSendBufSize());
+    }
+    // 0 while the self test waits for its message, then 1 if it passed or 2 if it failed
+    if (selfTest && params.lane == 0)
+        stats.emplace_back("udpm.selftest", selfTest->state.load());
+    if (params.direct_loopback) {
+        stats.emplace_back("udpm.self_dropped", udp_self_dropped);
+        stats.emplace_back("udpm.local_overflow", udp_local_overflow);
+    }
+    {
+        unique_lock<mutex> lk(statsLock);
+        for (auto& elt : peers) {
+            struct in_addr addr;
+            addr.s_addr = (u32)(elt.first >> 16);
+            string prefix = string("udpm.sender.") + inet_ntoa(addr) + ":" +
+                            std::to_string(ntohs((u16)elt.first)) + ".";
+            const PeerSeqnos& peer = elt.second;
+            stats.emplace_back(prefix + "msgs", peer.msgs);
+            stats.emplace_back(prefix + "missing", peer.missing);
+            stats.emplace_back(prefix + "reordered", peer.reordered);
+            stats.emplace_back(prefix + "duplicates", peer.duplicates);
+            for (auto& chan : peer.channels) {
+                string cprefix = prefix + "channel." + chan.second.name + ".";
+                stats.emplace_back(cprefix + "msgs", chan.second.msgs);
+                stats.emplace_back(cprefix + "reordered", chan.second.reordered);
+            }
+        }
+    }
+
+    for (auto& stat : stats)
+        cb(stat.first.c_str(), stat.second, usr);
+    return ZCM_EOK;
+}
+
+void UDPM::sendNacks(const FragKey& src, PeerSeqnos& peer)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = src.addr;
+    addr.sin_port = src.port;
+    UDPMAddress dest(addr);
+
+    // One NACK per run of missing msg_seqnos, oldest first
+    for (i32 age = (i32)peer.known - 1; age >= 0; age--) {
+        if ((peer.received >> age) & 1) continue;
+        i32 end = age;
+        while (end > 0 && !((peer.received >> (end - 1)) & 1)) end--;
+
+        MsgHeaderNack nack;
+        nack.magic = htonl(ZCM_MAGIC_NACK);
+        nack.first_seqno = htonl(peer.next - 1 - age);
+        nack.count = htonl(age - end + 1);
+        ZCM_DEBUG("NACKing %d msgs from msg_seqno %u", age - end + 1, peer.next - 1 - age);
+        recvfd.sendBuffers(dest, (char*)&nack, sizeof(nack));
+        age = end;
+    }
+}
+
+int UDPM::recvmsgEnable(const char *channel, bool enable)
+{
+    if (params.direct_loopback) {
+        unique_lock<mutex> lk(localLock);
+        if (!channel) {
+            if (enable) localAllRefs++;
+            else if (localAllRefs) localAllRefs--;
+        } else if (enable) {
+            localChannels[channel]++;
+        } else {
+            auto it = localChannels.find(channel);
+            if (it != localChannels.end() && --it->second == 0) localChannels.erase(it);
+        }
+    }
+
+    if (params.groups == 1) return ZCM_EOK;
+
+    unique_lock<mutex> lk(groupLock);
+    bool ok = true;
+    if (!channel) {
+        // Regex subscriptions could match channels of any group
+        if (!enable && allRefs == 0) return ZCM_EINVALID;
+        u32 before = allRefs;
+        allRefs += enable ? 1 : -1;
+        for (size_t g = 0; g < groupAddrs.size(); g++)
+            ok &= setGroupJoined(g, before || groupRefs[g], allRefs || groupRefs[g]);
+    } else {
+        size_t g = zcm_channel_hash(channel) % params.groups;
+        if (!enable && groupRefs[g] == 0) return ZCM_EINVALID;
+        u32 before = groupRefs[g];
+        groupRefs[g] += enable ? 1 : -1;
+        ok = setGroupJoined(g, allRefs || before, allRefs || groupRefs[g]);
+    }
+    return ok ? ZCM_EOK : ZCM_EUNKNOWN;
+}
+
+bool UDPM::setGroupJoined(size_t group, bool wasJoined, bool joined)
+{
+    if (wasJoined == joined) return true;
+    struct in_addr addr = ((struct sockaddr_in*)groupAddrs[group].getAddrPtr())->sin_addr;
+    return joined ? recvfd.joinMulticastGroup(addr) : recvfd.leaveMulticastGroup(addr);
+}
+
 int UDPM::recvmsg(zcm_msg_t *msg, int timeout)
 {
     if (m)
-        pool.freeMessage(m);
+        freeMessage(m);
 
     m = readMessage(timeout);
     if (m == nullptr)
@@ -381,13 +1569,58 @@ int UDPM::recvmsg(zcm_msg_t *msg, int timeout)
     msg->channel = m->channel;
     msg->len = m->datalen;
     msg->buf = (uint8_t*) m->data;
+    msg->chan_hash = m->chan_hash;
+    msg->recv_ns = m->recv_ns;
 
     return ZCM_EOK;
 }
 
+int UDPM::recvmsgClaim(zcm_msg_t *msg, int timeout, void **token)
+{
+    freeReleased();
+
+    Message *claimed = readMessage(timeout);
+    if (claimed == nullptr)
+        return ZCM_EAGAIN;
+
+    msg->utime = claimed->utime;
+    msg->channel = claimed->channel;
+    msg->len = claimed->datalen;
+    msg->buf = (uint8_t*) claimed->data;
+    msg->chan_hash = claimed->chan_hash;
+    msg->recv_ns = claimed->recv_ns;
+    claimed->lane = params.lane;
+    *token = claimed;
+
+    return ZCM_EOK;
+}
+
+void UDPM::recvmsgRelease(void *token)
+{
+    unique_lock<mutex> lk(releasedLock);
+    released.push_back((Message*) token);
+}
+
+void UDPM::freeReleased()
+{
+    unique_lock<mutex> lk(releasedLock);
+    for (Message *msg : released)
+        freeMessage(msg);
+    released.clear();
+}
+
 UDPM::~UDPM()
 {
     ZCM_DEBUG("closing zcm context");
+    freeReleased();
+    if (m)
+        freeMessage(m);
+    for (Message *msg : localQueue)
+        freeMessage(msg);
+    for (Packet *pkt : rxPkts)
+        if (pkt) pool.freePacket(pkt);
+    for (SentMsg& sent : sentRing)
+        sentPool.freeBuffer(sent.buf);
 }
 
 UDPM::UDPM(const string& ip, u16 port, size_t recv_buf_size, u8 ttl)
@@ -402,39 +1635,269 @@ bool UDPM::init()
     ZCM_DEBUG("Multicast %s:%d", params.ip.c_str(), params.port);
     UDPMSocket::checkConnection(params.ip, params.port);
 
-    sendfd = UDPMSocket::createSendSocket(params.addr, params.ttl);
-    if (!sendfd.isOpen()) return false;
-    kernel_sbuf_sz = sendfd.getSendBufSize();
+    // The other lanes only receive, see UDPMLanes
+    if (params.lane == 0) {
+        sendfd = UDPMSocket::createSendSocket(params.addr, params.ttl, !params.no_loopback);
+        if (!sendfd.isOpen()) return false;
+        kernel_sbuf_sz = sendfd.getSendBufSize();
+        if (params.autobuf) sizeSendBuf();
+    }
+
+    if (params.direct_loopback && params.lane == 0) {
+        // Pin down the address our packets come from, to know them when they loop back
+        if (!sendfd.bindPort(0)) return false;
+        selfPort = sendfd.getLocalPort();
+        for (const struct in_addr& addr : UDPMSocket::getLocalAddrs())
+            selfAddrs.push_back(addr.s_addr);
+        if (selfPort == 0 || selfAddrs.empty()) {
+            ZCM_DEBUG("ERROR: unable to find the local address for loopback=direct");
+            return false;
+        }
+    }
 
-    recvfd = UDPMSocket::createRecvSocket(params.addr, params.port);
+    recvfd = UDPMSocket::createRecvSocket(params.addr, params.port, params.groups == 1);
     if (!recvfd.isOpen()) return false;
+    for (u16 g = 0; g < params.groups && params.groups > 1; g++) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(ntohl(params.addr.s_addr) + g);
+        addr.sin_port = htons(params.port);
+        groupAddrs.emplace_back(addr);
+    }
+    groupRefs.resize(params.groups);
     kernel_rbuf_sz = recvfd.getRecvBufSize();
+    pool.setFragLimits(params.frag_mem, params.frag_bufs, params.frag_eviction);
+    pool.setHugePages(params.huge_pages);
+    if (params.busy_poll_us) recvfd.setBusyPoll(params.busy_poll_us);
+    if (params.hw_timestamps && !recvfd.enableHardwareTimestamps()) return false;
+    if (params.lanes > 1 && !recvfd.setLaneFilter(params.lane, params.lanes)) return false;
+
+    if (params.nack_window && params.lane == 0) {
+        // NACKs arrive on the send socket, but are served by the recv thread
+        if (!recvfd.alsoWaitFor(sendfd)) return false;
+        sentRing.resize(params.nack_window);
+    }
 
-    if (!this->selftest()) {
-        // self test failed.  destroy the read thread
-        fprintf(stderr, "ZCM self test failed!!\n"
-                "Check your routing and firewall settings\n");
-        return false;
+    if (params.selftest && params.lane == 0) {
+        selfTest.reset(new SelfTest());
+        selfTest->deadline = utimeNow() + SELFTEST_TIMEOUT_US;
+        selfTest->nonce = (u64)utimeNow() ^ ((u64)(uintptr_t)this << 16);
     }
 
     return true;
 }
 
-bool UDPM::selftest()
+bool UDPM::startSelfTest()
 {
-#ifdef ENABLE_SELFTEST
     ZCM_DEBUG("UDPM conducting self test");
-    assert(0 && "unimpl");
-#endif
+
+    // Join the group of the channel without subscribing to it, which would
+    // hand it to the direct loopback
+    if (params.groups > 1) {
+        unique_lock<mutex> lk(groupLock);
+        size_t g = zcm_channel_hash(SELF_TEST_CHANNEL) % params.groups;
+        if (!setGroupJoined(g, allRefs || groupRefs[g], true)) return false;
+        groupRefs[g]++;
+    }
+
+    zcm_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.channel = SELF_TEST_CHANNEL;
+    msg.len = sizeof(selfTest->nonce);
+    msg.buf = (uint8_t*)&selfTest->nonce;
+    return sendmsg(msg) == ZCM_EOK;
+}
+
+bool UDPM::isSelfTest(const Message *msg)
+{
+    if (msg->datalen != sizeof(selfTest->nonce) || strcmp(msg->channel, SELF_TEST_CHANNEL) != 0 ||
+        memcmp(msg->data, &selfTest->nonce, sizeof(selfTest->nonce)) != 0)
+        return false;
+    selfTest->state = SelfTest::PASSED;
     return true;
 }
 
+void UDPM::checkSelfTest()
+{
+    if (selfTest->state != SelfTest::WAITING || utimeNow() < selfTest->deadline) return;
+
+    u32 waiting = SelfTest::WAITING;
+    if (selfTest->state.compare_exchange_strong(waiting, SelfTest::FAILED))
+        fprintf(stderr, "ZCM self test failed!!\n"
+                "Check your routing and firewall settings\n");
+}
+
+// The receive side of the "lanes" url option: 'first' (which also does all
+// the sending) and the other lanes each run in their own thread, and push the
+// messages they claim into one queue for recvmsg(). The kernel delivers every
+// multicast packet to every socket bound to the port, SO_REUSEPORT or not, so
+// it is a socket filter on each lane that picks its senders (see
+// UDPMSocket::setLaneFilter()).
+struct UDPMLanes
+{
+    UDPM& first;
+    vector<unique_ptr<UDPM>> others;
+    vector<std::thread> threads;
+
+    struct LaneMsg
+    {
+        zcm_msg_t msg;
+        void*     token;
+    };
+    mutex              queueLock;
+    condition_variable queueCond;
+    std::deque<LaneMsg> queue;
+    bool               woken = false;
+    std::atomic<bool>  running {true};
+    void*              current = nullptr; // the last message handed out by recvmsg()
+
+    UDPMLanes(UDPM& first) : first(first) {}
+    ~UDPMLanes();
+    bool init();
+
+    UDPM& lane(u16 i) { return i == 0 ? first : *others[i - 1]; }
+    void run(UDPM *udpm);
+
+    int recvmsgEnable(const char *channel, bool enable);
+    int recvmsg(zcm_msg_t *msg, int timeout);
+    int recvmsgClaim(zcm_msg_t *msg, int timeout, void **token);
+    void recvmsgRelease(void *token);
+    void recvmsgWakeup();
+    int getStats(zcm_stat_handler_t cb, void *usr);
+};
+
+bool UDPMLanes::init()
+{
+    const Params& p = first.params;
+    for (u16 i = 1; i < p.lanes; i++) {
+        UDPM *udpm = new UDPM(p.ip, p.port, p.recv_buf_size, p.ttl);
+        others.emplace_back(udpm);
+        udpm->params = p;
+        udpm->params.lane = i;
+        // To know the packets of 'first' when they loop back
+        udpm->selfPort = first.selfPort;
+        udpm->selfAddrs = first.selfAddrs;
+        udpm->selfTest = first.selfTest;
+        if (!udpm->init()) return false;
+    }
+    for (u16 i = 0; i < p.lanes; i++)
+        threads.emplace_back(&UDPMLanes::run, this, &lane(i));
+    return true;
+}
+
+UDPMLanes::~UDPMLanes()
+{
+    running = false;
+    {
+        unique_lock<mutex> lk(queueLock);
+        queueCond.notify_all();
+    }
+    for (u16 i = 0; i < threads.size(); i++) lane(i).recvmsgWakeup();
+    for (auto& t : threads) t.join();
+
+    if (current) recvmsgRelease(current);
+    for (LaneMsg& lm : queue) recvmsgRelease(lm.token);
+}
+
+void UDPMLanes::run(UDPM *udpm)
+{
+    while (running) {
+        LaneMsg lm;
+        if (udpm->recvmsgClaim(&lm.msg, 100, &lm.token) != ZCM_EOK) continue;
+
+        unique_lock<mutex> lk(queueLock);
+        queueCond.wait(lk, [&](){ return !running || queue.size() < MAX_LANE_QUEUE; });
+        if (!running) {
+            udpm->recvmsgRelease(lm.token);
+            break;
+        }
+        queue.push_back(lm);
+        queueCond.notify_all();
+    }
+}
+
+int UDPMLanes::recvmsgEnable(const char *channel, bool enable)
+{
+    // Every lane joins the groups on its own socket
+    int ret = ZCM_EOK;
+    for (u16 i = 0; i < first.params.lanes; i++) {
+        int rc = lane(i).recvmsgEnable(channel, enable);
+        if (rc != ZCM_EOK) ret = rc;
+    }
+    return ret;
+}
+
+int UDPMLanes::recvmsg(zcm_msg_t *msg, int timeout)
+{
+    if (current) {
+        recvmsgRelease(current);
+        current = nullptr;
+    }
+    return recvmsgClaim(msg, timeout, &current);
+}
+
+int UDPMLanes::recvmsgClaim(zcm_msg_t *msg, int timeout, void **token)
+{
+    unique_lock<mutex> lk(queueLock);
+    auto ready = [&](){ return woken || !queue.empty(); };
+    if (timeout < 0) queueCond.wait(lk, ready);
+    else queueCond.wait_for(lk, std::chrono::milliseconds(timeout), ready);
+    woken = false;
+    if (queue.empty()) return ZCM_EAGAIN;
+
+    *msg = queue.front().msg;
+    *token = queue.front().token;
+    queue.pop_front();
+    queueCond.notify_all();
+    return ZCM_EOK;
+}
+
+void UDPMLanes::recvmsgRelease(void *token)
+{
+    lane(((Message*)token)->lane).recvmsgRelease(token);
+}
+
+void UDPMLanes::recvmsgWakeup()
+{
+    unique_lock<mutex> lk(queueLock);
+    woken = true;
+    queueCond.notify_all();
+}
+
+int UDPMLanes::getStats(zcm_stat_handler_t cb, void *usr)
+{
+    first.getStats(cb, usr);
+
+    // The counters of the other lanes come as "udpm.lane<i>.<name>"
+    struct Prefixed
+    {
+        string prefix;
+        zcm_stat_handler_t cb;
+        void *usr;
+        static void handler(const char *name, uint64_t value, void *usr)
+        {
+            Prefixed *p = (Prefixed*)usr;
+            string n = name;
+            if (n.compare(0, 5, "udpm.") == 0) n = n.substr(5);
+            p->cb((p->prefix + n).c_str(), value, p->usr);
+        }
+    };
+    for (u16 i = 1; i < first.params.lanes; i++) {
+        Prefixed p {"udpm.lane" + std::to_string(i) + ".", cb, usr};
+        lane(i).getStats(Prefixed::handler, &p);
+    }
+    return ZCM_EOK;
+}
+
 // Define this the class name you want
 #define ZCM_TRANS_CLASSNAME TransportUDPM
 
 struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
 {
     UDPM udpm;
+    // Takes over receiving when there are several lanes
+    unique_ptr<UDPMLanes> lanes;
 
     ZCM_TRANS_CLASSNAME(const string& ip, u16 port, size_t recv_buf_size, u8 ttl)
         : udpm(ip, port, recv_buf_size, ttl)
@@ -443,7 +1906,16 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
         vtbl = &methods;
     }
 
-    bool init() { return udpm.init(); }
+    bool init()
+    {
+        if (!udpm.init()) return false;
+        if (udpm.params.lanes > 1) {
+            lanes.reset(new UDPMLanes(udpm));
+            if (!lanes->init()) return false;
+        }
+        if (udpm.params.selftest && !udpm.startSelfTest()) return false;
+        return true;
+    }
 
     /********************** STATICS **********************/
     static zcm_trans_methods_t methods;
@@ -459,11 +1931,54 @@ struct ZCM_TRANS_CLASSNAME : public zcm_trans_t
     static int _sendmsg(zcm_trans_t *zt, zcm_msg_t msg)
     { return cast(zt)->udpm.sendmsg(msg); }
 
+    static int _sendmsgBatch(zcm_trans_t *zt, const zcm_msg_t *msgs, size_t nmsgs)
+    { return cast(zt)->udpm.sendmsgBatch(msgs, nmsgs); }
+
+    static int _sendmsgIov(zcm_trans_t *zt, zcm_msg_t msg, const zcm_iov_t *iov, size_t niov)
+    { return cast(zt)->udpm.sendmsgIov(msg, iov, niov); }
+
     static int _recvmsgEnable(zcm_trans_t *zt, const char *channel, bool enable)
-    { return ZCM_EOK; }
+    {
+        auto *t = cast(zt);
+        return t->lanes ? t->lanes->recvmsgEnable(channel, enable)
+                        : t->udpm.recvmsgEnable(channel, enable);
+    }
 
     static int _recvmsg(zcm_trans_t *zt, zcm_msg_t *msg, int timeout)
-    { return cast(zt)->udpm.recvmsg(msg, timeout); }
+    {
+        auto *t = cast(zt);
+        return t->lanes ? t->lanes->recvmsg(msg, timeout) : t->udpm.recvmsg(msg, timeout);
+    }
+
+    static int _recvmsgClaim(zcm_trans_t *zt, zcm_msg_t *msg, int timeout, void **token)
+    {
+        auto *t = cast(zt);
+        return t->lanes ? t->lanes->recvmsgClaim(msg, timeout, token)
+                        : t->udpm.recvmsgClaim(msg, timeout, token);
+    }
+
+    static void _recvmsgRelease(zcm_trans_t *zt, void *token)
+    {
+        auto *t = cast(zt);
+        if (t->lanes) t->lanes->recvmsgRelease(token);
+        else t->udpm.recvmsgRelease(token);
+    }
+
+    static void _recvmsgWakeup(zcm_trans_t *zt)
+    {
+        auto *t = cast(zt);
+        if (t->lanes) t->lanes->recvmsgWakeup();
+        else t->udpm.recvmsgWakeup();
+    }
+
+    static int _getStats(zcm_trans_t *zt, zcm_stat_handler_t cb, void *usr)
+    {
+        auto *t = cast(zt);
+        return t->lanes ? t->lanes->getStats(cb, usr) : t->udpm.getStats(cb, usr);
+    }
+
+    static void _setInterleave(zcm_trans_t *zt, zcm_interleave_t next, void *usr)
+    { cast(zt)->udpm.setInterleave(next, usr); }
 
     static void _destroy(zcm_trans_t *zt)
     { delete cast(zt); }
@@ -478,6 +1993,15 @@ zcm_trans_methods_t ZCM_TRANS_CLASSNAME::methods = {
     &ZCM_TRANS_CLASSNAME::_recvmsg,
     NULL, // update
     &ZCM_TRANS_CLASSNAME::_destroy,
+    &ZCM_TRANS_CLASSNAME::_recvmsgClaim,
+    &ZCM_TRANS_CLASSNAME::_recvmsgRelease,
+    &ZCM_TRANS_CLASSNAME::_sendmsgBatch,
+    &ZCM_TRANS_CLASSNAME::_recvmsgWakeup,
+    &ZCM_TRANS_CLASSNAME::_getStats,
+    NULL, // get_fd
+    &ZCM_TRANS_CLASSNAME::_setInterleave,
+    NULL, // has_subscribers
+    &ZCM_TRANS_CLASSNAME::_sendmsgIov,
 };
 
 static const char *optFind(zcm_url_opts_t *opts, const string& key)
@@ -524,7 +2048,175 @@ static zcm_trans_t *createUdpm(zcm_url_t *url)
         ttl = "0";
     }
     size_t recv_buf_size = 1024;
+
+    int fec = 0;
+    if (auto *opt = optFind(opts, "fec")) {
+        fec = atoi(opt);
+        // Every group, plus its parity, must fit in one batch of packets
+        if (fec < 0 || fec >= (int)UDPMSocket::MAX_BATCH) {
+            ZCM_DEBUG("ERROR: fec must be between 0 (off) and %zu", UDPMSocket::MAX_BATCH - 1);
+            return nullptr;
+        }
+    }
+
+    size_t frag = ZCM_FRAGMENT_MAX_PAYLOAD;
+    if (auto *opt = optFind(opts, "frag")) {
+        int v = atoi(opt);
+        if (v < MIN_FRAGMENT_PAYLOAD || v > MAX_FRAGMENT_PAYLOAD) {
+            ZCM_DEBUG("ERROR: frag must be between %d and %d bytes",
+                      MIN_FRAGMENT_PAYLOAD, MAX_FRAGMENT_PAYLOAD);
+            return nullptr;
+        }
+        frag = v;
+    }
+
+    int busypoll = 0;
+    if (auto *opt = optFind(opts, "busypoll")) {
+        busypoll = atoi(opt);
+        if (busypoll < 0) {
+            ZCM_DEBUG("ERROR: busypoll must be a number of microseconds");
+            return nullptr;
+        }
+    }
+
+    bool hwts = false;
+    if (auto *opt = optFind(opts, "timestamps")) {
+        if (string(opt) == "hw") {
+            hwts = true;
+        } else if (string(opt) != "sw") {
+            ZCM_DEBUG("ERROR: timestamps must be either sw or hw");
+            return nullptr;
+        }
+    }
+
+    int groups = 1;
+    if (auto *opt = optFind(opts, "groups")) {
+        groups = atoi(opt);
+        // All of the groups must be multicast addresses
+        struct in_addr first;
+        if (groups < 1 || groups > 256 || !inet_aton(address.c_str(), &first) ||
+            ((ntohl(first.s_addr) + groups - 1) >> 28) != 0xE) {
+            ZCM_DEBUG("ERROR: groups must be between 1 and 256 multicast addresses");
+            return nullptr;
+        }
+    }
+
+    size_t fragmem = MAX_FRAG_BUF_TOTAL_SIZE;
+    if (auto *opt = optFind(opts, "fragmem")) {
+        char *end;
+        unsigned long long v = strtoull(opt, &end, 10);
+        if (*end != '\0' || v < ZCM_MAX_UNFRAGMENTED_PACKET_SIZE || v > SIZE_MAX) {
+            ZCM_DEBUG("ERROR: fragmem must be at least %d bytes", ZCM_MAX_UNFRAGMENTED_PACKET_SIZE);
+            return nullptr;
+        }
+        fragmem = (size_t)v;
+    }
+
+    int fragbufs = MAX_NUM_FRAG_BUFS;
+    if (auto *opt = optFind(opts, "fragbufs")) {
+        fragbufs = atoi(opt);
+        if (fragbufs < 1) {
+            ZCM_DEBUG("ERROR: fragbufs must be at least 1");
+            return nullptr;
+        }
+    }
+
+    FragEviction fragevict = FragEviction::LRU;
+    if (auto *opt = optFind(opts, "fragevict")) {
+        if (string(opt) == "progress") {
+            fragevict = FragEviction::PROGRESS;
+        } else if (string(opt) != "lru") {
+            ZCM_DEBUG("ERROR: fragevict must be either lru or progress");
+            return nullptr;
+        }
+    }
+
+    bool autobuf = true;
+    if (auto *opt = optFind(opts, "autobuf")) {
+        if (string(opt) == "false") {
+            autobuf = false;
+        } else if (string(opt) != "true") {
+            ZCM_DEBUG("ERROR: autobuf must be either true or false");
+            return nullptr;
+        }
+    }
+
+    bool hugepages = false;
+    if (auto *opt = optFind(opts, "hugepages")) {
+        if (string(opt) == "true") {
+            hugepages = true;
+        } else if (string(opt) != "false") {
+            ZCM_DEBUG("ERROR: hugepages must be either true or false");
+            return nullptr;
+        }
+    }
+
+    bool selftest = false;
+    if (auto *opt = optFind(opts, "selftest")) {
+        if (string(opt) == "true") {
+            selftest = true;
+        } else if (string(opt) != "false") {
+            ZCM_DEBUG("ERROR: selftest must be either true or false");
+            return nullptr;
+        }
+    }
+
+    int lanes = 1;
+    if (auto *opt = optFind(opts, "lanes")) {
+        lanes = atoi(opt);
+        if (lanes < 1 || lanes > MAX_RECV_LANES) {
+            ZCM_DEBUG("ERROR: lanes must be between 1 and %d", MAX_RECV_LANES);
+            return nullptr;
+        }
+    }
+
+    bool direct = false, none = false;
+    if (auto *opt = optFind(opts, "loopback")) {
+        if (string(opt) == "direct") {
+            direct = true;
+        } else if (string(opt) == "none") {
+            none = true;
+        } else if (string(opt) != "kernel") {
+            ZCM_DEBUG("ERROR: loopback must be either kernel, direct or none");
+            return nullptr;
+        }
+        // The self test waits for its message to loop back
+        if (none && selftest) {
+            ZCM_DEBUG("ERROR: selftest can't be combined with loopback=none");
+            return nullptr;
+        }
+    }
+
+    int nack = 0;
+    if (auto *opt = optFind(opts, "nack")) {
+        nack = atoi(opt);
+        if (nack < 0 || nack > MAX_NACK_WINDOW) {
+            ZCM_DEBUG("ERROR: nack must be between 0 (off) and %d", MAX_NACK_WINDOW);
+            return nullptr;
+        }
+        // NACKs rely on receivers seeing every msg_seqno of a sender
+        if (nack && groups > 1) {
+            ZCM_DEBUG("ERROR: nack can't be combined with groups");
+            return nullptr;
+        }
+    }
+
     auto *trans = new ZCM_TRANS_CLASSNAME(address, atoi(port.c_str()), recv_buf_size, atoi(ttl));
+    trans->udpm.params.fec_group = fec;
+    trans->udpm.params.nack_window = nack;
+    trans->udpm.params.frag_payload = frag;
+    trans->udpm.params.busy_poll_us = busypoll;
+    trans->udpm.params.hw_timestamps = hwts;
+    trans->udpm.params.groups = groups;
+    trans->udpm.params.direct_loopback = direct;
+    trans->udpm.params.no_loopback = none;
+    trans->udpm.params.lanes = lanes;
+    trans->udpm.params.selftest = selftest;
+    trans->udpm.params.autobuf = autobuf;
+    trans->udpm.params.frag_mem = fragmem;
+    trans->udpm.params.frag_bufs = fragbufs;
+    trans->udpm.params.frag_eviction = fragevict;
+    trans->udpm.params.huge_pages = hugepages;
     if (!trans->init()) {
         delete trans;
         return nullptr;
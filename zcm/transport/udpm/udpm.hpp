@@ -5,6 +5,7 @@
 #include <cstdio>
 #include <cstddef>
 #include <cstdint>
+#include <climits>
 #include <cmath>
 #include <cstring>
 #include <cerrno>
@@ -14,12 +15,15 @@
 // TODO: get rid of these
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 
 // Headers for C++ library
 #include <algorithm>
 #include <vector>
 #include <stack>
+#include <deque>
+#include <memory>
 #include <unordered_map>
 #include <string>
 using namespace std;
@@ -36,9 +40,18 @@ using namespace std;
 # include <sys/socket.h>
 # include <sys/poll.h>
 # include <sys/select.h>
+# include <ifaddrs.h>
 typedef int SOCKET;
 #endif
 
+// Headers needed on Linux
+#ifdef __linux__
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+# include <linux/net_tstamp.h>
+# include <linux/filter.h>
+#endif
+
 // Misc. Compatability
 #ifdef SO_TIMESTAMP
 # define MSG_EXT_HDR
@@ -87,6 +100,8 @@ typedef int64_t  i64;
 /************************* Important Defines *******************/
 #define ZCM_MAGIC_SHORT 0x4c433032   // hex repr of ascii "LC02"
 #define ZCM_MAGIC_LONG  0x4c433033   // hex repr of ascii "LC03"
+#define ZCM_MAGIC_PARITY 0x4c433034  // hex repr of ascii "LC04"
+#define ZCM_MAGIC_NACK  0x4c433035   // hex repr of ascii "LC05"
 
 #ifdef __APPLE__
 # define ZCM_SHORT_MESSAGE_MAX_SIZE 1435
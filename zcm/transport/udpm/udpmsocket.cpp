@@ -80,6 +80,13 @@ void UDPMSocket::close()
         Platform::closesocket(fd);
         fd = -1;
     }
+#ifndef WIN32
+    if (epfd != -1) ::close(epfd);
+    if (wakeWr != -1 && wakeWr != wakeRd) ::close(wakeWr);
+    if (wakeRd != -1) ::close(wakeRd);
+#endif
+    epfd = wakeRd = wakeWr = -1;
+    extraFd = -1;
 }
 
 bool UDPMSocket::init()
@@ -105,6 +112,31 @@ bool UDPMSocket::joinMulticastGroup(struct in_addr multiaddr)
     return true;
 }
 
+bool UDPMSocket::leaveMulticastGroup(struct in_addr multiaddr)
+{
+    struct ip_mreq mreq;
+    mreq.imr_multiaddr = multiaddr;
+    mreq.imr_interface.s_addr = INADDR_ANY;
+    ZCM_DEBUG("ZCM: leaving multicast group %s", inet_ntoa(multiaddr));
+    if (setsockopt(fd, IPPROTO_IP, IP_DROP_MEMBERSHIP, (char*)&mreq, sizeof(mreq)) < 0) {
+        perror("setsockopt (IPPROTO_IP, IP_DROP_MEMBERSHIP)");
+        return false;
+    }
+    return true;
+}
+
+bool UDPMSocket::setMulticastAll(bool all)
+{
+#ifdef IP_MULTICAST_ALL
+    int opt = all;
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt (IPPROTO_IP, IP_MULTICAST_ALL)");
+        return false;
+    }
+#endif
+    return true;
+}
+
 bool UDPMSocket::setTTL(u8 ttl)
 {
     if (ttl == 0)
@@ -168,18 +200,64 @@ bool UDPMSocket::setReusePort()
 bool UDPMSocket::enablePacketTimestamp()
 {
     /* Enable per-packet timestamping by the kernel, if available */
-#ifdef SO_TIMESTAMP
+#if defined(SO_TIMESTAMPNS)
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &opt, sizeof(opt));
+#elif defined(SO_TIMESTAMP)
     int opt = 1;
     setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &opt, sizeof(opt));
 #endif
     return true;
 }
 
-bool UDPMSocket::enableLoopback()
+bool UDPMSocket::enableHardwareTimestamps()
+{
+#ifdef SO_TIMESTAMPING
+    int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        perror("setsockopt (SOL_SOCKET, SO_TIMESTAMPING)");
+        return false;
+    }
+    return true;
+#else
+    fprintf(stderr, "ZCM Error: hardware timestamps are not supported on this platform\n");
+    return false;
+#endif
+}
+
+void UDPMSocket::setBusyPoll(int usec)
+{
+#ifdef SO_BUSY_POLL
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) {
+        // Raising it above net.core.busy_read needs CAP_NET_ADMIN
+        ZCM_DEBUG("ZCM: unable to set SO_BUSY_POLL to %d us: %s", usec, strerror(errno));
+        return;
+    }
+# ifdef SO_PREFER_BUSY_POLL
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &opt, sizeof(opt));
+# endif
+    ZCM_DEBUG("ZCM: busy polling the receive queue for up to %d us", usec);
+#else
+    ZCM_DEBUG("ZCM: busy polling is not supported on this platform");
+#endif
+}
+
+bool UDPMSocket::enableDropCounter()
+{
+#ifdef SO_RXQ_OVFL
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &opt, sizeof(opt));
+#endif
+    return true;
+}
+
+bool UDPMSocket::setLoopback(bool enable)
 {
     // NOTE: For support on SUN Operating Systems, send_lo_opt should be 'u8'
     //       We don't currently support SUN
-    u32 opt = 1;
+    u32 opt = enable ? 1 : 0;
     if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, (char *)&opt, sizeof(opt)) < 0) {
         perror("setsockopt (IPPROTO_IP, IP_MULTICAST_LOOP)");
         return false;
@@ -187,6 +265,36 @@ bool UDPMSocket::enableLoopback()
     return true;
 }
 
+bool UDPMSocket::setLaneFilter(u16 lane, u16 lanes)
+{
+#if defined(__linux__)
+    // Socket filters on UDP see the packet from its UDP header on, and the
+    // IP header at SKF_NET_OFF. Keeps the packet if
+    // (source address + source port) % lanes == lane
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 0),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, (u32)(SKF_NET_OFF + 12)),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, lanes),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, lane, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        perror("setsockopt (SOL_SOCKET, SO_ATTACH_FILTER)");
+        return false;
+    }
+    return true;
+#else
+    fprintf(stderr, "ZCM Error: udpm lanes are only supported on Linux\n");
+    return false;
+#endif
+}
+
 size_t UDPMSocket::getRecvBufSize()
 {
     int size;
@@ -201,14 +309,196 @@ size_t UDPMSocket::getSendBufSize()
     int size;
     uint retsize = sizeof(int);
     getsockopt(fd, SOL_SOCKET, SO_SNDBUF, (char*)&size, (socklen_t *)&retsize);
-    ZCM_DEBUG("ZCM: receive buffer is %d bytes", size);
+    ZCM_DEBUG("ZCM: send buffer is %d bytes", size);
     return size;
 }
 
+// Linux doubles what it is asked for, to make room for its own bookkeeping,
+// and reports the doubled size
+#ifdef __linux__
+static const size_t KERNEL_BUF_SCALE = 2;
+#else
+static const size_t KERNEL_BUF_SCALE = 1;
+#endif
+
+size_t UDPMSocket::setRecvBufSize(size_t size)
+{
+    int req = (int)std::min(size / KERNEL_BUF_SCALE, (size_t)INT_MAX);
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char*)&req, sizeof(req)) < 0)
+        perror("setsockopt (SOL_SOCKET, SO_RCVBUF)");
+    return getRecvBufSize();
+}
+
+size_t UDPMSocket::setSendBufSize(size_t size)
+{
+    int req = (int)std::min(size / KERNEL_BUF_SCALE, (size_t)INT_MAX);
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (char*)&req, sizeof(req)) < 0)
+        perror("setsockopt (SOL_SOCKET, SO_SNDBUF)");
+    return getSendBufSize();
+}
+
+static size_t readSysctl(const char *path)
+{
+    size_t val = 0;
+#ifdef __linux__
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    unsigned long v;
+    if (fscanf(f, "%lu", &v) == 1) val = (size_t)v * KERNEL_BUF_SCALE;
+    fclose(f);
+#endif
+    return val;
+}
+
+size_t UDPMSocket::getMaxRecvBufSize()
+{
+    return readSysctl("/proc/sys/net/core/rmem_max");
+}
+
+size_t UDPMSocket::getMaxSendBufSize()
+{
+    return readSysctl("/proc/sys/net/core/wmem_max");
+}
+
+bool UDPMSocket::enableWakeup()
+{
+#if defined(__linux__)
+    wakeRd = wakeWr = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeRd < 0) {
+        perror("eventfd");
+        wakeRd = wakeWr = -1;
+        return false;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return false;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+    ev.data.fd = wakeRd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakeRd, &ev) < 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+#elif !defined(WIN32)
+    int fds[2];
+    if (zcm_internal_pipe_create(fds) < 0) {
+        perror("pipe");
+        return false;
+    }
+    wakeRd = fds[0];
+    wakeWr = fds[1];
+    fcntl(wakeRd, F_SETFL, fcntl(wakeRd, F_GETFL) | O_NONBLOCK);
+    fcntl(wakeWr, F_SETFL, fcntl(wakeWr, F_GETFL) | O_NONBLOCK);
+#endif
+    return true;
+}
+
+void UDPMSocket::wakeup()
+{
+#if defined(__linux__)
+    if (wakeWr == -1) return;
+    uint64_t one = 1;
+    if (zcm_internal_pipe_write(wakeWr, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("udpm wakeup -- write");
+#elif !defined(WIN32)
+    if (wakeWr == -1) return;
+    char one = 1;
+    if (zcm_internal_pipe_write(wakeWr, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("udpm wakeup -- write");
+#endif
+}
+
+void UDPMSocket::drainWakeup()
+{
+#ifndef WIN32
+    char buf[64];
+    while (zcm_internal_pipe_read(wakeRd, buf, sizeof(buf)) > 0) {}
+#endif
+}
+
+bool UDPMSocket::alsoWaitFor(UDPMSocket& other)
+{
+    assert(other.isOpen());
+    extraFd = other.fd;
+#if defined(__linux__)
+    if (epfd != -1) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = extraFd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, extraFd, &ev) < 0) {
+            perror("epoll_ctl");
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
 bool UDPMSocket::waitUntilData(int timeout)
 {
     assert(isOpen());
 
+#if defined(__linux__)
+    if (epfd != -1) {
+        struct epoll_event evs[3];
+        int n = epoll_wait(epfd, evs, 3, timeout);
+        if (n < 0) {
+            if (errno != EINTR) perror("udp_read_packet -- epoll_wait:");
+            return false;
+        }
+        bool woken = false, ready = false;
+        for (int i = 0; i < n; i++) {
+            if (evs[i].data.fd == wakeRd) woken = true;
+            else                          ready = true;
+        }
+        if (woken) {
+            drainWakeup();
+            return false;
+        }
+        return ready;
+    }
+#endif
+
+#ifndef WIN32
+    // The socket itself, then the optional extra socket and wakeup fds
+    struct pollfd pfds[3];
+    nfds_t npfds = 0;
+    int fds[3] = { fd, extraFd, wakeRd };
+    for (int f : fds) {
+        if (f == -1) continue;
+        pfds[npfds].fd = f;
+        pfds[npfds].events = POLLIN;
+        pfds[npfds].revents = 0;
+        npfds++;
+    }
+
+    int status = poll(pfds, npfds, timeout);
+    if (status == 0) {
+        // timeout
+        return false;
+    } else if (status < 0) {
+        if (errno != EINTR) perror("udp_read_packet -- poll:");
+        return false;
+    } else if (wakeRd != -1 && (pfds[npfds-1].revents & POLLIN)) {
+        drainWakeup();
+        return false;
+    }
+    // data is available
+    for (nfds_t i = 0; i < npfds; i++)
+        if (pfds[i].revents & POLLIN) return true;
+    return false;
+#else
     fd_set fds;
     FD_ZERO(&fds);
     FD_SET(fd, &fds);
@@ -229,6 +519,67 @@ bool UDPMSocket::waitUntilData(int timeout)
         perror("udp_read_packet -- select:");
         return false;
     }
+#endif
+}
+
+#if defined(SO_TIMESTAMPNS) || defined(SO_TIMESTAMPING)
+static i64 nsFromCmsg(struct cmsghdr *cmsg, size_t idx)
+{
+    struct timespec ts;
+    memcpy(&ts, CMSG_DATA(cmsg) + idx * sizeof(ts), sizeof(ts));
+    return (i64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+// Takes the kernel's (or the NIC's) receive timestamp from 'msg' if it has
+// one, and the number of packets the kernel dropped so far (which is only
+// attached once there was a drop). 'recv_ns' is left 0 unless the timestamp
+// had nanoseconds
+void UDPMSocket::readControl(i64 *utime, i64 *recv_ns, struct msghdr *msg)
+{
+    bool got_utime = false;
+    *recv_ns = 0;
+#if defined(SO_TIMESTAMP) || defined(SO_RXQ_OVFL)
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+    /* Get the receive timestamp out of the packet headers if possible */
+    for (; cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) continue;
+# ifdef SO_TIMESTAMPING
+        if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            // Software, legacy and raw hardware timestamps. The hardware one
+            // is 0 unless the NIC has timestamping turned on
+            i64 hw = nsFromCmsg(cmsg, 2);
+            if (hw) *recv_ns = hw;
+            else if (!*recv_ns) *recv_ns = nsFromCmsg(cmsg, 0);
+        }
+# endif
+# ifdef SO_TIMESTAMPNS
+        if (!*recv_ns && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+            *recv_ns = nsFromCmsg(cmsg, 0);
+# endif
+# ifdef SO_TIMESTAMP
+        if (!*utime && cmsg->cmsg_type == SCM_TIMESTAMP) {
+            struct timeval *t = (struct timeval*) CMSG_DATA (cmsg);
+            *utime = (int64_t) t->tv_sec * 1000000 + t->tv_usec;
+            got_utime = true;
+        }
+# endif
+# ifdef SO_RXQ_OVFL
+        if (cmsg->cmsg_type == SO_RXQ_OVFL)
+            memcpy(&kernelDrops, CMSG_DATA(cmsg), sizeof(kernelDrops));
+# endif
+    }
+#endif
+
+    if (*recv_ns) {
+        *utime = *recv_ns / 1000;
+        got_utime = true;
+    }
+    if (!got_utime) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        *utime = (i64)tv.tv_sec * 1000000 + tv.tv_usec;
+    }
 }
 
 int UDPMSocket::recvPacket(Packet *pkt)
@@ -248,7 +599,7 @@ int UDPMSocket::recvPacket(Packet *pkt)
     // operating systems that provide SO_TIMESTAMP allow us to obtain more
     // accurate timestamps by having the kernel produce timestamps as soon
     // as packets are received.
-    char controlbuf[64];
+    char controlbuf[CONTROL_BUF_SIZE];
     msg.msg_control = controlbuf;
     msg.msg_controllen = sizeof(controlbuf);
     msg.msg_flags = 0;
@@ -256,29 +607,107 @@ int UDPMSocket::recvPacket(Packet *pkt)
 
     int ret = ::recvmsg(fd, &msg, 0);
     pkt->fromlen = msg.msg_namelen;
+    readControl(&pkt->utime, &pkt->recv_ns, &msg);
 
-    bool got_utime = false;
-#ifdef SO_TIMESTAMP
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-    /* Get the receive timestamp out of the packet headers if possible */
-    while (!pkt->utime && cmsg) {
-        if (cmsg->cmsg_level == SOL_SOCKET &&
-            cmsg->cmsg_type == SCM_TIMESTAMP) {
-            struct timeval *t = (struct timeval*) CMSG_DATA (cmsg);
-            pkt->utime = (int64_t) t->tv_sec * 1000000 + t->tv_usec;
-            got_utime = true;
-            break;
-        }
-        cmsg = CMSG_NXTHDR(&msg, cmsg);
+    return ret;
+}
+
+int UDPMSocket::recvPackets(Packet **pkts, size_t n)
+{
+    assert(n <= MAX_RECV_BATCH);
+#ifdef __linux__
+    struct mmsghdr mhdrs[MAX_RECV_BATCH];
+    struct iovec vecs[MAX_RECV_BATCH];
+    char controlbufs[MAX_RECV_BATCH][CONTROL_BUF_SIZE];
+    for (size_t i = 0; i < n; i++) {
+        vecs[i].iov_base = pkts[i]->buf.data;
+        vecs[i].iov_len = pkts[i]->buf.size;
+
+        struct msghdr& mhdr = mhdrs[i].msg_hdr;
+        memset(&mhdr, 0, sizeof(mhdr));
+        mhdr.msg_name = &pkts[i]->from;
+        mhdr.msg_namelen = sizeof(struct sockaddr);
+        mhdr.msg_iov = &vecs[i];
+        mhdr.msg_iovlen = 1;
+        mhdr.msg_control = controlbufs[i];
+        mhdr.msg_controllen = sizeof(controlbufs[i]);
+        mhdrs[i].msg_len = 0;
     }
-#endif
 
-    if (!got_utime) {
-        struct timeval tv;
-        gettimeofday(&tv, NULL);
-        pkt->utime = (i64)tv.tv_sec * 1000000 + tv.tv_usec;
+    int ret = ::recvmmsg(fd, mhdrs, n, MSG_DONTWAIT, NULL);
+    if (ret < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+    for (int i = 0; i < ret; i++) {
+        pkts[i]->sz = mhdrs[i].msg_len;
+        pkts[i]->fromlen = mhdrs[i].msg_hdr.msg_namelen;
+        pkts[i]->utime = 0;
+        readControl(&pkts[i]->utime, &pkts[i]->recv_ns, &mhdrs[i].msg_hdr);
+    }
+    return ret;
+#else
+    // One packet at a time, as long as more are already waiting
+    size_t i = 0;
+    for (; i < n && waitUntilData(0); i++) {
+        pkts[i]->utime = 0;
+        int sz = recvPacket(pkts[i]);
+        if (sz < 0) return i > 0 ? (int)i : -1;
+        pkts[i]->sz = sz;
     }
+    return (int)i;
+#endif
+}
+
+int UDPMSocket::peekPacket(char *buf, size_t len, struct sockaddr_in *from)
+{
+#ifndef WIN32
+    socklen_t fromlen = sizeof(*from);
+    ssize_t ret = ::recvfrom(fd, buf, len, MSG_PEEK | MSG_DONTWAIT,
+                             (struct sockaddr*)from, &fromlen);
+    if (ret < 0) return 0;
+    return (int)ret;
+#else
+    return 0;
+#endif
+}
+
+int UDPMSocket::recvDatagram(char *buf, size_t len, struct sockaddr_in *from)
+{
+#ifndef WIN32
+    socklen_t fromlen = sizeof(*from);
+    ssize_t ret = ::recvfrom(fd, buf, len, MSG_DONTWAIT, (struct sockaddr*)from, &fromlen);
+    if (ret < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    return (int)ret;
+#else
+    return 0;
+#endif
+}
+
+int UDPMSocket::recvPacketSplit(char *hdr, size_t hdrlen, char *payload, size_t payloadlen,
+                                i64 *utime, i64 *recv_ns)
+{
+    struct iovec vecs[2];
+    vecs[0].iov_base = hdr;
+    vecs[0].iov_len = hdrlen;
+    vecs[1].iov_base = payload;
+    vecs[1].iov_len = payloadlen;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = vecs;
+    msg.msg_iovlen = 2;
+
+#ifdef MSG_EXT_HDR
+    char controlbuf[CONTROL_BUF_SIZE];
+    msg.msg_control = controlbuf;
+    msg.msg_controllen = sizeof(controlbuf);
+    msg.msg_flags = 0;
+#endif
+
+    int ret = ::recvmsg(fd, &msg, 0);
+    if (ret < 0 || (msg.msg_flags & MSG_TRUNC)) return -1;
 
+    *utime = 0;
+    readControl(utime, recv_ns, &msg);
     return ret;
 }
 
@@ -344,6 +773,91 @@ ssize_t UDPMSocket::sendBuffers(const UDPMAddress& dest, const char *a, size_t a
     return::sendmsg(fd, &mhdr, 0);
 }
 
+size_t UDPMSocket::sendPackets(const UDPMAddress& dest, struct iovec (*iovs)[3], size_t n)
+{
+    assert(n <= MAX_BATCH);
+#ifdef __linux__
+    struct mmsghdr mhdrs[MAX_BATCH];
+    for (size_t i = 0; i < n; i++) {
+        struct msghdr& mhdr = mhdrs[i].msg_hdr;
+        mhdr.msg_name = dest.getAddrPtr();
+        mhdr.msg_namelen = dest.getAddrSize();
+        mhdr.msg_iov = iovs[i];
+        mhdr.msg_iovlen = 3;
+        mhdr.msg_control = NULL;
+        mhdr.msg_controllen = 0;
+        mhdr.msg_flags = 0;
+        mhdrs[i].msg_len = 0;
+    }
+
+    size_t sent = 0;
+    while (sent < n) {
+        int rc = ::sendmmsg(fd, mhdrs + sent, n - sent, 0);
+        if (rc <= 0) break;
+        sent += rc;
+    }
+    return sent;
+#else
+    size_t sent = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = iovs[i][0].iov_len + iovs[i][1].iov_len + iovs[i][2].iov_len;
+        ssize_t status = sendBuffers(dest,
+                                     (char*)iovs[i][0].iov_base, iovs[i][0].iov_len,
+                                     (char*)iovs[i][1].iov_base, iovs[i][1].iov_len,
+                                     (char*)iovs[i][2].iov_base, iovs[i][2].iov_len);
+        if (status != (ssize_t)len) break;
+        sent++;
+    }
+    return sent;
+#endif
+}
+
+size_t UDPMSocket::sendPackets(const UDPMAddress& dest, struct iovec (*iovs)[MAX_PACKET_IOV],
+                               const size_t *niov, size_t n)
+{
+    assert(n <= MAX_BATCH);
+#ifdef __linux__
+    struct mmsghdr mhdrs[MAX_BATCH];
+    for (size_t i = 0; i < n; i++) {
+        struct msghdr& mhdr = mhdrs[i].msg_hdr;
+        mhdr.msg_name = dest.getAddrPtr();
+        mhdr.msg_namelen = dest.getAddrSize();
+        mhdr.msg_iov = iovs[i];
+        mhdr.msg_iovlen = niov[i];
+        mhdr.msg_control = NULL;
+        mhdr.msg_controllen = 0;
+        mhdr.msg_flags = 0;
+        mhdrs[i].msg_len = 0;
+    }
+
+    size_t sent = 0;
+    while (sent < n) {
+        int rc = ::sendmmsg(fd, mhdrs + sent, n - sent, 0);
+        if (rc <= 0) break;
+        sent += rc;
+    }
+    return sent;
+#else
+    size_t sent = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = 0;
+        for (size_t j = 0; j < niov[i]; j++) len += iovs[i][j].iov_len;
+
+        struct msghdr mhdr;
+        mhdr.msg_name = dest.getAddrPtr();
+        mhdr.msg_namelen = dest.getAddrSize();
+        mhdr.msg_iov = iovs[i];
+        mhdr.msg_iovlen = niov[i];
+        mhdr.msg_control = NULL;
+        mhdr.msg_controllen = 0;
+        mhdr.msg_flags = 0;
+        if (::sendmsg(fd, &mhdr, 0) != (ssize_t)len) break;
+        sent++;
+    }
+    return sent;
+#endif
+}
+
 bool UDPMSocket::checkConnection(const string& ip, u16 port)
 {
     UDPMAddress addr{ip, port};
@@ -357,45 +871,55 @@ bool UDPMSocket::checkConnection(const string& ip, u16 port)
     return true;
 }
 
-void UDPMSocket::checkAndWarnAboutSmallBuffer(size_t datalen, size_t kbufsize)
+u16 UDPMSocket::getLocalPort()
 {
-    // TODO: This should probably be in Platform
-#ifdef __linux__
-    if (warnedAboutSmallBuffer)
-        return;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    if (getsockname(fd, (struct sockaddr*)&addr, &len) < 0) return 0;
+    return ntohs(addr.sin_port);
+}
 
-    const size_t MIN_KBUF_SIZE = (1<<18)+1;
-    if (kbufsize < MIN_KBUF_SIZE && datalen > kbufsize) {
-        warnedAboutSmallBuffer = true;
-        fprintf(stderr,
-                "==== ZCM Warning ===\n"
-                "ZCM detected that large packets are being received, but the kernel UDP\n"
-                "receive buffer is very small.  The possibility of dropping packets due to\n"
-                "insufficient buffer space is very high.\n");
+vector<struct in_addr> UDPMSocket::getLocalAddrs()
+{
+    vector<struct in_addr> addrs;
+#ifndef WIN32
+    struct ifaddrs *ifs;
+    if (getifaddrs(&ifs) < 0) {
+        perror("getifaddrs");
+        return addrs;
     }
+    for (struct ifaddrs *i = ifs; i; i = i->ifa_next)
+        if (i->ifa_addr && i->ifa_addr->sa_family == AF_INET)
+            addrs.push_back(((struct sockaddr_in*)i->ifa_addr)->sin_addr);
+    freeifaddrs(ifs);
 #endif
+    return addrs;
 }
 
-UDPMSocket UDPMSocket::createSendSocket(struct in_addr multiaddr, u8 ttl)
+UDPMSocket UDPMSocket::createSendSocket(struct in_addr multiaddr, u8 ttl, bool loopback)
 {
     // don't use connect() on the actual transmit socket, because linux then
     // has problems multicasting to localhost
     UDPMSocket sock;
     if (!sock.init())                        { sock.close(); return sock; }
     if (!sock.setTTL(ttl))                   { sock.close(); return sock; }
-    if (!sock.enableLoopback())              { sock.close(); return sock; }
+    if (!sock.setLoopback(loopback))         { sock.close(); return sock; }
     if (!sock.joinMulticastGroup(multiaddr)) { sock.close(); return sock; }
     return sock;
 }
 
-UDPMSocket UDPMSocket::createRecvSocket(struct in_addr multiaddr, u16 port)
+UDPMSocket UDPMSocket::createRecvSocket(struct in_addr multiaddr, u16 port, bool join)
 {
     UDPMSocket sock;
     if (!sock.init())                        { sock.close(); return sock; }
     if (!sock.setReuseAddr())                { sock.close(); return sock; }
     if (!sock.setReusePort())                { sock.close(); return sock; }
     if (!sock.enablePacketTimestamp())       { sock.close(); return sock; }
+    if (!sock.enableDropCounter())           { sock.close(); return sock; }
     if (!sock.bindPort(port))                { sock.close(); return sock; }
-    if (!sock.joinMulticastGroup(multiaddr)) { sock.close(); return sock; }
+    if (join && !sock.joinMulticastGroup(multiaddr)) { sock.close(); return sock; }
+    if (!join && !sock.setMulticastAll(false))       { sock.close(); return sock; }
+    if (!sock.enableWakeup())                { sock.close(); return sock; }
     return sock;
 }
@@ -16,6 +16,13 @@ class UDPMAddress
         this->addr.sin_port = htons(port);
     }
 
+    UDPMAddress(const struct sockaddr_in& addr)
+    {
+        this->ip = inet_ntoa(addr.sin_addr);
+        this->port = ntohs(addr.sin_port);
+        this->addr = addr;
+    }
+
     const string& getIP() const { return ip; }
     u16 getPort() const { return port; }
     struct sockaddr* getAddrPtr() const { return (struct sockaddr*)&addr; }
@@ -37,36 +44,123 @@ class UDPMSocket
 
     bool init();
     bool joinMulticastGroup(struct in_addr multiaddr);
+    bool leaveMulticastGroup(struct in_addr multiaddr);
+    // Only deliver packets of the groups this socket joined, not those of
+    // every group joined on the host for our port (Linux only)
+    bool setMulticastAll(bool all);
     bool setTTL(u8 ttl);
     bool bindPort(u16 port);
     bool setReuseAddr();
     bool setReusePort();
     bool enablePacketTimestamp();
-    bool enableLoopback();
+    // Also ask for the NIC's receive timestamps (SO_TIMESTAMPING), which only
+    // show up once timestamping is turned on for the interface (SIOCSHWTSTAMP,
+    // e.g. with hwstamp_ctl). Linux only
+    bool enableHardwareTimestamps();
+    // Have the kernel report how many packets it dropped because the receive
+    // buffer was full (SO_RXQ_OVFL). See getKernelDrops()
+    bool enableDropCounter();
+    bool setLoopback(bool enable);
+    // Only keep the packets of the senders whose address hashes to 'lane'
+    // out of 'lanes' (Linux only)
+    bool setLaneFilter(u16 lane, u16 lanes);
+    bool enableWakeup();
+    // Makes the kernel busy poll the device queue for up to 'usec' when
+    // the socket is empty, instead of waiting for an interrupt (Linux only).
+    // Not being allowed to is not an error
+    void setBusyPoll(int usec);
     bool setDestination(const string& ip, u16 port);
 
     size_t getRecvBufSize();
     size_t getSendBufSize();
+    // Ask for kernel buffers of 'size' bytes, in the units the getters above
+    // report them in. Return the size the kernel settled on
+    size_t setRecvBufSize(size_t size);
+    size_t setSendBufSize(size_t size);
+    // The most setRecvBufSize() / setSendBufSize() can get without privileges
+    // (net.core.rmem_max / wmem_max on Linux), 0 if unknown
+    static size_t getMaxRecvBufSize();
+    static size_t getMaxSendBufSize();
+    // The port this socket is bound to, 0 if it isn't
+    u16 getLocalPort();
+    // Packets dropped by the kernel on this socket, as of the last packet received
+    u32 getKernelDrops() const { return kernelDrops; }
 
-    // Returns true when there is a packet available for receiving
+    // Returns true when there is a packet available for receiving.
+    // Returns false on timeout or early if wakeup() was called
     bool waitUntilData(int timeout);
+
+    // Makes a waitUntilData() in another thread (or the next one) return
+    // early. Requires enableWakeup(). Safe to call from any thread
+    void wakeup();
+
+    // Makes waitUntilData() also return true when 'other' has a packet
+    // available. 'other' must outlive this socket's use of it
+    bool alsoWaitFor(UDPMSocket& other);
     int recvPacket(Packet *pkt);
 
+    // Receives up to 'n' (<= MAX_RECV_BATCH) packets that are already waiting,
+    // without blocking. Sets 'sz' of each packet received.
+    // Returns the number of packets received or -1 on error
+    static constexpr size_t MAX_RECV_BATCH = 16;
+    int recvPackets(Packet **pkts, size_t n);
+
+    // Copies up to 'len' bytes of the next waiting packet into 'buf' without
+    // consuming it. Returns the number of bytes copied, 0 if nothing is waiting
+    int peekPacket(char *buf, size_t len, struct sockaddr_in *from);
+
+    // Receives the next waiting packet into 'buf' without blocking. Returns
+    // the packet size, 0 if nothing is waiting or -1 on error
+    int recvDatagram(char *buf, size_t len, struct sockaddr_in *from);
+
+    // Receives the next packet, putting its first 'hdrlen' bytes in 'hdr' and
+    // the rest in 'payload'. Returns the packet size, or -1 on error or if
+    // the packet didn't fit
+    int recvPacketSplit(char *hdr, size_t hdrlen, char *payload, size_t payloadlen,
+                        i64 *utime, i64 *recv_ns);
+
     ssize_t sendBuffers(const UDPMAddress& dest, const char *a, size_t alen);
     ssize_t sendBuffers(const UDPMAddress& dest, const char *a, size_t alen,
                             const char *b, size_t blen);
     ssize_t sendBuffers(const UDPMAddress& dest, const char *a, size_t alen,
                         const char *b, size_t blen, const char *c, size_t clen);
 
+    // Sends 'n' (<= MAX_BATCH) packets, each made of 3 buffers.
+    // Returns the number of packets that were sent
+    static constexpr size_t MAX_BATCH = 32;
+    size_t sendPackets(const UDPMAddress& dest, struct iovec (*iovs)[3], size_t n);
+    // Likewise, with packet i made of the first 'niov[i]' buffers of 'iovs[i]'
+    static constexpr size_t MAX_PACKET_IOV = 8;
+    size_t sendPackets(const UDPMAddress& dest, struct iovec (*iovs)[MAX_PACKET_IOV],
+                       const size_t *niov, size_t n);
+
     static bool checkConnection(const string& ip, u16 port);
-    void checkAndWarnAboutSmallBuffer(size_t datalen, size_t kbufsize);
+    // The IPv4 addresses of the interfaces of this host (empty on Windows)
+    static vector<struct in_addr> getLocalAddrs();
 
-    static UDPMSocket createSendSocket(struct in_addr multiaddr, u8 ttl);
-    static UDPMSocket createRecvSocket(struct in_addr multiaddr, u16 port);
+    // With 'loopback' false, no receiver on this host gets what it sends
+    static UDPMSocket createSendSocket(struct in_addr multiaddr, u8 ttl, bool loopback = true);
+    // With 'join' false the socket starts out in no multicast group
+    static UDPMSocket createRecvSocket(struct in_addr multiaddr, u16 port, bool join = true);
 
   private:
     SOCKET fd = -1;
-    bool warnedAboutSmallBuffer = false;
+    u32 kernelDrops = 0;
+
+    // epoll instance waiting on 'fd' and 'wakeRd' (Linux only)
+    int epfd = -1;
+    // Both ends of the wakeup channel: the same eventfd on Linux, a pipe
+    // on other unixes, unused on Windows
+    int wakeRd = -1;
+    int wakeWr = -1;
+    // See alsoWaitFor()
+    SOCKET extraFd = -1;
+
+    void drainWakeup();
+    // Reads the receive timestamp and drop count attached to a received packet
+    void readControl(i64 *utime, i64 *recv_ns, struct msghdr *msg);
+    // Room for a timestamp, a SO_TIMESTAMPING triple and a drop count
+    static constexpr size_t CONTROL_BUF_SIZE = 192;
 
   private:
     // Disallow copies
@@ -75,6 +169,16 @@ class UDPMSocket
 
   public:
     // Allow moves
-    UDPMSocket(UDPMSocket&& other) { std::swap(this->fd, other.fd); }
-    UDPMSocket& operator=(UDPMSocket&& other) { std::swap(this->fd, other.fd); return *this; }
+    UDPMSocket(UDPMSocket&& other) { swapFds(other); }
+    UDPMSocket& operator=(UDPMSocket&& other) { swapFds(other); return *this; }
+
+  private:
+    void swapFds(UDPMSocket& other)
+    {
+        std::swap(this->fd, other.fd);
+        std::swap(this->epfd, other.epfd);
+        std::swap(this->wakeRd, other.wakeRd);
+        std::swap(this->wakeWr, other.wakeWr);
+        std::swap(this->extraFd, other.extraFd);
+    }
 };
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "zcm/zcm_private.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Resolves channel names to the list of subscriptions that want them.
+//
+// Plain (non-regex) subscriptions are matched exactly. Regex patterns of the
+// (very common) form "<literal>.*" are compiled into a prefix trie so that all
+// of them are matched in a single pass over the channel name. Anything else
+// falls back to std::regex_match() via the sub's 'regexobj'.
+// On top of that, the result for every channel is cached (keyed by the
+// zcm_channel_hash() of the channel, which callers usually already have), so a
+// channel that has been seen before only costs one integer-keyed lookup and a
+// string compare. The cache is invalidated
+// by add() and remove(), which also bump version() so holders of an older
+// Result can tell that it is stale.
+//
+// Note: add() and remove() must not run concurrently with anything else, but
+//       match() may be called concurrently from several threads. Constructing
+//       the matcher with its final list of subs avoids add()/remove() entirely.
+class ChannelMatcher
+{
+  public:
+    using SubList = std::vector<zcm_sub_t*>;
+    using Result = std::shared_ptr<const SubList>;
+
+    ChannelMatcher() : noMatch(std::make_shared<const SubList>()) {}
+
+    explicit ChannelMatcher(const SubList& subs)
+        : all(subs), noMatch(std::make_shared<const SubList>())
+    {
+        for (zcm_sub_t* sub : all)
+            if (sub->regex) ++nregex;
+        rebuild();
+    }
+
+    void add(zcm_sub_t* sub)
+    {
+        all.push_back(sub);
+        if (sub->regex) ++nregex;
+        rebuild();
+    }
+
+    bool remove(zcm_sub_t* sub)
+    {
+        for (size_t i = 0; i < all.size(); ++i) {
+            if (all[i] == sub) {
+                all.erase(all.begin() + i);
+                if (sub->regex) --nregex;
+                rebuild();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t size() const { return all.size(); }
+    size_t numRegex() const { return nregex; }
+
+    // Incremented on every add() and remove()
+    uint64_t version() const { return ver; }
+
+    // All subscriptions in the order they were added
+    const SubList& subs() const { return all; }
+
+    // Returns every subscription wanting 'channel', in the order they were added
+    Result match(const char* channel)
+    {
+        return match(channel, zcm_channel_hash(channel));
+    }
+
+    // Same as above, 'hash' must be zcm_channel_hash(channel)
+    Result match(const char* channel, uint32_t hash)
+    {
+        if (all.empty()) return noMatch;
+
+        {
+            std::unique_lock<std::mutex> lk(cacheMutex);
+            auto it = cache.find(hash);
+            if (it != cache.end())
+                for (auto& entry : it->second)
+                    if (entry.first == channel) return entry.second;
+        }
+
+        Result res = compute(channel);
+
+        std::unique_lock<std::mutex> lk(cacheMutex);
+        // Don't let a flood of unique channel names grow the cache without bound
+        if (cacheSize >= MAX_CACHE_ENTRIES) {
+            cache.clear();
+            cacheSize = 0;
+        }
+        auto& bucket = cache[hash];
+        for (auto& entry : bucket)
+            if (entry.first == channel) return entry.second;
+        bucket.emplace_back(channel, res);
+        ++cacheSize;
+        return res;
+    }
+
+  private:
+    static constexpr size_t MAX_CACHE_ENTRIES = 4096;
+
+    struct TrieNode
+    {
+        std::unordered_map<char, std::unique_ptr<TrieNode>> next;
+        SubList subs; // patterns whose prefix ends at this node
+    };
+
+    // Returns true if 'pattern' is "<literal>.*" and sets 'prefix' to the literal
+    static bool isPrefixPattern(const char* pattern, std::string& prefix)
+    {
+        size_t len = strlen(pattern);
+        if (len < 2 || pattern[len-2] != '.' || pattern[len-1] != '*') return false;
+        for (size_t i = 0; i < len - 2; ++i)
+            if (strchr(".^$|()[]{}*+?\\", pattern[i])) return false;
+        prefix.assign(pattern, len - 2);
+        return true;
+    }
+
+    void rebuild()
+    {
+        ++ver;
+        exact.clear();
+        trie.reset(new TrieNode());
+        fallback.clear();
+        for (zcm_sub_t* sub : all) {
+            std::string prefix;
+            if (!sub->regex) {
+                exact[sub->channel].push_back(sub);
+            } else if (isPrefixPattern(sub->channel, prefix)) {
+                TrieNode* node = trie.get();
+                for (char c : prefix) {
+                    auto& child = node->next[c];
+                    if (!child) child.reset(new TrieNode());
+                    node = child.get();
+                }
+                node->subs.push_back(sub);
+            } else {
+                fallback.push_back(sub);
+            }
+        }
+
+        std::unique_lock<std::mutex> lk(cacheMutex);
+        cache.clear();
+        cacheSize = 0;
+    }
+
+    Result compute(const char* channel) const
+    {
+        std::unordered_set<zcm_sub_t*> matched;
+
+        auto it = exact.find(channel);
+        if (it != exact.end()) matched.insert(it->second.begin(), it->second.end());
+
+        const TrieNode* node = trie.get();
+        for (const char* c = channel; node; ++c) {
+            matched.insert(node->subs.begin(), node->subs.end());
+            if (*c == '\0') break;
+            auto next = node->next.find(*c);
+            node = (next == node->next.end()) ? nullptr : next->second.get();
+        }
+
+        for (zcm_sub_t* sub : fallback)
+            if (std::regex_match(channel, *(std::regex*)sub->regexobj))
+                matched.insert(sub);
+
+        if (matched.empty()) return noMatch;
+
+        auto res = std::make_shared<SubList>();
+        for (zcm_sub_t* sub : all)
+            if (matched.count(sub)) res->push_back(sub);
+        return res;
+    }
+
+    SubList all;
+    size_t nregex = 0;
+    uint64_t ver = 0;
+
+    std::unordered_map<std::string, SubList> exact;
+    SubList fallback;
+    std::unique_ptr<TrieNode> trie {new TrieNode()};
+    Result noMatch;
+
+    // Channels with colliding hashes share a bucket
+    using CacheBucket = std::vector<std::pair<std::string, Result>>;
+    std::mutex cacheMutex;
+    std::unordered_map<uint32_t, CacheBucket> cache;
+    size_t cacheSize = 0;
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <string>
+
+#ifdef __linux__
+# include <sys/mman.h>
+#endif
+
+// Huge pages for the large buffers that messages get copied through (rings,
+// pools): one TLB entry covers 2 MB of them instead of 4 KB. Explicit huge
+// pages (MAP_HUGETLB) are used when the system has some reserved
+// (vm.nr_hugepages), transparent ones (madvise) otherwise.
+// Note: these buffers are mapped directly, not taken from zcm_alloc()
+namespace HugePages {
+
+// The size of the huge pages asked for, the default one on x86 and arm64
+static constexpr size_t SIZE = 2 << 20;
+
+enum class Backing
+{
+    NONE,    // normal pages: huge pages are unsupported or disabled
+    HUGETLB, // explicit huge pages
+    THP,     // transparent huge pages, if the kernel finds them when touched
+};
+
+static inline const char* backingName(Backing b)
+{
+    switch (b) {
+        case Backing::HUGETLB: return "hugetlb";
+        case Backing::THP:     return "thp";
+        default:               return "none";
+    }
+}
+
+static inline size_t roundUp(size_t sz)
+{
+    return (sz + SIZE - 1) & ~(SIZE - 1);
+}
+
+// Asks for transparent huge pages for the SIZE aligned range at 'p'
+static inline bool advise(void* p, size_t size)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    return madvise(p, size, MADV_HUGEPAGE) == 0;
+#else
+    (void) p;
+    (void) size;
+    return false;
+#endif
+}
+
+// Maps 'size' bytes (rounded up to SIZE) of zeroed memory on huge pages if it
+// can, sets 'how' (if given) to what backs them. Returns null when out of memory
+static inline void* map(size_t size, Backing* how = nullptr)
+{
+    size = roundUp(size);
+#ifdef __linux__
+# ifdef MAP_HUGETLB
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        if (how) *how = Backing::HUGETLB;
+        return p;
+    }
+# endif
+    // Transparent huge pages only back whole aligned pages, so map one more
+    // and trim it off the ends
+    size_t span = size + SIZE;
+    char* raw = (char*) mmap(nullptr, span, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return nullptr;
+    char* aligned = (char*) (((uintptr_t) raw + SIZE - 1) & ~(uintptr_t) (SIZE - 1));
+    if (aligned > raw) munmap(raw, aligned - raw);
+    if (raw + span > aligned + size) munmap(aligned + size, raw + span - (aligned + size));
+    if (how) *how = advise(aligned, size) ? Backing::THP : Backing::NONE;
+    return aligned;
+#else
+    if (how) *how = Backing::NONE;
+    return calloc(1, size);
+#endif
+}
+
+// Gives back what map() returned for 'size'
+static inline void unmap(void* p, size_t size)
+{
+    if (!p) return;
+#ifdef __linux__
+    munmap(p, roundUp(size));
+#else
+    (void) size;
+    free(p);
+#endif
+}
+
+// Where a hugetlbfs of SIZE pages is mounted (e.g. "/dev/hugepages/"), empty if
+// nowhere. Files in it are backed by explicit huge pages, for memory shared by processes
+static inline std::string hugetlbfsDir()
+{
+#ifdef __linux__
+    FILE* f = fopen("/proc/mounts", "r");
+    if (!f) return "";
+    char dev[256], dir[4096], type[64], opts[1024];
+    std::string found;
+    while (fscanf(f, "%255s %4095s %63s %1023s %*[^\n]", dev, dir, type, opts) == 4) {
+        if (strcmp(type, "hugetlbfs") != 0) continue;
+        const char* ps = strstr(opts, "pagesize=");
+        if (!ps || strncmp(ps, "pagesize=2M", 11) == 0) {
+            found = std::string(dir) + "/";
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+#else
+    return "";
+#endif
+}
+
+}
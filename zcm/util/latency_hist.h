@@ -0,0 +1,67 @@
+#ifndef _ZCM_UTIL_LATENCY_HIST_H
+#define _ZCM_UTIL_LATENCY_HIST_H
+
+#include <stdint.h>
+
+/* A log-linear histogram of durations in nanoseconds, in the style of HdrHistogram:
+   values below 8 get a bucket each, and every power of 2 above that is split into 8
+   buckets, so each bucket is within 12.5% of the values counted in it. Values of
+   2^36 ns (about 69 s) and more all land in the last bucket. The user holds the
+   array of ZCM_LATENCY_HIST_BUCKETS counts */
+#define ZCM_LATENCY_HIST_SUB_BITS 3
+#define ZCM_LATENCY_HIST_MAX_BITS 36
+#define ZCM_LATENCY_HIST_BUCKETS \
+    ((ZCM_LATENCY_HIST_MAX_BITS - ZCM_LATENCY_HIST_SUB_BITS + 1) << ZCM_LATENCY_HIST_SUB_BITS)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline uint32_t zcm_latency_hist_bucket(uint64_t ns)
+{
+    uint32_t msb = 0;
+    if (ns < (1 << ZCM_LATENCY_HIST_SUB_BITS)) return (uint32_t) ns;
+    if (ns >> ZCM_LATENCY_HIST_MAX_BITS) return ZCM_LATENCY_HIST_BUCKETS - 1;
+#if defined(__GNUC__)
+    msb = 63 - __builtin_clzll(ns);
+#else
+    while (ns >> (msb + 1)) ++msb;
+#endif
+    return ((msb - ZCM_LATENCY_HIST_SUB_BITS + 1) << ZCM_LATENCY_HIST_SUB_BITS) +
+           (uint32_t) ((ns >> (msb - ZCM_LATENCY_HIST_SUB_BITS)) &
+                       ((1 << ZCM_LATENCY_HIST_SUB_BITS) - 1));
+}
+
+/* The largest value counted in 'bucket' */
+static inline uint64_t zcm_latency_hist_value(uint32_t bucket)
+{
+    uint32_t shift;
+    uint64_t sub;
+    if (bucket < (1 << ZCM_LATENCY_HIST_SUB_BITS)) return bucket;
+    shift = (bucket >> ZCM_LATENCY_HIST_SUB_BITS) - 1;
+    sub = (1 << ZCM_LATENCY_HIST_SUB_BITS) + (bucket & ((1 << ZCM_LATENCY_HIST_SUB_BITS) - 1));
+    return ((sub + 1) << shift) - 1;
+}
+
+/* The value below which 'ppm' parts per million of the 'total' counts lie,
+   rounded up to the end of its bucket. 0 when nothing was counted */
+static inline uint64_t zcm_latency_hist_percentile(const uint64_t* counts, uint64_t total,
+                                                   uint32_t ppm)
+{
+    uint64_t rank = (total * ppm + 999999) / 1000000;
+    uint64_t seen = 0;
+    uint32_t i;
+    if (total == 0) return 0;
+    if (rank == 0) rank = 1;
+    for (i = 0; i < ZCM_LATENCY_HIST_BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) return zcm_latency_hist_value(i);
+    }
+    return zcm_latency_hist_value(ZCM_LATENCY_HIST_BUCKETS - 1);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ZCM_UTIL_LATENCY_HIST_H */
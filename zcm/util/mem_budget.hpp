@@ -0,0 +1,74 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <atomic>
+
+// A count of bytes in use, shared by everyone holding memory against one limit.
+// Charges never block each other; only acquire() waits (for release()s)
+class MemBudget
+{
+    std::atomic<uint64_t> used {0};
+    std::atomic<uint64_t> highWater {0};
+    std::atomic<uint64_t> limit {0}; // 0 for none
+
+    std::mutex mut;
+    std::condition_variable cond;
+    std::atomic<int> waiters {0};
+
+  public:
+    MemBudget() {}
+    ~MemBudget() {}
+
+    uint64_t getLimit() const { return limit.load(std::memory_order_relaxed); }
+    uint64_t getUsed() const { return used.load(std::memory_order_relaxed); }
+    uint64_t getHighWaterMark() const { return highWater.load(std::memory_order_relaxed); }
+
+    void setLimit(uint64_t bytes)
+    {
+        limit.store(bytes, std::memory_order_relaxed);
+        std::unique_lock<std::mutex> lk(mut);
+        cond.notify_all();
+    }
+
+    // Charges 'n' bytes if they fit under the limit. Returns false (charging nothing)
+    // if they don't. A charge larger than the limit still succeeds when nothing else
+    // is charged, so that it can't be refused forever
+    bool tryAcquire(uint64_t n)
+    {
+        uint64_t cur = used.load();
+        do {
+            uint64_t max = limit.load(std::memory_order_relaxed);
+            if (max && cur && cur + n > max) return false;
+        } while (!used.compare_exchange_weak(cur, cur + n));
+
+        uint64_t hwm = highWater.load(std::memory_order_relaxed);
+        while (cur + n > hwm &&
+               !highWater.compare_exchange_weak(hwm, cur + n, std::memory_order_relaxed));
+        return true;
+    }
+
+    // Waits up to 'timeout' for tryAcquire() to succeed
+    bool acquire(uint64_t n, std::chrono::milliseconds timeout)
+    {
+        if (tryAcquire(n)) return true;
+
+        std::unique_lock<std::mutex> lk(mut);
+        waiters++;
+        bool ok = cond.wait_for(lk, timeout, [&](){ return tryAcquire(n); });
+        waiters--;
+        return ok;
+    }
+
+    // Gives back 'n' bytes charged by tryAcquire() or acquire()
+    void release(uint64_t n)
+    {
+        used.fetch_sub(n);
+        // Note: pairs with acquire() bumping 'waiters' before it checks 'used'
+        if (waiters.load()) {
+            std::unique_lock<std::mutex> lk(mut);
+            cond.notify_all();
+        }
+    }
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "zcm/util/queue.hpp"
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+// A thread-safe queue of 'NumLevels' priority levels, each a FIFO Queue of its
+// own capacity. Consumers always get the front of the highest level that has
+// something queued (the highest index), so elements of one level keep their
+// order while a higher level overtakes everything below it.
+// The API follows ThreadsafeQueue, with the level passed explicitly.
+template<class Element, size_t NumLevels>
+class MultiLevelQueue
+{
+    std::unique_ptr<Queue<Element>> levels[NumLevels];
+
+    std::mutex mut;
+    std::condition_variable cond;
+    bool disabled = false;
+    bool woken = false;
+
+    // The most elements ever queued at once (over all levels), written under
+    // 'mut' and read without it
+    std::atomic<size_t> highWater {0};
+
+    // Requires that 'mut' is locked
+    size_t count()
+    {
+        size_t n = 0;
+        for (auto& q : levels) n += q->numMessages();
+        return n;
+    }
+
+    // Requires that 'mut' is locked. Returns NumLevels if every level is empty
+    size_t highest()
+    {
+        for (size_t l = NumLevels; l-- > 0;)
+            if (levels[l]->hasMessage()) return l;
+        return NumLevels;
+    }
+
+    // Requires that 'mut' is locked
+    void noteDepth()
+    {
+        size_t n = count();
+        if (n > highWater.load(std::memory_order_relaxed))
+            highWater.store(n, std::memory_order_relaxed);
+    }
+
+  public:
+    static constexpr size_t NONE = NumLevels;
+
+    MultiLevelQueue(size_t size)
+    {
+        for (auto& q : levels) q.reset(new Queue<Element>(size));
+    }
+    ~MultiLevelQueue() {}
+
+    // The capacity of each level
+    size_t getCapacity()
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        return levels[0]->getCapacity();
+    }
+
+    // Like ThreadsafeQueue::setCapacity(), safe while in use
+    void setCapacity(size_t capacity)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        for (auto& q : levels) q->setCapacity(capacity);
+    }
+
+    bool hasMessage()
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        return highest() != NumLevels;
+    }
+
+    // Over all levels
+    size_t numMessages()
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        return count();
+    }
+
+    size_t numMessages(size_t level)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        return levels[level]->numMessages();
+    }
+
+    size_t getHighWaterMark() const { return highWater.load(std::memory_order_relaxed); }
+
+    // Check for room in 'level' and if so, push the new element there
+    // Returns true if the value was pushed, returns false if no room
+    template<class... Args>
+    bool pushIfRoom(size_t level, Args&&... args)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        Queue<Element>& q = *levels[level];
+        if (!q.hasFreeSpace()) return false;
+
+        q.push(std::forward<Args>(args)...);
+        noteDepth();
+        cond.notify_all();
+        return true;
+    }
+
+    // Check for room for all 'n' elements and if so, push all of them at once.
+    // The i'th element is constructed from (args..., elts[i]) into the level
+    // 'levelOf(elts[i])'. Returns true if the values were pushed, returns false
+    // (pushing nothing) if no room
+    template<class Elt, class LevelOf, class... Args>
+    bool pushBatchIfRoom(const Elt* elts, size_t n, LevelOf levelOf, Args&&... args)
+    {
+        size_t need[NumLevels] = {};
+        for (size_t i = 0; i < n; ++i) ++need[levelOf(elts[i])];
+
+        std::unique_lock<std::mutex> lk(mut);
+        // Note: a Queue of capacity N holds at most N-1 elements
+        for (size_t l = 0; l < NumLevels; ++l)
+            if (need[l] && levels[l]->numMessages() + need[l] >= levels[l]->getCapacity())
+                return false;
+
+        for (size_t i = 0; i < n; ++i) levels[levelOf(elts[i])]->push(args..., elts[i]);
+        noteDepth();
+        cond.notify_all();
+        return true;
+    }
+
+    // Wait for hasMessage() and then return the front element of the highest
+    // level that has one, setting 'level' to that level. Returns nullptr
+    // when forcibly awoken by disable() or wakeup()
+    Element* top(size_t& level)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        cond.wait(lk, [&](){ return disabled || woken || highest() != NumLevels; });
+        woken = false;
+        level = highest();
+        if (disabled || level == NumLevels) return nullptr;
+
+        return &levels[level]->top();
+    }
+
+    // Wait for hasMessage() and then fill 'elts' with up to 'max' elements from the
+    // front of the highest level that has any, setting 'level' to that level.
+    // They stay in the queue until they are removed by popN().
+    // Returns the number of elements, which is only 0 when forcibly awoken
+    size_t topN(Element** elts, size_t max, size_t& level)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        cond.wait(lk, [&](){ return disabled || woken || highest() != NumLevels; });
+        woken = false;
+        level = highest();
+        if (disabled || level == NumLevels) return 0;
+
+        Queue<Element>& q = *levels[level];
+        size_t n = std::min(max, q.numMessages());
+        for (size_t i = 0; i < n; ++i) elts[i] = &q.at(i);
+        return n;
+    }
+
+    // Never waits: returns the front element of the highest level above 'level'
+    // that has one, setting 'found' to that level, or nullptr if there is none
+    Element* peekAbove(size_t level, size_t& found)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        found = highest();
+        if (found == NumLevels || found <= level) return nullptr;
+        return &levels[found]->top();
+    }
+
+    // Requires that 'level' has a message
+    void pop(size_t level)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        levels[level]->pop();
+        cond.notify_all();
+    }
+
+    // Requires that 'level' has at least 'n' messages
+    void popN(size_t level, size_t n)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        for (size_t i = 0; i < n; ++i) levels[level]->pop();
+        cond.notify_all();
+    }
+
+    // Forcefully wakes up top(). top() *will not* return a message from the queue,
+    // even if one exists.
+    void disable()
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        disabled = true;
+        cond.notify_all();
+    }
+
+    void enable()
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        disabled = false;
+    }
+
+    // Wakes up top() once if it is (or next is) waiting on an empty queue.
+    // Unlike disable(), this does not prevent top() from returning messages.
+    void wakeup()
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        woken = true;
+        cond.notify_all();
+    }
+};
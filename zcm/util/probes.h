@@ -0,0 +1,29 @@
+#ifndef _ZCM_UTIL_PROBES_H
+#define _ZCM_UTIL_PROBES_H
+
+/* Static tracepoints (USDT, provider "zcm") along the path of a message, for tracers
+   like bpftrace or perf to attach to a running process, e.g.:
+       bpftrace -e 'usdt:libzcm.so:zcm:dispatch_begin { @[str(arg0)] = count(); }'
+   Built in with --use-usdt (which needs sys/sdt.h). An enabled build only adds a nop
+   per probe until a tracer attaches; otherwise the probes compile to nothing.
+   Every probe takes the channel and the size of the message:
+       publish           zcm_publish() was called
+       send_queue_push   the message was queued for the send thread
+       send_queue_pop    ... and taken off that queue
+       trans_sendmsg     the message is handed to the transport
+       trans_recvmsg     the transport handed the message over
+       recv_queue_push   the message was queued for a dispatch thread
+       recv_queue_pop    ... and taken off that queue
+       dispatch_begin    a callback is called with it (3rd argument: the zcm_sub_t)
+       dispatch_end      ... and returned (3rd argument: the zcm_sub_t) */
+
+#ifdef USING_USDT
+#include <sys/sdt.h>
+#define ZCM_PROBE2(name, a1, a2)     DTRACE_PROBE2(zcm, name, a1, a2)
+#define ZCM_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(zcm, name, a1, a2, a3)
+#else
+#define ZCM_PROBE2(name, a1, a2)     do {} while (0)
+#define ZCM_PROBE3(name, a1, a2, a3) do {} while (0)
+#endif
+
+#endif /* _ZCM_UTIL_PROBES_H */
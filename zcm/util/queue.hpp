@@ -2,45 +2,98 @@
 
 #include <utility>
 #include <memory>
+#include <cstdint>
 #include <cstring>
 #include <cassert>
 
+#include "zcm/zcm.h"
+#include "zcm/zcm_alloc.h"
+
 // A C++ queue implementation designed for efficiency.
 // No unneeded copies or initializations.
+// Elements live in a chain of fixed size segments, taken as the queue grows
+// and given back as it drains, so only the elements queued take up memory
+// (plus a segment or two), whatever the capacity. Elements never move: changing
+// the capacity only changes how many can be pushed.
 // Note: Nothing about this queue is thread-safe
 template<class Element>
 class Queue
 {
-    Element* queue;
-    size_t   capacity;
-    size_t   front = 0;
-    size_t   back = 0;
+    static constexpr size_t CACHE_LINE = 64;
+    // Every slot starts a cache line, so that the element the producer is
+    // writing never shares a line with the one the consumer is reading
+    static constexpr size_t SLOT_SIZE =
+        (sizeof(Element) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    // Note: one might be tempted to use '% capacity' for the slot of an index,
+    //       but the modulus is slow: segments are a power of 2 of slots instead
+    static constexpr size_t SEGMENT_SHIFT = 4;
+    static constexpr size_t SEGMENT_SLOTS = (size_t) 1 << SEGMENT_SHIFT;
+    static constexpr size_t SEGMENT_MASK = SEGMENT_SLOTS - 1;
+
+    struct Segment
+    {
+        Segment* next;
+        uint8_t* slots;
+    };
+
+    // 'front' and 'back' count every element popped and pushed: an index is
+    // in slot 'index & SEGMENT_MASK' of its segment. 'head' is the segment of
+    // 'front' and 'tail' that of 'back' (always there, even if empty). Each
+    // side only writes its own, a cache line away from the other's, even
+    // though callers hold a lock around both
+    // Note: padded rather than alignas(CACHE_LINE): c++11 has no aligned
+    //       operator new, and Queues are allocated with new
+    size_t front = 0;
+    Segment* head;
+    char frontPad[CACHE_LINE - sizeof(size_t) - sizeof(Segment*)];
+    size_t back = 0;
+    Segment* tail;
+    char backPad[CACHE_LINE - sizeof(size_t) - sizeof(Segment*)];
+
+    size_t capacity;          // holds at most capacity - 1 elements
+    Segment* spare = nullptr; // the last segment given back, kept for reuse
+
+    Segment* takeSegment()
+    {
+        Segment* s = spare;
+        if (s) {
+            spare = nullptr;
+        } else {
+            uint8_t* mem = (uint8_t*) zcm_alloc(sizeof(Segment) + CACHE_LINE + SEGMENT_SLOTS * SLOT_SIZE,
+                                                ZCM_ALLOC_BLOCKING);
+            ZCM_ASSERT(mem);
+            s = (Segment*) mem;
+            uintptr_t p = (uintptr_t) (mem + sizeof(Segment));
+            s->slots = (uint8_t*) ((p + CACHE_LINE - 1) & ~(uintptr_t) (CACHE_LINE - 1));
+        }
+        s->next = nullptr;
+        return s;
+    }
 
-    size_t incIdx(size_t i)
+    void giveSegment(Segment* s)
     {
-        // Note: one might be tempted to write '(i + 1) % capacity' here
-        // But, the modulus operation is slower than possibly missing
-        // a branch every once in a while. The branch is almost always
-        // Not Taken
-
-        size_t nextIdx = i + 1;
-        if (nextIdx == capacity) return 0;
-        return nextIdx;
+        if (!spare) spare = s;
+        else        zcm_dealloc(s, ZCM_ALLOC_BLOCKING);
+    }
+
+    Element* slot(Segment* s, size_t i)
+    {
+        return (Element*) (s->slots + (i & SEGMENT_MASK) * SLOT_SIZE);
     }
 
   public:
     Queue(size_t capacity) : capacity(capacity)
     {
         // We are avoiding initializing the structs here
-        queue = (Element*) new uint8_t[capacity * sizeof(Element)];
-        ZCM_ASSERT(queue);
+        head = tail = takeSegment();
     }
 
     ~Queue()
     {
         // We need to deconstruct any elements still in the queue
         while (hasMessage()) pop();
-        delete[] ((uint8_t*) queue);
+        zcm_dealloc(head, ZCM_ALLOC_BLOCKING);
+        zcm_dealloc(spare, ZCM_ALLOC_BLOCKING);
     }
 
     size_t getCapacity()
@@ -48,29 +101,17 @@ class Queue
         return capacity;
     }
 
+    // Takes effect at once, without moving or dropping anything: a queue
+    // holding more than the new capacity allows has no free space until it
+    // drains below it
     void setCapacity(size_t capacity)
     {
-        uint8_t* newQueue = new uint8_t[capacity * sizeof(Element)];
-        ZCM_ASSERT(newQueue);
-
-        size_t newBack = 0;
-        while (hasMessage() && newBack < capacity) {
-            uint8_t* msg = (uint8_t*) &top();
-            std::uninitialized_copy_n(msg, sizeof(Element), newQueue + newBack * sizeof(Element));
-            front = incIdx(front);
-            ++newBack;
-        }
-
-        delete[] ((uint8_t*) queue);
-        queue = (Element*) newQueue;
-        front = 0;
-        back = newBack;
         this->capacity = capacity;
     }
 
     bool hasFreeSpace()
     {
-        return front != incIdx(back);
+        return back - front + 1 < capacity;
     }
 
     bool hasMessage()
@@ -80,11 +121,7 @@ class Queue
 
     size_t numMessages()
     {
-        if (back >= front) {
-            return back - front;
-        } else {
-            return capacity - (front - back);
-        }
+        return back - front;
     }
 
     // Requires that hasFreeSpace() == true
@@ -95,16 +132,30 @@ class Queue
 
         // Initialize the Element by forwarding the parameter pack
         // directly to the constructor called via Placement New
-        new (&queue[back]) Element(std::forward<Args>(args)...);
+        new (slot(tail, back)) Element(std::forward<Args>(args)...);
 
-        back = incIdx(back);
+        if ((++back & SEGMENT_MASK) == 0) {
+            tail->next = takeSegment();
+            tail = tail->next;
+        }
     }
 
     // Requires that hasMessage() == true
     Element& top()
     {
         assert(hasMessage());
-        return queue[front];
+        return *slot(head, front);
+    }
+
+    // Returns the i'th element from the front
+    // Requires that i < numMessages()
+    Element& at(size_t i)
+    {
+        assert(i < numMessages());
+        size_t idx = front + i;
+        Segment* s = head;
+        for (size_t n = (idx >> SEGMENT_SHIFT) - (front >> SEGMENT_SHIFT); n > 0; --n) s = s->next;
+        return *slot(s, idx);
     }
 
     // Requires that hasMessage() == true
@@ -112,8 +163,13 @@ class Queue
     {
         assert(hasMessage());
         // Manually call the destructor
-        queue[front].~Element();
-        front = incIdx(front);
+        slot(head, front)->~Element();
+
+        if ((++front & SEGMENT_MASK) == 0) {
+            Segment* s = head;
+            head = head->next;
+            giveSegment(s);
+        }
     }
 
   private:
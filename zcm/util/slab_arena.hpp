@@ -0,0 +1,161 @@
+#pragma once
+
+#include <mutex>
+#include <cstdint>
+#include <cstdlib>
+#include <cassert>
+
+#include "zcm/zcm_alloc.h"
+
+// A thread-safe size-class allocator designed for the blocking queues.
+// Blocks are rounded up to a power of 2 and recycled through per-class free
+// lists instead of being returned to zcm's allocator. Each free list starts
+// with a few blocks of each small class and only grows from blocks actually
+// freed, up to the arena capacity (normally the queue size), so the memory
+// held tracks the deepest the queue has been rather than how deep it may get.
+// Once the free lists are warm, alloc() and free() never call into
+// zcm_alloc()/zcm_dealloc().
+// Note: requests larger than the largest size class go straight to zcm_alloc()
+class SlabArena
+{
+    struct Block { Block* next; };
+
+    static constexpr size_t MIN_SHIFT = 6;          // 64 B
+    static constexpr size_t MAX_SHIFT = 20;         // 1 MB
+    static constexpr size_t PREFILL_MAX_SHIFT = 12; // 4 KB
+    static constexpr size_t PREFILL_BLOCKS = 8;     // per class, about 64 KB in all
+    static constexpr size_t NUM_CLASSES = MAX_SHIFT - MIN_SHIFT + 1;
+
+    struct SizeClass
+    {
+        Block* head = nullptr;
+        size_t nfree = 0;
+    };
+
+    SizeClass classes[NUM_CLASSES];
+    size_t    capacity;
+    std::mutex mut;
+
+    // Returns NUM_CLASSES if 'sz' is too large for the arena
+    static size_t classOf(size_t sz)
+    {
+        size_t cls = 0;
+        size_t blockSize = (size_t)1 << MIN_SHIFT;
+        while (blockSize < sz && cls < NUM_CLASSES) {
+            blockSize <<= 1;
+            ++cls;
+        }
+        return cls;
+    }
+
+    static size_t blockSize(size_t cls)
+    {
+        return (size_t)1 << (cls + MIN_SHIFT);
+    }
+
+    // Requires that 'mut' is locked
+    void trim()
+    {
+        for (size_t cls = 0; cls < NUM_CLASSES; ++cls) {
+            SizeClass& sc = classes[cls];
+            while (sc.nfree > capacity) {
+                Block* b = sc.head;
+                sc.head = b->next;
+                sc.nfree--;
+                zcm_dealloc(b, ZCM_ALLOC_BLOCKING);
+            }
+        }
+    }
+
+    // Requires that 'mut' is locked
+    void prefill()
+    {
+        size_t n = capacity < PREFILL_BLOCKS ? capacity : PREFILL_BLOCKS;
+        for (size_t cls = 0; cls <= PREFILL_MAX_SHIFT - MIN_SHIFT; ++cls) {
+            SizeClass& sc = classes[cls];
+            while (sc.nfree < n) {
+                Block* b = (Block*) zcm_alloc(blockSize(cls), ZCM_ALLOC_BLOCKING);
+                if (!b) return;
+                b->next = sc.head;
+                sc.head = b;
+                sc.nfree++;
+            }
+        }
+    }
+
+  public:
+    // Note: a queue of capacity N has at most N elements alive plus one being
+    //       constructed, hence the "+ 1"
+    SlabArena(size_t capacity) : capacity(capacity + 1)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        prefill();
+    }
+
+    ~SlabArena()
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        capacity = 0;
+        trim();
+    }
+
+    // Only ever gives blocks back: the free lists grow to a larger capacity
+    // as blocks are freed
+    void setCapacity(size_t capacity)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        this->capacity = capacity + 1;
+        trim();
+    }
+
+    uint8_t* alloc(size_t sz)
+    {
+        size_t cls = classOf(sz);
+        if (cls == NUM_CLASSES) return (uint8_t*) zcm_alloc(sz, ZCM_ALLOC_BLOCKING);
+
+        {
+            std::unique_lock<std::mutex> lk(mut);
+            SizeClass& sc = classes[cls];
+            if (sc.head) {
+                Block* b = sc.head;
+                sc.head = b->next;
+                sc.nfree--;
+                return (uint8_t*) b;
+            }
+        }
+
+        return (uint8_t*) zcm_alloc(blockSize(cls), ZCM_ALLOC_BLOCKING);
+    }
+
+    // Note: 'sz' must be the same size that was passed to alloc()
+    void free(uint8_t* mem, size_t sz)
+    {
+        if (!mem) return;
+
+        size_t cls = classOf(sz);
+        if (cls == NUM_CLASSES) {
+            zcm_dealloc(mem, ZCM_ALLOC_BLOCKING);
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> lk(mut);
+            SizeClass& sc = classes[cls];
+            if (sc.nfree < capacity) {
+                Block* b = (Block*) mem;
+                b->next = sc.head;
+                sc.head = b;
+                sc.nfree++;
+                return;
+            }
+        }
+
+        zcm_dealloc(mem, ZCM_ALLOC_BLOCKING);
+    }
+
+  private:
+    SlabArena(const SlabArena& other) = delete;
+    SlabArena(SlabArena&& other) = delete;
+    SlabArena& operator=(const SlabArena& other) = delete;
+    SlabArena& operator=(SlabArena&& other) = delete;
+};
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <utility>
+#include <cstdint>
+#include <cassert>
+#include <cstring>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "zcm/zcm_alloc.h"
+
+// A lock-free single-producer/single-consumer queue with the same interface
+// as ThreadsafeQueue. The producer and consumer only touch their own index
+// and never take a lock on the fast path. Blocking callers (push() on a full
+// queue, top() on an empty one) spin briefly and then sleep on a condition
+// variable; the opposite side only pays for a wakeup when someone is asleep.
+// Note: push()/pushIfRoom() must only be called from one thread at a time and
+//       top()/pop() must only be called from one (other) thread at a time.
+//       setCapacity() must be called from the consumer side.
+template<class Element>
+class SpscQueue
+{
+    static constexpr size_t CACHE_LINE = 64;
+    static constexpr int    SPIN_COUNT = 16;
+
+    // Each a cache line away from the other and from the fields after them
+    // Note: padded rather than alignas(CACHE_LINE): c++11 has no aligned
+    //       operator new, and queues are allocated with new
+    // Written by the consumer only
+    std::atomic<size_t> front {0};
+    char frontPad[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    // Written by the producer only
+    std::atomic<size_t> back {0};
+    char backPad[CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+    Element* queue;
+    size_t capacity;
+
+    std::atomic<bool> disabled {false};
+    std::atomic<bool> woken {false};
+
+    // Used to exclude the producer while the queue is resized
+    std::atomic<bool> producing {false};
+    std::atomic<bool> resizing {false};
+
+    // Statistics, written by the producer only: the most elements ever queued
+    // at once, and the time push() spent waiting for room
+    std::atomic<size_t>   highWater {0};
+    std::atomic<uint64_t> blockedNs {0};
+
+    // Slow path only: sleeping and waking up
+    std::atomic<int> waiters {0};
+    std::mutex mut;
+    std::condition_variable cond;
+
+    size_t incIdx(size_t i) const
+    {
+        size_t nextIdx = i + 1;
+        if (nextIdx == capacity) return 0;
+        return nextIdx;
+    }
+
+    bool _hasFreeSpace() const
+    {
+        return front.load(std::memory_order_acquire) !=
+               incIdx(back.load(std::memory_order_relaxed));
+    }
+
+    bool _hasMessage() const
+    {
+        return front.load(std::memory_order_relaxed) !=
+               back.load(std::memory_order_acquire);
+    }
+
+    // Wake any sleeper. The seq_cst load pairs with the seq_cst increment in
+    // sleepUntil() so a sleeper either sees our update or gets notified
+    void wake()
+    {
+        if (waiters.load() > 0) {
+            { std::unique_lock<std::mutex> lk(mut); }
+            cond.notify_all();
+        }
+    }
+
+    template<class Pred>
+    void sleepUntil(Pred pred)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        waiters++;
+        cond.wait(lk, pred);
+        waiters--;
+    }
+
+    template<class Pred>
+    void sleepUntil(Pred pred, std::chrono::steady_clock::time_point until)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        waiters++;
+        cond.wait_until(lk, until, pred);
+        waiters--;
+    }
+
+    // Returns true while the caller should keep polling instead of sleeping.
+    // Yielding (rather than pure spinning) keeps this cheap when the other side
+    // is waiting for the same core
+    static bool backoff(int& spins)
+    {
+        if (++spins >= SPIN_COUNT) return false;
+        std::this_thread::yield();
+        return true;
+    }
+
+    void enterProducer()
+    {
+        producing.store(true);
+        while (resizing.load()) {
+            producing.store(false);
+            sleepUntil([&](){ return !resizing.load(); });
+            producing.store(true);
+        }
+    }
+
+    void exitProducer()
+    {
+        producing.store(false);
+    }
+
+    template<class... Args>
+    void _push(Args&&... args)
+    {
+        size_t b = back.load(std::memory_order_relaxed);
+        new (&queue[b]) Element(std::forward<Args>(args)...);
+        b = incIdx(b);
+        back.store(b);
+
+        size_t f = front.load(std::memory_order_relaxed);
+        size_t n = b >= f ? b - f : capacity - (f - b);
+        if (n > highWater.load(std::memory_order_relaxed))
+            highWater.store(n, std::memory_order_relaxed);
+
+        exitProducer();
+        wake();
+    }
+
+  public:
+    SpscQueue(size_t capacity) : capacity(capacity)
+    {
+        // We are avoiding initializing the structs here
+        queue = (Element*) zcm_alloc(capacity * sizeof(Element), ZCM_ALLOC_BLOCKING);
+        ZCM_ASSERT(queue);
+    }
+
+    ~SpscQueue()
+    {
+        while (_hasMessage()) pop();
+        zcm_dealloc(queue, ZCM_ALLOC_BLOCKING);
+    }
+
+    size_t getCapacity()
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        return capacity;
+    }
+
+    void setCapacity(size_t newCapacity)
+    {
+        resizing.store(true);
+        while (producing.load()) std::this_thread::yield();
+
+        {
+            std::unique_lock<std::mutex> lk(mut);
+            Element* newQueue = (Element*) zcm_alloc(newCapacity * sizeof(Element), ZCM_ALLOC_BLOCKING);
+            ZCM_ASSERT(newQueue);
+
+            size_t newBack = 0;
+            while (_hasMessage()) {
+                size_t f = front.load(std::memory_order_relaxed);
+                // Note: like Queue, elements are relocated bytewise.
+                //       A queue of capacity N holds at most N-1 elements
+                if (newBack + 1 < newCapacity) {
+                    memcpy((void*) &newQueue[newBack], (void*) &queue[f], sizeof(Element));
+                    ++newBack;
+                } else {
+                    queue[f].~Element();
+                }
+                front.store(incIdx(f), std::memory_order_relaxed);
+            }
+
+            zcm_dealloc(queue, ZCM_ALLOC_BLOCKING);
+            queue = newQueue;
+            capacity = newCapacity;
+            front.store(0);
+            back.store(newBack);
+            resizing.store(false);
+        }
+        cond.notify_all();
+    }
+
+    bool hasFreeSpace() { return _hasFreeSpace(); }
+    bool hasMessage()   { return _hasMessage(); }
+
+    size_t numMessages()
+    {
+        size_t f = front.load();
+        size_t b = back.load();
+        if (b >= f) return b - f;
+        return capacity - (f - b);
+    }
+
+    size_t getHighWaterMark() const { return highWater.load(std::memory_order_relaxed); }
+    uint64_t getBlockedNs() const { return blockedNs.load(std::memory_order_relaxed); }
+
+    // Wait for hasFreeSpace() and then push the new element
+    // Returns true if the value was pushed, otherwise it
+    // was forcibly awoken by disable()
+    template<class... Args>
+    bool push(Args&&... args)
+    {
+        int spins = 0;
+        bool blocked = false;
+        std::chrono::steady_clock::time_point start;
+        while (true) {
+            enterProducer();
+            if (_hasFreeSpace()) break;
+            exitProducer();
+
+            if (!blocked) {
+                blocked = true;
+                start = std::chrono::steady_clock::now();
+            }
+            if (disabled.load()) return false;
+            if (backoff(spins)) continue;
+            sleepUntil([&](){ return disabled.load() || _hasFreeSpace(); });
+        }
+
+        if (blocked) {
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - start).count();
+            blockedNs.store(blockedNs.load(std::memory_order_relaxed) + ns,
+                            std::memory_order_relaxed);
+        }
+        _push(std::forward<Args>(args)...);
+        return true;
+    }
+
+    // Check for hasFreeSpace() and if so, push the new element
+    // Returns true if the value was pushed, returns false if no room
+    template<class... Args>
+    bool pushIfRoom(Args&&... args)
+    {
+        enterProducer();
+        if (!_hasFreeSpace()) {
+            exitProducer();
+            return false;
+        }
+        _push(std::forward<Args>(args)...);
+        return true;
+    }
+
+    // Wait for hasMessage() and then return the top element
+    // Always returns a valid Element* except when is was
+    // forcibly awoken by disable() or wakeup(). In such a case
+    // nullptr is returned to the user
+    Element* top()
+    {
+        int spins = 0;
+        while (!_hasMessage()) {
+            if (disabled.load()) return nullptr;
+            if (woken.exchange(false)) return nullptr;
+            if (backoff(spins)) continue;
+            sleepUntil([&](){ return disabled.load() || woken.load() || _hasMessage(); });
+        }
+        if (disabled.load()) return nullptr;
+        return &queue[front.load(std::memory_order_relaxed)];
+    }
+
+    // Same as top(), except that it also gives up (returning nullptr) at 'until'
+    Element* topUntil(std::chrono::steady_clock::time_point until)
+    {
+        int spins = 0;
+        while (!_hasMessage()) {
+            if (disabled.load()) return nullptr;
+            if (woken.exchange(false)) return nullptr;
+            if (std::chrono::steady_clock::now() >= until) return nullptr;
+            if (backoff(spins)) continue;
+            sleepUntil([&](){ return disabled.load() || woken.load() || _hasMessage(); }, until);
+        }
+        if (disabled.load()) return nullptr;
+        return &queue[front.load(std::memory_order_relaxed)];
+    }
+
+    // Requires that hasMessage() == true
+    void pop()
+    {
+        assert(_hasMessage());
+        size_t f = front.load(std::memory_order_relaxed);
+        queue[f].~Element();
+        front.store(incIdx(f));
+        wake();
+    }
+
+    // Forcefully wakes up top() and push(). top() *will not* return a message from
+    // the queue, even if one exists. push() *will* push the message if there is room.
+    void disable()
+    {
+        disabled.store(true);
+        { std::unique_lock<std::mutex> lk(mut); }
+        cond.notify_all();
+    }
+
+    void enable()
+    {
+        disabled.store(false);
+    }
+
+    // Wakes up top() once if it is (or next is) waiting on an empty queue.
+    // Unlike disable(), this does not prevent top() from returning messages.
+    // May be called from any thread
+    void wakeup()
+    {
+        woken.store(true);
+        wake();
+    }
+
+  private:
+    SpscQueue(const SpscQueue& other) = delete;
+    SpscQueue(SpscQueue&& other) = delete;
+    SpscQueue& operator=(const SpscQueue& other) = delete;
+    SpscQueue& operator=(SpscQueue&& other) = delete;
+};
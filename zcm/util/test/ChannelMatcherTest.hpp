@@ -0,0 +1,95 @@
+#pragma once
+
+#include <regex>
+
+#include "cxxtest/TestSuite.h"
+
+#include "channel_matcher.hpp"
+
+class ChannelMatcherTest : public CxxTest::TestSuite
+{
+    zcm_sub_t subs[4];
+
+    void makeSub(zcm_sub_t& sub, const char* pattern)
+    {
+        strncpy(sub.channel, pattern, ZCM_CHANNEL_MAXLEN);
+        sub.channel[ZCM_CHANNEL_MAXLEN] = '\0';
+        sub.regex = 1;
+        sub.regexobj = new std::regex(pattern);
+    }
+
+  public:
+    void setUp() override
+    {
+        makeSub(subs[0], "SENSOR_.*");
+        makeSub(subs[1], "(FOO|SENSOR_A)");
+        makeSub(subs[2], ".*");
+        makeSub(subs[3], "SENSOR_B.*");
+    }
+
+    void tearDown() override
+    {
+        for (auto& sub : subs) delete (std::regex*) sub.regexobj;
+    }
+
+    void testMatchPreservesOrder()
+    {
+        ChannelMatcher m;
+        for (auto& sub : subs) m.add(&sub);
+
+        auto res = m.match("SENSOR_A");
+        TS_ASSERT_EQUALS(res->size(), 3);
+        TS_ASSERT_EQUALS((*res)[0], &subs[0]);
+        TS_ASSERT_EQUALS((*res)[1], &subs[1]);
+        TS_ASSERT_EQUALS((*res)[2], &subs[2]);
+
+        res = m.match("SENSOR_BX");
+        TS_ASSERT_EQUALS(res->size(), 3);
+        TS_ASSERT_EQUALS((*res)[2], &subs[3]);
+
+        res = m.match("OTHER");
+        TS_ASSERT_EQUALS(res->size(), 1);
+        TS_ASSERT_EQUALS((*res)[0], &subs[2]);
+    }
+
+    void testCacheInvalidation()
+    {
+        ChannelMatcher m;
+        m.add(&subs[0]);
+        TS_ASSERT_EQUALS(m.match("SENSOR_A")->size(), 1);
+        TS_ASSERT_EQUALS(m.match("SENSOR_A"), m.match("SENSOR_A"));
+
+        m.add(&subs[1]);
+        TS_ASSERT_EQUALS(m.match("SENSOR_A")->size(), 2);
+
+        TS_ASSERT(m.remove(&subs[0]));
+        TS_ASSERT(!m.remove(&subs[0]));
+        TS_ASSERT_EQUALS(m.match("SENSOR_A")->size(), 1);
+        TS_ASSERT_EQUALS(m.match("SENSOR_C")->size(), 0);
+    }
+
+    void testExactAndVersion()
+    {
+        zcm_sub_t exact;
+        strncpy(exact.channel, "SENSOR_A", ZCM_CHANNEL_MAXLEN);
+        exact.regex = 0;
+        exact.regexobj = nullptr;
+
+        ChannelMatcher m;
+        uint64_t v0 = m.version();
+        m.add(&subs[0]);
+        m.add(&exact);
+        TS_ASSERT_DIFFERS(m.version(), v0);
+        TS_ASSERT_EQUALS(m.numRegex(), 1);
+
+        auto res = m.match("SENSOR_A");
+        TS_ASSERT_EQUALS(res->size(), 2);
+        TS_ASSERT_EQUALS((*res)[1], &exact);
+        TS_ASSERT_EQUALS(m.match("SENSOR_AB")->size(), 1);
+
+        uint64_t v1 = m.version();
+        TS_ASSERT(m.remove(&exact));
+        TS_ASSERT_DIFFERS(m.version(), v1);
+        TS_ASSERT_EQUALS(m.match("SENSOR_A")->size(), 1);
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+
+#include "cxxtest/TestSuite.h"
+
+#include "queue.hpp"
+
+class QueueTest : public CxxTest::TestSuite
+{
+    // Counts its constructions and destructions, to catch leaked or doubly
+    // destroyed elements
+    struct Counted
+    {
+        size_t value;
+        Counted(size_t value) : value(value) { ++live(); }
+        ~Counted() { --live(); }
+        static int& live() { static int n = 0; return n; }
+    };
+
+  public:
+    void setUp() override { Counted::live() = 0; }
+    void tearDown() override {}
+
+    // Many more elements than a segment holds go through, a few at a time, so
+    // that segments are taken and given back over and over
+    void testWraparound()
+    {
+        Queue<Counted> q(40);
+        size_t pushed = 0, popped = 0;
+        for (size_t round = 0; round < 200; ++round) {
+            for (size_t i = 0; i < round % 37 && q.hasFreeSpace(); ++i) q.push(pushed++);
+            for (size_t i = 0; i < round % 23 && q.hasMessage(); ++i) {
+                TS_ASSERT_EQUALS(q.top().value, popped++);
+                q.pop();
+            }
+            TS_ASSERT_EQUALS(q.numMessages(), pushed - popped);
+            TS_ASSERT_EQUALS(Counted::live(), (int) (pushed - popped));
+        }
+        TS_ASSERT(pushed > 1000);
+        while (q.hasMessage()) {
+            TS_ASSERT_EQUALS(q.top().value, popped++);
+            q.pop();
+        }
+        TS_ASSERT_EQUALS(popped, pushed);
+        TS_ASSERT_EQUALS(Counted::live(), 0);
+    }
+
+    // The front is in the middle of a segment and the elements span several
+    void testAtAcrossSegments()
+    {
+        Queue<Counted> q(100);
+        for (size_t i = 0; i < 70; ++i) q.push(i);
+        for (size_t i = 0; i < 7; ++i) q.pop();
+        for (size_t i = 0; i < q.numMessages(); ++i) {
+            TS_ASSERT_EQUALS(q.at(i).value, i + 7);
+            // Every element starts a cache line
+            TS_ASSERT_EQUALS((uintptr_t) &q.at(i) % 64, 0);
+        }
+        TS_ASSERT_EQUALS(&q.at(0), &q.top());
+
+        // Still right once the front crossed into the next segment
+        for (size_t i = 0; i < 20; ++i) q.pop();
+        for (size_t i = 0; i < q.numMessages(); ++i) TS_ASSERT_EQUALS(q.at(i).value, i + 27);
+    }
+
+    // Holds capacity - 1 elements
+    void testCapacity()
+    {
+        Queue<Counted> q(20);
+        size_t n = 0;
+        while (q.hasFreeSpace()) q.push(n++);
+        TS_ASSERT_EQUALS(n, 19);
+        TS_ASSERT_EQUALS(q.getCapacity(), 20);
+    }
+
+    // Shrinking keeps every element, and takes no more until the queue drains
+    // below the new capacity. Growing makes room at once
+    void testSetCapacity()
+    {
+        Queue<Counted> q(40);
+        for (size_t i = 0; i < 30; ++i) q.push(i);
+        q.setCapacity(10);
+        TS_ASSERT(!q.hasFreeSpace());
+        TS_ASSERT_EQUALS(q.numMessages(), 30);
+        for (size_t i = 0; i < 21; ++i) {
+            TS_ASSERT_EQUALS(q.top().value, i);
+            q.pop();
+        }
+        TS_ASSERT(!q.hasFreeSpace());
+        q.pop();
+        TS_ASSERT(q.hasFreeSpace());
+
+        q.setCapacity(100);
+        for (size_t i = 30; q.hasFreeSpace(); ++i) q.push(i);
+        TS_ASSERT_EQUALS(q.numMessages(), 99);
+        for (size_t i = 0; i < q.numMessages(); ++i) TS_ASSERT_EQUALS(q.at(i).value, i + 22);
+    }
+
+    // Elements still queued are destroyed with the queue
+    void testDestroyQueued()
+    {
+        {
+            Queue<Counted> q(100);
+            for (size_t i = 0; i < 50; ++i) q.push(i);
+            for (size_t i = 0; i < 5; ++i) q.pop();
+            TS_ASSERT_EQUALS(Counted::live(), 45);
+        }
+        TS_ASSERT_EQUALS(Counted::live(), 0);
+    }
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <fstream>
+#include <cstdio>
+
+#ifdef __linux__
+# include <pthread.h>
+# include <sched.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+// Small platform wrappers for tuning the threads zcm runs internally.
+// All of them act on the calling thread and return false when the
+// request failed or isn't supported on this platform.
+namespace ThreadUtil {
+
+// Parses a list of cpus like "1,4-6", as found in /sys
+static inline bool parseCpuList(const std::string& str, std::vector<int>& cpus)
+{
+    cpus.clear();
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos) end = str.size();
+        std::string tok = str.substr(pos, end - pos);
+        pos = end + 1;
+
+        int first, last;
+        char trailing;
+        if (sscanf(tok.c_str(), "%d-%d%c", &first, &last, &trailing) == 2) {
+            if (first < 0 || last < first) return false;
+            for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        } else if (sscanf(tok.c_str(), "%d%c", &first, &trailing) == 1 && first >= 0) {
+            cpus.push_back(first);
+        } else {
+            return false;
+        }
+    }
+    return !cpus.empty();
+}
+
+// Pins the calling thread to 'cpus'. An empty list allows every cpu
+static inline bool setAffinity(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpus.empty()) {
+        int ncpus = std::thread::hardware_concurrency();
+        for (int i = 0; i < ncpus && i < CPU_SETSIZE; ++i) CPU_SET(i, &set);
+    } else {
+        for (int cpu : cpus) {
+            if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return cpus.empty();
+#endif
+}
+
+static inline bool getAffinity(std::vector<int>& cpus)
+{
+    cpus.clear();
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0) return false;
+    for (int i = 0; i < CPU_SETSIZE; ++i)
+        if (CPU_ISSET(i, &set)) cpus.push_back(i);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// The cpus of NUMA node 'node'
+static inline bool getNodeCpus(int node, std::vector<int>& cpus)
+{
+#ifdef __linux__
+    if (node < 0) return false;
+    std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    return std::getline(f, list) && parseCpuList(list, cpus);
+#else
+    (void) node;
+    (void) cpus;
+    return false;
+#endif
+}
+
+// The NUMA node of the network interface 'ifname' (e.g. "eth0"), or -1 if
+// it has none or isn't known
+static inline int getInterfaceNode(const std::string& ifname)
+{
+#ifdef __linux__
+    if (ifname.empty() || ifname.find('/') != std::string::npos) return -1;
+    std::ifstream f("/sys/class/net/" + ifname + "/device/numa_node");
+    int node = -1;
+    if (!(f >> node)) return -1;
+    return node;
+#else
+    (void) ifname;
+    return -1;
+#endif
+}
+
+// The memory policy of a thread: where the kernel takes the pages it touches from.
+// 'mask' holds one bit per NUMA node, for nodes 0 to 63
+struct MemPolicy
+{
+    int mode = 0;
+    unsigned long mask = 0;
+};
+
+#if defined(__linux__) && defined(SYS_set_mempolicy) && defined(SYS_get_mempolicy)
+// Note: the kernel takes one bit less of 'mask' than it is told
+static constexpr unsigned long MEMPOLICY_MAXNODE = sizeof(unsigned long) * 8 + 1;
+#endif
+
+static inline bool getMemPolicy(MemPolicy& pol)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy) && defined(SYS_get_mempolicy)
+    return syscall(SYS_get_mempolicy, &pol.mode, &pol.mask, MEMPOLICY_MAXNODE, 0, 0) == 0;
+#else
+    (void) pol;
+    return false;
+#endif
+}
+
+static inline bool setMemPolicy(const MemPolicy& pol)
+{
+#if defined(__linux__) && defined(SYS_set_mempolicy) && defined(SYS_get_mempolicy)
+    return syscall(SYS_set_mempolicy, pol.mode,
+                   pol.mask ? &pol.mask : nullptr, pol.mask ? MEMPOLICY_MAXNODE : 0) == 0;
+#else
+    (void) pol;
+    return false;
+#endif
+}
+
+// Takes the memory the calling thread touches from now on from NUMA node 'node'
+// while it has any free (MPOL_PREFERRED), or back from anywhere if 'node' < 0
+static inline bool setPreferredNode(int node)
+{
+    static constexpr int MPOL_DEFAULT_MODE = 0, MPOL_PREFERRED_MODE = 1;
+    MemPolicy pol;
+    if (node >= (int) (sizeof(pol.mask) * 8)) return false;
+    if (node >= 0) {
+        pol.mode = MPOL_PREFERRED_MODE;
+        pol.mask = 1ul << node;
+    } else {
+        pol.mode = MPOL_DEFAULT_MODE;
+    }
+    return setMemPolicy(pol);
+}
+
+// Scheduling policy and priority of a thread, as used by pthread_setschedparam()
+struct Scheduling
+{
+    int policy = 0;
+    int priority = 0;
+};
+
+static inline bool getScheduling(Scheduling& sched)
+{
+#ifdef __linux__
+    sched_param param;
+    if (pthread_getschedparam(pthread_self(), &sched.policy, &param) != 0) return false;
+    sched.priority = param.sched_priority;
+    return true;
+#else
+    (void) sched;
+    return false;
+#endif
+}
+
+static inline bool setScheduling(const Scheduling& sched)
+{
+#ifdef __linux__
+    sched_param param {};
+    param.sched_priority = sched.priority;
+    return pthread_setschedparam(pthread_self(), sched.policy, &param) == 0;
+#else
+    (void) sched;
+    return false;
+#endif
+}
+
+// Runs the calling thread under SCHED_FIFO at 'priority' (1-99, higher wins).
+// A priority of 0 puts it back under the default time-sharing scheduler.
+// Note: usually requires CAP_SYS_NICE or a matching RLIMIT_RTPRIO
+static inline bool setRealtimePriority(int priority)
+{
+#ifdef __linux__
+    Scheduling sched;
+    sched.policy = priority > 0 ? SCHED_FIFO : SCHED_OTHER;
+    sched.priority = priority;
+    return setScheduling(sched);
+#else
+    return priority == 0;
+#endif
+}
+
+// The kernel limits thread names to 15 characters; longer names are truncated
+static constexpr size_t MAX_NAME_LEN = 15;
+
+static inline bool setName(const std::string& name)
+{
+#ifdef __linux__
+    return pthread_setname_np(pthread_self(), name.substr(0, MAX_NAME_LEN).c_str()) == 0;
+#else
+    (void) name;
+    return false;
+#endif
+}
+
+static inline bool getName(std::string& name)
+{
+#ifdef __linux__
+    char buf[MAX_NAME_LEN + 1];
+    if (pthread_getname_np(pthread_self(), buf, sizeof(buf)) != 0) return false;
+    name = buf;
+    return true;
+#else
+    (void) name;
+    return false;
+#endif
+}
+
+// Everything above, saved so it can be handed back to a thread we borrowed
+struct Attributes
+{
+    bool hasCpus, hasSched, hasName, hasMemPolicy;
+    std::vector<int> cpus;
+    Scheduling sched;
+    std::string name;
+    MemPolicy memPolicy;
+
+    void save()
+    {
+        hasCpus = getAffinity(cpus);
+        hasSched = getScheduling(sched);
+        hasName = getName(name);
+        hasMemPolicy = getMemPolicy(memPolicy);
+    }
+
+    void restore() const
+    {
+        if (hasCpus) setAffinity(cpus);
+        if (hasSched) setScheduling(sched);
+        if (hasName) setName(name);
+        if (hasMemPolicy) setMemPolicy(memPolicy);
+    }
+};
+
+// Tells the cpu that we are in a spin-wait loop
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+// Exponential-ish backoff for polling loops: relaxes the cpu for the first
+// few calls and then starts yielding to other threads
+class Backoff
+{
+    static constexpr unsigned SPIN_COUNT = 64;
+    unsigned n = 0;
+
+  public:
+    void pause()
+    {
+        if (n < SPIN_COUNT) {
+            for (unsigned i = 0; i <= n; ++i) cpuRelax();
+            ++n;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    void reset() { n = 0; }
+};
+
+}
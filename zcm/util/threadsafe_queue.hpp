@@ -3,8 +3,10 @@
 #include "zcm/util/queue.hpp"
 
 #include <mutex>
+#include <chrono>
 #include <condition_variable>
 #include <atomic>
+#include <algorithm>
 
 // A thread-safe C++ queue implementation designed for efficiency.
 // No unneeded copies or initializations.
@@ -17,6 +19,20 @@ class ThreadsafeQueue
     std::mutex mut;
     std::condition_variable cond;
     bool disabled = false;
+    bool woken = false;
+
+    // Statistics, written under 'mut' and read without it: the most elements
+    // ever queued at once, and the time push() spent waiting for room
+    std::atomic<size_t>   highWater {0};
+    std::atomic<uint64_t> blockedNs {0};
+
+    // Requires that 'mut' is locked
+    void noteDepth()
+    {
+        size_t n = queue.numMessages();
+        if (n > highWater.load(std::memory_order_relaxed))
+            highWater.store(n, std::memory_order_relaxed);
+    }
 
   public:
     ThreadsafeQueue(size_t size) : queue(size) {}
@@ -28,10 +44,13 @@ class ThreadsafeQueue
         return queue.getCapacity();
     }
 
+    // Never moves or drops elements, so producers and consumers can carry on
+    // through it: pushes waiting for room are woken up if it grew
     void setCapacity(size_t capacity)
     {
         std::unique_lock<std::mutex> lk(mut);
-        return queue.setCapacity(capacity);
+        queue.setCapacity(capacity);
+        cond.notify_all();
     }
 
     bool hasFreeSpace()
@@ -52,6 +71,9 @@ class ThreadsafeQueue
         return queue.numMessages();
     }
 
+    size_t getHighWaterMark() const { return highWater.load(std::memory_order_relaxed); }
+    uint64_t getBlockedNs() const { return blockedNs.load(std::memory_order_relaxed); }
+
     // Wait for hasFreeSpace() and then push the new element
     // Returns true if the value was pushed, otherwise it
     // was forcibly awoken by forceWakeups()
@@ -59,10 +81,18 @@ class ThreadsafeQueue
     bool push(Args&&... args)
     {
         std::unique_lock<std::mutex> lk(mut);
-        cond.wait(lk, [&](){ return disabled || queue.hasFreeSpace(); });
+        if (!disabled && !queue.hasFreeSpace()) {
+            auto start = std::chrono::steady_clock::now();
+            cond.wait(lk, [&](){ return disabled || queue.hasFreeSpace(); });
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - start).count();
+            blockedNs.store(blockedNs.load(std::memory_order_relaxed) + ns,
+                            std::memory_order_relaxed);
+        }
         if (!queue.hasFreeSpace()) return false;
 
         queue.push(std::forward<Args>(args)...);
+        noteDepth();
         cond.notify_all();
         return true;
     }
@@ -76,24 +106,69 @@ class ThreadsafeQueue
         if (!queue.hasFreeSpace()) return false;
 
         queue.push(std::forward<Args>(args)...);
+        noteDepth();
+        cond.notify_all();
+        return true;
+    }
+
+    // Check for room for all 'n' elements and if so, push all of them at once.
+    // The i'th element is constructed from (args..., elts[i]).
+    // Returns true if the values were pushed, returns false (pushing nothing) if no room
+    template<class Elt, class... Args>
+    bool pushBatchIfRoom(const Elt* elts, size_t n, Args&&... args)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        // Note: a Queue of capacity N holds at most N-1 elements
+        if (queue.numMessages() + n >= queue.getCapacity()) return false;
+
+        for (size_t i = 0; i < n; ++i) queue.push(args..., elts[i]);
+        noteDepth();
         cond.notify_all();
         return true;
     }
 
     // Wait for hasMessage() and then return the top element
     // Always returns a valid Element* except when is was
-    // forcibly awoken by forceWakeups(). In such a case
+    // forcibly awoken by disable() or wakeup(). In such a case
     // nullptr is returned to the user
     Element* top()
     {
         std::unique_lock<std::mutex> lk(mut);
-        cond.wait(lk, [&](){ return disabled || queue.hasMessage(); });
-        if (disabled) return nullptr;
+        cond.wait(lk, [&](){ return disabled || woken || queue.hasMessage(); });
+        woken = false;
+        if (disabled || !queue.hasMessage()) return nullptr;
 
         Element& elt = queue.top();
         return &elt;
     }
 
+    // Same as top(), except that it also gives up (returning nullptr) at 'until'
+    Element* topUntil(std::chrono::steady_clock::time_point until)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        cond.wait_until(lk, until, [&](){ return disabled || woken || queue.hasMessage(); });
+        woken = false;
+        if (disabled || !queue.hasMessage()) return nullptr;
+
+        Element& elt = queue.top();
+        return &elt;
+    }
+
+    // Wait for hasMessage() and then fill 'elts' with up to 'max' elements from the
+    // front of the queue. They stay in the queue until they are removed by popN().
+    // Returns the number of elements, which is only 0 when forcibly awoken
+    size_t topN(Element** elts, size_t max)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        cond.wait(lk, [&](){ return disabled || woken || queue.hasMessage(); });
+        woken = false;
+        if (disabled) return 0;
+
+        size_t n = std::min(max, queue.numMessages());
+        for (size_t i = 0; i < n; ++i) elts[i] = &queue.at(i);
+        return n;
+    }
+
     // Requires that hasMessage() == true
     void pop()
     {
@@ -102,6 +177,14 @@ class ThreadsafeQueue
         cond.notify_all();
     }
 
+    // Requires that numMessages() >= n
+    void popN(size_t n)
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        for (size_t i = 0; i < n; ++i) queue.pop();
+        cond.notify_all();
+    }
+
     // Forcefully wakes up top() and push(). top() *will not* return a message from
     // the queue, even if one exists. push() *will* push the message if there is room.
     void disable()
@@ -116,4 +199,13 @@ class ThreadsafeQueue
         std::unique_lock<std::mutex> lk(mut);
         disabled = false;
     }
+
+    // Wakes up top() once if it is (or next is) waiting on an empty queue.
+    // Unlike disable(), this does not prevent top() from returning messages.
+    void wakeup()
+    {
+        std::unique_lock<std::mutex> lk(mut);
+        woken = true;
+        cond.notify_all();
+    }
 };
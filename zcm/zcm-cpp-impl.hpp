@@ -31,7 +31,7 @@ inline ZCM::ZCM(const std::string& transport)
 
 inline ZCM::ZCM(zcm_trans_t* zt)
 {
-    zcm = (zcm_t*) malloc(sizeof(zcm_t));
+    zcm = (zcm_t*) zcm_alloc(sizeof(zcm_t), ZCM_ALLOC_CORE);
     zcm_init_trans(zcm, zt);
 }
 
@@ -107,6 +107,11 @@ inline int ZCM::handle()
 {
     return zcm_handle(zcm);
 }
+
+inline int ZCM::handle(uint32_t timeoutUs)
+{
+    return zcm_handle_timeout(zcm, timeoutUs);
+}
 #endif
 
 #ifndef ZCM_EMBEDDED
@@ -114,6 +119,128 @@ inline void ZCM::setQueueSize(uint32_t sz)
 {
     return zcm_set_queue_size(zcm, sz);
 }
+
+inline int ZCM::setQueueBytes(uint64_t maxBytes)
+{
+    return zcm_set_queue_bytes(zcm, maxBytes);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setDispatchThreads(uint32_t numThreads)
+{
+    return zcm_set_dispatch_threads(zcm, numThreads);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setRecvStrategy(enum zcm_recv_strategy strategy, uint32_t spinUs)
+{
+    return zcm_set_recv_strategy(zcm, strategy, spinUs);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setThreadAffinity(enum zcm_thread thread, const std::vector<int>& cpus)
+{
+    return zcm_set_thread_affinity(zcm, thread, cpus.data(), cpus.size());
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setNumaNode(int node)
+{
+    return zcm_set_numa_node(zcm, node);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setThreadPriority(enum zcm_thread thread, int priority)
+{
+    return zcm_set_thread_priority(zcm, thread, priority);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setThreadName(enum zcm_thread thread, const std::string& name)
+{
+    return zcm_set_thread_name(zcm, thread, name.c_str());
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setInlinePublish(bool enable)
+{
+    return zcm_set_inline_publish(zcm, enable);
+}
+
+inline int ZCM::setTryPublish(bool enable)
+{
+    return zcm_set_try_publish(zcm, enable);
+}
+
+inline int ZCM::setStatsPublish(uint32_t periodMs)
+{
+    return zcm_set_stats_publish(zcm, periodMs);
+}
+
+inline int ZCM::setTracePublish(bool enable)
+{
+    return zcm_set_trace_publish(zcm, enable);
+}
+
+inline int ZCM::setChannelPriority(const std::string& channel, enum zcm_priority prio)
+{
+    return zcm_set_channel_priority(zcm, channel.c_str(), prio);
+}
+
+inline int ZCM::setCompression(const std::string& channel, enum zcm_codec codec,
+                               uint32_t minSize)
+{
+    return zcm_set_compression(zcm, channel.c_str(), codec, minSize);
+}
+
+inline int ZCM::setDecompress(bool enable)
+{
+    return zcm_set_decompress(zcm, enable);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+inline int ZCM::setSubQueue(Subscription* sub, uint32_t depth, enum zcm_queue_policy policy)
+{
+    return zcm_set_sub_queue(zcm, (zcm_sub_t*) sub->getRawSub(), depth, policy);
+}
+
+inline int ZCM::setSubDecimation(Subscription* sub, uint32_t minPeriodUs, uint32_t keepEvery)
+{
+    return zcm_set_sub_decimation(zcm, (zcm_sub_t*) sub->getRawSub(), minPeriodUs, keepEvery);
+}
+
+inline int ZCM::setSubFilter(Subscription* sub, zcm_filter_t filter, void* usr)
+{
+    return zcm_set_sub_filter(zcm, (zcm_sub_t*) sub->getRawSub(), filter, usr);
+}
+
+inline int ZCM::setSubPriority(Subscription* sub, enum zcm_priority prio)
+{
+    return zcm_set_sub_priority(zcm, (zcm_sub_t*) sub->getRawSub(), prio);
+}
+
+inline int ZCM::setSubMaxAge(Subscription* sub, uint32_t maxAgeUs)
+{
+    return zcm_set_sub_max_age(zcm, (zcm_sub_t*) sub->getRawSub(), maxAgeUs);
+}
+
+inline zcm_timer_t* ZCM::addTimer(uint64_t periodUs, zcm_timer_handler_t cb, void* usr)
+{
+    return zcm_add_timer(zcm, periodUs, cb, usr);
+}
+
+inline int ZCM::removeTimer(zcm_timer_t* timer)
+{
+    return zcm_remove_timer(zcm, timer);
+}
 #endif
 
 inline int ZCM::handleNonblock()
@@ -121,27 +248,138 @@ inline int ZCM::handleNonblock()
     return zcm_handle_nonblock(zcm);
 }
 
+inline int ZCM::handleNonblock(uint32_t maxMsgs, uint32_t budgetUs)
+{
+    return zcm_handle_nonblock_n(zcm, maxMsgs, budgetUs);
+}
+
+inline int ZCM::getFd()
+{
+    return zcm_get_fd(zcm);
+}
+
+inline bool ZCM::hasSubscribers(const std::string& channel)
+{
+    return zcm_has_subscribers(zcm, channel.c_str()) != 0;
+}
+
 inline void ZCM::flush()
 {
     return zcm_flush(zcm);
 }
 
+inline int ZCM::flush(uint32_t maxMsgs, uint32_t budgetUs)
+{
+    return zcm_flush_n(zcm, maxMsgs, budgetUs);
+}
+
+static inline void __zcm_cpp_add_stat(const char* name, uint64_t value, void* usr)
+{
+    (*(std::map<std::string, uint64_t>*) usr)[name] = value;
+}
+
+inline int ZCM::getStats(std::map<std::string, uint64_t>& stats)
+{
+    return zcm_get_stats(zcm, __zcm_cpp_add_stat, &stats);
+}
+
+inline int ZCM::setDispatchProfiling(bool enable, uint32_t slowUs,
+                                     zcm_slow_handler_t cb, void* usr)
+{
+    return zcm_set_dispatch_profiling(zcm, enable, slowUs, cb, usr);
+}
+
 inline int ZCM::publish(const std::string& channel, const uint8_t* data, uint32_t len)
 {
     return publishRaw(channel, data, len);
 }
 
+inline int ZCM::publishBatch(const zcm_pub_msg_t* msgs, uint32_t nmsgs)
+{
+    return zcm_publish_batch(zcm, msgs, nmsgs);
+}
+
+inline int ZCM::publishIov(const std::string& channel, const zcm_iov_t* iov, uint32_t niov)
+{
+    return zcm_publish_iov(zcm, channel.c_str(), iov, niov);
+}
+
+inline int ZCM::tryPublish(const std::string& channel, const uint8_t* data, uint32_t len,
+                           zcm_pub_status_t* status)
+{
+    return zcm_try_publish(zcm, channel.c_str(), data, len, status);
+}
+
+#if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+inline uint8_t* ZCM::encodeBuffer(uint32_t len, uint32_t& size)
+{
+    struct Dealloc
+    {
+        void operator()(uint8_t* p) const { zcm_dealloc(p, ZCM_ALLOC_CPP); }
+    };
+    struct Buffer
+    {
+        std::unique_ptr<uint8_t, Dealloc> data;
+        uint64_t size = 0;
+    };
+    static thread_local Buffer buf;
+    if (len > buf.size) {
+        buf.size = len > buf.size * 2 ? len : buf.size * 2;
+        buf.data.reset((uint8_t*) zcm_alloc(buf.size, ZCM_ALLOC_CPP));
+        ZCM_ASSERT(buf.data);
+    }
+    size = buf.size > UINT32_MAX ? UINT32_MAX : (uint32_t) buf.size;
+    return buf.data.get();
+}
+
+template <class Msg>
+inline int ZCM::encodeInto(const Msg* msg, uint8_t*& buf)
+{
+    // Encoding fails rather than overflow the buffer, so messages that fit in
+    // the one of this thread are encoded without computing their size first
+    uint32_t size;
+    buf = encodeBuffer(0, size);
+    int len = msg->encode(buf, 0, size);
+    if (len < 0) {
+        uint32_t needed = msg->getEncodedSize();
+        if (needed <= size) return ZCM_EINVALID;
+        buf = encodeBuffer(needed, size);
+        len = msg->encode(buf, 0, needed);
+        if (len < 0) return ZCM_EINVALID;
+    }
+    return len;
+}
+
+template <class Msg>
+inline int ZCM::publish(const std::string& channel, const Msg* msg)
+{
+    // publishRaw() is done with the buffer when it returns
+    uint8_t* buf;
+    int len = encodeInto(msg, buf);
+    if (len < 0) return len;
+    return publishRaw(channel, buf, len);
+}
+#else
 template <class Msg>
 inline int ZCM::publish(const std::string& channel, const Msg* msg)
 {
     uint32_t len = msg->getEncodedSize();
-    uint8_t* buf = new uint8_t[len];
+    uint8_t* buf = (uint8_t*) zcm_alloc(len, ZCM_ALLOC_CPP);
     ZCM_ASSERT(buf);
-    msg->encode(buf, 0, len);
-    int status = publishRaw(channel, buf, len);
-    delete[] buf;
+    int status = publish(channel, msg, buf, len);
+    zcm_dealloc(buf, ZCM_ALLOC_CPP);
     return status;
 }
+#endif
+
+template <class Msg>
+inline int ZCM::publish(const std::string& channel, const Msg* msg,
+                        uint8_t* buf, uint32_t maxlen)
+{
+    int len = msg->encode(buf, 0, maxlen);
+    if (len < 0) return ZCM_EINVALID;
+    return publishRaw(channel, buf, len);
+}
 
 inline Subscription* ZCM::subscribe(const std::string& channel,
                                     void (*cb)(const ReceiveBuffer* rbuf,
@@ -166,6 +404,54 @@ inline Subscription* ZCM::subscribe(const std::string& channel,
     return sub;
 }
 
+// Where typed subscriptions decode their messages: into the same Msg every time, so that
+// its vectors and strings keep their memory, and decoding stops allocating once messages
+// as large have been seen. With several dispatch threads, callbacks of one subscription
+// may run concurrently (for channels dispatched by different threads): messages arriving
+// while that Msg is in use are decoded into one of their own instead
+template<class Msg>
+class MsgDecoder
+{
+  public:
+    #if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+    MsgDecoder() : busy(false) {}
+    #endif
+
+    // Returns the decoded message, or nullptr on error. Must be handed back to done()
+    inline Msg* decode(const ReceiveBuffer* rbuf)
+    {
+        Msg* msg = &msgMem;
+        #if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+        if (busy.exchange(true, std::memory_order_acquire)) msg = new Msg();
+        #endif
+        int status = msg->decode(rbuf->data, 0, rbuf->data_size);
+        if (status < 0) {
+            #ifndef ZCM_EMBEDDED
+            fprintf (stderr, "error %d decoding %s!!!\n", status, Msg::getTypeName());
+            #endif
+            done(msg);
+            return nullptr;
+        }
+        return msg;
+    }
+
+    inline void done(Msg* msg)
+    {
+        #if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+        if (msg != &msgMem) delete msg;
+        else busy.store(false, std::memory_order_release);
+        #else
+        (void) msg;
+        #endif
+    }
+
+  private:
+    Msg msgMem;
+    #if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+    std::atomic<bool> busy;
+    #endif
+};
+
 // Virtual inheritance to avoid ambiguous base class problem http://stackoverflow.com/a/139329
 template<class Msg>
 class TypedSubscription : public virtual Subscription
@@ -175,27 +461,17 @@ class TypedSubscription : public virtual Subscription
   protected:
     void (*typedCallback)(const ReceiveBuffer* rbuf, const std::string& channel, const Msg* msg,
                           void* usr);
-    Msg msgMem; // Memory to decode this message into
+    MsgDecoder<Msg> decoder;
 
   public:
     virtual ~TypedSubscription() {}
 
-    inline int readMsg(const ReceiveBuffer* rbuf)
-    {
-        int status = msgMem.decode(rbuf->data, 0, rbuf->data_size);
-        if (status < 0) {
-            #ifndef ZCM_EMBEDDED
-            fprintf (stderr, "error %d decoding %s!!!\n", status, Msg::getTypeName());
-            #endif
-            return -1;
-        }
-        return 0;
-    }
-
     inline void typedDispatch(const ReceiveBuffer* rbuf, const std::string& channel)
     {
-        if (readMsg(rbuf) != 0) return;
-        (*typedCallback)(rbuf, channel, &msgMem, usr);
+        Msg* msg = decoder.decode(rbuf);
+        if (!msg) return;
+        (*typedCallback)(rbuf, channel, msg, usr);
+        decoder.done(msg);
     }
 
     static inline void dispatch(const ReceiveBuffer* rbuf, const char* channel, void* usr)
@@ -215,27 +491,17 @@ class TypedFunctionalSubscription : public virtual Subscription
     std::function<void (const ReceiveBuffer* rbuf,
                         const std::string& channel,
                         const Msg* msg)> cb;
-    Msg msgMem; // Memory to decode this message into
+    MsgDecoder<Msg> decoder;
 
   public:
     virtual ~TypedFunctionalSubscription() {}
 
-    inline int readMsg(const ReceiveBuffer* rbuf)
-    {
-        int status = msgMem.decode(rbuf->data, 0, rbuf->data_size);
-        if (status < 0) {
-            #ifndef ZCM_EMBEDDED
-            fprintf (stderr, "error %d decoding %s!!!\n", status, Msg::getTypeName());
-            #endif
-            return -1;
-        }
-        return 0;
-    }
-
     inline void typedDispatch(const ReceiveBuffer* rbuf, const std::string& channel)
     {
-        if (readMsg(rbuf) != 0) return;
-        cb(rbuf, channel, &msgMem);
+        Msg* msg = decoder.decode(rbuf);
+        if (!msg) return;
+        cb(rbuf, channel, msg);
+        decoder.done(msg);
     }
 
     static inline void dispatch(const ReceiveBuffer* rbuf, const char* channel, void* usr)
@@ -285,8 +551,10 @@ class TypedHandlerSubscription : public TypedSubscription<Msg>, HandlerSubscript
     {
         // Unfortunately, we need to add "this" here to handle template inheritance:
         // https://isocpp.org/wiki/faq/templates#nondependent-name-lookup-members
-        if (this->readMsg(rbuf) != 0) return;
-        (this->handler->*typedHandlerCallback)(rbuf, channel, &this->msgMem);
+        Msg* msg = this->decoder.decode(rbuf);
+        if (!msg) return;
+        (this->handler->*typedHandlerCallback)(rbuf, channel, msg);
+        this->decoder.done(msg);
     }
 
     static inline void dispatch(const ReceiveBuffer* rbuf, const char* channel, void* usr)
@@ -395,10 +663,229 @@ inline Subscription* ZCM::subscribe(const std::string& channel,
     subscriptions.push_back(sub);
     return sub;
 }
+
+// Virtual inheritance to avoid ambiguous base class problem http://stackoverflow.com/a/139329
+// Each of Msgs has a decoder of its own: the subscription is one of each
+template <class Handler, class... Msgs>
+class MultiSubscription : public virtual Subscription, MsgDecoder<Msgs>...
+{
+    friend class ZCM;
+    static_assert(sizeof...(Msgs) > 0, "subscribeMulti() needs at least one type");
+
+  protected:
+    Handler* handler;
+
+    template <class Msg>
+    static inline void typedDispatch(MultiSubscription* sub, const ReceiveBuffer* rbuf,
+                                     const std::string& channel)
+    {
+        MsgDecoder<Msg>& decoder = *sub;
+        Msg* msg = decoder.decode(rbuf);
+        if (!msg) return;
+        sub->handler->handleMessage(rbuf, channel, (const Msg*) msg);
+        decoder.done(msg);
+    }
+
+  public:
+    virtual ~MultiSubscription() {}
+
+    inline void multiDispatch(const ReceiveBuffer* rbuf, const std::string& channel)
+    {
+        // In the order of Msgs, which is what MsgSwitch indexes
+        static void (*const dispatchers[])(MultiSubscription*, const ReceiveBuffer*,
+                                           const std::string&) = { &typedDispatch<Msgs>... };
+        int i = MsgSwitch<Msgs...>::indexOf(rbuf->data, rbuf->data_size);
+        if (i >= 0) dispatchers[i](this, rbuf, channel);
+    }
+
+    static inline void dispatch(const ReceiveBuffer* rbuf, const char* channel, void* usr)
+    {
+        ((MultiSubscription<Handler, Msgs...>*)usr)->multiDispatch(rbuf, channel);
+    }
+};
+
+template <class Handler, class... Msgs>
+struct MultiSubscriptionOf { typedef MultiSubscription<Handler, Msgs...> type; };
+
+template <class Handler, class... Msgs>
+struct MultiSubscriptionOf<Handler, MsgTypes<Msgs...> >
+{ typedef MultiSubscription<Handler, Msgs...> type; };
+
+template <class... Msgs, class Handler>
+inline Subscription* ZCM::subscribeMulti(const std::string& channel, Handler* handler)
+{
+    if (!zcm) {
+        #ifndef ZCM_EMBEDDED
+        fprintf(stderr, "ZCM instance not initialized. Ignoring call to subscribeMulti()\n");
+        #endif
+        return nullptr;
+    }
+
+    typedef typename MultiSubscriptionOf<Handler, Msgs...>::type SubType;
+    SubType* sub = new SubType();
+    ZCM_ASSERT(sub);
+    sub->usr = nullptr;
+    sub->handler = handler;
+    subscribeRaw(sub->rawSub, channel, SubType::dispatch, sub);
+
+    subscriptions.push_back(sub);
+    return sub;
+}
+#endif
+
+#if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+// Virtual inheritance to avoid ambiguous base class problem http://stackoverflow.com/a/139329
+// Note: a batched sub is only ever dispatched by one thread, so the messages of
+//       one batch are always decoded into the same 'msgs'
+template<class Msg>
+class BatchSubscription : public virtual Subscription
+{
+    friend class ZCM;
+
+  protected:
+    std::function<void (const ReceiveBuffer* rbufs, const Msg* msgs, uint32_t n,
+                        const std::string& channel)> cb;
+    std::vector<Msg>           msgs;
+    std::vector<ReceiveBuffer> bufs;
+
+  public:
+    virtual ~BatchSubscription() {}
+
+    inline void batchDispatch(const ReceiveBuffer* rbufs, uint32_t n, const std::string& channel)
+    {
+        if (msgs.size() < n) msgs.resize(n);
+        bufs.clear();
+        for (uint32_t i = 0; i < n; ++i) {
+            int status = msgs[bufs.size()].decode(rbufs[i].data, 0, rbufs[i].data_size);
+            if (status < 0) {
+                fprintf (stderr, "error %d decoding %s!!!\n", status, Msg::getTypeName());
+                continue;
+            }
+            bufs.push_back(rbufs[i]);
+        }
+        if (!bufs.empty()) cb(bufs.data(), msgs.data(), bufs.size(), channel);
+    }
+
+    static inline void dispatch(const ReceiveBuffer* rbufs, uint32_t n,
+                                const char* channel, void* usr)
+    {
+        ((BatchSubscription<Msg>*)usr)->batchDispatch(rbufs, n, channel);
+    }
+};
+
+template <class Msg>
+inline Subscription* ZCM::subscribeBatch(const std::string& channel,
+                                         uint32_t maxBatch, uint32_t depth,
+                                         std::function<void (const ReceiveBuffer* rbufs,
+                                                             const Msg* msgs, uint32_t n,
+                                                             const std::string& channel)> cb)
+{
+    if (!zcm) {
+        fprintf(stderr, "ZCM instance not initialized. Ignoring call to subscribeBatch()\n");
+        return nullptr;
+    }
+
+    typedef BatchSubscription<Msg> SubType;
+    SubType* sub = new SubType();
+    ZCM_ASSERT(sub);
+    sub->usr = nullptr;
+    sub->cb = cb;
+    sub->rawSub = zcm_subscribe_batch(zcm, channel.c_str(), SubType::dispatch,
+                                      maxBatch, depth, sub);
+    if (!sub->rawSub) {
+        delete sub;
+        return nullptr;
+    }
+
+    subscriptions.push_back(sub);
+    return sub;
+}
+
+class SharedSubscriptionBase : public virtual Subscription
+{
+    friend class ZCM;
+
+  protected:
+    std::string channel;
+    const void* typeId;
+
+  public:
+    virtual ~SharedSubscriptionBase() {}
+
+    // One address per type, identifies the type of shared subscriptions
+    template <class Msg>
+    static inline const void* typeIdOf()
+    {
+        static const char id = 0;
+        return &id;
+    }
+};
+
+template <class Msg>
+class SharedSubscription : public SharedSubscriptionBase
+{
+    friend class ZCM;
+
+  protected:
+    std::function<void (const std::string& channel, const std::shared_ptr<const Msg>& msg)> cb;
+
+  public:
+    virtual ~SharedSubscription() {}
+};
+
+template <class Msg>
+inline int ZCM::publish(const std::string& channel, const std::shared_ptr<Msg>& msg)
+{
+    typedef typename std::remove_const<Msg>::type Type;
+    std::shared_ptr<const Type> shared = msg;
+    const void* typeId = SharedSubscriptionBase::typeIdOf<Type>();
+
+    std::vector<std::shared_ptr<SharedSubscriptionBase>> matches;
+    {
+        std::unique_lock<std::mutex> lk(sharedSubsLock);
+        for (auto& sub : sharedSubs)
+            if (sub->typeId == typeId && sub->channel == channel)
+                matches.push_back(sub);
+    }
+    for (auto& sub : matches)
+        static_cast<SharedSubscription<Type>*>(sub.get())->cb(channel, shared);
+    return ZCM_EOK;
+}
+
+template <class Msg>
+inline Subscription* ZCM::subscribeShared(const std::string& channel,
+                                          std::function<void (const std::string& channel,
+                                                              const std::shared_ptr<const Msg>& msg)> cb)
+{
+    typedef SharedSubscription<Msg> SubType;
+    std::shared_ptr<SubType> sub(new SubType());
+    sub->rawSub = nullptr;
+    sub->usr = nullptr;
+    sub->callback = nullptr;
+    sub->channel = channel;
+    sub->typeId = SharedSubscriptionBase::typeIdOf<Msg>();
+    sub->cb = cb;
+
+    std::unique_lock<std::mutex> lk(sharedSubsLock);
+    sharedSubs.push_back(sub);
+    return sub.get();
+}
 #endif
 
 inline void ZCM::unsubscribe(Subscription* sub)
 {
+    #if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+    {
+        std::unique_lock<std::mutex> lk(sharedSubsLock);
+        for (auto it = sharedSubs.begin(); it != sharedSubs.end(); ++it) {
+            if (it->get() == sub) {
+                sharedSubs.erase(it);
+                return;
+            }
+        }
+    }
+    #endif
+
     std::vector<Subscription*>::iterator end = subscriptions.end(),
                                           it = subscriptions.begin();
     for (; it != end; ++it) {
@@ -424,6 +911,107 @@ inline void ZCM::subscribeRaw(void*& rawSub, const std::string& channel,
 inline void ZCM::unsubscribeRaw(void*& rawSub)
 { zcm_unsubscribe(zcm, (zcm_sub_t*) rawSub); rawSub = nullptr; }
 
+#ifdef ZCM_CPP_COROUTINES
+template <class Msg>
+inline ZCM::Receiver<Msg> ZCM::recv(const std::string& channel, size_t maxBuffered)
+{
+    return Receiver<Msg>(zcm, channel, maxBuffered);
+}
+
+template <class Msg>
+inline ZCM::PublishAwaiter<Msg> ZCM::publishAsync(const std::string& channel, const Msg* msg)
+{
+    return PublishAwaiter<Msg>(zcm, channel, msg);
+}
+
+template <class Msg>
+inline ZCM::Receiver<Msg>::Receiver(zcm_t* zcm, const std::string& channel,
+                                    size_t maxBuffered)
+    : zcm(zcm), maxBuffered(maxBuffered > 0 ? maxBuffered : 1)
+{
+    sub = zcm_subscribe(zcm, channel.c_str(), &Receiver::dispatch, this);
+}
+
+// Note: can be called from the coroutine that dispatch() resumed, and so from
+//       within the callback of 'sub'
+template <class Msg>
+inline ZCM::Receiver<Msg>::~Receiver()
+{
+    if (sub) zcm_unsubscribe(zcm, sub);
+}
+
+template <class Msg>
+inline void ZCM::Receiver<Msg>::dispatch(const zcm_recv_buf_t* rbuf, const char* channel,
+                                         void* usr)
+{
+    Receiver* rx = (Receiver*) usr;
+    Msg msg;
+    if (msg.decode(rbuf->data, 0, rbuf->data_size) < 0) return;
+
+    std::coroutine_handle<> waiter;
+    {
+        std::unique_lock<std::mutex> lk(rx->lock);
+        if (rx->buffered.size() >= rx->maxBuffered) rx->buffered.pop_front();
+        rx->buffered.push_back(std::move(msg));
+        waiter = rx->waiter;
+        rx->waiter = nullptr;
+    }
+    // The coroutine may destroy 'rx', so this must come last
+    if (waiter) waiter.resume();
+}
+
+template <class Msg>
+inline bool ZCM::Receiver<Msg>::Next::await_ready()
+{
+    std::unique_lock<std::mutex> lk(rx->lock);
+    return !rx->buffered.empty();
+}
+
+template <class Msg>
+inline bool ZCM::Receiver<Msg>::Next::await_suspend(std::coroutine_handle<> h)
+{
+    std::unique_lock<std::mutex> lk(rx->lock);
+    if (!rx->buffered.empty()) return false;
+    rx->waiter = h;
+    return true;
+}
+
+template <class Msg>
+inline Msg ZCM::Receiver<Msg>::Next::await_resume()
+{
+    std::unique_lock<std::mutex> lk(rx->lock);
+    Msg msg = std::move(rx->buffered.front());
+    rx->buffered.pop_front();
+    return msg;
+}
+
+template <class Msg>
+inline bool ZCM::PublishAwaiter<Msg>::await_suspend(std::coroutine_handle<> h)
+{
+    handle = h;
+    uint8_t* buf;
+    int len = encodeInto(msg, buf);
+    if (len < 0) {
+        status = len;
+        return false;
+    }
+    int rc = zcm_publish_notify(zcm, channel.c_str(), buf, len, &PublishAwaiter::sent, this);
+    if (rc != ZCM_EOK) {
+        status = rc;
+        return false;
+    }
+    return !done.exchange(true);
+}
+
+template <class Msg>
+inline void ZCM::PublishAwaiter<Msg>::sent(int status, void* usr)
+{
+    PublishAwaiter* pa = (PublishAwaiter*) usr;
+    pa->status = status;
+    if (pa->done.exchange(true)) pa->handle.resume();
+}
+#endif
+
 
 // ***********************************
 // LogFile and LogEvent implementation
@@ -465,6 +1053,36 @@ inline FILE* LogFile::getFilePtr()
     return zcm_eventlog_get_fileptr(eventlog);
 }
 
+inline int LogFile::enableIndex(int64_t everyEvents, int64_t everyBytes)
+{
+    return zcm_eventlog_enable_index(eventlog, everyEvents, everyBytes);
+}
+
+inline int LogFile::enableCompression(int level, size_t blockBytes)
+{
+    return zcm_eventlog_enable_compression(eventlog, level, blockBytes);
+}
+
+inline int LogFile::enableChannelIds()
+{
+    return zcm_eventlog_enable_channel_ids(eventlog);
+}
+
+inline int LogFile::setWriteBuffer(size_t bytes)
+{
+    return zcm_eventlog_set_write_buffer(eventlog, bytes);
+}
+
+inline int LogFile::enableAsyncWrites(size_t buffers)
+{
+    return zcm_eventlog_enable_async_writes(eventlog, buffers);
+}
+
+inline int LogFile::flush(bool sync)
+{
+    return zcm_eventlog_flush(eventlog, sync);
+}
+
 inline const LogEvent* LogFile::cplusplusIfyEvent(zcm_eventlog_event_t* evt)
 {
     if (lastevent)
@@ -509,4 +1127,95 @@ inline int LogFile::writeEvent(const LogEvent* event)
     evt.data = event->data;
     return zcm_eventlog_write_event(eventlog, &evt);
 }
+
+inline LogCursor::LogCursor(LogFile& log)
+{
+    this->cursor = log.eventlog ? zcm_eventlog_cursor_create(log.eventlog) : nullptr;
+    this->lastevent = nullptr;
+}
+
+inline LogCursor::~LogCursor()
+{
+    if (cursor)
+        zcm_eventlog_cursor_destroy(cursor);
+    if (lastevent)
+        zcm_eventlog_free_event(lastevent);
+}
+
+inline bool LogCursor::good() const
+{
+    return cursor != nullptr;
+}
+
+inline off_t LogCursor::tell() const
+{
+    return zcm_eventlog_cursor_tell(cursor);
+}
+
+inline void LogCursor::seek(off_t offset)
+{
+    zcm_eventlog_cursor_seek(cursor, offset);
+}
+
+inline int LogCursor::seekToTimestamp(int64_t timestamp)
+{
+    return zcm_eventlog_cursor_seek_to_timestamp(cursor, timestamp);
+}
+
+inline const LogEvent* LogCursor::cplusplusIfyEvent(zcm_eventlog_event_t* evt)
+{
+    if (lastevent)
+        zcm_eventlog_free_event(lastevent);
+    lastevent = evt;
+    if (!evt)
+        return nullptr;
+    curEvent.eventnum = evt->eventnum;
+    curEvent.channel.assign(evt->channel, evt->channellen);
+    curEvent.timestamp = evt->timestamp;
+    curEvent.datalen = evt->datalen;
+    curEvent.data = evt->data;
+    return &curEvent;
+}
+
+inline const LogEvent* LogCursor::readNextEvent()
+{
+    zcm_eventlog_event_t* evt = zcm_eventlog_cursor_read_next_event(cursor);
+    return cplusplusIfyEvent(evt);
+}
+
+inline const LogEvent* LogCursor::readEventAtOffset(off_t offset)
+{
+    zcm_eventlog_event_t* evt = zcm_eventlog_cursor_read_event_at_offset(cursor, offset);
+    return cplusplusIfyEvent(evt);
+}
+
+inline Executor::Executor(uint32_t numThreads)
+{
+    ex = zcm_executor_create(numThreads);
+}
+
+inline Executor::~Executor()
+{
+    if (ex) zcm_executor_destroy(ex);
+}
+
+inline bool Executor::good() const
+{
+    return ex != nullptr;
+}
+
+inline int Executor::attach(ZCM& zcm)
+{
+    return zcm_executor_attach(ex, zcm.getUnderlyingZCM());
+}
+
+inline int Executor::detach(ZCM& zcm)
+{
+    return zcm_executor_detach(ex, zcm.getUnderlyingZCM());
+}
+
+inline zcm_executor_t* Executor::getUnderlyingExecutor()
+{
+    return ex;
+}
 #endif
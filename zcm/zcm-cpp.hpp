@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <string>
 #include <vector>
+#include <map>
 
 #include "zcm/zcm.h"
 
@@ -12,6 +13,19 @@
 
 #if __cplusplus > 199711L
 #include <functional>
+#include "zcm/zcm_dispatch.hpp"
+#endif
+
+#if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+#include <atomic>
+#include <memory>
+#include <mutex>
+#endif
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine) && !defined(ZCM_EMBEDDED)
+#define ZCM_CPP_COROUTINES
+#include <coroutine>
+#include <deque>
 #endif
 
 namespace zcm {
@@ -19,6 +33,9 @@ namespace zcm {
 typedef zcm_recv_buf_t ReceiveBuffer;
 typedef zcm_msg_handler_t MsgHandler;
 class Subscription;
+#if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+class SharedSubscriptionBase;
+#endif
 
 class ZCM
 {
@@ -42,28 +59,79 @@ class ZCM
     virtual inline void pause();
     virtual inline void resume();
     virtual inline int  handle();
+    virtual inline int  handle(uint32_t timeoutUs);
     virtual inline void setQueueSize(uint32_t sz);
+    virtual inline int  setQueueBytes(uint64_t maxBytes);
+    virtual inline int  setDispatchThreads(uint32_t numThreads);
+    virtual inline int  setInlinePublish(bool enable);
+    virtual inline int  setTryPublish(bool enable);
+    virtual inline int  setStatsPublish(uint32_t periodMs);
+    virtual inline int  setTracePublish(bool enable);
+    virtual inline int  setChannelPriority(const std::string& channel, enum zcm_priority prio);
+    virtual inline int  setCompression(const std::string& channel, enum zcm_codec codec,
+                                       uint32_t minSize = 0);
+    virtual inline int  setDecompress(bool enable);
+    virtual inline int  setRecvStrategy(enum zcm_recv_strategy strategy, uint32_t spinUs = 50);
+    virtual inline int  setThreadAffinity(enum zcm_thread thread, const std::vector<int>& cpus);
+    virtual inline int  setNumaNode(int node);
+    virtual inline int  setThreadPriority(enum zcm_thread thread, int priority);
+    virtual inline int  setThreadName(enum zcm_thread thread, const std::string& name);
+    virtual inline int  setSubQueue(Subscription* sub, uint32_t depth,
+                                    enum zcm_queue_policy policy);
+    virtual inline int  setSubDecimation(Subscription* sub, uint32_t minPeriodUs,
+                                         uint32_t keepEvery = 0);
+    virtual inline int  setSubFilter(Subscription* sub, zcm_filter_t filter, void* usr);
+    virtual inline int  setSubPriority(Subscription* sub, enum zcm_priority prio);
+    virtual inline int  setSubMaxAge(Subscription* sub, uint32_t maxAgeUs);
+    virtual inline zcm_timer_t* addTimer(uint64_t periodUs, zcm_timer_handler_t cb, void* usr);
+    virtual inline int  removeTimer(zcm_timer_t* timer);
     #endif
     virtual inline int  handleNonblock();
+    virtual inline int  handleNonblock(uint32_t maxMsgs, uint32_t budgetUs = 0);
+    virtual inline int  getFd();
+    virtual inline bool hasSubscribers(const std::string& channel);
     virtual inline void flush();
+    virtual inline int  flush(uint32_t maxMsgs, uint32_t budgetUs = 0);
+    // Adds the counters of zcm_get_stats() to 'stats', by name
+    virtual inline int  getStats(std::map<std::string, uint64_t>& stats);
+    virtual inline int  setDispatchProfiling(bool enable, uint32_t slowUs = 0,
+                                             zcm_slow_handler_t cb = NULL, void* usr = NULL);
 
   public:
     inline int publish(const std::string& channel, const uint8_t* data, uint32_t len);
+    inline int publishBatch(const zcm_pub_msg_t* msgs, uint32_t nmsgs);
+    // See zcm_publish_iov()
+    inline int publishIov(const std::string& channel, const zcm_iov_t* iov, uint32_t niov);
+    inline int tryPublish(const std::string& channel, const uint8_t* data, uint32_t len,
+                          zcm_pub_status_t* status = NULL);
 
     // Note: if we make a publish binding that takes a const message reference, the compiler does
     //       not select the right version between the pointer and reference versions, so when the
     //       user intended to call the pointer version, the reference version is called and causes
     //       compile errors (turns the input into a double pointer). We have to choose one or the
     //       other for the api.
+    // Encodes into a buffer of the calling thread, kept for its next publishes
     template <class Msg>
     inline int publish(const std::string& channel, const Msg* msg);
 
+    // Encodes into 'buf', which holds 'maxlen' bytes, rather than into a buffer of
+    // ZCM's: no getEncodedSize() pass. Returns ZCM_EINVALID if 'msg' doesn't fit
+    template <class Msg>
+    inline int publish(const std::string& channel, const Msg* msg,
+                       uint8_t* buf, uint32_t maxlen);
+
     inline Subscription* subscribe(const std::string& channel,
                                    void (*cb)(const ReceiveBuffer* rbuf,
                                               const std::string& channel,
                                               void* usr),
                                    void* usr);
 
+    // The messages handed to typed callbacks are only valid until the callback returns:
+    // each subscription decodes every message into the same Msg, reusing its memory.
+    // Msg can also be the View of a generated type (see zcm/zcm_view.hpp), for
+    // callbacks taking a const T::View*: the message is then checked but never
+    // copied out of the ReceiveBuffer, and the view is only valid during the
+    // callback
     template <class Msg, class Handler>
     inline Subscription* subscribe(const std::string& channel,
                                    void (Handler::*cb)(const ReceiveBuffer* rbuf,
@@ -90,10 +158,68 @@ class ZCM
                                    std::function<void (const ReceiveBuffer* rbuf,
                                                        const std::string& channel,
                                                        const Msg* msg)> cb);
+
+    // For channels carrying several types: each message is decoded as the one of
+    // Msgs its fingerprint is of (see zcm/zcm_dispatch.hpp) and handed to the
+    // handler's handleMessage(rbuf, channel, const Msg*) overload for that type.
+    // Messages of none of them are dropped. Msgs can also be a zcm::MsgTypes<...>
+    // list, e.g. the <package>::Types of zcm-gen --cpp-package-types
+    template <class... Msgs, class Handler>
+    inline Subscription* subscribeMulti(const std::string& channel, Handler* handler);
+    #endif
+
+    #if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+    // Pointer passing between the threads of one process: the message is never
+    // encoded, it's handed as is to the subscribeShared() subscriptions of this
+    // ZCM instance with the same channel (exact name, no regex) and type.
+    // Their callbacks run on the publishing thread, before publish() returns.
+    // Shared messages don't go through the transport: other ZCM instances, other
+    // processes and tools like the logger don't see them (publish the encoded
+    // message as well for those).
+    template <class Msg>
+    inline int publish(const std::string& channel, const std::shared_ptr<Msg>& msg);
+
+    template <class Msg>
+    inline Subscription* subscribeShared(const std::string& channel,
+                                         std::function<void (const std::string& channel,
+                                                             const std::shared_ptr<const Msg>& msg)> cb);
+
+    // See zcm_subscribe_batch(). 'msgs' holds the 'n' decoded messages, 'rbufs'
+    // their receive buffers (in the same order); messages that fail to decode
+    // are left out of both. Only valid during the callback
+    template <class Msg>
+    inline Subscription* subscribeBatch(const std::string& channel,
+                                        uint32_t maxBatch, uint32_t depth,
+                                        std::function<void (const ReceiveBuffer* rbufs,
+                                                            const Msg* msgs, uint32_t n,
+                                                            const std::string& channel)> cb);
     #endif
 
     inline void unsubscribe(Subscription* sub);
 
+    #ifdef ZCM_CPP_COROUTINES
+    template <class Msg> class Receiver;
+    template <class Msg> class PublishAwaiter;
+
+    // A subscription that coroutines co_await for their next message, e.g.
+    //     ZCM::Receiver<Msg>& rx = ...; Msg m = co_await rx;
+    // or for a single one: Msg m = co_await zcm.recv<Msg>(channel);
+    // Messages that arrive while nobody is waiting are kept, dropping the oldest
+    // past 'maxBuffered'. The waiting coroutine is resumed on the thread that
+    // dispatches the message (so it pairs with getFd() and handleNonblock() to run
+    // on an event loop) and runs there until its next suspension.
+    // Msg must be a generated type, not a View
+    template <class Msg>
+    inline Receiver<Msg> recv(const std::string& channel, size_t maxBuffered = 1);
+
+    // Encodes 'msg' when awaited, publishes it with zcm_publish_notify() and
+    // resumes with its result once the transport has it: on the send thread for
+    // blocking transports, so hop elsewhere before doing anything heavy.
+    // 'msg' is only read before the coroutine suspends
+    template <class Msg>
+    inline PublishAwaiter<Msg> publishAsync(const std::string& channel, const Msg* msg);
+    #endif
+
     virtual inline zcm_t* getUnderlyingZCM();
 
   protected:
@@ -109,8 +235,27 @@ class ZCM
     virtual inline void unsubscribeRaw(void*& rawSub);
 
   private:
+    #if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+    // At least 'len' bytes, 'size' of them, only used by the calling thread.
+    // Grows geometrically, and keeps the size of the largest message the
+    // thread published
+    static inline uint8_t* encodeBuffer(uint32_t len, uint32_t& size);
+
+    // Encodes 'msg' into the encodeBuffer() of the calling thread, pointed to
+    // by 'buf'. Returns the encoded size, or ZCM_EINVALID on error
+    template <class Msg>
+    static inline int encodeInto(const Msg* msg, uint8_t*& buf);
+    #endif
+
     zcm_t* zcm;
     std::vector<Subscription*> subscriptions;
+
+    #if __cplusplus > 199711L && !defined(ZCM_EMBEDDED)
+    // publish() calls the subscriptions outside of the lock, holding a reference
+    // so that they outlive a concurrent unsubscribe()
+    std::mutex sharedSubsLock;
+    std::vector<std::shared_ptr<SharedSubscriptionBase>> sharedSubs;
+    #endif
 };
 
 // New class required to allow the Handler callbacks and std::string channel names
@@ -136,6 +281,69 @@ class Subscription
     { ((Subscription*)usr)->dispatch(rbuf, channel); }
 };
 
+#ifdef ZCM_CPP_COROUTINES
+template <class Msg>
+class ZCM::Receiver
+{
+  public:
+    Receiver(const Receiver&) = delete;
+    Receiver& operator=(const Receiver&) = delete;
+    inline ~Receiver();
+
+    struct Next
+    {
+        Receiver* rx;
+        inline bool await_ready();
+        inline bool await_suspend(std::coroutine_handle<> h);
+        inline Msg  await_resume();
+    };
+
+    // Only one coroutine may wait on a Receiver at a time
+    Next operator co_await() { return Next{this}; }
+
+  private:
+    friend class ZCM;
+    inline Receiver(zcm_t* zcm, const std::string& channel, size_t maxBuffered);
+    static inline void dispatch(const zcm_recv_buf_t* rbuf, const char* channel, void* usr);
+
+    zcm_t*     zcm;
+    zcm_sub_t* sub;
+    size_t     maxBuffered;
+
+    std::mutex lock;
+    std::deque<Msg> buffered;
+    std::coroutine_handle<> waiter;
+};
+
+template <class Msg>
+class ZCM::PublishAwaiter
+{
+  public:
+    PublishAwaiter(const PublishAwaiter&) = delete;
+    PublishAwaiter& operator=(const PublishAwaiter&) = delete;
+
+    bool await_ready() const { return false; }
+    inline bool await_suspend(std::coroutine_handle<> h);
+    // The result of zcm_publish_notify(), or of sending the message
+    int await_resume() const { return status; }
+
+  private:
+    friend class ZCM;
+    PublishAwaiter(zcm_t* zcm, const std::string& channel, const Msg* msg)
+        : zcm(zcm), channel(channel), msg(msg) {}
+    static inline void sent(int status, void* usr);
+
+    zcm_t*             zcm;
+    std::string        channel;
+    const Msg*         msg;
+    int                status = ZCM_EOK;
+    // Set by whichever of await_suspend() and sent() comes first,
+    // so the second one knows to resume the coroutine
+    std::atomic<bool>  done {false};
+    std::coroutine_handle<> handle;
+};
+#endif
+
 // TODO: why not use or inherit from the existing zcm data structures for the below
 
 #ifndef ZCM_EMBEDDED
@@ -159,6 +367,12 @@ struct LogFile
     /**** Methods general operations ****/
     inline int seekToTimestamp(int64_t timestamp);
     inline FILE* getFilePtr();
+    inline int enableIndex(int64_t everyEvents, int64_t everyBytes);
+    inline int enableCompression(int level, size_t blockBytes);
+    inline int enableChannelIds();
+    inline int setWriteBuffer(size_t bytes);
+    inline int enableAsyncWrites(size_t buffers);
+    inline int flush(bool sync);
 
     /**** Methods for read/write ****/
     // NOTE: user should NOT hold-onto the returned ptr across successive calls
@@ -172,6 +386,48 @@ struct LogFile
     LogEvent curEvent;
     zcm_eventlog_t* eventlog;
     zcm_eventlog_event_t* lastevent;
+
+    friend struct LogCursor;
+};
+
+// A read position of its own in a LogFile, for reading it from several
+// threads at once (one per cursor); see zcm_eventlog_cursor_create()
+struct LogCursor
+{
+    inline LogCursor(LogFile& log);
+    inline ~LogCursor();
+    inline bool good() const;
+
+    inline off_t tell() const;
+    inline void  seek(off_t offset);
+    inline int   seekToTimestamp(int64_t timestamp);
+
+    // NOTE: user should NOT hold-onto the returned ptr across successive calls
+    inline const LogEvent* readNextEvent();
+    inline const LogEvent* readEventAtOffset(off_t offset);
+
+  private:
+    inline const LogEvent* cplusplusIfyEvent(zcm_eventlog_event_t* le);
+    LogEvent curEvent;
+    zcm_eventlog_cursor_t* cursor;
+    zcm_eventlog_event_t* lastevent;
+};
+
+// Dispatches and sends for any number of blocking ZCMs on one pool of
+// threads; see zcm_executor_create()
+struct Executor
+{
+    inline Executor(uint32_t numThreads);
+    inline ~Executor();
+    inline bool good() const;
+
+    inline int attach(ZCM& zcm);
+    inline int detach(ZCM& zcm);
+
+    inline zcm_executor_t* getUnderlyingExecutor();
+
+  private:
+    zcm_executor_t* ex;
 };
 #endif
 
@@ -24,6 +24,74 @@
 # define ZCM_DEBUG(...)
 #endif
 
+/* Relaxed: the counts only have to add up once the threads updating them are done */
+#if defined(__GNUC__)
+# define ZCM_ALLOC_COUNT(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#else
+# define ZCM_ALLOC_COUNT(counter, n) ((counter) += (n))
+#endif
+
+static void* zcm_default_alloc(void* usr, size_t size, enum zcm_alloc_subsystem subsys)
+{
+    (void) usr;
+    (void) subsys;
+    return malloc(size);
+}
+
+static void zcm_default_free(void* usr, void* ptr, enum zcm_alloc_subsystem subsys)
+{
+    (void) usr;
+    (void) subsys;
+    free(ptr);
+}
+
+static zcm_allocator_t zcm_allocator = { zcm_default_alloc, zcm_default_free, NULL };
+static zcm_alloc_stats_t zcm_alloc_stats[ZCM_ALLOC_NUM_SUBSYSTEMS];
+
+void zcm_set_allocator(const zcm_allocator_t* alloc)
+{
+    if (alloc) {
+        zcm_allocator = *alloc;
+    } else {
+        zcm_allocator.alloc = zcm_default_alloc;
+        zcm_allocator.free = zcm_default_free;
+        zcm_allocator.usr = NULL;
+    }
+}
+
+void* zcm_alloc(size_t size, enum zcm_alloc_subsystem subsys)
+{
+    void* ptr;
+    if (size == 0) return NULL;
+    ptr = zcm_allocator.alloc(zcm_allocator.usr, size, subsys);
+    if (ptr) {
+        ZCM_ALLOC_COUNT(zcm_alloc_stats[subsys].allocs, 1);
+        ZCM_ALLOC_COUNT(zcm_alloc_stats[subsys].bytes, size);
+    }
+    return ptr;
+}
+
+void zcm_dealloc(void* ptr, enum zcm_alloc_subsystem subsys)
+{
+    if (!ptr) return;
+    ZCM_ALLOC_COUNT(zcm_alloc_stats[subsys].frees, 1);
+    zcm_allocator.free(zcm_allocator.usr, ptr, subsys);
+}
+
+void zcm_get_alloc_stats(zcm_alloc_stats_t stats[ZCM_ALLOC_NUM_SUBSYSTEMS])
+{
+    int i;
+    for (i = 0; i < ZCM_ALLOC_NUM_SUBSYSTEMS; ++i) {
+#if defined(__GNUC__)
+        stats[i].allocs = __atomic_load_n(&zcm_alloc_stats[i].allocs, __ATOMIC_RELAXED);
+        stats[i].frees = __atomic_load_n(&zcm_alloc_stats[i].frees, __ATOMIC_RELAXED);
+        stats[i].bytes = __atomic_load_n(&zcm_alloc_stats[i].bytes, __ATOMIC_RELAXED);
+#else
+        stats[i] = zcm_alloc_stats[i];
+#endif
+    }
+}
+
 #ifndef ZCM_EMBEDDED
 int zcm_retcode_name_to_enum(const char* zcm_retcode_name)
 {
@@ -37,10 +105,10 @@ int zcm_retcode_name_to_enum(const char* zcm_retcode_name)
 #ifndef ZCM_EMBEDDED
 zcm_t* zcm_create(const char* url)
 {
-    zcm_t* z = malloc(sizeof(zcm_t));
+    zcm_t* z = zcm_alloc(sizeof(zcm_t), ZCM_ALLOC_CORE);
     ZCM_ASSERT(z);
     if (zcm_init(z, url) == -1) {
-        free(z);
+        zcm_dealloc(z, ZCM_ALLOC_CORE);
         return NULL;
     }
     return z;
@@ -49,10 +117,10 @@ zcm_t* zcm_create(const char* url)
 
 zcm_t* zcm_create_trans(zcm_trans_t* zt)
 {
-    zcm_t* z = malloc(sizeof(zcm_t));
+    zcm_t* z = zcm_alloc(sizeof(zcm_t), ZCM_ALLOC_CORE);
     ZCM_ASSERT(z);
     if (zcm_init_trans(z, zt) == -1) {
-        free(z);
+        zcm_dealloc(z, ZCM_ALLOC_CORE);
         return NULL;
     }
     return z;
@@ -61,7 +129,7 @@ zcm_t* zcm_create_trans(zcm_trans_t* zt)
 void zcm_destroy(zcm_t* zcm)
 {
     zcm_cleanup(zcm);
-    free(zcm);
+    zcm_dealloc(zcm, ZCM_ALLOC_CORE);
 }
 
 #ifndef ZCM_EMBEDDED
@@ -87,6 +155,8 @@ int zcm_init(zcm_t* zcm, const char* url)
         zcm_trans_t* trans = creator(u);
         if (trans) {
             ret = zcm_init_trans(zcm, trans);
+            if (ret == 0 && zcm->type == ZCM_BLOCKING)
+                zcm_blocking_set_url_opts(zcm->impl, zcm_url_opts(u));
         } else {
             ZCM_DEBUG("failed to create transport for '%s'", url);
         }
@@ -135,6 +205,18 @@ int zcm_init_trans(zcm_t* zcm, zcm_trans_t* zt)
     return -1;
 }
 
+int zcm_init_nonblocking(zcm_t* zcm, struct zcm_nonblocking* impl)
+{
+    zcm->type = ZCM_NONBLOCKING;
+    zcm->impl = impl;
+    if (impl == NULL) {
+        zcm->err = ZCM_ECONNECT;
+        return -1;
+    }
+    zcm->err = ZCM_EOK;
+    return 0;
+}
+
 void zcm_cleanup(zcm_t* zcm)
 {
     if (zcm) {
@@ -187,6 +269,71 @@ int zcm_publish(zcm_t* zcm, const char* channel, const uint8_t* data, uint32_t l
     return zcm_nonblocking_publish(zcm->impl, channel, data, len);
 }
 
+int zcm_try_publish(zcm_t* zcm, const char* channel, const uint8_t* data, uint32_t len,
+                    zcm_pub_status_t* status)
+{
+#ifndef ZCM_EMBEDDED
+    if (zcm->type == ZCM_BLOCKING) {
+        zcm->err = zcm_blocking_try_publish(zcm->impl, channel, data, len, status);
+        return zcm->err;
+    }
+#endif
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    if (status) {
+        status->queued = 0;
+        status->capacity = 0;
+        status->queued_bytes = 0;
+        status->max_bytes = 0;
+    }
+    return zcm_nonblocking_publish(zcm->impl, channel, data, len);
+}
+
+int zcm_publish_notify(zcm_t* zcm, const char* channel, const uint8_t* data, uint32_t len,
+                       zcm_sent_handler_t cb, void* usr)
+{
+    int ret;
+#ifndef ZCM_EMBEDDED
+    if (zcm->type == ZCM_BLOCKING) {
+        zcm->err = zcm_blocking_publish_notify(zcm->impl, channel, data, len, cb, usr);
+        return zcm->err;
+    }
+#endif
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    ret = zcm_nonblocking_publish(zcm->impl, channel, data, len);
+    if (ret == ZCM_EOK) cb(ZCM_EOK, usr);
+    return ret;
+}
+
+int zcm_publish_batch(zcm_t* zcm, const zcm_pub_msg_t* msgs, uint32_t nmsgs)
+{
+    uint32_t i;
+    int ret = ZCM_EOK, rc;
+#ifndef ZCM_EMBEDDED
+    if (zcm->type == ZCM_BLOCKING) {
+        zcm->err = zcm_blocking_publish_batch(zcm->impl, msgs, nmsgs);
+        return zcm->err;
+    }
+#endif
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    for (i = 0; i < nmsgs; ++i) {
+        rc = zcm_nonblocking_publish(zcm->impl, msgs[i].channel, msgs[i].data, msgs[i].len);
+        if (rc != ZCM_EOK && ret == ZCM_EOK) ret = rc;
+    }
+    return ret;
+}
+
+int zcm_publish_iov(zcm_t* zcm, const char* channel, const zcm_iov_t* iov, uint32_t niov)
+{
+#ifndef ZCM_EMBEDDED
+    if (zcm->type == ZCM_BLOCKING) {
+        zcm->err = zcm_blocking_publish_iov(zcm->impl, channel, iov, niov);
+        return zcm->err;
+    }
+#endif
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    return zcm_nonblocking_publish_iov(zcm->impl, channel, iov, niov);
+}
+
 void zcm_flush(zcm_t* zcm)
 {
 #ifndef ZCM_EMBEDDED
@@ -199,6 +346,33 @@ void zcm_flush(zcm_t* zcm)
     return zcm_nonblocking_flush(zcm->impl);
 }
 
+int  zcm_get_stats(zcm_t* zcm, zcm_stat_handler_t cb, void* usr)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING:    return zcm_blocking_get_stats(zcm->impl, cb, usr);
+        case ZCM_NONBLOCKING: return zcm_nonblocking_get_stats(zcm->impl, cb, usr);
+    }
+#endif
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    return zcm_nonblocking_get_stats(zcm->impl, cb, usr);
+}
+
+int  zcm_set_dispatch_profiling(zcm_t* zcm, int enable, uint32_t slowUs,
+                                zcm_slow_handler_t cb, void* usr)
+{
+#ifndef ZCM_EMBEDDED
+    switch (zcm->type) {
+        case ZCM_BLOCKING:
+            return zcm_blocking_set_dispatch_profiling(zcm->impl, enable, slowUs, cb, usr);
+        case ZCM_NONBLOCKING:
+            return zcm_nonblocking_set_dispatch_profiling(zcm->impl, enable, slowUs, cb, usr);
+    }
+#endif
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    return zcm_nonblocking_set_dispatch_profiling(zcm->impl, enable, slowUs, cb, usr);
+}
+
 int  zcm_try_flush(zcm_t* zcm)
 {
 #ifndef ZCM_EMBEDDED
@@ -212,6 +386,15 @@ int  zcm_try_flush(zcm_t* zcm)
     return ZCM_EOK;
 }
 
+int  zcm_flush_n(zcm_t* zcm, uint32_t maxMsgs, uint32_t budgetUs)
+{
+#ifndef ZCM_EMBEDDED
+    if (zcm->type == ZCM_BLOCKING) return zcm_blocking_flush_n(zcm->impl, maxMsgs, budgetUs);
+#endif
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    return zcm_nonblocking_flush_n(zcm->impl, maxMsgs, budgetUs);
+}
+
 zcm_sub_t* zcm_subscribe(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb, void* usr)
 {
 #ifndef ZCM_EMBEDDED
@@ -314,6 +497,12 @@ int zcm_handle(zcm_t* zcm)
     ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
     return zcm_blocking_handle(zcm->impl);
 }
+
+int zcm_handle_timeout(zcm_t* zcm, uint32_t timeoutUs)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_handle_timeout(zcm->impl, timeoutUs);
+}
 #endif
 
 #ifndef ZCM_EMBEDDED
@@ -332,8 +521,272 @@ int  zcm_try_set_queue_size(zcm_t* zcm, uint32_t numMsgs)
 }
 #endif
 
+#ifndef ZCM_EMBEDDED
+int  zcm_set_queue_bytes(zcm_t* zcm, uint64_t maxBytes)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_queue_bytes(zcm->impl, maxBytes);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_recv_strategy(zcm_t* zcm, enum zcm_recv_strategy strategy, uint32_t spinUs)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_recv_strategy(zcm->impl, strategy, spinUs);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_thread_affinity(zcm_t* zcm, enum zcm_thread thread, const int* cpus, uint32_t ncpus)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_thread_affinity(zcm->impl, thread, cpus, ncpus);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_numa_node(zcm_t* zcm, int node)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_numa_node(zcm->impl, node);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_thread_priority(zcm_t* zcm, enum zcm_thread thread, int priority)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_thread_priority(zcm->impl, thread, priority);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_thread_name(zcm_t* zcm, enum zcm_thread thread, const char* name)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_thread_name(zcm->impl, thread, name);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_inline_publish(zcm_t* zcm, int enable)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_inline_publish(zcm->impl, enable);
+}
+
+int  zcm_set_try_publish(zcm_t* zcm, int enable)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_try_publish(zcm->impl, enable);
+}
+
+int  zcm_set_stats_publish(zcm_t* zcm, uint32_t periodMs)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_stats_publish(zcm->impl, periodMs);
+}
+
+int  zcm_set_trace_publish(zcm_t* zcm, int enable)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_trace_publish(zcm->impl, enable);
+}
+
+void zcm_set_trace_id(uint64_t trace_id)
+{
+    zcm_blocking_set_trace_id(trace_id);
+}
+
+int  zcm_set_channel_priority(zcm_t* zcm, const char* channel, enum zcm_priority prio)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_channel_priority(zcm->impl, channel, prio);
+}
+
+int  zcm_set_compression(zcm_t* zcm, const char* channel, enum zcm_codec codec,
+                         uint32_t minSize)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_compression(zcm->impl, channel, codec, minSize);
+}
+
+int  zcm_set_decompress(zcm_t* zcm, int enable)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_decompress(zcm->impl, enable);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_sub_queue(zcm_t* zcm, zcm_sub_t* sub, uint32_t depth, enum zcm_queue_policy policy)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_sub_queue(zcm->impl, sub, depth, policy);
+}
+
+int  zcm_set_sub_decimation(zcm_t* zcm, zcm_sub_t* sub, uint32_t minPeriodUs,
+                            uint32_t keepEvery)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_sub_decimation(zcm->impl, sub, minPeriodUs, keepEvery);
+}
+
+int  zcm_set_sub_priority(zcm_t* zcm, zcm_sub_t* sub, enum zcm_priority prio)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_sub_priority(zcm->impl, sub, prio);
+}
+
+int  zcm_set_sub_max_age(zcm_t* zcm, zcm_sub_t* sub, uint32_t maxAgeUs)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_sub_max_age(zcm->impl, sub, maxAgeUs);
+}
+
+int  zcm_set_sub_filter(zcm_t* zcm, zcm_sub_t* sub, zcm_filter_t filter, void* usr)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_sub_filter(zcm->impl, sub, filter, usr);
+}
+
+zcm_sub_t* zcm_subscribe_batch(zcm_t* zcm, const char* channel, zcm_batch_handler_t cb,
+                               uint32_t maxBatch, uint32_t depth, void* usr)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_subscribe_batch(zcm->impl, channel, cb, maxBatch, depth, usr);
+}
+
+zcm_timer_t* zcm_add_timer(zcm_t* zcm, uint64_t periodUs, zcm_timer_handler_t cb, void* usr)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_add_timer(zcm->impl, periodUs, cb, usr);
+}
+
+int  zcm_remove_timer(zcm_t* zcm, zcm_timer_t* timer)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_remove_timer(zcm->impl, timer);
+}
+
+zcm_held_msg_t* zcm_hold_recv_buf(const zcm_recv_buf_t* rbuf)
+{
+    if (rbuf->zcm->type != ZCM_BLOCKING) return NULL;
+    return zcm_blocking_hold_recv_buf(rbuf);
+}
+
+void zcm_release_recv_buf(zcm_held_msg_t* held)
+{
+    zcm_blocking_release_recv_buf(held);
+}
+#endif
+
+#ifndef ZCM_EMBEDDED
+int  zcm_set_dispatch_threads(zcm_t* zcm, uint32_t numThreads)
+{
+    ZCM_ASSERT(zcm->type == ZCM_BLOCKING);
+    return zcm_blocking_set_dispatch_threads(zcm->impl, numThreads);
+}
+#endif
+
+uint32_t zcm_channel_hash(const char* channel)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (; *channel; ++channel) {
+        hash ^= (uint8_t) *channel;
+        hash *= 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+static const uint8_t traceMagic[8] = { 0x89, 'Z', 'C', 'M', 'T', 'R', 'C', 0x01 };
+
+void zcm_trace_encode(uint8_t* hdr, int64_t send_ns, uint64_t trace_id)
+{
+    int i;
+    for (i = 0; i < 8; ++i) {
+        hdr[i] = traceMagic[i];
+        hdr[8 + i] = (uint8_t) ((uint64_t) send_ns >> (56 - 8 * i));
+        hdr[16 + i] = (uint8_t) (trace_id >> (56 - 8 * i));
+    }
+}
+
+int zcm_trace_decode(const uint8_t* data, uint32_t len, int64_t* send_ns, uint64_t* trace_id)
+{
+    uint64_t ns = 0, id = 0;
+    int i;
+    *send_ns = 0;
+    *trace_id = 0;
+    if (len < ZCM_TRACE_HDR_SIZE) return 0;
+    for (i = 0; i < 8; ++i)
+        if (data[i] != traceMagic[i]) return 0;
+    for (i = 0; i < 8; ++i) {
+        ns = (ns << 8) | data[8 + i];
+        id = (id << 8) | data[16 + i];
+    }
+    *send_ns = (int64_t) ns;
+    *trace_id = id;
+    return 1;
+}
+
+static const uint8_t codecMagic[7] = { 0x89, 'Z', 'C', 'M', 'Z', 'I', 'P' };
+
+void zcm_codec_encode(uint8_t* hdr, uint8_t codec, uint32_t raw_len)
+{
+    int i;
+    for (i = 0; i < 7; ++i) hdr[i] = codecMagic[i];
+    hdr[7] = codec;
+    for (i = 0; i < 4; ++i) hdr[8 + i] = (uint8_t) (raw_len >> (24 - 8 * i));
+}
+
+int zcm_codec_decode(const uint8_t* data, uint32_t len, uint32_t* raw_len)
+{
+    uint32_t n = 0;
+    int i;
+    *raw_len = 0;
+    if (len < ZCM_CODEC_HDR_SIZE) return 0;
+    for (i = 0; i < 7; ++i)
+        if (data[i] != codecMagic[i]) return 0;
+    if (data[7] == ZCM_CODEC_NONE || data[7] >= ZCM_NUM_CODECS) return 0;
+    for (i = 0; i < 4; ++i) n = (n << 8) | data[8 + i];
+    *raw_len = n;
+    return data[7];
+}
+
 int zcm_handle_nonblock(zcm_t* zcm)
 {
+#ifndef ZCM_EMBEDDED
+    if (zcm->type == ZCM_BLOCKING) return zcm_blocking_handle_nonblock(zcm->impl);
+#endif
     ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
     return zcm_nonblocking_handle_nonblock(zcm->impl);
 }
+
+int zcm_handle_nonblock_n(zcm_t* zcm, uint32_t maxMsgs, uint32_t budgetUs)
+{
+#ifndef ZCM_EMBEDDED
+    if (zcm->type == ZCM_BLOCKING) return zcm_blocking_handle_nonblock_n(zcm->impl, maxMsgs, budgetUs);
+#endif
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    return zcm_nonblocking_handle_nonblock_n(zcm->impl, maxMsgs, budgetUs);
+}
+
+int zcm_get_fd(zcm_t* zcm)
+{
+#ifndef ZCM_EMBEDDED
+    if (zcm->type == ZCM_BLOCKING) return zcm_blocking_get_fd(zcm->impl);
+#endif
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    return zcm_nonblocking_get_fd(zcm->impl);
+}
+
+int zcm_has_subscribers(zcm_t* zcm, const char* channel)
+{
+#ifndef ZCM_EMBEDDED
+    if (zcm->type == ZCM_BLOCKING) return zcm_blocking_has_subscribers(zcm->impl, channel);
+#endif
+    ZCM_ASSERT(zcm->type == ZCM_NONBLOCKING);
+    return zcm_nonblocking_has_subscribers(zcm->impl, channel);
+}
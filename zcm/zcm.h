@@ -7,6 +7,8 @@ extern "C" {
 
 #include <stdint.h>
 
+#include "zcm_alloc.h"
+
 #include <assert.h>
 #define ZCM_ASSERT(X) assert(X)
 
@@ -15,7 +17,28 @@ extern "C" {
 #endif
 
 /* Important hardcoded values */
+/* Every subscription holds a channel name this long: embedded nodes with short
+   channel names can define it smaller to save RAM */
+#ifndef ZCM_CHANNEL_MAXLEN
 #define ZCM_CHANNEL_MAXLEN 32
+#endif
+
+/* Reserved for the zcm_stats_t messages of zcm_set_stats_publish() */
+#define ZCM_STATS_CHANNEL "ZCM_STATS"
+
+/* Size of the envelope zcm_set_trace_publish() wraps messages in */
+#define ZCM_TRACE_HDR_SIZE 24
+/* Size of the envelope zcm_set_compression() wraps compressed messages in */
+#define ZCM_CODEC_HDR_SIZE 12
+
+/* Codecs of zcm_set_compression() */
+enum zcm_codec {
+    ZCM_CODEC_NONE = 0,
+    ZCM_CODEC_FAST,     /* zlib at its fastest level */
+    ZCM_CODEC_SMALL,    /* zlib at its smallest level */
+    ZCM_NUM_CODECS
+};
+
 enum zcm_type {
     ZCM_BLOCKING,
     ZCM_NONBLOCKING
@@ -42,6 +65,9 @@ typedef struct zcm_trans_t    zcm_trans_t;
 typedef struct zcm_t          zcm_t;
 typedef struct zcm_recv_buf_t zcm_recv_buf_t;
 typedef struct zcm_sub_t      zcm_sub_t;
+typedef struct zcm_pub_msg_t  zcm_pub_msg_t;
+typedef struct zcm_pub_status_t zcm_pub_status_t;
+typedef struct zcm_iov_t      zcm_iov_t;
 
 /* Generic message handler function type */
 typedef void (*zcm_msg_handler_t)(const zcm_recv_buf_t* rbuf,
@@ -63,13 +89,46 @@ struct zcm_recv_buf_t
     zcm_t*   zcm;
     uint8_t* data; /* NOTE: do not free, the library manages this memory */
     uint32_t data_size;
+    uint32_t chan_hash; /* zcm_channel_hash() of the channel */
+    int64_t  recv_ns;   /* recv_utime in nanoseconds. Only more precise than recv_utime
+                           (e.g. kernel or NIC receive timestamps) if the transport is */
+    int64_t  send_ns;   /* the publisher's wall clock when it published the message, in
+                           nanoseconds, if it traces them (zcm_set_trace_publish()), else 0 */
+    uint64_t trace_id;  /* set by the publisher with zcm_set_trace_id(), else 0 */
 };
 
+/* Hashes a channel name (32-bit FNV-1a). Never returns 0, so 0 can mark a hash
+   that has not been computed yet. Every zcm_recv_buf_t carries the hash of its
+   channel so callbacks can key per-channel state on it without rehashing */
+uint32_t zcm_channel_hash(const char* channel);
+
+/* Called by zcm_get_stats() once per counter. 'name' is only valid during the call */
+typedef void (*zcm_stat_handler_t)(const char* name, uint64_t value, void* usr);
+
+/* Called right after a callback that ran for at least the threshold given to
+   zcm_set_dispatch_profiling(), from the thread that ran it. 'sub' is the one
+   zcm_subscribe() returned */
+typedef void (*zcm_slow_handler_t)(const zcm_sub_t* sub, const char* channel,
+                                   uint64_t elapsed_us, void* usr);
+
+/* Called with 'n' messages of one channel at once (see zcm_subscribe_batch()).
+   'rbufs' is only valid during the call */
+typedef void (*zcm_batch_handler_t)(const zcm_recv_buf_t* rbufs, uint32_t n,
+                                    const char* channel, void* usr);
+
+/* Returns nonzero if a subscription wants the message of 'len' bytes at 'data' (still
+   encoded, as its callback would get it). See zcm_set_sub_filter() */
+typedef int (*zcm_filter_t)(const uint8_t* data, uint32_t len, const char* channel, void* usr);
+
+/* Called once per zcm_publish_notify() that returned ZCM_EOK, with the return code of
+   the transport's sendmsg() or ZCM_EINTR if the message was dropped unsent */
+typedef void (*zcm_sent_handler_t)(int status, void* usr);
+
 #ifndef ZCM_EMBEDDED
 int zcm_retcode_name_to_enum(const char* zcm_retcode_name);
 #endif
 
-/* Standard create/destroy functions. These will malloc() and free() the zcm_t object.
+/* Standard create/destroy functions. These will zcm_alloc() and zcm_dealloc() the zcm_t object.
    Sets zcm errno on failure */
 #ifndef ZCM_EMBEDDED
 zcm_t* zcm_create(const char* url);
@@ -89,6 +148,14 @@ int zcm_init(zcm_t* zcm, const char* url);
    Sets zcm errno on failure */
 int zcm_init_trans(zcm_t* zcm, zcm_trans_t* zt);
 
+/* Initialize a zcm instance allocated by caller around a nonblocking zcm made by
+   zcm_nonblocking_create_static() (see nonblocking.h): with both, nothing is malloc()ed.
+   zcm_cleanup() destroys the transport but leaves the memory alone.
+   Returns 0 on success, and -1 if impl is NULL
+   Sets zcm errno on failure */
+struct zcm_nonblocking;
+int zcm_init_nonblocking(zcm_t* zcm, struct zcm_nonblocking* impl);
+
 /* Cleanup a zcm object allocated by caller */
 void zcm_cleanup(zcm_t* zcm);
 
@@ -113,13 +180,19 @@ zcm_sub_t* zcm_subscribe(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb,
 zcm_sub_t* zcm_try_subscribe(zcm_t* zcm, const char* channel, zcm_msg_handler_t cb, void* usr);
 
 /* Unsubscribe to zcm messages, freeing the subscription object
+   In blocking mode, once this returns the subscription's callback is not running on
+   any other thread and will not be called again. Both zcm_subscribe() and
+   zcm_unsubscribe() may be called from within a callback. Two callbacks that
+   unsubscribe from each other's subscription at once don't wait for each other:
+   there, the other callback may still be running until the caller's returns.
    Returns ZCM_EOK on success, error code on failure
    Does NOT set zcm errno on failure */
 int zcm_unsubscribe(zcm_t* zcm, zcm_sub_t* sub);
 
 /* Unsubscribe to zcm messages, freeing the subscription object
    Returns ZCM_EOK on success, error code on failure
-   Can fail to subscribe if zcm is already running
+   Fails with ZCM_EAGAIN rather than wait, when zcm is busy with the subscriptions
+   or the subscription's callback is running on another thread
    Does NOT set zcm errno on failure */
 int zcm_try_unsubscribe(zcm_t* zcm, zcm_sub_t* sub);
 
@@ -130,6 +203,70 @@ int zcm_try_unsubscribe(zcm_t* zcm, zcm_sub_t* sub);
    Sets zcm errno on failure */
 int zcm_publish(zcm_t* zcm, const char* channel, const uint8_t* data, uint32_t len);
 
+/* How full the send side was after a zcm_try_publish() */
+struct zcm_pub_status_t
+{
+    uint32_t queued;       /* messages queued at the priority class of the channel */
+    uint32_t capacity;     /* how many messages that queue holds */
+    uint64_t queued_bytes; /* memory of every queued message (see zcm_set_queue_bytes()) */
+    uint64_t max_bytes;    /* the bound on it, 0 for none */
+};
+
+/* Publish a zcm message buffer without ever waiting. Returns ZCM_EAGAIN if it would have
+   to: the send queue is full, the memory bound is reached or, with inline publishing,
+   another thread is sending. zcm_publish() never waits on the queues either, but inline
+   publishes wait for one another. When 'status' is not NULL, it is filled in (with zeros
+   in nonblocking mode, where transports never block) so that publishers can conflate or
+   slow down before the send side fills up.
+   Returns 0 on success, error code on failure
+   Sets zcm errno on failure */
+int zcm_try_publish(zcm_t* zcm, const char* channel, const uint8_t* data, uint32_t len,
+                    zcm_pub_status_t* status);
+
+/* Like zcm_publish(), and later calls 'cb' once the message is handed to the transport.
+   For blocking transports, that is from the send thread (or the publishing thread when
+   the message went out inline) right after sendmsg() returns, so 'cb' must not wait on
+   the send side itself: no zcm_flush() and no inline publishes. Messages still queued
+   when the zcm is destroyed are reported with ZCM_EINTR. In nonblocking mode, 'cb' is
+   called before this returns. 'cb' is never called when this returns an error.
+   Returns 0 on success, error code on failure
+   Sets zcm errno on failure */
+int zcm_publish_notify(zcm_t* zcm, const char* channel, const uint8_t* data, uint32_t len,
+                       zcm_sent_handler_t cb, void* usr);
+
+/* One message of a zcm_publish_batch() */
+struct zcm_pub_msg_t
+{
+    const char*    channel;
+    const uint8_t* data;
+    uint32_t       len;
+};
+
+/* Publish 'nmsgs' zcm message buffers at once. For blocking transports, either all of
+   the messages or none of them are queued (with a single lock acquisition), and
+   transports that support it send them with as few system calls as possible.
+   Otherwise, this is equivalent to calling zcm_publish() on each message.
+   Returns 0 on success, error code on failure
+   Sets zcm errno on failure */
+int zcm_publish_batch(zcm_t* zcm, const zcm_pub_msg_t* msgs, uint32_t nmsgs);
+
+/* One piece of the data of a zcm_publish_iov() */
+struct zcm_iov_t
+{
+    const void* base;
+    uint32_t    len;
+};
+
+/* Publish one message whose data is the 'niov' pieces of 'iov', one after the other.
+   Transports that can send the pieces from where they are (udpm fragments, for
+   instance) do, which saves putting a large message together in one buffer first;
+   for the others, the pieces are copied together. For blocking transports they are
+   only sent in place when published inline (zcm_set_inline_publish()) and neither
+   compressed nor traced: a queued message is a copy anyway.
+   Returns 0 on success, error code on failure
+   Sets zcm errno on failure */
+int zcm_publish_iov(zcm_t* zcm, const char* channel, const zcm_iov_t* iov, uint32_t niov);
+
 /* Block until all published messages have been sent even if the underlying
    transport is nonblocking. Additionally, dispatches all messages that have
    already been received sequentially in this thread. */
@@ -140,6 +277,58 @@ void zcm_flush(zcm_t* zcm);
    you should zcm_pause() first. */
 int  zcm_try_flush(zcm_t* zcm);
 
+/* Like zcm_flush(), bounded for loops that budget their time: sends what was queued
+   when called, then dispatches at most 'maxMsgs' of the messages received by then,
+   stopping once 'budgetUs' microseconds have passed (0 means no limit for either).
+   Messages received in the meantime are left for the next call. The budget is checked
+   before each message, so one slow callback can overrun it, and a round of
+   zcm_set_sub_queue() queues counts as one message. In nonblocking mode, the transport
+   update runs twice as in zcm_flush(), and the bounds work as in zcm_handle_nonblock_n().
+   Returns the number of messages dispatched */
+int  zcm_flush_n(zcm_t* zcm, uint32_t maxMsgs, uint32_t budgetUs);
+
+/* Reports every counter kept by zcm and its transport (e.g. packets the kernel
+   dropped, or messages missing from each sender) by calling 'cb' once per counter.
+   Counters count up from the creation of zcm, except for the "_depth" ones (queued
+   right now) and the "_hwm" ones (the most ever queued at once). In blocking mode
+   this may be called from any thread, even while zcm is running, and also reports:
+       zcm.pub_msgs, zcm.pub_bytes     published successfully
+       zcm.pub_queue_full              publishes refused with ZCM_EAGAIN
+       zcm.send_errors                 sends the transport failed
+       zcm.send_queue_depth, _hwm      messages waiting for the send thread
+       zcm.send_interleaved            sent between the pieces of a large message
+       zcm.recv_msgs, zcm.recv_bytes   received from the transport
+       zcm.recv_unrouted               received with no subscription to match
+       zcm.recv_decimated              received but skipped by every subscription it
+                                       matched (see zcm_set_sub_decimation())
+       zcm.recv_filtered               received but rejected by the filters of every
+                                       subscription it matched (zcm_set_sub_filter())
+       zcm.recv_queue_depth, _hwm      messages waiting for the dispatch threads
+       zcm.recv_blocked_us             time the recv thread waited on a full queue
+       zcm.sub_queue_drops             messages dropped by zcm_set_sub_queue() queues
+       zcm.dispatch_stale              messages too old to dispatch (zcm_set_sub_max_age())
+       zcm.queue_bytes, _hwm           memory of all queued messages (zcm_set_queue_bytes())
+       zcm.channel.<channel>.msgs, .bytes   received on each channel (up to 1024)
+       zcm.sub.<id>.<channel>.dispatch_msgs, .dispatch_us, .dispatch_max_us
+                                       calls of each subscription's callback and the
+                                       time they took: total, and the longest one
+   Returns ZCM_EOK on success. In nonblocking mode, ZCM_EINVALID if the transport
+   keeps no counters and dispatch profiling is off
+   Does NOT set zcm errno on failure */
+int  zcm_get_stats(zcm_t* zcm, zcm_stat_handler_t cb, void* usr);
+
+/* When enabled, keeps a histogram of how long each subscription's callback takes,
+   which zcm_get_stats() reports as zcm.sub.<id>.<channel>.dispatch_p50_ns (and
+   _p90_ns, _p99_ns, _p999_ns), each within 12.5%. Nonblocking zcm also reports
+   .dispatch_msgs for those. Callbacks run one after the other, so a slow one delays
+   all the others: if 'cb' is set, it is called after every callback that ran for
+   'slowUs' or more. Can also be enabled with the url option "dispatch_profiling=true".
+   Must be called while zcm is not running (blocking) or dispatching (nonblocking).
+   Returns ZCM_EOK on success, ZCM_EINVALID if there is no clock to time callbacks with
+   (embedded nonblocking builds have to define ZCM_NONBLOCK_NSTIME) */
+int  zcm_set_dispatch_profiling(zcm_t* zcm, int enable, uint32_t slowUs,
+                                zcm_slow_handler_t cb, void* usr);
+
 #ifndef ZCM_EMBEDDED
 /* Blocking Mode Only: Functions for controlling the message dispatch loop */
 void zcm_run(zcm_t* zcm);
@@ -149,6 +338,10 @@ int  zcm_try_stop(zcm_t* zcm); /* returns ZCM_EOK on success, error code on fail
 void zcm_pause(zcm_t* zcm); /* pauses message dispatch and publishing, not transport */
 void zcm_resume(zcm_t* zcm);
 int  zcm_handle(zcm_t* zcm); /* returns ZCM_EOK normally, error code on failure. */
+/* Like zcm_handle(), but dispatches at most one message (or the timers that are due),
+   waiting no more than 'timeoutUs' microseconds for it. Returns ZCM_EOK if anything
+   was dispatched, ZCM_EAGAIN on timeout, error code on failure */
+int  zcm_handle_timeout(zcm_t* zcm, uint32_t timeoutUs);
 /* Determines how many messages can be stored from the transport without being dispatched
    As well as the number of messages that may be stored from the user without being
    transmitted by the transport. Normal operation does not require the user to modify
@@ -156,16 +349,332 @@ int  zcm_handle(zcm_t* zcm); /* returns ZCM_EOK normally, error code on failure.
    calls to zcm_flush(), it will be important to set an appropriate queue size based on
    traffic and flush frequency. Note that if either queue reaches maximum capacity,
    messages will not be read from / sent to the transport, which could cause significant
-   issues depending on the transport. */
+   issues depending on the transport. The queues take up memory for the messages in them,
+   whatever their size, plus the memory of messages already dispatched or sent, kept for
+   reuse: at most as many messages' worth as the queue size, and only once the queue has
+   been that deep. They may be resized at any time: no message is dropped, and a queue
+   that holds more than its new size takes no more until it drains below it. */
 void zcm_set_queue_size(zcm_t* zcm, uint32_t numMsgs);
 int  zcm_try_set_queue_size(zcm_t* zcm, uint32_t numMsgs); /* returns ZCM_EOK or ZCM_EAGAIN */
+/* Bounds the memory of all the messages queued by zcm at once (waiting for the send
+   thread, the dispatch threads or in zcm_set_sub_queue() queues) to 'maxBytes' in total,
+   counting their channels and data. 0, the default, doesn't bound it. This applies on
+   top of zcm_set_queue_size(): a queue only takes a message that fits both, so to bound
+   by memory alone, also set a large queue size: the queues then grow under bursts, up to
+   'maxBytes', and give the memory back as they drain. Over the bound, publishes return
+   ZCM_EAGAIN, the recv thread waits for dispatches to free memory (like on a full queue)
+   and zcm_set_sub_queue() queues drop the message. A message bigger than the bound
+   still goes through when nothing else is queued. zcm_get_stats() reports the memory
+   in use as zcm.queue_bytes (and zcm.queue_bytes_hwm). Can also be set with the url
+   option "queue_bytes=N". Returns ZCM_EOK */
+int  zcm_set_queue_bytes(zcm_t* zcm, uint64_t maxBytes);
+/* Sets the number of threads dispatching messages in zcm_run() / zcm_start() (default 1).
+   Each channel is always dispatched by the same thread, so messages on one channel are
+   still dispatched in order, but callbacks for different channels may run concurrently.
+   Each thread has its own receive queue of the size set by zcm_set_queue_size().
+   zcm_handle() always dispatches from a single queue. Can also be set with the url
+   option "dispatch_threads=N". Must not be called while zcm is running or concurrently
+   with zcm_flush(). Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_dispatch_threads(zcm_t* zcm, uint32_t numThreads);
+/* When enabled, zcm_publish() and zcm_publish_batch() hand messages to the transport
+   directly from the calling thread instead of queueing them for the send thread. This
+   removes a thread handoff from every publish, at the cost of the publisher blocking
+   for as long as the transport takes to send. Concurrent publishes are serialized.
+   While paused, messages are queued and sent ahead of the next publish after
+   zcm_resume(). Can also be set with the url option "inline_publish=true".
+   Must not be called concurrently with zcm_publish(). Returns ZCM_EOK */
+int  zcm_set_inline_publish(zcm_t* zcm, int enable);
+/* When enabled, zcm_publish() and zcm_publish_batch() never wait, like zcm_try_publish().
+   Can also be set with the url option "try_publish=true". Returns ZCM_EOK */
+int  zcm_set_try_publish(zcm_t* zcm, int enable);
+/* Publishes the counters of zcm_get_stats() on ZCM_STATS_CHANNEL every 'periodMs'
+   (0, the default, disables it) while zcm_run() or zcm_start() run, so that tools
+   can watch every process on the network. They are encoded as a zcm_stats_t, whose
+   definition is installed as share/zcm/types/zcm_stats_t.zcm: generate it to
+   decode them. Published from the recv thread, at most ~100ms late. Can also be set
+   with the url options "stats_publish_ms=N" and "stats_name" (a name for the
+   process, sent along with the counters). Must be called while zcm is not running.
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_stats_publish(zcm_t* zcm, uint32_t periodMs);
+/* When enabled, every message published is sent with an envelope carrying the time it
+   was published and the trace id of the publishing thread, whatever the transport.
+   Receivers take the envelope off before dispatching (zcm_recv_buf_t send_ns and
+   trace_id), so subscribers must run a zcm that knows about it. Blocking receivers
+   report, per channel, the latency from the publish to the receive and to the dispatch
+   of the traced messages in zcm_get_stats(), as zcm.trace.<channel>.msgs,
+   .recv_p50_ns, .recv_p99_ns, .recv_p999_ns, .dispatch_p50_ns, .dispatch_p99_ns,
+   .dispatch_p999_ns and .min_ns (the lowest publish to dispatch latency seen).
+   Across hosts these include the offset between their clocks: .clock_skewed counts
+   the messages which seemed to arrive before they were sent (counted as 0 latency),
+   and the dispatch percentiles less .min_ns are the latency added on top of the
+   fastest delivery, whatever the offset. Takes ZCM_TRACE_HDR_SIZE bytes of the mtu.
+   Can also be set with the url option "trace_publish=true". Must not be called
+   concurrently with zcm_publish(). Returns ZCM_EOK */
+int  zcm_set_trace_publish(zcm_t* zcm, int enable);
+/* Sets the trace id of the messages the calling thread publishes next, on any zcm
+   tracing them (0, the default, for none). Callbacks can pass rbuf->trace_id on to
+   the messages they publish in turn */
+void zcm_set_trace_id(uint64_t trace_id);
+
+/* Priority classes of the channels published through the send thread */
+enum zcm_priority {
+    ZCM_PRIORITY_LOW = 0,
+    ZCM_PRIORITY_NORMAL, /* default */
+    ZCM_PRIORITY_HIGH,
+    ZCM_NUM_PRIORITIES
+};
+
+/* Sets the priority class of 'channel' (an exact name, not a regex). The send thread
+   keeps one queue per class, each of the size set by zcm_set_queue_size() (so up to
+   ZCM_NUM_PRIORITIES times that many messages are queued in all), and always sends
+   the messages of a higher class first; messages on one channel stay in order.
+   Transports that send large messages in pieces (udpm, unless reliable) also slip short
+   messages of a higher class in between the pieces, so a control message doesn't wait
+   for a whole upload to go out. Messages published inline (zcm_set_inline_publish())
+   go out as they come. Can also be set with the url options "priority_high=CH1,CH2"
+   and "priority_low=CH3,CH4". May be called while publishing, though the
+   messages of 'channel' already queued keep their class, so they may go out after
+   later ones. Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_channel_priority(zcm_t* zcm, const char* channel, enum zcm_priority prio);
+
+/* Compresses the messages published on 'channel' (a regex like zcm_subscribe()'s)
+   of at least 'minSize' bytes with 'codec', whatever the transport. They are sent in
+   an envelope of ZCM_CODEC_HDR_SIZE bytes, which blocking receivers take off again
+   before dispatching, so subscribers must run a zcm that knows about it (nonblocking
+   receivers dispatch the envelope as is). A message is only sent compressed if that
+   saves an eighth of it; after a few messages in a row that don't, the channel is
+   sent raw for a while before trying again. Messages which already are compressed
+   (republished by a bridge, or played back) go out untouched. The last call whose
+   'channel' matches a channel wins, so ZCM_CODEC_NONE can exclude channels from a
+   pattern set before. Counted in zcm_get_stats() as zcm.compressed_msgs,
+   zcm.compress_skipped, zcm.compress_saved_bytes and zcm.decompress_errors. Can also
+   be set for every channel with the url options "compress=fast|small" and
+   "compress_min=N". Must not be called concurrently with zcm_publish().
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise (or if built without zlib) */
+int  zcm_set_compression(zcm_t* zcm, const char* channel, enum zcm_codec codec,
+                         uint32_t minSize);
+/* When disabled, compressed messages are dispatched with their envelope instead
+   of being decompressed (the default is enabled), so bridges and loggers can pass
+   them on as they are. Can also be set with the url option "decompress=false".
+   Must be called while zcm is not running. Returns ZCM_EOK on success,
+   ZCM_EINVALID otherwise */
+int  zcm_set_decompress(zcm_t* zcm, int enable);
+
+/* How the receive side waits for new messages (see zcm_set_recv_strategy()) */
+enum zcm_recv_strategy {
+    ZCM_RECV_BLOCK = 0, /* default: sleep in the transport and on the queues */
+    ZCM_RECV_SPIN,      /* poll for 'spinUs' after each message, then sleep */
+    ZCM_RECV_BUSY_POLL  /* always poll, never sleep (dedicates a core to each thread) */
+};
+
+/* Sets the receive strategy. Polling strategies trade cpu time for latency: the recv
+   thread polls the transport and the dispatch threads poll their queues instead of
+   waiting to be woken up. Best combined with zcm_set_thread_affinity(). Can also be set
+   with the url options "recv_strategy=block|spin|busy_poll" and "recv_spin_us=N"
+   (default 50). Must be called while zcm is not running.
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_recv_strategy(zcm_t* zcm, enum zcm_recv_strategy strategy, uint32_t spinUs);
+
+/* Threads run internally by blocking zcm */
+enum zcm_thread {
+    ZCM_THREAD_SEND = 0, /* transmits published messages */
+    ZCM_THREAD_RECV,     /* receives messages from the transport */
+    ZCM_THREAD_DISPATCH, /* runs callbacks in zcm_run() / zcm_start() (all dispatch threads) */
+    ZCM_NUM_THREADS
+};
+
+/* Restricts an internal thread to the 'ncpus' cpus in 'cpus' (ncpus = 0 clears the
+   restriction). Takes effect the next time the thread is started. zcm_run() restores
+   the affinity of the calling thread when it returns; zcm_handle() never changes it.
+   Can also be set with the url options "send_cpus", "recv_cpus" and "dispatch_cpus"
+   (e.g. "recv_cpus=2,4-5"). Only supported on linux.
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_thread_affinity(zcm_t* zcm, enum zcm_thread thread, const int* cpus, uint32_t ncpus);
+
+/* Keeps the internal threads and what they allocate on NUMA node 'node' (-1, the
+   default, for anywhere): the threads not given cpus with zcm_set_thread_affinity() run
+   on the cpus of the node, and prefer its memory for the messages they receive, queue
+   and dispatch, including the transport's buffers. Best set to the node of the network
+   card, so each received byte stays on one node. Takes effect the next time the
+   threads are started. Can also be set with the url option "numa_node", given either a
+   node or the network interface to take the node of (e.g. "numa_node=eth0"). Only
+   supported on linux. Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_numa_node(zcm_t* zcm, int node);
+
+/* Runs an internal thread under SCHED_FIFO at 'priority' (1-99), or under the default
+   scheduler if 'priority' is 0 (the default). Takes effect the next time the thread is
+   started; failures (usually missing CAP_SYS_NICE) are only reported with ZCM_DEBUG.
+   Can also be set with the url options "send_prio", "recv_prio" and "dispatch_prio".
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_thread_priority(zcm_t* zcm, enum zcm_thread thread, int priority);
+
+/* Names an internal thread (as shown by top and gdb). Names are truncated to 15
+   characters; the dispatch workers get a "-N" suffix. Defaults to "zcm-send",
+   "zcm-recv" and "zcm-dispatch"; an empty name leaves the thread unnamed. Takes effect
+   the next time the thread is started. Can also be set with the url options
+   "send_name", "recv_name" and "dispatch_name".
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_thread_name(zcm_t* zcm, enum zcm_thread thread, const char* name);
+
+/* Receive queue policies for a single subscription (see zcm_set_sub_queue()) */
+enum zcm_queue_policy {
+    ZCM_QUEUE_SHARED = 0,  /* default: use the zcm-wide queue, blocking the transport when full */
+    ZCM_QUEUE_DROP_OLDEST, /* own queue, when full the oldest queued message is dropped */
+    ZCM_QUEUE_DROP_NEWEST, /* own queue, when full the incoming message is dropped */
+    ZCM_QUEUE_KEEP_LATEST  /* own queue of depth 1 that only ever holds the latest message */
+};
+
+/* Gives a subscription its own receive queue of 'depth' messages ('depth' is ignored
+   for ZCM_QUEUE_KEEP_LATEST). Messages for such a subscription never wait behind, or
+   hold up, messages for other subscriptions: when its queue is full, messages are
+   dropped according to 'policy' instead of blocking the transport. The subscription
+   queues and the shared queue are dispatched in alternation, so the callbacks still share
+   the dispatch thread (see zcm_set_dispatch_threads()). Best called right after
+   zcm_subscribe(); messages already queued for the subscription may be dropped.
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_sub_queue(zcm_t* zcm, zcm_sub_t* sub, uint32_t depth, enum zcm_queue_policy policy);
+/* Thins out the messages of a subscription that only needs some of them (e.g. 5 Hz of
+   a 1 kHz channel): only every 'keepEvery'th message is kept, and of those, none less than
+   'minPeriodUs' after the last one kept, going by their receive times. 0 turns either off.
+   Skipped messages are dropped by the recv thread as they arrive, before they are ever
+   copied or queued, unless another subscription wants them.
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_sub_decimation(zcm_t* zcm, zcm_sub_t* sub, uint32_t minPeriodUs,
+                            uint32_t keepEvery);
+/* Puts a subscription in a priority class (see zcm_set_channel_priority()) for dispatch.
+   Each dispatcher keeps a receive queue per class in use, of the size set by
+   zcm_set_queue_size(), and always dispatches the messages of the higher class first,
+   so an e-stop waits for at most the one callback already running rather than for
+   everything queued ahead of it. Messages of the lower class are only dispatched when
+   nothing else is queued. A message goes by the highest class of the subscriptions it
+   matches; messages on one channel stay in order. Subscriptions with their own queue
+   (zcm_set_sub_queue()) are not affected. Must be called while zcm is not running.
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_sub_priority(zcm_t* zcm, zcm_sub_t* sub, enum zcm_priority prio);
+/* Drops the messages of a subscription that are over 'maxAgeUs' microseconds old, going
+   by their receive time, when their turn to be dispatched comes, instead of calling its
+   callback with them: when the dispatch thread falls behind, stale sensor data is shed
+   rather than delaying the fresh. Each batch of zcm_subscribe_batch() loses its stale
+   messages only. zcm_get_stats() counts the drops as zcm.dispatch_stale, and as
+   zcm.sub.<id>.<channel>.stale_drops for each subscription. 0 turns it off.
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_sub_max_age(zcm_t* zcm, zcm_sub_t* sub, uint32_t maxAgeUs);
+/* Only lets the messages through for which 'filter' returns nonzero, e.g. to look at
+   a field at a fixed offset of the encoded message. It is called by the recv thread as
+   messages arrive, so rejected messages are never copied, queued or dispatched (unless
+   another subscription wants them), and must be quick and thread-safe. Compressed
+   messages (see zcm_set_compression()) are filtered once decompressed, by the dispatch
+   thread instead. Filtering happens before decimation. NULL removes the filter.
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_set_sub_filter(zcm_t* zcm, zcm_sub_t* sub, zcm_filter_t filter, void* usr);
+/* Like zcm_subscribe(), but 'cb' gets all the messages queued for the subscription,
+   up to 'maxBatch', in one call: for high rate channels where the callback does little
+   per message. The subscription has its own queue of 'depth' messages, dropping the
+   oldest when full (see zcm_set_sub_queue(), which can change that policy but not go
+   back to ZCM_QUEUE_SHARED). A batch only holds messages of one channel, so for a regex
+   channel, each run of messages on the same channel is a batch of its own. Unsubscribe
+   with zcm_unsubscribe(). Blocking mode only. Returns NULL on failure */
+zcm_sub_t* zcm_subscribe_batch(zcm_t* zcm, const char* channel, zcm_batch_handler_t cb,
+                               uint32_t maxBatch, uint32_t depth, void* usr);
+
+/* Called by a timer of zcm_add_timer(). 'ticks' is the number of periods since the last
+   call: 1, unless whole periods went by without the dispatch thread getting to it, in
+   which case this one call stands for all of them */
+typedef void (*zcm_timer_handler_t)(zcm_t* zcm, uint32_t ticks, void* usr);
+typedef struct zcm_timer_t zcm_timer_t;
+
+/* Calls 'cb' every 'periodUs' microseconds on the thread that dispatches the messages of
+   the first dispatcher: that of zcm_run() or zcm_start(), or the caller of zcm_handle()
+   and zcm_handle_nonblock(). It never runs concurrently with the callbacks of that
+   thread, so timers and subscriptions can share state without a lock. Deadlines follow
+   on from each other (the first one 'periodUs' from now), so a late call does not delay
+   the ones after it. Timers only fire while zcm is running or being handled, and not
+   while paused: zcm_handle_nonblock() fires those that are due, but zcm_get_fd() does not
+   become readable for them (nor does a zcm_executor_attach() fire them reliably).
+   May be called from any thread, including from within a callback.
+   Blocking mode only. Returns NULL on failure */
+zcm_timer_t* zcm_add_timer(zcm_t* zcm, uint64_t periodUs, zcm_timer_handler_t cb, void* usr);
+/* Once this returns, 'timer' is no longer called (unless this is called from within a
+   callback on another thread, which then finishes). Returns ZCM_EOK on success,
+   ZCM_EINVALID if 'timer' isn't a timer of zcm */
+int  zcm_remove_timer(zcm_t* zcm, zcm_timer_t* timer);
+
+/* A message kept past its callback by zcm_hold_recv_buf() */
+typedef struct zcm_held_msg_t zcm_held_msg_t;
+
+/* Keeps the data of 'rbuf' valid after its callback returns, until the returned hold is
+   passed to zcm_release_recv_buf(), so that it can be used later without being copied.
+   Must be called from the callback that got 'rbuf'. Only messages that zcm received
+   without a copy (from transports implementing recvmsg_claim(), see transport.h) can be
+   held: for the others, and those of zcm_set_sub_queue() queues, batched subscriptions,
+   compressed messages and nonblocking mode, this returns NULL, and the data must be
+   copied to be kept. Held messages no longer count towards zcm_set_queue_bytes(), but
+   still take up the memory of the transport (e.g. its receive buffers), which may drop
+   messages if too many are held at once. Every hold must be released before zcm_destroy() */
+zcm_held_msg_t* zcm_hold_recv_buf(const zcm_recv_buf_t* rbuf);
+/* Gives back the memory of a message held by zcm_hold_recv_buf(). May be called from any
+   thread */
+void zcm_release_recv_buf(zcm_held_msg_t* held);
+
+/* A pool of threads that serves many blocking zcm instances (see zcm_executor_attach()) */
+typedef struct zcm_executor_t zcm_executor_t;
+
+/* Creates an executor of 'numThreads' threads (at least 1). Linux only: returns NULL
+   elsewhere, or on failure */
+zcm_executor_t* zcm_executor_create(uint32_t numThreads);
+/* Detaches every zcm still attached, then joins the threads */
+void zcm_executor_destroy(zcm_executor_t* ex);
+/* Hands the dispatch and the sending of 'zcm' over to the threads of 'ex', so that
+   many instances share a few threads instead of running a dispatch and a send thread
+   each. Only its recv thread is left, as blocking transports can only be waited on
+   in their own recvmsg(). The callbacks of one zcm still run one at a time and in
+   order, on any of the threads; each zcm gets up to 64 messages dispatched at a time
+   before the others get their turn. Publishes are queued and sent by the executor
+   (unless inline, see zcm_set_inline_publish()). 'zcm' must not be running (nor
+   handled through zcm_get_fd()) and must not be started until detached again, nor
+   be destroyed before. Blocking mode only.
+   Returns ZCM_EOK on success, ZCM_EINVALID otherwise */
+int  zcm_executor_attach(zcm_executor_t* ex, zcm_t* zcm);
+/* Takes 'zcm' back from 'ex' and stops it, like zcm_stop(). Waits for its callbacks
+   to return, so must not be called from one of them. Returns ZCM_EOK on success,
+   ZCM_EINVALID if 'zcm' isn't attached to 'ex' */
+int  zcm_executor_detach(zcm_executor_t* ex, zcm_t* zcm);
 #endif
 
-/* Non-Blocking Mode Only: Functions checking and dispatching messages
+/* Functions checking and dispatching messages
    Returns ZCM_EOK if a message was dispatched, ZCM_EAGAIN if no messages,
-   error code otherwise */
+   error code otherwise. In blocking mode, this dispatches what the recv thread
+   received, like zcm_handle() but without waiting for a message */
 int zcm_handle_nonblock(zcm_t* zcm);
 
+/* Like zcm_handle_nonblock(), but runs the transport update (in nonblocking mode)
+   once and then dispatches messages until none are left, 'maxMsgs' have been
+   dispatched or 'budgetUs' microseconds have passed (0 means no limit for either).
+   The budget is checked after each message, so one slow callback can overrun it.
+   On ZCM_EMBEDDED builds the budget needs ZCM_NONBLOCK_UTIME() to be defined
+   (returning the time in microseconds) when building zcm, and is ignored otherwise.
+   Returns the number of messages dispatched */
+int zcm_handle_nonblock_n(zcm_t* zcm, uint32_t maxMsgs, uint32_t budgetUs);
+
+/* Returns a file descriptor that becomes readable when there may be messages, to wait
+   on in an external event loop (with select(), poll(), epoll...) before calling
+   zcm_handle_nonblock() until it returns ZCM_EAGAIN, so that one thread can serve many
+   zcm instances. In nonblocking mode, it is the transport's own descriptor (or -1 if
+   it has none). In blocking mode, it starts receiving in the background, like the first
+   zcm_handle(), and becomes readable when received messages are waiting; it can't be used
+   along with zcm_run() or zcm_start(), and returns -1 then. The descriptor belongs to zcm
+   and must only be waited on */
+int zcm_get_fd(zcm_t* zcm);
+
+/* Whether anybody may be subscribed to 'channel', so that publishers can skip encoding
+   and publishing what nobody would receive (e.g. expensive debug channels). Returns 0 only
+   when the transport knows that nobody is, which the ipc and inproc transports track, and
+   1 otherwise, including for transports that can't tell. New subscribers may take a moment
+   to show up: with ipc, subscribers in other processes only find a channel once this (or
+   a publish) was first called for it in the publishing process. In blocking mode this may
+   be called from any thread */
+int zcm_has_subscribers(zcm_t* zcm, const char* channel);
+
 /*
  * Version: M.m.u
  *   M: Major
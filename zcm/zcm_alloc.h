@@ -0,0 +1,59 @@
+#ifndef _ZCM_ALLOC_H
+#define _ZCM_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The parts of zcm whose allocations are counted apart */
+enum zcm_alloc_subsystem
+{
+    ZCM_ALLOC_CORE,       /* zcm_t objects and the nonblocking subscription tables */
+    ZCM_ALLOC_TYPES,      /* the generated C types: decoding, _copy() */
+    ZCM_ALLOC_BLOCKING,   /* messages queued by the blocking layer, and its queues */
+    ZCM_ALLOC_TRANSPORT,  /* the buffers of the transports */
+    ZCM_ALLOC_CPP,        /* what the C++ API encodes messages into */
+    ZCM_ALLOC_NUM_SUBSYSTEMS
+};
+
+/* Where all of zcm takes its memory from. alloc() is never asked for 0 bytes, and
+   returns NULL when out of memory. free() is never given NULL */
+typedef struct zcm_allocator_t zcm_allocator_t;
+struct zcm_allocator_t
+{
+    void* (*alloc)(void* usr, size_t size, enum zcm_alloc_subsystem subsys);
+    void  (*free)(void* usr, void* ptr, enum zcm_alloc_subsystem subsys);
+    void* usr;
+};
+
+/* Counts since the process started, of one subsystem */
+typedef struct zcm_alloc_stats_t zcm_alloc_stats_t;
+struct zcm_alloc_stats_t
+{
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes;  /* allocated, in total */
+};
+
+/* Makes 'alloc' (copied) the allocator of all of zcm, or malloc() and free() again if
+   NULL. Memory must go back to the allocator it came from: switch only while nothing
+   of zcm is alive, not even messages decoded by the generated C types. Not thread safe */
+void zcm_set_allocator(const zcm_allocator_t* alloc);
+
+/* What all of zcm allocates with: NULL for 0 bytes and when out of memory */
+void* zcm_alloc(size_t size, enum zcm_alloc_subsystem subsys);
+/* Does nothing for NULL */
+void  zcm_dealloc(void* ptr, enum zcm_alloc_subsystem subsys);
+
+/* Copies the counts of every subsystem into 'stats'. A path that allocates nothing
+   in steady state leaves 'allocs' unchanged */
+void zcm_get_alloc_stats(zcm_alloc_stats_t stats[ZCM_ALLOC_NUM_SUBSYSTEMS]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ZCM_ALLOC_H */
@@ -5,19 +5,90 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "zcm_alloc.h"
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 static inline void *zcm_malloc(uint32_t sz)
 {
-    if (sz) return malloc(sz);
-    return NULL;
+    return zcm_alloc(sz, ZCM_ALLOC_TYPES);
 }
 
 static inline void zcm_free(void* mem)
 {
-    free(mem);
+    zcm_dealloc(mem, ZCM_ALLOC_TYPES);
+}
+
+/**
+ * A bump allocator over a buffer that the caller owns, for the _decode_arena
+ * functions that zcm-gen --c-arena generates: decoding takes the strings and
+ * variable length arrays of a message from the arena instead of the heap, and
+ * zcm_arena_reset() releases all of them at once. Every allocation is rounded
+ * up to ZCM_ARENA_ALIGN bytes, from the start of 'buf', which should be
+ * aligned at least as much
+ */
+#define ZCM_ARENA_ALIGN 8
+#define ZCM_ARENA_ROUND(sz) (((sz) + (ZCM_ARENA_ALIGN - 1)) & ~(uint32_t)(ZCM_ARENA_ALIGN - 1))
+
+typedef struct _zcm_arena_t zcm_arena_t;
+struct _zcm_arena_t
+{
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t used;
+};
+
+static inline void zcm_arena_init(zcm_arena_t *a, void *buf, uint32_t size)
+{
+    a->buf = (uint8_t*) buf;
+    a->size = size;
+    a->used = 0;
+}
+
+static inline void zcm_arena_reset(zcm_arena_t *a)
+{
+    a->used = 0;
+}
+
+// Like zcm_malloc(), NULL for 0 bytes, and NULL when the arena is out of room
+static inline void *zcm_arena_alloc(zcm_arena_t *a, uint32_t sz)
+{
+    uint32_t rounded = ZCM_ARENA_ROUND(sz);
+    void *mem;
+    if (sz == 0 || rounded < sz || a->size - a->used < rounded) return NULL;
+    mem = a->buf + a->used;
+    a->used += rounded;
+    return mem;
+}
+
+/**
+ * The _encode_iov functions that zcm-gen --c-iov generates leave a primitive
+ * array in place, as one piece of its own, from this many bytes on. Below
+ * that, copying it beats the extra piece
+ */
+#ifndef ZCM_IOV_INPLACE_MIN
+#define ZCM_IOV_INPLACE_MIN 1024
+#endif
+
+/**
+ * The number of elements of a multidimensional array 'n' elements of which
+ * are 'dim' elements each, for the _view functions that zcm-gen --c-view
+ * generates. Past 'max' (the bytes left of a message) it stays at max + 1,
+ * which is already too many to fit, so that the product can't overflow
+ */
+static inline uint64_t __zcm_view_dim(uint64_t n, int64_t dim, uint32_t max)
+{
+    if (dim <= 0 || n == 0) return 0;
+    if ((uint64_t) dim > ((uint64_t) max + 1) / n) return (uint64_t) max + 1;
+    return n * (uint64_t) dim;
 }
 
 typedef struct ___zcm_hash_ptr __zcm_hash_ptr;
@@ -136,6 +207,117 @@ static inline uint32_t __int8_t_clone_array(const int8_t *p, int8_t *q, uint32_t
     return n;
 }
 
+/**
+ * BYTE ORDER
+ *
+ * Arrays of 2, 4 and 8 byte primitives are encoded by __ZCM_BE_COPY_<bits>()
+ * and __ZCM_LE_COPY_<bits>() when the byte order of the host is known at
+ * compile time: a memcpy in the byte order of the host, and a copy swapping
+ * the bytes of every element in the other one. The swapping copies use
+ * SSSE3/AVX2 (pshufb) or NEON (vrev) when compiled for them, and byte swaps
+ * of single elements otherwise. Encodings are the same either way
+ */
+#if defined(__GNUC__)
+#define __zcm_bswap16(v) __builtin_bswap16(v)
+#define __zcm_bswap32(v) __builtin_bswap32(v)
+#define __zcm_bswap64(v) __builtin_bswap64(v)
+#else
+static inline uint16_t __zcm_bswap16(uint16_t v) { return (uint16_t) ((v << 8) | (v >> 8)); }
+static inline uint32_t __zcm_bswap32(uint32_t v)
+{
+    return ((v & 0xff) << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) | (v >> 24);
+}
+static inline uint64_t __zcm_bswap64(uint64_t v)
+{
+    return ((uint64_t) __zcm_bswap32((uint32_t) v) << 32) | __zcm_bswap32((uint32_t) (v >> 32));
+}
+#endif
+
+// Copies 'n' elements of 'bits' bits from 'src' to 'dst', swapping the bytes
+// of each of them. The buffers must not overlap, and need not be aligned
+#define __ZCM_SWAP_COPY(bits)                                                              \
+static inline void __zcm_swap_copy_##bits(void *_dst, const void *_src, uint32_t n)        \
+{                                                                                          \
+    uint8_t *dst = (uint8_t*) _dst;                                                        \
+    const uint8_t *src = (const uint8_t*) _src;                                            \
+    uint32_t size = n * (bits / 8);                                                        \
+    uint32_t i = 0;                                                                        \
+    __ZCM_SWAP_COPY_AVX2(bits)                                                             \
+    __ZCM_SWAP_COPY_SSSE3(bits)                                                            \
+    __ZCM_SWAP_COPY_NEON(bits)                                                             \
+    for (; i < size; i += bits / 8) {                                                      \
+        uint##bits##_t v;                                                                  \
+        memcpy(&v, src + i, sizeof(v));                                                    \
+        v = __zcm_bswap##bits(v);                                                          \
+        memcpy(dst + i, &v, sizeof(v));                                                    \
+    }                                                                                      \
+}
+
+#if defined(__AVX2__)
+#define __ZCM_SWAP_COPY_AVX2(bits)                                                         \
+    {                                                                                      \
+        const __m256i s = _mm256_setr_epi8(__ZCM_SHUF##bits, __ZCM_SHUF##bits);            \
+        for (; i + 32 <= size; i += 32) {                                                  \
+            __m256i v = _mm256_loadu_si256((const __m256i*) (src + i));                    \
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_shuffle_epi8(v, s));          \
+        }                                                                                  \
+    }
+#else
+#define __ZCM_SWAP_COPY_AVX2(bits)
+#endif
+
+#if defined(__SSSE3__)
+#define __ZCM_SWAP_COPY_SSSE3(bits)                                                        \
+    {                                                                                      \
+        const __m128i s = _mm_setr_epi8(__ZCM_SHUF##bits);                                 \
+        for (; i + 16 <= size; i += 16) {                                                  \
+            __m128i v = _mm_loadu_si128((const __m128i*) (src + i));                       \
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_shuffle_epi8(v, s));                \
+        }                                                                                  \
+    }
+#else
+#define __ZCM_SWAP_COPY_SSSE3(bits)
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define __ZCM_SWAP_COPY_NEON(bits)                                                         \
+    for (; i + 16 <= size; i += 16)                                                        \
+        vst1q_u8(dst + i, vrev##bits##q_u8(vld1q_u8(src + i)));
+#else
+#define __ZCM_SWAP_COPY_NEON(bits)
+#endif
+
+#define __ZCM_SHUF16 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+#define __ZCM_SHUF32 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+#define __ZCM_SHUF64 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+
+__ZCM_SWAP_COPY(16)
+__ZCM_SWAP_COPY(32)
+__ZCM_SWAP_COPY(64)
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define __ZCM_BE_COPY_16(dst, src, n) __zcm_swap_copy_16(dst, src, n)
+#define __ZCM_BE_COPY_32(dst, src, n) __zcm_swap_copy_32(dst, src, n)
+#define __ZCM_BE_COPY_64(dst, src, n) __zcm_swap_copy_64(dst, src, n)
+#define __ZCM_LE_COPY_16(dst, src, n) memcpy(dst, src, (n) * 2)
+#define __ZCM_LE_COPY_32(dst, src, n) memcpy(dst, src, (n) * 4)
+#define __ZCM_LE_COPY_64(dst, src, n) memcpy(dst, src, (n) * 8)
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define __ZCM_BE_COPY_16(dst, src, n) memcpy(dst, src, (n) * 2)
+#define __ZCM_BE_COPY_32(dst, src, n) memcpy(dst, src, (n) * 4)
+#define __ZCM_BE_COPY_64(dst, src, n) memcpy(dst, src, (n) * 8)
+#define __ZCM_LE_COPY_16(dst, src, n) __zcm_swap_copy_16(dst, src, n)
+#define __ZCM_LE_COPY_32(dst, src, n) __zcm_swap_copy_32(dst, src, n)
+#define __ZCM_LE_COPY_64(dst, src, n) __zcm_swap_copy_64(dst, src, n)
+#endif
+
+// Whether a primitive array in memory is its own little endian encoding
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ZCM_HOST_LITTLE_ENDIAN 1
+#else
+#define ZCM_HOST_LITTLE_ENDIAN 0
+#endif
+
 /**
  * INT16_T
  */
@@ -152,17 +334,21 @@ static inline int __int16_t_encode_array(void *_buf, uint32_t offset, uint32_t m
 {
     uint32_t total_size = sizeof(int16_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_BE_COPY_16
+    __ZCM_BE_COPY_16(&buf[offset], p, elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     const uint16_t *unsigned_p = (uint16_t*)p;
     for (element = 0; element < elements; ++element) {
         uint16_t v = unsigned_p[element];
         buf[pos++] = (v>>8) & 0xff;
         buf[pos++] = (v & 0xff);
     }
+#endif
 
     return total_size;
 }
@@ -171,15 +357,19 @@ static inline int __int16_t_decode_array(const void *_buf, uint32_t offset, uint
 {
     uint32_t total_size = sizeof(int16_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_BE_COPY_16
+    __ZCM_BE_COPY_16(p, &buf[offset], elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     for (element = 0; element < elements; ++element) {
         p[element] = (buf[pos]<<8) + buf[pos+1];
         pos+=2;
     }
+#endif
 
     return total_size;
 }
@@ -188,17 +378,21 @@ static inline int __int16_t_encode_little_endian_array(void *_buf, uint32_t offs
 {
     uint32_t total_size = sizeof(int16_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_LE_COPY_16
+    __ZCM_LE_COPY_16(&buf[offset], p, elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     const uint16_t *unsigned_p = (uint16_t*)p;
     for (element = 0; element < elements; ++element) {
         uint16_t v = unsigned_p[element];
         buf[pos++] = (v & 0xff);
         buf[pos++] = (v>>8) & 0xff;
     }
+#endif
 
     return total_size;
 }
@@ -207,15 +401,19 @@ static inline int __int16_t_decode_little_endian_array(const void *_buf, uint32_
 {
     uint32_t total_size = sizeof(int16_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_LE_COPY_16
+    __ZCM_LE_COPY_16(p, &buf[offset], elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     for (element = 0; element < elements; ++element) {
         p[element] = (buf[pos+1]<<8) + buf[pos];
         pos+=2;
     }
+#endif
 
     return total_size;
 }
@@ -243,11 +441,14 @@ static inline int __int32_t_encode_array(void *_buf, uint32_t offset, uint32_t m
 {
     uint32_t total_size = sizeof(int32_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_BE_COPY_32
+    __ZCM_BE_COPY_32(&buf[offset], p, elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     const uint32_t* unsigned_p = (uint32_t*)p;
     for (element = 0; element < elements; ++element) {
         uint32_t v = unsigned_p[element];
@@ -256,6 +457,7 @@ static inline int __int32_t_encode_array(void *_buf, uint32_t offset, uint32_t m
         buf[pos++] = (v>>8)&0xff;
         buf[pos++] = (v & 0xff);
     }
+#endif
 
     return total_size;
 }
@@ -264,11 +466,14 @@ static inline int __int32_t_decode_array(const void *_buf, uint32_t offset, uint
 {
     uint32_t total_size = sizeof(int32_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_BE_COPY_32
+    __ZCM_BE_COPY_32(p, &buf[offset], elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     for (element = 0; element < elements; ++element) {
         p[element] = (((uint32_t)buf[pos+0])<<24) +
                      (((uint32_t)buf[pos+1])<<16) +
@@ -276,6 +481,7 @@ static inline int __int32_t_decode_array(const void *_buf, uint32_t offset, uint
                       ((uint32_t)buf[pos+3]);
         pos+=4;
     }
+#endif
 
     return total_size;
 }
@@ -284,11 +490,14 @@ static inline int __int32_t_encode_little_endian_array(void *_buf, uint32_t offs
 {
     uint32_t total_size = sizeof(int32_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_LE_COPY_32
+    __ZCM_LE_COPY_32(&buf[offset], p, elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     const uint32_t* unsigned_p = (uint32_t*)p;
     for (element = 0; element < elements; ++element) {
         uint32_t v = unsigned_p[element];
@@ -297,6 +506,7 @@ static inline int __int32_t_encode_little_endian_array(void *_buf, uint32_t offs
         buf[pos++] = (v>>16)&0xff;
         buf[pos++] = (v>>24)&0xff;
     }
+#endif
 
     return total_size;
 }
@@ -305,11 +515,14 @@ static inline int __int32_t_decode_little_endian_array(const void *_buf, uint32_
 {
     uint32_t total_size = sizeof(int32_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_LE_COPY_32
+    __ZCM_LE_COPY_32(p, &buf[offset], elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     for (element = 0; element < elements; ++element) {
         p[element] = (((uint32_t)buf[pos+3])<<24) +
                       (((uint32_t)buf[pos+2])<<16) +
@@ -317,6 +530,7 @@ static inline int __int32_t_decode_little_endian_array(const void *_buf, uint32_
                        ((uint32_t)buf[pos+0]);
         pos+=4;
     }
+#endif
 
     return total_size;
 }
@@ -344,11 +558,14 @@ static inline int __int64_t_encode_array(void *_buf, uint32_t offset, uint32_t m
 {
     uint32_t total_size = sizeof(int64_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_BE_COPY_64
+    __ZCM_BE_COPY_64(&buf[offset], p, elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     const uint64_t* unsigned_p = (uint64_t*)p;
     for (element = 0; element < elements; ++element) {
         uint64_t v = unsigned_p[element];
@@ -361,6 +578,7 @@ static inline int __int64_t_encode_array(void *_buf, uint32_t offset, uint32_t m
         buf[pos++] = (v>>8)&0xff;
         buf[pos++] = (v & 0xff);
     }
+#endif
 
     return total_size;
 }
@@ -369,11 +587,14 @@ static inline int __int64_t_decode_array(const void *_buf, uint32_t offset, uint
 {
     uint32_t total_size = sizeof(int64_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_BE_COPY_64
+    __ZCM_BE_COPY_64(p, &buf[offset], elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     for (element = 0; element < elements; ++element) {
         uint64_t a = (((uint32_t)buf[pos+0])<<24) +
                      (((uint32_t)buf[pos+1])<<16) +
@@ -387,6 +608,7 @@ static inline int __int64_t_decode_array(const void *_buf, uint32_t offset, uint
         pos+=4;
         p[element] = (a<<32) + (b&0xffffffff);
     }
+#endif
 
     return total_size;
 }
@@ -395,11 +617,14 @@ static inline int __int64_t_encode_little_endian_array(void *_buf, uint32_t offs
 {
     uint32_t total_size = sizeof(int64_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_LE_COPY_64
+    __ZCM_LE_COPY_64(&buf[offset], p, elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     const uint64_t* unsigned_p = (uint64_t*)p;
     for (element = 0; element < elements; ++element) {
         uint64_t v = unsigned_p[element];
@@ -412,6 +637,7 @@ static inline int __int64_t_encode_little_endian_array(void *_buf, uint32_t offs
         buf[pos++] = (v>>48)&0xff;
         buf[pos++] = (v>>56)&0xff;
     }
+#endif
 
     return total_size;
 }
@@ -420,11 +646,14 @@ static inline int __int64_t_decode_little_endian_array(const void *_buf, uint32_
 {
     uint32_t total_size = sizeof(int64_t) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_LE_COPY_64
+    __ZCM_LE_COPY_64(p, &buf[offset], elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
     for (element = 0; element < elements; ++element) {
         uint64_t b = (((uint32_t)buf[pos+3])<<24) +
                      (((uint32_t)buf[pos+2])<<16) +
@@ -438,6 +667,7 @@ static inline int __int64_t_decode_little_endian_array(const void *_buf, uint32_
         pos+=4;
         p[element] = (a<<32) + (b&0xffffffff);
     }
+#endif
 
     return total_size;
 }
@@ -470,12 +700,15 @@ static inline int __float_encode_array(void *_buf, uint32_t offset, uint32_t max
 {
     uint32_t total_size = sizeof(float) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
-    __zcm__float_uint32_t tmp;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_BE_COPY_32
+    __ZCM_BE_COPY_32(&buf[offset], p, elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
+    __zcm__float_uint32_t tmp;
     for (element = 0; element < elements; ++element) {
         tmp.flt = p[element];
         buf[pos++] = (tmp.uint >> 24) & 0xff;
@@ -483,6 +716,7 @@ static inline int __float_encode_array(void *_buf, uint32_t offset, uint32_t max
         buf[pos++] = (tmp.uint >>  8) & 0xff;
         buf[pos++] = (tmp.uint      ) & 0xff;
     }
+#endif
 
     return total_size;
 }
@@ -491,12 +725,15 @@ static inline int __float_decode_array(const void *_buf, uint32_t offset, uint32
 {
     uint32_t total_size = sizeof(float) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
-    __zcm__float_uint32_t tmp;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_BE_COPY_32
+    __ZCM_BE_COPY_32(p, &buf[offset], elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
+    __zcm__float_uint32_t tmp;
     for (element = 0; element < elements; ++element) {
         tmp.uint = (((uint32_t)buf[pos + 0]) << 24) |
                    (((uint32_t)buf[pos + 1]) << 16) |
@@ -505,6 +742,7 @@ static inline int __float_decode_array(const void *_buf, uint32_t offset, uint32
         p[element] = tmp.flt;
         pos += 4;
     }
+#endif
 
     return total_size;
 }
@@ -513,12 +751,15 @@ static inline int __float_encode_little_endian_array(void *_buf, uint32_t offset
 {
     uint32_t total_size = sizeof(float) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
-    __zcm__float_uint32_t tmp;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_LE_COPY_32
+    __ZCM_LE_COPY_32(&buf[offset], p, elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
+    __zcm__float_uint32_t tmp;
     for (element = 0; element < elements; ++element) {
         tmp.flt = p[element];
         buf[pos++] = (tmp.uint      ) & 0xff;
@@ -526,6 +767,7 @@ static inline int __float_encode_little_endian_array(void *_buf, uint32_t offset
         buf[pos++] = (tmp.uint >> 16) & 0xff;
         buf[pos++] = (tmp.uint >> 24) & 0xff;
     }
+#endif
 
     return total_size;
 }
@@ -534,12 +776,15 @@ static inline int __float_decode_little_endian_array(const void *_buf, uint32_t
 {
     uint32_t total_size = sizeof(float) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
-    __zcm__float_uint32_t tmp;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_LE_COPY_32
+    __ZCM_LE_COPY_32(p, &buf[offset], elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
+    __zcm__float_uint32_t tmp;
     for (element = 0; element < elements; ++element) {
         tmp.uint = (((uint32_t)buf[pos + 3]) << 24) |
                    (((uint32_t)buf[pos + 2]) << 16) |
@@ -548,6 +793,7 @@ static inline int __float_decode_little_endian_array(const void *_buf, uint32_t
         p[element] = tmp.flt;
         pos += 4;
     }
+#endif
 
     return total_size;
 }
@@ -580,12 +826,15 @@ static inline int __double_encode_array(void *_buf, uint32_t offset, uint32_t ma
 {
     uint32_t total_size = sizeof(double) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
-    __zcm__double_uint64_t tmp;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_BE_COPY_64
+    __ZCM_BE_COPY_64(&buf[offset], p, elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
+    __zcm__double_uint64_t tmp;
     for (element = 0; element < elements; ++element) {
         tmp.dbl = p[element];
         buf[pos++] = (tmp.uint >> 56) & 0xff;
@@ -597,6 +846,7 @@ static inline int __double_encode_array(void *_buf, uint32_t offset, uint32_t ma
         buf[pos++] = (tmp.uint >>  8) & 0xff;
         buf[pos++] = (tmp.uint      ) & 0xff;
     }
+#endif
 
     return total_size;
 }
@@ -605,12 +855,15 @@ static inline int __double_decode_array(const void *_buf, uint32_t offset, uint3
 {
     uint32_t total_size = sizeof(double) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
-    __zcm__double_uint64_t tmp;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_BE_COPY_64
+    __ZCM_BE_COPY_64(p, &buf[offset], elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
+    __zcm__double_uint64_t tmp;
     for (element = 0; element < elements; ++element) {
         uint64_t a = (((uint32_t) buf[pos + 0]) << 24) +
                      (((uint32_t) buf[pos + 1]) << 16) +
@@ -625,6 +878,7 @@ static inline int __double_decode_array(const void *_buf, uint32_t offset, uint3
         tmp.uint = (a << 32) + (b & 0xffffffff);
         p[element] = tmp.dbl;
     }
+#endif
 
     return total_size;
 }
@@ -633,12 +887,15 @@ static inline int __double_encode_little_endian_array(void *_buf, uint32_t offse
 {
     uint32_t total_size = sizeof(double) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
-    __zcm__double_uint64_t tmp;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_LE_COPY_64
+    __ZCM_LE_COPY_64(&buf[offset], p, elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
+    __zcm__double_uint64_t tmp;
     for (element = 0; element < elements; ++element) {
         tmp.dbl = p[element];
         buf[pos++] = (tmp.uint      ) & 0xff;
@@ -650,6 +907,7 @@ static inline int __double_encode_little_endian_array(void *_buf, uint32_t offse
         buf[pos++] = (tmp.uint >> 48) & 0xff;
         buf[pos++] = (tmp.uint >> 56) & 0xff;
     }
+#endif
 
     return total_size;
 }
@@ -658,12 +916,15 @@ static inline int __double_decode_little_endian_array(const void *_buf, uint32_t
 {
     uint32_t total_size = sizeof(double) * elements;
     uint8_t *buf = (uint8_t*) _buf;
-    uint32_t pos = offset;
-    uint32_t element;
-    __zcm__double_uint64_t tmp;
 
     if (maxlen < total_size) return -1;
 
+#ifdef __ZCM_LE_COPY_64
+    __ZCM_LE_COPY_64(p, &buf[offset], elements);
+#else
+    uint32_t pos = offset;
+    uint32_t element;
+    __zcm__double_uint64_t tmp;
     for (element = 0; element < elements; ++element) {
         uint64_t b = (((uint32_t)buf[pos + 3]) << 24) +
                      (((uint32_t)buf[pos + 2]) << 16) +
@@ -678,6 +939,7 @@ static inline int __double_decode_little_endian_array(const void *_buf, uint32_t
         tmp.uint = (a << 32) + (b & 0xffffffff);
         p[element] = tmp.dbl;
     }
+#endif
 
     return total_size;
 }
@@ -698,7 +960,7 @@ static inline int __string_decode_array_cleanup(char **s, uint32_t elements)
 {
     uint32_t element;
     for (element = 0; element < elements; ++element)
-        free(s[element]);
+        zcm_free(s[element]);
     return 0;
 }
 
@@ -770,6 +1032,28 @@ static inline int __string_encode_little_endian_array(void *_buf, uint32_t offse
     return pos;
 }
 
+// Encodes the 'len' chars of 's' and the \0 after them as one string, for callers
+// that already know the length (as std::string does), saving the strlen()
+static inline int __string_encode_sized(void *_buf, uint32_t offset, uint32_t maxlen, const char *s, uint32_t len)
+{
+    int32_t length = len + 1; // length includes \0
+    int thislen = __int32_t_encode_array(_buf, offset, maxlen, &length, 1);
+    if (thislen < 0) return thislen;
+    if (maxlen - thislen < (uint32_t) length) return -1;
+    memcpy((uint8_t*) _buf + offset + thislen, s, length);
+    return thislen + length;
+}
+
+static inline int __string_encode_little_endian_sized(void *_buf, uint32_t offset, uint32_t maxlen, const char *s, uint32_t len)
+{
+    int32_t length = len + 1; // length includes \0
+    int thislen = __int32_t_encode_little_endian_array(_buf, offset, maxlen, &length, 1);
+    if (thislen < 0) return thislen;
+    if (maxlen - thislen < (uint32_t) length) return -1;
+    memcpy((uint8_t*) _buf + offset + thislen, s, length);
+    return thislen + length;
+}
+
 static inline int __string_decode_little_endian_array(const void *_buf, uint32_t offset, uint32_t maxlen, char **p, uint32_t elements)
 {
     uint32_t pos = 0, element;
@@ -790,6 +1074,131 @@ static inline int __string_decode_little_endian_array(const void *_buf, uint32_t
     return pos;
 }
 
+static inline int __string_decode_arena_array(const void *_buf, uint32_t offset, uint32_t maxlen, char **p, uint32_t elements, zcm_arena_t *arena)
+{
+    uint32_t pos = 0, element;
+    int thislen;
+
+    for (element = 0; element < elements; ++element) {
+        int32_t length;
+
+        // read length including \0
+        thislen = __int32_t_decode_array(_buf, offset + pos, maxlen - pos, &length, 1);
+        if (thislen < 0) return thislen; else pos += thislen;
+
+        p[element] = (char*) zcm_arena_alloc(arena, length);
+        if (!p[element] && length) return -1;
+        thislen = __int8_t_decode_array(_buf, offset + pos, maxlen - pos, (int8_t*) p[element], length);
+        if (thislen < 0) return thislen; else pos += thislen;
+    }
+
+    return pos;
+}
+
+static inline int __string_decode_little_endian_arena_array(const void *_buf, uint32_t offset, uint32_t maxlen, char **p, uint32_t elements, zcm_arena_t *arena)
+{
+    uint32_t pos = 0, element;
+    int thislen;
+
+    for (element = 0; element < elements; ++element) {
+        int32_t length;
+
+        // read length including \0
+        thislen = __int32_t_decode_little_endian_array(_buf, offset + pos, maxlen - pos, &length, 1);
+        if (thislen < 0) return thislen; else pos += thislen;
+
+        p[element] = (char*) zcm_arena_alloc(arena, length);
+        if (!p[element] && length) return -1;
+        thislen = __int8_t_decode_little_endian_array(_buf, offset + pos, maxlen - pos, (int8_t*) p[element], length);
+        if (thislen < 0) return thislen; else pos += thislen;
+    }
+
+    return pos;
+}
+
+// Adds to 'need' what __string_decode_arena_array() would take from the arena,
+// returning the number of bytes it would decode
+static inline int __string_decode_arena_array_size(const void *_buf, uint32_t offset, uint32_t maxlen, uint32_t elements, uint32_t *need)
+{
+    uint32_t pos = 0, element;
+    int thislen;
+
+    for (element = 0; element < elements; ++element) {
+        int32_t length;
+
+        thislen = __int32_t_decode_array(_buf, offset + pos, maxlen - pos, &length, 1);
+        if (thislen < 0) return thislen; else pos += thislen;
+
+        if (length < 0 || maxlen - pos < (uint32_t) length) return -1;
+        pos += length;
+        *need += ZCM_ARENA_ROUND((uint32_t) length);
+    }
+
+    return pos;
+}
+
+static inline int __string_decode_little_endian_arena_array_size(const void *_buf, uint32_t offset, uint32_t maxlen, uint32_t elements, uint32_t *need)
+{
+    uint32_t pos = 0, element;
+    int thislen;
+
+    for (element = 0; element < elements; ++element) {
+        int32_t length;
+
+        thislen = __int32_t_decode_little_endian_array(_buf, offset + pos, maxlen - pos, &length, 1);
+        if (thislen < 0) return thislen; else pos += thislen;
+
+        if (length < 0 || maxlen - pos < (uint32_t) length) return -1;
+        pos += length;
+        *need += ZCM_ARENA_ROUND((uint32_t) length);
+    }
+
+    return pos;
+}
+
+// The size of the 'elements' strings encoded at 'offset', for the _view
+// functions of zcm-gen --c-view, or -1 if they don't fit in 'maxlen' or one
+// of them isn't NULL terminated
+static inline int __string_view_skip_array(const void *_buf, uint32_t offset, uint32_t maxlen, uint32_t elements)
+{
+    const uint8_t *buf = (const uint8_t*) _buf;
+    uint32_t pos = 0, element;
+    int thislen;
+
+    for (element = 0; element < elements; ++element) {
+        int32_t length;
+
+        thislen = __int32_t_decode_array(_buf, offset + pos, maxlen - pos, &length, 1);
+        if (thislen < 0) return thislen; else pos += thislen;
+
+        if (length < 1 || maxlen - pos < (uint32_t) length) return -1;
+        if (buf[offset + pos + length - 1] != '\0') return -1;
+        pos += length;
+    }
+
+    return pos;
+}
+
+static inline int __string_view_skip_little_endian_array(const void *_buf, uint32_t offset, uint32_t maxlen, uint32_t elements)
+{
+    const uint8_t *buf = (const uint8_t*) _buf;
+    uint32_t pos = 0, element;
+    int thislen;
+
+    for (element = 0; element < elements; ++element) {
+        int32_t length;
+
+        thislen = __int32_t_decode_little_endian_array(_buf, offset + pos, maxlen - pos, &length, 1);
+        if (thislen < 0) return thislen; else pos += thislen;
+
+        if (length < 1 || maxlen - pos < (uint32_t) length) return -1;
+        if (buf[offset + pos + length - 1] != '\0') return -1;
+        pos += length;
+    }
+
+    return pos;
+}
+
 // TODO: Figure out why "const char * const * p" doesn't work
 static inline uint32_t __string_clone_array(char * const *p, char **q, uint32_t elements)
 {
@@ -893,6 +1302,18 @@ struct _zcm_type_info_t
 
 };
 
+/**
+ * Entry of the registry emitted by zcm-gen --c-registry: an array named
+ * zcm_type_registry, ended by an entry with a NULL name, through which tools
+ * find the types of a library without reading its symbol table
+ */
+typedef struct _zcm_type_registry_entry_t zcm_type_registry_entry_t;
+struct _zcm_type_registry_entry_t
+{
+    const char*              name; /* the prefix of the type's functions */
+    const zcm_type_info_t* (*get_type_info)(void);
+};
+
 #ifdef __cplusplus
 }
 #endif
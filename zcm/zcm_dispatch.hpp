@@ -0,0 +1,102 @@
+#ifndef _ZCM_DISPATCH_HPP
+#define _ZCM_DISPATCH_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "zcm/zcm_coretypes.h"
+
+//
+// Routing of the messages of channels (or logs) carrying several types: a
+// table of their fingerprints, sorted once, finds the type of a message with
+// one binary search instead of comparing its hash against every getHash() in
+// turn. ZCM::subscribeMulti() dispatches with it; tools that only have the
+// encoded bytes (e.g. plugins) can use MsgSwitch directly:
+//
+//     typedef zcm::MsgSwitch< a_t, b_t, c_t > Switch;
+//     switch (Switch::indexOf(evt->data, evt->datalen)) {
+//         case 0: ...a_t...; break;
+//         case 1: ...b_t...; break;
+//     }
+//
+// zcm-gen --cpp-package-types emits <package>/package.hpp, with the list of
+// every type of the package as <package>::Types, for MsgSwitch<> and
+// subscribeMulti<>() alike.
+//
+// Requires c++11
+//
+
+namespace zcm {
+
+// A list of generated types, unpacked by MsgSwitch< MsgTypes<...> >
+template <class... Msgs> struct MsgTypes {};
+
+template <class... Msgs>
+class MsgSwitch
+{
+  public:
+    static const int size = (int) sizeof...(Msgs);
+
+    // The index in Msgs of the type 'hash' is the fingerprint of, -1 if none
+    static inline int indexOf(int64_t hash)
+    {
+        const Table& t = table();
+        int lo = 0, hi = size;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (t.hashes[mid] < hash) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo < size && t.hashes[lo] == hash ? t.indexes[lo] : -1;
+    }
+
+    // The index in Msgs of the type of the encoded message 'data', -1 if it's
+    // of none of them or too short to have a fingerprint. Types generated with
+    // --little-endian-encoding have theirs the other way around: those are
+    // looked for second
+    static inline int indexOf(const uint8_t* data, size_t len)
+    {
+        int64_t hash;
+        if (__int64_t_decode_array(data, 0, (uint32_t) len, &hash, 1) < 0) return -1;
+        int i = indexOf(hash);
+        if (i >= 0) return i;
+        __int64_t_decode_little_endian_array(data, 0, (uint32_t) len, &hash, 1);
+        return indexOf(hash);
+    }
+
+  private:
+    struct Table
+    {
+        int64_t hashes[sizeof...(Msgs) > 0 ? sizeof...(Msgs) : 1];
+        int indexes[sizeof...(Msgs) > 0 ? sizeof...(Msgs) : 1];
+
+        Table()
+        {
+            const int64_t h[] = { Msgs::getHash()..., 0 };
+            // Type lists are short: an insertion sort does
+            for (int i = 0; i < size; ++i) {
+                int j = i;
+                for (; j > 0 && hashes[j - 1] > h[i]; --j) {
+                    hashes[j] = hashes[j - 1];
+                    indexes[j] = indexes[j - 1];
+                }
+                hashes[j] = h[i];
+                indexes[j] = i;
+            }
+        }
+    };
+
+    // Built on first use: getHash() isn't a constant expression for every type
+    static inline const Table& table()
+    {
+        static const Table t;
+        return t;
+    }
+};
+
+template <class... Msgs>
+class MsgSwitch< MsgTypes<Msgs...> > : public MsgSwitch<Msgs...> {};
+
+}
+
+#endif /* _ZCM_DISPATCH_HPP */
@@ -0,0 +1,78 @@
+#ifndef _ZCM_INLINE_VECTOR_HPP
+#define _ZCM_INLINE_VECTOR_HPP
+
+#include <stddef.h>
+#include <assert.h>
+
+//
+// The storage zcm-gen --cpp-inline-max=N gives to the variable arrays bounded
+// by at most N in the .zcm file, instead of a std::vector: the elements live
+// inside the message, so decoding one allocates nothing and moving one is a
+// copy of the message itself, with no pointers to chase. Only the parts of
+// std::vector that make sense without reallocation are here. All N elements
+// always exist: resize() only changes how many of them count, and a decode()
+// finding more than N elements fails.
+//
+
+namespace zcm {
+
+template <typename T, size_t N>
+class InlineVector
+{
+    T      elems[N];
+    size_t n;
+
+  public:
+    typedef T        value_type;
+    typedef size_t   size_type;
+    typedef T*       iterator;
+    typedef const T* const_iterator;
+
+    InlineVector() : n(0) {}
+
+    size_t size() const { return n; }
+    bool   empty() const { return n == 0; }
+    static size_t capacity() { return N; }
+    static size_t max_size() { return N; }
+    // Nothing to reserve, the room for N elements is always there
+    void reserve(size_t) {}
+
+    // Requires that newSize <= N
+    void resize(size_t newSize, const T& v = T())
+    {
+        assert(newSize <= N);
+        for (size_t i = n; i < newSize; ++i) elems[i] = v;
+        n = newSize;
+    }
+    void clear() { n = 0; }
+
+    // Whether the array size 'size', as decoded, is one this can resize() to
+    template <typename S>
+    static bool fits(S size) { return !(size < 0) && (unsigned long long) size <= N; }
+
+    // Requires that size() < N
+    void push_back(const T& v)
+    {
+        assert(n < N);
+        elems[n++] = v;
+    }
+    void pop_back() { assert(n > 0); --n; }
+
+    T&       operator[](size_t i)       { return elems[i]; }
+    const T& operator[](size_t i) const { return elems[i]; }
+    T&       front()       { return elems[0]; }
+    const T& front() const { return elems[0]; }
+    T&       back()       { return elems[n - 1]; }
+    const T& back() const { return elems[n - 1]; }
+    T*       data()       { return elems; }
+    const T* data() const { return elems; }
+
+    iterator       begin()       { return elems; }
+    const_iterator begin() const { return elems; }
+    iterator       end()       { return elems + n; }
+    const_iterator end() const { return elems + n; }
+};
+
+}
+
+#endif /* _ZCM_INLINE_VECTOR_HPP */
@@ -18,6 +18,21 @@ struct zcm_sub_t
     void *usr;
 };
 
+/* The envelope of traced messages (see zcm_set_trace_publish()): a magic number,
+   the send time and the trace id, big endian, ahead of the message */
+void zcm_trace_encode(uint8_t* hdr, int64_t send_ns, uint64_t trace_id);
+/* Returns 1 and fills 'send_ns' and 'trace_id' if the message starts with an
+   envelope, otherwise returns 0 and sets them to 0 */
+int  zcm_trace_decode(const uint8_t* data, uint32_t len, int64_t* send_ns, uint64_t* trace_id);
+
+/* The envelope of compressed messages (see zcm_set_compression()): a magic number,
+   the enum zcm_codec and the size of the message uncompressed, big endian, ahead
+   of the compressed bytes */
+void zcm_codec_encode(uint8_t* hdr, uint8_t codec, uint32_t raw_len);
+/* Returns the codec and fills 'raw_len' if the message starts with an envelope,
+   otherwise returns ZCM_CODEC_NONE and sets it to 0 */
+int  zcm_codec_decode(const uint8_t* data, uint32_t len, uint32_t* raw_len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,87 @@
+#ifndef _ZCM_STREAM_HPP
+#define _ZCM_STREAM_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <memory>
+
+#include "zcm/zcm_view.hpp"
+
+//
+// Support for the T::Decoder classes zcm-gen emits next to every C++ type:
+// decoders fed an encoded message a piece at a time, as it arrives, resuming
+// where the previous piece left off. Arrays of primitives are copied straight
+// from the pieces into the message, so the whole encoding never has to be in
+// memory at once.
+//
+// Everything here is templated on LE: whether the type was generated with
+// --little-endian-encoding
+//
+
+namespace zcm {
+
+// The piece of an encoding being fed to a decoder. 'left' is how many bytes
+// the whole message may still take, this piece included
+struct StreamCursor
+{
+    const uint8_t* p;
+    uint32_t len;
+    uint32_t left;
+};
+
+// Decodes 'count' primitives into 'dst', as much of them as the cursor holds:
+// 'n' counts the bytes done over calls, and is back to 0 once all of them
+// are, when this returns true. 'dst' must not move in between
+template <typename T, bool LE>
+inline bool streamArray(StreamCursor& c, T* dst, uint32_t count, uint32_t& n)
+{
+    uint64_t total = (uint64_t) count * sizeof(T);
+    uint32_t take = total - n < c.len ? (uint32_t) (total - n) : c.len;
+    if (take > 0) {
+        memcpy((uint8_t*) dst + n, c.p, take);
+        if (sizeof(T) > 1 && LE != VIEW_HOST_LE) {
+            // The elements completed by this piece
+            for (uint32_t i = n / sizeof(T); i < (n + take) / sizeof(T); ++i)
+                ViewSwap<sizeof(T)>::swap((uint8_t*) &dst[i]);
+        }
+        c.p += take;
+        c.len -= take;
+        c.left -= take;
+        n += take;
+    }
+    if (n < total) return false;
+    n = 0;
+    return true;
+}
+
+// Decodes a string whose length (with its \0) was decoded into 'len', into
+// 's' resized for it, like streamArray()
+inline bool streamChars(StreamCursor& c, std::string& s, int32_t len, uint32_t& n)
+{
+    // The chars first, then the \0, which only needs skipping
+    if (n < (uint32_t) len - 1) {
+        uint32_t take = (uint32_t) len - 1 - n < c.len ? (uint32_t) len - 1 - n : c.len;
+        memcpy(&s[n], c.p, take);
+        c.p += take;
+        c.len -= take;
+        c.left -= take;
+        n += take;
+    }
+    if (n < (uint32_t) len - 1 || c.len == 0) return false;
+    ++c.p;
+    --c.len;
+    --c.left;
+    n = 0;
+    return true;
+}
+
+// Whether a string length decoded with 'c' is one the rest of the message holds
+inline bool streamStringLen(const StreamCursor& c, int32_t len)
+{
+    return len >= 1 && (uint32_t) len <= c.left;
+}
+
+}
+
+#endif /* _ZCM_STREAM_HPP */
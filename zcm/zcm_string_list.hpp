@@ -0,0 +1,64 @@
+#ifndef _ZCM_STRING_LIST_HPP
+#define _ZCM_STRING_LIST_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//
+// The storage zcm-gen --cpp-string-lists gives to variable arrays of strings,
+// instead of a std::vector<std::string>: all of the strings in one buffer, each
+// followed by its \0, plus where each one starts. Decoding a list is then two
+// allocations at most, whatever the number of strings, and none once a message
+// decoded into again has grown enough. The strings are read only in place:
+// build a list with push_back()
+//
+
+namespace zcm {
+
+class StringList
+{
+    std::string           chars;
+    std::vector<uint32_t> starts;
+
+  public:
+    size_t size() const { return starts.size(); }
+    bool   empty() const { return starts.empty(); }
+
+    // The i'th string, valid until the list is next changed
+    const char* operator[](size_t i) const { return chars.data() + starts[i]; }
+    // Its length, without the \0
+    size_t length(size_t i) const
+    {
+        size_t end = i + 1 < starts.size() ? starts[i + 1] : chars.size();
+        return end - starts[i] - 1;
+    }
+    std::string str(size_t i) const { return std::string((*this)[i], length(i)); }
+
+    void push_back(const char* s, size_t len)
+    {
+        starts.push_back((uint32_t) chars.size());
+        chars.append(s, len);
+        chars.push_back('\0');
+    }
+    void push_back(const std::string& s) { push_back(s.data(), s.size()); }
+
+    // Keeps the memory, for the next strings
+    void clear()
+    {
+        chars.clear();
+        starts.clear();
+    }
+    void reserve(size_t nstrings, size_t nchars)
+    {
+        starts.reserve(nstrings);
+        chars.reserve(nchars + nstrings);
+    }
+
+    // The bytes encoding all of the strings takes
+    uint32_t encodedSize() const { return (uint32_t) (chars.size() + 4 * starts.size()); }
+};
+
+}
+
+#endif /* _ZCM_STRING_LIST_HPP */
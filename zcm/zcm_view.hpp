@@ -0,0 +1,170 @@
+#ifndef _ZCM_VIEW_HPP
+#define _ZCM_VIEW_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "zcm/zcm_coretypes.h"
+
+//
+// Support for the T::View classes zcm-gen emits next to every C++ type: read
+// only views of an encoded message, reading its fields straight out of the
+// encoded bytes, only when asked for. Their decode() walks the encoding once,
+// checking it and recording where the fields are, without copying anything,
+// so that the accessors don't have to check anything but array indexes.
+// A view is only valid as long as the bytes it was decoded from are.
+//
+// Everything here is templated on LE: whether the type was generated with
+// --little-endian-encoding
+//
+
+namespace zcm {
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static const bool VIEW_HOST_LE = false;
+#else
+static const bool VIEW_HOST_LE = true;
+#endif
+
+template <size_t N> struct ViewSwap;
+template <> struct ViewSwap<1> { static inline void swap(uint8_t*) {} };
+template <> struct ViewSwap<2> {
+    static inline void swap(uint8_t* p)
+    { uint16_t v; memcpy(&v, p, 2); v = __zcm_bswap16(v); memcpy(p, &v, 2); }
+};
+template <> struct ViewSwap<4> {
+    static inline void swap(uint8_t* p)
+    { uint32_t v; memcpy(&v, p, 4); v = __zcm_bswap32(v); memcpy(p, &v, 4); }
+};
+template <> struct ViewSwap<8> {
+    static inline void swap(uint8_t* p)
+    { uint64_t v; memcpy(&v, p, 8); v = __zcm_bswap64(v); memcpy(p, &v, 8); }
+};
+
+// The primitive encoded at 'p', which need not be aligned
+template <typename T, bool LE>
+inline T viewRead(const uint8_t* p)
+{
+    T v;
+    memcpy(&v, p, sizeof(T));
+    if (LE != VIEW_HOST_LE) ViewSwap<sizeof(T)>::swap((uint8_t*) &v);
+    return v;
+}
+
+// 'n' times the array dimension 'dim', negative dimensions counting as 0 as
+// they do in decode(), or 'max' + 1 if that is more than 'max'
+inline uint64_t viewDim(uint64_t n, int64_t dim, uint32_t max)
+{
+    if (dim <= 0 || n == 0) return 0;
+    if ((uint64_t) dim > ((uint64_t) max + 1) / n) return (uint64_t) max + 1;
+    return n * (uint64_t) dim;
+}
+
+// Size of the string encoded at 'p' (length, characters and NULL), or -1 if
+// it doesn't fit in 'maxlen' or isn't NULL terminated
+template <bool LE>
+inline int viewStringSize(const uint8_t* p, uint32_t maxlen)
+{
+    if (maxlen < 4) return -1;
+    int32_t len = viewRead<int32_t, LE>(p);
+    if (len < 1 || (uint32_t) len > maxlen - 4 || p[4 + len - 1] != '\0') return -1;
+    return 4 + len;
+}
+
+// Arrays of primitives, multidimensional ones flattened in row major order
+template <typename T, bool LE>
+class ArrayView
+{
+  public:
+    ArrayView() : p(NULL), n(0) {}
+    ArrayView(const uint8_t* _p, uint32_t _n) : p(_p), n(_n) {}
+
+    uint32_t size() const { return n; }
+    bool empty() const { return n == 0; }
+
+    // 'i' must be less than size()
+    T operator[](uint32_t i) const { return viewRead<T, LE>(p + i * sizeof(T)); }
+
+    // Decodes all the elements into 'out', which must have room for size()
+    void copyTo(T* out) const
+    {
+        memcpy(out, p, n * sizeof(T));
+        if (LE != VIEW_HOST_LE)
+            for (uint32_t i = 0; i < n; ++i) ViewSwap<sizeof(T)>::swap((uint8_t*) (out + i));
+    }
+
+    // The encoded elements
+    const uint8_t* data() const { return p; }
+
+  private:
+    const uint8_t* p;
+    uint32_t n;
+};
+
+// How SeqView reads strings
+template <bool LE>
+struct StringViewElem
+{
+    typedef const char* value_type;
+    static inline int _skip(const uint8_t* p, uint32_t maxlen)
+    { return viewStringSize<LE>(p, maxlen); }
+    static inline value_type _at(const uint8_t* p, uint32_t)
+    { return (const char*) p + 4; }
+};
+
+// Arrays of strings or of other types, multidimensional ones flattened in row
+// major order. Elements aren't all the same size, so they're read in order:
+// 'Elem' is StringViewElem, or the View of the type of the elements
+template <typename Elem>
+class SeqView
+{
+  public:
+    typedef typename Elem::value_type value_type;
+
+    class const_iterator
+    {
+      public:
+        const_iterator() : p(NULL), len(0), left(0) {}
+        const_iterator(const uint8_t* _p, uint32_t _len, uint64_t _left) :
+            p(_p), len(_len), left(_left) {}
+
+        value_type operator*() const { return Elem::_at(p, len); }
+
+        const_iterator& operator++()
+        {
+            uint32_t size = (uint32_t) Elem::_skip(p, len);
+            p += size;
+            len -= size;
+            --left;
+            return *this;
+        }
+
+        const_iterator operator++(int) { const_iterator it = *this; ++*this; return it; }
+
+        bool operator==(const const_iterator& o) const { return left == o.left; }
+        bool operator!=(const const_iterator& o) const { return left != o.left; }
+
+      private:
+        const uint8_t* p;
+        uint32_t len;
+        uint64_t left;
+    };
+
+    SeqView() : p(NULL), len(0), n(0) {}
+    SeqView(const uint8_t* _p, uint32_t _len, uint64_t _n) : p(_p), len(_len), n(_n) {}
+
+    uint64_t size() const { return n; }
+    bool empty() const { return n == 0; }
+
+    const_iterator begin() const { return const_iterator(p, len, n); }
+    const_iterator end() const { return const_iterator(p, len, 0); }
+
+  private:
+    const uint8_t* p;
+    uint32_t len;
+    uint64_t n;
+};
+
+}
+
+#endif /* _ZCM_VIEW_HPP */